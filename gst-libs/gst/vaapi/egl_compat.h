@@ -36,4 +36,14 @@ typedef void (*PFNGLEGLIMAGETARGETRENDERBUFFERSTORAGEOESPROC)(GLenum target,
     GLeglImageOES image);
 #endif /* GL_OES_EGL_image */
 
+#ifndef EGL_EXT_platform_base
+#define EGL_EXT_platform_base 1
+typedef EGLDisplay (*PFNEGLGETPLATFORMDISPLAYEXTPROC)(EGLenum platform,
+    void *native_display, const EGLint *attrib_list);
+#endif /* EGL_EXT_platform_base */
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif /* EGL_PLATFORM_SURFACELESS_MESA */
+
 #endif /* EGL_COMPAT_H */
@@ -150,8 +150,33 @@ EGL_PROTO_ARG(modifiers, EGLuint64KHR *))
 EGL_PROTO_INVOKE(ExportDMABUFImageQueryMESA, EGLBoolean, (dpy, image, fourcc, num_planes, modifiers))
 EGL_PROTO_END()
 
+EGL_PROTO_BEGIN(CreateSyncKHR, EGLSyncKHR, KHR_fence_sync)
+EGL_PROTO_ARG_LIST(
+EGL_PROTO_ARG(dpy, EGLDisplay),
+EGL_PROTO_ARG(type, EGLenum),
+EGL_PROTO_ARG(attrib_list, const EGLint *))
+EGL_PROTO_INVOKE(CreateSyncKHR, EGLSyncKHR, (dpy, type, attrib_list))
+EGL_PROTO_END()
+
+EGL_PROTO_BEGIN(DestroySyncKHR, EGLBoolean, KHR_fence_sync)
+EGL_PROTO_ARG_LIST(
+EGL_PROTO_ARG(dpy, EGLDisplay),
+EGL_PROTO_ARG(sync, EGLSyncKHR))
+EGL_PROTO_INVOKE(DestroySyncKHR, EGLBoolean, (dpy, sync))
+EGL_PROTO_END()
+
+EGL_PROTO_BEGIN(ClientWaitSyncKHR, EGLint, KHR_fence_sync)
+EGL_PROTO_ARG_LIST(
+EGL_PROTO_ARG(dpy, EGLDisplay),
+EGL_PROTO_ARG(sync, EGLSyncKHR),
+EGL_PROTO_ARG(flags, EGLint),
+EGL_PROTO_ARG(timeout, EGLTimeKHR))
+EGL_PROTO_INVOKE(ClientWaitSyncKHR, EGLint, (dpy, sync, flags, timeout))
+EGL_PROTO_END()
+
 EGL_DEFINE_EXTENSION(EXT_image_dma_buf_import)
 EGL_DEFINE_EXTENSION(KHR_create_context)
+EGL_DEFINE_EXTENSION(KHR_fence_sync)
 EGL_DEFINE_EXTENSION(KHR_gl_texture_2D_image)
 EGL_DEFINE_EXTENSION(KHR_image_base)
 EGL_DEFINE_EXTENSION(KHR_surfaceless_context)
@@ -28,6 +28,20 @@
 #include "gstvaapidisplay_priv.h"
 #include "gstvaapisurface_priv.h"
 
+/* The pipeline parameters of a layer, kept across frames */
+typedef struct _GstVaapiBlendLayer GstVaapiBlendLayer;
+struct _GstVaapiBlendLayer
+{
+  VABufferID buffer;
+  /* the contents of buffer */
+  VAProcPipelineParameterBuffer param;
+  VARectangle src_rect;
+  VARectangle dst_rect;
+#if VA_CHECK_VERSION(1,1,0)
+  VABlendState blend_state;
+#endif
+};
+
 struct _GstVaapiBlend
 {
   GstObject parent_instance;
@@ -36,8 +50,14 @@ struct _GstVaapiBlend
 
   VAConfigID va_config;
   VAContextID va_context;
+  GRecMutex lock;
 
   guint32 flags;
+
+  /* GstVaapiBlendLayer, one per surface of the largest composition */
+  GArray *layers;
+  GPtrArray *surfaces;
+  guint buffer_reuse:1;
 };
 
 typedef struct _GstVaapiBlendClass GstVaapiBlendClass;
@@ -104,12 +124,18 @@ static void
 gst_vaapi_blend_finalize (GObject * object)
 {
   GstVaapiBlend *const blend = GST_VAAPI_BLEND (object);
+  guint i;
 
   if (!blend->display)
     goto bail;
 
   GST_VAAPI_DISPLAY_LOCK (blend->display);
 
+  for (i = 0; i < blend->layers->len; i++) {
+    vaapi_destroy_buffer (GST_VAAPI_DISPLAY_VADISPLAY (blend->display),
+        &g_array_index (blend->layers, GstVaapiBlendLayer, i).buffer);
+  }
+
   if (blend->va_context != VA_INVALID_ID) {
     vaDestroyContext (GST_VAAPI_DISPLAY_VADISPLAY (blend->display),
         blend->va_context);
@@ -127,6 +153,9 @@ gst_vaapi_blend_finalize (GObject * object)
   gst_vaapi_display_replace (&blend->display, NULL);
 
 bail:
+  g_array_unref (blend->layers);
+  g_ptr_array_unref (blend->surfaces);
+  g_rec_mutex_clear (&blend->lock);
   G_OBJECT_CLASS (gst_vaapi_blend_parent_class)->finalize (object);
 }
 
@@ -151,7 +180,12 @@ gst_vaapi_blend_init (GstVaapiBlend * blend)
   blend->display = NULL;
   blend->va_config = VA_INVALID_ID;
   blend->va_context = VA_INVALID_ID;
+  g_rec_mutex_init (&blend->lock);
   blend->flags = 0;
+  blend->layers = g_array_new (FALSE, FALSE, sizeof (GstVaapiBlendLayer));
+  blend->surfaces = g_ptr_array_new ();
+  /* Same switch as the one of GstVaapiFilter */
+  blend->buffer_reuse = !g_getenv ("GST_VAAPI_DISABLE_VPP_BUFFER_REUSE");
 }
 
 static gboolean
@@ -214,6 +248,73 @@ gst_vaapi_blend_replace (GstVaapiBlend ** old_blend_ptr,
   gst_object_replace ((GstObject **) old_blend_ptr, GST_OBJECT (new_blend));
 }
 
+/* Fills in the pipeline parameters of @layer for @current, and uploads
+   them into the VA buffer kept from the previous frames if they
+   changed, e.g. for a new surface */
+static gboolean
+ensure_layer_buffer (GstVaapiBlend * blend, GstVaapiBlendLayer * layer,
+    const GstVaapiBlendSurface * current)
+{
+  VADisplay const va_display = GST_VAAPI_DISPLAY_VADISPLAY (blend->display);
+  VAProcPipelineParameterBuffer param, *buf;
+
+  /* Build surface region (source) */
+  layer->src_rect.x = 0;
+  layer->src_rect.y = 0;
+  layer->src_rect.width = GST_VAAPI_SURFACE_WIDTH (current->surface);
+  layer->src_rect.height = GST_VAAPI_SURFACE_HEIGHT (current->surface);
+  if (current->crop) {
+    if ((current->crop->x + current->crop->width > layer->src_rect.width) ||
+        (current->crop->y + current->crop->height > layer->src_rect.height))
+      return FALSE;
+    layer->src_rect.x = current->crop->x;
+    layer->src_rect.y = current->crop->y;
+    layer->src_rect.width = current->crop->width;
+    layer->src_rect.height = current->crop->height;
+  }
+
+  /* Build output region (target) */
+  layer->dst_rect.x = current->target.x;
+  layer->dst_rect.y = current->target.y;
+  layer->dst_rect.width = current->target.width;
+  layer->dst_rect.height = current->target.height;
+
+  memset (&param, 0, sizeof (param));
+  param.surface = GST_VAAPI_SURFACE_ID (current->surface);
+  param.surface_region = &layer->src_rect;
+  param.output_region = &layer->dst_rect;
+  param.output_background_color = 0xff000000;
+
+#if VA_CHECK_VERSION(1,1,0)
+  layer->blend_state.flags = VA_BLEND_GLOBAL_ALPHA;
+  if (current->premultiplied_alpha &&
+      (blend->flags & VA_BLEND_PREMULTIPLIED_ALPHA))
+    layer->blend_state.flags |= VA_BLEND_PREMULTIPLIED_ALPHA;
+  layer->blend_state.global_alpha = current->alpha;
+  param.blend_state = &layer->blend_state;
+#endif
+
+  if (!blend->buffer_reuse)
+    vaapi_destroy_buffer (va_display, &layer->buffer);
+
+  /* The regions and the blend state are read through the pointers, at
+     vaRenderPicture() time, so they do not need an upload */
+  if (layer->buffer == VA_INVALID_ID) {
+    if (!vaapi_create_buffer (va_display, blend->va_context,
+            VAProcPipelineParameterBufferType, sizeof (param), &param,
+            &layer->buffer, NULL))
+      return FALSE;
+  } else if (memcmp (&layer->param, &param, sizeof (param)) != 0) {
+    buf = vaapi_map_buffer (va_display, layer->buffer);
+    if (!buf)
+      return FALSE;
+    *buf = param;
+    vaapi_unmap_buffer (va_display, layer->buffer, NULL);
+  }
+  memcpy (&layer->param, &param, sizeof (param));
+  return TRUE;
+}
+
 static gboolean
 gst_vaapi_blend_process_unlocked (GstVaapiBlend * blend,
     GstVaapiSurface * output, GstVaapiBlendSurfaceNextFunc next,
@@ -222,70 +323,50 @@ gst_vaapi_blend_process_unlocked (GstVaapiBlend * blend,
   VAStatus va_status;
   VADisplay va_display;
   GstVaapiBlendSurface *current;
+  VABufferID *buffers;
+  guint i, n_layers;
 
   va_display = GST_VAAPI_DISPLAY_VADISPLAY (blend->display);
 
-  va_status = vaBeginPicture (va_display, blend->va_context,
-      GST_VAAPI_SURFACE_ID (output));
-  if (!vaapi_check_status (va_status, "vaBeginPicture()"))
-    return FALSE;
-
-  current = next (user_data);
-  for (; current; current = next (user_data)) {
-    VAProcPipelineParameterBuffer *param = NULL;
-    VABufferID id = VA_INVALID_ID;
-    VARectangle src_rect = { 0, };
-    VARectangle dst_rect = { 0, };
-#if VA_CHECK_VERSION(1,1,0)
-    VABlendState blend_state;
-#endif
-
+  /* Gather all the layers first, so that they go to the driver in a
+     single vaRenderPicture() call */
+  g_ptr_array_set_size (blend->surfaces, 0);
+  for (current = next (user_data); current; current = next (user_data)) {
     if (!current->surface)
       return FALSE;
+    g_ptr_array_add (blend->surfaces, current);
+  }
+  n_layers = blend->surfaces->len;
+  if (n_layers == 0)
+    return TRUE;
+
+  /* The layers must not move anymore once their regions are referenced */
+  for (i = blend->layers->len; i < n_layers; i++) {
+    GstVaapiBlendLayer layer = { VA_INVALID_ID, };
+    g_array_append_val (blend->layers, layer);
+  }
 
-    /* Build surface region (source) */
-    src_rect.width = GST_VAAPI_SURFACE_WIDTH (current->surface);
-    src_rect.height = GST_VAAPI_SURFACE_HEIGHT (current->surface);
-    if (current->crop) {
-      if ((current->crop->x + current->crop->width > src_rect.width) ||
-          (current->crop->y + current->crop->height > src_rect.height))
-        return FALSE;
-      src_rect.x = current->crop->x;
-      src_rect.y = current->crop->y;
-      src_rect.width = current->crop->width;
-      src_rect.height = current->crop->height;
-    }
-
-    /* Build output region (target) */
-    dst_rect.x = current->target.x;
-    dst_rect.y = current->target.y;
-    dst_rect.width = current->target.width;
-    dst_rect.height = current->target.height;
+  buffers = g_newa (VABufferID, n_layers);
+  for (i = 0; i < n_layers; i++) {
+    GstVaapiBlendLayer *const layer =
+        &g_array_index (blend->layers, GstVaapiBlendLayer, i);
 
-    if (!vaapi_create_buffer (va_display, blend->va_context,
-            VAProcPipelineParameterBufferType, sizeof (*param), NULL, &id,
-            (gpointer *) & param))
+    if (!ensure_layer_buffer (blend, layer,
+            g_ptr_array_index (blend->surfaces, i)))
       return FALSE;
+    buffers[i] = layer->buffer;
+  }
 
-    memset (param, 0, sizeof (*param));
-
-    param->surface = GST_VAAPI_SURFACE_ID (current->surface);
-    param->surface_region = &src_rect;
-    param->output_region = &dst_rect;
-    param->output_background_color = 0xff000000;
-
-#if VA_CHECK_VERSION(1,1,0)
-    blend_state.flags = VA_BLEND_GLOBAL_ALPHA;
-    blend_state.global_alpha = current->alpha;
-    param->blend_state = &blend_state;
-#endif
-
-    vaapi_unmap_buffer (va_display, id, NULL);
+  va_status = vaBeginPicture (va_display, blend->va_context,
+      GST_VAAPI_SURFACE_ID (output));
+  if (!vaapi_check_status (va_status, "vaBeginPicture()"))
+    return FALSE;
 
-    va_status = vaRenderPicture (va_display, blend->va_context, &id, 1);
-    vaapi_destroy_buffer (va_display, &id);
-    if (!vaapi_check_status (va_status, "vaRenderPicture()"))
-      return FALSE;
+  va_status = vaRenderPicture (va_display, blend->va_context, buffers,
+      n_layers);
+  if (!vaapi_check_status (va_status, "vaRenderPicture()")) {
+    vaEndPicture (va_display, blend->va_context);
+    return FALSE;
   }
 
   va_status = vaEndPicture (va_display, blend->va_context);
@@ -318,9 +399,31 @@ gst_vaapi_blend_process (GstVaapiBlend * blend, GstVaapiSurface * output,
   g_return_val_if_fail (output != NULL, FALSE);
   g_return_val_if_fail (next != NULL, FALSE);
 
-  GST_VAAPI_DISPLAY_LOCK (blend->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (blend->display, &blend->lock);
   result = gst_vaapi_blend_process_unlocked (blend, output, next, user_data);
-  GST_VAAPI_DISPLAY_UNLOCK (blend->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (blend->display, &blend->lock);
 
   return result;
 }
+
+/**
+ * gst_vaapi_blend_has_premultiplied_alpha:
+ * @blend: a #GstVaapiBlend instance.
+ *
+ * Returns whether the driver blends the surfaces with their
+ * premultiplied alpha channel, for the #GstVaapiBlendSurface that set
+ * premultiplied_alpha, on top of the global alpha.
+ *
+ * Returns: %TRUE if per-pixel alpha blending is supported
+ **/
+gboolean
+gst_vaapi_blend_has_premultiplied_alpha (GstVaapiBlend * blend)
+{
+  g_return_val_if_fail (blend != NULL, FALSE);
+
+#if VA_CHECK_VERSION(1,1,0)
+  return (blend->flags & VA_BLEND_PREMULTIPLIED_ALPHA) != 0;
+#else
+  return FALSE;
+#endif
+}
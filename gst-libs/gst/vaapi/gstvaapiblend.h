@@ -43,6 +43,8 @@ struct _GstVaapiBlendSurface
   const GstVaapiRectangle *crop;
   GstVaapiRectangle target;
   gdouble alpha;
+  /* also blend with the premultiplied alpha channel of the surface */
+  gboolean premultiplied_alpha;
 };
 
 typedef GstVaapiBlendSurface* (*GstVaapiBlendSurfaceNextFunc)(gpointer data);
@@ -58,6 +60,9 @@ gboolean
 gst_vaapi_blend_process (GstVaapiBlend * blend, GstVaapiSurface * output,
     GstVaapiBlendSurfaceNextFunc next, gpointer user_data);
 
+gboolean
+gst_vaapi_blend_has_premultiplied_alpha (GstVaapiBlend * blend);
+
 GType
 gst_vaapi_blend_get_type (void) G_GNUC_CONST;
 
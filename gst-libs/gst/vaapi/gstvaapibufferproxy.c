@@ -26,6 +26,7 @@
 #include "gstvaapibufferproxy_priv.h"
 #include "gstvaapisurface_priv.h"
 #include "gstvaapiutils.h"
+#include <unistd.h>
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -88,6 +89,9 @@ gst_vaapi_buffer_proxy_finalize (GstVaapiBufferProxy * proxy)
   if (proxy->destroy_func)
     proxy->destroy_func (proxy->destroy_data);
 
+  if (proxy->owns_handle)
+    close ((gint) proxy->va_info.handle);
+
   proxy->surface = NULL;
 }
 
@@ -124,6 +128,10 @@ gst_vaapi_buffer_proxy_new (guintptr handle, guint type, gsize size,
   proxy->va_info.type = VAImageBufferType;
   proxy->va_info.mem_type = from_GstVaapiBufferMemoryType (proxy->type);
   proxy->va_info.mem_size = size;
+  proxy->modifier = GST_VAAPI_DRM_FORMAT_MOD_INVALID;
+  proxy->owns_handle = FALSE;
+  proxy->format = GST_VIDEO_FORMAT_UNKNOWN;
+  proxy->num_planes = 0;
   if (!proxy->va_info.mem_type)
     goto error_unsupported_mem_type;
   return proxy;
@@ -157,6 +165,10 @@ gst_vaapi_buffer_proxy_new_from_surface (GstMiniObject * surface,
   proxy->va_buf = buf_id;
   memset (&proxy->va_info, 0, sizeof (proxy->va_info));
   proxy->va_info.mem_type = from_GstVaapiBufferMemoryType (proxy->type);
+  proxy->modifier = GST_VAAPI_DRM_FORMAT_MOD_INVALID;
+  proxy->owns_handle = FALSE;
+  proxy->format = GST_VIDEO_FORMAT_UNKNOWN;
+  proxy->num_planes = 0;
   if (!proxy->va_info.mem_type)
     goto error_unsupported_mem_type;
   if (!gst_vaapi_buffer_proxy_acquire_handle (proxy))
@@ -178,6 +190,39 @@ error_acquire_handle:
   }
 }
 
+/* Wraps a dma-buf exported through vaExportSurfaceHandle(). The proxy
+ * owns @fd and closes it when destroyed. */
+GstVaapiBufferProxy *
+gst_vaapi_buffer_proxy_new_from_export (GstMiniObject * surface, gint fd,
+    gsize size, guint64 modifier)
+{
+  GstVaapiBufferProxy *proxy;
+
+  g_return_val_if_fail (surface != NULL, NULL);
+  g_return_val_if_fail (fd >= 0, NULL);
+
+  proxy = (GstVaapiBufferProxy *)
+      gst_vaapi_mini_object_new (gst_vaapi_buffer_proxy_class ());
+  if (!proxy)
+    return NULL;
+
+  proxy->surface = surface;
+  proxy->destroy_func = NULL;
+  proxy->destroy_data = NULL;
+  proxy->type = GST_VAAPI_BUFFER_MEMORY_TYPE_DMA_BUF;
+  proxy->va_buf = VA_INVALID_ID;
+  memset (&proxy->va_info, 0, sizeof (proxy->va_info));
+  proxy->va_info.handle = fd;
+  proxy->va_info.type = VAImageBufferType;
+  proxy->va_info.mem_type = from_GstVaapiBufferMemoryType (proxy->type);
+  proxy->va_info.mem_size = size;
+  proxy->modifier = modifier;
+  proxy->owns_handle = TRUE;
+  proxy->format = GST_VIDEO_FORMAT_UNKNOWN;
+  proxy->num_planes = 0;
+  return proxy;
+}
+
 /**
  * gst_vaapi_buffer_proxy_ref:
  * @proxy: a #GstVaapiBufferProxy
@@ -295,3 +340,87 @@ gst_vaapi_buffer_proxy_release_data (GstVaapiBufferProxy * proxy)
     proxy->destroy_data = NULL;
   }
 }
+
+/**
+ * gst_vaapi_buffer_proxy_get_modifier:
+ * @proxy: a #GstVaapiBufferProxy
+ *
+ * Returns the DRM format modifier describing the layout of the
+ * underlying buffer, or %GST_VAAPI_DRM_FORMAT_MOD_INVALID if the
+ * layout is implicit.
+ *
+ * Return value: the DRM format modifier
+ */
+guint64
+gst_vaapi_buffer_proxy_get_modifier (GstVaapiBufferProxy * proxy)
+{
+  g_return_val_if_fail (proxy != NULL, GST_VAAPI_DRM_FORMAT_MOD_INVALID);
+
+  return proxy->modifier;
+}
+
+/**
+ * gst_vaapi_buffer_proxy_set_modifier:
+ * @proxy: a #GstVaapiBufferProxy
+ * @modifier: a DRM format modifier
+ *
+ * Sets the DRM format modifier of an imported buffer, that is used
+ * when the buffer is wrapped into a VA surface.
+ */
+void
+gst_vaapi_buffer_proxy_set_modifier (GstVaapiBufferProxy * proxy,
+    guint64 modifier)
+{
+  g_return_if_fail (proxy != NULL);
+
+  proxy->modifier = modifier;
+}
+
+/**
+ * gst_vaapi_buffer_proxy_get_num_planes:
+ * @proxy: a #GstVaapiBufferProxy
+ *
+ * Returns the number of video planes laid out in the buffer of an
+ * exported surface, see gst_vaapi_buffer_proxy_get_plane().
+ *
+ * Return value: the number of planes, or 0 if the layout is unknown
+ */
+guint
+gst_vaapi_buffer_proxy_get_num_planes (GstVaapiBufferProxy * proxy)
+{
+  g_return_val_if_fail (proxy != NULL, 0);
+
+  if (proxy->format == GST_VIDEO_FORMAT_UNKNOWN)
+    return 0;
+  return proxy->num_planes;
+}
+
+/**
+ * gst_vaapi_buffer_proxy_get_plane:
+ * @proxy: a #GstVaapiBufferProxy
+ * @plane: the plane index
+ * @offset: (out) (allow-none): return location for the offset of the
+ *   plane in the buffer, in bytes
+ * @stride: (out) (allow-none): return location for the stride of the
+ *   plane, in bytes
+ *
+ * Returns the layout of @plane in the buffer of an exported surface,
+ * so that other APIs can import the buffer as an image.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_buffer_proxy_get_plane (GstVaapiBufferProxy * proxy, guint plane,
+    gsize * offset, gint * stride)
+{
+  g_return_val_if_fail (proxy != NULL, FALSE);
+
+  if (plane >= gst_vaapi_buffer_proxy_get_num_planes (proxy))
+    return FALSE;
+
+  if (offset)
+    *offset = proxy->offsets[plane];
+  if (stride)
+    *stride = proxy->strides[plane];
+  return TRUE;
+}
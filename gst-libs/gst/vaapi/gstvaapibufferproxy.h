@@ -55,6 +55,22 @@ G_BEGIN_DECLS
 #define GST_VAAPI_BUFFER_PROXY_SIZE(buf) \
   gst_vaapi_buffer_proxy_get_size (GST_VAAPI_BUFFER_PROXY (buf))
 
+/**
+ * GST_VAAPI_DRM_FORMAT_MOD_INVALID:
+ *
+ * DRM format modifier of buffers whose layout is not known, or is
+ * implied by the buffer object itself.
+ */
+#define GST_VAAPI_DRM_FORMAT_MOD_INVALID \
+  G_GUINT64_CONSTANT (0x00ffffffffffffff)
+
+/**
+ * GST_VAAPI_DRM_FORMAT_MOD_LINEAR:
+ *
+ * DRM format modifier of linear buffers.
+ */
+#define GST_VAAPI_DRM_FORMAT_MOD_LINEAR G_GUINT64_CONSTANT (0)
+
 typedef struct _GstVaapiBufferProxy             GstVaapiBufferProxy;
 
 /**
@@ -101,6 +117,20 @@ gst_vaapi_buffer_proxy_get_size (GstVaapiBufferProxy * proxy);
 void
 gst_vaapi_buffer_proxy_release_data (GstVaapiBufferProxy * proxy);
 
+guint64
+gst_vaapi_buffer_proxy_get_modifier (GstVaapiBufferProxy * proxy);
+
+void
+gst_vaapi_buffer_proxy_set_modifier (GstVaapiBufferProxy * proxy,
+    guint64 modifier);
+
+guint
+gst_vaapi_buffer_proxy_get_num_planes (GstVaapiBufferProxy * proxy);
+
+gboolean
+gst_vaapi_buffer_proxy_get_plane (GstVaapiBufferProxy * proxy, guint plane,
+    gsize * offset, gint * stride);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_BUFFER_PROXY_H */
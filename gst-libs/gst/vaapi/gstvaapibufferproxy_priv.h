@@ -25,6 +25,7 @@
 
 #include "gstvaapibufferproxy.h"
 #include "gstvaapiminiobject.h"
+#include <gst/video/video.h>
 
 G_BEGIN_DECLS
 
@@ -68,6 +69,14 @@ struct _GstVaapiBufferProxy {
   guint                 type;
   VABufferID            va_buf;
   VABufferInfo          va_info;
+  guint64               modifier;
+  gboolean              owns_handle;
+
+  /* Plane layout of exported surfaces, or GST_VIDEO_FORMAT_UNKNOWN */
+  GstVideoFormat        format;
+  guint                 num_planes;
+  gsize                 offsets[GST_VIDEO_MAX_PLANES];
+  gint                  strides[GST_VIDEO_MAX_PLANES];
 };
 
 G_GNUC_INTERNAL
@@ -75,6 +84,11 @@ GstVaapiBufferProxy *
 gst_vaapi_buffer_proxy_new_from_surface (GstMiniObject * surface,
     VABufferID buf_id, guint type, GDestroyNotify destroy_func, gpointer data);
 
+G_GNUC_INTERNAL
+GstVaapiBufferProxy *
+gst_vaapi_buffer_proxy_new_from_export (GstMiniObject * surface, gint fd,
+    gsize size, guint64 modifier);
+
 G_GNUC_INTERNAL
 guint
 from_GstVaapiBufferMemoryType (guint type);
@@ -71,6 +71,18 @@ GstVaapiCodecObject *
 gst_vaapi_codec_object_new (const GstVaapiCodecObjectClass * object_class,
     GstVaapiCodecBase * codec, gconstpointer param, guint param_size,
     gconstpointer data, guint data_size, guint flags)
+{
+  return gst_vaapi_codec_object_new_with_param_num (object_class, codec,
+      param, param_size, 1, data, data_size, flags);
+}
+
+/* Same as gst_vaapi_codec_object_new() for objects holding an array of
+   @param_num parameters of @param_size bytes each */
+GstVaapiCodecObject *
+gst_vaapi_codec_object_new_with_param_num (const GstVaapiCodecObjectClass *
+    object_class, GstVaapiCodecBase * codec, gconstpointer param,
+    guint param_size, guint param_num, gconstpointer data, guint data_size,
+    guint flags)
 {
   GstVaapiCodecObject *obj;
   GstVaapiCodecObjectConstructorArgs args;
@@ -85,6 +97,7 @@ gst_vaapi_codec_object_new (const GstVaapiCodecObjectClass * object_class,
 
   args.param = param;
   args.param_size = param_size;
+  args.param_num = param_num;
   args.data = data;
   args.data_size = data_size;
   args.flags = flags;
@@ -118,9 +131,10 @@ gst_vaapi_iq_matrix_create (GstVaapiIqMatrix * iq_matrix,
     const GstVaapiCodecObjectConstructorArgs * args)
 {
   iq_matrix->param_id = VA_INVALID_ID;
-  return vaapi_create_buffer (GET_VA_DISPLAY (iq_matrix),
-      GET_VA_CONTEXT (iq_matrix), VAIQMatrixBufferType,
-      args->param_size, args->param, &iq_matrix->param_id, &iq_matrix->param);
+  iq_matrix->param_size = args->param_size;
+  return gst_vaapi_decoder_create_buffer (GET_DECODER (iq_matrix),
+      VAIQMatrixBufferType, args->param_size, args->param,
+      &iq_matrix->param_id, &iq_matrix->param);
 }
 
 GstVaapiIqMatrix *
@@ -154,9 +168,10 @@ gst_vaapi_bitplane_create (GstVaapiBitPlane * bitplane,
     const GstVaapiCodecObjectConstructorArgs * args)
 {
   bitplane->data_id = VA_INVALID_ID;
-  return vaapi_create_buffer (GET_VA_DISPLAY (bitplane),
-      GET_VA_CONTEXT (bitplane), VABitPlaneBufferType, args->param_size,
-      args->param, &bitplane->data_id, (void **) &bitplane->data);
+  bitplane->data_size = args->param_size;
+  return gst_vaapi_decoder_create_buffer (GET_DECODER (bitplane),
+      VABitPlaneBufferType, args->param_size, args->param,
+      &bitplane->data_id, (void **) &bitplane->data);
 }
 
 
@@ -191,9 +206,10 @@ gst_vaapi_huffman_table_create (GstVaapiHuffmanTable * huf_table,
     const GstVaapiCodecObjectConstructorArgs * args)
 {
   huf_table->param_id = VA_INVALID_ID;
-  return vaapi_create_buffer (GET_VA_DISPLAY (huf_table),
-      GET_VA_CONTEXT (huf_table), VAHuffmanTableBufferType, args->param_size,
-      args->param, &huf_table->param_id, (void **) &huf_table->param);
+  huf_table->param_size = args->param_size;
+  return gst_vaapi_decoder_create_buffer (GET_DECODER (huf_table),
+      VAHuffmanTableBufferType, args->param_size, args->param,
+      &huf_table->param_id, (void **) &huf_table->param);
 }
 
 GstVaapiHuffmanTable *
@@ -52,13 +52,17 @@ typedef struct _GstVaapiProbabilityTable        GstVaapiProbabilityTable;
 enum
 {
   GST_VAAPI_CODEC_OBJECT_FLAG_CONSTRUCTED = (1 << 0),
-  GST_VAAPI_CODEC_OBJECT_FLAG_LAST        = (1 << 1)
+  /* tables the decoder keeps across pictures, their VA buffer is
+     submitted as is to each picture and is not recycled */
+  GST_VAAPI_CODEC_OBJECT_FLAG_PERSISTENT  = (1 << 1),
+  GST_VAAPI_CODEC_OBJECT_FLAG_LAST        = (1 << 2)
 };
 
 typedef struct
 {
   gconstpointer param;
   guint param_size;
+  guint param_num;
   gconstpointer data;
   guint data_size;
   guint flags;
@@ -105,6 +109,13 @@ gst_vaapi_codec_object_new (const GstVaapiCodecObjectClass * object_class,
     GstVaapiCodecBase * codec, gconstpointer param, guint param_size,
     gconstpointer data, guint data_size, guint flags);
 
+G_GNUC_INTERNAL
+GstVaapiCodecObject *
+gst_vaapi_codec_object_new_with_param_num (const GstVaapiCodecObjectClass *
+    object_class, GstVaapiCodecBase * codec, gconstpointer param,
+    guint param_size, guint param_num, gconstpointer data, guint data_size,
+    guint flags);
+
 #define gst_vaapi_codec_object_ref(object) \
   ((gpointer) gst_vaapi_mini_object_ref (GST_VAAPI_MINI_OBJECT (object)))
 
@@ -132,6 +143,7 @@ struct _GstVaapiIqMatrix
   /*< private >*/
   GstVaapiCodecObject parent_instance;
   VABufferID param_id;
+  guint param_size;
 
   /*< public >*/
   gpointer param;
@@ -159,6 +171,7 @@ struct _GstVaapiBitPlane
   /*< private >*/
   GstVaapiCodecObject parent_instance;
   VABufferID data_id;
+  guint data_size;
 
   /*< public >*/
   guint8 *data;
@@ -186,6 +199,7 @@ struct _GstVaapiHuffmanTable
   /*< private >*/
   GstVaapiCodecObject parent_instance;
   VABufferID param_id;
+  guint param_size;
 
   /*< public >*/
   gpointer param;
@@ -237,11 +251,14 @@ gboolean                                                                \
 G_PASTE (prefix, _create) (type *,                                      \
     const GstVaapiCodecObjectConstructorArgs * args);                   \
                                                                         \
+static GstVaapiMiniObjectCache G_PASTE (type, Cache);                   \
+                                                                        \
 static const GstVaapiCodecObjectClass G_PASTE (type, Class) = {         \
   .parent_class = {                                                     \
     .size = sizeof (type),                                              \
     .finalize = (GstVaapiCodecObjectDestroyFunc)                        \
-        G_PASTE (prefix, _destroy)                                      \
+        G_PASTE (prefix, _destroy),                                     \
+    .cache = &G_PASTE (type, Cache),                                    \
   },                                                                    \
   .create = (GstVaapiCodecObjectCreateFunc)                             \
       G_PASTE (prefix, _create),                                        \
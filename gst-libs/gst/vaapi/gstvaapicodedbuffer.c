@@ -26,6 +26,8 @@
 #include "gstvaapicodedbuffer_priv.h"
 #include "gstvaapiencoder_priv.h"
 #include "gstvaapiutils.h"
+#include "gstvaapidisplay_priv.h"
+#include "gstvaapivarecord.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -48,6 +50,8 @@ coded_buffer_create (GstVaapiCodedBuffer * buf, guint buf_size,
 
   GST_DEBUG ("coded buffer %" GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (buf_id));
   GST_VAAPI_CODED_BUFFER_ID (buf) = buf_id;
+  gst_vaapi_display_account_resource (display,
+      GST_VAAPI_DISPLAY_RESOURCE_CODED_BUFFER, 1, buf_size);
   return TRUE;
 }
 
@@ -65,6 +69,9 @@ coded_buffer_free (GstVaapiCodedBuffer * buf)
     vaapi_destroy_buffer (GST_VAAPI_DISPLAY_VADISPLAY (display), &buf_id);
     GST_VAAPI_DISPLAY_UNLOCK (display);
     GST_VAAPI_CODED_BUFFER_ID (buf) = VA_INVALID_ID;
+    gst_vaapi_display_account_resource (display,
+        GST_VAAPI_DISPLAY_RESOURCE_CODED_BUFFER, -1,
+        GST_VAAPI_CODED_BUFFER_ALLOC_SIZE (buf));
   }
 
   gst_vaapi_display_replace (&GST_VAAPI_CODED_BUFFER_DISPLAY (buf), NULL);
@@ -80,11 +87,11 @@ coded_buffer_map (GstVaapiCodedBuffer * buf)
   if (buf->segment_list)
     return TRUE;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   buf->segment_list =
       vaapi_map_buffer (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_CODED_BUFFER_ID (buf));
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   return buf->segment_list != NULL;
 }
 
@@ -96,10 +103,10 @@ coded_buffer_unmap (GstVaapiCodedBuffer * buf)
   if (!buf->segment_list)
     return;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   vaapi_unmap_buffer (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_CODED_BUFFER_ID (buf), (void **) &buf->segment_list);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
 }
 
 GST_DEFINE_MINI_OBJECT_TYPE (GstVaapiCodedBuffer, gst_vaapi_coded_buffer);
@@ -136,6 +143,7 @@ gst_vaapi_coded_buffer_new (GstVaapiContext * context, guint buf_size)
 
   GST_VAAPI_CODED_BUFFER_DISPLAY (buf) = gst_object_ref (display);
   GST_VAAPI_CODED_BUFFER_ID (buf) = VA_INVALID_ID;
+  GST_VAAPI_CODED_BUFFER_ALLOC_SIZE (buf) = buf_size;
   buf->segment_list = NULL;
 
   if (!coded_buffer_create (buf, buf_size, context))
@@ -187,6 +195,51 @@ gst_vaapi_coded_buffer_unmap (GstVaapiCodedBuffer * buf)
   coded_buffer_unmap (buf);
 }
 
+/*
+ * gst_vaapi_coded_buffer_sync:
+ * @buf: a #GstVaapiCodedBuffer
+ * @timeout: the maximum time to wait, in nanoseconds, or
+ *   %G_MAXUINT64 to wait until the picture is encoded
+ *
+ * Waits for the picture being encoded into @buf, through
+ * vaSyncBuffer(). Unlike a surface sync, this does not wait for the
+ * reconstructed picture to be written back, and it can time out.
+ *
+ * Return value: %VA_STATUS_SUCCESS once @buf can be mapped,
+ *   %VA_STATUS_ERROR_TIMEDOUT if it could not within @timeout, or
+ *   %VA_STATUS_ERROR_UNIMPLEMENTED if the driver or libva does not
+ *   support vaSyncBuffer()
+ */
+VAStatus
+gst_vaapi_coded_buffer_sync (GstVaapiCodedBuffer * buf, guint64 timeout)
+{
+#if VA_CHECK_VERSION(1,9,0)
+  GstVaapiDisplay *display;
+  GstClockTime record_start;
+  VAStatus status;
+
+  g_return_val_if_fail (buf != NULL, VA_STATUS_ERROR_INVALID_BUFFER);
+
+  display = GST_VAAPI_CODED_BUFFER_DISPLAY (buf);
+
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
+  status = vaSyncBuffer (GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_CODED_BUFFER_ID (buf), timeout);
+  GST_VAAPI_VA_RECORD_END (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display), GST_VAAPI_VA_RECORD_SYNC_BUFFER,
+      status, GST_VAAPI_CODED_BUFFER_ID (buf));
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
+
+  if (status != VA_STATUS_ERROR_TIMEDOUT
+      && status != VA_STATUS_ERROR_UNIMPLEMENTED)
+    vaapi_check_status (status, "vaSyncBuffer()");
+  return status;
+#else
+  return VA_STATUS_ERROR_UNIMPLEMENTED;
+#endif
+}
+
 /**
  * gst_vaapi_coded_buffer_get_size:
  * @buf: a #GstVaapiCodedBuffer
@@ -201,10 +254,13 @@ gssize
 gst_vaapi_coded_buffer_get_size (GstVaapiCodedBuffer * buf)
 {
   VACodedBufferSegment *segment;
+  gboolean was_mapped;
   gssize size;
 
   g_return_val_if_fail (buf != NULL, -1);
 
+  /* Keep an existing mapping alive, it may back wrapped memories */
+  was_mapped = buf->segment_list != NULL;
   if (!coded_buffer_map (buf))
     return -1;
 
@@ -212,7 +268,8 @@ gst_vaapi_coded_buffer_get_size (GstVaapiCodedBuffer * buf)
   for (segment = buf->segment_list; segment != NULL; segment = segment->next)
     size += segment->size;
 
-  coded_buffer_unmap (buf);
+  if (!was_mapped)
+    coded_buffer_unmap (buf);
   return size;
 }
 
@@ -229,12 +286,14 @@ gboolean
 gst_vaapi_coded_buffer_copy_into (GstBuffer * dest, GstVaapiCodedBuffer * src)
 {
   VACodedBufferSegment *segment;
+  gboolean was_mapped;
   goffset offset;
   gsize size;
 
   g_return_val_if_fail (src != NULL, FALSE);
   g_return_val_if_fail (dest != NULL, FALSE);
 
+  was_mapped = src->segment_list != NULL;
   if (!coded_buffer_map (src))
     return FALSE;
 
@@ -246,6 +305,144 @@ gst_vaapi_coded_buffer_copy_into (GstBuffer * dest, GstVaapiCodedBuffer * src)
     offset += segment->size;
   }
 
-  coded_buffer_unmap (src);
+  if (!was_mapped)
+    coded_buffer_unmap (src);
   return segment == NULL;
 }
+
+static VACodedBufferSegment *
+get_segment (GstVaapiCodedBuffer * buf, guint index)
+{
+  VACodedBufferSegment *segment;
+
+  for (segment = buf->segment_list; segment != NULL && index > 0;
+      segment = segment->next)
+    index--;
+  return segment;
+}
+
+/**
+ * gst_vaapi_coded_buffer_get_segment_size:
+ * @buf: a #GstVaapiCodedBuffer
+ * @index: the index of the coded segment
+ *
+ * Returns the size of the @index-th VACodedBufferSegment of @buf.
+ * Drivers may report each slice in its own segment, which allows to
+ * deliver the slices of a picture separately.
+ *
+ * Return value: the size of the segment in bytes, or -1 if there is no
+ *   such segment
+ */
+gssize
+gst_vaapi_coded_buffer_get_segment_size (GstVaapiCodedBuffer * buf,
+    guint index)
+{
+  VACodedBufferSegment *segment;
+  gboolean was_mapped;
+  gssize size;
+
+  g_return_val_if_fail (buf != NULL, -1);
+
+  was_mapped = buf->segment_list != NULL;
+  if (!coded_buffer_map (buf))
+    return -1;
+
+  segment = get_segment (buf, index);
+  size = segment ? segment->size : -1;
+
+  if (!was_mapped)
+    coded_buffer_unmap (buf);
+  return size;
+}
+
+/**
+ * gst_vaapi_coded_buffer_copy_segment_into:
+ * @dest: the destination #GstBuffer
+ * @src: the source #GstVaapiCodedBuffer
+ * @index: the index of the coded segment
+ *
+ * Copies the @index-th VACodedBufferSegment of @src into the regular
+ * buffer @dest.
+ *
+ * Return value: %TRUE if successful, %FALSE otherwise
+ */
+gboolean
+gst_vaapi_coded_buffer_copy_segment_into (GstBuffer * dest,
+    GstVaapiCodedBuffer * src, guint index)
+{
+  VACodedBufferSegment *segment;
+  gboolean was_mapped, success;
+
+  g_return_val_if_fail (src != NULL, FALSE);
+  g_return_val_if_fail (dest != NULL, FALSE);
+
+  was_mapped = src->segment_list != NULL;
+  if (!coded_buffer_map (src))
+    return FALSE;
+
+  segment = get_segment (src, index);
+  success = segment != NULL &&
+      gst_buffer_fill (dest, 0, segment->buf, segment->size) == segment->size;
+
+  if (!was_mapped)
+    coded_buffer_unmap (src);
+  return success;
+}
+
+static guint
+to_GstVaapiCodedBufferStatus (guint va_status)
+{
+  guint status = 0;
+
+  if (va_status & VA_CODED_BUF_STATUS_SLICE_OVERFLOW_MASK)
+    status |= GST_VAAPI_CODED_BUFFER_STATUS_SLICE_OVERFLOW;
+  if (va_status & VA_CODED_BUF_STATUS_BITRATE_OVERFLOW)
+    status |= GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_OVERFLOW;
+  if (va_status & VA_CODED_BUF_STATUS_BITRATE_HIGH)
+    status |= GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_HIGH;
+#ifdef VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW
+  if (va_status & VA_CODED_BUF_STATUS_FRAME_SIZE_OVERFLOW)
+    status |= GST_VAAPI_CODED_BUFFER_STATUS_FRAME_SIZE_OVERFLOW;
+#endif
+  return status;
+}
+
+/**
+ * gst_vaapi_coded_buffer_get_stats:
+ * @buf: a #GstVaapiCodedBuffer
+ * @stats: (out): the #GstVaapiCodedBufferStats to fill in
+ *
+ * Reads back the statistics the driver reported along with the coded
+ * picture in @buf. This shall be called once the picture is encoded.
+ *
+ * Return value: %TRUE if successful, %FALSE otherwise
+ */
+gboolean
+gst_vaapi_coded_buffer_get_stats (GstVaapiCodedBuffer * buf,
+    GstVaapiCodedBufferStats * stats)
+{
+  VACodedBufferSegment *segment;
+  gboolean was_mapped;
+
+  g_return_val_if_fail (buf != NULL, FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
+
+  was_mapped = buf->segment_list != NULL;
+  if (!coded_buffer_map (buf))
+    return FALSE;
+
+  memset (stats, 0, sizeof (*stats));
+  for (segment = buf->segment_list; segment != NULL; segment = segment->next) {
+    /* The picture QP is the same in all segments, keep the first one */
+    if (stats->average_qp == 0)
+      stats->average_qp =
+          segment->status & VA_CODED_BUF_STATUS_PICTURE_AVE_QP_MASK;
+    stats->status |= to_GstVaapiCodedBufferStatus (segment->status);
+    stats->size += segment->size;
+    stats->num_segments++;
+  }
+
+  if (!was_mapped)
+    coded_buffer_unmap (buf);
+  return TRUE;
+}
@@ -42,6 +42,44 @@ typedef struct _GstVaapiCodedBuffer             GstVaapiCodedBuffer;
 typedef struct _GstVaapiCodedBufferProxy        GstVaapiCodedBufferProxy;
 typedef struct _GstVaapiCodedBufferPool         GstVaapiCodedBufferPool;
 
+/**
+ * GstVaapiCodedBufferStatus:
+ * @GST_VAAPI_CODED_BUFFER_STATUS_SLICE_OVERFLOW: a slice exceeded the
+ *   maximal slice size.
+ * @GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_OVERFLOW: the picture exceeded
+ *   the bitrate budget and padding or skipping was needed.
+ * @GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_HIGH: the bitrate is above the
+ *   target, even at the maximal QP.
+ * @GST_VAAPI_CODED_BUFFER_STATUS_FRAME_SIZE_OVERFLOW: the picture
+ *   exceeded the maximal frame size.
+ *
+ * Status flags reported by the driver with a coded picture.
+ */
+typedef enum
+{
+  GST_VAAPI_CODED_BUFFER_STATUS_SLICE_OVERFLOW          = 1 << 0,
+  GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_OVERFLOW        = 1 << 1,
+  GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_HIGH            = 1 << 2,
+  GST_VAAPI_CODED_BUFFER_STATUS_FRAME_SIZE_OVERFLOW     = 1 << 3,
+} GstVaapiCodedBufferStatus;
+
+/**
+ * GstVaapiCodedBufferStats:
+ * @size: the coded size in bytes
+ * @num_segments: the number of coded segments
+ * @average_qp: the average QP of the picture, or 0 if not reported
+ * @status: the #GstVaapiCodedBufferStatus flags of all segments
+ *
+ * Statistics for one coded picture, as reported by the driver.
+ */
+typedef struct
+{
+  guint size;
+  guint num_segments;
+  guint average_qp;
+  guint status;
+} GstVaapiCodedBufferStats;
+
 #define GST_TYPE_VAAPI_CODED_BUFFER (gst_vaapi_coded_buffer_get_type ())
 
 GType
@@ -66,6 +104,18 @@ gst_vaapi_coded_buffer_get_size (GstVaapiCodedBuffer * buf);
 gboolean
 gst_vaapi_coded_buffer_copy_into (GstBuffer * dest, GstVaapiCodedBuffer * src);
 
+gssize
+gst_vaapi_coded_buffer_get_segment_size (GstVaapiCodedBuffer * buf,
+    guint index);
+
+gboolean
+gst_vaapi_coded_buffer_copy_segment_into (GstBuffer * dest,
+    GstVaapiCodedBuffer * src, guint index);
+
+gboolean
+gst_vaapi_coded_buffer_get_stats (GstVaapiCodedBuffer * buf,
+    GstVaapiCodedBufferStats * stats);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiCodedBuffer, gst_vaapi_coded_buffer_unref)
 
 G_END_DECLS
@@ -43,6 +43,7 @@ struct _GstVaapiCodedBuffer
   GstMiniObject         mini_object;
   GstVaapiDisplay      *display;
   GstVaapiID            object_id;
+  guint                 alloc_size;
 
   /*< public >*/
   VACodedBufferSegment *segment_list;
@@ -66,6 +67,15 @@ struct _GstVaapiCodedBuffer
 #undef GST_VAAPI_CODED_BUFFER_ID
 #define GST_VAAPI_CODED_BUFFER_ID(buf) (GST_VAAPI_CODED_BUFFER (buf)->object_id)
 
+/**
+ * GST_VAAPI_CODED_BUFFER_ALLOC_SIZE:
+ * @buf: a #GstVaapiCodedBuffer
+ *
+ * Macro that evaluates to the allocated size of @buf, in bytes
+ */
+#define GST_VAAPI_CODED_BUFFER_ALLOC_SIZE(buf) \
+  (GST_VAAPI_CODED_BUFFER (buf)->alloc_size)
+
 G_GNUC_INTERNAL
 GstVaapiCodedBuffer *
 gst_vaapi_coded_buffer_new (GstVaapiContext * context, guint buf_size);
@@ -79,6 +89,10 @@ G_GNUC_INTERNAL
 void
 gst_vaapi_coded_buffer_unmap (GstVaapiCodedBuffer * buf);
 
+G_GNUC_INTERNAL
+VAStatus
+gst_vaapi_coded_buffer_sync (GstVaapiCodedBuffer * buf, guint64 timeout);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_CODED_BUFFER_PRIV_H */
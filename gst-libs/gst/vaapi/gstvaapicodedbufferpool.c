@@ -29,10 +29,20 @@
 #define DEBUG 1
 #include "gstvaapidebug.h"
 
+/* Number of coded sizes the adaptive buffer size is computed from */
+#define CODED_SIZE_WINDOW 64
+
+/* Smallest size considered for adaptive allocations, in bytes */
+#define CODED_SIZE_MIN (16 * 1024)
+
 /**
  * GstVaapiCodedBufferPool:
  *
  * A pool of lazily allocated #GstVaapiCodedBuffer objects.
+ *
+ * In adaptive mode, new buffers are sized from the coded sizes seen
+ * so far, rather than from the worst case @max_size. @buf_size is
+ * then the size of newly allocated buffers.
  */
 struct _GstVaapiCodedBufferPool
 {
@@ -40,7 +50,12 @@ struct _GstVaapiCodedBufferPool
   GstVaapiVideoPool parent_instance;
 
   GstVaapiContext *context;
+  gsize max_size;
   gsize buf_size;
+
+  gboolean adaptive;
+  guint coded_sizes[CODED_SIZE_WINDOW];
+  guint num_coded_sizes;
 };
 
 static void
@@ -48,7 +63,10 @@ coded_buffer_pool_init (GstVaapiCodedBufferPool * pool,
     GstVaapiContext * context, gsize buf_size)
 {
   pool->context = gst_vaapi_context_ref (context);
+  pool->max_size = buf_size;
   pool->buf_size = buf_size;
+  pool->adaptive = FALSE;
+  pool->num_coded_sizes = 0;
 }
 
 static void
@@ -67,6 +85,47 @@ coded_buffer_pool_alloc_object (GstVaapiVideoPool * base_pool)
   return gst_vaapi_coded_buffer_new (pool->context, pool->buf_size);
 }
 
+/* Buffers that became too small, or much larger than needed, are not
+   recycled so that the next allocation uses the current size */
+static gboolean
+coded_buffer_pool_reuse_object (GstVaapiVideoPool * base_pool,
+    gpointer object)
+{
+  GstVaapiCodedBufferPool *const pool = GST_VAAPI_CODED_BUFFER_POOL (base_pool);
+  const gsize alloc_size = GST_VAAPI_CODED_BUFFER_ALLOC_SIZE (object);
+  const gsize buf_size = pool->buf_size;
+
+  return alloc_size >= buf_size && alloc_size / 2 <= buf_size;
+}
+
+static gint
+compare_coded_sizes (gconstpointer a, gconstpointer b)
+{
+  const guint size_a = *(const guint *) a;
+  const guint size_b = *(const guint *) b;
+
+  return size_a < size_b ? -1 : size_a > size_b;
+}
+
+/* Derives the allocation size from the last coded sizes: twice the
+   95th percentile, but never less than the largest size plus 25% */
+static gsize
+compute_buffer_size (GstVaapiCodedBufferPool * pool)
+{
+  guint sizes[CODED_SIZE_WINDOW];
+  gsize size, max_size;
+
+  memcpy (sizes, pool->coded_sizes, sizeof (sizes));
+  qsort (sizes, CODED_SIZE_WINDOW, sizeof (sizes[0]), compare_coded_sizes);
+
+  max_size = sizes[CODED_SIZE_WINDOW - 1];
+  size = 2 * (gsize) sizes[(CODED_SIZE_WINDOW * 95) / 100];
+  size = MAX (size, max_size + max_size / 4);
+  size = MAX (size, CODED_SIZE_MIN);
+  size = GST_ROUND_UP_N (size, 4096);
+  return MIN (size, pool->max_size);
+}
+
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_coded_buffer_pool_class (void)
 {
@@ -74,7 +133,8 @@ gst_vaapi_coded_buffer_pool_class (void)
     {sizeof (GstVaapiCodedBufferPool),
         (GDestroyNotify) coded_buffer_pool_finalize}
     ,
-    .alloc_object = coded_buffer_pool_alloc_object
+    .alloc_object = coded_buffer_pool_alloc_object,
+    .reuse_object = coded_buffer_pool_reuse_object
   };
   return GST_VAAPI_MINI_OBJECT_CLASS (&GstVaapiCodedBufferPoolClass);
 }
@@ -128,5 +188,104 @@ gst_vaapi_coded_buffer_pool_get_buffer_size (GstVaapiCodedBufferPool * pool)
 {
   g_return_val_if_fail (pool != NULL, 0);
 
-  return pool->buf_size;
+  return pool->max_size;
+}
+
+/**
+ * gst_vaapi_coded_buffer_pool_set_adaptive:
+ * @pool: a #GstVaapiCodedBufferPool
+ * @adaptive: whether to size buffers from the observed coded sizes
+ *
+ * Enables or disables adaptive sizing of the coded buffers allocated
+ * by @pool. In either case, statistics are reset and buffers are
+ * allocated with the maximum size until enough coded sizes were
+ * reported through gst_vaapi_coded_buffer_pool_update(). Free buffers
+ * are released, so this is also the way to restart from a safe state
+ * when the encoding parameters change, e.g. the bitrate.
+ */
+void
+gst_vaapi_coded_buffer_pool_set_adaptive (GstVaapiCodedBufferPool * pool,
+    gboolean adaptive)
+{
+  GstVaapiVideoPool *const base_pool = GST_VAAPI_VIDEO_POOL (pool);
+
+  g_return_if_fail (pool != NULL);
+
+  g_mutex_lock (&base_pool->mutex);
+  pool->adaptive = adaptive;
+  pool->num_coded_sizes = 0;
+  pool->buf_size = pool->max_size;
+  g_mutex_unlock (&base_pool->mutex);
+
+  gst_vaapi_video_pool_shrink (base_pool, 0);
+}
+
+/**
+ * gst_vaapi_coded_buffer_pool_update:
+ * @pool: a #GstVaapiCodedBufferPool
+ * @buf: a completed #GstVaapiCodedBuffer from @pool
+ *
+ * Reports the coded size of @buf to @pool, so that the size of the
+ * next allocated buffers can follow the actual bitstream sizes, and
+ * checks whether @buf overflowed, whether adaptive sizing is enabled
+ * or not.
+ *
+ * If @buf overflowed, its bitstream is truncated and must not be
+ * used. Adaptive sizing is then disabled and buffers return to their
+ * maximum size.
+ *
+ * Return value: %FALSE if @buf overflowed, %TRUE otherwise
+ */
+gboolean
+gst_vaapi_coded_buffer_pool_update (GstVaapiCodedBufferPool * pool,
+    GstVaapiCodedBuffer * buf)
+{
+  GstVaapiVideoPool *const base_pool = GST_VAAPI_VIDEO_POOL (pool);
+  VACodedBufferSegment *segment;
+  gboolean overflow = FALSE;
+  gsize size = 0, new_size;
+
+  g_return_val_if_fail (pool != NULL, FALSE);
+  g_return_val_if_fail (buf != NULL, FALSE);
+
+  /* The mapping is kept until the buffer returns to the pool */
+  if (!gst_vaapi_coded_buffer_map (buf, &segment))
+    return TRUE;
+  for (; segment != NULL; segment = segment->next) {
+    if (segment->status & VA_CODED_BUF_STATUS_SLICE_OVERFLOW_MASK)
+      overflow = TRUE;
+    size += segment->size;
+  }
+  if (size >= GST_VAAPI_CODED_BUFFER_ALLOC_SIZE (buf))
+    overflow = TRUE;
+
+  g_mutex_lock (&base_pool->mutex);
+  if (overflow) {
+    GST_WARNING ("coded buffer overflow (%" G_GSIZE_FORMAT " bytes)", size);
+    if (!pool->adaptive) {
+      g_mutex_unlock (&base_pool->mutex);
+      return FALSE;
+    }
+    GST_WARNING ("disabling adaptive coded buffer size");
+    pool->adaptive = FALSE;
+    pool->buf_size = pool->max_size;
+    g_mutex_unlock (&base_pool->mutex);
+    gst_vaapi_video_pool_shrink (base_pool, 0);
+    return FALSE;
+  }
+  if (!pool->adaptive) {
+    g_mutex_unlock (&base_pool->mutex);
+    return TRUE;
+  }
+
+  pool->coded_sizes[pool->num_coded_sizes % CODED_SIZE_WINDOW] = size;
+  if (++pool->num_coded_sizes % CODED_SIZE_WINDOW == 0) {
+    new_size = compute_buffer_size (pool);
+    if (new_size != pool->buf_size)
+      GST_DEBUG ("coded buffer size %" G_GSIZE_FORMAT " -> %" G_GSIZE_FORMAT
+          " bytes", pool->buf_size, new_size);
+    pool->buf_size = new_size;
+  }
+  g_mutex_unlock (&base_pool->mutex);
+  return TRUE;
 }
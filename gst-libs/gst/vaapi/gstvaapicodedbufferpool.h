@@ -40,6 +40,14 @@ gst_vaapi_coded_buffer_pool_new (struct _GstVaapiEncoder * encoder,
 gsize
 gst_vaapi_coded_buffer_pool_get_buffer_size (GstVaapiCodedBufferPool * pool);
 
+void
+gst_vaapi_coded_buffer_pool_set_adaptive (GstVaapiCodedBufferPool * pool,
+    gboolean adaptive);
+
+gboolean
+gst_vaapi_coded_buffer_pool_update (GstVaapiCodedBufferPool * pool,
+    GstVaapiCodedBuffer * buf);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_CODED_BUFFER_POOL_H */
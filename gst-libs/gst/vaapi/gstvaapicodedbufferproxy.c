@@ -43,6 +43,8 @@ static void
 coded_buffer_proxy_finalize (GstVaapiCodedBufferProxy * proxy)
 {
   if (proxy->buffer) {
+    /* Drop any mapping left by gst_vaapi_coded_buffer_proxy_wrap_buffer() */
+    gst_vaapi_coded_buffer_unmap (proxy->buffer);
     if (proxy->pool)
       gst_vaapi_video_pool_put_object (proxy->pool, proxy->buffer);
     gst_vaapi_coded_buffer_unref (proxy->buffer);
@@ -59,9 +61,11 @@ coded_buffer_proxy_finalize (GstVaapiCodedBufferProxy * proxy)
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_coded_buffer_proxy_class (void)
 {
+  static GstVaapiMiniObjectCache GstVaapiCodedBufferProxyCache;
   static const GstVaapiMiniObjectClass GstVaapiCodedBufferProxyClass = {
-    sizeof (GstVaapiCodedBufferProxy),
-    (GDestroyNotify) coded_buffer_proxy_finalize
+    .size = sizeof (GstVaapiCodedBufferProxy),
+    .finalize = (GDestroyNotify) coded_buffer_proxy_finalize,
+    .cache = &GstVaapiCodedBufferProxyCache
   };
   return &GstVaapiCodedBufferProxyClass;
 }
@@ -93,6 +97,8 @@ gst_vaapi_coded_buffer_proxy_new_from_pool (GstVaapiCodedBufferPool * pool)
 
   proxy->destroy_func = NULL;
   proxy->user_data_destroy = NULL;
+  proxy->dropped = FALSE;
+  proxy->failed = FALSE;
   proxy->pool = gst_vaapi_video_pool_ref (GST_VAAPI_VIDEO_POOL (pool));
   proxy->buffer = gst_vaapi_video_pool_get_object (proxy->pool);
   if (!proxy->buffer)
@@ -254,3 +260,93 @@ gst_vaapi_coded_buffer_proxy_set_user_data (GstVaapiCodedBufferProxy * proxy,
 
   coded_buffer_proxy_set_user_data (proxy, user_data, destroy_func);
 }
+
+/* Shared by the memories of a wrapped buffer, which can outlive the
+ * GstBuffer itself when they are shared with other buffers */
+typedef struct
+{
+  gint ref_count;
+  GstVaapiCodedBufferProxy *proxy;
+  GDestroyNotify release_func;
+  gpointer user_data;
+} WrappedMemoryData;
+
+static void
+wrapped_memory_release (WrappedMemoryData * data)
+{
+  if (!g_atomic_int_dec_and_test (&data->ref_count))
+    return;
+
+  gst_vaapi_coded_buffer_proxy_unref (data->proxy);
+  if (data->release_func)
+    data->release_func (data->user_data);
+  g_slice_free (WrappedMemoryData, data);
+}
+
+/**
+ * gst_vaapi_coded_buffer_proxy_wrap_buffer:
+ * @proxy: a #GstVaapiCodedBufferProxy
+ * @release_func: (nullable): a #GDestroyNotify function
+ * @user_data: some extra data to pass to the @release_func function
+ *
+ * Creates a #GstBuffer whose memories directly wrap the mapped
+ * segments of the underlying VA coded buffer, i.e. without copying
+ * the encoded bitstream into system memory.
+ *
+ * The memories hold a reference to @proxy, so the VA coded buffer
+ * stays mapped and is only unmapped, and pushed back to its parent
+ * pool, once the last memory is released. @release_func is called
+ * at that point, and not when the returned #GstBuffer is freed,
+ * since its memories may be shared with other buffers.
+ *
+ * Return value: (transfer full): the newly allocated #GstBuffer, or
+ *   %NULL if an error occurred, in which case @release_func is not
+ *   called
+ */
+GstBuffer *
+gst_vaapi_coded_buffer_proxy_wrap_buffer (GstVaapiCodedBufferProxy * proxy,
+    GDestroyNotify release_func, gpointer user_data)
+{
+  VACodedBufferSegment *segment;
+  WrappedMemoryData *data;
+  GstBuffer *buffer;
+  GstMemory *mem;
+
+  g_return_val_if_fail (proxy != NULL, NULL);
+  g_return_val_if_fail (proxy->buffer != NULL, NULL);
+
+  if (!gst_vaapi_coded_buffer_map (proxy->buffer, &segment))
+    return NULL;
+
+  data = g_slice_new (WrappedMemoryData);
+  data->ref_count = 0;
+  data->proxy = gst_vaapi_coded_buffer_proxy_ref (proxy);
+  data->release_func = release_func;
+  data->user_data = user_data;
+
+  buffer = gst_buffer_new ();
+  for (; segment != NULL; segment = segment->next) {
+    if (segment->size == 0)
+      continue;
+    g_atomic_int_inc (&data->ref_count);
+    mem = gst_memory_new_wrapped (0, segment->buf, segment->size, 0,
+        segment->size, data, (GDestroyNotify) wrapped_memory_release);
+    gst_buffer_append_memory (buffer, mem);
+  }
+
+  if (gst_buffer_n_memory (buffer) == 0)
+    goto error_empty;
+  return buffer;
+
+  /* ERRORS */
+error_empty:
+  {
+    GST_ERROR ("coded buffer %" GST_VAAPI_ID_FORMAT " has no data",
+        GST_VAAPI_ID_ARGS (GST_VAAPI_CODED_BUFFER_ID (proxy->buffer)));
+    gst_buffer_unref (buffer);
+    gst_vaapi_coded_buffer_unmap (proxy->buffer);
+    gst_vaapi_coded_buffer_proxy_unref (data->proxy);
+    g_slice_free (WrappedMemoryData, data);
+    return NULL;
+  }
+}
@@ -77,6 +77,10 @@ void
 gst_vaapi_coded_buffer_proxy_set_user_data (GstVaapiCodedBufferProxy * proxy,
     gpointer user_data, GDestroyNotify destroy_func);
 
+GstBuffer *
+gst_vaapi_coded_buffer_proxy_wrap_buffer (GstVaapiCodedBufferProxy * proxy,
+    GDestroyNotify release_func, gpointer user_data);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_CODED_BUFFER_PROXY_H */
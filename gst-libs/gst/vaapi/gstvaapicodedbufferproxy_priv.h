@@ -42,6 +42,9 @@ struct _GstVaapiCodedBufferProxy
   gpointer              destroy_data;
   GDestroyNotify        user_data_destroy;
   gpointer              user_data;
+  gboolean              dropped;
+  /* the picture could not be encoded, and holds no valid data */
+  gboolean              failed;
 };
 
 /**
@@ -36,13 +36,35 @@
 #include "gstvaapisurfaceproxy.h"
 #include "gstvaapivideopool_priv.h"
 #include "gstvaapiutils.h"
+#include "gstvaapiutils_core.h"
+#include "gstvaapitrace.h"
+#include "gstvaapivarecord.h"
 
 /* Define default VA surface chroma format to YUV 4:2:0 */
 #define DEFAULT_CHROMA_TYPE (GST_VAAPI_CHROMA_TYPE_YUV420)
 
-/* Number of scratch surfaces beyond those used as reference */
+/* Number of scratch surfaces beyond those used as reference, unless
+   the context user knows better */
 #define SCRATCH_SURFACES_COUNT (4)
 
+#define get_num_surfaces(cip) ((cip)->ref_frames + \
+    ((cip)->extra_surfaces ? (cip)->extra_surfaces : SCRATCH_SURFACES_COUNT))
+
+/* Number of seconds without any surface request after which the free
+   surfaces of an on-demand decoding context are released */
+#define IDLE_TIMEOUT (2)
+
+/* Number of seconds after which a parked context is destroyed, if no
+   new stream took it over */
+#define CONTEXT_CACHE_TIMEOUT (60)
+
+/* The priority serial a VA context of a GstVaapiContext was updated to */
+typedef struct
+{
+  VAContextID id;
+  gint serial;
+} ContextPriorityState;
+
 /* Debug category for GstVaapiContext */
 GST_DEBUG_CATEGORY (gst_debug_vaapi_context);
 #define GST_CAT_DEFAULT gst_debug_vaapi_context
@@ -61,6 +83,117 @@ _init_vaapi_context_debug (void)
 #endif
 }
 
+/* Decoding contexts allocating their surfaces on demand, per display */
+static GMutex g_on_demand_contexts_lock;
+
+static GQuark
+on_demand_contexts_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    const GQuark quark =
+        g_quark_from_static_string ("GstVaapiOnDemandContexts");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+static inline gint
+get_monotonic_seconds (void)
+{
+  return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
+
+static void
+on_demand_contexts_add (GstVaapiContext * context)
+{
+  GObject *const display = G_OBJECT (GST_VAAPI_CONTEXT_DISPLAY (context));
+  GList *contexts;
+
+  g_mutex_lock (&g_on_demand_contexts_lock);
+  contexts = g_object_steal_qdata (display, on_demand_contexts_quark ());
+  contexts = g_list_prepend (contexts, context);
+  g_object_set_qdata (display, on_demand_contexts_quark (), contexts);
+  g_mutex_unlock (&g_on_demand_contexts_lock);
+}
+
+static void
+on_demand_contexts_remove (GstVaapiContext * context)
+{
+  GObject *const display = G_OBJECT (GST_VAAPI_CONTEXT_DISPLAY (context));
+  GList *contexts;
+
+  g_mutex_lock (&g_on_demand_contexts_lock);
+  contexts = g_object_steal_qdata (display, on_demand_contexts_quark ());
+  contexts = g_list_remove (contexts, context);
+  g_object_set_qdata (display, on_demand_contexts_quark (), contexts);
+  g_mutex_unlock (&g_on_demand_contexts_lock);
+}
+
+/* Releases the free surfaces of the on-demand decoding contexts of
+   @display, but @self, that did not request any surface lately */
+static guint
+on_demand_contexts_release_idle (GstVaapiDisplay * display,
+    GstVaapiContext * self)
+{
+  const gint now = get_monotonic_seconds ();
+  GList *l;
+  guint num_released = 0;
+
+  g_mutex_lock (&g_on_demand_contexts_lock);
+  l = g_object_get_qdata (G_OBJECT (display), on_demand_contexts_quark ());
+  for (; l != NULL; l = l->next) {
+    GstVaapiContext *const context = l->data;
+
+    if (context == self || !context->surfaces_pool)
+      continue;
+    if (now - g_atomic_int_get (&context->last_activity) < IDLE_TIMEOUT)
+      continue;
+    num_released += gst_vaapi_video_pool_shrink (context->surfaces_pool, 0);
+  }
+  g_mutex_unlock (&g_on_demand_contexts_lock);
+
+  if (num_released > 0)
+    GST_DEBUG ("released %u surfaces of idle contexts", num_released);
+  return num_released;
+}
+
+/* Estimates the size of the surfaces allocated by @context */
+static guint64
+context_get_surface_size (GstVaapiContext * context)
+{
+  const GstVaapiContextInfo *const cip = &context->info;
+  GstVideoFormat format;
+  GstVideoInfo vi;
+
+  format = context->preferred_format;
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    format = gst_vaapi_video_format_from_chroma (cip->chroma_type);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    format = GST_VIDEO_FORMAT_NV12;
+
+  gst_video_info_init (&vi);
+  if (!gst_video_info_set_format (&vi, format, cip->width, cip->height))
+    return 0;
+  return GST_VIDEO_INFO_SIZE (&vi);
+}
+
+/* Checks whether @n more surfaces of @context fit into the display
+   memory budget, releasing the surfaces of idle contexts if needed */
+static gboolean
+context_fits_memory_budget (GstVaapiContext * context, guint n)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
+  const guint64 size = n * context_get_surface_size (context);
+
+  if (gst_vaapi_display_fits_memory_budget (display, size))
+    return TRUE;
+  if (!on_demand_contexts_release_idle (display, context))
+    return FALSE;
+  return gst_vaapi_display_fits_memory_budget (display, size);
+}
+
 static inline gboolean
 _context_is_broken_jpeg_decoder (GstVaapiContext * context)
 {
@@ -144,7 +277,74 @@ context_destroy_surfaces (GstVaapiContext * context)
 
   context->preferred_format = GST_VIDEO_FORMAT_UNKNOWN;
 
+  g_mutex_lock (&g_on_demand_contexts_lock);
   gst_vaapi_video_pool_replace (&context->surfaces_pool, NULL);
+  g_mutex_unlock (&g_on_demand_contexts_lock);
+}
+
+/* Destroys the auxiliary VA contexts beyond the first @num_ids */
+static void
+context_destroy_aux_ids (GstVaapiContext * context, guint num_ids)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
+  VAStatus status;
+  GstClockTime record_start;
+
+  while (context->aux_ids->len > num_ids) {
+    const guint i = context->aux_ids->len - 1;
+    VAContextID const context_id =
+        g_array_index (context->aux_ids, VAContextID, i);
+
+    GST_VAAPI_DISPLAY_LOCK (display);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
+    status = vaDestroyContext (GST_VAAPI_DISPLAY_VADISPLAY (display),
+        context_id);
+    GST_VAAPI_VA_RECORD_END (record_start,
+        GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_DESTROY_CONTEXT, status, context_id);
+    GST_VAAPI_DISPLAY_UNLOCK (display);
+    if (!vaapi_check_status (status, "vaDestroyContext()"))
+      GST_WARNING ("failed to destroy context 0x%08x", context_id);
+    g_array_set_size (context->aux_ids, i);
+  }
+}
+
+/* Creates the missing auxiliary VA contexts, on the same config as
+   the main one. Decoders do not bind surfaces to contexts, so any of
+   them can decode into the context surfaces. Failures are not fatal:
+   the context then simply has fewer ids */
+static void
+context_create_aux_ids (GstVaapiContext * context)
+{
+  const GstVaapiContextInfo *const cip = &context->info;
+  GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
+  VAContextID context_id = VA_INVALID_ID;
+  VAStatus status;
+  GstClockTime record_start;
+
+  if (cip->usage != GST_VAAPI_CONTEXT_USAGE_DECODE
+      || GST_VAAPI_CONTEXT_ID (context) == VA_INVALID_ID)
+    return;
+
+  while (context->aux_ids->len < context->num_aux_ids) {
+    GST_VAAPI_DISPLAY_LOCK (display);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
+    status = vaCreateContext (GST_VAAPI_DISPLAY_VADISPLAY (display),
+        context->va_config, cip->width, cip->height, VA_PROGRESSIVE,
+        NULL, 0, &context_id);
+    GST_VAAPI_VA_RECORD_END (record_start,
+        GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_CREATE_CONTEXT, status, context->va_config,
+        cip->width, cip->height, VA_PROGRESSIVE, context_id);
+    GST_VAAPI_DISPLAY_UNLOCK (display);
+    if (!vaapi_check_status (status, "vaCreateContext()")) {
+      GST_WARNING ("only %u auxiliary contexts could be created",
+          context->aux_ids->len);
+      context->num_aux_ids = context->aux_ids->len;
+      break;
+    }
+    g_array_append_val (context->aux_ids, context_id);
+  }
 }
 
 static void
@@ -153,14 +353,21 @@ context_destroy (GstVaapiContext * context)
   GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
   VAContextID context_id;
   VAStatus status;
+  GstClockTime record_start;
+
+  context_destroy_aux_ids (context, 0);
 
   context_id = GST_VAAPI_CONTEXT_ID (context);
   GST_DEBUG ("context 0x%08x / config 0x%08x", context_id, context->va_config);
 
   if (context_id != VA_INVALID_ID) {
     GST_VAAPI_DISPLAY_LOCK (display);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
     status = vaDestroyContext (GST_VAAPI_DISPLAY_VADISPLAY (display),
         context_id);
+    GST_VAAPI_VA_RECORD_END (record_start,
+        GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_DESTROY_CONTEXT, status, context_id);
     GST_VAAPI_DISPLAY_UNLOCK (display);
     if (!vaapi_check_status (status, "vaDestroyContext()"))
       GST_WARNING ("failed to destroy context 0x%08x", context_id);
@@ -169,8 +376,12 @@ context_destroy (GstVaapiContext * context)
 
   if (context->va_config != VA_INVALID_ID) {
     GST_VAAPI_DISPLAY_LOCK (display);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
     status = vaDestroyConfig (GST_VAAPI_DISPLAY_VADISPLAY (display),
         context->va_config);
+    GST_VAAPI_VA_RECORD_END (record_start,
+        GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_DESTROY_CONFIG, status, context->va_config);
     GST_VAAPI_DISPLAY_UNLOCK (display);
     if (!vaapi_check_status (status, "vaDestroyConfig()"))
       GST_WARNING ("failed to destroy config 0x%08x", context->va_config);
@@ -183,22 +394,233 @@ context_destroy (GstVaapiContext * context)
   }
 }
 
+/* Released contexts parked for the next streams, per display, the
+   most recently parked first. See GstVaapiDisplay:context-cache-size */
+static GMutex g_context_cache_lock;
+
+static GQuark
+context_cache_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    const GQuark quark = g_quark_from_static_string ("GstVaapiContextCache");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+/* Called with g_context_cache_lock held */
+static GQueue *
+context_cache_get (GstVaapiDisplay * display, gboolean create)
+{
+  GQueue *cache;
+
+  cache = g_object_get_qdata (G_OBJECT (display), context_cache_quark ());
+  if (!cache && create) {
+    cache = g_queue_new ();
+    g_object_set_qdata_full (G_OBJECT (display), context_cache_quark (),
+        cache, (GDestroyNotify) g_queue_free);
+  }
+  return cache;
+}
+
+/* Moves the parked contexts beyond @max_size, or parked for too long,
+   to @expired. Called with g_context_cache_lock held */
+static void
+context_cache_expire (GQueue * cache, guint max_size, GQueue * expired)
+{
+  const gint now = get_monotonic_seconds ();
+  GList *l, *next;
+
+  while (cache->length > max_size)
+    g_queue_push_tail (expired, g_queue_pop_tail (cache));
+
+  for (l = cache->head; l != NULL; l = next) {
+    GstVaapiContext *const context = l->data;
+
+    next = l->next;
+    if (now - g_atomic_int_get (&context->last_activity) <
+        CONTEXT_CACHE_TIMEOUT)
+      continue;
+    g_queue_unlink (cache, l);
+    g_queue_push_tail_link (expired, l);
+  }
+}
+
+static void context_free (GstVaapiContext * context);
+
+static void
+context_free_expired (GQueue * expired)
+{
+  GstVaapiContext *context;
+
+  while ((context = g_queue_pop_head (expired))) {
+    GST_DEBUG ("destroying parked context 0x%08" G_GSIZE_MODIFIER "x",
+        GST_VAAPI_CONTEXT_ID (context));
+    context_free (context);
+  }
+}
+
+/* Whether the parked context @context can serve as a new context
+   described by @cip */
+static gboolean
+context_cache_matches (GstVaapiContext * context,
+    const GstVaapiContextInfo * cip)
+{
+  const GstVaapiContextInfo *const info = &context->info;
+  const GstVaapiChromaType chroma_type = cip->chroma_type ?
+      cip->chroma_type : DEFAULT_CHROMA_TYPE;
+
+  if (info->usage != cip->usage || info->profile != cip->profile
+      || info->entrypoint != cip->entrypoint
+      || info->chroma_type != chroma_type
+      || info->width != cip->width || info->height != cip->height
+      || info->surface_alloc_flags != cip->surface_alloc_flags
+      || get_num_surfaces (info) < get_num_surfaces (cip))
+    return FALSE;
+
+  if (cip->usage == GST_VAAPI_CONTEXT_USAGE_ENCODE) {
+    const GstVaapiConfigInfoEncoder *const a = &info->config.encoder;
+    const GstVaapiConfigInfoEncoder *const b = &cip->config.encoder;
+
+    if (a->rc_mode != b->rc_mode || a->packed_headers != b->packed_headers
+        || a->roi_capability != b->roi_capability
+        || a->roi_num_supported != b->roi_num_supported)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Parks @context, whose last reference was just released, into the
+   cache of its display. Returns %FALSE if it is not to be kept */
+static gboolean
+context_cache_park (GstVaapiContext * context)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
+  GQueue expired = G_QUEUE_INIT;
+  GQueue *cache;
+  guint max_size;
+
+  if (context->on_demand || GST_VAAPI_CONTEXT_ID (context) == VA_INVALID_ID)
+    return FALSE;
+  max_size = gst_vaapi_display_get_context_cache_size (display);
+  if (max_size == 0)
+    return FALSE;
+
+  /* Auxiliary contexts are only created on request */
+  context_destroy_aux_ids (context, 0);
+  context->num_aux_ids = 0;
+  context->info.owner = NULL;
+  g_atomic_int_set (&context->last_activity, get_monotonic_seconds ());
+  GST_DEBUG ("parking context 0x%08" G_GSIZE_MODIFIER "x",
+      GST_VAAPI_CONTEXT_ID (context));
+
+  g_mutex_lock (&g_context_cache_lock);
+  cache = context_cache_get (display, TRUE);
+  g_queue_push_head (cache, context);
+  context_cache_expire (cache, max_size, &expired);
+  g_mutex_unlock (&g_context_cache_lock);
+
+  context_free_expired (&expired);
+  return TRUE;
+}
+
+/* Takes a parked context matching @cip out of the cache of @display */
+static GstVaapiContext *
+context_cache_take (GstVaapiDisplay * display, const GstVaapiContextInfo * cip)
+{
+  GstVaapiContext *context = NULL;
+  GQueue expired = G_QUEUE_INIT;
+  GQueue *cache;
+  GList *l;
+
+  g_mutex_lock (&g_context_cache_lock);
+  cache = context_cache_get (display, FALSE);
+  if (cache) {
+    context_cache_expire (cache,
+        gst_vaapi_display_get_context_cache_size (display), &expired);
+    for (l = cache->head; l != NULL; l = l->next) {
+      if (context_cache_matches (l->data, cip)) {
+        context = l->data;
+        g_queue_delete_link (cache, l);
+        break;
+      }
+    }
+  }
+  g_mutex_unlock (&g_context_cache_lock);
+
+  context_free_expired (&expired);
+  if (!context)
+    return NULL;
+
+  g_atomic_int_set (&context->ref_count, 1);
+  g_atomic_int_set (&context->last_activity, get_monotonic_seconds ());
+  context->info.owner = cip->owner;
+  context->reset_on_resize = TRUE;
+  gst_vaapi_context_set_surface_tracking (context, FALSE);
+  gst_vaapi_context_set_starvation_recovery (context, 0);
+  gst_vaapi_context_set_surface_func (context, NULL, NULL);
+  gst_vaapi_context_set_priority (context, GST_VAAPI_PRIORITY_DEFAULT);
+  g_atomic_int_set (&context->num_starvations, 0);
+  g_atomic_int_set (&context->num_recoveries, 0);
+  GST_DEBUG ("reusing parked context 0x%08" G_GSIZE_MODIFIER "x",
+      GST_VAAPI_CONTEXT_ID (context));
+  return context;
+}
+
+/**
+ * gst_vaapi_context_cache_trim:
+ * @display: a #GstVaapiDisplay
+ * @max_size: the number of parked contexts to keep
+ *
+ * Destroys the contexts parked on @display beyond the @max_size most
+ * recent ones, and those parked for too long.
+ */
+void
+gst_vaapi_context_cache_trim (GstVaapiDisplay * display, guint max_size)
+{
+  GQueue expired = G_QUEUE_INIT;
+  GQueue *cache;
+
+  g_return_if_fail (display != NULL);
+
+  g_mutex_lock (&g_context_cache_lock);
+  cache = context_cache_get (display, FALSE);
+  if (cache)
+    context_cache_expire (cache, max_size, &expired);
+  g_mutex_unlock (&g_context_cache_lock);
+
+  context_free_expired (&expired);
+}
+
 static gboolean
 context_ensure_surfaces (GstVaapiContext * context)
 {
   GstVaapiDisplay *display = GST_VAAPI_CONTEXT_DISPLAY (context);
   const GstVaapiContextInfo *const cip = &context->info;
-  const guint num_surfaces = cip->ref_frames + SCRATCH_SURFACES_COUNT;
+  const guint num_surfaces = get_num_surfaces (cip);
   GstVaapiSurface *surface;
   GstVideoFormat format;
+  GstClockTime trace_start;
   guint i, capacity;
 
   ensure_preferred_format (context);
+
+  /* Surfaces are allocated by the pool as the decoder requests them */
+  if (context->on_demand) {
+    if (!context_fits_memory_budget (context, num_surfaces))
+      goto error_memory_budget;
+    gst_vaapi_video_pool_set_capacity (context->surfaces_pool, 0);
+    return TRUE;
+  }
+
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
   format = context->preferred_format;
   for (i = context->surfaces->len; i < num_surfaces; i++) {
     if (format != GST_VIDEO_FORMAT_UNKNOWN) {
       surface = gst_vaapi_surface_new_with_format (display, format, cip->width,
-          cip->height, 0);
+          cip->height, cip->surface_alloc_flags);
     } else {
       surface = gst_vaapi_surface_new (display, cip->chroma_type, cip->width,
           cip->height);
@@ -209,10 +631,20 @@ context_ensure_surfaces (GstVaapiContext * context)
     if (!gst_vaapi_video_pool_add_object (context->surfaces_pool, surface))
       return FALSE;
   }
+  GST_VAAPI_TRACE_END (trace_start, cip->owner, GST_VAAPI_TRACE_STAGE_SURFACES,
+      GST_CLOCK_TIME_NONE);
 
   capacity = cip->usage == GST_VAAPI_CONTEXT_USAGE_DECODE ? 0 : num_surfaces;
   gst_vaapi_video_pool_set_capacity (context->surfaces_pool, capacity);
   return TRUE;
+
+  /* ERRORS */
+error_memory_budget:
+  {
+    GST_ERROR ("%u surfaces of %ux%u do not fit into the memory budget",
+        num_surfaces, cip->width, cip->height);
+    return FALSE;
+  }
 }
 
 static gboolean
@@ -222,7 +654,7 @@ context_create_surfaces (GstVaapiContext * context)
   GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
   guint num_surfaces;
 
-  num_surfaces = cip->ref_frames + SCRATCH_SURFACES_COUNT;
+  num_surfaces = get_num_surfaces (cip);
   if (!context->surfaces) {
     context->surfaces = g_ptr_array_new_full (num_surfaces,
         (GDestroyNotify) gst_mini_object_unref);
@@ -231,12 +663,27 @@ context_create_surfaces (GstVaapiContext * context)
   }
 
   if (!context->surfaces_pool) {
-    context->surfaces_pool =
-        gst_vaapi_surface_pool_new_with_chroma_type (display, cip->chroma_type,
-        cip->width, cip->height, 0);
+    GstVaapiVideoPool *pool = NULL;
 
-    if (!context->surfaces_pool)
+    ensure_preferred_format (context);
+    if (context->on_demand
+        && context->preferred_format != GST_VIDEO_FORMAT_UNKNOWN) {
+      pool = gst_vaapi_surface_pool_new (display, context->preferred_format,
+          cip->width, cip->height, cip->surface_alloc_flags);
+    }
+    if (!pool) {
+      pool = gst_vaapi_surface_pool_new_with_chroma_type (display,
+          cip->chroma_type, cip->width, cip->height, cip->surface_alloc_flags);
+    }
+    if (!pool)
       return FALSE;
+    if (context->track_surfaces)
+      gst_vaapi_video_pool_set_tracking (pool, TRUE);
+    context->num_grown_surfaces = 0;
+
+    g_mutex_lock (&g_on_demand_contexts_lock);
+    context->surfaces_pool = pool;
+    g_mutex_unlock (&g_on_demand_contexts_lock);
   }
   return context_ensure_surfaces (context);
 }
@@ -246,10 +693,11 @@ context_create (GstVaapiContext * context)
 {
   const GstVaapiContextInfo *const cip = &context->info;
   GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
-  VAContextID context_id;
+  VAContextID context_id = VA_INVALID_ID;
   VASurfaceID surface_id;
   VASurfaceID *surfaces_data = NULL;
   VAStatus status;
+  GstClockTime record_start, trace_start;
   GArray *surfaces = NULL;
   gboolean success = FALSE;
   guint i;
@@ -283,15 +731,26 @@ context_create (GstVaapiContext * context)
     num_surfaces = surfaces->len;
   }
 
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
   GST_VAAPI_DISPLAY_LOCK (display);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaCreateContext (GST_VAAPI_DISPLAY_VADISPLAY (display),
       context->va_config, cip->width, cip->height, VA_PROGRESSIVE,
       surfaces_data, num_surfaces, &context_id);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_VA_RECORD_CREATE_CONTEXT, status, surfaces_data, num_surfaces,
+      context->va_config, cip->width, cip->height, VA_PROGRESSIVE,
+      context_id);
   GST_VAAPI_DISPLAY_UNLOCK (display);
   if (!vaapi_check_status (status, "vaCreateContext()"))
     goto cleanup;
+  GST_VAAPI_TRACE_END (trace_start, cip->owner, GST_VAAPI_TRACE_STAGE_CONTEXT,
+      GST_CLOCK_TIME_NONE);
 
   GST_VAAPI_CONTEXT_ID (context) = context_id;
+  context_create_aux_ids (context);
+  g_array_set_size (context->priority_applied, 0);
   success = TRUE;
 
 cleanup:
@@ -308,11 +767,13 @@ config_create (GstVaapiContext * context)
   VAConfigAttrib attribs[7], *attrib;
   VAStatus status;
   guint value, va_chroma_format, attrib_index;
+  GstClockTime record_start, trace_start;
 
   /* Reset profile and entrypoint */
   if (cip->profile == GST_VAAPI_PROFILE_UNKNOWN
       || cip->entrypoint == GST_VAAPI_ENTRYPOINT_INVALID)
     goto cleanup;
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
   context->va_profile = gst_vaapi_profile_get_va_profile (cip->profile);
   context->va_entrypoint =
       gst_vaapi_entrypoint_get_va_entrypoint (cip->entrypoint);
@@ -415,13 +876,27 @@ config_create (GstVaapiContext * context)
   }
 
   GST_VAAPI_DISPLAY_LOCK (display);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaCreateConfig (GST_VAAPI_DISPLAY_VADISPLAY (display),
       context->va_profile, context->va_entrypoint, attribs, attrib_index,
       &context->va_config);
+  if (GST_CLOCK_TIME_IS_VALID (record_start)) {
+    const guint32 record_args[] = { context->va_profile,
+      context->va_entrypoint, context->va_config
+    };
+    gst_vaapi_va_record (GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_CREATE_CONFIG, status, record_start, record_args,
+        G_N_ELEMENTS (record_args), NULL, 0, attribs,
+        attrib_index * sizeof (VAConfigAttrib));
+  }
   GST_VAAPI_DISPLAY_UNLOCK (display);
   if (!vaapi_check_status (status, "vaCreateConfig()"))
     goto cleanup;
+  GST_VAAPI_TRACE_END (trace_start, cip->owner, GST_VAAPI_TRACE_STAGE_CONFIG,
+      GST_CLOCK_TIME_NONE);
 
+  context->priority_max = gst_vaapi_get_context_priority_max (display,
+      context->va_profile, context->va_entrypoint);
   return TRUE;
 cleanup:
   GST_WARNING ("Failed to create vaConfig");
@@ -473,6 +948,11 @@ gst_vaapi_context_init (GstVaapiContext * context,
 
   context->attribs = NULL;
   context->preferred_format = GST_VIDEO_FORMAT_UNKNOWN;
+
+  /* Decoders only allocate surfaces as needed under a memory budget */
+  context->on_demand = cip->usage == GST_VAAPI_CONTEXT_USAGE_DECODE &&
+      gst_vaapi_display_get_memory_budget (context->display) > 0;
+  g_atomic_int_set (&context->last_activity, get_monotonic_seconds ());
 }
 
 /**
@@ -500,6 +980,12 @@ gst_vaapi_context_new (GstVaapiDisplay * display,
       || cip->entrypoint == GST_VAAPI_ENTRYPOINT_INVALID)
     return NULL;
 
+  if (cip->width > 0 && cip->height > 0) {
+    context = context_cache_take (display, cip);
+    if (context)
+      return context;
+  }
+
   context = g_slice_new (GstVaapiContext);
   if (!context)
     return NULL;
@@ -509,8 +995,24 @@ gst_vaapi_context_new (GstVaapiDisplay * display,
   g_atomic_int_set (&context->ref_count, 1);
   context->surfaces = NULL;
   context->surfaces_pool = NULL;
+  context->aux_ids = g_array_new (FALSE, FALSE, sizeof (VAContextID));
+  context->num_aux_ids = 0;
+  context->track_surfaces = FALSE;
+  context->num_grown_surfaces = 0;
+  context->max_grown_surfaces = 0;
+  context->num_starvations = 0;
+  context->num_recoveries = 0;
+  context->surface_func = NULL;
+  context->surface_data = NULL;
+  context->priority_max = 0;
+  context->priority_value = -1;
+  context->priority_serial = 0;
+  context->priority_applied = g_array_new (FALSE, FALSE,
+      sizeof (ContextPriorityState));
 
   gst_vaapi_context_init (context, cip);
+  if (context->on_demand)
+    on_demand_contexts_add (context);
 
   if (!config_create (context))
     goto error;
@@ -539,6 +1041,21 @@ error:
   }
 }
 
+/* Checks whether the allocated surfaces can hold @width x @height
+   pictures */
+static gboolean
+context_surfaces_fit (GstVaapiContext * context, guint width, guint height)
+{
+  GstVaapiSurface *surface;
+
+  if (!context->surfaces || context->surfaces->len == 0)
+    return FALSE;
+
+  surface = g_ptr_array_index (context->surfaces, 0);
+  return GST_VAAPI_SURFACE_WIDTH (surface) >= width &&
+      GST_VAAPI_SURFACE_HEIGHT (surface) >= height;
+}
+
 /**
  * gst_vaapi_context_reset:
  * @context: a #GstVaapiContext
@@ -570,10 +1087,19 @@ gst_vaapi_context_reset (GstVaapiContext * context,
     reset_surfaces = TRUE;
   }
 
+  if (cip->surface_alloc_flags != new_cip->surface_alloc_flags) {
+    cip->surface_alloc_flags = new_cip->surface_alloc_flags;
+    reset_surfaces = TRUE;
+  }
+
   if (cip->width != new_cip->width || cip->height != new_cip->height) {
+    /* Encoders can keep on using larger surfaces for smaller pictures */
+    if (context->reset_on_resize
+        || new_cip->usage != GST_VAAPI_CONTEXT_USAGE_ENCODE
+        || !context_surfaces_fit (context, new_cip->width, new_cip->height))
+      reset_surfaces = TRUE;
     cip->width = new_cip->width;
     cip->height = new_cip->height;
-    reset_surfaces = TRUE;
   }
 
   if (cip->profile != new_cip->profile ||
@@ -583,10 +1109,11 @@ gst_vaapi_context_reset (GstVaapiContext * context,
     reset_config = TRUE;
   }
 
-  if (cip->ref_frames < new_cip->ref_frames) {
-    cip->ref_frames = new_cip->ref_frames;
+  if (get_num_surfaces (cip) < get_num_surfaces (new_cip))
     grow_surfaces = TRUE;
-  }
+  cip->ref_frames = MAX (cip->ref_frames, new_cip->ref_frames);
+  cip->extra_surfaces = new_cip->extra_surfaces;
+  cip->owner = new_cip->owner;
 
   if (cip->usage != new_cip->usage) {
     cip->usage = new_cip->usage;
@@ -630,6 +1157,160 @@ gst_vaapi_context_get_id (GstVaapiContext * context)
   return GST_VAAPI_CONTEXT_ID (context);
 }
 
+/**
+ * gst_vaapi_context_set_num_ids:
+ * @context: a #GstVaapiContext
+ * @num_ids: the number of VA contexts wanted, at least 1
+ *
+ * Creates or destroys auxiliary VA contexts, sharing the config and
+ * surfaces of the main one, so that independent pictures can be
+ * submitted to several contexts at once, and possibly run on several
+ * engines. Only decoding contexts support this. The auxiliary
+ * contexts are re-created along with the main one on reset.
+ *
+ * Return value: the number of VA contexts actually available
+ */
+guint
+gst_vaapi_context_set_num_ids (GstVaapiContext * context, guint num_ids)
+{
+  g_return_val_if_fail (context != NULL, 0);
+  g_return_val_if_fail (num_ids > 0, 0);
+
+  if (context->info.usage != GST_VAAPI_CONTEXT_USAGE_DECODE)
+    num_ids = 1;
+
+  context->num_aux_ids = num_ids - 1;
+  context_destroy_aux_ids (context, context->num_aux_ids);
+  context_create_aux_ids (context);
+  /* VA context ids may be reused by the new contexts */
+  g_array_set_size (context->priority_applied, 0);
+  return gst_vaapi_context_get_num_ids (context);
+}
+
+/**
+ * gst_vaapi_context_get_num_ids:
+ * @context: a #GstVaapiContext
+ *
+ * Return value: the number of VA contexts of @context, including the
+ *   main one
+ */
+guint
+gst_vaapi_context_get_num_ids (GstVaapiContext * context)
+{
+  g_return_val_if_fail (context != NULL, 0);
+
+  return 1 + context->aux_ids->len;
+}
+
+/**
+ * gst_vaapi_context_get_nth_id:
+ * @context: a #GstVaapiContext
+ * @index: the VA context index, zero being the main one
+ *
+ * Return value: the @index-th VAContextID of @context
+ */
+GstVaapiID
+gst_vaapi_context_get_nth_id (GstVaapiContext * context, guint index)
+{
+  g_return_val_if_fail (context != NULL, VA_INVALID_ID);
+
+  if (index == 0)
+    return GST_VAAPI_CONTEXT_ID (context);
+  g_return_val_if_fail (index <= context->aux_ids->len, VA_INVALID_ID);
+  return g_array_index (context->aux_ids, VAContextID, index - 1);
+}
+
+/* Trims the surfaces of an on-demand decoding context after an idle
+   period, and stops its growth while the display memory budget is
+   exceeded. The decoder then waits for a surface to be released */
+static void
+context_update_on_demand_pool (GstVaapiContext * context)
+{
+  GstVaapiVideoPool *const pool = context->surfaces_pool;
+  const guint num_surfaces = get_num_surfaces (&context->info);
+  const gint now = get_monotonic_seconds ();
+  guint num_used, num_allocated, capacity = 0;
+
+  num_used = g_atomic_int_get (&pool->used_count);
+  if (now - g_atomic_int_get (&context->last_activity) >= IDLE_TIMEOUT) {
+    gst_vaapi_video_pool_shrink (pool, num_used + 1);
+    context->num_grown_surfaces = 0;
+  }
+  g_atomic_int_set (&context->last_activity, now);
+
+  num_allocated = num_used + gst_vaapi_video_pool_get_size (pool);
+  if (gst_vaapi_video_pool_get_size (pool) == 0
+      && !context_fits_memory_budget (context, 1)) {
+    capacity = MAX (num_allocated, num_surfaces);
+    GST_LOG ("memory budget exceeded, limiting context to %u surfaces",
+        capacity);
+  }
+  gst_vaapi_video_pool_set_capacity (pool, capacity);
+}
+
+/* Gives the surfaces allocated by context_recover_starvation() back
+   once fewer surfaces than the original capacity are in use */
+static void
+context_release_grown_surfaces (GstVaapiContext * context)
+{
+  GstVaapiVideoPool *const pool = context->surfaces_pool;
+  guint capacity;
+
+  capacity = gst_vaapi_video_pool_get_capacity (pool);
+  if (capacity <= context->num_grown_surfaces)
+    return;
+  capacity -= context->num_grown_surfaces;
+  if (g_atomic_int_get (&pool->used_count) >= capacity)
+    return;
+
+  GST_DEBUG ("starvation is over, shrinking the pool back to %u surfaces",
+      capacity);
+  gst_vaapi_video_pool_set_capacity (pool, capacity);
+  gst_vaapi_video_pool_shrink (pool, capacity);
+  context->num_grown_surfaces = 0;
+}
+
+/* Called when the pool is full: allocates one more surface if
+   starvation recovery allows, instead of letting the caller wait */
+static GstVaapiSurfaceProxy *
+context_recover_starvation (GstVaapiContext * context)
+{
+  GstVaapiVideoPool *const pool = context->surfaces_pool;
+  GstVaapiSurfaceProxy *proxy;
+  GstClockTime oldest_age = 0;
+  const gchar *oldest_holder = NULL;
+  guint capacity;
+
+  g_atomic_int_inc (&context->num_starvations);
+
+  /* Unbounded pools only fail on allocation errors */
+  capacity = gst_vaapi_video_pool_get_capacity (pool);
+  if (capacity == 0)
+    return NULL;
+
+  gst_vaapi_video_pool_get_usage (pool, NULL, &oldest_age, &oldest_holder);
+  GST_INFO ("no free surface out of %u, oldest held for %" GST_TIME_FORMAT
+      " by %s", capacity, GST_TIME_ARGS (oldest_age),
+      oldest_holder ? oldest_holder : "the context user");
+
+  if (context->num_grown_surfaces >= context->max_grown_surfaces)
+    return NULL;
+
+  gst_vaapi_video_pool_set_capacity (pool, capacity + 1);
+  proxy = gst_vaapi_surface_proxy_new_from_pool (GST_VAAPI_SURFACE_POOL
+      (pool));
+  if (!proxy) {
+    gst_vaapi_video_pool_set_capacity (pool, capacity);
+    return NULL;
+  }
+
+  context->num_grown_surfaces++;
+  g_atomic_int_inc (&context->num_recoveries);
+  GST_WARNING ("surface starvation, grew the pool to %u surfaces",
+      capacity + 1);
+  return proxy;
+}
+
 /**
  * gst_vaapi_context_get_surface_proxy:
  * @context: a #GstVaapiContext
@@ -641,18 +1322,42 @@ gst_vaapi_context_get_id (GstVaapiContext * context)
  *
  * This function returns %NULL if there is no free surface available
  * in the pool. The surfaces are pre-allocated during context creation
- * though.
+ * though, unless the display has a memory budget. In that case, the
+ * surfaces of a decoding context are allocated on demand, free ones
+ * are released after the context was idle, and no surface is
+ * allocated beyond the bitstream needs while the budget is exceeded.
+ *
+ * If starvation recovery is enabled, a few more surfaces are allocated
+ * rather than returning %NULL, and released once the pressure is over.
+ *
+ * The surface function set with gst_vaapi_context_set_surface_func()
+ * is tried first, if any.
  *
  * Return value: a free surface, or %NULL if none is available
  */
 GstVaapiSurfaceProxy *
 gst_vaapi_context_get_surface_proxy (GstVaapiContext * context)
 {
+  GstVaapiSurfaceProxy *proxy;
+
   g_return_val_if_fail (context != NULL, NULL);
 
-  return
-      gst_vaapi_surface_proxy_new_from_pool (GST_VAAPI_SURFACE_POOL
+  if (context->surface_func) {
+    proxy = context->surface_func (context, context->surface_data);
+    if (proxy)
+      return proxy;
+  }
+
+  if (context->on_demand)
+    context_update_on_demand_pool (context);
+  else if (context->num_grown_surfaces > 0)
+    context_release_grown_surfaces (context);
+
+  proxy = gst_vaapi_surface_proxy_new_from_pool (GST_VAAPI_SURFACE_POOL
       (context->surfaces_pool));
+  if (!proxy)
+    proxy = context_recover_starvation (context);
+  return proxy;
 }
 
 /**
@@ -673,13 +1378,203 @@ gst_vaapi_context_get_surface_count (GstVaapiContext * context)
   return gst_vaapi_video_pool_get_size (context->surfaces_pool);
 }
 
+/**
+ * gst_vaapi_context_set_surface_tracking:
+ * @context: a #GstVaapiContext
+ * @tracking: %TRUE to track the surfaces in use
+ *
+ * Sets whether the surfaces handed out by @context are tracked, so
+ * that gst_vaapi_context_get_surface_stats() reports how long they
+ * have been in use and who holds them. The setting also applies to
+ * the surfaces allocated after a reset.
+ */
+void
+gst_vaapi_context_set_surface_tracking (GstVaapiContext * context,
+    gboolean tracking)
+{
+  g_return_if_fail (context != NULL);
+
+  context->track_surfaces = tracking;
+  if (context->surfaces_pool)
+    gst_vaapi_video_pool_set_tracking (context->surfaces_pool, tracking);
+}
+
+/**
+ * gst_vaapi_context_set_surface_func:
+ * @context: a #GstVaapiContext
+ * @func: (allow-none): the #GstVaapiContextSurfaceFunc, or %NULL
+ * @user_data: the user data to pass to @func
+ *
+ * Sets a function providing the surfaces handed out by
+ * gst_vaapi_context_get_surface_proxy(), e.g. buffers of another
+ * element imported as VA surfaces. The pool of @context is only used
+ * when @func returns %NULL. Such surfaces are neither tracked nor
+ * accounted for in the pool capacity.
+ */
+void
+gst_vaapi_context_set_surface_func (GstVaapiContext * context,
+    GstVaapiContextSurfaceFunc func, gpointer user_data)
+{
+  g_return_if_fail (context != NULL);
+
+  context->surface_func = func;
+  context->surface_data = user_data;
+}
+
+/**
+ * gst_vaapi_context_set_priority:
+ * @context: a #GstVaapiContext
+ * @priority: a #GstVaapiPriority
+ *
+ * Sets the priority the GPU scheduler gives to the work submitted on
+ * the VA contexts of @context. The driver only takes it along with a
+ * picture, so it is applied to each VA context by the next picture
+ * submitted there, see gst_vaapi_context_apply_priority(). This
+ * function can be called from any thread.
+ *
+ * Return value: %TRUE if the driver supports context priorities
+ */
+gboolean
+gst_vaapi_context_set_priority (GstVaapiContext * context,
+    GstVaapiPriority priority)
+{
+  gint value;
+
+  g_return_val_if_fail (context != NULL, FALSE);
+
+  if (context->priority_max == 0)
+    return FALSE;
+
+  value = gst_vaapi_priority_to_va_value (priority, context->priority_max,
+      g_atomic_int_get (&context->priority_serial) != 0);
+  if (value < 0 || value == g_atomic_int_get (&context->priority_value))
+    return TRUE;
+
+  GST_DEBUG ("context 0x%08" G_GSIZE_MODIFIER "x priority %d of %u",
+      GST_VAAPI_CONTEXT_ID (context), value, context->priority_max);
+  g_atomic_int_set (&context->priority_value, value);
+  g_atomic_int_inc (&context->priority_serial);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_context_apply_priority:
+ * @context: a #GstVaapiContext
+ * @va_context: the VA context a picture is being submitted to
+ *
+ * Submits the priority set with gst_vaapi_context_set_priority() to
+ * @va_context, unless it already has it. This is to be called between
+ * vaBeginPicture() and vaEndPicture(), from the thread submitting the
+ * pictures. Nothing is done for VA contexts that are not part of
+ * @context.
+ */
+void
+gst_vaapi_context_apply_priority (GstVaapiContext * context,
+    VAContextID va_context)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_CONTEXT_DISPLAY (context);
+  ContextPriorityState *state = NULL;
+  ContextPriorityState new_state;
+  gint serial;
+  guint i, num_ids;
+
+  g_return_if_fail (context != NULL);
+
+  serial = g_atomic_int_get (&context->priority_serial);
+  if (serial == 0)
+    return;
+
+  for (i = 0; i < context->priority_applied->len; i++) {
+    state = &g_array_index (context->priority_applied, ContextPriorityState,
+        i);
+    if (state->id == va_context)
+      break;
+    state = NULL;
+  }
+
+  if (!state) {
+    num_ids = gst_vaapi_context_get_num_ids (context);
+    for (i = 0; i < num_ids; i++) {
+      if (gst_vaapi_context_get_nth_id (context, i) == va_context)
+        break;
+    }
+    if (i == num_ids)
+      return;
+    new_state.id = va_context;
+    new_state.serial = 0;
+    g_array_append_val (context->priority_applied, new_state);
+    state = &g_array_index (context->priority_applied, ContextPriorityState,
+        context->priority_applied->len - 1);
+  }
+
+  if (state->serial == serial)
+    return;
+  if (!vaapi_render_context_priority (GST_VAAPI_DISPLAY_VADISPLAY (display),
+          va_context, g_atomic_int_get (&context->priority_value)))
+    GST_WARNING ("failed to update the priority of context 0x%08x",
+        va_context);
+  /* failures are not retried at every picture */
+  state->serial = serial;
+}
+
+/**
+ * gst_vaapi_context_set_starvation_recovery:
+ * @context: a #GstVaapiContext
+ * @max_surfaces: the number of surfaces to allocate past a full pool
+ *
+ * Sets how many surfaces gst_vaapi_context_get_surface_proxy() may
+ * allocate when the pool is exhausted, e.g. because downstream holds
+ * on to too many of them or the memory budget is reached, rather than
+ * failing. Those extra surfaces are released as soon as enough of
+ * the others are returned. Zero disables the recovery.
+ */
+void
+gst_vaapi_context_set_starvation_recovery (GstVaapiContext * context,
+    guint max_surfaces)
+{
+  g_return_if_fail (context != NULL);
+
+  context->max_grown_surfaces = max_surfaces;
+}
+
+/**
+ * gst_vaapi_context_get_surface_stats:
+ * @context: a #GstVaapiContext
+ * @stats: (out caller-allocates): the #GstVaapiContextSurfaceStats
+ *   to fill
+ *
+ * Reports the usage of the surfaces of @context. The surfaces in use
+ * are only accounted for if tracking is enabled, see
+ * gst_vaapi_context_set_surface_tracking().
+ */
+void
+gst_vaapi_context_get_surface_stats (GstVaapiContext * context,
+    GstVaapiContextSurfaceStats * stats)
+{
+  g_return_if_fail (context != NULL);
+  g_return_if_fail (stats != NULL);
+
+  memset (stats, 0, sizeof (*stats));
+
+  /* The pool is replaced on reset, under that lock */
+  g_mutex_lock (&g_on_demand_contexts_lock);
+  if (context->surfaces_pool)
+    gst_vaapi_video_pool_get_usage (context->surfaces_pool,
+        &stats->num_in_use, &stats->oldest_age, &stats->oldest_holder);
+  g_mutex_unlock (&g_on_demand_contexts_lock);
+  stats->num_starvations = g_atomic_int_get (&context->num_starvations);
+  stats->num_recoveries = g_atomic_int_get (&context->num_recoveries);
+}
+
 /**
  * gst_vaapi_context_reset_on_resize:
  * @context: a #GstVaapiContext
  * @reset_on_resize: Should the context be reset on size change
  *
  * Sets whether the underlying context should be reset when a size change
- * happens. The proper setting for this is codec dependent.
+ * happens. The proper setting for this is codec dependent. For encoding,
+ * disabling it keeps the context and its surfaces as long as the new
+ * size fits into them.
  */
 void
 gst_vaapi_context_reset_on_resize (GstVaapiContext * context,
@@ -780,9 +1675,20 @@ gst_vaapi_context_unref (GstVaapiContext * context)
   g_return_if_fail (context->ref_count > 0);
 
   if (g_atomic_int_dec_and_test (&context->ref_count)) {
-    context_destroy (context);
-    context_destroy_surfaces (context);
-    gst_vaapi_display_replace (&context->display, NULL);
-    g_slice_free (GstVaapiContext, context);
+    if (!context_cache_park (context))
+      context_free (context);
   }
 }
+
+static void
+context_free (GstVaapiContext * context)
+{
+  if (context->on_demand)
+    on_demand_contexts_remove (context);
+  context_destroy (context);
+  context_destroy_surfaces (context);
+  g_array_unref (context->aux_ids);
+  g_array_unref (context->priority_applied);
+  gst_vaapi_display_replace (&context->display, NULL);
+  g_slice_free (GstVaapiContext, context);
+}
@@ -39,6 +39,19 @@ G_BEGIN_DECLS
 typedef struct _GstVaapiConfigInfoEncoder GstVaapiConfigInfoEncoder;
 typedef struct _GstVaapiContextInfo GstVaapiContextInfo;
 typedef struct _GstVaapiContext GstVaapiContext;
+typedef struct _GstVaapiContextSurfaceStats GstVaapiContextSurfaceStats;
+
+/**
+ * GstVaapiContextSurfaceFunc:
+ * @context: a #GstVaapiContext
+ * @user_data: the user data passed to gst_vaapi_context_set_surface_func()
+ *
+ * Provides a surface for @context from outside of its pool.
+ *
+ * Return value: a #GstVaapiSurfaceProxy, or %NULL to use the pool
+ */
+typedef GstVaapiSurfaceProxy *(*GstVaapiContextSurfaceFunc) (
+    GstVaapiContext * context, gpointer user_data);
 
 /**
  * GstVaapiContextUsage:
@@ -76,7 +89,13 @@ struct _GstVaapiConfigInfoEncoder
  *
  * Structure holding VA context info like encoded size, decoder
  * profile and entry-point to use, and maximum number of reference
- * frames reported by the bitstream.
+ * frames reported by the bitstream. @extra_surfaces is the number of
+ * surfaces allocated beyond @ref_frames, for the picture being
+ * processed and for those held by downstream elements. Zero selects
+ * a default suited for most pipelines. The creation of the VA objects
+ * is timed as stages of @owner, if set, see gst_vaapi_trace_stage().
+ * @surface_alloc_flags holds the #GstVaapiSurfaceAllocFlags of the
+ * surfaces allocated along with the context.
  */
 struct _GstVaapiContextInfo
 {
@@ -87,9 +106,33 @@ struct _GstVaapiContextInfo
   guint width;
   guint height;
   guint ref_frames;
+  guint extra_surfaces;
+  guint surface_alloc_flags;
   union _GstVaapiConfigInfo {
     GstVaapiConfigInfoEncoder encoder;
   } config;
+  gpointer owner;
+};
+
+/**
+ * GstVaapiContextSurfaceStats:
+ * @num_in_use: the number of surfaces in use, if tracked
+ * @oldest_age: how long the oldest surface in use has been so
+ * @oldest_holder: the holder of that surface, %NULL for the context
+ *   user itself
+ * @num_starvations: the number of times no surface was available
+ * @num_recoveries: the number of those times a surface was allocated
+ *   anyway, see gst_vaapi_context_set_starvation_recovery()
+ *
+ * The usage of the surfaces of a #GstVaapiContext.
+ */
+struct _GstVaapiContextSurfaceStats
+{
+  guint num_in_use;
+  GstClockTime oldest_age;
+  const gchar *oldest_holder;
+  guint num_starvations;
+  guint num_recoveries;
 };
 
 /**
@@ -114,6 +157,27 @@ struct _GstVaapiContext
   gboolean reset_on_resize;
   GstVaapiConfigSurfaceAttributes *attribs;
   GstVideoFormat preferred_format;
+  gboolean on_demand;
+  volatile gint last_activity;
+  gboolean track_surfaces;
+  /* surfaces allocated past a full pool, at most max_grown_surfaces */
+  guint num_grown_surfaces;
+  guint max_grown_surfaces;
+  volatile gint num_starvations;
+  volatile gint num_recoveries;
+  /* surfaces provided from outside, tried before the pool */
+  GstVaapiContextSurfaceFunc surface_func;
+  gpointer surface_data;
+  /* auxiliary VA contexts sharing va_config and surfaces */
+  GArray *aux_ids;
+  guint num_aux_ids;
+  /* GPU priority: the highest value the driver takes, 0 if it has no
+     priorities, the value to apply, or -1, and the serial of its last
+     change, along with the serial each VA context was updated to */
+  guint priority_max;
+  volatile gint priority_value;
+  volatile gint priority_serial;
+  GArray *priority_applied;
 };
 
 #define GST_VAAPI_CONTEXT_ID(context)        (((GstVaapiContext *)(context))->object_id)
@@ -133,6 +197,18 @@ G_GNUC_INTERNAL
 GstVaapiID
 gst_vaapi_context_get_id (GstVaapiContext * context);
 
+G_GNUC_INTERNAL
+guint
+gst_vaapi_context_set_num_ids (GstVaapiContext * context, guint num_ids);
+
+G_GNUC_INTERNAL
+guint
+gst_vaapi_context_get_num_ids (GstVaapiContext * context);
+
+G_GNUC_INTERNAL
+GstVaapiID
+gst_vaapi_context_get_nth_id (GstVaapiContext * context, guint index);
+
 G_GNUC_INTERNAL
 GstVaapiSurfaceProxy *
 gst_vaapi_context_get_surface_proxy (GstVaapiContext * context);
@@ -141,11 +217,45 @@ G_GNUC_INTERNAL
 guint
 gst_vaapi_context_get_surface_count (GstVaapiContext * context);
 
+G_GNUC_INTERNAL
+void
+gst_vaapi_context_set_surface_tracking (GstVaapiContext * context,
+    gboolean tracking);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_context_set_surface_func (GstVaapiContext * context,
+    GstVaapiContextSurfaceFunc func, gpointer user_data);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_context_set_priority (GstVaapiContext * context,
+    GstVaapiPriority priority);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_context_apply_priority (GstVaapiContext * context,
+    VAContextID va_context);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_context_set_starvation_recovery (GstVaapiContext * context,
+    guint max_surfaces);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_context_get_surface_stats (GstVaapiContext * context,
+    GstVaapiContextSurfaceStats * stats);
+
 G_GNUC_INTERNAL
 void
 gst_vaapi_context_reset_on_resize (GstVaapiContext * context,
     gboolean reset_on_resize);
 
+G_GNUC_INTERNAL
+void
+gst_vaapi_context_cache_trim (GstVaapiDisplay * display, guint max_size);
+
 G_GNUC_INTERNAL
 GArray *
 gst_vaapi_context_get_surface_formats (GstVaapiContext * context);
@@ -32,8 +32,11 @@
 #include "gstvaapidecoder.h"
 #include "gstvaapidecoder_priv.h"
 #include "gstvaapiparser_frame.h"
+#include "gstvaapisurfacepool.h"
 #include "gstvaapisurfaceproxy_priv.h"
+#include "gstvaapitrace.h"
 #include "gstvaapiutils.h"
+#include "gstvaapiutils_core.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -46,9 +49,29 @@ enum
 };
 static GParamSpec *g_properties[N_PROPERTIES] = { NULL, };
 
+/* Maximum number of frames submitted to the decode thread, i.e. the
+   one being decoded plus the one queued behind it */
+#define DECODE_THREAD_MAX_PENDING 2
+
+/* Maximum number of idle VA parameter buffers kept for reuse */
+#define MAX_FREE_BUFFERS 64
+
+/* Time after which surfaces kept from a larger rendition are shrunk */
+#define DEFAULT_RENDITION_SETTLE_TIME (60 * GST_SECOND)
+
+typedef struct
+{
+  VABufferID id;
+  VAContextID context;
+  guint type;
+  guint size;
+  guint num_elements;
+} GstVaapiDecoderBuffer;
+
 G_DEFINE_TYPE (GstVaapiDecoder, gst_vaapi_decoder, GST_TYPE_OBJECT);
 
 static void drop_frame (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame);
+static void notify_codec_state_changed (GstVaapiDecoder * decoder);
 
 static void
 parser_state_reset (GstVaapiParserState * ps)
@@ -58,6 +81,8 @@ parser_state_reset (GstVaapiParserState * ps)
     gst_adapter_clear (ps->input_adapter);
   if (ps->output_adapter)
     gst_adapter_clear (ps->output_adapter);
+  if (ps->packet_adapter)
+    gst_adapter_clear (ps->packet_adapter);
   ps->current_adapter = NULL;
 
   if (ps->next_unit_pending) {
@@ -85,10 +110,18 @@ parser_state_finalize (GstVaapiParserState * ps)
     ps->output_adapter = NULL;
   }
 
+  if (ps->packet_adapter) {
+    gst_adapter_clear (ps->packet_adapter);
+    g_object_unref (ps->packet_adapter);
+    ps->packet_adapter = NULL;
+  }
+
   if (ps->next_unit_pending) {
     gst_vaapi_decoder_unit_clear (&ps->next_unit);
     ps->next_unit_pending = FALSE;
   }
+
+  g_clear_pointer (&ps->frame_pool, gst_vaapi_parser_frame_pool_unref);
 }
 
 static gboolean
@@ -103,6 +136,14 @@ parser_state_init (GstVaapiParserState * ps)
   ps->output_adapter = gst_adapter_new ();
   if (!ps->output_adapter)
     return FALSE;
+
+  ps->packet_adapter = gst_adapter_new ();
+  if (!ps->packet_adapter)
+    return FALSE;
+
+  ps->frame_pool = gst_vaapi_parser_frame_pool_new ();
+  if (!ps->frame_pool)
+    return FALSE;
   return TRUE;
 }
 
@@ -120,29 +161,114 @@ reset:
   ps->input_offset2 = -1;
 }
 
+/* Checks whether a buffer of @size bytes would exceed the input
+   limits. Called with the input lock held */
+static gboolean
+input_queue_is_full (GstVaapiDecoder * decoder, gsize size)
+{
+  /* let a single buffer in, however large */
+  if (g_queue_is_empty (&decoder->input_queue))
+    return FALSE;
+
+  if (decoder->max_input_buffers > 0
+      && decoder->input_queue.length >= decoder->max_input_buffers)
+    return TRUE;
+  if (decoder->max_input_bytes > 0
+      && decoder->input_bytes + size > decoder->max_input_bytes)
+    return TRUE;
+  return FALSE;
+}
+
+/* Drops the oldest buffer that is not an EOS marker. Called with the
+   input lock held */
+static gboolean
+input_queue_drop_oldest (GstVaapiDecoder * decoder)
+{
+  GList *l;
+
+  for (l = decoder->input_queue.head; l; l = l->next) {
+    GstBuffer *const buffer = l->data;
+
+    if (GST_BUFFER_IS_EOS (buffer))
+      continue;
+
+    GST_DEBUG ("drop queued buffer %p (%zu bytes)",
+        buffer, gst_buffer_get_size (buffer));
+    decoder->input_bytes -= gst_buffer_get_size (buffer);
+    g_queue_delete_link (&decoder->input_queue, l);
+    gst_buffer_unref (buffer);
+    decoder->input_stats.num_dropped++;
+    return TRUE;
+  }
+  return FALSE;
+}
+
 static gboolean
 push_buffer (GstVaapiDecoder * decoder, GstBuffer * buffer)
 {
+  gboolean dropped = FALSE;
+  gsize size;
+
   if (!buffer) {
     buffer = gst_buffer_new ();
     if (!buffer)
       return FALSE;
     GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_EOS);
   }
+  size = gst_buffer_get_size (buffer);
+
+  GST_DEBUG ("queue encoded data buffer %p (%zu bytes)", buffer, size);
+
+  g_mutex_lock (&decoder->input_lock);
+  /* the EOS marker is never held back */
+  if (!GST_BUFFER_IS_EOS (buffer) && input_queue_is_full (decoder, size)) {
+    if (decoder->input_overflow ==
+        GST_VAAPI_DECODER_INPUT_OVERFLOW_DROP_OLDEST) {
+      while (input_queue_is_full (decoder, size)
+          && input_queue_drop_oldest (decoder))
+        dropped = TRUE;
+    } else {
+      decoder->input_stats.num_waits++;
+      do {
+        g_cond_wait (&decoder->input_cond, &decoder->input_lock);
+      } while (input_queue_is_full (decoder, size));
+    }
+  }
 
-  GST_DEBUG ("queue encoded data buffer %p (%zu bytes)",
-      buffer, gst_buffer_get_size (buffer));
-
-  g_async_queue_push (decoder->buffers, buffer);
+  /* The next buffer does not continue the data already parsed */
+  if (dropped)
+    decoder->input_dropped = TRUE;
+  g_queue_push_tail (&decoder->input_queue, buffer);
+  decoder->input_bytes += size;
+  decoder->input_stats.max_num_buffers =
+      MAX (decoder->input_stats.max_num_buffers,
+      decoder->input_queue.length);
+  decoder->input_stats.max_num_bytes =
+      MAX (decoder->input_stats.max_num_bytes, decoder->input_bytes);
+  g_mutex_unlock (&decoder->input_lock);
+
+  /* The next pictures may reference the dropped data */
+  if (dropped)
+    g_atomic_int_set (&decoder->skip_mode, GST_VAAPI_DECODER_SKIP_NON_KEY);
   return TRUE;
 }
 
+/* Pops the next queued buffer. *@dropped_ptr tells whether buffers
+   were dropped right before it */
 static GstBuffer *
-pop_buffer (GstVaapiDecoder * decoder)
+pop_buffer (GstVaapiDecoder * decoder, gboolean * dropped_ptr)
 {
   GstBuffer *buffer;
 
-  buffer = g_async_queue_try_pop (decoder->buffers);
+  g_mutex_lock (&decoder->input_lock);
+  buffer = g_queue_pop_head (&decoder->input_queue);
+  if (buffer) {
+    decoder->input_bytes -= gst_buffer_get_size (buffer);
+    *dropped_ptr = decoder->input_dropped;
+    decoder->input_dropped = FALSE;
+    g_cond_broadcast (&decoder->input_cond);
+  }
+  g_mutex_unlock (&decoder->input_lock);
   if (!buffer)
     return NULL;
 
@@ -152,6 +278,22 @@ pop_buffer (GstVaapiDecoder * decoder)
   return buffer;
 }
 
+/* Drops all queued buffers, and wakes up the callers waiting for room
+   in the queue */
+static void
+input_queue_clear (GstVaapiDecoder * decoder)
+{
+  GstBuffer *buffer;
+
+  g_mutex_lock (&decoder->input_lock);
+  while ((buffer = g_queue_pop_head (&decoder->input_queue)) != NULL)
+    gst_buffer_unref (buffer);
+  decoder->input_bytes = 0;
+  decoder->input_dropped = FALSE;
+  g_cond_broadcast (&decoder->input_cond);
+  g_mutex_unlock (&decoder->input_lock);
+}
+
 static GstVaapiDecoderStatus
 do_parse (GstVaapiDecoder * decoder,
     GstVideoCodecFrame * base_frame, GstAdapter * adapter, gboolean at_eos,
@@ -161,6 +303,7 @@ do_parse (GstVaapiDecoder * decoder,
   GstVaapiParserFrame *frame;
   GstVaapiDecoderUnit *unit;
   GstVaapiDecoderStatus status;
+  GstClockTime trace_start;
 
   *got_unit_size_ptr = 0;
   *got_frame_ptr = FALSE;
@@ -168,8 +311,15 @@ do_parse (GstVaapiDecoder * decoder,
   frame = gst_video_codec_frame_get_user_data (base_frame);
   if (!frame) {
     GstVideoCodecState *const codec_state = decoder->codec_state;
-    frame = gst_vaapi_parser_frame_new (codec_state->info.width,
-        codec_state->info.height);
+    guint width, height;
+
+    /* The decode thread may update the codec state meanwhile */
+    g_mutex_lock (&decoder->decode_lock);
+    width = codec_state->info.width;
+    height = codec_state->info.height;
+    g_mutex_unlock (&decoder->decode_lock);
+
+    frame = gst_vaapi_parser_frame_pool_get (ps->frame_pool, width, height);
     if (!frame)
       return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
     gst_video_codec_frame_set_user_data (base_frame,
@@ -186,8 +336,11 @@ do_parse (GstVaapiDecoder * decoder,
   gst_vaapi_decoder_unit_init (unit);
 
   ps->current_frame = base_frame;
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
   status = GST_VAAPI_DECODER_GET_CLASS (decoder)->parse (decoder,
       adapter, at_eos, unit);
+  GST_VAAPI_TRACE_END (trace_start, decoder, GST_VAAPI_TRACE_STAGE_PARSE,
+      base_frame->pts);
   if (status != GST_VAAPI_DECODER_STATUS_SUCCESS) {
     if (at_eos && frame->units->len > 0 &&
         status == GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA) {
@@ -277,16 +430,17 @@ do_decode_1 (GstVaapiDecoder * decoder, GstVaapiParserFrame * frame)
 static inline GstVaapiDecoderStatus
 do_decode (GstVaapiDecoder * decoder, GstVideoCodecFrame * base_frame)
 {
-  GstVaapiParserState *const ps = &decoder->parser_state;
   GstVaapiParserFrame *const frame = base_frame->user_data;
   GstVaapiDecoderStatus status;
 
-  ps->current_frame = base_frame;
+  decoder->current_frame = base_frame;
 
   gst_vaapi_parser_frame_ref (frame);
   status = do_decode_1 (decoder, frame);
   gst_vaapi_parser_frame_unref (frame);
 
+  decoder->current_frame = NULL;
+
   switch ((guint) status) {
     case GST_VAAPI_DECODER_STATUS_DROP_FRAME:
       drop_frame (decoder, base_frame);
@@ -296,21 +450,190 @@ do_decode (GstVaapiDecoder * decoder, GstVideoCodecFrame * base_frame)
   return status;
 }
 
+/* A frame that failed to decode on the decode thread */
+typedef struct
+{
+  GstVideoCodecFrame *frame;
+  GstVaapiDecoderStatus status;
+} DecodeError;
+
+static void
+decode_errors_push (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame,
+    GstVaapiDecoderStatus status)
+{
+  DecodeError *const error = g_slice_new (DecodeError);
+
+  error->frame = gst_video_codec_frame_ref (frame);
+  error->status = status;
+  g_queue_push_tail (&decoder->decode_errors, error);
+}
+
+static void
+decode_error_free (DecodeError * error)
+{
+  gst_video_codec_frame_unref (error->frame);
+  g_slice_free (DecodeError, error);
+}
+
+/* Returns the decode status of @frame, just popped from the output
+   queue. Failing frames are pushed in output order */
+static GstVaapiDecoderStatus
+decode_errors_pop (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame)
+{
+  GstVaapiDecoderStatus status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+  DecodeError *error;
+
+  g_mutex_lock (&decoder->decode_lock);
+  error = g_queue_peek_head (&decoder->decode_errors);
+  if (error && error->frame == frame) {
+    g_queue_pop_head (&decoder->decode_errors);
+    status = error->status;
+    decode_error_free (error);
+  }
+  g_mutex_unlock (&decoder->decode_lock);
+  return status;
+}
+
+static void
+decode_errors_clear (GstVaapiDecoder * decoder)
+{
+  DecodeError *error;
+
+  g_mutex_lock (&decoder->decode_lock);
+  while ((error = g_queue_pop_head (&decoder->decode_errors)) != NULL)
+    decode_error_free (error);
+  g_mutex_unlock (&decoder->decode_lock);
+}
+
+static gpointer
+decode_thread_func (gpointer data)
+{
+  GstVaapiDecoder *const decoder = data;
+  GstVideoCodecFrame *frame;
+  GstVaapiDecoderStatus status;
+
+  for (;;) {
+    frame = g_async_queue_pop (decoder->decode_queue);
+    /* the decoder itself is pushed to request the thread to exit */
+    if (frame == (gpointer) decoder)
+      break;
+
+    status = do_decode (decoder, frame);
+    GST_DEBUG ("decode frame %d (status = %d)", frame->system_frame_number,
+        status);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS) {
+      /* The error goes out with the failing frame, so it is recorded
+         before the frame can be popped */
+      g_mutex_lock (&decoder->decode_lock);
+      decode_errors_push (decoder, frame, status);
+      if (decoder->decode_status == GST_VAAPI_DECODER_STATUS_SUCCESS)
+        decoder->decode_status = status;
+      g_mutex_unlock (&decoder->decode_lock);
+      drop_frame (decoder, frame);
+    }
+    gst_video_codec_frame_unref (frame);
+
+    g_mutex_lock (&decoder->decode_lock);
+    decoder->decode_pending--;
+    g_cond_broadcast (&decoder->decode_cond);
+    g_mutex_unlock (&decoder->decode_lock);
+  }
+  return NULL;
+}
+
+static gboolean
+decode_thread_start (GstVaapiDecoder * decoder)
+{
+  GError *error = NULL;
+
+  if (decoder->decode_thread)
+    return TRUE;
+
+  decoder->decode_status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+  decoder->decode_pending = 0;
+  decoder->decode_thread = g_thread_try_new ("vaapi-decode",
+      decode_thread_func, decoder, &error);
+  if (!decoder->decode_thread) {
+    GST_WARNING ("failed to create decode thread: %s", error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static GstVaapiDecoderStatus
+decode_thread_sync (GstVaapiDecoder * decoder)
+{
+  GstVaapiDecoderStatus status;
+
+  if (!decoder->decode_thread)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  g_mutex_lock (&decoder->decode_lock);
+  while (decoder->decode_pending > 0)
+    g_cond_wait (&decoder->decode_cond, &decoder->decode_lock);
+  status = decoder->decode_status;
+  decoder->decode_status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+  g_mutex_unlock (&decoder->decode_lock);
+  return status;
+}
+
+static void
+decode_thread_stop (GstVaapiDecoder * decoder)
+{
+  if (!decoder->decode_thread)
+    return;
+
+  decode_thread_sync (decoder);
+  g_async_queue_push (decoder->decode_queue, decoder);
+  g_thread_join (decoder->decode_thread);
+  decoder->decode_thread = NULL;
+}
+
+static GstVaapiDecoderStatus
+decode_thread_push (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame)
+{
+  g_mutex_lock (&decoder->decode_lock);
+  while (decoder->decode_pending >= DECODE_THREAD_MAX_PENDING)
+    g_cond_wait (&decoder->decode_cond, &decoder->decode_lock);
+
+  /* Errors of previous frames come out with these frames, through
+     gst_vaapi_decoder_get_frame() */
+  decoder->decode_pending++;
+  g_async_queue_push (decoder->decode_queue,
+      gst_video_codec_frame_ref (frame));
+  g_mutex_unlock (&decoder->decode_lock);
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static inline gboolean
+is_decode_thread (GstVaapiDecoder * decoder)
+{
+  return decoder->decode_thread && decoder->decode_thread == g_thread_self ();
+}
+
 static GstVaapiDecoderStatus
 decode_step (GstVaapiDecoder * decoder)
 {
   GstVaapiParserState *const ps = &decoder->parser_state;
   GstVaapiDecoderStatus status;
   GstBuffer *buffer;
-  gboolean got_frame;
+  gboolean got_frame, dropped;
   guint got_unit_size, input_size;
 
   /* Fill adapter with all buffers we have in the queue */
   for (;;) {
-    buffer = pop_buffer (decoder);
+    buffer = pop_buffer (decoder, &dropped);
     if (!buffer)
       break;
 
+    /* Data parsed so far may end with a unit cut by the drop, so the
+       parser starts over with the next buffer */
+    if (dropped) {
+      GST_DEBUG ("input was dropped, resetting parser state");
+      parser_state_reset (ps);
+    }
+
     ps->at_eos = GST_BUFFER_IS_EOS (buffer);
     if (!ps->at_eos)
       gst_adapter_push (ps->input_adapter, buffer);
@@ -395,7 +718,8 @@ push_frame (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame)
 }
 
 static inline GstVideoCodecFrame *
-pop_frame (GstVaapiDecoder * decoder, guint64 timeout)
+pop_frame (GstVaapiDecoder * decoder, guint64 timeout,
+    GstVaapiDecoderStatus * status_ptr)
 {
   GstVideoCodecFrame *frame;
   GstVaapiSurfaceProxy *proxy;
@@ -406,12 +730,19 @@ pop_frame (GstVaapiDecoder * decoder, guint64 timeout)
     frame = g_async_queue_try_pop (decoder->frames);
   if (!frame)
     return NULL;
+  *status_ptr = decode_errors_pop (decoder, frame);
 
   proxy = frame->user_data;
   GST_DEBUG ("pop frame %d (surface 0x%08x)", frame->system_frame_number,
       (proxy ? (guint32) GST_VAAPI_SURFACE_PROXY_SURFACE_ID (proxy) :
           VA_INVALID_ID));
 
+  /* The decode thread raises the flag before pushing any frame
+     matching the new codec state, so emit it now */
+  if (g_atomic_int_compare_and_exchange (&decoder->codec_state_changed_pending,
+          TRUE, FALSE))
+    notify_codec_state_changed (decoder);
+
   return frame;
 }
 
@@ -446,12 +777,59 @@ get_caps (GstVaapiDecoder * decoder)
   return GST_VAAPI_DECODER_CODEC_STATE (decoder)->caps;
 }
 
+static GstVideoCodecState *
+codec_state_copy (const GstVideoCodecState * in_state)
+{
+  GstVideoCodecState *state;
+
+  state = g_slice_new0 (GstVideoCodecState);
+  state->ref_count = 1;
+  state->info = in_state->info;
+  if (in_state->caps)
+    state->caps = gst_caps_copy (in_state->caps);
+  if (in_state->codec_data)
+    state->codec_data = gst_buffer_ref (in_state->codec_data);
+  return state;
+}
+
 static void
 notify_codec_state_changed (GstVaapiDecoder * decoder)
 {
-  if (decoder->codec_state_changed_func)
-    decoder->codec_state_changed_func (decoder, decoder->codec_state,
-        decoder->codec_state_changed_data);
+  GstVideoCodecState *codec_state;
+
+  /* Defer notification to the thread pulling out decoded frames */
+  if (is_decode_thread (decoder)) {
+    g_atomic_int_set (&decoder->codec_state_changed_pending, TRUE);
+    return;
+  }
+
+  if (!decoder->codec_state_changed_func)
+    return;
+
+  /* Hand out a snapshot, the decode thread may update the codec state
+     meanwhile */
+  g_mutex_lock (&decoder->decode_lock);
+  codec_state = codec_state_copy (decoder->codec_state);
+  g_mutex_unlock (&decoder->decode_lock);
+
+  decoder->codec_state_changed_func (decoder, codec_state,
+      decoder->codec_state_changed_data);
+  gst_video_codec_state_unref (codec_state);
+}
+
+static void
+free_buffers_clear (GstVaapiDecoder * decoder)
+{
+  guint i;
+
+  g_mutex_lock (&decoder->buffers_lock);
+  for (i = 0; i < decoder->free_buffers->len; i++) {
+    GstVaapiDecoderBuffer *const buf =
+        &g_array_index (decoder->free_buffers, GstVaapiDecoderBuffer, i);
+    vaapi_destroy_buffer (decoder->va_display, &buf->id);
+  }
+  g_array_set_size (decoder->free_buffers, 0);
+  g_mutex_unlock (&decoder->buffers_lock);
 }
 
 static void
@@ -459,21 +837,32 @@ gst_vaapi_decoder_finalize (GObject * object)
 {
   GstVaapiDecoder *const decoder = GST_VAAPI_DECODER (object);
 
+  decode_thread_stop (decoder);
+  g_async_queue_unref (decoder->decode_queue);
+  decode_errors_clear (decoder);
+  g_mutex_clear (&decoder->decode_lock);
+  g_cond_clear (&decoder->decode_cond);
+
+  free_buffers_clear (decoder);
+  g_array_unref (decoder->free_buffers);
+  g_mutex_clear (&decoder->buffers_lock);
+
   gst_video_codec_state_unref (decoder->codec_state);
   decoder->codec_state = NULL;
 
   parser_state_finalize (&decoder->parser_state);
 
-  if (decoder->buffers) {
-    g_async_queue_unref (decoder->buffers);
-    decoder->buffers = NULL;
-  }
+  input_queue_clear (decoder);
+  g_mutex_clear (&decoder->input_lock);
+  g_cond_clear (&decoder->input_cond);
 
   if (decoder->frames) {
     g_async_queue_unref (decoder->frames);
     decoder->frames = NULL;
   }
 
+  gst_vaapi_video_pool_replace (&decoder->proc_pool, NULL);
+
   if (decoder->context) {
     gst_vaapi_context_unref (decoder->context);
     decoder->context = NULL;
@@ -575,9 +964,28 @@ gst_vaapi_decoder_init (GstVaapiDecoder * decoder)
 
   decoder->va_context = VA_INVALID_ID;
   decoder->codec_state = codec_state;
-  decoder->buffers = g_async_queue_new_full ((GDestroyNotify) gst_buffer_unref);
+  g_queue_init (&decoder->input_queue);
+  g_mutex_init (&decoder->input_lock);
+  g_cond_init (&decoder->input_cond);
   decoder->frames = g_async_queue_new_full ((GDestroyNotify)
       gst_video_codec_frame_unref);
+
+  decoder->decode_queue = g_async_queue_new ();
+  g_queue_init (&decoder->decode_errors);
+  g_mutex_init (&decoder->decode_lock);
+  g_cond_init (&decoder->decode_cond);
+
+  decoder->free_buffers = g_array_new (FALSE, FALSE,
+      sizeof (GstVaapiDecoderBuffer));
+  g_mutex_init (&decoder->buffers_lock);
+
+  decoder->batch_slices = TRUE;
+  decoder->job_deadline = GST_CLOCK_TIME_NONE;
+  decoder->parallel_contexts = 1;
+  decoder->rendition_settle_time = DEFAULT_RENDITION_SETTLE_TIME;
+  decoder->rendition_oversized_since = GST_CLOCK_TIME_NONE;
+  decoder->proc_format = GST_VIDEO_FORMAT_UNKNOWN;
+  gst_video_info_init (&decoder->proc_info);
 }
 
 /**
@@ -709,6 +1117,10 @@ gst_vaapi_decoder_get_caps (GstVaapiDecoder * decoder)
  * or size equals to zero, then the function ignores this buffer and
  * returns %TRUE.
  *
+ * If the queue is past the limits set with
+ * gst_vaapi_decoder_set_input_limits(), this function either waits
+ * for room or drops the oldest queued buffers.
+ *
  * Return value: %TRUE on success
  */
 gboolean
@@ -724,6 +1136,75 @@ gst_vaapi_decoder_put_buffer (GstVaapiDecoder * decoder, GstBuffer * buf)
   return push_buffer (decoder, buf);
 }
 
+/**
+ * gst_vaapi_decoder_set_input_limits:
+ * @decoder: a #GstVaapiDecoder
+ * @max_bytes: the most compressed bytes to queue, or 0 for no limit
+ * @max_buffers: the most compressed buffers to queue, or 0 for no limit
+ * @overflow: the #GstVaapiDecoderInputOverflow behaviour past them
+ *
+ * Bounds the compressed data gst_vaapi_decoder_put_buffer() queues
+ * until the decoding catches up. A single buffer is always accepted
+ * into an empty queue. With %GST_VAAPI_DECODER_INPUT_OVERFLOW_BLOCK,
+ * the buffers must be decoded from another thread than the one that
+ * queues them, or the latter would wait forever; the waits end once
+ * gst_vaapi_decoder_get_surface() or gst_vaapi_decoder_reset()
+ * empties the queue. The limits may be changed from any thread.
+ *
+ * %GST_VAAPI_DECODER_INPUT_OVERFLOW_DROP_OLDEST is only supported by
+ * the decoders that can skip to the next key picture, i.e. H.264 and
+ * H.265 ones.
+ *
+ * Return value: %FALSE if @overflow is not supported by @decoder, in
+ *   which case nothing changes, %TRUE otherwise
+ */
+gboolean
+gst_vaapi_decoder_set_input_limits (GstVaapiDecoder * decoder,
+    gsize max_bytes, guint max_buffers, GstVaapiDecoderInputOverflow overflow)
+{
+  g_return_val_if_fail (decoder != NULL, FALSE);
+
+  /* The other decoders ignore the skip mode, and would keep decoding
+     from the references in the dropped data */
+  if (overflow == GST_VAAPI_DECODER_INPUT_OVERFLOW_DROP_OLDEST &&
+      decoder->codec != GST_VAAPI_CODEC_H264 &&
+      decoder->codec != GST_VAAPI_CODEC_H265) {
+    GST_WARNING ("cannot drop %s input, no key picture resync",
+        gst_vaapi_codec_get_name (decoder->codec));
+    return FALSE;
+  }
+
+  g_mutex_lock (&decoder->input_lock);
+  decoder->max_input_bytes = max_bytes;
+  decoder->max_input_buffers = max_buffers;
+  decoder->input_overflow = overflow;
+  g_cond_broadcast (&decoder->input_cond);
+  g_mutex_unlock (&decoder->input_lock);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_decoder_get_input_stats:
+ * @decoder: a #GstVaapiDecoder
+ * @stats: (out caller-allocates): the #GstVaapiDecoderInputStats to fill
+ *
+ * Reads back the depth of the queue of compressed input. This
+ * function may be called from any thread.
+ */
+void
+gst_vaapi_decoder_get_input_stats (GstVaapiDecoder * decoder,
+    GstVaapiDecoderInputStats * stats)
+{
+  g_return_if_fail (decoder != NULL);
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&decoder->input_lock);
+  *stats = decoder->input_stats;
+  stats->num_buffers = decoder->input_queue.length;
+  stats->num_bytes = decoder->input_bytes;
+  g_mutex_unlock (&decoder->input_lock);
+}
+
 /**
  * gst_vaapi_decoder_get_surface:
  * @decoder: a #GstVaapiDecoder
@@ -814,6 +1295,10 @@ gst_vaapi_decoder_get_frame (GstVaapiDecoder * decoder,
  * to the user-data anchor of the output frame. Ownership of the proxy
  * is transferred to the frame.
  *
+ * In threaded decode mode, a frame that failed to decode is returned
+ * in *@out_frame_ptr as well, without surface and flagged as
+ * decode-only, along with the decode error. The caller owns it too.
+ *
  * Return value: a #GstVaapiDecoderStatus
  */
 GstVaapiDecoderStatus
@@ -821,18 +1306,19 @@ gst_vaapi_decoder_get_frame_with_timeout (GstVaapiDecoder * decoder,
     GstVideoCodecFrame ** out_frame_ptr, guint64 timeout)
 {
   GstVideoCodecFrame *out_frame;
+  GstVaapiDecoderStatus status;
 
   g_return_val_if_fail (decoder != NULL,
       GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
   g_return_val_if_fail (out_frame_ptr != NULL,
       GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
 
-  out_frame = pop_frame (decoder, timeout);
+  out_frame = pop_frame (decoder, timeout, &status);
   if (!out_frame)
     return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
 
   *out_frame_ptr = out_frame;
-  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  return status;
 }
 
 void
@@ -842,6 +1328,7 @@ gst_vaapi_decoder_set_picture_size (GstVaapiDecoder * decoder,
   GstVideoCodecState *const codec_state = decoder->codec_state;
   gboolean size_changed = FALSE;
 
+  g_mutex_lock (&decoder->decode_lock);
   if (codec_state->info.width != width) {
     GST_DEBUG ("picture width changed to %d", width);
     codec_state->info.width = width;
@@ -855,6 +1342,7 @@ gst_vaapi_decoder_set_picture_size (GstVaapiDecoder * decoder,
     gst_caps_set_simple (codec_state->caps, "height", G_TYPE_INT, height, NULL);
     size_changed = TRUE;
   }
+  g_mutex_unlock (&decoder->decode_lock);
 
   if (size_changed)
     notify_codec_state_changed (decoder);
@@ -871,10 +1359,12 @@ gst_vaapi_decoder_set_framerate (GstVaapiDecoder * decoder,
 
   if (codec_state->info.fps_n != fps_n || codec_state->info.fps_d != fps_d) {
     GST_DEBUG ("framerate changed to %u/%u", fps_n, fps_d);
+    g_mutex_lock (&decoder->decode_lock);
     codec_state->info.fps_n = fps_n;
     codec_state->info.fps_d = fps_d;
     gst_caps_set_simple (codec_state->caps,
         "framerate", GST_TYPE_FRACTION, fps_n, fps_d, NULL);
+    g_mutex_unlock (&decoder->decode_lock);
     notify_codec_state_changed (decoder);
   }
 }
@@ -890,10 +1380,12 @@ gst_vaapi_decoder_set_pixel_aspect_ratio (GstVaapiDecoder * decoder,
 
   if (codec_state->info.par_n != par_n || codec_state->info.par_d != par_d) {
     GST_DEBUG ("pixel-aspect-ratio changed to %u/%u", par_n, par_d);
+    g_mutex_lock (&decoder->decode_lock);
     codec_state->info.par_n = par_n;
     codec_state->info.par_d = par_d;
     gst_caps_set_simple (codec_state->caps,
         "pixel-aspect-ratio", GST_TYPE_FRACTION, par_n, par_d, NULL);
+    g_mutex_unlock (&decoder->decode_lock);
     notify_codec_state_changed (decoder);
   }
 }
@@ -922,9 +1414,11 @@ gst_vaapi_decoder_set_interlace_mode (GstVaapiDecoder * decoder,
   if (codec_state->info.interlace_mode != mode) {
     GST_DEBUG ("interlace mode changed to %s",
         gst_interlace_mode_to_string (mode));
+    g_mutex_lock (&decoder->decode_lock);
     codec_state->info.interlace_mode = mode;
     gst_caps_set_simple (codec_state->caps, "interlaced",
         G_TYPE_BOOLEAN, mode != GST_VIDEO_INTERLACE_MODE_PROGRESSIVE, NULL);
+    g_mutex_unlock (&decoder->decode_lock);
     notify_codec_state_changed (decoder);
   }
 }
@@ -954,6 +1448,7 @@ gst_vaapi_decoder_set_multiview_mode (GstVaapiDecoder * decoder,
 
     GST_DEBUG ("Multiview mode changed to %s flags 0x%x views %d",
         mv_mode_str, mv_flags, views);
+    g_mutex_lock (&decoder->decode_lock);
     GST_VIDEO_INFO_MULTIVIEW_MODE (info) = mv_mode;
     GST_VIDEO_INFO_MULTIVIEW_FLAGS (info) = mv_flags;
     GST_VIDEO_INFO_VIEWS (info) = views;
@@ -962,93 +1457,1109 @@ gst_vaapi_decoder_set_multiview_mode (GstVaapiDecoder * decoder,
         G_TYPE_STRING, mv_mode_str,
         "multiview-flags", GST_TYPE_VIDEO_MULTIVIEW_FLAGSET, mv_flags,
         GST_FLAG_SET_MASK_EXACT, "views", G_TYPE_INT, views, NULL);
+    g_mutex_unlock (&decoder->decode_lock);
 
     notify_codec_state_changed (decoder);
   }
 }
 
-gboolean
-gst_vaapi_decoder_ensure_context (GstVaapiDecoder * decoder,
-    GstVaapiContextInfo * cip)
+/* Checks whether the pictures described by @cip can be decoded with
+   @context as is */
+static gboolean
+context_fits (GstVaapiContext * context, const GstVaapiContextInfo * cip)
 {
-  gst_vaapi_decoder_set_picture_size (decoder, cip->width, cip->height);
+  const GstVaapiContextInfo *info;
 
-  cip->usage = GST_VAAPI_CONTEXT_USAGE_DECODE;
-  if (decoder->context) {
-    if (!gst_vaapi_context_reset (decoder->context, cip))
-      return FALSE;
-  } else {
-    decoder->context = gst_vaapi_context_new (decoder->display, cip);
-    if (!decoder->context)
-      return FALSE;
-  }
-  decoder->va_context = gst_vaapi_context_get_id (decoder->context);
-  return TRUE;
-}
+  if (!context)
+    return FALSE;
 
-void
-gst_vaapi_decoder_push_frame (GstVaapiDecoder * decoder,
-    GstVideoCodecFrame * frame)
-{
-  push_frame (decoder, frame);
+  info = &context->info;
+  return info->usage == cip->usage && info->profile == cip->profile &&
+      info->entrypoint == cip->entrypoint &&
+      info->chroma_type == (cip->chroma_type ? cip->chroma_type :
+      GST_VAAPI_CHROMA_TYPE_YUV420) &&
+      info->width >= cip->width && info->height >= cip->height &&
+      info->ref_frames >= cip->ref_frames &&
+      info->surface_alloc_flags == cip->surface_alloc_flags;
 }
 
-GstVaapiDecoderStatus
-gst_vaapi_decoder_parse (GstVaapiDecoder * decoder,
-    GstVideoCodecFrame * base_frame, GstAdapter * adapter, gboolean at_eos,
-    guint * got_unit_size_ptr, gboolean * got_frame_ptr)
+/* Checks whether the pictures of @cip have been smaller than the kept
+   context for over the settle time, so that it is worth shrinking the
+   surfaces at this switch. The time runs from the first switch down */
+static gboolean
+rendition_is_settled (GstVaapiDecoder * decoder,
+    const GstVaapiContextInfo * cip)
 {
-  g_return_val_if_fail (decoder != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
-  g_return_val_if_fail (base_frame != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
-  g_return_val_if_fail (adapter != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
-  g_return_val_if_fail (got_unit_size_ptr != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
-  g_return_val_if_fail (got_frame_ptr != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  const GstVaapiContextInfo *const info = &decoder->context->info;
+  const GstClockTime now = gst_util_get_timestamp ();
 
-  return do_parse (decoder, base_frame, adapter, at_eos,
-      got_unit_size_ptr, got_frame_ptr);
+  if (info->width == cip->width && info->height == cip->height) {
+    decoder->rendition_oversized_since = GST_CLOCK_TIME_NONE;
+    return FALSE;
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (decoder->rendition_oversized_since)) {
+    decoder->rendition_oversized_since = now;
+    return FALSE;
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (decoder->rendition_settle_time) ||
+      now - decoder->rendition_oversized_since <
+      decoder->rendition_settle_time)
+    return FALSE;
+
+  GST_DEBUG ("shrink %ux%u context to %ux%u pictures after %"
+      GST_TIME_FORMAT, info->width, info->height, cip->width, cip->height,
+      GST_TIME_ARGS (now - decoder->rendition_oversized_since));
+  return TRUE;
 }
 
-GstVaapiDecoderStatus
-gst_vaapi_decoder_decode (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame)
+/* Creates the auxiliary VA contexts for intra-only streams, or
+   destroys them otherwise. Pictures are then decoded on the main
+   context until the next one is selected */
+static void
+update_parallel_contexts (GstVaapiDecoder * decoder)
 {
-  g_return_val_if_fail (decoder != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
-  g_return_val_if_fail (frame != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
-  g_return_val_if_fail (frame->user_data != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  guint num_contexts;
 
-  return do_decode (decoder, frame);
+  if (!decoder->context)
+    return;
+
+  num_contexts = decoder->intra_only ? decoder->parallel_contexts : 1;
+  if (gst_vaapi_context_get_num_ids (decoder->context) == num_contexts)
+    return;
+
+  /* Recycled buffers may belong to the VA contexts being destroyed */
+  free_buffers_clear (decoder);
+
+  num_contexts = gst_vaapi_context_set_num_ids (decoder->context,
+      num_contexts);
+  GST_DEBUG ("decoding on %u VA contexts", num_contexts);
+
+  decoder->context_index = 0;
+  decoder->va_context = gst_vaapi_context_get_id (decoder->context);
 }
 
-/* This function really marks the end of input,
- * so that the decoder will drain out any pending
- * frames on calls to gst_vaapi_decoder_get_frame_with_timeout() */
-GstVaapiDecoderStatus
-gst_vaapi_decoder_flush (GstVaapiDecoder * decoder)
+/* Sets up the pool of the surfaces pictures are scaled and converted
+   into at decode time, if such an output was requested and the driver
+   can process the pictures of the VA context profile. Otherwise, the
+   decoded surfaces are output as is */
+static void
+update_output_processing (GstVaapiDecoder * decoder)
 {
-  GstVaapiDecoderClass *klass;
+  GstVideoInfo *const vip = &decoder->proc_info;
+  const GstVaapiContextInfo *cip;
+  GstVaapiVideoPool *pool = NULL;
+  GstVideoFormat format;
+  guint value = 0;
+
+  if (!decoder->context || !decoder->proc_width || !decoder->proc_height)
+    goto done;
+  cip = &decoder->context->info;
+
+  format = decoder->proc_format;
+  if (format == GST_VIDEO_FORMAT_UNKNOWN) {
+    if (decoder->proc_width == GST_VAAPI_DECODER_WIDTH (decoder)
+        && decoder->proc_height == GST_VAAPI_DECODER_HEIGHT (decoder))
+      goto done;
+    format = gst_vaapi_video_format_from_chroma (cip->chroma_type ?
+        cip->chroma_type : GST_VAAPI_CHROMA_TYPE_YUV420);
+  }
 
-  g_return_val_if_fail (decoder != NULL,
-      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  /* Fields are decoded into the same surface, one at a time */
+  if (GST_VIDEO_INFO_IS_INTERLACED (&decoder->codec_state->info)) {
+    GST_DEBUG ("no decode processing of interlaced streams");
+    goto done;
+  }
 
-  klass = GST_VAAPI_DECODER_GET_CLASS (decoder);
+#if VA_CHECK_VERSION(1,0,0)
+  if (!gst_vaapi_get_config_attribute (decoder->display,
+          gst_vaapi_profile_get_va_profile (cip->profile), VAEntrypointVLD,
+          VAConfigAttribDecProcessing, &value))
+    value = 0;
+#endif
+  if (value != VA_DEC_PROCESSING) {
+    GST_DEBUG ("no decode processing for %s",
+        gst_vaapi_profile_get_va_name (cip->profile));
+    goto done;
+  }
 
-  if (klass->flush)
-    return klass->flush (decoder);
+  if (decoder->proc_pool && GST_VIDEO_INFO_FORMAT (vip) == format
+      && GST_VIDEO_INFO_WIDTH (vip) == decoder->proc_width
+      && GST_VIDEO_INFO_HEIGHT (vip) == decoder->proc_height)
+    return;
 
-  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  if (!gst_video_info_set_format (vip, format, decoder->proc_width,
+          decoder->proc_height))
+    goto done;
+  pool = gst_vaapi_surface_pool_new_full (decoder->display, vip,
+      decoder->surface_alloc_flags);
+  if (!pool)
+    goto done;
+
+  /* Output pictures are held downstream, not in the DPB */
+  gst_vaapi_video_pool_set_capacity (pool, 0);
+  GST_DEBUG ("decode processing to %s %ux%u",
+      gst_video_format_to_string (format), decoder->proc_width,
+      decoder->proc_height);
+
+done:
+  gst_vaapi_video_pool_replace (&decoder->proc_pool, pool);
+  if (pool)
+    gst_vaapi_video_pool_unref (pool);
 }
 
-/* Reset the decoder instance to a clean state,
- * clearing any pending decode state, without
- * reallocating the entire decoder */
-GstVaapiDecoderStatus
+/* Process-wide cache of the context parameters the streams were set up
+   with, keyed by their codec-data. The VA context of a stream seen
+   before is created as soon as its codec-data is decoded, so that the
+   first sequence header finds a matching context, i.e. streams
+   restarted over and over skip the profile and size probing */
+#define MAX_CONTEXT_CACHE_ENTRIES 32
+
+typedef struct
+{
+  GstVaapiCodec codec;
+  GstVaapiProfile profile;
+  GstVaapiEntrypoint entrypoint;
+  GstVaapiChromaType chroma_type;
+  guint width;
+  guint height;
+  guint ref_frames;
+} ContextCacheEntry;
+
+static GHashTable *context_cache;
+static GMutex context_cache_lock;
+
+static GBytes *
+context_cache_key (GstVaapiDecoder * decoder)
+{
+  GstBuffer *const codec_data = GST_VAAPI_DECODER_CODEC_DATA (decoder);
+  GstMapInfo map_info;
+  GBytes *key;
+
+  if (!codec_data || !gst_buffer_map (codec_data, &map_info, GST_MAP_READ))
+    return NULL;
+  key = g_bytes_new (map_info.data, map_info.size);
+  gst_buffer_unmap (codec_data, &map_info);
+  return key;
+}
+
+static void
+context_cache_store (GstVaapiDecoder * decoder,
+    const GstVaapiContextInfo * cip)
+{
+  ContextCacheEntry *entry;
+  GHashTableIter iter;
+  GBytes *key;
+
+  key = context_cache_key (decoder);
+  if (!key)
+    return;
+
+  entry = g_new (ContextCacheEntry, 1);
+  entry->codec = GST_VAAPI_DECODER_CODEC (decoder);
+  entry->profile = cip->profile;
+  entry->entrypoint = cip->entrypoint;
+  entry->chroma_type = cip->chroma_type;
+  entry->width = cip->width;
+  entry->height = cip->height;
+  entry->ref_frames = cip->ref_frames;
+
+  g_mutex_lock (&context_cache_lock);
+  if (!context_cache) {
+    context_cache = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+        (GDestroyNotify) g_bytes_unref, g_free);
+  }
+
+  /* Only a small set of streams is expected, evict any of them */
+  if (g_hash_table_size (context_cache) >= MAX_CONTEXT_CACHE_ENTRIES
+      && !g_hash_table_contains (context_cache, key)) {
+    g_hash_table_iter_init (&iter, context_cache);
+    if (g_hash_table_iter_next (&iter, NULL, NULL))
+      g_hash_table_iter_remove (&iter);
+  }
+  g_hash_table_replace (context_cache, key, entry);
+  g_mutex_unlock (&context_cache_lock);
+}
+
+static gboolean
+context_cache_lookup (GstVaapiDecoder * decoder, GstVaapiContextInfo * cip)
+{
+  const ContextCacheEntry *entry = NULL;
+  GBytes *key;
+
+  key = context_cache_key (decoder);
+  if (!key)
+    return FALSE;
+
+  memset (cip, 0, sizeof (*cip));
+  g_mutex_lock (&context_cache_lock);
+  if (context_cache)
+    entry = g_hash_table_lookup (context_cache, key);
+  if (entry && entry->codec == GST_VAAPI_DECODER_CODEC (decoder)) {
+    cip->profile = entry->profile;
+    cip->entrypoint = entry->entrypoint;
+    cip->chroma_type = entry->chroma_type;
+    cip->width = entry->width;
+    cip->height = entry->height;
+    cip->ref_frames = entry->ref_frames;
+  } else
+    entry = NULL;
+  g_mutex_unlock (&context_cache_lock);
+  g_bytes_unref (key);
+  return entry != NULL;
+}
+
+/* Forwards the surface requests of the VA context to the user */
+static GstVaapiSurfaceProxy *
+decoder_get_surface (GstVaapiContext * context, gpointer user_data)
+{
+  GstVaapiDecoder *const decoder = user_data;
+
+  return decoder->surface_func (decoder, context->info.chroma_type,
+      context->info.width, context->info.height, decoder->surface_data);
+}
+
+gboolean
+gst_vaapi_decoder_ensure_context (GstVaapiDecoder * decoder,
+    GstVaapiContextInfo * cip)
+{
+  gst_vaapi_decoder_set_picture_size (decoder, cip->width, cip->height);
+  context_cache_store (decoder, cip);
+
+  cip->usage = GST_VAAPI_CONTEXT_USAGE_DECODE;
+  cip->extra_surfaces = decoder->extra_surfaces;
+  cip->surface_alloc_flags = decoder->surface_alloc_flags;
+  cip->owner = decoder;
+  if (decoder->rendition_switch) {
+    if (context_fits (decoder->context, cip)
+        && !rendition_is_settled (decoder, cip)) {
+      GST_DEBUG ("keep %ux%u context for %ux%u pictures",
+          decoder->context->info.width, decoder->context->info.height,
+          cip->width, cip->height);
+      update_parallel_contexts (decoder);
+      update_output_processing (decoder);
+      return TRUE;
+    }
+    /* Leave room for the larger renditions, unless the stream settled
+       at a smaller one */
+    if (!context_fits (decoder->context, cip)) {
+      cip->width = MAX (cip->width, decoder->max_width);
+      cip->height = MAX (cip->height, decoder->max_height);
+    }
+    decoder->rendition_oversized_since = GST_CLOCK_TIME_NONE;
+  }
+
+  /* Recycled buffers belong to the VA context about to be replaced */
+  free_buffers_clear (decoder);
+
+  if (decoder->context) {
+    if (!gst_vaapi_context_reset (decoder->context, cip))
+      return FALSE;
+  } else {
+    decoder->context = gst_vaapi_context_new (decoder->display, cip);
+    if (!decoder->context)
+      return FALSE;
+  }
+  gst_vaapi_context_set_surface_tracking (decoder->context, TRUE);
+  gst_vaapi_context_set_starvation_recovery (decoder->context,
+      decoder->starvation_surfaces);
+  gst_vaapi_context_set_priority (decoder->context, decoder->priority);
+  gst_vaapi_context_set_surface_func (decoder->context,
+      decoder->surface_func ? decoder_get_surface : NULL, decoder);
+  decoder->va_context = gst_vaapi_context_get_id (decoder->context);
+  decoder->context_index = 0;
+  update_parallel_contexts (decoder);
+  update_output_processing (decoder);
+  return TRUE;
+}
+
+/*
+ * gst_vaapi_decoder_create_buffer:
+ * @decoder: a #GstVaapiDecoder
+ * @type: the VA buffer type
+ * @size: the VA buffer size, in bytes
+ * @data: (allow-none): the initial buffer contents
+ * @buf_id_ptr: return location for the VA buffer
+ * @mapped_data: (allow-none): return location for the mapped buffer
+ *
+ * Same as vaapi_create_buffer() except that a VA buffer of the same
+ * @type and @size, created for the current VA context and previously
+ * handed back through gst_vaapi_decoder_release_buffer(), is reused
+ * if available. In that case, the buffer is cleared if @data is %NULL.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_decoder_create_buffer (GstVaapiDecoder * decoder, guint type,
+    guint size, gconstpointer data, VABufferID * buf_id_ptr,
+    gpointer * mapped_data)
+{
+  return gst_vaapi_decoder_create_n_elements_buffer (decoder, type, size, 1,
+      data, buf_id_ptr, mapped_data);
+}
+
+/*
+ * gst_vaapi_decoder_create_n_elements_buffer:
+ * @decoder: a #GstVaapiDecoder
+ * @type: the VA buffer type
+ * @size: the size of a VA buffer element, in bytes
+ * @num_elements: the number of elements
+ * @data: (allow-none): the initial buffer contents
+ * @buf_id_ptr: return location for the VA buffer
+ * @mapped_data: (allow-none): return location for the mapped buffer
+ *
+ * Same as gst_vaapi_decoder_create_buffer() for a VA buffer holding an
+ * array of @num_elements elements, e.g. the parameters of several
+ * slices. Only buffers with the same number of elements are reused.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_decoder_create_n_elements_buffer (GstVaapiDecoder * decoder,
+    guint type, guint size, guint num_elements, gconstpointer data,
+    VABufferID * buf_id_ptr, gpointer * mapped_data)
+{
+  VABufferID buf_id = VA_INVALID_ID;
+  gpointer buf;
+  guint i;
+
+  g_mutex_lock (&decoder->buffers_lock);
+  for (i = decoder->free_buffers->len; i > 0; i--) {
+    GstVaapiDecoderBuffer *const entry =
+        &g_array_index (decoder->free_buffers, GstVaapiDecoderBuffer, i - 1);
+    if (entry->type == type && entry->size == size
+        && entry->num_elements == num_elements
+        && entry->context == decoder->va_context) {
+      buf_id = entry->id;
+      g_array_remove_index_fast (decoder->free_buffers, i - 1);
+      break;
+    }
+  }
+  g_mutex_unlock (&decoder->buffers_lock);
+
+  if (buf_id == VA_INVALID_ID)
+    return vaapi_create_n_elements_buffer (decoder->va_display,
+        decoder->va_context, type, size, data, buf_id_ptr, mapped_data,
+        num_elements);
+
+  buf = vaapi_map_buffer (decoder->va_display, buf_id);
+  if (!buf) {
+    vaapi_destroy_buffer (decoder->va_display, &buf_id);
+    return FALSE;
+  }
+
+  if (data)
+    memcpy (buf, data, (gsize) size * num_elements);
+  else
+    memset (buf, 0, (gsize) size * num_elements);
+
+  if (mapped_data)
+    *mapped_data = buf;
+  else
+    vaapi_unmap_buffer (decoder->va_display, buf_id, NULL);
+
+  *buf_id_ptr = buf_id;
+  return TRUE;
+}
+
+/*
+ * gst_vaapi_decoder_release_buffer:
+ * @decoder: a #GstVaapiDecoder
+ * @va_context: the VA context the buffer was created for
+ * @type: the VA buffer type
+ * @size: the VA buffer size, in bytes
+ * @buf_id_ptr: the VA buffer to release
+ *
+ * Hands an unmapped VA buffer back to @decoder for later reuse by
+ * gst_vaapi_decoder_create_buffer(), or destroys it if enough buffers
+ * are already kept around. The buffer must have been submitted and
+ * no longer be accessed by the hardware, i.e. this is only suitable
+ * for parameter buffers the driver consumes at vaRenderPicture() or
+ * vaEndPicture() time. @buf_id_ptr is reset to %VA_INVALID_ID.
+ */
+void
+gst_vaapi_decoder_release_buffer (GstVaapiDecoder * decoder,
+    VAContextID va_context, guint type, guint size, VABufferID * buf_id_ptr)
+{
+  gst_vaapi_decoder_release_n_elements_buffer (decoder, va_context, type,
+      size, 1, buf_id_ptr);
+}
+
+/*
+ * gst_vaapi_decoder_release_n_elements_buffer:
+ * @decoder: a #GstVaapiDecoder
+ * @va_context: the VA context the buffer was created for
+ * @type: the VA buffer type
+ * @size: the size of a VA buffer element, in bytes
+ * @num_elements: the number of elements
+ * @buf_id_ptr: the VA buffer to release
+ *
+ * Same as gst_vaapi_decoder_release_buffer() for a VA buffer created
+ * by gst_vaapi_decoder_create_n_elements_buffer().
+ */
+void
+gst_vaapi_decoder_release_n_elements_buffer (GstVaapiDecoder * decoder,
+    VAContextID va_context, guint type, guint size, guint num_elements,
+    VABufferID * buf_id_ptr)
+{
+  if (*buf_id_ptr == VA_INVALID_ID)
+    return;
+
+  g_mutex_lock (&decoder->buffers_lock);
+  if (decoder->free_buffers->len < MAX_FREE_BUFFERS) {
+    GstVaapiDecoderBuffer entry;
+
+    entry.id = *buf_id_ptr;
+    entry.context = va_context;
+    entry.type = type;
+    entry.size = size;
+    entry.num_elements = num_elements;
+    g_array_append_val (decoder->free_buffers, entry);
+    *buf_id_ptr = VA_INVALID_ID;
+  }
+  g_mutex_unlock (&decoder->buffers_lock);
+
+  vaapi_destroy_buffer (decoder->va_display, buf_id_ptr);
+}
+
+void
+gst_vaapi_decoder_push_frame (GstVaapiDecoder * decoder,
+    GstVideoCodecFrame * frame)
+{
+  push_frame (decoder, frame);
+}
+
+GstVaapiDecoderStatus
+gst_vaapi_decoder_parse (GstVaapiDecoder * decoder,
+    GstVideoCodecFrame * base_frame, GstAdapter * adapter, gboolean at_eos,
+    guint * got_unit_size_ptr, gboolean * got_frame_ptr)
+{
+  g_return_val_if_fail (decoder != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (base_frame != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (adapter != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (got_unit_size_ptr != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (got_frame_ptr != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  return do_parse (decoder, base_frame, adapter, at_eos,
+      got_unit_size_ptr, got_frame_ptr);
+}
+
+/**
+ * gst_vaapi_decoder_parse_packet:
+ * @decoder: a #GstVaapiDecoder
+ * @frame: a #GstVideoCodecFrame
+ *
+ * Parses all the units of the @frame input buffer, which shall hold a
+ * complete access unit made of length prefixed NAL units, e.g. access
+ * unit aligned avc or hvc1 streams. Unlike gst_vaapi_decoder_parse(),
+ * the input buffer is walked in place and is the one @frame is decoded
+ * from, so that no data are accumulated into, or copied out of, the
+ * caller adapter. @frame is then ready for gst_vaapi_decoder_decode().
+ *
+ * Return value: a #GstVaapiDecoderStatus
+ */
+GstVaapiDecoderStatus
+gst_vaapi_decoder_parse_packet (GstVaapiDecoder * decoder,
+    GstVideoCodecFrame * frame)
+{
+  GstVaapiParserState *ps;
+  GstVaapiParserFrame *parser_frame;
+  GstVaapiDecoderStatus status;
+  guint got_unit_size;
+  gboolean got_frame;
+
+  g_return_val_if_fail (decoder != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (frame != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (frame->input_buffer != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  ps = &decoder->parser_state;
+  gst_adapter_push (ps->packet_adapter, gst_buffer_ref (frame->input_buffer));
+
+  /* Units starting a new frame are kept in this one, since the buffer
+     holds a single access unit */
+  do {
+    status = do_parse (decoder, frame, ps->packet_adapter, FALSE,
+        &got_unit_size, &got_frame);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      break;
+    if (got_unit_size > 0)
+      gst_adapter_flush (ps->packet_adapter, got_unit_size);
+    else if (!ps->next_unit_pending)
+      break;
+  } while (gst_adapter_available (ps->packet_adapter) > 0);
+  gst_adapter_clear (ps->packet_adapter);
+
+  /* Trailing truncated NAL units are dropped, the access unit is still
+     decoded from the complete ones */
+  parser_frame = gst_video_codec_frame_get_user_data (frame);
+  if (status == GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA && parser_frame
+      && parser_frame->output_offset > 0)
+    status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+  return status;
+}
+
+GstVaapiDecoderStatus
+gst_vaapi_decoder_decode (GstVaapiDecoder * decoder, GstVideoCodecFrame * frame)
+{
+  g_return_val_if_fail (decoder != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (frame != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (frame->user_data != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  if (decoder->threaded && decode_thread_start (decoder))
+    return decode_thread_push (decoder, frame);
+  return do_decode (decoder, frame);
+}
+
+/**
+ * gst_vaapi_decoder_sync:
+ * @decoder: a #GstVaapiDecoder
+ *
+ * Waits for all the frames submitted through gst_vaapi_decoder_decode()
+ * to be decoded. This is a no-op if the threaded decode mode is not
+ * enabled.
+ *
+ * Return value: the first error that occurred while decoding the
+ *   pending frames, or %GST_VAAPI_DECODER_STATUS_SUCCESS
+ */
+GstVaapiDecoderStatus
+gst_vaapi_decoder_sync (GstVaapiDecoder * decoder)
+{
+  g_return_val_if_fail (decoder != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  return decode_thread_sync (decoder);
+}
+
+/**
+ * gst_vaapi_decoder_set_threaded:
+ * @decoder: a #GstVaapiDecoder
+ * @threaded: %TRUE to decode frames in a separate thread
+ *
+ * If @threaded is %TRUE, gst_vaapi_decoder_decode() only queues the
+ * parsed frame and returns immediately. The decode units are then
+ * submitted to the hardware from a dedicated thread, so that parsing
+ * of the next frame overlaps with the decoding of the current one.
+ *
+ * Decoded frames are still retrieved with gst_vaapi_decoder_get_frame()
+ * and the codec state changed callback is always invoked from the
+ * thread calling it. Decode errors are reported by the next call to
+ * gst_vaapi_decoder_decode(), gst_vaapi_decoder_sync() or
+ * gst_vaapi_decoder_flush().
+ */
+void
+gst_vaapi_decoder_set_threaded (GstVaapiDecoder * decoder, gboolean threaded)
+{
+  g_return_if_fail (decoder != NULL);
+
+  if (!threaded)
+    decode_thread_stop (decoder);
+  decoder->threaded = threaded;
+}
+
+/**
+ * gst_vaapi_decoder_get_threaded:
+ * @decoder: a #GstVaapiDecoder
+ *
+ * Return value: %TRUE if the threaded decode mode is enabled
+ */
+gboolean
+gst_vaapi_decoder_get_threaded (GstVaapiDecoder * decoder)
+{
+  g_return_val_if_fail (decoder != NULL, FALSE);
+
+  return decoder->threaded;
+}
+
+/**
+ * gst_vaapi_decoder_set_job_deadline:
+ * @decoder: a #GstVaapiDecoder
+ * @deadline: the clock time the next pictures should be decoded by,
+ *   or %GST_CLOCK_TIME_NONE
+ *
+ * Sets the deadline the next picture submissions are scheduled with
+ * when the #GstVaapiDisplay:job-scheduling of the display is enabled.
+ */
+void
+gst_vaapi_decoder_set_job_deadline (GstVaapiDecoder * decoder,
+    GstClockTime deadline)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->job_deadline = deadline;
+}
+
+/**
+ * gst_vaapi_decoder_get_error_stats:
+ * @decoder: a #GstVaapiDecoder
+ * @stats: (out caller-allocates): the #GstVaapiDecoderErrorStats to fill
+ *
+ * Reads back how many pictures were decoded with substituted
+ * references, when the error concealment mode of the codec decoder is
+ * enabled. This function may be called from any thread.
+ */
+void
+gst_vaapi_decoder_get_error_stats (GstVaapiDecoder * decoder,
+    GstVaapiDecoderErrorStats * stats)
+{
+  g_return_if_fail (decoder != NULL);
+  g_return_if_fail (stats != NULL);
+
+  stats->concealed_pictures = g_atomic_int_get (&decoder->concealed_pictures);
+  stats->missing_references = g_atomic_int_get (&decoder->missing_references);
+}
+
+/* Accounts a picture decoded with @missing_references substituted
+   reference list entries */
+void
+gst_vaapi_decoder_add_concealed_picture (GstVaapiDecoder * decoder,
+    guint missing_references)
+{
+  g_atomic_int_inc (&decoder->concealed_pictures);
+  g_atomic_int_add (&decoder->missing_references, missing_references);
+}
+
+/**
+ * gst_vaapi_decoder_set_skip_mode:
+ * @decoder: a #GstVaapiDecoder
+ * @skip_mode: the #GstVaapiDecoderSkipMode
+ *
+ * Selects the pictures the decoder drops before submitting them to
+ * the hardware. Skipped frames are returned as decode-only frames,
+ * without a surface proxy. The mode applies from the next picture
+ * onwards and may be changed from any thread, except when leaving
+ * %GST_VAAPI_DECODER_SKIP_NON_KEY: the pictures up to the next key
+ * picture are skipped still, since they may reference skipped ones.
+ */
+void
+gst_vaapi_decoder_set_skip_mode (GstVaapiDecoder * decoder,
+    GstVaapiDecoderSkipMode skip_mode)
+{
+  g_return_if_fail (decoder != NULL);
+
+  g_atomic_int_set (&decoder->skip_mode_requested, skip_mode);
+  if (skip_mode == GST_VAAPI_DECODER_SKIP_NON_KEY
+      || g_atomic_int_get (&decoder->skip_mode) !=
+      GST_VAAPI_DECODER_SKIP_NON_KEY)
+    g_atomic_int_set (&decoder->skip_mode, skip_mode);
+}
+
+/* Called by the decoders once a picture passed the skip mode checks.
+   In GST_VAAPI_DECODER_SKIP_NON_KEY mode, this is a key picture, from
+   which the requested mode can apply */
+void
+gst_vaapi_decoder_update_skip_mode (GstVaapiDecoder * decoder)
+{
+  g_atomic_int_set (&decoder->skip_mode,
+      g_atomic_int_get (&decoder->skip_mode_requested));
+}
+
+/**
+ * gst_vaapi_decoder_get_skip_mode:
+ * @decoder: a #GstVaapiDecoder
+ *
+ * Return value: the #GstVaapiDecoderSkipMode of @decoder
+ */
+GstVaapiDecoderSkipMode
+gst_vaapi_decoder_get_skip_mode (GstVaapiDecoder * decoder)
+{
+  g_return_val_if_fail (decoder != NULL, GST_VAAPI_DECODER_SKIP_NONE);
+
+  return g_atomic_int_get (&decoder->skip_mode);
+}
+
+/**
+ * gst_vaapi_decoder_set_rendition_switch:
+ * @decoder: a #GstVaapiDecoder
+ * @rendition_switch: %TRUE to keep the VA context across size changes
+ *
+ * Enables the rendition switch mode, meant for adaptive streaming.
+ * In that mode, the VA context and its surfaces are kept as long as
+ * the new stream needs no larger surfaces nor more of them, and has
+ * the same profile and chroma format. Pictures smaller than the
+ * surfaces are output with a crop rectangle.
+ */
+void
+gst_vaapi_decoder_set_rendition_switch (GstVaapiDecoder * decoder,
+    gboolean rendition_switch)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->rendition_switch = rendition_switch;
+}
+
+/**
+ * gst_vaapi_decoder_set_max_picture_size:
+ * @decoder: a #GstVaapiDecoder
+ * @max_width: the largest picture width expected, or 0
+ * @max_height: the largest picture height expected, or 0
+ *
+ * Sets the minimal size of the surfaces allocated in rendition switch
+ * mode, so that switching up to a rendition of that size does not
+ * have to re-create the VA context.
+ */
+void
+gst_vaapi_decoder_set_max_picture_size (GstVaapiDecoder * decoder,
+    guint max_width, guint max_height)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->max_width = max_width;
+  decoder->max_height = max_height;
+}
+
+/**
+ * gst_vaapi_decoder_set_rendition_settle_time:
+ * @decoder: a #GstVaapiDecoder
+ * @settle_time: the time in nanoseconds, or %GST_CLOCK_TIME_NONE
+ *
+ * Sets how long the surfaces kept in rendition switch mode may stay
+ * larger than the pictures. Once it has elapsed since the stream
+ * switched down, the next switch that still fits re-creates the VA
+ * context at the picture size. %GST_CLOCK_TIME_NONE keeps the
+ * surfaces until the stream grows out of them.
+ */
+void
+gst_vaapi_decoder_set_rendition_settle_time (GstVaapiDecoder * decoder,
+    GstClockTime settle_time)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->rendition_settle_time = settle_time;
+}
+
+/**
+ * gst_vaapi_decoder_set_downstream_surfaces:
+ * @decoder: a #GstVaapiDecoder
+ * @num_surfaces: the number of decoded surfaces downstream may hold
+ *
+ * Sets the number of output surfaces that downstream elements keep
+ * while more pictures are decoded, e.g. the minimum number of buffers
+ * of the allocation query. The next VA context is then created with
+ * exactly that many spare surfaces, besides the DPB and the picture
+ * being decoded, instead of a fixed default. More surfaces are still
+ * allocated on demand if downstream appears to queue more.
+ */
+void
+gst_vaapi_decoder_set_downstream_surfaces (GstVaapiDecoder * decoder,
+    guint num_surfaces)
+{
+  g_return_if_fail (decoder != NULL);
+
+  /* one more for the picture being decoded */
+  decoder->extra_surfaces = num_surfaces + 1;
+}
+
+/**
+ * gst_vaapi_decoder_set_starvation_recovery:
+ * @decoder: a #GstVaapiDecoder
+ * @max_surfaces: the number of surfaces to allocate past a full pool
+ *
+ * Sets how many more decoded surfaces may be allocated, temporarily,
+ * when none is available, e.g. because downstream elements hold on
+ * to too many of them, instead of failing to decode the picture.
+ * Zero disables the recovery.
+ */
+void
+gst_vaapi_decoder_set_starvation_recovery (GstVaapiDecoder * decoder,
+    guint max_surfaces)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->starvation_surfaces = max_surfaces;
+  if (decoder->context)
+    gst_vaapi_context_set_starvation_recovery (decoder->context,
+        max_surfaces);
+}
+
+/**
+ * gst_vaapi_decoder_set_priority:
+ * @decoder: a #GstVaapiDecoder
+ * @priority: the #GstVaapiPriority
+ *
+ * Sets the GPU priority the driver schedules the pictures of
+ * @decoder with, relative to the other VA contexts. It takes effect
+ * from the next decoded picture, and is ignored by drivers without
+ * context priorities.
+ */
+void
+gst_vaapi_decoder_set_priority (GstVaapiDecoder * decoder,
+    GstVaapiPriority priority)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->priority = priority;
+  if (decoder->context)
+    gst_vaapi_context_set_priority (decoder->context, priority);
+}
+
+/**
+ * gst_vaapi_decoder_set_surface_func:
+ * @decoder: a #GstVaapiDecoder
+ * @func: (allow-none): the #GstVaapiDecoderSurfaceFunc, or %NULL
+ * @user_data: the user data to pass to @func
+ *
+ * Sets a function providing the surfaces pictures are decoded into,
+ * instead of the surfaces of the VA context. The decoder falls back
+ * to the latter whenever @func returns %NULL, so @func should not
+ * block. This is meant to be set up before decoding starts.
+ */
+void
+gst_vaapi_decoder_set_surface_func (GstVaapiDecoder * decoder,
+    GstVaapiDecoderSurfaceFunc func, gpointer user_data)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->surface_func = func;
+  decoder->surface_data = user_data;
+  if (decoder->context)
+    gst_vaapi_context_set_surface_func (decoder->context,
+        func ? decoder_get_surface : NULL, decoder);
+}
+
+/**
+ * gst_vaapi_decoder_get_surface_stats:
+ * @decoder: a #GstVaapiDecoder
+ * @stats: (out caller-allocates): the #GstVaapiDecoderSurfaceStats to
+ *   fill
+ *
+ * Reports how long the decoded surfaces have been in use and who
+ * holds the oldest one, so that downstream elements holding on to
+ * surfaces can be told from slow decoding. The holders are named
+ * through gst_vaapi_surface_proxy_set_holder().
+ */
+void
+gst_vaapi_decoder_get_surface_stats (GstVaapiDecoder * decoder,
+    GstVaapiDecoderSurfaceStats * stats)
+{
+  GstVaapiContextSurfaceStats context_stats;
+
+  g_return_if_fail (decoder != NULL);
+  g_return_if_fail (stats != NULL);
+
+  memset (stats, 0, sizeof (*stats));
+  if (!decoder->context)
+    return;
+
+  gst_vaapi_context_get_surface_stats (decoder->context, &context_stats);
+  stats->num_in_use = context_stats.num_in_use;
+  stats->oldest_age = context_stats.oldest_age;
+  stats->oldest_holder = context_stats.oldest_holder;
+  stats->num_starvations = context_stats.num_starvations;
+  stats->num_recoveries = context_stats.num_recoveries;
+}
+
+/**
+ * gst_vaapi_decoder_set_parallel_contexts:
+ * @decoder: a #GstVaapiDecoder
+ * @num_contexts: the number of VA contexts to decode on, at least 1
+ *
+ * Sets the number of VA contexts pictures are spread over, in turn,
+ * when the stream is known to be made of intra pictures only, e.g.
+ * an H.264 or H.265 sequence that allows no reference picture. Such
+ * pictures are independent, so drivers can decode several of them
+ * at once, possibly on several engines. Pictures are still output in
+ * presentation order. Other streams always use a single VA context.
+ */
+void
+gst_vaapi_decoder_set_parallel_contexts (GstVaapiDecoder * decoder,
+    guint num_contexts)
+{
+  g_return_if_fail (decoder != NULL);
+  g_return_if_fail (num_contexts > 0);
+
+  decoder->parallel_contexts = num_contexts;
+  update_parallel_contexts (decoder);
+}
+
+/**
+ * gst_vaapi_decoder_set_surface_alloc_flags:
+ * @decoder: a #GstVaapiDecoder
+ * @flags: the #GstVaapiSurfaceAllocFlags of the decoded surfaces
+ *
+ * Sets how the decoded surfaces, and those output by the decode
+ * processing, are allocated, e.g. with
+ * %GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED once downstream is known to
+ * only hand them to VA engines. Since this is usually known after the
+ * first pictures were decoded, the surfaces of the current VA context
+ * are re-created. Those still held are released as usual.
+ */
+void
+gst_vaapi_decoder_set_surface_alloc_flags (GstVaapiDecoder * decoder,
+    guint flags)
+{
+  GstVaapiContextInfo info;
+
+  g_return_if_fail (decoder != NULL);
+
+  if (decoder->surface_alloc_flags == flags)
+    return;
+  decoder->surface_alloc_flags = flags;
+  gst_vaapi_video_pool_replace (&decoder->proc_pool, NULL);
+  if (!decoder->context)
+    return;
+
+  GST_DEBUG ("surface allocation flags changed to 0x%x", flags);
+  info = decoder->context->info;
+  info.surface_alloc_flags = flags;
+
+  free_buffers_clear (decoder);
+  if (!gst_vaapi_context_reset (decoder->context, &info)) {
+    GST_WARNING ("failed to re-create the decoded surfaces");
+    return;
+  }
+  decoder->va_context = gst_vaapi_context_get_id (decoder->context);
+  decoder->context_index = 0;
+  update_parallel_contexts (decoder);
+  update_output_processing (decoder);
+}
+
+/**
+ * gst_vaapi_decoder_set_output_processing:
+ * @decoder: a #GstVaapiDecoder
+ * @format: the output #GstVideoFormat, or %GST_VIDEO_FORMAT_UNKNOWN to
+ *   keep the decoded one
+ * @width: the output width, or 0 to output the decoded surfaces
+ * @height: the output height, or 0 to output the decoded surfaces
+ *
+ * Requests the output pictures to be scaled and converted to @format
+ * at @width x @height by the decode pipeline itself, e.g. the scaler
+ * fixed-function of Intel hardware, instead of a separate video
+ * processing pass. The reference pictures are still kept at the stream
+ * resolution.
+ *
+ * This only takes effect if the driver supports decode processing for
+ * the stream profile, and for progressive streams. Otherwise, the
+ * decoded surfaces are output as is, so the output surface size tells
+ * which one happened. This is meant to be called before decoding, or
+ * while no picture is being decoded.
+ */
+void
+gst_vaapi_decoder_set_output_processing (GstVaapiDecoder * decoder,
+    GstVideoFormat format, guint width, guint height)
+{
+  g_return_if_fail (decoder != NULL);
+
+  if (!width || !height)
+    width = height = 0;
+
+  decoder->proc_format = format;
+  decoder->proc_width = width;
+  decoder->proc_height = height;
+  update_output_processing (decoder);
+}
+
+/*
+ * gst_vaapi_decoder_set_intra_only:
+ * @decoder: a #GstVaapiDecoder
+ * @intra_only: %TRUE if no picture of the stream references another
+ *
+ * Called by the codec decoders when a new sequence is activated, so
+ * that pictures are only spread over several VA contexts while they
+ * are independent.
+ */
+void
+gst_vaapi_decoder_set_intra_only (GstVaapiDecoder * decoder,
+    gboolean intra_only)
+{
+  if (decoder->intra_only == !!intra_only)
+    return;
+
+  GST_DEBUG ("%s intra-only stream", intra_only ? "entering" : "leaving");
+  decoder->intra_only = !!intra_only;
+  update_parallel_contexts (decoder);
+}
+
+/*
+ * gst_vaapi_decoder_select_va_context:
+ * @decoder: a #GstVaapiDecoder
+ *
+ * Selects the VA context the next picture and its buffers are created
+ * for, cycling through the available ones.
+ *
+ * Return value: the selected VA context
+ */
+VAContextID
+gst_vaapi_decoder_select_va_context (GstVaapiDecoder * decoder)
+{
+  guint num_contexts;
+
+  if (!decoder->context)
+    return decoder->va_context;
+
+  num_contexts = gst_vaapi_context_get_num_ids (decoder->context);
+  if (num_contexts > 1) {
+    decoder->context_index = (decoder->context_index + 1) % num_contexts;
+    decoder->va_context = gst_vaapi_context_get_nth_id (decoder->context,
+        decoder->context_index);
+  }
+  return decoder->va_context;
+}
+
+/** Returns a GType for the #GstVaapiDecoderSkipMode set */
+GType
+gst_vaapi_decoder_skip_mode_get_type (void)
+{
+  static volatile gsize g_type = 0;
+
+  static const GEnumValue skip_mode_values[] = {
+    /* *INDENT-OFF* */
+    { GST_VAAPI_DECODER_SKIP_NONE,
+      "Decode all frames", "none" },
+    { GST_VAAPI_DECODER_SKIP_NON_REFERENCE,
+      "Skip non-reference frames", "non-reference" },
+    { GST_VAAPI_DECODER_SKIP_NON_KEY,
+      "Decode intra frames only", "non-key" },
+    { 0, NULL, NULL },
+    /* *INDENT-ON* */
+  };
+
+  if (g_once_init_enter (&g_type)) {
+    GType type =
+        g_enum_register_static ("GstVaapiDecoderSkipMode", skip_mode_values);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
+/* This function really marks the end of input,
+ * so that the decoder will drain out any pending
+ * frames on calls to gst_vaapi_decoder_get_frame_with_timeout() */
+GstVaapiDecoderStatus
+gst_vaapi_decoder_flush (GstVaapiDecoder * decoder)
+{
+  GstVaapiDecoderClass *klass;
+  GstVaapiDecoderStatus status;
+
+  g_return_val_if_fail (decoder != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  klass = GST_VAAPI_DECODER_GET_CLASS (decoder);
+
+  status = decode_thread_sync (decoder);
+
+  if (klass->flush) {
+    GstVaapiDecoderStatus flush_status = klass->flush (decoder);
+    if (flush_status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return flush_status;
+  }
+
+  return status;
+}
+
+/* Reset the decoder instance to a clean state,
+ * clearing any pending decode state, without
+ * reallocating the entire decoder */
+GstVaapiDecoderStatus
 gst_vaapi_decoder_reset (GstVaapiDecoder * decoder)
 {
   GstVaapiDecoderClass *klass;
@@ -1061,6 +2572,8 @@ gst_vaapi_decoder_reset (GstVaapiDecoder * decoder)
 
   GST_DEBUG ("Resetting decoder");
 
+  decode_thread_sync (decoder);
+
   if (klass->reset) {
     ret = klass->reset (decoder);
   } else {
@@ -1070,16 +2583,18 @@ gst_vaapi_decoder_reset (GstVaapiDecoder * decoder)
   if (ret != GST_VAAPI_DECODER_STATUS_SUCCESS)
     return ret;
 
+  /* The next picture cannot reference the skipped ones */
+  gst_vaapi_decoder_update_skip_mode (decoder);
+
   /* Clear any buffers and frame in the queues */
   {
     GstVideoCodecFrame *frame;
-    GstBuffer *buffer;
 
     while ((frame = g_async_queue_try_pop (decoder->frames)) != NULL)
       gst_video_codec_frame_unref (frame);
+    decode_errors_clear (decoder);
 
-    while ((buffer = g_async_queue_try_pop (decoder->buffers)) != NULL)
-      gst_buffer_unref (buffer);
+    input_queue_clear (decoder);
   }
 
   parser_state_reset (&decoder->parser_state);
@@ -1093,6 +2608,7 @@ gst_vaapi_decoder_decode_codec_data (GstVaapiDecoder * decoder)
   GstVaapiDecoderClass *const klass = GST_VAAPI_DECODER_GET_CLASS (decoder);
   GstBuffer *const codec_data = GST_VAAPI_DECODER_CODEC_DATA (decoder);
   GstVaapiDecoderStatus status;
+  GstVaapiContextInfo info;
   GstMapInfo map_info;
   const guchar *buf;
   guint buf_size;
@@ -1116,6 +2632,16 @@ gst_vaapi_decoder_decode_codec_data (GstVaapiDecoder * decoder)
   else
     status = GST_VAAPI_DECODER_STATUS_SUCCESS;
   gst_buffer_unmap (codec_data, &map_info);
+
+  /* The cached parameters may not suit this display, in which case the
+     context is set up from the sequence headers as usual */
+  if (status == GST_VAAPI_DECODER_STATUS_SUCCESS && !decoder->context
+      && context_cache_lookup (decoder, &info)) {
+    GST_DEBUG ("known stream, setting up a %ux%u context for profile %s",
+        info.width, info.height, gst_vaapi_profile_get_va_name (info.profile));
+    if (!gst_vaapi_decoder_ensure_context (decoder, &info))
+      GST_DEBUG ("failed to set up the context of a known stream");
+  }
   return status;
 }
 
@@ -1146,6 +2672,9 @@ gst_vaapi_decoder_update_caps (GstVaapiDecoder * decoder, GstCaps * caps)
   if (!decoder_caps)
     return FALSE;
 
+  /* The codec state must not change under the decode thread */
+  decode_thread_sync (decoder);
+
   if (gst_caps_is_always_compatible (caps, decoder_caps))
     return set_caps (decoder, caps);
 
@@ -77,9 +77,127 @@ typedef enum {
   GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN = -1
 } GstVaapiDecoderStatus;
 
+/**
+ * GstVaapiDecoderErrorStats:
+ * @concealed_pictures: number of pictures decoded with substituted
+ *   references
+ * @missing_references: number of reference list entries that had to
+ *   be substituted
+ *
+ * Error concealment statistics, accumulated since the decoder was
+ * created.
+ */
+typedef struct {
+  guint concealed_pictures;
+  guint missing_references;
+} GstVaapiDecoderErrorStats;
+
+/**
+ * GstVaapiDecoderSurfaceFunc:
+ * @decoder: a #GstVaapiDecoder
+ * @chroma_type: the #GstVaapiChromaType of the decoded surfaces
+ * @width: the minimum width of the surface
+ * @height: the minimum height of the surface
+ * @user_data: the user data passed to
+ *   gst_vaapi_decoder_set_surface_func()
+ *
+ * Provides a surface to decode a picture into, e.g. one imported from
+ * a buffer downstream allocated.
+ *
+ * Return value: (transfer full): a #GstVaapiSurfaceProxy, or %NULL to
+ *   allocate the surface from the decoder pool
+ */
+typedef GstVaapiSurfaceProxy *(*GstVaapiDecoderSurfaceFunc) (
+    GstVaapiDecoder * decoder, GstVaapiChromaType chroma_type, guint width,
+    guint height, gpointer user_data);
+
+/**
+ * GstVaapiDecoderSurfaceStats:
+ * @num_in_use: number of decoded surfaces in use, by the decoder or
+ *   downstream
+ * @oldest_age: how long the oldest of them has been in use
+ * @oldest_holder: (nullable): the name of the element holding it, or
+ *   %NULL if the decoder itself still does
+ * @num_starvations: number of times no surface was available
+ * @num_recoveries: number of those times the pool was grown, see
+ *   gst_vaapi_decoder_set_starvation_recovery()
+ *
+ * Usage of the decoded surfaces of the current VA context.
+ */
+typedef struct {
+  guint num_in_use;
+  GstClockTime oldest_age;
+  const gchar *oldest_holder;
+  guint num_starvations;
+  guint num_recoveries;
+} GstVaapiDecoderSurfaceStats;
+
+/**
+ * GstVaapiDecoderInputOverflow:
+ * @GST_VAAPI_DECODER_INPUT_OVERFLOW_BLOCK: gst_vaapi_decoder_put_buffer()
+ *   waits until the decoding thread made room in the queue.
+ * @GST_VAAPI_DECODER_INPUT_OVERFLOW_DROP_OLDEST: the oldest queued
+ *   buffers are dropped to make room. The parser starts over after
+ *   the drop, and the pictures up to the next key picture are
+ *   skipped, since they may reference dropped ones. Only H.264 and
+ *   H.265 decoders support it.
+ *
+ * What happens to a buffer queued past the limits set with
+ * gst_vaapi_decoder_set_input_limits().
+ */
+typedef enum {
+  GST_VAAPI_DECODER_INPUT_OVERFLOW_BLOCK = 0,
+  GST_VAAPI_DECODER_INPUT_OVERFLOW_DROP_OLDEST,
+} GstVaapiDecoderInputOverflow;
+
+/**
+ * GstVaapiDecoderInputStats:
+ * @num_buffers: number of compressed buffers queued
+ * @num_bytes: their total size
+ * @max_num_buffers: the most buffers queued at once
+ * @max_num_bytes: the most bytes queued at once
+ * @num_waits: number of times gst_vaapi_decoder_put_buffer() waited
+ *   for room in the queue
+ * @num_dropped: number of buffers dropped to make room
+ *
+ * Depth of the queue of compressed input, accumulated since the
+ * decoder was created.
+ */
+typedef struct {
+  guint num_buffers;
+  guint64 num_bytes;
+  guint max_num_buffers;
+  guint64 max_num_bytes;
+  guint num_waits;
+  guint num_dropped;
+} GstVaapiDecoderInputStats;
+
+/**
+ * GstVaapiDecoderSkipMode:
+ * @GST_VAAPI_DECODER_SKIP_NONE: Decode all pictures.
+ * @GST_VAAPI_DECODER_SKIP_NON_REFERENCE: Skip the pictures no other
+ *   picture is predicted from.
+ * @GST_VAAPI_DECODER_SKIP_NON_KEY: Decode intra coded pictures only.
+ *
+ * The pictures the decoder drops before submitting them to the
+ * hardware, e.g. for fast seeking or thumbnail generation. Skip modes
+ * are only implemented by the H.264 and H.265 decoders.
+ */
+typedef enum {
+  GST_VAAPI_DECODER_SKIP_NONE = 0,
+  GST_VAAPI_DECODER_SKIP_NON_REFERENCE,
+  GST_VAAPI_DECODER_SKIP_NON_KEY,
+} GstVaapiDecoderSkipMode;
+
+#define GST_VAAPI_TYPE_DECODER_SKIP_MODE \
+    (gst_vaapi_decoder_skip_mode_get_type ())
+
 GType
 gst_vaapi_decoder_get_type (void) G_GNUC_CONST;
 
+GType
+gst_vaapi_decoder_skip_mode_get_type (void) G_GNUC_CONST;
+
 void
 gst_vaapi_decoder_replace (GstVaapiDecoder ** old_decoder_ptr,
     GstVaapiDecoder * new_decoder);
@@ -106,6 +224,15 @@ gst_vaapi_decoder_get_caps (GstVaapiDecoder * decoder);
 gboolean
 gst_vaapi_decoder_put_buffer (GstVaapiDecoder * decoder, GstBuffer * buf);
 
+gboolean
+gst_vaapi_decoder_set_input_limits (GstVaapiDecoder * decoder,
+    gsize max_bytes, guint max_buffers,
+    GstVaapiDecoderInputOverflow overflow);
+
+void
+gst_vaapi_decoder_get_input_stats (GstVaapiDecoder * decoder,
+    GstVaapiDecoderInputStats * stats);
+
 GstVaapiDecoderStatus
 gst_vaapi_decoder_get_surface (GstVaapiDecoder * decoder,
     GstVaapiSurfaceProxy ** out_proxy_ptr);
@@ -123,6 +250,10 @@ gst_vaapi_decoder_parse (GstVaapiDecoder * decoder,
     GstVideoCodecFrame * frame, GstAdapter * adapter, gboolean at_eos,
     guint * got_unit_size_ptr, gboolean * got_frame_ptr);
 
+GstVaapiDecoderStatus
+gst_vaapi_decoder_parse_packet (GstVaapiDecoder * decoder,
+    GstVideoCodecFrame * frame);
+
 GstVaapiDecoderStatus
 gst_vaapi_decoder_decode (GstVaapiDecoder * decoder,
     GstVideoCodecFrame * frame);
@@ -130,6 +261,74 @@ gst_vaapi_decoder_decode (GstVaapiDecoder * decoder,
 GstVaapiDecoderStatus
 gst_vaapi_decoder_flush (GstVaapiDecoder * decoder);
 
+GstVaapiDecoderStatus
+gst_vaapi_decoder_sync (GstVaapiDecoder * decoder);
+
+void
+gst_vaapi_decoder_set_threaded (GstVaapiDecoder * decoder, gboolean threaded);
+
+gboolean
+gst_vaapi_decoder_get_threaded (GstVaapiDecoder * decoder);
+
+void
+gst_vaapi_decoder_set_job_deadline (GstVaapiDecoder * decoder,
+    GstClockTime deadline);
+
+void
+gst_vaapi_decoder_get_error_stats (GstVaapiDecoder * decoder,
+    GstVaapiDecoderErrorStats * stats);
+
+void
+gst_vaapi_decoder_set_skip_mode (GstVaapiDecoder * decoder,
+    GstVaapiDecoderSkipMode skip_mode);
+
+GstVaapiDecoderSkipMode
+gst_vaapi_decoder_get_skip_mode (GstVaapiDecoder * decoder);
+
+void
+gst_vaapi_decoder_set_rendition_switch (GstVaapiDecoder * decoder,
+    gboolean rendition_switch);
+
+void
+gst_vaapi_decoder_set_max_picture_size (GstVaapiDecoder * decoder,
+    guint max_width, guint max_height);
+
+void
+gst_vaapi_decoder_set_rendition_settle_time (GstVaapiDecoder * decoder,
+    GstClockTime settle_time);
+
+void
+gst_vaapi_decoder_set_downstream_surfaces (GstVaapiDecoder * decoder,
+    guint num_surfaces);
+
+void
+gst_vaapi_decoder_set_starvation_recovery (GstVaapiDecoder * decoder,
+    guint max_surfaces);
+
+void
+gst_vaapi_decoder_set_priority (GstVaapiDecoder * decoder,
+    GstVaapiPriority priority);
+
+void
+gst_vaapi_decoder_get_surface_stats (GstVaapiDecoder * decoder,
+    GstVaapiDecoderSurfaceStats * stats);
+
+void
+gst_vaapi_decoder_set_surface_func (GstVaapiDecoder * decoder,
+    GstVaapiDecoderSurfaceFunc func, gpointer user_data);
+
+void
+gst_vaapi_decoder_set_parallel_contexts (GstVaapiDecoder * decoder,
+    guint num_contexts);
+
+void
+gst_vaapi_decoder_set_surface_alloc_flags (GstVaapiDecoder * decoder,
+    guint flags);
+
+void
+gst_vaapi_decoder_set_output_processing (GstVaapiDecoder * decoder,
+    GstVideoFormat format, guint width, guint height);
+
 GstVaapiDecoderStatus
 gst_vaapi_decoder_reset (GstVaapiDecoder * decoder);
 
@@ -0,0 +1,1261 @@
+/*
+ *  gstvaapidecoder_av1.c - AV1 decoder
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:gstvaapidecoder_av1
+ * @short_description: AV1 decoder
+ */
+
+#include "sysdeps.h"
+#include <gst/codecparsers/gstav1parser.h>
+#include "gstvaapidecoder_av1.h"
+#include "gstvaapidecoder_objects.h"
+#include "gstvaapidecoder_priv.h"
+#include "gstvaapidisplay_priv.h"
+
+#include "gstvaapicompat.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+#define GST_VAAPI_DECODER_AV1_CAST(decoder) \
+  ((GstVaapiDecoderAV1 *)(decoder))
+
+typedef struct _GstVaapiDecoderAV1Private GstVaapiDecoderAV1Private;
+typedef struct _GstVaapiDecoderAV1Class GstVaapiDecoderAV1Class;
+typedef struct _GstVaapiPictureAV1 GstVaapiPictureAV1;
+
+/* ------------------------------------------------------------------------- */
+/* --- AV1 Pictures                                                      --- */
+/* ------------------------------------------------------------------------- */
+
+#define GST_VAAPI_PICTURE_AV1(picture) \
+    ((GstVaapiPictureAV1 *)(picture))
+
+struct _GstVaapiPictureAV1
+{
+  GstVaapiPicture base;
+  /* The reconstructed frame, used for prediction. This is the output
+   * surface itself unless film grain is applied, in which case the
+   * driver writes the grain into the output surface only */
+  GstVaapiSurfaceProxy *recon_proxy;
+};
+
+GST_VAAPI_CODEC_DEFINE_TYPE (GstVaapiPictureAV1, gst_vaapi_picture_av1);
+
+void
+gst_vaapi_picture_av1_destroy (GstVaapiPictureAV1 * picture)
+{
+  gst_vaapi_surface_proxy_replace (&picture->recon_proxy, NULL);
+  gst_vaapi_picture_destroy (GST_VAAPI_PICTURE (picture));
+}
+
+gboolean
+gst_vaapi_picture_av1_create (GstVaapiPictureAV1 * picture,
+    const GstVaapiCodecObjectConstructorArgs * args)
+{
+  if (!gst_vaapi_picture_create (GST_VAAPI_PICTURE (picture), args))
+    return FALSE;
+
+  picture->recon_proxy = gst_vaapi_surface_proxy_ref (picture->base.proxy);
+  return TRUE;
+}
+
+static inline GstVaapiPictureAV1 *
+gst_vaapi_picture_av1_new (GstVaapiDecoderAV1 * decoder)
+{
+  return (GstVaapiPictureAV1 *)
+      gst_vaapi_codec_object_new (&GstVaapiPictureAV1Class,
+      GST_VAAPI_CODEC_BASE (decoder), NULL,
+      sizeof (VADecPictureParameterBufferAV1), NULL, 0, 0);
+}
+
+/* ------------------------------------------------------------------------- */
+/* --- AV1 Decoder                                                       --- */
+/* ------------------------------------------------------------------------- */
+
+struct _GstVaapiDecoderAV1Private
+{
+  GstVaapiProfile profile;
+  guint width;
+  guint height;
+  GstAV1Parser *parser;
+  GstAV1SequenceHeaderOBU seq_header;
+  GstAV1FrameHeaderOBU frame_header;
+  GstVaapiPictureAV1 *current_picture;
+  GstVaapiPictureAV1 *ref_frames[GST_AV1_NUM_REF_FRAMES];
+
+  GstVaapiPicture *output_picture;      /* to output for the current frame */
+
+  /* anchor frames for large scale tile decoding, i.e. the reference
+   * frames in ref_frame_map order */
+  VASurfaceID anchor_frames[GST_AV1_NUM_REF_FRAMES];
+
+  guint is_opened:1;
+  guint has_seq_header:1;
+  guint film_grain:1;           /* context sized for film grain surfaces */
+  guint output_existing:1;      /* output_picture is shown again */
+  guint size_changed:1;
+};
+
+/**
+ * GstVaapiDecoderAV1:
+ *
+ * A decoder based on AV1.
+ */
+struct _GstVaapiDecoderAV1
+{
+  /*< private > */
+  GstVaapiDecoder parent_instance;
+
+  GstVaapiDecoderAV1Private priv;
+};
+
+/**
+ * GstVaapiDecoderAV1Class:
+ *
+ * A decoder class based on AV1.
+ */
+struct _GstVaapiDecoderAV1Class
+{
+  /*< private > */
+  GstVaapiDecoderClass parent_class;
+};
+
+G_DEFINE_TYPE (GstVaapiDecoderAV1, gst_vaapi_decoder_av1,
+    GST_TYPE_VAAPI_DECODER);
+
+static GstVaapiDecoderStatus
+get_status (GstAV1ParserResult result)
+{
+  GstVaapiDecoderStatus status;
+
+  switch (result) {
+    case GST_AV1_PARSER_OK:
+      status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+      break;
+    case GST_AV1_PARSER_NO_MORE_DATA:
+      status = GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
+      break;
+    case GST_AV1_PARSER_BITSTREAM_ERROR:
+    case GST_AV1_PARSER_MISSING_OBU_REFERENCE:
+      status = GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
+      break;
+    default:
+      status = GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+      break;
+  }
+  return status;
+}
+
+static void
+gst_vaapi_decoder_av1_close (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  guint i;
+
+  for (i = 0; i < GST_AV1_NUM_REF_FRAMES; i++)
+    gst_vaapi_picture_replace (&priv->ref_frames[i], NULL);
+  gst_vaapi_picture_replace (&priv->current_picture, NULL);
+  gst_vaapi_picture_replace (&priv->output_picture, NULL);
+
+  g_clear_pointer (&priv->parser, gst_av1_parser_free);
+  priv->has_seq_header = FALSE;
+}
+
+static gboolean
+gst_vaapi_decoder_av1_open (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstCaps *const caps = GST_VAAPI_DECODER_CODEC_STATE (decoder)->caps;
+  gboolean annex_b = FALSE;
+
+  gst_vaapi_decoder_av1_close (decoder);
+
+  if (caps && gst_caps_get_size (caps) > 0) {
+    GstStructure *const structure = gst_caps_get_structure (caps, 0);
+
+    annex_b = g_strcmp0 (gst_structure_get_string (structure,
+            "stream-format"), "annexb") == 0;
+  }
+
+  priv->parser = gst_av1_parser_new ();
+  if (!priv->parser)
+    return FALSE;
+  if (annex_b)
+    gst_av1_parser_reset (priv->parser, TRUE);
+  return TRUE;
+}
+
+static void
+gst_vaapi_decoder_av1_destroy (GstVaapiDecoder * base_decoder)
+{
+  GstVaapiDecoderAV1 *const decoder = GST_VAAPI_DECODER_AV1_CAST (base_decoder);
+
+  gst_vaapi_decoder_av1_close (decoder);
+  decoder->priv.is_opened = FALSE;
+}
+
+static gboolean
+gst_vaapi_decoder_av1_create (GstVaapiDecoder * base_decoder)
+{
+  GstVaapiDecoderAV1 *const decoder = GST_VAAPI_DECODER_AV1_CAST (base_decoder);
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+
+  priv->profile = GST_VAAPI_PROFILE_UNKNOWN;
+  priv->width = 0;
+  priv->height = 0;
+  priv->film_grain = FALSE;
+  return TRUE;
+}
+
+static GstVaapiDecoderStatus
+gst_vaapi_decoder_av1_reset (GstVaapiDecoder * base_decoder)
+{
+  gst_vaapi_decoder_av1_destroy (base_decoder);
+  if (gst_vaapi_decoder_av1_create (base_decoder))
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+}
+
+static GstVaapiDecoderStatus
+ensure_decoder (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+
+  if (!priv->is_opened) {
+    priv->is_opened = gst_vaapi_decoder_av1_open (decoder);
+    if (!priv->is_opened)
+      return GST_VAAPI_DECODER_STATUS_ERROR_UNSUPPORTED_CODEC;
+  }
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+/* Returns GstVaapiProfile from AV1 seq_profile value */
+static GstVaapiProfile
+get_profile (guint seq_profile)
+{
+  GstVaapiProfile profile;
+
+  switch (seq_profile) {
+    case GST_AV1_PROFILE_0:
+      profile = GST_VAAPI_PROFILE_AV1_0;
+      break;
+    case GST_AV1_PROFILE_1:
+      profile = GST_VAAPI_PROFILE_AV1_1;
+      break;
+    default:
+      GST_DEBUG ("unsupported seq_profile value");
+      profile = GST_VAAPI_PROFILE_UNKNOWN;
+      break;
+  }
+  return profile;
+}
+
+static gboolean
+get_chroma_type (GstAV1SequenceHeaderOBU * seq_header,
+    GstVaapiContextInfo * info)
+{
+  /* Monochrome streams are decoded into 4:2:0 surfaces */
+  switch (seq_header->seq_profile) {
+    case GST_AV1_PROFILE_0:
+      if (seq_header->bit_depth == 8)
+        info->chroma_type = GST_VAAPI_CHROMA_TYPE_YUV420;
+      else if (seq_header->bit_depth == 10)
+        info->chroma_type = GST_VAAPI_CHROMA_TYPE_YUV420_10BPP;
+      else
+        return FALSE;
+      break;
+    case GST_AV1_PROFILE_1:
+      if (seq_header->bit_depth == 8)
+        info->chroma_type = GST_VAAPI_CHROMA_TYPE_YUV444;
+      else if (seq_header->bit_depth == 10)
+        info->chroma_type = GST_VAAPI_CHROMA_TYPE_YUV444_10BPP;
+      else
+        return FALSE;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static GstVaapiDecoderStatus
+ensure_context (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1SequenceHeaderOBU *const seq_header = &priv->seq_header;
+  GstVaapiProfile profile;
+  const GstVaapiEntrypoint entrypoint = GST_VAAPI_ENTRYPOINT_VLD;
+  gboolean reset_context = FALSE;
+
+  profile = get_profile (seq_header->seq_profile);
+
+  if (priv->profile != profile) {
+    if (!gst_vaapi_display_has_decoder (GST_VAAPI_DECODER_DISPLAY (decoder),
+            profile, entrypoint))
+      return GST_VAAPI_DECODER_STATUS_ERROR_UNSUPPORTED_PROFILE;
+
+    priv->profile = profile;
+    reset_context = TRUE;
+  }
+
+  if (priv->size_changed) {
+    GST_DEBUG ("size changed");
+    priv->size_changed = FALSE;
+    reset_context = TRUE;
+  }
+
+  if (priv->film_grain != seq_header->film_grain_params_present) {
+    GST_DEBUG ("film grain %s", seq_header->film_grain_params_present ?
+        "enabled" : "disabled");
+    priv->film_grain = seq_header->film_grain_params_present;
+    reset_context = TRUE;
+  }
+
+  if (reset_context) {
+    GstVaapiContextInfo info;
+
+    info.profile = priv->profile;
+    info.entrypoint = entrypoint;
+    info.width = priv->width;
+    info.height = priv->height;
+    /* Frames with film grain hold a second surface for the
+     * reconstructed picture */
+    info.ref_frames = GST_AV1_NUM_REF_FRAMES;
+    if (priv->film_grain)
+      info.ref_frames *= 2;
+    if (!get_chroma_type (seq_header, &info))
+      return GST_VAAPI_DECODER_STATUS_ERROR_UNSUPPORTED_CHROMA_FORMAT;
+
+    reset_context =
+        gst_vaapi_decoder_ensure_context (GST_VAAPI_DECODER (decoder), &info);
+
+    if (!reset_context)
+      return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+
+    gst_vaapi_context_reset_on_resize (GST_VAAPI_DECODER_CONTEXT (decoder),
+        FALSE);
+  }
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+/* Grows the surfaces to hold a @width x @height picture. As with
+ * VP9, the context is only recreated for frames larger than what was
+ * configured so far, since references may be of a different size */
+static void
+update_size (GstVaapiDecoderAV1 * decoder, guint width, guint height)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+
+  if (width > priv->width || height > priv->height) {
+    priv->width = MAX (priv->width, width);
+    priv->height = MAX (priv->height, height);
+    priv->size_changed = TRUE;
+  }
+}
+
+static void
+set_crop_rect (GstVaapiDecoderAV1 * decoder, GstVaapiPicture * picture,
+    guint width, guint height)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstVaapiRectangle crop_rect;
+
+  if (priv->width <= width && priv->height <= height)
+    return;
+
+  crop_rect.x = 0;
+  crop_rect.y = 0;
+  crop_rect.width = width;
+  crop_rect.height = height;
+  gst_vaapi_picture_set_crop_rect (picture, &crop_rect);
+}
+
+static void
+init_picture (GstVaapiDecoderAV1 * decoder, GstVaapiPicture * picture)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1FrameHeaderOBU *const frame_header = &priv->frame_header;
+
+  picture->structure = GST_VAAPI_PICTURE_STRUCTURE_FRAME;
+  picture->type = (frame_header->frame_type == GST_AV1_KEY_FRAME ||
+      frame_header->frame_type == GST_AV1_INTRA_ONLY_FRAME) ?
+      GST_VAAPI_PICTURE_TYPE_I : GST_VAAPI_PICTURE_TYPE_P;
+  picture->pts = GST_VAAPI_DECODER_CODEC_FRAME (decoder)->pts;
+
+  if (!frame_header->show_frame)
+    GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_SKIPPED);
+}
+
+static void
+fill_segment_info (VADecPictureParameterBufferAV1 * pic_param,
+    GstAV1FrameHeaderOBU * frame_header)
+{
+  GstAV1SegmenationParams *const seg = &frame_header->segmentation_params;
+  guint i, j;
+
+  pic_param->seg_info.segment_info_fields.bits.enabled =
+      seg->segmentation_enabled;
+  pic_param->seg_info.segment_info_fields.bits.update_map =
+      seg->segmentation_update_map;
+  pic_param->seg_info.segment_info_fields.bits.temporal_update =
+      seg->segmentation_temporal_update;
+  pic_param->seg_info.segment_info_fields.bits.update_data =
+      seg->segmentation_update_data;
+
+  for (i = 0; i < GST_AV1_MAX_SEGMENTS; i++) {
+    guint8 feature_mask = 0;
+
+    for (j = 0; j < GST_AV1_SEG_LVL_MAX; j++) {
+      pic_param->seg_info.feature_data[i][j] = seg->feature_data[i][j];
+      if (seg->feature_enabled[i][j])
+        feature_mask |= 1 << j;
+    }
+    pic_param->seg_info.feature_mask[i] = feature_mask;
+  }
+}
+
+/* The grain is synthesized by the driver into the output surface,
+ * keeping the reference clean, see fill_picture() */
+static void
+fill_film_grain_info (VADecPictureParameterBufferAV1 * pic_param,
+    GstAV1FrameHeaderOBU * frame_header)
+{
+  GstAV1FilmGrainParams *const fg = &frame_header->film_grain_params;
+  VAFilmGrainStructAV1 *const fg_info = &pic_param->film_grain_info;
+  guint i;
+
+  if (!fg->apply_grain)
+    return;
+
+#define COPY_FG_FIELD(f) \
+    fg_info->film_grain_info_fields.bits.f = fg->f
+
+  COPY_FG_FIELD (apply_grain);
+  COPY_FG_FIELD (chroma_scaling_from_luma);
+  COPY_FG_FIELD (grain_scaling_minus_8);
+  COPY_FG_FIELD (ar_coeff_lag);
+  COPY_FG_FIELD (ar_coeff_shift_minus_6);
+  COPY_FG_FIELD (grain_scale_shift);
+  COPY_FG_FIELD (overlap_flag);
+  COPY_FG_FIELD (clip_to_restricted_range);
+#undef COPY_FG_FIELD
+
+  fg_info->grain_seed = fg->grain_seed;
+
+  fg_info->num_y_points = MIN (fg->num_y_points,
+      G_N_ELEMENTS (fg_info->point_y_value));
+  for (i = 0; i < fg_info->num_y_points; i++) {
+    fg_info->point_y_value[i] = fg->point_y_value[i];
+    fg_info->point_y_scaling[i] = fg->point_y_scaling[i];
+  }
+  fg_info->num_cb_points = MIN (fg->num_cb_points,
+      G_N_ELEMENTS (fg_info->point_cb_value));
+  for (i = 0; i < fg_info->num_cb_points; i++) {
+    fg_info->point_cb_value[i] = fg->point_cb_value[i];
+    fg_info->point_cb_scaling[i] = fg->point_cb_scaling[i];
+  }
+  fg_info->num_cr_points = MIN (fg->num_cr_points,
+      G_N_ELEMENTS (fg_info->point_cr_value));
+  for (i = 0; i < fg_info->num_cr_points; i++) {
+    fg_info->point_cr_value[i] = fg->point_cr_value[i];
+    fg_info->point_cr_scaling[i] = fg->point_cr_scaling[i];
+  }
+
+  for (i = 0; i < G_N_ELEMENTS (fg_info->ar_coeffs_y); i++)
+    fg_info->ar_coeffs_y[i] = (gint) fg->ar_coeffs_y_plus_128[i] - 128;
+  for (i = 0; i < G_N_ELEMENTS (fg_info->ar_coeffs_cb); i++) {
+    fg_info->ar_coeffs_cb[i] = (gint) fg->ar_coeffs_cb_plus_128[i] - 128;
+    fg_info->ar_coeffs_cr[i] = (gint) fg->ar_coeffs_cr_plus_128[i] - 128;
+  }
+
+  fg_info->cb_mult = fg->cb_mult;
+  fg_info->cb_luma_mult = fg->cb_luma_mult;
+  fg_info->cb_offset = fg->cb_offset;
+  fg_info->cr_mult = fg->cr_mult;
+  fg_info->cr_luma_mult = fg->cr_luma_mult;
+  fg_info->cr_offset = fg->cr_offset;
+}
+
+static void
+fill_ref_frames (GstVaapiDecoderAV1 * decoder,
+    VADecPictureParameterBufferAV1 * pic_param,
+    GstAV1FrameHeaderOBU * frame_header)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  guint i;
+
+  for (i = 0; i < GST_AV1_NUM_REF_FRAMES; i++) {
+    pic_param->ref_frame_map[i] = priv->ref_frames[i] ?
+        GST_VAAPI_SURFACE_PROXY_SURFACE_ID (priv->ref_frames[i]->recon_proxy) :
+        VA_INVALID_SURFACE;
+  }
+  for (i = 0; i < GST_AV1_REFS_PER_FRAME; i++)
+    pic_param->ref_frame_idx[i] = frame_header->ref_frame_idx[i];
+  pic_param->primary_ref_frame = frame_header->primary_ref_frame;
+  pic_param->order_hint = frame_header->order_hint;
+}
+
+static gboolean
+fill_picture (GstVaapiDecoderAV1 * decoder, GstVaapiPictureAV1 * picture)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  VADecPictureParameterBufferAV1 *const pic_param = picture->base.param;
+  GstAV1SequenceHeaderOBU *const seq_header = &priv->seq_header;
+  GstAV1FrameHeaderOBU *const frame_header = &priv->frame_header;
+  GstAV1TileInfo *const tile_info = &frame_header->tile_info;
+  GstAV1QuantizationParams *const quant = &frame_header->quantization_params;
+  GstAV1LoopFilterParams *const lf = &frame_header->loop_filter_params;
+  GstAV1CDEFParams *const cdef = &frame_header->cdef_params;
+  GstAV1LoopRestorationParams *const lr =
+      &frame_header->loop_restoration_params;
+  GstAV1GlobalMotionParams *const gm = &frame_header->global_motion_params;
+  guint i, j;
+
+  /* Fill in VADecPictureParameterBufferAV1 */
+  pic_param->profile = seq_header->seq_profile;
+  pic_param->order_hint_bits_minus_1 = seq_header->order_hint_bits_minus_1;
+  switch (seq_header->bit_depth) {
+    case 8:
+      pic_param->bit_depth_idx = 0;
+      break;
+    case 10:
+      pic_param->bit_depth_idx = 1;
+      break;
+    case 12:
+      pic_param->bit_depth_idx = 2;
+      break;
+    default:
+      GST_ERROR ("unsupported bit depth %u", seq_header->bit_depth);
+      return FALSE;
+  }
+  pic_param->matrix_coefficients = seq_header->color_config.matrix_coefficients;
+
+#define COPY_SEQ_FIELD(f) \
+    pic_param->seq_info_fields.fields.f = seq_header->f
+#define COPY_COLOR_FIELD(f) \
+    pic_param->seq_info_fields.fields.f = seq_header->color_config.f
+
+  COPY_SEQ_FIELD (still_picture);
+  COPY_SEQ_FIELD (use_128x128_superblock);
+  COPY_SEQ_FIELD (enable_filter_intra);
+  COPY_SEQ_FIELD (enable_intra_edge_filter);
+  COPY_SEQ_FIELD (enable_interintra_compound);
+  COPY_SEQ_FIELD (enable_masked_compound);
+  COPY_SEQ_FIELD (enable_dual_filter);
+  COPY_SEQ_FIELD (enable_order_hint);
+  COPY_SEQ_FIELD (enable_jnt_comp);
+  COPY_SEQ_FIELD (enable_cdef);
+  COPY_SEQ_FIELD (film_grain_params_present);
+  COPY_COLOR_FIELD (mono_chrome);
+  COPY_COLOR_FIELD (color_range);
+  COPY_COLOR_FIELD (subsampling_x);
+  COPY_COLOR_FIELD (subsampling_y);
+#undef COPY_COLOR_FIELD
+#undef COPY_SEQ_FIELD
+
+  /* With film grain, the driver decodes into the reconstructed surface
+   * and writes the grain-applied copy into the output one */
+  pic_param->current_frame =
+      GST_VAAPI_SURFACE_PROXY_SURFACE_ID (picture->recon_proxy);
+  pic_param->current_display_picture = picture->base.surface_id;
+
+  pic_param->frame_width_minus1 = frame_header->upscaled_width - 1;
+  pic_param->frame_height_minus1 = frame_header->frame_height - 1;
+
+  fill_ref_frames (decoder, pic_param, frame_header);
+  fill_segment_info (pic_param, frame_header);
+  fill_film_grain_info (pic_param, frame_header);
+
+  pic_param->tile_cols = tile_info->tile_cols;
+  pic_param->tile_rows = tile_info->tile_rows;
+  for (i = 0; i < MIN (tile_info->tile_cols,
+          G_N_ELEMENTS (pic_param->width_in_sbs_minus_1)); i++)
+    pic_param->width_in_sbs_minus_1[i] = tile_info->width_in_sbs_minus_1[i];
+  for (i = 0; i < MIN (tile_info->tile_rows,
+          G_N_ELEMENTS (pic_param->height_in_sbs_minus_1)); i++)
+    pic_param->height_in_sbs_minus_1[i] = tile_info->height_in_sbs_minus_1[i];
+  pic_param->tile_count_minus_1 = tile_info->tile_cols * tile_info->tile_rows
+      - 1;
+  pic_param->context_update_tile_id = tile_info->context_update_tile_id;
+
+#define COPY_PIC_FIELD(f) \
+    pic_param->pic_info_fields.bits.f = frame_header->f
+
+  COPY_PIC_FIELD (frame_type);
+  COPY_PIC_FIELD (show_frame);
+  COPY_PIC_FIELD (showable_frame);
+  COPY_PIC_FIELD (error_resilient_mode);
+  COPY_PIC_FIELD (disable_cdf_update);
+  COPY_PIC_FIELD (allow_screen_content_tools);
+  COPY_PIC_FIELD (force_integer_mv);
+  COPY_PIC_FIELD (allow_intrabc);
+  COPY_PIC_FIELD (use_superres);
+  COPY_PIC_FIELD (allow_high_precision_mv);
+  COPY_PIC_FIELD (is_motion_mode_switchable);
+  COPY_PIC_FIELD (use_ref_frame_mvs);
+  COPY_PIC_FIELD (disable_frame_end_update_cdf);
+  COPY_PIC_FIELD (allow_warped_motion);
+#undef COPY_PIC_FIELD
+  pic_param->pic_info_fields.bits.uniform_tile_spacing_flag =
+      tile_info->uniform_tile_spacing_flag;
+
+  pic_param->superres_scale_denominator = frame_header->superres_denom;
+  pic_param->interp_filter = frame_header->interpolation_filter;
+
+  pic_param->filter_level[0] = lf->loop_filter_level[0];
+  pic_param->filter_level[1] = lf->loop_filter_level[1];
+  pic_param->filter_level_u = lf->loop_filter_level[2];
+  pic_param->filter_level_v = lf->loop_filter_level[3];
+  pic_param->loop_filter_info_fields.bits.sharpness_level =
+      lf->loop_filter_sharpness;
+  pic_param->loop_filter_info_fields.bits.mode_ref_delta_enabled =
+      lf->loop_filter_delta_enabled;
+  pic_param->loop_filter_info_fields.bits.mode_ref_delta_update =
+      lf->loop_filter_delta_update;
+  for (i = 0; i < GST_AV1_TOTAL_REFS_PER_FRAME; i++)
+    pic_param->ref_deltas[i] = lf->loop_filter_ref_deltas[i];
+  for (i = 0; i < G_N_ELEMENTS (pic_param->mode_deltas); i++)
+    pic_param->mode_deltas[i] = lf->loop_filter_mode_deltas[i];
+
+  pic_param->base_qindex = quant->base_q_idx;
+  pic_param->y_dc_delta_q = quant->delta_q_y_dc;
+  pic_param->u_dc_delta_q = quant->delta_q_u_dc;
+  pic_param->u_ac_delta_q = quant->delta_q_u_ac;
+  pic_param->v_dc_delta_q = quant->delta_q_v_dc;
+  pic_param->v_ac_delta_q = quant->delta_q_v_ac;
+  pic_param->qmatrix_fields.bits.using_qmatrix = quant->using_qmatrix;
+  pic_param->qmatrix_fields.bits.qm_y = quant->qm_y;
+  pic_param->qmatrix_fields.bits.qm_u = quant->qm_u;
+  pic_param->qmatrix_fields.bits.qm_v = quant->qm_v;
+
+  pic_param->mode_control_fields.bits.delta_q_present_flag =
+      quant->delta_q_present;
+  pic_param->mode_control_fields.bits.log2_delta_q_res = quant->delta_q_res;
+  pic_param->mode_control_fields.bits.delta_lf_present_flag =
+      lf->delta_lf_present;
+  pic_param->mode_control_fields.bits.log2_delta_lf_res = lf->delta_lf_res;
+  pic_param->mode_control_fields.bits.delta_lf_multi = lf->delta_lf_multi;
+  pic_param->mode_control_fields.bits.tx_mode = frame_header->tx_mode;
+  pic_param->mode_control_fields.bits.reference_select =
+      frame_header->reference_select;
+  pic_param->mode_control_fields.bits.reduced_tx_set =
+      frame_header->reduced_tx_set;
+  pic_param->mode_control_fields.bits.skip_mode_present =
+      frame_header->skip_mode_present;
+
+  pic_param->cdef_damping_minus_3 = cdef->cdef_damping - 3;
+  pic_param->cdef_bits = cdef->cdef_bits;
+  for (i = 0; i < G_N_ELEMENTS (pic_param->cdef_y_strengths); i++) {
+    guint8 y_sec = cdef->cdef_y_sec_strength[i];
+    guint8 uv_sec = cdef->cdef_uv_sec_strength[i];
+
+    /* The parser expands a coded secondary strength of 3 to 4 */
+    if (y_sec == 4)
+      y_sec--;
+    if (uv_sec == 4)
+      uv_sec--;
+    pic_param->cdef_y_strengths[i] =
+        (cdef->cdef_y_pri_strength[i] << 2) | (y_sec & 0x03);
+    pic_param->cdef_uv_strengths[i] =
+        (cdef->cdef_uv_pri_strength[i] << 2) | (uv_sec & 0x03);
+  }
+
+  pic_param->loop_restoration_fields.bits.yframe_restoration_type =
+      lr->frame_restoration_type[0];
+  pic_param->loop_restoration_fields.bits.cbframe_restoration_type =
+      lr->frame_restoration_type[1];
+  pic_param->loop_restoration_fields.bits.crframe_restoration_type =
+      lr->frame_restoration_type[2];
+  pic_param->loop_restoration_fields.bits.lr_unit_shift = lr->lr_unit_shift;
+  pic_param->loop_restoration_fields.bits.lr_uv_shift = lr->lr_uv_shift;
+
+  for (i = 0; i < GST_AV1_REFS_PER_FRAME; i++) {
+    const guint ref = GST_AV1_REF_LAST_FRAME + i;
+
+    pic_param->wm[i].wmtype = gm->gm_type[ref];
+    for (j = 0; j < 6; j++)
+      pic_param->wm[i].wmmat[j] = gm->gm_params[ref][j];
+    pic_param->wm[i].wmmat[6] = 0;
+    pic_param->wm[i].wmmat[7] = 0;
+    pic_param->wm[i].invalid = gm->invalid[ref];
+  }
+
+  return TRUE;
+}
+
+static void
+update_ref_frames (GstVaapiDecoderAV1 * decoder, GstVaapiPictureAV1 * picture)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1FrameHeaderOBU *const frame_header = &priv->frame_header;
+  guint8 mask;
+  guint i = 0;
+
+  for (mask = frame_header->refresh_frame_flags; mask; mask >>= 1, ++i) {
+    if (mask & 1)
+      gst_vaapi_picture_replace (&priv->ref_frames[i], picture);
+  }
+  gst_av1_parser_reference_frame_update (priv->parser, frame_header);
+}
+
+/* Emits the surface of @picture again, for the frame being decoded */
+static gboolean
+output_existing_picture (GstVaapiDecoderAV1 * decoder,
+    GstVaapiPicture * picture)
+{
+  GstVideoCodecFrame *const out_frame = GST_VAAPI_DECODER_CODEC_FRAME (decoder);
+  GstVaapiSurfaceProxy *proxy;
+
+  if (!picture->proxy)
+    return FALSE;
+
+  proxy = gst_vaapi_surface_proxy_ref (picture->proxy);
+  if (picture->has_crop_rect)
+    gst_vaapi_surface_proxy_set_crop_rect (proxy, &picture->crop_rect);
+  gst_video_codec_frame_set_user_data (out_frame,
+      proxy, (GDestroyNotify) gst_vaapi_mini_object_unref);
+  gst_vaapi_decoder_push_frame (GST_VAAPI_DECODER_CAST (decoder), out_frame);
+  return TRUE;
+}
+
+/* Outputs a single picture per temporal unit: the shown frame, or the
+ * last decoded one if none is shown, so that the frame gets released
+ * as decode-only */
+static GstVaapiDecoderStatus
+output_picture (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstVaapiPicture *const picture = priv->output_picture;
+  gboolean success;
+
+  if (!picture)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  if (priv->output_existing)
+    success = output_existing_picture (decoder, picture);
+  else
+    success = gst_vaapi_picture_output (picture);
+  gst_vaapi_picture_replace (&priv->output_picture, NULL);
+  priv->output_existing = FALSE;
+
+  if (!success)
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+decode_current_picture (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstVaapiPictureAV1 *const picture = priv->current_picture;
+  GstVaapiPicture *const base_picture = GST_VAAPI_PICTURE (picture);
+
+  if (!picture)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  if (base_picture->slices->len == 0) {
+    GST_WARNING ("drop frame without tile data");
+    gst_vaapi_picture_replace (&priv->current_picture, NULL);
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  }
+
+  if (!gst_vaapi_picture_decode (base_picture))
+    goto error;
+
+  update_ref_frames (decoder, picture);
+
+  if (!GST_VAAPI_PICTURE_IS_SKIPPED (base_picture) || !priv->output_picture) {
+    gst_vaapi_picture_replace (&priv->output_picture, base_picture);
+    priv->output_existing = FALSE;
+  }
+  gst_vaapi_picture_replace (&priv->current_picture, NULL);
+
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error:
+  {
+    gst_vaapi_picture_replace (&priv->current_picture, NULL);
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  }
+}
+
+static GstVaapiDecoderStatus
+decode_sequence (GstVaapiDecoderAV1 * decoder, GstAV1OBU * obu)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1SequenceHeaderOBU *const seq_header = &priv->seq_header;
+  GstAV1ParserResult result;
+
+  result = gst_av1_parser_parse_sequence_header_obu (priv->parser, obu,
+      seq_header);
+  if (result != GST_AV1_PARSER_OK)
+    return get_status (result);
+
+  if (get_profile (seq_header->seq_profile) == GST_VAAPI_PROFILE_UNKNOWN)
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNSUPPORTED_PROFILE;
+
+  update_size (decoder, GST_VAAPI_DECODER_WIDTH (decoder),
+      GST_VAAPI_DECODER_HEIGHT (decoder));
+  update_size (decoder, seq_header->max_frame_width_minus_1 + 1,
+      seq_header->max_frame_height_minus_1 + 1);
+  priv->has_seq_header = TRUE;
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+decode_frame_header (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1FrameHeaderOBU *const frame_header = &priv->frame_header;
+  GstVaapiPictureAV1 *picture;
+  GstVaapiDecoderStatus status;
+
+  /* The previous frame of the temporal unit must be complete now */
+  status = decode_current_picture (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+
+  /* if show_exising_frame flag is true, we just need to return
+   * the existing frame in ref frame array: its surface is output
+   * again with the timing of the current frame, nothing is decoded */
+  if (frame_header->show_existing_frame) {
+    GstVaapiPictureAV1 *const existing_frame =
+        priv->ref_frames[frame_header->frame_to_show_map_idx];
+
+    if (!existing_frame) {
+      GST_ERROR ("Failed to get the existing frame from dpb");
+      return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+    }
+    gst_vaapi_picture_replace (&priv->output_picture,
+        GST_VAAPI_PICTURE (existing_frame));
+    priv->output_existing = TRUE;
+
+    /* Showing a key frame again refreshes all the reference slots */
+    if (frame_header->frame_type == GST_AV1_KEY_FRAME)
+      update_ref_frames (decoder, existing_frame);
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  }
+
+  update_size (decoder, frame_header->upscaled_width,
+      frame_header->frame_height);
+  status = ensure_context (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+
+  /* Create new picture */
+  picture = gst_vaapi_picture_av1_new (decoder);
+  if (!picture) {
+    GST_ERROR ("failed to allocate picture");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+  gst_vaapi_picture_replace (&priv->current_picture, picture);
+  gst_vaapi_picture_unref (picture);
+
+  if (frame_header->film_grain_params.apply_grain) {
+    GstVaapiSurfaceProxy *const proxy =
+        gst_vaapi_context_get_surface_proxy (GST_VAAPI_DECODER_CONTEXT
+        (decoder));
+
+    if (!proxy) {
+      GST_ERROR ("failed to allocate film grain reference surface");
+      return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    gst_vaapi_surface_proxy_replace (&picture->recon_proxy, proxy);
+    gst_vaapi_surface_proxy_unref (proxy);
+  }
+
+  set_crop_rect (decoder, GST_VAAPI_PICTURE (picture),
+      frame_header->upscaled_width, frame_header->frame_height);
+  init_picture (decoder, GST_VAAPI_PICTURE (picture));
+  if (!fill_picture (decoder, picture))
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+/* Submits one slice per tile, tile offsets are relative to @data */
+static GstVaapiDecoderStatus
+decode_tile_group (GstVaapiDecoderAV1 * decoder,
+    GstAV1TileGroupOBU * tile_group, const guint8 * data)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1TileInfo *const tile_info = &priv->frame_header.tile_info;
+  GstVaapiPicture *const picture = GST_VAAPI_PICTURE (priv->current_picture);
+  GstVaapiSlice *slice;
+  VASliceParameterBufferAV1 *slice_param;
+  guint i;
+
+  if (!picture) {
+    GST_ERROR ("tile group without frame header");
+    return GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
+  }
+
+  for (i = tile_group->tg_start; i <= tile_group->tg_end; i++) {
+    slice = GST_VAAPI_SLICE_NEW (AV1, decoder,
+        data + tile_group->entry[i].tile_offset,
+        tile_group->entry[i].tile_size);
+    if (!slice) {
+      GST_ERROR ("failed to allocate slice");
+      return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    slice_param = slice->param;
+    slice_param->tile_row = tile_group->entry[i].tile_row;
+    slice_param->tile_column = tile_group->entry[i].tile_col;
+    gst_vaapi_picture_add_slice (picture, slice);
+  }
+
+  /* The frame is complete with its last tile */
+  if (tile_group->tg_end == tile_info->tile_cols * tile_info->tile_rows - 1)
+    return decode_current_picture (decoder);
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+/* Large scale tile decoding: every tile of the list is predicted from
+ * an anchor frame and lands at its own place in the output frame. The
+ * anchor frames are the reference frames, as set up by the frames
+ * decoded before the tile list */
+static GstVaapiDecoderStatus
+decode_tile_list (GstVaapiDecoderAV1 * decoder, GstAV1TileListOBU * tile_list)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1SequenceHeaderOBU *const seq_header = &priv->seq_header;
+  GstAV1FrameHeaderOBU *const frame_header = &priv->frame_header;
+  GstAV1TileInfo *const tile_info = &frame_header->tile_info;
+  VADecPictureParameterBufferAV1 *pic_param;
+  VASliceParameterBufferAV1 *slice_param;
+  GstVaapiPictureAV1 *picture;
+  GstVaapiSlice *slice;
+  GstVaapiDecoderStatus status;
+  guint i, sb_size, tile_width, tile_height, width, height;
+
+  /* The frame header only carries the coding parameters of the tiles */
+  gst_vaapi_picture_replace (&priv->current_picture, NULL);
+
+  sb_size = seq_header->use_128x128_superblock ? 128 : 64;
+  tile_width = (tile_info->width_in_sbs_minus_1[0] + 1) * sb_size;
+  tile_height = (tile_info->height_in_sbs_minus_1[0] + 1) * sb_size;
+  width = (tile_list->output_frame_width_in_tiles_minus_1 + 1) * tile_width;
+  height = (tile_list->output_frame_height_in_tiles_minus_1 + 1) *
+      tile_height;
+
+  update_size (decoder, width, height);
+  status = ensure_context (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+
+  picture = gst_vaapi_picture_av1_new (decoder);
+  if (!picture) {
+    GST_ERROR ("failed to allocate picture");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+  gst_vaapi_picture_replace (&priv->current_picture, picture);
+  gst_vaapi_picture_unref (picture);
+
+  set_crop_rect (decoder, GST_VAAPI_PICTURE (picture), width, height);
+  init_picture (decoder, GST_VAAPI_PICTURE (picture));
+  GST_VAAPI_PICTURE_FLAG_UNSET (GST_VAAPI_PICTURE (picture),
+      GST_VAAPI_PICTURE_FLAG_SKIPPED);
+  if (!fill_picture (decoder, picture))
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+
+  for (i = 0; i < GST_AV1_NUM_REF_FRAMES; i++) {
+    priv->anchor_frames[i] = priv->ref_frames[i] ?
+        GST_VAAPI_SURFACE_PROXY_SURFACE_ID (priv->ref_frames[i]->recon_proxy) :
+        VA_INVALID_SURFACE;
+  }
+
+  pic_param = picture->base.param;
+  pic_param->pic_info_fields.bits.large_scale_tile = 1;
+  pic_param->anchor_frames_num = GST_AV1_NUM_REF_FRAMES;
+  pic_param->anchor_frames_list = priv->anchor_frames;
+  pic_param->output_frame_width_in_tiles_minus_1 =
+      tile_list->output_frame_width_in_tiles_minus_1;
+  pic_param->output_frame_height_in_tiles_minus_1 =
+      tile_list->output_frame_height_in_tiles_minus_1;
+
+  for (i = 0; i <= tile_list->tile_count_minus_1; i++) {
+    if (tile_list->entry[i].anchor_frame_idx >= GST_AV1_NUM_REF_FRAMES ||
+        !priv->ref_frames[tile_list->entry[i].anchor_frame_idx]) {
+      GST_ERROR ("invalid anchor frame %u",
+          tile_list->entry[i].anchor_frame_idx);
+      return GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
+    }
+
+    slice = GST_VAAPI_SLICE_NEW (AV1, decoder,
+        tile_list->entry[i].coded_tile_data,
+        tile_list->entry[i].tile_data_size_minus_1 + 1);
+    if (!slice) {
+      GST_ERROR ("failed to allocate slice");
+      return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+
+    slice_param = slice->param;
+    slice_param->tile_row = tile_list->entry[i].anchor_tile_row;
+    slice_param->tile_column = tile_list->entry[i].anchor_tile_col;
+    slice_param->anchor_frame_idx = tile_list->entry[i].anchor_frame_idx;
+    slice_param->tile_idx_in_tile_list = i;
+    gst_vaapi_picture_add_slice (GST_VAAPI_PICTURE (picture), slice);
+  }
+
+  /* The output frame is not a reference */
+  if (!gst_vaapi_picture_decode (GST_VAAPI_PICTURE (picture))) {
+    gst_vaapi_picture_replace (&priv->current_picture, NULL);
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  }
+  gst_vaapi_picture_replace (&priv->output_picture,
+      GST_VAAPI_PICTURE (picture));
+  priv->output_existing = FALSE;
+  gst_vaapi_picture_replace (&priv->current_picture, NULL);
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+decode_obu (GstVaapiDecoderAV1 * decoder, GstAV1OBU * obu)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstAV1ParserResult result = GST_AV1_PARSER_OK;
+  GstVaapiDecoderStatus status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  if (!priv->has_seq_header && obu->obu_type != GST_AV1_OBU_SEQUENCE_HEADER &&
+      obu->obu_type != GST_AV1_OBU_TEMPORAL_DELIMITER) {
+    GST_DEBUG ("skip OBU of type %d before the sequence header",
+        obu->obu_type);
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  }
+
+  switch (obu->obu_type) {
+    case GST_AV1_OBU_SEQUENCE_HEADER:
+      status = decode_sequence (decoder, obu);
+      break;
+    case GST_AV1_OBU_TEMPORAL_DELIMITER:
+      result = gst_av1_parser_parse_temporal_delimiter_obu (priv->parser, obu);
+      break;
+    case GST_AV1_OBU_REDUNDANT_FRAME_HEADER:
+      /* Only useful to recover a lost frame header */
+      if (priv->current_picture)
+        break;
+      /* fall-through */
+    case GST_AV1_OBU_FRAME_HEADER:
+      result = gst_av1_parser_parse_frame_header_obu (priv->parser, obu,
+          &priv->frame_header);
+      if (result == GST_AV1_PARSER_OK)
+        status = decode_frame_header (decoder);
+      break;
+    case GST_AV1_OBU_FRAME:{
+      GstAV1FrameOBU frame;
+
+      result = gst_av1_parser_parse_frame_obu (priv->parser, obu, &frame);
+      if (result != GST_AV1_PARSER_OK)
+        break;
+      priv->frame_header = frame.frame_header;
+      status = decode_frame_header (decoder);
+      if (status == GST_VAAPI_DECODER_STATUS_SUCCESS)
+        status = decode_tile_group (decoder, &frame.tile_group, obu->data);
+      break;
+    }
+    case GST_AV1_OBU_TILE_GROUP:{
+      GstAV1TileGroupOBU tile_group;
+
+      result = gst_av1_parser_parse_tile_group_obu (priv->parser, obu,
+          &tile_group);
+      if (result == GST_AV1_PARSER_OK)
+        status = decode_tile_group (decoder, &tile_group, obu->data);
+      break;
+    }
+    case GST_AV1_OBU_TILE_LIST:{
+      GstAV1TileListOBU tile_list;
+
+      result = gst_av1_parser_parse_tile_list_obu (priv->parser, obu,
+          &tile_list);
+      if (result == GST_AV1_PARSER_OK)
+        status = decode_tile_list (decoder, &tile_list);
+      break;
+    }
+    default:
+      /* metadata and padding */
+      break;
+  }
+
+  if (result != GST_AV1_PARSER_OK)
+    return get_status (result);
+  return status;
+}
+
+static GstVaapiDecoderStatus
+decode_buffer (GstVaapiDecoderAV1 * decoder, const guchar * buf,
+    guint buf_size)
+{
+  GstVaapiDecoderAV1Private *const priv = &decoder->priv;
+  GstVaapiDecoderStatus status;
+  GstAV1ParserResult result;
+  GstAV1OBU obu;
+  guint32 consumed;
+  guint ofs = 0;
+
+  gst_vaapi_picture_replace (&priv->output_picture, NULL);
+  priv->output_existing = FALSE;
+
+  while (ofs < buf_size) {
+    result = gst_av1_parser_identify_one_obu (priv->parser, buf + ofs,
+        buf_size - ofs, &obu, &consumed);
+    if (result == GST_AV1_PARSER_DROP) {
+      /* not part of the selected operating point */
+      ofs += consumed;
+      continue;
+    }
+    if (result != GST_AV1_PARSER_OK)
+      return get_status (result);
+
+    status = decode_obu (decoder, &obu);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
+    ofs += consumed;
+  }
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+gst_vaapi_decoder_av1_parse (GstVaapiDecoder * base_decoder,
+    GstAdapter * adapter, gboolean at_eos, GstVaapiDecoderUnit * unit)
+{
+  guint buf_size, flags = 0;
+
+  buf_size = gst_adapter_available (adapter);
+  if (!buf_size)
+    return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
+
+  /* A temporal unit is decoded as a whole, its frames are submitted
+   * back to back from gst_vaapi_decoder_av1_decode() */
+  unit->size = buf_size;
+
+  /* The whole frame is available */
+  flags |= GST_VAAPI_DECODER_UNIT_FLAG_FRAME_START;
+  flags |= GST_VAAPI_DECODER_UNIT_FLAG_SLICE;
+  flags |= GST_VAAPI_DECODER_UNIT_FLAG_FRAME_END;
+
+  GST_VAAPI_DECODER_UNIT_FLAG_SET (unit, flags);
+
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+gst_vaapi_decoder_av1_decode (GstVaapiDecoder * base_decoder,
+    GstVaapiDecoderUnit * unit)
+{
+  GstVaapiDecoderAV1 *const decoder = GST_VAAPI_DECODER_AV1_CAST (base_decoder);
+  GstVaapiDecoderStatus status;
+  GstBuffer *const buffer =
+      GST_VAAPI_DECODER_CODEC_FRAME (decoder)->input_buffer;
+  GstMapInfo map_info;
+
+  status = ensure_decoder (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+
+  if (!gst_buffer_map (buffer, &map_info, GST_MAP_READ)) {
+    GST_ERROR ("failed to map buffer");
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  }
+
+  status = decode_buffer (decoder, map_info.data + unit->offset, unit->size);
+  gst_buffer_unmap (buffer, &map_info);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+gst_vaapi_decoder_av1_start_frame (GstVaapiDecoder * base_decoder,
+    GstVaapiDecoderUnit * base_unit)
+{
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static GstVaapiDecoderStatus
+gst_vaapi_decoder_av1_end_frame (GstVaapiDecoder * base_decoder)
+{
+  GstVaapiDecoderAV1 *const decoder = GST_VAAPI_DECODER_AV1_CAST (base_decoder);
+  GstVaapiDecoderStatus status;
+
+  status = decode_current_picture (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+  return output_picture (decoder);
+}
+
+static GstVaapiDecoderStatus
+gst_vaapi_decoder_av1_flush (GstVaapiDecoder * base_decoder)
+{
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+static void
+gst_vaapi_decoder_av1_finalize (GObject * object)
+{
+  GstVaapiDecoder *const base_decoder = GST_VAAPI_DECODER (object);
+
+  gst_vaapi_decoder_av1_destroy (base_decoder);
+  G_OBJECT_CLASS (gst_vaapi_decoder_av1_parent_class)->finalize (object);
+}
+
+static void
+gst_vaapi_decoder_av1_class_init (GstVaapiDecoderAV1Class * klass)
+{
+  GObjectClass *const object_class = G_OBJECT_CLASS (klass);
+  GstVaapiDecoderClass *const decoder_class = GST_VAAPI_DECODER_CLASS (klass);
+
+  object_class->finalize = gst_vaapi_decoder_av1_finalize;
+
+  decoder_class->reset = gst_vaapi_decoder_av1_reset;
+  decoder_class->parse = gst_vaapi_decoder_av1_parse;
+  decoder_class->decode = gst_vaapi_decoder_av1_decode;
+  decoder_class->start_frame = gst_vaapi_decoder_av1_start_frame;
+  decoder_class->end_frame = gst_vaapi_decoder_av1_end_frame;
+  decoder_class->flush = gst_vaapi_decoder_av1_flush;
+}
+
+static void
+gst_vaapi_decoder_av1_init (GstVaapiDecoderAV1 * decoder)
+{
+  GstVaapiDecoder *const base_decoder = GST_VAAPI_DECODER (decoder);
+
+  gst_vaapi_decoder_av1_create (base_decoder);
+}
+
+/**
+ * gst_vaapi_decoder_av1_new:
+ * @display: a #GstVaapiDisplay
+ * @caps: a #GstCaps holding codec information
+ *
+ * Creates a new #GstVaapiDecoder for AV1 decoding.  The @caps can
+ * hold extra information like the stream format and pictured coded
+ * size.
+ *
+ * Return value: the newly allocated #GstVaapiDecoder object
+ */
+GstVaapiDecoder *
+gst_vaapi_decoder_av1_new (GstVaapiDisplay * display, GstCaps * caps)
+{
+  return g_object_new (GST_TYPE_VAAPI_DECODER_AV1, "display", display,
+      "caps", caps, NULL);
+}
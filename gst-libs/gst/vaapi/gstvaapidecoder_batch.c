@@ -0,0 +1,236 @@
+/*
+ *  gstvaapidecoder_batch.c - Batch decoding of independent pictures
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:gstvaapidecoder_batch
+ * @short_description: Batch decoding of independent pictures
+ *
+ * Decodes a set of self-contained pictures, e.g. key frames picked
+ * from several files, without building a pipeline for each of them.
+ */
+
+#include "sysdeps.h"
+#include "gstvaapidecoder_batch.h"
+#include "gstvaapidecoder_priv.h"
+#include "gstvaapisurfacepool.h"
+#include "gstvaapisurfaceproxy_priv.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+/* Releases an entry of the output array, which may be empty */
+static void
+surface_proxy_clear (GstVaapiSurfaceProxy * proxy)
+{
+  if (proxy)
+    gst_vaapi_surface_proxy_unref (proxy);
+}
+
+/* Decodes @buffer from a clean decoder state and returns the first
+   picture it holds. The decoded picture is not waited for */
+static GstVaapiDecoderStatus
+decode_one (GstVaapiDecoder * decoder, GstBuffer * buffer,
+    GstVaapiSurfaceProxy ** out_proxy_ptr)
+{
+  GstVaapiSurfaceProxy *proxy, *out_proxy = NULL;
+  GstVaapiDecoderStatus status;
+  gboolean flushed = FALSE;
+
+  status = gst_vaapi_decoder_reset (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+
+  if (!gst_vaapi_decoder_put_buffer (decoder, buffer) ||
+      !gst_vaapi_decoder_put_buffer (decoder, NULL))
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+
+  for (;;) {
+    status = gst_vaapi_decoder_get_surface (decoder, &proxy);
+    if (status == GST_VAAPI_DECODER_STATUS_SUCCESS) {
+      /* Keep the first picture only */
+      if (!out_proxy)
+        out_proxy = proxy;
+      else
+        gst_vaapi_surface_proxy_unref (proxy);
+      continue;
+    }
+    if (status != GST_VAAPI_DECODER_STATUS_END_OF_STREAM &&
+        status != GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA)
+      break;
+
+    /* Pictures still waiting in the DPB are output on flush */
+    if (out_proxy || flushed)
+      break;
+    status = gst_vaapi_decoder_flush (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      break;
+    flushed = TRUE;
+  }
+
+  *out_proxy_ptr = out_proxy;
+  if (out_proxy)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  if (status == GST_VAAPI_DECODER_STATUS_END_OF_STREAM)
+    status = GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
+  return status;
+}
+
+/* Scales @proxy into a surface of @pool, with the operations set on
+   @filter. The decoded surface is released as soon as the processing
+   is submitted, so that the decoder never runs out of surfaces */
+static GstVaapiSurfaceProxy *
+scale_one (GstVaapiFilter * filter, GstVaapiVideoPool * pool,
+    GstVaapiSurfaceProxy * proxy)
+{
+  GstVaapiSurfaceProxy *out_proxy;
+  GstVaapiFilterStatus status;
+
+  out_proxy =
+      gst_vaapi_surface_proxy_new_from_pool (GST_VAAPI_SURFACE_POOL (pool));
+  if (!out_proxy)
+    return NULL;
+
+  gst_vaapi_filter_set_cropping_rectangle (filter,
+      gst_vaapi_surface_proxy_get_crop_rect (proxy));
+  status = gst_vaapi_filter_process (filter,
+      GST_VAAPI_SURFACE_PROXY_SURFACE (proxy),
+      GST_VAAPI_SURFACE_PROXY_SURFACE (out_proxy), 0);
+  if (status != GST_VAAPI_FILTER_STATUS_SUCCESS) {
+    GST_ERROR ("failed to scale picture (status = %d)", status);
+    gst_vaapi_surface_proxy_unref (out_proxy);
+    return NULL;
+  }
+
+  out_proxy->timestamp = proxy->timestamp;
+  out_proxy->duration = proxy->duration;
+  return out_proxy;
+}
+
+/**
+ * gst_vaapi_decoder_decode_batch:
+ * @decoder: a #GstVaapiDecoder
+ * @buffers: (array length=num_buffers): the pictures to decode
+ * @num_buffers: the number of @buffers
+ * @filter: (allow-none): a #GstVaapiFilter to scale the pictures with
+ * @width: the width of the scaled pictures
+ * @height: the height of the scaled pictures
+ * @out_proxies_ptr: return location for the decoded surfaces
+ *
+ * Decodes each of @buffers, independently from the others, on the
+ * VA context of @decoder. Each buffer shall hold a picture that can
+ * be decoded on its own, along with the headers it needs, e.g. a key
+ * frame extracted from a file. Pictures of different sizes are
+ * supported, see gst_vaapi_decoder_set_rendition_switch() to avoid
+ * re-creating the VA context then.
+ *
+ * Pictures are submitted one after the other without waiting for the
+ * hardware to complete, and the returned surfaces are only synced on
+ * first access, e.g. on mapping or when exporting their DMA buffer
+ * with gst_vaapi_surface_peek_dma_buf_handle().
+ *
+ * If @filter is set, every picture is also processed with it into a
+ * new surface of @width x @height, in the format of the decoded
+ * surfaces, and only the processed surfaces are returned. This keeps
+ * the number of decoding surfaces needed independent of the batch
+ * size.
+ *
+ * On return, *@out_proxies_ptr holds one #GstVaapiSurfaceProxy per
+ * buffer, in the same order, or %NULL for a picture that could not be
+ * decoded. Only the first picture of a buffer is returned. The caller
+ * owns the array, so g_ptr_array_unref() shall be called after usage.
+ *
+ * Return value: %GST_VAAPI_DECODER_STATUS_SUCCESS if all pictures
+ *   were decoded, or else the status of the first failure
+ */
+GstVaapiDecoderStatus
+gst_vaapi_decoder_decode_batch (GstVaapiDecoder * decoder,
+    GstBuffer ** buffers, guint num_buffers, GstVaapiFilter * filter,
+    guint width, guint height, GPtrArray ** out_proxies_ptr)
+{
+  GstVaapiDecoderStatus status, ret = GST_VAAPI_DECODER_STATUS_SUCCESS;
+  GstVaapiVideoPool *pool = NULL;
+  GstVaapiSurfaceProxy *proxy, *out_proxy;
+  GPtrArray *out_proxies;
+  guint i;
+
+  g_return_val_if_fail (decoder != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (buffers != NULL || num_buffers == 0,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (!filter || (width > 0 && height > 0),
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (out_proxies_ptr != NULL,
+      GST_VAAPI_DECODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  out_proxies = g_ptr_array_new_full (num_buffers,
+      (GDestroyNotify) surface_proxy_clear);
+
+  /* Decoded surfaces are all kept until the end of the batch */
+  if (!filter)
+    gst_vaapi_decoder_set_downstream_surfaces (decoder, num_buffers);
+
+  for (i = 0; i < num_buffers; i++) {
+    proxy = NULL;
+    status = decode_one (decoder, buffers[i], &proxy);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS) {
+      GST_WARNING ("failed to decode picture %u (status = %d)", i, status);
+      goto next;
+    }
+
+    if (filter) {
+      if (!pool) {
+        pool = gst_vaapi_surface_pool_new (decoder->display,
+            gst_vaapi_surface_get_format (GST_VAAPI_SURFACE_PROXY_SURFACE
+                (proxy)), width, height, 0);
+        if (!pool) {
+          gst_vaapi_surface_proxy_unref (proxy);
+          status = GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+          goto error;
+        }
+      }
+      out_proxy = scale_one (filter, pool, proxy);
+      gst_vaapi_surface_proxy_unref (proxy);
+      proxy = out_proxy;
+      if (!proxy)
+        status = GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+    }
+
+  next:
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS &&
+        ret == GST_VAAPI_DECODER_STATUS_SUCCESS)
+      ret = status;
+    g_ptr_array_add (out_proxies, proxy);
+  }
+
+  /* Proxies keep their pool alive */
+  if (pool)
+    gst_vaapi_video_pool_unref (pool);
+
+  *out_proxies_ptr = out_proxies;
+  return ret;
+
+  /* ERRORS */
+error:
+  {
+    for (; i < num_buffers; i++)
+      g_ptr_array_add (out_proxies, NULL);
+    *out_proxies_ptr = out_proxies;
+    return status;
+  }
+}
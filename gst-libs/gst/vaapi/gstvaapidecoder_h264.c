@@ -31,15 +31,14 @@
 #include "gstvaapidecoder_h264.h"
 #include "gstvaapidecoder_objects.h"
 #include "gstvaapidecoder_priv.h"
+#include "gstvaapidecoder_slicepool.h"
 #include "gstvaapidisplay_priv.h"
 #include "gstvaapiutils_h264_priv.h"
+#include "gstvaapiutils_h26x_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
 
-/* Defined to 1 if strict ordering of DPB is needed. Only useful for debug */
-#define USE_STRICT_DPB_ORDERING 0
-
 typedef struct _GstVaapiDecoderH264Private GstVaapiDecoderH264Private;
 typedef struct _GstVaapiDecoderH264Class GstVaapiDecoderH264Class;
 typedef struct _GstVaapiFrameStore GstVaapiFrameStore;
@@ -121,9 +120,11 @@ gst_vaapi_parser_info_h264_finalize (GstVaapiParserInfoH264 * pi)
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_parser_info_h264_class (void)
 {
+  static GstVaapiMiniObjectCache GstVaapiParserInfoH264Cache;
   static const GstVaapiMiniObjectClass GstVaapiParserInfoH264Class = {
     .size = sizeof (GstVaapiParserInfoH264),
-    .finalize = (GDestroyNotify) gst_vaapi_parser_info_h264_finalize
+    .finalize = (GDestroyNotify) gst_vaapi_parser_info_h264_finalize,
+    .cache = &GstVaapiParserInfoH264Cache
   };
   return &GstVaapiParserInfoH264Class;
 }
@@ -323,9 +324,11 @@ gst_vaapi_frame_store_new (GstVaapiPictureH264 * picture)
 {
   GstVaapiFrameStore *fs;
 
+  static GstVaapiMiniObjectCache GstVaapiFrameStoreCache;
   static const GstVaapiMiniObjectClass GstVaapiFrameStoreClass = {
-    sizeof (GstVaapiFrameStore),
-    gst_vaapi_frame_store_finalize
+    .size = sizeof (GstVaapiFrameStore),
+    .finalize = gst_vaapi_frame_store_finalize,
+    .cache = &GstVaapiFrameStoreCache
   };
 
   fs = (GstVaapiFrameStore *)
@@ -413,6 +416,31 @@ gst_vaapi_frame_store_split_fields (GstVaapiFrameStore * fs, gboolean tff)
   return TRUE;
 }
 
+/* Returns the lowest POC of the pictures held in the frame store */
+static inline gint32
+gst_vaapi_frame_store_get_poc (GstVaapiFrameStore * fs)
+{
+  gint32 poc = fs->buffers[0]->base.poc;
+  guint i;
+
+  for (i = 1; i < fs->num_buffers; i++)
+    poc = MIN (poc, fs->buffers[i]->base.poc);
+  return poc;
+}
+
+/* Compares frame stores by POC, then by VOC */
+static inline gint
+gst_vaapi_frame_store_compare (GstVaapiFrameStore * fs1,
+    GstVaapiFrameStore * fs2)
+{
+  const gint32 poc1 = gst_vaapi_frame_store_get_poc (fs1);
+  const gint32 poc2 = gst_vaapi_frame_store_get_poc (fs2);
+
+  if (poc1 != poc2)
+    return poc1 < poc2 ? -1 : 1;
+  return (gint) fs1->buffers[0]->base.voc - (gint) fs2->buffers[0]->base.voc;
+}
+
 static inline gboolean
 gst_vaapi_frame_store_has_frame (GstVaapiFrameStore * fs)
 {
@@ -539,6 +567,14 @@ struct _GstVaapiDecoderH264Private
 
   gboolean force_low_latency;
   gboolean base_only;
+  gboolean conceal_errors;
+  guint num_concealed_refs;     // substituted refs of the current picture
+
+  /* slice headers parsed ahead, from the AU held in slice_batch */
+  GstVaapiSlicePool *slice_pool;
+  GstBuffer *slice_batch;
+  GstMapInfo slice_batch_map;
+  gboolean slice_pool_disabled;
 };
 
 /**
@@ -574,6 +610,9 @@ exec_ref_pic_marking (GstVaapiDecoderH264 * decoder,
 static gboolean
 exec_ref_pic_marking_sliding_window (GstVaapiDecoderH264 * decoder);
 
+static void
+slice_batch_clear (GstVaapiDecoderH264 * decoder);
+
 static gboolean
 is_inter_view_reference_for_next_pictures (GstVaapiDecoderH264 * decoder,
     GstVaapiPictureH264 * picture);
@@ -723,18 +762,64 @@ array_remove_index (void *array, guint * array_length_ptr, guint index)
 #define ARRAY_REMOVE_INDEX(array, index) \
     array_remove_index(array, &array##_count, index)
 
+/* The DPB is kept sorted by increasing POC (then VOC) so that lookups
+   for output or for a specific POC can stop as early as possible */
+
 static void
 dpb_remove_index (GstVaapiDecoderH264 * decoder, guint index)
 {
   GstVaapiDecoderH264Private *const priv = &decoder->priv;
-  guint i, num_frames = --priv->dpb_count;
+  const guint num_frames = --priv->dpb_count;
+
+  gst_vaapi_frame_store_replace (&priv->dpb[index], NULL);
+  if (index != num_frames)
+    memmove (&priv->dpb[index], &priv->dpb[index + 1],
+        (num_frames - index) * sizeof (*priv->dpb));
+  priv->dpb[num_frames] = NULL;
+}
+
+static void
+dpb_insert (GstVaapiDecoderH264 * decoder, GstVaapiFrameStore * fs)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  guint lo = 0, hi = priv->dpb_count;
+
+  /* Insert after any frame store that compares equal */
+  while (lo < hi) {
+    const guint mid = (lo + hi) / 2;
+    if (gst_vaapi_frame_store_compare (priv->dpb[mid], fs) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo != priv->dpb_count)
+    memmove (&priv->dpb[lo + 1], &priv->dpb[lo],
+        (priv->dpb_count - lo) * sizeof (*priv->dpb));
+  priv->dpb[lo] = NULL;
+  gst_vaapi_frame_store_replace (&priv->dpb[lo], fs);
+  priv->dpb_count++;
+}
+
+/* Moves the frame store back to its place after its POC decreased,
+   e.g. when the second field was added */
+static void
+dpb_reorder (GstVaapiDecoderH264 * decoder, GstVaapiFrameStore * fs)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  guint i;
+
+  for (i = 0; i < priv->dpb_count; i++) {
+    if (priv->dpb[i] == fs)
+      break;
+  }
 
-  if (USE_STRICT_DPB_ORDERING) {
-    for (i = index; i < num_frames; i++)
-      gst_vaapi_frame_store_replace (&priv->dpb[i], priv->dpb[i + 1]);
-  } else if (index != num_frames)
-    gst_vaapi_frame_store_replace (&priv->dpb[index], priv->dpb[num_frames]);
-  gst_vaapi_frame_store_replace (&priv->dpb[num_frames], NULL);
+  for (; i > 0 && i < priv->dpb_count; i--) {
+    if (gst_vaapi_frame_store_compare (priv->dpb[i - 1], fs) <= 0)
+      break;
+    priv->dpb[i] = priv->dpb[i - 1];
+    priv->dpb[i - 1] = fs;
+  }
 }
 
 static gboolean
@@ -793,6 +878,9 @@ dpb_find_nearest_prev_poc (GstVaapiDecoderH264 * decoder,
 
   for (i = 0; i < priv->dpb_count; i++) {
     GstVaapiFrameStore *const fs = priv->dpb[i];
+    /* No more pictures with a lower POC */
+    if (gst_vaapi_frame_store_get_poc (fs) >= picture->base.poc)
+      break;
     if (picture->base.view_id != fs->view_id)
       continue;
     for (j = 0; j < fs->num_buffers; j++) {
@@ -825,6 +913,11 @@ dpb_find_lowest_poc_for_output (GstVaapiDecoderH264 * decoder,
 
   for (i = 0; i < priv->dpb_count; i++) {
     GstVaapiFrameStore *const fs = priv->dpb[i];
+    /* The remaining frame stores cannot hold a lower POC, though the
+       maximum POC of output frames still has to be determined */
+    if (!can_be_output && found_picture &&
+        gst_vaapi_frame_store_get_poc (fs) > found_picture->base.poc)
+      break;
     if (!fs->output_needed) {
       /* find the maximum poc of any previously output frames that are
        * still held in the DPB. */
@@ -897,6 +990,8 @@ dpb_find_lowest_voc (GstVaapiDecoderH264 * decoder,
 
   for (i = 0; i < priv->dpb_count; i++) {
     GstVaapiFrameStore *const fs = priv->dpb[i];
+    if (gst_vaapi_frame_store_get_poc (fs) > picture->base.poc)
+      break;
     if (!fs->output_needed || fs->view_id == picture->base.view_id)
       continue;
     for (j = 0; j < fs->num_buffers; j++) {
@@ -1073,6 +1168,45 @@ dpb_prune_mvc (GstVaapiDecoderH264 * decoder, GstVaapiPictureH264 * picture)
   }
 }
 
+/* Returns the active SPS */
+static inline GstH264SPS *
+get_sps (GstVaapiDecoderH264 * decoder)
+{
+  GstVaapiParserInfoH264 *const pi = decoder->priv.active_sps;
+
+  return pi ? &pi->data.sps : NULL;
+}
+
+/* Outputs frames as soon as more of them wait for output than the
+   stream may reorder, rather than only once the DPB is full, so that
+   their surfaces go downstream earlier */
+static void
+dpb_bump_reordered (GstVaapiDecoderH264 * decoder,
+    GstVaapiPictureH264 * picture)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  GstH264SPS *const sps = get_sps (decoder);
+  guint i, num_output_needed;
+
+  if (!sps || !sps->vui_parameters_present_flag ||
+      !sps->vui_parameters.bitstream_restriction_flag)
+    return;
+  if (priv->max_views > 1 || !priv->progressive_sequence)
+    return;
+
+  for (;;) {
+    num_output_needed = 0;
+    for (i = 0; i < priv->dpb_count; i++) {
+      if (priv->dpb[i]->output_needed)
+        num_output_needed++;
+    }
+    if (num_output_needed <= sps->vui_parameters.num_reorder_frames)
+      break;
+    if (!dpb_bump (decoder, picture))
+      break;
+  }
+}
+
 static gboolean
 dpb_add (GstVaapiDecoderH264 * decoder, GstVaapiPictureH264 * picture)
 {
@@ -1103,6 +1237,7 @@ dpb_add (GstVaapiDecoderH264 * decoder, GstVaapiPictureH264 * picture)
       return FALSE;
     if (!gst_vaapi_frame_store_add (fs, picture))
       return FALSE;
+    dpb_reorder (decoder, fs);
 
     if (fs->output_called)
       return dpb_output (decoder, fs);
@@ -1154,7 +1289,8 @@ dpb_add (GstVaapiDecoderH264 * decoder, GstVaapiPictureH264 * picture)
         return FALSE;
     }
   }
-  gst_vaapi_frame_store_replace (&priv->dpb[priv->dpb_count++], fs);
+  dpb_insert (decoder, fs);
+  dpb_bump_reordered (decoder, picture);
   return TRUE;
 }
 
@@ -1267,6 +1403,7 @@ gst_vaapi_decoder_h264_close (GstVaapiDecoderH264 * decoder)
   gst_vaapi_parser_info_h264_replace (&priv->prev_pi, NULL);
 
   dpb_clear (decoder, NULL);
+  slice_batch_clear (decoder);
 
   if (priv->inter_views) {
     g_ptr_array_unref (priv->inter_views);
@@ -1303,6 +1440,8 @@ gst_vaapi_decoder_h264_destroy (GstVaapiDecoder * base_decoder)
   gst_vaapi_decoder_h264_close (decoder);
   priv->is_opened = FALSE;
 
+  g_clear_pointer (&priv->slice_pool, gst_vaapi_slice_pool_free);
+
   g_clear_pointer (&priv->dpb, g_free);
   priv->dpb_size_max = priv->dpb_size = 0;
 
@@ -1402,15 +1541,6 @@ ensure_sps (GstVaapiDecoderH264 * decoder, GstH264SPS * sps)
   return pi ? &pi->data.sps : NULL;
 }
 
-/* Returns the active SPS */
-static inline GstH264SPS *
-get_sps (GstVaapiDecoderH264 * decoder)
-{
-  GstVaapiParserInfoH264 *const pi = decoder->priv.active_sps;
-
-  return pi ? &pi->data.sps : NULL;
-}
-
 static void
 fill_profiles (GstVaapiProfile profiles[16], guint * n_profiles_ptr,
     GstVaapiProfile profile)
@@ -1516,6 +1646,26 @@ get_profile (GstVaapiDecoderH264 * decoder, GstH264SPS * sps, guint dpb_size)
   return GST_VAAPI_PROFILE_UNKNOWN;
 }
 
+/* Checks whether no picture of the sequence can reference another
+   one, i.e. whether pictures can be decoded in any order */
+static gboolean
+is_intra_only_sps (GstH264SPS * sps)
+{
+  if (sps->num_ref_frames == 0)
+    return TRUE;
+
+  /* Intra profiles (A.2.8 to A.2.11) */
+  switch (sps->profile_idc) {
+    case GST_H264_PROFILE_HIGH10:
+    case GST_H264_PROFILE_HIGH_422:
+    case GST_H264_PROFILE_HIGH_444:
+      return sps->constraint_set3_flag;
+    case 44:                   /* CAVLC 4:4:4 Intra */
+      return TRUE;
+  }
+  return FALSE;
+}
+
 static GstVaapiDecoderStatus
 ensure_context (GstVaapiDecoderH264 * decoder, GstH264SPS * sps)
 {
@@ -1613,6 +1763,8 @@ ensure_context (GstVaapiDecoderH264 * decoder, GstH264SPS * sps)
 
   gst_vaapi_decoder_set_pixel_aspect_ratio (base_decoder,
       sps->vui_parameters.par_n, sps->vui_parameters.par_d);
+  gst_vaapi_decoder_set_intra_only (base_decoder,
+      num_views == 1 && is_intra_only_sps (sps));
 
   if (!reset_context && priv->has_context)
     return GST_VAAPI_DECODER_STATUS_SUCCESS;
@@ -1737,6 +1889,12 @@ decode_current_picture (GstVaapiDecoderH264 * decoder)
   if (!dpb_add (decoder, picture))
     goto error;
 
+  if (priv->num_concealed_refs > 0) {
+    gst_vaapi_decoder_add_concealed_picture (GST_VAAPI_DECODER (decoder),
+        priv->num_concealed_refs);
+    priv->num_concealed_refs = 0;
+  }
+
   if (priv->force_low_latency)
     dpb_output_ready_frames (decoder);
   gst_vaapi_picture_replace (&priv->current_picture, NULL);
@@ -1861,26 +2019,19 @@ parse_sei (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
-static GstVaapiDecoderStatus
-parse_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
+/* Sets up @pi for parsing its slice header, @prev_pi being the NAL
+   unit that precedes it in the stream, if known */
+static void
+parse_slice_prepare (GstVaapiParserInfoH264 * pi,
+    GstVaapiParserInfoH264 * prev_pi)
 {
-  GstVaapiDecoderH264Private *const priv = &decoder->priv;
-  GstVaapiParserInfoH264 *const pi = unit->parsed_info;
   GstH264SliceHdr *const slice_hdr = &pi->data.slice_hdr;
   GstH264NalUnit *const nalu = &pi->nalu;
-  GstH264SPS *sps;
-  GstH264ParserResult result;
-
-  GST_DEBUG ("parse slice");
-
-  priv->parser_state &= (GST_H264_VIDEO_STATE_GOT_SPS |
-      GST_H264_VIDEO_STATE_GOT_PPS);
 
   /* Propagate Prefix NAL unit info, if necessary */
   switch (nalu->type) {
     case GST_H264_NAL_SLICE:
     case GST_H264_NAL_SLICE_IDR:{
-      GstVaapiParserInfoH264 *const prev_pi = priv->prev_pi;
       if (prev_pi && prev_pi->nalu.type == GST_H264_NAL_PREFIX_UNIT) {
         /* MVC sequences shall have a Prefix NAL unit immediately
            preceding this NAL unit */
@@ -1907,9 +2058,20 @@ parse_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
      standard but that should get a default value anyway */
   slice_hdr->cabac_init_idc = 0;
   slice_hdr->direct_spatial_mv_pred_flag = 0;
+}
+
+/* Updates the parser state from the slice header parsed into @pi */
+static GstVaapiDecoderStatus
+parse_slice_finish (GstVaapiDecoderH264 * decoder,
+    GstVaapiParserInfoH264 * pi, GstH264ParserResult result)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  GstH264SliceHdr *const slice_hdr = &pi->data.slice_hdr;
+  GstH264SPS *sps;
+
+  priv->parser_state &= (GST_H264_VIDEO_STATE_GOT_SPS |
+      GST_H264_VIDEO_STATE_GOT_PPS);
 
-  result = gst_h264_parser_parse_slice_hdr (priv->parser, &pi->nalu,
-      slice_hdr, TRUE, TRUE);
   if (result != GST_H264_PARSER_OK)
     return get_status (result);
 
@@ -1925,6 +2087,190 @@ parse_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
+static GstVaapiDecoderStatus
+parse_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  GstVaapiParserInfoH264 *const pi = unit->parsed_info;
+  GstH264ParserResult result;
+
+  GST_DEBUG ("parse slice");
+
+  parse_slice_prepare (pi, priv->prev_pi);
+  result = gst_h264_parser_parse_slice_hdr (priv->parser, &pi->nalu,
+      &pi->data.slice_hdr, TRUE, TRUE);
+  return parse_slice_finish (decoder, pi, result);
+}
+
+/* A slice of the current AU whose header is parsed from the pool */
+typedef struct
+{
+  GstVaapiParserInfoH264 *pi;
+  const guint8 *data;
+  guint size;
+  GstH264ParserResult result;
+} SliceJobH264;
+
+static void
+slice_job_free (SliceJobH264 * job)
+{
+  gst_vaapi_parser_info_h264_replace (&job->pi, NULL);
+  g_slice_free (SliceJobH264, job);
+}
+
+static void
+slice_job_parse (SliceJobH264 * job, GstVaapiDecoderH264 * decoder)
+{
+  /* The parser is only read from, nothing else is parsed meanwhile */
+  job->result = gst_h264_parser_parse_slice_hdr (decoder->priv.parser,
+      &job->pi->nalu, &job->pi->data.slice_hdr, TRUE, TRUE);
+}
+
+static void
+slice_batch_release (GstVaapiDecoderH264 * decoder)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+
+  if (!priv->slice_batch)
+    return;
+  gst_buffer_unmap (priv->slice_batch, &priv->slice_batch_map);
+  gst_buffer_replace (&priv->slice_batch, NULL);
+}
+
+static void
+slice_batch_clear (GstVaapiDecoderH264 * decoder)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+
+  if (priv->slice_pool)
+    gst_vaapi_slice_pool_clear (priv->slice_pool);
+  slice_batch_release (decoder);
+}
+
+/* Hands over to the pool the slices that immediately follow the one
+   just parsed at the start of the adapter, up to the next non-VCL NAL
+   unit, which may change the parser state. This needs the whole AU
+   to be available, i.e. AU aligned stream buffers */
+static void
+slice_batch_start (GstVaapiDecoderH264 * decoder, GstAdapter * adapter,
+    guint ofs, guint size)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  GQueue jobs = G_QUEUE_INIT;
+  GstVaapiParserInfoH264 *pi;
+  GstH264ParserResult result;
+  SliceJobH264 *job;
+  const guint8 *data;
+  guint i, nal_size;
+  gint next;
+
+  if (priv->stream_alignment != GST_VAAPI_STREAM_ALIGN_H264_AU)
+    return;
+  if (priv->slice_batch || ofs >= size)
+    return;
+
+  if (!priv->slice_pool) {
+    if (priv->slice_pool_disabled)
+      return;
+    priv->slice_pool = gst_vaapi_slice_pool_new ((GFunc) slice_job_parse,
+        decoder, (GDestroyNotify) slice_job_free);
+    if (!priv->slice_pool) {
+      priv->slice_pool_disabled = TRUE;
+      return;
+    }
+  }
+
+  priv->slice_batch = gst_adapter_get_buffer (adapter, size);
+  if (!priv->slice_batch)
+    return;
+  if (!gst_buffer_map (priv->slice_batch, &priv->slice_batch_map,
+          GST_MAP_READ)) {
+    gst_buffer_replace (&priv->slice_batch, NULL);
+    return;
+  }
+  data = priv->slice_batch_map.data;
+
+  /* Split the NAL units the same way gst_vaapi_decoder_h264_parse() does */
+  while (ofs < size) {
+    if (priv->is_avcC) {
+      if (size - ofs < priv->nal_length_size)
+        break;
+      nal_size = 0;
+      for (i = 0; i < priv->nal_length_size; i++)
+        nal_size = (nal_size << 8) | data[ofs + i];
+      if (nal_size > size - ofs - priv->nal_length_size)
+        break;
+      nal_size += priv->nal_length_size;
+    } else {
+      if (size - ofs < 4)
+        break;
+      next = gst_vaapi_utils_find_start_code (data + ofs + 4, size - ofs - 4);
+      nal_size = next < 0 ? size - ofs : next + 4;
+    }
+
+    pi = gst_vaapi_parser_info_h264_new ();
+    if (!pi)
+      break;
+    if (priv->is_avcC)
+      result = gst_h264_parser_identify_nalu_avc (priv->parser,
+          data + ofs, 0, nal_size, priv->nal_length_size, &pi->nalu);
+    else
+      result = gst_h264_parser_identify_nalu_unchecked (priv->parser,
+          data + ofs, 0, nal_size, &pi->nalu);
+    if (result != GST_H264_PARSER_OK || (pi->nalu.type != GST_H264_NAL_SLICE
+            && pi->nalu.type != GST_H264_NAL_SLICE_IDR)) {
+      gst_vaapi_parser_info_h264_unref (pi);
+      break;
+    }
+
+    /* The slice is preceded by another slice */
+    parse_slice_prepare (pi, NULL);
+
+    job = g_slice_new (SliceJobH264);
+    job->pi = pi;
+    job->data = data + ofs;
+    job->size = nal_size;
+    g_queue_push_tail (&jobs, job);
+    ofs += nal_size;
+  }
+
+  if (g_queue_get_length (&jobs) < GST_VAAPI_SLICE_POOL_MIN_JOBS) {
+    g_queue_foreach (&jobs, (GFunc) slice_job_free, NULL);
+    g_queue_clear (&jobs);
+    slice_batch_release (decoder);
+    return;
+  }
+
+  GST_DEBUG ("parsing %u slice headers ahead", g_queue_get_length (&jobs));
+  while ((job = g_queue_pop_head (&jobs)))
+    gst_vaapi_slice_pool_push (priv->slice_pool, job);
+}
+
+/* Returns the slice parsed ahead for the NAL unit at @buf, if any. The
+   pending slices are dropped if the stream does not match them, e.g.
+   after a flush */
+static SliceJobH264 *
+slice_batch_pop (GstVaapiDecoderH264 * decoder, const guchar * buf,
+    guint buf_size)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  SliceJobH264 *job;
+
+  if (!priv->slice_batch)
+    return NULL;
+
+  job = gst_vaapi_slice_pool_peek (priv->slice_pool);
+  if (!job || job->data != buf || job->size != buf_size) {
+    slice_batch_clear (decoder);
+    return NULL;
+  }
+
+  job = gst_vaapi_slice_pool_pop (priv->slice_pool);
+  if (gst_vaapi_slice_pool_is_empty (priv->slice_pool))
+    slice_batch_release (decoder);
+  return job;
+}
+
 static GstVaapiDecoderStatus
 decode_sps (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
 {
@@ -2960,7 +3306,10 @@ exec_picture_refs_modification_1 (GstVaapiDecoderH264 * decoder,
   for (i = 0; i < num_refs; i++) {
     if (!ref_list[i]) {
       ret = FALSE;
-      GST_ERROR ("list %u entry %u is empty", list, i);
+      if (priv->conceal_errors)
+        GST_WARNING ("list %u entry %u is empty", list, i);
+      else
+        GST_ERROR ("list %u entry %u is empty", list, i);
     }
   }
 
@@ -3022,6 +3371,70 @@ mark_picture_refs (GstVaapiDecoderH264 * decoder, GstVaapiPictureH264 * picture)
     GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_CORRUPTED);
 }
 
+/* Finds the reference picture closest to @picture in output order */
+static GstVaapiPictureH264 *
+find_nearest_reference (GstVaapiDecoderH264 * decoder,
+    GstVaapiPictureH264 * picture)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  GstVaapiPictureH264 *found_picture = NULL;
+  gint32 found_diff = G_MAXINT32;
+  guint i;
+
+  for (i = 0; i < priv->short_ref_count + priv->long_ref_count; i++) {
+    GstVaapiPictureH264 *const pic = i < priv->short_ref_count ?
+        priv->short_ref[i] : priv->long_ref[i - priv->short_ref_count];
+    const gint32 diff = ABS (pic->base.poc - picture->base.poc);
+    if (diff < found_diff) {
+      found_picture = pic;
+      found_diff = diff;
+    }
+  }
+  return found_picture;
+}
+
+/* Substitutes the missing entries of @ref_list with the nearest
+   available reference, and flags @picture as corrupted */
+static gboolean
+conceal_picture_refs_1 (GstVaapiDecoderH264 * decoder,
+    GstVaapiPictureH264 * picture, GstVaapiPictureH264 ** ref_list,
+    guint ref_list_count)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+  GstVaapiPictureH264 *ref_picture = NULL;
+  guint i;
+
+  for (i = 0; i < ref_list_count; i++) {
+    if (ref_list[i])
+      continue;
+    if (!ref_picture)
+      ref_picture = find_nearest_reference (decoder, picture);
+    if (!ref_picture)
+      return FALSE;
+    ref_list[i] = ref_picture;
+    priv->num_concealed_refs++;
+  }
+
+  if (ref_picture) {
+    GST_INFO ("concealed missing references of picture POC %d with POC %d",
+        picture->base.poc, ref_picture->base.poc);
+    GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_CORRUPTED);
+  }
+  return TRUE;
+}
+
+static gboolean
+conceal_picture_refs (GstVaapiDecoderH264 * decoder,
+    GstVaapiPictureH264 * picture)
+{
+  GstVaapiDecoderH264Private *const priv = &decoder->priv;
+
+  return conceal_picture_refs_1 (decoder, picture, priv->RefPicList0,
+      priv->RefPicList0_count) &&
+      conceal_picture_refs_1 (decoder, picture, priv->RefPicList1,
+      priv->RefPicList1_count);
+}
+
 static void
 init_picture_ref_lists (GstVaapiDecoderH264 * decoder,
     GstVaapiPictureH264 * picture)
@@ -3120,6 +3533,11 @@ init_picture_refs (GstVaapiDecoderH264 * decoder,
 
   ret = ret && exec_picture_refs_modification (decoder, picture, slice_hdr);
 
+  /* Keep decoding from the nearest reference rather than dropping the
+     slice when some were lost */
+  if (priv->conceal_errors)
+    ret = conceal_picture_refs (decoder, picture);
+
   mark_picture_refs (decoder, picture);
 
   return ret;
@@ -3371,6 +3789,11 @@ init_picture (GstVaapiDecoderH264 * decoder,
     GST_DEBUG ("<IDR>");
     GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_IDR);
     dpb_flush (decoder, picture);
+  } else if (gst_vaapi_decoder_get_skip_mode (GST_VAAPI_DECODER (decoder)) ==
+      GST_VAAPI_DECODER_SKIP_NON_KEY && !base_picture->parent_picture) {
+    /* The pictures since the previous key picture were skipped: there
+       is no frame num gap to fill, nor anything to reorder with */
+    dpb_flush (decoder, picture);
   } else if (!fill_picture_gaps (decoder, picture, slice_hdr))
     return FALSE;
 
@@ -4035,6 +4458,7 @@ decode_picture (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
   }
   gst_vaapi_picture_replace (&priv->current_picture, picture);
   gst_vaapi_picture_unref (picture);
+  priv->num_concealed_refs = 0;
 
   /* Clear inter-view references list if this is the primary coded
      picture of the current access unit */
@@ -4232,7 +4656,6 @@ decode_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
   GstVaapiSlice *slice;
   GstBuffer *const buffer =
       GST_VAAPI_DECODER_CODEC_FRAME (decoder)->input_buffer;
-  GstMapInfo map_info;
 
   GST_DEBUG ("slice (%u bytes)", pi->nalu.size);
 
@@ -4251,20 +4674,14 @@ decode_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
     return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
   }
 
-  if (!gst_buffer_map (buffer, &map_info, GST_MAP_READ)) {
-    GST_ERROR ("failed to map buffer");
-    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
-  }
-
   /* Check wether this is the first/last slice in the current access unit */
   if (pi->flags & GST_VAAPI_DECODER_UNIT_FLAG_AU_START)
     GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_AU_START);
   if (pi->flags & GST_VAAPI_DECODER_UNIT_FLAG_AU_END)
     GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_AU_END);
 
-  slice = GST_VAAPI_SLICE_NEW (H264, decoder,
-      (map_info.data + unit->offset + pi->nalu.offset), pi->nalu.size);
-  gst_buffer_unmap (buffer, &map_info);
+  slice = GST_VAAPI_SLICE_NEW_FROM_BUFFER (H264, decoder, buffer,
+      unit->offset + pi->nalu.offset, pi->nalu.size);
   if (!slice) {
     GST_ERROR ("failed to allocate slice");
     return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
@@ -4281,20 +4698,14 @@ decode_slice (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
   }
 
   gst_vaapi_picture_add_slice (GST_VAAPI_PICTURE_CAST (picture), slice);
+  gst_vaapi_picture_add_slice_stats (GST_VAAPI_PICTURE_CAST (picture),
+      pi->nalu.size, 26 + slice_hdr->pps->pic_init_qp_minus26 +
+      slice_hdr->slice_qp_delta, GST_H264_IS_I_SLICE (slice_hdr)
+      || GST_H264_IS_SI_SLICE (slice_hdr));
   picture->last_slice_hdr = slice_hdr;
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
-static inline gint
-scan_for_start_code (GstAdapter * adapter, guint ofs, guint size, guint32 * scp)
-{
-  if (size == 0)
-    return -1;
-
-  return (gint) gst_adapter_masked_scan_uint32_peek (adapter,
-      0xffffff00, 0x00000100, ofs, size, scp);
-}
-
 static GstVaapiDecoderStatus
 decode_unit (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
 {
@@ -4475,6 +4886,7 @@ gst_vaapi_decoder_h264_parse (GstVaapiDecoder * base_decoder,
   GstVaapiParserInfoH264 *pi;
   GstVaapiDecoderStatus status;
   GstH264ParserResult result;
+  SliceJobH264 *job;
   guchar *buf;
   guint i, size, buf_size, nalu_size, flags;
   guint32 start_code;
@@ -4518,11 +4930,11 @@ gst_vaapi_decoder_h264_parse (GstVaapiDecoder * base_decoder,
 
     if (priv->stream_alignment == GST_VAAPI_STREAM_ALIGN_H264_NALU) {
       buf_size = size;
-      ofs = scan_for_start_code (adapter, 4, size - 4, NULL);
+      ofs = gst_vaapi_utils_scan_for_start_code (adapter, 4, size - 4, NULL);
       if (ofs > 0)
         buf_size = ofs;
     } else {
-      ofs = scan_for_start_code (adapter, 0, size, NULL);
+      ofs = gst_vaapi_utils_scan_for_start_code (adapter, 0, size, NULL);
       if (ofs < 0)
         return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
 
@@ -4536,7 +4948,8 @@ gst_vaapi_decoder_h264_parse (GstVaapiDecoder * base_decoder,
         ofs2 = 4;
 
       ofs = G_UNLIKELY (size < ofs2 + 4) ? -1 :
-          scan_for_start_code (adapter, ofs2, size - ofs2, NULL);
+          gst_vaapi_utils_scan_for_start_code (adapter, ofs2, size - ofs2,
+          NULL);
       if (ofs < 0) {
         // Assume the whole NAL unit is present if end-of-stream
         // or stream buffers aligned on access unit boundaries
@@ -4559,6 +4972,17 @@ gst_vaapi_decoder_h264_parse (GstVaapiDecoder * base_decoder,
 
   unit->size = buf_size;
 
+  job = slice_batch_pop (decoder, buf, buf_size);
+  if (job) {
+    pi = job->pi;
+    job->pi = NULL;
+    gst_vaapi_decoder_unit_set_parsed_info (unit,
+        pi, (GDestroyNotify) gst_vaapi_mini_object_unref);
+    status = parse_slice_finish (decoder, pi, job->result);
+    slice_job_free (job);
+    goto got_status;
+  }
+
   pi = gst_vaapi_parser_info_h264_new ();
   if (!pi)
     return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
@@ -4605,11 +5029,15 @@ gst_vaapi_decoder_h264_parse (GstVaapiDecoder * base_decoder,
     case GST_H264_NAL_SLICE_IDR:
     case GST_H264_NAL_SLICE:
       status = parse_slice (decoder, unit);
+      if (status == GST_VAAPI_DECODER_STATUS_SUCCESS)
+        slice_batch_start (decoder, adapter, buf_size, size);
       break;
     default:
       status = GST_VAAPI_DECODER_STATUS_SUCCESS;
       break;
   }
+
+got_status:
   if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
     goto exit;
 
@@ -4709,14 +5137,43 @@ gst_vaapi_decoder_h264_decode (GstVaapiDecoder * base_decoder,
   return decode_unit (decoder, unit);
 }
 
+/* Checks whether the picture starting with @unit is to be dropped
+   because of the decoder skip mode */
+static gboolean
+is_skipped_picture (GstVaapiDecoderH264 * decoder, GstVaapiDecoderUnit * unit)
+{
+  GstVaapiParserInfoH264 *const pi = unit->parsed_info;
+  GstH264SliceHdr *const slice_hdr = &pi->data.slice_hdr;
+
+  switch (gst_vaapi_decoder_get_skip_mode (GST_VAAPI_DECODER (decoder))) {
+    case GST_VAAPI_DECODER_SKIP_NON_REFERENCE:
+      return pi->nalu.ref_idc == 0;
+    case GST_VAAPI_DECODER_SKIP_NON_KEY:
+      return !GST_H264_IS_I_SLICE (slice_hdr) &&
+          !GST_H264_IS_SI_SLICE (slice_hdr);
+    default:
+      break;
+  }
+  return FALSE;
+}
+
 static GstVaapiDecoderStatus
 gst_vaapi_decoder_h264_start_frame (GstVaapiDecoder * base_decoder,
     GstVaapiDecoderUnit * unit)
 {
   GstVaapiDecoderH264 *const decoder =
       GST_VAAPI_DECODER_H264_CAST (base_decoder);
+  GstVaapiDecoderStatus status;
 
-  return decode_picture (decoder, unit);
+  if (is_skipped_picture (decoder, unit)) {
+    GST_DEBUG ("skip picture");
+    return (GstVaapiDecoderStatus) GST_VAAPI_DECODER_STATUS_DROP_FRAME;
+  }
+
+  status = decode_picture (decoder, unit);
+  if (status == GST_VAAPI_DECODER_STATUS_SUCCESS)
+    gst_vaapi_decoder_update_skip_mode (base_decoder);
+  return status;
 }
 
 static GstVaapiDecoderStatus
@@ -4844,6 +5301,41 @@ gst_vaapi_decoder_h264_get_low_latency (GstVaapiDecoderH264 * decoder)
   return decoder->priv.force_low_latency;
 }
 
+/**
+ * gst_vaapi_decoder_h264_set_error_concealment:
+ * @decoder: a #GstVaapiDecoderH264
+ * @conceal_errors: %TRUE to conceal missing references
+ *
+ * If @conceal_errors is %TRUE, reference pictures lost in the stream
+ * are substituted with the nearest available reference instead of
+ * failing the slices that use them. The resulting pictures are
+ * flagged as corrupted and accounted in the statistics returned by
+ * gst_vaapi_decoder_get_error_stats().
+ **/
+void
+gst_vaapi_decoder_h264_set_error_concealment (GstVaapiDecoderH264 * decoder,
+    gboolean conceal_errors)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->priv.conceal_errors = conceal_errors;
+}
+
+/**
+ * gst_vaapi_decoder_h264_get_error_concealment:
+ * @decoder: a #GstVaapiDecoderH264
+ *
+ * Returns: %TRUE if missing references are concealed; otherwise
+ * %FALSE.
+ **/
+gboolean
+gst_vaapi_decoder_h264_get_error_concealment (GstVaapiDecoderH264 * decoder)
+{
+  g_return_val_if_fail (decoder != NULL, FALSE);
+
+  return decoder->priv.conceal_errors;
+}
+
 /**
  * gst_vaapi_decoder_h264_new:
  * @display: a #GstVaapiDisplay
@@ -73,6 +73,13 @@ void
 gst_vaapi_decoder_h264_set_base_only(GstVaapiDecoderH264 * decoder,
     gboolean base_only);
 
+gboolean
+gst_vaapi_decoder_h264_get_error_concealment(GstVaapiDecoderH264 * decoder);
+
+void
+gst_vaapi_decoder_h264_set_error_concealment(GstVaapiDecoderH264 * decoder,
+    gboolean conceal_errors);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiDecoderH264, gst_object_unref)
 
 G_END_DECLS
@@ -33,8 +33,10 @@
 #include "gstvaapidecoder_h265.h"
 #include "gstvaapidecoder_objects.h"
 #include "gstvaapidecoder_priv.h"
+#include "gstvaapidecoder_slicepool.h"
 #include "gstvaapidisplay_priv.h"
 #include "gstvaapiutils_h265_priv.h"
+#include "gstvaapiutils_h26x_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -50,6 +52,7 @@ typedef struct _GstVaapiParserInfoH265 GstVaapiParserInfoH265;
 typedef struct _GstVaapiPictureH265 GstVaapiPictureH265;
 
 static gboolean nal_is_slice (guint8 nal_type);
+static void slice_batch_clear (GstVaapiDecoderH265 * decoder);
 
 /* ------------------------------------------------------------------------- */
 /* --- H.265 Parser Info                                                 --- */
@@ -115,9 +118,11 @@ gst_vaapi_parser_info_h265_finalize (GstVaapiParserInfoH265 * pi)
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_parser_info_h265_class (void)
 {
+  static GstVaapiMiniObjectCache GstVaapiParserInfoH265Cache;
   static const GstVaapiMiniObjectClass GstVaapiParserInfoH265Class = {
     .size = sizeof (GstVaapiParserInfoH265),
-    .finalize = (GDestroyNotify) gst_vaapi_parser_info_h265_finalize
+    .finalize = (GDestroyNotify) gst_vaapi_parser_info_h265_finalize,
+    .cache = &GstVaapiParserInfoH265Cache
   };
   return &GstVaapiParserInfoH265Class;
 }
@@ -226,7 +231,9 @@ struct _GstVaapiPictureH265
   guint NoRaslOutputFlag:1;
   guint NoOutputOfPriorPicsFlag:1;
   guint RapPicFlag:1;           // nalu type between 16 and 21
+  guint LeadingPicFlag:1;       // RADL or RASL picture
   guint IntraPicFlag:1;         // Intra pic (only Intra slices)
+  guint rps_generation;         // last RPS derivation listing the picture
 };
 
 GST_VAAPI_CODEC_DEFINE_TYPE (GstVaapiPictureH265, gst_vaapi_picture_h265);
@@ -287,9 +294,11 @@ gst_vaapi_frame_store_new (GstVaapiPictureH265 * picture)
 {
   GstVaapiFrameStore *fs;
 
+  static GstVaapiMiniObjectCache GstVaapiFrameStoreCache;
   static const GstVaapiMiniObjectClass GstVaapiFrameStoreClass = {
-    sizeof (GstVaapiFrameStore),
-    gst_vaapi_frame_store_finalize
+    .size = sizeof (GstVaapiFrameStore),
+    .finalize = gst_vaapi_frame_store_finalize,
+    .cache = &GstVaapiFrameStoreCache
   };
 
   fs = (GstVaapiFrameStore *)
@@ -349,6 +358,9 @@ struct _GstVaapiDecoderH265Private
   guint parser_state;
   guint decoder_state;
   GstVaapiStreamAlignH265 stream_alignment;
+  gboolean force_low_latency;
+  gboolean conceal_errors;
+  guint num_concealed_refs;     // substituted refs of the current picture
   GstVaapiPictureH265 *current_picture;
   GstVaapiParserInfoH265 *vps[GST_H265_MAX_VPS_COUNT];
   GstVaapiParserInfoH265 *active_vps;
@@ -363,6 +375,10 @@ struct _GstVaapiDecoderH265Private
   guint dpb_count;
   guint dpb_size;
   guint dpb_size_max;
+  /* the DPB pictures sorted by POC, for the RPS derivation */
+  GstVaapiPictureH265 **dpb_by_poc;
+  guint dpb_by_poc_count;
+  guint rps_generation;
   GstVaapiProfile profile;
   GstVaapiEntrypoint entrypoint;
   GstVaapiChromaType chroma_type;
@@ -379,6 +395,8 @@ struct _GstVaapiDecoderH265Private
   guint RefPicList1_count;
 
   guint32 SpsMaxLatencyPictures;
+  gint32 last_output_poc;
+  gboolean has_last_output_poc;
   gint32 WpOffsetHalfRangeC;
 
   guint nal_length_size;
@@ -404,6 +422,13 @@ struct _GstVaapiDecoderH265Private
   guint NumPocLtCurr;
   guint NumPocLtFoll;
   guint NumPocTotalCurr;
+
+  /* slice headers parsed ahead, from the AU held in slice_batch */
+  GstVaapiSlicePool *slice_pool;
+  GstBuffer *slice_batch;
+  GstMapInfo slice_batch_map;
+  gboolean slice_pool_disabled;
+
   guint is_opened:1;
   guint is_hvcC:1;
   guint has_context:1;
@@ -695,6 +720,7 @@ dpb_remove_index (GstVaapiDecoderH265 * decoder, gint index)
 static gboolean
 dpb_output (GstVaapiDecoderH265 * decoder, GstVaapiFrameStore * fs)
 {
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
   GstVaapiPictureH265 *picture;
 
   g_return_val_if_fail (fs != NULL, FALSE);
@@ -704,6 +730,8 @@ dpb_output (GstVaapiDecoderH265 * decoder, GstVaapiFrameStore * fs)
     return FALSE;
 
   picture->output_needed = FALSE;
+  priv->last_output_poc = picture->poc;
+  priv->has_last_output_poc = TRUE;
   return gst_vaapi_picture_output (GST_VAAPI_PICTURE_CAST (picture));
 }
 
@@ -731,24 +759,52 @@ dpb_get_picture (GstVaapiDecoderH265 * decoder, gint poc, gboolean match_lsb)
   return NULL;
 }
 
-/* Get the dpb picture having the specifed poc and shor/long ref flags */
-static GstVaapiPictureH265 *
-dpb_get_ref_picture (GstVaapiDecoderH265 * decoder, gint poc, gboolean is_short)
+/* Sorts the DPB pictures by POC, keeping the DPB order of equal POCs,
+   so that the RPS derivation looks them up in O(log(DPB)) */
+static void
+dpb_index_by_poc (GstVaapiDecoderH265 * decoder)
 {
   GstVaapiDecoderH265Private *const priv = &decoder->priv;
-  guint i;
+  guint i, j, n = 0;
 
   for (i = 0; i < priv->dpb_count; i++) {
     GstVaapiPictureH265 *const picture = priv->dpb[i]->buffer;
 
-    if (picture && picture->poc == poc) {
-      if (is_short && GST_VAAPI_PICTURE_IS_SHORT_TERM_REFERENCE (picture))
-        return picture;
-      else if (GST_VAAPI_PICTURE_IS_LONG_TERM_REFERENCE (picture))
-        return picture;
-    }
+    if (!picture)
+      continue;
+    for (j = n; j > 0 && priv->dpb_by_poc[j - 1]->poc > picture->poc; j--)
+      priv->dpb_by_poc[j] = priv->dpb_by_poc[j - 1];
+    priv->dpb_by_poc[j] = picture;
+    n++;
+  }
+  priv->dpb_by_poc_count = n;
+}
+
+/* Get the dpb reference picture having the specified poc, through the
+   index built by dpb_index_by_poc() */
+static GstVaapiPictureH265 *
+dpb_lookup_ref_picture (GstVaapiDecoderH265 * decoder, gint poc)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  guint lo = 0, hi = priv->dpb_by_poc_count;
+
+  while (lo < hi) {
+    const guint mid = (lo + hi) / 2;
+    if (priv->dpb_by_poc[mid]->poc < poc)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
 
+  for (; lo < priv->dpb_by_poc_count; lo++) {
+    GstVaapiPictureH265 *const picture = priv->dpb_by_poc[lo];
+
+    if (picture->poc != poc)
+      break;
+    if (GST_VAAPI_PICTURE_FLAG_IS_SET (picture,
+            GST_VAAPI_PICTURE_FLAGS_REFERENCE))
+      return picture;
+  }
   return NULL;
 }
 
@@ -825,6 +881,43 @@ dpb_flush (GstVaapiDecoderH265 * decoder)
   /* Output any frame remaining in DPB */
   while (dpb_bump (decoder, NULL));
   dpb_clear (decoder, TRUE);
+  decoder->priv.has_last_output_poc = FALSE;
+}
+
+/* Outputs the pictures that no later picture can precede anymore,
+   without waiting for the DPB to fill up. Without reordering, this is
+   any picture; otherwise, a picture is only output if it immediately
+   follows the last output one in POC order. Right after an IRAP
+   picture, nothing is output until its leading pictures, which come
+   first in output order, are known to be decoded */
+static void
+dpb_output_ready_pictures (GstVaapiDecoderH265 * decoder,
+    GstVaapiPictureH265 * picture)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  GstH265SPS *const sps = get_sps (decoder);
+  GstVaapiPictureH265 *found_picture;
+  gint found_index;
+
+  if (!sps->max_num_reorder_pics[sps->max_sub_layers_minus1]) {
+    while (dpb_bump (decoder, NULL));
+    return;
+  }
+
+  if (!priv->has_last_output_poc &&
+      (picture->RapPicFlag || picture->LeadingPicFlag))
+    return;
+
+  for (;;) {
+    found_index = dpb_find_lowest_poc (decoder, &found_picture);
+    if (found_index < 0)
+      break;
+    if (priv->has_last_output_poc &&
+        found_picture->poc != priv->last_output_poc + 1)
+      break;
+    if (!dpb_bump (decoder, NULL))
+      break;
+  }
 }
 
 static gint
@@ -907,6 +1000,9 @@ dpb_add (GstVaapiDecoderH265 * decoder, GstVaapiPictureH265 * picture)
           && check_latency_cnt (decoder)))
     dpb_bump (decoder, picture);
 
+  if (priv->force_low_latency)
+    dpb_output_ready_pictures (decoder, picture);
+
   return TRUE;
 }
 
@@ -935,6 +1031,8 @@ dpb_init (GstVaapiDecoderH265 * decoder, GstVaapiPictureH265 * picture,
       dpb_clear (decoder, FALSE);
       while (dpb_bump (decoder, NULL));
     }
+    /* POC numbering restarts from the IRAP picture */
+    priv->has_last_output_poc = FALSE;
   } else {
     dpb_clear (decoder, FALSE);
     while ((dpb_get_num_need_output (decoder) >
@@ -960,6 +1058,10 @@ dpb_reset (GstVaapiDecoderH265 * decoder, guint dpb_size)
     priv->dpb = g_try_realloc_n (priv->dpb, dpb_size, sizeof (*priv->dpb));
     if (!priv->dpb)
       return FALSE;
+    priv->dpb_by_poc = g_try_realloc_n (priv->dpb_by_poc, dpb_size,
+        sizeof (*priv->dpb_by_poc));
+    if (!priv->dpb_by_poc)
+      return FALSE;
     memset (&priv->dpb[priv->dpb_size_max], 0,
         (dpb_size - priv->dpb_size_max) * sizeof (*priv->dpb));
     priv->dpb_size_max = dpb_size;
@@ -1002,6 +1104,7 @@ gst_vaapi_decoder_h265_close (GstVaapiDecoderH265 * decoder)
   gst_vaapi_parser_info_h265_replace (&priv->prev_pi, NULL);
 
   dpb_clear (decoder, TRUE);
+  slice_batch_clear (decoder);
 
   if (priv->parser) {
     gst_h265_parser_free (priv->parser);
@@ -1032,7 +1135,9 @@ gst_vaapi_decoder_h265_destroy (GstVaapiDecoder * base_decoder)
   guint i;
 
   gst_vaapi_decoder_h265_close (decoder);
+  g_clear_pointer (&priv->slice_pool, gst_vaapi_slice_pool_free);
   g_clear_pointer (&priv->dpb, g_free);
+  g_clear_pointer (&priv->dpb_by_poc, g_free);
   priv->dpb_count = priv->dpb_size_max = priv->dpb_size = 0;
 
   for (i = 0; i < G_N_ELEMENTS (priv->pps); i++)
@@ -1059,6 +1164,7 @@ gst_vaapi_decoder_h265_create (GstVaapiDecoder * base_decoder)
   priv->progressive_sequence = TRUE;
   priv->new_bitstream = TRUE;
   priv->prev_nal_is_eos = FALSE;
+  priv->has_last_output_poc = FALSE;
   return TRUE;
 }
 
@@ -1137,6 +1243,21 @@ get_profile (GstVaapiDecoderH265 * decoder, GstH265SPS * sps, guint dpb_size)
   return GST_VAAPI_PROFILE_UNKNOWN;
 }
 
+/* Checks whether no picture of the sequence can reference another
+   one, i.e. whether pictures can be decoded in any order */
+static gboolean
+is_intra_only_sps (GstH265SPS * sps)
+{
+  /* The DPB only holds the current picture */
+  if (sps->max_dec_pic_buffering_minus1[sps->max_sub_layers_minus1] == 0)
+    return TRUE;
+
+  /* Intra profiles of the range extensions (A.3.5) */
+  return sps->profile_tier_level.profile_idc >=
+      GST_H265_PROFILE_IDC_FORMAT_RANGE_EXTENSION &&
+      sps->profile_tier_level.intra_constraint_flag;
+}
+
 static GstVaapiDecoderStatus
 ensure_context (GstVaapiDecoderH265 * decoder, GstH265SPS * sps)
 {
@@ -1193,6 +1314,7 @@ ensure_context (GstVaapiDecoderH265 * decoder, GstH265SPS * sps)
   gst_vaapi_decoder_set_interlaced (base_decoder, !priv->progressive_sequence);
   gst_vaapi_decoder_set_pixel_aspect_ratio (base_decoder,
       sps->vui_params.par_n, sps->vui_params.par_d);
+  gst_vaapi_decoder_set_intra_only (base_decoder, is_intra_only_sps (sps));
   if (!reset_context && priv->has_context)
     return GST_VAAPI_DECODER_STATUS_SUCCESS;
 
@@ -1382,6 +1504,12 @@ decode_current_picture (GstVaapiDecoderH265 * decoder)
   if (!dpb_add (decoder, picture))
     goto error;
 
+  if (priv->num_concealed_refs > 0) {
+    gst_vaapi_decoder_add_concealed_picture (GST_VAAPI_DECODER (decoder),
+        priv->num_concealed_refs);
+    priv->num_concealed_refs = 0;
+  }
+
   gst_vaapi_picture_replace (&priv->current_picture, NULL);
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 
@@ -1484,23 +1612,24 @@ parse_sei (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
+static GstH265ParserResult
+parse_slice_hdr (GstH265Parser * parser, GstVaapiParserInfoH265 * pi)
+{
+  GstH265SliceHdr *const slice_hdr = &pi->data.slice_hdr;
+
+  memset (slice_hdr, 0, sizeof (GstH265SliceHdr));
+  return gst_h265_parser_parse_slice_hdr (parser, &pi->nalu, slice_hdr);
+}
+
+/* Updates the parser state once a slice header got parsed */
 static GstVaapiDecoderStatus
-parse_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
+parse_slice_finish (GstVaapiDecoderH265 * decoder, GstH265ParserResult result)
 {
   GstVaapiDecoderH265Private *const priv = &decoder->priv;
-  GstVaapiParserInfoH265 *const pi = unit->parsed_info;
-  GstH265SliceHdr *const slice_hdr = &pi->data.slice_hdr;
-  GstH265ParserResult result;
 
-  GST_DEBUG ("parse slice");
   priv->parser_state &= (GST_H265_VIDEO_STATE_GOT_SPS |
       GST_H265_VIDEO_STATE_GOT_PPS);
 
-  slice_hdr->short_term_ref_pic_set_idx = 0;
-
-  memset (slice_hdr, 0, sizeof (GstH265SliceHdr));
-
-  result = gst_h265_parser_parse_slice_hdr (priv->parser, &pi->nalu, slice_hdr);
   if (result != GST_H265_PARSER_OK)
     return get_status (result);
 
@@ -1508,6 +1637,181 @@ parse_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
+static GstVaapiDecoderStatus
+parse_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  GstVaapiParserInfoH265 *const pi = unit->parsed_info;
+
+  GST_DEBUG ("parse slice");
+
+  return parse_slice_finish (decoder, parse_slice_hdr (priv->parser, pi));
+}
+
+/* A slice of the current AU whose header is parsed from the pool */
+typedef struct
+{
+  GstVaapiParserInfoH265 *pi;
+  const guint8 *data;
+  guint size;
+  GstH265ParserResult result;
+} SliceJobH265;
+
+static void
+slice_job_free (SliceJobH265 * job)
+{
+  gst_vaapi_parser_info_h265_replace (&job->pi, NULL);
+  g_slice_free (SliceJobH265, job);
+}
+
+static void
+slice_job_parse (SliceJobH265 * job, GstVaapiDecoderH265 * decoder)
+{
+  /* The parser is only read from, nothing else is parsed meanwhile */
+  job->result = parse_slice_hdr (decoder->priv.parser, job->pi);
+}
+
+static void
+slice_batch_release (GstVaapiDecoderH265 * decoder)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+
+  if (!priv->slice_batch)
+    return;
+  gst_buffer_unmap (priv->slice_batch, &priv->slice_batch_map);
+  gst_buffer_replace (&priv->slice_batch, NULL);
+}
+
+static void
+slice_batch_clear (GstVaapiDecoderH265 * decoder)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+
+  if (priv->slice_pool)
+    gst_vaapi_slice_pool_clear (priv->slice_pool);
+  slice_batch_release (decoder);
+}
+
+/* Hands over to the pool the slice segments that immediately follow
+   the one just parsed at the start of the adapter, up to the next
+   non-VCL NAL unit, which may change the parser state. This needs the
+   whole AU to be available, i.e. AU aligned stream buffers */
+static void
+slice_batch_start (GstVaapiDecoderH265 * decoder, GstAdapter * adapter,
+    guint ofs, guint size)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  GQueue jobs = G_QUEUE_INIT;
+  GstVaapiParserInfoH265 *pi;
+  GstH265ParserResult result;
+  SliceJobH265 *job;
+  const guint8 *data;
+  guint i, nal_size;
+  gint next;
+
+  if (priv->stream_alignment != GST_VAAPI_STREAM_ALIGN_H265_AU)
+    return;
+  if (priv->slice_batch || ofs >= size)
+    return;
+
+  if (!priv->slice_pool) {
+    if (priv->slice_pool_disabled)
+      return;
+    priv->slice_pool = gst_vaapi_slice_pool_new ((GFunc) slice_job_parse,
+        decoder, (GDestroyNotify) slice_job_free);
+    if (!priv->slice_pool) {
+      priv->slice_pool_disabled = TRUE;
+      return;
+    }
+  }
+
+  priv->slice_batch = gst_adapter_get_buffer (adapter, size);
+  if (!priv->slice_batch)
+    return;
+  if (!gst_buffer_map (priv->slice_batch, &priv->slice_batch_map,
+          GST_MAP_READ)) {
+    gst_buffer_replace (&priv->slice_batch, NULL);
+    return;
+  }
+  data = priv->slice_batch_map.data;
+
+  /* Split the NAL units the same way gst_vaapi_decoder_h265_parse() does */
+  while (ofs < size) {
+    if (priv->is_hvcC) {
+      if (size - ofs < priv->nal_length_size)
+        break;
+      nal_size = 0;
+      for (i = 0; i < priv->nal_length_size; i++)
+        nal_size = (nal_size << 8) | data[ofs + i];
+      if (nal_size > size - ofs - priv->nal_length_size)
+        break;
+      nal_size += priv->nal_length_size;
+    } else {
+      if (size - ofs < 4)
+        break;
+      next = gst_vaapi_utils_find_start_code (data + ofs + 4, size - ofs - 4);
+      nal_size = next < 0 ? size - ofs : next + 4;
+    }
+
+    pi = gst_vaapi_parser_info_h265_new ();
+    if (!pi)
+      break;
+    if (priv->is_hvcC)
+      result = gst_h265_parser_identify_nalu_hevc (priv->parser,
+          data + ofs, 0, nal_size, priv->nal_length_size, &pi->nalu);
+    else
+      result = gst_h265_parser_identify_nalu_unchecked (priv->parser,
+          data + ofs, 0, nal_size, &pi->nalu);
+    if (result != GST_H265_PARSER_OK || !nal_is_slice (pi->nalu.type)) {
+      gst_vaapi_parser_info_h265_unref (pi);
+      break;
+    }
+
+    job = g_slice_new (SliceJobH265);
+    job->pi = pi;
+    job->data = data + ofs;
+    job->size = nal_size;
+    g_queue_push_tail (&jobs, job);
+    ofs += nal_size;
+  }
+
+  if (g_queue_get_length (&jobs) < GST_VAAPI_SLICE_POOL_MIN_JOBS) {
+    g_queue_foreach (&jobs, (GFunc) slice_job_free, NULL);
+    g_queue_clear (&jobs);
+    slice_batch_release (decoder);
+    return;
+  }
+
+  GST_DEBUG ("parsing %u slice headers ahead", g_queue_get_length (&jobs));
+  while ((job = g_queue_pop_head (&jobs)))
+    gst_vaapi_slice_pool_push (priv->slice_pool, job);
+}
+
+/* Returns the slice parsed ahead for the NAL unit at @buf, if any. The
+   pending slices are dropped if the stream does not match them, e.g.
+   after a flush */
+static SliceJobH265 *
+slice_batch_pop (GstVaapiDecoderH265 * decoder, const guchar * buf,
+    guint buf_size)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  SliceJobH265 *job;
+
+  if (!priv->slice_batch)
+    return NULL;
+
+  job = gst_vaapi_slice_pool_peek (priv->slice_pool);
+  if (!job || job->data != buf || job->size != buf_size) {
+    slice_batch_clear (decoder);
+    return NULL;
+  }
+
+  job = gst_vaapi_slice_pool_pop (priv->slice_pool);
+  if (gst_vaapi_slice_pool_is_empty (priv->slice_pool))
+    slice_batch_release (decoder);
+  return job;
+}
+
 static GstVaapiDecoderStatus
 decode_vps (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
 {
@@ -1766,6 +2070,76 @@ init_picture_refs (GstVaapiDecoderH265 * decoder,
   }
 }
 
+/* Finds the reference picture closest to @picture in output order */
+static GstVaapiPictureH265 *
+find_nearest_reference (GstVaapiDecoderH265 * decoder,
+    GstVaapiPictureH265 * picture)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  GstVaapiPictureH265 *found_picture = NULL;
+  gint32 found_diff = G_MAXINT32;
+  guint i;
+
+  for (i = 0; i < priv->dpb_count; i++) {
+    GstVaapiFrameStore *const fs = priv->dpb[i];
+    gint32 diff;
+
+    if (!gst_vaapi_frame_store_has_reference (fs) || fs->buffer == picture)
+      continue;
+    diff = ABS (fs->buffer->poc - picture->poc);
+    if (diff < found_diff) {
+      found_picture = fs->buffer;
+      found_diff = diff;
+    }
+  }
+  return found_picture;
+}
+
+/* Substitutes the missing entries of @ref_list with the nearest
+   available reference, and flags @picture as corrupted if one of its
+   references had to be substituted or is itself corrupted */
+static void
+conceal_picture_refs_1 (GstVaapiDecoderH265 * decoder,
+    GstVaapiPictureH265 * picture, GstVaapiPictureH265 ** ref_list,
+    guint ref_list_count)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+  GstVaapiPictureH265 *ref_picture = NULL;
+  guint i;
+
+  for (i = 0; i < ref_list_count; i++) {
+    if (!ref_list[i]) {
+      if (!ref_picture)
+        ref_picture = find_nearest_reference (decoder, picture);
+      if (!ref_picture) {
+        GST_WARNING ("no reference available to conceal picture POC %d",
+            picture->poc);
+        return;
+      }
+      ref_list[i] = ref_picture;
+      priv->num_concealed_refs++;
+      GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_CORRUPTED);
+    } else if (GST_VAAPI_PICTURE_IS_CORRUPTED (ref_list[i]))
+      GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_CORRUPTED);
+  }
+
+  if (ref_picture)
+    GST_INFO ("concealed missing references of picture POC %d with POC %d",
+        picture->poc, ref_picture->poc);
+}
+
+static void
+conceal_picture_refs (GstVaapiDecoderH265 * decoder,
+    GstVaapiPictureH265 * picture)
+{
+  GstVaapiDecoderH265Private *const priv = &decoder->priv;
+
+  conceal_picture_refs_1 (decoder, picture, priv->RefPicList0,
+      priv->RefPicList0_count);
+  conceal_picture_refs_1 (decoder, picture, priv->RefPicList1,
+      priv->RefPicList1_count);
+}
+
 static gboolean
 init_picture (GstVaapiDecoderH265 * decoder,
     GstVaapiPictureH265 * picture, GstVaapiParserInfoH265 * pi)
@@ -1786,6 +2160,9 @@ init_picture (GstVaapiDecoderH265 * decoder,
       pi->nalu.type <= GST_H265_NAL_SLICE_CRA_NUT)
     picture->RapPicFlag = TRUE;
 
+  if (nal_is_radl (pi->nalu.type) || nal_is_rasl (pi->nalu.type))
+    picture->LeadingPicFlag = TRUE;
+
   /* FIXME: Use SEI header values */
   base_picture->structure = GST_VAAPI_PICTURE_STRUCTURE_FRAME;
   picture->structure = base_picture->structure;
@@ -2164,20 +2541,17 @@ is_new_access_unit (GstVaapiParserInfoH265 * pi,
   return FALSE;
 }
 
-static gboolean
-has_entry_in_rps (GstVaapiPictureH265 * dpb_pic,
+/* Stamps the pictures of @rps_list as listed by the current RPS */
+static void
+mark_rps_entries (GstVaapiDecoderH265 * decoder,
     GstVaapiPictureH265 ** rps_list, guint rps_list_length)
 {
   guint i;
 
-  if (!dpb_pic || !rps_list || !rps_list_length)
-    return FALSE;
-
   for (i = 0; i < rps_list_length; i++) {
-    if (rps_list[i] && rps_list[i]->poc == dpb_pic->poc)
-      return TRUE;
+    if (rps_list[i])
+      rps_list[i]->rps_generation = decoder->priv.rps_generation;
   }
-  return FALSE;
 }
 
 /* the derivation process for the RPS and the picture marking */
@@ -2190,6 +2564,8 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
   GstVaapiPictureH265 *dpb_pic = NULL;
   guint i;
 
+  dpb_index_by_poc (decoder);
+
   memset (priv->RefPicSetLtCurr, 0, sizeof (GstVaapiPictureH265 *) * 16);
   memset (priv->RefPicSetLtFoll, 0, sizeof (GstVaapiPictureH265 *) * 16);
   memset (priv->RefPicSetStCurrBefore, 0, sizeof (GstVaapiPictureH265 *) * 16);
@@ -2205,7 +2581,7 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
       else
         priv->RefPicSetLtCurr[i] = NULL;
     } else {
-      dpb_pic = dpb_get_picture (decoder, priv->PocLtCurr[i], FALSE);
+      dpb_pic = dpb_lookup_ref_picture (decoder, priv->PocLtCurr[i]);
       if (dpb_pic)
         priv->RefPicSetLtCurr[i] = dpb_pic;
       else
@@ -2223,7 +2599,7 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
       else
         priv->RefPicSetLtFoll[i] = NULL;
     } else {
-      dpb_pic = dpb_get_picture (decoder, priv->PocLtFoll[i], FALSE);
+      dpb_pic = dpb_lookup_ref_picture (decoder, priv->PocLtFoll[i]);
       if (dpb_pic)
         priv->RefPicSetLtFoll[i] = dpb_pic;
       else
@@ -2249,7 +2625,7 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
 
   /* (8-7) */
   for (i = 0; i < priv->NumPocStCurrBefore; i++) {
-    dpb_pic = dpb_get_ref_picture (decoder, priv->PocStCurrBefore[i], TRUE);
+    dpb_pic = dpb_lookup_ref_picture (decoder, priv->PocStCurrBefore[i]);
     if (dpb_pic) {
       gst_vaapi_picture_h265_set_reference (dpb_pic,
           GST_VAAPI_PICTURE_FLAG_SHORT_TERM_REFERENCE |
@@ -2262,7 +2638,7 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
     priv->RefPicSetStCurrBefore[i] = NULL;
 
   for (i = 0; i < priv->NumPocStCurrAfter; i++) {
-    dpb_pic = dpb_get_ref_picture (decoder, priv->PocStCurrAfter[i], TRUE);
+    dpb_pic = dpb_lookup_ref_picture (decoder, priv->PocStCurrAfter[i]);
     if (dpb_pic) {
       gst_vaapi_picture_h265_set_reference (dpb_pic,
           GST_VAAPI_PICTURE_FLAG_SHORT_TERM_REFERENCE |
@@ -2275,7 +2651,7 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
     priv->RefPicSetStCurrAfter[i] = NULL;
 
   for (i = 0; i < priv->NumPocStFoll; i++) {
-    dpb_pic = dpb_get_ref_picture (decoder, priv->PocStFoll[i], TRUE);
+    dpb_pic = dpb_lookup_ref_picture (decoder, priv->PocStFoll[i]);
     if (dpb_pic) {
       gst_vaapi_picture_h265_set_reference (dpb_pic,
           GST_VAAPI_PICTURE_FLAG_SHORT_TERM_REFERENCE |
@@ -2288,18 +2664,18 @@ derive_and_mark_rps (GstVaapiDecoderH265 * decoder,
     priv->RefPicSetStFoll[i] = NULL;
 
   /* Mark all dpb pics not beloging to RefPicSet*[] as unused for ref */
+  if (++priv->rps_generation == 0)
+    ++priv->rps_generation;
+  mark_rps_entries (decoder, priv->RefPicSetLtCurr, priv->NumPocLtCurr);
+  mark_rps_entries (decoder, priv->RefPicSetLtFoll, priv->NumPocLtFoll);
+  mark_rps_entries (decoder, priv->RefPicSetStCurrAfter,
+      priv->NumPocStCurrAfter);
+  mark_rps_entries (decoder, priv->RefPicSetStCurrBefore,
+      priv->NumPocStCurrBefore);
+  mark_rps_entries (decoder, priv->RefPicSetStFoll, priv->NumPocStFoll);
   for (i = 0; i < priv->dpb_count; i++) {
     dpb_pic = priv->dpb[i]->buffer;
-    if (dpb_pic &&
-        !has_entry_in_rps (dpb_pic, priv->RefPicSetLtCurr, priv->NumPocLtCurr)
-        && !has_entry_in_rps (dpb_pic, priv->RefPicSetLtFoll,
-            priv->NumPocLtFoll)
-        && !has_entry_in_rps (dpb_pic, priv->RefPicSetStCurrAfter,
-            priv->NumPocStCurrAfter)
-        && !has_entry_in_rps (dpb_pic, priv->RefPicSetStCurrBefore,
-            priv->NumPocStCurrBefore)
-        && !has_entry_in_rps (dpb_pic, priv->RefPicSetStFoll,
-            priv->NumPocStFoll))
+    if (dpb_pic && dpb_pic->rps_generation != priv->rps_generation)
       gst_vaapi_picture_h265_set_reference (dpb_pic, 0);
   }
 
@@ -2458,6 +2834,7 @@ decode_picture (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
 
   gst_vaapi_picture_replace (&priv->current_picture, picture);
   gst_vaapi_picture_unref (picture);
+  priv->num_concealed_refs = 0;
 
   /* Update cropping rectangle */
   if (sps->conformance_window_flag) {
@@ -2807,7 +3184,6 @@ decode_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
   GstVaapiSlice *slice = NULL;
   GstBuffer *const buffer =
       GST_VAAPI_DECODER_CODEC_FRAME (decoder)->input_buffer;
-  GstMapInfo map_info;
 
   GST_DEBUG ("slice (%u bytes)", pi->nalu.size);
   if (!is_valid_state (pi->state, GST_H265_VIDEO_STATE_VALID_PICTURE_HEADERS)) {
@@ -2825,11 +3201,6 @@ decode_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
     return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
   }
 
-  if (!gst_buffer_map (buffer, &map_info, GST_MAP_READ)) {
-    GST_ERROR ("failed to map buffer");
-    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
-  }
-
   /* Check wether this is the first/last slice in the current access unit */
   if (pi->flags & GST_VAAPI_DECODER_UNIT_FLAG_AU_START)
     GST_VAAPI_PICTURE_FLAG_SET (picture, GST_VAAPI_PICTURE_FLAG_AU_START);
@@ -2840,14 +3211,13 @@ decode_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
   if (is_range_extension_profile (priv->profile)
       || is_scc_profile (priv->profile)) {
 #if VA_CHECK_VERSION(1,2,0)
-    slice = GST_VAAPI_SLICE_NEW (HEVCExtension, decoder,
-        (map_info.data + unit->offset + pi->nalu.offset), pi->nalu.size);
+    slice = GST_VAAPI_SLICE_NEW_FROM_BUFFER (HEVCExtension, decoder, buffer,
+        unit->offset + pi->nalu.offset, pi->nalu.size);
 #endif
   } else {
-    slice = GST_VAAPI_SLICE_NEW (HEVC, decoder,
-        (map_info.data + unit->offset + pi->nalu.offset), pi->nalu.size);
+    slice = GST_VAAPI_SLICE_NEW_FROM_BUFFER (HEVC, decoder, buffer,
+        unit->offset + pi->nalu.offset, pi->nalu.size);
   }
-  gst_buffer_unmap (buffer, &map_info);
   if (!slice) {
     GST_ERROR ("failed to allocate slice");
     return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
@@ -2855,26 +3225,23 @@ decode_slice (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
 
   init_picture_refs (decoder, picture, slice_hdr);
 
+  /* Keep decoding from the nearest reference when some were lost */
+  if (priv->conceal_errors)
+    conceal_picture_refs (decoder, picture);
+
   if (!fill_slice (decoder, picture, slice, pi, unit)) {
     gst_vaapi_mini_object_unref (GST_VAAPI_MINI_OBJECT (slice));
     return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
   }
 
   gst_vaapi_picture_add_slice (GST_VAAPI_PICTURE_CAST (picture), slice);
+  gst_vaapi_picture_add_slice_stats (GST_VAAPI_PICTURE_CAST (picture),
+      pi->nalu.size, 26 + slice_hdr->pps->init_qp_minus26 +
+      slice_hdr->qp_delta, GST_H265_IS_I_SLICE (slice_hdr));
   picture->last_slice_hdr = slice_hdr;
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
-static inline gint
-scan_for_start_code (GstAdapter * adapter, guint ofs, guint size, guint32 * scp)
-{
-  if (size == 0)
-    return -1;
-
-  return (gint) gst_adapter_masked_scan_uint32_peek (adapter,
-      0xffffff00, 0x00000100, ofs, size, scp);
-}
-
 static GstVaapiDecoderStatus
 decode_unit (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
 {
@@ -3080,6 +3447,7 @@ gst_vaapi_decoder_h265_parse (GstVaapiDecoder * base_decoder,
   GstVaapiParserInfoH265 *pi;
   GstVaapiDecoderStatus status;
   GstH265ParserResult result;
+  SliceJobH265 *job;
   guchar *buf;
   guint i, size, buf_size, nalu_size, flags;
   guint32 start_code;
@@ -3119,11 +3487,11 @@ gst_vaapi_decoder_h265_parse (GstVaapiDecoder * base_decoder,
       return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
     if (priv->stream_alignment == GST_VAAPI_STREAM_ALIGN_H265_NALU) {
       buf_size = size;
-      ofs = scan_for_start_code (adapter, 4, size - 4, NULL);
+      ofs = gst_vaapi_utils_scan_for_start_code (adapter, 4, size - 4, NULL);
       if (ofs > 0)
         buf_size = ofs;
     } else {
-      ofs = scan_for_start_code (adapter, 0, size, NULL);
+      ofs = gst_vaapi_utils_scan_for_start_code (adapter, 0, size, NULL);
       if (ofs < 0)
         return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
       if (ofs > 0) {
@@ -3135,7 +3503,8 @@ gst_vaapi_decoder_h265_parse (GstVaapiDecoder * base_decoder,
       if (ofs2 < 4)
         ofs2 = 4;
       ofs = G_UNLIKELY (size < ofs2 + 4) ? -1 :
-          scan_for_start_code (adapter, ofs2, size - ofs2, NULL);
+          gst_vaapi_utils_scan_for_start_code (adapter, ofs2, size - ofs2,
+          NULL);
       if (ofs < 0) {
         // Assume the whole NAL unit is present if end-of-stream
         // or stream buffers aligned on access unit boundaries
@@ -3155,6 +3524,18 @@ gst_vaapi_decoder_h265_parse (GstVaapiDecoder * base_decoder,
   if (!buf)
     return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
   unit->size = buf_size;
+
+  job = slice_batch_pop (decoder, buf, buf_size);
+  if (job) {
+    pi = job->pi;
+    job->pi = NULL;
+    gst_vaapi_decoder_unit_set_parsed_info (unit,
+        pi, (GDestroyNotify) gst_vaapi_mini_object_unref);
+    status = parse_slice_finish (decoder, job->result);
+    slice_job_free (job);
+    goto got_status;
+  }
+
   pi = gst_vaapi_parser_info_h265_new ();
   if (!pi)
     return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
@@ -3200,11 +3581,15 @@ gst_vaapi_decoder_h265_parse (GstVaapiDecoder * base_decoder,
     case GST_H265_NAL_SLICE_IDR_N_LP:
     case GST_H265_NAL_SLICE_CRA_NUT:
       status = parse_slice (decoder, unit);
+      if (status == GST_VAAPI_DECODER_STATUS_SUCCESS)
+        slice_batch_start (decoder, adapter, buf_size, size);
       break;
     default:
       status = GST_VAAPI_DECODER_STATUS_SUCCESS;
       break;
   }
+
+got_status:
   if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
     goto exit;
   flags = 0;
@@ -3304,14 +3689,53 @@ gst_vaapi_decoder_h265_decode (GstVaapiDecoder * base_decoder,
   return decode_unit (decoder, unit);
 }
 
+/* Checks whether the picture starting with @unit is to be dropped
+   because of the decoder skip mode */
+static gboolean
+is_skipped_picture (GstVaapiDecoderH265 * decoder, GstVaapiDecoderUnit * unit)
+{
+  GstVaapiParserInfoH265 *const pi = unit->parsed_info;
+  GstH265SliceHdr *const slice_hdr = &pi->data.slice_hdr;
+
+  switch (gst_vaapi_decoder_get_skip_mode (GST_VAAPI_DECODER (decoder))) {
+    case GST_VAAPI_DECODER_SKIP_NON_REFERENCE:
+      /* Sub-layer non-reference pictures can still be referenced by
+         the pictures of the higher sub-layers */
+      return !nal_is_ref (pi->nalu.type) &&
+          pi->nalu.temporal_id_plus1 - 1 ==
+          slice_hdr->pps->sps->max_sub_layers_minus1;
+    case GST_VAAPI_DECODER_SKIP_NON_KEY:
+      return !nal_is_irap (pi->nalu.type) && !GST_H265_IS_I_SLICE (slice_hdr);
+    default:
+      break;
+  }
+  return FALSE;
+}
+
 static GstVaapiDecoderStatus
 gst_vaapi_decoder_h265_start_frame (GstVaapiDecoder * base_decoder,
     GstVaapiDecoderUnit * unit)
 {
   GstVaapiDecoderH265 *const decoder =
       GST_VAAPI_DECODER_H265_CAST (base_decoder);
+  GstVaapiParserInfoH265 *const pi = unit->parsed_info;
+  GstVaapiDecoderStatus status;
+
+  if (is_skipped_picture (decoder, unit)) {
+    GST_DEBUG ("skip picture");
+    return (GstVaapiDecoderStatus) GST_VAAPI_DECODER_STATUS_DROP_FRAME;
+  }
 
-  return decode_picture (decoder, unit);
+  /* The pictures since the previous key picture were skipped, their
+     POC cannot order the intra picture against the DPB contents */
+  if (gst_vaapi_decoder_get_skip_mode (base_decoder) ==
+      GST_VAAPI_DECODER_SKIP_NON_KEY && !nal_is_irap (pi->nalu.type))
+    dpb_flush (decoder);
+
+  status = decode_picture (decoder, unit);
+  if (status == GST_VAAPI_DECODER_STATUS_SUCCESS)
+    gst_vaapi_decoder_update_skip_mode (base_decoder);
+  return status;
 }
 
 static GstVaapiDecoderStatus
@@ -3384,6 +3808,80 @@ gst_vaapi_decoder_h265_set_alignment (GstVaapiDecoderH265 * decoder,
   decoder->priv.stream_alignment = alignment;
 }
 
+/**
+ * gst_vaapi_decoder_h265_set_low_latency:
+ * @decoder: a #GstVaapiDecoderH265
+ * @force_low_latency: %TRUE if force low latency
+ *
+ * If @force_low_latency is %TRUE, the decoded pictures are output as
+ * soon as no later picture can precede them in display order, instead
+ * of waiting for the decoded picture buffer (DPB) bumping process. The
+ * output order is preserved, but the DPB output timing of the HEVC
+ * specification is not.
+ *
+ * Streams without reordering (sps_max_num_reorder_pics equal to 0)
+ * are output right after decode in any case.
+ **/
+void
+gst_vaapi_decoder_h265_set_low_latency (GstVaapiDecoderH265 * decoder,
+    gboolean force_low_latency)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->priv.force_low_latency = force_low_latency;
+}
+
+/**
+ * gst_vaapi_decoder_h265_get_low_latency:
+ * @decoder: a #GstVaapiDecoderH265
+ *
+ * Returns: %TRUE if the low latency mode is enabled; otherwise
+ * %FALSE.
+ **/
+gboolean
+gst_vaapi_decoder_h265_get_low_latency (GstVaapiDecoderH265 * decoder)
+{
+  g_return_val_if_fail (decoder != NULL, FALSE);
+
+  return decoder->priv.force_low_latency;
+}
+
+/**
+ * gst_vaapi_decoder_h265_set_error_concealment:
+ * @decoder: a #GstVaapiDecoderH265
+ * @conceal_errors: %TRUE to conceal missing references
+ *
+ * If @conceal_errors is %TRUE, reference pictures lost in the stream
+ * are substituted with the nearest available reference instead of
+ * being left out of the reference picture lists. The resulting
+ * pictures, and the ones predicted from them, are flagged as
+ * corrupted. Substitutions are accounted in the statistics returned
+ * by gst_vaapi_decoder_get_error_stats().
+ **/
+void
+gst_vaapi_decoder_h265_set_error_concealment (GstVaapiDecoderH265 * decoder,
+    gboolean conceal_errors)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->priv.conceal_errors = conceal_errors;
+}
+
+/**
+ * gst_vaapi_decoder_h265_get_error_concealment:
+ * @decoder: a #GstVaapiDecoderH265
+ *
+ * Returns: %TRUE if missing references are concealed; otherwise
+ * %FALSE.
+ **/
+gboolean
+gst_vaapi_decoder_h265_get_error_concealment (GstVaapiDecoderH265 * decoder)
+{
+  g_return_val_if_fail (decoder != NULL, FALSE);
+
+  return decoder->priv.conceal_errors;
+}
+
 /**
  * gst_vaapi_decoder_h265_new:
  * @display: a #GstVaapiDisplay
@@ -63,6 +63,20 @@ void
 gst_vaapi_decoder_h265_set_alignment (GstVaapiDecoderH265 *decoder,
     GstVaapiStreamAlignH265 alignment);
 
+gboolean
+gst_vaapi_decoder_h265_get_low_latency (GstVaapiDecoderH265 * decoder);
+
+void
+gst_vaapi_decoder_h265_set_low_latency (GstVaapiDecoderH265 * decoder,
+    gboolean force_low_latency);
+
+gboolean
+gst_vaapi_decoder_h265_get_error_concealment (GstVaapiDecoderH265 * decoder);
+
+void
+gst_vaapi_decoder_h265_set_error_concealment (GstVaapiDecoderH265 * decoder,
+    gboolean conceal_errors);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiDecoderH265, gst_object_unref)
 
 G_END_DECLS
@@ -33,6 +33,7 @@
 #include "gstvaapidecoder_objects.h"
 #include "gstvaapidecoder_priv.h"
 #include "gstvaapidisplay_priv.h"
+#include "gstvaapiutils.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -40,6 +41,9 @@
 #define GST_VAAPI_DECODER_JPEG_CAST(decoder) \
     ((GstVaapiDecoderJpeg *)(decoder))
 
+/* Maximum number of VA contexts frames are spread over */
+#define MAX_CONTEXTS 8
+
 typedef struct _GstVaapiDecoderJpegPrivate GstVaapiDecoderJpegPrivate;
 typedef struct _GstVaapiDecoderJpegClass GstVaapiDecoderJpegClass;
 
@@ -64,10 +68,18 @@ struct _GstVaapiDecoderJpegPrivate
   GstJpegFrameHdr frame_hdr;
   GstJpegHuffmanTables huf_tables;
   GstJpegQuantTables quant_tables;
+  /* VA tables, kept packed across pictures while unchanged */
+  VAIQMatrixBufferJPEGBaseline iq_matrix;
+  VAHuffmanTableBufferJPEGBaseline huf_table;
   guint mcu_restart;
   guint parser_state;
   guint decoder_state;
+  guint num_contexts;
+  GArray *extra_contexts;
+  guint next_context;
   guint is_opened:1;
+  guint iq_matrix_is_default:1;
+  guint huf_table_is_default:1;
   guint profile_changed:1;
   guint size_changed:1;
 };
@@ -110,12 +122,86 @@ unit_get_marker_code (GstVaapiDecoderUnit * unit)
   return GPOINTER_TO_SIZE (unit->parsed_info);
 }
 
+/* Destroys the VA contexts created in addition to the decoder one */
+static void
+destroy_extra_contexts (GstVaapiDecoderJpeg * decoder)
+{
+  GstVaapiDecoder *const base_decoder = GST_VAAPI_DECODER (decoder);
+  GstVaapiDecoderJpegPrivate *const priv = &decoder->priv;
+  GstVaapiDisplay *const display = GST_VAAPI_DECODER_DISPLAY (decoder);
+  guint i;
+
+  if (!priv->extra_contexts || priv->extra_contexts->len == 0)
+    return;
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  for (i = 0; i < priv->extra_contexts->len; i++) {
+    vaDestroyContext (base_decoder->va_display,
+        g_array_index (priv->extra_contexts, VAContextID, i));
+  }
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  g_array_set_size (priv->extra_contexts, 0);
+
+  if (base_decoder->context)
+    base_decoder->va_context = gst_vaapi_context_get_id (base_decoder->context);
+  priv->next_context = 0;
+}
+
+/* Creates the extra VA contexts, from the decoder context config */
+static void
+ensure_extra_contexts (GstVaapiDecoderJpeg * decoder)
+{
+  GstVaapiDecoder *const base_decoder = GST_VAAPI_DECODER (decoder);
+  GstVaapiDecoderJpegPrivate *const priv = &decoder->priv;
+  GstVaapiDisplay *const display = GST_VAAPI_DECODER_DISPLAY (decoder);
+  GstVaapiContext *const context = base_decoder->context;
+  VAContextID context_id;
+  VAStatus status;
+
+  if (!context || priv->num_contexts < 2)
+    return;
+
+  if (!priv->extra_contexts)
+    priv->extra_contexts = g_array_new (FALSE, FALSE, sizeof (VAContextID));
+
+  while (priv->extra_contexts->len + 1 < priv->num_contexts) {
+    GST_VAAPI_DISPLAY_LOCK (display);
+    status = vaCreateContext (base_decoder->va_display, context->va_config,
+        priv->width, priv->height, VA_PROGRESSIVE, NULL, 0, &context_id);
+    GST_VAAPI_DISPLAY_UNLOCK (display);
+    if (!vaapi_check_status (status, "vaCreateContext()"))
+      break;
+    g_array_append_val (priv->extra_contexts, context_id);
+  }
+  GST_DEBUG ("decoding over %u VA contexts", priv->extra_contexts->len + 1);
+}
+
+/* Selects the VA context the next picture is decoded with, in turn */
+static void
+select_next_context (GstVaapiDecoderJpeg * decoder)
+{
+  GstVaapiDecoder *const base_decoder = GST_VAAPI_DECODER (decoder);
+  GstVaapiDecoderJpegPrivate *const priv = &decoder->priv;
+  guint n;
+
+  if (!priv->extra_contexts || priv->extra_contexts->len == 0)
+    return;
+
+  n = priv->next_context++ % (priv->extra_contexts->len + 1);
+  if (n == 0)
+    base_decoder->va_context = gst_vaapi_context_get_id (base_decoder->context);
+  else
+    base_decoder->va_context =
+        g_array_index (priv->extra_contexts, VAContextID, n - 1);
+}
+
 static void
 gst_vaapi_decoder_jpeg_close (GstVaapiDecoderJpeg * decoder)
 {
   GstVaapiDecoderJpegPrivate *const priv = &decoder->priv;
 
   gst_vaapi_picture_replace (&priv->current_picture, NULL);
+  destroy_extra_contexts (decoder);
 
   /* Reset all */
   priv->profile = GST_VAAPI_PROFILE_JPEG_BASELINE;
@@ -145,6 +231,7 @@ gst_vaapi_decoder_jpeg_destroy (GstVaapiDecoder * base_decoder)
       GST_VAAPI_DECODER_JPEG_CAST (base_decoder);
 
   gst_vaapi_decoder_jpeg_close (decoder);
+  g_clear_pointer (&decoder->priv.extra_contexts, g_array_unref);
 }
 
 static gboolean
@@ -259,10 +346,14 @@ ensure_context (GstVaapiDecoderJpeg * decoder)
       return GST_VAAPI_DECODER_STATUS_ERROR_UNSUPPORTED_CHROMA_FORMAT;
     info.chroma_type = chroma_type;
 
+    /* They share the config of the context about to be reset */
+    destroy_extra_contexts (decoder);
+
     reset_context =
         gst_vaapi_decoder_ensure_context (GST_VAAPI_DECODER (decoder), &info);
     if (!reset_context)
       return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+    ensure_extra_contexts (decoder);
   }
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
@@ -338,23 +429,13 @@ fill_picture (GstVaapiDecoderJpeg * decoder,
 }
 
 static GstVaapiDecoderStatus
-fill_quantization_table (GstVaapiDecoderJpeg * decoder,
-    GstVaapiPicture * picture)
+pack_quantization_table (GstVaapiDecoderJpeg * decoder)
 {
   GstVaapiDecoderJpegPrivate *const priv = &decoder->priv;
-  VAIQMatrixBufferJPEGBaseline *iq_matrix;
+  VAIQMatrixBufferJPEGBaseline *const iq_matrix = &priv->iq_matrix;
   guint i, j, num_tables;
 
-  if (!VALID_STATE (decoder, GOT_IQ_TABLE))
-    gst_jpeg_get_default_quantization_tables (&priv->quant_tables);
-
-  picture->iq_matrix = GST_VAAPI_IQ_MATRIX_NEW (JPEGBaseline, decoder);
-  if (!picture->iq_matrix) {
-    GST_ERROR ("failed to allocate quantiser table");
-    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
-  }
-  iq_matrix = picture->iq_matrix->param;
-
+  memset (iq_matrix, 0, sizeof (*iq_matrix));
   num_tables = MIN (G_N_ELEMENTS (iq_matrix->quantiser_table),
       GST_JPEG_MAX_QUANT_ELEMENTS);
 
@@ -379,6 +460,37 @@ fill_quantization_table (GstVaapiDecoderJpeg * decoder,
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
+static GstVaapiDecoderStatus
+fill_quantization_table (GstVaapiDecoderJpeg * decoder,
+    GstVaapiPicture * picture)
+{
+  GstVaapiDecoderJpegPrivate *const priv = &decoder->priv;
+  GstVaapiDecoderStatus status;
+
+  /* Most MJPEG streams never carry their own tables, so the default
+     ones are only packed once */
+  if (VALID_STATE (decoder, GOT_IQ_TABLE)) {
+    priv->iq_matrix_is_default = FALSE;
+    status = pack_quantization_table (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
+  } else if (!priv->iq_matrix_is_default) {
+    gst_jpeg_get_default_quantization_tables (&priv->quant_tables);
+    status = pack_quantization_table (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
+    priv->iq_matrix_is_default = TRUE;
+  }
+
+  picture->iq_matrix = gst_vaapi_iq_matrix_new (GST_VAAPI_DECODER (decoder),
+      &priv->iq_matrix, sizeof (priv->iq_matrix));
+  if (!picture->iq_matrix) {
+    GST_ERROR ("failed to allocate quantiser table");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
 static gboolean
 huffman_tables_updated (const GstJpegHuffmanTables * huf_tables)
 {
@@ -405,10 +517,9 @@ huffman_tables_reset (GstJpegHuffmanTables * huf_tables)
 }
 
 static void
-fill_huffman_table (GstVaapiHuffmanTable * huf_table,
+fill_huffman_table (VAHuffmanTableBufferJPEGBaseline * huffman_table,
     const GstJpegHuffmanTables * huf_tables)
 {
-  VAHuffmanTableBufferJPEGBaseline *const huffman_table = huf_table->param;
   guint i, num_tables;
 
   num_tables = MIN (G_N_ELEMENTS (huffman_table->huffman_table),
@@ -565,6 +676,7 @@ decode_scan (GstVaapiDecoderJpeg * decoder, GstJpegSegment * seg)
   GstJpegScanHdr scan_hdr;
   guint scan_hdr_size, scan_data_size;
   guint i, h_max, v_max, mcu_width, mcu_height;
+  gboolean upload_huf_table = FALSE;
 
   if (!VALID_STATE (decoder, GOT_SOF))
     return GST_VAAPI_DECODER_STATUS_SUCCESS;
@@ -586,19 +698,30 @@ decode_scan (GstVaapiDecoderJpeg * decoder, GstJpegSegment * seg)
   }
   gst_vaapi_picture_add_slice (picture, slice);
 
-  if (!VALID_STATE (decoder, GOT_HUF_TABLE))
-    gst_jpeg_get_default_huffman_tables (&priv->huf_tables);
+  // Update VA Huffman table if it changed for this scan. The default
+  // tables are only packed once, but still submitted with every scan
+  if (!VALID_STATE (decoder, GOT_HUF_TABLE)) {
+    if (!priv->huf_table_is_default) {
+      gst_jpeg_get_default_huffman_tables (&priv->huf_tables);
+      fill_huffman_table (&priv->huf_table, &priv->huf_tables);
+      huffman_tables_reset (&priv->huf_tables);
+      priv->huf_table_is_default = TRUE;
+    }
+    upload_huf_table = TRUE;
+  } else if (huffman_tables_updated (&priv->huf_tables)) {
+    fill_huffman_table (&priv->huf_table, &priv->huf_tables);
+    huffman_tables_reset (&priv->huf_tables);
+    priv->huf_table_is_default = FALSE;
+    upload_huf_table = TRUE;
+  }
 
-  // Update VA Huffman table if it changed for this scan
-  if (huffman_tables_updated (&priv->huf_tables)) {
-    slice->huf_table = GST_VAAPI_HUFFMAN_TABLE_NEW (JPEGBaseline, decoder);
+  if (upload_huf_table) {
+    slice->huf_table = gst_vaapi_huffman_table_new (GST_VAAPI_DECODER
+        (decoder), (guint8 *) & priv->huf_table, sizeof (priv->huf_table));
     if (!slice->huf_table) {
       GST_ERROR ("failed to allocate Huffman tables");
-      huffman_tables_reset (&priv->huf_tables);
       return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
     }
-    fill_huffman_table (slice->huf_table, &priv->huf_tables);
-    huffman_tables_reset (&priv->huf_tables);
   }
 
   slice_param = slice->param;
@@ -884,6 +1007,7 @@ gst_vaapi_decoder_jpeg_start_frame (GstVaapiDecoder * base_decoder,
     GST_ERROR ("failed to reset context");
     return status;
   }
+  select_next_context (decoder);
 
   picture = GST_VAAPI_PICTURE_NEW (JPEGBaseline, decoder);
   if (!picture) {
@@ -943,6 +1067,7 @@ gst_vaapi_decoder_jpeg_init (GstVaapiDecoderJpeg * decoder)
 {
   GstVaapiDecoder *const base_decoder = GST_VAAPI_DECODER (decoder);
 
+  decoder->priv.num_contexts = 1;
   gst_vaapi_decoder_jpeg_create (base_decoder);
 }
 
@@ -962,3 +1087,41 @@ gst_vaapi_decoder_jpeg_new (GstVaapiDisplay * display, GstCaps * caps)
   return g_object_new (GST_TYPE_VAAPI_DECODER_JPEG, "display", display,
       "caps", caps, NULL);
 }
+
+/**
+ * gst_vaapi_decoder_jpeg_set_num_contexts:
+ * @decoder: a #GstVaapiDecoderJpeg
+ * @num_contexts: the number of VA contexts to decode with
+ *
+ * Spreads consecutive pictures over @num_contexts VA contexts, in
+ * turn, so that the hardware can decode several of them at once, as
+ * JPEG pictures do not depend on each other. The pictures are still
+ * output in decode order. The default of 1 decodes all pictures with
+ * the same context.
+ *
+ * This takes effect the next time the decoder (re)creates its VA
+ * context, i.e. it should be set before decoding starts.
+ **/
+void
+gst_vaapi_decoder_jpeg_set_num_contexts (GstVaapiDecoderJpeg * decoder,
+    guint num_contexts)
+{
+  g_return_if_fail (decoder != NULL);
+
+  decoder->priv.num_contexts = CLAMP (num_contexts, 1, MAX_CONTEXTS);
+}
+
+/**
+ * gst_vaapi_decoder_jpeg_get_num_contexts:
+ * @decoder: a #GstVaapiDecoderJpeg
+ *
+ * Returns: the number of VA contexts pictures are spread over, as set
+ *   with gst_vaapi_decoder_jpeg_set_num_contexts()
+ **/
+guint
+gst_vaapi_decoder_jpeg_get_num_contexts (GstVaapiDecoderJpeg * decoder)
+{
+  g_return_val_if_fail (decoder != NULL, 1);
+
+  return decoder->priv.num_contexts;
+}
@@ -30,7 +30,7 @@ G_BEGIN_DECLS
 
 #define GST_TYPE_VAAPI_DECODER_JPEG \
     (gst_vaapi_decoder_jpeg_get_type ())
-#define GST_VAAPI_DECODER_JPEG(decoder) \
+#define GST_VAAPI_DECODER_JPEG(obj) \
     (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_VAAPI_DECODER_JPEG, GstVaapiDecoderJpeg))
 #define GST_VAAPI_IS_DECODER_JPEG(obj) \
     (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_VAAPI_DECODER_JPEG))
@@ -43,6 +43,13 @@ gst_vaapi_decoder_jpeg_get_type (void) G_GNUC_CONST;
 GstVaapiDecoder *
 gst_vaapi_decoder_jpeg_new (GstVaapiDisplay *display, GstCaps *caps);
 
+void
+gst_vaapi_decoder_jpeg_set_num_contexts (GstVaapiDecoderJpeg * decoder,
+    guint num_contexts);
+
+guint
+gst_vaapi_decoder_jpeg_get_num_contexts (GstVaapiDecoderJpeg * decoder);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiDecoderJpeg, gst_object_unref)
 
 G_END_DECLS
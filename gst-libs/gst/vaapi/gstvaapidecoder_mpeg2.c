@@ -33,6 +33,7 @@
 #include "gstvaapidecoder_dpb.h"
 #include "gstvaapidecoder_priv.h"
 #include "gstvaapidisplay_priv.h"
+#include "gstvaapiutils_h26x_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -177,9 +178,10 @@ struct _GstVaapiParserInfoMpeg2
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_parser_info_mpeg2_class (void)
 {
+  static GstVaapiMiniObjectCache GstVaapiParserInfoMpeg2Cache;
   static const GstVaapiMiniObjectClass GstVaapiParserInfoMpeg2Class = {
-    sizeof (GstVaapiParserInfoMpeg2),
-    NULL
+    .size = sizeof (GstVaapiParserInfoMpeg2),
+    .cache = &GstVaapiParserInfoMpeg2Cache
   };
   return &GstVaapiParserInfoMpeg2Class;
 }
@@ -262,6 +264,16 @@ struct _GstVaapiDecoderMpeg2Private
   GstVaapiPicture *current_picture;
   GstVaapiDpb *dpb;
   PTSGenerator tsg;
+  /* Slice parameters of the current picture, submitted along with the
+     span of slice_buffer holding their data, [slice_data_start,
+     slice_data_end), as a single VA slice */
+  GArray *slice_params;
+  GstBuffer *slice_buffer;
+  guint slice_data_start;
+  guint slice_data_end;
+  /* IQ matrix last submitted to the VA context */
+  VAIQMatrixBufferMPEG2 last_iq_matrix;
+  guint has_last_iq_matrix:1;
   guint is_opened:1;
   guint size_changed:1;
   guint profile_changed:1;
@@ -297,12 +309,25 @@ struct _GstVaapiDecoderMpeg2Class
 G_DEFINE_TYPE (GstVaapiDecoderMpeg2, gst_vaapi_decoder_mpeg2,
     GST_TYPE_VAAPI_DECODER);
 
+static void
+clear_slices (GstVaapiDecoderMpeg2 * decoder)
+{
+  GstVaapiDecoderMpeg2Private *const priv = &decoder->priv;
+
+  if (priv->slice_params)
+    g_array_set_size (priv->slice_params, 0);
+  gst_buffer_replace (&priv->slice_buffer, NULL);
+}
+
 static void
 gst_vaapi_decoder_mpeg2_close (GstVaapiDecoderMpeg2 * decoder)
 {
   GstVaapiDecoderMpeg2Private *const priv = &decoder->priv;
 
   gst_vaapi_picture_replace (&priv->current_picture, NULL);
+  clear_slices (decoder);
+  g_clear_pointer (&priv->slice_params, g_array_unref);
+  priv->has_last_iq_matrix = FALSE;
 
   gst_vaapi_parser_info_mpeg2_replace (&priv->seq_hdr, NULL);
   gst_vaapi_parser_info_mpeg2_replace (&priv->seq_ext, NULL);
@@ -333,6 +358,9 @@ gst_vaapi_decoder_mpeg2_open (GstVaapiDecoderMpeg2 * decoder)
   if (!priv->dpb)
     return FALSE;
 
+  priv->slice_params = g_array_new (FALSE, FALSE,
+      sizeof (VASliceParameterBufferMPEG2));
+
   pts_init (&priv->tsg);
   return TRUE;
 }
@@ -473,6 +501,7 @@ ensure_context (GstVaapiDecoderMpeg2 * decoder)
         &info);
     if (!reset_context)
       return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+    priv->has_last_iq_matrix = FALSE;
   }
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
@@ -482,7 +511,8 @@ ensure_quant_matrix (GstVaapiDecoderMpeg2 * decoder, GstVaapiPicture * picture)
 {
   GstVaapiDecoderMpeg2Private *const priv = &decoder->priv;
   GstMpegVideoSequenceHdr *const seq_hdr = &priv->seq_hdr->data.seq_hdr;
-  VAIQMatrixBufferMPEG2 *iq_matrix;
+  VAIQMatrixBufferMPEG2 iq_matrix_buf = { 0, };
+  VAIQMatrixBufferMPEG2 *const iq_matrix = &iq_matrix_buf;
   guint8 *intra_quant_matrix = NULL;
   guint8 *non_intra_quant_matrix = NULL;
   guint8 *chroma_intra_quant_matrix = NULL;
@@ -493,13 +523,6 @@ ensure_quant_matrix (GstVaapiDecoderMpeg2 * decoder, GstVaapiPicture * picture)
 
   priv->quant_matrix_changed = FALSE;
 
-  picture->iq_matrix = GST_VAAPI_IQ_MATRIX_NEW (MPEG2, decoder);
-  if (!picture->iq_matrix) {
-    GST_ERROR ("failed to allocate IQ matrix");
-    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
-  }
-  iq_matrix = picture->iq_matrix->param;
-
   intra_quant_matrix = seq_hdr->intra_quantizer_matrix;
   non_intra_quant_matrix = seq_hdr->non_intra_quantizer_matrix;
 
@@ -537,6 +560,22 @@ ensure_quant_matrix (GstVaapiDecoderMpeg2 * decoder, GstVaapiPicture * picture)
   if (chroma_non_intra_quant_matrix)
     copy_quant_matrix (iq_matrix->chroma_non_intra_quantiser_matrix,
         chroma_non_intra_quant_matrix);
+
+  /* Broadcast streams repeat their sequence header, and thus their
+     quantizer matrices, at every GOP. The driver keeps the last IQ
+     matrix submitted to the context, so only changes are submitted */
+  if (priv->has_last_iq_matrix &&
+      memcmp (iq_matrix, &priv->last_iq_matrix, sizeof (*iq_matrix)) == 0)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  picture->iq_matrix = GST_VAAPI_IQ_MATRIX_NEW (MPEG2, decoder);
+  if (!picture->iq_matrix) {
+    GST_ERROR ("failed to allocate IQ matrix");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+  memcpy (picture->iq_matrix->param, iq_matrix, sizeof (*iq_matrix));
+  priv->last_iq_matrix = *iq_matrix;
+  priv->has_last_iq_matrix = TRUE;
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
@@ -548,6 +587,41 @@ is_valid_state (GstVaapiDecoderMpeg2 * decoder, guint state)
   return (priv->state & state) == state;
 }
 
+/* Submits the slices gathered so far as a single VA slice, with an
+   array of slice parameters */
+static GstVaapiDecoderStatus
+flush_slices (GstVaapiDecoderMpeg2 * decoder)
+{
+  GstVaapiDecoderMpeg2Private *const priv = &decoder->priv;
+  GstVaapiSlice *slice;
+  GstMapInfo map_info;
+
+  if (priv->slice_params->len == 0)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  if (!gst_buffer_map (priv->slice_buffer, &map_info, GST_MAP_READ)) {
+    GST_ERROR ("failed to map buffer");
+    clear_slices (decoder);
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  }
+
+  GST_DEBUG ("%u slices (%u bytes)", priv->slice_params->len,
+      priv->slice_data_end - priv->slice_data_start);
+
+  slice = GST_VAAPI_SLICE_NEW_N_PARAMS (MPEG2, decoder,
+      priv->slice_params->data, priv->slice_params->len,
+      map_info.data + priv->slice_data_start,
+      priv->slice_data_end - priv->slice_data_start);
+  gst_buffer_unmap (priv->slice_buffer, &map_info);
+  clear_slices (decoder);
+  if (!slice) {
+    GST_ERROR ("failed to allocate slice");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+  gst_vaapi_picture_add_slice (priv->current_picture, slice);
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
 static GstVaapiDecoderStatus
 decode_current_picture (GstVaapiDecoderMpeg2 * decoder)
 {
@@ -558,9 +632,13 @@ decode_current_picture (GstVaapiDecoderMpeg2 * decoder)
     goto drop_frame;
   priv->state &= GST_MPEG_VIDEO_STATE_VALID_SEQ_HEADERS;
 
-  if (!picture)
+  if (!picture) {
+    clear_slices (decoder);
     return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  }
 
+  if (flush_slices (decoder) != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    goto error;
   if (!gst_vaapi_picture_decode (picture))
     goto error;
   if (GST_VAAPI_PICTURE_IS_COMPLETE (picture)) {
@@ -580,6 +658,7 @@ error:
 
 drop_frame:
   {
+    clear_slices (decoder);
     priv->state &= GST_MPEG_VIDEO_STATE_VALID_SEQ_HEADERS;
     return (GstVaapiDecoderStatus) GST_VAAPI_DECODER_STATUS_DROP_FRAME;
   }
@@ -1160,40 +1239,41 @@ static GstVaapiDecoderStatus
 decode_slice (GstVaapiDecoderMpeg2 * decoder, GstVaapiDecoderUnit * unit)
 {
   GstVaapiDecoderMpeg2Private *const priv = &decoder->priv;
-  GstVaapiPicture *const picture = priv->current_picture;
-  GstVaapiSlice *slice;
-  VASliceParameterBufferMPEG2 *slice_param;
+  VASliceParameterBufferMPEG2 slice_param = { 0, };
   GstMpegVideoSliceHdr *const slice_hdr = unit->parsed_info;
   GstBuffer *const buffer =
       GST_VAAPI_DECODER_CODEC_FRAME (decoder)->input_buffer;
-  GstMapInfo map_info;
+  GstVaapiDecoderStatus status;
 
   if (!is_valid_state (decoder, GST_MPEG_VIDEO_STATE_VALID_PIC_HEADERS))
     return GST_VAAPI_DECODER_STATUS_SUCCESS;
 
-  if (!gst_buffer_map (buffer, &map_info, GST_MAP_READ)) {
-    GST_ERROR ("failed to map buffer");
-    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  /* There is one slice per macroblock row at least, so slices are
+     gathered as long as they follow each other in the same buffer */
+  if (priv->slice_params->len > 0 && (buffer != priv->slice_buffer ||
+          unit->offset < priv->slice_data_end)) {
+    status = flush_slices (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
+  }
+  if (priv->slice_params->len == 0) {
+    gst_buffer_replace (&priv->slice_buffer, buffer);
+    priv->slice_data_start = unit->offset;
   }
 
   GST_DEBUG ("slice %d (%u bytes)", slice_hdr->mb_row, unit->size);
 
-  slice = GST_VAAPI_SLICE_NEW (MPEG2, decoder,
-      (map_info.data + unit->offset), unit->size);
-  gst_buffer_unmap (buffer, &map_info);
-  if (!slice) {
-    GST_ERROR ("failed to allocate slice");
-    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
-  }
-  gst_vaapi_picture_add_slice (picture, slice);
-
   /* Fill in VASliceParameterBufferMPEG2 */
-  slice_param = slice->param;
-  slice_param->macroblock_offset = slice_hdr->header_size + 32;
-  slice_param->slice_horizontal_position = slice_hdr->mb_column;
-  slice_param->slice_vertical_position = slice_hdr->mb_row;
-  slice_param->quantiser_scale_code = slice_hdr->quantiser_scale_code;
-  slice_param->intra_slice_flag = slice_hdr->intra_slice;
+  slice_param.slice_data_size = unit->size;
+  slice_param.slice_data_offset = unit->offset - priv->slice_data_start;
+  slice_param.slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+  slice_param.macroblock_offset = slice_hdr->header_size + 32;
+  slice_param.slice_horizontal_position = slice_hdr->mb_column;
+  slice_param.slice_vertical_position = slice_hdr->mb_row;
+  slice_param.quantiser_scale_code = slice_hdr->quantiser_scale_code;
+  slice_param.intra_slice_flag = slice_hdr->intra_slice;
+  g_array_append_val (priv->slice_params, slice_param);
+  priv->slice_data_end = unit->offset + unit->size;
 
   priv->state |= GST_MPEG_VIDEO_STATE_GOT_SLICE;
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
@@ -1203,25 +1283,11 @@ static inline gint
 scan_for_start_code (const guchar * buf, guint buf_size,
     GstMpegVideoPacketTypeCode * type_ptr)
 {
-  guint i = 0;
+  const gint ofs = gst_vaapi_utils_find_start_code (buf, buf_size);
 
-  while (i <= (buf_size - 4)) {
-    if (buf[i + 2] > 1)
-      i += 3;
-    else if (buf[i + 1])
-      i += 2;
-    else if (buf[i] || buf[i + 2] != 1)
-      i++;
-    else
-      break;
-  }
-
-  if (i <= (buf_size - 4)) {
-    if (type_ptr)
-      *type_ptr = buf[i + 3];
-    return i;
-  }
-  return -1;
+  if (ofs >= 0 && type_ptr)
+    *type_ptr = buf[ofs + 3];
+  return ofs;
 }
 
 static GstVaapiDecoderStatus
@@ -65,6 +65,11 @@ struct _GstVaapiDecoderMpeg4Private
   GstVaapiPicture *next_picture;
   // backward reference pic
   GstVaapiPicture *prev_picture;
+  /* slice parameters of the current picture, submitted at once, their
+     data lying in the slice_data_size bytes at slice_data */
+  GArray *slice_params;
+  const guint8 *slice_data;
+  guint slice_data_size;
   GstClockTime seq_pts;
   GstClockTime gop_pts;
   GstClockTime pts_diff;
@@ -128,6 +133,8 @@ gst_vaapi_decoder_mpeg4_close (GstVaapiDecoderMpeg4 * decoder)
   gst_vaapi_picture_replace (&priv->curr_picture, NULL);
   gst_vaapi_picture_replace (&priv->next_picture, NULL);
   gst_vaapi_picture_replace (&priv->prev_picture, NULL);
+  g_clear_pointer (&priv->slice_params, g_array_unref);
+  priv->slice_data = NULL;
 }
 
 static gboolean
@@ -800,8 +807,8 @@ decode_slice (GstVaapiDecoderMpeg4 * decoder,
 {
   GstVaapiDecoderMpeg4Private *const priv = &decoder->priv;
   GstVaapiPicture *const picture = priv->curr_picture;
-  GstVaapiSlice *slice;
-  VASliceParameterBufferMPEG4 *slice_param;
+  VASliceParameterBufferMPEG4 slice_param_buf = { 0, };
+  VASliceParameterBufferMPEG4 *const slice_param = &slice_param_buf;
 
   GST_DEBUG ("decoder silce: %p, %u bytes)", buf, buf_size);
 
@@ -809,15 +816,23 @@ decode_slice (GstVaapiDecoderMpeg4 * decoder,
   if (!has_packet_header && !fill_picture (decoder, picture))
     return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
 
-  slice = GST_VAAPI_SLICE_NEW (MPEG4, decoder, buf, buf_size);
-  if (!slice) {
-    GST_DEBUG ("failed to allocate slice");
-    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  /* The video packets of a VOP follow each other in the same buffer,
+     they are submitted as a single slice by flush_slices() */
+  if (!priv->slice_params)
+    priv->slice_params = g_array_new (FALSE, FALSE,
+        sizeof (VASliceParameterBufferMPEG4));
+  if (!has_packet_header) {
+    g_array_set_size (priv->slice_params, 0);
+    priv->slice_data = buf;
+  } else if (!priv->slice_data || buf < priv->slice_data) {
+    GST_ERROR ("video packet out of its VOP");
+    return GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
   }
-  gst_vaapi_picture_add_slice (picture, slice);
 
   /* Fill in VASliceParameterBufferMPEG4 */
-  slice_param = slice->param;
+  slice_param->slice_data_size = buf_size;
+  slice_param->slice_data_offset = buf - priv->slice_data;
+  slice_param->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
   if (priv->is_svh) {
     slice_param->macroblock_offset = (priv->svh_hdr.size) % 8;
     slice_param->macroblock_number = 0;
@@ -834,6 +849,33 @@ decode_slice (GstVaapiDecoderMpeg4 * decoder,
       slice_param->quant_scale = priv->vop_hdr.quant;
     }
   }
+  g_array_append_val (priv->slice_params, slice_param_buf);
+  priv->slice_data_size = buf + buf_size - priv->slice_data;
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+/* Submits the slices gathered by decode_slice() as a single slice,
+   with an array of slice parameters. This must be called before the
+   data they point to is released */
+static GstVaapiDecoderStatus
+flush_slices (GstVaapiDecoderMpeg4 * decoder)
+{
+  GstVaapiDecoderMpeg4Private *const priv = &decoder->priv;
+  GstVaapiSlice *slice;
+
+  if (!priv->slice_params || priv->slice_params->len == 0)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  slice = GST_VAAPI_SLICE_NEW_N_PARAMS (MPEG4, decoder,
+      priv->slice_params->data, priv->slice_params->len, priv->slice_data,
+      priv->slice_data_size);
+  g_array_set_size (priv->slice_params, 0);
+  priv->slice_data = NULL;
+  if (!slice) {
+    GST_DEBUG ("failed to allocate slice");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+  gst_vaapi_picture_add_slice (priv->curr_picture, slice);
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
@@ -933,6 +975,9 @@ decode_packet (GstVaapiDecoderMpeg4 * decoder, GstMpeg4Packet packet)
         _data_size -= video_packet.size;
       }
     }
+    status = flush_slices (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
     status = decode_current_picture (decoder);
   } else if (tos->type == GST_MPEG4_USER_DATA
       || tos->type == GST_MPEG4_VIDEO_SESSION_ERR
@@ -976,6 +1021,9 @@ decode_buffer (GstVaapiDecoderMpeg4 * decoder, const guchar * buf,
     status = decode_slice (decoder, buf + ofs, buf_size - ofs, FALSE);
     if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
       return status;
+    status = flush_slices (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
   } else {
     packet.data = buf;
     packet.offset = 0;
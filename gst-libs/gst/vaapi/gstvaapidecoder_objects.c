@@ -26,9 +26,12 @@
 #include <gst/vaapi/gstvaapicontext.h>
 #include "gstvaapidecoder_objects.h"
 #include "gstvaapidecoder_priv.h"
+#include "gstvaapidisplay_priv.h"
 #include "gstvaapisurfaceproxy_priv.h"
 #include "gstvaapicompat.h"
+#include "gstvaapitrace.h"
 #include "gstvaapiutils.h"
+#include "gstvaapivarecord.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -76,6 +79,7 @@ gst_vaapi_picture_destroy (GstVaapiPicture * picture)
     gst_vaapi_surface_proxy_unref (picture->proxy);
     picture->proxy = NULL;
   }
+  gst_vaapi_surface_proxy_replace (&picture->proc_proxy, NULL);
   picture->surface_id = VA_INVALID_ID;
   picture->surface = NULL;
 
@@ -86,6 +90,28 @@ gst_vaapi_picture_destroy (GstVaapiPicture * picture)
   gst_vaapi_picture_replace (&picture->parent_picture, NULL);
 }
 
+/* Crops pictures decoded into surfaces kept from a larger stream */
+static void
+init_crop_rect (GstVaapiPicture * picture)
+{
+  GstVaapiDecoder *const decoder = GET_DECODER (picture);
+  GstVaapiRectangle *const crop_rect = &picture->crop_rect;
+
+  if (!decoder->rendition_switch)
+    return;
+  if (GST_VAAPI_SURFACE_WIDTH (picture->surface) <=
+      GST_VAAPI_DECODER_WIDTH (decoder) &&
+      GST_VAAPI_SURFACE_HEIGHT (picture->surface) <=
+      GST_VAAPI_DECODER_HEIGHT (decoder))
+    return;
+
+  crop_rect->x = 0;
+  crop_rect->y = 0;
+  crop_rect->width = GST_VAAPI_DECODER_WIDTH (decoder);
+  crop_rect->height = GST_VAAPI_DECODER_HEIGHT (decoder);
+  picture->has_crop_rect = TRUE;
+}
+
 gboolean
 gst_vaapi_picture_create (GstVaapiPicture * picture,
     const GstVaapiCodecObjectConstructorArgs * args)
@@ -99,6 +125,11 @@ gst_vaapi_picture_create (GstVaapiPicture * picture,
 
     picture->parent_picture = gst_vaapi_picture_ref (parent_picture);
 
+    /* Fields and views of a frame are decoded into the same surface,
+       hence on the same VA context */
+    picture->va_context = parent_picture->va_context;
+    GET_VA_CONTEXT (picture) = picture->va_context;
+
     picture->proxy = gst_vaapi_surface_proxy_ref (parent_picture->proxy);
     picture->type = parent_picture->type;
     picture->pts = parent_picture->pts;
@@ -143,6 +174,8 @@ gst_vaapi_picture_create (GstVaapiPicture * picture,
   } else {
     picture->type = GST_VAAPI_PICTURE_TYPE_NONE;
     picture->pts = GST_CLOCK_TIME_NONE;
+    picture->va_context =
+        gst_vaapi_decoder_select_va_context (GET_DECODER (picture));
 
     picture->proxy =
         gst_vaapi_context_get_surface_proxy (GET_CONTEXT (picture));
@@ -154,10 +187,12 @@ gst_vaapi_picture_create (GstVaapiPicture * picture,
   }
   picture->surface = GST_VAAPI_SURFACE_PROXY_SURFACE (picture->proxy);
   picture->surface_id = GST_VAAPI_SURFACE_PROXY_SURFACE_ID (picture->proxy);
+  if (!(args->flags & GST_VAAPI_CREATE_PICTURE_FLAG_CLONE))
+    init_crop_rect (picture);
 
-  success = vaapi_create_buffer (GET_VA_DISPLAY (picture),
-      GET_VA_CONTEXT (picture), VAPictureParameterBufferType,
-      args->param_size, args->param, &picture->param_id, &picture->param);
+  success = gst_vaapi_decoder_create_buffer (GET_DECODER (picture),
+      VAPictureParameterBufferType, args->param_size, args->param,
+      &picture->param_id, &picture->param);
   if (!success)
     return FALSE;
   picture->param_size = args->param_size;
@@ -225,100 +260,528 @@ gst_vaapi_picture_add_slice (GstVaapiPicture * picture, GstVaapiSlice * slice)
   g_ptr_array_add (picture->slices, slice);
 }
 
+/* Accounts a slice of @size bytes, coded at @qp (or -1 if unknown), in
+   the coding hints attached to the output of @picture */
+void
+gst_vaapi_picture_add_slice_stats (GstVaapiPicture * picture, guint size,
+    gint qp, gboolean is_intra)
+{
+  g_return_if_fail (GST_VAAPI_IS_PICTURE (picture));
+
+  picture->coded_size += size;
+  if (qp >= 0) {
+    picture->qp_sum += qp;
+    picture->num_qp_slices++;
+  }
+  if (!is_intra)
+    picture->has_inter_slices = TRUE;
+}
+
+/* Fills in the source coding statistics of @picture, including those
+   of its first field, if any */
+static gboolean
+get_coding_hints (GstVaapiPicture * picture, GstVaapiCodingHints * hints)
+{
+  GstVaapiPicture *const parent = picture->parent_picture;
+  guint qp_sum = picture->qp_sum, num_qp_slices = picture->num_qp_slices;
+
+  hints->coded_size = picture->coded_size;
+  hints->is_intra = !picture->has_inter_slices;
+  if (parent && parent->frame == picture->frame) {
+    hints->coded_size += parent->coded_size;
+    hints->is_intra &= !parent->has_inter_slices;
+    qp_sum += parent->qp_sum;
+    num_qp_slices += parent->num_qp_slices;
+  }
+  if (hints->coded_size == 0)
+    return FALSE;
+
+  hints->has_qp = num_qp_slices > 0;
+  hints->qp = hints->has_qp ?
+      (qp_sum + num_qp_slices / 2) / num_qp_slices : 0;
+  return TRUE;
+}
+
 static gboolean
-do_decode (VADisplay dpy, VAContextID ctx, VABufferID * buf_id, void **buf_ptr)
+do_render (VADisplay dpy, VAContextID ctx, VABufferID * buf_id, void **buf_ptr)
 {
   VAStatus status;
+  GstClockTime record_start;
 
-  vaapi_unmap_buffer (dpy, *buf_id, buf_ptr);
+  /* Persistent tables are only mapped until their first submission */
+  if (*buf_ptr)
+    vaapi_unmap_buffer (dpy, *buf_id, buf_ptr);
 
+  record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (dpy, buf_id, 1);
   status = vaRenderPicture (dpy, ctx, buf_id, 1);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, dpy,
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, buf_id, 1, ctx);
   if (!vaapi_check_status (status, "vaRenderPicture()"))
     return FALSE;
+  return TRUE;
+}
 
-  /* XXX: vaRenderPicture() is meant to destroy the VA buffer implicitly */
-  vaapi_destroy_buffer (dpy, buf_id);
+/* Submit each slice with its own vaRenderPicture() call */
+static gboolean
+do_render_slices (GstVaapiPicture * picture)
+{
+  VADisplay const va_display = GET_VA_DISPLAY (picture);
+  VAContextID const va_context = picture->va_context;
+  GstVaapiHuffmanTable *huf_table;
+  VAStatus status;
+  GstClockTime record_start;
+  guint i;
+
+  for (i = 0; i < picture->slices->len; i++) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+    VABufferID va_buffers[2];
+
+    huf_table = slice->huf_table;
+    if (huf_table) {
+      if (!do_render (va_display, va_context, &huf_table->param_id,
+              (void **) &huf_table->param))
+        return FALSE;
+      gst_vaapi_decoder_release_buffer (GET_DECODER (picture), va_context,
+          VAHuffmanTableBufferType, huf_table->param_size,
+          &huf_table->param_id);
+    }
+
+    va_buffers[0] = slice->param_id;
+    va_buffers[1] = slice->data_id;
+
+    record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (va_display, va_buffers,
+        2);
+    status = vaRenderPicture (va_display, va_context, va_buffers, 2);
+    GST_VAAPI_VA_RECORD_END_IDS (record_start, va_display,
+        GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, va_buffers, 2, va_context);
+    if (!vaapi_check_status (status, "vaRenderPicture()"))
+      return FALSE;
+  }
   return TRUE;
 }
 
-gboolean
-gst_vaapi_picture_decode (GstVaapiPicture * picture)
+/* Check whether all slices can be submitted at once, i.e. there is
+   no per-slice Huffman table to interleave with the slice buffers */
+static gboolean
+can_render_slices_batched (GstVaapiPicture * picture)
+{
+  guint i;
+
+  if (picture->slices->len < 2)
+    return FALSE;
+
+  for (i = 0; i < picture->slices->len; i++) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+    if (slice->huf_table)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Submit all slice parameter and data buffers with a single
+   vaRenderPicture() call */
+static gboolean
+do_render_slices_batched (GstVaapiPicture * picture)
+{
+  VABufferID *va_buffers, va_buffers_static[64];
+  guint i, num_buffers;
+  VAStatus status;
+  GstClockTime record_start;
+
+  num_buffers = picture->slices->len * 2;
+  if (num_buffers <= G_N_ELEMENTS (va_buffers_static))
+    va_buffers = va_buffers_static;
+  else
+    va_buffers = g_new (VABufferID, num_buffers);
+
+  for (i = 0; i < picture->slices->len; i++) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+
+    va_buffers[2 * i + 0] = slice->param_id;
+    va_buffers[2 * i + 1] = slice->data_id;
+  }
+
+  record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (GET_VA_DISPLAY (picture),
+      va_buffers, num_buffers);
+  status = vaRenderPicture (GET_VA_DISPLAY (picture),
+      picture->va_context, va_buffers, num_buffers);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, GET_VA_DISPLAY (picture),
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, va_buffers, num_buffers,
+      picture->va_context);
+
+  if (va_buffers != va_buffers_static)
+    g_free (va_buffers);
+  return status == VA_STATUS_SUCCESS;
+}
+
+/* Creates a VA buffer for @picture, reusing one from the decoder pool
+   if the picture targets the VA context the pool currently serves */
+static gboolean
+create_picture_buffer (GstVaapiPicture * picture, guint type, guint size,
+    guint num_elements, gconstpointer data, VABufferID * buf_id_ptr,
+    gpointer * mapped_data)
+{
+  GstVaapiDecoder *const decoder = GET_DECODER (picture);
+
+  if (picture->va_context == decoder->va_context)
+    return gst_vaapi_decoder_create_n_elements_buffer (decoder, type, size,
+        num_elements, data, buf_id_ptr, mapped_data);
+  return vaapi_create_n_elements_buffer (decoder->va_display,
+      picture->va_context, type, size, data, buf_id_ptr, mapped_data,
+      num_elements);
+}
+
+/* Creates the VA buffers of a slice made from a #GstBuffer, so that it
+   can be submitted as any other slice. The parameters are left mapped */
+static gboolean
+realize_slice (GstVaapiPicture * picture, GstVaapiSlice * slice)
+{
+  GstMapInfo map_info;
+  gpointer param;
+  gboolean success;
+
+  if (!slice->buffer)
+    return TRUE;
+
+  if (!gst_buffer_map (slice->buffer, &map_info, GST_MAP_READ))
+    return FALSE;
+  success = vaapi_create_buffer (GET_VA_DISPLAY (picture),
+      picture->va_context, VASliceDataBufferType, slice->data_size,
+      map_info.data + slice->data_offset, &slice->data_id, NULL);
+  gst_buffer_unmap (slice->buffer, &map_info);
+  if (!success)
+    return FALSE;
+
+  if (!create_picture_buffer (picture, VASliceParameterBufferType,
+          slice->param_size, 1, slice->param, &slice->param_id, &param))
+    return FALSE;
+
+  g_free (slice->param);
+  slice->param = param;
+  gst_buffer_replace (&slice->buffer, NULL);
+  return TRUE;
+}
+
+/* Check whether all slices are made from the same #GstBuffer, i.e.
+   whether they can be submitted as a single slice parameter array
+   along with a single slice data buffer */
+static gboolean
+can_render_slices_coalesced (GstVaapiPicture * picture)
+{
+  GstVaapiSlice *first_slice;
+  guint i;
+
+  if (picture->slices->len == 0)
+    return FALSE;
+
+  first_slice = g_ptr_array_index (picture->slices, 0);
+  for (i = 0; i < picture->slices->len; i++) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+    if (!slice->buffer || slice->buffer != first_slice->buffer)
+      return FALSE;
+    if (slice->param_size != first_slice->param_size || slice->huf_table)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Submit all slices with a single vaRenderPicture() call, through one
+   slice parameter array and one slice data buffer spanning the slice
+   data in the #GstBuffer, filled in from a single mapping. The VA
+   buffers are returned in @param_id and @data_id, to be released once
+   the picture is decoded */
+static gboolean
+do_render_slices_coalesced (GstVaapiPicture * picture,
+    VABufferID * param_id, VABufferID * data_id)
+{
+  VADisplay const va_display = GET_VA_DISPLAY (picture);
+  VAContextID const va_context = picture->va_context;
+  GstVaapiSlice *const first_slice = g_ptr_array_index (picture->slices, 0);
+  const guint param_size = first_slice->param_size;
+  VABufferID va_buffers[2];
+  GstMapInfo map_info;
+  guint i, data_start, data_end;
+  guint8 *params;
+  VAStatus status;
+  GstClockTime record_start;
+  gboolean success;
+
+  data_start = G_MAXUINT;
+  data_end = 0;
+  for (i = 0; i < picture->slices->len; i++) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+
+    data_start = MIN (data_start, slice->data_offset);
+    data_end = MAX (data_end, slice->data_offset + slice->data_size);
+  }
+
+  if (!gst_buffer_map (first_slice->buffer, &map_info, GST_MAP_READ))
+    return FALSE;
+  success = vaapi_create_buffer (va_display, va_context,
+      VASliceDataBufferType, data_end - data_start,
+      map_info.data + data_start, data_id, NULL);
+  gst_buffer_unmap (first_slice->buffer, &map_info);
+  if (!success)
+    return FALSE;
+
+  if (!create_picture_buffer (picture, VASliceParameterBufferType,
+          param_size, picture->slices->len, NULL, param_id,
+          (gpointer *) & params))
+    return FALSE;
+
+  for (i = 0; i < picture->slices->len; i++) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+    VASliceParameterBufferBase *const slice_param =
+        (VASliceParameterBufferBase *) (params + i * param_size);
+
+    memcpy (slice_param, slice->param, param_size);
+    slice_param->slice_data_offset += slice->data_offset - data_start;
+  }
+  vaapi_unmap_buffer (va_display, *param_id, NULL);
+
+  va_buffers[0] = *param_id;
+  va_buffers[1] = *data_id;
+
+  record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (va_display, va_buffers, 2);
+  status = vaRenderPicture (va_display, va_context, va_buffers, 2);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, va_display,
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, va_buffers, 2, va_context);
+  return status == VA_STATUS_SUCCESS;
+}
+
+/* Scales and converts the picture into a surface of the decoder output
+   pool, as part of its decoding. The pipeline parameters point to the
+   @region and @output_id storage, which has to outlive vaEndPicture() */
+static gboolean
+do_render_processing (GstVaapiPicture * picture, VARectangle * region,
+    VASurfaceID * output_id, VABufferID * param_id)
+{
+#if VA_CHECK_VERSION(1,0,0)
+  GstVaapiDecoder *const decoder = GET_DECODER (picture);
+  VADisplay const va_display = GET_VA_DISPLAY (picture);
+  VAContextID const va_context = picture->va_context;
+  VAProcPipelineParameterBuffer *param;
+  GstClockTime record_start;
+  VAStatus status;
+
+  gst_vaapi_surface_proxy_replace (&picture->proc_proxy, NULL);
+  picture->proc_proxy = gst_vaapi_surface_proxy_new_from_pool
+      (GST_VAAPI_SURFACE_POOL (decoder->proc_pool));
+  if (!picture->proc_proxy)
+    return FALSE;
+  *output_id = GST_VAAPI_SURFACE_PROXY_SURFACE_ID (picture->proc_proxy);
+
+  if (!vaapi_create_buffer (va_display, va_context,
+          VAProcPipelineParameterBufferType, sizeof (*param), NULL, param_id,
+          (gpointer *) & param))
+    return FALSE;
+
+  memset (param, 0, sizeof (*param));
+  param->surface = picture->surface_id;
+  if (picture->has_crop_rect) {
+    region->x = picture->crop_rect.x;
+    region->y = picture->crop_rect.y;
+    region->width = picture->crop_rect.width;
+    region->height = picture->crop_rect.height;
+    param->surface_region = region;
+  }
+  param->filter_flags = VA_FILTER_SCALING_DEFAULT;
+  param->additional_outputs = output_id;
+  param->num_additional_outputs = 1;
+  vaapi_unmap_buffer (va_display, *param_id, NULL);
+
+  record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (va_display, param_id, 1);
+  status = vaRenderPicture (va_display, va_context, param_id, 1);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, va_display,
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, param_id, 1, va_context);
+  return status == VA_STATUS_SUCCESS;
+#else
+  return FALSE;
+#endif
+}
+
+static gboolean
+do_picture_decode (GstVaapiPicture * picture)
 {
   GstVaapiIqMatrix *iq_matrix;
   GstVaapiBitPlane *bitplane;
   GstVaapiHuffmanTable *huf_table;
   GstVaapiProbabilityTable *prob_table;
+  GstVaapiDecoder *decoder;
   VADisplay va_display;
   VAContextID va_context;
   VAStatus status;
+  GstClockTime trace_start, record_start;
+  VABufferID slices_param_id, slices_data_id;
+  VABufferID proc_param_id = VA_INVALID_ID;
+  VASurfaceID proc_output_id;
+  VARectangle proc_region;
+  gboolean submitted;
   guint i;
 
-  g_return_val_if_fail (GST_VAAPI_IS_PICTURE (picture), FALSE);
-
+  decoder = GET_DECODER (picture);
   va_display = GET_VA_DISPLAY (picture);
-  va_context = GET_VA_CONTEXT (picture);
+  va_context = picture->va_context;
 
-  GST_DEBUG ("decode picture 0x%08x", picture->surface_id);
+  GST_DEBUG ("decode picture 0x%08x on context 0x%08x", picture->surface_id,
+      va_context);
 
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaBeginPicture (va_display, va_context, picture->surface_id);
+  GST_VAAPI_VA_RECORD_END (record_start, va_display,
+      GST_VAAPI_VA_RECORD_BEGIN_PICTURE, status, va_context,
+      picture->surface_id);
   if (!vaapi_check_status (status, "vaBeginPicture()"))
     return FALSE;
 
-  if (!do_decode (va_display, va_context, &picture->param_id, &picture->param))
+  if (decoder->context)
+    gst_vaapi_context_apply_priority (decoder->context, va_context);
+
+  if (!do_render (va_display, va_context, &picture->param_id, &picture->param))
     return FALSE;
+  gst_vaapi_decoder_release_buffer (decoder, va_context,
+      VAPictureParameterBufferType, picture->param_size, &picture->param_id);
 
+  /* IQ matrices and Huffman tables are consumed at render time too,
+     e.g. JPEG streams keep on submitting the same tables */
   iq_matrix = picture->iq_matrix;
-  if (iq_matrix && !do_decode (va_display, va_context,
-          &iq_matrix->param_id, &iq_matrix->param))
-    return FALSE;
+  if (iq_matrix) {
+    if (!do_render (va_display, va_context, &iq_matrix->param_id,
+            &iq_matrix->param))
+      return FALSE;
+    if (!GST_VAAPI_MINI_OBJECT_FLAG_IS_SET (iq_matrix,
+            GST_VAAPI_CODEC_OBJECT_FLAG_PERSISTENT))
+      gst_vaapi_decoder_release_buffer (decoder, va_context,
+          VAIQMatrixBufferType, iq_matrix->param_size, &iq_matrix->param_id);
+  }
 
+  /* Bitplanes are recycled once the picture is submitted, along with
+     the slice parameters */
   bitplane = picture->bitplane;
-  if (bitplane && !do_decode (va_display, va_context,
+  if (bitplane && !do_render (va_display, va_context,
           &bitplane->data_id, (void **) &bitplane->data))
     return FALSE;
 
   huf_table = picture->huf_table;
-  if (huf_table && !do_decode (va_display, va_context,
-          &huf_table->param_id, (void **) &huf_table->param))
-    return FALSE;
+  if (huf_table) {
+    if (!do_render (va_display, va_context, &huf_table->param_id,
+            (void **) &huf_table->param))
+      return FALSE;
+    gst_vaapi_decoder_release_buffer (decoder, va_context,
+        VAHuffmanTableBufferType, huf_table->param_size, &huf_table->param_id);
+  }
 
   prob_table = picture->prob_table;
-  if (prob_table && !do_decode (va_display, va_context,
-          &prob_table->param_id, (void **) &prob_table->param))
-    return FALSE;
-
-  for (i = 0; i < picture->slices->len; i++) {
-    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
-    VABufferID va_buffers[2];
-
-    huf_table = slice->huf_table;
-    if (huf_table && !do_decode (va_display, va_context,
-            &huf_table->param_id, (void **) &huf_table->param))
+  if (prob_table) {
+    if (!do_render (va_display, va_context, &prob_table->param_id,
+            &prob_table->param))
       return FALSE;
+    if (!GST_VAAPI_MINI_OBJECT_FLAG_IS_SET (prob_table,
+            GST_VAAPI_CODEC_OBJECT_FLAG_PERSISTENT))
+      vaapi_destroy_buffer (va_display, &prob_table->param_id);
+  }
 
-    vaapi_unmap_buffer (va_display, slice->param_id, NULL);
-    va_buffers[0] = slice->param_id;
-    va_buffers[1] = slice->data_id;
+  /* Drivers rejecting multi-slice submissions fall back to per-slice
+     VA buffers and vaRenderPicture() calls for the lifetime of the
+     decoder */
+  slices_param_id = VA_INVALID_ID;
+  slices_data_id = VA_INVALID_ID;
+  submitted = FALSE;
+  if (decoder->batch_slices && can_render_slices_coalesced (picture)) {
+    submitted = do_render_slices_coalesced (picture, &slices_param_id,
+        &slices_data_id);
+    if (!submitted) {
+      GST_WARNING ("coalesced slice submission failed, "
+          "falling back to per-slice submission");
+      vaapi_destroy_buffer (va_display, &slices_param_id);
+      vaapi_destroy_buffer (va_display, &slices_data_id);
+      decoder->batch_slices = FALSE;
+    }
+  }
 
-    status = vaRenderPicture (va_display, va_context, va_buffers, 2);
-    if (!vaapi_check_status (status, "vaRenderPicture()"))
+  if (!submitted) {
+    for (i = 0; i < picture->slices->len; i++) {
+      GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
+      if (!realize_slice (picture, slice))
+        return FALSE;
+      vaapi_unmap_buffer (va_display, slice->param_id, NULL);
+    }
+
+    if (decoder->batch_slices && can_render_slices_batched (picture)) {
+      submitted = do_render_slices_batched (picture);
+      if (!submitted) {
+        GST_WARNING ("batched slice submission failed, "
+            "falling back to per-slice submission");
+        decoder->batch_slices = FALSE;
+      }
+    }
+    if (!submitted && !do_render_slices (picture))
       return FALSE;
   }
 
+  /* Field pictures are only complete once the second one is decoded */
+  if (decoder->proc_pool
+      && picture->structure == GST_VAAPI_PICTURE_STRUCTURE_FRAME
+      && !do_render_processing (picture, &proc_region, &proc_output_id,
+          &proc_param_id)) {
+    GST_WARNING ("decode processing failed, outputting decoded surface");
+    gst_vaapi_surface_proxy_replace (&picture->proc_proxy, NULL);
+  }
+
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaEndPicture (va_display, va_context);
+  GST_VAAPI_VA_RECORD_END (record_start, va_display,
+      GST_VAAPI_VA_RECORD_END_PICTURE, status, va_context);
+  GST_VAAPI_TRACE_END (trace_start, decoder, GST_VAAPI_TRACE_STAGE_DECODE,
+      picture->pts);
+  if (GST_CLOCK_TIME_IS_VALID (trace_start) && status == VA_STATUS_SUCCESS)
+    gst_vaapi_trace_gpu_submit (decoder, picture->surface, picture->pts);
 
   for (i = 0; i < picture->slices->len; i++) {
     GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, i);
 
-    vaapi_destroy_buffer (va_display, &slice->param_id);
+    /* Slice data may still be read by the hardware at this point,
+       so only the slice parameters are recycled */
+    gst_vaapi_decoder_release_n_elements_buffer (decoder, va_context,
+        VASliceParameterBufferType, slice->param_size, slice->param_num,
+        &slice->param_id);
     vaapi_destroy_buffer (va_display, &slice->data_id);
   }
+  if (slices_param_id != VA_INVALID_ID) {
+    GstVaapiSlice *const slice = g_ptr_array_index (picture->slices, 0);
+    gst_vaapi_decoder_release_n_elements_buffer (decoder, va_context,
+        VASliceParameterBufferType, slice->param_size, picture->slices->len,
+        &slices_param_id);
+    vaapi_destroy_buffer (va_display, &slices_data_id);
+  }
+  if (bitplane)
+    gst_vaapi_decoder_release_buffer (decoder, va_context,
+        VABitPlaneBufferType, bitplane->data_size, &bitplane->data_id);
+  vaapi_destroy_buffer (va_display, &proc_param_id);
 
   if (!vaapi_check_status (status, "vaEndPicture()"))
     return FALSE;
   return TRUE;
 }
 
+gboolean
+gst_vaapi_picture_decode (GstVaapiPicture * picture)
+{
+  GstVaapiDecoder *decoder;
+  gboolean scheduled, success;
+
+  g_return_val_if_fail (GST_VAAPI_IS_PICTURE (picture), FALSE);
+
+  decoder = GET_DECODER (picture);
+  scheduled = gst_vaapi_display_job_begin (decoder->display,
+      decoder->job_deadline);
+  success = do_picture_decode (picture);
+  if (scheduled)
+    gst_vaapi_display_job_end (decoder->display);
+  return success;
+}
+
 /* Mark picture as output for internal purposes only. Don't push frame out */
 static void
 do_output_internal (GstVaapiPicture * picture)
@@ -335,6 +798,7 @@ do_output (GstVaapiPicture * picture)
 {
   GstVideoCodecFrame *const out_frame = picture->frame;
   GstVaapiSurfaceProxy *proxy;
+  GstVaapiCodingHints hints;
   guint flags = 0;
 
   if (GST_VAAPI_PICTURE_IS_OUTPUT (picture))
@@ -343,10 +807,14 @@ do_output (GstVaapiPicture * picture)
   if (!picture->proxy)
     return FALSE;
 
-  proxy = gst_vaapi_surface_proxy_ref (picture->proxy);
-
-  if (picture->has_crop_rect)
-    gst_vaapi_surface_proxy_set_crop_rect (proxy, &picture->crop_rect);
+  /* The processed surface already holds the cropped picture */
+  if (picture->proc_proxy)
+    proxy = gst_vaapi_surface_proxy_ref (picture->proc_proxy);
+  else {
+    proxy = gst_vaapi_surface_proxy_ref (picture->proxy);
+    if (picture->has_crop_rect)
+      gst_vaapi_surface_proxy_set_crop_rect (proxy, &picture->crop_rect);
+  }
 
   gst_video_codec_frame_set_user_data (out_frame,
       proxy, (GDestroyNotify) gst_vaapi_mini_object_unref);
@@ -377,6 +845,9 @@ do_output (GstVaapiPicture * picture)
   }
   GST_VAAPI_SURFACE_PROXY_FLAG_SET (proxy, flags);
 
+  gst_vaapi_surface_proxy_set_coding_hints (proxy,
+      get_coding_hints (picture, &hints) ? &hints : NULL);
+
   gst_vaapi_decoder_push_frame (GET_DECODER (picture), out_frame);
   gst_video_codec_frame_clear (&picture->frame);
 
@@ -429,6 +900,13 @@ gst_vaapi_picture_set_crop_rect (GstVaapiPicture * picture,
 
 GST_VAAPI_CODEC_DEFINE_TYPE (GstVaapiSlice, gst_vaapi_slice);
 
+/* Constructor flags */
+enum
+{
+  /* the VA buffers are created at decode time */
+  SLICE_CREATE_DEFERRED = 1 << 0,
+};
+
 void
 gst_vaapi_slice_destroy (GstVaapiSlice * slice)
 {
@@ -436,6 +914,10 @@ gst_vaapi_slice_destroy (GstVaapiSlice * slice)
 
   gst_vaapi_codec_object_replace (&slice->huf_table, NULL);
 
+  if (slice->buffer) {
+    gst_buffer_replace (&slice->buffer, NULL);
+    g_free (slice->param);
+  }
   vaapi_destroy_buffer (va_display, &slice->data_id);
   vaapi_destroy_buffer (va_display, &slice->param_id);
   slice->param = NULL;
@@ -451,17 +933,36 @@ gst_vaapi_slice_create (GstVaapiSlice * slice,
   slice->param_id = VA_INVALID_ID;
   slice->data_id = VA_INVALID_ID;
 
+  if (args->flags & SLICE_CREATE_DEFERRED) {
+    slice->param = g_malloc0 (args->param_size);
+    slice->param_size = args->param_size;
+    slice->param_num = 1;
+    slice->data_size = args->data_size;
+
+    slice_param = slice->param;
+    slice_param->slice_data_size = args->data_size;
+    slice_param->slice_data_offset = 0;
+    slice_param->slice_data_flag = VA_SLICE_DATA_FLAG_ALL;
+    return TRUE;
+  }
+
   success = vaapi_create_buffer (GET_VA_DISPLAY (slice), GET_VA_CONTEXT (slice),
       VASliceDataBufferType, args->data_size, args->data, &slice->data_id,
       NULL);
   if (!success)
     return FALSE;
 
-  success = vaapi_create_buffer (GET_VA_DISPLAY (slice), GET_VA_CONTEXT (slice),
-      VASliceParameterBufferType, args->param_size, args->param,
-      &slice->param_id, &slice->param);
+  success = gst_vaapi_decoder_create_n_elements_buffer (GET_DECODER (slice),
+      VASliceParameterBufferType, args->param_size, args->param_num,
+      args->param, &slice->param_id, &slice->param);
   if (!success)
     return FALSE;
+  slice->param_size = args->param_size;
+  slice->param_num = args->param_num;
+
+  /* Parameters provided by the caller already locate their slice */
+  if (args->param)
+    return TRUE;
 
   slice_param = slice->param;
   slice_param->slice_data_size = args->data_size;
@@ -480,3 +981,48 @@ gst_vaapi_slice_new (GstVaapiDecoder * decoder,
       GST_VAAPI_CODEC_BASE (decoder), param, param_size, data, data_size, 0);
   return GST_VAAPI_SLICE_CAST (object);
 }
+
+/* Creates a slice holding @param_num slice parameters, i.e. several
+   slices whose data lies in the same @data buffer. The parameters are
+   expected to set their slice_data_offset and slice_data_size */
+GstVaapiSlice *
+gst_vaapi_slice_new_n_params (GstVaapiDecoder * decoder,
+    gconstpointer param, guint param_size, guint param_num,
+    const guchar * data, guint data_size)
+{
+  GstVaapiCodecObject *object;
+
+  g_return_val_if_fail (param != NULL, NULL);
+  g_return_val_if_fail (param_num > 0, NULL);
+
+  object = gst_vaapi_codec_object_new_with_param_num (&GstVaapiSliceClass,
+      GST_VAAPI_CODEC_BASE (decoder), param, param_size, param_num, data,
+      data_size, 0);
+  return GST_VAAPI_SLICE_CAST (object);
+}
+
+/* Creates a slice whose data are the @size bytes at @offset in @buffer.
+   The VA buffers are only created when the picture is decoded, so that
+   the slices of a picture from the same @buffer are submitted with one
+   slice data buffer, filled in from a single mapping of @buffer */
+GstVaapiSlice *
+gst_vaapi_slice_new_from_buffer (GstVaapiDecoder * decoder,
+    guint param_size, GstBuffer * buffer, guint offset, guint size)
+{
+  GstVaapiCodecObject *object;
+  GstVaapiSlice *slice;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (offset + size <= gst_buffer_get_size (buffer), NULL);
+
+  object = gst_vaapi_codec_object_new (&GstVaapiSliceClass,
+      GST_VAAPI_CODEC_BASE (decoder), NULL, param_size, NULL, size,
+      SLICE_CREATE_DEFERRED);
+  if (!object)
+    return NULL;
+
+  slice = GST_VAAPI_SLICE_CAST (object);
+  slice->buffer = gst_buffer_ref (buffer);
+  slice->data_offset = offset;
+  return slice;
+}
@@ -145,8 +145,11 @@ struct _GstVaapiPicture
   GstVideoCodecFrame *frame;
   GstVaapiSurface *surface;
   GstVaapiSurfaceProxy *proxy;
+  /* the output surface, if scaled by the decode pipeline */
+  GstVaapiSurfaceProxy *proc_proxy;
   VABufferID param_id;
   guint param_size;
+  VAContextID va_context;
 
   /*< public >*/
   GstVaapiPictureType type;
@@ -164,6 +167,12 @@ struct _GstVaapiPicture
   guint structure;
   GstVaapiRectangle crop_rect;
   guint has_crop_rect:1;
+
+  /* source coding statistics, see gst_vaapi_picture_add_slice_stats() */
+  guint coded_size;
+  guint qp_sum;
+  guint num_qp_slices;
+  guint has_inter_slices:1;
 };
 
 G_GNUC_INTERNAL
@@ -192,6 +201,11 @@ G_GNUC_INTERNAL
 void
 gst_vaapi_picture_add_slice (GstVaapiPicture * picture, GstVaapiSlice * slice);
 
+G_GNUC_INTERNAL
+void
+gst_vaapi_picture_add_slice_stats (GstVaapiPicture * picture, guint size,
+    gint qp, gboolean is_intra);
+
 G_GNUC_INTERNAL
 gboolean
 gst_vaapi_picture_decode (GstVaapiPicture * picture);
@@ -241,9 +255,18 @@ struct _GstVaapiSlice
   VABufferID param_id;
   VABufferID data_id;
   gpointer param;
+  guint param_size;
+  /* number of slice parameters in param, all sharing data_id */
+  guint param_num;
 
   /* Per-slice overrides */
   GstVaapiHuffmanTable *huf_table;
+
+  /* Slices created from a #GstBuffer keep their parameters in system
+     memory and reference their data until the picture is decoded */
+  GstBuffer *buffer;
+  guint data_offset;
+  guint data_size;
 };
 
 G_GNUC_INTERNAL
@@ -260,6 +283,16 @@ GstVaapiSlice *
 gst_vaapi_slice_new (GstVaapiDecoder * decoder, gconstpointer param,
     guint param_size, const guchar * data, guint data_size);
 
+G_GNUC_INTERNAL
+GstVaapiSlice *
+gst_vaapi_slice_new_n_params (GstVaapiDecoder * decoder, gconstpointer param,
+    guint param_size, guint param_num, const guchar * data, guint data_size);
+
+G_GNUC_INTERNAL
+GstVaapiSlice *
+gst_vaapi_slice_new_from_buffer (GstVaapiDecoder * decoder, guint param_size,
+    GstBuffer * buffer, guint offset, guint size);
+
 /* ------------------------------------------------------------------------- */
 /* --- Helpers to create codec-dependent objects                         --- */
 /* ------------------------------------------------------------------------- */
@@ -273,6 +306,18 @@ gst_vaapi_slice_new (GstVaapiDecoder * decoder, gconstpointer param,
       NULL, sizeof (G_PASTE (VASliceParameterBuffer, codec)),   \
       buf, buf_size)
 
+#define GST_VAAPI_SLICE_NEW_N_PARAMS(codec, decoder, params, n_params, \
+    buf, buf_size)                                                    \
+  gst_vaapi_slice_new_n_params (GST_VAAPI_DECODER_CAST (decoder),     \
+      params, sizeof (G_PASTE (VASliceParameterBuffer, codec)),       \
+      n_params, buf, buf_size)
+
+#define GST_VAAPI_SLICE_NEW_FROM_BUFFER(codec, decoder, buffer, offset, \
+    size)                                                              \
+  gst_vaapi_slice_new_from_buffer (GST_VAAPI_DECODER_CAST (decoder),   \
+      sizeof (G_PASTE (VASliceParameterBuffer, codec)), buffer, offset, \
+      size)
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_DECODER_OBJECTS_H */
@@ -29,6 +29,8 @@
 #include <gst/vaapi/gstvaapidecoder.h>
 #include <gst/vaapi/gstvaapidecoder_unit.h>
 #include <gst/vaapi/gstvaapicontext.h>
+#include <gst/vaapi/gstvaapivideopool.h>
+#include "gstvaapiparser_frame.h"
 
 G_BEGIN_DECLS
 
@@ -124,7 +126,7 @@ typedef struct _GstVaapiDecoderClass GstVaapiDecoderClass;
  */
 #undef  GST_VAAPI_DECODER_CODEC_FRAME
 #define GST_VAAPI_DECODER_CODEC_FRAME(decoder) \
-    GST_VAAPI_PARSER_STATE(decoder)->current_frame
+    GST_VAAPI_DECODER_CAST(decoder)->current_frame
 
 /**
  * GST_VAAPI_DECODER_WIDTH:
@@ -173,9 +175,12 @@ struct _GstVaapiParserState
   gint input_offset1;
   gint input_offset2;
   GstAdapter *output_adapter;
+  /* holds the input buffer of gst_vaapi_decoder_parse_packet() */
+  GstAdapter *packet_adapter;
   GstVaapiDecoderUnit next_unit;
   guint next_unit_pending:1;
   guint at_eos:1;
+  GstVaapiParserFramePool *frame_pool;
 };
 
 /**
@@ -195,11 +200,97 @@ struct _GstVaapiDecoder
   VAContextID va_context;
   GstVaapiCodec codec;
   GstVideoCodecState *codec_state;
-  GAsyncQueue *buffers;
   GAsyncQueue *frames;
   GstVaapiParserState parser_state;
   GstVaapiDecoderStateChangedFunc codec_state_changed_func;
   gpointer codec_state_changed_data;
+
+  /* frame being decoded, i.e. not necessarily the one being parsed */
+  GstVideoCodecFrame *current_frame;
+
+  /* threaded decode mode */
+  GThread *decode_thread;
+  GAsyncQueue *decode_queue;
+  GMutex decode_lock;
+  GCond decode_cond;
+  guint decode_pending;
+  GstVaapiDecoderStatus decode_status;
+  /* frames that failed to decode, in output order, with their status */
+  GQueue decode_errors;
+  gint codec_state_changed_pending;
+  guint threaded:1;
+
+  /* recycled VA parameter buffers */
+  GArray *free_buffers;
+  GMutex buffers_lock;
+
+  /* compressed input, bounded by gst_vaapi_decoder_set_input_limits(),
+     0 meaning no limit */
+  GQueue input_queue;
+  GMutex input_lock;
+  GCond input_cond;
+  gsize input_bytes;
+  gsize max_input_bytes;
+  guint max_input_buffers;
+  GstVaapiDecoderInputOverflow input_overflow;
+  GstVaapiDecoderInputStats input_stats;
+  /* buffers were dropped since the last one popped */
+  gboolean input_dropped;
+
+  /* submit all slices of a picture with a single vaRenderPicture() */
+  guint batch_slices:1;
+
+  /* deadline given to the display job scheduler */
+  GstClockTime job_deadline;
+
+  /* error concealment statistics, updated with atomic operations */
+  gint concealed_pictures;
+  gint missing_references;
+
+  /* pictures dropped before submission, see GstVaapiDecoderSkipMode,
+     and the requested mode, applied at the next key picture when
+     leaving GST_VAAPI_DECODER_SKIP_NON_KEY */
+  gint skip_mode;
+  gint skip_mode_requested;
+
+  /* keep the VA context across streams that fit in its surfaces */
+  guint max_width;
+  guint max_height;
+  guint rendition_switch:1;
+  /* how long a kept context may stay larger than the pictures, and
+     since when it has, or GST_CLOCK_TIME_NONE */
+  GstClockTime rendition_settle_time;
+  GstClockTime rendition_oversized_since;
+
+  /* surfaces beyond the DPB, or 0 if downstream needs are unknown */
+  guint extra_surfaces;
+
+  /* surfaces allocated past a full pool rather than failing */
+  guint starvation_surfaces;
+
+  /* GPU priority of the VA contexts */
+  GstVaapiPriority priority;
+
+  /* decoded surfaces provided by the user, tried before the pool */
+  GstVaapiDecoderSurfaceFunc surface_func;
+  gpointer surface_data;
+
+  /* GstVaapiSurfaceAllocFlags of the decoded and output surfaces */
+  guint surface_alloc_flags;
+
+  /* VA contexts pictures are spread over when no picture references
+     another one, see gst_vaapi_decoder_set_parallel_contexts() */
+  guint parallel_contexts;
+  guint context_index;
+  guint intra_only:1;
+
+  /* pictures scaled and converted in the decode pipeline, see
+     gst_vaapi_decoder_set_output_processing() */
+  GstVideoFormat proc_format;
+  guint proc_width;
+  guint proc_height;
+  GstVideoInfo proc_info;
+  GstVaapiVideoPool *proc_pool;
 };
 
 /**
@@ -270,6 +361,47 @@ G_GNUC_INTERNAL
 GstVaapiDecoderStatus
 gst_vaapi_decoder_decode_codec_data (GstVaapiDecoder * decoder);
 
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_decoder_create_buffer (GstVaapiDecoder * decoder, guint type,
+    guint size, gconstpointer data, VABufferID * buf_id_ptr,
+    gpointer * mapped_data);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_decoder_create_n_elements_buffer (GstVaapiDecoder * decoder,
+    guint type, guint size, guint num_elements, gconstpointer data,
+    VABufferID * buf_id_ptr, gpointer * mapped_data);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_decoder_release_buffer (GstVaapiDecoder * decoder,
+    VAContextID va_context, guint type, guint size, VABufferID * buf_id_ptr);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_decoder_release_n_elements_buffer (GstVaapiDecoder * decoder,
+    VAContextID va_context, guint type, guint size, guint num_elements,
+    VABufferID * buf_id_ptr);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_decoder_set_intra_only (GstVaapiDecoder * decoder,
+    gboolean intra_only);
+
+G_GNUC_INTERNAL
+VAContextID
+gst_vaapi_decoder_select_va_context (GstVaapiDecoder * decoder);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_decoder_update_skip_mode (GstVaapiDecoder * decoder);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_decoder_add_concealed_picture (GstVaapiDecoder * decoder,
+    guint missing_references);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_DECODER_PRIV_H */
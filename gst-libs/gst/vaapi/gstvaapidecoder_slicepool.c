@@ -0,0 +1,245 @@
+/*
+ *  gstvaapidecoder_slicepool.c - Parallel slice header parsing
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "sysdeps.h"
+#include "gstvaapidecoder_slicepool.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+/* Slice headers are small, more threads would mostly wait */
+#define MAX_THREADS     8
+
+typedef struct
+{
+  gpointer job;
+  gboolean done;
+} SliceJobEntry;
+
+/*
+ * GstVaapiSlicePool:
+ *
+ * Runs @func on the pushed jobs from a pool of threads, and hands them
+ * back in submission order. The parsers push the slices of an access
+ * unit as soon as its boundaries are known, then pop each of them when
+ * the streaming thread reaches it.
+ */
+struct _GstVaapiSlicePool
+{
+  GThreadPool *threads;
+  GFunc func;
+  gpointer user_data;
+  GDestroyNotify destroy;
+
+  GMutex lock;
+  GCond cond;
+  GQueue entries;
+};
+
+static void
+run_job (gpointer data, gpointer user_data)
+{
+  SliceJobEntry *const entry = data;
+  GstVaapiSlicePool *const pool = user_data;
+
+  pool->func (entry->job, pool->user_data);
+
+  g_mutex_lock (&pool->lock);
+  entry->done = TRUE;
+  g_cond_broadcast (&pool->cond);
+  g_mutex_unlock (&pool->lock);
+}
+
+/**
+ * gst_vaapi_slice_pool_new:
+ * @func: the function parsing a job
+ * @user_data: user data passed to @func
+ * @destroy: the function releasing a job
+ *
+ * Creates a new pool of slice parsing threads. No pool is created on
+ * single processor systems, where the jobs would only add overhead.
+ *
+ * Return value: the newly allocated #GstVaapiSlicePool, or %NULL
+ */
+GstVaapiSlicePool *
+gst_vaapi_slice_pool_new (GFunc func, gpointer user_data,
+    GDestroyNotify destroy)
+{
+  GstVaapiSlicePool *pool;
+  const guint num_threads = MIN (g_get_num_processors (), MAX_THREADS);
+  GError *error = NULL;
+
+  g_return_val_if_fail (func != NULL, NULL);
+  g_return_val_if_fail (destroy != NULL, NULL);
+
+  if (num_threads < 2)
+    return NULL;
+
+  pool = g_slice_new0 (GstVaapiSlicePool);
+  pool->func = func;
+  pool->user_data = user_data;
+  pool->destroy = destroy;
+  g_mutex_init (&pool->lock);
+  g_cond_init (&pool->cond);
+  g_queue_init (&pool->entries);
+
+  pool->threads = g_thread_pool_new (run_job, pool, num_threads, FALSE,
+      &error);
+  if (!pool->threads)
+    goto error_threads;
+  return pool;
+
+  /* ERRORS */
+error_threads:
+  {
+    GST_WARNING ("failed to create slice parsing threads: %s",
+        error->message);
+    g_clear_error (&error);
+    gst_vaapi_slice_pool_free (pool);
+    return NULL;
+  }
+}
+
+/**
+ * gst_vaapi_slice_pool_free:
+ * @pool: a #GstVaapiSlicePool
+ *
+ * Releases @pool, after the jobs still pending are done.
+ */
+void
+gst_vaapi_slice_pool_free (GstVaapiSlicePool * pool)
+{
+  g_return_if_fail (pool != NULL);
+
+  gst_vaapi_slice_pool_clear (pool);
+  if (pool->threads)
+    g_thread_pool_free (pool->threads, FALSE, TRUE);
+  g_mutex_clear (&pool->lock);
+  g_cond_clear (&pool->cond);
+  g_slice_free (GstVaapiSlicePool, pool);
+}
+
+/**
+ * gst_vaapi_slice_pool_push:
+ * @pool: a #GstVaapiSlicePool
+ * @job: the job to parse
+ *
+ * Queues @job for parsing. @pool owns @job until it is popped.
+ */
+void
+gst_vaapi_slice_pool_push (GstVaapiSlicePool * pool, gpointer job)
+{
+  SliceJobEntry *entry;
+
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (job != NULL);
+
+  entry = g_slice_new (SliceJobEntry);
+  entry->job = job;
+  entry->done = FALSE;
+
+  g_mutex_lock (&pool->lock);
+  g_queue_push_tail (&pool->entries, entry);
+  g_mutex_unlock (&pool->lock);
+
+  g_thread_pool_push (pool->threads, entry, NULL);
+}
+
+/**
+ * gst_vaapi_slice_pool_peek:
+ * @pool: a #GstVaapiSlicePool
+ *
+ * Returns: (transfer none): the oldest job, whether it is parsed yet
+ *   or not, or %NULL if there is none
+ */
+gpointer
+gst_vaapi_slice_pool_peek (GstVaapiSlicePool * pool)
+{
+  SliceJobEntry *entry;
+
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  /* Only the caller thread adds or removes entries */
+  entry = g_queue_peek_head (&pool->entries);
+  return entry ? entry->job : NULL;
+}
+
+/**
+ * gst_vaapi_slice_pool_pop:
+ * @pool: a #GstVaapiSlicePool
+ *
+ * Dequeues the oldest job, waiting for it to be parsed.
+ *
+ * Returns: (transfer full): the oldest job, or %NULL if there is none
+ */
+gpointer
+gst_vaapi_slice_pool_pop (GstVaapiSlicePool * pool)
+{
+  SliceJobEntry *entry;
+  gpointer job;
+
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  g_mutex_lock (&pool->lock);
+  entry = g_queue_peek_head (&pool->entries);
+  if (entry) {
+    while (!entry->done)
+      g_cond_wait (&pool->cond, &pool->lock);
+    g_queue_pop_head (&pool->entries);
+  }
+  g_mutex_unlock (&pool->lock);
+
+  if (!entry)
+    return NULL;
+
+  job = entry->job;
+  g_slice_free (SliceJobEntry, entry);
+  return job;
+}
+
+/**
+ * gst_vaapi_slice_pool_is_empty:
+ * @pool: a #GstVaapiSlicePool
+ *
+ * Returns: %TRUE if no job is queued
+ */
+gboolean
+gst_vaapi_slice_pool_is_empty (GstVaapiSlicePool * pool)
+{
+  g_return_val_if_fail (pool != NULL, TRUE);
+
+  return g_queue_is_empty (&pool->entries);
+}
+
+/**
+ * gst_vaapi_slice_pool_clear:
+ * @pool: a #GstVaapiSlicePool
+ *
+ * Drops all the queued jobs, waiting for those being parsed.
+ */
+void
+gst_vaapi_slice_pool_clear (GstVaapiSlicePool * pool)
+{
+  gpointer job;
+
+  g_return_if_fail (pool != NULL);
+
+  while ((job = gst_vaapi_slice_pool_pop (pool)))
+    pool->destroy (job);
+}
@@ -0,0 +1,63 @@
+/*
+ *  gstvaapidecoder_slicepool.h - Parallel slice header parsing
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_DECODER_SLICE_POOL_H
+#define GST_VAAPI_DECODER_SLICE_POOL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Minimal number of slices worth handing over to the pool */
+#define GST_VAAPI_SLICE_POOL_MIN_JOBS   2
+
+typedef struct _GstVaapiSlicePool GstVaapiSlicePool;
+
+G_GNUC_INTERNAL
+GstVaapiSlicePool *
+gst_vaapi_slice_pool_new (GFunc func, gpointer user_data,
+    GDestroyNotify destroy);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_slice_pool_free (GstVaapiSlicePool * pool);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_slice_pool_push (GstVaapiSlicePool * pool, gpointer job);
+
+G_GNUC_INTERNAL
+gpointer
+gst_vaapi_slice_pool_peek (GstVaapiSlicePool * pool);
+
+G_GNUC_INTERNAL
+gpointer
+gst_vaapi_slice_pool_pop (GstVaapiSlicePool * pool);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_slice_pool_is_empty (GstVaapiSlicePool * pool);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_slice_pool_clear (GstVaapiSlicePool * pool);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_DECODER_SLICE_POOL_H */
@@ -33,6 +33,7 @@
 #include "gstvaapidecoder_unit.h"
 #include "gstvaapidecoder_priv.h"
 #include "gstvaapidisplay_priv.h"
+#include "gstvaapiutils_h26x_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -64,6 +65,9 @@ struct _GstVaapiDecoderVC1Private
   guint8 *rbdu_buffer;
   guint8 rndctrl;
   guint rbdu_buffer_size;
+  /* one nibble per macroblock, the bitplanes of a picture combined */
+  guint8 *bitplane_buffer;
+  guint bitplane_buffer_size;
   guint is_opened:1;
   guint has_codec_data:1;
   guint has_entrypoint:1;
@@ -171,6 +175,10 @@ gst_vaapi_decoder_vc1_destroy (GstVaapiDecoder * base_decoder)
     g_clear_pointer (&priv->rbdu_buffer, g_free);
     priv->rbdu_buffer_size = 0;
   }
+  if (priv->bitplane_buffer) {
+    g_clear_pointer (&priv->bitplane_buffer, g_free);
+    priv->bitplane_buffer_size = 0;
+  }
 }
 
 static gboolean
@@ -657,21 +665,67 @@ has_OVERFLAGS_bitplane (GstVaapiDecoderVC1 * decoder)
       pic->condover == GST_VC1_CONDOVER_SELECT);
 }
 
-static inline void
-pack_bitplanes (GstVaapiBitPlane * bitplane, guint n,
-    const guint8 * bitplanes[3], guint x, guint y, guint stride)
+/* Combines the bitplanes of a macroblock row into one byte per
+   macroblock, eight macroblocks at a time. Bitplane entries are 0 or
+   1, so that the planes combine within each byte of a word */
+static void
+combine_bitplanes_row (guint8 * dst, const guint8 * bitplanes[3],
+    guint offset, guint width)
 {
-  const guint dst_index = n / 2;
-  const guint src_index = y * stride + x;
-  guint8 v = 0;
-
-  if (bitplanes[0])
-    v |= bitplanes[0][src_index];
-  if (bitplanes[1])
-    v |= bitplanes[1][src_index] << 1;
-  if (bitplanes[2])
-    v |= bitplanes[2][src_index] << 2;
-  bitplane->data[dst_index] = (bitplane->data[dst_index] << 4) | v;
+  const guint64 lsb_mask = G_GUINT64_CONSTANT (0x0101010101010101);
+  guint64 v, w;
+  guint i, x;
+
+  for (x = 0; x + 8 <= width; x += 8) {
+    v = 0;
+    for (i = 0; i < 3; i++) {
+      if (!bitplanes[i])
+        continue;
+      memcpy (&w, bitplanes[i] + offset + x, sizeof (w));
+      v |= (w & lsb_mask) << i;
+    }
+    memcpy (dst + x, &v, sizeof (v));
+  }
+
+  for (; x < width; x++) {
+    dst[x] = 0;
+    for (i = 0; i < 3; i++) {
+      if (bitplanes[i])
+        dst[x] |= (bitplanes[i][offset + x] & 1) << i;
+    }
+  }
+}
+
+/* Packs the bitplanes into the VA layout, i.e. two macroblocks per
+   byte, the first one in the high order nibble */
+static gboolean
+pack_bitplanes (GstVaapiDecoderVC1 * decoder, guint8 * dst,
+    const guint8 * bitplanes[3])
+{
+  GstVaapiDecoderVC1Private *const priv = &decoder->priv;
+  GstVC1SeqHdr *const seq_hdr = &priv->seq_hdr;
+  const guint n = seq_hdr->mb_width * seq_hdr->mb_height;
+  guint8 *src;
+  guint i, y;
+
+  if (!priv->bitplane_buffer || n > priv->bitplane_buffer_size) {
+    src = g_realloc (priv->bitplane_buffer, n);
+    if (!src)
+      return FALSE;
+    priv->bitplane_buffer = src;
+    priv->bitplane_buffer_size = n;
+  }
+  src = priv->bitplane_buffer;
+
+  for (y = 0; y < seq_hdr->mb_height; y++)
+    combine_bitplanes_row (src + y * seq_hdr->mb_width, bitplanes,
+        y * seq_hdr->mb_stride, seq_hdr->mb_width);
+
+  for (i = 0; i < n / 2; i++)
+    dst[i] = (src[2 * i] << 4) | src[2 * i + 1];
+  if (n & 1)                    /* last nibble goes to the high order */
+    dst[n / 2] = src[n - 1] << 4;
+  return TRUE;
 }
 
 static gboolean
@@ -885,7 +939,6 @@ fill_picture (GstVaapiDecoderVC1 * decoder, GstVaapiPicture * picture)
 
   if (pic_param->bitplane_present.value) {
     const guint8 *bitplanes[3];
-    guint x, y, n;
 
     switch (picture->type) {
       case GST_VAAPI_PICTURE_TYPE_P:
@@ -923,13 +976,8 @@ fill_picture (GstVaapiDecoderVC1 * decoder, GstVaapiPicture * picture)
     if (!picture->bitplane)
       return FALSE;
 
-    n = 0;
-    for (y = 0; y < seq_hdr->mb_height; y++)
-      for (x = 0; x < seq_hdr->mb_width; x++, n++)
-        pack_bitplanes (picture->bitplane, n, bitplanes, x, y,
-            seq_hdr->mb_stride);
-    if (n & 1)                  /* move last nibble to the high order */
-      picture->bitplane->data[n / 2] <<= 4;
+    if (!pack_bitplanes (decoder, picture->bitplane->data, bitplanes))
+      return FALSE;
   }
   return TRUE;
 }
@@ -1253,13 +1301,6 @@ ensure_decoder (GstVaapiDecoderVC1 * decoder)
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
-static inline gint
-scan_for_start_code (GstAdapter * adapter, guint ofs, guint size, guint32 * scp)
-{
-  return (gint) gst_adapter_masked_scan_uint32_peek (adapter,
-      0xffffff00, 0x00000100, ofs, size, scp);
-}
-
 static GstVaapiDecoderStatus
 gst_vaapi_decoder_vc1_parse (GstVaapiDecoder * base_decoder,
     GstAdapter * adapter, gboolean at_eos, GstVaapiDecoderUnit * unit)
@@ -1287,14 +1328,14 @@ gst_vaapi_decoder_vc1_parse (GstVaapiDecoder * base_decoder,
     if (size < 4)
       return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
 
-    ofs = scan_for_start_code (adapter, 0, size, NULL);
+    ofs = gst_vaapi_utils_scan_for_start_code (adapter, 0, size, NULL);
     if (ofs < 0)
       return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
     gst_adapter_flush (adapter, ofs);
     size -= ofs;
 
     ofs = G_UNLIKELY (size < 8) ? -1 :
-        scan_for_start_code (adapter, 4, size - 4, NULL);
+        gst_vaapi_utils_scan_for_start_code (adapter, 4, size - 4, NULL);
     if (ofs < 0) {
       // Assume the whole packet is present if end-of-stream
       if (!at_eos)
@@ -55,6 +55,13 @@ struct _GstVaapiDecoderVp8Private
   GstVaapiPicture *golden_ref_picture;
   GstVaapiPicture *alt_ref_picture;
   GstVaapiPicture *current_picture;
+  /* IQ matrix and probability table of the last picture, submitted
+     again to the next pictures of tables_context they match */
+  GstVaapiIqMatrix *iq_matrix;
+  GstVaapiProbabilityTable *prob_table;
+  VAIQMatrixBufferVP8 iq_matrix_data;
+  VAProbabilityDataBufferVP8 prob_table_data;
+  VAContextID tables_context;
   guint size_changed:1;
 };
 
@@ -104,11 +111,22 @@ get_status (GstVp8ParserResult result)
   return status;
 }
 
+static void
+clear_tables (GstVaapiDecoderVp8 * decoder)
+{
+  GstVaapiDecoderVp8Private *const priv = &decoder->priv;
+
+  gst_vaapi_codec_object_replace (&priv->iq_matrix, NULL);
+  gst_vaapi_codec_object_replace (&priv->prob_table, NULL);
+  priv->tables_context = VA_INVALID_ID;
+}
+
 static void
 gst_vaapi_decoder_vp8_close (GstVaapiDecoderVp8 * decoder)
 {
   GstVaapiDecoderVp8Private *const priv = &decoder->priv;
 
+  clear_tables (decoder);
   gst_vaapi_picture_replace (&priv->last_picture, NULL);
   gst_vaapi_picture_replace (&priv->golden_ref_picture, NULL);
   gst_vaapi_picture_replace (&priv->alt_ref_picture, NULL);
@@ -192,28 +210,38 @@ ensure_context (GstVaapiDecoderVp8 * decoder)
 
     if (!reset_context)
       return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+    clear_tables (decoder);
   }
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
+/* Checks whether the tables kept from the last picture can be
+   submitted to @picture, i.e. whether they live in its VA context */
+static gboolean
+has_tables (GstVaapiDecoderVp8 * decoder, GstVaapiPicture * picture)
+{
+  GstVaapiDecoderVp8Private *const priv = &decoder->priv;
+
+  if (priv->tables_context != picture->va_context) {
+    clear_tables (decoder);
+    priv->tables_context = picture->va_context;
+    return FALSE;
+  }
+  return TRUE;
+}
+
 static GstVaapiDecoderStatus
 ensure_quant_matrix (GstVaapiDecoderVp8 * decoder, GstVaapiPicture * picture)
 {
   GstVaapiDecoderVp8Private *const priv = &decoder->priv;
   GstVp8FrameHdr *const frame_hdr = &priv->frame_hdr;
   GstVp8Segmentation *const seg = &priv->parser.segmentation;
-  VAIQMatrixBufferVP8 *iq_matrix;
+  VAIQMatrixBufferVP8 iq_matrix_buf = { 0, };
+  VAIQMatrixBufferVP8 *const iq_matrix = &iq_matrix_buf;
   const gint8 QI_MAX = 127;
   gint8 qi, qi_base;
   gint i;
 
-  picture->iq_matrix = GST_VAAPI_IQ_MATRIX_NEW (VP8, decoder);
-  if (!picture->iq_matrix) {
-    GST_ERROR ("failed to allocate IQ matrix");
-    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
-  }
-  iq_matrix = picture->iq_matrix->param;
-
   /* Fill in VAIQMatrixBufferVP8 */
   for (i = 0; i < 4; i++) {
     if (seg->segmentation_enabled) {
@@ -236,6 +264,22 @@ ensure_quant_matrix (GstVaapiDecoderVp8 * decoder, GstVaapiPicture * picture)
     qi = qi_base + frame_hdr->quant_indices.uv_ac_delta;
     iq_matrix->quantization_index[i][5] = CLAMP (qi, 0, QI_MAX);
   }
+
+  /* Quantizer indices seldom change from a frame to the next */
+  if (!has_tables (decoder, picture) || !priv->iq_matrix ||
+      memcmp (iq_matrix, &priv->iq_matrix_data, sizeof (*iq_matrix)) != 0) {
+    gst_vaapi_codec_object_replace (&priv->iq_matrix, NULL);
+    priv->iq_matrix = GST_VAAPI_IQ_MATRIX_NEW (VP8, decoder);
+    if (!priv->iq_matrix) {
+      GST_ERROR ("failed to allocate IQ matrix");
+      return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
+    }
+    GST_VAAPI_MINI_OBJECT_FLAG_SET (priv->iq_matrix,
+        GST_VAAPI_CODEC_OBJECT_FLAG_PERSISTENT);
+    memcpy (priv->iq_matrix->param, iq_matrix, sizeof (*iq_matrix));
+    priv->iq_matrix_data = *iq_matrix;
+  }
+  gst_vaapi_codec_object_replace (&picture->iq_matrix, priv->iq_matrix);
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
@@ -245,19 +289,34 @@ ensure_probability_table (GstVaapiDecoderVp8 * decoder,
 {
   GstVaapiDecoderVp8Private *const priv = &decoder->priv;
   GstVp8FrameHdr *const frame_hdr = &priv->frame_hdr;
-  VAProbabilityDataBufferVP8 *prob_table;
+  VAProbabilityDataBufferVP8 *const prob_table = &priv->prob_table_data;
+
+  G_STATIC_ASSERT (sizeof (prob_table->dct_coeff_probs) ==
+      sizeof (frame_hdr->token_probs.prob));
+
+  /* Token probabilities persist across frames unless the frame header
+     updates them, which low complexity streams hardly do */
+  if (has_tables (decoder, picture) && priv->prob_table &&
+      memcmp (prob_table->dct_coeff_probs, frame_hdr->token_probs.prob,
+          sizeof (prob_table->dct_coeff_probs)) == 0)
+    goto done;
 
-  picture->prob_table = GST_VAAPI_PROBABILITY_TABLE_NEW (VP8, decoder);
-  if (!picture->prob_table) {
+  gst_vaapi_codec_object_replace (&priv->prob_table, NULL);
+  priv->prob_table = GST_VAAPI_PROBABILITY_TABLE_NEW (VP8, decoder);
+  if (!priv->prob_table) {
     GST_ERROR ("failed to allocate probality table");
     return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
   }
-  prob_table = picture->prob_table->param;
+  GST_VAAPI_MINI_OBJECT_FLAG_SET (priv->prob_table,
+      GST_VAAPI_CODEC_OBJECT_FLAG_PERSISTENT);
 
   /* Fill in VAProbabilityDataBufferVP8 */
   memcpy (prob_table->dct_coeff_probs, frame_hdr->token_probs.prob,
-      sizeof (frame_hdr->token_probs.prob));
+      sizeof (prob_table->dct_coeff_probs));
+  memcpy (priv->prob_table->param, prob_table, sizeof (*prob_table));
 
+done:
+  gst_vaapi_codec_object_replace (&picture->prob_table, priv->prob_table);
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
@@ -53,12 +53,12 @@ struct _GstVaapiDecoderVp9Private
   GstVaapiPicture *current_picture;
   GstVaapiPicture *ref_frames[GST_VP9_REF_FRAMES];      /* reference frames in ref_slots[max_ref] */
 
+  GstVaapiPicture *output_picture;      /* to output for the current frame */
+
   guint num_frames;             /* number of frames in a super frame */
   guint frame_sizes[8];         /* size of frames in a super frame */
-  guint frame_cnt;              /* frame count variable for super frame */
-  guint total_idx_size;         /* super frame index size (full block size) */
-  guint had_superframe_hdr:1;   /* indicate the presense of super frame */
 
+  guint output_existing:1;      /* output_picture is shown again */
   guint size_changed:1;
 };
 
@@ -116,6 +116,8 @@ gst_vaapi_decoder_vp9_close (GstVaapiDecoderVp9 * decoder)
 
   for (i = 0; i < GST_VP9_REF_FRAMES; i++)
     gst_vaapi_picture_replace (&priv->ref_frames[i], NULL);
+  gst_vaapi_picture_replace (&priv->current_picture, NULL);
+  gst_vaapi_picture_replace (&priv->output_picture, NULL);
 
   g_clear_pointer (&priv->parser, gst_vp9_parser_free);
 }
@@ -485,15 +487,10 @@ decode_picture (GstVaapiDecoderVp9 * decoder, const guchar * buf,
   GstVaapiPicture *picture;
   GstVaapiDecoderStatus status;
   guint crop_width = 0, crop_height = 0;
-  gboolean is_clone_pic = FALSE;
-
-  status = ensure_context (decoder);
-  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
-    return status;
 
   /* if show_exising_frame flag is true, we just need to return
-   * the existing frame in ref frame array, so creating a clone
-   * of already decoded frame */
+   * the existing frame in ref frame array: its surface is output
+   * again with the timing of the current frame, nothing is decoded */
   if (frame_hdr->show_existing_frame) {
     GstVaapiPicture *existing_frame =
         priv->ref_frames[frame_hdr->frame_to_show];
@@ -502,35 +499,24 @@ decode_picture (GstVaapiDecoderVp9 * decoder, const guchar * buf,
       GST_ERROR ("Failed to get the existing frame from dpb");
       return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
     }
+    gst_vaapi_picture_replace (&priv->output_picture, existing_frame);
+    priv->output_existing = TRUE;
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+  }
 
-    picture = gst_vaapi_picture_new_clone (existing_frame);
-    if (!picture) {
-      GST_ERROR ("Failed to create clone picture");
-      return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
-    }
-    is_clone_pic = TRUE;
-
-    /* for cloned picture we should always unset the skip flag since
-     * the previously decoded frame might be decode-only but repeat-frame
-     * should make it ready for display */
-    GST_VAAPI_PICTURE_FLAG_UNSET (picture, GST_VAAPI_PICTURE_FLAG_SKIPPED);
+  status = ensure_context (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
 
-    /* reset picture pts with whatever set in VideoCodecFrame */
-    picture->pts = GST_VAAPI_DECODER_CODEC_FRAME (decoder)->pts;
-  } else {
-    /* Create new picture */
-    picture = GST_VAAPI_PICTURE_NEW (VP9, decoder);
-    if (!picture) {
-      GST_ERROR ("failed to allocate picture");
-      return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
-    }
+  /* Create new picture */
+  picture = GST_VAAPI_PICTURE_NEW (VP9, decoder);
+  if (!picture) {
+    GST_ERROR ("failed to allocate picture");
+    return GST_VAAPI_DECODER_STATUS_ERROR_ALLOCATION_FAILED;
   }
   gst_vaapi_picture_replace (&priv->current_picture, picture);
   gst_vaapi_picture_unref (picture);
 
-  if (is_clone_pic)
-    return GST_VAAPI_DECODER_STATUS_SUCCESS;
-
   if (priv->width > frame_hdr->width || priv->height > frame_hdr->height) {
     crop_width = frame_hdr->width;
     crop_height = frame_hdr->height;
@@ -552,28 +538,69 @@ decode_picture (GstVaapiDecoderVp9 * decoder, const guchar * buf,
 }
 
 
+/* Emits the surface of @picture again, for the frame being decoded */
+static gboolean
+output_existing_picture (GstVaapiDecoderVp9 * decoder,
+    GstVaapiPicture * picture)
+{
+  GstVideoCodecFrame *const out_frame = GST_VAAPI_DECODER_CODEC_FRAME (decoder);
+  GstVaapiSurfaceProxy *proxy;
+
+  if (!picture->proxy)
+    return FALSE;
+
+  proxy = gst_vaapi_surface_proxy_ref (picture->proxy);
+  if (picture->has_crop_rect)
+    gst_vaapi_surface_proxy_set_crop_rect (proxy, &picture->crop_rect);
+  gst_video_codec_frame_set_user_data (out_frame,
+      proxy, (GDestroyNotify) gst_vaapi_mini_object_unref);
+  gst_vaapi_decoder_push_frame (GST_VAAPI_DECODER_CAST (decoder), out_frame);
+  return TRUE;
+}
+
+/* Outputs a single picture per input frame: the last shown frame out
+ * of a super frame, or its last frame if none is shown, so that the
+ * frame gets released as decode-only */
+static GstVaapiDecoderStatus
+output_picture (GstVaapiDecoderVp9 * decoder)
+{
+  GstVaapiDecoderVp9Private *const priv = &decoder->priv;
+  GstVaapiPicture *const picture = priv->output_picture;
+  gboolean success;
+
+  if (!picture)
+    return GST_VAAPI_DECODER_STATUS_SUCCESS;
+
+  if (priv->output_existing)
+    success = output_existing_picture (decoder, picture);
+  else
+    success = gst_vaapi_picture_output (picture);
+  gst_vaapi_picture_replace (&priv->output_picture, NULL);
+  priv->output_existing = FALSE;
+
+  if (!success)
+    return GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
 static GstVaapiDecoderStatus
 decode_current_picture (GstVaapiDecoderVp9 * decoder)
 {
   GstVaapiDecoderVp9Private *const priv = &decoder->priv;
   GstVaapiPicture *const picture = priv->current_picture;
-  GstVp9FrameHdr *const frame_hdr = &priv->frame_hdr;
 
   if (!picture)
     return GST_VAAPI_DECODER_STATUS_SUCCESS;
 
-  if (frame_hdr->show_existing_frame)
-    goto ret;
-
   if (!gst_vaapi_picture_decode (picture))
     goto error;
 
   update_ref_frames (decoder);
 
-ret:
-  if (!gst_vaapi_picture_output (picture))
-    goto error;
-
+  if (!GST_VAAPI_PICTURE_IS_SKIPPED (picture) || !priv->output_picture) {
+    gst_vaapi_picture_replace (&priv->output_picture, picture);
+    priv->output_existing = FALSE;
+  }
   gst_vaapi_picture_replace (&priv->current_picture, NULL);
 
   return GST_VAAPI_DECODER_STATUS_SUCCESS;
@@ -676,35 +703,15 @@ static GstVaapiDecoderStatus
 gst_vaapi_decoder_vp9_parse (GstVaapiDecoder * base_decoder,
     GstAdapter * adapter, gboolean at_eos, GstVaapiDecoderUnit * unit)
 {
-  GstVaapiDecoderVp9 *const decoder = GST_VAAPI_DECODER_VP9_CAST (base_decoder);
-  GstVaapiDecoderVp9Private *const priv = &decoder->priv;
-  guchar *buf;
   guint buf_size, flags = 0;
 
   buf_size = gst_adapter_available (adapter);
   if (!buf_size)
     return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
-  buf = (guchar *) gst_adapter_map (adapter, buf_size);
-  if (!buf)
-    return GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA;
-
-  if (!priv->had_superframe_hdr) {
-    if (!parse_super_frame (buf, buf_size, priv->frame_sizes, &priv->num_frames,
-            &priv->total_idx_size))
-      return GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
-
-    if (priv->num_frames > 1)
-      priv->had_superframe_hdr = TRUE;
-  }
 
-  unit->size = priv->frame_sizes[priv->frame_cnt++];
-
-  if (priv->frame_cnt == priv->num_frames) {
-    priv->num_frames = 0;
-    priv->frame_cnt = 0;
-    priv->had_superframe_hdr = FALSE;
-    unit->size += priv->total_idx_size;
-  }
+  /* A super frame is decoded as a whole, its frames are submitted
+   * back to back from gst_vaapi_decoder_vp9_decode() */
+  unit->size = buf_size;
 
   /* The whole frame is available */
   flags |= GST_VAAPI_DECODER_UNIT_FLAG_FRAME_START;
@@ -721,18 +728,40 @@ decode_buffer (GstVaapiDecoderVp9 * decoder, const guchar * buf, guint buf_size)
 {
   GstVaapiDecoderVp9Private *const priv = &decoder->priv;
   GstVaapiDecoderStatus status;
-  guint size = buf_size;
+  guint i, total_idx_size, ofs = 0;
 
-  if (priv->total_idx_size && !priv->had_superframe_hdr) {
-    size -= priv->total_idx_size;
-    priv->total_idx_size = 0;
-  }
+  gst_vaapi_picture_replace (&priv->output_picture, NULL);
+  priv->output_existing = FALSE;
 
-  status = parse_frame_header (decoder, buf, size, &priv->frame_hdr);
-  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
-    return status;
+  if (!parse_super_frame (buf, buf_size, priv->frame_sizes, &priv->num_frames,
+          &total_idx_size))
+    return GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
+  buf_size -= total_idx_size;
+
+  for (i = 0; i < priv->num_frames; i++) {
+    const guint size = priv->frame_sizes[i];
+
+    if (size > buf_size - ofs) {
+      GST_ERROR ("invalid super frame index");
+      return GST_VAAPI_DECODER_STATUS_ERROR_BITSTREAM_PARSER;
+    }
+
+    /* Submit the previous frame right away, the last one is decoded
+     * from gst_vaapi_decoder_vp9_end_frame() */
+    status = decode_current_picture (decoder);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
 
-  return decode_picture (decoder, buf, size);
+    status = parse_frame_header (decoder, buf + ofs, size, &priv->frame_hdr);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
+
+    status = decode_picture (decoder, buf + ofs, size);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      return status;
+    ofs += size;
+  }
+  return GST_VAAPI_DECODER_STATUS_SUCCESS;
 }
 
 static GstVaapiDecoderStatus
@@ -769,8 +798,12 @@ static GstVaapiDecoderStatus
 gst_vaapi_decoder_vp9_end_frame (GstVaapiDecoder * base_decoder)
 {
   GstVaapiDecoderVp9 *const decoder = GST_VAAPI_DECODER_VP9_CAST (base_decoder);
+  GstVaapiDecoderStatus status;
 
-  return decode_current_picture (decoder);
+  status = decode_current_picture (decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    return status;
+  return output_picture (decoder);
 }
 
 static GstVaapiDecoderStatus
@@ -27,13 +27,29 @@
  * @short_description: VA display abstraction
  */
 
+/* for dladdr() */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 #include "sysdeps.h"
 #include "gstvaapiutils.h"
 #include "gstvaapivalue.h"
 #include "gstvaapidisplay.h"
 #include "gstvaapitexturemap.h"
 #include "gstvaapidisplay_priv.h"
+#include "gstvaapicontext.h"
+#include "gstvaapifilter.h"
 #include "gstvaapiworkarounds.h"
+#include "gstvaapitrace.h"
+#include "gstvaapiutils_numa.h"
+
+#if HAVE_DLADDR
+# include <dlfcn.h>
+#endif
+#ifdef __linux__
+# include <sys/prctl.h>
+#endif
 
 /* Debug category for all vaapi libs */
 GST_DEBUG_CATEGORY (gst_debug_vaapi);
@@ -51,6 +67,35 @@ GST_DEBUG_CATEGORY (gst_debug_vaapi_display);
 G_DEFINE_TYPE_WITH_CODE (GstVaapiDisplay, gst_vaapi_display, GST_TYPE_OBJECT,
     _do_init);
 
+/* Display lock contention profile, enabled by setting the
+   GST_VAAPI_DISPLAY_LOCK_PROFILE environment variable. The outermost
+   acquisitions of the lock are aggregated by holder thread, which is
+   named after the element for streaming threads, and call site. The
+   histograms are dumped by gst_vaapi_display_dump_lock_profile() and
+   when the display is finalized. When disabled, locking costs a
+   boolean check. */
+#define LOCK_PROFILE_BUCKETS 16
+
+typedef struct _LockProfileEntry LockProfileEntry;
+struct _LockProfileEntry
+{
+  gchar owner[17];
+  gconstpointer site;
+  guint64 count;
+  GstClockTime wait_total;
+  GstClockTime wait_max;
+  GstClockTime hold_total;
+  GstClockTime hold_max;
+  /* bucket i counts times below 2^i us, the last one the others */
+  guint64 wait_hist[LOCK_PROFILE_BUCKETS];
+  guint64 hold_hist[LOCK_PROFILE_BUCKETS];
+};
+
+static gboolean lock_profile_enabled;
+
+/* Call site of the gst_vaapi_display_lock() in progress, per thread */
+static GPrivate lock_profile_site;
+
 typedef struct _GstVaapiProfileConfig GstVaapiProfileConfig;
 struct _GstVaapiProfileConfig
 {
@@ -87,6 +132,10 @@ enum
   PROP_BRIGHTNESS,
   PROP_CONTRAST,
   PROP_VA_DISPLAY,
+  PROP_RESOURCE_USAGE,
+  PROP_MEMORY_BUDGET,
+  PROP_JOB_SCHEDULING,
+  PROP_CONTEXT_CACHE_SIZE,
 
   N_PROPERTIES
 };
@@ -467,6 +516,7 @@ ensure_profiles (GstVaapiDisplay * display)
   VAEntrypoint *entrypoints = NULL;
   gint i, j, n, num_entrypoints;
   VAStatus status;
+  GstClockTime start;
   gboolean success = FALSE;
 
   GST_VAAPI_DISPLAY_LOCK (display);
@@ -475,6 +525,7 @@ ensure_profiles (GstVaapiDisplay * display)
     GST_VAAPI_DISPLAY_UNLOCK (display);
     return TRUE;
   }
+  start = gst_util_get_timestamp ();
 
   priv->codecs = g_array_new (FALSE, FALSE, sizeof (GstVaapiProfileConfig));
   if (!priv->codecs)
@@ -545,23 +596,44 @@ ensure_profiles (GstVaapiDisplay * display)
 
   g_ptr_array_sort (priv->decoders, compare_profiles);
   g_ptr_array_sort (priv->encoders, compare_profiles);
+  success = TRUE;
+
+cleanup:
+  g_free (profiles);
+  g_free (entrypoints);
+  priv->probe_time += gst_util_get_timestamp () - start;
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  return success;
+}
+
+/* Initialize video processing support, independently from the codec
+   profiles so that VPP-only users do not enumerate them */
+static void
+ensure_video_processing (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  VAEntrypoint *entrypoints;
+  gint i, num_entrypoints;
+  VAStatus status;
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  if (priv->got_vpp) {
+    GST_VAAPI_DISPLAY_UNLOCK (display);
+    return;
+  }
+  priv->got_vpp = TRUE;
 
-  /* Video processing API */
+  entrypoints = g_new (VAEntrypoint, vaMaxNumEntrypoints (priv->display));
   status = vaQueryConfigEntrypoints (priv->display, VAProfileNone,
       entrypoints, &num_entrypoints);
   if (vaapi_check_status (status, "vaQueryEntrypoints() [VAProfileNone]")) {
-    for (j = 0; j < num_entrypoints; j++) {
-      if (entrypoints[j] == VAEntrypointVideoProc)
+    for (i = 0; i < num_entrypoints; i++) {
+      if (entrypoints[i] == VAEntrypointVideoProc)
         priv->has_vpp = TRUE;
     }
   }
-  success = TRUE;
-
-cleanup:
-  g_free (profiles);
   g_free (entrypoints);
   GST_VAAPI_DISPLAY_UNLOCK (display);
-  return success;
 }
 
 /* Initialize VA display attributes */
@@ -574,8 +646,11 @@ ensure_properties (GstVaapiDisplay * display)
   gint i, n;
   gboolean success = FALSE;
 
-  if (priv->properties)
+  GST_VAAPI_DISPLAY_LOCK (display);
+  if (priv->properties) {
+    GST_VAAPI_DISPLAY_UNLOCK (display);
     return TRUE;
+  }
 
   priv->properties = g_array_new (FALSE, FALSE, sizeof (GstVaapiProperty));
   if (!priv->properties)
@@ -644,6 +719,7 @@ ensure_properties (GstVaapiDisplay * display)
 
 cleanup:
   g_free (display_attrs);
+  GST_VAAPI_DISPLAY_UNLOCK (display);
   return success;
 }
 
@@ -655,6 +731,7 @@ ensure_image_formats (GstVaapiDisplay * display)
   VAImageFormat *formats = NULL;
   VAStatus status;
   gint i, n, max_images;
+  GstClockTime start;
   gboolean success = FALSE;
 
   GST_VAAPI_DISPLAY_LOCK (display);
@@ -662,6 +739,7 @@ ensure_image_formats (GstVaapiDisplay * display)
     GST_VAAPI_DISPLAY_UNLOCK (display);
     return TRUE;
   }
+  start = gst_util_get_timestamp ();
 
   priv->image_formats = g_array_new (FALSE, FALSE, sizeof (GstVaapiFormatInfo));
   if (!priv->image_formats)
@@ -716,6 +794,7 @@ ensure_image_formats (GstVaapiDisplay * display)
 
 cleanup:
   g_free (formats);
+  priv->probe_time += gst_util_get_timestamp () - start;
   GST_VAAPI_DISPLAY_UNLOCK (display);
   return success;
 }
@@ -729,6 +808,7 @@ ensure_subpicture_formats (GstVaapiDisplay * display)
   unsigned int *flags = NULL;
   VAStatus status;
   guint i, n;
+  GstClockTime start;
   gboolean success = FALSE;
 
   GST_VAAPI_DISPLAY_LOCK (display);
@@ -736,6 +816,7 @@ ensure_subpicture_formats (GstVaapiDisplay * display)
     GST_VAAPI_DISPLAY_UNLOCK (display);
     return TRUE;
   }
+  start = gst_util_get_timestamp ();
 
   priv->subpicture_formats =
       g_array_new (FALSE, FALSE, sizeof (GstVaapiFormatInfo));
@@ -769,6 +850,7 @@ ensure_subpicture_formats (GstVaapiDisplay * display)
 cleanup:
   g_free (formats);
   g_free (flags);
+  priv->probe_time += gst_util_get_timestamp () - start;
   GST_VAAPI_DISPLAY_UNLOCK (display);
   return success;
 }
@@ -791,42 +873,141 @@ ensure_vendor_string (GstVaapiDisplay * display)
   return priv->vendor_string != NULL;
 }
 
+/* Encodes a driver version for the quirks table */
+#define DRIVER_VERSION(major, minor, micro) \
+  (((major) << 16) | ((minor) << 8) | (micro))
+
+typedef gboolean (*DriverQuirkProbeFunc) (GstVaapiDisplay * display);
+
+/* Checks whether the driver still misses RGBA in its image formats */
+static gboolean
+probe_missing_rgba_image_format (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  VAImageFormat *formats;
+  VAStatus status;
+  gboolean missing = TRUE;
+  gint i, n = 0;
+
+  formats = g_new (VAImageFormat, vaMaxNumImageFormats (priv->display));
+  status = vaQueryImageFormats (priv->display, formats, &n);
+  if (vaapi_check_status (status, "vaQueryImageFormats()")) {
+    for (i = 0; i < n && missing; i++)
+      missing = formats[i].fourcc != VA_FOURCC_RGBA;
+  }
+  g_free (formats);
+  return missing;
+}
+
+/*
+ * Each quirk applies to the drivers whose vendor string contains
+ * match_string, within [min_version, max_version) when a bound is not
+ * zero. If a probe is set, it runs on first use to tell whether this
+ * very driver still needs the workaround, so that fast paths are only
+ * disabled where they actually fail.
+ */
+/* *INDENT-OFF* */
+static const struct
+{
+  const char *match_string;
+  guint min_version;
+  guint max_version;
+  guint quirks;
+  DriverQuirkProbeFunc probe;
+} vaapi_driver_quirks_table[] = {
+  /* @XXX(victor): is this string enough to identify it */
+  { "AMD", 0, 0, GST_VAAPI_DRIVER_QUIRK_NO_CHECK_SURFACE_PUT_IMAGE, NULL },
+  { "i965", 0, 0, GST_VAAPI_DRIVER_QUIRK_NO_CHECK_VPP_COLOR_STD, NULL },
+  { "iHD", 0, 0, GST_VAAPI_DRIVER_QUIRK_NO_RGBYUV_VPP_COLOR_PRIMARY, NULL },
+  { "i965", 0, 0, GST_VAAPI_DRIVER_QUIRK_MISSING_RGBA_IMAGE_FORMAT,
+    probe_missing_rgba_image_format },
+  { "iHD", 0, 0, GST_VAAPI_DRIVER_QUIRK_JPEG_ENC_SHIFT_VALUE_BY_50, NULL },
+  { "iHD", 0, 0, GST_VAAPI_DRIVER_QUIRK_HEVC_ENC_SLICE_NOT_SPAN_TILE, NULL },
+  { "i965", 0, 0, GST_VAAPI_DRIVER_QUIRK_JPEG_DEC_BROKEN_FORMATS, NULL },
+};
+/* *INDENT-ON* */
+
+/* Extracts the first "major.minor[.micro]" number following the word
+   "driver" in the vendor string, e.g. "Intel iHD driver for Intel(R)
+   Gen Graphics - 20.1.1 ()" or "Mesa Gallium driver 20.0.8 for ..." */
+static guint
+parse_driver_version (const gchar * vendor_string)
+{
+  const gchar *str;
+  guint major, minor, micro;
+
+  str = strstr (vendor_string, "driver");
+  if (!str)
+    return 0;
+
+  for (; *str; str++) {
+    if (!g_ascii_isdigit (*str) || g_ascii_isalnum (str[-1]))
+      continue;
+    micro = 0;
+    if (sscanf (str, "%u.%u.%u", &major, &minor, &micro) >= 2)
+      return DRIVER_VERSION (MIN (major, 0xffff), MIN (minor, 0xff),
+          MIN (micro, 0xff));
+  }
+  return 0;
+}
+
 static void
 set_driver_quirks (GstVaapiDisplay * display)
 {
   GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
-  guint i;
-
-  /* *INDENT-OFF* */
-  static const struct
-  {
-    const char *match_string;
-    guint quirks;
-  } vaapi_driver_quirks_table[] = {
-    /* @XXX(victor): is this string enough to identify it */
-    { "AMD", GST_VAAPI_DRIVER_QUIRK_NO_CHECK_SURFACE_PUT_IMAGE },
-    { "i965", GST_VAAPI_DRIVER_QUIRK_NO_CHECK_VPP_COLOR_STD },
-    { "iHD", GST_VAAPI_DRIVER_QUIRK_NO_RGBYUV_VPP_COLOR_PRIMARY },
-    { "i965", GST_VAAPI_DRIVER_QUIRK_MISSING_RGBA_IMAGE_FORMAT },
-    { "iHD", GST_VAAPI_DRIVER_QUIRK_JPEG_ENC_SHIFT_VALUE_BY_50 },
-    { "iHD", GST_VAAPI_DRIVER_QUIRK_HEVC_ENC_SLICE_NOT_SPAN_TILE },
-    { "i965", GST_VAAPI_DRIVER_QUIRK_JPEG_DEC_BROKEN_FORMATS },
-  };
-  /* *INDENT-ON* */
+  guint i, version;
 
   if (!ensure_vendor_string (display))
     return;
 
+  version = priv->driver_version = parse_driver_version (priv->vendor_string);
+
   for (i = 0; i < G_N_ELEMENTS (vaapi_driver_quirks_table); i++) {
     const char *match_str = vaapi_driver_quirks_table[i].match_string;
+    const guint min_version = vaapi_driver_quirks_table[i].min_version;
+    const guint max_version = vaapi_driver_quirks_table[i].max_version;
+
     if (g_strstr_len (priv->vendor_string, strlen (priv->vendor_string),
-            match_str) != NULL) {
+            match_str) == NULL)
+      continue;
+    /* An unknown version is assumed to be affected */
+    if (version && ((min_version && version < min_version) ||
+            (max_version && version >= max_version)))
+      continue;
+
+    if (vaapi_driver_quirks_table[i].probe)
+      priv->driver_quirks_pending |= vaapi_driver_quirks_table[i].quirks;
+    else
       priv->driver_quirks |= vaapi_driver_quirks_table[i].quirks;
-    }
   }
 
-  GST_INFO_OBJECT (display, "Matched driver string \"%s\", setting quirks "
-      "(%#x)", priv->vendor_string, priv->driver_quirks);
+  GST_INFO_OBJECT (display, "Matched driver string \"%s\" (version %#x), "
+      "setting quirks (%#x), to be probed (%#x)", priv->vendor_string,
+      version, priv->driver_quirks, priv->driver_quirks_pending);
+}
+
+/* Runs the probes of the pending @quirks */
+static void
+probe_driver_quirks (GstVaapiDisplay * display, guint quirks)
+{
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  guint i;
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  for (i = 0; i < G_N_ELEMENTS (vaapi_driver_quirks_table); i++) {
+    const guint entry_quirks = vaapi_driver_quirks_table[i].quirks &
+        priv->driver_quirks_pending & quirks;
+
+    if (!entry_quirks || !vaapi_driver_quirks_table[i].probe)
+      continue;
+
+    priv->driver_quirks_pending &= ~entry_quirks;
+    if (vaapi_driver_quirks_table[i].probe (display))
+      priv->driver_quirks |= entry_quirks;
+    GST_INFO_OBJECT (display, "driver quirks %#x %s", entry_quirks,
+        (priv->driver_quirks & entry_quirks) ? "confirmed" : "not needed");
+  }
+  GST_VAAPI_DISPLAY_UNLOCK (display);
 }
 
 static void
@@ -970,8 +1151,11 @@ gst_vaapi_display_create (GstVaapiDisplay * display,
     return FALSE;
 
   if (!priv->parent) {
+    const GstClockTime start = gst_util_get_timestamp ();
+
     if (!vaapi_initialize (priv->display))
       return FALSE;
+    priv->init_time = gst_util_get_timestamp () - start;
   }
 
   GST_INFO_OBJECT (display, "new display addr=%p", display);
@@ -988,14 +1172,140 @@ gst_vaapi_display_create (GstVaapiDisplay * display,
   return TRUE;
 }
 
+static void
+lock_profile_owner (gchar owner[17])
+{
+  owner[0] = '\0';
+#ifdef __linux__
+  /* GstTask names its threads after the element and pad */
+  if (prctl (PR_GET_NAME, owner, 0, 0, 0) != 0)
+    owner[0] = '\0';
+  owner[16] = '\0';
+#endif
+  if (owner[0] == '\0')
+    g_snprintf (owner, 17, "%p", g_thread_self ());
+}
+
+static inline guint
+lock_profile_bucket (GstClockTime time)
+{
+  guint64 us = time / GST_USECOND;
+  guint i = 0;
+
+  while (us > 0 && i < LOCK_PROFILE_BUCKETS - 1) {
+    us >>= 1;
+    i++;
+  }
+  return i;
+}
+
+/* Called with the display lock held, before its outermost release */
+static void
+lock_profile_account (GstVaapiDisplayPrivate * priv)
+{
+  const GstClockTime hold = gst_util_get_timestamp () - priv->lock_acquired;
+  LockProfileEntry *entry;
+  gchar owner[17];
+  gchar *key;
+
+  lock_profile_owner (owner);
+  key = g_strdup_printf ("%s@%p", owner, priv->lock_site);
+  entry = g_hash_table_lookup (priv->lock_profile, key);
+  if (!entry) {
+    entry = g_slice_new0 (LockProfileEntry);
+    g_strlcpy (entry->owner, owner, sizeof (entry->owner));
+    entry->site = priv->lock_site;
+    g_hash_table_insert (priv->lock_profile, key, entry);
+  } else
+    g_free (key);
+
+  entry->count++;
+  entry->wait_total += priv->lock_wait;
+  entry->wait_max = MAX (entry->wait_max, priv->lock_wait);
+  entry->wait_hist[lock_profile_bucket (priv->lock_wait)]++;
+  entry->hold_total += hold;
+  entry->hold_max = MAX (entry->hold_max, hold);
+  entry->hold_hist[lock_profile_bucket (hold)]++;
+}
+
+static void
+lock_profile_entry_free (gpointer data)
+{
+  g_slice_free (LockProfileEntry, data);
+}
+
+static gint
+lock_profile_entry_compare (gconstpointer a, gconstpointer b)
+{
+  const LockProfileEntry *const ea = *(const LockProfileEntry **) a;
+  const LockProfileEntry *const eb = *(const LockProfileEntry **) b;
+  const gint ret = g_strcmp0 (ea->owner, eb->owner);
+
+  if (ret != 0)
+    return ret;
+  if (ea->hold_total != eb->hold_total)
+    return ea->hold_total > eb->hold_total ? -1 : 1;
+  return 0;
+}
+
+static gchar *
+lock_profile_site_name (gconstpointer site)
+{
+#if HAVE_DLADDR
+  Dl_info info;
+
+  if (site && dladdr (site, &info) && info.dli_sname) {
+    return g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x", info.dli_sname,
+        (gsize) ((const guint8 *) site - (const guint8 *) info.dli_saddr));
+  }
+#endif
+  return g_strdup_printf ("%p", site);
+}
+
+static void
+lock_profile_print_histogram (GString * str, const gchar * name,
+    const guint64 * hist)
+{
+  guint i;
+
+  g_string_append_printf (str, "    %s:", name);
+  for (i = 0; i < LOCK_PROFILE_BUCKETS; i++) {
+    if (hist[i] == 0)
+      continue;
+    if (i < LOCK_PROFILE_BUCKETS - 1)
+      g_string_append_printf (str, " <%uus:%" G_GUINT64_FORMAT, 1U << i,
+          hist[i]);
+    else
+      g_string_append_printf (str, " >=%uus:%" G_GUINT64_FORMAT,
+          1U << (i - 1), hist[i]);
+  }
+  g_string_append_c (str, '\n');
+}
+
 static void
 gst_vaapi_display_lock_default (GstVaapiDisplay * display)
 {
   GstVaapiDisplayPrivate *priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  GstClockTime wait_start = 0;
 
   if (priv->parent)
     priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+
+  if (G_UNLIKELY (lock_profile_enabled))
+    wait_start = gst_util_get_timestamp ();
   g_rec_mutex_lock (&priv->mutex);
+
+  /* The hold time is only measured while someone collects it */
+  if (priv->lock_depth++ == 0) {
+    priv->lock_count++;
+    priv->lock_start = GST_VAAPI_TRACE_BEGIN ();
+
+    if (G_UNLIKELY (priv->lock_profile)) {
+      priv->lock_acquired = gst_util_get_timestamp ();
+      priv->lock_wait = priv->lock_acquired - wait_start;
+      priv->lock_site = g_private_get (&lock_profile_site);
+    }
+  }
 }
 
 static void
@@ -1005,6 +1315,13 @@ gst_vaapi_display_unlock_default (GstVaapiDisplay * display)
 
   if (priv->parent)
     priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+
+  if (--priv->lock_depth == 0) {
+    if (GST_CLOCK_TIME_IS_VALID (priv->lock_start))
+      priv->lock_time += gst_util_get_timestamp () - priv->lock_start;
+    if (G_UNLIKELY (priv->lock_profile))
+      lock_profile_account (priv);
+  }
   g_rec_mutex_unlock (&priv->mutex);
 }
 
@@ -1019,6 +1336,21 @@ gst_vaapi_display_init (GstVaapiDisplay * display)
   priv->par_d = 1;
 
   g_rec_mutex_init (&priv->mutex);
+  g_mutex_init (&priv->usage_lock);
+  g_mutex_init (&priv->job_lock);
+  g_cond_init (&priv->job_cond);
+  g_queue_init (&priv->job_waiters);
+
+  /* Let VA calls on independent contexts and surfaces run concurrently,
+     for drivers known to be thread-safe */
+  priv->fine_grained_locking =
+      g_getenv ("GST_VAAPI_FINE_GRAINED_LOCKING") != NULL;
+
+  if (g_getenv ("GST_VAAPI_DISPLAY_LOCK_PROFILE")) {
+    lock_profile_enabled = TRUE;
+    priv->lock_profile = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, lock_profile_entry_free);
+  }
 }
 
 static gboolean
@@ -1065,6 +1397,20 @@ gst_vaapi_display_set_property (GObject * object, guint property_id,
   GstVaapiDisplay *display = GST_VAAPI_DISPLAY (object);
   const GstVaapiProperty *prop;
 
+  if (property_id == PROP_MEMORY_BUDGET) {
+    gst_vaapi_display_set_memory_budget (display, g_value_get_uint64 (value));
+    return;
+  }
+  if (property_id == PROP_CONTEXT_CACHE_SIZE) {
+    gst_vaapi_display_set_context_cache_size (display,
+        g_value_get_uint (value));
+    return;
+  }
+  if (property_id == PROP_JOB_SCHEDULING) {
+    gst_vaapi_display_set_job_scheduling (display, g_value_get_boolean (value));
+    return;
+  }
+
   if (!ensure_properties (display))
     return;
 
@@ -1118,6 +1464,29 @@ _get_property (GstVaapiDisplay * display, const GstVaapiProperty * prop,
   return TRUE;
 }
 
+static GstStructure *
+get_resource_usage (GstVaapiDisplay * display)
+{
+  static const gchar *names[GST_VAAPI_DISPLAY_RESOURCE_COUNT] = {
+    "surfaces", "images", "coded-buffers", "subpictures"
+  };
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  GstStructure *structure;
+  gchar *size_name;
+  guint i;
+
+  structure = gst_structure_new_empty ("resource-usage");
+  g_mutex_lock (&priv->usage_lock);
+  for (i = 0; i < GST_VAAPI_DISPLAY_RESOURCE_COUNT; i++) {
+    size_name = g_strdup_printf ("%s-size", names[i]);
+    gst_structure_set (structure, names[i], G_TYPE_UINT, priv->usage_count[i],
+        size_name, G_TYPE_UINT64, priv->usage_size[i], NULL);
+    g_free (size_name);
+  }
+  g_mutex_unlock (&priv->usage_lock);
+  return structure;
+}
+
 static void
 gst_vaapi_display_get_property (GObject * object, guint property_id,
     GValue * value, GParamSpec * pspec)
@@ -1129,6 +1498,23 @@ gst_vaapi_display_get_property (GObject * object, guint property_id,
     g_value_set_pointer (value, gst_vaapi_display_get_display (display));
     return;
   }
+  if (property_id == PROP_RESOURCE_USAGE) {
+    g_value_take_boxed (value, get_resource_usage (display));
+    return;
+  }
+  if (property_id == PROP_MEMORY_BUDGET) {
+    g_value_set_uint64 (value, gst_vaapi_display_get_memory_budget (display));
+    return;
+  }
+  if (property_id == PROP_CONTEXT_CACHE_SIZE) {
+    g_value_set_uint (value,
+        gst_vaapi_display_get_context_cache_size (display));
+    return;
+  }
+  if (property_id == PROP_JOB_SCHEDULING) {
+    g_value_set_boolean (value, gst_vaapi_display_get_job_scheduling (display));
+    return;
+  }
 
   if (!ensure_properties (display))
     return;
@@ -1149,7 +1535,15 @@ gst_vaapi_display_finalize (GObject * object)
   GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
 
   gst_vaapi_display_destroy (display);
+  if (priv->lock_profile) {
+    if (!priv->parent)
+      gst_vaapi_display_dump_lock_profile (display);
+    g_hash_table_unref (priv->lock_profile);
+  }
   g_rec_mutex_clear (&priv->mutex);
+  g_mutex_clear (&priv->usage_lock);
+  g_mutex_clear (&priv->job_lock);
+  g_cond_clear (&priv->job_cond);
 
   G_OBJECT_CLASS (gst_vaapi_display_parent_class)->finalize (object);
 }
@@ -1240,6 +1634,66 @@ gst_vaapi_display_class_init (GstVaapiDisplayClass * klass)
       g_param_spec_pointer ("va-display", "VADisplay",
       "VA Display handler", G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * GstVaapiDisplay:resource-usage:
+   *
+   * The number and estimated size in bytes of the VA objects
+   * currently allocated on the display, as a #GstStructure with
+   * "surfaces", "images", "coded-buffers" and "subpictures" counts,
+   * and their respective "-size" fields. Imported surfaces and
+   * images derived from surfaces are counted with no size, since
+   * their memory is accounted elsewhere.
+   */
+  g_properties[PROP_RESOURCE_USAGE] =
+      g_param_spec_boxed ("resource-usage", "Resource usage",
+      "VA objects allocated on the display", GST_TYPE_STRUCTURE,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiDisplay:memory-budget:
+   *
+   * The maximal size in bytes of the VA objects allocated on the
+   * display, as accounted by #GstVaapiDisplay:resource-usage, or 0 for
+   * no limit. When set, decoders allocate their surfaces on demand,
+   * release them once idle, and are refused surfaces beyond their
+   * minimal needs while the budget is exhausted.
+   */
+  g_properties[PROP_MEMORY_BUDGET] =
+      g_param_spec_uint64 ("memory-budget", "Memory budget",
+      "Maximal size of the VA objects allocated on the display (0 = no limit)",
+      0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiDisplay:job-scheduling:
+   *
+   * When enabled, the decode, VPP and encode submissions of all the
+   * elements using the display run one at a time, the job with the
+   * earliest deadline first. Jobs without a deadline only run when
+   * no job with one is waiting. Elements give their jobs a deadline
+   * through their job-priority property.
+   */
+  g_properties[PROP_JOB_SCHEDULING] =
+      g_param_spec_boolean ("job-scheduling", "Job scheduling",
+      "Order the VA submissions by deadline", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiDisplay:context-cache-size:
+   *
+   * The number of released decoding, encoding and VPP contexts kept
+   * along with their surfaces, so that a new stream of the same
+   * profile, entrypoint, size, format and attributes starts without
+   * creating any VA object. Parked contexts are released after some
+   * time without a match, or when the size is lowered. They hold a
+   * reference on the display meanwhile, so set it back to 0 before
+   * dropping the display. Contexts allocating their surfaces under a
+   * #GstVaapiDisplay:memory-budget are never kept.
+   */
+  g_properties[PROP_CONTEXT_CACHE_SIZE] =
+      g_param_spec_uint ("context-cache-size", "Context cache size",
+      "Number of released VA contexts kept for reuse (0 = disabled)",
+      0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   g_object_class_install_properties (object_class, N_PROPERTIES, g_properties);
   gst_type_mark_as_plugin_api (gst_vaapi_display_type_get_type (), 0);
 }
@@ -1327,6 +1781,11 @@ gst_vaapi_display_lock (GstVaapiDisplay * display)
 
   g_return_if_fail (display != NULL);
 
+#ifdef __GNUC__
+  if (G_UNLIKELY (lock_profile_enabled))
+    g_private_set (&lock_profile_site, __builtin_return_address (0));
+#endif
+
   klass = GST_VAAPI_DISPLAY_GET_CLASS (display);
   if (klass->lock)
     klass->lock (display);
@@ -1561,8 +2020,7 @@ gst_vaapi_display_has_video_processing (GstVaapiDisplay * display)
 {
   g_return_val_if_fail (display != NULL, FALSE);
 
-  if (!ensure_profiles (display))
-    return FALSE;
+  ensure_video_processing (display);
   return GST_VAAPI_DISPLAY_GET_PRIVATE (display)->has_vpp;
 }
 
@@ -2180,7 +2638,1022 @@ gst_vaapi_display_reset_texture_map (GstVaapiDisplay * display)
 gboolean
 gst_vaapi_display_has_driver_quirks (GstVaapiDisplay * display, guint quirks)
 {
+  GstVaapiDisplayPrivate *priv;
+
+  g_return_val_if_fail (display != NULL, FALSE);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  if (G_UNLIKELY (priv->driver_quirks_pending & quirks))
+    probe_driver_quirks (display, quirks);
+  return (priv->driver_quirks & quirks);
+}
+
+/**
+ * gst_vaapi_display_get_resource_usage:
+ * @display: a #GstVaapiDisplay
+ * @resource: a #GstVaapiDisplayResource
+ * @count_ptr: (out) (allow-none): return location for the number of
+ *   objects
+ * @size_ptr: (out) (allow-none): return location for their estimated
+ *   size in bytes
+ *
+ * Retrieves how many VA objects of kind @resource are currently
+ * allocated on @display, across all the elements sharing it.
+ *
+ * This function is thread safe.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+gst_vaapi_display_get_resource_usage (GstVaapiDisplay * display,
+    GstVaapiDisplayResource resource, guint * count_ptr, guint64 * size_ptr)
+{
+  GstVaapiDisplayPrivate *priv;
+
+  g_return_val_if_fail (display != NULL, FALSE);
+  g_return_val_if_fail (resource < GST_VAAPI_DISPLAY_RESOURCE_COUNT, FALSE);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  if (count_ptr)
+    *count_ptr = priv->usage_count[resource];
+  if (size_ptr)
+    *size_ptr = priv->usage_size[resource];
+  g_mutex_unlock (&priv->usage_lock);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_display_get_lock_stats:
+ * @display: a #GstVaapiDisplay
+ * @count_ptr: (out) (allow-none): return location for the number of
+ *   times the display lock was taken
+ * @time_ptr: (out) (allow-none): return location for the time it was
+ *   held
+ *
+ * Retrieves how often the lock serializing the VA calls of @display
+ * was taken, across all the elements sharing it, and for how long.
+ * Recursive locking counts once. The hold time only accounts for the
+ * periods stage timings were collected, see gst_vaapi_trace_is_enabled().
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+gst_vaapi_display_get_lock_stats (GstVaapiDisplay * display,
+    guint64 * count_ptr, GstClockTime * time_ptr)
+{
+  GstVaapiDisplayPrivate *priv;
+
+  g_return_val_if_fail (display != NULL, FALSE);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  if (priv->parent)
+    priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+
+  g_rec_mutex_lock (&priv->mutex);
+  if (count_ptr)
+    *count_ptr = priv->lock_count;
+  if (time_ptr)
+    *time_ptr = priv->lock_time;
+  g_rec_mutex_unlock (&priv->mutex);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_display_get_startup_times:
+ * @display: a #GstVaapiDisplay
+ * @init_time_ptr: (out) (allow-none): return location for the time
+ *   vaInitialize() took
+ * @probe_time_ptr: (out) (allow-none): return location for the time
+ *   spent querying the profiles, image and subpicture formats
+ *
+ * Retrieves the one-time costs of bringing up @display. They are paid
+ * by the first element using it, and are zero for the elements that
+ * share it afterwards.
+ *
+ * Returns: %TRUE on success
+ **/
+gboolean
+gst_vaapi_display_get_startup_times (GstVaapiDisplay * display,
+    GstClockTime * init_time_ptr, GstClockTime * probe_time_ptr)
+{
+  GstVaapiDisplayPrivate *priv, *init_priv;
+
   g_return_val_if_fail (display != NULL, FALSE);
 
-  return (GST_VAAPI_DISPLAY_GET_PRIVATE (display)->driver_quirks & quirks);
+  /* The parent display, if any, is the one that was initialized */
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  init_priv = priv->parent ? GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent) :
+      priv;
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  if (init_time_ptr)
+    *init_time_ptr = init_priv->init_time;
+  if (probe_time_ptr)
+    *probe_time_ptr = priv->probe_time;
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_display_dump_lock_profile:
+ * @display: a #GstVaapiDisplay
+ *
+ * Prints the display lock contention profile of @display to stderr:
+ * for each holder thread and call site, the number of acquisitions,
+ * the average and maximum time spent waiting for and holding the lock,
+ * and their histograms. This only has an effect if the
+ * GST_VAAPI_DISPLAY_LOCK_PROFILE environment variable is set. The
+ * profile is also dumped when @display is finalized.
+ */
+void
+gst_vaapi_display_dump_lock_profile (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *priv;
+  GPtrArray *entries;
+  GHashTableIter iter;
+  gpointer value;
+  GString *str;
+  guint i;
+
+  g_return_if_fail (display != NULL);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  if (priv->parent)
+    priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+  if (!priv->lock_profile)
+    return;
+
+  entries = g_ptr_array_new ();
+  str = g_string_new (NULL);
+  g_rec_mutex_lock (&priv->mutex);
+  g_string_append_printf (str, "VA display %p lock profile (%"
+      G_GUINT64_FORMAT " acquisitions)\n", display, priv->lock_count);
+  g_hash_table_iter_init (&iter, priv->lock_profile);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    g_ptr_array_add (entries, value);
+  g_ptr_array_sort (entries, lock_profile_entry_compare);
+
+  for (i = 0; i < entries->len; i++) {
+    const LockProfileEntry *const entry = g_ptr_array_index (entries, i);
+    gchar *const site = lock_profile_site_name (entry->site);
+
+    g_string_append_printf (str, "  %s %s: %" G_GUINT64_FORMAT " locks, "
+        "wait avg %" G_GUINT64_FORMAT "us max %" G_GUINT64_FORMAT "us, "
+        "hold avg %" G_GUINT64_FORMAT "us max %" G_GUINT64_FORMAT "us, "
+        "hold total %" G_GUINT64_FORMAT "us\n", entry->owner, site,
+        entry->count, entry->wait_total / entry->count / GST_USECOND,
+        entry->wait_max / GST_USECOND,
+        entry->hold_total / entry->count / GST_USECOND,
+        entry->hold_max / GST_USECOND, entry->hold_total / GST_USECOND);
+    lock_profile_print_histogram (str, "wait", entry->wait_hist);
+    lock_profile_print_histogram (str, "hold", entry->hold_hist);
+    g_free (site);
+  }
+  g_rec_mutex_unlock (&priv->mutex);
+
+  g_printerr ("%s", str->str);
+  g_string_free (str, TRUE);
+  g_ptr_array_free (entries, TRUE);
+}
+
+/* Called by the VA object wrappers on creation (@delta = 1) and
+ * destruction (@delta = -1), with the size they hold */
+void
+gst_vaapi_display_account_resource (GstVaapiDisplay * display,
+    GstVaapiDisplayResource resource, gint delta, gint64 size)
+{
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+
+  g_mutex_lock (&priv->usage_lock);
+  priv->usage_count[resource] += delta;
+  priv->usage_size[resource] += delta * size;
+  g_mutex_unlock (&priv->usage_lock);
+}
+
+/**
+ * gst_vaapi_display_get_encode_load:
+ * @display: a #GstVaapiDisplay
+ * @entrypoint: an encoding #GstVaapiEntrypoint
+ *
+ * Retrieves the load the encoders configured on @display put on the
+ * engine behind @entrypoint, across all the elements sharing it. This
+ * is what #GST_VAAPI_ENCODER_TUNE_AUTO balances the streams with.
+ *
+ * This function is thread safe.
+ *
+ * Returns: the number of macroblocks per second being encoded
+ **/
+guint64
+gst_vaapi_display_get_encode_load (GstVaapiDisplay * display,
+    GstVaapiEntrypoint entrypoint)
+{
+  GstVaapiDisplayPrivate *priv;
+  guint64 load;
+
+  g_return_val_if_fail (display != NULL, 0);
+
+  if (entrypoint > GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP)
+    return 0;
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  load = priv->encode_load[entrypoint];
+  g_mutex_unlock (&priv->usage_lock);
+  return load;
+}
+
+/* Called by the encoders when their context is configured (@delta > 0)
+ * and released (@delta < 0), in macroblocks per second */
+void
+gst_vaapi_display_account_encode_load (GstVaapiDisplay * display,
+    GstVaapiEntrypoint entrypoint, gint64 delta)
+{
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+
+  if (entrypoint > GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP)
+    return;
+
+  g_mutex_lock (&priv->usage_lock);
+  priv->encode_load[entrypoint] += delta;
+  g_mutex_unlock (&priv->usage_lock);
+}
+
+/* The load score is the share of late frames among the last reports,
+ * decayed by 1/8 per report and scaled to LOAD_SCORE_MAX. The levels
+ * are left well below where they are entered, so that the elements
+ * degrading their output don't flip back and forth */
+#define LOAD_SCORE_MAX 1024
+static const guint load_score_enter[] = { 0, 512, 832 };
+static const guint load_score_leave[] = { 0, 256, 576 };
+
+/**
+ * gst_vaapi_display_report_load:
+ * @display: a #GstVaapiDisplay
+ * @overloaded: %TRUE if the frame being reported on was late
+ *
+ * Feeds the load estimate of @display with one more sample, from the
+ * QoS lateness, queue depth or processing time an element observed for
+ * a frame. The elements that adapt their quality to the load read the
+ * resulting level with gst_vaapi_display_get_load_level().
+ *
+ * This function is thread safe.
+ **/
+void
+gst_vaapi_display_report_load (GstVaapiDisplay * display,
+    gboolean overloaded)
+{
+  GstVaapiDisplayPrivate *priv;
+  GstVaapiDisplayLoadLevel level;
+  guint score;
+
+  g_return_if_fail (display != NULL);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  score = priv->load_score - priv->load_score / 8;
+  if (overloaded)
+    score += LOAD_SCORE_MAX / 8;
+  priv->load_score = score;
+
+  level = priv->load_level;
+  while (level < GST_VAAPI_DISPLAY_LOAD_CRITICAL
+      && score >= load_score_enter[level + 1])
+    level++;
+  while (level > GST_VAAPI_DISPLAY_LOAD_NORMAL
+      && score < load_score_leave[level])
+    level--;
+  if (level != priv->load_level) {
+    GST_INFO ("display load level changed from %d to %d (score %u)",
+        priv->load_level, level, score);
+    priv->load_level = level;
+  }
+  g_mutex_unlock (&priv->usage_lock);
+}
+
+/**
+ * gst_vaapi_display_get_load_level:
+ * @display: a #GstVaapiDisplay
+ *
+ * Retrieves the load level of @display, as estimated from the reports
+ * of all the elements sharing it.
+ *
+ * This function is thread safe.
+ *
+ * Returns: the current #GstVaapiDisplayLoadLevel
+ **/
+GstVaapiDisplayLoadLevel
+gst_vaapi_display_get_load_level (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *priv;
+  GstVaapiDisplayLoadLevel level;
+
+  g_return_val_if_fail (display != NULL, GST_VAAPI_DISPLAY_LOAD_NORMAL);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  level = priv->load_level;
+  g_mutex_unlock (&priv->usage_lock);
+  return level;
+}
+
+/**
+ * gst_vaapi_display_get_numa_node:
+ * @display: a #GstVaapiDisplay
+ *
+ * Determines the NUMA node the VA device of @display is attached to,
+ * i.e. where the threads mapping its images and coded buffers had
+ * better run. Displays that do not know their device, e.g. X11 ones,
+ * report the node of all the DRM render nodes, if they share one.
+ *
+ * Returns: the NUMA node, or -1 if unknown or on single node hosts
+ **/
+gint
+gst_vaapi_display_get_numa_node (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayClass *klass;
+  gint node = -1;
+
+  g_return_val_if_fail (display != NULL, -1);
+
+  klass = GST_VAAPI_DISPLAY_GET_CLASS (display);
+  if (klass->get_numa_node)
+    node = klass->get_numa_node (display);
+  return node >= 0 ? node : gst_vaapi_numa_get_default_node ();
+}
+
+/**
+ * gst_vaapi_display_get_memory_budget:
+ * @display: a #GstVaapiDisplay
+ *
+ * Returns: the memory budget of @display in bytes, or 0 if there is
+ *   none, see #GstVaapiDisplay:memory-budget
+ **/
+guint64
+gst_vaapi_display_get_memory_budget (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *priv;
+  guint64 budget;
+
+  g_return_val_if_fail (display != NULL, 0);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  budget = priv->memory_budget;
+  g_mutex_unlock (&priv->usage_lock);
+  return budget;
+}
+
+/**
+ * gst_vaapi_display_set_memory_budget:
+ * @display: a #GstVaapiDisplay
+ * @budget: the memory budget in bytes, or 0 for no limit
+ *
+ * Sets the maximal size of the VA objects allocated on @display, see
+ * #GstVaapiDisplay:memory-budget. The budget applies to the decoding
+ * contexts created afterwards.
+ *
+ * This function is thread safe.
+ **/
+void
+gst_vaapi_display_set_memory_budget (GstVaapiDisplay * display,
+    guint64 budget)
+{
+  GstVaapiDisplayPrivate *priv;
+
+  g_return_if_fail (display != NULL);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  priv->memory_budget = budget;
+  g_mutex_unlock (&priv->usage_lock);
+}
+
+/**
+ * gst_vaapi_display_get_context_cache_size:
+ * @display: a #GstVaapiDisplay
+ *
+ * Returns: the number of released VA contexts kept on @display for
+ *   reuse, see #GstVaapiDisplay:context-cache-size
+ **/
+guint
+gst_vaapi_display_get_context_cache_size (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *priv;
+  guint size;
+
+  g_return_val_if_fail (display != NULL, 0);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  size = priv->context_cache_size;
+  g_mutex_unlock (&priv->usage_lock);
+  return size;
+}
+
+/**
+ * gst_vaapi_display_set_context_cache_size:
+ * @display: a #GstVaapiDisplay
+ * @size: the number of released VA contexts to keep, or 0
+ *
+ * Sets the number of released VA contexts kept on @display for the
+ * next streams, see #GstVaapiDisplay:context-cache-size. The parked
+ * contexts beyond @size are destroyed right away.
+ *
+ * This function is thread safe.
+ **/
+void
+gst_vaapi_display_set_context_cache_size (GstVaapiDisplay * display,
+    guint size)
+{
+  GstVaapiDisplayPrivate *priv;
+
+  g_return_if_fail (display != NULL);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  g_mutex_lock (&priv->usage_lock);
+  priv->context_cache_size = size;
+  g_mutex_unlock (&priv->usage_lock);
+
+  gst_vaapi_context_cache_trim (display, size);
+}
+
+/* Checks whether @size more bytes can be allocated on @display */
+gboolean
+gst_vaapi_display_fits_memory_budget (GstVaapiDisplay * display,
+    guint64 size)
+{
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  guint64 total = size;
+  gboolean fits;
+  guint i;
+
+  g_mutex_lock (&priv->usage_lock);
+  for (i = 0; i < GST_VAAPI_DISPLAY_RESOURCE_COUNT; i++)
+    total += priv->usage_size[i];
+  fits = priv->memory_budget == 0 || total <= priv->memory_budget;
+  g_mutex_unlock (&priv->usage_lock);
+  return fits;
+}
+
+/**
+ * gst_vaapi_display_get_job_scheduling:
+ * @display: a #GstVaapiDisplay
+ *
+ * Returns: %TRUE if the VA submissions on @display are ordered by
+ *   deadline, see #GstVaapiDisplay:job-scheduling
+ **/
+gboolean
+gst_vaapi_display_get_job_scheduling (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *priv;
+  gboolean enabled;
+
+  g_return_val_if_fail (display != NULL, FALSE);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  if (priv->parent)
+    priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+  g_mutex_lock (&priv->job_lock);
+  enabled = priv->job_scheduling;
+  g_mutex_unlock (&priv->job_lock);
+  return enabled;
+}
+
+/**
+ * gst_vaapi_display_set_job_scheduling:
+ * @display: a #GstVaapiDisplay
+ * @enabled: whether to order the VA submissions by deadline
+ *
+ * Enables or disables the job scheduler of @display, see
+ * #GstVaapiDisplay:job-scheduling. Jobs already started are not
+ * affected.
+ *
+ * This function is thread safe.
+ **/
+void
+gst_vaapi_display_set_job_scheduling (GstVaapiDisplay * display,
+    gboolean enabled)
+{
+  GstVaapiDisplayPrivate *priv;
+
+  g_return_if_fail (display != NULL);
+
+  priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  if (priv->parent)
+    priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+  g_mutex_lock (&priv->job_lock);
+  priv->job_scheduling = enabled;
+  /* Let the waiters run in any order */
+  if (!enabled)
+    g_cond_broadcast (&priv->job_cond);
+  g_mutex_unlock (&priv->job_lock);
+}
+
+typedef struct
+{
+  GstClockTime deadline;
+} JobWaiter;
+
+/* Orders jobs by deadline, GST_CLOCK_TIME_NONE being the largest, and
+   in arrival order otherwise: the new waiter @b goes after every
+   queued waiter @a that is not later than it */
+static gint
+compare_job_waiters (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const GstClockTime da = ((const JobWaiter *) a)->deadline;
+  const GstClockTime db = ((const JobWaiter *) b)->deadline;
+
+  return da <= db ? -1 : 1;
+}
+
+/**
+ * gst_vaapi_display_job_begin:
+ * @display: a #GstVaapiDisplay
+ * @deadline: the clock time the job should be done by, or
+ *   %GST_CLOCK_TIME_NONE
+ *
+ * Waits for the turn of a VA submission job when the job scheduler
+ * of @display is enabled. Must be called before taking any display or
+ * context lock, and matched with gst_vaapi_display_job_end() if it
+ * returns %TRUE.
+ *
+ * Return value: %TRUE if the job was scheduled
+ **/
+gboolean
+gst_vaapi_display_job_begin (GstVaapiDisplay * display, GstClockTime deadline)
+{
+  GstVaapiDisplayPrivate *priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  JobWaiter waiter = { deadline };
+  GList *link;
+
+  if (priv->parent)
+    priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+
+  g_mutex_lock (&priv->job_lock);
+  if (!priv->job_scheduling) {
+    g_mutex_unlock (&priv->job_lock);
+    return FALSE;
+  }
+
+  if (priv->job_running || !g_queue_is_empty (&priv->job_waiters)) {
+    g_queue_insert_sorted (&priv->job_waiters, &waiter, compare_job_waiters,
+        NULL);
+    link = g_queue_find (&priv->job_waiters, &waiter);
+    while (priv->job_scheduling &&
+        (priv->job_running || priv->job_waiters.head != link))
+      g_cond_wait (&priv->job_cond, &priv->job_lock);
+    g_queue_delete_link (&priv->job_waiters, link);
+
+    /* Scheduling was turned off meanwhile */
+    if (!priv->job_scheduling) {
+      g_cond_broadcast (&priv->job_cond);
+      g_mutex_unlock (&priv->job_lock);
+      return FALSE;
+    }
+  }
+  priv->job_running = TRUE;
+  g_mutex_unlock (&priv->job_lock);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_display_job_end:
+ * @display: a #GstVaapiDisplay
+ *
+ * Ends the job started by a successful gst_vaapi_display_job_begin()
+ * and hands the display over to the most urgent waiting job.
+ **/
+void
+gst_vaapi_display_job_end (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayPrivate *priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+
+  if (priv->parent)
+    priv = GST_VAAPI_DISPLAY_GET_PRIVATE (priv->parent);
+
+  g_mutex_lock (&priv->job_lock);
+  priv->job_running = FALSE;
+  if (!g_queue_is_empty (&priv->job_waiters))
+    g_cond_broadcast (&priv->job_cond);
+  g_mutex_unlock (&priv->job_lock);
+}
+
+/**
+ * gst_vaapi_display_copy_object:
+ * @display: a #GstVaapiDisplay
+ * @is_surface: %TRUE if @dst_id and @src_id are VA surfaces, %FALSE
+ *   if they are VA buffers
+ * @dst_id: the target VA surface or buffer
+ * @src_id: the source VA surface or buffer
+ *
+ * Copies @src_id into @dst_id with the copy engine of the GPU, through
+ * vaCopy(), and waits for the copy to complete. Drivers that do not
+ * implement it are remembered, so that callers falling back to a CPU
+ * copy only pay for the first attempt.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_display_copy_object (GstVaapiDisplay * display,
+    gboolean is_surface, GstVaapiID dst_id, GstVaapiID src_id)
+{
+#if VA_CHECK_VERSION(1,12,0)
+  GstVaapiDisplayPrivate *const priv = GST_VAAPI_DISPLAY_GET_PRIVATE (display);
+  VACopyObject dst = { 0, }, src = { 0, };
+  VACopyOption option = { 0, };
+  VAStatus status;
+
+  if (g_atomic_int_get (&priv->no_copy_engine))
+    return FALSE;
+
+  if (is_surface) {
+    dst.obj_type = src.obj_type = VACopyObjectSurface;
+    dst.object.surface_id = dst_id;
+    src.object.surface_id = src_id;
+  } else {
+    dst.obj_type = src.obj_type = VACopyObjectBuffer;
+    dst.object.buffer_id = dst_id;
+    src.object.buffer_id = src_id;
+  }
+  option.bits.va_copy_sync = VA_EXEC_SYNC;
+  option.bits.va_copy_mode = VA_EXEC_MODE_DEFAULT;
+
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
+  status = vaCopy (priv->display, &dst, &src, option);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
+  if (status == VA_STATUS_ERROR_UNIMPLEMENTED
+      || status == VA_STATUS_ERROR_UNSUPPORTED_ENTRYPOINT) {
+    GST_INFO ("the driver has no copy engine support");
+    g_atomic_int_set (&priv->no_copy_engine, TRUE);
+    return FALSE;
+  }
+  return vaapi_check_status (status, "vaCopy()");
+#else
+  return FALSE;
+#endif
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Driver warm-up                                                   --- */
+/* ------------------------------------------------------------------------ */
+
+/* The drivers compile or load their kernels when the first config and
+ * context of a kind are created, and when the first pictures of a kind
+ * are processed. A warm-up pays for that on a background thread before
+ * the first stream needs it */
+
+#define PREWARM_SIZE 128
+
+enum
+{
+  PREWARM_VPP_SCALE = 1 << 0,
+  PREWARM_VPP_CSC = 1 << 1,
+  PREWARM_VPP_DENOISE = 1 << 2,
+  PREWARM_VPP_SHARPEN = 1 << 3,
+};
+
+typedef struct
+{
+  gchar *name;
+  GstVaapiContextUsage usage;
+  GstVaapiProfile profile;
+  GstVaapiEntrypoint entrypoint;
+  guint vpp_ops;
+} PrewarmItem;
+
+typedef struct
+{
+  GstVaapiDisplay *display;
+  GArray *items;
+} PrewarmData;
+
+static void
+prewarm_item_clear (PrewarmItem * item)
+{
+  g_free (item->name);
+}
+
+static void
+prewarm_data_free (PrewarmData * data)
+{
+  gst_object_unref (data->display);
+  g_array_unref (data->items);
+  g_slice_free (PrewarmData, data);
+}
+
+/* Looks up the profile named "<codec>-<profile>" among @profiles */
+static GstVaapiProfile
+prewarm_lookup_profile (GArray * profiles, const gchar * name)
+{
+  GstVaapiProfile profile;
+  gboolean match;
+  gchar *str;
+  guint i;
+
+  if (!profiles)
+    return GST_VAAPI_PROFILE_UNKNOWN;
+
+  for (i = 0; i < profiles->len; i++) {
+    profile = g_array_index (profiles, GstVaapiProfile, i);
+    str = g_strdup_printf ("%s-%s",
+        gst_vaapi_codec_get_name (gst_vaapi_profile_get_codec (profile)),
+        gst_vaapi_profile_get_name (profile));
+    match = g_ascii_strcasecmp (str, name) == 0;
+    g_free (str);
+    if (match)
+      return profile;
+  }
+  return GST_VAAPI_PROFILE_UNKNOWN;
+}
+
+static gboolean
+prewarm_parse_vpp (PrewarmItem * item, const gchar * ops)
+{
+  static const struct
+  {
+    const gchar *name;
+    guint op;
+  } vpp_ops[] = {
+    {"scale", PREWARM_VPP_SCALE},
+    {"csc", PREWARM_VPP_CSC},
+    {"denoise", PREWARM_VPP_DENOISE},
+    {"sharpen", PREWARM_VPP_SHARPEN},
+  };
+  gchar **tokens;
+  guint i, j = 0;
+
+  item->usage = GST_VAAPI_CONTEXT_USAGE_VPP;
+  if (!ops) {
+    item->vpp_ops = PREWARM_VPP_SCALE | PREWARM_VPP_CSC;
+    return TRUE;
+  }
+
+  tokens = g_strsplit (ops, "+", -1);
+  for (i = 0; tokens[i]; i++) {
+    for (j = 0; j < G_N_ELEMENTS (vpp_ops); j++) {
+      if (g_ascii_strcasecmp (tokens[i], vpp_ops[j].name) == 0)
+        break;
+    }
+    if (j == G_N_ELEMENTS (vpp_ops))
+      break;
+    item->vpp_ops |= vpp_ops[j].op;
+  }
+  g_strfreev (tokens);
+  return j < G_N_ELEMENTS (vpp_ops) && item->vpp_ops != 0;
+}
+
+static gboolean
+prewarm_parse_item (GstVaapiDisplay * display, const gchar * spec,
+    PrewarmItem * item)
+{
+  const gchar *mode;
+  gchar *name;
+  GArray *profiles;
+  gboolean success = FALSE;
+
+  memset (item, 0, sizeof (*item));
+  mode = strchr (spec, ':');
+  name = mode ? g_strndup (spec, mode - spec) : g_strdup (spec);
+  if (mode)
+    mode++;
+
+  if (g_ascii_strcasecmp (name, "vpp") == 0) {
+    success = prewarm_parse_vpp (item, mode) &&
+        gst_vaapi_display_has_video_processing (display);
+    goto done;
+  }
+  if (!mode)
+    goto done;
+
+  if (g_ascii_strcasecmp (mode, "decode") == 0) {
+    item->usage = GST_VAAPI_CONTEXT_USAGE_DECODE;
+    item->entrypoint = GST_VAAPI_ENTRYPOINT_VLD;
+    profiles = gst_vaapi_display_get_decode_profiles (display);
+  } else if (g_ascii_strcasecmp (mode, "encode") == 0
+      || g_ascii_strcasecmp (mode, "encode-lp") == 0) {
+    item->usage = GST_VAAPI_CONTEXT_USAGE_ENCODE;
+    item->entrypoint = mode[6] ? GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP :
+        GST_VAAPI_ENTRYPOINT_SLICE_ENCODE;
+    profiles = gst_vaapi_display_get_encode_profiles (display);
+  } else
+    goto done;
+
+  item->profile = prewarm_lookup_profile (profiles, name);
+  if (profiles)
+    g_array_unref (profiles);
+  if (item->profile == GST_VAAPI_PROFILE_UNKNOWN)
+    goto done;
+
+  if (item->usage == GST_VAAPI_CONTEXT_USAGE_ENCODE) {
+    if (gst_vaapi_profile_get_codec (item->profile) == GST_VAAPI_CODEC_JPEG)
+      item->entrypoint = GST_VAAPI_ENTRYPOINT_PICTURE_ENCODE;
+    success = gst_vaapi_display_has_encoder (display, item->profile,
+        item->entrypoint);
+  } else {
+    success = gst_vaapi_display_has_decoder (display, item->profile,
+        item->entrypoint);
+  }
+
+done:
+  if (success)
+    item->name = g_strdup (spec);
+  g_free (name);
+  return success;
+}
+
+/* Creates and releases a small context, which loads the kernels of the
+   profile and entrypoint */
+static gboolean
+prewarm_context (GstVaapiDisplay * display, const PrewarmItem * item)
+{
+  static const GstVaapiChromaType chroma_types[] = {
+    GST_VAAPI_CHROMA_TYPE_YUV420, GST_VAAPI_CHROMA_TYPE_YUV420_10BPP,
+  };
+  GstVaapiContextInfo cip = { 0, };
+  GstVaapiContext *context = NULL;
+  guint i;
+
+  cip.usage = item->usage;
+  cip.profile = item->profile;
+  cip.entrypoint = item->entrypoint;
+  cip.width = PREWARM_SIZE;
+  cip.height = PREWARM_SIZE;
+  cip.ref_frames = 1;
+  if (item->usage == GST_VAAPI_CONTEXT_USAGE_ENCODE)
+    cip.config.encoder.rc_mode = GST_VAAPI_RATECONTROL_CQP;
+
+  for (i = 0; i < G_N_ELEMENTS (chroma_types) && !context; i++) {
+    cip.chroma_type = chroma_types[i];
+    context = gst_vaapi_context_new (display, &cip);
+  }
+  if (!context)
+    return FALSE;
+  gst_vaapi_context_unref (context);
+  return TRUE;
+}
+
+static gboolean
+prewarm_filter_pass (GstVaapiFilter * filter, GstVaapiSurface * src_surface,
+    GstVideoFormat format, guint size)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (src_surface);
+  GstVaapiSurface *dst_surface;
+  GstVaapiFilterStatus status;
+
+  if (!gst_vaapi_filter_set_format (filter, format))
+    return FALSE;
+  dst_surface = gst_vaapi_surface_new_with_format (display, format, size,
+      size, 0);
+  if (!dst_surface)
+    return FALSE;
+  status = gst_vaapi_filter_process (filter, src_surface, dst_surface, 0);
+  if (status == GST_VAAPI_FILTER_STATUS_SUCCESS)
+    gst_vaapi_surface_sync (dst_surface);
+  gst_vaapi_surface_unref (dst_surface);
+  return status == GST_VAAPI_FILTER_STATUS_SUCCESS;
+}
+
+/* Runs one pass of each of the filter operations of @item */
+static gboolean
+prewarm_filter (GstVaapiDisplay * display, const PrewarmItem * item)
+{
+  GstVaapiFilter *filter;
+  GstVaapiSurface *src_surface;
+  gboolean success = TRUE;
+
+  filter = gst_vaapi_filter_new (display);
+  if (!filter)
+    return FALSE;
+  src_surface = gst_vaapi_surface_new_with_format (display,
+      GST_VIDEO_FORMAT_NV12, PREWARM_SIZE, PREWARM_SIZE, 0);
+  if (!src_surface) {
+    gst_object_unref (filter);
+    return FALSE;
+  }
+
+  if (item->vpp_ops & PREWARM_VPP_SCALE) {
+    success &= gst_vaapi_filter_set_scaling (filter,
+        GST_VAAPI_SCALE_METHOD_HQ);
+    success &= prewarm_filter_pass (filter, src_surface,
+        GST_VIDEO_FORMAT_NV12, PREWARM_SIZE / 2);
+    gst_vaapi_filter_set_scaling (filter, GST_VAAPI_SCALE_METHOD_DEFAULT);
+  }
+  if (item->vpp_ops & PREWARM_VPP_CSC)
+    success &= prewarm_filter_pass (filter, src_surface,
+        GST_VIDEO_FORMAT_BGRA, PREWARM_SIZE);
+  if (item->vpp_ops & PREWARM_VPP_DENOISE) {
+    success &= gst_vaapi_filter_set_denoising_level (filter, 0.5);
+    success &= prewarm_filter_pass (filter, src_surface,
+        GST_VIDEO_FORMAT_NV12, PREWARM_SIZE);
+    gst_vaapi_filter_set_denoising_level (filter, 0.0);
+  }
+  if (item->vpp_ops & PREWARM_VPP_SHARPEN) {
+    success &= gst_vaapi_filter_set_sharpening_level (filter, 0.5);
+    success &= prewarm_filter_pass (filter, src_surface,
+        GST_VIDEO_FORMAT_NV12, PREWARM_SIZE);
+  }
+
+  gst_vaapi_surface_unref (src_surface);
+  gst_object_unref (filter);
+  return success;
+}
+
+static gpointer
+prewarm_thread (PrewarmData * data)
+{
+  GstClockTime start;
+  gboolean success;
+  guint i;
+
+  for (i = 0; i < data->items->len; i++) {
+    const PrewarmItem *const item =
+        &g_array_index (data->items, PrewarmItem, i);
+
+    start = gst_util_get_timestamp ();
+    if (item->usage == GST_VAAPI_CONTEXT_USAGE_VPP)
+      success = prewarm_filter (data->display, item);
+    else
+      success = prewarm_context (data->display, item);
+    if (success)
+      GST_INFO ("warmed up %s in %" GST_TIME_FORMAT, item->name,
+          GST_TIME_ARGS (gst_util_get_timestamp () - start));
+    else
+      GST_WARNING ("failed to warm up %s", item->name);
+  }
+
+  prewarm_data_free (data);
+  return NULL;
+}
+
+/**
+ * gst_vaapi_display_prewarm:
+ * @display: a #GstVaapiDisplay
+ * @spec: a comma separated list of the operations to warm up
+ *
+ * Has the driver behind @display compile or load the kernels of the
+ * operations listed in @spec on a background thread, so that the first
+ * streams using them start at the steady-state speed. An operation is
+ * either "<codec>-<profile>:<decode|encode|encode-lp>", like
+ * "h264-high:decode", for which a small context is created, or
+ * "vpp[:<ops>]", for which small surfaces are processed with each of
+ * the '+' separated "scale", "csc", "denoise" and "sharpen" filter
+ * operations. "vpp" alone stands for "vpp:scale+csc".
+ *
+ * The operations the driver doesn't support are skipped with a
+ * warning.
+ *
+ * Returns: %TRUE if the warm-up of at least one operation started
+ **/
+gboolean
+gst_vaapi_display_prewarm (GstVaapiDisplay * display, const gchar * spec)
+{
+  PrewarmData *data;
+  PrewarmItem item;
+  GThread *thread;
+  gchar **tokens;
+  guint i;
+
+  g_return_val_if_fail (display != NULL, FALSE);
+  g_return_val_if_fail (spec != NULL, FALSE);
+
+  data = g_slice_new (PrewarmData);
+  data->display = gst_object_ref (display);
+  data->items = g_array_new (FALSE, FALSE, sizeof (PrewarmItem));
+  g_array_set_clear_func (data->items, (GDestroyNotify) prewarm_item_clear);
+
+  tokens = g_strsplit (spec, ",", -1);
+  for (i = 0; tokens[i]; i++) {
+    g_strstrip (tokens[i]);
+    if (!*tokens[i])
+      continue;
+    if (prewarm_parse_item (display, tokens[i], &item))
+      g_array_append_val (data->items, item);
+    else
+      GST_WARNING ("can't warm up %s, skipping", tokens[i]);
+  }
+  g_strfreev (tokens);
+
+  if (data->items->len == 0)
+    goto error_no_items;
+
+  thread = g_thread_try_new ("vaapi-prewarm", (GThreadFunc) prewarm_thread,
+      data, NULL);
+  if (!thread)
+    goto error_thread;
+  g_thread_unref (thread);
+  return TRUE;
+
+  /* ERRORS */
+error_no_items:
+  {
+    prewarm_data_free (data);
+    return FALSE;
+  }
+error_thread:
+  {
+    GST_WARNING ("failed to create the warm-up thread");
+    prewarm_data_free (data);
+    return FALSE;
+  }
 }
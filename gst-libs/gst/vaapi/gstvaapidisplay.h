@@ -123,6 +123,43 @@ typedef enum
   GST_VAAPI_DRIVER_QUIRK_JPEG_DEC_BROKEN_FORMATS = (1U << 6),
 } GstVaapiDriverQuirks;
 
+/**
+ * GstVaapiDisplayResource:
+ * @GST_VAAPI_DISPLAY_RESOURCE_SURFACE: VA surfaces.
+ * @GST_VAAPI_DISPLAY_RESOURCE_IMAGE: VA images.
+ * @GST_VAAPI_DISPLAY_RESOURCE_CODED_BUFFER: VA coded buffers.
+ * @GST_VAAPI_DISPLAY_RESOURCE_SUBPICTURE: VA subpictures.
+ *
+ * The kinds of VA objects whose usage is accounted per display, see
+ * gst_vaapi_display_get_resource_usage().
+ */
+typedef enum
+{
+  GST_VAAPI_DISPLAY_RESOURCE_SURFACE = 0,
+  GST_VAAPI_DISPLAY_RESOURCE_IMAGE,
+  GST_VAAPI_DISPLAY_RESOURCE_CODED_BUFFER,
+  GST_VAAPI_DISPLAY_RESOURCE_SUBPICTURE,
+
+  /*< private >*/
+  GST_VAAPI_DISPLAY_RESOURCE_COUNT
+} GstVaapiDisplayResource;
+
+/**
+ * GstVaapiDisplayLoadLevel:
+ * @GST_VAAPI_DISPLAY_LOAD_NORMAL: the elements keep up with real time.
+ * @GST_VAAPI_DISPLAY_LOAD_HIGH: frames are regularly late.
+ * @GST_VAAPI_DISPLAY_LOAD_CRITICAL: most frames are late.
+ *
+ * How loaded the VA device behind a display is, as reported by the
+ * elements sharing it, see gst_vaapi_display_report_load().
+ */
+typedef enum
+{
+  GST_VAAPI_DISPLAY_LOAD_NORMAL = 0,
+  GST_VAAPI_DISPLAY_LOAD_HIGH,
+  GST_VAAPI_DISPLAY_LOAD_CRITICAL,
+} GstVaapiDisplayLoadLevel;
+
 /**
  * GstVaapiDisplayType:
  * @GST_VAAPI_DISPLAY_TYPE_ANY: Automatic detection of the display type.
@@ -294,6 +331,59 @@ gst_vaapi_display_reset_texture_map (GstVaapiDisplay * display);
 gboolean
 gst_vaapi_display_has_driver_quirks (GstVaapiDisplay * display, guint quirks);
 
+gboolean
+gst_vaapi_display_get_resource_usage (GstVaapiDisplay * display,
+    GstVaapiDisplayResource resource, guint * count_ptr, guint64 * size_ptr);
+
+guint64
+gst_vaapi_display_get_encode_load (GstVaapiDisplay * display,
+    GstVaapiEntrypoint entrypoint);
+
+void
+gst_vaapi_display_report_load (GstVaapiDisplay * display,
+    gboolean overloaded);
+
+GstVaapiDisplayLoadLevel
+gst_vaapi_display_get_load_level (GstVaapiDisplay * display);
+
+guint64
+gst_vaapi_display_get_memory_budget (GstVaapiDisplay * display);
+
+gint
+gst_vaapi_display_get_numa_node (GstVaapiDisplay * display);
+
+void
+gst_vaapi_display_set_memory_budget (GstVaapiDisplay * display,
+    guint64 budget);
+
+gboolean
+gst_vaapi_display_get_lock_stats (GstVaapiDisplay * display,
+    guint64 * count_ptr, GstClockTime * time_ptr);
+
+gboolean
+gst_vaapi_display_get_startup_times (GstVaapiDisplay * display,
+    GstClockTime * init_time_ptr, GstClockTime * probe_time_ptr);
+
+void
+gst_vaapi_display_dump_lock_profile (GstVaapiDisplay * display);
+
+gboolean
+gst_vaapi_display_prewarm (GstVaapiDisplay * display, const gchar * spec);
+
+gboolean
+gst_vaapi_display_get_job_scheduling (GstVaapiDisplay * display);
+
+void
+gst_vaapi_display_set_job_scheduling (GstVaapiDisplay * display,
+    gboolean enabled);
+
+guint
+gst_vaapi_display_get_context_cache_size (GstVaapiDisplay * display);
+
+void
+gst_vaapi_display_set_context_cache_size (GstVaapiDisplay * display,
+    guint size);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiDisplay, gst_object_unref)
 
 G_END_DECLS
@@ -31,8 +31,10 @@
 #include <fcntl.h>
 #include <libudev.h>
 #include <xf86drm.h>
+#include <xf86drmMode.h>
 #include <va/va_drm.h>
 #include "gstvaapiutils.h"
+#include "gstvaapiutils_numa.h"
 #include "gstvaapidisplay_priv.h"
 #include "gstvaapidisplay_drm.h"
 #include "gstvaapidisplay_drm_priv.h"
@@ -69,77 +71,167 @@ supports_vaapi (int fd)
   return ret;
 }
 
-/* Get default device path. Actually, the first match in the DRM subsystem */
-static const gchar *
-get_default_device_path (GstVaapiDisplay * display)
+/* VA capable devices, per DRMDeviceType, guarded by
+   g_drm_device_type_lock */
+static GPtrArray *g_drm_devices[DRM_DEVICE_RENDERNODES + 1];
+static guint g_drm_device_next;
+
+static gint g_drm_device_policy = -1;
+
+/* Live displays, for GST_VAAPI_DRM_DEVICE_POLICY_LEAST_LOADED */
+static GList *g_drm_displays;
+static GMutex g_drm_displays_lock;
+
+/* Lists the device paths supporting VA-API, in the DRM subsystem order */
+static GPtrArray *
+get_vaapi_devices (void)
 {
-  GstVaapiDisplayDRMPrivate *const priv =
-      GST_VAAPI_DISPLAY_DRM_PRIVATE (display);
   const gchar *syspath, *devpath;
   struct udev *udev = NULL;
   struct udev_device *device, *parent;
   struct udev_enumerate *e = NULL;
   struct udev_list_entry *l;
+  GPtrArray *devices;
   gint i;
   int fd;
 
-  if (!priv->device_path_default) {
-    udev = udev_new ();
-    if (!udev)
-      goto end;
-
-    e = udev_enumerate_new (udev);
-    if (!e)
-      goto end;
-
-    udev_enumerate_add_match_subsystem (e, "drm");
-    switch (g_drm_device_type) {
-      case DRM_DEVICE_LEGACY:
-        udev_enumerate_add_match_sysname (e, "card[0-9]*");
-        break;
-      case DRM_DEVICE_RENDERNODES:
-        udev_enumerate_add_match_sysname (e, "renderD[0-9]*");
+  if (g_drm_device_type < DRM_DEVICE_LEGACY
+      || g_drm_device_type > DRM_DEVICE_RENDERNODES) {
+    GST_ERROR ("unknown drm device type (%d)", g_drm_device_type);
+    return NULL;
+  }
+  if (g_drm_devices[g_drm_device_type])
+    return g_drm_devices[g_drm_device_type];
+
+  udev = udev_new ();
+  if (!udev)
+    return NULL;
+
+  e = udev_enumerate_new (udev);
+  if (!e)
+    goto end;
+
+  devices = g_ptr_array_new_with_free_func (g_free);
+
+  udev_enumerate_add_match_subsystem (e, "drm");
+  if (g_drm_device_type == DRM_DEVICE_LEGACY)
+    udev_enumerate_add_match_sysname (e, "card[0-9]*");
+  else
+    udev_enumerate_add_match_sysname (e, "renderD[0-9]*");
+  udev_enumerate_scan_devices (e);
+  udev_list_entry_foreach (l, udev_enumerate_get_list_entry (e)) {
+    syspath = udev_list_entry_get_name (l);
+    device = udev_device_new_from_syspath (udev, syspath);
+    parent = udev_device_get_parent (device);
+
+    for (i = 0; allowed_subsystems[i] != NULL; i++)
+      if (g_strcmp0 (udev_device_get_subsystem (parent),
+              allowed_subsystems[i]) == 0)
         break;
-      default:
-        GST_ERROR ("unknown drm device type (%d)", g_drm_device_type);
-        goto end;
-    }
-    udev_enumerate_scan_devices (e);
-    udev_list_entry_foreach (l, udev_enumerate_get_list_entry (e)) {
-      syspath = udev_list_entry_get_name (l);
-      device = udev_device_new_from_syspath (udev, syspath);
-      parent = udev_device_get_parent (device);
-
-      for (i = 0; allowed_subsystems[i] != NULL; i++)
-        if (g_strcmp0 (udev_device_get_subsystem (parent),
-                allowed_subsystems[i]) == 0)
-          break;
-
-      if (allowed_subsystems[i] == NULL) {
-        udev_device_unref (device);
-        continue;
-      }
 
-      devpath = udev_device_get_devnode (device);
-      fd = open (devpath, O_RDWR | O_CLOEXEC);
-      if (fd < 0) {
-        udev_device_unref (device);
-        continue;
-      }
+    if (allowed_subsystems[i] == NULL) {
+      udev_device_unref (device);
+      continue;
+    }
 
-      if (supports_vaapi (fd))
-        priv->device_path_default = g_strdup (devpath);
-      close (fd);
+    devpath = udev_device_get_devnode (device);
+    fd = open (devpath, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
       udev_device_unref (device);
-      if (priv->device_path_default)
-        break;
+      continue;
+    }
+
+    if (supports_vaapi (fd))
+      g_ptr_array_add (devices, g_strdup (devpath));
+    close (fd);
+    udev_device_unref (device);
+  }
+
+  if (devices->len > 0)
+    g_drm_devices[g_drm_device_type] = devices;
+  else
+    g_ptr_array_unref (devices);
+
+end:
+  if (e)
+    udev_enumerate_unref (e);
+  udev_unref (udev);
+  return g_drm_devices[g_drm_device_type];
+}
+
+/* Sums up the VA memory allocated by the displays opened on
+   @device_path */
+static guint64
+get_device_load (const gchar * device_path)
+{
+  guint64 load = 0, size;
+  GList *l;
+  guint i;
+
+  g_mutex_lock (&g_drm_displays_lock);
+  for (l = g_drm_displays; l != NULL; l = l->next) {
+    GstVaapiDisplay *const display = l->data;
+    GstVaapiDisplayDRMPrivate *const priv =
+        GST_VAAPI_DISPLAY_DRM_PRIVATE (display);
+
+    if (g_strcmp0 (priv->device_path, device_path) != 0)
+      continue;
+
+    /* Count each display too, so that idle ones still spread out */
+    load++;
+    for (i = 0; i < GST_VAAPI_DISPLAY_RESOURCE_COUNT; i++) {
+      if (gst_vaapi_display_get_resource_usage (display, i, NULL, &size))
+        load += size;
     }
+  }
+  g_mutex_unlock (&g_drm_displays_lock);
+  return load;
+}
 
-  end:
-    if (e)
-      udev_enumerate_unref (e);
-    if (udev)
-      udev_unref (udev);
+static const gchar *
+select_device_path (GPtrArray * devices)
+{
+  const gchar *device_path = g_ptr_array_index (devices, 0);
+  guint64 load, min_load;
+  guint i;
+
+  switch (gst_vaapi_display_drm_get_device_policy ()) {
+    case GST_VAAPI_DRM_DEVICE_POLICY_ROUND_ROBIN:
+      device_path = g_ptr_array_index (devices,
+          g_drm_device_next++ % devices->len);
+      break;
+    case GST_VAAPI_DRM_DEVICE_POLICY_LEAST_LOADED:
+      min_load = G_MAXUINT64;
+      for (i = 0; i < devices->len; i++) {
+        load = get_device_load (g_ptr_array_index (devices, i));
+        if (load < min_load) {
+          min_load = load;
+          device_path = g_ptr_array_index (devices, i);
+        }
+      }
+      break;
+    default:
+      break;
+  }
+  return device_path;
+}
+
+/* Get default device path, as selected by the device policy among the
+   DRM devices supporting VA-API */
+static const gchar *
+get_default_device_path (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayDRMPrivate *const priv =
+      GST_VAAPI_DISPLAY_DRM_PRIVATE (display);
+  GPtrArray *devices;
+
+  if (!priv->device_path_default) {
+    devices = get_vaapi_devices ();
+    if (devices) {
+      priv->device_path_default = g_strdup (select_device_path (devices));
+      GST_INFO ("selected DRM device %s out of %u",
+          priv->device_path_default, devices->len);
+    }
   }
   return priv->device_path_default;
 }
@@ -285,6 +377,10 @@ gst_vaapi_display_drm_open_display (GstVaapiDisplay * display,
     return FALSE;
   priv->use_foreign_display = FALSE;
 
+  g_mutex_lock (&g_drm_displays_lock);
+  g_drm_displays = g_list_prepend (g_drm_displays, display);
+  g_mutex_unlock (&g_drm_displays_lock);
+
   return TRUE;
 }
 
@@ -295,11 +391,21 @@ gst_vaapi_display_drm_close_display (GstVaapiDisplay * display)
       GST_VAAPI_DISPLAY_DRM_PRIVATE (display);
 
   if (priv->drm_device >= 0) {
-    if (!priv->use_foreign_display)
+    if (!priv->use_foreign_display) {
+      g_mutex_lock (&g_drm_displays_lock);
+      g_drm_displays = g_list_remove (g_drm_displays, display);
+      g_mutex_unlock (&g_drm_displays_lock);
       close (priv->drm_device);
+    }
     priv->drm_device = -1;
   }
 
+  if (priv->kms_device >= 0) {
+    close (priv->kms_device);
+    priv->kms_device = -1;
+  }
+  priv->kms_probed = FALSE;
+
   g_clear_pointer (&priv->device_path, g_free);
   g_clear_pointer (&priv->device_path_default, g_free);
 }
@@ -321,6 +427,43 @@ gst_vaapi_display_drm_get_display_info (GstVaapiDisplay * display,
   return TRUE;
 }
 
+static void
+gst_vaapi_display_drm_get_size (GstVaapiDisplay * display,
+    guint * pwidth, guint * pheight)
+{
+  GstVaapiDisplayDRMOutput output;
+
+  if (!gst_vaapi_display_drm_get_kms_output (display, &output))
+    return;
+
+  if (pwidth)
+    *pwidth = output.mode.hdisplay;
+  if (pheight)
+    *pheight = output.mode.vdisplay;
+}
+
+static void
+gst_vaapi_display_drm_get_size_mm (GstVaapiDisplay * display,
+    guint * pwidth, guint * pheight)
+{
+  GstVaapiDisplayDRMOutput output;
+
+  if (!gst_vaapi_display_drm_get_kms_output (display, &output))
+    return;
+
+  if (pwidth)
+    *pwidth = output.width_mm;
+  if (pheight)
+    *pheight = output.height_mm;
+}
+
+static gint
+gst_vaapi_display_drm_get_numa_node (GstVaapiDisplay * display)
+{
+  return gst_vaapi_numa_get_device_node (GST_VAAPI_DISPLAY_DRM_DEVICE
+      (display));
+}
+
 static GstVaapiWindow *
 gst_vaapi_display_drm_create_window (GstVaapiDisplay * display, GstVaapiID id,
     guint width, guint height)
@@ -337,6 +480,7 @@ gst_vaapi_display_drm_init (GstVaapiDisplayDRM * display)
 
   display->priv = priv;
   priv->drm_device = -1;
+  priv->kms_device = -1;
 }
 
 static void
@@ -349,7 +493,10 @@ gst_vaapi_display_drm_class_init (GstVaapiDisplayDRMClass * klass)
   dpy_class->open_display = gst_vaapi_display_drm_open_display;
   dpy_class->close_display = gst_vaapi_display_drm_close_display;
   dpy_class->get_display = gst_vaapi_display_drm_get_display_info;
+  dpy_class->get_size = gst_vaapi_display_drm_get_size;
+  dpy_class->get_size_mm = gst_vaapi_display_drm_get_size_mm;
   dpy_class->create_window = gst_vaapi_display_drm_create_window;
+  dpy_class->get_numa_node = gst_vaapi_display_drm_get_numa_node;
 }
 
 /**
@@ -360,9 +507,10 @@ gst_vaapi_display_drm_class_init (GstVaapiDisplayDRMClass * klass)
  * allocated #GstVaapiDisplay object. The DRM display will be cloed
  * when the reference count of the object reaches zero.
  *
- * If @device_path is NULL, the DRM device path will be automatically
- * determined as the first positive match in the list of available DRM
- * devices.
+ * If @device_path is NULL, the DRM device path is taken from the
+ * GST_VAAPI_DRM_DEVICE environment variable, if set. Otherwise, it is
+ * picked among the available DRM devices supporting VA-API, as set by
+ * gst_vaapi_display_drm_set_device_policy().
  *
  * Return value: a newly allocated #GstVaapiDisplay object
  */
@@ -501,3 +649,213 @@ gst_vaapi_display_drm_get_device_path (GstVaapiDisplayDRM * display)
 
   return get_device_path (GST_VAAPI_DISPLAY_CAST (display));
 }
+
+/**
+ * gst_vaapi_display_drm_get_device_policy:
+ *
+ * Returns the policy gst_vaapi_display_drm_new() follows to pick a
+ * DRM device. Unless set by gst_vaapi_display_drm_set_device_policy(),
+ * it is read from the GST_VAAPI_DRM_DEVICE_POLICY environment
+ * variable: "first" (default), "round-robin" or "least-loaded".
+ *
+ * Return value: the DRM device selection policy
+ */
+GstVaapiDRMDevicePolicy
+gst_vaapi_display_drm_get_device_policy (void)
+{
+  gint policy;
+
+  policy = g_atomic_int_get (&g_drm_device_policy);
+  if (policy < 0) {
+    const gchar *const str = g_getenv ("GST_VAAPI_DRM_DEVICE_POLICY");
+
+    if (g_strcmp0 (str, "round-robin") == 0)
+      policy = GST_VAAPI_DRM_DEVICE_POLICY_ROUND_ROBIN;
+    else if (g_strcmp0 (str, "least-loaded") == 0)
+      policy = GST_VAAPI_DRM_DEVICE_POLICY_LEAST_LOADED;
+    else
+      policy = GST_VAAPI_DRM_DEVICE_POLICY_FIRST;
+    g_atomic_int_compare_and_exchange (&g_drm_device_policy, -1, policy);
+  }
+  return policy;
+}
+
+/**
+ * gst_vaapi_display_drm_set_device_policy:
+ * @policy: a #GstVaapiDRMDevicePolicy
+ *
+ * Sets how gst_vaapi_display_drm_new() picks a DRM device for the
+ * displays created afterwards, also through gst_vaapi_create_display()
+ * by the VA-API elements. An explicit device path, or the
+ * GST_VAAPI_DRM_DEVICE environment variable, still take precedence.
+ */
+void
+gst_vaapi_display_drm_set_device_policy (GstVaapiDRMDevicePolicy policy)
+{
+  g_atomic_int_set (&g_drm_device_policy, policy);
+}
+
+/* Opens the modesetting node of the device behind @drm_device, which
+   usually is a render node */
+static gint
+open_kms_device (gint drm_device)
+{
+  drmModeRes *res;
+  drmDevicePtr device;
+  gint fd = -1;
+
+  res = drmModeGetResources (drm_device);
+  if (res) {
+    drmModeFreeResources (res);
+    return dup (drm_device);
+  }
+
+  if (drmGetDevice2 (drm_device, 0, &device) != 0)
+    return -1;
+  if (device->available_nodes & (1 << DRM_NODE_PRIMARY))
+    fd = open (device->nodes[DRM_NODE_PRIMARY], O_RDWR | O_CLOEXEC);
+  drmFreeDevice (&device);
+  return fd;
+}
+
+/**
+ * gst_vaapi_display_drm_get_kms_device:
+ * @display: a #GstVaapiDisplayDRM
+ *
+ * Opens the DRM node @display can drive the outputs of the device
+ * with, on first call.
+ *
+ * Return value: the KMS file descriptor, or -1 if the device has no
+ *   output or cannot be opened for modesetting
+ */
+gint
+gst_vaapi_display_drm_get_kms_device (GstVaapiDisplay * display)
+{
+  GstVaapiDisplayDRMPrivate *const priv =
+      GST_VAAPI_DISPLAY_DRM_PRIVATE (display);
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  if (!priv->kms_probed && priv->drm_device >= 0) {
+    priv->kms_device = open_kms_device (priv->drm_device);
+    if (priv->kms_device < 0)
+      GST_INFO ("no KMS device for %s", priv->device_path);
+    priv->kms_probed = TRUE;
+  }
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  return priv->kms_device;
+}
+
+/* Finds a CRTC @connector can be driven by */
+static guint32
+find_crtc (gint fd, drmModeRes * res, drmModeConnector * connector)
+{
+  drmModeEncoder *encoder;
+  guint32 crtc_id = 0;
+  gint i, j;
+
+  for (i = 0; i < connector->count_encoders && !crtc_id; i++) {
+    encoder = drmModeGetEncoder (fd, connector->encoders[i]);
+    if (!encoder)
+      continue;
+    for (j = 0; j < res->count_crtcs; j++) {
+      if (encoder->possible_crtcs & (1 << j)) {
+        crtc_id = res->crtcs[j];
+        break;
+      }
+    }
+    drmModeFreeEncoder (encoder);
+  }
+  return crtc_id;
+}
+
+static gboolean
+get_connector_output (gint fd, drmModeRes * res,
+    drmModeConnector * connector, GstVaapiDisplayDRMOutput * output)
+{
+  drmModeEncoder *encoder;
+  drmModeCrtc *crtc;
+  gint i;
+
+  memset (output, 0, sizeof (*output));
+  output->connector_id = connector->connector_id;
+  output->width_mm = connector->mmWidth;
+  output->height_mm = connector->mmHeight;
+
+  /* Keep the current mode if the connector is lit up */
+  if (connector->encoder_id) {
+    encoder = drmModeGetEncoder (fd, connector->encoder_id);
+    if (encoder) {
+      output->crtc_id = encoder->crtc_id;
+      drmModeFreeEncoder (encoder);
+    }
+  }
+  if (output->crtc_id) {
+    crtc = drmModeGetCrtc (fd, output->crtc_id);
+    if (crtc) {
+      if (crtc->mode_valid) {
+        output->mode = crtc->mode;
+        output->mode_set = TRUE;
+      }
+      drmModeFreeCrtc (crtc);
+    }
+  }
+
+  if (!output->mode_set) {
+    output->crtc_id = find_crtc (fd, res, connector);
+    if (!output->crtc_id)
+      return FALSE;
+    output->mode = connector->modes[0];
+    for (i = 0; i < connector->count_modes; i++) {
+      if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+        output->mode = connector->modes[i];
+        break;
+      }
+    }
+  }
+
+  for (i = 0; i < res->count_crtcs; i++) {
+    if (res->crtcs[i] == output->crtc_id)
+      break;
+  }
+  output->crtc_index = i;
+  return i < res->count_crtcs;
+}
+
+/**
+ * gst_vaapi_display_drm_get_kms_output:
+ * @display: a #GstVaapiDisplayDRM
+ * @output: return location for the output
+ *
+ * Looks up the first connected output of the device.
+ *
+ * Return value: %TRUE if an output was found
+ */
+gboolean
+gst_vaapi_display_drm_get_kms_output (GstVaapiDisplay * display,
+    GstVaapiDisplayDRMOutput * output)
+{
+  drmModeRes *res;
+  drmModeConnector *connector;
+  gboolean found = FALSE;
+  gint i, fd;
+
+  fd = gst_vaapi_display_drm_get_kms_device (display);
+  if (fd < 0)
+    return FALSE;
+
+  res = drmModeGetResources (fd);
+  if (!res)
+    return FALSE;
+
+  for (i = 0; i < res->count_connectors && !found; i++) {
+    connector = drmModeGetConnector (fd, res->connectors[i]);
+    if (!connector)
+      continue;
+    if (connector->connection == DRM_MODE_CONNECTED
+        && connector->count_modes > 0)
+      found = get_connector_output (fd, res, connector, output);
+    drmModeFreeConnector (connector);
+  }
+  drmModeFreeResources (res);
+  return found;
+}
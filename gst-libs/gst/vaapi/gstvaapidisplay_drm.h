@@ -33,6 +33,25 @@ G_BEGIN_DECLS
 
 typedef struct _GstVaapiDisplayDRM              GstVaapiDisplayDRM;
 
+/**
+ * GstVaapiDRMDevicePolicy:
+ * @GST_VAAPI_DRM_DEVICE_POLICY_FIRST: use the first DRM device
+ *   supporting VA-API
+ * @GST_VAAPI_DRM_DEVICE_POLICY_ROUND_ROBIN: cycle through the DRM
+ *   devices supporting VA-API, one per new display
+ * @GST_VAAPI_DRM_DEVICE_POLICY_LEAST_LOADED: use the DRM device with
+ *   the least VA memory allocated by the displays of the process
+ *
+ * How gst_vaapi_display_drm_new() picks a DRM device when none is
+ * given.
+ */
+typedef enum
+{
+  GST_VAAPI_DRM_DEVICE_POLICY_FIRST = 0,
+  GST_VAAPI_DRM_DEVICE_POLICY_ROUND_ROBIN,
+  GST_VAAPI_DRM_DEVICE_POLICY_LEAST_LOADED,
+} GstVaapiDRMDevicePolicy;
+
 GstVaapiDisplay *
 gst_vaapi_display_drm_new (const gchar * device_path);
 
@@ -49,6 +68,12 @@ const gchar *
 gst_vaapi_display_drm_get_device_path (GstVaapiDisplayDRM *
     display);
 
+GstVaapiDRMDevicePolicy
+gst_vaapi_display_drm_get_device_policy (void);
+
+void
+gst_vaapi_display_drm_set_device_policy (GstVaapiDRMDevicePolicy policy);
+
 GType
 gst_vaapi_display_drm_get_type (void) G_GNUC_CONST;
 
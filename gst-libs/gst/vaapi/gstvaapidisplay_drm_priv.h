@@ -24,6 +24,7 @@
 #define GST_VAAPI_DISPLAY_DRM_PRIV_H
 
 #include <gst/vaapi/gstvaapidisplay_drm.h>
+#include <xf86drmMode.h>
 #include "gstvaapidisplay_priv.h"
 
 G_BEGIN_DECLS
@@ -53,12 +54,39 @@ typedef struct _GstVaapiDisplayDRMClass         GstVaapiDisplayDRMClass;
 #define GST_VAAPI_DISPLAY_DRM_DEVICE(display) \
     GST_VAAPI_DISPLAY_DRM_PRIVATE(display)->drm_device
 
+/**
+ * GstVaapiDisplayDRMOutput:
+ * @connector_id: the connected DRM connector
+ * @crtc_id: the CRTC driving @connector_id
+ * @crtc_index: the index of @crtc_id in the device resources
+ * @mode: the current mode of @crtc_id, or the preferred one of
+ *   @connector_id if it is off
+ * @mode_set: whether @mode is already programmed
+ * @width_mm: the physical width of the output
+ * @height_mm: the physical height of the output
+ *
+ * A KMS output, that is a connector and the CRTC it is scanned out
+ * from.
+ */
+typedef struct
+{
+  guint32 connector_id;
+  guint32 crtc_id;
+  guint crtc_index;
+  drmModeModeInfo mode;
+  gboolean mode_set;
+  guint width_mm;
+  guint height_mm;
+} GstVaapiDisplayDRMOutput;
+
 struct _GstVaapiDisplayDRMPrivate
 {
   gchar *device_path_default;
   gchar *device_path;
   gint drm_device;
+  gint kms_device;
   guint use_foreign_display:1;  // Foreign native_display?
+  guint kms_probed:1;
 };
 
 /**
@@ -85,6 +113,15 @@ struct _GstVaapiDisplayDRMClass
   GstVaapiDisplayClass parent_class;
 };
 
+G_GNUC_INTERNAL
+gint
+gst_vaapi_display_drm_get_kms_device (GstVaapiDisplay * display);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_display_drm_get_kms_output (GstVaapiDisplay * display,
+    GstVaapiDisplayDRMOutput * output);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_DISPLAY_DRM_PRIV_H */
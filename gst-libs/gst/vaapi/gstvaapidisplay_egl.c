@@ -34,6 +34,9 @@
 #if USE_WAYLAND
 #include "gstvaapidisplay_wayland.h"
 #endif
+#if USE_DRM
+#include "gstvaapidisplay_drm.h"
+#endif
 
 #define DEBUG_VAAPI_DISPLAY 1
 #include "gstvaapidebug.h"
@@ -119,6 +122,11 @@ gst_vaapi_display_egl_bind_display (GstVaapiDisplay * base_display,
 #if USE_WAYLAND
     if (!native_vaapi_display)
       native_vaapi_display = gst_vaapi_display_wayland_new (NULL);
+#endif
+#if USE_DRM
+    /* Headless: render through the surfaceless platform */
+    if (!native_vaapi_display)
+      native_vaapi_display = gst_vaapi_display_drm_new (NULL);
 #endif
   } else {
     /* thus it could be assigned to parent */
@@ -137,15 +145,20 @@ gst_vaapi_display_egl_bind_display (GstVaapiDisplay * base_display,
     case GST_VAAPI_DISPLAY_TYPE_WAYLAND:
       gl_platform = EGL_PLATFORM_WAYLAND;
       break;
+    case GST_VAAPI_DISPLAY_TYPE_DRM:
+      gl_platform = EGL_PLATFORM_SURFACELESS;
+      break;
     default:
       break;
   }
 
   if (native_egl_display) {
     egl_display = egl_display_new_wrapped (native_egl_display);
+  } else if (gl_platform == EGL_PLATFORM_SURFACELESS) {
+    egl_display = egl_display_new (NULL, gl_platform, -1);
   } else {
     egl_display = egl_display_new (GST_VAAPI_DISPLAY_NATIVE (display->display),
-        gl_platform);
+        gl_platform, gst_vaapi_display_get_numa_node (display->display));
   }
   if (!egl_display)
     return FALSE;
@@ -248,6 +261,16 @@ gst_vaapi_display_egl_get_size_mm (GstVaapiDisplay * base_display,
     klass->get_size_mm (display->display, width_ptr, height_ptr);
 }
 
+static gint
+gst_vaapi_display_egl_get_numa_node (GstVaapiDisplay * base_display)
+{
+  GstVaapiDisplayEGL *display = GST_VAAPI_DISPLAY_EGL (base_display);
+
+  if (!display->display)
+    return -1;
+  return gst_vaapi_display_get_numa_node (display->display);
+}
+
 static guintptr
 gst_vaapi_display_egl_get_visual_id (GstVaapiDisplay * base_display,
     GstVaapiWindow * window)
@@ -285,7 +308,10 @@ gst_vaapi_display_egl_create_texture (GstVaapiDisplay * display, GstVaapiID id,
     return gst_vaapi_texture_egl_new (display, target, format, width, height);
 
   ensure_texture_map (dpy);
-  if (!(texture = gst_vaapi_texture_map_lookup (dpy->texture_map, id))) {
+  /* A stale binding is replaced by the new one */
+  texture = gst_vaapi_texture_map_lookup_full (dpy->texture_map, id, target,
+      format, width, height);
+  if (!texture) {
     if ((texture =
             gst_vaapi_texture_egl_new_wrapped (display, id, target, format,
                 width, height))) {
@@ -348,6 +374,7 @@ gst_vaapi_display_egl_class_init (GstVaapiDisplayEGLClass * klass)
   dpy_class->create_window = gst_vaapi_display_egl_create_window;
   dpy_class->create_texture = gst_vaapi_display_egl_create_texture;
   dpy_class->get_texture_map = gst_vaapi_display_egl_get_texture_map;
+  dpy_class->get_numa_node = gst_vaapi_display_egl_get_numa_node;
 }
 
 /**
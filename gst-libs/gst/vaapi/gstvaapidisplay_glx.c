@@ -71,7 +71,10 @@ gst_vaapi_display_glx_create_texture (GstVaapiDisplay * display, GstVaapiID id,
     return gst_vaapi_texture_glx_new (display, target, format, width, height);
 
   ensure_texture_map (dpy);
-  if (!(texture = gst_vaapi_texture_map_lookup (dpy->texture_map, id))) {
+  /* A stale binding is replaced by the new one */
+  texture = gst_vaapi_texture_map_lookup_full (dpy->texture_map, id, target,
+      format, 0, 0);
+  if (!texture) {
     if ((texture =
             gst_vaapi_texture_glx_new_wrapped (display, id, target, format))) {
       gst_vaapi_texture_map_add (dpy->texture_map, texture, id);
@@ -107,6 +107,32 @@ typedef enum _GstVaapiDisplayInitType           GstVaapiDisplayInitType;
 #define GST_VAAPI_DISPLAY_HAS_VPP(display) \
   gst_vaapi_display_has_video_processing (GST_VAAPI_DISPLAY_CAST (display))
 
+/**
+ * GST_VAAPI_DISPLAY_LOCK_CONTEXT:
+ * @display: a #GstVaapiDisplay
+ * @mutex: (nullable): a #GRecMutex serializing the uses of a VA
+ *   context, or %NULL
+ *
+ * Locks @display for VA calls that only involve a single VA context,
+ * or objects the caller owns like surfaces, images or buffers. With
+ * fine-grained locking, only @mutex, if any, is locked instead.
+ * This is an internal macro that does not do any run-time type check.
+ */
+#define GST_VAAPI_DISPLAY_LOCK_CONTEXT(display, mutex) \
+  gst_vaapi_display_lock_context (GST_VAAPI_DISPLAY_CAST (display), mutex)
+
+/**
+ * GST_VAAPI_DISPLAY_UNLOCK_CONTEXT:
+ * @display: a #GstVaapiDisplay
+ * @mutex: (nullable): the #GRecMutex given to
+ *   GST_VAAPI_DISPLAY_LOCK_CONTEXT()
+ *
+ * Unlocks @display, or @mutex with fine-grained locking.
+ * This is an internal macro that does not do any run-time type check.
+ */
+#define GST_VAAPI_DISPLAY_UNLOCK_CONTEXT(display, mutex) \
+  gst_vaapi_display_unlock_context (GST_VAAPI_DISPLAY_CAST (display), mutex)
+
 struct _GstVaapiDisplayPrivate
 {
   GstVaapiDisplay *parent;
@@ -131,7 +157,46 @@ struct _GstVaapiDisplayPrivate
   guint has_vpp:1;
   guint has_profiles:1;
   guint got_scrres:1;
+  guint got_vpp:1;
+  guint fine_grained_locking:1;
   guint driver_quirks;
+  guint driver_quirks_pending;
+  /* set once vaCopy() turned out to be unimplemented */
+  gint no_copy_engine;
+  guint driver_version;
+  GMutex usage_lock;
+  guint usage_count[GST_VAAPI_DISPLAY_RESOURCE_COUNT];
+  guint64 usage_size[GST_VAAPI_DISPLAY_RESOURCE_COUNT];
+  guint64 memory_budget;
+  guint context_cache_size;
+  /* macroblocks per second being encoded, by entrypoint */
+  guint64 encode_load[GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP + 1];
+  /* decayed share of late frames, see gst_vaapi_display_report_load() */
+  guint load_score;
+  GstVaapiDisplayLoadLevel load_level;
+
+  /* job scheduler, see gst_vaapi_display_job_begin() */
+  GMutex job_lock;
+  GCond job_cond;
+  GQueue job_waiters;
+  gboolean job_running;
+  gboolean job_scheduling;
+
+  /* display lock statistics, updated by the lock holder */
+  guint lock_depth;
+  GstClockTime lock_start;
+  guint64 lock_count;
+  GstClockTime lock_time;
+
+  /* display lock contention profile, see GST_VAAPI_DISPLAY_LOCK_PROFILE */
+  GHashTable *lock_profile;
+  gconstpointer lock_site;
+  GstClockTime lock_acquired;
+  GstClockTime lock_wait;
+
+  /* startup costs, see gst_vaapi_display_get_startup_times() */
+  GstClockTime init_time;
+  GstClockTime probe_time;
 };
 
 /**
@@ -163,6 +228,8 @@ struct _GstVaapiDisplay
  * @create_window: (optional) virtual function to create a window
  * @create_texture: (optional) virtual function to create a texture
  * @get_texture_map: (optional) virtual function to get texture map
+ * @get_numa_node: (optional) virtual function to get the NUMA node of
+ *   the VA device
  *
  * Base class for VA displays.
  */
@@ -192,6 +259,7 @@ struct _GstVaapiDisplayClass
   GstVaapiTexture    *(*create_texture)  (GstVaapiDisplay * display, GstVaapiID id, guint target, guint format,
     guint width, guint height);
   GstVaapiTextureMap *(*get_texture_map) (GstVaapiDisplay * display);
+  gint                (*get_numa_node)   (GstVaapiDisplay * display);
 };
 
 /* Initialization types */
@@ -206,6 +274,54 @@ GstVaapiDisplay *
 gst_vaapi_display_config (GstVaapiDisplay * display,
     GstVaapiDisplayInitType init_type, gpointer init_value);
 
+G_GNUC_INTERNAL
+void
+gst_vaapi_display_account_resource (GstVaapiDisplay * display,
+    GstVaapiDisplayResource resource, gint delta, gint64 size);
+
+static inline void
+gst_vaapi_display_lock_context (GstVaapiDisplay * display, GRecMutex * mutex)
+{
+  if (!GST_VAAPI_DISPLAY_GET_PRIVATE (display)->fine_grained_locking)
+    gst_vaapi_display_lock (display);
+  else if (mutex)
+    g_rec_mutex_lock (mutex);
+}
+
+static inline void
+gst_vaapi_display_unlock_context (GstVaapiDisplay * display,
+    GRecMutex * mutex)
+{
+  if (!GST_VAAPI_DISPLAY_GET_PRIVATE (display)->fine_grained_locking)
+    gst_vaapi_display_unlock (display);
+  else if (mutex)
+    g_rec_mutex_unlock (mutex);
+}
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_display_account_encode_load (GstVaapiDisplay * display,
+    GstVaapiEntrypoint entrypoint, gint64 delta);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_display_fits_memory_budget (GstVaapiDisplay * display,
+    guint64 size);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_display_job_begin (GstVaapiDisplay * display,
+    GstClockTime deadline);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_display_job_end (GstVaapiDisplay * display);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_display_copy_object (GstVaapiDisplay * display,
+    gboolean is_surface, GstVaapiID dst_id, GstVaapiID src_id);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_DISPLAY_PRIV_H */
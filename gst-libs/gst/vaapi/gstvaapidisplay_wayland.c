@@ -140,6 +140,19 @@ static const struct zwp_linux_dmabuf_v1_listener dmabuf_listener = {
   dmabuf_modifier,
 };
 
+static void
+presentation_clock_id (void *data, struct wp_presentation *presentation,
+    uint32_t clk_id)
+{
+  GstVaapiDisplayWaylandPrivate *const priv = data;
+
+  GST_DEBUG ("presentation clock id %u", clk_id);
+  priv->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+  presentation_clock_id,
+};
 
 static void
 registry_handle_global (void *data,
@@ -149,8 +162,8 @@ registry_handle_global (void *data,
   GstVaapiDisplayWaylandPrivate *const priv = data;
 
   if (strcmp (interface, "wl_compositor") == 0)
-    priv->compositor =
-        wl_registry_bind (registry, id, &wl_compositor_interface, 1);
+    priv->compositor = wl_registry_bind (registry, id,
+        &wl_compositor_interface, MIN (version, 2));
   else if (strcmp (interface, "wl_subcompositor") == 0)
     priv->subcompositor =
         wl_registry_bind (registry, id, &wl_subcompositor_interface, 1);
@@ -169,6 +182,11 @@ registry_handle_global (void *data,
     priv->dmabuf =
         wl_registry_bind (registry, id, &zwp_linux_dmabuf_v1_interface, 3);
     zwp_linux_dmabuf_v1_add_listener (priv->dmabuf, &dmabuf_listener, priv);
+  } else if (strcmp (interface, "wp_presentation") == 0) {
+    priv->presentation =
+        wl_registry_bind (registry, id, &wp_presentation_interface, 1);
+    wp_presentation_add_listener (priv->presentation, &presentation_listener,
+        priv);
   }
 }
 
@@ -254,6 +272,7 @@ gst_vaapi_display_wayland_close_display (GstVaapiDisplay * display)
   GstVaapiDisplayWaylandPrivate *const priv =
       GST_VAAPI_DISPLAY_WAYLAND_GET_PRIVATE (display);
 
+  g_clear_pointer (&priv->presentation, wp_presentation_destroy);
   g_clear_pointer (&priv->output, wl_output_destroy);
   g_clear_pointer (&priv->wl_shell, wl_shell_destroy);
   g_clear_pointer (&priv->xdg_wm_base, xdg_wm_base_destroy);
@@ -340,6 +359,7 @@ gst_vaapi_display_wayland_init (GstVaapiDisplayWayland * display)
 
   display->priv = priv;
   priv->event_fd = -1;
+  priv->presentation_clock = CLOCK_MONOTONIC;
   priv->dmabuf_formats = g_array_new (FALSE, FALSE, sizeof (GstDRMFormat));
 }
 
@@ -455,3 +475,45 @@ gst_vaapi_display_wayland_get_display (GstVaapiDisplayWayland * display)
 
   return GST_VAAPI_DISPLAY_WL_DISPLAY (display);
 }
+
+/**
+ * gst_vaapi_display_wayland_get_dmabuf_formats:
+ * @display: a #GstVaapiDisplayWayland
+ *
+ * Retrieves the video formats the compositor accepts as dma-buf
+ * buffers, with any modifier, in the order it announced them. Surfaces
+ * in one of these formats can be presented without conversion.
+ *
+ * Return value: (transfer full) (element-type GstVideoFormat): a newly
+ *   allocated array of #GstVideoFormat, empty if the compositor does
+ *   not support the linux-dmabuf protocol
+ *
+ * Since: 1.18
+ */
+GArray *
+gst_vaapi_display_wayland_get_dmabuf_formats (GstVaapiDisplayWayland * display)
+{
+  GstVaapiDisplayWaylandPrivate *priv;
+  GArray *formats;
+  GstVideoFormat format;
+  guint i, j;
+
+  g_return_val_if_fail (GST_VAAPI_IS_DISPLAY_WAYLAND (display), NULL);
+
+  priv = GST_VAAPI_DISPLAY_WAYLAND_GET_PRIVATE (display);
+  formats = g_array_new (FALSE, FALSE, sizeof (GstVideoFormat));
+
+  for (i = 0; i < priv->dmabuf_formats->len; i++) {
+    GstDRMFormat *const fmt =
+        &g_array_index (priv->dmabuf_formats, GstDRMFormat, i);
+
+    format = gst_vaapi_video_format_from_drm_format (fmt->format);
+    for (j = 0; j < formats->len; j++) {
+      if (g_array_index (formats, GstVideoFormat, j) == format)
+        break;
+    }
+    if (j == formats->len)
+      g_array_append_val (formats, format);
+  }
+  return formats;
+}
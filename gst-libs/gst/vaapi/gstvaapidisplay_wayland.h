@@ -48,6 +48,9 @@ gst_vaapi_display_wayland_new_with_va_display (VADisplay va_display,
 struct wl_display *
 gst_vaapi_display_wayland_get_display (GstVaapiDisplayWayland * display);
 
+GArray *
+gst_vaapi_display_wayland_get_dmabuf_formats (GstVaapiDisplayWayland * display);
+
 GType
 gst_vaapi_display_wayland_get_type (void) G_GNUC_CONST;
 
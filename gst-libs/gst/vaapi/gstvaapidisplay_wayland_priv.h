@@ -26,6 +26,9 @@
 
 #include "xdg-shell-client-protocol.h"
 #include "linux-dmabuf-unstable-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+
+#include <time.h>
 
 #include <gst/vaapi/gstvaapidisplay_wayland.h>
 #include "gstvaapidisplay_priv.h"
@@ -75,6 +78,7 @@ struct _GstVaapiDisplayWaylandPrivate
   struct wl_subcompositor *subcompositor;
   struct wl_output *output;
   struct zwp_linux_dmabuf_v1 *dmabuf;
+  struct wp_presentation *presentation;
   struct wl_registry *registry;
   GArray *dmabuf_formats;
   guint width;
@@ -82,6 +86,7 @@ struct _GstVaapiDisplayWaylandPrivate
   guint phys_width;
   guint phys_height;
   gint event_fd;
+  clockid_t presentation_clock;
   guint use_foreign_display:1;
 };
 
@@ -38,6 +38,12 @@
 # include <X11/extensions/Xrandr.h>
 #endif
 
+#if HAVE_DRI3_PRESENT
+# include <X11/Xlib-xcb.h>
+# include <xcb/dri3.h>
+# include <xcb/present.h>
+#endif
+
 #define DEBUG_VAAPI_DISPLAY 1
 #include "gstvaapidebug.h"
 
@@ -99,6 +105,17 @@ set_synchronous (GstVaapiDisplayX11 * display, gboolean synchronous)
   }
 }
 
+#if HAVE_DRI3_PRESENT
+static gboolean
+x11_has_extension (Display * dpy, xcb_extension_t * ext_id)
+{
+  const xcb_query_extension_reply_t *const ext =
+      xcb_get_extension_data (XGetXCBConnection (dpy), ext_id);
+
+  return ext && ext->present;
+}
+#endif
+
 /* Check for display server extensions */
 static void
 check_extensions (GstVaapiDisplayX11 * display)
@@ -110,6 +127,28 @@ check_extensions (GstVaapiDisplayX11 * display)
   priv->use_xrandr = XRRQueryExtension (priv->x11_display,
       &evt_base, &err_base);
 #endif
+
+#if HAVE_DRI3_PRESENT
+  priv->use_dri3_present = FALSE;
+  if (x11_has_extension (priv->x11_display, &xcb_dri3_id) &&
+      x11_has_extension (priv->x11_display, &xcb_present_id)) {
+    xcb_connection_t *const conn = XGetXCBConnection (priv->x11_display);
+    xcb_dri3_query_version_reply_t *dri3_reply;
+    xcb_present_query_version_reply_t *present_reply;
+
+    /* DRI3 1.2 is needed to import buffers with modifiers */
+    dri3_reply = xcb_dri3_query_version_reply (conn,
+        xcb_dri3_query_version (conn, 1, 2), NULL);
+    present_reply = xcb_present_query_version_reply (conn,
+        xcb_present_query_version (conn, 1, 0), NULL);
+
+    priv->use_dri3_present = dri3_reply && present_reply &&
+        (dri3_reply->major_version > 1 || dri3_reply->minor_version >= 2);
+
+    free (dri3_reply);
+    free (present_reply);
+  }
+#endif
 }
 
 static gboolean
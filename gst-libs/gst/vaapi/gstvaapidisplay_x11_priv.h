@@ -74,6 +74,7 @@ struct _GstVaapiDisplayX11Private
   GArray *pixmap_formats;
   guint use_foreign_display:1;  // Foreign native_display?
   guint use_xrandr:1;
+  guint use_dri3_present:1;
   guint synchronous:1;
 };
 
@@ -25,8 +25,13 @@
 #include "gstvaapicompat.h"
 #include "gstvaapiencoder.h"
 #include "gstvaapiencoder_priv.h"
+#include "gstvaapiencoder_lookahead.h"
+#include "gstvaapicodedbuffer_priv.h"
+#include "gstvaapicodedbufferproxy_priv.h"
 #include "gstvaapicontext.h"
 #include "gstvaapidisplay_priv.h"
+#include "gstvaapisurfacepool.h"
+#include "gstvaapitrace.h"
 #include "gstvaapiutils.h"
 #include "gstvaapiutils_core.h"
 #include "gstvaapivalue.h"
@@ -39,6 +44,8 @@ gst_vaapi_encoder_ensure_param_quality_level (GstVaapiEncoder * encoder,
     GstVaapiEncPicture * picture)
 {
   GstVaapiEncMiscParam *misc;
+  VAEncMiscParameterBufferQualityLevel va_quality_level;
+  guint boost;
 
   /* quality level param is not supported */
   if (GST_VAAPI_ENCODER_QUALITY_LEVEL (encoder) == 0)
@@ -47,8 +54,12 @@ gst_vaapi_encoder_ensure_param_quality_level (GstVaapiEncoder * encoder,
   misc = GST_VAAPI_ENC_QUALITY_LEVEL_MISC_PARAM_NEW (encoder);
   if (!misc)
     return FALSE;
-  memcpy (misc->data, &encoder->va_quality_level,
-      sizeof (encoder->va_quality_level));
+  va_quality_level = encoder->va_quality_level;
+  boost = g_atomic_int_get (&encoder->quality_level_boost);
+  if (boost > 0)
+    va_quality_level.quality_level = MIN (va_quality_level.quality_level +
+        boost, encoder->quality_level_max);
+  memcpy (misc->data, &va_quality_level, sizeof (va_quality_level));
   gst_vaapi_enc_picture_add_misc_param (picture, misc);
   gst_vaapi_codec_object_replace (&misc, NULL);
   return TRUE;
@@ -125,6 +136,305 @@ gst_vaapi_encoder_ensure_param_trellis (GstVaapiEncoder * encoder,
   return TRUE;
 }
 
+/* Name of the GstVideoRegionOfInterestMeta parameter carrying a QP map */
+#define QP_MAP_PARAM_NAME "GstVaapiQpMap"
+
+static void
+qp_map_reset (GstVaapiEncoder * encoder)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (encoder->qp_map_ids); i++)
+    vaapi_destroy_buffer (encoder->va_display, &encoder->qp_map_ids[i]);
+  g_clear_pointer (&encoder->qp_map, g_free);
+  g_clear_pointer (&encoder->qp_map_next, g_free);
+  encoder->qp_map_index = 0;
+  encoder->qp_map_valid = FALSE;
+}
+
+/* Fills qp_map_next from the QP delta map of @s, covering the area of
+   @roi. The blocks out of that area get @qp */
+static gboolean
+qp_map_fill (GstVaapiEncoder * encoder, GstVideoRegionOfInterestMeta * roi,
+    const GstStructure * s, guint qp, guint min_qp, guint max_qp)
+{
+  const guint bs = encoder->qp_block_size;
+  GstBuffer *buf = NULL;
+  GstMapInfo info;
+  guint map_bs = 0, stride = 0, x, y;
+
+  if (!gst_structure_get (s, "map", GST_TYPE_BUFFER, &buf,
+          "block-size", G_TYPE_UINT, &map_bs, NULL) || map_bs == 0)
+    goto error_invalid_map;
+  if (!gst_structure_get_uint (s, "stride", &stride))
+    stride = (roi->w + map_bs - 1) / map_bs;
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ))
+    goto error_invalid_map;
+
+  for (y = 0; y < encoder->qp_map_height; y++) {
+    guint8 *const row = encoder->qp_map_next + y * encoder->qp_map_width;
+    const guint py = y * bs + bs / 2;
+
+    for (x = 0; x < encoder->qp_map_width; x++) {
+      const guint px = x * bs + bs / 2;
+      gsize offset;
+      gint value = qp;
+
+      if (px >= roi->x && px < roi->x + roi->w
+          && py >= roi->y && py < roi->y + roi->h) {
+        offset = (gsize) ((py - roi->y) / map_bs) * stride +
+            (px - roi->x) / map_bs;
+        if (offset < info.size)
+          value += (gint8) info.data[offset];
+      }
+      row[x] = CLAMP (value, (gint) min_qp, (gint) max_qp);
+    }
+  }
+
+  gst_buffer_unmap (buf, &info);
+  gst_buffer_unref (buf);
+  return TRUE;
+
+  /* ERRORS */
+error_invalid_map:
+  {
+    GST_WARNING ("invalid QP map, it needs a map buffer and a block size");
+    if (buf)
+      gst_buffer_unref (buf);
+    return FALSE;
+  }
+}
+
+/* Uploads the QP map of the "GstVaapiQpMap" parameter of a region of
+   interest meta of the input buffer, as one absolute QP per block: the
+   QP deltas of the map are added to @qp. The map is only uploaded again
+   when it changes, into the VA buffer which was not used last, and it
+   is sampled at the block size of the driver */
+gboolean
+gst_vaapi_encoder_ensure_qp_map (GstVaapiEncoder * encoder,
+    GstVaapiEncPicture * picture, guint qp, guint min_qp, guint max_qp)
+{
+#if VA_CHECK_VERSION(1,0,0)
+  GstVideoRegionOfInterestMeta *roi;
+  const GstStructure *s = NULL;
+  gpointer state = NULL;
+  GstBuffer *input;
+  VABufferID *buf_id;
+  guint8 *data;
+  guint y;
+
+  if (!encoder->qp_block_size
+      || GST_VAAPI_ENCODER_RATE_CONTROL (encoder) != GST_VAAPI_RATECONTROL_CQP)
+    return TRUE;
+
+  if (!picture->frame || !(input = picture->frame->input_buffer))
+    return TRUE;
+
+  while ((roi = (GstVideoRegionOfInterestMeta *)
+          gst_buffer_iterate_meta_filtered (input, &state,
+              GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+    s = gst_video_region_of_interest_meta_get_param (roi, QP_MAP_PARAM_NAME);
+    if (s)
+      break;
+  }
+  if (!s)
+    return TRUE;
+
+  if (!encoder->qp_map) {
+    const gsize size = encoder->qp_map_width * encoder->qp_map_height;
+
+    encoder->qp_map = g_malloc (size);
+    encoder->qp_map_next = g_malloc (size);
+  }
+
+  if (!qp_map_fill (encoder, roi, s, qp, min_qp, max_qp))
+    return TRUE;
+
+  if (encoder->qp_map_valid && memcmp (encoder->qp_map, encoder->qp_map_next,
+          encoder->qp_map_width * encoder->qp_map_height) == 0)
+    goto done;
+
+  encoder->qp_map_index ^= 1;
+  buf_id = &encoder->qp_map_ids[encoder->qp_map_index];
+  if (*buf_id == VA_INVALID_ID) {
+    unsigned int unit_size, pitch;
+    VAStatus status;
+
+    status = vaCreateBuffer2 (encoder->va_display, encoder->va_context,
+        VAEncQPBufferType, encoder->qp_map_width, encoder->qp_map_height,
+        &unit_size, &pitch, buf_id);
+    if (!vaapi_check_status (status, "vaCreateBuffer2()"))
+      goto error_create_buffer;
+    encoder->qp_map_pitch = pitch;
+  }
+
+  /* this waits for the picture in flight which used the buffer */
+  data = vaapi_map_buffer (encoder->va_display, *buf_id);
+  if (!data)
+    goto error_create_buffer;
+  for (y = 0; y < encoder->qp_map_height; y++)
+    memcpy (data + y * encoder->qp_map_pitch,
+        encoder->qp_map_next + y * encoder->qp_map_width,
+        encoder->qp_map_width);
+  vaapi_unmap_buffer (encoder->va_display, *buf_id, NULL);
+
+  data = encoder->qp_map;
+  encoder->qp_map = encoder->qp_map_next;
+  encoder->qp_map_next = data;
+  encoder->qp_map_valid = TRUE;
+
+done:
+  picture->qp_map_id = encoder->qp_map_ids[encoder->qp_map_index];
+#endif
+  return TRUE;
+
+  /* ERRORS */
+#if VA_CHECK_VERSION(1,0,0)
+error_create_buffer:
+  {
+    GST_ERROR ("failed to upload the QP map");
+    vaapi_destroy_buffer (encoder->va_display,
+        &encoder->qp_map_ids[encoder->qp_map_index]);
+    encoder->qp_map_valid = FALSE;
+    return FALSE;
+  }
+#endif
+}
+
+/* Returns the layer of the picture at @frame_index in a dyadic temporal
+   structure of @num_layers layers, i.e. of period 2^(num_layers - 1):
+   the layer of 0 is 0, the odd indices are in the top layer */
+guint
+gst_vaapi_encoder_get_temporal_id (guint num_layers, guint frame_index)
+{
+  const guint period = 1 << (num_layers - 1);
+  guint index;
+
+  if (num_layers < 2)
+    return 0;
+
+  index = frame_index % period;
+  if (index == 0)
+    return 0;
+  return num_layers - 1 - g_bit_nth_lsf (index, -1);
+}
+
+/* Describes the dyadic temporal structure to the driver and, when a
+   @layer_bitrates entry (in kbps, including the layers below) is set,
+   the rate control and frame rate of that layer */
+gboolean
+gst_vaapi_encoder_ensure_param_temporal_layers (GstVaapiEncoder * encoder,
+    GstVaapiEncPicture * picture, guint num_layers,
+    const guint * layer_bitrates)
+{
+#if VA_CHECK_VERSION(1,0,0)
+  GstVaapiEncMiscParam *misc;
+  VAEncMiscParameterTemporalLayerStructure *layers;
+  VAEncMiscParameterRateControl *rate_control;
+  VAEncMiscParameterFrameRate *frame_rate;
+  const guint fps_n = GST_VAAPI_ENCODER_FPS_N (encoder);
+  const guint fps_d = GST_VAAPI_ENCODER_FPS_D (encoder);
+  guint i, period, n, d, gcd;
+
+  if (num_layers < 2)
+    return TRUE;
+
+  period = 1 << (num_layers - 1);
+  misc = GST_VAAPI_ENC_MISC_PARAM_NEW (TemporalLayerStructure, encoder);
+  if (!misc)
+    return FALSE;
+  layers = misc->data;
+  layers->number_of_layers = num_layers;
+  layers->periodicity = period;
+  for (i = 0; i < period && i < G_N_ELEMENTS (layers->layer_id); i++)
+    layers->layer_id[i] = gst_vaapi_encoder_get_temporal_id (num_layers, i);
+  gst_vaapi_enc_picture_add_misc_param (picture, misc);
+  gst_vaapi_codec_object_replace (&misc, NULL);
+
+  if (!layer_bitrates
+      || GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP)
+    return TRUE;
+
+  for (i = 0; i < num_layers; i++) {
+    if (layer_bitrates[i] == 0)
+      continue;
+
+    misc = GST_VAAPI_ENC_MISC_PARAM_NEW (RateControl, encoder);
+    if (!misc)
+      return FALSE;
+    rate_control = misc->data;
+    *rate_control = GST_VAAPI_ENCODER_VA_RATE_CONTROL (encoder);
+    rate_control->bits_per_second = layer_bitrates[i] * 1000;
+    rate_control->rc_flags.bits.temporal_id = i;
+    gst_vaapi_enc_picture_add_misc_param (picture, misc);
+    gst_vaapi_codec_object_replace (&misc, NULL);
+
+    if (fps_n == 0 || fps_d == 0)
+      continue;
+
+    /* Layer i and the ones below hold 2^i pictures of each period */
+    n = fps_n << i;
+    d = fps_d * period;
+    gcd = gst_util_greatest_common_divisor (n, d);
+    n /= gcd;
+    d /= gcd;
+    if (n > G_MAXUINT16 || d > G_MAXUINT16)
+      continue;
+
+    misc = GST_VAAPI_ENC_MISC_PARAM_NEW (FrameRate, encoder);
+    if (!misc)
+      return FALSE;
+    frame_rate = misc->data;
+    frame_rate->framerate = d << 16 | n;
+    frame_rate->framerate_flags.bits.temporal_id = i;
+    gst_vaapi_enc_picture_add_misc_param (picture, misc);
+    gst_vaapi_codec_object_replace (&misc, NULL);
+  }
+#endif
+  return TRUE;
+}
+
+/* Refreshes a band of @num_columns / keyframe-period block columns per
+   inter picture, so that the whole picture is refreshed once per
+   keyframe period without sending any keyframe */
+gboolean
+gst_vaapi_encoder_ensure_param_intra_refresh (GstVaapiEncoder * encoder,
+    GstVaapiEncPicture * picture, guint num_columns)
+{
+#if VA_CHECK_VERSION(1,0,0)
+  GstVaapiEncMiscParam *misc;
+  VAEncMiscParameterRIR *param;
+  guint insert_size;
+
+  if (!encoder->intra_refresh || num_columns == 0)
+    return TRUE;
+
+  if (picture->type == GST_VAAPI_PICTURE_TYPE_I) {
+    encoder->intra_refresh_pos = 0;
+    return TRUE;
+  }
+
+  insert_size = (num_columns + encoder->keyframe_period - 1) /
+      encoder->keyframe_period;
+  if (encoder->intra_refresh_pos >= num_columns)
+    encoder->intra_refresh_pos = 0;
+
+  misc = GST_VAAPI_ENC_MISC_PARAM_NEW (RIR, encoder);
+  if (!misc)
+    return FALSE;
+
+  param = misc->data;
+  param->rir_flags.bits.enable_rir_column = 1;
+  param->intra_insertion_location = encoder->intra_refresh_pos;
+  param->intra_insert_size = insert_size;
+  encoder->intra_refresh_pos += insert_size;
+
+  gst_vaapi_enc_picture_add_misc_param (picture, misc);
+  gst_vaapi_codec_object_replace (&misc, NULL);
+#endif
+  return TRUE;
+}
+
 gboolean
 gst_vaapi_encoder_ensure_param_roi_regions (GstVaapiEncoder * encoder,
     GstVaapiEncPicture * picture)
@@ -193,6 +503,10 @@ gst_vaapi_encoder_ensure_param_roi_regions (GstVaapiEncoder * encoder,
         g_quark_to_string (roi->roi_type), roi->id, roi->x, roi->y, roi->w,
         roi->h);
 
+    /* per-block maps are handled by gst_vaapi_encoder_ensure_qp_map() */
+    if (gst_video_region_of_interest_meta_get_param (roi, QP_MAP_PARAM_NAME))
+      continue;
+
     region_roi[i].roi_rectangle.x = roi->x;
     region_roi[i].roi_rectangle.y = roi->y;
     region_roi[i].roi_rectangle.width = roi->w;
@@ -307,6 +621,363 @@ gst_vaapi_encoder_create_surface (GstVaapiEncoder * encoder)
   return proxy;
 }
 
+/* Called with the encoder mutex held */
+static gboolean
+ensure_input_pool (GstVaapiEncoder * encoder)
+{
+  const GstVideoInfo *const vip = GST_VAAPI_ENCODER_VIDEO_INFO (encoder);
+  const guint width = GST_VAAPI_ENCODER_WIDTH (encoder);
+  const guint height = GST_VAAPI_ENCODER_HEIGHT (encoder);
+  GstVideoInfo *const pool_vip = &encoder->input_pool_info;
+  GstVaapiVideoPool *pool;
+
+  if (encoder->input_pool && GST_VIDEO_INFO_WIDTH (pool_vip) == width
+      && GST_VIDEO_INFO_HEIGHT (pool_vip) == height
+      && GST_VIDEO_INFO_FORMAT (pool_vip) == GST_VIDEO_INFO_FORMAT (vip))
+    return TRUE;
+
+  gst_video_info_set_format (pool_vip, GST_VIDEO_INFO_FORMAT (vip), width,
+      height);
+  pool = gst_vaapi_surface_pool_new_full (encoder->display, pool_vip, 0);
+  if (!pool)
+    return FALSE;
+
+  /* The pool grows to the number of frames in flight, i.e. the
+     upstream queue depth plus the frames the encoder holds */
+  gst_vaapi_video_pool_set_capacity (pool, 0);
+  gst_vaapi_video_pool_replace (&encoder->input_pool, pool);
+  gst_vaapi_video_pool_unref (pool);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_encoder_create_input_surface:
+ * @encoder: a #GstVaapiEncoder
+ *
+ * Creates a new VA surface object proxy for the encoder input, at the
+ * encoder size and format, e.g. to scale or convert upstream surfaces
+ * into. These come from a pool of their own, so that input bursts
+ * cannot exhaust the reconstructed surfaces of the context.
+ *
+ * Return value: (transfer full): a new #GstVaapiSurfaceProxy, or %NULL
+ */
+GstVaapiSurfaceProxy *
+gst_vaapi_encoder_create_input_surface (GstVaapiEncoder * encoder)
+{
+  GstVaapiSurfaceProxy *proxy = NULL;
+
+  g_return_val_if_fail (encoder != NULL, NULL);
+
+  g_mutex_lock (&encoder->mutex);
+  if (ensure_input_pool (encoder))
+    proxy = gst_vaapi_surface_proxy_new_from_pool (GST_VAAPI_SURFACE_POOL
+        (encoder->input_pool));
+  g_mutex_unlock (&encoder->mutex);
+  return proxy;
+}
+
+/* Largest QP increase the software rate control applies to stay
+   under the CQP bitrate cap */
+#define RC_MAX_QP_OFFSET        12
+
+static inline gboolean
+rc_is_enabled (GstVaapiEncoder * encoder)
+{
+  return encoder->cqp_max_bitrate > 0 &&
+      GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP;
+}
+
+static void
+rc_reset (GstVaapiEncoder * encoder)
+{
+  g_mutex_lock (&encoder->mutex);
+  encoder->rc_excess_bits = 0;
+  encoder->rc_qp_offset = 0;
+  encoder->drop_excess_bits = 0;
+  g_mutex_unlock (&encoder->mutex);
+
+  if (encoder->rc_qp_deltas)
+    g_hash_table_remove_all (encoder->rc_qp_deltas);
+}
+
+/* Accounts the @size bytes of a coded picture against the per-frame
+ * budget of the bitrate cap. The excess drains at the cap rate, and
+ * every second worth of excess raises the QP by 6, which roughly
+ * halves the picture sizes. Below the cap, the QP goes back to the
+ * requested constant one. */
+static void
+rc_update (GstVaapiEncoder * encoder, gssize size)
+{
+  guint64 window, budget;
+  gint target;
+
+  if (size < 0 || GST_VAAPI_ENCODER_FPS_N (encoder) == 0)
+    return;
+
+  window = (guint64) encoder->cqp_max_bitrate * 1000;
+  budget = gst_util_uint64_scale (window, GST_VAAPI_ENCODER_FPS_D (encoder),
+      GST_VAAPI_ENCODER_FPS_N (encoder));
+
+  g_mutex_lock (&encoder->mutex);
+  encoder->rc_excess_bits = MAX (0,
+      encoder->rc_excess_bits + (gint64) size * 8 - (gint64) budget);
+  target = MIN (encoder->rc_excess_bits * 6 / window, RC_MAX_QP_OFFSET);
+
+  /* The feedback lags behind by the pictures in flight: move one step
+     per picture so as not to oscillate */
+  if (target > encoder->rc_qp_offset)
+    encoder->rc_qp_offset++;
+  else if (target < encoder->rc_qp_offset)
+    encoder->rc_qp_offset--;
+  g_mutex_unlock (&encoder->mutex);
+}
+
+static inline gboolean
+drop_is_enabled (GstVaapiEncoder * encoder)
+{
+  return encoder->bitrate > 0 &&
+      (GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CBR ||
+      GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_VBR);
+}
+
+/* Accounts the @size bytes of a coded picture, or zero for a dropped
+ * one, against the per-frame budget of the target bitrate. The excess
+ * is what a channel at that rate still has to transmit */
+static void
+drop_update (GstVaapiEncoder * encoder, gssize size)
+{
+  guint64 budget;
+
+  if (size < 0 || GST_VAAPI_ENCODER_FPS_N (encoder) == 0)
+    return;
+
+  budget = gst_util_uint64_scale ((guint64) encoder->bitrate * 1000,
+      GST_VAAPI_ENCODER_FPS_D (encoder), GST_VAAPI_ENCODER_FPS_N (encoder));
+
+  g_mutex_lock (&encoder->mutex);
+  encoder->drop_excess_bits = MAX (0,
+      encoder->drop_excess_bits + (gint64) size * 8 - (gint64) budget);
+  g_mutex_unlock (&encoder->mutex);
+}
+
+/* Tells whether the frame being reordered should be dropped, because
+   the bits produced in excess of the target bitrate went over
+   @max_bits. The coded sizes lag behind by the pictures in flight, so
+   this errs on the late side. Only CBR and VBR drop frames */
+gboolean
+gst_vaapi_encoder_check_frame_drop (GstVaapiEncoder * encoder,
+    guint64 max_bits)
+{
+  gboolean drop;
+
+  if (!drop_is_enabled (encoder) || max_bits == 0)
+    return FALSE;
+
+  g_mutex_lock (&encoder->mutex);
+  drop = encoder->drop_excess_bits > (gint64) max_bits;
+  g_mutex_unlock (&encoder->mutex);
+  return drop;
+}
+
+/* Remembers the complexity based QP delta of @frame until its picture
+ * is submitted, possibly after reordering */
+static void
+rc_store_qp_delta (GstVaapiEncoder * encoder, GstVideoCodecFrame * frame,
+    gint qp_delta)
+{
+  if (qp_delta == 0)
+    return;
+
+  if (!encoder->rc_qp_deltas)
+    encoder->rc_qp_deltas = g_hash_table_new (NULL, NULL);
+  g_hash_table_insert (encoder->rc_qp_deltas,
+      GUINT_TO_POINTER (frame->system_frame_number),
+      GINT_TO_POINTER (qp_delta));
+}
+
+/* Decides the QP change of @picture, applied by the subclasses on top
+ * of their constant QP */
+static void
+rc_apply (GstVaapiEncoder * encoder, GstVaapiEncPicture * picture)
+{
+  gint qp_delta = 0;
+
+  if (encoder->rc_qp_deltas && picture->frame) {
+    gpointer key = GUINT_TO_POINTER (picture->frame->system_frame_number);
+
+    qp_delta = GPOINTER_TO_INT (g_hash_table_lookup (encoder->rc_qp_deltas,
+            key));
+    g_hash_table_remove (encoder->rc_qp_deltas, key);
+  }
+
+  g_mutex_lock (&encoder->mutex);
+  qp_delta += encoder->rc_qp_offset;
+  g_mutex_unlock (&encoder->mutex);
+
+  picture->qp_delta = qp_delta;
+  if (qp_delta != 0)
+    GST_LOG ("picture %u: QP delta %d", picture->frame_num, qp_delta);
+}
+
+/* Waits up to @timeout ns for @picture to be encoded into the coded
+ * buffer of @codedbuf_proxy. vaSyncBuffer() only waits for the
+ * bitstream; drivers without it wait on the reconstructed surface,
+ * which cannot time out */
+static GstVaapiEncoderStatus
+sync_coded_buffer (GstVaapiEncoder * encoder,
+    GstVaapiCodedBufferProxy * codedbuf_proxy, GstVaapiEncPicture * picture,
+    guint64 timeout)
+{
+  VAStatus status;
+
+  if (!g_atomic_int_get (&encoder->no_sync_buffer)) {
+    status = gst_vaapi_coded_buffer_sync (GST_VAAPI_CODED_BUFFER_PROXY_BUFFER
+        (codedbuf_proxy), timeout);
+    if (status == VA_STATUS_SUCCESS)
+      return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+    if (status == VA_STATUS_ERROR_TIMEDOUT)
+      return GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
+    if (status != VA_STATUS_ERROR_UNIMPLEMENTED)
+      return GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_SURFACE;
+
+    GST_INFO ("vaSyncBuffer() is not supported, syncing surfaces");
+    g_atomic_int_set (&encoder->no_sync_buffer, TRUE);
+  }
+
+  if (!gst_vaapi_surface_sync (picture->surface))
+    return GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_SURFACE;
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
+/* Waits up to @timeout ns for the picture attached to @codedbuf_proxy
+ * to be encoded and replaces it with its parent frame, as expected by
+ * the consumer. On GST_VAAPI_ENCODER_STATUS_NO_BUFFER, the picture is
+ * still attached and this is to be called again */
+static GstVaapiEncoderStatus
+complete_coded_buffer (GstVaapiEncoder * encoder,
+    GstVaapiCodedBufferProxy * codedbuf_proxy, guint64 timeout)
+{
+  GstVaapiEncPicture *picture;
+  GstVaapiEncoderStatus status;
+  GstClockTime trace_start;
+
+  picture = gst_vaapi_coded_buffer_proxy_get_user_data (codedbuf_proxy);
+  if (codedbuf_proxy->dropped) {
+    /* Nothing was submitted for that picture */
+    if (drop_is_enabled (encoder))
+      drop_update (encoder, 0);
+    goto done;
+  }
+
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
+  status = sync_coded_buffer (encoder, codedbuf_proxy, picture, timeout);
+  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return status;
+  GST_VAAPI_TRACE_END (trace_start, encoder, GST_VAAPI_TRACE_STAGE_SYNC,
+      picture->frame->pts);
+
+  /* A truncated bitstream is neither accounted nor handed out. The
+     picture cannot be submitted again into a larger buffer: its VA
+     parameter buffers are gone with vaRenderPicture(), the codec
+     already updated its references, and later pictures may have been
+     submitted on the same context. So the frame fails, and the next
+     pictures get coded buffers of the maximum size */
+  if (!gst_vaapi_coded_buffer_pool_update (GST_VAAPI_CODED_BUFFER_POOL
+          (encoder->codedbuf_pool),
+          GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy))) {
+    GST_ERROR ("coded buffer overflow, failing frame %u",
+        picture->frame->system_frame_number);
+    return GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_BUFFER;
+  }
+
+  if (rc_is_enabled (encoder))
+    rc_update (encoder, gst_vaapi_coded_buffer_get_size
+        (GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy)));
+  if (drop_is_enabled (encoder))
+    drop_update (encoder, gst_vaapi_coded_buffer_get_size
+        (GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy)));
+
+done:
+  gst_vaapi_coded_buffer_proxy_set_user_data (codedbuf_proxy,
+      gst_video_codec_frame_ref (picture->frame),
+      (GDestroyNotify) gst_video_codec_frame_unref);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
+/* Marks the end of the submission queue for the completion thread */
+static gint sync_thread_sentinel;
+
+/* Completion thread: syncs and maps coded buffers in submission order,
+ * then hands them over to gst_vaapi_encoder_get_buffer_with_timeout() */
+static gpointer
+sync_thread_func (GstVaapiEncoder * encoder)
+{
+  GstVaapiCodedBufferProxy *codedbuf_proxy;
+  VACodedBufferSegment *segment;
+
+  for (;;) {
+    codedbuf_proxy = g_async_queue_pop (encoder->codedbuf_queue);
+    if (codedbuf_proxy == (gpointer) & sync_thread_sentinel)
+      break;
+
+    if (complete_coded_buffer (encoder, codedbuf_proxy,
+            G_MAXUINT64) != GST_VAAPI_ENCODER_STATUS_SUCCESS) {
+      GST_ERROR ("failed to encode the frame");
+      /* read by the consumer after the queue handover */
+      codedbuf_proxy->failed = TRUE;
+    } else if (!codedbuf_proxy->dropped) {
+      /* Map now, so that the consumer only has to read the data. The
+         mapping is dropped when the proxy returns to its pool */
+      gst_vaapi_coded_buffer_map (GST_VAAPI_CODED_BUFFER_PROXY_BUFFER
+          (codedbuf_proxy), &segment);
+    }
+
+    g_mutex_lock (&encoder->mutex);
+    encoder->num_inflight--;
+    g_cond_signal (&encoder->inflight_free);
+    g_mutex_unlock (&encoder->mutex);
+
+    g_async_queue_push (encoder->codedbuf_done_queue, codedbuf_proxy);
+  }
+  return NULL;
+}
+
+static gboolean
+ensure_sync_thread (GstVaapiEncoder * encoder)
+{
+  if (encoder->sync_thread)
+    return TRUE;
+
+  encoder->sync_thread = g_thread_try_new ("vaapiencoder-sync",
+      (GThreadFunc) sync_thread_func, encoder, NULL);
+  return encoder->sync_thread != NULL;
+}
+
+static void
+stop_sync_thread (GstVaapiEncoder * encoder)
+{
+  if (!encoder->sync_thread)
+    return;
+
+  g_async_queue_push (encoder->codedbuf_queue, &sync_thread_sentinel);
+  g_thread_join (encoder->sync_thread);
+  encoder->sync_thread = NULL;
+}
+
+/* Gives back an in-flight slot taken for a picture that never reached
+ * the completion thread */
+static void
+release_inflight (GstVaapiEncoder * encoder)
+{
+  if (encoder->async_depth == 0)
+    return;
+
+  g_mutex_lock (&encoder->mutex);
+  encoder->num_inflight--;
+  g_cond_signal (&encoder->inflight_free);
+  g_mutex_unlock (&encoder->mutex);
+}
+
 /* Create a coded buffer proxy where the picture is going to be
  * decoded, the subclass encode vmethod is called and, if it doesn't
  * fail, the coded buffer is pushed into the async queue */
@@ -318,33 +989,165 @@ gst_vaapi_encoder_encode_and_queue (GstVaapiEncoder * encoder,
   GstVaapiCodedBufferProxy *codedbuf_proxy;
   GstVaapiEncoderStatus status;
 
+  if (encoder->async_depth > 0) {
+    if (!ensure_sync_thread (encoder))
+      goto error_create_thread;
+
+    /* Bound the number of pictures in flight on the GPU */
+    g_mutex_lock (&encoder->mutex);
+    while (encoder->num_inflight >= encoder->async_depth)
+      g_cond_wait (&encoder->inflight_free, &encoder->mutex);
+    encoder->num_inflight++;
+    g_mutex_unlock (&encoder->mutex);
+  }
+
   codedbuf_proxy = gst_vaapi_encoder_create_coded_buffer (encoder);
   if (!codedbuf_proxy)
     goto error_create_coded_buffer;
 
-  status = klass->encode (encoder, picture, codedbuf_proxy);
-  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
-    goto error_encode;
+  if (rc_is_enabled (encoder))
+    rc_apply (encoder, picture);
+
+  /* A dropped picture keeps its place in the queue, so that its frame
+     is handed back in order, but nothing is submitted for it */
+  if (GST_VAAPI_ENC_PICTURE_IS_DROPPED (picture)) {
+    GST_LOG ("dropping picture %u", picture->frame_num);
+    codedbuf_proxy->dropped = TRUE;
+    status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  } else {
+    status = klass->encode (encoder, picture, codedbuf_proxy);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_encode;
+  }
 
   gst_vaapi_coded_buffer_proxy_set_user_data (codedbuf_proxy,
       picture, (GDestroyNotify) gst_vaapi_mini_object_unref);
+  g_atomic_int_inc (&encoder->num_pending);
   g_async_queue_push (encoder->codedbuf_queue, codedbuf_proxy);
   encoder->num_codedbuf_queued++;
 
   return status;
 
   /* ERRORS */
+error_create_thread:
+  {
+    GST_ERROR ("failed to create coded buffer completion thread");
+    return GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
 error_create_coded_buffer:
   {
     GST_ERROR ("failed to allocate coded buffer");
+    release_inflight (encoder);
     return GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED;
   }
 error_encode:
   {
     GST_ERROR ("failed to encode frame (status = %d)", status);
     gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
+    release_inflight (encoder);
+    return status;
+  }
+}
+
+/* Reorders @frame and submits any picture that became ready */
+static GstVaapiEncoderStatus
+gst_vaapi_encoder_put_frame_internal (GstVaapiEncoder * encoder,
+    GstVideoCodecFrame * frame)
+{
+  GstVaapiEncoderClass *const klass = GST_VAAPI_ENCODER_GET_CLASS (encoder);
+  GstVaapiEncoderStatus status;
+  GstVaapiEncPicture *picture;
+
+  for (;;) {
+    picture = NULL;
+    status = klass->reordering (encoder, frame, &picture);
+    if (status == GST_VAAPI_ENCODER_STATUS_NO_SURFACE)
+      break;
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_reorder_frame;
+
+    status = gst_vaapi_encoder_encode_and_queue (encoder, picture);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_encode;
+
+    /* Try again with any pending reordered frame now available for encoding */
+    frame = NULL;
+  }
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error_reorder_frame:
+  {
+    GST_ERROR ("failed to process reordered frames");
+    return status;
+  }
+error_encode:
+  {
+    gst_vaapi_enc_picture_unref (picture);
+    return status;
+  }
+}
+
+static gboolean
+ensure_lookahead (GstVaapiEncoder * encoder)
+{
+  if (encoder->lookahead)
+    return TRUE;
+
+  /* Holding frames back defeats the purpose of low latency tuning */
+  if (GST_VAAPI_ENCODER_TUNE (encoder) == GST_VAAPI_ENCODER_TUNE_LOW_LATENCY) {
+    GST_INFO_OBJECT (encoder, "scene change detection disabled");
+    encoder->lookahead_depth = 0;
+    return FALSE;
+  }
+
+  encoder->lookahead = gst_vaapi_encoder_lookahead_new (encoder->display,
+      encoder->lookahead_depth);
+  if (!encoder->lookahead) {
+    GST_WARNING_OBJECT (encoder, "scene change detection is not available");
+    encoder->lookahead_depth = 0;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Submits the frames leaving the lookahead queue */
+static GstVaapiEncoderStatus
+submit_lookahead_frames (GstVaapiEncoder * encoder, gboolean drain)
+{
+  GstVaapiEncoderStatus status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  GstVideoCodecFrame *frame;
+
+  if (!encoder->lookahead)
     return status;
+
+  while ((frame = gst_vaapi_encoder_lookahead_pop (encoder->lookahead,
+              drain))) {
+    if (rc_is_enabled (encoder))
+      rc_store_qp_delta (encoder, frame,
+          gst_vaapi_encoder_lookahead_get_qp_delta (encoder->lookahead));
+    status = gst_vaapi_encoder_put_frame_internal (encoder, frame);
+    gst_video_codec_frame_unref (frame);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      break;
   }
+  return status;
+}
+
+/* Gets what the lookahead measured on the frame being reordered. This
+   is only valid from the reordering() hook, since the frames leaving
+   the lookahead queue are reordered right away */
+gboolean
+gst_vaapi_encoder_get_lookahead_stats (GstVaapiEncoder * encoder,
+    guint * complexity, gint * qp_delta)
+{
+  if (!encoder->lookahead)
+    return FALSE;
+  if (!gst_vaapi_encoder_lookahead_get_complexity (encoder->lookahead,
+          complexity))
+    return FALSE;
+  *qp_delta = gst_vaapi_encoder_lookahead_get_qp_delta (encoder->lookahead);
+  return TRUE;
 }
 
 /**
@@ -361,38 +1164,21 @@ GstVaapiEncoderStatus
 gst_vaapi_encoder_put_frame (GstVaapiEncoder * encoder,
     GstVideoCodecFrame * frame)
 {
-  GstVaapiEncoderClass *const klass = GST_VAAPI_ENCODER_GET_CLASS (encoder);
-  GstVaapiEncoderStatus status;
-  GstVaapiEncPicture *picture;
-
-  for (;;) {
-    picture = NULL;
-    status = klass->reordering (encoder, frame, &picture);
-    if (status == GST_VAAPI_ENCODER_STATUS_NO_SURFACE)
-      break;
-    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
-      goto error_reorder_frame;
-
-    status = gst_vaapi_encoder_encode_and_queue (encoder, picture);
-    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
-      goto error_encode;
+  GstVaapiSurfaceProxy *proxy;
+  const GstVaapiCodingHints *hints = NULL;
 
-    /* Try again with any pending reordered frame now available for encoding */
-    frame = NULL;
+  if (encoder->source_hints) {
+    proxy = gst_video_codec_frame_get_user_data (frame);
+    hints = proxy ? gst_vaapi_surface_proxy_get_coding_hints (proxy) : NULL;
+    if (hints && hints->is_intra)
+      GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
   }
-  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
 
-  /* ERRORS */
-error_reorder_frame:
-  {
-    GST_ERROR ("failed to process reordered frames");
-    return status;
-  }
-error_encode:
-  {
-    gst_vaapi_enc_picture_unref (picture);
-    return status;
+  if (encoder->lookahead_depth > 0 && ensure_lookahead (encoder)) {
+    gst_vaapi_encoder_lookahead_push (encoder->lookahead, frame, hints);
+    return submit_lookahead_frames (encoder, FALSE);
   }
+  return gst_vaapi_encoder_put_frame_internal (encoder, frame);
 }
 
 /**
@@ -407,6 +1193,11 @@ error_encode:
  * after usage. Otherwise, @GST_VAAPI_DECODER_STATUS_ERROR_NO_BUFFER
  * is returned if no coded buffer is available so far (timeout).
  *
+ * If the rate control dropped the frame,
+ * %GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED is returned instead of
+ * success: *@out_codedbuf_proxy_ptr is set just the same, so that the
+ * frame can be released, but holds no data.
+ *
  * The parent frame is available as a #GstVideoCodecFrame attached to
  * the user-data anchor of the output coded buffer. Ownership of the
  * frame is transferred to the coded buffer.
@@ -417,26 +1208,54 @@ GstVaapiEncoderStatus
 gst_vaapi_encoder_get_buffer_with_timeout (GstVaapiEncoder * encoder,
     GstVaapiCodedBufferProxy ** out_codedbuf_proxy_ptr, guint64 timeout)
 {
-  GstVaapiEncPicture *picture;
   GstVaapiCodedBufferProxy *codedbuf_proxy;
-
-  codedbuf_proxy = g_async_queue_timeout_pop (encoder->codedbuf_queue, timeout);
-  if (!codedbuf_proxy)
-    return GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
-
-  /* Wait for completion of all operations and report any error that occurred */
-  picture = gst_vaapi_coded_buffer_proxy_get_user_data (codedbuf_proxy);
-  if (!gst_vaapi_surface_sync (picture->surface))
-    goto error_invalid_buffer;
-
-  gst_vaapi_coded_buffer_proxy_set_user_data (codedbuf_proxy,
-      gst_video_codec_frame_ref (picture->frame),
-      (GDestroyNotify) gst_video_codec_frame_unref);
+  GstVaapiEncoderStatus status;
+  gboolean dropped;
+
+  if (encoder->sync_thread) {
+    codedbuf_proxy = g_async_queue_timeout_pop (encoder->codedbuf_done_queue,
+        timeout);
+    /* A zero timeout means draining: wait for the pictures that were
+       already submitted, as the synchronous path would do */
+    if (!codedbuf_proxy && timeout == 0
+        && g_atomic_int_get (&encoder->num_pending) > 0)
+      codedbuf_proxy = g_async_queue_pop (encoder->codedbuf_done_queue);
+    if (!codedbuf_proxy)
+      return GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
+    g_atomic_int_add (&encoder->num_pending, -1);
+
+    /* Only this frame is lost, the next ones encoded fine */
+    if (codedbuf_proxy->failed)
+      goto error_invalid_buffer;
+  } else {
+    /* The oldest picture comes first, even if its sync timed out */
+    codedbuf_proxy = encoder->sync_pending;
+    encoder->sync_pending = NULL;
+    if (!codedbuf_proxy)
+      codedbuf_proxy = g_async_queue_timeout_pop (encoder->codedbuf_queue,
+          timeout);
+    if (!codedbuf_proxy)
+      return GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
+
+    /* Wait for completion of all operations and report any error that
+       occurred. A zero timeout means draining, hence no time limit */
+    status = complete_coded_buffer (encoder, codedbuf_proxy,
+        timeout > 0 ? timeout * GST_USECOND : G_MAXUINT64);
+    if (status == GST_VAAPI_ENCODER_STATUS_NO_BUFFER) {
+      encoder->sync_pending = codedbuf_proxy;
+      return status;
+    }
+    g_atomic_int_add (&encoder->num_pending, -1);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_invalid_buffer;
+  }
 
   if (out_codedbuf_proxy_ptr)
     *out_codedbuf_proxy_ptr = gst_vaapi_coded_buffer_proxy_ref (codedbuf_proxy);
+  dropped = codedbuf_proxy->dropped;
   gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
-  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  return dropped ? GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED :
+      GST_VAAPI_ENCODER_STATUS_SUCCESS;
 
   /* ERRORS */
 error_invalid_buffer:
@@ -474,6 +1293,10 @@ gst_vaapi_encoder_flush (GstVaapiEncoder * encoder)
   GstVaapiEncoderStatus status;
   gpointer iter = NULL;
 
+  status = submit_lookahead_frames (encoder, TRUE);
+  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return status;
+
   picture = NULL;
   while (_get_pending_reordered (encoder, &picture, &iter)) {
     if (!picture)
@@ -714,6 +1537,7 @@ init_context_info (GstVaapiEncoder * encoder, GstVaapiContextInfo * cip)
   cip->width = 0;
   cip->height = 0;
   cip->ref_frames = encoder->num_ref_frames;
+  cip->owner = encoder;
 }
 
 /* Updates video context */
@@ -753,6 +1577,41 @@ error_unsupported_format:
   }
 }
 
+/* Accounts the macroblock rate of the stream on the engine behind its
+   entrypoint, or releases it if @active is unset, so that
+   GST_VAAPI_ENCODER_TUNE_AUTO can balance the streams of the display */
+static void
+update_encode_load (GstVaapiEncoder * encoder, gboolean active)
+{
+  GstVideoInfo *const vip = GST_VAAPI_ENCODER_VIDEO_INFO (encoder);
+  GstVaapiEntrypoint entrypoint = GST_VAAPI_ENTRYPOINT_INVALID;
+  guint64 load = 0;
+  guint fps_n = 30, fps_d = 1;
+
+  if (active) {
+    entrypoint = encoder->context_info.entrypoint;
+    if (GST_VIDEO_INFO_FPS_N (vip) > 0 && GST_VIDEO_INFO_FPS_D (vip) > 0) {
+      fps_n = GST_VIDEO_INFO_FPS_N (vip);
+      fps_d = GST_VIDEO_INFO_FPS_D (vip);
+    }
+    load = gst_util_uint64_scale_int_ceil (((guint64)
+            GST_ROUND_UP_16 (GST_VAAPI_ENCODER_WIDTH (encoder)) / 16) *
+        (GST_ROUND_UP_16 (GST_VAAPI_ENCODER_HEIGHT (encoder)) / 16),
+        fps_n, fps_d);
+  }
+
+  if (entrypoint == encoder->load_entrypoint && load == encoder->load)
+    return;
+  if (encoder->load > 0) {
+    gst_vaapi_display_account_encode_load (encoder->display,
+        encoder->load_entrypoint, -(gint64) encoder->load);
+  }
+  if (load > 0)
+    gst_vaapi_display_account_encode_load (encoder->display, entrypoint, load);
+  encoder->load_entrypoint = entrypoint;
+  encoder->load = load;
+}
+
 /* Ensures the underlying VA context for encoding is created */
 static gboolean
 gst_vaapi_encoder_ensure_context (GstVaapiEncoder * encoder)
@@ -769,8 +1628,21 @@ gst_vaapi_encoder_ensure_context (GstVaapiEncoder * encoder)
     encoder->context = gst_vaapi_context_new (encoder->display, cip);
     if (!encoder->context)
       return FALSE;
+
+    /* H.264 and H.265 pictures may be smaller than the reconstructed
+       surfaces, so that resolution drops do not reallocate them */
+    switch (gst_vaapi_profile_get_codec (cip->profile)) {
+      case GST_VAAPI_CODEC_H264:
+      case GST_VAAPI_CODEC_H265:
+        gst_vaapi_context_reset_on_resize (encoder->context, FALSE);
+        break;
+      default:
+        break;
+    }
   }
+  gst_vaapi_context_set_priority (encoder->context, encoder->priority);
   encoder->va_context = gst_vaapi_context_get_id (encoder->context);
+  update_encode_load (encoder, TRUE);
   return TRUE;
 }
 
@@ -824,9 +1696,29 @@ gst_vaapi_encoder_reconfigure_internal (GstVaapiEncoder * encoder)
   } else {
     GST_VAAPI_ENCODER_QUALITY_LEVEL (encoder) = 0;
   }
+  encoder->quality_level_max = quality_level_max;
   GST_INFO ("Quality level is fixed to %d",
       GST_VAAPI_ENCODER_QUALITY_LEVEL (encoder));
 
+  rc_reset (encoder);
+
+  /* The QP map buffers belong to the previous context */
+  qp_map_reset (encoder);
+  encoder->qp_block_size = 0;
+#if VA_CHECK_VERSION(1,0,0)
+  if (get_config_attribute (encoder, VAConfigAttribQPBlockSize,
+          &encoder->qp_block_size) && encoder->qp_block_size > 0) {
+    encoder->qp_map_width = (GST_VAAPI_ENCODER_WIDTH (encoder) +
+        encoder->qp_block_size - 1) / encoder->qp_block_size;
+    encoder->qp_map_height = (GST_VAAPI_ENCODER_HEIGHT (encoder) +
+        encoder->qp_block_size - 1) / encoder->qp_block_size;
+    GST_INFO ("QP maps of %dx%d blocks are supported",
+        encoder->qp_block_size, encoder->qp_block_size);
+  } else {
+    encoder->qp_block_size = 0;
+  }
+#endif
+
   if (encoder->trellis) {
 #if VA_CHECK_VERSION(1,0,0)
     guint quantization_method = 0;
@@ -845,17 +1737,39 @@ gst_vaapi_encoder_reconfigure_internal (GstVaapiEncoder * encoder)
 #endif
   }
 
+  encoder->intra_refresh = FALSE;
+  if (GST_VAAPI_ENCODER_TUNE (encoder) == GST_VAAPI_ENCODER_TUNE_LOW_LATENCY) {
+#if VA_CHECK_VERSION(1,0,0)
+    guint intra_refresh = 0;
+    if (get_config_attribute (encoder, VAConfigAttribEncIntraRefresh,
+            &intra_refresh)
+        && (intra_refresh & VA_ENC_INTRA_REFRESH_ROLLING_COLUMN))
+      encoder->intra_refresh = TRUE;
+#endif
+    if (!encoder->intra_refresh)
+      GST_INFO ("Rolling intra refresh is not supported,"
+          " keeping periodic keyframes");
+  }
+
   codedbuf_size = encoder->codedbuf_pool ?
       gst_vaapi_coded_buffer_pool_get_buffer_size (GST_VAAPI_CODED_BUFFER_POOL
-      (encoder)) : 0;
+      (encoder->codedbuf_pool)) : 0;
   if (codedbuf_size != encoder->codedbuf_size) {
     pool = gst_vaapi_coded_buffer_pool_new (encoder, encoder->codedbuf_size);
     if (!pool)
       goto error_alloc_codedbuf_pool;
-    gst_vaapi_video_pool_set_capacity (pool, 5);
+    /* For low latency, only one coded buffer may wait for output
+       while the next picture is encoded */
+    gst_vaapi_video_pool_set_capacity (pool,
+        GST_VAAPI_ENCODER_TUNE (encoder) == GST_VAAPI_ENCODER_TUNE_LOW_LATENCY ?
+        2 : MAX (5, encoder->async_depth + 2));
     gst_vaapi_video_pool_replace (&encoder->codedbuf_pool, pool);
     gst_vaapi_video_pool_unref (pool);
   }
+
+  /* Restart coded size tracking, e.g. after a bitrate change */
+  gst_vaapi_coded_buffer_pool_set_adaptive (GST_VAAPI_CODED_BUFFER_POOL
+      (encoder->codedbuf_pool), encoder->adaptive_codedbuf);
   return GST_VAAPI_ENCODER_STATUS_SUCCESS;
 
   /* ERRORS */
@@ -997,6 +1911,34 @@ error_unsupported_rate_control:
  *
  * Return value: a #GstVaapiEncoderStatus
  */
+/* Applies a new bitrate or target percentage while encoding. Only the
+   rate control and HRD parameters sent with the next picture change,
+   unless the codec needs a full reconfiguration */
+static GstVaapiEncoderStatus
+gst_vaapi_encoder_update_rate_control (GstVaapiEncoder * encoder)
+{
+  GstVaapiEncoderClass *const klass = GST_VAAPI_ENCODER_GET_CLASS (encoder);
+  GstVaapiEncoderStatus status;
+
+  if (!klass->update_rate_control)
+    return gst_vaapi_encoder_reconfigure_internal (encoder);
+
+  GST_VAAPI_ENCODER_VA_RATE_CONTROL (encoder).bits_per_second =
+      encoder->bitrate * 1000;
+  GST_VAAPI_ENCODER_VA_RATE_CONTROL (encoder).target_percentage =
+      (GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CBR) ?
+      100 : encoder->target_percentage;
+
+  status = klass->update_rate_control (encoder);
+  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return status;
+
+  /* Restart coded size tracking */
+  gst_vaapi_coded_buffer_pool_set_adaptive (GST_VAAPI_CODED_BUFFER_POOL
+      (encoder->codedbuf_pool), encoder->adaptive_codedbuf);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
 GstVaapiEncoderStatus
 gst_vaapi_encoder_set_bitrate (GstVaapiEncoder * encoder, guint bitrate)
 {
@@ -1005,7 +1947,7 @@ gst_vaapi_encoder_set_bitrate (GstVaapiEncoder * encoder, guint bitrate)
   if (encoder->bitrate != bitrate && encoder->num_codedbuf_queued > 0) {
     GST_INFO ("Bitrate is changed to %d on runtime", bitrate);
     encoder->bitrate = bitrate;
-    return gst_vaapi_encoder_reconfigure_internal (encoder);
+    return gst_vaapi_encoder_update_rate_control (encoder);
   }
 
   encoder->bitrate = bitrate;
@@ -1024,7 +1966,7 @@ gst_vaapi_encoder_set_target_percentage (GstVaapiEncoder * encoder,
       GST_INFO ("Target percentage is changed to %d on runtime",
           target_percentage);
       encoder->target_percentage = target_percentage;
-      return gst_vaapi_encoder_reconfigure_internal (encoder);
+      return gst_vaapi_encoder_update_rate_control (encoder);
     }
     GST_WARNING ("Target percentage is ignored for CBR rate-control");
     return GST_VAAPI_ENCODER_STATUS_SUCCESS;
@@ -1141,6 +2083,32 @@ error_operation_failed:
   }
 }
 
+/**
+ * gst_vaapi_encoder_set_quality_level_boost:
+ * @encoder: a #GstVaapiEncoder
+ * @steps: the number of quality levels to trade for speed
+ *
+ * Encodes the next pictures @steps quality levels closer to the fastest
+ * one the driver supports than the configured quality level, or at the
+ * configured one again if @steps is zero. Unlike the quality level, the
+ * boost is carried by each picture and can change at any time, e.g. to
+ * keep up with real time while the VA device is overloaded.
+ *
+ * This function is thread safe.
+ */
+void
+gst_vaapi_encoder_set_quality_level_boost (GstVaapiEncoder * encoder,
+    guint steps)
+{
+  g_return_if_fail (encoder != NULL);
+
+  if (g_atomic_int_get (&encoder->quality_level_boost) == (gint) steps)
+    return;
+
+  GST_INFO ("quality level boost set to %u", steps);
+  g_atomic_int_set (&encoder->quality_level_boost, steps);
+}
+
 /**
  * gst_vaapi_encoder_set_trellis:
  * @encoder: a #GstVaapiEncoder
@@ -1175,6 +2143,116 @@ error_operation_failed:
   }
 }
 
+/**
+ * gst_vaapi_encoder_set_async_depth:
+ * @encoder: a #GstVaapiEncoder
+ * @async_depth: the maximum number of pictures in flight
+ *
+ * Sets the number of pictures that may be submitted to the hardware
+ * before the first of them has completed. A non-zero value makes a
+ * dedicated thread wait for the completion of pictures and map their
+ * coded buffers, so that gst_vaapi_encoder_get_buffer_with_timeout()
+ * only hands over ready data. Zero keeps completion in the caller of
+ * gst_vaapi_encoder_get_buffer_with_timeout().
+ *
+ * Note: this can only be changed before the first frame is encoded.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_set_async_depth (GstVaapiEncoder * encoder,
+    guint async_depth)
+{
+  g_return_val_if_fail (encoder != NULL, 0);
+
+  if (encoder->async_depth != async_depth && encoder->num_codedbuf_queued > 0)
+    goto error_operation_failed;
+
+  encoder->async_depth = async_depth;
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error_operation_failed:
+  {
+    GST_ERROR ("could not change async depth after encoding started");
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_set_lookahead:
+ * @encoder: a #GstVaapiEncoder
+ * @depth: the number of frames to analyze ahead
+ *
+ * Enables scene change detection over @depth following frames, or
+ * disables it if @depth is zero. A keyframe is forced at each
+ * detected scene change. Frames are delayed by @depth frames before
+ * encoding, and a scene change is only reported if the frames within
+ * that window do not return to the previous scene.
+ *
+ * Note: this can only be changed before the first frame is encoded.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_set_lookahead (GstVaapiEncoder * encoder, guint depth)
+{
+  g_return_val_if_fail (encoder != NULL, 0);
+
+  if (encoder->lookahead_depth != depth && (encoder->num_codedbuf_queued > 0
+          || encoder->lookahead))
+    goto error_operation_failed;
+
+  encoder->lookahead_depth = depth;
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error_operation_failed:
+  {
+    GST_ERROR ("could not change lookahead after encoding started");
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_set_job_deadline:
+ * @encoder: a #GstVaapiEncoder
+ * @deadline: the clock time the next pictures should be encoded by,
+ *   or %GST_CLOCK_TIME_NONE
+ *
+ * Sets the deadline the next picture submissions are scheduled with
+ * when the #GstVaapiDisplay:job-scheduling of the display is enabled.
+ */
+void
+gst_vaapi_encoder_set_job_deadline (GstVaapiEncoder * encoder,
+    GstClockTime deadline)
+{
+  g_return_if_fail (encoder != NULL);
+
+  encoder->job_deadline = deadline;
+}
+
+/**
+ * gst_vaapi_encoder_set_priority:
+ * @encoder: a #GstVaapiEncoder
+ * @priority: the #GstVaapiPriority
+ *
+ * Sets the GPU priority the driver schedules the pictures of
+ * @encoder with, relative to the other VA contexts. It takes effect
+ * from the next encoded picture, and is ignored by drivers without
+ * context priorities.
+ */
+void
+gst_vaapi_encoder_set_priority (GstVaapiEncoder * encoder,
+    GstVaapiPriority priority)
+{
+  g_return_if_fail (encoder != NULL);
+
+  encoder->priority = priority;
+  if (encoder->context)
+    gst_vaapi_context_set_priority (encoder->context, priority);
+}
+
 G_DEFINE_ABSTRACT_TYPE (GstVaapiEncoder, gst_vaapi_encoder, GST_TYPE_OBJECT);
 
 /**
@@ -1188,6 +2266,15 @@ G_DEFINE_ABSTRACT_TYPE (GstVaapiEncoder, gst_vaapi_encoder, GST_TYPE_OBJECT);
  * @ENCODER_PROP_DEFAULT_ROI_VALUE: The default delta qp to apply
  *   to each region of interest.
  * @ENCODER_PROP_TRELLIS: Use trellis quantization method (gboolean).
+ * @ENCODER_PROP_ASYNC_DEPTH: Number of pictures in flight (uint).
+ * @ENCODER_PROP_ADAPTIVE_CODED_BUFFERS: Size coded buffers from the
+ *   actual bitstream sizes (gboolean).
+ * @ENCODER_PROP_LOOKAHEAD: Number of frames analyzed ahead for scene
+ *   changes (uint).
+ * @ENCODER_PROP_CQP_MAX_BITRATE: Bitrate cap of the software rate
+ *   control in CQP mode, in kbps (uint).
+ * @ENCODER_PROP_SOURCE_HINTS: Use the coding hints of decoded input
+ *   frames (gboolean).
  *
  * The set of configurable properties for the encoder.
  */
@@ -1200,6 +2287,11 @@ enum
   ENCODER_PROP_QUALITY_LEVEL,
   ENCODER_PROP_DEFAULT_ROI_VALUE,
   ENCODER_PROP_TRELLIS,
+  ENCODER_PROP_ASYNC_DEPTH,
+  ENCODER_PROP_ADAPTIVE_CODED_BUFFERS,
+  ENCODER_PROP_LOOKAHEAD,
+  ENCODER_PROP_CQP_MAX_BITRATE,
+  ENCODER_PROP_SOURCE_HINTS,
   ENCODER_N_PROPERTIES
 };
 
@@ -1246,6 +2338,26 @@ gst_vaapi_encoder_set_property (GObject * object, guint prop_id,
       status =
           gst_vaapi_encoder_set_trellis (encoder, g_value_get_boolean (value));
       break;
+    case ENCODER_PROP_ASYNC_DEPTH:
+      status = gst_vaapi_encoder_set_async_depth (encoder,
+          g_value_get_uint (value));
+      break;
+    case ENCODER_PROP_ADAPTIVE_CODED_BUFFERS:
+      encoder->adaptive_codedbuf = g_value_get_boolean (value);
+      status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+      break;
+    case ENCODER_PROP_LOOKAHEAD:
+      status = gst_vaapi_encoder_set_lookahead (encoder,
+          g_value_get_uint (value));
+      break;
+    case ENCODER_PROP_CQP_MAX_BITRATE:
+      encoder->cqp_max_bitrate = g_value_get_uint (value);
+      status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+      break;
+    case ENCODER_PROP_SOURCE_HINTS:
+      encoder->source_hints = g_value_get_boolean (value);
+      status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1284,6 +2396,21 @@ gst_vaapi_encoder_get_property (GObject * object, guint prop_id,
     case ENCODER_PROP_TRELLIS:
       g_value_set_boolean (value, encoder->trellis);
       break;
+    case ENCODER_PROP_ASYNC_DEPTH:
+      g_value_set_uint (value, encoder->async_depth);
+      break;
+    case ENCODER_PROP_ADAPTIVE_CODED_BUFFERS:
+      g_value_set_boolean (value, encoder->adaptive_codedbuf);
+      break;
+    case ENCODER_PROP_LOOKAHEAD:
+      g_value_set_uint (value, encoder->lookahead_depth);
+      break;
+    case ENCODER_PROP_CQP_MAX_BITRATE:
+      g_value_set_uint (value, encoder->cqp_max_bitrate);
+      break;
+    case ENCODER_PROP_SOURCE_HINTS:
+      g_value_set_boolean (value, encoder->source_hints);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1294,15 +2421,21 @@ static void
 gst_vaapi_encoder_init (GstVaapiEncoder * encoder)
 {
   encoder->va_context = VA_INVALID_ID;
+  encoder->job_deadline = GST_CLOCK_TIME_NONE;
+  encoder->qp_map_ids[0] = VA_INVALID_ID;
+  encoder->qp_map_ids[1] = VA_INVALID_ID;
 
   gst_video_info_init (&encoder->video_info);
 
   g_mutex_init (&encoder->mutex);
   g_cond_init (&encoder->surface_free);
   g_cond_init (&encoder->codedbuf_free);
+  g_cond_init (&encoder->inflight_free);
 
   encoder->codedbuf_queue = g_async_queue_new_full ((GDestroyNotify)
       gst_vaapi_coded_buffer_proxy_unref);
+  encoder->codedbuf_done_queue = g_async_queue_new_full ((GDestroyNotify)
+      gst_vaapi_coded_buffer_proxy_unref);
 }
 
 /* Base encoder cleanup (internal) */
@@ -1311,6 +2444,19 @@ gst_vaapi_encoder_finalize (GObject * object)
 {
   GstVaapiEncoder *encoder = GST_VAAPI_ENCODER (object);
 
+  stop_sync_thread (encoder);
+
+  if (encoder->lookahead) {
+    gst_vaapi_encoder_lookahead_free (encoder->lookahead);
+    encoder->lookahead = NULL;
+  }
+
+  qp_map_reset (encoder);
+  if (encoder->rc_qp_deltas) {
+    g_hash_table_unref (encoder->rc_qp_deltas);
+    encoder->rc_qp_deltas = NULL;
+  }
+  update_encode_load (encoder, FALSE);
   if (encoder->context)
     gst_vaapi_context_unref (encoder->context);
   encoder->context = NULL;
@@ -1322,13 +2468,21 @@ gst_vaapi_encoder_finalize (GObject * object)
     encoder->properties = NULL;
   }
 
+  g_clear_pointer (&encoder->sync_pending,
+      gst_vaapi_coded_buffer_proxy_unref);
   gst_vaapi_video_pool_replace (&encoder->codedbuf_pool, NULL);
+  gst_vaapi_video_pool_replace (&encoder->input_pool, NULL);
   if (encoder->codedbuf_queue) {
     g_async_queue_unref (encoder->codedbuf_queue);
     encoder->codedbuf_queue = NULL;
   }
+  if (encoder->codedbuf_done_queue) {
+    g_async_queue_unref (encoder->codedbuf_done_queue);
+    encoder->codedbuf_done_queue = NULL;
+  }
   g_cond_clear (&encoder->surface_free);
   g_cond_clear (&encoder->codedbuf_free);
+  g_cond_clear (&encoder->inflight_free);
   g_mutex_clear (&encoder->mutex);
 
   G_OBJECT_CLASS (gst_vaapi_encoder_parent_class)->finalize (object);
@@ -1442,6 +2596,89 @@ gst_vaapi_encoder_class_init (GstVaapiEncoderClass * klass)
       FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoder:async-depth:
+   *
+   * The number of pictures that may be in flight on the hardware.
+   * When non-zero, encoded pictures are waited for and mapped in a
+   * dedicated thread.
+   */
+  properties[ENCODER_PROP_ASYNC_DEPTH] =
+      g_param_spec_uint ("async-depth",
+      "Async Depth",
+      "Number of pictures in flight, completed in a separate thread "
+      "(0: complete in the output thread)", 0, 16, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoder:adaptive-coded-buffers:
+   *
+   * Size the coded buffers from the actual bitstream sizes instead of
+   * the worst case derived from the resolution. Adaptive sizing is
+   * turned off again if a coded buffer ever overflows.
+   */
+  properties[ENCODER_PROP_ADAPTIVE_CODED_BUFFERS] =
+      g_param_spec_boolean ("adaptive-coded-buffers",
+      "Adaptive Coded Buffers",
+      "Size coded buffers from the observed bitstream sizes",
+      FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoder:lookahead:
+   *
+   * The number of frames analyzed ahead of the current one to detect
+   * scene changes, where a keyframe is inserted and the GOP restarts.
+   * The input is delayed by as many frames. Zero disables the
+   * detection. Only honoured by the encoders that support forced
+   * keyframes, i.e. H.264, H.265 and MPEG-2.
+   */
+  properties[ENCODER_PROP_LOOKAHEAD] =
+      g_param_spec_uint ("lookahead",
+      "Lookahead",
+      "Number of frames analyzed ahead for scene change detection "
+      "(0: disabled)", 0, 60, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoder:cqp-max-bitrate:
+   *
+   * The bitrate cap, in kbps, of a software rate control layered over
+   * CQP: pictures are encoded at the constant QP, which sets the
+   * target quality, and the QP is only raised while the coded sizes
+   * exceed the cap averaged over one second. With
+   * #GstVaapiEncoder:lookahead, the frames more complex than the
+   * frames around them also get a higher QP, and the simpler ones a
+   * lower QP. Zero disables it. Only honoured in CQP mode by the
+   * H.264, H.265 and MPEG-2 encoders.
+   */
+  properties[ENCODER_PROP_CQP_MAX_BITRATE] =
+      g_param_spec_uint ("cqp-max-bitrate",
+      "CQP Maximum Bitrate",
+      "Bitrate cap in kbps of the software rate control in CQP mode "
+      "(0: disabled)", 0, 2000 * 1024, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoder:source-hints:
+   *
+   * Whether to reuse how the input was coded when it comes straight
+   * from a H.264 or H.265 decoder, e.g. in a transcode: a keyframe is
+   * forced wherever the source had an intra picture, and
+   * #GstVaapiEncoder:lookahead takes the frame complexity from the
+   * source picture sizes and QPs instead of analyzing the frames.
+   */
+  properties[ENCODER_PROP_SOURCE_HINTS] =
+      g_param_spec_boolean ("source-hints",
+      "Source hints",
+      "Follow the keyframes and complexity of decoded input",
+      FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_N_PROPERTIES,
       properties);
 }
@@ -1725,6 +2962,96 @@ gst_vaapi_encoder_get_profile (GstVaapiEncoder * encoder)
   return encoder->profile;
 }
 
+/* Checks whether the low-power entrypoint supports the features and
+   the resolution of the stream */
+static gboolean
+is_low_power_capable (GstVaapiEncoder * encoder, GstVaapiProfile profile)
+{
+  const VAProfile va_profile = gst_vaapi_profile_get_va_profile (profile);
+  guint features = encoder->required_features;
+  guint value;
+
+  if (encoder->trellis)
+    features |= GST_VAAPI_ENCODER_FEATURE_TRELLIS;
+  if (encoder->default_roi_value != 0)
+    features |= GST_VAAPI_ENCODER_FEATURE_ROI;
+
+  if ((features & GST_VAAPI_ENCODER_FEATURE_BFRAMES)
+      && (!gst_vaapi_get_config_attribute (encoder->display, va_profile,
+              VAEntrypointEncSliceLP, VAConfigAttribEncMaxRefFrames, &value)
+          || ((value >> 16) & 0xffff) == 0))
+    return FALSE;
+
+#if VA_CHECK_VERSION(0,39,1)
+  if ((features & GST_VAAPI_ENCODER_FEATURE_ROI)
+      && (!gst_vaapi_get_config_attribute (encoder->display, va_profile,
+              VAEntrypointEncSliceLP, VAConfigAttribEncROI, &value)
+          || ((VAConfigAttribValEncROI *) & value)->bits.num_roi_regions == 0))
+    return FALSE;
+#endif
+
+#if VA_CHECK_VERSION(1,0,0)
+  if ((features & GST_VAAPI_ENCODER_FEATURE_TRELLIS)
+      && (!gst_vaapi_get_config_attribute (encoder->display, va_profile,
+              VAEntrypointEncSliceLP, VAConfigAttribEncQuantization, &value)
+          || !(value & VA_ENC_QUANTIZATION_TRELLIS_SUPPORTED)))
+    return FALSE;
+
+  if (gst_vaapi_get_config_attribute (encoder->display, va_profile,
+          VAEntrypointEncSliceLP, VAConfigAttribMaxPictureWidth, &value)
+      && GST_VAAPI_ENCODER_WIDTH (encoder) > value)
+    return FALSE;
+  if (gst_vaapi_get_config_attribute (encoder->display, va_profile,
+          VAEntrypointEncSliceLP, VAConfigAttribMaxPictureHeight, &value)
+      && GST_VAAPI_ENCODER_HEIGHT (encoder) > value)
+    return FALSE;
+#endif
+
+  return TRUE;
+}
+
+/* Picks the entrypoint of @profile for GST_VAAPI_ENCODER_TUNE_AUTO:
+   the full one if the low-power one lacks a feature, otherwise the one
+   carrying the lowest load, not counting the stream itself */
+static GstVaapiEntrypoint
+get_auto_entrypoint (GstVaapiEncoder * encoder, GstVaapiProfile profile)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
+  guint64 load_full, load_lp;
+
+  if (!gst_vaapi_display_has_encoder (display, profile,
+          GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP)) {
+    if (gst_vaapi_display_has_encoder (display, profile,
+            GST_VAAPI_ENTRYPOINT_SLICE_ENCODE))
+      return GST_VAAPI_ENTRYPOINT_SLICE_ENCODE;
+    return GST_VAAPI_ENTRYPOINT_INVALID;
+  }
+  if (!gst_vaapi_display_has_encoder (display, profile,
+          GST_VAAPI_ENTRYPOINT_SLICE_ENCODE))
+    return GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP;
+
+  if (!is_low_power_capable (encoder, profile)) {
+    GST_INFO ("low-power entrypoint lacks features of the stream");
+    return GST_VAAPI_ENTRYPOINT_SLICE_ENCODE;
+  }
+
+  load_full = gst_vaapi_display_get_encode_load (display,
+      GST_VAAPI_ENTRYPOINT_SLICE_ENCODE);
+  load_lp = gst_vaapi_display_get_encode_load (display,
+      GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP);
+  if (encoder->load_entrypoint == GST_VAAPI_ENTRYPOINT_SLICE_ENCODE)
+    load_full -= MIN (load_full, encoder->load);
+  else if (encoder->load_entrypoint == GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP)
+    load_lp -= MIN (load_lp, encoder->load);
+
+  GST_DEBUG ("encode load: %" G_GUINT64_FORMAT " MB/s full, %"
+      G_GUINT64_FORMAT " MB/s low-power", load_full, load_lp);
+
+  /* On par, the low-power engine saves power */
+  return load_lp <= load_full ? GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP :
+      GST_VAAPI_ENTRYPOINT_SLICE_ENCODE;
+}
+
 /* Get the entrypoint based on the tune option. */
 /**
  * gst_vaapi_encoder_get_entrypoint:
@@ -1733,8 +3060,10 @@ gst_vaapi_encoder_get_profile (GstVaapiEncoder * encoder)
  *
  * This function will return the valid entrypoint of the @encoder for
  * @profile. If the low-power mode(tune option) is set, only LP
- * entrypoints will be considered. If not, the first available entry
- * point will be return.
+ * entrypoints will be considered. If the auto mode is set, the
+ * entrypoint is picked from the stream requirements and the load of
+ * the engines, see gst_vaapi_display_get_encode_load(). If not, the
+ * first available entry point will be return.
  *
  * Returns: The #GstVaapiEntrypoint.
  **/
@@ -1751,6 +3080,9 @@ gst_vaapi_encoder_get_entrypoint (GstVaapiEncoder * encoder,
   if (profile == GST_VAAPI_PROFILE_JPEG_BASELINE)
     return GST_VAAPI_ENTRYPOINT_PICTURE_ENCODE;
 
+  if (GST_VAAPI_ENCODER_TUNE (encoder) == GST_VAAPI_ENCODER_TUNE_AUTO)
+    return get_auto_entrypoint (encoder, profile);
+
   if (GST_VAAPI_ENCODER_TUNE (encoder) == GST_VAAPI_ENCODER_TUNE_LOW_POWER) {
     if (gst_vaapi_display_has_encoder (GST_VAAPI_ENCODER_DISPLAY (encoder),
             profile, GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP))
@@ -1834,6 +3166,8 @@ gst_vaapi_encoder_tune_get_type (void)
       "Low latency", "low-latency" },
     { GST_VAAPI_ENCODER_TUNE_LOW_POWER,
       "Low power mode", "low-power" },
+    { GST_VAAPI_ENCODER_TUNE_AUTO,
+      "Automatic low power mode", "auto" },
     { 0, NULL, NULL },
     /* *INDENT-ON* */
   };
@@ -26,6 +26,7 @@
 
 #include <gst/video/gstvideoutils.h>
 #include <gst/vaapi/gstvaapicodedbufferproxy.h>
+#include <gst/vaapi/gstvaapisurfaceproxy.h>
 
 G_BEGIN_DECLS
 
@@ -55,6 +56,8 @@ gst_vaapi_encoder_get_type (void) G_GNUC_CONST;
  * @GST_VAAPI_ENCODER_STATUS_NO_SURFACE: No surface left to encode.
  * @GST_VAAPI_ENCODER_STATUS_NO_BUFFER: No coded buffer left to hold
  *   the encoded picture.
+ * @GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED: The rate control dropped
+ *   the frame attached to the coded buffer, which holds no data.
  * @GST_VAAPI_ENCODER_STATUS_ERROR_UNKNOWN: Unknown error.
  * @GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED: No memory left.
  * @GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED: The requested
@@ -75,6 +78,7 @@ typedef enum
   GST_VAAPI_ENCODER_STATUS_SUCCESS = 0,
   GST_VAAPI_ENCODER_STATUS_NO_SURFACE = 1,
   GST_VAAPI_ENCODER_STATUS_NO_BUFFER = 2,
+  GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED = 3,
 
   GST_VAAPI_ENCODER_STATUS_ERROR_UNKNOWN = -1,
   GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED = -2,
@@ -96,6 +100,9 @@ typedef enum
  * @GST_VAAPI_ENCODER_TUNE_LOW_POWER: Tune encoder for low power /
  *   resources conditions. This can affect compression ratio or visual
  *   quality to match low power conditions.
+ * @GST_VAAPI_ENCODER_TUNE_AUTO: Pick the low-power or the full encoding
+ *   entrypoint for each stream, from the features it requires, its
+ *   resolution and the load the other encoders put on the engines.
  *
  * The set of tuning options for a #GstVaapiEncoder. By default,
  * maximum compatibility for decoding is preferred, so the lowest
@@ -106,6 +113,7 @@ typedef enum {
   GST_VAAPI_ENCODER_TUNE_HIGH_COMPRESSION,
   GST_VAAPI_ENCODER_TUNE_LOW_LATENCY,
   GST_VAAPI_ENCODER_TUNE_LOW_POWER,
+  GST_VAAPI_ENCODER_TUNE_AUTO,
 } GstVaapiEncoderTune;
 
 /**
@@ -170,9 +178,31 @@ GstVaapiEncoderStatus
 gst_vaapi_encoder_set_quality_level (GstVaapiEncoder * encoder,
     guint quality_level);
 
+void
+gst_vaapi_encoder_set_quality_level_boost (GstVaapiEncoder * encoder,
+    guint steps);
+
 GstVaapiEncoderStatus
 gst_vaapi_encoder_set_trellis (GstVaapiEncoder * encoder, gboolean trellis);
 
+GstVaapiEncoderStatus
+gst_vaapi_encoder_set_async_depth (GstVaapiEncoder * encoder,
+    guint async_depth);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_set_lookahead (GstVaapiEncoder * encoder, guint depth);
+
+void
+gst_vaapi_encoder_set_job_deadline (GstVaapiEncoder * encoder,
+    GstClockTime deadline);
+
+void
+gst_vaapi_encoder_set_priority (GstVaapiEncoder * encoder,
+    GstVaapiPriority priority);
+
+GstVaapiSurfaceProxy *
+gst_vaapi_encoder_create_input_surface (GstVaapiEncoder * encoder);
+
 GstVaapiEncoderStatus
 gst_vaapi_encoder_get_buffer_with_timeout (GstVaapiEncoder * encoder,
     GstVaapiCodedBufferProxy ** out_codedbuf_proxy_ptr, guint64 timeout);
@@ -0,0 +1,763 @@
+/*
+ *  gstvaapiencoder_chunked.c - Chunk-parallel encoding of a single stream
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:gstvaapiencoder_chunked
+ * @short_description: Chunk-parallel encoding of a single stream
+ *
+ * A #GstVaapiEncoderChunked splits a stream into chunks starting with
+ * a keyframe, e.g. for offline encoding. The chunks are handed, in
+ * turn, to several #GstVaapiEncoder instances, each running on its own
+ * thread and VA context, so that drivers can encode them at the same
+ * time, possibly on several engines, e.g. with both the VME and the
+ * low-power entrypoints. Each encoder is flushed at the end of its
+ * chunks, so that these are closed GOPs, and the coded frames are
+ * returned in stream order.
+ *
+ * The encoders shall be configured alike, so that they produce the
+ * same stream headers, which is checked before their first chunk is
+ * output. The input frames of the chunks being encoded are held by the
+ * encoders, i.e. up to about one chunk per encoder, which trades the
+ * memory for the parallelism.
+ */
+
+#include "sysdeps.h"
+#include "gstvaapiencoder_chunked.h"
+#include "gstvaapiencoder_priv.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+/* About ten seconds at 30 fps */
+#define DEFAULT_CHUNK_SIZE 300
+
+/* Frames an encoder is given before the worker waits for the oldest
+   one, so that a few pictures are in flight on each engine */
+#define MAX_PENDING_FRAMES 4
+
+typedef struct _Worker Worker;
+
+typedef struct
+{
+  GstVideoCodecFrame *frame;
+  /* NULL if the rate control dropped the frame */
+  GstBuffer *buffer;
+} ChunkOutput;
+
+typedef struct
+{
+  guint index;
+  Worker *worker;
+  guint num_frames;
+  /* ChunkOutput, in encoding order */
+  GQueue outputs;
+  GstVaapiEncoderStatus status;
+  /* no more frames are queued */
+  gboolean ended;
+  /* all the frames were output by the encoder */
+  gboolean done;
+} Chunk;
+
+/* A frame of a chunk, or the end of the chunk if there is no frame,
+   or the end of the worker if there is no chunk either */
+typedef struct
+{
+  Chunk *chunk;
+  GstVideoCodecFrame *frame;
+} WorkItem;
+
+struct _Worker
+{
+  GstVaapiEncoderChunked *chunked;
+  GstVaapiEncoder *encoder;
+  GThread *thread;
+  GAsyncQueue *queue;
+  guint num_pending;
+  /* the chunks queued and not done yet */
+  guint num_chunks;
+  gboolean headers_checked;
+};
+
+struct _GstVaapiEncoderChunked
+{
+  GstVaapiDisplay *display;
+  GPtrArray *workers;
+  guint chunk_size;
+  gboolean configured;
+
+  /* the chunk the next frames are added to */
+  Chunk *current_chunk;
+  guint num_chunks;
+
+  /* the chunks not fully returned yet, in stream order */
+  GQueue chunks;
+  GMutex lock;
+  GCond cond;
+};
+
+static void
+chunk_output_free (ChunkOutput * output)
+{
+  if (output->frame)
+    gst_video_codec_frame_unref (output->frame);
+  gst_buffer_replace (&output->buffer, NULL);
+  g_slice_free (ChunkOutput, output);
+}
+
+static void
+chunk_free (Chunk * chunk)
+{
+  g_queue_clear_full (&chunk->outputs, (GDestroyNotify) chunk_output_free);
+  g_slice_free (Chunk, chunk);
+}
+
+static void
+worker_push (Worker * worker, Chunk * chunk, GstVideoCodecFrame * frame)
+{
+  WorkItem *const item = g_slice_new (WorkItem);
+
+  item->chunk = chunk;
+  item->frame = frame ? gst_video_codec_frame_ref (frame) : NULL;
+  g_async_queue_push (worker->queue, item);
+}
+
+static GstBuffer *
+copy_coded_buffer (GstVaapiCodedBufferProxy * proxy)
+{
+  const gssize size = GST_VAAPI_CODED_BUFFER_PROXY_BUFFER_SIZE (proxy);
+  GstBuffer *buffer;
+
+  if (size <= 0)
+    return NULL;
+
+  buffer = gst_buffer_new_allocate (NULL, size, NULL);
+  if (!buffer)
+    return NULL;
+  if (!gst_vaapi_coded_buffer_copy_into (buffer,
+          GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (proxy))) {
+    gst_buffer_unref (buffer);
+    return NULL;
+  }
+  return buffer;
+}
+
+/* Moves the coded frames of the worker encoder to @chunk, until only a
+   few are pending, or none if @drain is set. The coded buffers are
+   copied out so that the encoders never wait for their pools, and the
+   input surfaces are released */
+static GstVaapiEncoderStatus
+collect_frames (Worker * worker, Chunk * chunk, gboolean drain)
+{
+  GstVaapiEncoderChunked *const chunked = worker->chunked;
+  GstVaapiCodedBufferProxy *proxy;
+  GstVaapiEncoderStatus status;
+  GstVideoCodecFrame *frame;
+  ChunkOutput *output;
+
+  while (drain || worker->num_pending > MAX_PENDING_FRAMES) {
+    proxy = NULL;
+    status = gst_vaapi_encoder_get_buffer_with_timeout (worker->encoder,
+        &proxy, 0);
+    if (status == GST_VAAPI_ENCODER_STATUS_NO_BUFFER)
+      break;
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS
+        && status != GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED)
+      goto error_encode;
+    if (worker->num_pending > 0)
+      worker->num_pending--;
+
+    output = g_slice_new0 (ChunkOutput);
+    frame = gst_vaapi_coded_buffer_proxy_get_user_data (proxy);
+    if (frame) {
+      output->frame = gst_video_codec_frame_ref (frame);
+      gst_video_codec_frame_set_user_data (frame, NULL, NULL);
+    }
+    if (status == GST_VAAPI_ENCODER_STATUS_SUCCESS) {
+      output->buffer = copy_coded_buffer (proxy);
+      if (!output->buffer)
+        goto error_copy;
+    }
+    gst_vaapi_coded_buffer_proxy_unref (proxy);
+
+    g_mutex_lock (&chunked->lock);
+    g_queue_push_tail (&chunk->outputs, output);
+    g_cond_broadcast (&chunked->cond);
+    g_mutex_unlock (&chunked->lock);
+  }
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error_encode:
+  {
+    GST_ERROR ("failed to encode a frame of chunk %u", chunk->index);
+    if (proxy)
+      gst_vaapi_coded_buffer_proxy_unref (proxy);
+    return status;
+  }
+error_copy:
+  {
+    GST_ERROR ("failed to copy a coded buffer of chunk %u", chunk->index);
+    chunk_output_free (output);
+    gst_vaapi_coded_buffer_proxy_unref (proxy);
+    return GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+}
+
+static GstVaapiEncoderStatus
+encode_frame (Worker * worker, Chunk * chunk, GstVideoCodecFrame * frame)
+{
+  GstVaapiEncoderStatus status;
+
+  status = gst_vaapi_encoder_put_frame (worker->encoder, frame);
+  if (status < GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return status;
+  worker->num_pending++;
+  return collect_frames (worker, chunk, FALSE);
+}
+
+/* Encodes the frames still held by the encoder, e.g. reordered ones,
+   so that the chunk does not reference the next one on this encoder */
+static GstVaapiEncoderStatus
+finish_chunk (Worker * worker, Chunk * chunk)
+{
+  GstVaapiEncoderStatus status;
+
+  status = gst_vaapi_encoder_flush (worker->encoder);
+  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return status;
+  status = collect_frames (worker, chunk, TRUE);
+  worker->num_pending = 0;
+  return status;
+}
+
+static gpointer
+worker_thread (gpointer data)
+{
+  Worker *const worker = data;
+  GstVaapiEncoderChunked *const chunked = worker->chunked;
+  GstVaapiEncoderStatus status;
+  WorkItem *item;
+  Chunk *chunk;
+
+  for (;;) {
+    item = g_async_queue_pop (worker->queue);
+    chunk = item->chunk;
+    if (!chunk) {
+      g_slice_free (WorkItem, item);
+      break;
+    }
+
+    /* A failed chunk is still flushed, for the next one to start
+       from a clean state */
+    status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+    if (!item->frame)
+      status = finish_chunk (worker, chunk);
+    else if (chunk->status == GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      status = encode_frame (worker, chunk, item->frame);
+
+    g_mutex_lock (&chunked->lock);
+    if (chunk->status == GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      chunk->status = status;
+    if (!item->frame) {
+      chunk->done = TRUE;
+      worker->num_chunks--;
+    }
+    g_cond_broadcast (&chunked->cond);
+    g_mutex_unlock (&chunked->lock);
+
+    if (item->frame)
+      gst_video_codec_frame_unref (item->frame);
+    g_slice_free (WorkItem, item);
+  }
+  return NULL;
+}
+
+static void
+worker_free (Worker * worker)
+{
+  if (worker->thread) {
+    worker_push (worker, NULL, NULL);
+    g_thread_join (worker->thread);
+  }
+  g_async_queue_unref (worker->queue);
+  gst_object_replace ((GstObject **) & worker->encoder, NULL);
+  g_slice_free (Worker, worker);
+}
+
+/* Queues the end of the current chunk, if any */
+static void
+end_chunk (GstVaapiEncoderChunked * chunked)
+{
+  Chunk *const chunk = chunked->current_chunk;
+
+  if (!chunk)
+    return;
+
+  g_mutex_lock (&chunked->lock);
+  chunk->ended = TRUE;
+  chunked->current_chunk = NULL;
+  g_mutex_unlock (&chunked->lock);
+
+  worker_push (chunk->worker, chunk, NULL);
+}
+
+/* Starts a new chunk on the next encoder, once its previous chunk is
+   encoded, so that about one chunk of frames is held per encoder */
+static Chunk *
+start_chunk (GstVaapiEncoderChunked * chunked)
+{
+  Worker *const worker = g_ptr_array_index (chunked->workers,
+      chunked->num_chunks % chunked->workers->len);
+  Chunk *chunk;
+
+  chunk = g_slice_new0 (Chunk);
+  chunk->index = chunked->num_chunks++;
+  chunk->worker = worker;
+  chunk->status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  g_queue_init (&chunk->outputs);
+
+  g_mutex_lock (&chunked->lock);
+  while (worker->num_chunks > 0)
+    g_cond_wait (&chunked->cond, &chunked->lock);
+  worker->num_chunks++;
+  g_queue_push_tail (&chunked->chunks, chunk);
+  chunked->current_chunk = chunk;
+  g_mutex_unlock (&chunked->lock);
+
+  GST_DEBUG ("chunk %u on encoder %u", chunk->index,
+      chunk->index % chunked->workers->len);
+  return chunk;
+}
+
+/* Checks that the stream headers of the @worker encoder are the ones
+   of the first encoder, so that their chunks can be concatenated */
+static gboolean
+check_stream_headers (GstVaapiEncoderChunked * chunked, Worker * worker)
+{
+  Worker *const first = g_ptr_array_index (chunked->workers, 0);
+  GstBuffer *codec_data = NULL, *first_codec_data = NULL;
+  GstMapInfo map_info;
+  gboolean same = FALSE;
+
+  if (worker->headers_checked)
+    return TRUE;
+  worker->headers_checked = TRUE;
+  if (worker == first)
+    return TRUE;
+
+  if (gst_vaapi_encoder_get_codec_data (first->encoder, &first_codec_data)
+      != GST_VAAPI_ENCODER_STATUS_SUCCESS
+      || gst_vaapi_encoder_get_codec_data (worker->encoder, &codec_data)
+      != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    goto done;
+
+  if (!codec_data || !first_codec_data)
+    same = codec_data == first_codec_data;
+  else if (gst_buffer_get_size (codec_data) ==
+      gst_buffer_get_size (first_codec_data)
+      && gst_buffer_map (first_codec_data, &map_info, GST_MAP_READ)) {
+    same = gst_buffer_memcmp (codec_data, 0, map_info.data,
+        map_info.size) == 0;
+    gst_buffer_unmap (first_codec_data, &map_info);
+  }
+
+done:
+  gst_buffer_replace (&codec_data, NULL);
+  gst_buffer_replace (&first_codec_data, NULL);
+  return same;
+}
+
+/**
+ * gst_vaapi_encoder_chunked_new:
+ * @display: a #GstVaapiDisplay
+ *
+ * Creates a new chunk-parallel encoding session, without any encoder.
+ * The encoders added afterwards shall all be bound to @display.
+ *
+ * Return value: the newly allocated #GstVaapiEncoderChunked
+ */
+GstVaapiEncoderChunked *
+gst_vaapi_encoder_chunked_new (GstVaapiDisplay * display)
+{
+  GstVaapiEncoderChunked *chunked;
+
+  g_return_val_if_fail (display != NULL, NULL);
+
+  chunked = g_slice_new0 (GstVaapiEncoderChunked);
+  chunked->display = gst_object_ref (display);
+  chunked->workers = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      worker_free);
+  chunked->chunk_size = DEFAULT_CHUNK_SIZE;
+  g_queue_init (&chunked->chunks);
+  g_mutex_init (&chunked->lock);
+  g_cond_init (&chunked->cond);
+  return chunked;
+}
+
+/**
+ * gst_vaapi_encoder_chunked_free:
+ * @chunked: a #GstVaapiEncoderChunked
+ *
+ * Stops the encoding threads and releases @chunked, along with the
+ * references it holds to the encoders. The frames not returned yet
+ * are dropped, so gst_vaapi_encoder_chunked_flush() shall be called
+ * first at end of stream.
+ */
+void
+gst_vaapi_encoder_chunked_free (GstVaapiEncoderChunked * chunked)
+{
+  g_return_if_fail (chunked != NULL);
+
+  end_chunk (chunked);
+  g_ptr_array_unref (chunked->workers);
+  g_queue_clear_full (&chunked->chunks, (GDestroyNotify) chunk_free);
+  g_mutex_clear (&chunked->lock);
+  g_cond_clear (&chunked->cond);
+  gst_vaapi_display_replace (&chunked->display, NULL);
+  g_slice_free (GstVaapiEncoderChunked, chunked);
+}
+
+/**
+ * gst_vaapi_encoder_chunked_add_encoder:
+ * @chunked: a #GstVaapiEncoderChunked
+ * @encoder: a #GstVaapiEncoder, not configured yet
+ *
+ * Adds @encoder to the ones the chunks are spread over. @chunked holds
+ * a reference to @encoder. Encoders can only be added before
+ * gst_vaapi_encoder_chunked_set_codec_state() is called.
+ *
+ * Return value: the index of the encoder, or -1 on error
+ */
+gint
+gst_vaapi_encoder_chunked_add_encoder (GstVaapiEncoderChunked * chunked,
+    GstVaapiEncoder * encoder)
+{
+  Worker *worker;
+
+  g_return_val_if_fail (chunked != NULL, -1);
+  g_return_val_if_fail (GST_VAAPI_IS_ENCODER (encoder), -1);
+
+  if (chunked->configured)
+    goto error_configured;
+  if (GST_VAAPI_ENCODER_DISPLAY (encoder) != chunked->display)
+    goto error_display;
+
+  worker = g_slice_new0 (Worker);
+  worker->chunked = chunked;
+  worker->encoder = gst_object_ref (encoder);
+  worker->queue = g_async_queue_new ();
+  g_ptr_array_add (chunked->workers, worker);
+  return chunked->workers->len - 1;
+
+  /* ERRORS */
+error_configured:
+  {
+    GST_ERROR ("could not add encoder after encoding started");
+    return -1;
+  }
+error_display:
+  {
+    GST_ERROR ("encoder is bound to another display");
+    return -1;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_chunked_get_num_encoders:
+ * @chunked: a #GstVaapiEncoderChunked
+ *
+ * Return value: the number of encoders in @chunked
+ */
+guint
+gst_vaapi_encoder_chunked_get_num_encoders (GstVaapiEncoderChunked * chunked)
+{
+  g_return_val_if_fail (chunked != NULL, 0);
+
+  return chunked->workers->len;
+}
+
+/**
+ * gst_vaapi_encoder_chunked_get_encoder:
+ * @chunked: a #GstVaapiEncoderChunked
+ * @index: the encoder index
+ *
+ * Return value: (transfer none): the #GstVaapiEncoder at @index, e.g.
+ *   to get the codec-data of the stream
+ */
+GstVaapiEncoder *
+gst_vaapi_encoder_chunked_get_encoder (GstVaapiEncoderChunked * chunked,
+    guint index)
+{
+  Worker *worker;
+
+  g_return_val_if_fail (chunked != NULL, NULL);
+  g_return_val_if_fail (index < chunked->workers->len, NULL);
+
+  worker = g_ptr_array_index (chunked->workers, index);
+  return worker->encoder;
+}
+
+/**
+ * gst_vaapi_encoder_chunked_set_chunk_size:
+ * @chunked: a #GstVaapiEncoderChunked
+ * @num_frames: the maximal number of frames of a chunk, or 0 to only
+ *   start chunks at the forced keyframes
+ *
+ * Sets the number of frames after which a new chunk is started. A
+ * chunk is also started at each forced keyframe. Larger chunks cost
+ * less keyframes, but more input frames are held while encoding.
+ */
+void
+gst_vaapi_encoder_chunked_set_chunk_size (GstVaapiEncoderChunked * chunked,
+    guint num_frames)
+{
+  g_return_if_fail (chunked != NULL);
+
+  chunked->chunk_size = num_frames;
+}
+
+/**
+ * gst_vaapi_encoder_chunked_set_codec_state:
+ * @chunked: a #GstVaapiEncoderChunked
+ * @state: a #GstVideoCodecState describing the input frames
+ *
+ * Configures every encoder for @state and starts their threads.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_set_codec_state (GstVaapiEncoderChunked * chunked,
+    GstVideoCodecState * state)
+{
+  GstVaapiEncoderStatus status;
+  Worker *worker;
+  guint i;
+
+  g_return_val_if_fail (chunked != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (state != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (!chunked->configured,
+      GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED);
+
+  if (chunked->workers->len == 0)
+    goto error_no_encoder;
+
+  for (i = 0; i < chunked->workers->len; i++) {
+    worker = g_ptr_array_index (chunked->workers, i);
+    status = gst_vaapi_encoder_set_codec_state (worker->encoder, state);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_configure;
+
+    if (worker->encoder->profile != GST_VAAPI_PROFILE_UNKNOWN) {
+      GST_INFO ("encoder %u uses entrypoint %d", i,
+          gst_vaapi_encoder_get_entrypoint (worker->encoder,
+              worker->encoder->profile));
+    }
+  }
+
+  for (i = 0; i < chunked->workers->len; i++) {
+    worker = g_ptr_array_index (chunked->workers, i);
+    worker->thread = g_thread_try_new ("vaapichunkenc", worker_thread,
+        worker, NULL);
+    if (!worker->thread)
+      goto error_thread;
+  }
+
+  chunked->configured = TRUE;
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error_no_encoder:
+  {
+    GST_ERROR ("no encoder to encode chunks with");
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  }
+error_configure:
+  {
+    GST_ERROR ("failed to configure encoder %u", i);
+    return status;
+  }
+error_thread:
+  {
+    GST_ERROR ("failed to create the thread of encoder %u", i);
+    return GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_chunked_put_frame:
+ * @chunked: a #GstVaapiEncoderChunked
+ * @frame: a #GstVideoCodecFrame holding the input #GstVaapiSurfaceProxy
+ *
+ * Queues @frame to the encoder of the current chunk, or starts a new
+ * chunk with @frame, forced as a keyframe. This waits for the previous
+ * chunk of the next encoder to be encoded first, if needed. The input
+ * surface of @frame is released once encoded.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_put_frame (GstVaapiEncoderChunked * chunked,
+    GstVideoCodecFrame * frame)
+{
+  Chunk *chunk;
+
+  g_return_val_if_fail (chunked != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (frame != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (chunked->configured,
+      GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED);
+
+  chunk = chunked->current_chunk;
+  if (chunk && ((chunked->chunk_size > 0
+              && chunk->num_frames >= chunked->chunk_size)
+          || GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame))) {
+    end_chunk (chunked);
+    chunk = NULL;
+  }
+  if (!chunk) {
+    chunk = start_chunk (chunked);
+    GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
+  }
+
+  chunk->num_frames++;
+  worker_push (chunk->worker, chunk, frame);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
+/**
+ * gst_vaapi_encoder_chunked_get_buffer:
+ * @chunked: a #GstVaapiEncoderChunked
+ * @out_frame_ptr: return location for the coded #GstVideoCodecFrame
+ * @out_buffer_ptr: return location for the coded data
+ * @timeout: the number of microseconds to wait for a coded frame, or
+ *   0 to wait for all the chunks ended so far
+ *
+ * Returns the next coded frame in stream order, along with its data.
+ * The caller owns both and shall unref them after usage. If the rate
+ * control dropped the frame, %GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED
+ * is returned and *@out_buffer_ptr is set to %NULL. Otherwise,
+ * %GST_VAAPI_ENCODER_STATUS_NO_BUFFER is returned if no frame is
+ * available so far.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_get_buffer (GstVaapiEncoderChunked * chunked,
+    GstVideoCodecFrame ** out_frame_ptr, GstBuffer ** out_buffer_ptr,
+    guint64 timeout)
+{
+  const gint64 end_time = g_get_monotonic_time () + timeout;
+  GstVaapiEncoderStatus status;
+  ChunkOutput *output = NULL;
+  Worker *worker = NULL;
+  Chunk *chunk;
+
+  g_return_val_if_fail (chunked != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (out_frame_ptr != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (out_buffer_ptr != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  g_mutex_lock (&chunked->lock);
+  for (;;) {
+    chunk = g_queue_peek_head (&chunked->chunks);
+    if (!chunk) {
+      status = GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
+      break;
+    }
+    if (chunk->status != GST_VAAPI_ENCODER_STATUS_SUCCESS) {
+      status = chunk->status;
+      break;
+    }
+
+    output = g_queue_pop_head (&chunk->outputs);
+    if (output) {
+      status = output->buffer ? GST_VAAPI_ENCODER_STATUS_SUCCESS :
+          GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED;
+      worker = chunk->worker;
+      break;
+    }
+
+    if (chunk->done) {
+      g_queue_pop_head (&chunked->chunks);
+      chunk_free (chunk);
+      continue;
+    }
+
+    /* The current chunk may never complete without more frames */
+    if (timeout == 0 && !chunk->ended) {
+      status = GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
+      break;
+    }
+    if (timeout == 0)
+      g_cond_wait (&chunked->cond, &chunked->lock);
+    else if (!g_cond_wait_until (&chunked->cond, &chunked->lock, end_time)) {
+      status = GST_VAAPI_ENCODER_STATUS_NO_BUFFER;
+      break;
+    }
+  }
+  g_mutex_unlock (&chunked->lock);
+
+  if (!output)
+    return status;
+
+  if (!check_stream_headers (chunked, worker))
+    goto error_headers;
+
+  *out_frame_ptr = output->frame;
+  *out_buffer_ptr = output->buffer;
+  output->frame = NULL;
+  output->buffer = NULL;
+  chunk_output_free (output);
+  return status;
+
+  /* ERRORS */
+error_headers:
+  {
+    GST_ERROR ("stream headers differ from the first encoder ones, "
+        "chunks cannot be concatenated");
+    chunk_output_free (output);
+    return GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_HEADER;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_chunked_flush:
+ * @chunked: a #GstVaapiEncoderChunked
+ *
+ * Ends the current chunk, so that its last frames get encoded. The
+ * next frame starts a new chunk. The remaining coded frames are then
+ * retrieved with gst_vaapi_encoder_chunked_get_buffer() and a zero
+ * timeout, until %GST_VAAPI_ENCODER_STATUS_NO_BUFFER is returned.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_flush (GstVaapiEncoderChunked * chunked)
+{
+  g_return_val_if_fail (chunked != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  end_chunk (chunked);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
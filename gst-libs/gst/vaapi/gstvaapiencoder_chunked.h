@@ -0,0 +1,68 @@
+/*
+ *  gstvaapiencoder_chunked.h - Chunk-parallel encoding of a single stream
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_ENCODER_CHUNKED_H
+#define GST_VAAPI_ENCODER_CHUNKED_H
+
+#include <gst/vaapi/gstvaapiencoder.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstVaapiEncoderChunked GstVaapiEncoderChunked;
+
+GstVaapiEncoderChunked *
+gst_vaapi_encoder_chunked_new (GstVaapiDisplay * display);
+
+void
+gst_vaapi_encoder_chunked_free (GstVaapiEncoderChunked * chunked);
+
+gint
+gst_vaapi_encoder_chunked_add_encoder (GstVaapiEncoderChunked * chunked,
+    GstVaapiEncoder * encoder);
+
+guint
+gst_vaapi_encoder_chunked_get_num_encoders (GstVaapiEncoderChunked * chunked);
+
+GstVaapiEncoder *
+gst_vaapi_encoder_chunked_get_encoder (GstVaapiEncoderChunked * chunked,
+    guint index);
+
+void
+gst_vaapi_encoder_chunked_set_chunk_size (GstVaapiEncoderChunked * chunked,
+    guint num_frames);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_set_codec_state (GstVaapiEncoderChunked * chunked,
+    GstVideoCodecState * state);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_put_frame (GstVaapiEncoderChunked * chunked,
+    GstVideoCodecFrame * frame);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_get_buffer (GstVaapiEncoderChunked * chunked,
+    GstVideoCodecFrame ** out_frame_ptr, GstBuffer ** out_buffer_ptr,
+    guint64 timeout);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_chunked_flush (GstVaapiEncoderChunked * chunked);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_ENCODER_CHUNKED_H */
@@ -62,7 +62,9 @@
 #define SUPPORTED_TUNE_OPTIONS                          \
   (GST_VAAPI_ENCODER_TUNE_MASK (NONE) |                 \
    GST_VAAPI_ENCODER_TUNE_MASK (HIGH_COMPRESSION) |     \
-   GST_VAAPI_ENCODER_TUNE_MASK (LOW_POWER))
+   GST_VAAPI_ENCODER_TUNE_MASK (LOW_LATENCY) |          \
+   GST_VAAPI_ENCODER_TUNE_MASK (LOW_POWER) |            \
+   GST_VAAPI_ENCODER_TUNE_MASK (AUTO))
 
 /* Supported set of VA packed headers, within this implementation */
 #define SUPPORTED_PACKED_HEADERS                \
@@ -154,6 +156,7 @@ typedef struct
   guint poc;
   guint frame_num;
   guint temporal_id;
+  gboolean long_term;
 } GstVaapiEncoderH264Ref;
 
 typedef enum
@@ -776,10 +779,25 @@ struct _GstVaapiEncoderH264
   guint8 delta_pic_order_always_zero_flag;
   guint num_ref_frames;
 
+  /* long-term reference, to recover from losses without an IDR */
+  guint ltr_interval;
+  guint ltr_frame_count;
+  GstVaapiEncoderH264Ref *ltr_ref;
+  gint ltr_available;           /* atomic */
+  gint ltr_recovery_requested;  /* atomic */
+  gboolean ltr_mark;            /* current picture becomes the LTR */
+  gboolean ltr_recovery;        /* current picture only uses the LTR */
+
   GstBuffer *sps_data;
   GstBuffer *subset_sps_data;
   GstBuffer *pps_data;
 
+  /* prebuilt packed headers */
+  GstVaapiH26xHeaderCache sps_cache;
+  GstVaapiH26xHeaderCache subset_sps_cache;
+  GstVaapiH26xHeaderCache pps_cache;
+  GstVaapiH26xHeaderCache slice_cache;
+
   guint bitrate_bits;           // bitrate (bits)
   guint cpb_length;             // length of CPB buffer (ms)
   guint cpb_length_bits;        // length of CPB buffer (bits)
@@ -890,13 +908,16 @@ bs_error:
   }
 }
 
-/* Write a Slice NAL unit */
+/* Write the slice header after first_mb_in_slice, which is the same
+   for all the slices of a picture */
 static gboolean
 bs_write_slice (GstBitWriter * bs,
     const VAEncSliceParameterBufferH264 * slice_param,
     GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture)
 {
   const VAEncPictureParameterBufferH264 *const pic_param = picture->param;
+  GstVaapiH264ViewRefPool *const ref_pool =
+      &encoder->ref_pools[encoder->view_idx];
   guint32 field_pic_flag = 0;
   guint32 ref_pic_list_modification_flag_l0 = 0;
   guint32 ref_pic_list_modification_flag_l1 = 0;
@@ -904,8 +925,6 @@ bs_write_slice (GstBitWriter * bs,
   guint32 long_term_reference_flag = 0;
   guint32 adaptive_ref_pic_marking_mode_flag = 0;
 
-  /* first_mb_in_slice */
-  WRITE_UE (bs, slice_param->macroblock_address);
   /* slice_type */
   WRITE_UE (bs, slice_param->slice_type);
   /* pic_parameter_set_id */
@@ -953,14 +972,24 @@ bs_write_slice (GstBitWriter * bs,
     if ((encoder->prediction_type != GST_VAAPI_ENCODER_H264_PREDICTION_DEFAULT)
         && (encoder->abs_diff_pic_num_list0 > 1))
       ref_pic_list_modification_flag_l0 = 1;
+    /* the decoder still lists the short-term references first */
+    if (encoder->ltr_recovery)
+      ref_pic_list_modification_flag_l0 = 1;
 
     WRITE_UINT32 (bs, ref_pic_list_modification_flag_l0, 1);
 
     if (ref_pic_list_modification_flag_l0) {
-      /*modification_of_pic_num_idc */
-      WRITE_UE (bs, 0);
-      /* abs_diff_pic_num_minus1 */
-      WRITE_UE (bs, encoder->abs_diff_pic_num_list0 - 1);
+      if (encoder->ltr_recovery) {
+        /*modification_of_pic_num_idc */
+        WRITE_UE (bs, 2);
+        /* long_term_pic_num, the LongTermFrameIdx is always 0 */
+        WRITE_UE (bs, 0);
+      } else {
+        /*modification_of_pic_num_idc */
+        WRITE_UE (bs, 0);
+        /* abs_diff_pic_num_minus1 */
+        WRITE_UE (bs, encoder->abs_diff_pic_num_list0 - 1);
+      }
       /*modification_of_pic_num_idc */
       WRITE_UE (bs, 3);
     }
@@ -999,12 +1028,40 @@ bs_write_slice (GstBitWriter * bs,
     if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture)) {
       /* no_output_of_prior_pics_flag = 0 */
       WRITE_UINT32 (bs, no_output_of_prior_pics_flag, 1);
-      /* long_term_reference_flag = 0 */
+      /* the IDR is the first long-term reference, if any */
+      long_term_reference_flag = encoder->ltr_mark;
       WRITE_UINT32 (bs, long_term_reference_flag, 1);
     } else {
-      /* only sliding_window reference picture marking mode is supported */
-      /* adpative_ref_pic_marking_mode_flag = 0 */
+      /* sliding window marking, unless the picture becomes the
+         long-term reference or drops the short-term ones */
+      adaptive_ref_pic_marking_mode_flag = encoder->ltr_mark ||
+          (encoder->ltr_recovery && !g_queue_is_empty (&ref_pool->ref_list));
       WRITE_UINT32 (bs, adaptive_ref_pic_marking_mode_flag, 1);
+
+      if (adaptive_ref_pic_marking_mode_flag) {
+        if (encoder->ltr_recovery) {
+          GList *l;
+
+          for (l = g_queue_peek_head_link (&ref_pool->ref_list); l;
+              l = g_list_next (l)) {
+            const GstVaapiEncoderH264Ref *const ref = l->data;
+
+            /* memory_management_control_operation: unmark short-term */
+            WRITE_UE (bs, 1);
+            /* difference_of_pic_nums_minus1 */
+            WRITE_UE (bs, (picture->frame_num + encoder->max_frame_num -
+                    ref->frame_num) % encoder->max_frame_num - 1);
+          }
+        }
+        if (encoder->ltr_mark) {
+          /* memory_management_control_operation: mark current long-term */
+          WRITE_UE (bs, 6);
+          /* long_term_frame_idx */
+          WRITE_UE (bs, 0);
+        }
+        /* memory_management_control_operation: end */
+        WRITE_UE (bs, 0);
+      }
     }
   }
 
@@ -1291,6 +1348,17 @@ ensure_tuning_high_compression (GstVaapiEncoderH264 * encoder)
   return TRUE;
 }
 
+/* Ensure low latency tuning options: output pictures in decode order */
+static gboolean
+ensure_tuning_low_latency (GstVaapiEncoderH264 * encoder)
+{
+  encoder->num_bframes = 0;
+  if (encoder->prediction_type ==
+      GST_VAAPI_ENCODER_H264_PREDICTION_HIERARCHICAL_B)
+    encoder->prediction_type = GST_VAAPI_ENCODER_H264_PREDICTION_DEFAULT;
+  return TRUE;
+}
+
 /* Ensure tuning options */
 static gboolean
 ensure_tuning (GstVaapiEncoderH264 * encoder)
@@ -1301,6 +1369,9 @@ ensure_tuning (GstVaapiEncoderH264 * encoder)
     case GST_VAAPI_ENCODER_TUNE_HIGH_COMPRESSION:
       success = ensure_tuning_high_compression (encoder);
       break;
+    case GST_VAAPI_ENCODER_TUNE_LOW_LATENCY:
+      success = ensure_tuning_low_latency (encoder);
+      break;
     default:
       success = TRUE;
       break;
@@ -1482,29 +1553,70 @@ bs_error:
   }
 }
 
+/* Parameters the SPS and subset SPS headers are built from */
+typedef struct
+{
+  VAEncSequenceParameterBufferH264 seq_param;
+  VAEncMiscParameterHRD hrd_params;
+  GstVaapiProfile profile;
+  GstVaapiRateControl rate_control;
+} SpsCacheKey;
+
+/* Parameters the PPS header is built from */
+typedef struct
+{
+  VAEncPictureParameterBufferH264 pic_param;
+  GstVaapiProfile profile;
+} PpsCacheKey;
+
+static void
+fill_sps_cache_key (GstVaapiEncoderH264 * encoder,
+    const VAEncSequenceParameterBufferH264 * seq_param,
+    GstVaapiProfile profile, SpsCacheKey * key)
+{
+  memset (key, 0, sizeof (*key));
+  memcpy (&key->seq_param, seq_param, sizeof (key->seq_param));
+  fill_hrd_params (encoder, &key->hrd_params);
+  key->profile = profile;
+  key->rate_control = GST_VAAPI_ENCODER_RATE_CONTROL (encoder);
+}
+
+/* Leaves out the fields that change on every picture but are not
+   written into the PPS */
+static void
+fill_pps_cache_key (GstVaapiEncoderH264 * encoder,
+    const VAEncPictureParameterBufferH264 * pic_param, PpsCacheKey * key)
+{
+  VAEncPictureParameterBufferH264 *const param = &key->pic_param;
+
+  memset (key, 0, sizeof (*key));
+  memcpy (param, pic_param, sizeof (*param));
+  memset (&param->CurrPic, 0, sizeof (param->CurrPic));
+  memset (param->ReferenceFrames, 0, sizeof (param->ReferenceFrames));
+  param->coded_buf = VA_INVALID_ID;
+  param->last_picture = 0;
+  param->frame_num = 0;
+  param->pic_fields.bits.idr_pic_flag = 0;
+  param->pic_fields.bits.reference_pic_flag = 0;
+  key->profile = encoder->profile;
+}
+
 /* Adds the supplied sequence header (SPS) to the list of packed
    headers to pass down as-is to the encoder */
 static gboolean
 add_packed_sequence_header (GstVaapiEncoderH264 * encoder,
     GstVaapiEncPicture * picture, GstVaapiEncSequence * sequence)
 {
-  GstVaapiEncoder *const base_encoder = GST_VAAPI_ENCODER_CAST (encoder);
+  GstVaapiH26xHeaderCache *const cache = &encoder->sps_cache;
   GstVaapiEncPackedHeader *packed_seq;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_seq_param = { 0 };
   const VAEncSequenceParameterBufferH264 *const seq_param = sequence->param;
   GstVaapiProfile profile = encoder->profile;
-
-  VAEncMiscParameterHRD hrd_params;
+  SpsCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  fill_hrd_params (encoder, &hrd_params);
-
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
-  bs_write_nal_header (&bs, GST_H264_NAL_REF_IDC_HIGH, GST_H264_NAL_SPS);
-
   /* Set High profile for encoding the MVC base view. Otherwise, some
      traditional decoder cannot recognize MVC profile streams with
      only the base view in there */
@@ -1512,12 +1624,19 @@ add_packed_sequence_header (GstVaapiEncoderH264 * encoder,
       profile == GST_VAAPI_PROFILE_H264_STEREO_HIGH)
     profile = GST_VAAPI_PROFILE_H264_HIGH;
 
-  bs_write_sps (&bs, seq_param, profile, base_encoder->rate_control,
-      &hrd_params);
+  fill_sps_cache_key (encoder, seq_param, profile, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    WRITE_UINT32 (&bs, 0x00000001, 32); /* start code */
+    bs_write_nal_header (&bs, GST_H264_NAL_REF_IDC_HIGH, GST_H264_NAL_SPS);
 
-  g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+    bs_write_sps (&bs, seq_param, profile, key.rate_control, &key.hrd_params);
+
+    g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_seq_param.type = VAEncPackedHeaderSequence;
   packed_seq_param.bit_length = data_bit_size;
@@ -1533,7 +1652,6 @@ add_packed_sequence_header (GstVaapiEncoderH264 * encoder,
 
   /* store sps data */
   _check_sps_pps_status (encoder, data + 4, data_bit_size / 8 - 4);
-  gst_bit_writer_reset (&bs);
   return TRUE;
 
   /* ERRORS */
@@ -1549,29 +1667,31 @@ static gboolean
 add_packed_sequence_header_mvc (GstVaapiEncoderH264 * encoder,
     GstVaapiEncPicture * picture, GstVaapiEncSequence * sequence)
 {
-  GstVaapiEncoder *const base_encoder = GST_VAAPI_ENCODER_CAST (encoder);
+  GstVaapiH26xHeaderCache *const cache = &encoder->subset_sps_cache;
   GstVaapiEncPackedHeader *packed_seq;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_header_param_buffer = { 0 };
   const VAEncSequenceParameterBufferH264 *const seq_param = sequence->param;
-  VAEncMiscParameterHRD hrd_params;
+  SpsCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  fill_hrd_params (encoder, &hrd_params);
-
-  /* non-base layer, pack one subset sps */
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
-  bs_write_nal_header (&bs, GST_H264_NAL_REF_IDC_HIGH, GST_H264_NAL_SUBSET_SPS);
+  fill_sps_cache_key (encoder, seq_param, encoder->profile, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    /* non-base layer, pack one subset sps */
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    WRITE_UINT32 (&bs, 0x00000001, 32); /* start code */
+    bs_write_nal_header (&bs, GST_H264_NAL_REF_IDC_HIGH,
+        GST_H264_NAL_SUBSET_SPS);
 
-  bs_write_subset_sps (&bs, seq_param, encoder->profile,
-      base_encoder->rate_control, encoder->num_views, encoder->view_ids,
-      &hrd_params);
+    bs_write_subset_sps (&bs, seq_param, encoder->profile, key.rate_control,
+        encoder->num_views, encoder->view_ids, &key.hrd_params);
 
-  g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+    g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_header_param_buffer.type = VAEncPackedHeaderSequence;
   packed_header_param_buffer.bit_length = data_bit_size;
@@ -1587,7 +1707,6 @@ add_packed_sequence_header_mvc (GstVaapiEncoderH264 * encoder,
 
   /* store subset sps data */
   _check_sps_pps_status (encoder, data + 4, data_bit_size / 8 - 4);
-  gst_bit_writer_reset (&bs);
   return TRUE;
 
   /* ERRORS */
@@ -1605,20 +1724,26 @@ static gboolean
 add_packed_picture_header (GstVaapiEncoderH264 * encoder,
     GstVaapiEncPicture * picture)
 {
+  GstVaapiH26xHeaderCache *const cache = &encoder->pps_cache;
   GstVaapiEncPackedHeader *packed_pic;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_pic_param = { 0 };
   const VAEncPictureParameterBufferH264 *const pic_param = picture->param;
+  PpsCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
-  bs_write_nal_header (&bs, GST_H264_NAL_REF_IDC_HIGH, GST_H264_NAL_PPS);
-  bs_write_pps (&bs, pic_param, encoder->profile);
-  g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+  fill_pps_cache_key (encoder, pic_param, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    WRITE_UINT32 (&bs, 0x00000001, 32); /* start code */
+    bs_write_nal_header (&bs, GST_H264_NAL_REF_IDC_HIGH, GST_H264_NAL_PPS);
+    bs_write_pps (&bs, pic_param, encoder->profile);
+    g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_pic_param.type = VAEncPackedHeaderPicture;
   packed_pic_param.bit_length = data_bit_size;
@@ -1634,7 +1759,6 @@ add_packed_picture_header (GstVaapiEncoderH264 * encoder,
 
   /* store pps data */
   _check_sps_pps_status (encoder, data + 4, data_bit_size / 8 - 4);
-  gst_bit_writer_reset (&bs);
   return TRUE;
 
   /* ERRORS */
@@ -1831,6 +1955,7 @@ static gboolean
 add_packed_slice_header (GstVaapiEncoderH264 * encoder,
     GstVaapiEncPicture * picture, GstVaapiEncSlice * slice)
 {
+  GstVaapiH26xHeaderCache *const cache = &encoder->slice_cache;
   GstVaapiEncPackedHeader *packed_slice;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_slice_param = { 0 };
@@ -1839,6 +1964,15 @@ add_packed_slice_header (GstVaapiEncoderH264 * encoder,
   guint8 *data;
   guint8 nal_ref_idc, nal_unit_type;
 
+  /* The slices of a picture only differ in first_mb_in_slice, the rest
+     of the header is written once per picture */
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, NULL, 0)) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    if (!bs_write_slice (&bs, slice_param, encoder, picture))
+      goto bs_error;
+    gst_vaapi_utils_h26x_header_cache_store (cache, NULL, 0, &bs);
+  }
+
   gst_bit_writer_init_with_size (&bs, 128, FALSE);
   WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
 
@@ -1852,7 +1986,10 @@ add_packed_slice_header (GstVaapiEncoderH264 * encoder,
   } else
     bs_write_nal_header (&bs, nal_ref_idc, nal_unit_type);
 
-  bs_write_slice (&bs, slice_param, encoder, picture);
+  /* first_mb_in_slice */
+  WRITE_UE (&bs, slice_param->macroblock_address);
+  if (!bs_write_bits (&bs, cache->data, cache->bit_size))
+    goto bs_error;
   data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
   data = GST_BIT_WRITER_DATA (&bs);
 
@@ -1904,6 +2041,51 @@ reference_pic_create (GstVaapiEncoderH264 * encoder,
   return ref;
 }
 
+/* Long-term references are signalled through the packed slice
+   headers, and restricted to the IPPP structure of real-time
+   encoding, see reset_properties() */
+static inline gboolean
+h264_use_ltr (GstVaapiEncoderH264 * encoder)
+{
+  return encoder->ltr_interval > 0 &&
+      (GST_VAAPI_ENCODER_PACKED_HEADERS (encoder) &
+      VA_ENC_PACKED_HEADER_SLICE);
+}
+
+/* Decides whether @picture becomes the long-term reference, or only
+ * predicts from it after a loss was reported. The IDR pictures always
+ * become the long-term reference, so that there is one at any time */
+static void
+ltr_prepare_picture (GstVaapiEncoderH264 * encoder,
+    GstVaapiEncPicture * picture)
+{
+  encoder->ltr_mark = FALSE;
+  encoder->ltr_recovery = FALSE;
+  if (!h264_use_ltr (encoder))
+    return;
+
+  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture)) {
+    g_atomic_int_set (&encoder->ltr_recovery_requested, FALSE);
+    encoder->ltr_mark = TRUE;
+    encoder->ltr_frame_count = 0;
+    return;
+  }
+  if (!encoder->ltr_ref)
+    return;
+
+  if (g_atomic_int_compare_and_exchange (&encoder->ltr_recovery_requested,
+          TRUE, FALSE)) {
+    GST_DEBUG ("frame %u only references the long-term frame %u",
+        picture->frame_num, encoder->ltr_ref->frame_num);
+    encoder->ltr_recovery = TRUE;
+    return;
+  }
+  if (++encoder->ltr_frame_count >= encoder->ltr_interval) {
+    encoder->ltr_mark = TRUE;
+    encoder->ltr_frame_count = 0;
+  }
+}
+
 static gboolean
 reference_list_update (GstVaapiEncoderH264 * encoder,
     GstVaapiEncPicture * picture, GstVaapiSurfaceProxy * surface)
@@ -1917,20 +2099,66 @@ reference_list_update (GstVaapiEncoderH264 * encoder,
     gst_vaapi_encoder_release_surface (GST_VAAPI_ENCODER (encoder), surface);
     return TRUE;
   }
+
+  /* Mirrors the marking of the decoder: the short-term references are
+     dropped by an IDR or, through MMCO 1, by a recovery picture, and
+     the sliding window doesn't apply to the pictures marked as
+     long-term through MMCO 6 */
   if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture)) {
     while (!g_queue_is_empty (&ref_pool->ref_list))
       reference_pic_free (encoder, g_queue_pop_head (&ref_pool->ref_list));
-  } else if (g_queue_get_length (&ref_pool->ref_list) >=
-      ref_pool->max_ref_frames) {
+    if (encoder->ltr_ref) {
+      reference_pic_free (encoder, encoder->ltr_ref);
+      encoder->ltr_ref = NULL;
+      g_atomic_int_set (&encoder->ltr_available, FALSE);
+    }
+  } else if (encoder->ltr_recovery) {
+    while (!g_queue_is_empty (&ref_pool->ref_list))
+      reference_pic_free (encoder, g_queue_pop_head (&ref_pool->ref_list));
+  } else if (!encoder->ltr_mark && g_queue_get_length (&ref_pool->ref_list) +
+      (encoder->ltr_ref != NULL) >= ref_pool->max_ref_frames) {
     reference_pic_free (encoder, g_queue_pop_head (&ref_pool->ref_list));
   }
   ref = reference_pic_create (encoder, picture, surface);
+
+  if (encoder->ltr_mark) {
+    reference_pic_free (encoder, encoder->ltr_ref);
+    ref->long_term = TRUE;
+    encoder->ltr_ref = ref;
+    g_atomic_int_set (&encoder->ltr_available, TRUE);
+    return TRUE;
+  }
+
   g_queue_push_tail (&ref_pool->ref_list, ref);
   g_assert (g_queue_get_length (&ref_pool->ref_list) <=
       ref_pool->max_ref_frames);
   return TRUE;
 }
 
+/* P pictures predict from the short-term references, most recent
+ * first, and then from the long-term one, as in the initial list of
+ * the decoder. A recovery picture only predicts from the long-term
+ * reference */
+static gboolean
+reference_list_init_ltr (GstVaapiEncoderH264 * encoder,
+    GstVaapiEncPicture * picture, GQueue * ref_list,
+    GstVaapiEncoderH264Ref ** reflist_0, guint * reflist_0_count)
+{
+  GList *iter;
+  guint count = 0;
+
+  if (!encoder->ltr_recovery) {
+    iter = g_queue_peek_tail_link (ref_list);
+    for (; iter; iter = g_list_previous (iter))
+      reflist_0[count++] = iter->data;
+  }
+  if (encoder->ltr_ref)
+    reflist_0[count++] = encoder->ltr_ref;
+
+  *reflist_0_count = count;
+  return count > 0;
+}
+
 /* update reflist0 for hierarchical-p and hierarchical-b encode */
 static void
 reflist0_init_hierarchical (GstVaapiEncoderH264 * encoder,
@@ -2052,6 +2280,10 @@ reference_list_init (GstVaapiEncoderH264 * encoder,
   if (picture->type == GST_VAAPI_PICTURE_TYPE_I)
     return TRUE;
 
+  if (h264_use_ltr (encoder))
+    return reference_list_init_ltr (encoder, picture, &ref_pool->ref_list,
+        reflist_0, reflist_0_count);
+
   /* reference picture handling for hierarchial encode */
   if (encoder->prediction_type != GST_VAAPI_ENCODER_H264_PREDICTION_DEFAULT) {
     return reference_list_init_hierarchical (encoder, picture,
@@ -2223,6 +2455,17 @@ fill_picture (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture,
       pic_param->ReferenceFrames[i].frame_idx = ref_pic->frame_num;
       ++i;
     }
+    if (encoder->ltr_ref) {
+      ref_pic = encoder->ltr_ref;
+      pic_param->ReferenceFrames[i].picture_id =
+          GST_VAAPI_SURFACE_PROXY_SURFACE_ID (ref_pic->pic);
+      pic_param->ReferenceFrames[i].TopFieldOrderCnt = ref_pic->poc;
+      pic_param->ReferenceFrames[i].flags |=
+          VA_PICTURE_H264_LONG_TERM_REFERENCE;
+      /* LongTermFrameIdx */
+      pic_param->ReferenceFrames[i].frame_idx = 0;
+      ++i;
+    }
     g_assert (i <= 16 && i <= ref_pool->max_ref_frames);
   }
   for (; i < 16; ++i) {
@@ -2264,6 +2507,25 @@ fill_picture (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture,
 }
 
 /* Adds slice headers to picture */
+/* Returns the QP of the slices of @picture, only the I/P/B offsets of
+   the constant QP mode apply */
+static guint
+get_picture_qp (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture)
+{
+  gint qp = encoder->qp_i;
+
+  if (GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP) {
+    if (picture->type == GST_VAAPI_PICTURE_TYPE_P)
+      qp += encoder->qp_ip;
+    else if (picture->type == GST_VAAPI_PICTURE_TYPE_B)
+      qp += encoder->qp_ib;
+    /* software rate control, see gst_vaapi_encoder_encode_and_queue() */
+    qp += picture->qp_delta;
+    qp = CLAMP (qp, (gint) encoder->min_qp, (gint) encoder->max_qp);
+  }
+  return qp;
+}
+
 static gboolean
 add_slice_headers (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture,
     GstVaapiEncoderH264Ref ** reflist_0, guint reflist_0_count,
@@ -2281,6 +2543,7 @@ add_slice_headers (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture,
   mb_size = encoder->mb_width * encoder->mb_height;
 
   g_assert (encoder->num_slices && encoder->num_slices < mb_size);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->slice_cache);
   slice_of_mbs = mb_size / encoder->num_slices;
   slice_mod_mbs = mb_size % encoder->num_slices;
   last_mb_index = 0;
@@ -2330,9 +2593,16 @@ add_slice_headers (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture,
             GST_VAAPI_SURFACE_PROXY_SURFACE_ID (reflist_0[i_ref]->pic);
         slice_param->RefPicList0[i_ref].TopFieldOrderCnt =
             reflist_0[i_ref]->poc;
-        slice_param->RefPicList0[i_ref].flags |=
-            VA_PICTURE_H264_SHORT_TERM_REFERENCE;
-        slice_param->RefPicList0[i_ref].frame_idx = reflist_0[i_ref]->frame_num;
+        if (reflist_0[i_ref]->long_term) {
+          slice_param->RefPicList0[i_ref].flags |=
+              VA_PICTURE_H264_LONG_TERM_REFERENCE;
+          slice_param->RefPicList0[i_ref].frame_idx = 0;
+        } else {
+          slice_param->RefPicList0[i_ref].flags |=
+              VA_PICTURE_H264_SHORT_TERM_REFERENCE;
+          slice_param->RefPicList0[i_ref].frame_idx =
+              reflist_0[i_ref]->frame_num;
+        }
       }
     }
     for (; i_ref < G_N_ELEMENTS (slice_param->RefPicList0); ++i_ref) {
@@ -2383,22 +2653,8 @@ add_slice_headers (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture,
         sizeof (slice_param->chroma_offset_l1));
 
     slice_param->cabac_init_idc = 0;
-    slice_param->slice_qp_delta = encoder->qp_i - encoder->init_qp;
-    if (GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP) {
-      if (picture->type == GST_VAAPI_PICTURE_TYPE_P) {
-        slice_param->slice_qp_delta += encoder->qp_ip;
-      } else if (picture->type == GST_VAAPI_PICTURE_TYPE_B) {
-        slice_param->slice_qp_delta += encoder->qp_ib;
-      }
-      if ((gint) encoder->init_qp + slice_param->slice_qp_delta <
-          (gint) encoder->min_qp) {
-        slice_param->slice_qp_delta = encoder->min_qp - encoder->init_qp;
-      }
-      if ((gint) encoder->init_qp + slice_param->slice_qp_delta >
-          (gint) encoder->max_qp) {
-        slice_param->slice_qp_delta = encoder->max_qp - encoder->init_qp;
-      }
-    }
+    slice_param->slice_qp_delta =
+        (gint) get_picture_qp (encoder, picture) - (gint) encoder->init_qp;
     slice_param->disable_deblocking_filter_idc = 0;
     slice_param->slice_alpha_c0_offset_div2 = 2;
     slice_param->slice_beta_offset_div2 = 2;
@@ -2577,10 +2833,17 @@ ensure_misc_params (GstVaapiEncoderH264 * encoder, GstVaapiEncPicture * picture)
 
   if (!gst_vaapi_encoder_ensure_param_roi_regions (base_encoder, picture))
     return FALSE;
+  if (!gst_vaapi_encoder_ensure_qp_map (base_encoder, picture,
+          get_picture_qp (encoder, picture), encoder->min_qp, encoder->max_qp))
+    return FALSE;
 
   if (!gst_vaapi_encoder_ensure_param_quality_level (base_encoder, picture))
     return FALSE;
 
+  if (!gst_vaapi_encoder_ensure_param_intra_refresh (base_encoder, picture,
+          encoder->mb_width))
+    return FALSE;
+
   return TRUE;
 
 error_create_packed_sei_hdr:
@@ -2730,6 +2993,9 @@ ensure_profile_and_level (GstVaapiEncoderH264 * encoder)
   if (!ensure_profile (encoder) || !ensure_profile_limits (encoder))
     return GST_VAAPI_ENCODER_STATUS_ERROR_UNSUPPORTED_PROFILE;
 
+  GST_VAAPI_ENCODER_CAST (encoder)->required_features =
+      encoder->num_bframes > 0 ? GST_VAAPI_ENCODER_FEATURE_BFRAMES : 0;
+
   /* If set low-power encode entry point and hardware doesn't have
    * support, it will fail in ensure_hw_profile() in later stage. */
   encoder->entrypoint =
@@ -2869,13 +3135,22 @@ reset_properties (GstVaapiEncoderH264 * encoder)
         (1 + encoder->num_bframes) : 0;
   }
 
+  if (encoder->ltr_interval > 0 && (encoder->num_bframes > 0
+          || encoder->is_mvc || encoder->prediction_type !=
+          GST_VAAPI_ENCODER_H264_PREDICTION_DEFAULT)) {
+    GST_WARNING ("Disabling long-term references, they need P frames only");
+    encoder->ltr_interval = 0;
+  }
+
   for (i = 0; i < encoder->num_views; i++) {
     GstVaapiH264ViewRefPool *const ref_pool = &encoder->ref_pools[i];
     GstVaapiH264ViewReorderPool *const reorder_pool =
         &encoder->reorder_pools[i];
 
     if (encoder->prediction_type == GST_VAAPI_ENCODER_H264_PREDICTION_DEFAULT) {
-      ref_pool->max_reflist0_count = encoder->num_ref_frames;
+      /* the long-term reference takes a slot of its own */
+      ref_pool->max_reflist0_count = encoder->num_ref_frames
+          + (encoder->ltr_interval > 0);
       ref_pool->max_reflist1_count = encoder->num_bframes > 0;
       ref_pool->max_ref_frames = ref_pool->max_reflist0_count
           + ref_pool->max_reflist1_count;
@@ -2917,6 +3192,8 @@ gst_vaapi_encoder_h264_encode (GstVaapiEncoder * base_encoder,
 
   g_assert (GST_VAAPI_SURFACE_PROXY_SURFACE (reconstruct));
 
+  ltr_prepare_picture (encoder, picture);
+
   if (!ensure_sequence (encoder, picture))
     goto error;
   if (!ensure_misc_params (encoder, picture))
@@ -3218,13 +3495,15 @@ gst_vaapi_encoder_h264_reordering (GstVaapiEncoder * base_encoder,
   picture->temporal_id = (encoder->temporal_levels == 1) ? 1 :
       get_temporal_id (encoder, reorder_pool->frame_index);
 
-  is_idr = (reorder_pool->frame_index == 0 ||
-      reorder_pool->frame_index >= encoder->idr_period);
+  /* With rolling intra refresh, only the first frame and the forced
+     keyframes are intra coded */
+  is_idr = (reorder_pool->frame_index == 0 || (!base_encoder->intra_refresh &&
+          reorder_pool->frame_index >= encoder->idr_period));
 
   /* check key frames */
   if (is_idr || GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame) ||
-      (reorder_pool->frame_index %
-          GST_VAAPI_ENCODER_KEYFRAME_PERIOD (encoder)) == 0) {
+      (!base_encoder->intra_refresh && (reorder_pool->frame_index %
+              GST_VAAPI_ENCODER_KEYFRAME_PERIOD (encoder)) == 0)) {
     ++reorder_pool->frame_index;
 
     /* b frame enabled,  check queue of reorder_frame_list */
@@ -3362,6 +3641,11 @@ gst_vaapi_encoder_h264_reconfigure (GstVaapiEncoder * base_encoder)
   GstVaapiEncoderStatus status;
   guint mb_width, mb_height;
 
+  /* Headers are rebuilt from the new configuration */
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->sps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->subset_sps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->pps_cache);
+
   mb_width = (GST_VAAPI_ENCODER_WIDTH (encoder) + 15) / 16;
   mb_height = (GST_VAAPI_ENCODER_HEIGHT (encoder) + 15) / 16;
   if (mb_width != encoder->mb_width || mb_height != encoder->mb_height) {
@@ -3390,6 +3674,20 @@ gst_vaapi_encoder_h264_reconfigure (GstVaapiEncoder * base_encoder)
   return set_context_info (base_encoder);
 }
 
+/* Only the rate control and HRD parameters follow the new bitrate, the
+   level is updated in case the bitrate no longer fits it */
+static GstVaapiEncoderStatus
+gst_vaapi_encoder_h264_update_rate_control (GstVaapiEncoder * base_encoder)
+{
+  GstVaapiEncoderH264 *const encoder = GST_VAAPI_ENCODER_H264 (base_encoder);
+
+  ensure_bitrate_hrd (encoder);
+  if (!ensure_level (encoder))
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  ensure_control_rate_params (encoder);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
 struct _GstVaapiEncoderH264Class
 {
   GstVaapiEncoderClass parent_class;
@@ -3452,6 +3750,11 @@ gst_vaapi_encoder_h264_finalize (GObject * object)
   gst_buffer_replace (&encoder->subset_sps_data, NULL);
   gst_buffer_replace (&encoder->pps_data, NULL);
 
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->sps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->subset_sps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->pps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->slice_cache);
+
   /* reference list info de-init */
   for (i = 0; i < MAX_NUM_VIEWS; i++) {
     GstVaapiH264ViewRefPool *const ref_pool = &encoder->ref_pools[i];
@@ -3461,6 +3764,8 @@ gst_vaapi_encoder_h264_finalize (GObject * object)
     }
     g_queue_clear (&ref_pool->ref_list);
   }
+  reference_pic_free (encoder, encoder->ltr_ref);
+  encoder->ltr_ref = NULL;
 
   /* re-ordering  list initialize */
   for (i = 0; i < MAX_NUM_VIEWS; i++) {
@@ -3558,6 +3863,8 @@ get_view_ids (GstVaapiEncoderH264 * const encoder, GValue * value)
  * @ENCODER_H264_PROP_PREDICTION_TYPE: Reference picture selection modes
  * @ENCODER_H264_PROP_MAX_QP: Maximal quantizer value (uint).
  * @ENCODER_H264_PROP_QUALITY_FACTOR: Factor for ICQ/QVBR bitrate control mode.
+ * @ENCODER_H264_PROP_LTR_INTERVAL: Number of frames between two
+ *   long-term reference frames (uint).
  *
  * The set of H.264 encoder specific configurable properties.
  */
@@ -3584,6 +3891,7 @@ enum
   ENCODER_H264_PROP_PREDICTION_TYPE,
   ENCODER_H264_PROP_MAX_QP,
   ENCODER_H264_PROP_QUALITY_FACTOR,
+  ENCODER_H264_PROP_LTR_INTERVAL,
   ENCODER_H264_N_PROPERTIES
 };
 
@@ -3667,6 +3975,9 @@ gst_vaapi_encoder_h264_set_property (GObject * object, guint prop_id,
     case ENCODER_H264_PROP_QUALITY_FACTOR:
       encoder->quality_factor = g_value_get_uint (value);
       break;
+    case ENCODER_H264_PROP_LTR_INTERVAL:
+      encoder->ltr_interval = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -3743,6 +4054,9 @@ gst_vaapi_encoder_h264_get_property (GObject * object, guint prop_id,
     case ENCODER_H264_PROP_QUALITY_FACTOR:
       g_value_set_uint (value, encoder->quality_factor);
       break;
+    case ENCODER_H264_PROP_LTR_INTERVAL:
+      g_value_set_uint (value, encoder->ltr_interval);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -3758,6 +4072,8 @@ gst_vaapi_encoder_h264_class_init (GstVaapiEncoderH264Class * klass)
 
   encoder_class->class_data = &g_class_data;
   encoder_class->reconfigure = gst_vaapi_encoder_h264_reconfigure;
+  encoder_class->update_rate_control =
+      gst_vaapi_encoder_h264_update_rate_control;
   encoder_class->reordering = gst_vaapi_encoder_h264_reordering;
   encoder_class->encode = gst_vaapi_encoder_h264_encode;
   encoder_class->flush = gst_vaapi_encoder_h264_flush;
@@ -4044,6 +4360,25 @@ gst_vaapi_encoder_h264_class_init (GstVaapiEncoderH264Class * klass)
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoderH264:ltr-interval:
+   *
+   * The number of frames between two long-term reference frames, the
+   * IDR frames being long-term references too. After a loss, see
+   * gst_vaapi_encoder_h264_invalidate_refs(), the next frame only
+   * predicts from the last long-term reference instead of being an
+   * IDR frame. Zero disables long-term references. They need packed
+   * slice headers, and are not used with B-frames, hierarchical
+   * prediction or MVC.
+   */
+  properties[ENCODER_H264_PROP_LTR_INTERVAL] =
+      g_param_spec_uint ("ltr-interval",
+      "LTR interval",
+      "Number of frames between two long-term reference frames used "
+      "for loss recovery (0: disabled)", 0, 4096, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_H264_N_PROPERTIES,
       properties);
 
@@ -4149,3 +4484,29 @@ gst_vaapi_encoder_h264_supports_avc (GstVaapiEncoderH264 * encoder)
           (VA_ENC_PACKED_HEADER_SEQUENCE | VA_ENC_PACKED_HEADER_PICTURE)) ==
       (VA_ENC_PACKED_HEADER_SEQUENCE | VA_ENC_PACKED_HEADER_PICTURE));
 }
+
+/**
+ * gst_vaapi_encoder_h264_invalidate_refs:
+ * @encoder: a #GstVaapiEncoderH264
+ *
+ * Makes the next frame only predict from the last long-term
+ * reference frame, see #GstVaapiEncoderH264:ltr-interval, and drops
+ * the other reference frames. A receiver that lost data after that
+ * long-term reference can then resume decoding without an IDR frame.
+ *
+ * This function can be called from any thread.
+ *
+ * Returns: %TRUE if a long-term reference is available; %FALSE
+ *   otherwise, in which case a keyframe should be requested instead
+ **/
+gboolean
+gst_vaapi_encoder_h264_invalidate_refs (GstVaapiEncoderH264 * encoder)
+{
+  g_return_val_if_fail (encoder != NULL, FALSE);
+
+  if (!g_atomic_int_get (&encoder->ltr_available))
+    return FALSE;
+
+  g_atomic_int_set (&encoder->ltr_recovery_requested, TRUE);
+  return TRUE;
+}
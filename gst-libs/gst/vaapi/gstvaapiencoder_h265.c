@@ -47,7 +47,18 @@
 /* Supported set of tuning options, within this implementation */
 #define SUPPORTED_TUNE_OPTIONS                          \
   (GST_VAAPI_ENCODER_TUNE_MASK (NONE) |                 \
-   GST_VAAPI_ENCODER_TUNE_MASK (LOW_POWER))
+   GST_VAAPI_ENCODER_TUNE_MASK (LOW_LATENCY) |          \
+   GST_VAAPI_ENCODER_TUNE_MASK (LOW_POWER) |            \
+   GST_VAAPI_ENCODER_TUNE_MASK (AUTO))
+
+/* Define the maximum number of temporal layers */
+#define MIN_TEMPORAL_LEVELS 1
+#define MAX_TEMPORAL_LEVELS 4
+
+/* Palette sizes of the screen content coding. VA does not pass them,
+   they are the ones the hardware uses */
+#define H265_SCC_PALETTE_MAX_SIZE 64
+#define H265_SCC_DELTA_PALETTE_MAX_PREDICTOR_SIZE 32
 
 /* Supported set of VA packed headers, within this implementation */
 #define SUPPORTED_PACKED_HEADERS                \
@@ -59,6 +70,8 @@ typedef struct
 {
   GstVaapiSurfaceProxy *pic;
   guint poc;
+  guint temporal_id;
+  gboolean long_term;
 } GstVaapiEncoderH265Ref;
 
 typedef enum
@@ -119,6 +132,14 @@ struct _GstVaapiEncoderH265
   gboolean no_p_frame;
   guint32 num_tile_cols;
   guint32 num_tile_rows;
+  /* one slice per tile, in tile scan order */
+  gboolean tile_slices;
+  /* no in-loop filtering across tile boundaries */
+  gboolean independent_tiles;
+
+  /* screen content coding tools */
+  gboolean screen_content;
+  gboolean use_scc;
   /* CTUs start address used in stream pack */
   guint32 *tile_slice_address;
   /* CTUs in this slice */
@@ -139,10 +160,30 @@ struct _GstVaapiEncoderH265
   guint32 idr_num;
   guint num_ref_frames;
 
+  /* long-term reference, to recover from losses without an IDR */
+  guint ltr_interval;
+  guint ltr_frame_count;
+  GstVaapiEncoderH265Ref *ltr_ref;
+  gint ltr_available;           /* atomic */
+  gint ltr_recovery_requested;  /* atomic */
+  gboolean ltr_mark;            /* current picture becomes the LTR */
+  gboolean ltr_recovery;        /* current picture only uses the LTR */
+
+  /* temporal scalability (hierarchical-P) */
+  guint temporal_levels;
+  guint temporal_period;
+  guint temporal_layer_bitrates[MAX_TEMPORAL_LEVELS];   /* kbps */
+
   GstBuffer *vps_data;
   GstBuffer *sps_data;
   GstBuffer *pps_data;
 
+  /* prebuilt packed headers */
+  GstVaapiH26xHeaderCache vps_cache;
+  GstVaapiH26xHeaderCache sps_cache;
+  GstVaapiH26xHeaderCache pps_cache;
+  GstVaapiH26xHeaderCache slice_cache;
+
   guint bitrate_bits;           // bitrate (bits)
   guint cpb_length;             // length of CPB buffer (ms)
   guint cpb_length_bits;        // length of CPB buffer (bits)
@@ -191,6 +232,41 @@ h265_is_tile_enabled (GstVaapiEncoderH265 * encoder)
   return encoder->num_tile_cols * encoder->num_tile_rows > 1;
 }
 
+static inline gboolean
+h265_is_scc_profile (GstVaapiProfile profile)
+{
+#if VA_CHECK_VERSION(1,8,0)
+  return profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN
+      || profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_10
+      || profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444
+      || profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444_10;
+#else
+  return FALSE;
+#endif
+}
+
+/* Long-term references are signalled through the packed SPS and slice
+   headers, and restricted to P frames, see reset_properties() */
+static inline gboolean
+h265_use_ltr (GstVaapiEncoderH265 * encoder)
+{
+  const guint packed_headers =
+      VA_ENC_PACKED_HEADER_SEQUENCE | VA_ENC_PACKED_HEADER_SLICE;
+
+  return encoder->ltr_interval > 0 &&
+      (GST_VAAPI_ENCODER_PACKED_HEADERS (encoder) & packed_headers) ==
+      packed_headers;
+}
+
+/* Returns TRUE if no slice may span several tiles */
+static gboolean
+h265_slices_follow_tiles (GstVaapiEncoderH265 * encoder)
+{
+  return encoder->tile_slices ||
+      gst_vaapi_display_has_driver_quirks (GST_VAAPI_ENCODER_DISPLAY (encoder),
+      GST_VAAPI_DRIVER_QUIRK_HEVC_ENC_SLICE_NOT_SPAN_TILE);
+}
+
 /* Get log2_max_pic_order_cnt value for H.265 specification */
 static guint
 h265_get_log2_max_pic_order_cnt (guint num)
@@ -211,10 +287,11 @@ h265_get_log2_max_pic_order_cnt (guint num)
 
 /* Write the NAL unit header */
 static gboolean
-bs_write_nal_header (GstBitWriter * bs, guint32 nal_unit_type)
+bs_write_nal_header (GstBitWriter * bs, guint32 nal_unit_type,
+    guint32 temporal_id)
 {
   guint8 nuh_layer_id = 0;
-  guint8 nuh_temporal_id_plus1 = 1;
+  guint8 nuh_temporal_id_plus1 = temporal_id + 1;
 
   WRITE_UINT32 (bs, 0, 1);
   WRITE_UINT32 (bs, nal_unit_type, 6);
@@ -251,7 +328,8 @@ bs_error:
 /* Write profile_tier_level()  */
 static gboolean
 bs_write_profile_tier_level (GstBitWriter * bs,
-    const VAEncSequenceParameterBufferHEVC * seq_param, GstVaapiProfile profile)
+    const VAEncSequenceParameterBufferHEVC * seq_param, GstVaapiProfile profile,
+    guint32 max_sub_layers_minus1)
 {
   guint i;
 
@@ -305,8 +383,9 @@ bs_write_profile_tier_level (GstBitWriter * bs,
     WRITE_UINT32 (bs, 0, 1);
   }
 
-  /* general_profile_compatibility_flag[5~32] */
-  WRITE_UINT32 (bs, 0, 27);
+  /* general_profile_compatibility_flag[5~31] */
+  for (i = 5; i < 32; i++)
+    WRITE_UINT32 (bs, seq_param->general_profile_idc == i, 1);
 
   /* general_progressive_source_flag */
   WRITE_UINT32 (bs, 1, 1);
@@ -318,7 +397,8 @@ bs_write_profile_tier_level (GstBitWriter * bs,
   WRITE_UINT32 (bs, 1, 1);
 
   /* additional indications specified for general_profile_idc from 4~10 */
-  if (seq_param->general_profile_idc == 4) {
+  if (seq_param->general_profile_idc == 4
+      || seq_param->general_profile_idc == 9) {
     /* In A.3.5, Format range extensions profiles.
        Just support main444, main444-10 and main422-10 profile now, may add
        more profiles when needed. */
@@ -403,15 +483,57 @@ bs_write_profile_tier_level (GstBitWriter * bs,
         /* lower_bit_rate_constraint_flag */
         WRITE_UINT32 (bs, 1, 1);
         break;
+#if VA_CHECK_VERSION(1,8,0)
+      case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN:
+      case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_10:
+      case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444:
+      case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444_10:{
+        /* In A.3.7, Screen content coding extensions profiles */
+        const gboolean is_8bit =
+            profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN ||
+            profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444;
+        const gboolean is_420 =
+            profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN ||
+            profile == GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_10;
+
+        /* max_12bit_constraint_flag */
+        WRITE_UINT32 (bs, 1, 1);
+        /* max_10bit_constraint_flag */
+        WRITE_UINT32 (bs, 1, 1);
+        /* max_8bit_constraint_flag */
+        WRITE_UINT32 (bs, is_8bit, 1);
+        /* max_422chroma_constraint_flag */
+        WRITE_UINT32 (bs, is_420, 1);
+        /* max_420chroma_constraint_flag */
+        WRITE_UINT32 (bs, is_420, 1);
+        /* max_monochrome_constraint_flag */
+        WRITE_UINT32 (bs, 0, 1);
+        /* intra_constraint_flag */
+        WRITE_UINT32 (bs, 0, 1);
+        /* one_picture_only_constraint_flag */
+        WRITE_UINT32 (bs, 0, 1);
+        /* lower_bit_rate_constraint_flag */
+        WRITE_UINT32 (bs, 1, 1);
+        break;
+      }
+#endif
       default:
         GST_WARNING ("do not support the profile: %s of range extensions",
             gst_vaapi_profile_get_va_name (profile));
         goto bs_error;
     }
 
-    /* general_reserved_zero_34bits */
-    for (i = 0; i < 34; i++)
-      WRITE_UINT32 (bs, 0, 1);
+    if (seq_param->general_profile_idc == 9) {
+      /* max_14bit_constraint_flag */
+      WRITE_UINT32 (bs, 1, 1);
+      /* general_reserved_zero_33bits */
+      for (i = 0; i < 33; i++)
+        WRITE_UINT32 (bs, 0, 1);
+    } else {
+      /* general_reserved_zero_34bits */
+      for (i = 0; i < 34; i++)
+        WRITE_UINT32 (bs, 0, 1);
+    }
   } else {
     /* general_reserved_zero_43bits */
     for (i = 0; i < 43; i++)
@@ -423,6 +545,18 @@ bs_write_profile_tier_level (GstBitWriter * bs,
   /* general_level_idc */
   WRITE_UINT32 (bs, seq_param->general_level_idc, 8);
 
+  for (i = 0; i < max_sub_layers_minus1; i++) {
+    /* sub_layer_profile_present_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* sub_layer_level_present_flag */
+    WRITE_UINT32 (bs, 0, 1);
+  }
+  if (max_sub_layers_minus1 > 0) {
+    /* reserved_zero_2bits */
+    for (i = max_sub_layers_minus1; i < 8; i++)
+      WRITE_UINT32 (bs, 0, 2);
+  }
+
   return TRUE;
 
   /* ERRORS */
@@ -441,7 +575,7 @@ bs_write_vps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
 {
   guint32 video_parameter_set_id = 0;
   guint32 vps_max_layers_minus1 = 0;
-  guint32 vps_max_sub_layers_minus1 = 0;
+  guint32 vps_max_sub_layers_minus1 = encoder->temporal_levels - 1;
   guint32 vps_temporal_id_nesting_flag = 1;
   guint32 vps_sub_layer_ordering_info_present_flag = 0;
   guint32 vps_max_latency_increase_plus1 = 0;
@@ -468,7 +602,8 @@ bs_write_vps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
   WRITE_UINT32 (bs, 0xffff, 16);
 
   /* profile_tier_level */
-  bs_write_profile_tier_level (bs, seq_param, profile);
+  bs_write_profile_tier_level (bs, seq_param, profile,
+      vps_max_sub_layers_minus1);
 
   /* vps_sub_layer_ordering_info_present_flag */
   WRITE_UINT32 (bs, vps_sub_layer_ordering_info_present_flag, 1);
@@ -519,17 +654,17 @@ bs_write_sps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
     GstVaapiRateControl rate_control, const VAEncMiscParameterHRD * hrd_params)
 {
   guint32 video_parameter_set_id = 0;
-  guint32 max_sub_layers_minus1 = 0;
+  guint32 max_sub_layers_minus1 = encoder->temporal_levels - 1;
   guint32 temporal_id_nesting_flag = 1;
   guint32 separate_colour_plane_flag = 0;
   guint32 seq_parameter_set_id = 0;
   guint32 sps_sub_layer_ordering_info_present_flag = 0;
   guint32 sps_max_latency_increase_plus1 = 0;
   guint32 num_short_term_ref_pic_sets = 0;
-  guint32 long_term_ref_pics_present_flag = 0;
-  guint32 sps_extension_flag = 0;
+  guint32 long_term_ref_pics_present_flag = h265_use_ltr (encoder);
+  guint32 sps_extension_flag = encoder->use_scc;
   guint32 nal_hrd_parameters_present_flag = 0;
-  guint maxNumSubLayers = 1, i;
+  guint maxNumSubLayers = encoder->temporal_levels, i;
   guint32 cbr_flag = rate_control == GST_VAAPI_RATECONTROL_CBR ? 1 : 0;
 
   /* video_parameter_set_id */
@@ -540,7 +675,7 @@ bs_write_sps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
   WRITE_UINT32 (bs, temporal_id_nesting_flag, 1);
 
   /* profile_tier_level */
-  bs_write_profile_tier_level (bs, seq_param, profile);
+  bs_write_profile_tier_level (bs, seq_param, profile, max_sub_layers_minus1);
 
   /* seq_parameter_set_id */
   WRITE_UE (bs, seq_parameter_set_id);
@@ -607,6 +742,9 @@ bs_write_sps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
 
   /* long_term_ref_pics_present_flag */
   WRITE_UINT32 (bs, long_term_ref_pics_present_flag, 1);
+  /* num_long_term_ref_pics_sps, they are all written in the slices */
+  if (long_term_ref_pics_present_flag)
+    WRITE_UE (bs, 0);
 
   /* sps_temporal_mvp_enabled_flag */
   WRITE_UINT32 (bs, seq_param->seq_fields.bits.sps_temporal_mvp_enabled_flag,
@@ -684,6 +822,12 @@ bs_write_sps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
           WRITE_UINT32 (bs, 23, 5);
 
           for (i = 0; i < maxNumSubLayers; i++) {
+            guint32 bitrate = seq_param->bits_per_second;
+
+            /* sub-layers without an explicit bitrate share the total one */
+            if (i < maxNumSubLayers - 1 && encoder->temporal_layer_bitrates[i])
+              bitrate = encoder->temporal_layer_bitrates[i] * 1000;
+
             /* fixed_pic_rate_general_flag */
             WRITE_UINT32 (bs, 0, 1);
             /* fixed_pic_rate_within_cvs_flag */
@@ -691,7 +835,7 @@ bs_write_sps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
             /* low_delay_hrd_flag */
             WRITE_UINT32 (bs, 1, 1);
             /* bit_rate_value_minus1 */
-            WRITE_UE (bs, (seq_param->bits_per_second >> SX_BITRATE) - 1);
+            WRITE_UE (bs, (bitrate >> SX_BITRATE) - 1);
             /* cpb_size_value_minus1 */
             WRITE_UE (bs, (hrd_params->buffer_size >> SX_CPB_SIZE) - 1);
             /* cbr_flag */
@@ -705,6 +849,34 @@ bs_write_sps_data (GstBitWriter * bs, GstVaapiEncoderH265 * encoder,
   }
   /* sps_extension_flag */
   WRITE_UINT32 (bs, sps_extension_flag, 1);
+  if (sps_extension_flag) {
+    /* sps_range_extension_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* sps_multilayer_extension_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* sps_3d_extension_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* sps_scc_extension_flag */
+    WRITE_UINT32 (bs, 1, 1);
+    /* sps_extension_4bits */
+    WRITE_UINT32 (bs, 0, 4);
+
+    /* sps_scc_extension (), with intra block copy and palette mode */
+    /* sps_curr_pic_ref_enabled_flag */
+    WRITE_UINT32 (bs, 1, 1);
+    /* palette_mode_enabled_flag */
+    WRITE_UINT32 (bs, 1, 1);
+    /* palette_max_size */
+    WRITE_UE (bs, H265_SCC_PALETTE_MAX_SIZE);
+    /* delta_palette_max_predictor_size */
+    WRITE_UE (bs, H265_SCC_DELTA_PALETTE_MAX_PREDICTOR_SIZE);
+    /* sps_palette_predictor_initializers_present_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* motion_vector_resolution_control_idc */
+    WRITE_UINT32 (bs, 0, 2);
+    /* intra_boundary_filtering_disabled_flag */
+    WRITE_UINT32 (bs, 0, 1);
+  }
 
   return TRUE;
 
@@ -748,6 +920,10 @@ bs_write_pps (GstBitWriter * bs,
   guint32 slice_segment_header_extension_present_flag = 0;
   guint32 pps_extension_flag = 0;
 
+#if VA_CHECK_VERSION(1,8,0)
+  pps_extension_flag = pic_param->scc_fields.bits.pps_curr_pic_ref_enabled_flag;
+#endif
+
   /* pic_parameter_set_id */
   WRITE_UE (bs, pic_parameter_set_id);
   /* seq_parameter_set_id */
@@ -833,6 +1009,26 @@ bs_write_pps (GstBitWriter * bs,
   WRITE_UINT32 (bs, slice_segment_header_extension_present_flag, 1);
   /* pps_extension_flag */
   WRITE_UINT32 (bs, pps_extension_flag, 1);
+  if (pps_extension_flag) {
+    /* pps_range_extension_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* pps_multilayer_extension_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* pps_3d_extension_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* pps_scc_extension_flag */
+    WRITE_UINT32 (bs, 1, 1);
+    /* pps_extension_4bits */
+    WRITE_UINT32 (bs, 0, 4);
+
+    /* pps_scc_extension () */
+    /* pps_curr_pic_ref_enabled_flag */
+    WRITE_UINT32 (bs, 1, 1);
+    /* residual_adaptive_colour_transform_enabled_flag */
+    WRITE_UINT32 (bs, 0, 1);
+    /* pps_palette_predictor_initializers_present_flag */
+    WRITE_UINT32 (bs, 0, 1);
+  }
 
   /* rbsp_trailing_bits */
   bs_write_trailing_bits (bs);
@@ -847,40 +1043,22 @@ bs_error:
   }
 }
 
-/* Write a Slice NAL unit */
+/* Write the slice header fields following slice_segment_address, up
+   to the byte alignment. They are the same for all the slices of a
+   picture */
 static gboolean
 bs_write_slice (GstBitWriter * bs,
     const VAEncSliceParameterBufferHEVC * slice_param,
-    GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
-    guint8 nal_unit_type)
+    GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture)
 {
   const VAEncPictureParameterBufferHEVC *const pic_param = picture->param;
 
-  guint8 no_output_of_prior_pics_flag = 0;
   guint8 dependent_slice_segment_flag = 0;
   guint8 short_term_ref_pic_set_sps_flag = 0;
   guint8 slice_deblocking_filter_disabled_flag = 0;
   guint8 num_ref_idx_active_override_flag =
       slice_param->slice_fields.bits.num_ref_idx_active_override_flag;
 
-  /* first_slice_segment_in_pic_flag */
-  WRITE_UINT32 (bs, encoder->first_slice_segment_in_pic_flag, 1);
-
-  /* FIXME: For all IRAP pics */
-  /* no_output_of_prior_pics_flag */
-  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture))
-    WRITE_UINT32 (bs, no_output_of_prior_pics_flag, 1);
-
-  /* slice_pic_parameter_set_id */
-  WRITE_UE (bs, slice_param->slice_pic_parameter_set_id);
-
-  /* slice_segment_address , bits_size = Ceil(Log2(PicSizeInCtbsY)) */
-  if (!encoder->first_slice_segment_in_pic_flag) {
-    guint pic_size_ctb = encoder->ctu_width * encoder->ctu_height;
-    guint bits_size = (guint) ceil ((log2 (pic_size_ctb)));
-    WRITE_UINT32 (bs, slice_param->slice_segment_address, bits_size);
-  }
-
   if (!dependent_slice_segment_flag) {
     /* slice_type */
     WRITE_UE (bs, slice_param->slice_type);
@@ -902,8 +1080,11 @@ bs_write_slice (GstBitWriter * bs,
         /* Get count of ref_pic_list */
         if (picture->type == GST_VAAPI_PICTURE_TYPE_P
             || picture->type == GST_VAAPI_PICTURE_TYPE_B) {
+          /* the long-term reference comes last, if used */
           for (i = 0; i < G_N_ELEMENTS (slice_param->ref_pic_list0); ++i) {
-            if (slice_param->ref_pic_list0[i].picture_id == VA_INVALID_SURFACE)
+            if (slice_param->ref_pic_list0[i].picture_id == VA_INVALID_SURFACE
+                || (slice_param->ref_pic_list0[i].flags &
+                    VA_PICTURE_HEVC_LONG_TERM_REFERENCE))
               break;
           }
           reflist_0_count = i;
@@ -968,6 +1149,34 @@ bs_write_slice (GstBitWriter * bs,
         }
       }
 
+      /* The long-term reference stays in the RPS of every picture,
+         even when it is not referenced */
+      if (h265_use_ltr (encoder)) {
+        guint8 used_by_curr_pic_lt_flag = 0;
+        guint i;
+
+        /* num_long_term_pics */
+        WRITE_UE (bs, encoder->ltr_ref != NULL);
+        if (encoder->ltr_ref) {
+          for (i = 0; i < G_N_ELEMENTS (slice_param->ref_pic_list0); ++i) {
+            if (slice_param->ref_pic_list0[i].picture_id == VA_INVALID_SURFACE)
+              break;
+            if (slice_param->ref_pic_list0[i].flags &
+                VA_PICTURE_HEVC_LONG_TERM_REFERENCE)
+              used_by_curr_pic_lt_flag = 1;
+          }
+          /* poc_lsb_lt */
+          WRITE_UINT32 (bs, encoder->ltr_ref->poc &
+              ((1 << encoder->log2_max_pic_order_cnt) - 1),
+              encoder->log2_max_pic_order_cnt);
+          /* used_by_curr_pic_lt_flag */
+          WRITE_UINT32 (bs, used_by_curr_pic_lt_flag, 1);
+          /* delta_poc_msb_present_flag, the POC LSBs don't wrap around
+             within an LTR interval */
+          WRITE_UINT32 (bs, 0, 1);
+        }
+      }
+
       /* slice_temporal_mvp_enabled_flag */
       if (encoder->sps_temporal_mvp_enabled_flag)
         WRITE_UINT32 (bs,
@@ -1024,16 +1233,62 @@ bs_write_slice (GstBitWriter * bs,
     WRITE_UE (bs, 0);
   }
 
-  /* byte_alignment() */
+  return TRUE;
+
+  /* ERRORS */
+bs_error:
+  {
+    GST_WARNING ("failed to write Slice NAL unit");
+    return FALSE;
+  }
+}
+
+/* Write the slice header fields that differ between the slices of a
+   picture, i.e. up to slice_segment_address */
+static gboolean
+bs_write_slice_address (GstBitWriter * bs,
+    const VAEncSliceParameterBufferHEVC * slice_param,
+    GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture)
+{
+  guint8 no_output_of_prior_pics_flag = 0;
+
+  /* first_slice_segment_in_pic_flag */
+  WRITE_UINT32 (bs, encoder->first_slice_segment_in_pic_flag, 1);
+
+  /* FIXME: For all IRAP pics */
+  /* no_output_of_prior_pics_flag */
+  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture))
+    WRITE_UINT32 (bs, no_output_of_prior_pics_flag, 1);
+
+  /* slice_pic_parameter_set_id */
+  WRITE_UE (bs, slice_param->slice_pic_parameter_set_id);
+
+  /* slice_segment_address , bits_size = Ceil(Log2(PicSizeInCtbsY)) */
+  if (!encoder->first_slice_segment_in_pic_flag) {
+    guint pic_size_ctb = encoder->ctu_width * encoder->ctu_height;
+    guint bits_size = (guint) ceil ((log2 (pic_size_ctb)));
+    WRITE_UINT32 (bs, slice_param->slice_segment_address, bits_size);
+  }
+  return TRUE;
+
+  /* ERRORS */
+bs_error:
   {
-    /* alignment_bit_equal_to_one */
-    WRITE_UINT32 (bs, 1, 1);
-    while (GST_BIT_WRITER_BIT_SIZE (bs) % 8 != 0) {
-      /* alignment_bit_equal_to_zero */
-      WRITE_UINT32 (bs, 0, 1);
-    }
+    GST_WARNING ("failed to write Slice NAL unit");
+    return FALSE;
   }
+}
 
+/* Write the byte_alignment() closing the slice header */
+static gboolean
+bs_write_slice_alignment (GstBitWriter * bs)
+{
+  /* alignment_bit_equal_to_one */
+  WRITE_UINT32 (bs, 1, 1);
+  while (GST_BIT_WRITER_BIT_SIZE (bs) % 8 != 0) {
+    /* alignment_bit_equal_to_zero */
+    WRITE_UINT32 (bs, 0, 1);
+  }
   return TRUE;
 
   /* ERRORS */
@@ -1093,6 +1348,28 @@ is_profile_allowed (GstVaapiEncoderH265 * encoder, GstVaapiProfile profile)
   return FALSE;
 }
 
+static guint
+add_scc_profile_candidates (GstVaapiProfile * candidates, guint depth,
+    guint chrome)
+{
+  guint num = 0;
+
+#if VA_CHECK_VERSION(1,8,0)
+  if (chrome == 3) {
+    if (depth == 8)
+      candidates[num++] = GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444;
+    if (depth <= 10)
+      candidates[num++] = GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444_10;
+  } else if (chrome == 1) {
+    if (depth == 8)
+      candidates[num++] = GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN;
+    if (depth <= 10)
+      candidates[num++] = GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_10;
+  }
+#endif
+  return num;
+}
+
 /* Derives the profile from the active coding tools. */
 static gboolean
 ensure_profile (GstVaapiEncoderH265 * encoder)
@@ -1101,8 +1378,8 @@ ensure_profile (GstVaapiEncoderH265 * encoder)
   const GstVideoFormat format =
       GST_VIDEO_INFO_FORMAT (GST_VAAPI_ENCODER_VIDEO_INFO (encoder));
   guint depth, chrome;
-  GstVaapiProfile profile_candidates[4];
-  guint num, i;
+  GstVaapiProfile profile_candidates[8];
+  guint num, num_scc, i;
 
   g_assert (GST_VIDEO_FORMAT_INFO_IS_YUV (gst_video_format_get_info (format)));
   depth = GST_VIDEO_FORMAT_INFO_DEPTH (gst_video_format_get_info (format), 0);
@@ -1111,6 +1388,12 @@ ensure_profile (GstVaapiEncoderH265 * encoder)
 
   num = 0;
 
+  /* The screen content coding profiles come first when asked for,
+     last otherwise, so that downstream can still select them */
+  if (encoder->screen_content)
+    num = add_scc_profile_candidates (profile_candidates, depth, chrome);
+  num_scc = num;
+
   if (chrome == 3) {
     /* 4:4:4 */
     if (depth == 8)
@@ -1133,6 +1416,9 @@ ensure_profile (GstVaapiEncoderH265 * encoder)
       profile_candidates[num++] = GST_VAAPI_PROFILE_H265_MAIN_STILL_PICTURE;
   }
 
+  if (!encoder->screen_content)
+    num += add_scc_profile_candidates (profile_candidates + num, depth, chrome);
+
   if (num == 0) {
     GST_ERROR ("Fail to find a profile for format %s.",
         gst_video_format_to_string (format));
@@ -1159,8 +1445,13 @@ ensure_profile (GstVaapiEncoderH265 * encoder)
     return FALSE;
   }
 
+  if (num_scc > 0 && !h265_is_scc_profile (profile))
+    GST_WARNING ("no screen content coding profile available, using %s",
+        gst_vaapi_profile_get_va_name (profile));
+
   encoder->profile = profile;
   encoder->profile_idc = gst_vaapi_utils_h265_get_profile_idc (profile);
+  encoder->use_scc = h265_is_scc_profile (profile);
   return TRUE;
 }
 
@@ -1313,30 +1604,83 @@ fill_hrd_params (GstVaapiEncoderH265 * encoder, VAEncMiscParameterHRD * hrd)
   }
 }
 
+/* Parameters the VPS and SPS headers are built from, along with the
+   encoder configuration */
+typedef struct
+{
+  VAEncSequenceParameterBufferHEVC seq_param;
+  VAEncMiscParameterHRD hrd_params;
+  GstVaapiProfile profile;
+  GstVaapiRateControl rate_control;
+} SpsCacheKey;
+
+/* Parameters the PPS header is built from */
+typedef struct
+{
+  VAEncPictureParameterBufferHEVC pic_param;
+} PpsCacheKey;
+
+static void
+fill_sps_cache_key (GstVaapiEncoderH265 * encoder,
+    const VAEncSequenceParameterBufferHEVC * seq_param, SpsCacheKey * key)
+{
+  memset (key, 0, sizeof (*key));
+  memcpy (&key->seq_param, seq_param, sizeof (key->seq_param));
+  fill_hrd_params (encoder, &key->hrd_params);
+  key->profile = encoder->profile;
+  key->rate_control = GST_VAAPI_ENCODER_RATE_CONTROL (encoder);
+}
+
+/* Leaves out the fields that change on every picture but are not
+   written into the PPS */
+static void
+fill_pps_cache_key (const VAEncPictureParameterBufferHEVC * pic_param,
+    PpsCacheKey * key)
+{
+  VAEncPictureParameterBufferHEVC *const param = &key->pic_param;
+
+  memset (key, 0, sizeof (*key));
+  memcpy (param, pic_param, sizeof (*param));
+  memset (&param->decoded_curr_pic, 0, sizeof (param->decoded_curr_pic));
+  memset (param->reference_frames, 0, sizeof (param->reference_frames));
+  param->coded_buf = VA_INVALID_ID;
+  param->collocated_ref_pic_index = 0;
+  param->last_picture = 0;
+  param->nal_unit_type = 0;
+  param->pic_fields.bits.idr_pic_flag = 0;
+  param->pic_fields.bits.coding_type = 0;
+  param->pic_fields.bits.reference_pic_flag = 0;
+  param->pic_fields.bits.no_output_of_prior_pics_flag = 0;
+}
+
 /* Adds the supplied video parameter set header (VPS) to the list of packed
    headers to pass down as-is to the encoder */
 static gboolean
 add_packed_vps_header (GstVaapiEncoderH265 * encoder,
     GstVaapiEncPicture * picture, GstVaapiEncSequence * sequence)
 {
+  GstVaapiH26xHeaderCache *const cache = &encoder->vps_cache;
   GstVaapiEncPackedHeader *packed_vps;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_vps_param = { 0 };
   const VAEncSequenceParameterBufferHEVC *const seq_param = sequence->param;
-  GstVaapiProfile profile = encoder->profile;
-
+  SpsCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
-  bs_write_nal_header (&bs, GST_H265_NAL_VPS);
+  fill_sps_cache_key (encoder, seq_param, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    WRITE_UINT32 (&bs, 0x00000001, 32); /* start code */
+    bs_write_nal_header (&bs, GST_H265_NAL_VPS, 0);
 
-  bs_write_vps (&bs, encoder, picture, seq_param, profile);
+    bs_write_vps (&bs, encoder, picture, seq_param, key.profile);
 
-  g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+    g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_vps_param.type = VAEncPackedHeaderSequence;
   packed_vps_param.bit_length = data_bit_size;
@@ -1352,7 +1696,6 @@ add_packed_vps_header (GstVaapiEncoderH265 * encoder,
 
   /* store vps data */
   _check_vps_sps_pps_status (encoder, data + 4, data_bit_size / 8 - 4);
-  gst_bit_writer_reset (&bs);
   return TRUE;
 
   /* ERRORS */
@@ -1370,29 +1713,29 @@ static gboolean
 add_packed_sequence_header (GstVaapiEncoderH265 * encoder,
     GstVaapiEncPicture * picture, GstVaapiEncSequence * sequence)
 {
-  GstVaapiEncoder *const base_encoder = GST_VAAPI_ENCODER_CAST (encoder);
+  GstVaapiH26xHeaderCache *const cache = &encoder->sps_cache;
   GstVaapiEncPackedHeader *packed_seq;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_seq_param = { 0 };
   const VAEncSequenceParameterBufferHEVC *const seq_param = sequence->param;
-  GstVaapiProfile profile = encoder->profile;
-
-  VAEncMiscParameterHRD hrd_params;
+  SpsCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  fill_hrd_params (encoder, &hrd_params);
+  fill_sps_cache_key (encoder, seq_param, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    WRITE_UINT32 (&bs, 0x00000001, 32); /* start code */
+    bs_write_nal_header (&bs, GST_H265_NAL_SPS, 0);
 
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
-  bs_write_nal_header (&bs, GST_H265_NAL_SPS);
-
-  bs_write_sps (&bs, encoder, picture, seq_param, profile,
-      base_encoder->rate_control, &hrd_params);
+    bs_write_sps (&bs, encoder, picture, seq_param, key.profile,
+        key.rate_control, &key.hrd_params);
 
-  g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+    g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_seq_param.type = VAEncPackedHeaderSequence;
   packed_seq_param.bit_length = data_bit_size;
@@ -1408,7 +1751,6 @@ add_packed_sequence_header (GstVaapiEncoderH265 * encoder,
 
   /* store sps data */
   _check_vps_sps_pps_status (encoder, data + 4, data_bit_size / 8 - 4);
-  gst_bit_writer_reset (&bs);
   return TRUE;
 
   /* ERRORS */
@@ -1426,20 +1768,26 @@ static gboolean
 add_packed_picture_header (GstVaapiEncoderH265 * encoder,
     GstVaapiEncPicture * picture)
 {
+  GstVaapiH26xHeaderCache *const cache = &encoder->pps_cache;
   GstVaapiEncPackedHeader *packed_pic;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_pic_param = { 0 };
   const VAEncPictureParameterBufferHEVC *const pic_param = picture->param;
+  PpsCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
-  bs_write_nal_header (&bs, GST_H265_NAL_PPS);
-  bs_write_pps (&bs, pic_param);
-  g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+  fill_pps_cache_key (pic_param, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    WRITE_UINT32 (&bs, 0x00000001, 32); /* start code */
+    bs_write_nal_header (&bs, GST_H265_NAL_PPS, 0);
+    bs_write_pps (&bs, pic_param);
+    g_assert (GST_BIT_WRITER_BIT_SIZE (&bs) % 8 == 0);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_pic_param.type = VAEncPackedHeaderPicture;
   packed_pic_param.bit_length = data_bit_size;
@@ -1455,7 +1803,6 @@ add_packed_picture_header (GstVaapiEncoderH265 * encoder,
 
   /* store pps data */
   _check_vps_sps_pps_status (encoder, data + 4, data_bit_size / 8 - 4);
-  gst_bit_writer_reset (&bs);
   return TRUE;
 
   /* ERRORS */
@@ -1467,8 +1814,18 @@ bs_error:
   }
 }
 
+/* Returns TRUE if the picture belongs to the highest temporal layer,
+   and hence is never used as a reference */
+static inline gboolean
+is_temporal_id_max (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture)
+{
+  return encoder->temporal_levels > 1 &&
+      picture->temporal_id == encoder->temporal_levels - 1;
+}
+
 static gboolean
-get_nal_unit_type (GstVaapiEncPicture * picture, guint8 * nal_unit_type)
+get_nal_unit_type (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
+    guint8 * nal_unit_type)
 {
   switch (picture->type) {
     case GST_VAAPI_PICTURE_TYPE_I:
@@ -1478,7 +1835,14 @@ get_nal_unit_type (GstVaapiEncPicture * picture, guint8 * nal_unit_type)
         *nal_unit_type = GST_H265_NAL_SLICE_TRAIL_R;
       break;
     case GST_VAAPI_PICTURE_TYPE_P:
-      *nal_unit_type = GST_H265_NAL_SLICE_TRAIL_R;
+      /* The pictures of a temporal layer only reference the lower
+         layers, so every one of them is a valid up-switching point */
+      if (picture->temporal_id == 0)
+        *nal_unit_type = GST_H265_NAL_SLICE_TRAIL_R;
+      else if (is_temporal_id_max (encoder, picture))
+        *nal_unit_type = GST_H265_NAL_SLICE_TSA_N;
+      else
+        *nal_unit_type = GST_H265_NAL_SLICE_TSA_R;
       break;
     case GST_VAAPI_PICTURE_TYPE_B:
       *nal_unit_type = GST_H265_NAL_SLICE_TRAIL_N;
@@ -1495,6 +1859,7 @@ static gboolean
 add_packed_slice_header (GstVaapiEncoderH265 * encoder,
     GstVaapiEncPicture * picture, GstVaapiEncSlice * slice)
 {
+  GstVaapiH26xHeaderCache *const cache = &encoder->slice_cache;
   GstVaapiEncPackedHeader *packed_slice;
   GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_slice_param = { 0 };
@@ -1503,14 +1868,28 @@ add_packed_slice_header (GstVaapiEncoderH265 * encoder,
   guint8 *data;
   guint8 nal_unit_type;
 
+  /* The slices of a picture only differ up to slice_segment_address,
+     the rest of the header is written once per picture */
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, NULL, 0)) {
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    if (!bs_write_slice (&bs, slice_param, encoder, picture))
+      goto bs_error;
+    gst_vaapi_utils_h26x_header_cache_store (cache, NULL, 0, &bs);
+  }
+
   gst_bit_writer_init_with_size (&bs, 128, FALSE);
   WRITE_UINT32 (&bs, 0x00000001, 32);   /* start code */
 
-  if (!get_nal_unit_type (picture, &nal_unit_type))
+  if (!get_nal_unit_type (encoder, picture, &nal_unit_type))
     goto bs_error;
-  bs_write_nal_header (&bs, nal_unit_type);
+  bs_write_nal_header (&bs, nal_unit_type, picture->temporal_id);
 
-  bs_write_slice (&bs, slice_param, encoder, picture, nal_unit_type);
+  if (!bs_write_slice_address (&bs, slice_param, encoder, picture))
+    goto bs_error;
+  if (!bs_write_bits (&bs, cache->data, cache->bit_size))
+    goto bs_error;
+  if (!bs_write_slice_alignment (&bs))
+    goto bs_error;
   data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
   data = GST_BIT_WRITER_DATA (&bs);
 
@@ -1557,9 +1936,75 @@ reference_pic_create (GstVaapiEncoderH265 * encoder,
 
   ref->pic = surface;
   ref->poc = picture->poc;
+  ref->temporal_id = picture->temporal_id;
   return ref;
 }
 
+/* With temporal layers, a picture only references the latest picture
+   of each lower layer (or the latest base layer picture for the base
+   layer itself). Anything else is dropped from the pool before the
+   picture is encoded, so that it doesn't enter its RPS either */
+static void
+reference_list_prune (GstVaapiEncoderH265 * encoder,
+    GstVaapiEncPicture * picture)
+{
+  GstVaapiH265RefPool *const ref_pool = &encoder->ref_pool;
+  const guint max_temporal_id = MAX (picture->temporal_id, 1);
+  guint seen = 0;
+  GList *iter, *prev;
+
+  if (encoder->temporal_levels <= 1
+      || picture->type == GST_VAAPI_PICTURE_TYPE_I)
+    return;
+
+  for (iter = g_queue_peek_tail_link (&ref_pool->ref_list); iter; iter = prev) {
+    GstVaapiEncoderH265Ref *const ref = iter->data;
+
+    prev = g_list_previous (iter);
+    if (ref->temporal_id < max_temporal_id
+        && !(seen & (1U << ref->temporal_id))) {
+      seen |= 1U << ref->temporal_id;
+      continue;
+    }
+    g_queue_delete_link (&ref_pool->ref_list, iter);
+    reference_pic_free (encoder, ref);
+  }
+}
+
+/* Decides whether @picture becomes the long-term reference, or only
+ * predicts from it after a loss was reported. The IDR pictures always
+ * become the long-term reference, so that there is one at any time */
+static void
+ltr_prepare_picture (GstVaapiEncoderH265 * encoder,
+    GstVaapiEncPicture * picture)
+{
+  encoder->ltr_mark = FALSE;
+  encoder->ltr_recovery = FALSE;
+  if (!h265_use_ltr (encoder))
+    return;
+
+  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture)) {
+    g_atomic_int_set (&encoder->ltr_recovery_requested, FALSE);
+    encoder->ltr_mark = TRUE;
+    encoder->ltr_frame_count = 0;
+    return;
+  }
+  if (!encoder->ltr_ref)
+    return;
+
+  if (g_atomic_int_compare_and_exchange (&encoder->ltr_recovery_requested,
+          TRUE, FALSE)) {
+    GST_DEBUG ("picture %u only references the long-term picture %u",
+        picture->poc, encoder->ltr_ref->poc);
+    encoder->ltr_recovery = TRUE;
+    return;
+  }
+  if (++encoder->ltr_frame_count >= encoder->ltr_interval) {
+    encoder->ltr_mark = TRUE;
+    encoder->ltr_frame_count = 0;
+  }
+}
+
 static gboolean
 reference_list_update (GstVaapiEncoderH265 * encoder,
     GstVaapiEncPicture * picture, GstVaapiSurfaceProxy * surface)
@@ -1567,19 +2012,38 @@ reference_list_update (GstVaapiEncoderH265 * encoder,
   GstVaapiEncoderH265Ref *ref;
   GstVaapiH265RefPool *const ref_pool = &encoder->ref_pool;
 
-  if (GST_VAAPI_PICTURE_TYPE_B == picture->type) {
+  if (GST_VAAPI_PICTURE_TYPE_B == picture->type
+      || is_temporal_id_max (encoder, picture)) {
     gst_vaapi_encoder_release_surface (GST_VAAPI_ENCODER (encoder), surface);
     return TRUE;
   }
 
-  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture)) {
+  /* A recovery picture left the short-term references out of its RPS,
+     so the decoder dropped them too */
+  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture) || encoder->ltr_recovery) {
     while (!g_queue_is_empty (&ref_pool->ref_list))
       reference_pic_free (encoder, g_queue_pop_head (&ref_pool->ref_list));
-  } else if (g_queue_get_length (&ref_pool->ref_list) >=
-      ref_pool->max_ref_frames) {
+  } else if (g_queue_get_length (&ref_pool->ref_list) +
+      (encoder->ltr_ref != NULL) >= ref_pool->max_ref_frames) {
     reference_pic_free (encoder, g_queue_pop_head (&ref_pool->ref_list));
   }
+  if (GST_VAAPI_ENC_PICTURE_IS_IDR (picture) && encoder->ltr_ref) {
+    reference_pic_free (encoder, encoder->ltr_ref);
+    encoder->ltr_ref = NULL;
+    g_atomic_int_set (&encoder->ltr_available, FALSE);
+  }
   ref = reference_pic_create (encoder, picture, surface);
+
+  /* The picture moves straight to the long-term part of the RPS of
+     the next pictures, the previous long-term reference is left out */
+  if (encoder->ltr_mark) {
+    reference_pic_free (encoder, encoder->ltr_ref);
+    ref->long_term = TRUE;
+    encoder->ltr_ref = ref;
+    g_atomic_int_set (&encoder->ltr_available, TRUE);
+    return TRUE;
+  }
+
   g_queue_push_tail (&ref_pool->ref_list, ref);
   g_assert (g_queue_get_length (&ref_pool->ref_list) <=
       ref_pool->max_ref_frames);
@@ -1603,6 +2067,22 @@ reference_list_init (GstVaapiEncoderH265 * encoder,
   if (picture->type == GST_VAAPI_PICTURE_TYPE_I)
     return TRUE;
 
+  /* The short-term references come first, most recent first, and the
+     long-term one last, as in the initial lists of the decoder. A
+     recovery picture only predicts from the long-term reference */
+  if (h265_use_ltr (encoder)) {
+    count = 0;
+    if (!encoder->ltr_recovery) {
+      iter = g_queue_peek_tail_link (&ref_pool->ref_list);
+      for (; iter; iter = g_list_previous (iter))
+        reflist_0[count++] = iter->data;
+    }
+    if (encoder->ltr_ref)
+      reflist_0[count++] = encoder->ltr_ref;
+    *reflist_0_count = count;
+    return count > 0;
+  }
+
   iter = g_queue_peek_tail_link (&ref_pool->ref_list);
   for (; iter; iter = g_list_previous (iter)) {
     tmp = (GstVaapiEncoderH265Ref *) iter->data;
@@ -1687,6 +2167,9 @@ fill_sequence (GstVaapiEncoderH265 * encoder, GstVaapiEncSequence * sequence)
   seq_param->seq_fields.bits.pcm_loop_filter_disabled_flag = FALSE;
   seq_param->seq_fields.bits.sps_temporal_mvp_enabled_flag =
       encoder->sps_temporal_mvp_enabled_flag = TRUE;
+#if VA_CHECK_VERSION(1,8,0)
+  seq_param->scc_fields.bits.palette_mode_enabled_flag = encoder->use_scc;
+#endif
 
   /* Based on 32x32 CTU (64x64 when using lowpower mode for hardware limitation) */
   seq_param->log2_min_luma_coding_block_size_minus3 = 0;
@@ -1753,11 +2236,18 @@ fill_picture (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
       GST_VAAPI_SURFACE_PROXY_SURFACE_ID (surface);
   pic_param->decoded_curr_pic.pic_order_cnt = picture->poc;
   pic_param->decoded_curr_pic.flags = 0;
+#if VA_CHECK_VERSION(1,8,0)
+  /* intra block copy, the current picture is a reference of itself */
+  pic_param->scc_fields.bits.pps_curr_pic_ref_enabled_flag = encoder->use_scc;
+#endif
 
   i = 0;
   if (picture->type != GST_VAAPI_PICTURE_TYPE_I) {
-    for (reflist = g_queue_peek_head_link (&ref_pool->ref_list);
-        reflist; reflist = g_list_next (reflist)) {
+    /* the short-term references are not in the RPS of a recovery
+       picture anymore */
+    reflist = encoder->ltr_recovery ? NULL :
+        g_queue_peek_head_link (&ref_pool->ref_list);
+    for (; reflist; reflist = g_list_next (reflist)) {
       ref_pic = reflist->data;
       g_assert (ref_pic && ref_pic->pic &&
           GST_VAAPI_SURFACE_PROXY_SURFACE_ID (ref_pic->pic) != VA_INVALID_ID);
@@ -1767,6 +2257,15 @@ fill_picture (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
       pic_param->reference_frames[i].pic_order_cnt = ref_pic->poc;
       ++i;
     }
+    if (encoder->ltr_ref) {
+      ref_pic = encoder->ltr_ref;
+      pic_param->reference_frames[i].picture_id =
+          GST_VAAPI_SURFACE_PROXY_SURFACE_ID (ref_pic->pic);
+      pic_param->reference_frames[i].pic_order_cnt = ref_pic->poc;
+      pic_param->reference_frames[i].flags =
+          VA_PICTURE_HEVC_LONG_TERM_REFERENCE;
+      ++i;
+    }
     g_assert (i <= 15 && i <= ref_pool->max_ref_frames);
   }
   for (; i < 15; ++i) {
@@ -1785,7 +2284,7 @@ fill_picture (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
   pic_param->num_ref_idx_l1_default_active_minus1 =
       (ref_pool->max_reflist1_count ? (ref_pool->max_reflist1_count - 1) : 0);
 
-  if (!get_nal_unit_type (picture, &nal_unit_type))
+  if (!get_nal_unit_type (encoder, picture, &nal_unit_type))
     return FALSE;
   pic_param->nal_unit_type = nal_unit_type;
 
@@ -1794,7 +2293,8 @@ fill_picture (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
   pic_param->pic_fields.bits.idr_pic_flag =
       GST_VAAPI_ENC_PICTURE_IS_IDR (picture);
   pic_param->pic_fields.bits.coding_type = picture->type;
-  if (picture->type != GST_VAAPI_PICTURE_TYPE_B)
+  if (picture->type != GST_VAAPI_PICTURE_TYPE_B
+      && !is_temporal_id_max (encoder, picture))
     pic_param->pic_fields.bits.reference_pic_flag = TRUE;
   pic_param->pic_fields.bits.sign_data_hiding_enabled_flag = FALSE;
   pic_param->pic_fields.bits.transform_skip_enabled_flag = TRUE;
@@ -1825,8 +2325,9 @@ fill_picture (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
   pic_param->pic_fields.bits.tiles_enabled_flag =
       h265_is_tile_enabled (encoder);
   if (pic_param->pic_fields.bits.tiles_enabled_flag) {
-    /* Always set loop filter across tiles enabled now */
-    pic_param->pic_fields.bits.loop_filter_across_tiles_enabled_flag = 1;
+    /* Filter across tiles unless they have to be decodable on their own */
+    pic_param->pic_fields.bits.loop_filter_across_tiles_enabled_flag =
+        !encoder->independent_tiles;
 
     pic_param->num_tile_columns_minus1 = encoder->num_tile_cols - 1;
     pic_param->num_tile_rows_minus1 = encoder->num_tile_rows - 1;
@@ -1844,6 +2345,25 @@ fill_picture (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
   return TRUE;
 }
 
+/* Returns the QP of the slices of @picture, only the I/P/B offsets of
+   the constant QP mode apply */
+static guint
+get_picture_qp (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture)
+{
+  gint qp = encoder->qp_i;
+
+  if (GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP) {
+    if (picture->type == GST_VAAPI_PICTURE_TYPE_P)
+      qp += encoder->qp_ip;
+    else if (picture->type == GST_VAAPI_PICTURE_TYPE_B)
+      qp += encoder->qp_ib;
+    /* software rate control, see gst_vaapi_encoder_encode_and_queue() */
+    qp += picture->qp_delta;
+    qp = CLAMP (qp, (gint) encoder->min_qp, (gint) encoder->max_qp);
+  }
+  return qp;
+}
+
 static GstVaapiEncSlice *
 create_and_fill_one_slice (GstVaapiEncoderH265 * encoder,
     GstVaapiEncPicture * picture,
@@ -1871,6 +2391,8 @@ create_and_fill_one_slice (GstVaapiEncoderH265 * encoder,
     slice_param->num_ref_idx_l0_active_minus1 = reflist_0_count - 1;
   else
     slice_param->num_ref_idx_l0_active_minus1 = 0;
+
+
   if (picture->type == GST_VAAPI_PICTURE_TYPE_B && reflist_1_count > 0)
     slice_param->num_ref_idx_l1_active_minus1 = reflist_1_count - 1;
   else
@@ -1879,12 +2401,25 @@ create_and_fill_one_slice (GstVaapiEncoderH265 * encoder,
     slice_param->num_ref_idx_l1_active_minus1 =
         slice_param->num_ref_idx_l0_active_minus1;
 
+  /* With intra block copy, the current picture ends the list 0, even
+     for the intra pictures which are then coded as P slices (7.4.7.1) */
+  if (encoder->use_scc) {
+    slice_param->slice_fields.bits.num_ref_idx_active_override_flag = TRUE;
+    if (slice_param->slice_type == GST_H265_I_SLICE)
+      slice_param->slice_type = GST_H265_P_SLICE;
+    else if (reflist_0_count > 0)
+      slice_param->num_ref_idx_l0_active_minus1++;
+  }
+
   i_ref = 0;
   if (picture->type != GST_VAAPI_PICTURE_TYPE_I) {
     for (; i_ref < reflist_0_count; ++i_ref) {
       slice_param->ref_pic_list0[i_ref].picture_id =
           GST_VAAPI_SURFACE_PROXY_SURFACE_ID (reflist_0[i_ref]->pic);
       slice_param->ref_pic_list0[i_ref].pic_order_cnt = reflist_0[i_ref]->poc;
+      if (reflist_0[i_ref]->long_term)
+        slice_param->ref_pic_list0[i_ref].flags =
+            VA_PICTURE_HEVC_LONG_TERM_REFERENCE;
     }
   }
   for (; i_ref < G_N_ELEMENTS (slice_param->ref_pic_list0); ++i_ref) {
@@ -1904,6 +2439,9 @@ create_and_fill_one_slice (GstVaapiEncoderH265 * encoder,
       slice_param->ref_pic_list1[i_ref].picture_id =
           GST_VAAPI_SURFACE_PROXY_SURFACE_ID (reflist_0[i_ref]->pic);
       slice_param->ref_pic_list1[i_ref].pic_order_cnt = reflist_0[i_ref]->poc;
+      if (reflist_0[i_ref]->long_term)
+        slice_param->ref_pic_list1[i_ref].flags =
+            VA_PICTURE_HEVC_LONG_TERM_REFERENCE;
     }
   }
   for (; i_ref < G_N_ELEMENTS (slice_param->ref_pic_list1); ++i_ref) {
@@ -1912,22 +2450,8 @@ create_and_fill_one_slice (GstVaapiEncoderH265 * encoder,
   }
 
   slice_param->max_num_merge_cand = 5;  /* MaxNumMergeCand      */
-  slice_param->slice_qp_delta = encoder->qp_i - encoder->init_qp;
-  if (GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP) {
-    if (picture->type == GST_VAAPI_PICTURE_TYPE_P) {
-      slice_param->slice_qp_delta += encoder->qp_ip;
-    } else if (picture->type == GST_VAAPI_PICTURE_TYPE_B) {
-      slice_param->slice_qp_delta += encoder->qp_ib;
-    }
-    if ((gint) encoder->init_qp + slice_param->slice_qp_delta <
-        (gint) encoder->min_qp) {
-      slice_param->slice_qp_delta = encoder->min_qp - encoder->init_qp;
-    }
-    if ((gint) encoder->init_qp + slice_param->slice_qp_delta >
-        (gint) encoder->max_qp) {
-      slice_param->slice_qp_delta = encoder->max_qp - encoder->init_qp;
-    }
-  }
+  slice_param->slice_qp_delta =
+      (gint) get_picture_qp (encoder, picture) - (gint) encoder->init_qp;
 
   slice_param->slice_fields.bits.slice_loop_filter_across_slices_enabled_flag =
       TRUE;
@@ -1951,6 +2475,8 @@ add_slice_headers (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture,
 
   g_assert (picture);
 
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->slice_cache);
+
   if (h265_is_tile_enabled (encoder)) {
     for (i_slice = 0; i_slice < encoder->num_slices; ++i_slice) {
       encoder->first_slice_segment_in_pic_flag = (i_slice == 0);
@@ -2144,8 +2670,17 @@ ensure_misc_params (GstVaapiEncoderH265 * encoder, GstVaapiEncPicture * picture)
     return FALSE;
   if (!gst_vaapi_encoder_ensure_param_roi_regions (base_encoder, picture))
     return FALSE;
+  if (!gst_vaapi_encoder_ensure_qp_map (base_encoder, picture,
+          get_picture_qp (encoder, picture), encoder->min_qp, encoder->max_qp))
+    return FALSE;
   if (!gst_vaapi_encoder_ensure_param_quality_level (base_encoder, picture))
     return FALSE;
+  if (!gst_vaapi_encoder_ensure_param_intra_refresh (base_encoder, picture,
+          encoder->ctu_width))
+    return FALSE;
+  if (!gst_vaapi_encoder_ensure_param_temporal_layers (base_encoder, picture,
+          encoder->temporal_levels, encoder->temporal_layer_bitrates))
+    return FALSE;
   return TRUE;
 }
 
@@ -2275,6 +2810,11 @@ ensure_profile_tier_level (GstVaapiEncoderH265 * encoder)
   const GstVaapiTierH265 tier = encoder->tier;
   const GstVaapiLevelH265 level = encoder->level;
 
+  /* B-frames and the P-frames coded as B-frames need list 1 */
+  GST_VAAPI_ENCODER_CAST (encoder)->required_features =
+      encoder->num_bframes > 0 || encoder->no_p_frame ?
+      GST_VAAPI_ENCODER_FEATURE_BFRAMES : 0;
+
   if (!ensure_profile (encoder))
     return GST_VAAPI_ENCODER_STATUS_ERROR_UNSUPPORTED_PROFILE;
 
@@ -2366,6 +2906,25 @@ reset_properties (GstVaapiEncoderH265 * encoder)
   gst_vaapi_encoder_ensure_max_num_ref_frames (base_encoder, encoder->profile,
       encoder->entrypoint);
 
+  /* A temporal layer needs one reference per lower layer, and every
+     keyframe starts the layer pattern over */
+  encoder->temporal_period = 1;
+  if (encoder->temporal_levels > 1) {
+    if (encoder->temporal_levels - 1 > base_encoder->max_num_ref_frames_0
+        && base_encoder->max_num_ref_frames_0 > 0) {
+      GST_WARNING ("Lowering the temporal levels to %d, the driver supports "
+          "only %d reference frames", base_encoder->max_num_ref_frames_0 + 1,
+          base_encoder->max_num_ref_frames_0);
+      encoder->temporal_levels = base_encoder->max_num_ref_frames_0 + 1;
+    }
+    encoder->temporal_period = 1 << (encoder->temporal_levels - 1);
+    base_encoder->keyframe_period =
+        GST_ROUND_UP_N (base_encoder->keyframe_period,
+        encoder->temporal_period);
+    if (encoder->idr_period < base_encoder->keyframe_period)
+      encoder->idr_period = base_encoder->keyframe_period;
+  }
+
   if (!check_ref_list (encoder))
     return GST_VAAPI_ENCODER_STATUS_ERROR_UNKNOWN;
 
@@ -2374,6 +2933,10 @@ reset_properties (GstVaapiEncoderH265 * encoder)
     encoder->num_bframes = 0;
   }
 
+  /* Output pictures in decode order when tuned for low latency */
+  if (GST_VAAPI_ENCODER_TUNE (encoder) == GST_VAAPI_ENCODER_TUNE_LOW_LATENCY)
+    encoder->num_bframes = 0;
+
   if (encoder->num_ref_frames > base_encoder->max_num_ref_frames_0) {
     GST_INFO ("Lowering the number of reference frames to %d",
         base_encoder->max_num_ref_frames_0);
@@ -2383,6 +2946,20 @@ reset_properties (GstVaapiEncoderH265 * encoder)
   if (encoder->num_bframes > (base_encoder->keyframe_period + 1) / 2)
     encoder->num_bframes = (base_encoder->keyframe_period + 1) / 2;
 
+  /* Temporal layers use a hierarchical-P structure */
+  if (encoder->temporal_levels > 1) {
+    if (encoder->num_bframes > 0)
+      GST_INFO ("Disabling b-frames for temporal scalability");
+    encoder->num_bframes = 0;
+    encoder->num_ref_frames = encoder->temporal_levels - 1;
+  }
+
+  if (encoder->ltr_interval > 0 && (encoder->num_bframes > 0
+          || encoder->temporal_levels > 1)) {
+    GST_WARNING ("Disabling long-term references, they need P frames only");
+    encoder->ltr_interval = 0;
+  }
+
   if (encoder->num_bframes > 0 && GST_VAAPI_ENCODER_FPS_N (encoder) > 0)
     encoder->cts_offset = gst_util_uint64_scale (GST_SECOND,
         GST_VAAPI_ENCODER_FPS_D (encoder), GST_VAAPI_ENCODER_FPS_N (encoder));
@@ -2392,6 +2969,10 @@ reset_properties (GstVaapiEncoderH265 * encoder)
   /* init max_poc */
   encoder->log2_max_pic_order_cnt =
       h265_get_log2_max_pic_order_cnt (encoder->idr_period);
+  /* the long-term reference is identified by its POC LSBs, which must
+     not wrap around within an LTR interval */
+  if (encoder->ltr_interval > 0)
+    encoder->log2_max_pic_order_cnt = 16;
   g_assert (encoder->log2_max_pic_order_cnt >= 4);
   encoder->max_pic_order_cnt = (1 << encoder->log2_max_pic_order_cnt);
   encoder->idr_num = 0;
@@ -2411,6 +2992,17 @@ reset_properties (GstVaapiEncoderH265 * encoder)
   ref_pool->max_ref_frames = ref_pool->max_reflist0_count
       + ref_pool->max_reflist1_count;
 
+  /* the long-term reference takes a slot of its own */
+  if (encoder->ltr_interval > 0) {
+    encoder->max_dec_pic_buffering++;
+    ref_pool->max_reflist0_count++;
+    ref_pool->max_ref_frames++;
+  }
+
+  /* with intra block copy, the current picture is a reference too */
+  if (encoder->use_scc)
+    encoder->max_dec_pic_buffering++;
+
   reorder_pool = &encoder->reorder_pool;
   reorder_pool->frame_index = 0;
 
@@ -2441,6 +3033,17 @@ recalculate_slices_num_by_tile (GstVaapiEncoderH265 * encoder)
 {
   GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
 
+  /* Tile slices are extracted as they are, so exactly one per tile */
+  if (encoder->tile_slices) {
+    if (encoder->num_slices > 1 &&
+        encoder->num_slices != encoder->num_tile_cols * encoder->num_tile_rows)
+      GST_WARNING ("user set num-slices to %d, but tile-slices needs one"
+          " slice per tile. Just set the num-slices to tile num %d here.",
+          encoder->num_slices, encoder->num_tile_cols * encoder->num_tile_rows);
+    encoder->num_slices = encoder->num_tile_cols * encoder->num_tile_rows;
+    return;
+  }
+
   /* If driver has the requirement that the slice should not span tiles,
      we need to increase slice number if needed. */
   if (gst_vaapi_display_has_driver_quirks (display,
@@ -2464,7 +3067,6 @@ recalculate_slices_num_by_tile (GstVaapiEncoderH265 * encoder)
 static GstVaapiEncoderStatus
 calculate_slices_start_address (GstVaapiEncoderH265 * encoder)
 {
-  GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
   guint32 ctu_per_slice;
   guint32 left_slices;
   gint32 i, j, k;
@@ -2473,8 +3075,7 @@ calculate_slices_start_address (GstVaapiEncoderH265 * encoder)
      firstly we should scatter slices uniformly into each tile, bigger
      tile gets more slices. Then we should assign CTUs within one tile
      uniformly to each slice in that tile. */
-  if (gst_vaapi_display_has_driver_quirks (display,
-          GST_VAAPI_DRIVER_QUIRK_HEVC_ENC_SLICE_NOT_SPAN_TILE)) {
+  if (h265_slices_follow_tiles (encoder)) {
     guint32 *slices_per_tile = g_malloc (encoder->num_tile_cols *
         encoder->num_tile_rows * sizeof (guint32));
     if (!slices_per_tile)
@@ -2722,6 +3323,9 @@ gst_vaapi_encoder_h265_encode (GstVaapiEncoder * base_encoder,
 
   g_assert (GST_VAAPI_SURFACE_PROXY_SURFACE (reconstruct));
 
+  reference_list_prune (encoder, picture);
+  ltr_prepare_picture (encoder, picture);
+
   if (!ensure_sequence (encoder, picture))
     goto error;
   if (!ensure_misc_params (encoder, picture))
@@ -2868,8 +3472,8 @@ gst_vaapi_encoder_h265_get_codec_data (GstVaapiEncoder * base_encoder,
   WRITE_UINT32 (&bs, 0x01, 3);  /* bit_depth_chroma_minus8 */
   WRITE_UINT32 (&bs, 0x00, 16); /* avgFramerate */
   WRITE_UINT32 (&bs, 0x00, 2);  /* constatnFramerate */
-  WRITE_UINT32 (&bs, 0x00, 3);  /* numTemporalLayers */
-  WRITE_UINT32 (&bs, 0x00, 1);  /* temporalIdNested */
+  WRITE_UINT32 (&bs, encoder->temporal_levels, 3);     /* numTemporalLayers */
+  WRITE_UINT32 (&bs, 0x01, 1);  /* temporalIdNested */
   WRITE_UINT32 (&bs, nal_length_size - 1, 2);   /* lengthSizeMinusOne */
   WRITE_UINT32 (&bs, 0x00, 8);  /* numOfArrays */
 
@@ -3007,13 +3611,21 @@ gst_vaapi_encoder_h265_reordering (GstVaapiEncoder * base_encoder,
   picture->poc = ((reorder_pool->cur_present_index * 1) %
       encoder->max_pic_order_cnt);
 
-  is_idr = (reorder_pool->frame_index == 0 ||
-      reorder_pool->frame_index >= encoder->idr_period);
+  /* With rolling intra refresh, only the first frame and the forced
+     keyframes are intra coded */
+  is_idr = (reorder_pool->frame_index == 0 || (!base_encoder->intra_refresh &&
+          reorder_pool->frame_index >= encoder->idr_period));
+
+  /* Keyframes restart the temporal layer pattern */
+  if (encoder->temporal_levels > 1 && (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME
+          (frame) || (!base_encoder->intra_refresh && (reorder_pool->frame_index
+                  % GST_VAAPI_ENCODER_KEYFRAME_PERIOD (encoder)) == 0)))
+    is_idr = TRUE;
 
   /* check key frames */
   if (is_idr || GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame) ||
-      (reorder_pool->frame_index %
-          GST_VAAPI_ENCODER_KEYFRAME_PERIOD (encoder)) == 0) {
+      (!base_encoder->intra_refresh && (reorder_pool->frame_index %
+              GST_VAAPI_ENCODER_KEYFRAME_PERIOD (encoder)) == 0)) {
     ++reorder_pool->frame_index;
 
     /* b frame enabled,  check queue of reorder_frame_list */
@@ -3058,6 +3670,10 @@ gst_vaapi_encoder_h265_reordering (GstVaapiEncoder * base_encoder,
 
 end:
   g_assert (picture);
+  if (encoder->temporal_levels > 1)
+    picture->temporal_id =
+        gst_vaapi_encoder_get_temporal_id (encoder->temporal_levels,
+        reorder_pool->frame_index - 1);
   frame = picture->frame;
   if (GST_CLOCK_TIME_IS_VALID (frame->pts))
     frame->pts += encoder->cts_offset;
@@ -3127,6 +3743,11 @@ gst_vaapi_encoder_h265_reconfigure (GstVaapiEncoder * base_encoder)
   GstVaapiEncoderStatus status;
   guint luma_width, luma_height;
 
+  /* Headers are rebuilt from the new configuration */
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->vps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->sps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->pps_cache);
+
   luma_width = GST_VAAPI_ENCODER_WIDTH (encoder);
   luma_height = GST_VAAPI_ENCODER_HEIGHT (encoder);
 
@@ -3195,6 +3816,7 @@ gst_vaapi_encoder_h265_init (GstVaapiEncoderH265 * encoder)
   encoder->conformance_window_flag = 0;
   encoder->num_slices = 1;
   encoder->no_p_frame = FALSE;
+  encoder->temporal_levels = MIN_TEMPORAL_LEVELS;
 
   /* re-ordering  list initialize */
   reorder_pool = &encoder->reorder_pool;
@@ -3213,6 +3835,20 @@ gst_vaapi_encoder_h265_init (GstVaapiEncoderH265 * encoder)
   encoder->allowed_profiles = NULL;
 }
 
+/* Only the rate control and HRD parameters follow the new bitrate, the
+   tier and level are updated in case the bitrate no longer fits them */
+static GstVaapiEncoderStatus
+gst_vaapi_encoder_h265_update_rate_control (GstVaapiEncoder * base_encoder)
+{
+  GstVaapiEncoderH265 *const encoder = GST_VAAPI_ENCODER_H265 (base_encoder);
+
+  ensure_bitrate_hrd (encoder);
+  if (!ensure_tier_level (encoder))
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  ensure_control_rate_params (encoder);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
 struct _GstVaapiEncoderH265Class
 {
   GstVaapiEncoderClass parent_class;
@@ -3235,6 +3871,11 @@ gst_vaapi_encoder_h265_finalize (GObject * object)
   gst_buffer_replace (&encoder->sps_data, NULL);
   gst_buffer_replace (&encoder->pps_data, NULL);
 
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->vps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->sps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->pps_cache);
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->slice_cache);
+
   /* reference list info de-init */
   ref_pool = &encoder->ref_pool;
   while (!g_queue_is_empty (&ref_pool->ref_list)) {
@@ -3242,6 +3883,8 @@ gst_vaapi_encoder_h265_finalize (GObject * object)
     reference_pic_free (encoder, ref);
   }
   g_queue_clear (&ref_pool->ref_list);
+  reference_pic_free (encoder, encoder->ltr_ref);
+  encoder->ltr_ref = NULL;
 
   /* re-ordering  list initialize */
   reorder_pool = &encoder->reorder_pool;
@@ -3260,6 +3903,43 @@ gst_vaapi_encoder_h265_finalize (GObject * object)
   G_OBJECT_CLASS (gst_vaapi_encoder_h265_parent_class)->finalize (object);
 }
 
+static void
+set_temporal_layer_bitrates (GstVaapiEncoderH265 * const encoder,
+    const GValue * value)
+{
+  guint i, len = gst_value_array_get_size (value);
+
+  if (len > MAX_TEMPORAL_LEVELS) {
+    GST_WARNING ("%d temporal layer bitrates are provided, only the first %d "
+        "are used", len, MAX_TEMPORAL_LEVELS);
+    len = MAX_TEMPORAL_LEVELS;
+  }
+
+  memset (encoder->temporal_layer_bitrates, 0,
+      sizeof (encoder->temporal_layer_bitrates));
+  for (i = 0; i < len; i++) {
+    const GValue *val = gst_value_array_get_value (value, i);
+    encoder->temporal_layer_bitrates[i] = g_value_get_uint (val);
+  }
+}
+
+static void
+get_temporal_layer_bitrates (GstVaapiEncoderH265 * const encoder,
+    GValue * value)
+{
+  guint i;
+  GValue bitrate = G_VALUE_INIT;
+
+  g_value_reset (value);
+  g_value_init (&bitrate, G_TYPE_UINT);
+
+  for (i = 0; i < encoder->temporal_levels; i++) {
+    g_value_set_uint (&bitrate, encoder->temporal_layer_bitrates[i]);
+    gst_value_array_append_value (value, &bitrate);
+  }
+  g_value_unset (&bitrate);
+}
+
 /**
  * @ENCODER_H265_PROP_RATECONTROL: Rate control (#GstVaapiRateControl).
  * @ENCODER_H265_PROP_TUNE: The tuning options (#GstVaapiEncoderTune).
@@ -3276,6 +3956,16 @@ gst_vaapi_encoder_h265_finalize (GObject * object)
  * @ENCODER_H265_PROP_QP_IB: Difference of QP between I and B frame.
  * @ENCODER_H265_PROP_LOW_DELAY_B: use low delay b feature.
  * @ENCODER_H265_PROP_MAX_QP: Maximal quantizer value (uint).
+ * @ENCODER_H265_PROP_TEMPORAL_LEVELS: Number of temporal levels (uint).
+ * @ENCODER_H265_PROP_TEMPORAL_LAYER_BITRATES: Per temporal layer
+ *   bitrate (#GstValueArray of uint).
+ * @ENCODER_H265_PROP_TILE_SLICES: Encode each tile as one slice (bool).
+ * @ENCODER_H265_PROP_INDEPENDENT_TILES: Disable the in-loop filters
+ *   across tile boundaries (bool).
+ * @ENCODER_H265_PROP_LTR_INTERVAL: Number of frames between two
+ *   long-term reference frames (uint).
+ * @ENCODER_H265_PROP_SCREEN_CONTENT: Use the screen content coding
+ *   tools (bool).
  *
  * The set of H.265 encoder specific configurable properties.
  */
@@ -3299,6 +3989,12 @@ enum
   ENCODER_H265_PROP_QUALITY_FACTOR,
   ENCODER_H265_PROP_NUM_TILE_COLS,
   ENCODER_H265_PROP_NUM_TILE_ROWS,
+  ENCODER_H265_PROP_TEMPORAL_LEVELS,
+  ENCODER_H265_PROP_TEMPORAL_LAYER_BITRATES,
+  ENCODER_H265_PROP_TILE_SLICES,
+  ENCODER_H265_PROP_INDEPENDENT_TILES,
+  ENCODER_H265_PROP_LTR_INTERVAL,
+  ENCODER_H265_PROP_SCREEN_CONTENT,
   ENCODER_H265_N_PROPERTIES
 };
 
@@ -3377,6 +4073,24 @@ gst_vaapi_encoder_h265_set_property (GObject * object, guint prop_id,
     case ENCODER_H265_PROP_NUM_TILE_ROWS:
       encoder->num_tile_rows = g_value_get_uint (value);
       break;
+    case ENCODER_H265_PROP_TEMPORAL_LEVELS:
+      encoder->temporal_levels = g_value_get_uint (value);
+      break;
+    case ENCODER_H265_PROP_TEMPORAL_LAYER_BITRATES:
+      set_temporal_layer_bitrates (encoder, value);
+      break;
+    case ENCODER_H265_PROP_TILE_SLICES:
+      encoder->tile_slices = g_value_get_boolean (value);
+      break;
+    case ENCODER_H265_PROP_INDEPENDENT_TILES:
+      encoder->independent_tiles = g_value_get_boolean (value);
+      break;
+    case ENCODER_H265_PROP_LTR_INTERVAL:
+      encoder->ltr_interval = g_value_get_uint (value);
+      break;
+    case ENCODER_H265_PROP_SCREEN_CONTENT:
+      encoder->screen_content = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -3440,6 +4154,24 @@ gst_vaapi_encoder_h265_get_property (GObject * object, guint prop_id,
     case ENCODER_H265_PROP_NUM_TILE_ROWS:
       g_value_set_uint (value, encoder->num_tile_rows);
       break;
+    case ENCODER_H265_PROP_TEMPORAL_LEVELS:
+      g_value_set_uint (value, encoder->temporal_levels);
+      break;
+    case ENCODER_H265_PROP_TEMPORAL_LAYER_BITRATES:
+      get_temporal_layer_bitrates (encoder, value);
+      break;
+    case ENCODER_H265_PROP_TILE_SLICES:
+      g_value_set_boolean (value, encoder->tile_slices);
+      break;
+    case ENCODER_H265_PROP_INDEPENDENT_TILES:
+      g_value_set_boolean (value, encoder->independent_tiles);
+      break;
+    case ENCODER_H265_PROP_LTR_INTERVAL:
+      g_value_set_uint (value, encoder->ltr_interval);
+      break;
+    case ENCODER_H265_PROP_SCREEN_CONTENT:
+      g_value_set_boolean (value, encoder->screen_content);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -3455,6 +4187,8 @@ gst_vaapi_encoder_h265_class_init (GstVaapiEncoderH265Class * klass)
 
   encoder_class->class_data = &g_class_data;
   encoder_class->reconfigure = gst_vaapi_encoder_h265_reconfigure;
+  encoder_class->update_rate_control =
+      gst_vaapi_encoder_h265_update_rate_control;
   encoder_class->reordering = gst_vaapi_encoder_h265_reordering;
   encoder_class->encode = gst_vaapi_encoder_h265_encode;
   encoder_class->flush = gst_vaapi_encoder_h265_flush;
@@ -3674,6 +4408,103 @@ gst_vaapi_encoder_h265_class_init (GstVaapiEncoderH265Class * klass)
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoderH265:temporal-levels:
+   *
+   * Number of temporal layers, encoded as a hierarchical-P structure
+   * where each layer doubles the frame rate of the layers below it.
+   * B-frames are disabled when more than one level is used.
+   */
+  properties[ENCODER_H265_PROP_TEMPORAL_LEVELS] =
+      g_param_spec_uint ("temporal-levels",
+      "temporal levels",
+      "Number of temporal levels in the encoded stream",
+      MIN_TEMPORAL_LEVELS, MAX_TEMPORAL_LEVELS, MIN_TEMPORAL_LEVELS,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderH265:temporal-layer-bitrates:
+   *
+   * The target bitrate of each temporal layer, in kbps, starting from
+   * the base layer. Each value accounts for its layer and all the
+   * layers below it. A value of 0 leaves the layer to the overall
+   * rate control.
+   */
+  properties[ENCODER_H265_PROP_TEMPORAL_LAYER_BITRATES] =
+      gst_param_spec_array ("temporal-layer-bitrates",
+      "Temporal layer bitrates",
+      "Cumulative bitrate (in kbps) of each temporal layer",
+      g_param_spec_uint ("temporal-layer-bitrate", "Temporal layer bitrate",
+          "bitrate of a temporal layer", 0, 2000 * 1024, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderH265:tile-slices:
+   *
+   * Encode each tile as exactly one slice, in tile scan order, so
+   * that the tiles can be extracted from the bitstream as whole NAL
+   * units. Overrides num-slices when tiles are enabled.
+   */
+  properties[ENCODER_H265_PROP_TILE_SLICES] =
+      g_param_spec_boolean ("tile-slices",
+      "Tile slices",
+      "Encode each tile as one slice", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderH265:independent-tiles:
+   *
+   * Disable the deblocking and SAO filters across tile boundaries, and
+   * the temporal motion vector prediction, so that a tile only depends
+   * on the pixels of its own area. Motion vectors are chosen by the
+   * driver, which may still point outside of the tile area.
+   */
+  properties[ENCODER_H265_PROP_INDEPENDENT_TILES] =
+      g_param_spec_boolean ("independent-tiles",
+      "Independent tiles",
+      "Disable the in-loop filters across tile boundaries", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderH265:ltr-interval:
+   *
+   * The number of frames between two long-term reference frames, the
+   * IDR frames being long-term references too. After a loss, see
+   * gst_vaapi_encoder_h265_invalidate_refs(), the next frame only
+   * predicts from the last long-term reference instead of being an
+   * IDR frame. Zero disables long-term references. They need packed
+   * sequence and slice headers, and are not used with B-frames or
+   * temporal layers.
+   */
+  properties[ENCODER_H265_PROP_LTR_INTERVAL] =
+      g_param_spec_uint ("ltr-interval",
+      "LTR interval",
+      "Number of frames between two long-term reference frames used "
+      "for loss recovery (0: disabled)", 0, 4096, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderH265:screen-content:
+   *
+   * Selects a screen-extended profile, with the palette mode and the
+   * intra block copy tools, when the hardware supports one for the
+   * input format. They code the text and the flat areas of desktop
+   * captures much more efficiently.
+   */
+  properties[ENCODER_H265_PROP_SCREEN_CONTENT] =
+      g_param_spec_boolean ("screen-content",
+      "Screen content",
+      "Use the screen content coding tools (palette mode, intra block copy)",
+      FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_H265_N_PROPERTIES,
       properties);
 
@@ -3750,3 +4581,93 @@ gst_vaapi_encoder_h265_get_profile_tier_level (GstVaapiEncoderH265 * encoder,
 
   return TRUE;
 }
+
+/**
+ * gst_vaapi_encoder_h265_get_num_tile_slices:
+ * @encoder: a #GstVaapiEncoderH265
+ *
+ * Queries the H.265 @encoder for the number of tile slices of each
+ * picture, i.e. the number of tiles when #GstVaapiEncoderH265:tile-slices
+ * is set. The slice NAL units of a picture then come in tile scan order,
+ * one per tile. That information is only valid after the encoder is
+ * configured.
+ *
+ * Return value: the number of tile slices, or 0 if slices don't match tiles
+ */
+guint
+gst_vaapi_encoder_h265_get_num_tile_slices (GstVaapiEncoderH265 * encoder)
+{
+  g_return_val_if_fail (encoder != NULL, 0);
+
+  if (!encoder->tile_slices || !h265_is_tile_enabled (encoder)
+      || !encoder->tile_slice_address)
+    return 0;
+  return encoder->num_slices;
+}
+
+/**
+ * gst_vaapi_encoder_h265_get_tile_slice_rect:
+ * @encoder: a #GstVaapiEncoderH265
+ * @index: the tile slice index, in tile scan order
+ * @rect: return location for the area of the tile, in luma samples
+ *
+ * Queries the H.265 @encoder for the picture area covered by the tile
+ * slice @index. See gst_vaapi_encoder_h265_get_num_tile_slices().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_encoder_h265_get_tile_slice_rect (GstVaapiEncoderH265 * encoder,
+    guint index, GstVaapiRectangle * rect)
+{
+  const guint ctu_size =
+      encoder->entrypoint == GST_VAAPI_ENTRYPOINT_SLICE_ENCODE_LP ? 64 : 32;
+  guint i, col, row, x = 0, y = 0;
+
+  g_return_val_if_fail (encoder != NULL, FALSE);
+  g_return_val_if_fail (rect != NULL, FALSE);
+
+  if (index >= gst_vaapi_encoder_h265_get_num_tile_slices (encoder))
+    return FALSE;
+
+  col = index % encoder->num_tile_cols;
+  row = index / encoder->num_tile_cols;
+  for (i = 0; i < col; i++)
+    x += tile_ctu_cols[i];
+  for (i = 0; i < row; i++)
+    y += tile_ctu_rows[i];
+
+  rect->x = x * ctu_size;
+  rect->y = y * ctu_size;
+  rect->width = MIN (tile_ctu_cols[col] * ctu_size,
+      GST_VAAPI_ENCODER_WIDTH (encoder) - rect->x);
+  rect->height = MIN (tile_ctu_rows[row] * ctu_size,
+      GST_VAAPI_ENCODER_HEIGHT (encoder) - rect->y);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_encoder_h265_invalidate_refs:
+ * @encoder: a #GstVaapiEncoderH265
+ *
+ * Makes the next frame only predict from the last long-term
+ * reference frame, see #GstVaapiEncoderH265:ltr-interval, and drops
+ * the other reference frames. A receiver that lost data after that
+ * long-term reference can then resume decoding without an IDR frame.
+ *
+ * This function can be called from any thread.
+ *
+ * Returns: %TRUE if a long-term reference is available; %FALSE
+ *   otherwise, in which case a keyframe should be requested instead
+ **/
+gboolean
+gst_vaapi_encoder_h265_invalidate_refs (GstVaapiEncoderH265 * encoder)
+{
+  g_return_val_if_fail (encoder != NULL, FALSE);
+
+  if (!g_atomic_int_get (&encoder->ltr_available))
+    return FALSE;
+
+  g_atomic_int_set (&encoder->ltr_recovery_requested, TRUE);
+  return TRUE;
+}
@@ -52,6 +52,16 @@ gboolean
 gst_vaapi_encoder_h265_get_profile_tier_level (GstVaapiEncoderH265 * encoder,
     GstVaapiProfile * out_profile_ptr, GstVaapiTierH265 *out_tier_ptr, GstVaapiLevelH265 * out_level_ptr);
 
+guint
+gst_vaapi_encoder_h265_get_num_tile_slices (GstVaapiEncoderH265 * encoder);
+
+gboolean
+gst_vaapi_encoder_h265_get_tile_slice_rect (GstVaapiEncoderH265 * encoder,
+    guint index, GstVaapiRectangle * rect);
+
+gboolean
+gst_vaapi_encoder_h265_invalidate_refs (GstVaapiEncoderH265 * encoder);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiEncoderH265, gst_object_unref)
 
 G_END_DECLS
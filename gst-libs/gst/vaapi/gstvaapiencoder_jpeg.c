@@ -28,6 +28,10 @@
 #include "gstvaapiencoder_jpeg.h"
 #include "gstvaapicodedbufferproxy_priv.h"
 #include "gstvaapisurface.h"
+#include "gstvaapicontext.h"
+#include "gstvaapiutils.h"
+#include "gstvaapiutils_core.h"
+#include "gstvaapiutils_h26x_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -52,6 +56,12 @@
 #define NUM_AC_CODE_WORDS_HUFFVAL 162
 #define NUM_DC_CODE_WORDS_HUFFVAL 12
 
+/* Maximum number of VA contexts pictures are spread over */
+#define MAX_CONTEXTS 8
+
+/* Largest restart interval the DRI marker can signal, in MCUs */
+#define MAX_RESTART_INTERVAL 65535
+
 /* ------------------------------------------------------------------------- */
 /* --- JPEG Encoder                                                      --- */
 /* ------------------------------------------------------------------------- */
@@ -63,6 +73,7 @@ struct _GstVaapiEncoderJpeg
   guint quality;
   GstJpegQuantTables quant_tables;
   GstJpegQuantTables scaled_quant_tables;
+  guint scaled_quality;
   gboolean has_quant_tables;
   GstJpegHuffmanTables huff_tables;
   gboolean has_huff_tables;
@@ -73,8 +84,115 @@ struct _GstVaapiEncoderJpeg
   gint h_max_samp;
   gint v_max_samp;
   guint n_components;
+
+  /* restart interval, in MCUs, as requested and as actually used once
+     fitted to the number of slices the hardware can emit */
+  guint restart_interval;
+  guint num_restart_intervals;
+  guint mcu_restart_interval;
+
+  /* prebuilt packed header, the same for all pictures */
+  GstVaapiH26xHeaderCache packed_hdr_cache;
+
+  /* VA contexts pictures are spread over, in addition to the
+     encoder one */
+  guint num_contexts;
+  GArray *extra_contexts;
+  VAConfigID extra_contexts_config;
+  VAContextID extra_contexts_parent;
+  guint next_context;
 };
 
+/* Destroys the VA contexts created in addition to the encoder one */
+static void
+destroy_extra_contexts (GstVaapiEncoderJpeg * encoder)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
+  guint i;
+
+  if (!encoder->extra_contexts || encoder->extra_contexts->len == 0)
+    return;
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  for (i = 0; i < encoder->extra_contexts->len; i++) {
+    vaDestroyContext (GST_VAAPI_DISPLAY_VADISPLAY (display),
+        g_array_index (encoder->extra_contexts, VAContextID, i));
+  }
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  g_array_set_size (encoder->extra_contexts, 0);
+  encoder->extra_contexts_config = VA_INVALID_ID;
+  encoder->extra_contexts_parent = VA_INVALID_ID;
+  encoder->next_context = 0;
+}
+
+/* Creates the extra VA contexts, from the encoder context config. They
+   are created again whenever that context is reset */
+static void
+ensure_extra_contexts (GstVaapiEncoderJpeg * encoder)
+{
+  GstVaapiEncoder *const base_encoder = GST_VAAPI_ENCODER_CAST (encoder);
+  GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
+  GstVaapiContext *const context = base_encoder->context;
+  GArray *surfaces;
+  VAContextID context_id;
+  VAStatus status;
+  guint i;
+
+  if (!context || !context->surfaces || encoder->num_contexts < 2)
+    return;
+
+  if (!encoder->extra_contexts)
+    encoder->extra_contexts = g_array_new (FALSE, FALSE, sizeof (VAContextID));
+  else if (encoder->extra_contexts_config != context->va_config ||
+      encoder->extra_contexts_parent != gst_vaapi_context_get_id (context))
+    destroy_extra_contexts (encoder);
+
+  if (encoder->extra_contexts->len + 1 >= encoder->num_contexts)
+    return;
+
+  surfaces = g_array_sized_new (FALSE, FALSE, sizeof (VASurfaceID),
+      context->surfaces->len);
+  for (i = 0; i < context->surfaces->len; i++) {
+    GstVaapiSurface *const surface = g_ptr_array_index (context->surfaces, i);
+    VASurfaceID surface_id = GST_VAAPI_SURFACE_ID (surface);
+    g_array_append_val (surfaces, surface_id);
+  }
+
+  while (encoder->extra_contexts->len + 1 < encoder->num_contexts) {
+    GST_VAAPI_DISPLAY_LOCK (display);
+    status = vaCreateContext (GST_VAAPI_DISPLAY_VADISPLAY (display),
+        context->va_config, GST_VAAPI_ENCODER_WIDTH (encoder),
+        GST_VAAPI_ENCODER_HEIGHT (encoder), VA_PROGRESSIVE,
+        (VASurfaceID *) surfaces->data, surfaces->len, &context_id);
+    GST_VAAPI_DISPLAY_UNLOCK (display);
+    if (!vaapi_check_status (status, "vaCreateContext()"))
+      break;
+    g_array_append_val (encoder->extra_contexts, context_id);
+  }
+  g_array_unref (surfaces);
+
+  encoder->extra_contexts_config = context->va_config;
+  encoder->extra_contexts_parent = gst_vaapi_context_get_id (context);
+  GST_DEBUG ("encoding over %u VA contexts", encoder->extra_contexts->len + 1);
+}
+
+/* Selects the VA context the next picture is encoded with, in turn */
+static void
+select_next_context (GstVaapiEncoderJpeg * encoder)
+{
+  GstVaapiEncoder *const base_encoder = GST_VAAPI_ENCODER_CAST (encoder);
+  guint n;
+
+  base_encoder->va_context = gst_vaapi_context_get_id (base_encoder->context);
+  if (!encoder->extra_contexts || encoder->extra_contexts->len == 0)
+    return;
+
+  n = encoder->next_context++ % (encoder->extra_contexts->len + 1);
+  if (n > 0)
+    base_encoder->va_context =
+        g_array_index (encoder->extra_contexts, VAContextID, n - 1);
+}
+
 /* based on upstream gst-plugins-good jpegencoder */
 static void
 generate_sampling_factors (GstVaapiEncoderJpeg * encoder)
@@ -136,6 +254,62 @@ ensure_profile (GstVaapiEncoderJpeg * encoder)
   return GST_VAAPI_ENCODER_STATUS_SUCCESS;
 }
 
+/* Size of the MCUs of the interleaved scan, in luma samples */
+static void
+get_mcu_size (GstVaapiEncoderJpeg * encoder, guint * width, guint * height)
+{
+  *width = 8 * MAX (encoder->h_max_samp, 1);
+  *height = 8 * MAX (encoder->v_max_samp, 1);
+}
+
+/* Total number of MCUs in the picture */
+static guint
+get_num_mcus (GstVaapiEncoderJpeg * encoder, guint * mcus_per_row)
+{
+  guint mcu_width, mcu_height, rows;
+
+  get_mcu_size (encoder, &mcu_width, &mcu_height);
+  *mcus_per_row = (GST_VAAPI_ENCODER_WIDTH (encoder) + mcu_width - 1) /
+      mcu_width;
+  rows = (GST_VAAPI_ENCODER_HEIGHT (encoder) + mcu_height - 1) / mcu_height;
+  return *mcus_per_row * rows;
+}
+
+/* Derives the restart interval actually used. Each interval is one
+   slice for the hardware, so the interval is lengthened when the
+   driver reports it cannot emit that many slices in a picture */
+static void
+ensure_restart_interval (GstVaapiEncoderJpeg * encoder)
+{
+  GstVaapiEncoder *const base_encoder = GST_VAAPI_ENCODER_CAST (encoder);
+  guint interval, mcus_per_row, num_mcus, max_slices;
+
+  encoder->mcu_restart_interval = 0;
+  encoder->num_restart_intervals = 0;
+  if (encoder->restart_interval == 0)
+    return;
+
+  num_mcus = get_num_mcus (encoder, &mcus_per_row);
+  if (num_mcus == 0)
+    return;
+
+  interval = MIN (encoder->restart_interval, num_mcus);
+  if (gst_vaapi_get_config_attribute (GST_VAAPI_ENCODER_DISPLAY (encoder),
+          gst_vaapi_profile_get_va_profile (base_encoder->profile),
+          gst_vaapi_entrypoint_get_va_entrypoint
+          (GST_VAAPI_ENTRYPOINT_PICTURE_ENCODE), VAConfigAttribEncMaxSlices,
+          &max_slices) && max_slices > 0
+      && (num_mcus + interval - 1) / interval > max_slices) {
+    interval = (num_mcus + max_slices - 1) / max_slices;
+    GST_INFO ("restart interval raised to %u MCUs, to fit in %u slices",
+        interval, max_slices);
+  }
+  interval = MIN (interval, MAX_RESTART_INTERVAL);
+
+  encoder->mcu_restart_interval = interval;
+  encoder->num_restart_intervals = (num_mcus + interval - 1) / interval;
+}
+
 /* Derives the profile supported by the underlying hardware */
 static gboolean
 ensure_hw_profile (GstVaapiEncoderJpeg * encoder)
@@ -182,12 +356,16 @@ set_context_info (GstVaapiEncoder * base_encoder)
     MAX_FRAME_HDR_SIZE = 19,
     MAX_QUANT_TABLE_SIZE = 138,
     MAX_HUFFMAN_TABLE_SIZE = 432,
-    MAX_SCAN_HDR_SIZE = 14
+    MAX_SCAN_HDR_SIZE = 14,
+    MAX_DRI_HDR_SIZE = 6,
+    RST_MARKER_SIZE = 2
   };
 
   if (!ensure_hw_profile (encoder))
     return GST_VAAPI_ENCODER_STATUS_ERROR_UNSUPPORTED_PROFILE;
 
+  ensure_restart_interval (encoder);
+
   base_encoder->num_ref_frames = 0;
 
   /* Only YUV 4:2:0 formats are supported for now. */
@@ -195,7 +373,8 @@ set_context_info (GstVaapiEncoder * base_encoder)
       GST_ROUND_UP_16 (vip->height) * 3 / 2;
 
   base_encoder->codedbuf_size += MAX_APP_HDR_SIZE + MAX_FRAME_HDR_SIZE +
-      MAX_QUANT_TABLE_SIZE + MAX_HUFFMAN_TABLE_SIZE + MAX_SCAN_HDR_SIZE;
+      MAX_QUANT_TABLE_SIZE + MAX_HUFFMAN_TABLE_SIZE + MAX_SCAN_HDR_SIZE +
+      MAX_DRI_HDR_SIZE + encoder->num_restart_intervals * RST_MARKER_SIZE;
 
   base_encoder->context_info.profile = base_encoder->profile;
   base_encoder->context_info.entrypoint = GST_VAAPI_ENTRYPOINT_PICTURE_ENCODE;
@@ -281,6 +460,28 @@ generate_scaled_qm (GstJpegQuantTables * quant_tables,
   }
 }
 
+/* Generates the scaled QM once per quality factor */
+static void
+ensure_quant_tables (GstVaapiEncoderJpeg * encoder)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
+  guint shift = 0;
+
+  if (!encoder->has_quant_tables) {
+    gst_jpeg_get_default_quantization_tables (&encoder->quant_tables);
+    encoder->has_quant_tables = TRUE;
+  } else if (encoder->scaled_quality == encoder->quality)
+    return;
+
+  if (gst_vaapi_display_has_driver_quirks (display,
+          GST_VAAPI_DRIVER_QUIRK_JPEG_ENC_SHIFT_VALUE_BY_50))
+    shift = 50;
+
+  generate_scaled_qm (&encoder->quant_tables, &encoder->scaled_quant_tables,
+      encoder->quality, shift);
+  encoder->scaled_quality = encoder->quality;
+}
+
 static gboolean
 fill_quantization_table (GstVaapiEncoderJpeg * encoder,
     GstVaapiEncPicture * picture)
@@ -297,19 +498,7 @@ fill_quantization_table (GstVaapiEncoderJpeg * encoder,
   }
   q_matrix = picture->q_matrix->param;
 
-  if (!encoder->has_quant_tables) {
-    GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
-    guint shift = 0;
-
-    if (gst_vaapi_display_has_driver_quirks (display,
-            GST_VAAPI_DRIVER_QUIRK_JPEG_ENC_SHIFT_VALUE_BY_50))
-      shift = 50;
-
-    gst_jpeg_get_default_quantization_tables (&encoder->quant_tables);
-    encoder->has_quant_tables = TRUE;
-    generate_scaled_qm (&encoder->quant_tables, &encoder->scaled_quant_tables,
-        encoder->quality, shift);
-  }
+  ensure_quant_tables (encoder);
   q_matrix->load_lum_quantiser_matrix = 1;
   for (i = 0; i < GST_JPEG_MAX_QUANT_ELEMENTS; i++) {
     q_matrix->lum_quantiser_matrix[i] =
@@ -411,7 +600,8 @@ fill_slices (GstVaapiEncoderJpeg * encoder, GstVaapiEncPicture * picture)
 
   memset (slice_param, 0, sizeof (VAEncSliceParameterBufferJPEG));
 
-  slice_param->restart_interval = 0;
+  /* the driver inserts the RSTn markers in the entropy-coded data */
+  slice_param->restart_interval = encoder->mcu_restart_interval;
   slice_param->num_components = pic_param->num_components;
 
   slice_param->components[0].component_selector = 1;
@@ -517,19 +707,7 @@ bs_write_jpeg_header (GstBitWriter * bs, GstVaapiEncoderJpeg * encoder,
   gst_bit_writer_put_bits_uint8 (bs, 0, 8);     //Thumbnail height
 
   /* Add  quantization table */
-  if (!encoder->has_quant_tables) {
-    GstVaapiDisplay *const display = GST_VAAPI_ENCODER_DISPLAY (encoder);
-    guint shift = 0;
-
-    if (gst_vaapi_display_has_driver_quirks (display,
-            GST_VAAPI_DRIVER_QUIRK_JPEG_ENC_SHIFT_VALUE_BY_50))
-      shift = 50;
-
-    gst_jpeg_get_default_quantization_tables (&encoder->quant_tables);
-    generate_scaled_qm (&encoder->quant_tables, &encoder->scaled_quant_tables,
-        encoder->quality, shift);
-    encoder->has_quant_tables = TRUE;
-  }
+  ensure_quant_tables (encoder);
 
   gst_bit_writer_put_bits_uint8 (bs, 0xFF, 8);
   gst_bit_writer_put_bits_uint8 (bs, GST_JPEG_MARKER_DQT, 8);
@@ -606,6 +784,14 @@ bs_write_jpeg_header (GstBitWriter * bs, GstVaapiEncoderJpeg * encoder,
     }
   }
 
+  /* Add restart interval definition */
+  if (encoder->mcu_restart_interval > 0) {
+    gst_bit_writer_put_bits_uint8 (bs, 0xFF, 8);
+    gst_bit_writer_put_bits_uint8 (bs, GST_JPEG_MARKER_DRI, 8);
+    gst_bit_writer_put_bits_uint16 (bs, 4, 16); //Lr
+    gst_bit_writer_put_bits_uint16 (bs, encoder->mcu_restart_interval, 16);
+  }
+
   /* Add ScanHeader */
   generate_scan_hdr (&scan_hdr, picture);
   gst_bit_writer_put_bits_uint8 (bs, 0xFF, 8);
@@ -627,19 +813,54 @@ bs_write_jpeg_header (GstBitWriter * bs, GstVaapiEncoderJpeg * encoder,
   return TRUE;
 }
 
+/* Parameters the packed header is built from */
+typedef struct
+{
+  guint quality;
+  guint width;
+  guint height;
+  guint n_components;
+  guint restart_interval;
+  gint h_samp[GST_VIDEO_MAX_COMPONENTS];
+  gint v_samp[GST_VIDEO_MAX_COMPONENTS];
+} PackedHeaderCacheKey;
+
+static void
+fill_packed_header_cache_key (GstVaapiEncoderJpeg * encoder,
+    GstVaapiEncPicture * picture, PackedHeaderCacheKey * key)
+{
+  VAEncPictureParameterBufferJPEG *const pic_param = picture->param;
+
+  memset (key, 0, sizeof (*key));
+  key->quality = encoder->quality;
+  key->width = pic_param->picture_width;
+  key->height = pic_param->picture_height;
+  key->n_components = pic_param->num_components;
+  key->restart_interval = encoder->mcu_restart_interval;
+  memcpy (key->h_samp, encoder->h_samp, sizeof (key->h_samp));
+  memcpy (key->v_samp, encoder->v_samp, sizeof (key->v_samp));
+}
+
 static gboolean
 add_packed_header (GstVaapiEncoderJpeg * encoder, GstVaapiEncPicture * picture)
 {
+  GstVaapiH26xHeaderCache *const cache = &encoder->packed_hdr_cache;
   GstVaapiEncPackedHeader *packed_raw_data_hdr;
-  GstBitWriter bs;
   VAEncPackedHeaderParameterBuffer packed_raw_data_hdr_param = { 0 };
+  PackedHeaderCacheKey key;
   guint32 data_bit_size;
   guint8 *data;
 
-  gst_bit_writer_init_with_size (&bs, 128, FALSE);
-  bs_write_jpeg_header (&bs, encoder, picture);
-  data_bit_size = GST_BIT_WRITER_BIT_SIZE (&bs);
-  data = GST_BIT_WRITER_DATA (&bs);
+  fill_packed_header_cache_key (encoder, picture, &key);
+  if (!gst_vaapi_utils_h26x_header_cache_lookup (cache, &key, sizeof (key))) {
+    GstBitWriter bs;
+
+    gst_bit_writer_init_with_size (&bs, 128, FALSE);
+    bs_write_jpeg_header (&bs, encoder, picture);
+    gst_vaapi_utils_h26x_header_cache_store (cache, &key, sizeof (key), &bs);
+  }
+  data_bit_size = cache->bit_size;
+  data = cache->data;
 
   packed_raw_data_hdr_param.type = VAEncPackedHeaderRawData;
   packed_raw_data_hdr_param.bit_length = data_bit_size;
@@ -654,8 +875,6 @@ add_packed_header (GstVaapiEncoderJpeg * encoder, GstVaapiEncPicture * picture)
   gst_vaapi_enc_picture_add_packed_header (picture, packed_raw_data_hdr);
   gst_vaapi_codec_object_replace (&packed_raw_data_hdr, NULL);
 
-  gst_bit_writer_reset (&bs);
-
   return TRUE;
 }
 
@@ -692,6 +911,11 @@ gst_vaapi_encoder_jpeg_encode (GstVaapiEncoder * base_encoder,
 
   g_assert (GST_VAAPI_SURFACE_PROXY_SURFACE (reconstruct));
 
+  /* JPEG pictures do not depend on each other, so consecutive ones can
+     be encoded at the same time through different VA contexts */
+  ensure_extra_contexts (encoder);
+  select_next_context (encoder);
+
   if (!ensure_picture (encoder, picture, codedbuf, reconstruct))
     goto error;
   if (!ensure_quantization_table (encoder, picture))
@@ -708,11 +932,14 @@ gst_vaapi_encoder_jpeg_encode (GstVaapiEncoder * base_encoder,
     gst_vaapi_encoder_release_surface (GST_VAAPI_ENCODER (encoder),
         reconstruct);
 
+  base_encoder->va_context = gst_vaapi_context_get_id (base_encoder->context);
   return GST_VAAPI_ENCODER_STATUS_SUCCESS;
 
   /* ERRORS */
 error:
   {
+    base_encoder->va_context =
+        gst_vaapi_context_get_id (base_encoder->context);
     if (reconstruct)
       gst_vaapi_encoder_release_surface (GST_VAAPI_ENCODER (encoder),
           reconstruct);
@@ -761,6 +988,8 @@ gst_vaapi_encoder_jpeg_reconfigure (GstVaapiEncoder * base_encoder)
   /* generate sampling factors (A.1.1) */
   generate_sampling_factors (encoder);
 
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->packed_hdr_cache);
+
   return set_context_info (base_encoder);
 }
 
@@ -781,12 +1010,30 @@ gst_vaapi_encoder_jpeg_init (GstVaapiEncoderJpeg * encoder)
       sizeof (encoder->scaled_quant_tables));
   encoder->has_huff_tables = FALSE;
   memset (&encoder->huff_tables, 0, sizeof (encoder->huff_tables));
+  encoder->num_contexts = 1;
+  encoder->extra_contexts_config = VA_INVALID_ID;
+  encoder->extra_contexts_parent = VA_INVALID_ID;
+}
+
+static void
+gst_vaapi_encoder_jpeg_finalize (GObject * object)
+{
+  GstVaapiEncoderJpeg *const encoder = GST_VAAPI_ENCODER_JPEG (object);
+
+  gst_vaapi_utils_h26x_header_cache_clear (&encoder->packed_hdr_cache);
+  destroy_extra_contexts (encoder);
+  g_clear_pointer (&encoder->extra_contexts, g_array_unref);
+
+  G_OBJECT_CLASS (gst_vaapi_encoder_jpeg_parent_class)->finalize (object);
 }
 
 /**
  * @ENCODER_JPEG_PROP_RATECONTROL: Rate control (#GstVaapiRateControl).
  * @ENCODER_JPEG_PROP_TUNE: The tuning options (#GstVaapiEncoderTune).
  * @ENCODER_JPEG_PROP_QUALITY: Quality Factor value (uint).
+ * @ENCODER_JPEG_PROP_NUM_CONTEXTS: Number of VA contexts to encode
+ *   with (uint).
+ * @ENCODER_JPEG_PROP_RESTART_INTERVAL: Restart interval, in MCUs (uint).
  *
  * The set of JPEG encoder specific configurable properties.
  */
@@ -795,6 +1042,8 @@ enum
   ENCODER_JPEG_PROP_RATECONTROL = 1,
   ENCODER_JPEG_PROP_TUNE,
   ENCODER_JPEG_PROP_QUALITY,
+  ENCODER_JPEG_PROP_NUM_CONTEXTS,
+  ENCODER_JPEG_PROP_RESTART_INTERVAL,
   ENCODER_JPEG_N_PROPERTIES
 };
 
@@ -824,6 +1073,12 @@ gst_vaapi_encoder_jpeg_set_property (GObject * object, guint prop_id,
     case ENCODER_JPEG_PROP_QUALITY:
       encoder->quality = g_value_get_uint (value);
       break;
+    case ENCODER_JPEG_PROP_NUM_CONTEXTS:
+      encoder->num_contexts = g_value_get_uint (value);
+      break;
+    case ENCODER_JPEG_PROP_RESTART_INTERVAL:
+      encoder->restart_interval = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -846,6 +1101,12 @@ gst_vaapi_encoder_jpeg_get_property (GObject * object, guint prop_id,
     case ENCODER_JPEG_PROP_QUALITY:
       g_value_set_uint (value, encoder->quality);
       break;
+    case ENCODER_JPEG_PROP_NUM_CONTEXTS:
+      g_value_set_uint (value, encoder->num_contexts);
+      break;
+    case ENCODER_JPEG_PROP_RESTART_INTERVAL:
+      g_value_set_uint (value, encoder->restart_interval);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -867,6 +1128,7 @@ gst_vaapi_encoder_jpeg_class_init (GstVaapiEncoderJpegClass * klass)
 
   object_class->set_property = gst_vaapi_encoder_jpeg_set_property;
   object_class->get_property = gst_vaapi_encoder_jpeg_get_property;
+  object_class->finalize = gst_vaapi_encoder_jpeg_finalize;
 
   properties[ENCODER_JPEG_PROP_RATECONTROL] =
       g_param_spec_enum ("rate-control",
@@ -892,6 +1154,38 @@ gst_vaapi_encoder_jpeg_class_init (GstVaapiEncoderJpegClass * klass)
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoderJpeg:num-contexts:
+   *
+   * Number of VA contexts consecutive pictures are spread over, in
+   * turn, so that the hardware can encode several of them at once.
+   * The coded buffers are still output in order. How many pictures are
+   * actually in flight is bounded by #GstVaapiEncoder:async-depth.
+   */
+  properties[ENCODER_JPEG_PROP_NUM_CONTEXTS] =
+      g_param_spec_uint ("num-contexts",
+      "Number of contexts",
+      "Number of VA contexts to spread the pictures over", 1, MAX_CONTEXTS, 1,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderJpeg:restart-interval:
+   *
+   * Number of MCUs between two restart markers, or 0 for none. The
+   * entropy-coded segments between the markers can be decoded on
+   * their own, hence in parallel. Each segment is a slice for the
+   * hardware, so the interval is lengthened if the driver supports
+   * fewer slices than the picture would have.
+   */
+  properties[ENCODER_JPEG_PROP_RESTART_INTERVAL] =
+      g_param_spec_uint ("restart-interval",
+      "Restart interval",
+      "Number of MCUs between restart markers (0: no restart markers)",
+      0, MAX_RESTART_INTERVAL, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_JPEG_N_PROPERTIES,
       properties);
 
@@ -912,3 +1206,77 @@ gst_vaapi_encoder_jpeg_new (GstVaapiDisplay * display)
 {
   return g_object_new (GST_TYPE_VAAPI_ENCODER_JPEG, "display", display, NULL);
 }
+
+/**
+ * gst_vaapi_encoder_jpeg_get_num_restart_intervals:
+ * @encoder: a #GstVaapiEncoderJpeg
+ *
+ * Queries the JPEG @encoder for the number of restart intervals the
+ * pictures are split into, see #GstVaapiEncoderJpeg:restart-interval.
+ *
+ * Return value: the number of restart intervals, or 0 if the pictures
+ *   have no restart markers
+ */
+guint
+gst_vaapi_encoder_jpeg_get_num_restart_intervals (GstVaapiEncoderJpeg *
+    encoder)
+{
+  g_return_val_if_fail (encoder != NULL, 0);
+
+  return encoder->num_restart_intervals;
+}
+
+/**
+ * gst_vaapi_encoder_jpeg_get_restart_interval_rect:
+ * @encoder: a #GstVaapiEncoderJpeg
+ * @index: the restart interval index
+ * @rect: return location for the area of the interval, in luma samples
+ * @first_mcu: (allow-none): return location for the first MCU of the
+ *   interval, in raster order
+ * @num_mcus: (allow-none): return location for the number of MCUs of
+ *   the interval
+ *
+ * Queries the JPEG @encoder for the picture area covered by the
+ * restart interval @index. When the interval does not span whole MCU
+ * rows, @rect is the bounding box of its MCUs.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_encoder_jpeg_get_restart_interval_rect (GstVaapiEncoderJpeg *
+    encoder, guint index, GstVaapiRectangle * rect, guint * first_mcu,
+    guint * num_mcus)
+{
+  guint mcu_width, mcu_height, mcus_per_row, total, first, last, n;
+
+  g_return_val_if_fail (encoder != NULL, FALSE);
+  g_return_val_if_fail (rect != NULL, FALSE);
+
+  if (index >= encoder->num_restart_intervals)
+    return FALSE;
+
+  get_mcu_size (encoder, &mcu_width, &mcu_height);
+  total = get_num_mcus (encoder, &mcus_per_row);
+  first = index * encoder->mcu_restart_interval;
+  n = MIN (encoder->mcu_restart_interval, total - first);
+  last = first + n - 1;
+
+  if (first / mcus_per_row == last / mcus_per_row) {
+    rect->x = (first % mcus_per_row) * mcu_width;
+    rect->width = n * mcu_width;
+  } else {
+    rect->x = 0;
+    rect->width = mcus_per_row * mcu_width;
+  }
+  rect->y = (first / mcus_per_row) * mcu_height;
+  rect->height = (last / mcus_per_row + 1) * mcu_height - rect->y;
+  rect->width = MIN (rect->width, GST_VAAPI_ENCODER_WIDTH (encoder) - rect->x);
+  rect->height = MIN (rect->height,
+      GST_VAAPI_ENCODER_HEIGHT (encoder) - rect->y);
+
+  if (first_mcu)
+    *first_mcu = first;
+  if (num_mcus)
+    *num_mcus = n;
+  return TRUE;
+}
@@ -43,6 +43,15 @@ gst_vaapi_encoder_jpeg_get_type (void) G_GNUC_CONST;
 GstVaapiEncoder *
 gst_vaapi_encoder_jpeg_new (GstVaapiDisplay * display);
 
+guint
+gst_vaapi_encoder_jpeg_get_num_restart_intervals (GstVaapiEncoderJpeg *
+    encoder);
+
+gboolean
+gst_vaapi_encoder_jpeg_get_restart_interval_rect (GstVaapiEncoderJpeg *
+    encoder, guint index, GstVaapiRectangle * rect, guint * first_mcu,
+    guint * num_mcus);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiEncoderJpeg, gst_object_unref)
 
 G_END_DECLS
@@ -0,0 +1,554 @@
+/*
+ *  gstvaapiencoder_ladder.c - Multi-resolution encoding from a single source
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:gstvaapiencoder_ladder
+ * @short_description: Multi-resolution encoding from a single source
+ *
+ * A #GstVaapiEncoderLadder feeds several #GstVaapiEncoder instances,
+ * one per rendition, from a single stream of source surfaces. Each
+ * source frame is scaled to all rendition sizes by a single
+ * gst_vaapi_filter_process_multi() call, straight into the surface
+ * pools of the rendition encoders, so no extra copy or intermediate
+ * pool is involved.
+ *
+ * All renditions use the same keyframe period, and scene change
+ * detection runs once on the source frames, so that the encoded
+ * renditions have their IDR frames at the same positions and can be
+ * switched between at any keyframe.
+ */
+
+#include "sysdeps.h"
+#include "gstvaapiencoder_ladder.h"
+#include "gstvaapiencoder_lookahead.h"
+#include "gstvaapiencoder_priv.h"
+#include "gstvaapifilter.h"
+#include "gstvaapisurfaceproxy.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+typedef struct
+{
+  GstVaapiEncoder *encoder;
+  guint width;
+  guint height;
+  gboolean scaled;
+} Rendition;
+
+struct _GstVaapiEncoderLadder
+{
+  GstVaapiDisplay *display;
+  GstVaapiFilter *filter;
+  GstVaapiEncoderLookahead *lookahead;
+  GArray *renditions;
+  guint keyframe_period;
+  guint lookahead_depth;
+  gboolean configured;
+};
+
+static void
+rendition_clear (Rendition * rendition)
+{
+  gst_object_replace ((GstObject **) & rendition->encoder, NULL);
+}
+
+static inline Rendition *
+get_rendition (GstVaapiEncoderLadder * ladder, guint index)
+{
+  return &g_array_index (ladder->renditions, Rendition, index);
+}
+
+/* Creates the frame submitted to one rendition encoder: it carries the
+   timing and flags of the source @src_frame, and the scaled @proxy */
+static GstVideoCodecFrame *
+rendition_frame_new (GstVideoCodecFrame * src_frame,
+    GstVaapiSurfaceProxy * proxy)
+{
+  GstVideoCodecFrame *frame;
+
+  frame = g_slice_new0 (GstVideoCodecFrame);
+  frame->ref_count = 1;
+  frame->flags = src_frame->flags;
+  frame->system_frame_number = src_frame->system_frame_number;
+  frame->decode_frame_number = src_frame->decode_frame_number;
+  frame->presentation_frame_number = src_frame->presentation_frame_number;
+  frame->dts = src_frame->dts;
+  frame->pts = src_frame->pts;
+  frame->duration = src_frame->duration;
+  frame->deadline = src_frame->deadline;
+
+  /* The encoder may look at the input buffer metas (e.g. ROI) */
+  if (src_frame->input_buffer)
+    frame->input_buffer = gst_buffer_ref (src_frame->input_buffer);
+
+  gst_video_codec_frame_set_user_data (frame, proxy,
+      (GDestroyNotify) gst_vaapi_surface_proxy_unref);
+  return frame;
+}
+
+/* Submits @frame to every rendition encoder. The scaled surfaces are
+   all produced by one VPP call, before any encoder gets its frame */
+static GstVaapiEncoderStatus
+dispatch_frame (GstVaapiEncoderLadder * ladder, GstVideoCodecFrame * frame)
+{
+  GstVaapiSurfaceProxy *const src_proxy = gst_video_codec_frame_get_user_data
+      (frame);
+  const guint num_renditions = ladder->renditions->len;
+  GstVaapiSurfaceProxy **proxies;
+  GstVaapiSurface **surfaces;
+  GstVaapiEncoderStatus status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  GstVaapiFilterStatus filter_status;
+  guint i, num_surfaces = 0;
+
+  if (!src_proxy)
+    return GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_SURFACE;
+
+  proxies = g_newa (GstVaapiSurfaceProxy *, num_renditions);
+  surfaces = g_newa (GstVaapiSurface *, num_renditions);
+  for (i = 0; i < num_renditions; i++) {
+    Rendition *const rendition = get_rendition (ladder, i);
+
+    if (!rendition->scaled) {
+      proxies[i] = gst_vaapi_surface_proxy_ref (src_proxy);
+      continue;
+    }
+
+    proxies[i] = gst_vaapi_encoder_create_input_surface (rendition->encoder);
+    if (!proxies[i])
+      goto error_create_surface;
+    surfaces[num_surfaces++] = GST_VAAPI_SURFACE_PROXY_SURFACE (proxies[i]);
+  }
+
+  if (num_surfaces > 0) {
+    filter_status = gst_vaapi_filter_process_multi (ladder->filter,
+        GST_VAAPI_SURFACE_PROXY_SURFACE (src_proxy), surfaces, num_surfaces,
+        0);
+    if (filter_status != GST_VAAPI_FILTER_STATUS_SUCCESS)
+      goto error_process;
+  }
+
+  for (i = 0; i < num_renditions; i++) {
+    GstVideoCodecFrame *rendition_frame;
+
+    /* The frame takes over the proxy */
+    rendition_frame = rendition_frame_new (frame, proxies[i]);
+    proxies[i] = NULL;
+    if (status == GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      status = gst_vaapi_encoder_put_frame (get_rendition (ladder, i)->encoder,
+          rendition_frame);
+    gst_video_codec_frame_unref (rendition_frame);
+  }
+  return status;
+
+  /* ERRORS */
+error_create_surface:
+  {
+    GST_ERROR ("failed to allocate a %ux%u surface",
+        get_rendition (ladder, i)->width, get_rendition (ladder, i)->height);
+    while (i-- > 0)
+      gst_vaapi_surface_proxy_unref (proxies[i]);
+    return GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED;
+  }
+error_process:
+  {
+    GST_ERROR ("failed to scale frame (status = %d)", filter_status);
+    for (i = 0; i < num_renditions; i++)
+      gst_vaapi_surface_proxy_unref (proxies[i]);
+    return GST_VAAPI_ENCODER_STATUS_ERROR_UNKNOWN;
+  }
+}
+
+/* Dispatches the frames leaving the shared lookahead queue */
+static GstVaapiEncoderStatus
+dispatch_lookahead_frames (GstVaapiEncoderLadder * ladder, gboolean drain)
+{
+  GstVaapiEncoderStatus status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  GstVideoCodecFrame *frame;
+
+  while ((frame = gst_vaapi_encoder_lookahead_pop (ladder->lookahead, drain))) {
+    status = dispatch_frame (ladder, frame);
+    gst_video_codec_frame_unref (frame);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      break;
+  }
+  return status;
+}
+
+/**
+ * gst_vaapi_encoder_ladder_new:
+ * @display: a #GstVaapiDisplay
+ *
+ * Creates a new, empty, encoding ladder. The rendition encoders added
+ * afterwards shall all be bound to @display.
+ *
+ * Return value: the newly allocated #GstVaapiEncoderLadder
+ */
+GstVaapiEncoderLadder *
+gst_vaapi_encoder_ladder_new (GstVaapiDisplay * display)
+{
+  GstVaapiEncoderLadder *ladder;
+
+  g_return_val_if_fail (display != NULL, NULL);
+
+  ladder = g_slice_new0 (GstVaapiEncoderLadder);
+  ladder->display = gst_object_ref (display);
+  ladder->renditions = g_array_new (FALSE, TRUE, sizeof (Rendition));
+  g_array_set_clear_func (ladder->renditions,
+      (GDestroyNotify) rendition_clear);
+  return ladder;
+}
+
+/**
+ * gst_vaapi_encoder_ladder_free:
+ * @ladder: a #GstVaapiEncoderLadder
+ *
+ * Releases @ladder and the references it holds to the rendition
+ * encoders. Any frame still held for scene change detection is
+ * dropped, so gst_vaapi_encoder_ladder_flush() shall be called first
+ * at end of stream.
+ */
+void
+gst_vaapi_encoder_ladder_free (GstVaapiEncoderLadder * ladder)
+{
+  g_return_if_fail (ladder != NULL);
+
+  if (ladder->lookahead)
+    gst_vaapi_encoder_lookahead_free (ladder->lookahead);
+  g_array_unref (ladder->renditions);
+  gst_vaapi_filter_replace (&ladder->filter, NULL);
+  gst_vaapi_display_replace (&ladder->display, NULL);
+  g_slice_free (GstVaapiEncoderLadder, ladder);
+}
+
+/**
+ * gst_vaapi_encoder_ladder_add_rendition:
+ * @ladder: a #GstVaapiEncoderLadder
+ * @encoder: a #GstVaapiEncoder, not configured yet
+ * @width: the rendition width, in pixels
+ * @height: the rendition height, in pixels
+ *
+ * Adds a rendition of @width x @height pixels, encoded by @encoder.
+ * The ladder holds a reference to @encoder, and takes over its
+ * keyframe period and scene change detection settings. Renditions
+ * can only be added before gst_vaapi_encoder_ladder_set_codec_state()
+ * is called.
+ *
+ * Return value: the index of the new rendition, or -1 on error
+ */
+gint
+gst_vaapi_encoder_ladder_add_rendition (GstVaapiEncoderLadder * ladder,
+    GstVaapiEncoder * encoder, guint width, guint height)
+{
+  Rendition rendition = { NULL, };
+
+  g_return_val_if_fail (ladder != NULL, -1);
+  g_return_val_if_fail (GST_VAAPI_IS_ENCODER (encoder), -1);
+  g_return_val_if_fail (width > 0 && height > 0, -1);
+
+  if (ladder->configured)
+    goto error_configured;
+  if (GST_VAAPI_ENCODER_DISPLAY (encoder) != ladder->display)
+    goto error_display;
+
+  /* Scene cuts are detected once for all renditions */
+  if (gst_vaapi_encoder_set_lookahead (encoder, 0)
+      != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    goto error_configured;
+
+  rendition.encoder = gst_object_ref (encoder);
+  rendition.width = GST_ROUND_UP_2 (width);
+  rendition.height = GST_ROUND_UP_2 (height);
+  g_array_append_val (ladder->renditions, rendition);
+  return ladder->renditions->len - 1;
+
+  /* ERRORS */
+error_configured:
+  {
+    GST_ERROR ("could not add rendition after encoding started");
+    return -1;
+  }
+error_display:
+  {
+    GST_ERROR ("rendition encoder is bound to another display");
+    return -1;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_ladder_get_num_renditions:
+ * @ladder: a #GstVaapiEncoderLadder
+ *
+ * Return value: the number of renditions in @ladder
+ */
+guint
+gst_vaapi_encoder_ladder_get_num_renditions (GstVaapiEncoderLadder * ladder)
+{
+  g_return_val_if_fail (ladder != NULL, 0);
+
+  return ladder->renditions->len;
+}
+
+/**
+ * gst_vaapi_encoder_ladder_get_encoder:
+ * @ladder: a #GstVaapiEncoderLadder
+ * @index: the rendition index
+ *
+ * Returns the encoder of the rendition at @index. The coded buffers
+ * of each rendition are retrieved from that encoder, with
+ * gst_vaapi_encoder_get_buffer_with_timeout().
+ *
+ * Return value: (transfer none): the #GstVaapiEncoder of the rendition
+ */
+GstVaapiEncoder *
+gst_vaapi_encoder_ladder_get_encoder (GstVaapiEncoderLadder * ladder,
+    guint index)
+{
+  g_return_val_if_fail (ladder != NULL, NULL);
+  g_return_val_if_fail (index < ladder->renditions->len, NULL);
+
+  return get_rendition (ladder, index)->encoder;
+}
+
+/**
+ * gst_vaapi_encoder_ladder_set_keyframe_period:
+ * @ladder: a #GstVaapiEncoderLadder
+ * @keyframe_period: the maximal distance between two keyframes, or 0
+ *   to keep the encoder defaults
+ *
+ * Sets the keyframe period applied to all renditions, so that their
+ * IDR frames are aligned. It takes effect on the next call to
+ * gst_vaapi_encoder_ladder_set_codec_state().
+ */
+void
+gst_vaapi_encoder_ladder_set_keyframe_period (GstVaapiEncoderLadder * ladder,
+    guint keyframe_period)
+{
+  g_return_if_fail (ladder != NULL);
+
+  ladder->keyframe_period = keyframe_period;
+}
+
+/**
+ * gst_vaapi_encoder_ladder_set_lookahead:
+ * @ladder: a #GstVaapiEncoderLadder
+ * @depth: the number of frames to look ahead, or 0 to disable
+ *
+ * Enables scene change detection on the source frames, with the same
+ * semantics as gst_vaapi_encoder_set_lookahead(). Detected cuts are
+ * forced as keyframes on all renditions. It can only be changed
+ * before gst_vaapi_encoder_ladder_set_codec_state() is called.
+ */
+void
+gst_vaapi_encoder_ladder_set_lookahead (GstVaapiEncoderLadder * ladder,
+    guint depth)
+{
+  g_return_if_fail (ladder != NULL);
+  g_return_if_fail (!ladder->configured);
+
+  ladder->lookahead_depth = depth;
+}
+
+static gboolean
+ensure_filter (GstVaapiEncoderLadder * ladder, GstVideoFormat format)
+{
+  if (!ladder->filter) {
+    ladder->filter = gst_vaapi_filter_new (ladder->display);
+    if (!ladder->filter)
+      return FALSE;
+  }
+  return gst_vaapi_filter_set_format (ladder->filter, format);
+}
+
+static void
+ensure_lookahead (GstVaapiEncoderLadder * ladder)
+{
+  if (ladder->lookahead || ladder->lookahead_depth == 0)
+    return;
+
+  ladder->lookahead = gst_vaapi_encoder_lookahead_new (ladder->display,
+      ladder->lookahead_depth);
+  if (!ladder->lookahead) {
+    GST_WARNING ("scene change detection is not available");
+    ladder->lookahead_depth = 0;
+  }
+}
+
+static GstVaapiEncoderStatus
+configure_rendition (GstVaapiEncoderLadder * ladder, Rendition * rendition,
+    GstVideoCodecState * src_state)
+{
+  const GstVideoInfo *const src_vip = &src_state->info;
+  GstVideoCodecState state = { 0, };
+  GstVideoInfo *const vip = &state.info;
+  GstVaapiEncoderStatus status;
+
+  if (ladder->keyframe_period > 0) {
+    status = gst_vaapi_encoder_set_keyframe_period (rendition->encoder,
+        ladder->keyframe_period);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      return status;
+  }
+
+  rendition->scaled = rendition->width != GST_VIDEO_INFO_WIDTH (src_vip) ||
+      rendition->height != GST_VIDEO_INFO_HEIGHT (src_vip);
+  if (!rendition->scaled)
+    return gst_vaapi_encoder_set_codec_state (rendition->encoder, src_state);
+
+  /* Only the video info is looked at by the encoder */
+  state.ref_count = 1;
+  gst_video_info_set_interlaced_format (vip, GST_VIDEO_INFO_FORMAT (src_vip),
+      GST_VIDEO_INFO_INTERLACE_MODE (src_vip), rendition->width,
+      rendition->height);
+  GST_VIDEO_INFO_FPS_N (vip) = GST_VIDEO_INFO_FPS_N (src_vip);
+  GST_VIDEO_INFO_FPS_D (vip) = GST_VIDEO_INFO_FPS_D (src_vip);
+  GST_VIDEO_INFO_PAR_N (vip) = GST_VIDEO_INFO_PAR_N (src_vip);
+  GST_VIDEO_INFO_PAR_D (vip) = GST_VIDEO_INFO_PAR_D (src_vip);
+  GST_VIDEO_INFO_COLORIMETRY (vip) = GST_VIDEO_INFO_COLORIMETRY (src_vip);
+  GST_VIDEO_INFO_CHROMA_SITE (vip) = GST_VIDEO_INFO_CHROMA_SITE (src_vip);
+
+  return gst_vaapi_encoder_set_codec_state (rendition->encoder, &state);
+}
+
+/**
+ * gst_vaapi_encoder_ladder_set_codec_state:
+ * @ladder: a #GstVaapiEncoderLadder
+ * @state: a #GstVideoCodecState describing the source frames
+ *
+ * Configures every rendition encoder for @state, scaled to the
+ * rendition size. The source pixel aspect ratio is kept, so the
+ * rendition sizes shall preserve the source display aspect ratio.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_ladder_set_codec_state (GstVaapiEncoderLadder * ladder,
+    GstVideoCodecState * state)
+{
+  GstVaapiEncoderStatus status;
+  gboolean needs_filter = FALSE;
+  guint i;
+
+  g_return_val_if_fail (ladder != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (state != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  if (ladder->renditions->len == 0)
+    goto error_no_rendition;
+
+  for (i = 0; i < ladder->renditions->len; i++) {
+    Rendition *const rendition = get_rendition (ladder, i);
+
+    status = configure_rendition (ladder, rendition, state);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_configure;
+    needs_filter |= rendition->scaled;
+  }
+
+  if (needs_filter
+      && !ensure_filter (ladder, GST_VIDEO_INFO_FORMAT (&state->info)))
+    goto error_filter;
+
+  ensure_lookahead (ladder);
+  ladder->configured = TRUE;
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+
+  /* ERRORS */
+error_no_rendition:
+  {
+    GST_ERROR ("no rendition to encode");
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  }
+error_configure:
+  {
+    GST_ERROR ("failed to configure rendition %u (%ux%u)", i,
+        get_rendition (ladder, i)->width, get_rendition (ladder, i)->height);
+    return status;
+  }
+error_filter:
+  {
+    GST_ERROR ("failed to set up VPP scaling to %s",
+        gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (&state->info)));
+    return GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_ladder_put_frame:
+ * @ladder: a #GstVaapiEncoderLadder
+ * @frame: a #GstVideoCodecFrame holding the source #GstVaapiSurfaceProxy
+ *
+ * Scales @frame for every rendition and queues the result to the
+ * rendition encoders. A forced keyframe on @frame is forced on all
+ * renditions. The @frame itself is not queued to any encoder, so the
+ * coded buffers of each rendition refer to their own frames, with the
+ * same system frame number and timestamps as @frame.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_ladder_put_frame (GstVaapiEncoderLadder * ladder,
+    GstVideoCodecFrame * frame)
+{
+  g_return_val_if_fail (ladder != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (frame != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (ladder->configured,
+      GST_VAAPI_ENCODER_STATUS_ERROR_OPERATION_FAILED);
+
+  if (ladder->lookahead) {
+    gst_vaapi_encoder_lookahead_push (ladder->lookahead, frame, NULL);
+    return dispatch_lookahead_frames (ladder, FALSE);
+  }
+  return dispatch_frame (ladder, frame);
+}
+
+/**
+ * gst_vaapi_encoder_ladder_flush:
+ * @ladder: a #GstVaapiEncoderLadder
+ *
+ * Submits any frame held for scene change detection, then flushes all
+ * rendition encoders.
+ *
+ * Return value: a #GstVaapiEncoderStatus
+ */
+GstVaapiEncoderStatus
+gst_vaapi_encoder_ladder_flush (GstVaapiEncoderLadder * ladder)
+{
+  GstVaapiEncoderStatus status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  guint i;
+
+  g_return_val_if_fail (ladder != NULL,
+      GST_VAAPI_ENCODER_STATUS_ERROR_INVALID_PARAMETER);
+
+  if (ladder->lookahead) {
+    status = dispatch_lookahead_frames (ladder, TRUE);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      return status;
+  }
+
+  for (i = 0; i < ladder->renditions->len; i++) {
+    status = gst_vaapi_encoder_flush (get_rendition (ladder, i)->encoder);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      break;
+  }
+  return status;
+}
@@ -0,0 +1,67 @@
+/*
+ *  gstvaapiencoder_ladder.h - Multi-resolution encoding from a single source
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_ENCODER_LADDER_H
+#define GST_VAAPI_ENCODER_LADDER_H
+
+#include <gst/vaapi/gstvaapiencoder.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstVaapiEncoderLadder GstVaapiEncoderLadder;
+
+GstVaapiEncoderLadder *
+gst_vaapi_encoder_ladder_new (GstVaapiDisplay * display);
+
+void
+gst_vaapi_encoder_ladder_free (GstVaapiEncoderLadder * ladder);
+
+gint
+gst_vaapi_encoder_ladder_add_rendition (GstVaapiEncoderLadder * ladder,
+    GstVaapiEncoder * encoder, guint width, guint height);
+
+guint
+gst_vaapi_encoder_ladder_get_num_renditions (GstVaapiEncoderLadder * ladder);
+
+GstVaapiEncoder *
+gst_vaapi_encoder_ladder_get_encoder (GstVaapiEncoderLadder * ladder,
+    guint index);
+
+void
+gst_vaapi_encoder_ladder_set_keyframe_period (GstVaapiEncoderLadder * ladder,
+    guint keyframe_period);
+
+void
+gst_vaapi_encoder_ladder_set_lookahead (GstVaapiEncoderLadder * ladder,
+    guint depth);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_ladder_set_codec_state (GstVaapiEncoderLadder * ladder,
+    GstVideoCodecState * state);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_ladder_put_frame (GstVaapiEncoderLadder * ladder,
+    GstVideoCodecFrame * frame);
+
+GstVaapiEncoderStatus
+gst_vaapi_encoder_ladder_flush (GstVaapiEncoderLadder * ladder);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_ENCODER_LADDER_H */
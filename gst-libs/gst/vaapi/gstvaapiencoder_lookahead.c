@@ -0,0 +1,477 @@
+/*
+ *  gstvaapiencoder_lookahead.c - Scene change detection for encoders
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "sysdeps.h"
+#include "gstvaapiencoder_lookahead.h"
+#include "gstvaapifilter.h"
+#include "gstvaapiimage.h"
+#include "gstvaapisurface.h"
+#include "gstvaapisurfaceproxy.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+#include <math.h>
+
+/* Size of the luma thumbnails the frames are compared on */
+#define THUMB_WIDTH     64
+#define THUMB_HEIGHT    64
+#define THUMB_SIZE      (THUMB_WIDTH * THUMB_HEIGHT)
+
+#define HIST_BINS       32
+
+/* A cut needs both a large mean absolute difference (out of 255) and a
+   large histogram change (in percent), so that camera motion over a
+   similar scene, or a fade, is not taken for a cut */
+#define CUT_SAD_THRESHOLD       24
+#define CUT_HIST_THRESHOLD      30
+
+/* Minimal distance between two detected cuts, in frames */
+#define CUT_MIN_DISTANCE        8
+
+/* Largest QP change suggested from the frame complexity. The scale
+   follows the usual qcomp = 0.6 curve: 6 * (1 - 0.6) QP per doubling
+   of the complexity against the frames around */
+#define COMPLEXITY_MAX_QP_DELTA 3
+#define COMPLEXITY_QP_SCALE     2.4
+
+typedef struct
+{
+  guint8 luma[THUMB_SIZE];
+  guint hist[HIST_BINS];
+} Thumbnail;
+
+typedef struct
+{
+  GstVideoCodecFrame *frame;
+  Thumbnail thumb;
+  gboolean valid;
+  /* mean absolute difference to the previous frame, in 1/16 luma
+     levels, if has_complexity is set */
+  guint complexity;
+  gboolean has_complexity;
+} LookaheadEntry;
+
+/*
+ * GstVaapiEncoderLookahead:
+ *
+ * Delays the frames submitted to the encoder by @depth frames and
+ * flags scene cuts as forced keyframes. Frames are compared on small
+ * luma thumbnails produced through VPP. A cut is only reported when
+ * the frames queued after it do not return to the previous scene, so
+ * that flashes do not trigger a keyframe.
+ *
+ * The temporal complexity of each frame is measured on the same
+ * thumbnails, so that the software rate control can spend fewer bits
+ * on the frames that are expensive compared to their neighbours.
+ */
+struct _GstVaapiEncoderLookahead
+{
+  GstVaapiDisplay *display;
+  GstVaapiFilter *filter;
+  GstVaapiSurface *surface;
+  GstVaapiImage *image;
+  guint depth;
+
+  GQueue entries;
+  Thumbnail last_thumb;
+  gboolean has_last_thumb;
+  guint frames_since_cut;
+
+  Thumbnail push_thumb;
+  gboolean has_push_thumb;
+  gint qp_delta;
+  guint complexity;
+  gboolean has_complexity;
+};
+
+static void
+lookahead_entry_free (LookaheadEntry * entry)
+{
+  if (entry->frame)
+    gst_video_codec_frame_unref (entry->frame);
+  g_slice_free (LookaheadEntry, entry);
+}
+
+/* Downscales the frame surface and reads back its luma plane */
+static gboolean
+make_thumbnail (GstVaapiEncoderLookahead * lookahead,
+    GstVideoCodecFrame * frame, Thumbnail * thumb)
+{
+  GstVaapiSurfaceProxy *const proxy = gst_video_codec_frame_get_user_data
+      (frame);
+  const guchar *plane;
+  guint x, y, pitch;
+
+  if (!proxy)
+    return FALSE;
+
+  if (gst_vaapi_filter_process (lookahead->filter,
+          GST_VAAPI_SURFACE_PROXY_SURFACE (proxy), lookahead->surface, 0)
+      != GST_VAAPI_FILTER_STATUS_SUCCESS)
+    return FALSE;
+  if (!gst_vaapi_surface_get_image (lookahead->surface, lookahead->image))
+    return FALSE;
+  if (!gst_vaapi_image_map (lookahead->image))
+    return FALSE;
+
+  plane = gst_vaapi_image_get_plane (lookahead->image, 0);
+  pitch = gst_vaapi_image_get_pitch (lookahead->image, 0);
+  memset (thumb->hist, 0, sizeof (thumb->hist));
+  for (y = 0; y < THUMB_HEIGHT; y++) {
+    for (x = 0; x < THUMB_WIDTH; x++) {
+      const guint8 v = plane[y * pitch + x];
+      thumb->luma[y * THUMB_WIDTH + x] = v;
+      thumb->hist[v * HIST_BINS / 256]++;
+    }
+  }
+
+  gst_vaapi_image_unmap (lookahead->image);
+  return TRUE;
+}
+
+static guint
+thumbnail_sad (const Thumbnail * a, const Thumbnail * b)
+{
+  guint i, sad = 0;
+
+  for (i = 0; i < THUMB_SIZE; i++)
+    sad += ABS ((gint) a->luma[i] - (gint) b->luma[i]);
+  return sad;
+}
+
+static gboolean
+is_scene_cut (const Thumbnail * a, const Thumbnail * b)
+{
+  guint i, hist_diff = 0;
+
+  if (thumbnail_sad (a, b) < CUT_SAD_THRESHOLD * THUMB_SIZE)
+    return FALSE;
+
+  for (i = 0; i < HIST_BINS; i++)
+    hist_diff += ABS ((gint) a->hist[i] - (gint) b->hist[i]);
+  /* hist_diff ranges from 0 to 2 * THUMB_SIZE */
+  return hist_diff * 50 >= CUT_HIST_THRESHOLD * THUMB_SIZE;
+}
+
+/* Checks whether @entry, first in the queue, starts a new scene */
+static gboolean
+check_scene_cut (GstVaapiEncoderLookahead * lookahead, LookaheadEntry * entry)
+{
+  GList *l;
+
+  if (!entry->valid || !lookahead->has_last_thumb)
+    return FALSE;
+  if (lookahead->frames_since_cut < CUT_MIN_DISTANCE)
+    return FALSE;
+  if (!is_scene_cut (&lookahead->last_thumb, &entry->thumb))
+    return FALSE;
+
+  /* Flash rejection: the following frames must differ too */
+  for (l = lookahead->entries.head; l != NULL; l = l->next) {
+    LookaheadEntry *const next = l->data;
+    if (next->valid && !is_scene_cut (&lookahead->last_thumb, &next->thumb))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Suggests a QP change for @entry, first in the queue, from its
+ * complexity against the average over the lookahead window */
+static gint
+get_qp_delta (GstVaapiEncoderLookahead * lookahead, LookaheadEntry * entry)
+{
+  guint64 sum;
+  guint n;
+  GList *l;
+  gdouble delta;
+
+  if (!entry->has_complexity)
+    return 0;
+
+  sum = entry->complexity;
+  n = 1;
+  for (l = lookahead->entries.head; l != NULL; l = l->next) {
+    LookaheadEntry *const next = l->data;
+    if (next->has_complexity) {
+      sum += next->complexity;
+      n++;
+    }
+  }
+  if (n < 2)
+    return 0;
+
+  /* The offset keeps static content from producing huge ratios */
+  delta = COMPLEXITY_QP_SCALE * log2 ((entry->complexity + 16.0) /
+      ((gdouble) sum / n + 16.0));
+  return CLAMP ((gint) lround (delta), -COMPLEXITY_MAX_QP_DELTA,
+      COMPLEXITY_MAX_QP_DELTA);
+}
+
+/**
+ * gst_vaapi_encoder_lookahead_new:
+ * @display: a #GstVaapiDisplay
+ * @depth: the number of frames to look ahead
+ *
+ * Creates a new scene change detector holding up to @depth frames.
+ *
+ * Return value: the newly allocated #GstVaapiEncoderLookahead, or
+ *   %NULL if VPP is not available
+ */
+GstVaapiEncoderLookahead *
+gst_vaapi_encoder_lookahead_new (GstVaapiDisplay * display, guint depth)
+{
+  GstVaapiEncoderLookahead *lookahead;
+
+  g_return_val_if_fail (display != NULL, NULL);
+  g_return_val_if_fail (depth > 0, NULL);
+
+  lookahead = g_slice_new0 (GstVaapiEncoderLookahead);
+  lookahead->display = gst_object_ref (display);
+  lookahead->depth = depth;
+  lookahead->frames_since_cut = CUT_MIN_DISTANCE;
+  g_queue_init (&lookahead->entries);
+
+  lookahead->filter = gst_vaapi_filter_new (display);
+  if (!lookahead->filter)
+    goto error;
+  if (!gst_vaapi_filter_set_format (lookahead->filter, GST_VIDEO_FORMAT_NV12))
+    goto error;
+
+  lookahead->surface = gst_vaapi_surface_new (display,
+      GST_VAAPI_CHROMA_TYPE_YUV420, THUMB_WIDTH, THUMB_HEIGHT);
+  if (!lookahead->surface)
+    goto error;
+  lookahead->image = gst_vaapi_image_new (display, GST_VIDEO_FORMAT_NV12,
+      THUMB_WIDTH, THUMB_HEIGHT);
+  if (!lookahead->image)
+    goto error;
+  return lookahead;
+
+  /* ERRORS */
+error:
+  {
+    GST_WARNING ("failed to set up scene change detection");
+    gst_vaapi_encoder_lookahead_free (lookahead);
+    return NULL;
+  }
+}
+
+/**
+ * gst_vaapi_encoder_lookahead_free:
+ * @lookahead: a #GstVaapiEncoderLookahead
+ *
+ * Releases @lookahead, together with any frame that is still queued.
+ */
+void
+gst_vaapi_encoder_lookahead_free (GstVaapiEncoderLookahead * lookahead)
+{
+  g_return_if_fail (lookahead != NULL);
+
+  g_queue_foreach (&lookahead->entries, (GFunc) lookahead_entry_free, NULL);
+  g_queue_clear (&lookahead->entries);
+
+  if (lookahead->image)
+    gst_vaapi_image_unref (lookahead->image);
+  if (lookahead->surface)
+    gst_vaapi_surface_unref (lookahead->surface);
+  gst_vaapi_filter_replace (&lookahead->filter, NULL);
+  gst_vaapi_display_replace (&lookahead->display, NULL);
+  g_slice_free (GstVaapiEncoderLookahead, lookahead);
+}
+
+/* Estimates the complexity of an inter frame from the cost of its
+   source picture, as bits per macroblock at QP 26 */
+static guint
+get_hints_complexity (GstVideoCodecFrame * frame,
+    const GstVaapiCodingHints * hints)
+{
+  GstVaapiSurfaceProxy *const proxy = gst_video_codec_frame_get_user_data
+      (frame);
+  GstVaapiSurface *surface;
+  gdouble bits;
+  guint mbs;
+
+  surface = proxy ? GST_VAAPI_SURFACE_PROXY_SURFACE (proxy) : NULL;
+  if (!surface)
+    return 0;
+  mbs = ((gst_vaapi_surface_get_width (surface) + 15) / 16) *
+      ((gst_vaapi_surface_get_height (surface) + 15) / 16);
+  if (mbs == 0)
+    return 0;
+
+  /* Picture sizes roughly halve for every 6 QP steps */
+  bits = hints->coded_size * 8.0 / mbs;
+  if (hints->has_qp)
+    bits *= pow (2.0, ((gint) hints->qp - 26) / 6.0);
+  return MIN (bits, G_MAXUINT);
+}
+
+/**
+ * gst_vaapi_encoder_lookahead_push:
+ * @lookahead: a #GstVaapiEncoderLookahead
+ * @frame: a #GstVideoCodecFrame holding a #GstVaapiSurfaceProxy
+ * @hints: (allow-none): how @frame was coded in its source, if known
+ *
+ * Analyzes @frame and queues it. @lookahead holds an extra reference
+ * to @frame until it is popped. With @hints, the frame complexity is
+ * taken from its source picture rather than measured, and the scene
+ * cuts are those already flagged as forced keyframes, which saves
+ * the processing and readback of a thumbnail.
+ */
+void
+gst_vaapi_encoder_lookahead_push (GstVaapiEncoderLookahead * lookahead,
+    GstVideoCodecFrame * frame, const GstVaapiCodingHints * hints)
+{
+  LookaheadEntry *entry;
+
+  g_return_if_fail (lookahead != NULL);
+  g_return_if_fail (frame != NULL);
+
+  entry = g_slice_new (LookaheadEntry);
+  entry->frame = gst_video_codec_frame_ref (frame);
+
+  if (hints) {
+    /* Intra pictures are much larger and tell nothing about the
+       complexity of the scene */
+    entry->valid = FALSE;
+    entry->complexity = hints->is_intra ? 0 :
+        get_hints_complexity (frame, hints);
+    entry->has_complexity = entry->complexity > 0;
+    /* The next thumbnail has no previous frame to compare to */
+    lookahead->has_push_thumb = FALSE;
+    g_queue_push_tail (&lookahead->entries, entry);
+    return;
+  }
+
+  entry->valid = make_thumbnail (lookahead, frame, &entry->thumb);
+  entry->has_complexity = FALSE;
+  if (!entry->valid) {
+    GST_DEBUG ("no thumbnail for frame %u", frame->system_frame_number);
+  } else {
+    if (lookahead->has_push_thumb) {
+      entry->complexity = thumbnail_sad (&lookahead->push_thumb,
+          &entry->thumb) * 16 / THUMB_SIZE;
+      entry->has_complexity = TRUE;
+    }
+    lookahead->push_thumb = entry->thumb;
+    lookahead->has_push_thumb = TRUE;
+  }
+  g_queue_push_tail (&lookahead->entries, entry);
+}
+
+/**
+ * gst_vaapi_encoder_lookahead_pop:
+ * @lookahead: a #GstVaapiEncoderLookahead
+ * @drain: whether to return frames even if fewer than the lookahead
+ *   depth are queued
+ *
+ * Dequeues the oldest frame once enough following frames are known,
+ * or unconditionally if @drain is %TRUE. The frame is flagged as a
+ * forced keyframe if it starts a new scene.
+ *
+ * Return value: (transfer full): the next #GstVideoCodecFrame, or
+ *   %NULL if none is ready
+ */
+GstVideoCodecFrame *
+gst_vaapi_encoder_lookahead_pop (GstVaapiEncoderLookahead * lookahead,
+    gboolean drain)
+{
+  LookaheadEntry *entry;
+  GstVideoCodecFrame *frame;
+
+  g_return_val_if_fail (lookahead != NULL, NULL);
+
+  if (g_queue_is_empty (&lookahead->entries))
+    return NULL;
+  if (!drain && g_queue_get_length (&lookahead->entries) <= lookahead->depth)
+    return NULL;
+
+  entry = g_queue_pop_head (&lookahead->entries);
+  frame = entry->frame;
+  entry->frame = NULL;
+
+  lookahead->qp_delta = 0;
+  if (check_scene_cut (lookahead, entry)) {
+    GST_DEBUG ("scene cut at frame %u", frame->system_frame_number);
+    GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
+    lookahead->frames_since_cut = 0;
+  } else if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)) {
+    lookahead->frames_since_cut = 0;
+  } else {
+    /* The difference to the previous scene says nothing about the
+       cost of a keyframe, only inter frames are adjusted */
+    lookahead->qp_delta = get_qp_delta (lookahead, entry);
+  }
+  lookahead->frames_since_cut++;
+  lookahead->complexity = entry->complexity;
+  lookahead->has_complexity = entry->has_complexity;
+
+  if (entry->valid) {
+    lookahead->last_thumb = entry->thumb;
+    lookahead->has_last_thumb = TRUE;
+  }
+  lookahead_entry_free (entry);
+  return frame;
+}
+
+/**
+ * gst_vaapi_encoder_lookahead_get_qp_delta:
+ * @lookahead: a #GstVaapiEncoderLookahead
+ *
+ * Returns the QP change suggested for the frame last returned by
+ * gst_vaapi_encoder_lookahead_pop(): positive if that frame is more
+ * complex than the frames around it, negative if it is simpler.
+ *
+ * Return value: the QP delta, within +/-3
+ */
+gint
+gst_vaapi_encoder_lookahead_get_qp_delta (GstVaapiEncoderLookahead *
+    lookahead)
+{
+  g_return_val_if_fail (lookahead != NULL, 0);
+
+  return lookahead->qp_delta;
+}
+
+/**
+ * gst_vaapi_encoder_lookahead_get_complexity:
+ * @lookahead: a #GstVaapiEncoderLookahead
+ * @complexity: (out): the mean absolute luma difference, in 1/16
+ *   levels
+ *
+ * Gets the temporal complexity of the frame last returned by
+ * gst_vaapi_encoder_lookahead_pop(), i.e. its difference to the frame
+ * before it. High values mean fast motion, where bidirectional
+ * prediction brings little.
+ *
+ * Return value: %TRUE if the complexity of that frame is known
+ */
+gboolean
+gst_vaapi_encoder_lookahead_get_complexity (GstVaapiEncoderLookahead *
+    lookahead, guint * complexity)
+{
+  g_return_val_if_fail (lookahead != NULL, FALSE);
+  g_return_val_if_fail (complexity != NULL, FALSE);
+
+  if (!lookahead->has_complexity)
+    return FALSE;
+  *complexity = lookahead->complexity;
+  return TRUE;
+}
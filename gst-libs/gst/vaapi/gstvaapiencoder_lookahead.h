@@ -0,0 +1,61 @@
+/*
+ *  gstvaapiencoder_lookahead.h - Scene change detection for encoders
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_ENCODER_LOOKAHEAD_H
+#define GST_VAAPI_ENCODER_LOOKAHEAD_H
+
+#include <gst/vaapi/gstvaapidisplay.h>
+#include <gst/vaapi/gstvaapisurfaceproxy.h>
+#include <gst/video/gstvideoutils.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstVaapiEncoderLookahead GstVaapiEncoderLookahead;
+
+G_GNUC_INTERNAL
+GstVaapiEncoderLookahead *
+gst_vaapi_encoder_lookahead_new (GstVaapiDisplay * display, guint depth);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_encoder_lookahead_free (GstVaapiEncoderLookahead * lookahead);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_encoder_lookahead_push (GstVaapiEncoderLookahead * lookahead,
+    GstVideoCodecFrame * frame, const GstVaapiCodingHints * hints);
+
+G_GNUC_INTERNAL
+GstVideoCodecFrame *
+gst_vaapi_encoder_lookahead_pop (GstVaapiEncoderLookahead * lookahead,
+    gboolean drain);
+
+G_GNUC_INTERNAL
+gint
+gst_vaapi_encoder_lookahead_get_qp_delta (GstVaapiEncoderLookahead *
+    lookahead);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_encoder_lookahead_get_complexity (GstVaapiEncoderLookahead *
+    lookahead, guint * complexity);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_ENCODER_LOOKAHEAD_H */
@@ -53,6 +53,11 @@
   (VA_ENC_PACKED_HEADER_SEQUENCE |              \
    VA_ENC_PACKED_HEADER_PICTURE)
 
+/* With adaptive B-frames, a frame differing from the previous one by
+   more than this mean absolute luma difference, in 1/16 levels, is
+   coded as a P-frame: the motion is too fast for B-frames to pay off */
+#define ADAPTIVE_BFRAMES_MAX_COMPLEXITY (10 * 16)
+
 static gboolean
 gst_bit_writer_write_sps (GstBitWriter * bitwriter,
     const VAEncSequenceParameterBufferMPEG2 * seq_param);
@@ -488,16 +493,31 @@ set_misc_parameters (GstVaapiEncoderMpeg2 * encoder,
   return TRUE;
 }
 
+/* Applies the QP delta of @picture, in H.264 units where 6 steps
+ * double the quantizer, to the linear MPEG-2 quantizer scale */
+static guint
+get_quantiser_scale_code (GstVaapiEncoderMpeg2 * encoder,
+    GstVaapiEncPicture * picture)
+{
+  gdouble scale = encoder->cqp;
+
+  if (picture->qp_delta != 0)
+    scale *= pow (2.0, picture->qp_delta / 6.0);
+  return CLAMP ((gint) lround (scale / 2), 1, 31);
+}
+
 static gboolean
 fill_slices (GstVaapiEncoderMpeg2 * encoder, GstVaapiEncPicture * picture)
 {
   VAEncSliceParameterBufferMPEG2 *slice_param;
   GstVaapiEncSlice *slice;
   guint width_in_mbs, height_in_mbs;
-  guint i_slice;
+  guint i_slice, quantiser_scale_code;
 
   g_assert (picture);
 
+  quantiser_scale_code = get_quantiser_scale_code (encoder, picture);
+
   width_in_mbs = (GST_VAAPI_ENCODER_WIDTH (encoder) + 15) / 16;
   height_in_mbs = (GST_VAAPI_ENCODER_HEIGHT (encoder) + 15) / 16;
 
@@ -511,7 +531,7 @@ fill_slices (GstVaapiEncoderMpeg2 * encoder, GstVaapiEncPicture * picture)
     slice_param->macroblock_address = i_slice * width_in_mbs;
     slice_param->num_macroblocks = width_in_mbs;
     slice_param->is_intra_slice = (picture->type == GST_VAAPI_PICTURE_TYPE_I);
-    slice_param->quantiser_scale_code = encoder->cqp / 2;
+    slice_param->quantiser_scale_code = quantiser_scale_code;
 
     gst_vaapi_enc_picture_add_slice (picture, slice);
     gst_vaapi_codec_object_replace (&slice, NULL);
@@ -585,6 +605,7 @@ gst_vaapi_encoder_mpeg2_flush (GstVaapiEncoder * base_encoder)
     gst_vaapi_enc_picture_unref (pic);
   }
   g_queue_clear (&encoder->b_frames);
+  gst_vaapi_enc_picture_replace (&encoder->pending_key, NULL);
 
   return GST_VAAPI_ENCODER_STATUS_SUCCESS;
 }
@@ -597,6 +618,9 @@ gst_vaapi_encoder_mpeg2_reordering (GstVaapiEncoder * base_encoder,
       GST_VAAPI_ENCODER_MPEG2_CAST (base_encoder);
   GstVaapiEncPicture *picture = NULL;
   GstVaapiEncoderStatus status = GST_VAAPI_ENCODER_STATUS_SUCCESS;
+  gboolean has_stats;
+  guint complexity = 0;
+  gint qp_delta = 0;
 
   if (!frame) {
     if (g_queue_is_empty (&encoder->b_frames) && encoder->dump_frames) {
@@ -604,7 +628,13 @@ gst_vaapi_encoder_mpeg2_reordering (GstVaapiEncoder * base_encoder,
       encoder->dump_frames = FALSE;
     }
     if (!encoder->dump_frames) {
-      return GST_VAAPI_ENCODER_STATUS_NO_SURFACE;
+      if (!encoder->pending_key)
+        return GST_VAAPI_ENCODER_STATUS_NO_SURFACE;
+      /* the GOP is closed, the forced keyframe can start the next one */
+      picture = encoder->pending_key;
+      encoder->pending_key = NULL;
+      encoder->new_gop = TRUE;
+      goto end;
     }
     picture = g_queue_pop_head (&encoder->b_frames);
     g_assert (picture);
@@ -618,24 +648,48 @@ gst_vaapi_encoder_mpeg2_reordering (GstVaapiEncoder * base_encoder,
     return GST_VAAPI_ENCODER_STATUS_ERROR_ALLOCATION_FAILED;
   }
 
-  if (encoder->frame_num >= base_encoder->keyframe_period) {
+  has_stats = gst_vaapi_encoder_get_lookahead_stats (base_encoder,
+      &complexity, &qp_delta);
+  if (has_stats && encoder->adaptive_quantizer &&
+      GST_VAAPI_ENCODER_RATE_CONTROL (encoder) == GST_VAAPI_RATECONTROL_CQP)
+    picture->qp_delta = qp_delta;
+
+  if (encoder->frame_num >= base_encoder->keyframe_period
+      || GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)) {
     encoder->frame_num = 0;
-    clear_references (encoder);
+    if (g_queue_is_empty (&encoder->b_frames))
+      clear_references (encoder);
   }
   if (encoder->frame_num == 0) {
     picture->type = GST_VAAPI_PICTURE_TYPE_I;
     GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
-    encoder->new_gop = TRUE;
-  } else {
-    encoder->new_gop = FALSE;
-    if ((encoder->frame_num % (encoder->ip_period + 1)) == 0 ||
-        encoder->frame_num == base_encoder->keyframe_period - 1) {
+    picture->frame_num = encoder->frame_num++;
+
+    /* The pending B-frames need a following reference to be coded:
+       the last one becomes a P-frame closing the GOP, the keyframe
+       waits until they are all coded */
+    if (!g_queue_is_empty (&encoder->b_frames)) {
+      encoder->pending_key = picture;
+      picture = g_queue_pop_tail (&encoder->b_frames);
       picture->type = GST_VAAPI_PICTURE_TYPE_P;
+      encoder->new_gop = FALSE;
       encoder->dump_frames = TRUE;
-    } else {
-      picture->type = GST_VAAPI_PICTURE_TYPE_B;
-      status = GST_VAAPI_ENCODER_STATUS_NO_SURFACE;
+      goto end;
     }
+    encoder->new_gop = TRUE;
+    goto end;
+  }
+
+  encoder->new_gop = FALSE;
+  if (g_queue_get_length (&encoder->b_frames) >= encoder->ip_period ||
+      encoder->frame_num == base_encoder->keyframe_period - 1 ||
+      (encoder->adaptive_bframes && has_stats &&
+          complexity > ADAPTIVE_BFRAMES_MAX_COMPLEXITY)) {
+    picture->type = GST_VAAPI_PICTURE_TYPE_P;
+    encoder->dump_frames = TRUE;
+  } else {
+    picture->type = GST_VAAPI_PICTURE_TYPE_B;
+    status = GST_VAAPI_ENCODER_STATUS_NO_SURFACE;
   }
   picture->frame_num = encoder->frame_num++;
 
@@ -781,6 +835,7 @@ gst_vaapi_encoder_mpeg2_finalize (GObject * object)
     gst_vaapi_enc_picture_unref (pic);
   }
   g_queue_clear (&encoder->b_frames);
+  gst_vaapi_enc_picture_replace (&encoder->pending_key, NULL);
 
   G_OBJECT_CLASS (gst_vaapi_encoder_mpeg2_parent_class)->finalize (object);
 }
@@ -791,6 +846,10 @@ gst_vaapi_encoder_mpeg2_finalize (GObject * object)
  * @ENCODER_MPEG2_PROP_QUANTIZER: Constant quantizer value (uint).
  * @ENCODER_MPEG2_PROP_MAX_BFRAMES: Number of B-frames between I
  *   and P (uint).
+ * @ENCODER_MPEG2_PROP_ADAPTIVE_BFRAMES: Code fast motion frames as
+ *   P-frames (bool).
+ * @ENCODER_MPEG2_PROP_ADAPTIVE_QUANTIZER: Adapt the quantizer to the
+ *   frame complexity (bool).
  *
  * The set of MPEG-2 encoder specific configurable properties.
  */
@@ -800,6 +859,8 @@ enum
   ENCODER_MPEG2_PROP_TUNE,
   ENCODER_MPEG2_PROP_QUANTIZER,
   ENCODER_MPEG2_PROP_MAX_BFRAMES,
+  ENCODER_MPEG2_PROP_ADAPTIVE_BFRAMES,
+  ENCODER_MPEG2_PROP_ADAPTIVE_QUANTIZER,
   ENCODER_MPEG2_N_PROPERTIES
 };
 
@@ -832,6 +893,12 @@ gst_vaapi_encoder_mpeg2_set_property (GObject * object, guint prop_id,
     case ENCODER_MPEG2_PROP_MAX_BFRAMES:
       encoder->ip_period = g_value_get_uint (value);
       break;
+    case ENCODER_MPEG2_PROP_ADAPTIVE_BFRAMES:
+      encoder->adaptive_bframes = g_value_get_boolean (value);
+      break;
+    case ENCODER_MPEG2_PROP_ADAPTIVE_QUANTIZER:
+      encoder->adaptive_quantizer = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -857,6 +924,12 @@ gst_vaapi_encoder_mpeg2_get_property (GObject * object, guint prop_id,
     case ENCODER_MPEG2_PROP_MAX_BFRAMES:
       g_value_set_uint (value, encoder->ip_period);
       break;
+    case ENCODER_MPEG2_PROP_ADAPTIVE_BFRAMES:
+      g_value_set_boolean (value, encoder->adaptive_bframes);
+      break;
+    case ENCODER_MPEG2_PROP_ADAPTIVE_QUANTIZER:
+      g_value_set_boolean (value, encoder->adaptive_quantizer);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -920,6 +993,34 @@ gst_vaapi_encoder_mpeg2_class_init (GstVaapiEncoderMpeg2Class * klass)
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoderMpeg2:adaptive-bframes:
+   *
+   * Codes the frames with fast motion, as measured by
+   * #GstVaapiEncoder:lookahead, as P-frames instead of B-frames, so
+   * that #GstVaapiEncoderMpeg2:max-bframes becomes a maximum. Needs
+   * the lookahead.
+   */
+  properties[ENCODER_MPEG2_PROP_ADAPTIVE_BFRAMES] =
+      g_param_spec_boolean ("adaptive-bframes", "Adaptive B-Frames",
+      "Place the B-frames from the lookahead motion estimate", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderMpeg2:adaptive-quantizer:
+   *
+   * Raises the quantizer of the frames more complex than the frames
+   * around them, as measured by #GstVaapiEncoder:lookahead, and lowers
+   * it for the simpler ones. Needs the lookahead, and is only honoured
+   * in CQP mode.
+   */
+  properties[ENCODER_MPEG2_PROP_ADAPTIVE_QUANTIZER] =
+      g_param_spec_boolean ("adaptive-quantizer", "Adaptive Quantizer",
+      "Adapt the quantizer to the lookahead complexity estimate", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_MPEG2_N_PROPERTIES,
       properties);
 
@@ -49,11 +49,14 @@ struct _GstVaapiEncoderMpeg2
   guint8 level_idc;
   guint32 cqp; /* quantizer value for CQP mode */
   guint32 ip_period;
+  gboolean adaptive_bframes;
+  gboolean adaptive_quantizer;
 
   /* re-ordering */
   GQueue b_frames;
   gboolean dump_frames;
   gboolean new_gop;
+  GstVaapiEncPicture *pending_key; /* forced keyframe after the B-frames */
 
   /* reference list */
   GstVaapiSurfaceProxy *forward;
@@ -23,9 +23,12 @@
 #include "sysdeps.h"
 #include "gstvaapiencoder_objects.h"
 #include "gstvaapiencoder_priv.h"
+#include "gstvaapidisplay_priv.h"
 #include "gstvaapisurfaceproxy_priv.h"
 #include "gstvaapicompat.h"
+#include "gstvaapitrace.h"
 #include "gstvaapiutils.h"
+#include "gstvaapivarecord.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -385,9 +388,11 @@ gst_vaapi_enc_picture_create (GstVaapiEncPicture * picture,
   picture->pts = GST_CLOCK_TIME_NONE;
   picture->frame_num = 0;
   picture->poc = 0;
+  picture->qp_delta = 0;
 
   picture->param_id = VA_INVALID_ID;
   picture->param_size = args->param_size;
+  picture->qp_map_id = VA_INVALID_ID;
   success = vaapi_create_buffer (GET_VA_DISPLAY (picture),
       GET_VA_CONTEXT (picture),
       VAEncPictureParameterBufferType,
@@ -483,10 +488,14 @@ static gboolean
 do_encode (VADisplay dpy, VAContextID ctx, VABufferID * buf_id, void **buf_ptr)
 {
   VAStatus status;
+  GstClockTime record_start;
 
   vaapi_unmap_buffer (dpy, *buf_id, buf_ptr);
 
+  record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (dpy, buf_id, 1);
   status = vaRenderPicture (dpy, ctx, buf_id, 1);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, dpy,
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, buf_id, 1, ctx);
   if (!vaapi_check_status (status, "vaRenderPicture()"))
     return FALSE;
 
@@ -495,8 +504,8 @@ do_encode (VADisplay dpy, VAContextID ctx, VABufferID * buf_id, void **buf_ptr)
   return TRUE;
 }
 
-gboolean
-gst_vaapi_enc_picture_encode (GstVaapiEncPicture * picture)
+static gboolean
+do_picture_encode (GstVaapiEncPicture * picture)
 {
   GstVaapiEncSequence *sequence;
   GstVaapiEncQMatrix *q_matrix;
@@ -504,20 +513,26 @@ gst_vaapi_enc_picture_encode (GstVaapiEncPicture * picture)
   VADisplay va_display;
   VAContextID va_context;
   VAStatus status;
+  GstClockTime record_start;
   guint i;
 
-  g_return_val_if_fail (picture != NULL, FALSE);
-  g_return_val_if_fail (picture->surface_id != VA_INVALID_SURFACE, FALSE);
-
   va_display = GET_VA_DISPLAY (picture);
   va_context = GET_VA_CONTEXT (picture);
 
   GST_DEBUG ("encode picture 0x%08x", picture->surface_id);
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaBeginPicture (va_display, va_context, picture->surface_id);
+  GST_VAAPI_VA_RECORD_END (record_start, va_display,
+      GST_VAAPI_VA_RECORD_BEGIN_PICTURE, status, va_context,
+      picture->surface_id);
   if (!vaapi_check_status (status, "vaBeginPicture()"))
     return FALSE;
 
+  if (GET_ENCODER (picture)->context)
+    gst_vaapi_context_apply_priority (GET_ENCODER (picture)->context,
+        va_context);
+
   /* Submit Sequence parameter */
   sequence = picture->sequence;
   if (sequence && !do_encode (va_display, va_context,
@@ -550,6 +565,18 @@ gst_vaapi_enc_picture_encode (GstVaapiEncPicture * picture)
   if (!do_encode (va_display, va_context, &picture->param_id, &picture->param))
     return FALSE;
 
+  /* Submit QP map, which is kept by the encoder for the next pictures */
+  if (picture->qp_map_id != VA_INVALID_ID) {
+    record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (va_display,
+        &picture->qp_map_id, 1);
+    status = vaRenderPicture (va_display, va_context, &picture->qp_map_id, 1);
+    GST_VAAPI_VA_RECORD_END_IDS (record_start, va_display,
+        GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, &picture->qp_map_id, 1,
+        va_context);
+    if (!vaapi_check_status (status, "vaRenderPicture()"))
+      return FALSE;
+  }
+
   /* Submit Misc Params */
   for (i = 0; i < picture->misc_params->len; i++) {
     GstVaapiEncMiscParam *const misc =
@@ -576,8 +603,32 @@ gst_vaapi_enc_picture_encode (GstVaapiEncPicture * picture)
       return FALSE;
   }
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaEndPicture (va_display, va_context);
+  GST_VAAPI_VA_RECORD_END (record_start, va_display,
+      GST_VAAPI_VA_RECORD_END_PICTURE, status, va_context);
   if (!vaapi_check_status (status, "vaEndPicture()"))
     return FALSE;
+
+  GST_VAAPI_TRACE_GPU (GET_ENCODER (picture), picture->surface,
+      picture->frame ? picture->frame->pts : GST_CLOCK_TIME_NONE);
   return TRUE;
 }
+
+gboolean
+gst_vaapi_enc_picture_encode (GstVaapiEncPicture * picture)
+{
+  GstVaapiEncoder *encoder;
+  gboolean scheduled, success;
+
+  g_return_val_if_fail (picture != NULL, FALSE);
+  g_return_val_if_fail (picture->surface_id != VA_INVALID_SURFACE, FALSE);
+
+  encoder = GET_ENCODER (picture);
+  scheduled = gst_vaapi_display_job_begin (encoder->display,
+      encoder->job_deadline);
+  success = do_picture_encode (picture);
+  if (scheduled)
+    gst_vaapi_display_job_end (encoder->display);
+  return success;
+}
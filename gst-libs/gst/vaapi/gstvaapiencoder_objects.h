@@ -221,7 +221,8 @@ typedef enum
 {
   GST_VAAPI_ENC_PICTURE_FLAG_IDR          = (GST_VAAPI_CODEC_OBJECT_FLAG_LAST << 0),
   GST_VAAPI_ENC_PICTURE_FLAG_REFERENCE    = (GST_VAAPI_CODEC_OBJECT_FLAG_LAST << 1),
-  GST_VAAPI_ENC_PICTURE_FLAG_LAST         = (GST_VAAPI_CODEC_OBJECT_FLAG_LAST << 2),
+  GST_VAAPI_ENC_PICTURE_FLAG_DROPPED      = (GST_VAAPI_CODEC_OBJECT_FLAG_LAST << 2),
+  GST_VAAPI_ENC_PICTURE_FLAG_LAST         = (GST_VAAPI_CODEC_OBJECT_FLAG_LAST << 3),
 } GstVaapiEncPictureFlags;
 
 #define GST_VAAPI_ENC_PICTURE_FLAGS         GST_VAAPI_MINI_OBJECT_FLAGS
@@ -235,6 +236,9 @@ typedef enum
 #define GST_VAAPI_ENC_PICTURE_IS_REFRENCE(picture) \
     GST_VAAPI_ENC_PICTURE_FLAG_IS_SET(picture, GST_VAAPI_ENC_PICTURE_FLAG_REFERENCE)
 
+#define GST_VAAPI_ENC_PICTURE_IS_DROPPED(picture) \
+    GST_VAAPI_ENC_PICTURE_FLAG_IS_SET(picture, GST_VAAPI_ENC_PICTURE_FLAG_DROPPED)
+
 /**
  * GstVaapiEncPicture:
  *
@@ -254,6 +258,8 @@ struct _GstVaapiEncPicture
   GstVaapiEncSequence *sequence;
   GPtrArray *packed_headers;
   GPtrArray *misc_params;
+  /* not owned, see gst_vaapi_encoder_ensure_qp_map() */
+  VABufferID qp_map_id;
 
   /*< public >*/
   GstVaapiPictureType type;
@@ -266,6 +272,9 @@ struct _GstVaapiEncPicture
   guint frame_num;
   guint poc;
   guint temporal_id;
+  /* QP change decided by the software rate control, on top of the
+     constant QP of the picture type */
+  gint qp_delta;
 };
 
 G_GNUC_INTERNAL
@@ -218,6 +218,11 @@ G_BEGIN_DECLS
 #define GST_VAAPI_TYPE_ENCODER_MBBRC \
   (gst_vaapi_encoder_mbbrc_get_type ())
 
+/* Coding features a stream requires from its entrypoint (internal) */
+#define GST_VAAPI_ENCODER_FEATURE_BFRAMES       (1U << 0)
+#define GST_VAAPI_ENCODER_FEATURE_ROI           (1U << 1)
+#define GST_VAAPI_ENCODER_FEATURE_TRELLIS       (1U << 2)
+
 typedef struct _GstVaapiEncoderClass GstVaapiEncoderClass;
 typedef struct _GstVaapiEncoderClassData GstVaapiEncoderClassData;
 
@@ -251,15 +256,55 @@ struct _GstVaapiEncoder
 
   /* parameters */
   VAEncMiscParameterBufferQualityLevel va_quality_level;
+  guint quality_level_max;
+  /* steps towards speed added to the quality level of the pictures,
+     see gst_vaapi_encoder_set_quality_level_boost() */
+  gint quality_level_boost;
 
   GMutex mutex;
   GCond surface_free;
+  /* surfaces the encoder input is scaled into, apart from the
+     reconstructed surfaces of the context */
+  GstVaapiVideoPool *input_pool;
+  GstVideoInfo input_pool_info;
   GCond codedbuf_free;
   guint codedbuf_size;
   GstVaapiVideoPool *codedbuf_pool;
+  gboolean adaptive_codedbuf;
   GAsyncQueue *codedbuf_queue;
   guint32 num_codedbuf_queued;
 
+  /* asynchronous completion of coded buffers */
+  guint async_depth;
+  GThread *sync_thread;
+  GAsyncQueue *codedbuf_done_queue;
+  GCond inflight_free;
+  guint num_inflight;
+  gint num_pending;
+  /* coded buffer whose timed sync expired in the synchronous path,
+     completed first on the next gst_vaapi_encoder_get_buffer() */
+  GstVaapiCodedBufferProxy *sync_pending;
+  /* vaSyncBuffer() is not supported, sync the surfaces instead */
+  gint no_sync_buffer;
+
+  /* scene change detection */
+  guint lookahead_depth;
+  struct _GstVaapiEncoderLookahead *lookahead;
+  /* follow the coding hints of decoded input, see
+   * GstVaapiEncoder:source-hints */
+  gboolean source_hints;
+
+  /* software rate control holding the CQP quality under a bitrate
+   * cap, fed back with the coded sizes by complete_coded_buffer() */
+  guint cqp_max_bitrate;
+  gint64 rc_excess_bits;
+  gint rc_qp_offset;
+  GHashTable *rc_qp_deltas;     /* lookahead deltas by frame number */
+
+  /* frame dropping of the bitrate driven rate controls, fed back with
+   * the coded sizes by complete_coded_buffer() */
+  gint64 drop_excess_bits;
+
   guint got_packed_headers:1;
   guint got_rate_control_mask:1;
 
@@ -270,8 +315,38 @@ struct _GstVaapiEncoder
 
   gint8 default_roi_value;
 
+  /* per-block QP map, uploaded into one of two VA buffers in turn so
+   * that the one of the picture in flight is never overwritten */
+  guint qp_block_size;
+  guint qp_map_width;
+  guint qp_map_height;
+  guint qp_map_pitch;
+  VABufferID qp_map_ids[2];
+  guint qp_map_index;
+  guint8 *qp_map;               /* last uploaded map */
+  guint8 *qp_map_next;
+  gboolean qp_map_valid;
+
   /* trellis quantization */
   gboolean trellis;
+
+  /* rolling intra refresh, used instead of periodic keyframes when
+   * tuning for low latency */
+  gboolean intra_refresh;
+  guint intra_refresh_pos;
+
+  /* deadline given to the display job scheduler */
+  GstClockTime job_deadline;
+
+  /* GPU priority of the VA context */
+  GstVaapiPriority priority;
+
+  /* features the low-power entrypoint must support for
+     GST_VAAPI_ENCODER_TUNE_AUTO to pick it, set by the subclasses */
+  guint required_features;
+  /* macroblock rate accounted on the display for this stream */
+  GstVaapiEntrypoint load_entrypoint;
+  guint64 load;
 };
 
 struct _GstVaapiEncoderClassData
@@ -321,6 +396,8 @@ struct _GstVaapiEncoderClass
   const GstVaapiEncoderClassData *class_data;
 
   GstVaapiEncoderStatus (*reconfigure)  (GstVaapiEncoder * encoder);
+  /* update_rate_control can be NULL, a full reconfigure is done then */
+  GstVaapiEncoderStatus (*update_rate_control) (GstVaapiEncoder * encoder);
   GstVaapiEncoderStatus (*reordering)   (GstVaapiEncoder * encoder,
                                          GstVideoCodecFrame * in,
                                          GstVaapiEncPicture ** out);
@@ -373,6 +450,36 @@ gboolean
 gst_vaapi_encoder_ensure_param_trellis (GstVaapiEncoder * encoder,
     GstVaapiEncPicture * picture);
 
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_encoder_ensure_param_intra_refresh (GstVaapiEncoder * encoder,
+    GstVaapiEncPicture * picture, guint num_columns);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_encoder_ensure_qp_map (GstVaapiEncoder * encoder,
+    GstVaapiEncPicture * picture, guint qp, guint min_qp, guint max_qp);
+
+G_GNUC_INTERNAL
+guint
+gst_vaapi_encoder_get_temporal_id (guint num_layers, guint frame_index);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_encoder_get_lookahead_stats (GstVaapiEncoder * encoder,
+    guint * complexity, gint * qp_delta);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_encoder_check_frame_drop (GstVaapiEncoder * encoder,
+    guint64 max_bits);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_encoder_ensure_param_temporal_layers (GstVaapiEncoder * encoder,
+    GstVaapiEncPicture * picture, guint num_layers,
+    const guint * layer_bitrates);
+
 G_GNUC_INTERNAL
 gboolean
 gst_vaapi_encoder_ensure_num_slices (GstVaapiEncoder * encoder,
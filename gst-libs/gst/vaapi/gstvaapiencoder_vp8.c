@@ -52,6 +52,9 @@
 #define DEFAULT_LOOP_FILTER_LEVEL 0
 #define DEFAULT_SHARPNESS_LEVEL 0
 #define DEFAULT_YAC_QI 40
+#define DEFAULT_ERROR_RESILIENT TRUE
+#define DEFAULT_GOLDEN_FRAME_INTERVAL 0
+#define DEFAULT_DROP_FRAME_THRESHOLD 0
 
 /* ------------------------------------------------------------------------- */
 /* --- VP8 Encoder                                                      --- */
@@ -69,6 +72,13 @@ struct _GstVaapiEncoderVP8
   GstVaapiSurfaceProxy *last_ref;
   GstVaapiSurfaceProxy *golden_ref;
   GstVaapiSurfaceProxy *alt_ref;
+
+  /* real time */
+  gboolean error_resilient;
+  guint golden_frame_interval;  /* 0: golden and altref follow last */
+  guint frames_since_golden;
+  gboolean refresh_golden;      /* for the picture being encoded */
+  guint drop_frame_threshold;   /* percentage of the HRD buffer */
 };
 
 /* Derives the profile that suits best to the configuration */
@@ -202,10 +212,19 @@ push_reference (GstVaapiEncoderVP8 * encoder, GstVaapiSurfaceProxy * ref)
   if (encoder->last_ref == NULL) {
     encoder->golden_ref = gst_vaapi_surface_proxy_ref (ref);
     encoder->alt_ref = gst_vaapi_surface_proxy_ref (ref);
-  } else {
+  } else if (encoder->golden_frame_interval == 0) {
     clear_ref (encoder, &encoder->alt_ref);
     encoder->alt_ref = encoder->golden_ref;
     encoder->golden_ref = encoder->last_ref;
+  } else {
+    /* golden only moves every golden-frame-interval frames, the
+       previous one becoming the altref */
+    if (encoder->refresh_golden) {
+      clear_ref (encoder, &encoder->alt_ref);
+      encoder->alt_ref = encoder->golden_ref;
+      encoder->golden_ref = gst_vaapi_surface_proxy_ref (ref);
+    }
+    clear_ref (encoder, &encoder->last_ref);
   }
   encoder->last_ref = ref;
 }
@@ -318,10 +337,17 @@ fill_picture (GstVaapiEncoderVP8 * encoder,
     pic_param->ref_last_frame =
         GST_VAAPI_SURFACE_PROXY_SURFACE_ID (encoder->last_ref);
     pic_param->pic_flags.bits.refresh_last = 1;
-    pic_param->pic_flags.bits.refresh_golden_frame = 0;
-    pic_param->pic_flags.bits.copy_buffer_to_golden = 1;
-    pic_param->pic_flags.bits.refresh_alternate_frame = 0;
-    pic_param->pic_flags.bits.copy_buffer_to_alternate = 2;
+    if (encoder->golden_frame_interval == 0) {
+      pic_param->pic_flags.bits.refresh_golden_frame = 0;
+      pic_param->pic_flags.bits.copy_buffer_to_golden = 1;
+      pic_param->pic_flags.bits.refresh_alternate_frame = 0;
+      pic_param->pic_flags.bits.copy_buffer_to_alternate = 2;
+    } else if (encoder->refresh_golden) {
+      /* the copy to altref reads the golden frame before the refresh */
+      pic_param->pic_flags.bits.refresh_golden_frame = 1;
+      pic_param->pic_flags.bits.refresh_alternate_frame = 0;
+      pic_param->pic_flags.bits.copy_buffer_to_alternate = 2;
+    }
   } else {
     pic_param->ref_last_frame = VA_INVALID_SURFACE;
     pic_param->ref_gf_frame = VA_INVALID_SURFACE;
@@ -333,6 +359,10 @@ fill_picture (GstVaapiEncoderVP8 * encoder,
 
   pic_param->pic_flags.bits.show_frame = 1;
 
+  /* Probability updates only last for the frame, so that a loss does
+     not corrupt the entropy contexts of the following ones */
+  pic_param->pic_flags.bits.refresh_entropy_probs = !encoder->error_resilient;
+
   if (encoder->loop_filter_level) {
     pic_param->pic_flags.bits.version = 1;
     pic_param->pic_flags.bits.loop_filter_type = 1;     /* Enable simple loop filter */
@@ -417,6 +447,15 @@ gst_vaapi_encoder_vp8_encode (GstVaapiEncoder * base_encoder,
 
   g_assert (GST_VAAPI_SURFACE_PROXY_SURFACE (reconstruct));
 
+  encoder->refresh_golden = FALSE;
+  if (picture->type == GST_VAAPI_PICTURE_TYPE_I)
+    encoder->frames_since_golden = 0;
+  else if (encoder->golden_frame_interval > 0 &&
+      ++encoder->frames_since_golden >= encoder->golden_frame_interval) {
+    encoder->refresh_golden = TRUE;
+    encoder->frames_since_golden = 0;
+  }
+
   if (!ensure_sequence (encoder, picture))
     goto error;
   if (!ensure_misc_params (encoder, picture))
@@ -483,6 +522,15 @@ gst_vaapi_encoder_vp8_reordering (GstVaapiEncoder * base_encoder,
     GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
   } else {
     picture->type = GST_VAAPI_PICTURE_TYPE_P;
+
+    /* Skip the frame rather than overflow the buffer: the next ones
+       keep predicting from the last coded picture */
+    if (encoder->drop_frame_threshold > 0 &&
+        gst_vaapi_encoder_check_frame_drop (base_encoder,
+            (guint64) GST_VAAPI_ENCODER_VA_HRD (encoder).buffer_size *
+            encoder->drop_frame_threshold / 100))
+      GST_VAAPI_ENC_PICTURE_FLAG_SET (picture,
+          GST_VAAPI_ENC_PICTURE_FLAG_DROPPED);
   }
 
   encoder->frame_num++;
@@ -528,6 +576,9 @@ gst_vaapi_encoder_vp8_init (GstVaapiEncoderVP8 * encoder)
   encoder->last_ref = NULL;
   encoder->golden_ref = NULL;
   encoder->alt_ref = NULL;
+  encoder->error_resilient = DEFAULT_ERROR_RESILIENT;
+  encoder->golden_frame_interval = DEFAULT_GOLDEN_FRAME_INTERVAL;
+  encoder->drop_frame_threshold = DEFAULT_DROP_FRAME_THRESHOLD;
 }
 
 static void
@@ -544,6 +595,12 @@ gst_vaapi_encoder_vp8_finalize (GObject * object)
  * @ENCODER_VP8_PROP_LOOP_FILTER_LEVEL: Loop Filter Level(uint).
  * @ENCODER_VP8_PROP_LOOP_SHARPNESS_LEVEL: Sharpness Level(uint).
  * @ENCODER_VP8_PROP_YAC_Q_INDEX: Quantization table index for luma AC(uint).
+ * @ENCODER_VP8_PROP_ERROR_RESILIENT: Don't carry probability updates
+ *   over to the next frames (bool).
+ * @ENCODER_VP8_PROP_GOLDEN_FRAME_INTERVAL: Frames between golden frame
+ *   refreshes (uint).
+ * @ENCODER_VP8_PROP_DROP_FRAME_THRESHOLD: Buffer fullness above which
+ *   frames are dropped (uint).
  *
  * The set of VP8 encoder specific configurable properties.
  */
@@ -554,6 +611,9 @@ enum
   ENCODER_VP8_PROP_LOOP_FILTER_LEVEL,
   ENCODER_VP8_PROP_SHARPNESS_LEVEL,
   ENCODER_VP8_PROP_YAC_Q_INDEX,
+  ENCODER_VP8_PROP_ERROR_RESILIENT,
+  ENCODER_VP8_PROP_GOLDEN_FRAME_INTERVAL,
+  ENCODER_VP8_PROP_DROP_FRAME_THRESHOLD,
   ENCODER_VP8_N_PROPERTIES
 };
 
@@ -589,6 +649,15 @@ gst_vaapi_encoder_vp8_set_property (GObject * object, guint prop_id,
     case ENCODER_VP8_PROP_YAC_Q_INDEX:
       encoder->yac_qi = g_value_get_uint (value);
       break;
+    case ENCODER_VP8_PROP_ERROR_RESILIENT:
+      encoder->error_resilient = g_value_get_boolean (value);
+      break;
+    case ENCODER_VP8_PROP_GOLDEN_FRAME_INTERVAL:
+      encoder->golden_frame_interval = g_value_get_uint (value);
+      break;
+    case ENCODER_VP8_PROP_DROP_FRAME_THRESHOLD:
+      encoder->drop_frame_threshold = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -617,6 +686,15 @@ gst_vaapi_encoder_vp8_get_property (GObject * object, guint prop_id,
     case ENCODER_VP8_PROP_YAC_Q_INDEX:
       g_value_set_uint (value, encoder->yac_qi);
       break;
+    case ENCODER_VP8_PROP_ERROR_RESILIENT:
+      g_value_set_boolean (value, encoder->error_resilient);
+      break;
+    case ENCODER_VP8_PROP_GOLDEN_FRAME_INTERVAL:
+      g_value_set_uint (value, encoder->golden_frame_interval);
+      break;
+    case ENCODER_VP8_PROP_DROP_FRAME_THRESHOLD:
+      g_value_set_uint (value, encoder->drop_frame_threshold);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -679,6 +757,49 @@ gst_vaapi_encoder_vp8_class_init (GstVaapiEncoderVP8Class * klass)
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoderVP8:error-resilient:
+   *
+   * Keep the probability updates of a frame from applying to the
+   * following ones, so that decoding recovers from a lost frame at
+   * the next golden or key frame.
+   */
+  properties[ENCODER_VP8_PROP_ERROR_RESILIENT] =
+      g_param_spec_boolean ("error-resilient", "Error Resilient",
+      "Don't carry probability updates over to the next frames",
+      DEFAULT_ERROR_RESILIENT,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderVP8:golden-frame-interval:
+   *
+   * The number of frames between two golden frame refreshes. The
+   * golden frame then stays a stable reference for that long, and the
+   * previous golden frame becomes the altref. When zero, golden and
+   * altref are the two frames before the last one.
+   */
+  properties[ENCODER_VP8_PROP_GOLDEN_FRAME_INTERVAL] =
+      g_param_spec_uint ("golden-frame-interval", "Golden Frame Interval",
+      "Frames between golden frame refreshes (0: follow the last frame)",
+      0, 4096, DEFAULT_GOLDEN_FRAME_INTERVAL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderVP8:drop-frame-threshold:
+   *
+   * With CBR or VBR, inter frames are dropped, with no coded output,
+   * while the bits produced in excess of the bitrate are above this
+   * percentage of the HRD buffer size. Zero never drops frames.
+   */
+  properties[ENCODER_VP8_PROP_DROP_FRAME_THRESHOLD] =
+      g_param_spec_uint ("drop-frame-threshold", "Drop Frame Threshold",
+      "Buffer fullness, in percent, above which frames are dropped "
+      "(0: never drop)", 0, 100, DEFAULT_DROP_FRAME_THRESHOLD,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_VP8_N_PROPERTIES,
       properties);
 
@@ -53,6 +53,8 @@
 #define DEFAULT_LOOP_FILTER_LEVEL 10
 #define DEFAULT_SHARPNESS_LEVEL 0
 #define DEFAULT_YAC_QINDEX 60
+#define DEFAULT_GOLDEN_FRAME_INTERVAL 0
+#define DEFAULT_DROP_FRAME_THRESHOLD 0
 
 #define MAX_FRAME_WIDTH 4096
 #define MAX_FRAME_HEIGHT 4096
@@ -60,6 +62,10 @@
 /* Default CPB length (in milliseconds) */
 #define DEFAULT_CPB_LENGTH 1500
 
+/* Define the maximum number of temporal layers */
+#define MIN_TEMPORAL_LEVELS 1
+#define MAX_TEMPORAL_LEVELS 4
+
 typedef enum
 {
   GST_VAAPI_ENCODER_VP9_REF_PIC_MODE_0 = 0,
@@ -105,9 +111,21 @@ struct _GstVaapiEncoderVP9
   guint ref_list_idx;           /* next free slot in ref_list */
   GstVaapiEntrypoint entrypoint;
 
+  /* temporal scalability: slot i holds the latest picture of layer i */
+  guint temporal_levels;
+  guint temporal_layer_bitrates[MAX_TEMPORAL_LEVELS];   /* kbps */
+  guint ref_list_frame_num[GST_VP9_REF_FRAMES];
+
   /* Bitrate contral parameters, CPB = Coded Picture Buffer */
   guint bitrate_bits;           /* bitrate (bits) */
   guint cpb_length;             /* length of CPB buffer (ms) */
+
+  /* real time */
+  gboolean error_resilient;
+  guint golden_frame_interval;  /* 0: golden stays the keyframe */
+  guint frames_since_golden;
+  gboolean refresh_golden;      /* for the picture being encoded */
+  guint drop_frame_threshold;   /* percentage of the HRD buffer */
 };
 
 /* Estimates a good enough bitrate if none was supplied */
@@ -306,9 +324,35 @@ ensure_misc_params (GstVaapiEncoderVP9 * encoder, GstVaapiEncPicture * picture)
     return FALSE;
   if (!gst_vaapi_encoder_ensure_param_control_rate (base_encoder, picture))
     return FALSE;
+  if (!gst_vaapi_encoder_ensure_param_temporal_layers (base_encoder, picture,
+          encoder->temporal_levels, encoder->temporal_layer_bitrates))
+    return FALSE;
   return TRUE;
 }
 
+/* A picture of layer t only predicts from the latest picture of the
+   layers below it (or of the base layer for the base layer itself),
+   and only the layers below the top one are kept as references */
+static void
+get_temporal_ref_indices (GstVaapiEncoderVP9 * encoder, guint temporal_id,
+    guint * last_idx, guint8 * refresh_frame_flags)
+{
+  const guint max_temporal_id = MAX (temporal_id, 1);
+  guint i;
+
+  *last_idx = 0;
+  for (i = 1; i < max_temporal_id; i++) {
+    if (encoder->ref_list_frame_num[i] > encoder->ref_list_frame_num[*last_idx])
+      *last_idx = i;
+  }
+
+  *refresh_frame_flags = temporal_id < encoder->temporal_levels - 1 ?
+      1 << temporal_id : 0;
+
+  GST_LOG ("temporal_id:%d last_ref_idx:%d refesh_frame_flag:%x",
+      temporal_id, *last_idx, *refresh_frame_flags);
+}
+
 static void
 get_ref_indices (guint ref_pic_mode, guint ref_list_idx, guint * last_idx,
     guint * gf_idx, guint * arf_idx, guint8 * refresh_frame_flags)
@@ -368,7 +412,21 @@ fill_picture (GstVaapiEncoderVP9 * encoder,
 
   pic_param->pic_flags.bits.show_frame = 1;
 
-  if (picture->type == GST_VAAPI_PICTURE_TYPE_P) {
+  if (picture->type == GST_VAAPI_PICTURE_TYPE_P
+      && encoder->temporal_levels > 1) {
+    pic_param->pic_flags.bits.frame_type = GST_VP9_INTER_FRAME;
+
+    /* a single reference, so that the layers above can be dropped */
+    pic_param->ref_flags.bits.ref_frame_ctrl_l0 = 0x1;
+
+    get_temporal_ref_indices (encoder, picture->temporal_id, &last_idx,
+        &refresh_frame_flags);
+
+    pic_param->ref_flags.bits.ref_last_idx = last_idx;
+    pic_param->ref_flags.bits.ref_gf_idx = last_idx;
+    pic_param->ref_flags.bits.ref_arf_idx = last_idx;
+    pic_param->refresh_frame_flags = refresh_frame_flags;
+  } else if (picture->type == GST_VAAPI_PICTURE_TYPE_P) {
     pic_param->pic_flags.bits.frame_type = GST_VP9_INTER_FRAME;
 
     /* use three of the reference frames (last, golden and altref)
@@ -378,11 +436,23 @@ fill_picture (GstVaapiEncoderVP9 * encoder,
     get_ref_indices (encoder->ref_pic_mode, encoder->ref_list_idx, &last_idx,
         &gf_idx, &arf_idx, &refresh_frame_flags);
 
+    if (encoder->refresh_golden)
+      refresh_frame_flags |= 1 << gf_idx;
+
     pic_param->ref_flags.bits.ref_last_idx = last_idx;
     pic_param->ref_flags.bits.ref_gf_idx = gf_idx;
     pic_param->ref_flags.bits.ref_arf_idx = arf_idx;
     pic_param->refresh_frame_flags = refresh_frame_flags;
   }
+  pic_param->ref_flags.bits.temporal_id = picture->temporal_id;
+
+  /* Every frame starts over from the default probabilities, and none
+     updates the saved contexts, so that a loss doesn't propagate */
+  if (encoder->error_resilient) {
+    pic_param->pic_flags.bits.error_resilient_mode = 1;
+    pic_param->pic_flags.bits.frame_parallel_decoding_mode = 1;
+    pic_param->pic_flags.bits.refresh_frame_context = 0;
+  }
 
   pic_param->luma_ac_qindex = encoder->yac_qi;
   pic_param->luma_dc_qindex_delta = 1;
@@ -419,12 +489,26 @@ update_ref_list (GstVaapiEncoderVP9 * encoder, GstVaapiEncPicture * picture,
     gst_vaapi_surface_proxy_unref (ref);
     /* set next free slot index */
     encoder->ref_list_idx = 1;
+    memset (encoder->ref_list_frame_num, 0,
+        sizeof (encoder->ref_list_frame_num));
+    return;
+  }
+
+  if (encoder->temporal_levels > 1) {
+    i = picture->temporal_id;
+    if (i < encoder->temporal_levels - 1) {
+      gst_vaapi_surface_proxy_replace (&encoder->ref_list[i], ref);
+      encoder->ref_list_frame_num[i] = encoder->frame_num;
+    }
+    gst_vaapi_surface_proxy_unref (ref);
     return;
   }
 
   switch (encoder->ref_pic_mode) {
     case GST_VAAPI_ENCODER_VP9_REF_PIC_MODE_0:
       gst_vaapi_surface_proxy_replace (&encoder->ref_list[0], ref);
+      if (encoder->refresh_golden)
+        gst_vaapi_surface_proxy_replace (&encoder->ref_list[1], ref);
       gst_vaapi_surface_proxy_unref (ref);
       break;
     case GST_VAAPI_ENCODER_VP9_REF_PIC_MODE_1:
@@ -451,6 +535,18 @@ gst_vaapi_encoder_vp9_encode (GstVaapiEncoder * base_encoder,
 
   g_assert (GST_VAAPI_SURFACE_PROXY_SURFACE (reconstruct));
 
+  /* The golden slot is only refreshed on its own in mode-0 */
+  encoder->refresh_golden = FALSE;
+  if (picture->type == GST_VAAPI_PICTURE_TYPE_I)
+    encoder->frames_since_golden = 0;
+  else if (encoder->golden_frame_interval > 0 &&
+      encoder->temporal_levels <= 1 &&
+      encoder->ref_pic_mode == GST_VAAPI_ENCODER_VP9_REF_PIC_MODE_0 &&
+      ++encoder->frames_since_golden >= encoder->golden_frame_interval) {
+    encoder->refresh_golden = TRUE;
+    encoder->frames_since_golden = 0;
+  }
+
   if (!ensure_sequence (encoder, picture))
     goto error;
   if (!ensure_misc_params (encoder, picture))
@@ -510,7 +606,18 @@ gst_vaapi_encoder_vp9_reordering (GstVaapiEncoder * base_encoder,
     GST_VIDEO_CODEC_FRAME_SET_SYNC_POINT (frame);
   } else {
     picture->type = GST_VAAPI_PICTURE_TYPE_P;
+
+    /* Skip the frame rather than overflow the buffer: the next ones
+       keep predicting from the last coded pictures */
+    if (encoder->drop_frame_threshold > 0 &&
+        gst_vaapi_encoder_check_frame_drop (base_encoder,
+            (guint64) GST_VAAPI_ENCODER_VA_HRD (encoder).buffer_size *
+            encoder->drop_frame_threshold / 100))
+      GST_VAAPI_ENC_PICTURE_FLAG_SET (picture,
+          GST_VAAPI_ENC_PICTURE_FLAG_DROPPED);
   }
+  picture->temporal_id = gst_vaapi_encoder_get_temporal_id
+      (encoder->temporal_levels, encoder->frame_num);
 
   encoder->frame_num++;
   *output = picture;
@@ -534,11 +641,27 @@ gst_vaapi_encoder_vp9_reconfigure (GstVaapiEncoder * base_encoder)
     return GST_VAAPI_ENCODER_STATUS_ERROR_UNSUPPORTED_PROFILE;
   }
 
+  /* Every keyframe starts the temporal layer pattern over */
+  if (encoder->temporal_levels > 1)
+    base_encoder->keyframe_period =
+        GST_ROUND_UP_N (base_encoder->keyframe_period,
+        1 << (encoder->temporal_levels - 1));
+
   ensure_control_rate_params (encoder);
   return set_context_info (base_encoder);
 }
 
 
+static GstVaapiEncoderStatus
+gst_vaapi_encoder_vp9_update_rate_control (GstVaapiEncoder * base_encoder)
+{
+  GstVaapiEncoderVP9 *const encoder = GST_VAAPI_ENCODER_VP9 (base_encoder);
+
+  ensure_bitrate (encoder);
+  ensure_control_rate_params (encoder);
+  return GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
 struct _GstVaapiEncoderVP9Class
 {
   GstVaapiEncoderClass parent_class;
@@ -556,6 +679,9 @@ gst_vaapi_encoder_vp9_init (GstVaapiEncoderVP9 * encoder)
   encoder->yac_qi = DEFAULT_YAC_QINDEX;
   encoder->cpb_length = DEFAULT_CPB_LENGTH;
   encoder->entrypoint = GST_VAAPI_ENTRYPOINT_SLICE_ENCODE;
+  encoder->temporal_levels = MIN_TEMPORAL_LEVELS;
+  encoder->golden_frame_interval = DEFAULT_GOLDEN_FRAME_INTERVAL;
+  encoder->drop_frame_threshold = DEFAULT_DROP_FRAME_THRESHOLD;
 
   memset (encoder->ref_list, 0,
       G_N_ELEMENTS (encoder->ref_list) * sizeof (encoder->ref_list[0]));
@@ -570,6 +696,14 @@ gst_vaapi_encoder_vp9_init (GstVaapiEncoderVP9 * encoder)
  * @ENCODER_VP9_PROP_YAC_Q_INDEX: Quantization table index for luma AC
  * @ENCODER_VP9_PROP_REF_PIC_MODE: Reference picute selection modes
  * @ENCODER_VP9_PROP_CPB_LENGTH:Length of CPB buffer in milliseconds
+ * @ENCODER_VP9_PROP_TEMPORAL_LEVELS: Number of temporal levels (uint).
+ * @ENCODER_VP9_PROP_TEMPORAL_LAYER_BITRATES: Per temporal layer
+ *   bitrate (#GstValueArray of uint).
+ * @ENCODER_VP9_PROP_ERROR_RESILIENT: Error resilient mode (bool).
+ * @ENCODER_VP9_PROP_GOLDEN_FRAME_INTERVAL: Frames between golden frame
+ *   refreshes (uint).
+ * @ENCODER_VP9_PROP_DROP_FRAME_THRESHOLD: Buffer fullness above which
+ *   frames are dropped (uint).
  *
  * The set of VP9 encoder specific configurable properties.
  */
@@ -582,11 +716,53 @@ enum
   ENCODER_VP9_PROP_YAC_Q_INDEX,
   ENCODER_VP9_PROP_REF_PIC_MODE,
   ENCODER_VP9_PROP_CPB_LENGTH,
+  ENCODER_VP9_PROP_TEMPORAL_LEVELS,
+  ENCODER_VP9_PROP_TEMPORAL_LAYER_BITRATES,
+  ENCODER_VP9_PROP_ERROR_RESILIENT,
+  ENCODER_VP9_PROP_GOLDEN_FRAME_INTERVAL,
+  ENCODER_VP9_PROP_DROP_FRAME_THRESHOLD,
   ENCODER_VP9_N_PROPERTIES
 };
 
 static GParamSpec *properties[ENCODER_VP9_N_PROPERTIES];
 
+static void
+set_temporal_layer_bitrates (GstVaapiEncoderVP9 * const encoder,
+    const GValue * value)
+{
+  guint i, len = gst_value_array_get_size (value);
+
+  if (len > MAX_TEMPORAL_LEVELS) {
+    GST_WARNING ("%d temporal layer bitrates are provided, only the first %d "
+        "are used", len, MAX_TEMPORAL_LEVELS);
+    len = MAX_TEMPORAL_LEVELS;
+  }
+
+  memset (encoder->temporal_layer_bitrates, 0,
+      sizeof (encoder->temporal_layer_bitrates));
+  for (i = 0; i < len; i++) {
+    const GValue *val = gst_value_array_get_value (value, i);
+    encoder->temporal_layer_bitrates[i] = g_value_get_uint (val);
+  }
+}
+
+static void
+get_temporal_layer_bitrates (GstVaapiEncoderVP9 * const encoder,
+    GValue * value)
+{
+  guint i;
+  GValue bitrate = G_VALUE_INIT;
+
+  g_value_reset (value);
+  g_value_init (&bitrate, G_TYPE_UINT);
+
+  for (i = 0; i < encoder->temporal_levels; i++) {
+    g_value_set_uint (&bitrate, encoder->temporal_layer_bitrates[i]);
+    gst_value_array_append_value (value, &bitrate);
+  }
+  g_value_unset (&bitrate);
+}
+
 static void
 gst_vaapi_encoder_vp9_set_property (GObject * object, guint prop_id,
     const GValue * value, GParamSpec * pspec)
@@ -623,6 +799,21 @@ gst_vaapi_encoder_vp9_set_property (GObject * object, guint prop_id,
     case ENCODER_VP9_PROP_CPB_LENGTH:
       encoder->cpb_length = g_value_get_uint (value);
       break;
+    case ENCODER_VP9_PROP_TEMPORAL_LEVELS:
+      encoder->temporal_levels = g_value_get_uint (value);
+      break;
+    case ENCODER_VP9_PROP_TEMPORAL_LAYER_BITRATES:
+      set_temporal_layer_bitrates (encoder, value);
+      break;
+    case ENCODER_VP9_PROP_ERROR_RESILIENT:
+      encoder->error_resilient = g_value_get_boolean (value);
+      break;
+    case ENCODER_VP9_PROP_GOLDEN_FRAME_INTERVAL:
+      encoder->golden_frame_interval = g_value_get_uint (value);
+      break;
+    case ENCODER_VP9_PROP_DROP_FRAME_THRESHOLD:
+      encoder->drop_frame_threshold = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -657,6 +848,21 @@ gst_vaapi_encoder_vp9_get_property (GObject * object, guint prop_id,
     case ENCODER_VP9_PROP_CPB_LENGTH:
       g_value_set_uint (value, encoder->cpb_length);
       break;
+    case ENCODER_VP9_PROP_TEMPORAL_LEVELS:
+      g_value_set_uint (value, encoder->temporal_levels);
+      break;
+    case ENCODER_VP9_PROP_TEMPORAL_LAYER_BITRATES:
+      get_temporal_layer_bitrates (encoder, value);
+      break;
+    case ENCODER_VP9_PROP_ERROR_RESILIENT:
+      g_value_set_boolean (value, encoder->error_resilient);
+      break;
+    case ENCODER_VP9_PROP_GOLDEN_FRAME_INTERVAL:
+      g_value_set_uint (value, encoder->golden_frame_interval);
+      break;
+    case ENCODER_VP9_PROP_DROP_FRAME_THRESHOLD:
+      g_value_set_uint (value, encoder->drop_frame_threshold);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
   }
@@ -672,6 +878,8 @@ gst_vaapi_encoder_vp9_class_init (GstVaapiEncoderVP9Class * klass)
 
   encoder_class->class_data = &g_class_data;
   encoder_class->reconfigure = gst_vaapi_encoder_vp9_reconfigure;
+  encoder_class->update_rate_control =
+      gst_vaapi_encoder_vp9_update_rate_control;
   encoder_class->reordering = gst_vaapi_encoder_vp9_reordering;
   encoder_class->encode = gst_vaapi_encoder_vp9_encode;
   encoder_class->flush = gst_vaapi_encoder_vp9_flush;
@@ -743,6 +951,80 @@ gst_vaapi_encoder_vp9_class_init (GstVaapiEncoderVP9Class * klass)
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
       GST_VAAPI_PARAM_ENCODER_EXPOSURE);
 
+  /**
+   * GstVaapiEncoderVP9:temporal-levels:
+   *
+   * Number of temporal layers. Each layer doubles the frame rate of the
+   * layers below it, and only predicts from them. The ref-pic-mode is
+   * ignored when more than one level is used.
+   */
+  properties[ENCODER_VP9_PROP_TEMPORAL_LEVELS] =
+      g_param_spec_uint ("temporal-levels",
+      "temporal levels",
+      "Number of temporal levels in the encoded stream",
+      MIN_TEMPORAL_LEVELS, MAX_TEMPORAL_LEVELS, MIN_TEMPORAL_LEVELS,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderVP9:temporal-layer-bitrates:
+   *
+   * The target bitrate of each temporal layer, in kbps, starting from
+   * the base layer. Each value accounts for its layer and all the
+   * layers below it. A value of 0 leaves the layer to the overall
+   * rate control.
+   */
+  properties[ENCODER_VP9_PROP_TEMPORAL_LAYER_BITRATES] =
+      gst_param_spec_array ("temporal-layer-bitrates",
+      "Temporal layer bitrates",
+      "Cumulative bitrate (in kbps) of each temporal layer",
+      g_param_spec_uint ("temporal-layer-bitrate", "Temporal layer bitrate",
+          "bitrate of a temporal layer", 0, 2000 * 1024, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS),
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderVP9:error-resilient:
+   *
+   * Code every frame in error resilient mode: the probabilities are
+   * reset, and no frame updates the saved contexts, so that decoding
+   * recovers from a lost frame at the next frame it doesn't reference.
+   */
+  properties[ENCODER_VP9_PROP_ERROR_RESILIENT] =
+      g_param_spec_boolean ("error-resilient", "Error Resilient",
+      "Code the frames in error resilient mode", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderVP9:golden-frame-interval:
+   *
+   * The number of frames between two golden frame refreshes, with
+   * ref-pic-mode mode-0 and a single temporal level. When zero, the
+   * golden frame stays the keyframe.
+   */
+  properties[ENCODER_VP9_PROP_GOLDEN_FRAME_INTERVAL] =
+      g_param_spec_uint ("golden-frame-interval", "Golden Frame Interval",
+      "Frames between golden frame refreshes (0: keep the keyframe)",
+      0, 4096, DEFAULT_GOLDEN_FRAME_INTERVAL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
+  /**
+   * GstVaapiEncoderVP9:drop-frame-threshold:
+   *
+   * With CBR or VBR, inter frames are dropped, with no coded output,
+   * while the bits produced in excess of the bitrate are above this
+   * percentage of the HRD buffer size. Zero never drops frames.
+   */
+  properties[ENCODER_VP9_PROP_DROP_FRAME_THRESHOLD] =
+      g_param_spec_uint ("drop-frame-threshold", "Drop Frame Threshold",
+      "Buffer fullness, in percent, above which frames are dropped "
+      "(0: never drop)", 0, 100, DEFAULT_DROP_FRAME_THRESHOLD,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT |
+      GST_VAAPI_PARAM_ENCODER_EXPOSURE);
+
   g_object_class_install_properties (object_class, ENCODER_VP9_N_PROPERTIES,
       properties);
 
@@ -29,6 +29,8 @@
 #include "gstvaapidisplay_priv.h"
 #include "gstvaapisurface_priv.h"
 #include "gstvaapiutils_core.h"
+#include "gstvaapitrace.h"
+#include "gstvaapivarecord.h"
 
 #define GST_VAAPI_FILTER_CAST(obj) \
     ((GstVaapiFilter *)(obj))
@@ -58,6 +60,7 @@ struct _GstVaapiFilter
   VADisplay va_display;
   VAConfigID va_config;
   VAContextID va_context;
+  GRecMutex lock;
   GPtrArray *operations;
   GstVideoFormat format;
   GstVaapiScaleMethod scale_method;
@@ -67,6 +70,7 @@ struct _GstVaapiFilter
   GArray *backward_references;
   GstVaapiRectangle crop_rect;
   GstVaapiRectangle target_rect;
+  guint32 background_color;
   guint use_crop_rect:1;
   guint use_target_rect:1;
   guint32 mirror_flags;
@@ -76,8 +80,33 @@ struct _GstVaapiFilter
   GstVideoColorimetry output_colorimetry;
 
 #if VA_CHECK_VERSION(1,4,0)
-  VAHdrMetaDataHDR10 hdr_meta;
+  /* HDR tone mapping parameter buffers, most recently used first */
+  GQueue hdr_buffers;
 #endif
+
+  /* Pipeline parameters of the last processed frame. The VA buffer is
+     kept across frames, and the memory the parameters point to lives
+     here so that the buffer contents stay valid */
+  VABufferID pipeline_buffer;
+  VAProcPipelineParameterBuffer pipeline_param;
+  VARectangle pipeline_src_rect;
+  VARectangle pipeline_dst_rect;
+  VABufferID *pipeline_filters;
+  guint pipeline_num_filters;
+  VAProcPipelineCaps pipeline_caps;
+  guint pipeline_caps_valid:1;
+  guint pipeline_buffer_reuse:1;
+
+  /* deadline given to the display job scheduler */
+  GstClockTime job_deadline;
+
+  /* GPU priority: the highest value the driver takes, or 0, the value
+     to apply, and the serials of its last change and of the one the
+     VA context was updated to */
+  guint priority_max;
+  volatile gint priority_value;
+  volatile gint priority_serial;
+  gint priority_applied;
 };
 
 typedef struct _GstVaapiFilterClass GstVaapiFilterClass;
@@ -228,9 +257,9 @@ vpp_get_filters (GstVaapiFilter * filter, guint * num_filters_ptr)
 {
   VAProcFilterType *filters;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   filters = vpp_get_filters_unlocked (filter, num_filters_ptr);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return filters;
 }
 
@@ -279,9 +308,9 @@ vpp_get_filter_caps (GstVaapiFilter * filter, VAProcFilterType type,
 {
   gpointer caps;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   caps = vpp_get_filter_caps_unlocked (filter, type, cap_size, num_caps_ptr);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return caps;
 }
 
@@ -308,9 +337,9 @@ vpp_get_pipeline_caps_unlocked (GstVaapiFilter * filter)
 static void
 vpp_get_pipeline_caps (GstVaapiFilter * filter)
 {
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   vpp_get_pipeline_caps_unlocked (filter);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -742,6 +771,160 @@ error:
   }
 }
 
+/* Capabilities of the VPP implementation, which only depend on the
+   driver. They are attached to the GstVaapiDisplay on first use, so
+   that further filters on that display skip the VA queries */
+typedef struct
+{
+  GstVaapiFilterOp op;
+  gpointer va_caps;
+  guint va_num_caps;
+} FilterOpCaps;
+
+typedef struct
+{
+  GArray *ops;                  /* FilterOpCaps, in VA filters order */
+  guint32 mirror_flags;
+  guint32 rotation_flags;
+  GstVaapiConfigSurfaceAttributes *attribs;
+} FilterCapsSnapshot;
+
+static GMutex g_filter_caps_lock;
+
+static GQuark
+filter_caps_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    const GQuark quark = g_quark_from_static_string ("GstVaapiFilterCaps");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+static GstVaapiConfigSurfaceAttributes *
+surface_attributes_copy (const GstVaapiConfigSurfaceAttributes * attribs)
+{
+  GstVaapiConfigSurfaceAttributes *copy;
+
+  copy = g_slice_dup (GstVaapiConfigSurfaceAttributes, attribs);
+  if (attribs->formats) {
+    copy->formats = g_array_sized_new (FALSE, FALSE, sizeof (GstVideoFormat),
+        attribs->formats->len);
+    g_array_append_vals (copy->formats, attribs->formats->data,
+        attribs->formats->len);
+  }
+  return copy;
+}
+
+static void
+filter_caps_snapshot_free (FilterCapsSnapshot * snapshot)
+{
+  guint i;
+
+  if (snapshot->ops) {
+    for (i = 0; i < snapshot->ops->len; i++)
+      g_free (g_array_index (snapshot->ops, FilterOpCaps, i).va_caps);
+    g_array_unref (snapshot->ops);
+  }
+  if (snapshot->attribs)
+    gst_vaapi_config_surface_attributes_free (snapshot->attribs);
+  g_slice_free (FilterCapsSnapshot, snapshot);
+}
+
+/* Returns the snapshot of @display, creating an empty one if needed.
+   Must be called with g_filter_caps_lock held */
+static FilterCapsSnapshot *
+filter_caps_snapshot_get (GstVaapiDisplay * display)
+{
+  FilterCapsSnapshot *snapshot;
+
+  snapshot = g_object_get_qdata (G_OBJECT (display), filter_caps_quark ());
+  if (!snapshot) {
+    snapshot = g_slice_new0 (FilterCapsSnapshot);
+    g_object_set_qdata_full (G_OBJECT (display), filter_caps_quark (),
+        snapshot, (GDestroyNotify) filter_caps_snapshot_free);
+  }
+  return snapshot;
+}
+
+/* Records the operations determined for @filter */
+static void
+filter_caps_store_operations (GstVaapiFilter * filter, GPtrArray * ops)
+{
+  FilterCapsSnapshot *snapshot;
+  guint i;
+
+  g_mutex_lock (&g_filter_caps_lock);
+  snapshot = filter_caps_snapshot_get (filter->display);
+  if (!snapshot->ops) {
+    snapshot->ops = g_array_sized_new (FALSE, FALSE, sizeof (FilterOpCaps),
+        ops->len);
+    for (i = 0; i < ops->len; i++) {
+      GstVaapiFilterOpData *const op_data = g_ptr_array_index (ops, i);
+      FilterOpCaps op_caps;
+
+      op_caps.op = op_data->op;
+      op_caps.va_num_caps = op_data->va_num_caps;
+      op_caps.va_caps = op_data->va_caps ? g_memdup (op_data->va_caps,
+          op_data->va_cap_size * op_data->va_num_caps) : NULL;
+      g_array_append_val (snapshot->ops, op_caps);
+    }
+    snapshot->mirror_flags = filter->mirror_flags;
+    snapshot->rotation_flags = filter->rotation_flags;
+  }
+  g_mutex_unlock (&g_filter_caps_lock);
+}
+
+/* Rebuilds the operations of @filter from the display snapshot, if any */
+static GPtrArray *
+filter_caps_load_operations (GstVaapiFilter * filter)
+{
+  FilterCapsSnapshot *snapshot;
+  GPtrArray *ops = NULL;
+  guint i;
+
+  g_mutex_lock (&g_filter_caps_lock);
+  snapshot = g_object_get_qdata (G_OBJECT (filter->display),
+      filter_caps_quark ());
+  if (!snapshot || !snapshot->ops)
+    goto done;
+
+  ensure_properties ();
+
+  ops = g_ptr_array_new_full (snapshot->ops->len, op_data_unref);
+  for (i = 0; i < snapshot->ops->len; i++) {
+    const FilterOpCaps *const op_caps =
+        &g_array_index (snapshot->ops, FilterOpCaps, i);
+    GstVaapiFilterOpData *op_data;
+
+    op_data = op_data_new (op_caps->op, g_properties[op_caps->op]);
+    if (!op_data)
+      goto error;
+    if (op_caps->va_caps) {
+      op_data->va_caps = g_memdup (op_caps->va_caps,
+          op_data->va_cap_size * op_caps->va_num_caps);
+      op_data->va_num_caps = op_caps->va_num_caps;
+    }
+    g_ptr_array_add (ops, op_data);
+  }
+  filter->mirror_flags = snapshot->mirror_flags;
+  filter->rotation_flags = snapshot->rotation_flags;
+
+done:
+  g_mutex_unlock (&g_filter_caps_lock);
+  return ops;
+
+  /* ERRORS */
+error:
+  {
+    g_ptr_array_unref (ops);
+    ops = NULL;
+    goto done;
+  }
+}
+
 /* Get the ordered list of operations, based on VA/VPP queries */
 static GPtrArray *
 get_operations_ordered (GstVaapiFilter * filter, GPtrArray * default_ops)
@@ -797,6 +980,7 @@ get_operations_ordered (GstVaapiFilter * filter, GPtrArray * default_ops)
   }
 
   vpp_get_pipeline_caps (filter);
+  filter_caps_store_operations (filter, ops);
 
   if (filter->operations)
     g_ptr_array_unref (filter->operations);
@@ -827,6 +1011,11 @@ get_operations (GstVaapiFilter * filter)
   if (filter && filter->operations)
     return g_ptr_array_ref (filter->operations);
 
+  if (filter && (ops = filter_caps_load_operations (filter))) {
+    filter->operations = g_ptr_array_ref (ops);
+    return ops;
+  }
+
   ops = get_operations_default ();
   if (!ops)
     return NULL;
@@ -926,9 +1115,9 @@ op_set_generic (GstVaapiFilter * filter, GstVaapiFilterOpData * op_data,
 {
   gboolean success = FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   success = op_set_generic_unlocked (filter, op_data, value);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return success;
 }
 
@@ -1031,9 +1220,9 @@ op_set_color_balance (GstVaapiFilter * filter, GstVaapiFilterOpData * op_data,
 {
   gboolean success = FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   success = op_set_color_balance_unlocked (filter, op_data, value);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return success;
 }
 
@@ -1080,9 +1269,9 @@ op_set_deinterlace (GstVaapiFilter * filter, GstVaapiFilterOpData * op_data,
 {
   gboolean success = FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   success = op_set_deinterlace_unlocked (filter, op_data, method, flags);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return success;
 }
 
@@ -1113,9 +1302,9 @@ op_set_skintone_level (GstVaapiFilter * filter,
 {
   gboolean success = FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   success = op_set_skintone_level_unlocked (filter, op_data, value);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return success;
 }
 
@@ -1142,9 +1331,9 @@ op_set_skintone (GstVaapiFilter * filter, GstVaapiFilterOpData * op_data,
 {
   gboolean success = FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   success = op_set_skintone_unlocked (filter, op_data, enhance);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
   return success;
 }
 #endif
@@ -1189,9 +1378,9 @@ op_set_hdr_tone_map (GstVaapiFilter * filter, GstVaapiFilterOpData * op_data,
     gboolean value)
 {
   gboolean success = FALSE;
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   success = op_set_hdr_tone_map_unlocked (filter, op_data, value);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
 
   return success;
 }
@@ -1201,19 +1390,23 @@ deint_refs_set (GArray * refs, GstVaapiSurface ** surfaces, guint num_surfaces)
 {
   guint i;
 
+  VASurfaceID *ids;
+
   if (num_surfaces > 0 && !surfaces)
     return FALSE;
 
+  /* Fill the array in place: it keeps its allocation across fields */
+  g_array_set_size (refs, num_surfaces);
+  ids = (VASurfaceID *) refs->data;
   for (i = 0; i < num_surfaces; i++)
-    g_array_append_val (refs, GST_VAAPI_SURFACE_ID (surfaces[i]));
+    ids[i] = GST_VAAPI_SURFACE_ID (surfaces[i]);
   return TRUE;
 }
 
-static void
+static inline void
 deint_refs_clear (GArray * refs)
 {
-  if (refs->len > 0)
-    g_array_remove_range (refs, 0, refs->len);
+  g_array_set_size (refs, 0);
 }
 
 static inline void
@@ -1230,12 +1423,29 @@ deint_refs_clear_all (GstVaapiFilter * filter)
 static gboolean
 ensure_attributes (GstVaapiFilter * filter)
 {
+  FilterCapsSnapshot *snapshot;
+
   if (G_LIKELY (filter->attribs))
     return TRUE;
 
+  g_mutex_lock (&g_filter_caps_lock);
+  snapshot = filter_caps_snapshot_get (filter->display);
+  if (snapshot->attribs)
+    filter->attribs = surface_attributes_copy (snapshot->attribs);
+  g_mutex_unlock (&g_filter_caps_lock);
+  if (filter->attribs)
+    return TRUE;
+
   filter->attribs = gst_vaapi_config_surface_attributes_get (filter->display,
       filter->va_config);
-  return (filter->attribs != NULL);
+  if (!filter->attribs)
+    return FALSE;
+
+  g_mutex_lock (&g_filter_caps_lock);
+  if (!snapshot->attribs)
+    snapshot->attribs = surface_attributes_copy (filter->attribs);
+  g_mutex_unlock (&g_filter_caps_lock);
+  return TRUE;
 }
 
 static inline gboolean
@@ -1262,6 +1472,209 @@ find_format (GstVaapiFilter * filter, GstVideoFormat format)
   return FALSE;
 }
 
+/* ------------------------------------------------------------------------- */
+/* --- HDR Tone Mapping Profiles                                         --- */
+/* ------------------------------------------------------------------------- */
+
+#if VA_CHECK_VERSION(1,4,0)
+/* Number of HDR parameter buffers kept per filter */
+#define HDR_BUFFER_CACHE_SIZE 4
+
+/* HDR10 metadata set, shared by all filters of a display. The VA
+   parameter buffers point to it, so it has to outlive them */
+typedef struct
+{
+  VAHdrMetaDataHDR10 meta;
+  volatile gint ref_count;
+  GstVaapiDisplay *display;
+} HdrProfile;
+
+typedef struct
+{
+  HdrProfile *profile;
+  VABufferID va_buffer;
+} HdrBuffer;
+
+/* Registry of HDR profiles, attached to the GstVaapiDisplay. It does not
+   hold any reference to the profiles, which remove themselves from it
+   when they are released */
+static GMutex g_hdr_profiles_lock;
+
+static GQuark
+hdr_profiles_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    const GQuark quark = g_quark_from_static_string ("GstVaapiHdrProfiles");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+static guint
+hdr_profile_hash (gconstpointer key)
+{
+  const guint8 *const data = key;
+  guint i, hash = 5381;
+
+  for (i = 0; i < sizeof (VAHdrMetaDataHDR10); i++)
+    hash = (hash << 5) + hash + data[i];
+  return hash;
+}
+
+static gboolean
+hdr_profile_equal (gconstpointer a, gconstpointer b)
+{
+  return memcmp (a, b, sizeof (VAHdrMetaDataHDR10)) == 0;
+}
+
+/* Returns a new reference to the profile matching @meta */
+static HdrProfile *
+hdr_profile_lookup (GstVaapiDisplay * display, const VAHdrMetaDataHDR10 * meta)
+{
+  GHashTable *profiles;
+  HdrProfile *profile;
+
+  g_mutex_lock (&g_hdr_profiles_lock);
+  profiles = g_object_get_qdata (G_OBJECT (display), hdr_profiles_quark ());
+  if (!profiles) {
+    profiles = g_hash_table_new (hdr_profile_hash, hdr_profile_equal);
+    g_object_set_qdata_full (G_OBJECT (display), hdr_profiles_quark (),
+        profiles, (GDestroyNotify) g_hash_table_unref);
+  }
+
+  profile = g_hash_table_lookup (profiles, meta);
+  if (profile) {
+    g_atomic_int_inc (&profile->ref_count);
+  } else {
+    profile = g_slice_new (HdrProfile);
+    profile->meta = *meta;
+    profile->ref_count = 1;
+    profile->display = display;
+    g_hash_table_add (profiles, profile);
+  }
+  g_mutex_unlock (&g_hdr_profiles_lock);
+  return profile;
+}
+
+static void
+hdr_profile_unref (HdrProfile * profile)
+{
+  GHashTable *profiles;
+
+  g_mutex_lock (&g_hdr_profiles_lock);
+  if (g_atomic_int_dec_and_test (&profile->ref_count)) {
+    profiles = g_object_get_qdata (G_OBJECT (profile->display),
+        hdr_profiles_quark ());
+    if (profiles)
+      g_hash_table_remove (profiles, profile);
+    g_slice_free (HdrProfile, profile);
+  }
+  g_mutex_unlock (&g_hdr_profiles_lock);
+}
+
+static void
+hdr_buffer_free (GstVaapiFilter * filter, HdrBuffer * hdr_buffer)
+{
+  vaapi_destroy_buffer (filter->va_display, &hdr_buffer->va_buffer);
+  hdr_profile_unref (hdr_buffer->profile);
+  g_slice_free (HdrBuffer, hdr_buffer);
+}
+
+/* Destroys the cached parameter buffers, including the one the HDR
+   operation may currently use */
+static void
+hdr_buffers_clear (GstVaapiFilter * filter)
+{
+  GstVaapiFilterOpData *op_data = NULL;
+  HdrBuffer *hdr_buffer;
+  guint i;
+
+  for (i = 0; filter->operations && i < filter->operations->len; i++) {
+    GstVaapiFilterOpData *const data = g_ptr_array_index (filter->operations,
+        i);
+    if (data->op == GST_VAAPI_FILTER_OP_HDR_TONE_MAP)
+      op_data = data;
+  }
+
+  while ((hdr_buffer = g_queue_pop_head (&filter->hdr_buffers))) {
+    if (op_data && op_data->va_buffer == hdr_buffer->va_buffer)
+      op_data->va_buffer = VA_INVALID_ID;
+    hdr_buffer_free (filter, hdr_buffer);
+  }
+}
+
+static gboolean
+hdr_buffers_contain (GstVaapiFilter * filter, VABufferID va_buffer)
+{
+  GList *l;
+
+  for (l = filter->hdr_buffers.head; l != NULL; l = l->next) {
+    if (((HdrBuffer *) l->data)->va_buffer == va_buffer)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Looks up the parameter buffer for @meta, or creates and fills a new
+   one, and moves it to the front of the cache */
+static HdrBuffer *
+hdr_buffers_ensure (GstVaapiFilter * filter, GstVaapiFilterOpData * op_data,
+    const VAHdrMetaDataHDR10 * meta)
+{
+  VAProcFilterParameterBufferHDRToneMapping *buf;
+  HdrBuffer *hdr_buffer;
+  GList *l;
+
+  for (l = filter->hdr_buffers.head; l != NULL; l = l->next) {
+    hdr_buffer = l->data;
+    if (hdr_profile_equal (&hdr_buffer->profile->meta, meta)) {
+      g_queue_unlink (&filter->hdr_buffers, l);
+      g_queue_push_head_link (&filter->hdr_buffers, l);
+      return hdr_buffer;
+    }
+  }
+
+  hdr_buffer = g_slice_new (HdrBuffer);
+  hdr_buffer->profile = hdr_profile_lookup (filter->display, meta);
+  hdr_buffer->va_buffer = VA_INVALID_ID;
+
+  /* Adopt the buffer the operation was enabled with, if not cached yet */
+  if (op_data->va_buffer != VA_INVALID_ID &&
+      !hdr_buffers_contain (filter, op_data->va_buffer))
+    hdr_buffer->va_buffer = op_data->va_buffer;
+  else if (!vaapi_create_buffer (filter->va_display, filter->va_context,
+          VAProcFilterParameterBufferType, op_data->va_buffer_size, NULL,
+          &hdr_buffer->va_buffer, NULL))
+    goto error;
+
+  buf = vaapi_map_buffer (filter->va_display, hdr_buffer->va_buffer);
+  if (!buf)
+    goto error;
+
+  buf->type = op_data->va_type;
+  buf->data.metadata_type = op_data->va_subtype;
+  buf->data.metadata = &hdr_buffer->profile->meta;
+  buf->data.metadata_size = sizeof (hdr_buffer->profile->meta);
+  vaapi_unmap_buffer (filter->va_display, hdr_buffer->va_buffer, NULL);
+
+  g_queue_push_head (&filter->hdr_buffers, hdr_buffer);
+  while (g_queue_get_length (&filter->hdr_buffers) > HDR_BUFFER_CACHE_SIZE)
+    hdr_buffer_free (filter, g_queue_pop_tail (&filter->hdr_buffers));
+  return hdr_buffer;
+
+  /* ERRORS */
+error:
+  {
+    if (op_data->va_buffer == hdr_buffer->va_buffer)
+      op_data->va_buffer = VA_INVALID_ID;
+    hdr_buffer_free (filter, hdr_buffer);
+    return NULL;
+  }
+}
+#endif
+
 /* ------------------------------------------------------------------------- */
 /* --- Interface                                                         --- */
 /* ------------------------------------------------------------------------- */
@@ -1271,7 +1684,16 @@ gst_vaapi_filter_init (GstVaapiFilter * filter)
 {
   filter->va_config = VA_INVALID_ID;
   filter->va_context = VA_INVALID_ID;
+  g_rec_mutex_init (&filter->lock);
+  filter->pipeline_buffer = VA_INVALID_ID;
+  /* Setting GST_VAAPI_DISABLE_VPP_BUFFER_REUSE brings back one pipeline
+     buffer per frame, e.g. to benchmark both paths */
+  filter->pipeline_buffer_reuse =
+      !g_getenv ("GST_VAAPI_DISABLE_VPP_BUFFER_REUSE");
   filter->format = DEFAULT_FORMAT;
+  filter->background_color = 0xff000000;
+  filter->job_deadline = GST_CLOCK_TIME_NONE;
+  filter->priority_value = -1;
 
   filter->forward_references =
       g_array_sized_new (FALSE, FALSE, sizeof (VASurfaceID), 4);
@@ -1284,20 +1706,32 @@ static gboolean
 gst_vaapi_filter_initialize (GstVaapiFilter * filter)
 {
   VAStatus va_status;
+  GstClockTime record_start;
 
   if (!filter->display)
     return FALSE;
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   va_status = vaCreateConfig (filter->va_display, VAProfileNone,
       VAEntrypointVideoProc, NULL, 0, &filter->va_config);
+  GST_VAAPI_VA_RECORD_END (record_start, filter->va_display,
+      GST_VAAPI_VA_RECORD_CREATE_CONFIG, va_status, VAProfileNone,
+      VAEntrypointVideoProc, filter->va_config);
   if (!vaapi_check_status (va_status, "vaCreateConfig() [VPP]"))
     return FALSE;
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   va_status = vaCreateContext (filter->va_display, filter->va_config, 0, 0, 0,
       NULL, 0, &filter->va_context);
+  GST_VAAPI_VA_RECORD_END (record_start, filter->va_display,
+      GST_VAAPI_VA_RECORD_CREATE_CONTEXT, va_status, filter->va_config, 0, 0,
+      0, filter->va_context);
   if (!vaapi_check_status (va_status, "vaCreateContext() [VPP]"))
     return FALSE;
 
+  filter->priority_max = gst_vaapi_get_context_priority_max (filter->display,
+      VAProfileNone, VAEntrypointVideoProc);
+
   gst_video_colorimetry_from_string (&filter->input_colorimetry, NULL);
   gst_video_colorimetry_from_string (&filter->output_colorimetry, NULL);
 
@@ -1308,12 +1742,17 @@ static void
 gst_vaapi_filter_finalize (GObject * object)
 {
   GstVaapiFilter *const filter = GST_VAAPI_FILTER (object);
+  GstClockTime record_start;
+  VAStatus va_status;
   guint i;
 
   if (!filter->display)
     goto bail;
 
   GST_VAAPI_DISPLAY_LOCK (filter->display);
+#if VA_CHECK_VERSION(1,4,0)
+  hdr_buffers_clear (filter);
+#endif
   if (filter->operations) {
     for (i = 0; i < filter->operations->len; i++) {
       GstVaapiFilterOpData *const op_data =
@@ -1323,14 +1762,22 @@ gst_vaapi_filter_finalize (GObject * object)
     g_ptr_array_unref (filter->operations);
     filter->operations = NULL;
   }
+  vaapi_destroy_buffer (filter->va_display, &filter->pipeline_buffer);
+  g_clear_pointer (&filter->pipeline_filters, g_free);
 
   if (filter->va_context != VA_INVALID_ID) {
-    vaDestroyContext (filter->va_display, filter->va_context);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
+    va_status = vaDestroyContext (filter->va_display, filter->va_context);
+    GST_VAAPI_VA_RECORD_END (record_start, filter->va_display,
+        GST_VAAPI_VA_RECORD_DESTROY_CONTEXT, va_status, filter->va_context);
     filter->va_context = VA_INVALID_ID;
   }
 
   if (filter->va_config != VA_INVALID_ID) {
-    vaDestroyConfig (filter->va_display, filter->va_config);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
+    va_status = vaDestroyConfig (filter->va_display, filter->va_config);
+    GST_VAAPI_VA_RECORD_END (record_start, filter->va_display,
+        GST_VAAPI_VA_RECORD_DESTROY_CONFIG, va_status, filter->va_config);
     filter->va_config = VA_INVALID_ID;
   }
   GST_VAAPI_DISPLAY_UNLOCK (filter->display);
@@ -1352,6 +1799,7 @@ bail:
     filter->attribs = NULL;
   }
 
+  g_rec_mutex_clear (&filter->lock);
   G_OBJECT_CLASS (gst_vaapi_filter_parent_class)->finalize (object);
 }
 
@@ -1664,37 +2112,102 @@ gst_vaapi_filter_fill_color_standards (GstVaapiFilter * filter,
 #endif
 }
 
-/**
- * gst_vaapi_filter_process:
- * @filter: a #GstVaapiFilter
- * @src_surface: the source @GstVaapiSurface
- * @dst_surface: the destination @GstVaapiSurface
- * @flags: #GstVaapiSurfaceRenderFlags that apply to @src_surface
- *
- * Applies the operations currently defined in the @filter to
- * @src_surface and return the output in @dst_surface. The order of
- * operations is determined in a way that suits best the underlying
- * hardware. i.e. the only guarantee held is the generated outcome,
- * not any specific order of operations.
- *
- * Return value: a #GstVaapiFilterStatus
- */
-static GstVaapiFilterStatus
-gst_vaapi_filter_process_unlocked (GstVaapiFilter * filter,
-    GstVaapiSurface * src_surface, GstVaapiSurface * dst_surface, guint flags)
+/* Validates the pipeline caps, only when the set of enabled filters
+   changed since the last frame */
+static gboolean
+ensure_pipeline_caps (GstVaapiFilter * filter, const VABufferID * filters,
+    guint num_filters)
+{
+  VAStatus va_status;
+
+  if (filter->pipeline_caps_valid
+      && filter->pipeline_num_filters == num_filters
+      && memcmp (filter->pipeline_filters, filters,
+          num_filters * sizeof (*filters)) == 0)
+    return TRUE;
+
+  if (!filter->pipeline_filters)
+    filter->pipeline_filters =
+        g_new (VABufferID, filter->operations->len + 1);
+  memcpy (filter->pipeline_filters, filters, num_filters * sizeof (*filters));
+  filter->pipeline_num_filters = num_filters;
+
+  filter->pipeline_caps_valid = FALSE;
+  va_status = vaQueryVideoProcPipelineCaps (filter->va_display,
+      filter->va_context, filter->pipeline_filters, num_filters,
+      &filter->pipeline_caps);
+  if (!vaapi_check_status (va_status, "vaQueryVideoProcPipelineCaps()"))
+    return FALSE;
+
+  filter->pipeline_caps_valid = TRUE;
+  return TRUE;
+}
+
+/* Submits the priority set with gst_vaapi_filter_set_priority(), once,
+   along with the picture being processed */
+static void
+apply_priority (GstVaapiFilter * filter)
+{
+  const gint serial = g_atomic_int_get (&filter->priority_serial);
+
+  if (serial == filter->priority_applied)
+    return;
+  if (!vaapi_render_context_priority (filter->va_display, filter->va_context,
+          g_atomic_int_get (&filter->priority_value)))
+    GST_WARNING ("failed to update the VPP priority");
+  filter->priority_applied = serial;
+}
+
+/* Uploads @pipeline_param into the VA buffer kept from the last frame.
+   With an unchanged configuration, only the source surface is patched */
+static gboolean
+ensure_pipeline_buffer (GstVaapiFilter * filter,
+    const VAProcPipelineParameterBuffer * pipeline_param)
+{
+  VAProcPipelineParameterBuffer *buf;
+  gboolean same_config;
+
+  if (!filter->pipeline_buffer_reuse)
+    vaapi_destroy_buffer (filter->va_display, &filter->pipeline_buffer);
+
+  if (filter->pipeline_buffer == VA_INVALID_ID) {
+    if (!vaapi_create_buffer (filter->va_display, filter->va_context,
+            VAProcPipelineParameterBufferType, sizeof (*pipeline_param),
+            pipeline_param, &filter->pipeline_buffer, NULL))
+      return FALSE;
+    memcpy (&filter->pipeline_param, pipeline_param, sizeof (*pipeline_param));
+    return TRUE;
+  }
+
+  filter->pipeline_param.surface = pipeline_param->surface;
+  same_config = memcmp (&filter->pipeline_param, pipeline_param,
+      sizeof (*pipeline_param)) == 0;
+
+  buf = vaapi_map_buffer (filter->va_display, filter->pipeline_buffer);
+  if (!buf)
+    return FALSE;
+  if (same_config)
+    buf->surface = pipeline_param->surface;
+  else
+    *buf = *pipeline_param;
+  vaapi_unmap_buffer (filter->va_display, filter->pipeline_buffer, NULL);
+
+  memcpy (&filter->pipeline_param, pipeline_param, sizeof (*pipeline_param));
+  return TRUE;
+}
+
+/* Builds the pipeline parameters that apply to @src_surface, all but
+   the output region */
+static gboolean
+build_pipeline_param (GstVaapiFilter * filter, GstVaapiSurface * src_surface,
+    guint flags, VAProcPipelineParameterBuffer * pipeline_param)
 {
-  VAProcPipelineParameterBuffer *pipeline_param = NULL;
-  VABufferID pipeline_param_buf_id = VA_INVALID_ID;
   VABufferID filters[N_PROPERTIES];
-  VAProcPipelineCaps pipeline_caps;
+  const VAProcPipelineCaps *const pipeline_caps = &filter->pipeline_caps;
+  VARectangle *const src_rect = &filter->pipeline_src_rect;
   guint i, num_filters = 0;
-  VAStatus va_status;
-  VARectangle src_rect, dst_rect;
   guint va_mirror = 0, va_rotation = 0;
 
-  if (!ensure_operations (filter))
-    return GST_VAAPI_FILTER_STATUS_ERROR_ALLOCATION_FAILED;
-
   /* Build surface region (source) */
   if (filter->use_crop_rect) {
     const GstVaapiRectangle *const crop_rect = &filter->crop_rect;
@@ -1703,38 +2216,17 @@ gst_vaapi_filter_process_unlocked (GstVaapiFilter * filter,
             GST_VAAPI_SURFACE_WIDTH (src_surface)) ||
         (crop_rect->y + crop_rect->height >
             GST_VAAPI_SURFACE_HEIGHT (src_surface)))
-      goto error;
-
-    src_rect.x = crop_rect->x;
-    src_rect.y = crop_rect->y;
-    src_rect.width = crop_rect->width;
-    src_rect.height = crop_rect->height;
-  } else {
-    src_rect.x = 0;
-    src_rect.y = 0;
-    src_rect.width = GST_VAAPI_SURFACE_WIDTH (src_surface);
-    src_rect.height = GST_VAAPI_SURFACE_HEIGHT (src_surface);
-  }
-
-  /* Build output region (target) */
-  if (filter->use_target_rect) {
-    const GstVaapiRectangle *const target_rect = &filter->target_rect;
-
-    if ((target_rect->x + target_rect->width >
-            GST_VAAPI_SURFACE_WIDTH (dst_surface)) ||
-        (target_rect->y + target_rect->height >
-            GST_VAAPI_SURFACE_HEIGHT (dst_surface)))
-      goto error;
+      return FALSE;
 
-    dst_rect.x = target_rect->x;
-    dst_rect.y = target_rect->y;
-    dst_rect.width = target_rect->width;
-    dst_rect.height = target_rect->height;
+    src_rect->x = crop_rect->x;
+    src_rect->y = crop_rect->y;
+    src_rect->width = crop_rect->width;
+    src_rect->height = crop_rect->height;
   } else {
-    dst_rect.x = 0;
-    dst_rect.y = 0;
-    dst_rect.width = GST_VAAPI_SURFACE_WIDTH (dst_surface);
-    dst_rect.height = GST_VAAPI_SURFACE_HEIGHT (dst_surface);
+    src_rect->x = 0;
+    src_rect->y = 0;
+    src_rect->width = GST_VAAPI_SURFACE_WIDTH (src_surface);
+    src_rect->height = GST_VAAPI_SURFACE_HEIGHT (src_surface);
   }
 
   for (i = 0, num_filters = 0; i < filter->operations->len; i++) {
@@ -1745,33 +2237,26 @@ gst_vaapi_filter_process_unlocked (GstVaapiFilter * filter,
     if (op_data->va_buffer == VA_INVALID_ID) {
       GST_ERROR ("invalid VA buffer for operation %s",
           g_param_spec_get_name (op_data->pspec));
-      goto error;
+      return FALSE;
     }
     filters[num_filters++] = op_data->va_buffer;
   }
 
   /* Validate pipeline caps */
-  va_status = vaQueryVideoProcPipelineCaps (filter->va_display,
-      filter->va_context, filters, num_filters, &pipeline_caps);
-  if (!vaapi_check_status (va_status, "vaQueryVideoProcPipelineCaps()"))
-    goto error;
-
-  if (!vaapi_create_buffer (filter->va_display, filter->va_context,
-          VAProcPipelineParameterBufferType, sizeof (*pipeline_param),
-          NULL, &pipeline_param_buf_id, (gpointer *) & pipeline_param))
-    goto error;
+  if (!ensure_pipeline_caps (filter, filters, num_filters))
+    return FALSE;
 
   memset (pipeline_param, 0, sizeof (*pipeline_param));
   pipeline_param->surface = GST_VAAPI_SURFACE_ID (src_surface);
-  pipeline_param->surface_region = &src_rect;
+  pipeline_param->surface_region = src_rect;
 
   gst_vaapi_filter_fill_color_standards (filter, pipeline_param);
 
-  pipeline_param->output_region = &dst_rect;
-  pipeline_param->output_background_color = 0xff000000;
+  pipeline_param->output_region = &filter->pipeline_dst_rect;
+  pipeline_param->output_background_color = filter->background_color;
   pipeline_param->filter_flags = from_GstVaapiSurfaceRenderFlags (flags) |
       from_GstVaapiScaleMethod (filter->scale_method);
-  pipeline_param->filters = filters;
+  pipeline_param->filters = filter->pipeline_filters;
   pipeline_param->num_filters = num_filters;
 
   from_GstVideoOrientationMethod (filter->video_direction, &va_mirror,
@@ -1788,7 +2273,7 @@ gst_vaapi_filter_process_unlocked (GstVaapiFilter * filter,
         filter->forward_references->data;
     pipeline_param->num_forward_references =
         MIN (filter->forward_references->len,
-        pipeline_caps.num_forward_references);
+        pipeline_caps->num_forward_references);
   } else {
     pipeline_param->forward_references = NULL;
     pipeline_param->num_forward_references = 0;
@@ -1799,46 +2284,154 @@ gst_vaapi_filter_process_unlocked (GstVaapiFilter * filter,
         filter->backward_references->data;
     pipeline_param->num_backward_references =
         MIN (filter->backward_references->len,
-        pipeline_caps.num_backward_references);
+        pipeline_caps->num_backward_references);
   } else {
     pipeline_param->backward_references = NULL;
     pipeline_param->num_backward_references = 0;
   }
+  return TRUE;
+}
 
-  vaapi_unmap_buffer (filter->va_display, pipeline_param_buf_id, NULL);
+/* Runs the pipeline described by @pipeline_param into @dst_surface */
+static gboolean
+submit_pipeline (GstVaapiFilter * filter,
+    const VAProcPipelineParameterBuffer * pipeline_param,
+    GstVaapiSurface * dst_surface)
+{
+  VARectangle *const dst_rect = &filter->pipeline_dst_rect;
+  VAStatus va_status;
+  GstClockTime record_start;
 
+  /* Build output region (target) */
+  if (filter->use_target_rect) {
+    const GstVaapiRectangle *const target_rect = &filter->target_rect;
+
+    if ((target_rect->x + target_rect->width >
+            GST_VAAPI_SURFACE_WIDTH (dst_surface)) ||
+        (target_rect->y + target_rect->height >
+            GST_VAAPI_SURFACE_HEIGHT (dst_surface)))
+      return FALSE;
+
+    dst_rect->x = target_rect->x;
+    dst_rect->y = target_rect->y;
+    dst_rect->width = target_rect->width;
+    dst_rect->height = target_rect->height;
+  } else {
+    dst_rect->x = 0;
+    dst_rect->y = 0;
+    dst_rect->width = GST_VAAPI_SURFACE_WIDTH (dst_surface);
+    dst_rect->height = GST_VAAPI_SURFACE_HEIGHT (dst_surface);
+  }
+
+  if (!ensure_pipeline_buffer (filter, pipeline_param))
+    return FALSE;
+
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   va_status = vaBeginPicture (filter->va_display, filter->va_context,
       GST_VAAPI_SURFACE_ID (dst_surface));
+  GST_VAAPI_VA_RECORD_END (record_start, filter->va_display,
+      GST_VAAPI_VA_RECORD_BEGIN_PICTURE, va_status, filter->va_context,
+      GST_VAAPI_SURFACE_ID (dst_surface));
   if (!vaapi_check_status (va_status, "vaBeginPicture()"))
-    goto error;
+    return FALSE;
+
+  apply_priority (filter);
 
+  /* The pipeline parameters hold pointers, their contents are not
+     recorded and the replay tool only accounts for VPP pictures */
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   va_status = vaRenderPicture (filter->va_display, filter->va_context,
-      &pipeline_param_buf_id, 1);
+      &filter->pipeline_buffer, 1);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, filter->va_display,
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, va_status, &filter->pipeline_buffer,
+      1, filter->va_context);
   if (!vaapi_check_status (va_status, "vaRenderPicture()"))
-    goto error;
+    return FALSE;
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   va_status = vaEndPicture (filter->va_display, filter->va_context);
+  GST_VAAPI_VA_RECORD_END (record_start, filter->va_display,
+      GST_VAAPI_VA_RECORD_END_PICTURE, va_status, filter->va_context);
   if (!vaapi_check_status (va_status, "vaEndPicture()"))
+    return FALSE;
+
+  GST_VAAPI_TRACE_GPU (filter, dst_surface, GST_CLOCK_TIME_NONE);
+  return TRUE;
+}
+
+/* Overrides the source region of the pipeline with @region */
+static gboolean
+set_pipeline_src_region (GstVaapiFilter * filter,
+    GstVaapiSurface * src_surface, const GstVaapiRectangle * region)
+{
+  VARectangle *const src_rect = &filter->pipeline_src_rect;
+
+  if (region->width == 0 || region->height == 0 ||
+      region->x + region->width > GST_VAAPI_SURFACE_WIDTH (src_surface) ||
+      region->y + region->height > GST_VAAPI_SURFACE_HEIGHT (src_surface))
+    return FALSE;
+
+  src_rect->x = region->x;
+  src_rect->y = region->y;
+  src_rect->width = region->width;
+  src_rect->height = region->height;
+  return TRUE;
+}
+
+static GstVaapiFilterStatus
+gst_vaapi_filter_process_unlocked (GstVaapiFilter * filter,
+    GstVaapiSurface * src_surface, const GstVaapiRectangle * src_regions,
+    GstVaapiSurface ** dst_surfaces, guint num_dst_surfaces, guint flags)
+{
+  VAProcPipelineParameterBuffer pipeline_param;
+  guint i;
+
+  if (!ensure_operations (filter))
+    return GST_VAAPI_FILTER_STATUS_ERROR_ALLOCATION_FAILED;
+
+  if (!build_pipeline_param (filter, src_surface, flags, &pipeline_param))
     goto error;
 
+  for (i = 0; i < num_dst_surfaces; i++) {
+    if (src_regions &&
+        !set_pipeline_src_region (filter, src_surface, &src_regions[i]))
+      goto error;
+    if (!submit_pipeline (filter, &pipeline_param, dst_surfaces[i]))
+      goto error;
+  }
+
   deint_refs_clear_all (filter);
-  vaapi_destroy_buffer (filter->va_display, &pipeline_param_buf_id);
   return GST_VAAPI_FILTER_STATUS_SUCCESS;
 
   /* ERRORS */
 error:
   {
     deint_refs_clear_all (filter);
-    vaapi_destroy_buffer (filter->va_display, &pipeline_param_buf_id);
     return GST_VAAPI_FILTER_STATUS_ERROR_OPERATION_FAILED;
   }
 }
 
+/**
+ * gst_vaapi_filter_process:
+ * @filter: a #GstVaapiFilter
+ * @src_surface: the source @GstVaapiSurface
+ * @dst_surface: the destination @GstVaapiSurface
+ * @flags: #GstVaapiSurfaceRenderFlags that apply to @src_surface
+ *
+ * Applies the operations currently defined in the @filter to
+ * @src_surface and return the output in @dst_surface. The order of
+ * operations is determined in a way that suits best the underlying
+ * hardware. i.e. the only guarantee held is the generated outcome,
+ * not any specific order of operations.
+ *
+ * Return value: a #GstVaapiFilterStatus
+ */
 GstVaapiFilterStatus
 gst_vaapi_filter_process (GstVaapiFilter * filter,
     GstVaapiSurface * src_surface, GstVaapiSurface * dst_surface, guint flags)
 {
   GstVaapiFilterStatus status;
+  gboolean scheduled;
 
   g_return_val_if_fail (filter != NULL,
       GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
@@ -1847,13 +2440,161 @@ gst_vaapi_filter_process (GstVaapiFilter * filter,
   g_return_val_if_fail (dst_surface != NULL,
       GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  scheduled = gst_vaapi_display_job_begin (filter->display,
+      filter->job_deadline);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   status = gst_vaapi_filter_process_unlocked (filter,
-      src_surface, dst_surface, flags);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+      src_surface, NULL, &dst_surface, 1, flags);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
+  if (scheduled)
+    gst_vaapi_display_job_end (filter->display);
+  return status;
+}
+
+/**
+ * gst_vaapi_filter_process_multi:
+ * @filter: a #GstVaapiFilter
+ * @src_surface: the source @GstVaapiSurface
+ * @dst_surfaces: (array length=num_dst_surfaces): the destination
+ *   #GstVaapiSurface objects
+ * @num_dst_surfaces: the number of destination surfaces
+ * @flags: #GstVaapiSurfaceRenderFlags that apply to @src_surface
+ *
+ * Applies the operations currently defined in the @filter to
+ * @src_surface, once for each of the @dst_surfaces. The outputs may
+ * differ in size and format, each one is scaled to fit its
+ * destination surface, or the target rectangle if one is set.
+ *
+ * This is equivalent to calling gst_vaapi_filter_process() for each
+ * destination, but the display is locked once, and the filter
+ * operations and pipeline caps are only validated once.
+ *
+ * Return value: a #GstVaapiFilterStatus
+ */
+GstVaapiFilterStatus
+gst_vaapi_filter_process_multi (GstVaapiFilter * filter,
+    GstVaapiSurface * src_surface, GstVaapiSurface ** dst_surfaces,
+    guint num_dst_surfaces, guint flags)
+{
+  GstVaapiFilterStatus status;
+  gboolean scheduled;
+
+  g_return_val_if_fail (filter != NULL,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (src_surface != NULL,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (dst_surfaces != NULL || num_dst_surfaces == 0,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+
+  scheduled = gst_vaapi_display_job_begin (filter->display,
+      filter->job_deadline);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
+  status = gst_vaapi_filter_process_unlocked (filter,
+      src_surface, NULL, dst_surfaces, num_dst_surfaces, flags);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
+  if (scheduled)
+    gst_vaapi_display_job_end (filter->display);
+  return status;
+}
+
+/**
+ * gst_vaapi_filter_process_regions:
+ * @filter: a #GstVaapiFilter
+ * @src_surface: the source @GstVaapiSurface
+ * @src_regions: (array length=num_regions): the regions of
+ *   @src_surface to process
+ * @dst_surfaces: (array length=num_regions): the destination
+ *   #GstVaapiSurface objects, one for each region
+ * @num_regions: the number of regions
+ * @flags: #GstVaapiSurfaceRenderFlags that apply to @src_surface
+ *
+ * Like gst_vaapi_filter_process_multi(), but each destination surface
+ * receives its own region of @src_surface, which overrides the
+ * cropping rectangle. This is meant to extract many patches from a
+ * single frame, e.g. the regions of interest found by a detector.
+ *
+ * Return value: a #GstVaapiFilterStatus
+ */
+GstVaapiFilterStatus
+gst_vaapi_filter_process_regions (GstVaapiFilter * filter,
+    GstVaapiSurface * src_surface, const GstVaapiRectangle * src_regions,
+    GstVaapiSurface ** dst_surfaces, guint num_regions, guint flags)
+{
+  GstVaapiFilterStatus status;
+  gboolean scheduled;
+
+  g_return_val_if_fail (filter != NULL,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (src_surface != NULL,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (src_regions != NULL || num_regions == 0,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+  g_return_val_if_fail (dst_surfaces != NULL || num_regions == 0,
+      GST_VAAPI_FILTER_STATUS_ERROR_INVALID_PARAMETER);
+
+  scheduled = gst_vaapi_display_job_begin (filter->display,
+      filter->job_deadline);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
+  status = gst_vaapi_filter_process_unlocked (filter,
+      src_surface, src_regions, dst_surfaces, num_regions, flags);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
+  if (scheduled)
+    gst_vaapi_display_job_end (filter->display);
   return status;
 }
 
+/**
+ * gst_vaapi_filter_set_job_deadline:
+ * @filter: a #GstVaapiFilter
+ * @deadline: the clock time the next frames should be processed by,
+ *   or %GST_CLOCK_TIME_NONE
+ *
+ * Sets the deadline the next processing jobs are scheduled with when
+ * the #GstVaapiDisplay:job-scheduling of the display is enabled.
+ */
+void
+gst_vaapi_filter_set_job_deadline (GstVaapiFilter * filter,
+    GstClockTime deadline)
+{
+  g_return_if_fail (filter != NULL);
+
+  filter->job_deadline = deadline;
+}
+
+/**
+ * gst_vaapi_filter_set_priority:
+ * @filter: a #GstVaapiFilter
+ * @priority: the #GstVaapiPriority
+ *
+ * Sets the GPU priority the driver schedules the processing jobs of
+ * @filter with, relative to the other VA contexts. It takes effect
+ * from the next processed frame. This function can be called from
+ * any thread.
+ *
+ * Return value: %TRUE if the driver supports context priorities
+ */
+gboolean
+gst_vaapi_filter_set_priority (GstVaapiFilter * filter,
+    GstVaapiPriority priority)
+{
+  gint value;
+
+  g_return_val_if_fail (filter != NULL, FALSE);
+
+  if (filter->priority_max == 0)
+    return FALSE;
+
+  value = gst_vaapi_priority_to_va_value (priority, filter->priority_max,
+      g_atomic_int_get (&filter->priority_serial) != 0);
+  if (value < 0 || value == g_atomic_int_get (&filter->priority_value))
+    return TRUE;
+
+  GST_DEBUG ("VPP priority %d of %u", value, filter->priority_max);
+  g_atomic_int_set (&filter->priority_value, value);
+  g_atomic_int_inc (&filter->priority_serial);
+  return TRUE;
+}
+
 /**
  * gst_vaapi_filter_get_formats:
  * @filter: a #GstVaapiFilter
@@ -2011,6 +2752,26 @@ gst_vaapi_filter_set_target_rectangle (GstVaapiFilter * filter,
   return TRUE;
 }
 
+/**
+ * gst_vaapi_filter_set_background_color:
+ * @filter: a #GstVaapiFilter
+ * @argb: the color, as 0xAARRGGBB
+ *
+ * Sets the color the destination surface is filled with outside of the
+ * target rectangle, e.g. to letterbox the output. The default is
+ * opaque black.
+ *
+ * Return value: %TRUE if the operation is supported, %FALSE otherwise.
+ */
+gboolean
+gst_vaapi_filter_set_background_color (GstVaapiFilter * filter, guint32 argb)
+{
+  g_return_val_if_fail (filter != NULL, FALSE);
+
+  filter->background_color = argb;
+  return TRUE;
+}
+
 /**
  * gst_vaapi_filter_set_denoising_level:
  * @filter: a #GstVaapiFilter
@@ -2439,9 +3200,9 @@ gst_vaapi_filter_set_colorimetry (GstVaapiFilter * filter,
 
   g_return_val_if_fail (filter != NULL, FALSE);
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   result = gst_vaapi_filter_set_colorimetry_unlocked (filter, input, output);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
 
   return result;
 }
@@ -2470,44 +3231,41 @@ gst_vaapi_filter_set_hdr_tone_map_meta_unlocked (GstVaapiFilter * filter,
 {
 #if VA_CHECK_VERSION(1,4,0)
   GstVaapiFilterOpData *op_data;
-  VAProcFilterParameterBufferHDRToneMapping *buf;
-  VAHdrMetaDataHDR10 *meta = &filter->hdr_meta;
+  HdrBuffer *hdr_buffer;
+  VAHdrMetaDataHDR10 meta;
 
   op_data = find_operation (filter, GST_VAAPI_FILTER_OP_HDR_TONE_MAP);
 
   if (!op_data)
     return FALSE;
 
-  meta->display_primaries_x[0] = minfo->display_primaries[1].x;
-  meta->display_primaries_x[1] = minfo->display_primaries[2].x;
-  meta->display_primaries_x[2] = minfo->display_primaries[0].x;
+  /* Zero the padding too, the metadata is compared bytewise */
+  memset (&meta, 0, sizeof (meta));
 
-  meta->display_primaries_y[0] = minfo->display_primaries[1].y;
-  meta->display_primaries_y[1] = minfo->display_primaries[2].y;
-  meta->display_primaries_y[2] = minfo->display_primaries[0].y;
+  meta.display_primaries_x[0] = minfo->display_primaries[1].x;
+  meta.display_primaries_x[1] = minfo->display_primaries[2].x;
+  meta.display_primaries_x[2] = minfo->display_primaries[0].x;
 
-  meta->white_point_x = minfo->white_point.x;
-  meta->white_point_y = minfo->white_point.y;
+  meta.display_primaries_y[0] = minfo->display_primaries[1].y;
+  meta.display_primaries_y[1] = minfo->display_primaries[2].y;
+  meta.display_primaries_y[2] = minfo->display_primaries[0].y;
 
-  meta->max_display_mastering_luminance =
+  meta.white_point_x = minfo->white_point.x;
+  meta.white_point_y = minfo->white_point.y;
+
+  meta.max_display_mastering_luminance =
       minfo->max_display_mastering_luminance;
-  meta->min_display_mastering_luminance =
+  meta.min_display_mastering_luminance =
       minfo->min_display_mastering_luminance;
 
-  meta->max_content_light_level = linfo->max_content_light_level;
-  meta->max_pic_average_light_level = linfo->max_frame_average_light_level;
+  meta.max_content_light_level = linfo->max_content_light_level;
+  meta.max_pic_average_light_level = linfo->max_frame_average_light_level;
 
-  buf = vaapi_map_buffer (filter->va_display, op_data->va_buffer);
-  if (!buf)
+  hdr_buffer = hdr_buffers_ensure (filter, op_data, &meta);
+  if (!hdr_buffer)
     return FALSE;
 
-  buf->type = op_data->va_type;
-  buf->data.metadata_type = op_data->va_subtype;
-  buf->data.metadata = meta;
-  buf->data.metadata_size = sizeof (meta);
-
-  vaapi_unmap_buffer (filter->va_display, op_data->va_buffer, NULL);
-
+  op_data->va_buffer = hdr_buffer->va_buffer;
   return TRUE;
 #else
   return FALSE;
@@ -2522,6 +3280,12 @@ gst_vaapi_filter_set_hdr_tone_map_meta_unlocked (GstVaapiFilter * filter,
  *
  * Sets the input HDR meta data used for tone mapping.
  *
+ * The parameters for the last few metadata sets are kept, and the
+ * metadata itself is shared by all the filters of the display, so
+ * switching between recurring sets does not involve uploading them
+ * again. This makes it cheap enough to call for every frame, e.g. for
+ * dynamic metadata, without reconfiguring @filter.
+ *
  * Return value: %TRUE if the operation is supported, %FALSE otherwise.
  */
 gboolean
@@ -2534,10 +3298,10 @@ gst_vaapi_filter_set_hdr_tone_map_meta (GstVaapiFilter * filter,
   g_return_val_if_fail (minfo != NULL, FALSE);
   g_return_val_if_fail (linfo != NULL, FALSE);
 
-  GST_VAAPI_DISPLAY_LOCK (filter->display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (filter->display, &filter->lock);
   status =
       gst_vaapi_filter_set_hdr_tone_map_meta_unlocked (filter, minfo, linfo);
-  GST_VAAPI_DISPLAY_UNLOCK (filter->display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (filter->display, &filter->lock);
 
   return status;
 }
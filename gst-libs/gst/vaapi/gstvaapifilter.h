@@ -210,6 +210,24 @@ GstVaapiFilterStatus
 gst_vaapi_filter_process (GstVaapiFilter * filter,
     GstVaapiSurface * src_surface, GstVaapiSurface * dst_surface, guint flags);
 
+GstVaapiFilterStatus
+gst_vaapi_filter_process_multi (GstVaapiFilter * filter,
+    GstVaapiSurface * src_surface, GstVaapiSurface ** dst_surfaces,
+    guint num_dst_surfaces, guint flags);
+
+GstVaapiFilterStatus
+gst_vaapi_filter_process_regions (GstVaapiFilter * filter,
+    GstVaapiSurface * src_surface, const GstVaapiRectangle * src_regions,
+    GstVaapiSurface ** dst_surfaces, guint num_regions, guint flags);
+
+void
+gst_vaapi_filter_set_job_deadline (GstVaapiFilter * filter,
+    GstClockTime deadline);
+
+gboolean
+gst_vaapi_filter_set_priority (GstVaapiFilter * filter,
+    GstVaapiPriority priority);
+
 GArray *
 gst_vaapi_filter_get_formats (GstVaapiFilter * filter);
 
@@ -230,6 +248,9 @@ gboolean
 gst_vaapi_filter_set_target_rectangle (GstVaapiFilter * filter,
     const GstVaapiRectangle * rect);
 
+gboolean
+gst_vaapi_filter_set_background_color (GstVaapiFilter * filter, guint32 argb);
+
 gboolean
 gst_vaapi_filter_set_denoising_level (GstVaapiFilter * filter, gfloat level);
 
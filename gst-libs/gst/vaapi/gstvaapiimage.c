@@ -30,8 +30,11 @@
 #include "sysdeps.h"
 #include "gstvaapicompat.h"
 #include "gstvaapiutils.h"
+#include "gstvaapiutils_copy.h"
 #include "gstvaapiimage.h"
 #include "gstvaapiimage_priv.h"
+#include "gstvaapidisplay_priv.h"
+#include "gstvaapivarecord.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -119,6 +122,7 @@ gst_vaapi_image_free (GstVaapiImage * image)
   GstVaapiDisplay *const display = GST_VAAPI_IMAGE_DISPLAY (image);
   VAImageID image_id;
   VAStatus status;
+  GstClockTime record_start;
 
   _gst_vaapi_image_unmap (image);
 
@@ -127,12 +131,18 @@ gst_vaapi_image_free (GstVaapiImage * image)
 
   if (image_id != VA_INVALID_ID) {
     GST_VAAPI_DISPLAY_LOCK (display);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
     status = vaDestroyImage (GST_VAAPI_DISPLAY_VADISPLAY (display), image_id);
+    GST_VAAPI_VA_RECORD_END (record_start,
+        GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_DESTROY_IMAGE, status, image_id);
     GST_VAAPI_DISPLAY_UNLOCK (display);
     if (!vaapi_check_status (status, "vaDestroyImage()"))
       GST_WARNING ("failed to destroy image %" GST_VAAPI_ID_FORMAT,
           GST_VAAPI_ID_ARGS (image_id));
     GST_VAAPI_IMAGE_ID (image) = VA_INVALID_ID;
+    gst_vaapi_display_account_resource (display,
+        GST_VAAPI_DISPLAY_RESOURCE_IMAGE, -1, image->accounted_size);
   }
 
   gst_vaapi_display_replace (&GST_VAAPI_IMAGE_DISPLAY (image), NULL);
@@ -215,6 +225,9 @@ gst_vaapi_image_create (GstVaapiImage * image, GstVideoFormat format,
 
   GST_DEBUG ("image %" GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (image_id));
   GST_VAAPI_IMAGE_ID (image) = image_id;
+  image->accounted_size = image->internal_image.data_size;
+  gst_vaapi_display_account_resource (GST_VAAPI_IMAGE_DISPLAY (image),
+      GST_VAAPI_DISPLAY_RESOURCE_IMAGE, 1, image->accounted_size);
   return TRUE;
 }
 
@@ -237,6 +250,8 @@ gst_vaapi_image_init (GstVaapiImage * image, GstVaapiDisplay * display)
   image->internal_format = image->format = GST_VIDEO_FORMAT_UNKNOWN;
   image->width = image->height = 0;
   image->is_linear = FALSE;
+  image->is_read_only = FALSE;
+  image->accounted_size = 0;
 }
 
 GST_DEFINE_MINI_OBJECT_TYPE (GstVaapiImage, gst_vaapi_image);
@@ -411,7 +426,10 @@ _gst_vaapi_image_set_image (GstVaapiImage * image, const VAImage * va_image)
   image->width = va_image->width;
   image->height = va_image->height;
 
+  /* Foreign images, e.g. derived from a surface, share its memory */
   GST_VAAPI_IMAGE_ID (image) = va_image->image_id;
+  gst_vaapi_display_account_resource (GST_VAAPI_IMAGE_DISPLAY (image),
+      GST_VAAPI_DISPLAY_RESOURCE_IMAGE, 1, image->accounted_size);
 
   /* Try to linearize image */
   if (!image->is_linear) {
@@ -570,6 +588,49 @@ gst_vaapi_image_map (GstVaapiImage * image)
   return _gst_vaapi_image_map (image, NULL);
 }
 
+/**
+ * gst_vaapi_image_map_read_only:
+ * @image: a #GstVaapiImage
+ *
+ * Maps the image data buffer for reading only. Drivers may then hand
+ * out a cached CPU mapping, and skip any write back on unmap. The
+ * pixels shall not be modified. A later gst_vaapi_image_map() call
+ * remaps the image for writing.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_image_map_read_only (GstVaapiImage * image)
+{
+  GstVaapiDisplay *display;
+  VAStatus status;
+
+  g_return_val_if_fail (image != NULL, FALSE);
+
+  /* Any mapping is good enough for reading */
+  if (_gst_vaapi_image_is_mapped (image))
+    return TRUE;
+
+  display = GST_VAAPI_IMAGE_DISPLAY (image);
+  if (!display)
+    return FALSE;
+
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
+#if VA_CHECK_VERSION(1,21,0)
+  status = vaMapBuffer2 (GST_VAAPI_DISPLAY_VADISPLAY (display),
+      image->image.buf, (void **) &image->image_data, VA_MAPBUFFER_FLAG_READ);
+#else
+  status = vaMapBuffer (GST_VAAPI_DISPLAY_VADISPLAY (display),
+      image->image.buf, (void **) &image->image_data);
+#endif
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
+  if (!vaapi_check_status (status, "vaMapBuffer()"))
+    return FALSE;
+
+  image->is_read_only = TRUE;
+  return TRUE;
+}
+
 gboolean
 _gst_vaapi_image_map (GstVaapiImage * image, GstVaapiImageRaw * raw_image)
 {
@@ -577,6 +638,10 @@ _gst_vaapi_image_map (GstVaapiImage * image, GstVaapiImageRaw * raw_image)
   VAStatus status;
   guint i;
 
+  /* A read-only mapping may not reach the surface once written to */
+  if (image->is_read_only && !_gst_vaapi_image_unmap (image))
+    return FALSE;
+
   if (_gst_vaapi_image_is_mapped (image))
     goto map_success;
 
@@ -584,10 +649,10 @@ _gst_vaapi_image_map (GstVaapiImage * image, GstVaapiImageRaw * raw_image)
   if (!display)
     return FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   status = vaMapBuffer (GST_VAAPI_DISPLAY_VADISPLAY (display),
       image->image.buf, (void **) &image->image_data);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaMapBuffer()"))
     return FALSE;
 
@@ -637,14 +702,15 @@ _gst_vaapi_image_unmap (GstVaapiImage * image)
   if (!display)
     return FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   status = vaUnmapBuffer (GST_VAAPI_DISPLAY_VADISPLAY (display),
       image->image.buf);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaUnmapBuffer()"))
     return FALSE;
 
   image->image_data = NULL;
+  image->is_read_only = FALSE;
   return TRUE;
 }
 
@@ -747,13 +813,7 @@ memcpy_pic (guchar * dst,
     guint dst_stride,
     const guchar * src, guint src_stride, guint len, guint height)
 {
-  guint i;
-
-  for (i = 0; i < height; i++) {
-    memcpy (dst, src, len);
-    dst += dst_stride;
-    src += src_stride;
-  }
+  gst_vaapi_copy_plane (dst, dst_stride, src, src_stride, len, height);
 }
 
 /* Copy NV12 images */
@@ -779,6 +839,30 @@ copy_image_NV12 (GstVaapiImageRaw * dst_image,
   memcpy_pic (dst, dst_stride, src, src_stride, rect->width, rect->height / 2);
 }
 
+/* Copy P010 images */
+static void
+copy_image_P010 (GstVaapiImageRaw * dst_image,
+    GstVaapiImageRaw * src_image, const GstVaapiRectangle * rect)
+{
+  guchar *dst, *src;
+  guint dst_stride, src_stride;
+
+  /* Y plane, 16 bits per sample */
+  dst_stride = dst_image->stride[0];
+  dst = dst_image->pixels[0] + rect->y * dst_stride + rect->x * 2;
+  src_stride = src_image->stride[0];
+  src = src_image->pixels[0] + rect->y * src_stride + rect->x * 2;
+  memcpy_pic (dst, dst_stride, src, src_stride, rect->width * 2, rect->height);
+
+  /* UV plane, interleaved 16-bit samples */
+  dst_stride = dst_image->stride[1];
+  dst = dst_image->pixels[1] + (rect->y / 2) * dst_stride + (rect->x & -2) * 2;
+  src_stride = src_image->stride[1];
+  src = src_image->pixels[1] + (rect->y / 2) * src_stride + (rect->x & -2) * 2;
+  memcpy_pic (dst, dst_stride, src, src_stride, rect->width * 2,
+      rect->height / 2);
+}
+
 /* Copy YV12 images */
 static void
 copy_image_YV12 (GstVaapiImageRaw * dst_image,
@@ -869,6 +953,9 @@ copy_image (GstVaapiImageRaw * dst_image,
     case GST_VIDEO_FORMAT_NV12:
       copy_image_NV12 (dst_image, src_image, rect);
       break;
+    case GST_VIDEO_FORMAT_P010_10LE:
+      copy_image_P010 (dst_image, src_image, rect);
+      break;
     case GST_VIDEO_FORMAT_YV12:
     case GST_VIDEO_FORMAT_I420:
       copy_image_YV12 (dst_image, src_image, rect);
@@ -1035,13 +1122,34 @@ gst_vaapi_image_update_from_raw (GstVaapiImage * image,
   return success;
 }
 
+/* Checks whether the VA buffers of two images hold the same layout,
+   so that their contents can be copied as a whole */
+static gboolean
+image_layouts_match (const VAImage * dst, const VAImage * src)
+{
+  guint i;
+
+  if (dst->format.fourcc != src->format.fourcc ||
+      dst->width != src->width || dst->height != src->height ||
+      dst->data_size != src->data_size || dst->num_planes != src->num_planes)
+    return FALSE;
+
+  for (i = 0; i < src->num_planes; i++) {
+    if (dst->pitches[i] != src->pitches[i] ||
+        dst->offsets[i] != src->offsets[i])
+      return FALSE;
+  }
+  return TRUE;
+}
+
 /**
  * gst_vaapi_image_copy:
  * @dst_image: the target #GstVaapiImage
  * @src_image: the source #GstVaapiImage
  *
  * Copies pixels data from @src_image to @dst_image. Both images shall
- * have the same format and size.
+ * have the same format and size. The copy engine of the GPU is used
+ * when the images share the same layout, and the driver supports it.
  *
  * Return value: %TRUE on success
  */
@@ -1054,6 +1162,13 @@ gst_vaapi_image_copy (GstVaapiImage * dst_image, GstVaapiImage * src_image)
   g_return_val_if_fail (dst_image != NULL, FALSE);
   g_return_val_if_fail (src_image != NULL, FALSE);
 
+  if (dst_image->display == src_image->display &&
+      !dst_image->image_data && !src_image->image_data &&
+      image_layouts_match (&dst_image->image, &src_image->image) &&
+      gst_vaapi_display_copy_object (dst_image->display, FALSE,
+          dst_image->image.buf, src_image->image.buf))
+    return TRUE;
+
   if (!_gst_vaapi_image_map (dst_image, &dst_image_raw))
     goto end;
   if (!_gst_vaapi_image_map (src_image, &src_image_raw))
@@ -135,6 +135,9 @@ gst_vaapi_image_is_mapped(GstVaapiImage *image);
 gboolean
 gst_vaapi_image_map(GstVaapiImage *image);
 
+gboolean
+gst_vaapi_image_map_read_only(GstVaapiImage *image);
+
 gboolean
 gst_vaapi_image_unmap(GstVaapiImage *image);
 
@@ -50,6 +50,8 @@ struct _GstVaapiImage {
     guint               width;
     guint               height;
     guint               is_linear       : 1;
+    guint               is_read_only    : 1;
+    guint               accounted_size;
 };
 
 /**
@@ -23,6 +23,109 @@
 #include <string.h>
 #include "gstvaapiminiobject.h"
 
+/* Classes that have a cache get a slot in the free lists of every
+   thread. An object freed by a thread goes to the free list of that
+   thread, whichever thread allocated it */
+#define CACHE_MAX_CLASSES       32
+#define CACHE_MAX_OBJECTS       64
+
+typedef struct
+{
+  gpointer head;
+  guint length;
+  guint size;
+} FreeList;
+
+typedef struct
+{
+  FreeList lists[CACHE_MAX_CLASSES];
+} ThreadCache;
+
+static gint g_cache_slots;
+
+static void
+thread_cache_free (gpointer data)
+{
+  ThreadCache *const tcache = data;
+  FreeList *list;
+  gpointer object;
+  guint i;
+
+  for (i = 0; i < CACHE_MAX_CLASSES; i++) {
+    list = &tcache->lists[i];
+    while ((object = list->head)) {
+      list->head = *(gpointer *) object;
+      g_slice_free1 (list->size, object);
+    }
+  }
+  g_slice_free (ThreadCache, tcache);
+}
+
+static GPrivate g_thread_cache = G_PRIVATE_INIT (thread_cache_free);
+
+/* Returns the free list of @klass for the current thread, or NULL if
+   it has no cache */
+static FreeList *
+cache_get_list (const GstVaapiMiniObjectClass * klass)
+{
+  GstVaapiMiniObjectCache *const cache = klass->cache;
+  ThreadCache *tcache;
+  FreeList *list;
+  gsize slot;
+
+  if (!cache)
+    return NULL;
+
+  /* Slots are numbered from 1, the classes beyond the last one are
+     not cached */
+  if (g_once_init_enter (&cache->slot)) {
+    slot = g_atomic_int_add (&g_cache_slots, 1) + 1;
+    g_once_init_leave (&cache->slot, MIN (slot, CACHE_MAX_CLASSES + 1));
+  }
+  slot = cache->slot;
+  if (G_UNLIKELY (slot > CACHE_MAX_CLASSES))
+    return NULL;
+
+  tcache = g_private_get (&g_thread_cache);
+  if (G_UNLIKELY (!tcache)) {
+    tcache = g_slice_new0 (ThreadCache);
+    g_private_set (&g_thread_cache, tcache);
+  }
+  list = &tcache->lists[slot - 1];
+  list->size = klass->size;
+  return list;
+}
+
+static gpointer
+cache_alloc (const GstVaapiMiniObjectClass * klass)
+{
+  FreeList *const list = cache_get_list (klass);
+  gpointer object;
+
+  if (!list || !list->head)
+    return g_slice_alloc (klass->size);
+
+  object = list->head;
+  list->head = *(gpointer *) object;
+  list->length--;
+  return object;
+}
+
+static void
+cache_free (const GstVaapiMiniObjectClass * klass, gpointer object)
+{
+  FreeList *const list = cache_get_list (klass);
+
+  if (!list || list->length >= CACHE_MAX_OBJECTS) {
+    g_slice_free1 (klass->size, object);
+    return;
+  }
+
+  *(gpointer *) object = list->head;
+  list->head = object;
+  list->length++;
+}
+
 static void
 gst_vaapi_mini_object_free (GstVaapiMiniObject * object)
 {
@@ -33,8 +136,10 @@ gst_vaapi_mini_object_free (GstVaapiMiniObject * object)
   if (klass->finalize)
     klass->finalize (object);
 
-  if (G_LIKELY (g_atomic_int_dec_and_test (&object->ref_count)))
-    g_slice_free1 (klass->size, object);
+  if (G_LIKELY (g_atomic_int_dec_and_test (&object->ref_count))) {
+    if (!klass->recycle || !klass->recycle (object))
+      cache_free (klass, object);
+  }
 }
 
 /**
@@ -65,7 +170,7 @@ gst_vaapi_mini_object_new (const GstVaapiMiniObjectClass * object_class)
 
   g_return_val_if_fail (object_class->size >= sizeof (*object), NULL);
 
-  object = g_slice_alloc (object_class->size);
+  object = cache_alloc (object_class);
   if (!object)
     return NULL;
 
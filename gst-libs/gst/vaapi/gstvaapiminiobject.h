@@ -29,6 +29,7 @@ G_BEGIN_DECLS
 
 typedef struct _GstVaapiMiniObject              GstVaapiMiniObject;
 typedef struct _GstVaapiMiniObjectClass         GstVaapiMiniObjectClass;
+typedef struct _GstVaapiMiniObjectCache         GstVaapiMiniObjectCache;
 
 /**
  * GST_VAAPI_MINI_OBJECT:
@@ -124,11 +125,30 @@ struct _GstVaapiMiniObject
   guint flags;
 };
 
+/**
+ * GstVaapiMiniObjectCache:
+ *
+ * The per-thread free lists of a #GstVaapiMiniObjectClass. This shall
+ * be statically allocated and zero-initialized, next to the class.
+ */
+struct _GstVaapiMiniObjectCache
+{
+  /*< private >*/
+  volatile gsize slot;
+};
+
 /**
  * GstVaapiMiniObjectClass:
  * @size: size in bytes of the #GstVaapiMiniObject, plus any
  *   additional data for derived classes
  * @finalize: function called to destroy data in derived classes
+ * @recycle: (optional): function called once the object is finalized
+ *   and no longer referenced, that may keep its memory for later reuse
+ *   instead of having it freed, in which case it returns %TRUE
+ * @cache: (optional): the #GstVaapiMiniObjectCache the memory of the
+ *   freed objects is kept in, for the next allocations from the same
+ *   thread, so that objects created and destroyed for every frame don't
+ *   go through the global allocator
  *
  * A #GstVaapiMiniObjectClass represents the base object class that
  * defines the size of the #GstVaapiMiniObject and utility function to
@@ -139,6 +159,8 @@ struct _GstVaapiMiniObjectClass
   /*< protected >*/
   guint size;
   GDestroyNotify finalize;
+  gboolean (*recycle) (gpointer object);
+  GstVaapiMiniObjectCache *cache;
 };
 
 GstVaapiMiniObject *
@@ -28,12 +28,34 @@
 #include "sysdeps.h"
 #include "gstvaapiparser_frame.h"
 
+/* Frames a pool keeps for reuse, along with their unit arrays */
+#define POOL_MAX_FRAMES 16
+
+struct _GstVaapiParserFramePool
+{
+  /*< private >*/
+  GstVaapiMiniObject parent_instance;
+
+  GMutex lock;
+  GstVaapiParserFrame *frames[POOL_MAX_FRAMES];
+  guint num_frames;
+  /* largest unit counts seen, to size the arrays of new frames */
+  guint max_pre_units;
+  guint max_units;
+  guint max_post_units;
+};
+
+static gboolean gst_vaapi_parser_frame_recycle (GstVaapiParserFrame * frame);
+
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_parser_frame_class (void)
 {
+  static GstVaapiMiniObjectCache GstVaapiParserFrameCache;
   static const GstVaapiMiniObjectClass GstVaapiParserFrameClass = {
-    sizeof (GstVaapiParserFrame),
-    (GDestroyNotify) gst_vaapi_parser_frame_free
+    .size = sizeof (GstVaapiParserFrame),
+    .finalize = (GDestroyNotify) gst_vaapi_parser_frame_free,
+    .recycle = (gpointer) gst_vaapi_parser_frame_recycle,
+    .cache = &GstVaapiParserFrameCache
   };
   return &GstVaapiParserFrameClass;
 }
@@ -48,52 +70,54 @@ alloc_units (GArray ** units_ptr, guint size)
   return units != NULL;
 }
 
+static void
+clear_units (GArray * units)
+{
+  guint i;
+
+  if (!units)
+    return;
+
+  for (i = 0; i < units->len; i++) {
+    GstVaapiDecoderUnit *const unit =
+        &g_array_index (units, GstVaapiDecoderUnit, i);
+    gst_vaapi_decoder_unit_clear (unit);
+  }
+  g_array_set_size (units, 0);
+}
+
 static inline void
 free_units (GArray ** units_ptr)
 {
   GArray *const units = *units_ptr;
-  guint i;
 
   if (units) {
-    for (i = 0; i < units->len; i++) {
-      GstVaapiDecoderUnit *const unit =
-          &g_array_index (units, GstVaapiDecoderUnit, i);
-      gst_vaapi_decoder_unit_clear (unit);
-    }
+    clear_units (units);
     g_array_unref (units);
     *units_ptr = NULL;
   }
 }
 
-/**
- * gst_vaapi_parser_frame_new:
- * @width: frame width in pixels
- * @height: frame height in pixels
- *
- * Creates a new #GstVaapiParserFrame object.
- *
- * Returns: The newly allocated #GstVaapiParserFrame
- */
-GstVaapiParserFrame *
-gst_vaapi_parser_frame_new (guint width, guint height)
+static GstVaapiParserFrame *
+parser_frame_new (guint num_pre_units, guint num_units, guint num_post_units)
 {
   GstVaapiParserFrame *frame;
-  guint num_slices;
 
   frame = (GstVaapiParserFrame *)
       gst_vaapi_mini_object_new (gst_vaapi_parser_frame_class ());
   if (!frame)
     return NULL;
 
-  if (!height)
-    height = 1088;
-  num_slices = (height + 15) / 16;
+  frame->units = NULL;
+  frame->pre_units = NULL;
+  frame->post_units = NULL;
+  frame->pool = NULL;
 
-  if (!alloc_units (&frame->pre_units, 16))
+  if (!alloc_units (&frame->pre_units, num_pre_units))
     goto error;
-  if (!alloc_units (&frame->units, num_slices))
+  if (!alloc_units (&frame->units, num_units))
     goto error;
-  if (!alloc_units (&frame->post_units, 1))
+  if (!alloc_units (&frame->post_units, num_post_units))
     goto error;
   frame->output_offset = 0;
   return frame;
@@ -106,12 +130,36 @@ error:
   }
 }
 
+static inline guint
+get_num_slices (guint height)
+{
+  if (!height)
+    height = 1088;
+  return (height + 15) / 16;
+}
+
+/**
+ * gst_vaapi_parser_frame_new:
+ * @width: frame width in pixels
+ * @height: frame height in pixels
+ *
+ * Creates a new #GstVaapiParserFrame object.
+ *
+ * Returns: The newly allocated #GstVaapiParserFrame
+ */
+GstVaapiParserFrame *
+gst_vaapi_parser_frame_new (guint width, guint height)
+{
+  return parser_frame_new (16, get_num_slices (height), 1);
+}
+
 /**
  * gst_vaapi_parser_frame_free:
  * @frame: a #GstVaapiParserFrame
  *
- * Deallocates any internal resources bound to the supplied decoder
- * @frame.
+ * Releases the units of the supplied decoder @frame. Its unit arrays
+ * are deallocated afterwards, unless its pool keeps them for the next
+ * frame.
  *
  * @note This is an internal function used to implement lightweight
  * sub-classes.
@@ -119,9 +167,144 @@ error:
 void
 gst_vaapi_parser_frame_free (GstVaapiParserFrame * frame)
 {
+  GstVaapiParserFramePool *const pool = frame->pool;
+
+  if (pool && frame->units) {
+    g_mutex_lock (&pool->lock);
+    pool->max_pre_units = MAX (pool->max_pre_units, frame->pre_units->len);
+    pool->max_units = MAX (pool->max_units, frame->units->len);
+    pool->max_post_units = MAX (pool->max_post_units, frame->post_units->len);
+    g_mutex_unlock (&pool->lock);
+  }
+
+  clear_units (frame->units);
+  clear_units (frame->pre_units);
+  clear_units (frame->post_units);
+}
+
+/* Hands the unreferenced @frame back to its pool, if it has room */
+static gboolean
+gst_vaapi_parser_frame_recycle (GstVaapiParserFrame * frame)
+{
+  GstVaapiParserFramePool *const pool = frame->pool;
+  gboolean kept = FALSE;
+
+  frame->pool = NULL;
+  if (pool) {
+    g_mutex_lock (&pool->lock);
+    if (frame->units && pool->num_frames < POOL_MAX_FRAMES) {
+      pool->frames[pool->num_frames++] = frame;
+      kept = TRUE;
+    }
+    g_mutex_unlock (&pool->lock);
+    gst_vaapi_mini_object_unref (GST_VAAPI_MINI_OBJECT (pool));
+  }
+  if (kept)
+    return TRUE;
+
   free_units (&frame->units);
   free_units (&frame->pre_units);
   free_units (&frame->post_units);
+  return FALSE;
+}
+
+static void
+gst_vaapi_parser_frame_pool_finalize (GstVaapiParserFramePool * pool)
+{
+  GstVaapiParserFrame *frame;
+  guint i;
+
+  for (i = 0; i < pool->num_frames; i++) {
+    frame = pool->frames[i];
+    free_units (&frame->units);
+    free_units (&frame->pre_units);
+    free_units (&frame->post_units);
+    g_slice_free (GstVaapiParserFrame, frame);
+  }
+  g_mutex_clear (&pool->lock);
+}
+
+/**
+ * gst_vaapi_parser_frame_pool_new:
+ *
+ * Creates a pool of #GstVaapiParserFrame objects. The frames it hands
+ * out come back to it once they are no longer referenced, with their
+ * unit arrays, which are sized after the largest frames seen so far.
+ *
+ * Returns: The newly allocated #GstVaapiParserFramePool
+ */
+GstVaapiParserFramePool *
+gst_vaapi_parser_frame_pool_new (void)
+{
+  static const GstVaapiMiniObjectClass GstVaapiParserFramePoolClass = {
+    .size = sizeof (GstVaapiParserFramePool),
+    .finalize = (GDestroyNotify) gst_vaapi_parser_frame_pool_finalize
+  };
+  GstVaapiParserFramePool *pool;
+
+  pool = (GstVaapiParserFramePool *)
+      gst_vaapi_mini_object_new0 (&GstVaapiParserFramePoolClass);
+  if (!pool)
+    return NULL;
+
+  g_mutex_init (&pool->lock);
+  return pool;
+}
+
+/**
+ * gst_vaapi_parser_frame_pool_unref:
+ * @pool: a #GstVaapiParserFramePool
+ *
+ * Releases a reference to @pool. The frames still in use keep it
+ * alive until they are released too.
+ */
+void
+gst_vaapi_parser_frame_pool_unref (GstVaapiParserFramePool * pool)
+{
+  gst_vaapi_mini_object_unref (GST_VAAPI_MINI_OBJECT (pool));
+}
+
+/**
+ * gst_vaapi_parser_frame_pool_get:
+ * @pool: a #GstVaapiParserFramePool
+ * @width: frame width in pixels
+ * @height: frame height in pixels
+ *
+ * Returns a #GstVaapiParserFrame from @pool, either one that was
+ * released or a new one.
+ *
+ * Returns: The #GstVaapiParserFrame, with a single reference
+ */
+GstVaapiParserFrame *
+gst_vaapi_parser_frame_pool_get (GstVaapiParserFramePool * pool,
+    guint width, guint height)
+{
+  GstVaapiParserFrame *frame = NULL;
+  guint num_pre_units, num_units, num_post_units;
+
+  g_return_val_if_fail (pool != NULL, NULL);
+
+  g_mutex_lock (&pool->lock);
+  if (pool->num_frames > 0)
+    frame = pool->frames[--pool->num_frames];
+  num_pre_units = MAX (pool->max_pre_units, 16);
+  num_units = MAX (pool->max_units, get_num_slices (height));
+  num_post_units = MAX (pool->max_post_units, 1);
+  g_mutex_unlock (&pool->lock);
+
+  if (frame) {
+    GST_VAAPI_MINI_OBJECT (frame)->ref_count = 1;
+    GST_VAAPI_MINI_OBJECT_FLAGS (frame) = 0;
+    frame->output_offset = 0;
+  } else {
+    frame = parser_frame_new (num_pre_units, num_units, num_post_units);
+    if (!frame)
+      return NULL;
+  }
+
+  frame->pool = (GstVaapiParserFramePool *)
+      gst_vaapi_mini_object_ref (GST_VAAPI_MINI_OBJECT (pool));
+  return frame;
 }
 
 /**
@@ -29,6 +29,7 @@
 G_BEGIN_DECLS
 
 typedef struct _GstVaapiParserFrame             GstVaapiParserFrame;
+typedef struct _GstVaapiParserFramePool         GstVaapiParserFramePool;
 
 #define GST_VAAPI_PARSER_FRAME(frame) \
     ((GstVaapiParserFrame *)(frame))
@@ -44,6 +45,7 @@ typedef struct _GstVaapiParserFrame             GstVaapiParserFrame;
  * @units: list of #GstVaapiDecoderUnit objects (slice data)
  * @pre_units: list of units to decode before GstVaapiDecoder:start_frame()
  * @post_units: list of units to decode after GstVaapiDecoder:end_frame()
+ * @pool: the #GstVaapiParserFramePool the frame returns to, if any
  *
  * An extension to #GstVideoCodecFrame with #GstVaapiDecoder specific
  * information. Decoder frames are usually attached to codec frames as
@@ -57,12 +59,26 @@ struct _GstVaapiParserFrame {
     GArray             *units;
     GArray             *pre_units;
     GArray             *post_units;
+    GstVaapiParserFramePool *pool;
 };
 
 G_GNUC_INTERNAL
 GstVaapiParserFrame *
 gst_vaapi_parser_frame_new(guint width, guint height);
 
+G_GNUC_INTERNAL
+GstVaapiParserFramePool *
+gst_vaapi_parser_frame_pool_new (void);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_parser_frame_pool_unref (GstVaapiParserFramePool * pool);
+
+G_GNUC_INTERNAL
+GstVaapiParserFrame *
+gst_vaapi_parser_frame_pool_get (GstVaapiParserFramePool * pool,
+    guint width, guint height);
+
 G_GNUC_INTERNAL
 void
 gst_vaapi_parser_frame_free(GstVaapiParserFrame *frame);
@@ -32,6 +32,7 @@
 #include "gstvaapiutils.h"
 #include "gstvaapisubpicture.h"
 #include "gstvaapiimage_priv.h"
+#include "gstvaapidisplay_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -73,6 +74,8 @@ gst_vaapi_subpicture_free_image (GstVaapiSubpicture * subpicture)
       GST_WARNING ("failed to destroy subpicture %" GST_VAAPI_ID_FORMAT,
           GST_VAAPI_ID_ARGS (subpicture_id));
     subpicture->object_id = VA_INVALID_ID;
+    gst_vaapi_display_account_resource (display,
+        GST_VAAPI_DISPLAY_RESOURCE_SUBPICTURE, -1, 0);
   }
 
   if (subpicture->image)
@@ -107,6 +110,9 @@ gst_vaapi_subpicture_bind_image (GstVaapiSubpicture * subpicture,
   GST_DEBUG ("subpicture %" GST_VAAPI_ID_FORMAT,
       GST_VAAPI_ID_ARGS (subpicture_id));
   subpicture->object_id = subpicture_id;
+  /* The pixels are held, and counted, by the bound image */
+  gst_vaapi_display_account_resource (display,
+      GST_VAAPI_DISPLAY_RESOURCE_SUBPICTURE, 1, 0);
   subpicture->image =
       (GstVaapiImage *) gst_mini_object_ref (GST_MINI_OBJECT_CAST (image));
   return TRUE;
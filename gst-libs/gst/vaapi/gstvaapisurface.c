@@ -32,10 +32,12 @@
 #include "gstvaapiutils.h"
 #include "gstvaapisurface.h"
 #include "gstvaapisurface_priv.h"
+#include "gstvaapidisplay_priv.h"
 #include "gstvaapicontext.h"
 #include "gstvaapiimage.h"
 #include "gstvaapiimage_priv.h"
 #include "gstvaapibufferproxy_priv.h"
+#include "gstvaapivarecord.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -65,12 +67,34 @@ gst_vaapi_surface_destroy_subpictures (GstVaapiSurface * surface)
   }
 }
 
+/* Estimates the memory held by @surface. Imported memory is owned by
+ * someone else and not counted */
+static gsize
+surface_get_data_size (GstVaapiSurface * surface)
+{
+  GstVideoFormat format = GST_VAAPI_SURFACE_FORMAT (surface);
+  GstVideoInfo vi;
+
+  if (surface->extbuf_proxy)
+    return 0;
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    format = gst_vaapi_video_format_from_chroma
+        (GST_VAAPI_SURFACE_CHROMA_TYPE (surface));
+  if (format == GST_VIDEO_FORMAT_UNKNOWN ||
+      !gst_video_info_set_format (&vi, format,
+          GST_VAAPI_SURFACE_WIDTH (surface),
+          GST_VAAPI_SURFACE_HEIGHT (surface)))
+    return 0;
+  return GST_VIDEO_INFO_SIZE (&vi);
+}
+
 static void
 gst_vaapi_surface_free (GstVaapiSurface * surface)
 {
   GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (surface);
   VASurfaceID surface_id;
   VAStatus status;
+  GstClockTime record_start;
 
   surface_id = GST_VAAPI_SURFACE_ID (surface);
   GST_DEBUG ("surface %" GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (surface_id));
@@ -79,13 +103,20 @@ gst_vaapi_surface_free (GstVaapiSurface * surface)
 
   if (surface_id != VA_INVALID_SURFACE) {
     GST_VAAPI_DISPLAY_LOCK (display);
+    record_start = GST_VAAPI_VA_RECORD_BEGIN ();
     status = vaDestroySurfaces (GST_VAAPI_DISPLAY_VADISPLAY (display),
         &surface_id, 1);
+    GST_VAAPI_VA_RECORD_END (record_start,
+        GST_VAAPI_DISPLAY_VADISPLAY (display),
+        GST_VAAPI_VA_RECORD_DESTROY_SURFACES, status, surface_id);
     GST_VAAPI_DISPLAY_UNLOCK (display);
     if (!vaapi_check_status (status, "vaDestroySurfaces()"))
       GST_WARNING ("failed to destroy surface %" GST_VAAPI_ID_FORMAT,
           GST_VAAPI_ID_ARGS (surface_id));
     GST_VAAPI_SURFACE_ID (surface) = VA_INVALID_SURFACE;
+    gst_vaapi_display_account_resource (display,
+        GST_VAAPI_DISPLAY_RESOURCE_SURFACE, -1,
+        surface_get_data_size (surface));
   }
   gst_vaapi_buffer_proxy_replace (&surface->extbuf_proxy, NULL);
   gst_vaapi_display_replace (&GST_VAAPI_SURFACE_DISPLAY (surface), NULL);
@@ -98,17 +129,23 @@ gst_vaapi_surface_init (GstVaapiSurface * surface,
     GstVaapiChromaType chroma_type, guint width, guint height)
 {
   GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (surface);
-  VASurfaceID surface_id;
+  VASurfaceID surface_id = VA_INVALID_SURFACE;
   VAStatus status;
   guint va_chroma_format;
+  GstClockTime record_start;
 
   va_chroma_format = from_GstVaapiChromaType (chroma_type);
   if (!va_chroma_format)
     goto error_unsupported_chroma_type;
 
   GST_VAAPI_DISPLAY_LOCK (display);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaCreateSurfaces (GST_VAAPI_DISPLAY_VADISPLAY (display),
       width, height, va_chroma_format, 1, &surface_id);
+  GST_VAAPI_VA_RECORD_END (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_VA_RECORD_CREATE_SURFACES, status, va_chroma_format, width,
+      height, surface_id);
   GST_VAAPI_DISPLAY_UNLOCK (display);
   if (!vaapi_check_status (status, "vaCreateSurfaces()"))
     return FALSE;
@@ -120,6 +157,8 @@ gst_vaapi_surface_init (GstVaapiSurface * surface,
 
   GST_DEBUG ("surface %" GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (surface_id));
   GST_VAAPI_SURFACE_ID (surface) = surface_id;
+  gst_vaapi_display_account_resource (display,
+      GST_VAAPI_DISPLAY_RESOURCE_SURFACE, 1, surface_get_data_size (surface));
   return TRUE;
 
   /* ERRORS */
@@ -140,6 +179,14 @@ get_usage_hint (guint alloc_flags)
   else if (alloc_flags & GST_VAAPI_SURFACE_ALLOC_FLAG_HINT_ENCODER)
     usage_hints = VA_SURFACE_ATTRIB_USAGE_HINT_ENCODER;
 
+  /* libva has no attribute for render compression: drivers keep
+   * compressed layouts for surfaces that only the media engines read
+   * and write, and resolve them when they are exported or mapped */
+  if ((alloc_flags & GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED)
+      && !(alloc_flags & GST_VAAPI_SURFACE_ALLOC_FLAG_LINEAR_STORAGE))
+    usage_hints |= VA_SURFACE_ATTRIB_USAGE_HINT_VPP_READ |
+        VA_SURFACE_ATTRIB_USAGE_HINT_VPP_WRITE;
+
   return usage_hints;
 }
 
@@ -149,9 +196,10 @@ gst_vaapi_surface_init_full (GstVaapiSurface * surface,
 {
   GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (surface);
   const GstVideoFormat format = GST_VIDEO_INFO_FORMAT (vip);
-  VASurfaceID surface_id;
+  VASurfaceID surface_id = VA_INVALID_SURFACE;
   VAStatus status;
   guint chroma_type, va_chroma_format, i;
+  GstClockTime record_start;
   const VAImageFormat *va_format;
   VASurfaceAttrib attribs[4], *attrib;
   VASurfaceAttribExternalBuffers extbuf = { 0, };
@@ -217,9 +265,14 @@ gst_vaapi_surface_init_full (GstVaapiSurface * surface,
   }
 
   GST_VAAPI_DISPLAY_LOCK (display);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaCreateSurfaces (GST_VAAPI_DISPLAY_VADISPLAY (display),
       va_chroma_format, extbuf.width, extbuf.height, &surface_id, 1,
       attribs, attrib - attribs);
+  GST_VAAPI_VA_RECORD_END (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_VA_RECORD_CREATE_SURFACES, status, va_chroma_format,
+      extbuf.width, extbuf.height, surface_id);
   GST_VAAPI_DISPLAY_UNLOCK (display);
   if (!vaapi_check_status (status, "vaCreateSurfaces()"))
     return FALSE;
@@ -231,6 +284,8 @@ gst_vaapi_surface_init_full (GstVaapiSurface * surface,
 
   GST_DEBUG ("surface %" GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (surface_id));
   GST_VAAPI_SURFACE_ID (surface) = surface_id;
+  gst_vaapi_display_account_resource (display,
+      GST_VAAPI_DISPLAY_RESOURCE_SURFACE, 1, surface_get_data_size (surface));
   return TRUE;
 
   /* ERRORS */
@@ -246,14 +301,19 @@ gst_vaapi_surface_init_from_buffer_proxy (GstVaapiSurface * surface,
 {
   GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (surface);
   GstVideoFormat format;
-  VASurfaceID surface_id;
+  VASurfaceID surface_id = VA_INVALID_SURFACE;
   VAStatus status;
   guint chroma_type, va_chroma_format;
+  GstClockTime record_start;
   const VAImageFormat *va_format;
   VASurfaceAttrib attribs[2], *attrib;
   VASurfaceAttribExternalBuffers extbuf = { 0, };
   unsigned long extbuf_handle;
   guint i, width, height;
+#if VA_CHECK_VERSION(1,1,0)
+  VADRMPRIMESurfaceDescriptor desc = { 0, };
+  const guint64 modifier = gst_vaapi_buffer_proxy_get_modifier (proxy);
+#endif
 
   format = GST_VIDEO_INFO_FORMAT (vip);
   width = GST_VIDEO_INFO_WIDTH (vip);
@@ -301,10 +361,43 @@ gst_vaapi_surface_init_from_buffer_proxy (GstVaapiSurface * surface,
       from_GstVaapiBufferMemoryType (GST_VAAPI_BUFFER_PROXY_TYPE (proxy));
   attrib++;
 
+#if VA_CHECK_VERSION(1,1,0)
+  /* Tiled or compressed dma-bufs need their modifier to be imported
+   * as they are, which only the PRIME_2 descriptor can carry */
+  if (GST_VAAPI_BUFFER_PROXY_TYPE (proxy) ==
+      GST_VAAPI_BUFFER_MEMORY_TYPE_DMA_BUF
+      && modifier != GST_VAAPI_DRM_FORMAT_MOD_INVALID
+      && modifier != GST_VAAPI_DRM_FORMAT_MOD_LINEAR) {
+    desc.fourcc = va_format->fourcc;
+    desc.width = width;
+    desc.height = height;
+    desc.num_objects = 1;
+    desc.objects[0].fd = extbuf_handle;
+    desc.objects[0].size = extbuf.data_size;
+    desc.objects[0].drm_format_modifier = modifier;
+    desc.num_layers = 1;
+    desc.layers[0].drm_format =
+        gst_vaapi_drm_format_from_va_fourcc (va_format->fourcc);
+    desc.layers[0].num_planes = extbuf.num_planes;
+    for (i = 0; i < extbuf.num_planes; i++) {
+      desc.layers[0].object_index[i] = 0;
+      desc.layers[0].offset[i] = extbuf.offsets[i];
+      desc.layers[0].pitch[i] = extbuf.pitches[i];
+    }
+    attribs[0].value.value.p = &desc;
+    attribs[1].value.value.i = VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2;
+  }
+#endif
+
   GST_VAAPI_DISPLAY_LOCK (display);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaCreateSurfaces (GST_VAAPI_DISPLAY_VADISPLAY (display),
       va_chroma_format, width, height, &surface_id, 1, attribs,
       attrib - attribs);
+  GST_VAAPI_VA_RECORD_END (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_VA_RECORD_CREATE_SURFACES, status, va_chroma_format, width,
+      height, surface_id);
   GST_VAAPI_DISPLAY_UNLOCK (display);
   if (!vaapi_check_status (status, "vaCreateSurfaces()"))
     return FALSE;
@@ -316,6 +409,8 @@ gst_vaapi_surface_init_from_buffer_proxy (GstVaapiSurface * surface,
 
   GST_DEBUG ("surface %" GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (surface_id));
   GST_VAAPI_SURFACE_ID (surface) = surface_id;
+  gst_vaapi_display_account_resource (display,
+      GST_VAAPI_DISPLAY_RESOURCE_SURFACE, 1, surface_get_data_size (surface));
   return TRUE;
 
   /* ERRORS */
@@ -511,6 +606,43 @@ error:
   }
 }
 
+/**
+ * gst_vaapi_surface_new_with_user_ptr:
+ * @display: a #GstVaapiDisplay
+ * @data: the system memory holding the pixels
+ * @info: the #GstVideoInfo structure defining the layout of @data
+ *
+ * Creates a new #GstVaapiSurface wrapping the system memory at @data,
+ * so that the hardware reads the pixels in place instead of having
+ * them copied into a VA surface. @data shall be page aligned, and stay
+ * valid and unmodified for as long as the surface is in use.
+ *
+ * Return value: the newly allocated #GstVaapiSurface object, or %NULL
+ *   if the driver does not support user pointer memory, or rejected
+ *   the layout
+ */
+GstVaapiSurface *
+gst_vaapi_surface_new_with_user_ptr (GstVaapiDisplay * display,
+    gpointer data, const GstVideoInfo * info)
+{
+  GstVaapiBufferProxy *proxy;
+  GstVaapiSurface *surface;
+
+  g_return_val_if_fail (data != NULL, NULL);
+  g_return_val_if_fail (info != NULL, NULL);
+
+  proxy = gst_vaapi_buffer_proxy_new ((guintptr) data,
+      GST_VAAPI_BUFFER_MEMORY_TYPE_USER_PTR, GST_VIDEO_INFO_SIZE (info), NULL,
+      NULL);
+  if (!proxy)
+    return NULL;
+
+  surface = gst_vaapi_surface_new_from_buffer_proxy (display, proxy, info);
+  /* Surface holds proxy's reference */
+  gst_vaapi_buffer_proxy_unref (proxy);
+  return surface;
+}
+
 /**
  * gst_vaapi_surface_get_id:
  * @surface: a #GstVaapiSurface
@@ -655,6 +787,7 @@ gst_vaapi_surface_derive_image (GstVaapiSurface * surface)
   VAImage va_image;
   VAStatus status;
   GstVaapiImage *image;
+  GstClockTime record_start;
 
   g_return_val_if_fail (surface != NULL, NULL);
 
@@ -662,10 +795,14 @@ gst_vaapi_surface_derive_image (GstVaapiSurface * surface)
   va_image.image_id = VA_INVALID_ID;
   va_image.buf = VA_INVALID_ID;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaDeriveImage (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_SURFACE_ID (surface), &va_image);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_VA_RECORD_END (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display), GST_VAAPI_VA_RECORD_DERIVE_IMAGE,
+      status, GST_VAAPI_SURFACE_ID (surface), va_image.image_id);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaDeriveImage()"))
     return NULL;
   if (va_image.image_id == VA_INVALID_ID || va_image.buf == VA_INVALID_ID)
@@ -712,10 +849,10 @@ gst_vaapi_surface_get_image (GstVaapiSurface * surface, GstVaapiImage * image)
   if (image_id == VA_INVALID_ID)
     return FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   status = vaGetImage (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_SURFACE_ID (surface), 0, 0, width, height, image_id);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaGetImage()"))
     return FALSE;
 
@@ -757,11 +894,11 @@ gst_vaapi_surface_put_image (GstVaapiSurface * surface, GstVaapiImage * image)
   if (image_id == VA_INVALID_ID)
     return FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   status = vaPutImage (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_SURFACE_ID (surface), image_id, 0, 0, width, height, 0, 0,
       width, height);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaPutImage()"))
     return FALSE;
 
@@ -946,6 +1083,7 @@ gst_vaapi_surface_sync (GstVaapiSurface * surface)
 {
   GstVaapiDisplay *display;
   VAStatus status;
+  GstClockTime record_start;
 
   g_return_val_if_fail (surface != NULL, FALSE);
 
@@ -953,16 +1091,60 @@ gst_vaapi_surface_sync (GstVaapiSurface * surface)
   if (!display)
     return FALSE;
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaSyncSurface (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_SURFACE_ID (surface));
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_VA_RECORD_END (record_start,
+      GST_VAAPI_DISPLAY_VADISPLAY (display), GST_VAAPI_VA_RECORD_SYNC_SURFACE,
+      status, GST_VAAPI_SURFACE_ID (surface));
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaSyncSurface()"))
     return FALSE;
 
   return TRUE;
 }
 
+/**
+ * gst_vaapi_surface_copy:
+ * @dst_surface: the target #GstVaapiSurface
+ * @src_surface: the source #GstVaapiSurface
+ *
+ * Copies the pixels of @src_surface into @dst_surface with the copy
+ * engine of the GPU, without involving the CPU. This is the fastest
+ * way to fill a surface wrapping system memory, e.g. from
+ * gst_vaapi_surface_new_with_user_ptr(), from a decoded surface. Both
+ * surfaces shall belong to the same display, and have the same format
+ * and size.
+ *
+ * Return value: %TRUE on success, %FALSE if the driver has no copy
+ *   engine support, in which case the caller is expected to copy the
+ *   pixels through images
+ */
+gboolean
+gst_vaapi_surface_copy (GstVaapiSurface * dst_surface,
+    GstVaapiSurface * src_surface)
+{
+  GstVaapiDisplay *display;
+
+  g_return_val_if_fail (dst_surface != NULL, FALSE);
+  g_return_val_if_fail (src_surface != NULL, FALSE);
+
+  display = GST_VAAPI_SURFACE_DISPLAY (dst_surface);
+  if (!display || display != GST_VAAPI_SURFACE_DISPLAY (src_surface))
+    return FALSE;
+  if (GST_VAAPI_SURFACE_WIDTH (dst_surface) !=
+      GST_VAAPI_SURFACE_WIDTH (src_surface)
+      || GST_VAAPI_SURFACE_HEIGHT (dst_surface) !=
+      GST_VAAPI_SURFACE_HEIGHT (src_surface)
+      || GST_VAAPI_SURFACE_FORMAT (dst_surface) !=
+      GST_VAAPI_SURFACE_FORMAT (src_surface))
+    return FALSE;
+
+  return gst_vaapi_display_copy_object (display, TRUE,
+      GST_VAAPI_SURFACE_ID (dst_surface), GST_VAAPI_SURFACE_ID (src_surface));
+}
+
 /**
  * gst_vaapi_surface_query_status:
  * @surface: a #GstVaapiSurface
@@ -983,10 +1165,10 @@ gst_vaapi_surface_query_status (GstVaapiSurface * surface,
 
   g_return_val_if_fail (surface != NULL, FALSE);
 
-  GST_VAAPI_DISPLAY_LOCK (display);
+  GST_VAAPI_DISPLAY_LOCK_CONTEXT (display, NULL);
   status = vaQuerySurfaceStatus (GST_VAAPI_DISPLAY_VADISPLAY (display),
       GST_VAAPI_SURFACE_ID (surface), &surface_status);
-  GST_VAAPI_DISPLAY_UNLOCK (display);
+  GST_VAAPI_DISPLAY_UNLOCK_CONTEXT (display, NULL);
   if (!vaapi_check_status (status, "vaQuerySurfaceStatus()"))
     return FALSE;
 
@@ -995,6 +1177,66 @@ gst_vaapi_surface_query_status (GstVaapiSurface * surface,
   return TRUE;
 }
 
+/* The subpicture last created for an overlay rectangle, attached to
+   it so that unchanged subtitles or OSD are not uploaded again */
+typedef struct
+{
+  GstVaapiDisplay *display;
+  guint seqnum;
+  GstVaapiSubpicture *subpicture;
+} CachedSubpicture;
+
+static GQuark
+cached_subpicture_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    gsize quark = (gsize) g_quark_from_static_string ("GstVaapiSubpicture");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+static void
+cached_subpicture_free (CachedSubpicture * cached)
+{
+  gst_vaapi_subpicture_unref (cached->subpicture);
+  g_slice_free (CachedSubpicture, cached);
+}
+
+/* Returns a new reference to the subpicture of @rect, which is only
+   created if the rectangle changed since it was last uploaded */
+static GstVaapiSubpicture *
+get_subpicture_from_overlay_rectangle (GstVaapiDisplay * display,
+    GstVideoOverlayRectangle * rect)
+{
+  const GQuark quark = cached_subpicture_quark ();
+  const guint seqnum = gst_video_overlay_rectangle_get_seqnum (rect);
+  CachedSubpicture *cached;
+  GstVaapiSubpicture *subpicture;
+
+  /* The subpicture holds a display reference, so the display pointer
+     cannot have been reused */
+  cached = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (rect), quark);
+  if (cached && cached->display == display && cached->seqnum == seqnum)
+    return (GstVaapiSubpicture *)
+        gst_mini_object_ref (GST_MINI_OBJECT_CAST (cached->subpicture));
+
+  subpicture = gst_vaapi_subpicture_new_from_overlay_rectangle (display, rect);
+  if (!subpicture)
+    return NULL;
+
+  cached = g_slice_new (CachedSubpicture);
+  cached->display = display;
+  cached->seqnum = seqnum;
+  cached->subpicture = (GstVaapiSubpicture *)
+      gst_mini_object_ref (GST_MINI_OBJECT_CAST (subpicture));
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (rect), quark, cached,
+      (GDestroyNotify) cached_subpicture_free);
+  return subpicture;
+}
+
 /**
  * gst_vaapi_surface_set_subpictures_from_composition:
  * @surface: a #GstVaapiSurface
@@ -1004,6 +1246,10 @@ gst_vaapi_surface_query_status (GstVaapiSurface * surface,
  * a NULL composition will clear all the current subpictures. Note that this
  * method will clear existing subpictures.
  *
+ * The subpicture created for each overlay rectangle is kept along with
+ * the rectangle, and gets associated again as is with any surface the
+ * same rectangle is shown on afterwards, until its seqnum changes.
+ *
  * Return value: %TRUE on success
  */
 gboolean
@@ -1034,8 +1280,7 @@ gst_vaapi_surface_set_subpictures_from_composition (GstVaapiSurface * surface,
     GstVaapiSubpicture *subpicture;
 
     rect = gst_video_overlay_composition_get_rectangle (composition, n);
-    subpicture = gst_vaapi_subpicture_new_from_overlay_rectangle (display,
-        rect);
+    subpicture = get_subpicture_from_overlay_rectangle (display, rect);
     if (subpicture == NULL) {
       GST_WARNING ("could not create subpicture for rectangle %p", rect);
       return FALSE;
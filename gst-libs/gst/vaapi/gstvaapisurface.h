@@ -167,6 +167,10 @@ typedef enum
  * @GST_VAAPI_SURFACE_ALLOC_FLAG_HINT_DECODER: Surface used by video
  *   decoder
  * @GST_VAAPI_SURFACE_ALLOC_FLAG_HINT_ENCODER: Surface used by encoder
+ * @GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED: Surface only accessed by
+ *   the VA engines of the same display, which lets the driver pick a
+ *   compressed layout. Ignored along with
+ *   @GST_VAAPI_SURFACE_ALLOC_FLAG_LINEAR_STORAGE.
  *
  * The set of optional allocation flags for gst_vaapi_surface_new_full().
  */
@@ -177,6 +181,7 @@ typedef enum
   GST_VAAPI_SURFACE_ALLOC_FLAG_FIXED_OFFSETS    = 1 << 2,
   GST_VAAPI_SURFACE_ALLOC_FLAG_HINT_DECODER     = 1 << 3,
   GST_VAAPI_SURFACE_ALLOC_FLAG_HINT_ENCODER     = 1 << 4,
+  GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED       = 1 << 5,
 } GstVaapiSurfaceAllocFlags;
 
 #define GST_VAAPI_SURFACE(obj) \
@@ -226,6 +231,10 @@ GstVaapiSurface *
 gst_vaapi_surface_new_from_buffer_proxy (GstVaapiDisplay * display,
     GstVaapiBufferProxy * proxy, const GstVideoInfo * vip);
 
+GstVaapiSurface *
+gst_vaapi_surface_new_with_user_ptr (GstVaapiDisplay * display,
+    gpointer data, const GstVideoInfo * vip);
+
 GstVaapiID
 gst_vaapi_surface_get_id (GstVaapiSurface * surface);
 
@@ -266,6 +275,10 @@ gst_vaapi_surface_deassociate_subpicture (GstVaapiSurface * surface,
 gboolean
 gst_vaapi_surface_sync (GstVaapiSurface * surface);
 
+gboolean
+gst_vaapi_surface_copy (GstVaapiSurface * dst_surface,
+    GstVaapiSurface * src_surface);
+
 gboolean
 gst_vaapi_surface_query_status (GstVaapiSurface * surface,
     GstVaapiSurfaceStatus * pstatus);
@@ -21,20 +21,32 @@
  */
 
 #include "sysdeps.h"
+#include "gstvaapicompat.h"
 #include "gstvaapisurface_drm.h"
+#include "gstvaapidisplay_priv.h"
 #include "gstvaapisurface_priv.h"
 #include "gstvaapiimage_priv.h"
 #include "gstvaapibufferproxy_priv.h"
 
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
 static GstVaapiBufferProxy *
 gst_vaapi_surface_get_drm_buf_handle (GstVaapiSurface * surface, guint type)
 {
   GstVaapiBufferProxy *proxy;
   GstVaapiImage *image;
+  const VAImage *va_image;
+  guint i;
 
   image = gst_vaapi_surface_derive_image (surface);
   if (!image)
     goto error_derive_image;
+  va_image = &image->internal_image;
 
   /* The proxy takes ownership if the image, even creation failure. */
   proxy =
@@ -43,6 +55,13 @@ gst_vaapi_surface_get_drm_buf_handle (GstVaapiSurface * surface, guint type)
       image);
   if (!proxy)
     goto error_alloc_export_buffer;
+
+  proxy->format = image->internal_format;
+  proxy->num_planes = MIN (va_image->num_planes, GST_VIDEO_MAX_PLANES);
+  for (i = 0; i < proxy->num_planes; i++) {
+    proxy->offsets[i] = va_image->offsets[i];
+    proxy->strides[i] = va_image->pitches[i];
+  }
   return proxy;
 
   /* ERRORS */
@@ -58,6 +77,60 @@ error_alloc_export_buffer:
   }
 }
 
+/* Exports the surface along with its DRM format modifier, so that
+ * tiled or compressed layouts are described rather than implied. Only
+ * layouts that fit in a single dma-buf with one plane per video plane
+ * are kept, since that's all a GstVideoMeta can describe. */
+static GstVaapiBufferProxy *
+gst_vaapi_surface_export_dma_buf_handle (GstVaapiSurface * surface)
+{
+#if VA_CHECK_VERSION(1,1,0)
+  GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (surface);
+  const GstVideoFormat format = GST_VAAPI_SURFACE_FORMAT (surface);
+  const GstVideoFormatInfo *finfo;
+  VADRMPRIMESurfaceDescriptor desc;
+  GstVaapiBufferProxy *proxy = NULL;
+  VAStatus status;
+  guint i;
+
+  if (format == GST_VIDEO_FORMAT_UNKNOWN || format == GST_VIDEO_FORMAT_ENCODED)
+    return NULL;
+  finfo = gst_video_format_get_info (format);
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  status = vaExportSurfaceHandle (GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_SURFACE_ID (surface), VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2,
+      VA_EXPORT_SURFACE_COMPOSED_LAYERS | VA_EXPORT_SURFACE_READ_WRITE, &desc);
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  if (status != VA_STATUS_SUCCESS)
+    return NULL;
+
+  if (desc.num_objects == 1 && desc.num_layers == 1
+      && desc.layers[0].num_planes == GST_VIDEO_FORMAT_INFO_N_PLANES (finfo)) {
+    proxy = gst_vaapi_buffer_proxy_new_from_export
+        (GST_MINI_OBJECT_CAST (surface), desc.objects[0].fd,
+        desc.objects[0].size, desc.objects[0].drm_format_modifier);
+    if (proxy) {
+      proxy->format = format;
+      proxy->num_planes = desc.layers[0].num_planes;
+      for (i = 0; i < proxy->num_planes; i++) {
+        proxy->offsets[i] = desc.layers[0].offset[i];
+        proxy->strides[i] = desc.layers[0].pitch[i];
+      }
+    }
+  } else {
+    GST_DEBUG ("unsupported export layout (%u objects, %u layers)",
+        desc.num_objects, desc.num_layers);
+  }
+
+  for (i = proxy ? 1 : 0; i < desc.num_objects; i++)
+    close (desc.objects[i].fd);
+  return proxy;
+#else
+  return NULL;
+#endif
+}
+
 /**
  * gst_vaapi_surface_peek_dma_buf_handle:
  * @surface: a #GstVaapiSurface
@@ -80,8 +153,10 @@ gst_vaapi_surface_peek_dma_buf_handle (GstVaapiSurface * surface)
   if (surface->extbuf_proxy)
     return surface->extbuf_proxy;
 
-  buf_proxy = gst_vaapi_surface_get_drm_buf_handle (surface,
-      GST_VAAPI_BUFFER_MEMORY_TYPE_DMA_BUF);
+  buf_proxy = gst_vaapi_surface_export_dma_buf_handle (surface);
+  if (!buf_proxy)
+    buf_proxy = gst_vaapi_surface_get_drm_buf_handle (surface,
+        GST_VAAPI_BUFFER_MEMORY_TYPE_DMA_BUF);
 
   if (buf_proxy) {
     gst_vaapi_surface_set_buffer_proxy (surface, buf_proxy);
@@ -138,6 +213,26 @@ fill_video_info (GstVideoInfo * vip, GstVideoFormat format, guint width,
   }
 }
 
+static GstVaapiSurface *
+surface_new_with_dma_buf (GstVaapiDisplay * display, gint fd,
+    GstVideoInfo * vi, guint64 modifier)
+{
+  GstVaapiBufferProxy *proxy;
+  GstVaapiSurface *surface;
+
+  proxy = gst_vaapi_buffer_proxy_new ((gintptr) fd,
+      GST_VAAPI_BUFFER_MEMORY_TYPE_DMA_BUF, GST_VIDEO_INFO_SIZE (vi), NULL,
+      NULL);
+  if (!proxy)
+    return NULL;
+  gst_vaapi_buffer_proxy_set_modifier (proxy, modifier);
+
+  surface = gst_vaapi_surface_new_from_buffer_proxy (display, proxy, vi);
+  /* Surface holds proxy's reference */
+  gst_vaapi_buffer_proxy_unref (proxy);
+  return surface;
+}
+
 /**
  * gst_vaapi_surface_new_with_dma_buf_handle:
  * @display: a #GstVaapiDisplay
@@ -160,21 +255,310 @@ GstVaapiSurface *
 gst_vaapi_surface_new_with_dma_buf_handle (GstVaapiDisplay * display, gint fd,
     GstVideoInfo * vi)
 {
-  GstVaapiBufferProxy *proxy;
+  return surface_new_with_dma_buf (display, fd, vi,
+      GST_VAAPI_DRM_FORMAT_MOD_INVALID);
+}
+
+/* ------------------------------------------------------------------------- */
+/* --- DMA-BUF Import Cache                                              --- */
+/* ------------------------------------------------------------------------- */
+
+/* Number of imported surfaces kept per display */
+#define DMABUF_IMPORT_CACHE_SIZE 64
+
+typedef struct
+{
+  dev_t dev;
+  ino_t ino;
+  GstVideoFormat format;
+  guint width;
+  guint height;
+  gsize size;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+  guint64 modifier;
+} DmaBufImportKey;
+
+typedef struct
+{
+  DmaBufImportKey key;
   GstVaapiSurface *surface;
+} DmaBufImport;
 
-  proxy = gst_vaapi_buffer_proxy_new ((gintptr) fd,
-      GST_VAAPI_BUFFER_MEMORY_TYPE_DMA_BUF, GST_VIDEO_INFO_SIZE (vi), NULL,
-      NULL);
-  if (!proxy)
+typedef struct
+{
+  GHashTable *imports;          /* DmaBufImportKey -> GList link in lru */
+  GQueue lru;                   /* DmaBufImport, most recently used first */
+} DmaBufImportCache;
+
+static GMutex g_dmabuf_imports_lock;
+
+static GQuark
+dmabuf_imports_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    gsize quark = (gsize) g_quark_from_static_string ("GstVaapiDmaBufImports");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+static guint
+dmabuf_import_key_hash (gconstpointer data)
+{
+  const DmaBufImportKey *const key = data;
+  guint h;
+
+  h = (guint) key->ino ^ (guint) ((guint64) key->ino >> 32);
+  h = h * 31 + (guint) key->dev;
+  h = h * 31 + (guint) key->offset[1];
+  return h;
+}
+
+static gboolean
+dmabuf_import_key_equal (gconstpointer a, gconstpointer b)
+{
+  return memcmp (a, b, sizeof (DmaBufImportKey)) == 0;
+}
+
+static void
+dmabuf_import_free (DmaBufImport * import)
+{
+  gst_vaapi_surface_unref (import->surface);
+  g_slice_free (DmaBufImport, import);
+}
+
+static void
+dmabuf_import_cache_free (DmaBufImportCache * cache)
+{
+  g_hash_table_unref (cache->imports);
+  g_queue_foreach (&cache->lru, (GFunc) dmabuf_import_free, NULL);
+  g_queue_clear (&cache->lru);
+  g_slice_free (DmaBufImportCache, cache);
+}
+
+static DmaBufImportCache *
+dmabuf_import_cache_get (GstVaapiDisplay * display)
+{
+  DmaBufImportCache *cache;
+
+  cache = g_object_get_qdata (G_OBJECT (display), dmabuf_imports_quark ());
+  if (!cache) {
+    cache = g_slice_new0 (DmaBufImportCache);
+    cache->imports = g_hash_table_new (dmabuf_import_key_hash,
+        dmabuf_import_key_equal);
+    g_queue_init (&cache->lru);
+    g_object_set_qdata_full (G_OBJECT (display), dmabuf_imports_quark (),
+        cache, (GDestroyNotify) dmabuf_import_cache_free);
+  }
+  return cache;
+}
+
+static gboolean
+dmabuf_import_key_init (DmaBufImportKey * key, gint fd, GstVideoInfo * vi,
+    guint64 modifier)
+{
+  struct stat st;
+  guint i;
+
+  if (fstat (fd, &st) != 0)
+    return FALSE;
+
+  /* zeroed so that the padding compares equal too */
+  memset (key, 0, sizeof (*key));
+  key->dev = st.st_dev;
+  key->ino = st.st_ino;
+  key->format = GST_VIDEO_INFO_FORMAT (vi);
+  key->width = GST_VIDEO_INFO_WIDTH (vi);
+  key->height = GST_VIDEO_INFO_HEIGHT (vi);
+  key->size = GST_VIDEO_INFO_SIZE (vi);
+  key->modifier = modifier;
+  for (i = 0; i < GST_VIDEO_INFO_N_PLANES (vi); i++) {
+    key->offset[i] = GST_VIDEO_INFO_PLANE_OFFSET (vi, i);
+    key->stride[i] = GST_VIDEO_INFO_PLANE_STRIDE (vi, i);
+  }
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_surface_import_dma_buf_handle:
+ * @display: a #GstVaapiDisplay
+ * @fd: the DRM PRIME file descriptor
+ * @vi: the #GstVideoInfo describing the buffer layout
+ * @modifier: the DRM format modifier of the buffer, or
+ *   %GST_VAAPI_DRM_FORMAT_MOD_INVALID if it is implicit
+ *
+ * Like gst_vaapi_surface_new_with_dma_buf_handle(), except that the
+ * imported surfaces are kept in a cache attached to @display. The
+ * cache is keyed by the identity of the dma-buf (its device and inode
+ * numbers) plus the buffer layout in @vi and @modifier, so that a producer wrapping
+ * the same dma-buf in a new #GstBuffer every frame does not cause a
+ * new import. The least recently used surfaces are evicted first.
+ *
+ * Since the cached surfaces hold a reference to @display, users must
+ * release them with gst_vaapi_surface_reset_dma_buf_cache() once done.
+ *
+ * Return value: (transfer full): a #GstVaapiSurface wrapping @fd, or
+ *   %NULL if the import failed
+ */
+GstVaapiSurface *
+gst_vaapi_surface_import_dma_buf_handle (GstVaapiDisplay * display, gint fd,
+    GstVideoInfo * vi, guint64 modifier)
+{
+  DmaBufImportCache *cache;
+  DmaBufImport *import;
+  DmaBufImportKey key;
+  GstVaapiSurface *surface;
+  GList *link;
+
+  g_return_val_if_fail (display != NULL, NULL);
+  g_return_val_if_fail (fd >= 0, NULL);
+  g_return_val_if_fail (vi != NULL, NULL);
+
+  if (!dmabuf_import_key_init (&key, fd, vi, modifier))
+    return surface_new_with_dma_buf (display, fd, vi, modifier);
+
+  g_mutex_lock (&g_dmabuf_imports_lock);
+  cache = dmabuf_import_cache_get (display);
+  link = g_hash_table_lookup (cache->imports, &key);
+  if (link) {
+    g_queue_unlink (&cache->lru, link);
+    g_queue_push_head_link (&cache->lru, link);
+    import = link->data;
+    surface = (GstVaapiSurface *)
+        gst_mini_object_ref (GST_MINI_OBJECT_CAST (import->surface));
+    g_mutex_unlock (&g_dmabuf_imports_lock);
+    return surface;
+  }
+  g_mutex_unlock (&g_dmabuf_imports_lock);
+
+  surface = surface_new_with_dma_buf (display, fd, vi, modifier);
+  if (!surface)
     return NULL;
 
-  surface = gst_vaapi_surface_new_from_buffer_proxy (display, proxy, vi);
-  /* Surface holds proxy's reference */
-  gst_vaapi_buffer_proxy_unref (proxy);
+  import = g_slice_new (DmaBufImport);
+  import->key = key;
+  import->surface = (GstVaapiSurface *)
+      gst_mini_object_ref (GST_MINI_OBJECT_CAST (surface));
+
+  g_mutex_lock (&g_dmabuf_imports_lock);
+  /* the cache may have been reset, or another thread may have imported
+   * the same buffer meanwhile */
+  cache = dmabuf_import_cache_get (display);
+  link = g_hash_table_lookup (cache->imports, &key);
+  if (link) {
+    g_hash_table_remove (cache->imports, &key);
+    dmabuf_import_free (link->data);
+    g_queue_delete_link (&cache->lru, link);
+  }
+  g_queue_push_head (&cache->lru, import);
+  g_hash_table_insert (cache->imports, &import->key, cache->lru.head);
+
+  while (cache->lru.length > DMABUF_IMPORT_CACHE_SIZE) {
+    DmaBufImport *const old = g_queue_pop_tail (&cache->lru);
+    g_hash_table_remove (cache->imports, &old->key);
+    dmabuf_import_free (old);
+  }
+  g_mutex_unlock (&g_dmabuf_imports_lock);
+
   return surface;
 }
 
+/**
+ * gst_vaapi_surface_reset_dma_buf_cache:
+ * @display: a #GstVaapiDisplay
+ *
+ * Releases all the surfaces imported through
+ * gst_vaapi_surface_import_dma_buf_handle() on @display.
+ */
+void
+gst_vaapi_surface_reset_dma_buf_cache (GstVaapiDisplay * display)
+{
+  DmaBufImportCache *cache;
+
+  g_return_if_fail (display != NULL);
+
+  g_mutex_lock (&g_dmabuf_imports_lock);
+  cache = g_object_steal_qdata (G_OBJECT (display), dmabuf_imports_quark ());
+  g_mutex_unlock (&g_dmabuf_imports_lock);
+
+  if (cache)
+    dmabuf_import_cache_free (cache);
+}
+
+/**
+ * gst_vaapi_surface_import_from_surface:
+ * @display: a #GstVaapiDisplay
+ * @surface: a #GstVaapiSurface from another #GstVaapiDisplay
+ *
+ * Shares @surface with @display, which may be bound to another DRM
+ * device, by exporting it as a dma-buf (PRIME) handle and importing
+ * it back through gst_vaapi_surface_import_dma_buf_handle(). The
+ * pixels are not copied, and since exported handles are kept on
+ * @surface, the imports of pooled surfaces are reused across frames.
+ *
+ * Rendering into @surface is waited for beforehand, since no fence
+ * is shared between the two VA displays.
+ *
+ * Return value: (transfer full): a #GstVaapiSurface of @display
+ *   sharing the storage of @surface, or %NULL if either the export
+ *   or the import is not supported
+ */
+GstVaapiSurface *
+gst_vaapi_surface_import_from_surface (GstVaapiDisplay * display,
+    GstVaapiSurface * surface)
+{
+  GstVaapiBufferProxy *buf_proxy;
+  GstVaapiSurface *out_surface;
+  GstVideoInfo vi;
+  guint i;
+
+  g_return_val_if_fail (display != NULL, NULL);
+  g_return_val_if_fail (surface != NULL, NULL);
+
+  buf_proxy = gst_vaapi_surface_peek_dma_buf_handle (surface);
+  if (!buf_proxy)
+    goto error_export;
+  if (buf_proxy->format == GST_VIDEO_FORMAT_UNKNOWN)
+    goto error_layout;
+
+  gst_video_info_set_format (&vi, buf_proxy->format,
+      GST_VAAPI_SURFACE_WIDTH (surface), GST_VAAPI_SURFACE_HEIGHT (surface));
+  if (GST_VIDEO_INFO_N_PLANES (&vi) != buf_proxy->num_planes)
+    goto error_layout;
+  for (i = 0; i < buf_proxy->num_planes; i++) {
+    GST_VIDEO_INFO_PLANE_OFFSET (&vi, i) = buf_proxy->offsets[i];
+    GST_VIDEO_INFO_PLANE_STRIDE (&vi, i) = buf_proxy->strides[i];
+  }
+  GST_VIDEO_INFO_SIZE (&vi) = GST_VAAPI_BUFFER_PROXY_SIZE (buf_proxy);
+
+  if (!gst_vaapi_surface_sync (surface))
+    return NULL;
+
+  out_surface = gst_vaapi_surface_import_dma_buf_handle (display,
+      GST_VAAPI_BUFFER_PROXY_HANDLE (buf_proxy), &vi, buf_proxy->modifier);
+
+  /* A derived image keeps the surface busy for its producer */
+  gst_vaapi_buffer_proxy_release_data (buf_proxy);
+  return out_surface;
+
+  /* ERRORS */
+error_export:
+  {
+    GST_DEBUG ("failed to export VA surface %" GST_VAAPI_ID_FORMAT,
+        GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID (surface)));
+    return NULL;
+  }
+error_layout:
+  {
+    GST_DEBUG ("unknown layout of exported VA surface %" GST_VAAPI_ID_FORMAT,
+        GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID (surface)));
+    return NULL;
+  }
+}
+
 /**
  * gst_vaapi_surface_new_with_gem_buf_handle:
  * @display: a #GstVaapiDisplay
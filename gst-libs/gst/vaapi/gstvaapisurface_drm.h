@@ -38,6 +38,17 @@ GstVaapiSurface *
 gst_vaapi_surface_new_with_dma_buf_handle (GstVaapiDisplay * display, gint fd,
     GstVideoInfo * vi);
 
+GstVaapiSurface *
+gst_vaapi_surface_import_dma_buf_handle (GstVaapiDisplay * display, gint fd,
+    GstVideoInfo * vi, guint64 modifier);
+
+void
+gst_vaapi_surface_reset_dma_buf_cache (GstVaapiDisplay * display);
+
+GstVaapiSurface *
+gst_vaapi_surface_import_from_surface (GstVaapiDisplay * display,
+    GstVaapiSurface * surface);
+
 GstVaapiSurface *
 gst_vaapi_surface_new_with_gem_buf_handle (GstVaapiDisplay * display,
     guint32 name, guint size, GstVideoFormat format, guint width, guint height,
@@ -47,8 +47,28 @@ struct _GstVaapiSurfacePool
   GstVaapiChromaType chroma_type;
   GstVideoInfo video_info;
   guint alloc_flags;
+
+  /* key in the display registry, for shared pools */
+  gchar *shared_key;
 };
 
+/* Registry of shared surface pools, attached to the GstVaapiDisplay. It
+   does not hold any reference to the pools, which remove themselves
+   from it when they get destroyed */
+static GMutex g_shared_pools_lock;
+
+static GQuark
+shared_pools_quark (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    gsize quark = (gsize) g_quark_from_static_string ("GstVaapiSharedPools");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
 static gboolean
 surface_pool_init (GstVaapiSurfacePool * pool, const GstVideoInfo * vip,
     guint surface_allocation_flags)
@@ -90,14 +110,50 @@ gst_vaapi_surface_pool_alloc_object (GstVaapiVideoPool * base_pool)
       GST_VIDEO_INFO_HEIGHT (&pool->video_info));
 }
 
+static gboolean
+gst_vaapi_surface_pool_is_object_idle (GstVaapiVideoPool * base_pool,
+    gpointer object)
+{
+  GstVaapiSurfaceStatus status;
+
+  /* A surface released while the hardware still reads from it, e.g.
+   * the source of a VPP operation or an encode, is not idle yet */
+  if (!gst_vaapi_surface_query_status (object, &status))
+    return TRUE;
+  return (status & GST_VAAPI_SURFACE_STATUS_IDLE) != 0;
+}
+
+static void
+gst_vaapi_surface_pool_finalize (GstVaapiSurfacePool * pool)
+{
+  GstVaapiVideoPool *const base_pool = GST_VAAPI_VIDEO_POOL (pool);
+
+  if (pool->shared_key) {
+    GHashTable *shared_pools;
+
+    g_mutex_lock (&g_shared_pools_lock);
+    shared_pools = g_object_get_qdata (G_OBJECT (base_pool->display),
+        shared_pools_quark ());
+    if (shared_pools &&
+        g_hash_table_lookup (shared_pools, pool->shared_key) == pool)
+      g_hash_table_remove (shared_pools, pool->shared_key);
+    g_mutex_unlock (&g_shared_pools_lock);
+
+    g_free (pool->shared_key);
+    pool->shared_key = NULL;
+  }
+  gst_vaapi_video_pool_finalize (base_pool);
+}
+
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_surface_pool_class (void)
 {
   static const GstVaapiVideoPoolClass GstVaapiSurfacePoolClass = {
     {sizeof (GstVaapiSurfacePool),
-        (GDestroyNotify) gst_vaapi_video_pool_finalize}
+        (GDestroyNotify) gst_vaapi_surface_pool_finalize}
     ,
-    .alloc_object = gst_vaapi_surface_pool_alloc_object
+    .alloc_object = gst_vaapi_surface_pool_alloc_object,
+    .is_object_idle = gst_vaapi_surface_pool_is_object_idle
   };
   return GST_VAAPI_MINI_OBJECT_CLASS (&GstVaapiSurfacePoolClass);
 }
@@ -156,6 +212,7 @@ gst_vaapi_surface_pool_new_full (GstVaapiDisplay * display,
       gst_vaapi_mini_object_new (gst_vaapi_surface_pool_class ());
   if (!pool)
     return NULL;
+  GST_VAAPI_SURFACE_POOL (pool)->shared_key = NULL;
 
   gst_vaapi_video_pool_init (pool, display,
       GST_VAAPI_VIDEO_POOL_OBJECT_TYPE_SURFACE);
@@ -210,3 +267,82 @@ gst_vaapi_surface_pool_new_with_chroma_type (GstVaapiDisplay * display,
 
   return pool;
 }
+
+/* Takes a reference to @pool, unless it is already being destroyed */
+static gboolean
+surface_pool_try_ref (GstVaapiVideoPool * pool)
+{
+  GstVaapiMiniObject *const object = GST_VAAPI_MINI_OBJECT (pool);
+  gint ref_count;
+
+  do {
+    ref_count = g_atomic_int_get (&object->ref_count);
+    if (ref_count <= 0)
+      return FALSE;
+  } while (!g_atomic_int_compare_and_exchange (&object->ref_count,
+          ref_count, ref_count + 1));
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_surface_pool_new_shared:
+ * @display: a #GstVaapiDisplay
+ * @vip: a #GstVideoInfo
+ * @surface_allocation_flags: (optional) allocation flags
+ *
+ * Returns a #GstVaapiVideoPool of #GstVaapiSurface with the specified
+ * format and dimensions in @vip, shared with all other users of the
+ * @display asking for the same format, dimensions and allocation
+ * flags. Since the @display is itself shared across elements through
+ * #GstContext, this lets independent pipelines draw surfaces from the
+ * same pool instead of each holding its own reserve.
+ *
+ * The pool is created on first use and destroyed with its last user.
+ *
+ * Return value: a new reference to the shared #GstVaapiVideoPool
+ */
+GstVaapiVideoPool *
+gst_vaapi_surface_pool_new_shared (GstVaapiDisplay * display,
+    const GstVideoInfo * vip, guint surface_allocation_flags)
+{
+  GstVaapiVideoPool *pool;
+  GHashTable *shared_pools;
+  gchar *key;
+
+  g_return_val_if_fail (display != NULL, NULL);
+  g_return_val_if_fail (vip != NULL, NULL);
+
+  key = g_strdup_printf ("%s:%ux%u:0x%x",
+      gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (vip)),
+      GST_VIDEO_INFO_WIDTH (vip), GST_VIDEO_INFO_HEIGHT (vip),
+      surface_allocation_flags);
+
+  g_mutex_lock (&g_shared_pools_lock);
+  shared_pools = g_object_get_qdata (G_OBJECT (display), shared_pools_quark ());
+  if (!shared_pools) {
+    shared_pools = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        NULL);
+    g_object_set_qdata_full (G_OBJECT (display), shared_pools_quark (),
+        shared_pools, (GDestroyNotify) g_hash_table_unref);
+  }
+
+  pool = g_hash_table_lookup (shared_pools, key);
+  if (pool && surface_pool_try_ref (pool)) {
+    g_mutex_unlock (&g_shared_pools_lock);
+    g_free (key);
+    GST_DEBUG ("reusing shared surface pool %p", pool);
+    return pool;
+  }
+
+  pool = gst_vaapi_surface_pool_new_full (display, vip,
+      surface_allocation_flags);
+  if (pool) {
+    GST_VAAPI_SURFACE_POOL (pool)->shared_key = g_strdup (key);
+    g_hash_table_replace (shared_pools, key, pool);
+    key = NULL;
+  }
+  g_mutex_unlock (&g_shared_pools_lock);
+
+  g_free (key);
+  return pool;
+}
@@ -35,15 +35,35 @@
 #define DEBUG 1
 #include "gstvaapidebug.h"
 
+/* Proxies released by their last user are kept on their surface, one
+   for the proxy that owns the surface and one for a copy of it, so
+   that the next proxies of that surface need no new allocation */
+static GQuark
+proxy_cache_quark (gboolean is_copy)
+{
+  static gsize g_quarks[2];
+  gsize *const quark_ptr = &g_quarks[!!is_copy];
+
+  if (g_once_init_enter (quark_ptr)) {
+    GQuark quark = g_quark_from_static_string (is_copy ?
+        "GstVaapiSurfaceProxyCopyCache" : "GstVaapiSurfaceProxyCache");
+    g_once_init_leave (quark_ptr, quark);
+  }
+  return *quark_ptr;
+}
+
+static void
+proxy_cache_free (gpointer data)
+{
+  g_slice_free (GstVaapiSurfaceProxy, data);
+}
+
 static void
 gst_vaapi_surface_proxy_finalize (GstVaapiSurfaceProxy * proxy)
 {
-  if (proxy->surface) {
-    if (proxy->pool && !proxy->parent)
-      gst_vaapi_video_pool_put_object (proxy->pool, proxy->surface);
-    gst_vaapi_surface_unref (proxy->surface);
-    proxy->surface = NULL;
-  }
+  /* The surface reference is dropped by the recycle function */
+  if (proxy->surface && proxy->pool && !proxy->parent)
+    gst_vaapi_video_pool_put_object (proxy->pool, proxy->surface);
   gst_vaapi_video_pool_replace (&proxy->pool, NULL);
   gst_vaapi_surface_proxy_replace (&proxy->parent, NULL);
 
@@ -52,16 +72,61 @@ gst_vaapi_surface_proxy_finalize (GstVaapiSurfaceProxy * proxy)
     proxy->destroy_func (proxy->destroy_data);
 }
 
+static gboolean
+gst_vaapi_surface_proxy_recycle (GstVaapiSurfaceProxy * proxy)
+{
+  GstVaapiSurface *const surface = proxy->surface;
+
+  if (!surface)
+    return FALSE;
+
+  proxy->surface = NULL;
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (surface),
+      proxy_cache_quark (proxy->is_copy), proxy, proxy_cache_free);
+  gst_vaapi_surface_unref (surface);
+  return TRUE;
+}
+
 static inline const GstVaapiMiniObjectClass *
 gst_vaapi_surface_proxy_class (void)
 {
+  static GstVaapiMiniObjectCache GstVaapiSurfaceProxyCache;
   static const GstVaapiMiniObjectClass GstVaapiSurfaceProxyClass = {
-    sizeof (GstVaapiSurfaceProxy),
-    (GDestroyNotify) gst_vaapi_surface_proxy_finalize
+    .size = sizeof (GstVaapiSurfaceProxy),
+    .finalize = (GDestroyNotify) gst_vaapi_surface_proxy_finalize,
+    .recycle = (gpointer) gst_vaapi_surface_proxy_recycle,
+    .cache = &GstVaapiSurfaceProxyCache
   };
   return &GstVaapiSurfaceProxyClass;
 }
 
+/* Returns a proxy object for @surface, with no reference to it yet,
+   possibly one kept from a previous proxy of @surface */
+static GstVaapiSurfaceProxy *
+gst_vaapi_surface_proxy_alloc (GstVaapiSurface * surface, gboolean is_copy)
+{
+  GstVaapiSurfaceProxy *proxy;
+
+  proxy = gst_mini_object_steal_qdata (GST_MINI_OBJECT_CAST (surface),
+      proxy_cache_quark (is_copy));
+  if (proxy) {
+    GST_VAAPI_MINI_OBJECT (proxy)->ref_count = 1;
+    GST_VAAPI_SURFACE_PROXY_FLAGS (proxy) = 0;
+  } else {
+    proxy = (GstVaapiSurfaceProxy *)
+        gst_vaapi_mini_object_new (gst_vaapi_surface_proxy_class ());
+    if (!proxy)
+      return NULL;
+  }
+
+  proxy->parent = NULL;
+  proxy->pool = NULL;
+  proxy->surface = NULL;
+  proxy->destroy_func = NULL;
+  proxy->is_copy = is_copy;
+  return proxy;
+}
+
 static void
 gst_vaapi_surface_proxy_init_properties (GstVaapiSurfaceProxy * proxy)
 {
@@ -69,6 +134,7 @@ gst_vaapi_surface_proxy_init_properties (GstVaapiSurfaceProxy * proxy)
   proxy->timestamp = GST_CLOCK_TIME_NONE;
   proxy->duration = GST_CLOCK_TIME_NONE;
   proxy->has_crop_rect = FALSE;
+  proxy->has_hints = FALSE;
 }
 
 /**
@@ -88,27 +154,14 @@ gst_vaapi_surface_proxy_new (GstVaapiSurface * surface)
 
   g_return_val_if_fail (surface != NULL, NULL);
 
-  proxy = (GstVaapiSurfaceProxy *)
-      gst_vaapi_mini_object_new (gst_vaapi_surface_proxy_class ());
+  proxy = gst_vaapi_surface_proxy_alloc (surface, FALSE);
   if (!proxy)
     return NULL;
 
-  proxy->parent = NULL;
-  proxy->destroy_func = NULL;
-  proxy->pool = NULL;
   proxy->surface =
       (GstVaapiSurface *) gst_mini_object_ref (GST_MINI_OBJECT_CAST (surface));
-  if (!proxy->surface)
-    goto error;
   gst_vaapi_surface_proxy_init_properties (proxy);
   return proxy;
-
-  /* ERRORS */
-error:
-  {
-    gst_vaapi_surface_proxy_unref (proxy);
-    return NULL;
-  }
 }
 
 /**
@@ -120,34 +173,48 @@ error:
  * to the proxy object is released, then the underlying VA surface is
  * pushed back to its parent pool.
  *
+ * Surfaces that are idle are preferred. If the hardware is still
+ * working on all free surfaces, the proxy is marked as pending, see
+ * gst_vaapi_surface_proxy_sync().
+ *
+ * The proxy object itself is reused from the last proxy of the same
+ * surface, when there is one.
+ *
  * Returns: The same newly allocated @proxy object, or %NULL on error
  */
 GstVaapiSurfaceProxy *
 gst_vaapi_surface_proxy_new_from_pool (GstVaapiSurfacePool * pool)
 {
+  GstVaapiVideoPool *const base_pool = GST_VAAPI_VIDEO_POOL (pool);
   GstVaapiSurfaceProxy *proxy;
+  GstVaapiSurface *surface;
+  gboolean is_idle;
 
   g_return_val_if_fail (pool != NULL, NULL);
 
-  proxy = (GstVaapiSurfaceProxy *)
-      gst_vaapi_mini_object_new (gst_vaapi_surface_proxy_class ());
-  if (!proxy)
+  surface = gst_vaapi_video_pool_get_idle_object (base_pool, &is_idle);
+  if (!surface)
     return NULL;
 
-  proxy->parent = NULL;
-  proxy->destroy_func = NULL;
-  proxy->pool = gst_vaapi_video_pool_ref (GST_VAAPI_VIDEO_POOL (pool));
-  proxy->surface = gst_vaapi_video_pool_get_object (proxy->pool);
-  if (!proxy->surface)
+  proxy = gst_vaapi_surface_proxy_alloc (surface, FALSE);
+  if (!proxy)
     goto error;
-  gst_mini_object_ref (GST_MINI_OBJECT_CAST (proxy->surface));
+
+  proxy->pool = gst_vaapi_video_pool_ref (base_pool);
+  proxy->surface =
+      (GstVaapiSurface *) gst_mini_object_ref (GST_MINI_OBJECT_CAST (surface));
   gst_vaapi_surface_proxy_init_properties (proxy);
+
+  /* All free surfaces were still in use by the hardware */
+  if (!is_idle)
+    GST_VAAPI_SURFACE_PROXY_FLAG_SET (proxy,
+        GST_VAAPI_SURFACE_PROXY_FLAG_PENDING);
   return proxy;
 
   /* ERRORS */
 error:
   {
-    gst_vaapi_surface_proxy_unref (proxy);
+    gst_vaapi_video_pool_put_object (base_pool, surface);
     return NULL;
   }
 }
@@ -172,8 +239,7 @@ gst_vaapi_surface_proxy_copy (GstVaapiSurfaceProxy * proxy)
 
   g_return_val_if_fail (proxy != NULL, NULL);
 
-  copy = (GstVaapiSurfaceProxy *)
-      gst_vaapi_mini_object_new (gst_vaapi_surface_proxy_class ());
+  copy = gst_vaapi_surface_proxy_alloc (proxy->surface, TRUE);
   if (!copy)
     return NULL;
 
@@ -187,10 +253,12 @@ gst_vaapi_surface_proxy_copy (GstVaapiSurfaceProxy * proxy)
   copy->view_id = proxy->view_id;
   copy->timestamp = proxy->timestamp;
   copy->duration = proxy->duration;
-  copy->destroy_func = NULL;
   copy->has_crop_rect = proxy->has_crop_rect;
   if (copy->has_crop_rect)
     copy->crop_rect = proxy->crop_rect;
+  copy->has_hints = proxy->has_hints;
+  if (copy->has_hints)
+    copy->hints = proxy->hints;
 
   return copy;
 }
@@ -405,3 +473,107 @@ gst_vaapi_surface_proxy_set_crop_rect (GstVaapiSurfaceProxy * proxy,
   if (proxy->has_crop_rect)
     proxy->crop_rect = *crop_rect;
 }
+
+/**
+ * gst_vaapi_surface_proxy_get_coding_hints:
+ * @proxy: a #GstVaapiSurfaceProxy
+ *
+ * Returns how the picture held by @proxy was coded in the stream it
+ * was decoded from, as attached by the decoder.
+ *
+ * Return value: the #GstVaapiCodingHints, or %NULL if none was
+ *   associated with the surface proxy
+ */
+const GstVaapiCodingHints *
+gst_vaapi_surface_proxy_get_coding_hints (GstVaapiSurfaceProxy * proxy)
+{
+  g_return_val_if_fail (proxy != NULL, NULL);
+
+  return proxy->has_hints ? &proxy->hints : NULL;
+}
+
+/**
+ * gst_vaapi_surface_proxy_set_coding_hints:
+ * @proxy: #GstVaapiSurfaceProxy
+ * @hints: (allow-none): the #GstVaapiCodingHints to be stored in @proxy
+ *
+ * Associates the coding statistics of the source picture with @proxy,
+ * or clears them if @hints is %NULL.
+ */
+void
+gst_vaapi_surface_proxy_set_coding_hints (GstVaapiSurfaceProxy * proxy,
+    const GstVaapiCodingHints * hints)
+{
+  g_return_if_fail (proxy != NULL);
+
+  proxy->has_hints = hints != NULL;
+  if (proxy->has_hints)
+    proxy->hints = *hints;
+}
+
+/**
+ * gst_vaapi_surface_proxy_set_pending:
+ * @proxy: #GstVaapiSurfaceProxy
+ *
+ * Marks the underlying surface of @proxy as the target of GPU work
+ * that was submitted but not waited for. Other VA operations on the
+ * same display are ordered by the driver and can use the surface
+ * right away. Only CPU accesses, or other engines (e.g. through an
+ * exported DMA buffer), need to call gst_vaapi_surface_proxy_sync()
+ * first.
+ */
+void
+gst_vaapi_surface_proxy_set_pending (GstVaapiSurfaceProxy * proxy)
+{
+  g_return_if_fail (proxy != NULL);
+
+  GST_VAAPI_SURFACE_PROXY_FLAG_SET (proxy,
+      GST_VAAPI_SURFACE_PROXY_FLAG_PENDING);
+}
+
+/**
+ * gst_vaapi_surface_proxy_sync:
+ * @proxy: #GstVaapiSurfaceProxy
+ *
+ * Waits for the pending GPU work on the underlying surface of @proxy
+ * to complete, if any. This does nothing if the surface was not
+ * marked with gst_vaapi_surface_proxy_set_pending().
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+gst_vaapi_surface_proxy_sync (GstVaapiSurfaceProxy * proxy)
+{
+  g_return_val_if_fail (proxy != NULL, FALSE);
+
+  if (!GST_VAAPI_SURFACE_PROXY_FLAG_IS_SET (proxy,
+          GST_VAAPI_SURFACE_PROXY_FLAG_PENDING))
+    return TRUE;
+
+  if (!gst_vaapi_surface_sync (GST_VAAPI_SURFACE_PROXY_SURFACE (proxy)))
+    return FALSE;
+
+  GST_VAAPI_SURFACE_PROXY_FLAG_UNSET (proxy,
+      GST_VAAPI_SURFACE_PROXY_FLAG_PENDING);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_surface_proxy_set_holder:
+ * @proxy: #GstVaapiSurfaceProxy
+ * @holder: (allow-none): an interned string naming the holder
+ *
+ * Records @holder as the current holder of the underlying surface,
+ * if it comes from a pool that tracks its surfaces, see
+ * gst_vaapi_video_pool_set_object_holder().
+ */
+void
+gst_vaapi_surface_proxy_set_holder (GstVaapiSurfaceProxy * proxy,
+    const gchar * holder)
+{
+  g_return_if_fail (proxy != NULL);
+
+  if (proxy->pool)
+    gst_vaapi_video_pool_set_object_holder (proxy->pool, proxy->surface,
+        holder);
+}
@@ -40,6 +40,8 @@ G_BEGIN_DECLS
  *   view component of a MultiView Coded (MVC) frame
  * @GST_VAAPI_SURFACE_PROXY_FLAG_CORRUPTED: the underlying surface is
  *   corrupted somehow, e.g. reconstructed from invalid references
+ * @GST_VAAPI_SURFACE_PROXY_FLAG_PENDING: the GPU may still be accessing
+ *   the underlying surface, see gst_vaapi_surface_proxy_sync()
  * @GST_VAAPI_SURFACE_PROXY_FLAG_LAST: first flag that can be used by subclasses
  *
  * Flags for #GstVaapiDecoderFrame.
@@ -52,9 +54,29 @@ typedef enum
   GST_VAAPI_SURFACE_PROXY_FLAG_ONEFIELD = (1 << 3),
   GST_VAAPI_SURFACE_PROXY_FLAG_FFB = (1 << 4),
   GST_VAAPI_SURFACE_PROXY_FLAG_CORRUPTED = (1 << 5),
+  GST_VAAPI_SURFACE_PROXY_FLAG_PENDING = (1 << 6),
   GST_VAAPI_SURFACE_PROXY_FLAG_LAST = (1 << 8)
 } GstVaapiSurfaceProxyFlags;
 
+/**
+ * GstVaapiCodingHints:
+ * @coded_size: the size, in bytes, of the source picture
+ * @qp: the average slice QP of the source picture, if @has_qp is set
+ * @is_intra: whether the source picture only had intra slices
+ * @has_qp: whether @qp is known
+ *
+ * How the decoded picture held by a #GstVaapiSurfaceProxy was coded in
+ * the source stream. Encoders re-encoding the picture can use this
+ * instead of analyzing it, see #GstVaapiEncoder:source-hints.
+ */
+typedef struct
+{
+  guint coded_size;
+  guint qp;
+  guint is_intra:1;
+  guint has_qp:1;
+} GstVaapiCodingHints;
+
 /**
  * GST_VAAPI_SURFACE_PROXY_SURFACE:
  * @proxy: a #GstVaapiSurfaceProxy
@@ -152,6 +174,23 @@ void
 gst_vaapi_surface_proxy_set_crop_rect (GstVaapiSurfaceProxy * proxy,
     const GstVaapiRectangle * crop_rect);
 
+const GstVaapiCodingHints *
+gst_vaapi_surface_proxy_get_coding_hints (GstVaapiSurfaceProxy * proxy);
+
+void
+gst_vaapi_surface_proxy_set_coding_hints (GstVaapiSurfaceProxy * proxy,
+    const GstVaapiCodingHints * hints);
+
+void
+gst_vaapi_surface_proxy_set_pending (GstVaapiSurfaceProxy * proxy);
+
+gboolean
+gst_vaapi_surface_proxy_sync (GstVaapiSurfaceProxy * proxy);
+
+void
+gst_vaapi_surface_proxy_set_holder (GstVaapiSurfaceProxy * proxy,
+    const gchar * holder);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_SURFACE_PROXY_H */
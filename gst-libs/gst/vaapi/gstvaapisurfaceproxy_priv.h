@@ -46,7 +46,10 @@ struct _GstVaapiSurfaceProxy
   GDestroyNotify destroy_func;
   gpointer destroy_data;
   GstVaapiRectangle crop_rect;
+  GstVaapiCodingHints hints;
   guint has_crop_rect:1;
+  guint has_hints:1;
+  guint is_copy:1;
 };
 
 #define GST_VAAPI_SURFACE_PROXY_FLAGS       GST_VAAPI_MINI_OBJECT_FLAGS
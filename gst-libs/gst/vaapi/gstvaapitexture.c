@@ -191,6 +191,11 @@ gst_vaapi_texture_new_wrapped (GstVaapiDisplay * display, guint id,
  *
  * Returns the underlying texture id of the @texture.
  *
+ * Unless the @texture wraps a foreign GL texture, uploads may rotate
+ * through a few GL textures, so that a surface can be uploaded while
+ * the previous one is still being rendered. The texture id therefore
+ * has to be retrieved again after each gst_vaapi_texture_put_surface().
+ *
  * Return value: the underlying texture id of the @texture
  */
 guint
@@ -347,6 +352,11 @@ gst_vaapi_texture_set_orientation_flags (GstVaapiTexture * texture, guint flags)
  * de-interlacing (if needed), color space conversion, scaling and
  * other postprocessing transformations are performed.
  *
+ * The GL texture that was rendered into is then the one returned by
+ * gst_vaapi_texture_get_id(). When uploads rotate through several GL
+ * textures, it is not written to again before two more surfaces were
+ * put, so the caller may keep sampling it meanwhile.
+ *
  * Return value: %TRUE on success
  */
 gboolean
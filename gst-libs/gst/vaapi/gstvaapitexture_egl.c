@@ -41,6 +41,16 @@
 #include "gstvaapidebug.h"
 
 typedef struct _GstVaapiTextureEGLPrivate GstVaapiTextureEGLPrivate;
+typedef struct _GstVaapiTextureEGLSlot GstVaapiTextureEGLSlot;
+
+/* One GL texture of the ring, with the fence of its last upload */
+struct _GstVaapiTextureEGLSlot
+{
+  GLuint texture_id;
+  EGLImageKHR egl_image;
+  GstVaapiSurface *surface;
+  EGLSyncKHR sync;
+};
 
 /**
  * GstVaapiTextureEGLPrivate:
@@ -52,8 +62,9 @@ struct _GstVaapiTextureEGLPrivate
   /*< private > */
   GstVaapiTexture *texture;
   EglContext *egl_context;
-  EGLImageKHR egl_image;
-  GstVaapiSurface *surface;
+  GstVaapiTextureEGLSlot slots[GST_VAAPI_TEXTURE_RING_SIZE];
+  guint num_slots;
+  guint current_slot;
   GstVaapiFilter *filter;
 };
 
@@ -73,34 +84,27 @@ typedef struct
 } UploadSurfaceArgs;
 
 static gboolean
-create_objects (GstVaapiTexture * texture, GLuint texture_id)
+create_slot_objects (GstVaapiTexture * texture, GstVaapiTextureEGLSlot * slot,
+    guint mem_types)
 {
   GstVaapiTextureEGLPrivate *const texture_egl =
       gst_vaapi_texture_get_private (texture);
   EglContext *const ctx = texture_egl->egl_context;
   EglVTable *const vtable = egl_context_get_vtable (ctx, FALSE);
   GLint attribs[3] = { EGL_IMAGE_PRESERVED_KHR, EGL_TRUE, EGL_NONE };
-  guint mem_types;
 
-  texture_egl->filter =
-      gst_vaapi_filter_new (GST_VAAPI_TEXTURE_DISPLAY (texture));
-  if (!texture_egl->filter)
-    goto error_create_filter;
-
-  mem_types = gst_vaapi_filter_get_memory_types (texture_egl->filter);
-
-  texture_egl->egl_image =
+  slot->egl_image =
       vtable->eglCreateImageKHR (ctx->display->base.handle.p,
       ctx->base.handle.p, EGL_GL_TEXTURE_2D_KHR,
-      (EGLClientBuffer) GSIZE_TO_POINTER (texture_id), attribs);
-  if (!texture_egl->egl_image)
+      (EGLClientBuffer) GSIZE_TO_POINTER (slot->texture_id), attribs);
+  if (!slot->egl_image)
     goto error_create_image;
 
-  texture_egl->surface =
+  slot->surface =
       gst_vaapi_surface_new_with_egl_image (GST_VAAPI_TEXTURE_DISPLAY (texture),
-      texture_egl->egl_image, GST_VIDEO_FORMAT_RGBA, texture->width,
+      slot->egl_image, GST_VIDEO_FORMAT_RGBA, texture->width,
       texture->height, mem_types);
-  if (!texture_egl->surface)
+  if (!slot->surface)
     goto error_create_surface;
 
   return TRUE;
@@ -108,14 +112,39 @@ create_objects (GstVaapiTexture * texture, GLuint texture_id)
   /* ERRORS */
 error_create_image:
   {
-    GST_ERROR ("failed to create EGL image from 2D texture %u", texture_id);
+    GST_ERROR ("failed to create EGL image from 2D texture %u",
+        slot->texture_id);
     return FALSE;
   }
 error_create_surface:
   {
-    GST_ERROR ("failed to create VA surface from 2D texture %u", texture_id);
+    GST_ERROR ("failed to create VA surface from 2D texture %u",
+        slot->texture_id);
     return FALSE;
   }
+}
+
+static gboolean
+create_objects (GstVaapiTexture * texture)
+{
+  GstVaapiTextureEGLPrivate *const texture_egl =
+      gst_vaapi_texture_get_private (texture);
+  guint i, mem_types;
+
+  texture_egl->filter =
+      gst_vaapi_filter_new (GST_VAAPI_TEXTURE_DISPLAY (texture));
+  if (!texture_egl->filter)
+    goto error_create_filter;
+
+  mem_types = gst_vaapi_filter_get_memory_types (texture_egl->filter);
+
+  for (i = 0; i < texture_egl->num_slots; i++) {
+    if (!create_slot_objects (texture, &texture_egl->slots[i], mem_types))
+      return FALSE;
+  }
+  return TRUE;
+
+  /* ERRORS */
 error_create_filter:
   {
     GST_ERROR ("failed to create VPP filter for color conversion");
@@ -126,21 +155,31 @@ error_create_filter:
 static gboolean
 do_create_texture_unlocked (GstVaapiTexture * texture)
 {
-  GLuint texture_id;
   GstVaapiTextureEGLPrivate *texture_egl =
       gst_vaapi_texture_get_private (texture);
-
-  if (texture->is_wrapped)
-    texture_id = GST_VAAPI_TEXTURE_ID (texture);
-  else {
-    texture_id = egl_create_texture (texture_egl->egl_context,
-        texture->gl_target, texture->gl_format,
-        texture->width, texture->height);
-    if (!texture_id)
-      return FALSE;
-    GST_VAAPI_TEXTURE_ID (texture) = texture_id;
+  EglVTable *const vtable =
+      egl_context_get_vtable (texture_egl->egl_context, FALSE);
+  guint i;
+
+  /* Foreign textures are owned by the caller, and rotating through
+     more textures is only safe if uploads can be fenced */
+  if (texture->is_wrapped) {
+    texture_egl->num_slots = 1;
+    texture_egl->slots[0].texture_id = GST_VAAPI_TEXTURE_ID (texture);
+  } else {
+    texture_egl->num_slots = vtable->has_EGL_KHR_fence_sync ?
+        GST_VAAPI_TEXTURE_RING_SIZE : 1;
+    for (i = 0; i < texture_egl->num_slots; i++) {
+      texture_egl->slots[i].texture_id =
+          egl_create_texture (texture_egl->egl_context, texture->gl_target,
+          texture->gl_format, texture->width, texture->height);
+      if (!texture_egl->slots[i].texture_id)
+        return FALSE;
+    }
+    GST_VAAPI_TEXTURE_ID (texture) = texture_egl->slots[0].texture_id;
   }
-  return create_objects (texture, texture_id);
+  texture_egl->current_slot = 0;
+  return create_objects (texture);
 }
 
 static void
@@ -166,13 +205,22 @@ destroy_objects (GstVaapiTextureEGLPrivate * texture_egl)
 {
   EglContext *const ctx = texture_egl->egl_context;
   EglVTable *const vtable = egl_context_get_vtable (ctx, FALSE);
-
-  if (texture_egl->egl_image != EGL_NO_IMAGE_KHR) {
-    vtable->eglDestroyImageKHR (ctx->display->base.handle.p,
-        texture_egl->egl_image);
-    texture_egl->egl_image = EGL_NO_IMAGE_KHR;
+  guint i;
+
+  for (i = 0; i < texture_egl->num_slots; i++) {
+    GstVaapiTextureEGLSlot *const slot = &texture_egl->slots[i];
+
+    if (slot->sync != EGL_NO_SYNC_KHR) {
+      vtable->eglDestroySyncKHR (ctx->display->base.handle.p, slot->sync);
+      slot->sync = EGL_NO_SYNC_KHR;
+    }
+    if (slot->egl_image != EGL_NO_IMAGE_KHR) {
+      vtable->eglDestroyImageKHR (ctx->display->base.handle.p,
+          slot->egl_image);
+      slot->egl_image = EGL_NO_IMAGE_KHR;
+    }
+    gst_mini_object_replace ((GstMiniObject **) & slot->surface, NULL);
   }
-  gst_mini_object_replace ((GstMiniObject **) & texture_egl->surface, NULL);
   gst_vaapi_filter_replace (&texture_egl->filter, NULL);
 }
 
@@ -180,15 +228,18 @@ static void
 do_destroy_texture_unlocked (GstVaapiTextureEGLPrivate * texture_egl)
 {
   GstVaapiTexture *const base_texture = texture_egl->texture;
-  const GLuint texture_id = GST_VAAPI_TEXTURE_ID (base_texture);
+  guint i;
 
   destroy_objects (texture_egl);
 
-  if (texture_id) {
-    if (!base_texture->is_wrapped)
-      egl_destroy_texture (texture_egl->egl_context, texture_id);
-    GST_VAAPI_TEXTURE_ID (base_texture) = 0;
+  for (i = 0; i < texture_egl->num_slots; i++) {
+    GstVaapiTextureEGLSlot *const slot = &texture_egl->slots[i];
+
+    if (slot->texture_id && !base_texture->is_wrapped)
+      egl_destroy_texture (texture_egl->egl_context, slot->texture_id);
+    slot->texture_id = 0;
   }
+  GST_VAAPI_TEXTURE_ID (base_texture) = 0;
 }
 
 static void
@@ -211,15 +262,40 @@ static gboolean
 do_upload_surface_unlocked (GstVaapiTextureEGLPrivate * texture_egl,
     GstVaapiSurface * surface, const GstVaapiRectangle * crop_rect, guint flags)
 {
+  EglContext *const ctx = texture_egl->egl_context;
+  EglVTable *const vtable = egl_context_get_vtable (ctx, FALSE);
+  GstVaapiTextureEGLSlot *slot;
   GstVaapiFilterStatus status;
+  guint slot_index;
 
   if (!gst_vaapi_filter_set_cropping_rectangle (texture_egl->filter, crop_rect))
     return FALSE;
 
+  /* Upload into the texture used the longest time ago, once the GL
+     commands of its previous upload completed */
+  slot_index = (texture_egl->current_slot + 1) % texture_egl->num_slots;
+  slot = &texture_egl->slots[slot_index];
+  if (slot->sync != EGL_NO_SYNC_KHR) {
+    if (vtable->eglClientWaitSyncKHR (ctx->display->base.handle.p,
+            slot->sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+            G_GUINT64_CONSTANT (1000000000)) == EGL_FALSE)
+      GST_WARNING ("failed to wait for texture %u", slot->texture_id);
+    vtable->eglDestroySyncKHR (ctx->display->base.handle.p, slot->sync);
+    slot->sync = EGL_NO_SYNC_KHR;
+  }
+
   status = gst_vaapi_filter_process (texture_egl->filter, surface,
-      texture_egl->surface, flags);
+      slot->surface, flags);
   if (status != GST_VAAPI_FILTER_STATUS_SUCCESS)
     return FALSE;
+
+  if (texture_egl->num_slots > 1) {
+    slot->sync = vtable->eglCreateSyncKHR (ctx->display->base.handle.p,
+        EGL_SYNC_FENCE_KHR, NULL);
+    vtable->glFlush ();
+  }
+  texture_egl->current_slot = slot_index;
+  GST_VAAPI_TEXTURE_ID (texture_egl->texture) = slot->texture_id;
   return TRUE;
 }
 
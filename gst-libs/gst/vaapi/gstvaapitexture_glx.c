@@ -46,6 +46,15 @@
   ((GstVaapiTextureGLX *)(texture))
 
 typedef struct _GstVaapiTextureGLXPrivate GstVaapiTextureGLXPrivate;
+typedef struct _GstVaapiTextureGLXSlot GstVaapiTextureGLXSlot;
+
+/* One GL texture of the ring, with the fence of its last upload */
+struct _GstVaapiTextureGLXSlot
+{
+  GLuint texture_id;
+  GLFramebufferObject *fbo;
+  GLsync sync;
+};
 
 /**
  * GstVaapiTextureGLXPrivate:
@@ -58,7 +67,9 @@ struct _GstVaapiTextureGLXPrivate
   GstVaapiTexture *texture;
   GLContextState *gl_context;
   GLPixmapObject *pixo;
-  GLFramebufferObject *fbo;
+  GstVaapiTextureGLXSlot slots[GST_VAAPI_TEXTURE_RING_SIZE];
+  guint num_slots;
+  guint current_slot;
 };
 
 static gboolean
@@ -69,14 +80,24 @@ gst_vaapi_texture_glx_put_surface (GstVaapiTexture * texture,
 static void
 destroy_objects (GstVaapiTextureGLXPrivate * texture)
 {
+  GLVTable *const gl_vtable = gl_get_vtable ();
   GLContextState old_cs;
+  guint i;
 
   if (texture->gl_context)
     gl_set_current_context (texture->gl_context, &old_cs);
 
-  if (texture->fbo) {
-    gl_destroy_framebuffer_object (texture->fbo);
-    texture->fbo = NULL;
+  for (i = 0; i < texture->num_slots; i++) {
+    GstVaapiTextureGLXSlot *const slot = &texture->slots[i];
+
+    if (slot->sync) {
+      gl_vtable->gl_delete_sync (slot->sync);
+      slot->sync = NULL;
+    }
+    if (slot->fbo) {
+      gl_destroy_framebuffer_object (slot->fbo);
+      slot->fbo = NULL;
+    }
   }
 
   if (texture->pixo) {
@@ -95,15 +116,18 @@ static void
 destroy_texture_unlocked (GstVaapiTextureGLXPrivate * texture_glx)
 {
   GstVaapiTexture *texture = texture_glx->texture;
-  const guint texture_id = GST_VAAPI_TEXTURE_ID (texture);
+  guint i;
 
   destroy_objects (texture_glx);
 
-  if (texture_id) {
-    if (!texture->is_wrapped)
-      glDeleteTextures (1, &texture_id);
-    GST_VAAPI_TEXTURE_ID (texture) = 0;
+  for (i = 0; i < texture_glx->num_slots; i++) {
+    GstVaapiTextureGLXSlot *const slot = &texture_glx->slots[i];
+
+    if (slot->texture_id && !texture->is_wrapped)
+      glDeleteTextures (1, &slot->texture_id);
+    slot->texture_id = 0;
   }
+  GST_VAAPI_TEXTURE_ID (texture) = 0;
 }
 
 static void
@@ -119,7 +143,7 @@ gst_vaapi_texture_glx_destroy (GstVaapiTextureGLXPrivate * texture_glx)
 }
 
 static gboolean
-create_objects (GstVaapiTexture * texture, guint texture_id)
+create_objects (GstVaapiTexture * texture)
 {
   GstVaapiTextureGLXPrivate *texture_glx =
       gst_vaapi_texture_get_private (texture);
@@ -127,6 +151,7 @@ create_objects (GstVaapiTexture * texture, guint texture_id)
       GST_VAAPI_DISPLAY_NATIVE (GST_VAAPI_TEXTURE_DISPLAY (texture));
   GLContextState old_cs;
   gboolean success = FALSE;
+  guint i;
 
   gl_get_current_context (&old_cs);
 
@@ -143,11 +168,15 @@ create_objects (GstVaapiTexture * texture, guint texture_id)
     goto out_reset_context;
   }
 
-  texture_glx->fbo = gl_create_framebuffer_object (texture->gl_target,
-      texture_id, texture->width, texture->height);
-  if (!texture_glx->fbo) {
-    GST_ERROR ("failed to create FBO");
-    goto out_reset_context;
+  for (i = 0; i < texture_glx->num_slots; i++) {
+    GstVaapiTextureGLXSlot *const slot = &texture_glx->slots[i];
+
+    slot->fbo = gl_create_framebuffer_object (texture->gl_target,
+        slot->texture_id, texture->width, texture->height);
+    if (!slot->fbo) {
+      GST_ERROR ("failed to create FBO");
+      goto out_reset_context;
+    }
   }
   success = TRUE;
 
@@ -159,18 +188,29 @@ out_reset_context:
 static gboolean
 create_texture_unlocked (GstVaapiTexture * texture)
 {
-  guint texture_id;
-
-  if (texture->is_wrapped)
-    texture_id = GST_VAAPI_TEXTURE_ID (texture);
-  else {
-    texture_id = gl_create_texture (texture->gl_target, texture->gl_format,
-        texture->width, texture->height);
-    if (!texture_id)
-      return FALSE;
-    GST_VAAPI_TEXTURE_ID (texture) = texture_id;
+  GstVaapiTextureGLXPrivate *texture_glx =
+      gst_vaapi_texture_get_private (texture);
+  GLVTable *const gl_vtable = gl_get_vtable ();
+  guint i;
+
+  /* Foreign textures are owned by the caller, and rotating through
+     more textures is only safe if uploads can be fenced */
+  if (texture->is_wrapped) {
+    texture_glx->num_slots = 1;
+    texture_glx->slots[0].texture_id = GST_VAAPI_TEXTURE_ID (texture);
+  } else {
+    texture_glx->num_slots = (gl_vtable && gl_vtable->has_sync) ?
+        GST_VAAPI_TEXTURE_RING_SIZE : 1;
+    for (i = 0; i < texture_glx->num_slots; i++) {
+      texture_glx->slots[i].texture_id = gl_create_texture (texture->gl_target,
+          texture->gl_format, texture->width, texture->height);
+      if (!texture_glx->slots[i].texture_id)
+        return FALSE;
+    }
+    GST_VAAPI_TEXTURE_ID (texture) = texture_glx->slots[0].texture_id;
   }
-  return create_objects (texture, texture_id);
+  texture_glx->current_slot = 0;
+  return create_objects (texture);
 }
 
 static gboolean
@@ -347,9 +387,12 @@ gst_vaapi_texture_glx_put_surface_unlocked (GstVaapiTexture * texture,
 {
   GstVaapiTextureGLXPrivate *texture_glx =
       gst_vaapi_texture_get_private (texture);
+  GLVTable *const gl_vtable = gl_get_vtable ();
+  GstVaapiTextureGLXSlot *slot;
   VAStatus status;
   GLContextState old_cs;
   gboolean success = FALSE;
+  guint slot_index;
 
   const GLfloat *txc, *tyc;
   static const GLfloat g_texcoords[2][2] = {
@@ -369,7 +412,20 @@ gst_vaapi_texture_glx_put_surface_unlocked (GstVaapiTexture * texture,
       !gl_set_current_context (texture_glx->gl_context, &old_cs))
     return FALSE;
 
-  if (!gl_bind_framebuffer_object (texture_glx->fbo)) {
+  /* Upload into the texture used the longest time ago, once the GL
+     commands of its previous upload completed */
+  slot_index = (texture_glx->current_slot + 1) % texture_glx->num_slots;
+  slot = &texture_glx->slots[slot_index];
+  if (slot->sync) {
+    if (gl_vtable->gl_client_wait_sync (slot->sync,
+            GL_SYNC_FLUSH_COMMANDS_BIT, G_GUINT64_CONSTANT (1000000000)) ==
+        GL_WAIT_FAILED)
+      GST_WARNING ("failed to wait for texture %u", slot->texture_id);
+    gl_vtable->gl_delete_sync (slot->sync);
+    slot->sync = NULL;
+  }
+
+  if (!gl_bind_framebuffer_object (slot->fbo)) {
     GST_ERROR ("failed to bind FBO");
     goto out_reset_context;
   }
@@ -406,10 +462,17 @@ gst_vaapi_texture_glx_put_surface_unlocked (GstVaapiTexture * texture,
     GST_ERROR ("failed to release GLX pixmap");
     goto out_unbind_fbo;
   }
+
+  if (texture_glx->num_slots > 1) {
+    slot->sync = gl_vtable->gl_fence_sync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush ();
+  }
+  texture_glx->current_slot = slot_index;
+  GST_VAAPI_TEXTURE_ID (texture) = slot->texture_id;
   success = TRUE;
 
 out_unbind_fbo:
-  if (!gl_unbind_framebuffer_object (texture_glx->fbo))
+  if (!gl_unbind_framebuffer_object (slot->fbo))
     success = FALSE;
 out_reset_context:
   if (texture_glx->gl_context && !gl_set_current_context (&old_cs, NULL))
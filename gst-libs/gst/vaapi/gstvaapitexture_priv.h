@@ -87,6 +87,10 @@ G_BEGIN_DECLS
 #define GST_VAAPI_TEXTURE_HEIGHT(texture) \
   (GST_VAAPI_TEXTURE (texture)->height)
 
+/* Number of GL textures uploads rotate through, for textures not
+   wrapping a foreign GL texture */
+#define GST_VAAPI_TEXTURE_RING_SIZE 3
+
 /* GstVaapiTextureClass hooks */
 typedef gboolean (*GstVaapiTexturePutSurfaceFunc) (GstVaapiTexture * texture,
     GstVaapiSurface * surface, const GstVaapiRectangle * crop_rect, guint flags);
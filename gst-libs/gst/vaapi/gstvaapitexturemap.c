@@ -26,6 +26,7 @@
  */
 
 #include "gstvaapitexturemap.h"
+#include "gstvaapitexture_priv.h"
 
 #define DEBUG 1
 #include "gstvaapidebug.h"
@@ -40,7 +41,9 @@ struct _GstVaapiTextureMap
   GstObject parent_instance;
 
   /*< private > */
-  GHashTable *texture_map;
+  GHashTable *texture_map;      /* GL texture id -> link in lru */
+  GQueue lru;                   /* most recently used first */
+  guint64 size;
 };
 
 /**
@@ -53,16 +56,38 @@ struct _GstVaapiTextureMapClass
   GstObjectClass parent_class;
 };
 
+/* The least recently used textures are dropped beyond either limit;
+   each one keeps a VA surface of its own size alive */
 #define MAX_NUM_TEXTURE 10
+#define MAX_TEXTURE_MAP_SIZE (128 * 1024 * 1024)
 
 G_DEFINE_TYPE (GstVaapiTextureMap, gst_vaapi_texture_map, GST_TYPE_OBJECT);
 
+static inline guint64
+texture_get_size (GstVaapiTexture * texture)
+{
+  /* RGBA storage */
+  return (guint64) GST_VAAPI_TEXTURE_WIDTH (texture) *
+      GST_VAAPI_TEXTURE_HEIGHT (texture) * 4;
+}
+
+static void
+texture_map_remove_link (GstVaapiTextureMap * map, GList * link)
+{
+  GstVaapiTexture *const texture = link->data;
+
+  g_hash_table_remove (map->texture_map,
+      GUINT_TO_POINTER (GST_VAAPI_TEXTURE_ID (texture)));
+  g_queue_delete_link (&map->lru, link);
+  map->size -= texture_get_size (texture);
+  gst_mini_object_unref (GST_MINI_OBJECT_CAST (texture));
+}
+
 static void
 gst_vaapi_texture_map_init (GstVaapiTextureMap * map)
 {
-  map->texture_map =
-      g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
-      (GDestroyNotify) gst_mini_object_unref);
+  map->texture_map = g_hash_table_new (g_direct_hash, g_direct_equal);
+  g_queue_init (&map->lru);
 }
 
 static void
@@ -71,7 +96,7 @@ gst_vaapi_texture_map_finalize (GObject * object)
   GstVaapiTextureMap *map = GST_VAAPI_TEXTURE_MAP (object);
 
   if (map->texture_map) {
-    g_hash_table_remove_all (map->texture_map);
+    gst_vaapi_texture_map_reset (map);
     g_hash_table_destroy (map->texture_map);
   }
 
@@ -108,7 +133,9 @@ gst_vaapi_texture_map_new (void)
  * @texture: a #GstVaapiTexture instance to add
  * @id: the id of the GLTexture
  *
- * Adds @texture into the @map table.
+ * Adds @texture into the @map table, taking ownership of it. Any
+ * texture previously bound to @id is replaced. The least recently
+ * used textures are evicted to keep the map within its limits.
  *
  * Returns: %TRUE if @texture was inserted correctly.
  **/
@@ -116,17 +143,29 @@ gboolean
 gst_vaapi_texture_map_add (GstVaapiTextureMap * map, GstVaapiTexture * texture,
     guint id)
 {
+  GList *link;
+
   g_return_val_if_fail (map != NULL, FALSE);
   g_return_val_if_fail (map->texture_map != NULL, FALSE);
   g_return_val_if_fail (texture != NULL, FALSE);
-
-  if (g_hash_table_size (map->texture_map) > MAX_NUM_TEXTURE) {
-    GST_WARNING ("Texture map is full");
-    return FALSE;
+  g_return_val_if_fail (GST_VAAPI_TEXTURE_ID (texture) == id, FALSE);
+
+  link = g_hash_table_lookup (map->texture_map, GUINT_TO_POINTER (id));
+  if (link)
+    texture_map_remove_link (map, link);
+
+  g_queue_push_head (&map->lru, texture);
+  g_hash_table_insert (map->texture_map, GUINT_TO_POINTER (id),
+      map->lru.head);
+  map->size += texture_get_size (texture);
+
+  /* Always keep the texture just added */
+  while (map->lru.length > 1 && (map->lru.length > MAX_NUM_TEXTURE ||
+          map->size > MAX_TEXTURE_MAP_SIZE)) {
+    GST_DEBUG ("evicting texture %u",
+        GST_VAAPI_TEXTURE_ID (map->lru.tail->data));
+    texture_map_remove_link (map, map->lru.tail);
   }
-
-  g_hash_table_insert (map->texture_map, GUINT_TO_POINTER (id), texture);
-
   return TRUE;
 }
 
@@ -136,17 +175,62 @@ gst_vaapi_texture_map_add (GstVaapiTextureMap * map, GstVaapiTexture * texture,
  * @id: the id of the GLTexture
  *
  * Search for the #GstVaapiTexture associated with the GLTexture @id
- * in the @map.
+ * in the @map, and marks it as the most recently used.
  *
  * Returns: a pointer to #GstVaapiTexture if found; otherwise %NULL.
  **/
 GstVaapiTexture *
 gst_vaapi_texture_map_lookup (GstVaapiTextureMap * map, guint id)
 {
+  GList *link;
+
   g_return_val_if_fail (map != NULL, NULL);
   g_return_val_if_fail (map->texture_map != NULL, NULL);
 
-  return g_hash_table_lookup (map->texture_map, GUINT_TO_POINTER (id));
+  link = g_hash_table_lookup (map->texture_map, GUINT_TO_POINTER (id));
+  if (!link)
+    return NULL;
+
+  if (link != map->lru.head) {
+    g_queue_unlink (&map->lru, link);
+    g_queue_push_head_link (&map->lru, link);
+  }
+  return link->data;
+}
+
+/**
+ * gst_vaapi_texture_map_lookup_full:
+ * @map: a #GstVaapiTextureMap instance
+ * @id: the id of the GLTexture
+ * @target: the target to which the texture is bound
+ * @format: the format of the pixel data
+ * @width: the texture width, or 0 to match any
+ * @height: the texture height, or 0 to match any
+ *
+ * Like gst_vaapi_texture_map_lookup(), but only returns a texture
+ * whose binding still matches the GLTexture @id. GL texture names are
+ * recycled, so the storage of a name may have changed since it was
+ * bound.
+ *
+ * Returns: a pointer to #GstVaapiTexture if found; otherwise %NULL.
+ **/
+GstVaapiTexture *
+gst_vaapi_texture_map_lookup_full (GstVaapiTextureMap * map, guint id,
+    guint target, guint format, guint width, guint height)
+{
+  GstVaapiTexture *texture;
+
+  texture = gst_vaapi_texture_map_lookup (map, id);
+  if (!texture)
+    return NULL;
+
+  if (GST_VAAPI_TEXTURE_TARGET (texture) != target ||
+      GST_VAAPI_TEXTURE_FORMAT (texture) != format)
+    return NULL;
+  if ((width && GST_VAAPI_TEXTURE_WIDTH (texture) != width) ||
+      (height && GST_VAAPI_TEXTURE_HEIGHT (texture) != height))
+    return NULL;
+  return texture;
 }
 
 /**
@@ -161,5 +245,6 @@ gst_vaapi_texture_map_reset (GstVaapiTextureMap * map)
   g_return_if_fail (map != NULL);
   g_return_if_fail (map->texture_map != NULL);
 
-  g_hash_table_remove_all (map->texture_map);
+  while (map->lru.head)
+    texture_map_remove_link (map, map->lru.head);
 }
@@ -47,6 +47,14 @@ GstVaapiTexture *
 gst_vaapi_texture_map_lookup (GstVaapiTextureMap * map,
                               guint id);
 
+GstVaapiTexture *
+gst_vaapi_texture_map_lookup_full (GstVaapiTextureMap * map,
+                                   guint id,
+                                   guint target,
+                                   guint format,
+                                   guint width,
+                                   guint height);
+
 void
 gst_vaapi_texture_map_reset (GstVaapiTextureMap * map);
 
@@ -0,0 +1,479 @@
+/*
+ *  gstvaapitrace.c - per-stage latency tracing
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/* Stage timings are emitted as "vaapi-latency" GstTracerRecord entries,
+   i.e. through the GST_TRACER debug category at the TRACE level, the
+   same way the core tracers log their records. They can be enabled
+   with GST_DEBUG="GST_TRACER:7" and post-processed by the usual tracer
+   log tools.
+
+   Elements may also accumulate the timings of the objects working for
+   them into a GstVaapiTraceStats, attached to those objects, so that
+   they are available as live counters without a tracing setup. When
+   neither is in use, a stage costs a threshold check and an atomic
+   read.
+
+   The GPU time of a picture is measured from its submission until a
+   helper thread sees its surface leave the VASurfaceRendering state
+   with vaQuerySurfaceStatus(), so that it can be told apart from the
+   time the submitting thread would block in vaSyncSurface(). The
+   resolution is the polling interval, and the polling takes the
+   display lock, hence this only runs while tracing is enabled. */
+
+/* GstTracerRecord is flagged as unstable API */
+#define GST_USE_UNSTABLE_API
+
+#include "sysdeps.h"
+#include "gstvaapitrace.h"
+#include "gstvaapisurface_priv.h"
+#include "gstvaapidisplay_priv.h"
+
+/* Interval between two polls of the pending surfaces, in us */
+#define GPU_POLL_INTERVAL 250
+
+/* Bound on the pending surfaces, beyond which pictures are not timed */
+#define GPU_MAX_PENDING 256
+
+static GstDebugCategory *trace_category;
+static GstTracerRecord *trace_record;
+static GQuark trace_stats_quark;
+static gint trace_stats_collectors;
+
+struct _GstVaapiTraceStats
+{
+  gint ref_count;
+  GMutex lock;
+  guint64 count[GST_VAAPI_TRACE_STAGE_SURFACES + 1];
+  GstClockTime total[GST_VAAPI_TRACE_STAGE_SURFACES + 1];
+  GstClockTime max[GST_VAAPI_TRACE_STAGE_SURFACES + 1];
+};
+
+typedef struct
+{
+  GWeakRef object;
+  GstVaapiSurface *surface;
+  GstClockTime pts;
+  GstClockTime start;
+} GpuJob;
+
+static GMutex gpu_lock;
+static GCond gpu_cond;
+static GQueue gpu_jobs = G_QUEUE_INIT;
+static GThread *gpu_thread;
+
+static const gchar *const stage_names[] = {
+  "parse",
+  "decode",
+  "sync",
+  "map-coded",
+  "put-surface",
+  "filter",
+  "gpu",
+  "config",
+  "context",
+  "surfaces",
+};
+
+static gpointer
+trace_init (gpointer data)
+{
+  GST_DEBUG_CATEGORY_GET (trace_category, "GST_TRACER");
+  trace_stats_quark = g_quark_from_static_string ("GstVaapiTraceStats");
+
+  trace_record = gst_tracer_record_new ("vaapi-latency.class",
+      "element", GST_TYPE_STRUCTURE, gst_structure_new ("scope",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "related-to", GST_TYPE_TRACER_VALUE_SCOPE,
+          GST_TRACER_VALUE_SCOPE_ELEMENT, NULL),
+      "stage", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_STRING,
+          "description", G_TYPE_STRING, "pipeline stage", NULL),
+      "pts", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "presentation timestamp of the frame",
+          NULL),
+      "time", GST_TYPE_STRUCTURE, gst_structure_new ("value",
+          "type", G_TYPE_GTYPE, G_TYPE_UINT64,
+          "description", G_TYPE_STRING, "time spent in the stage, in ns",
+          "min", G_TYPE_UINT64, G_GUINT64_CONSTANT (0),
+          "max", G_TYPE_UINT64, G_MAXUINT64, NULL), NULL);
+  GST_OBJECT_FLAG_SET (trace_record, GST_OBJECT_FLAG_MAY_BE_LEAKED);
+  return NULL;
+}
+
+static inline void
+trace_ensure_init (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, trace_init, NULL);
+}
+
+static inline gboolean
+trace_log_is_enabled (void)
+{
+  return trace_category &&
+      gst_debug_category_get_threshold (trace_category) >= GST_LEVEL_TRACE;
+}
+
+/**
+ * gst_vaapi_trace_is_enabled:
+ *
+ * Return value: %TRUE if stage timings are currently being logged or
+ *   collected into a #GstVaapiTraceStats
+ */
+gboolean
+gst_vaapi_trace_is_enabled (void)
+{
+  trace_ensure_init ();
+
+  return g_atomic_int_get (&trace_stats_collectors) > 0 ||
+      trace_log_is_enabled ();
+}
+
+/**
+ * gst_vaapi_trace_stage:
+ * @object: (allow-none): the #GstObject the stage was performed for,
+ *   typically an element or a decoder, encoder or filter object named
+ *   after it
+ * @stage: the #GstVaapiTraceStage
+ * @pts: the presentation timestamp of the frame, if known
+ * @start: the stage start time, from gst_util_get_timestamp()
+ *
+ * Logs the time spent in @stage since @start. This is normally called
+ * through GST_VAAPI_TRACE_END().
+ */
+void
+gst_vaapi_trace_stage (gpointer object, GstVaapiTraceStage stage,
+    GstClockTime pts, GstClockTime start)
+{
+  const GstClockTime end = gst_util_get_timestamp ();
+  const gchar *name = NULL;
+  GstVaapiTraceStats *stats = NULL;
+
+  g_return_if_fail (stage < G_N_ELEMENTS (stage_names));
+
+  trace_ensure_init ();
+
+  if (object && G_IS_OBJECT (object)) {
+    if (g_atomic_int_get (&trace_stats_collectors) > 0)
+      stats = g_object_get_qdata (object, trace_stats_quark);
+    if (GST_IS_OBJECT (object))
+      name = GST_OBJECT_NAME (object);
+  }
+
+  if (stats)
+    gst_vaapi_trace_stats_add (stats, stage, end - start);
+
+  if (trace_log_is_enabled ())
+    gst_tracer_record_log (trace_record, name ? name : "", stage_names[stage],
+        (guint64) pts, (guint64) (end - start));
+}
+
+static void
+gpu_job_free (GpuJob * job)
+{
+  g_weak_ref_clear (&job->object);
+  gst_vaapi_surface_unref (job->surface);
+  g_slice_free (GpuJob, job);
+}
+
+/* Returns FALSE if the surface status could not be queried */
+static gboolean
+gpu_job_poll (GpuJob * job, gboolean * completed)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_SURFACE_DISPLAY (job->surface);
+  VASurfaceStatus surface_status;
+  VAStatus status;
+
+  GST_VAAPI_DISPLAY_LOCK (display);
+  status = vaQuerySurfaceStatus (GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_SURFACE_ID (job->surface), &surface_status);
+  GST_VAAPI_DISPLAY_UNLOCK (display);
+  if (status != VA_STATUS_SUCCESS)
+    return FALSE;
+
+  *completed = !(surface_status & VASurfaceRendering);
+  return TRUE;
+}
+
+static gpointer
+gpu_thread_func (gpointer data)
+{
+  GQueue jobs, pending = G_QUEUE_INIT;
+  GpuJob *job;
+  GObject *object;
+  gboolean completed;
+
+  g_mutex_lock (&gpu_lock);
+  for (;;) {
+    while (g_queue_is_empty (&gpu_jobs))
+      g_cond_wait (&gpu_cond, &gpu_lock);
+    jobs = gpu_jobs;
+    g_queue_init (&gpu_jobs);
+    g_mutex_unlock (&gpu_lock);
+
+    while ((job = g_queue_pop_head (&jobs))) {
+      completed = FALSE;
+      if (gpu_job_poll (job, &completed) && !completed) {
+        g_queue_push_tail (&pending, job);
+        continue;
+      }
+      object = completed ? g_weak_ref_get (&job->object) : NULL;
+      if (object) {
+        gst_vaapi_trace_stage (object, GST_VAAPI_TRACE_STAGE_GPU, job->pts,
+            job->start);
+        g_object_unref (object);
+      }
+      gpu_job_free (job);
+    }
+
+    if (!g_queue_is_empty (&pending))
+      g_usleep (GPU_POLL_INTERVAL);
+
+    g_mutex_lock (&gpu_lock);
+    while ((job = g_queue_pop_tail (&pending)))
+      g_queue_push_head (&gpu_jobs, job);
+  }
+  return NULL;
+}
+
+/**
+ * gst_vaapi_trace_gpu_submit:
+ * @object: the #GstObject the picture was submitted for
+ * @surface: the #GstVaapiSurface the picture renders to
+ * @pts: the presentation timestamp of the frame, if known
+ *
+ * Starts timing the GPU work of the picture just submitted to
+ * @surface, which is accounted as a %GST_VAAPI_TRACE_STAGE_GPU stage of
+ * @object once the surface is no longer rendering. This is normally
+ * called through GST_VAAPI_TRACE_GPU(), right after vaEndPicture().
+ */
+void
+gst_vaapi_trace_gpu_submit (gpointer object, GstVaapiSurface * surface,
+    GstClockTime pts)
+{
+  GpuJob *job;
+
+  g_return_if_fail (G_IS_OBJECT (object));
+  g_return_if_fail (surface != NULL);
+
+  g_mutex_lock (&gpu_lock);
+  if (g_queue_get_length (&gpu_jobs) >= GPU_MAX_PENDING)
+    goto done;
+  if (!gpu_thread)
+    gpu_thread = g_thread_new ("vaapi-gpu-trace", gpu_thread_func, NULL);
+
+  job = g_slice_new (GpuJob);
+  g_weak_ref_init (&job->object, object);
+  job->surface = (GstVaapiSurface *)
+      gst_mini_object_ref (GST_MINI_OBJECT_CAST (surface));
+  job->pts = pts;
+  job->start = gst_util_get_timestamp ();
+  g_queue_push_tail (&gpu_jobs, job);
+  g_cond_signal (&gpu_cond);
+
+done:
+  g_mutex_unlock (&gpu_lock);
+}
+
+/**
+ * gst_vaapi_trace_stats_new:
+ *
+ * Creates an empty accumulator of stage timings.
+ *
+ * Return value: the newly allocated #GstVaapiTraceStats
+ */
+GstVaapiTraceStats *
+gst_vaapi_trace_stats_new (void)
+{
+  GstVaapiTraceStats *stats;
+
+  trace_ensure_init ();
+
+  stats = g_slice_new0 (GstVaapiTraceStats);
+  stats->ref_count = 1;
+  g_mutex_init (&stats->lock);
+  return stats;
+}
+
+/**
+ * gst_vaapi_trace_stats_ref:
+ * @stats: a #GstVaapiTraceStats
+ *
+ * Atomically increases the reference count of @stats by one.
+ *
+ * Return value: @stats
+ */
+GstVaapiTraceStats *
+gst_vaapi_trace_stats_ref (GstVaapiTraceStats * stats)
+{
+  g_return_val_if_fail (stats != NULL, NULL);
+
+  g_atomic_int_inc (&stats->ref_count);
+  return stats;
+}
+
+/**
+ * gst_vaapi_trace_stats_unref:
+ * @stats: a #GstVaapiTraceStats
+ *
+ * Atomically decreases the reference count of @stats by one, and frees
+ * it once the count reaches zero.
+ */
+void
+gst_vaapi_trace_stats_unref (GstVaapiTraceStats * stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  if (!g_atomic_int_dec_and_test (&stats->ref_count))
+    return;
+
+  g_mutex_clear (&stats->lock);
+  g_slice_free (GstVaapiTraceStats, stats);
+}
+
+static void
+trace_stats_release (gpointer data)
+{
+  g_atomic_int_add (&trace_stats_collectors, -1);
+  gst_vaapi_trace_stats_unref (data);
+}
+
+/**
+ * gst_vaapi_trace_stats_attach:
+ * @stats: a #GstVaapiTraceStats
+ * @object: a #GObject
+ *
+ * Accumulates the stages performed for @object into @stats, and enables
+ * stage timing for as long as some object has stats attached. @object
+ * holds a reference to @stats until it is detached or finalized. Any
+ * #GstVaapiTraceStats previously attached to @object is replaced.
+ */
+void
+gst_vaapi_trace_stats_attach (GstVaapiTraceStats * stats, gpointer object)
+{
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (G_IS_OBJECT (object));
+
+  trace_ensure_init ();
+
+  g_atomic_int_inc (&trace_stats_collectors);
+  g_object_set_qdata_full (object, trace_stats_quark,
+      gst_vaapi_trace_stats_ref (stats), trace_stats_release);
+}
+
+/**
+ * gst_vaapi_trace_stats_detach:
+ * @object: a #GObject
+ *
+ * Stops accumulating the stages performed for @object.
+ */
+void
+gst_vaapi_trace_stats_detach (gpointer object)
+{
+  g_return_if_fail (G_IS_OBJECT (object));
+
+  trace_ensure_init ();
+
+  g_object_set_qdata (object, trace_stats_quark, NULL);
+}
+
+/**
+ * gst_vaapi_trace_stats_add:
+ * @stats: a #GstVaapiTraceStats
+ * @stage: the #GstVaapiTraceStage
+ * @duration: the time spent in @stage
+ *
+ * Accounts one run of @stage into @stats.
+ */
+void
+gst_vaapi_trace_stats_add (GstVaapiTraceStats * stats,
+    GstVaapiTraceStage stage, GstClockTime duration)
+{
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (stage < G_N_ELEMENTS (stage_names));
+
+  g_mutex_lock (&stats->lock);
+  stats->count[stage]++;
+  stats->total[stage] += duration;
+  if (duration > stats->max[stage])
+    stats->max[stage] = duration;
+  g_mutex_unlock (&stats->lock);
+}
+
+/**
+ * gst_vaapi_trace_stats_append:
+ * @stats: a #GstVaapiTraceStats
+ * @structure: a #GstStructure
+ *
+ * Sets the "<stage>-count", "<stage>-avg-latency" and
+ * "<stage>-max-latency" fields of @structure, latencies in ns, for
+ * every stage accounted in @stats.
+ */
+void
+gst_vaapi_trace_stats_append (GstVaapiTraceStats * stats,
+    GstStructure * structure)
+{
+  gchar field[64];
+  guint i;
+
+  g_return_if_fail (stats != NULL);
+  g_return_if_fail (structure != NULL);
+
+  g_mutex_lock (&stats->lock);
+  for (i = 0; i < G_N_ELEMENTS (stage_names); i++) {
+    if (stats->count[i] == 0)
+      continue;
+
+    g_snprintf (field, sizeof (field), "%s-count", stage_names[i]);
+    gst_structure_set (structure, field, G_TYPE_UINT64, stats->count[i],
+        NULL);
+    g_snprintf (field, sizeof (field), "%s-avg-latency", stage_names[i]);
+    gst_structure_set (structure, field, G_TYPE_UINT64,
+        (guint64) (stats->total[i] / stats->count[i]), NULL);
+    g_snprintf (field, sizeof (field), "%s-max-latency", stage_names[i]);
+    gst_structure_set (structure, field, G_TYPE_UINT64,
+        (guint64) stats->max[i], NULL);
+  }
+  g_mutex_unlock (&stats->lock);
+}
+
+/**
+ * gst_vaapi_trace_stats_get_total:
+ * @stats: a #GstVaapiTraceStats
+ * @stage: the #GstVaapiTraceStage
+ *
+ * Return value: the time spent in all the runs of @stage accounted in
+ *   @stats
+ */
+GstClockTime
+gst_vaapi_trace_stats_get_total (GstVaapiTraceStats * stats,
+    GstVaapiTraceStage stage)
+{
+  GstClockTime total;
+
+  g_return_val_if_fail (stats != NULL, 0);
+  g_return_val_if_fail (stage < G_N_ELEMENTS (stage_names), 0);
+
+  g_mutex_lock (&stats->lock);
+  total = stats->total[stage];
+  g_mutex_unlock (&stats->lock);
+  return total;
+}
@@ -0,0 +1,124 @@
+/*
+ *  gstvaapitrace.h - per-stage latency tracing
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_TRACE_H
+#define GST_VAAPI_TRACE_H
+
+#include <gst/gst.h>
+#include <gst/vaapi/gstvaapisurface.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GstVaapiTraceStage:
+ * @GST_VAAPI_TRACE_STAGE_PARSE: bitstream parsing of one unit
+ * @GST_VAAPI_TRACE_STAGE_DECODE: vaBeginPicture() to vaEndPicture()
+ * @GST_VAAPI_TRACE_STAGE_SYNC: vaSyncSurface()
+ * @GST_VAAPI_TRACE_STAGE_MAP_CODED: mapping and copy of a coded buffer
+ * @GST_VAAPI_TRACE_STAGE_PUT_SURFACE: rendering of a surface to a window
+ * @GST_VAAPI_TRACE_STAGE_FILTER: video processing of one surface
+ * @GST_VAAPI_TRACE_STAGE_GPU: submission of a picture to the completion
+ *   of its surface, as polled by gst_vaapi_trace_gpu_submit()
+ * @GST_VAAPI_TRACE_STAGE_CONFIG: creation of a VA config
+ * @GST_VAAPI_TRACE_STAGE_CONTEXT: creation of a VA context
+ * @GST_VAAPI_TRACE_STAGE_SURFACES: allocation of the surfaces of a VA
+ *   context
+ *
+ * The pipeline stages timed by gst_vaapi_trace_stage().
+ */
+typedef enum
+{
+  GST_VAAPI_TRACE_STAGE_PARSE,
+  GST_VAAPI_TRACE_STAGE_DECODE,
+  GST_VAAPI_TRACE_STAGE_SYNC,
+  GST_VAAPI_TRACE_STAGE_MAP_CODED,
+  GST_VAAPI_TRACE_STAGE_PUT_SURFACE,
+  GST_VAAPI_TRACE_STAGE_FILTER,
+  GST_VAAPI_TRACE_STAGE_GPU,
+  GST_VAAPI_TRACE_STAGE_CONFIG,
+  GST_VAAPI_TRACE_STAGE_CONTEXT,
+  GST_VAAPI_TRACE_STAGE_SURFACES,
+} GstVaapiTraceStage;
+
+/**
+ * GstVaapiTraceStats:
+ *
+ * An opaque accumulator of stage timings, see gst_vaapi_trace_stats_new().
+ */
+typedef struct _GstVaapiTraceStats GstVaapiTraceStats;
+
+gboolean
+gst_vaapi_trace_is_enabled (void);
+
+void
+gst_vaapi_trace_stage (gpointer object, GstVaapiTraceStage stage,
+    GstClockTime pts, GstClockTime start);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_trace_gpu_submit (gpointer object, GstVaapiSurface * surface,
+    GstClockTime pts);
+
+GstVaapiTraceStats *
+gst_vaapi_trace_stats_new (void);
+
+GstVaapiTraceStats *
+gst_vaapi_trace_stats_ref (GstVaapiTraceStats * stats);
+
+void
+gst_vaapi_trace_stats_unref (GstVaapiTraceStats * stats);
+
+void
+gst_vaapi_trace_stats_attach (GstVaapiTraceStats * stats, gpointer object);
+
+void
+gst_vaapi_trace_stats_detach (gpointer object);
+
+void
+gst_vaapi_trace_stats_add (GstVaapiTraceStats * stats,
+    GstVaapiTraceStage stage, GstClockTime duration);
+
+void
+gst_vaapi_trace_stats_append (GstVaapiTraceStats * stats,
+    GstStructure * structure);
+
+GstClockTime
+gst_vaapi_trace_stats_get_total (GstVaapiTraceStats * stats,
+    GstVaapiTraceStage stage);
+
+/* Returns the start time of a stage, or GST_CLOCK_TIME_NONE if tracing
+   is disabled, in which case GST_VAAPI_TRACE_END() is a no-op */
+#define GST_VAAPI_TRACE_BEGIN() \
+  (gst_vaapi_trace_is_enabled () ? gst_util_get_timestamp () : \
+   GST_CLOCK_TIME_NONE)
+
+#define GST_VAAPI_TRACE_END(start, object, stage, pts) G_STMT_START { \
+    if (G_UNLIKELY (GST_CLOCK_TIME_IS_VALID (start)))                 \
+      gst_vaapi_trace_stage (object, stage, pts, start);              \
+  } G_STMT_END
+
+/* Times the GPU work of the picture just submitted to @surface */
+#define GST_VAAPI_TRACE_GPU(object, surface, pts) G_STMT_START {      \
+    if (G_UNLIKELY (gst_vaapi_trace_is_enabled ()))                   \
+      gst_vaapi_trace_gpu_submit (object, surface, pts);              \
+  } G_STMT_END
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_TRACE_H */
@@ -172,6 +172,23 @@ typedef enum {
 #define GST_VAAPI_RATECONTROL_MASK(RC) \
     (1U << G_PASTE(GST_VAAPI_RATECONTROL_,RC))
 
+/**
+ * GstVaapiPriority:
+ * @GST_VAAPI_PRIORITY_DEFAULT: Leave the driver default priority
+ * @GST_VAAPI_PRIORITY_LOW: The lowest priority the driver supports
+ * @GST_VAAPI_PRIORITY_NORMAL: The middle of the driver priority range
+ * @GST_VAAPI_PRIORITY_HIGH: The highest priority the driver supports
+ *
+ * The priority the GPU scheduler gives to the work submitted on a VA
+ * context, on drivers supporting VAConfigAttribContextPriority.
+ */
+typedef enum {
+    GST_VAAPI_PRIORITY_DEFAULT = 0,
+    GST_VAAPI_PRIORITY_LOW,
+    GST_VAAPI_PRIORITY_NORMAL,
+    GST_VAAPI_PRIORITY_HIGH,
+} GstVaapiPriority;
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_TYPES_H */
@@ -29,6 +29,7 @@
 #include "gstvaapifilter.h"
 #include "gstvaapisubpicture.h"
 #include "gstvaapisurface.h"
+#include "gstvaapivarecord.h"
 #include <stdio.h>
 #include <stdarg.h>
 
@@ -140,8 +141,12 @@ vaapi_map_buffer (VADisplay dpy, VABufferID buf_id)
 {
   VAStatus status;
   gpointer data = NULL;
+  GstClockTime record_start;
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaMapBuffer (dpy, buf_id, &data);
+  GST_VAAPI_VA_RECORD_END (record_start, dpy,
+      GST_VAAPI_VA_RECORD_MAP_BUFFER, status, buf_id);
   if (!vaapi_check_status (status, "vaMapBuffer()"))
     return NULL;
   return data;
@@ -152,11 +157,15 @@ void
 vaapi_unmap_buffer (VADisplay dpy, VABufferID buf_id, gpointer * pbuf)
 {
   VAStatus status;
+  GstClockTime record_start;
 
   if (pbuf)
     *pbuf = NULL;
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaUnmapBuffer (dpy, buf_id);
+  GST_VAAPI_VA_RECORD_END (record_start, dpy,
+      GST_VAAPI_VA_RECORD_UNMAP_BUFFER, status, buf_id);
   if (!vaapi_check_status (status, "vaUnmapBuffer()"))
     return;
 }
@@ -175,11 +184,16 @@ vaapi_create_n_elements_buffer (VADisplay dpy, VAContextID ctx, int type,
     guint size, gconstpointer buf, VABufferID * buf_id_ptr,
     gpointer * mapped_data, int num_elements)
 {
-  VABufferID buf_id;
+  VABufferID buf_id = VA_INVALID_ID;
   VAStatus status;
   gpointer data = (gpointer) buf;
+  GstClockTime record_start;
 
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
   status = vaCreateBuffer (dpy, ctx, type, size, num_elements, data, &buf_id);
+  GST_VAAPI_VA_RECORD_END (record_start, dpy,
+      GST_VAAPI_VA_RECORD_CREATE_BUFFER, status, ctx, type, size,
+      num_elements, buf_id);
   if (!vaapi_check_status (status, "vaCreateBuffer()"))
     return FALSE;
 
@@ -205,13 +219,48 @@ error:
 void
 vaapi_destroy_buffer (VADisplay dpy, VABufferID * buf_id_ptr)
 {
+  GstClockTime record_start;
+  VAStatus status;
+
   if (!buf_id_ptr || *buf_id_ptr == VA_INVALID_ID)
     return;
 
-  vaDestroyBuffer (dpy, *buf_id_ptr);
+  record_start = GST_VAAPI_VA_RECORD_BEGIN ();
+  status = vaDestroyBuffer (dpy, *buf_id_ptr);
+  GST_VAAPI_VA_RECORD_END (record_start, dpy,
+      GST_VAAPI_VA_RECORD_DESTROY_BUFFER, status, *buf_id_ptr);
   *buf_id_ptr = VA_INVALID_ID;
 }
 
+/* Submits a context priority update. It has to be rendered between
+   vaBeginPicture() and vaEndPicture(), and lasts until the next one */
+gboolean
+vaapi_render_context_priority (VADisplay dpy, VAContextID ctx, guint value)
+{
+#if VA_CHECK_VERSION(1,9,0)
+  VAContextParameterUpdateBuffer param;
+  VABufferID buf_id = VA_INVALID_ID;
+  VAStatus status;
+  GstClockTime record_start;
+
+  memset (&param, 0, sizeof (param));
+  param.flags.bits.context_priority_update = 1;
+  param.context_priority.bits.priority = value;
+  if (!vaapi_create_buffer (dpy, ctx, VAContextParameterUpdateBufferType,
+          sizeof (param), &param, &buf_id, NULL))
+    return FALSE;
+
+  record_start = GST_VAAPI_VA_RECORD_RENDER_BEGIN (dpy, &buf_id, 1);
+  status = vaRenderPicture (dpy, ctx, &buf_id, 1);
+  GST_VAAPI_VA_RECORD_END_IDS (record_start, dpy,
+      GST_VAAPI_VA_RECORD_RENDER_PICTURE, status, &buf_id, 1, ctx);
+  vaapi_destroy_buffer (dpy, &buf_id);
+  return vaapi_check_status (status, "vaRenderPicture()");
+#else
+  return FALSE;
+#endif
+}
+
 /* Return a string representation of a VAProfile */
 const gchar *
 string_of_VAProfile (VAProfile profile)
@@ -244,6 +293,8 @@ string_of_VAProfile (VAProfile profile)
 #endif
 #if VA_CHECK_VERSION(1,8,0)
       MAP (HEVCSccMain444_10);
+      MAP (AV1Profile0);
+      MAP (AV1Profile1);
 #endif
       MAP (HEVCMain);
       MAP (HEVCMain10);
@@ -66,6 +66,11 @@ G_GNUC_INTERNAL
 void
 vaapi_destroy_buffer (VADisplay dpy, VABufferID * buf_id);
 
+/** Submits a context priority update, within a picture */
+G_GNUC_INTERNAL
+gboolean
+vaapi_render_context_priority (VADisplay dpy, VAContextID ctx, guint value);
+
 /** Return a string representation of a VAProfile */
 G_GNUC_INTERNAL
 const gchar *
@@ -0,0 +1,321 @@
+/*
+ *  gstvaapiutils_copy.c - fast copy out of VA image mappings
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/* VA images are generally mapped as uncached speculative write-combining
+   (USWC) memory. Regular loads from such memory are not cached and are
+   extremely slow, whereas MOVNTDQA streaming loads fetch a whole cache
+   line into a streaming buffer at once. The SIMD paths below are built
+   with per-function target attributes and selected at runtime, so that
+   no particular compiler flag is needed.
+
+   Uploads go the other way: regular stores to USWC memory are combined
+   reasonably well, but non-temporal MOVNTDQ stores avoid polluting the
+   cache with lines the CPU won't read again. */
+
+#include "sysdeps.h"
+#include "gstvaapiutils_copy.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define USE_STREAMING_LOADS 1
+# include <immintrin.h>
+#else
+# define USE_STREAMING_LOADS 0
+#endif
+
+typedef void (*CopyRowFunc) (guint8 * dst, const guint8 * src, guint len);
+
+static void
+copy_row_c (guint8 * dst, const guint8 * src, guint len)
+{
+  memcpy (dst, src, len);
+}
+
+#if USE_STREAMING_LOADS
+__attribute__ ((target ("sse4.1")))
+static void
+copy_row_sse41 (guint8 * dst, const guint8 * src, guint len)
+{
+  guint n;
+
+  /* MOVNTDQA requires 16-byte aligned sources */
+  n = MIN ((-(guintptr) src) & 15, len);
+  memcpy (dst, src, n);
+  dst += n;
+  src += n;
+  len -= n;
+
+  for (; len >= 64; len -= 64, src += 64, dst += 64) {
+    const __m128i x0 = _mm_stream_load_si128 ((__m128i *) src + 0);
+    const __m128i x1 = _mm_stream_load_si128 ((__m128i *) src + 1);
+    const __m128i x2 = _mm_stream_load_si128 ((__m128i *) src + 2);
+    const __m128i x3 = _mm_stream_load_si128 ((__m128i *) src + 3);
+    _mm_storeu_si128 ((__m128i *) dst + 0, x0);
+    _mm_storeu_si128 ((__m128i *) dst + 1, x1);
+    _mm_storeu_si128 ((__m128i *) dst + 2, x2);
+    _mm_storeu_si128 ((__m128i *) dst + 3, x3);
+  }
+
+  for (; len >= 16; len -= 16, src += 16, dst += 16)
+    _mm_storeu_si128 ((__m128i *) dst,
+        _mm_stream_load_si128 ((__m128i *) src));
+
+  memcpy (dst, src, len);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+copy_row_avx2 (guint8 * dst, const guint8 * src, guint len)
+{
+  guint n;
+
+  /* VMOVNTDQA requires 32-byte aligned sources */
+  n = MIN ((-(guintptr) src) & 31, len);
+  memcpy (dst, src, n);
+  dst += n;
+  src += n;
+  len -= n;
+
+  for (; len >= 128; len -= 128, src += 128, dst += 128) {
+    const __m256i y0 = _mm256_stream_load_si256 ((__m256i *) src + 0);
+    const __m256i y1 = _mm256_stream_load_si256 ((__m256i *) src + 1);
+    const __m256i y2 = _mm256_stream_load_si256 ((__m256i *) src + 2);
+    const __m256i y3 = _mm256_stream_load_si256 ((__m256i *) src + 3);
+    _mm256_storeu_si256 ((__m256i *) dst + 0, y0);
+    _mm256_storeu_si256 ((__m256i *) dst + 1, y1);
+    _mm256_storeu_si256 ((__m256i *) dst + 2, y2);
+    _mm256_storeu_si256 ((__m256i *) dst + 3, y3);
+  }
+
+  for (; len >= 32; len -= 32, src += 32, dst += 32)
+    _mm256_storeu_si256 ((__m256i *) dst,
+        _mm256_stream_load_si256 ((__m256i *) src));
+
+  memcpy (dst, src, len);
+}
+#endif
+
+static gpointer
+select_copy_row_func (gpointer data)
+{
+  CopyRowFunc func = copy_row_c;
+  const gchar *name = "c";
+
+#if USE_STREAMING_LOADS
+  __builtin_cpu_init ();
+  if (!g_getenv ("GST_VAAPI_DISABLE_SIMD_COPY")) {
+    if (__builtin_cpu_supports ("avx2")) {
+      func = copy_row_avx2;
+      name = "avx2";
+    } else if (__builtin_cpu_supports ("sse4.1")) {
+      func = copy_row_sse41;
+      name = "sse4.1";
+    }
+  }
+#endif
+
+  GST_DEBUG ("using %s plane copy", name);
+  return (gpointer) func;
+}
+
+static CopyRowFunc
+get_copy_row_func (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, select_copy_row_func, NULL);
+  return (CopyRowFunc) once.retval;
+}
+
+void
+gst_vaapi_copy_plane (guint8 * dst, guint dst_stride,
+    const guint8 * src, guint src_stride, guint len, guint height)
+{
+  CopyRowFunc const copy_row = get_copy_row_func ();
+  guint i;
+
+  if (copy_row == copy_row_c && dst_stride == src_stride && len == src_stride) {
+    memcpy (dst, src, (gsize) len * height);
+    return;
+  }
+
+  for (i = 0; i < height; i++) {
+    copy_row (dst, src, len);
+    dst += dst_stride;
+    src += src_stride;
+  }
+}
+
+typedef void (*UploadRowFunc) (guint8 * dst, const guint8 * src, guint len);
+typedef void (*InterleaveRowFunc) (guint8 * dst, const guint8 * src_u,
+    const guint8 * src_v, guint len);
+
+typedef struct
+{
+  UploadRowFunc upload_row;
+  InterleaveRowFunc interleave_row;
+} UploadFuncs;
+
+static void
+upload_row_c (guint8 * dst, const guint8 * src, guint len)
+{
+  memcpy (dst, src, len);
+}
+
+static void
+interleave_row_c (guint8 * dst, const guint8 * src_u, const guint8 * src_v,
+    guint len)
+{
+  guint i;
+
+  for (i = 0; i < len; i++) {
+    dst[2 * i + 0] = src_u[i];
+    dst[2 * i + 1] = src_v[i];
+  }
+}
+
+#if USE_STREAMING_LOADS
+__attribute__ ((target ("sse2")))
+static void
+upload_row_sse2 (guint8 * dst, const guint8 * src, guint len)
+{
+  guint n;
+
+  /* MOVNTDQ requires 16-byte aligned destinations */
+  n = MIN ((-(guintptr) dst) & 15, len);
+  memcpy (dst, src, n);
+  dst += n;
+  src += n;
+  len -= n;
+
+  for (; len >= 64; len -= 64, src += 64, dst += 64) {
+    const __m128i x0 = _mm_loadu_si128 ((const __m128i *) src + 0);
+    const __m128i x1 = _mm_loadu_si128 ((const __m128i *) src + 1);
+    const __m128i x2 = _mm_loadu_si128 ((const __m128i *) src + 2);
+    const __m128i x3 = _mm_loadu_si128 ((const __m128i *) src + 3);
+    _mm_stream_si128 ((__m128i *) dst + 0, x0);
+    _mm_stream_si128 ((__m128i *) dst + 1, x1);
+    _mm_stream_si128 ((__m128i *) dst + 2, x2);
+    _mm_stream_si128 ((__m128i *) dst + 3, x3);
+  }
+
+  for (; len >= 16; len -= 16, src += 16, dst += 16)
+    _mm_stream_si128 ((__m128i *) dst,
+        _mm_loadu_si128 ((const __m128i *) src));
+
+  memcpy (dst, src, len);
+}
+
+__attribute__ ((target ("sse2")))
+static void
+interleave_row_sse2 (guint8 * dst, const guint8 * src_u,
+    const guint8 * src_v, guint len)
+{
+  guint n;
+
+  /* Each chroma sample pair is 2 bytes, so an even destination
+   * address is enough to reach 16-byte alignment */
+  n = ((guintptr) dst & 1) ? len : MIN (((-(guintptr) dst) & 15) / 2, len);
+  interleave_row_c (dst, src_u, src_v, n);
+  dst += 2 * n;
+  src_u += n;
+  src_v += n;
+  len -= n;
+
+  for (; len >= 16; len -= 16, src_u += 16, src_v += 16, dst += 32) {
+    const __m128i u = _mm_loadu_si128 ((const __m128i *) src_u);
+    const __m128i v = _mm_loadu_si128 ((const __m128i *) src_v);
+    _mm_stream_si128 ((__m128i *) dst + 0, _mm_unpacklo_epi8 (u, v));
+    _mm_stream_si128 ((__m128i *) dst + 1, _mm_unpackhi_epi8 (u, v));
+  }
+
+  interleave_row_c (dst, src_u, src_v, len);
+}
+#endif
+
+static gpointer
+select_upload_funcs (gpointer data)
+{
+  static UploadFuncs funcs = { upload_row_c, interleave_row_c };
+
+#if USE_STREAMING_LOADS
+  __builtin_cpu_init ();
+  if (!g_getenv ("GST_VAAPI_DISABLE_SIMD_COPY")
+      && __builtin_cpu_supports ("sse2")) {
+    funcs.upload_row = upload_row_sse2;
+    funcs.interleave_row = interleave_row_sse2;
+    GST_DEBUG ("using sse2 plane upload");
+  }
+#endif
+
+  return &funcs;
+}
+
+static const UploadFuncs *
+get_upload_funcs (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, select_upload_funcs, NULL);
+  return once.retval;
+}
+
+static inline void
+upload_fence (void)
+{
+#if USE_STREAMING_LOADS
+  /* Non-temporal stores are weakly ordered, make them visible before
+   * the image is unmapped and handed to the GPU */
+  _mm_sfence ();
+#endif
+}
+
+void
+gst_vaapi_upload_plane (guint8 * dst, guint dst_stride,
+    const guint8 * src, guint src_stride, guint len, guint height)
+{
+  const UploadFuncs *const funcs = get_upload_funcs ();
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    funcs->upload_row (dst, src, len);
+    dst += dst_stride;
+    src += src_stride;
+  }
+  upload_fence ();
+}
+
+void
+gst_vaapi_upload_interleaved_plane (guint8 * dst, guint dst_stride,
+    const guint8 * src_u, guint src_u_stride, const guint8 * src_v,
+    guint src_v_stride, guint len, guint height)
+{
+  const UploadFuncs *const funcs = get_upload_funcs ();
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    funcs->interleave_row (dst, src_u, src_v, len);
+    dst += dst_stride;
+    src_u += src_u_stride;
+    src_v += src_v_stride;
+  }
+  upload_fence ();
+}
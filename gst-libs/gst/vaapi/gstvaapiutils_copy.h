@@ -0,0 +1,49 @@
+/*
+ *  gstvaapiutils_copy.h - fast copy out of VA image mappings
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_UTILS_COPY_H
+#define GST_VAAPI_UTILS_COPY_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Copies @height lines of @len bytes, using streaming loads when the
+    CPU supports them. Suitable for reading from uncached (USWC) memory */
+void
+gst_vaapi_copy_plane (guint8 * dst, guint dst_stride,
+    const guint8 * src, guint src_stride, guint len, guint height);
+
+/** Copies @height lines of @len bytes into uncached (USWC) memory,
+    using non-temporal stores when the CPU supports them */
+void
+gst_vaapi_upload_plane (guint8 * dst, guint dst_stride,
+    const guint8 * src, guint src_stride, guint len, guint height);
+
+/** Interleaves @height lines of @len samples from the @src_u and
+    @src_v planes into a two-component plane (e.g. NV12 chroma) in
+    uncached memory */
+void
+gst_vaapi_upload_interleaved_plane (guint8 * dst, guint dst_stride,
+    const guint8 * src_u, guint src_u_stride, const guint8 * src_v,
+    guint src_v_stride, guint len, guint height);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_UTILS_COPY_H */
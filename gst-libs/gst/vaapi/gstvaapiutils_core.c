@@ -77,6 +77,60 @@ gst_vaapi_get_config_attribute (GstVaapiDisplay * display, VAProfile profile,
   return TRUE;
 }
 
+/**
+ * gst_vaapi_get_context_priority_max:
+ * @display: a #GstVaapiDisplay
+ * @profile: a VA profile
+ * @entrypoint: a VA entrypoint
+ *
+ * Return value: the highest context priority value the driver takes
+ *   for @profile/@entrypoint, or 0 if it does not support priorities
+ */
+guint
+gst_vaapi_get_context_priority_max (GstVaapiDisplay * display,
+    VAProfile profile, VAEntrypoint entrypoint)
+{
+#if VA_CHECK_VERSION(1,9,0)
+  guint value;
+
+  if (gst_vaapi_get_config_attribute (display, profile, entrypoint,
+          VAConfigAttribContextPriority, &value))
+    return value;
+#endif
+  return 0;
+}
+
+/**
+ * gst_vaapi_priority_to_va_value:
+ * @priority: a #GstVaapiPriority
+ * @max_value: the value from gst_vaapi_get_context_priority_max()
+ * @was_set: %TRUE if a priority was already applied to the context
+ *
+ * Maps @priority to the driver range. The default priority is left
+ * alone, unless another one was applied before: the middle of the
+ * range is then restored.
+ *
+ * Return value: the context priority value, or -1 for none
+ */
+gint
+gst_vaapi_priority_to_va_value (GstVaapiPriority priority, guint max_value,
+    gboolean was_set)
+{
+  if (max_value == 0)
+    return -1;
+
+  switch (priority) {
+    case GST_VAAPI_PRIORITY_LOW:
+      return 0;
+    case GST_VAAPI_PRIORITY_HIGH:
+      return max_value;
+    case GST_VAAPI_PRIORITY_NORMAL:
+      return max_value / 2;
+    default:
+      return was_set ? (gint) (max_value / 2) : -1;
+  }
+}
+
 static VASurfaceAttrib *
 get_surface_attributes (GstVaapiDisplay * display, VAConfigID config,
     guint * num_attribs)
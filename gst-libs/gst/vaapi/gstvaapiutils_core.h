@@ -59,6 +59,16 @@ gboolean
 gst_vaapi_get_config_attribute (GstVaapiDisplay * display, VAProfile profile,
     VAEntrypoint entrypoint, VAConfigAttribType type, guint * out_value_ptr);
 
+G_GNUC_INTERNAL
+guint
+gst_vaapi_get_context_priority_max (GstVaapiDisplay * display,
+    VAProfile profile, VAEntrypoint entrypoint);
+
+G_GNUC_INTERNAL
+gint
+gst_vaapi_priority_to_va_value (GstVaapiPriority priority, guint max_value,
+    gboolean was_set);
+
 G_GNUC_INTERNAL
 GstVaapiConfigSurfaceAttributes *
 gst_vaapi_config_surface_attributes_get (GstVaapiDisplay * display, VAConfigID config);
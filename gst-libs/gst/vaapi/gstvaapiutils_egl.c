@@ -22,6 +22,7 @@
 
 #include "sysdeps.h"
 #include "gstvaapiutils_egl.h"
+#include "gstvaapiutils_numa.h"
 #if USE_GST_GL_HELPERS
 # include <gst/gl/gl.h>
 # if GST_GL_HAVE_PLATFORM_EGL
@@ -513,13 +514,40 @@ egl_vtable_new_cached (EglDisplay * display, guint gles_version)
 /* ------------------------------------------------------------------------- */
 // EGL Display
 
+/* Maximum number of messages the GL thread runs before waking up their
+   senders */
+#define EGL_MAX_BATCH_SIZE 16
+
+/* The display whose GL commands the current thread runs in place */
+static GPrivate g_inline_display;
+
+static inline gboolean
+egl_display_is_gl_thread (EglDisplay * display)
+{
+  return display->is_direct || display->gl_thread == g_thread_self () ||
+      g_private_get (&g_inline_display) == display;
+}
+
+static void
+egl_display_run_inline (EglDisplay * display, EglContextRunFunc func,
+    gpointer args)
+{
+  gpointer const prev_display = g_private_get (&g_inline_display);
+
+  g_rec_mutex_lock (&display->gl_lock);
+  g_private_set (&g_inline_display, display);
+  func (args);
+  g_private_set (&g_inline_display, prev_display);
+  g_rec_mutex_unlock (&display->gl_lock);
+}
+
 static gboolean
 egl_display_run (EglDisplay * display, EglContextRunFunc func, gpointer args)
 {
   EglMessage *msg;
 
-  if (display->gl_thread == g_thread_self ()) {
-    func (args);
+  if (egl_display_is_gl_thread (display)) {
+    egl_display_run_inline (display, func, args);
     return TRUE;
   }
 
@@ -540,9 +568,39 @@ egl_display_run (EglDisplay * display, EglContextRunFunc func, gpointer args)
   return TRUE;
 }
 
+/* Opens the Mesa surfaceless platform, which needs neither a window
+   system nor a native display */
+static EGLDisplay
+egl_get_surfaceless_display (void)
+{
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+  const gchar *extensions;
+
+  extensions = eglQueryString (EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (!extensions || !strstr (extensions, "EGL_MESA_platform_surfaceless"))
+    goto error_unsupported;
+
+  get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress ("eglGetPlatformDisplayEXT");
+  if (!get_platform_display)
+    goto error_unsupported;
+  return get_platform_display (EGL_PLATFORM_SURFACELESS_MESA,
+      EGL_DEFAULT_DISPLAY, NULL);
+
+  /* ERRORS */
+error_unsupported:
+  {
+    GST_ERROR ("EGL_MESA_platform_surfaceless is not supported");
+    return EGL_NO_DISPLAY;
+  }
+}
+
 static gpointer
 egl_get_display_from_native (guintptr native_display, guint gl_platform)
 {
+  if (gl_platform == EGL_PLATFORM_SURFACELESS)
+    return egl_get_surfaceless_display ();
+
 #if USE_GST_GL_HELPERS && GST_GL_HAVE_PLATFORM_EGL
   EGLDisplay ret;
   GstGLDisplayType display_type = GST_GL_DISPLAY_TYPE_ANY;
@@ -565,23 +623,23 @@ egl_get_display_from_native (guintptr native_display, guint gl_platform)
   return eglGetDisplay ((EGLNativeDisplayType) native_display);
 }
 
-static gpointer
-egl_display_thread (gpointer data)
+/* Opens and queries the EGL display, on the thread that will run the
+   GL commands */
+static gboolean
+egl_display_setup (EglDisplay * display)
 {
-  EglDisplay *const display = data;
   EGLDisplay gl_display = display->base.handle.p;
   EGLint major_version, minor_version;
   gchar **gl_apis, **gl_api;
 
-  g_mutex_lock (&display->mutex);
   if (!display->base.is_wrapped) {
     gl_display = display->base.handle.p =
         egl_get_display_from_native (display->base.handle.u,
         display->gl_platform);
     if (!gl_display)
-      goto error;
+      return FALSE;
     if (!eglInitialize (gl_display, &major_version, &minor_version))
-      goto error;
+      return FALSE;
   }
 
   display->gl_vendor_string =
@@ -597,7 +655,7 @@ egl_display_thread (gpointer data)
 
   gl_apis = g_strsplit (display->gl_apis_string, " ", 0);
   if (!gl_apis)
-    goto error;
+    return FALSE;
   for (gl_api = gl_apis; *gl_api != NULL; gl_api++) {
     const GlVersionInfo *const vinfo =
         gl_version_info_lookup_by_api_name (*gl_api);
@@ -606,7 +664,29 @@ egl_display_thread (gpointer data)
       display->gl_apis |= vinfo->gl_api_bit;
   }
   g_strfreev (gl_apis);
-  if (!display->gl_apis)
+  return display->gl_apis != 0;
+}
+
+static void
+egl_display_teardown (EglDisplay * display)
+{
+  EGLDisplay const gl_display = display->base.handle.p;
+
+  if (gl_display != EGL_NO_DISPLAY && !display->base.is_wrapped)
+    eglTerminate (gl_display);
+  display->base.handle.p = NULL;
+}
+
+static gpointer
+egl_display_thread (gpointer data)
+{
+  EglDisplay *const display = data;
+
+  /* Next to the GPU the uploaded textures come from */
+  gst_vaapi_numa_bind_thread (display->numa_node);
+
+  g_mutex_lock (&display->mutex);
+  if (!egl_display_setup (display))
     goto error;
 
   display->base.is_valid = TRUE;
@@ -615,24 +695,34 @@ egl_display_thread (gpointer data)
   g_mutex_unlock (&display->mutex);
 
   while (!display->gl_thread_cancel) {
-    EglMessage *const msg =
-        g_async_queue_timeout_pop (display->gl_queue, 100000);
-
-    if (msg) {
-      if (msg->base.is_valid) {
+    EglMessage *msg = g_async_queue_pop (display->gl_queue);
+    EglMessage *batch[EGL_MAX_BATCH_SIZE];
+    guint i, n = 0;
+
+    /* Run whatever was queued meanwhile too, then wake all the
+       senders up at once */
+    g_rec_mutex_lock (&display->gl_lock);
+    do {
+      if (msg->base.is_valid)
         msg->func (msg->args);
-        msg->base.is_valid = FALSE;
-        g_cond_broadcast (&display->gl_thread_ready);
-      }
-      egl_object_unref (msg);
-    }
+      batch[n++] = msg;
+    } while (n < EGL_MAX_BATCH_SIZE &&
+        (msg = g_async_queue_try_pop (display->gl_queue)));
+    g_rec_mutex_unlock (&display->gl_lock);
+
+    g_mutex_lock (&display->mutex);
+    for (i = 0; i < n; i++)
+      batch[i]->base.is_valid = FALSE;
+    g_cond_broadcast (&display->gl_thread_ready);
+    g_mutex_unlock (&display->mutex);
+
+    for (i = 0; i < n; i++)
+      egl_object_unref (batch[i]);
   }
   g_mutex_lock (&display->mutex);
 
 done:
-  if (gl_display != EGL_NO_DISPLAY && !display->base.is_wrapped)
-    eglTerminate (gl_display);
-  display->base.handle.p = NULL;
+  egl_display_teardown (display);
   g_cond_broadcast (&display->gl_thread_ready);
   g_mutex_unlock (&display->mutex);
   return NULL;
@@ -649,12 +739,25 @@ error:
 static gboolean
 egl_display_init (EglDisplay * display)
 {
+  g_mutex_init (&display->mutex);
+  g_rec_mutex_init (&display->gl_lock);
+
+  /* A surfaceless display has no window system thread affinity, so
+     saves the round trips through the GL thread */
+  display->is_direct = display->gl_platform == EGL_PLATFORM_SURFACELESS;
+  if (display->is_direct) {
+    display->created = TRUE;
+    display->base.is_valid = egl_display_setup (display);
+    if (!display->base.is_valid)
+      egl_display_teardown (display);
+    return display->base.is_valid;
+  }
+
   display->gl_queue =
       g_async_queue_new_full ((GDestroyNotify) gst_vaapi_mini_object_unref);
   if (!display->gl_queue)
     return FALSE;
 
-  g_mutex_init (&display->mutex);
   g_cond_init (&display->gl_thread_ready);
   display->gl_thread = g_thread_try_new ("OpenGL Thread", egl_display_thread,
       display, NULL);
@@ -671,11 +774,22 @@ egl_display_init (EglDisplay * display)
 static void
 egl_display_finalize (EglDisplay * display)
 {
-  display->gl_thread_cancel = TRUE;
-  g_thread_join (display->gl_thread);
-  g_cond_clear (&display->gl_thread_ready);
+  if (display->is_direct)
+    egl_display_teardown (display);
+  else {
+    if (display->gl_thread) {
+      /* Wakes the GL thread up with an empty message */
+      display->gl_thread_cancel = TRUE;
+      g_async_queue_push (display->gl_queue,
+          egl_object_new0 (egl_message_class ()));
+      g_thread_join (display->gl_thread);
+    }
+    g_cond_clear (&display->gl_thread_ready);
+  }
+  if (display->gl_queue)
+    g_async_queue_unref (display->gl_queue);
+  g_rec_mutex_clear (&display->gl_lock);
   g_mutex_clear (&display->mutex);
-  g_async_queue_unref (display->gl_queue);
 
   g_free (display->gl_vendor_string);
   g_free (display->gl_version_string);
@@ -683,7 +797,8 @@ egl_display_finalize (EglDisplay * display)
 }
 
 static EglDisplay *
-egl_display_new_full (gpointer handle, gboolean is_wrapped, guint platform)
+egl_display_new_full (gpointer handle, gboolean is_wrapped, guint platform,
+    gint numa_node)
 {
   EglDisplay *display;
 
@@ -694,6 +809,7 @@ egl_display_new_full (gpointer handle, gboolean is_wrapped, guint platform)
   display->base.handle.p = handle;
   display->base.is_wrapped = is_wrapped;
   display->gl_platform = platform;
+  display->numa_node = numa_node;
   if (!egl_display_init (display))
     goto error;
   return display;
@@ -707,11 +823,12 @@ error:
 }
 
 EglDisplay *
-egl_display_new (gpointer native_display, guint platform)
+egl_display_new (gpointer native_display, guint platform, gint numa_node)
 {
-  g_return_val_if_fail (native_display != NULL, NULL);
+  g_return_val_if_fail (native_display != NULL ||
+      platform == EGL_PLATFORM_SURFACELESS, NULL);
 
-  return egl_display_new_full (native_display, FALSE, platform);
+  return egl_display_new_full (native_display, FALSE, platform, numa_node);
 }
 
 EglDisplay *
@@ -719,7 +836,7 @@ egl_display_new_wrapped (EGLDisplay gl_display)
 {
   g_return_val_if_fail (gl_display != EGL_NO_DISPLAY, NULL);
 
-  return egl_display_new_full (gl_display, TRUE, EGL_PLATFORM_UNKNOWN);
+  return egl_display_new_full (gl_display, TRUE, EGL_PLATFORM_UNKNOWN, -1);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -797,6 +914,11 @@ egl_config_new (EglDisplay * display, guint gles_version, GstVideoFormat format)
   *attrib++ = GST_VIDEO_FORMAT_INFO_DEPTH (finfo, GST_VIDEO_COMP_A);
   *attrib++ = EGL_RENDERABLE_TYPE;
   *attrib++ = vinfo->gl_api_bit;
+  if (display->gl_platform == EGL_PLATFORM_SURFACELESS) {
+    /* No window surfaces there, EGL_WINDOW_BIT is the default */
+    *attrib++ = EGL_SURFACE_TYPE;
+    *attrib++ = EGL_PBUFFER_BIT;
+  }
   *attrib++ = EGL_NONE;
   g_assert (attrib - attribs <= G_N_ELEMENTS (attribs));
 
@@ -859,6 +981,11 @@ egl_config_new_from_gl_context (EglDisplay * display, EGLContext gl_context)
   *attrib++ = config_id;
   *attrib++ = EGL_RENDERABLE_TYPE;
   *attrib++ = vinfo->gl_api_bit;
+  if (display->gl_platform == EGL_PLATFORM_SURFACELESS) {
+    /* No window surfaces there, EGL_WINDOW_BIT is the default */
+    *attrib++ = EGL_SURFACE_TYPE;
+    *attrib++ = EGL_PBUFFER_BIT;
+  }
   *attrib++ = EGL_NONE;
   g_assert (attrib - attribs <= G_N_ELEMENTS (attribs));
 
@@ -1138,7 +1265,7 @@ EglVTable *
 egl_context_get_vtable (EglContext * ctx, gboolean need_gl_symbols)
 {
   g_return_val_if_fail (ctx != NULL, NULL);
-  g_return_val_if_fail (ctx->display->gl_thread == g_thread_self (), NULL);
+  g_return_val_if_fail (egl_display_is_gl_thread (ctx->display), NULL);
 
   if (!ensure_vtable (ctx))
     return NULL;
@@ -1167,9 +1294,13 @@ egl_context_set_current (EglContext * ctx, gboolean activate,
   EglContextState cs, *new_cs;
 
   g_return_val_if_fail (ctx != NULL, FALSE);
-  g_return_val_if_fail (ctx->display->gl_thread == g_thread_self (), FALSE);
+  g_return_val_if_fail (egl_display_is_gl_thread (ctx->display), FALSE);
 
   if (activate) {
+    /* The bound API is per-thread, and direct displays run on any */
+    if (ctx->display->is_direct && ctx->config)
+      eglBindAPI (ctx->config->gl_api);
+
     new_cs = &cs;
     new_cs->display = ctx->display->base.handle.p;
     new_cs->context = ctx->base.handle.p;
@@ -1202,6 +1333,14 @@ egl_context_run (EglContext * ctx, EglContextRunFunc func, gpointer args)
   g_return_val_if_fail (ctx != NULL, FALSE);
   g_return_val_if_fail (func != NULL, FALSE);
 
+  /* No need for the GL thread if the caller already runs GL commands
+     on that display, e.g. from a GstGL context shared with @ctx */
+  if (ctx->config && eglGetCurrentContext () != EGL_NO_CONTEXT &&
+      eglGetCurrentDisplay () == ctx->display->base.handle.p &&
+      eglQueryAPI () == ctx->config->gl_api) {
+    egl_display_run_inline (ctx->display, func, args);
+    return TRUE;
+  }
   return egl_display_run (ctx->display, func, args);
 }
 
@@ -55,6 +55,7 @@ enum {
   EGL_PLATFORM_UNKNOWN,
   EGL_PLATFORM_X11,
   EGL_PLATFORM_WAYLAND,
+  EGL_PLATFORM_SURFACELESS,
 };
 
 union egl_handle_s
@@ -116,6 +117,7 @@ struct egl_display_s
   gchar *gl_apis_string;
   guint gl_apis;                /* EGL_*_BIT mask */
   guint gl_platform;
+  gint numa_node;               /* of the GL thread, or -1 */
 
   GMutex mutex;
   GThread *gl_thread;
@@ -123,6 +125,10 @@ struct egl_display_s
   volatile gboolean gl_thread_cancel;
   GAsyncQueue *gl_queue;
   gboolean created;
+
+  /* Without a native display, GL work runs on the calling thread */
+  gboolean is_direct;
+  GRecMutex gl_lock;
 };
 
 struct egl_config_s
@@ -195,7 +201,8 @@ struct egl_window_s
 
 G_GNUC_INTERNAL
 EglDisplay *
-egl_display_new (gpointer native_display, guint gl_platform);
+egl_display_new (gpointer native_display, guint gl_platform,
+    gint numa_node);
 
 G_GNUC_INTERNAL
 EglDisplay *
@@ -789,6 +789,19 @@ gl_init_vtable (void)
       return NULL;
     gl_vtable->has_framebuffer_object = TRUE;
   }
+
+  /* GL_ARB_sync */
+  has_extension = find_string ("GL_ARB_sync", gl_extensions, " ");
+  if (has_extension) {
+    gl_vtable->gl_fence_sync = (PFNGLFENCESYNCPROC)
+        get_proc_address ("glFenceSync");
+    gl_vtable->gl_client_wait_sync = (PFNGLCLIENTWAITSYNCPROC)
+        get_proc_address ("glClientWaitSync");
+    gl_vtable->gl_delete_sync = (PFNGLDELETESYNCPROC)
+        get_proc_address ("glDeleteSync");
+    gl_vtable->has_sync = gl_vtable->gl_fence_sync &&
+        gl_vtable->gl_client_wait_sync && gl_vtable->gl_delete_sync;
+  }
   return gl_vtable;
 }
 
@@ -48,6 +48,16 @@ typedef void (*PFNGLXDESTROYPIXMAPPROC) (Display *, GLXPixmap);
 #define GL_FRAMEBUFFER_BINDING GL_FRAMEBUFFER_BINDING_EXT
 #endif
 
+#ifndef GL_ARB_sync
+typedef struct __GLsync *GLsync;
+typedef GLsync (*PFNGLFENCESYNCPROC) (GLenum, GLbitfield);
+typedef GLenum (*PFNGLCLIENTWAITSYNCPROC) (GLsync, GLbitfield, guint64);
+typedef void (*PFNGLDELETESYNCPROC) (GLsync);
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_WAIT_FAILED 0x911D
+#endif
+
 G_GNUC_INTERNAL
 const gchar *
 gl_get_error_string (GLenum error);
@@ -148,8 +158,12 @@ struct _GLVTable
   PFNGLFRAMEBUFFERRENDERBUFFEREXTPROC gl_framebuffer_renderbuffer;
   PFNGLFRAMEBUFFERTEXTURE2DEXTPROC gl_framebuffer_texture_2d;
   PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC gl_check_framebuffer_status;
+  PFNGLFENCESYNCPROC gl_fence_sync;
+  PFNGLCLIENTWAITSYNCPROC gl_client_wait_sync;
+  PFNGLDELETESYNCPROC gl_delete_sync;
   guint has_texture_from_pixmap:1;
   guint has_framebuffer_object:1;
+  guint has_sync:1;
 };
 
 G_GNUC_INTERNAL
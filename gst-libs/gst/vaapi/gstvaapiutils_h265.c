@@ -44,6 +44,13 @@ static const struct map gst_vaapi_h265_profile_map[] = {
   { GST_VAAPI_PROFILE_H265_MAIN_444_10,          "main-444-10"          },
   { GST_VAAPI_PROFILE_H265_MAIN_422_10,          "main-422-10"          },
   { GST_VAAPI_PROFILE_H265_MAIN12,               "main-12"              },
+  { GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN, "screen-extended-main" },
+  { GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_10,
+    "screen-extended-main-10" },
+  { GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444,
+    "screen-extended-main-444" },
+  { GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444_10,
+    "screen-extended-main-444-10" },
   { 0, NULL }
 /* *INDENT-ON* */
 };
@@ -226,6 +233,15 @@ gst_vaapi_utils_h265_get_profile_idc (GstVaapiProfile profile)
     case GST_VAAPI_PROFILE_H265_MAIN12:
       profile_idc = GST_H265_PROFILE_IDC_FORMAT_RANGE_EXTENSION;
       break;
+    case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN:
+      /* Fall through */
+    case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_10:
+      /* Fall through */
+    case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444:
+      /* Fall through */
+    case GST_VAAPI_PROFILE_H265_SCREEN_EXTENDED_MAIN_444_10:
+      profile_idc = GST_H265_PROFILE_IDC_SCREEN_CONTENT_CODING;
+      break;
     default:
       GST_DEBUG ("unsupported GstVaapiProfile value");
       profile_idc = 0;
@@ -24,6 +24,21 @@
  */
 
 #include "gstvaapiutils_h26x_priv.h"
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define USE_SIMD_SCAN_X86 1
+# include <immintrin.h>
+#else
+# define USE_SIMD_SCAN_X86 0
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+# define USE_SIMD_SCAN_NEON 1
+# include <arm_neon.h>
+#else
+# define USE_SIMD_SCAN_NEON 0
+#endif
 
 /* Write an unsigned integer Exp-Golomb-coded syntax element. i.e. ue(v) */
 gboolean
@@ -60,6 +75,30 @@ bs_write_se (GstBitWriter * bs, gint32 value)
   return TRUE;
 }
 
+/* Append a bit string, as written by another GstBitWriter */
+gboolean
+bs_write_bits (GstBitWriter * bs, const guint8 * data, guint bit_size)
+{
+  const guint num_bytes = bit_size / 8;
+  const guint num_bits = bit_size % 8;
+  guint i;
+
+  /* gst_bit_writer_put_bytes() needs a byte aligned writer */
+  if (GST_BIT_WRITER_BIT_SIZE (bs) % 8 == 0) {
+    if (num_bytes > 0 && !gst_bit_writer_put_bytes (bs, data, num_bytes))
+      return FALSE;
+  } else {
+    for (i = 0; i < num_bytes; i++) {
+      if (!gst_bit_writer_put_bits_uint8 (bs, data[i], 8))
+        return FALSE;
+    }
+  }
+  if (num_bits > 0 && !gst_bit_writer_put_bits_uint8 (bs,
+          data[num_bytes] >> (8 - num_bits), num_bits))
+    return FALSE;
+  return TRUE;
+}
+
 /* Copy from src to dst, applying emulation prevention bytes.
  *
  * This is copied from libavcodec written by Mark Thompson
@@ -145,3 +184,283 @@ bs_error:
     return FALSE;
   }
 }
+
+/**
+ * gst_vaapi_utils_h26x_header_cache_lookup:
+ * @cache: a #GstVaapiH26xHeaderCache
+ * @key: the parameters the header is built from
+ * @key_size: the size of @key, in bytes
+ *
+ * Checks whether @cache holds a header built from @key.
+ *
+ * Returns: %TRUE if the cached header can be reused as is.
+ **/
+gboolean
+gst_vaapi_utils_h26x_header_cache_lookup (GstVaapiH26xHeaderCache * cache,
+    gconstpointer key, guint key_size)
+{
+  if (!cache->data || cache->key_size != key_size)
+    return FALSE;
+  return key_size == 0 || memcmp (cache->key, key, key_size) == 0;
+}
+
+/**
+ * gst_vaapi_utils_h26x_header_cache_store:
+ * @cache: a #GstVaapiH26xHeaderCache
+ * @key: the parameters the header was built from
+ * @key_size: the size of @key, in bytes
+ * @bs: a #GstBitWriter holding the header
+ *
+ * Replaces the header held in @cache with the contents of @bs. The
+ * data of @bs is moved into @cache and @bs is reset.
+ **/
+void
+gst_vaapi_utils_h26x_header_cache_store (GstVaapiH26xHeaderCache * cache,
+    gconstpointer key, guint key_size, GstBitWriter * bs)
+{
+  gst_vaapi_utils_h26x_header_cache_clear (cache);
+
+  cache->bit_size = GST_BIT_WRITER_BIT_SIZE (bs);
+  cache->data = gst_bit_writer_reset_and_get_data (bs);
+  cache->key = key_size > 0 ? g_memdup (key, key_size) : NULL;
+  cache->key_size = key_size;
+}
+
+/**
+ * gst_vaapi_utils_h26x_header_cache_clear:
+ * @cache: a #GstVaapiH26xHeaderCache
+ *
+ * Drops the header held in @cache, if any.
+ **/
+void
+gst_vaapi_utils_h26x_header_cache_clear (GstVaapiH26xHeaderCache * cache)
+{
+  g_clear_pointer (&cache->data, g_free);
+  g_clear_pointer (&cache->key, g_free);
+  cache->key_size = 0;
+  cache->bit_size = 0;
+}
+
+/* ------------------------------------------------------------------------- */
+/* --- Start Code Scanner                                                --- */
+/* ------------------------------------------------------------------------- */
+
+/* Start code prefixes hold two consecutive zero bytes, so a block with
+   no zero byte at all cannot contain the start of one. The SIMD
+   variants skip such blocks, then the candidates are checked one at
+   a time, skipping up to three bytes at each step */
+typedef const guint8 *(*FindStartCodeFunc) (const guint8 * p,
+    const guint8 * end);
+
+#define SCAN_STEP(p)                                    \
+  G_STMT_START {                                        \
+    if (p[2] > 1)                                       \
+      p += 3;                                           \
+    else if (p[1])                                      \
+      p += 2;                                           \
+    else if (p[0] || p[2] != 1)                         \
+      p++;                                              \
+    else                                                \
+      return p;                                         \
+  } G_STMT_END
+
+static const guint8 *
+find_start_code_c (const guint8 * p, const guint8 * end)
+{
+  while (end - p >= 3)
+    SCAN_STEP (p);
+  return NULL;
+}
+
+#if USE_SIMD_SCAN_X86
+__attribute__ ((target ("sse2")))
+static const guint8 *
+find_start_code_sse2 (const guint8 * p, const guint8 * end)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const guint8 *block_end = p;
+
+  while (end - p >= 3) {
+    if (p >= block_end && end - p >= 16) {
+      const __m128i x = _mm_loadu_si128 ((const __m128i *) p);
+      if (!_mm_movemask_epi8 (_mm_cmpeq_epi8 (x, zero))) {
+        p += 16;
+        continue;
+      }
+      block_end = p + 16;
+    }
+    SCAN_STEP (p);
+  }
+  return NULL;
+}
+
+__attribute__ ((target ("avx2")))
+static const guint8 *
+find_start_code_avx2 (const guint8 * p, const guint8 * end)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const guint8 *block_end = p;
+
+  while (end - p >= 3) {
+    if (p >= block_end && end - p >= 32) {
+      const __m256i y = _mm256_loadu_si256 ((const __m256i *) p);
+      if (!_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (y, zero))) {
+        p += 32;
+        continue;
+      }
+      block_end = p + 32;
+    }
+    SCAN_STEP (p);
+  }
+  return NULL;
+}
+#endif
+
+#if USE_SIMD_SCAN_NEON
+static const guint8 *
+find_start_code_neon (const guint8 * p, const guint8 * end)
+{
+  const guint8 *block_end = p;
+
+  while (end - p >= 3) {
+    if (p >= block_end && end - p >= 16) {
+      const uint8x16_t x = vld1q_u8 (p);
+      if (!vmaxvq_u8 (vceqzq_u8 (x))) {
+        p += 16;
+        continue;
+      }
+      block_end = p + 16;
+    }
+    SCAN_STEP (p);
+  }
+  return NULL;
+}
+#endif
+
+#undef SCAN_STEP
+
+static gpointer
+select_find_start_code_func (gpointer data)
+{
+  FindStartCodeFunc func = find_start_code_c;
+
+#if USE_SIMD_SCAN_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    func = find_start_code_avx2;
+  else if (__builtin_cpu_supports ("sse2"))
+    func = find_start_code_sse2;
+#elif USE_SIMD_SCAN_NEON
+  func = find_start_code_neon;
+#endif
+
+  return (gpointer) func;
+}
+
+static inline FindStartCodeFunc
+get_find_start_code_func (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, select_find_start_code_func, NULL);
+  return (FindStartCodeFunc) once.retval;
+}
+
+/**
+ * gst_vaapi_utils_find_start_code:
+ * @data: the bitstream data
+ * @size: the size, in bytes, of @data
+ *
+ * Looks for the first 00 00 01 xx start code held in full in @data.
+ *
+ * Returns: the offset of the start code in @data, or -1 if there is
+ *   none
+ **/
+gint
+gst_vaapi_utils_find_start_code (const guint8 * data, guint size)
+{
+  const guint8 *p;
+
+  if (size < 4)
+    return -1;
+
+  /* The prefix may not start in the last three bytes */
+  p = get_find_start_code_func ()(data, data + size - 1);
+  return p ? (gint) (p - data) : -1;
+}
+
+/**
+ * gst_vaapi_utils_scan_for_start_code:
+ * @adapter: a #GstAdapter
+ * @ofs: the offset into @adapter to start scanning from
+ * @size: the number of bytes to scan from @ofs
+ * @scp: (out) (allow-none): return location for the start code
+ *
+ * Looks for the first 00 00 01 xx start code held in full within the
+ * @size bytes from @ofs, as gst_adapter_masked_scan_uint32_peek()
+ * would, but scanning the adapter memory in place, chunk by chunk.
+ * Start codes straddling two chunks are left to the adapter.
+ *
+ * Returns: the offset of the start code in @adapter, or -1 if there is
+ *   none
+ **/
+gint
+gst_vaapi_utils_scan_for_start_code (GstAdapter * adapter, guint ofs,
+    guint size, guint32 * scp)
+{
+  FindStartCodeFunc const find_start_code = get_find_start_code_func ();
+  GstBufferList *list;
+  GstMapInfo info;
+  const guint8 *p;
+  gint64 next, last, pos, n;
+  guint i, len;
+  gint ret = -1;
+
+  if (size < 4)
+    return -1;
+
+  list = gst_adapter_get_buffer_list (adapter, ofs + size);
+  if (!list)
+    return -1;
+
+  next = ofs;                   /* first start code position to check */
+  last = (gint64) ofs + size - 4;       /* last possible position */
+  pos = 0;
+
+  for (i = 0; i < gst_buffer_list_length (list) && next <= last; i++) {
+    GstBuffer *const buffer = gst_buffer_list_get (list, i);
+
+    len = gst_buffer_get_size (buffer);
+
+    /* Start codes lying entirely in this chunk */
+    n = MIN (pos + len - 4, last);
+    if (n >= next) {
+      if (!gst_buffer_map (buffer, &info, GST_MAP_READ))
+        break;
+      p = find_start_code (info.data + (next - pos), info.data + (n - pos) + 3);
+      if (p) {
+        ret = next + (p - (info.data + (next - pos)));
+        if (scp)
+          *scp = GST_READ_UINT32_BE (p);
+      }
+      gst_buffer_unmap (buffer, &info);
+      if (ret >= 0)
+        break;
+      next = n + 1;
+    }
+
+    /* Start codes crossing the end of this chunk */
+    pos += len;
+    n = MIN (pos - 1, last);
+    if (n >= next) {
+      ret = (gint) gst_adapter_masked_scan_uint32_peek (adapter,
+          0xffffff00, 0x00000100, next, n - next + 4, scp);
+      if (ret >= 0)
+        break;
+      next = n + 1;
+    }
+  }
+
+  gst_buffer_list_unref (list);
+  return ret;
+}
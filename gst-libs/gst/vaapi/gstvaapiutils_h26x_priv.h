@@ -25,6 +25,7 @@
 #ifndef GST_VAAPI_UTILS_H26X_PRIV_H
 #define GST_VAAPI_UTILS_H26X_PRIV_H
 
+#include <gst/base/gstadapter.h>
 #include <gst/base/gstbitwriter.h>
 
 G_BEGIN_DECLS
@@ -77,11 +78,65 @@ G_GNUC_INTERNAL
 gboolean
 bs_write_se (GstBitWriter * bs, gint32 value);
 
+/* Append bit_size bits of data, most significant bit first */
+G_GNUC_INTERNAL
+gboolean
+bs_write_bits (GstBitWriter * bs, const guint8 * data, guint bit_size);
+
 /* Write nal unit, applying emulation prevention bytes */
 G_GNUC_INTERNAL
 gboolean
 gst_vaapi_utils_h26x_write_nal_unit (GstBitWriter * bs, guint8 * nal, guint nal_size);
 
+/* ------------------------------------------------------------------------- */
+/* --- H.264/265 Packed Header Cache                                     --- */
+/* ------------------------------------------------------------------------- */
+
+typedef struct _GstVaapiH26xHeaderCache GstVaapiH26xHeaderCache;
+
+/*
+ * GstVaapiH26xHeaderCache:
+ *
+ * A header bitstream built once and reused for as long as the
+ * parameters it was built from, the @key, do not change.
+ */
+struct _GstVaapiH26xHeaderCache
+{
+  guint8 *key;
+  guint key_size;
+  guint8 *data;
+  guint bit_size;
+};
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_utils_h26x_header_cache_lookup (GstVaapiH26xHeaderCache * cache,
+    gconstpointer key, guint key_size);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_utils_h26x_header_cache_store (GstVaapiH26xHeaderCache * cache,
+    gconstpointer key, guint key_size, GstBitWriter * bs);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_utils_h26x_header_cache_clear (GstVaapiH26xHeaderCache * cache);
+
+/* ------------------------------------------------------------------------- */
+/* --- Start Code Scanner                                                --- */
+/* ------------------------------------------------------------------------- */
+
+/* Also used for the MPEG-2 and VC-1 byte streams, which share the
+   00 00 01 start code prefix */
+G_GNUC_INTERNAL
+gint
+gst_vaapi_utils_find_start_code (const guint8 * data, guint size);
+
+G_GNUC_INTERNAL
+gint
+gst_vaapi_utils_scan_for_start_code (GstAdapter * adapter, guint ofs,
+    guint size, guint32 * scp);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_UTILS_H26X_PRIV_H */
@@ -0,0 +1,208 @@
+/*
+ *  gstvaapiutils_numa.c - NUMA placement of the threads feeding the GPU
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/* On multi-socket hosts, a GPU is attached to the PCIe root of one
+   socket. The threads mapping VA images and coded buffers, and the
+   GstBuffers they fill, had better live on that socket too, rather
+   than having every access cross the interconnect. The kernel tells
+   the node through sysfs, and reports -1 on single node hosts. */
+
+/* for sched_setaffinity() */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
+#include "sysdeps.h"
+#include "gstvaapiutils_numa.h"
+
+#ifdef __linux__
+# include <sched.h>
+# include <unistd.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+# include <sys/sysmacros.h>
+#endif
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+/* from <linux/mempolicy.h> */
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif
+
+/* The node the calling thread is bound to, plus one */
+static GPrivate bound_node;
+
+static gint
+read_node_file (const gchar * path)
+{
+  gchar *contents = NULL;
+  gint64 node = -1;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL))
+    node = g_ascii_strtoll (contents, NULL, 10);
+  g_free (contents);
+  return node >= 0 && node < G_MAXINT ? node : -1;
+}
+
+gint
+gst_vaapi_numa_get_device_node (gint fd)
+{
+#ifdef __linux__
+  struct stat st;
+  gchar *path;
+  gint node;
+
+  if (fd < 0 || fstat (fd, &st) != 0 || !S_ISCHR (st.st_mode))
+    return -1;
+
+  path = g_strdup_printf ("/sys/dev/char/%u:%u/device/numa_node",
+      major (st.st_rdev), minor (st.st_rdev));
+  node = read_node_file (path);
+  g_free (path);
+  return node;
+#else
+  return -1;
+#endif
+}
+
+static gpointer
+default_node_init (gpointer data)
+{
+  const gchar *name;
+  GDir *dir;
+  gint node = -1;
+  gboolean found = FALSE;
+
+  dir = g_dir_open ("/sys/class/drm", 0, NULL);
+  if (!dir)
+    return GINT_TO_POINTER (-1);
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *path;
+    gint device_node;
+
+    if (!g_str_has_prefix (name, "renderD"))
+      continue;
+    path = g_strdup_printf ("/sys/class/drm/%s/device/numa_node", name);
+    device_node = read_node_file (path);
+    g_free (path);
+
+    if (device_node < 0 || (found && device_node != node)) {
+      node = -1;
+      break;
+    }
+    node = device_node;
+    found = TRUE;
+  }
+  g_dir_close (dir);
+  return GINT_TO_POINTER (node);
+}
+
+gint
+gst_vaapi_numa_get_default_node (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, default_node_init, NULL);
+  return GPOINTER_TO_INT (once.retval);
+}
+
+#ifdef __linux__
+static gboolean
+bind_thread_cpus (gint node)
+{
+  gchar *path, *contents = NULL, **ranges;
+  cpu_set_t cpus;
+  guint i, n_cpus = 0;
+  gboolean success;
+
+  path = g_strdup_printf ("/sys/devices/system/node/node%d/cpulist", node);
+  success = g_file_get_contents (path, &contents, NULL, NULL);
+  g_free (path);
+  if (!success)
+    return FALSE;
+
+  /* e.g. "0-15,32-47" */
+  CPU_ZERO (&cpus);
+  ranges = g_strsplit (g_strstrip (contents), ",", -1);
+  for (i = 0; ranges[i]; i++) {
+    gchar *end;
+    guint64 first, last, cpu;
+
+    first = g_ascii_strtoull (ranges[i], &end, 10);
+    if (end == ranges[i])
+      continue;
+    last = *end == '-' ? g_ascii_strtoull (end + 1, NULL, 10) : first;
+    for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++, n_cpus++)
+      CPU_SET (cpu, &cpus);
+  }
+  g_strfreev (ranges);
+  g_free (contents);
+
+  if (n_cpus == 0)
+    return FALSE;
+  return sched_setaffinity (0, sizeof (cpus), &cpus) == 0;
+}
+
+static gboolean
+bind_thread_memory (gint node)
+{
+#ifdef SYS_set_mempolicy
+  unsigned long nodemask[4] = { 0, };
+  const guint bits = sizeof (nodemask[0]) * 8;
+
+  if (node >= G_N_ELEMENTS (nodemask) * bits)
+    return FALSE;
+  nodemask[node / bits] = 1UL << (node % bits);
+
+  /* Preferred rather than bound, so that allocations still succeed
+     once the node is full */
+  return syscall (SYS_set_mempolicy, MPOL_PREFERRED, nodemask,
+      G_N_ELEMENTS (nodemask) * bits + 1) == 0;
+#else
+  return FALSE;
+#endif
+}
+#endif
+
+gboolean
+gst_vaapi_numa_bind_thread (gint node)
+{
+  if (node < 0)
+    return FALSE;
+  if (GPOINTER_TO_INT (g_private_get (&bound_node)) == node + 1)
+    return TRUE;
+
+#ifdef __linux__
+  if (!bind_thread_cpus (node)) {
+    GST_WARNING ("failed to bind thread to the CPUs of NUMA node %d", node);
+    return FALSE;
+  }
+  if (!bind_thread_memory (node))
+    GST_DEBUG ("no memory policy for NUMA node %d", node);
+
+  GST_DEBUG ("thread bound to NUMA node %d", node);
+  g_private_set (&bound_node, GINT_TO_POINTER (node + 1));
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
@@ -0,0 +1,45 @@
+/*
+ *  gstvaapiutils_numa.h - NUMA placement of the threads feeding the GPU
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_UTILS_NUMA_H
+#define GST_VAAPI_UTILS_NUMA_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Returns the NUMA node the DRM device opened as @fd is attached
+    to, or -1 if unknown or if the host has a single node */
+gint
+gst_vaapi_numa_get_device_node (gint fd);
+
+/** Returns the NUMA node all the DRM render nodes are attached to,
+    or -1 if they are spread over several nodes or if unknown */
+gint
+gst_vaapi_numa_get_default_node (void);
+
+/** Runs the calling thread on the CPUs of NUMA @node, and allocates
+    its memory there first. Binding again to the same node is cheap,
+    so this can be called from a task loop */
+gboolean
+gst_vaapi_numa_bind_thread (gint node);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_UTILS_NUMA_H */
@@ -132,6 +132,31 @@ gst_vaapi_rotation_get_type (void)
   return g_type;
 }
 
+GType
+gst_vaapi_priority_get_type (void)
+{
+  static volatile gsize g_type = 0;
+
+  static const GEnumValue priority_values[] = {
+    {GST_VAAPI_PRIORITY_DEFAULT,
+        "Driver default priority", "default"},
+    {GST_VAAPI_PRIORITY_LOW,
+        "Lowest priority", "low"},
+    {GST_VAAPI_PRIORITY_NORMAL,
+        "Middle priority", "normal"},
+    {GST_VAAPI_PRIORITY_HIGH,
+        "Highest priority", "high"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&g_type)) {
+    GType type = g_enum_register_static ("GstVaapiPriority", priority_values);
+    gst_type_mark_as_plugin_api (type, 0);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
 /* --- GstVaapiRateControl --- */
 
 GType
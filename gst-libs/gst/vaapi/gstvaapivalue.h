@@ -77,6 +77,15 @@ G_BEGIN_DECLS
  */
 #define GST_VAAPI_TYPE_RATE_CONTROL gst_vaapi_rate_control_get_type()
 
+/**
+ * GST_VAAPI_TYPE_PRIORITY:
+ *
+ * A type that represents the VA context priority.
+ *
+ * Return value: the #GType of GstVaapiPriority
+ */
+#define GST_VAAPI_TYPE_PRIORITY gst_vaapi_priority_get_type()
+
 GType
 gst_vaapi_point_get_type(void) G_GNUC_CONST;
 
@@ -92,6 +101,9 @@ gst_vaapi_rotation_get_type(void) G_GNUC_CONST;
 GType
 gst_vaapi_rate_control_get_type(void) G_GNUC_CONST;
 
+GType
+gst_vaapi_priority_get_type(void) G_GNUC_CONST;
+
 /**
  * GST_VAAPI_POPCOUNT32:
  * @x: the value from which to compute population count
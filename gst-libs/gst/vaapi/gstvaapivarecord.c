@@ -0,0 +1,194 @@
+/*
+ *  gstvaapivarecord.c - VA call recorder
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/* Setting GST_VAAPI_VA_RECORD to a file name records the VA calls that
+   make up the hardware workload, i.e. the creation of the configs,
+   contexts, surfaces and buffers, the buffer contents, the pictures
+   submitted and the synchronizations, along with their duration. The
+   tests/internal/replay-va tool resubmits such a file without
+   GStreamer, so that driver and plugin regressions can be told apart.
+   When the variable is unset, a call costs a boolean check. */
+
+#include "sysdeps.h"
+#include "gstvaapivarecord.h"
+
+#define DEBUG 1
+#include "gstvaapidebug.h"
+
+static FILE *record_file;
+static GMutex record_lock;
+static GstClockTime record_epoch;
+/* The VADisplays seen so far, indexed as in the records */
+static GPtrArray *record_displays;
+
+static gpointer
+record_init (gpointer data)
+{
+  const gchar *const filename = g_getenv ("GST_VAAPI_VA_RECORD");
+
+  if (!filename || !*filename)
+    return NULL;
+
+  record_file = fopen (filename, "wb");
+  if (!record_file) {
+    GST_WARNING ("failed to open VA record file %s", filename);
+    return NULL;
+  }
+  if (fwrite (GST_VAAPI_VA_RECORD_MAGIC, GST_VAAPI_VA_RECORD_MAGIC_SIZE, 1,
+          record_file) != 1) {
+    GST_WARNING ("failed to write VA record file %s", filename);
+    fclose (record_file);
+    record_file = NULL;
+    return NULL;
+  }
+
+  GST_INFO ("recording VA calls to %s", filename);
+  record_displays = g_ptr_array_new ();
+  record_epoch = gst_util_get_timestamp ();
+  return NULL;
+}
+
+/**
+ * gst_vaapi_va_record_is_enabled:
+ *
+ * Return value: %TRUE if VA calls are being recorded
+ */
+gboolean
+gst_vaapi_va_record_is_enabled (void)
+{
+  static GOnce once = G_ONCE_INIT;
+
+  g_once (&once, record_init, NULL);
+  return record_file != NULL;
+}
+
+/* Called with record_lock held */
+static guint16
+record_display_index (VADisplay dpy)
+{
+  guint i;
+
+  for (i = 0; i < record_displays->len; i++) {
+    if (g_ptr_array_index (record_displays, i) == dpy)
+      return i;
+  }
+  g_ptr_array_add (record_displays, dpy);
+  return i;
+}
+
+/**
+ * gst_vaapi_va_record:
+ * @dpy: the #VADisplay the call was made on
+ * @call: the #GstVaapiVaRecordCall
+ * @status: the #VAStatus the call returned
+ * @start: the call start time, from GST_VAAPI_VA_RECORD_BEGIN()
+ * @args: the scalar arguments of the record
+ * @n_args: the number of @args
+ * @ids: (allow-none): the ID list following @args, if any
+ * @n_ids: the number of @ids
+ * @data: (allow-none): the data of the record, if any
+ * @data_size: the size of @data, in bytes
+ *
+ * Appends a record of a VA call that started at @start and just
+ * completed. This is normally called through GST_VAAPI_VA_RECORD_END().
+ */
+void
+gst_vaapi_va_record (VADisplay dpy, GstVaapiVaRecordCall call,
+    VAStatus status, GstClockTime start, const guint32 * args, guint n_args,
+    const guint32 * ids, guint n_ids, gconstpointer data, gsize data_size)
+{
+  const GstClockTime end = gst_util_get_timestamp ();
+  GstVaapiVaRecordHeader header = { 0, };
+  gboolean success;
+
+  if (!data)
+    data_size = 0;
+  if (!ids)
+    n_ids = 0;
+
+  header.call = call;
+  header.n_args = n_args + n_ids;
+  header.data_size = data_size;
+  header.status = status;
+  header.timestamp = start > record_epoch ? start - record_epoch : 0;
+  header.duration = end - start;
+
+  g_mutex_lock (&record_lock);
+  if (!record_file)
+    goto done;
+
+  header.display = record_display_index (dpy);
+  success = fwrite (&header, sizeof (header), 1, record_file) == 1
+      && (n_args == 0
+      || fwrite (args, sizeof (guint32), n_args, record_file) == n_args)
+      && (n_ids == 0
+      || fwrite (ids, sizeof (guint32), n_ids, record_file) == n_ids)
+      && (data_size == 0 || fwrite (data, data_size, 1, record_file) == 1);
+  if (!success) {
+    GST_WARNING ("failed to write VA call record, recording stopped");
+    fclose (record_file);
+    record_file = NULL;
+  }
+
+done:
+  g_mutex_unlock (&record_lock);
+}
+
+/**
+ * gst_vaapi_va_record_render_begin:
+ * @dpy: the #VADisplay the buffers belong to
+ * @buffers: the #VABufferID array about to be rendered
+ * @n_buffers: the number of @buffers
+ *
+ * Records the contents of the parameter and data @buffers, except for
+ * the coded and image buffers the driver writes. They are read back
+ * through a mapping since most of them are filled in while mapped.
+ * This is normally called through GST_VAAPI_VA_RECORD_RENDER_BEGIN().
+ *
+ * Return value: the start time of the vaRenderPicture() call
+ */
+GstClockTime
+gst_vaapi_va_record_render_begin (VADisplay dpy, const VABufferID * buffers,
+    guint n_buffers)
+{
+  VABufferType type;
+  unsigned int size, num_elements;
+  GstClockTime start;
+  gpointer data;
+  guint i;
+
+  for (i = 0; i < n_buffers; i++) {
+    const guint32 args[] = { buffers[i] };
+
+    if (vaBufferInfo (dpy, buffers[i], &type, &size,
+            &num_elements) != VA_STATUS_SUCCESS)
+      continue;
+    if (type == VAEncCodedBufferType || type == VAImageBufferType)
+      continue;
+    if (vaMapBuffer (dpy, buffers[i], &data) != VA_STATUS_SUCCESS)
+      continue;
+
+    start = gst_util_get_timestamp ();
+    gst_vaapi_va_record (dpy, GST_VAAPI_VA_RECORD_BUFFER_DATA,
+        VA_STATUS_SUCCESS, start, args, G_N_ELEMENTS (args), NULL, 0, data,
+        (gsize) size * num_elements);
+    vaUnmapBuffer (dpy, buffers[i]);
+  }
+  return gst_util_get_timestamp ();
+}
@@ -0,0 +1,144 @@
+/*
+ *  gstvaapivarecord.h - VA call recorder
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_VA_RECORD_H
+#define GST_VAAPI_VA_RECORD_H
+
+#include <gst/gst.h>
+#include <va/va.h>
+
+G_BEGIN_DECLS
+
+/* File layout: the GST_VAAPI_VA_RECORD_MAGIC string, then one record
+   per VA call, made of a GstVaapiVaRecordHeader, its n_args 32-bit
+   arguments and its data_size bytes of data, all in host byte order */
+#define GST_VAAPI_VA_RECORD_MAGIC       "GVAREC01"
+#define GST_VAAPI_VA_RECORD_MAGIC_SIZE  8
+
+/* Records and their arguments. IDs are the ones the driver returned
+   at recording time */
+typedef enum
+{
+  /* profile, entrypoint, config; data: VAConfigAttrib array */
+  GST_VAAPI_VA_RECORD_CREATE_CONFIG = 1,
+  /* config */
+  GST_VAAPI_VA_RECORD_DESTROY_CONFIG,
+  /* rt_format, width, height, surfaces... */
+  GST_VAAPI_VA_RECORD_CREATE_SURFACES,
+  /* surfaces... */
+  GST_VAAPI_VA_RECORD_DESTROY_SURFACES,
+  /* config, width, height, flags, context, render targets... */
+  GST_VAAPI_VA_RECORD_CREATE_CONTEXT,
+  /* context */
+  GST_VAAPI_VA_RECORD_DESTROY_CONTEXT,
+  /* context, type, size, num_elements, buffer */
+  GST_VAAPI_VA_RECORD_CREATE_BUFFER,
+  /* buffer */
+  GST_VAAPI_VA_RECORD_DESTROY_BUFFER,
+  /* buffer */
+  GST_VAAPI_VA_RECORD_MAP_BUFFER,
+  /* buffer */
+  GST_VAAPI_VA_RECORD_UNMAP_BUFFER,
+  /* context, render target */
+  GST_VAAPI_VA_RECORD_BEGIN_PICTURE,
+  /* context, buffers... */
+  GST_VAAPI_VA_RECORD_RENDER_PICTURE,
+  /* context */
+  GST_VAAPI_VA_RECORD_END_PICTURE,
+  /* surface */
+  GST_VAAPI_VA_RECORD_SYNC_SURFACE,
+  /* surface, image */
+  GST_VAAPI_VA_RECORD_DERIVE_IMAGE,
+  /* image */
+  GST_VAAPI_VA_RECORD_DESTROY_IMAGE,
+  /* buffer; data: contents. Not a VA call, this precedes the
+     RENDER_PICTURE record the buffer is submitted with */
+  GST_VAAPI_VA_RECORD_BUFFER_DATA,
+  /* buffer. Replayed as an untimed wait */
+  GST_VAAPI_VA_RECORD_SYNC_BUFFER,
+} GstVaapiVaRecordCall;
+
+typedef struct _GstVaapiVaRecordHeader GstVaapiVaRecordHeader;
+struct _GstVaapiVaRecordHeader
+{
+  guint16 call;
+  /* index of the VADisplay, in the order they were first seen */
+  guint16 display;
+  guint16 n_args;
+  guint16 reserved;
+  guint32 data_size;
+  /* VAStatus of the call */
+  guint32 status;
+  /* start time, in ns since the recording started */
+  guint64 timestamp;
+  guint64 duration;
+};
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_va_record_is_enabled (void);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_va_record (VADisplay dpy, GstVaapiVaRecordCall call,
+    VAStatus status, GstClockTime start, const guint32 * args, guint n_args,
+    const guint32 * ids, guint n_ids, gconstpointer data, gsize data_size);
+
+G_GNUC_INTERNAL
+GstClockTime
+gst_vaapi_va_record_render_begin (VADisplay dpy, const VABufferID * buffers,
+    guint n_buffers);
+
+/* Returns the start time of a VA call, or GST_CLOCK_TIME_NONE if no
+   recording is in progress, in which case GST_VAAPI_VA_RECORD_END()
+   is a no-op */
+#define GST_VAAPI_VA_RECORD_BEGIN() \
+  (gst_vaapi_va_record_is_enabled () ? gst_util_get_timestamp () : \
+   GST_CLOCK_TIME_NONE)
+
+/* Same as GST_VAAPI_VA_RECORD_BEGIN(), for a vaRenderPicture() call.
+   This records the contents of the @buffers about to be submitted */
+#define GST_VAAPI_VA_RECORD_RENDER_BEGIN(dpy, buffers, n_buffers) \
+  (gst_vaapi_va_record_is_enabled () ? \
+   gst_vaapi_va_record_render_begin (dpy, buffers, n_buffers) : \
+   GST_CLOCK_TIME_NONE)
+
+#define GST_VAAPI_VA_RECORD_END(start, dpy, call, status, ...)        \
+  G_STMT_START {                                                      \
+    if (G_UNLIKELY (GST_CLOCK_TIME_IS_VALID (start))) {                \
+      const guint32 record_args_[] = { __VA_ARGS__ };                 \
+      gst_vaapi_va_record (dpy, call, status, start, record_args_,    \
+          G_N_ELEMENTS (record_args_), NULL, 0, NULL, 0);             \
+    }                                                                 \
+  } G_STMT_END
+
+/* Same as GST_VAAPI_VA_RECORD_END(), with a trailing ID list */
+#define GST_VAAPI_VA_RECORD_END_IDS(start, dpy, call, status, ids,    \
+    n_ids, ...)                                                       \
+  G_STMT_START {                                                      \
+    if (G_UNLIKELY (GST_CLOCK_TIME_IS_VALID (start))) {                \
+      const guint32 record_args_[] = { __VA_ARGS__ };                 \
+      gst_vaapi_va_record (dpy, call, status, start, record_args_,    \
+          G_N_ELEMENTS (record_args_), ids, n_ids, NULL, 0);          \
+    }                                                                 \
+  } G_STMT_END
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_VA_RECORD_H */
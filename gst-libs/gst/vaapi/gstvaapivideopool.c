@@ -49,26 +49,268 @@ gst_vaapi_video_pool_alloc_object (GstVaapiVideoPool * pool)
   return GST_VAAPI_VIDEO_POOL_GET_CLASS (pool)->alloc_object (pool);
 }
 
+/* Bounded MPMC FIFO, after Dmitry Vyukov's design: each cell carries a
+   sequence number telling whether it is ready to be written or read
+   for a given ring position */
+static gboolean
+ring_push (GstVaapiVideoPool * pool, gpointer object)
+{
+  GstVaapiVideoPoolCell *cell;
+  guint pos, seq;
+  gint diff;
+
+  pos = g_atomic_int_get (&pool->ring_tail);
+  for (;;) {
+    cell = &pool->ring[pos & (GST_VAAPI_VIDEO_POOL_RING_SIZE - 1)];
+    seq = g_atomic_int_get (&cell->seq);
+    diff = (gint) (seq - pos);
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&pool->ring_tail, pos, pos + 1))
+        break;
+      pos = g_atomic_int_get (&pool->ring_tail);
+    } else if (diff < 0)
+      return FALSE;             /* ring is full */
+    else
+      pos = g_atomic_int_get (&pool->ring_tail);
+  }
+
+  cell->object = object;
+  g_atomic_int_set (&cell->seq, pos + 1);
+  return TRUE;
+}
+
+static gpointer
+ring_pop (GstVaapiVideoPool * pool)
+{
+  GstVaapiVideoPoolCell *cell;
+  gpointer object;
+  guint pos, seq;
+  gint diff;
+
+  pos = g_atomic_int_get (&pool->ring_head);
+  for (;;) {
+    cell = &pool->ring[pos & (GST_VAAPI_VIDEO_POOL_RING_SIZE - 1)];
+    seq = g_atomic_int_get (&cell->seq);
+    diff = (gint) (seq - (pos + 1));
+    if (diff == 0) {
+      if (g_atomic_int_compare_and_exchange (&pool->ring_head, pos, pos + 1))
+        break;
+      pos = g_atomic_int_get (&pool->ring_head);
+    } else if (diff < 0)
+      return NULL;              /* ring is empty */
+    else
+      pos = g_atomic_int_get (&pool->ring_head);
+  }
+
+  object = cell->object;
+  cell->object = NULL;
+  g_atomic_int_set (&cell->seq, pos + GST_VAAPI_VIDEO_POOL_RING_SIZE);
+  return object;
+}
+
+static guint
+ring_get_length (GstVaapiVideoPool * pool)
+{
+  return g_atomic_int_get (&pool->ring_tail) -
+      g_atomic_int_get (&pool->ring_head);
+}
+
+static void
+update_high_water (GstVaapiVideoPool * pool, guint used_count)
+{
+  guint high_water;
+
+  do {
+    high_water = g_atomic_int_get (&pool->high_water);
+    if (used_count <= high_water)
+      return;
+  } while (!g_atomic_int_compare_and_exchange (&pool->high_water,
+          high_water, used_count));
+}
+
+/* Updates the length of the overflow queue as seen outside of the
+   pool mutex, which shall be held */
+static inline void
+free_objects_changed (GstVaapiVideoPool * pool)
+{
+  g_atomic_int_set (&pool->free_objects_length,
+      g_queue_get_length (&pool->free_objects));
+}
+
+/* Pushes a free object, whose reference is owned by the pool. Once
+   objects overflowed the ring, the next ones follow them into the
+   queue, so that they are not reused before */
+static void
+push_free_object (GstVaapiVideoPool * pool, gpointer object)
+{
+  if (g_atomic_int_get (&pool->free_objects_length) == 0 &&
+      ring_push (pool, object))
+    return;
+
+  g_mutex_lock (&pool->mutex);
+  g_queue_push_tail (&pool->free_objects, object);
+  free_objects_changed (pool);
+  g_mutex_unlock (&pool->mutex);
+}
+
+/* Pops the oldest free object: the ring only holds objects released
+   before the ones in the overflow queue */
+static gpointer
+pop_free_object (GstVaapiVideoPool * pool)
+{
+  gpointer object;
+
+  object = ring_pop (pool);
+  if (object)
+    return object;
+
+  g_mutex_lock (&pool->mutex);
+  object = g_queue_pop_head (&pool->free_objects);
+  free_objects_changed (pool);
+  g_mutex_unlock (&pool->mutex);
+  return object;
+}
+
+#ifndef G_DISABLE_CHECKS
+/* Checks whether @object is already free, i.e. released twice */
+static gboolean
+is_free_object (GstVaapiVideoPool * pool, gpointer object)
+{
+  gboolean found = FALSE;
+  guint i;
+
+  for (i = 0; i < GST_VAAPI_VIDEO_POOL_RING_SIZE && !found; i++)
+    found = g_atomic_pointer_get (&pool->ring[i].object) == object;
+
+  if (!found) {
+    g_mutex_lock (&pool->mutex);
+    found = g_queue_find (&pool->free_objects, object) != NULL;
+    g_mutex_unlock (&pool->mutex);
+  }
+  return found;
+}
+#endif
+
+/* The acquisition of an object in use, while tracking is enabled */
+typedef struct
+{
+  gint64 acquire_time;
+  const gchar *holder;
+} GstVaapiVideoPoolUsage;
+
+static void
+usage_free (GstVaapiVideoPoolUsage * usage)
+{
+  g_slice_free (GstVaapiVideoPoolUsage, usage);
+}
+
+static void
+track_object_acquired (GstVaapiVideoPool * pool, gpointer object)
+{
+  GstVaapiVideoPoolUsage *usage;
+
+  if (!g_atomic_int_get (&pool->tracking))
+    return;
+
+  usage = g_slice_new (GstVaapiVideoPoolUsage);
+  usage->acquire_time = g_get_monotonic_time ();
+  usage->holder = NULL;
+
+  g_mutex_lock (&pool->mutex);
+  if (pool->outstanding)
+    g_hash_table_replace (pool->outstanding, object, usage);
+  else
+    usage_free (usage);
+  g_mutex_unlock (&pool->mutex);
+}
+
+static void
+track_object_released (GstVaapiVideoPool * pool, gpointer object)
+{
+  if (!g_atomic_int_get (&pool->tracking))
+    return;
+
+  g_mutex_lock (&pool->mutex);
+  if (pool->outstanding)
+    g_hash_table_remove (pool->outstanding, object);
+  g_mutex_unlock (&pool->mutex);
+}
+
+/* Number of busy free objects skipped before giving up */
+#define MAX_BUSY_OBJECTS 4
+
+/* Pops the oldest free object the hardware is done with. Busy objects
+ * are pushed back, and the oldest of them is only returned if no idle
+ * one was found */
+static gpointer
+pop_idle_free_object (GstVaapiVideoPool * pool, gboolean * is_idle_ptr)
+{
+  const GstVaapiVideoPoolClass *const klass =
+      GST_VAAPI_VIDEO_POOL_GET_CLASS (pool);
+  gpointer busy_objects[MAX_BUSY_OBJECTS];
+  gpointer object = NULL;
+  guint i, n_busy = 0;
+
+  *is_idle_ptr = TRUE;
+  if (!klass->is_object_idle)
+    return pop_free_object (pool);
+
+  while (n_busy < MAX_BUSY_OBJECTS) {
+    object = pop_free_object (pool);
+    if (!object || klass->is_object_idle (pool, object))
+      break;
+    busy_objects[n_busy++] = object;
+    object = NULL;
+  }
+
+  /* Never allocate past busy objects: pools may be bound to a fixed
+   * set of surfaces, e.g. a decoding context */
+  i = 0;
+  if (!object && n_busy > 0) {
+    object = busy_objects[i++];
+    *is_idle_ptr = FALSE;
+  }
+  for (; i < n_busy; i++)
+    push_free_object (pool, busy_objects[i]);
+  return object;
+}
+
 void
 gst_vaapi_video_pool_init (GstVaapiVideoPool * pool, GstVaapiDisplay * display,
     GstVaapiVideoPoolObjectType object_type)
 {
+  guint i;
+
   pool->object_type = object_type;
   pool->display = gst_object_ref (display);
-  pool->used_objects = NULL;
   pool->used_count = 0;
+  pool->high_water = 0;
   pool->capacity = 0;
 
+  for (i = 0; i < GST_VAAPI_VIDEO_POOL_RING_SIZE; i++) {
+    pool->ring[i].seq = i;
+    pool->ring[i].object = NULL;
+  }
+  pool->ring_head = 0;
+  pool->ring_tail = 0;
+
   g_queue_init (&pool->free_objects);
+  pool->free_objects_length = 0;
   g_mutex_init (&pool->mutex);
+  pool->tracking = FALSE;
+  pool->outstanding = NULL;
 }
 
 void
 gst_vaapi_video_pool_finalize (GstVaapiVideoPool * pool)
 {
-  g_list_free_full (pool->used_objects, (GDestroyNotify) gst_mini_object_unref);
+  gpointer object;
+
+  while ((object = ring_pop (pool)))
+    gst_mini_object_unref (object);
   g_queue_foreach (&pool->free_objects, (GFunc) gst_mini_object_unref, NULL);
   g_queue_clear (&pool->free_objects);
+  g_clear_pointer (&pool->outstanding, g_hash_table_unref);
   gst_vaapi_display_replace (&pool->display, NULL);
   g_mutex_clear (&pool->mutex);
 }
@@ -161,47 +403,65 @@ gst_vaapi_video_pool_get_object_type (GstVaapiVideoPool * pool)
  * and thus shall be released through gst_vaapi_video_pool_put_object()
  * when it's no longer needed.
  *
+ * This function does not take any lock unless the lock-free ring of
+ * free objects is empty.
+ *
  * Return value: a possibly newly allocated object, or %NULL on error
  */
-static gpointer
-gst_vaapi_video_pool_get_object_unlocked (GstVaapiVideoPool * pool)
+gpointer
+gst_vaapi_video_pool_get_object (GstVaapiVideoPool * pool)
 {
-  gpointer object;
+  gboolean is_idle;
 
-  if (pool->capacity && pool->used_count >= pool->capacity)
-    return NULL;
-
-  object = g_queue_pop_head (&pool->free_objects);
-  if (!object) {
-    g_mutex_unlock (&pool->mutex);
-    object = gst_vaapi_video_pool_alloc_object (pool);
-    g_mutex_lock (&pool->mutex);
-    if (!object)
-      return NULL;
-
-    /* Others already allocated a new one before us during we
-       release the mutex */
-    if (pool->capacity && pool->used_count >= pool->capacity) {
-      gst_mini_object_unref (object);
-      return NULL;
-    }
-  }
+  g_return_val_if_fail (pool != NULL, NULL);
 
-  ++pool->used_count;
-  pool->used_objects = g_list_prepend (pool->used_objects, object);
-  return gst_mini_object_ref (object);
+  return gst_vaapi_video_pool_get_idle_object (pool, &is_idle);
 }
 
+/**
+ * gst_vaapi_video_pool_get_idle_object:
+ * @pool: a #GstVaapiVideoPool
+ * @is_idle_ptr: return location for whether the object is idle
+ *
+ * Same as gst_vaapi_video_pool_get_object(), but free objects the
+ * hardware still works on are skipped in favour of idle ones. If all
+ * of them are busy, the oldest one is returned anyway and
+ * @is_idle_ptr is set to %FALSE, so that the caller knows it has to
+ * wait before accessing the object from the CPU.
+ *
+ * Return value: a possibly newly allocated object, or %NULL on error
+ */
 gpointer
-gst_vaapi_video_pool_get_object (GstVaapiVideoPool * pool)
+gst_vaapi_video_pool_get_idle_object (GstVaapiVideoPool * pool,
+    gboolean * is_idle_ptr)
 {
   gpointer object;
+  guint used_count, capacity;
 
   g_return_val_if_fail (pool != NULL, NULL);
+  g_return_val_if_fail (is_idle_ptr != NULL, NULL);
+
+  /* Reserve a slot first, so that concurrent callers cannot exceed
+     the pool capacity */
+  do {
+    used_count = g_atomic_int_get (&pool->used_count);
+    capacity = g_atomic_int_get (&pool->capacity);
+    if (capacity && used_count >= capacity)
+      return NULL;
+  } while (!g_atomic_int_compare_and_exchange (&pool->used_count,
+          used_count, used_count + 1));
 
-  g_mutex_lock (&pool->mutex);
-  object = gst_vaapi_video_pool_get_object_unlocked (pool);
-  g_mutex_unlock (&pool->mutex);
+  update_high_water (pool, used_count + 1);
+
+  object = pop_idle_free_object (pool, is_idle_ptr);
+  if (!object) {
+    object = gst_vaapi_video_pool_alloc_object (pool);
+    if (!object) {
+      g_atomic_int_add (&pool->used_count, -1);
+      return NULL;
+    }
+  }
+  track_object_acquired (pool, object);
   return object;
 }
 
@@ -215,31 +475,27 @@ gst_vaapi_video_pool_get_object (GstVaapiVideoPool * pool)
  * Calling this function with an arbitrary object yields undefined
  * behaviour.
  */
-static void
-gst_vaapi_video_pool_put_object_unlocked (GstVaapiVideoPool * pool,
-    gpointer object)
-{
-  GList *elem;
-
-  elem = g_list_find (pool->used_objects, object);
-  if (!elem)
-    return;
-
-  gst_mini_object_unref (object);
-  --pool->used_count;
-  pool->used_objects = g_list_delete_link (pool->used_objects, elem);
-  g_queue_push_tail (&pool->free_objects, object);
-}
-
 void
 gst_vaapi_video_pool_put_object (GstVaapiVideoPool * pool, gpointer object)
 {
+  const GstVaapiVideoPoolClass *klass;
+
   g_return_if_fail (pool != NULL);
   g_return_if_fail (object != NULL);
 
-  g_mutex_lock (&pool->mutex);
-  gst_vaapi_video_pool_put_object_unlocked (pool, object);
-  g_mutex_unlock (&pool->mutex);
+#ifndef G_DISABLE_CHECKS
+  g_return_if_fail (!is_free_object (pool, object));
+#endif
+
+  track_object_released (pool, object);
+  g_atomic_int_add (&pool->used_count, -1);
+
+  klass = GST_VAAPI_VIDEO_POOL_GET_CLASS (pool);
+  if (klass->reuse_object && !klass->reuse_object (pool, object)) {
+    gst_mini_object_unref (object);
+    return;
+  }
+  push_free_object (pool, object);
 }
 
 /**
@@ -258,6 +514,7 @@ gst_vaapi_video_pool_add_object_unlocked (GstVaapiVideoPool * pool,
     gpointer object)
 {
   g_queue_push_tail (&pool->free_objects, gst_mini_object_ref (object));
+  free_objects_changed (pool);
   return TRUE;
 }
 
@@ -329,7 +586,7 @@ gst_vaapi_video_pool_get_size (GstVaapiVideoPool * pool)
   g_return_val_if_fail (pool != NULL, 0);
 
   g_mutex_lock (&pool->mutex);
-  size = g_queue_get_length (&pool->free_objects);
+  size = g_queue_get_length (&pool->free_objects) + ring_get_length (pool);
   g_mutex_unlock (&pool->mutex);
   return size;
 }
@@ -339,11 +596,13 @@ gst_vaapi_video_pool_reserve_unlocked (GstVaapiVideoPool * pool, guint n)
 {
   guint i, num_allocated;
 
-  num_allocated = g_queue_get_length (&pool->free_objects) + pool->used_count;
+  num_allocated = g_queue_get_length (&pool->free_objects) +
+      ring_get_length (pool) + g_atomic_int_get (&pool->used_count);
   if (n <= num_allocated)
     return TRUE;
 
-  n = MIN (n, pool->capacity);
+  if (pool->capacity)
+    n = MIN (n, pool->capacity);
   for (i = num_allocated; i < n; i++) {
     gpointer object;
 
@@ -353,6 +612,7 @@ gst_vaapi_video_pool_reserve_unlocked (GstVaapiVideoPool * pool, guint n)
     if (!object)
       return FALSE;
     g_queue_push_tail (&pool->free_objects, object);
+    free_objects_changed (pool);
   }
   return TRUE;
 }
@@ -398,9 +658,7 @@ gst_vaapi_video_pool_get_capacity (GstVaapiVideoPool * pool)
 
   g_return_val_if_fail (pool != NULL, 0);
 
-  g_mutex_lock (&pool->mutex);
-  capacity = pool->capacity;
-  g_mutex_unlock (&pool->mutex);
+  capacity = g_atomic_int_get (&pool->capacity);
 
   return capacity;
 }
@@ -418,6 +676,187 @@ gst_vaapi_video_pool_set_capacity (GstVaapiVideoPool * pool, guint capacity)
   g_return_if_fail (pool != NULL);
 
   g_mutex_lock (&pool->mutex);
-  pool->capacity = capacity;
+  g_atomic_int_set (&pool->capacity, capacity);
+  g_mutex_unlock (&pool->mutex);
+}
+
+/**
+ * gst_vaapi_video_pool_get_high_water_mark:
+ * @pool: a #GstVaapiVideoPool
+ * @reset: whether to restart tracking from the current usage
+ *
+ * Returns the maximum number of objects that were simultaneously in
+ * use since the @pool was created, or since the last reset. If @reset
+ * is %TRUE, the high-water mark is then set back to the number of
+ * objects currently in use.
+ *
+ * Return value: the high-water mark of used objects
+ */
+guint
+gst_vaapi_video_pool_get_high_water_mark (GstVaapiVideoPool * pool,
+    gboolean reset)
+{
+  guint high_water;
+
+  g_return_val_if_fail (pool != NULL, 0);
+
+  if (!reset)
+    return g_atomic_int_get (&pool->high_water);
+
+  do {
+    high_water = g_atomic_int_get (&pool->high_water);
+  } while (!g_atomic_int_compare_and_exchange (&pool->high_water, high_water,
+          g_atomic_int_get (&pool->used_count)));
+  return high_water;
+}
+
+/**
+ * gst_vaapi_video_pool_shrink:
+ * @pool: a #GstVaapiVideoPool
+ * @n: the number of objects to keep allocated
+ *
+ * Releases free objects from the @pool until at most @n objects, free
+ * or in use, remain allocated. Objects currently in use are never
+ * released, so the @pool may still hold more than @n objects past
+ * this call.
+ *
+ * Return value: the number of released objects
+ */
+guint
+gst_vaapi_video_pool_shrink (GstVaapiVideoPool * pool, guint n)
+{
+  gpointer object;
+  guint num_allocated, num_released = 0;
+
+  g_return_val_if_fail (pool != NULL, 0);
+
+  g_mutex_lock (&pool->mutex);
+  num_allocated = g_queue_get_length (&pool->free_objects) +
+      ring_get_length (pool) + g_atomic_int_get (&pool->used_count);
+  while (num_allocated > n) {
+    object = g_queue_pop_tail (&pool->free_objects);
+    if (object)
+      free_objects_changed (pool);
+    else
+      object = ring_pop (pool);
+    if (!object)
+      break;
+    gst_mini_object_unref (object);
+    num_allocated--;
+    num_released++;
+  }
+  g_mutex_unlock (&pool->mutex);
+  return num_released;
+}
+
+/**
+ * gst_vaapi_video_pool_set_tracking:
+ * @pool: a #GstVaapiVideoPool
+ * @tracking: %TRUE to track the objects in use
+ *
+ * Sets whether the @pool records when each object it hands out was
+ * acquired, and who holds it, see gst_vaapi_video_pool_get_usage().
+ * This costs a lock on every acquisition and release, so it is off
+ * by default. Objects acquired before tracking was enabled are not
+ * accounted for.
+ */
+void
+gst_vaapi_video_pool_set_tracking (GstVaapiVideoPool * pool,
+    gboolean tracking)
+{
+  g_return_if_fail (pool != NULL);
+
+  g_mutex_lock (&pool->mutex);
+  if (tracking && !pool->outstanding) {
+    pool->outstanding = g_hash_table_new_full (g_direct_hash,
+        g_direct_equal, NULL, (GDestroyNotify) usage_free);
+  } else if (!tracking)
+    g_clear_pointer (&pool->outstanding, g_hash_table_unref);
+  g_atomic_int_set (&pool->tracking, tracking);
+  g_mutex_unlock (&pool->mutex);
+}
+
+/**
+ * gst_vaapi_video_pool_set_object_holder:
+ * @pool: a #GstVaapiVideoPool
+ * @object: an object obtained from the @pool
+ * @holder: (allow-none): an interned string naming the holder
+ *
+ * Records that @object is now held by @holder, e.g. the downstream
+ * element a decoded surface was pushed to. @holder must be a string
+ * returned by g_intern_string(), or %NULL for the user of the @pool.
+ * This does nothing unless tracking is enabled.
+ */
+void
+gst_vaapi_video_pool_set_object_holder (GstVaapiVideoPool * pool,
+    gpointer object, const gchar * holder)
+{
+  GstVaapiVideoPoolUsage *usage;
+
+  g_return_if_fail (pool != NULL);
+  g_return_if_fail (object != NULL);
+
+  if (!g_atomic_int_get (&pool->tracking))
+    return;
+
+  g_mutex_lock (&pool->mutex);
+  usage = pool->outstanding ?
+      g_hash_table_lookup (pool->outstanding, object) : NULL;
+  if (usage)
+    usage->holder = holder;
+  g_mutex_unlock (&pool->mutex);
+}
+
+/**
+ * gst_vaapi_video_pool_get_usage:
+ * @pool: a #GstVaapiVideoPool
+ * @num_tracked_ptr: (out) (allow-none): return location for the
+ *   number of tracked objects in use
+ * @oldest_age_ptr: (out) (allow-none): return location for how long
+ *   the oldest of them has been in use
+ * @oldest_holder_ptr: (out) (allow-none): return location for the
+ *   holder of the oldest object, %NULL for the user of the @pool
+ *
+ * Reports the objects in use since tracking was enabled, see
+ * gst_vaapi_video_pool_set_tracking(). The returned age is zero if
+ * no object is in use.
+ *
+ * Return value: %TRUE if tracking is enabled
+ */
+gboolean
+gst_vaapi_video_pool_get_usage (GstVaapiVideoPool * pool,
+    guint * num_tracked_ptr, GstClockTime * oldest_age_ptr,
+    const gchar ** oldest_holder_ptr)
+{
+  const GstVaapiVideoPoolUsage *usage, *oldest = NULL;
+  GHashTableIter iter;
+  guint num_tracked = 0;
+  gint64 now;
+
+  g_return_val_if_fail (pool != NULL, FALSE);
+
+  g_mutex_lock (&pool->mutex);
+  if (!pool->outstanding) {
+    g_mutex_unlock (&pool->mutex);
+    return FALSE;
+  }
+
+  g_hash_table_iter_init (&iter, pool->outstanding);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) & usage)) {
+    if (!oldest || usage->acquire_time < oldest->acquire_time)
+      oldest = usage;
+    num_tracked++;
+  }
+
+  now = g_get_monotonic_time ();
+  if (num_tracked_ptr)
+    *num_tracked_ptr = num_tracked;
+  if (oldest_age_ptr) {
+    *oldest_age_ptr = oldest ?
+        (now - oldest->acquire_time) * GST_USECOND : 0;
+  }
+  if (oldest_holder_ptr)
+    *oldest_holder_ptr = oldest ? oldest->holder : NULL;
   g_mutex_unlock (&pool->mutex);
+  return TRUE;
 }
@@ -91,6 +91,26 @@ gst_vaapi_video_pool_get_capacity (GstVaapiVideoPool * pool);
 void
 gst_vaapi_video_pool_set_capacity (GstVaapiVideoPool * pool, guint capacity);
 
+guint
+gst_vaapi_video_pool_get_high_water_mark (GstVaapiVideoPool * pool,
+    gboolean reset);
+
+guint
+gst_vaapi_video_pool_shrink (GstVaapiVideoPool * pool, guint n);
+
+void
+gst_vaapi_video_pool_set_tracking (GstVaapiVideoPool * pool,
+    gboolean tracking);
+
+void
+gst_vaapi_video_pool_set_object_holder (GstVaapiVideoPool * pool,
+    gpointer object, const gchar * holder);
+
+gboolean
+gst_vaapi_video_pool_get_usage (GstVaapiVideoPool * pool,
+    guint * num_tracked_ptr, GstClockTime * oldest_age_ptr,
+    const gchar ** oldest_holder_ptr);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_VIDEO_POOL_H */
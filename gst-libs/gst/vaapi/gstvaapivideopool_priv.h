@@ -35,11 +35,32 @@ G_BEGIN_DECLS
   ((klass) != NULL)
 
 typedef struct _GstVaapiVideoPoolClass GstVaapiVideoPoolClass;
+typedef struct _GstVaapiVideoPoolCell GstVaapiVideoPoolCell;
+
+/* Number of free objects held in the lock-free ring, power of two */
+#define GST_VAAPI_VIDEO_POOL_RING_SIZE 32
+
+struct _GstVaapiVideoPoolCell
+{
+  guint seq;
+  gpointer object;
+};
 
 /**
  * GstVaapiVideoPool:
  *
  * A pool of lazily allocated video objects. e.g. surfaces, images.
+ *
+ * Free objects are primarily kept in a bounded lock-free FIFO ring,
+ * so that acquiring and releasing objects does not take any lock in
+ * the common case. The @free_objects queue, protected by @mutex,
+ * holds the objects that do not fit into the ring. As long as it is
+ * not empty, released objects are queued there too, and only reused
+ * after the ones in the ring, so that reuse stays in FIFO order.
+ * @free_objects_length mirrors its length for the lock-free path.
+ *
+ * Once tracking is enabled, @outstanding maps each object in use to
+ * its #GstVaapiVideoPoolUsage, also under @mutex.
  */
 struct _GstVaapiVideoPool
 {
@@ -48,16 +69,27 @@ struct _GstVaapiVideoPool
 
   guint object_type;
   GstVaapiDisplay *display;
+  GstVaapiVideoPoolCell ring[GST_VAAPI_VIDEO_POOL_RING_SIZE];
+  guint ring_head;
+  guint ring_tail;
   GQueue free_objects;
-  GList *used_objects;
+  guint free_objects_length;
   guint used_count;
+  guint high_water;
   guint capacity;
   GMutex mutex;
+  gboolean tracking;
+  GHashTable *outstanding;
 };
 
 /**
  * GstVaapiVideoPoolClass:
  * @alloc_object: virtual function for allocating a video pool object
+ * @reuse_object: optional virtual function telling whether an object
+ *   returned to the pool should be kept for reuse, or released
+ * @is_object_idle: optional virtual function telling whether a free
+ *   object is no longer used by the hardware, and can be handed out
+ *   without waiting
  *
  * A pool base class used to hold video objects. e.g. surfaces, images.
  */
@@ -68,6 +100,8 @@ struct _GstVaapiVideoPoolClass
 
   /*< public >*/
   gpointer (*alloc_object) (GstVaapiVideoPool * pool);
+  gboolean (*reuse_object) (GstVaapiVideoPool * pool, gpointer object);
+  gboolean (*is_object_idle) (GstVaapiVideoPool * pool, gpointer object);
 };
 
 G_GNUC_INTERNAL
@@ -79,6 +113,11 @@ G_GNUC_INTERNAL
 void
 gst_vaapi_video_pool_finalize (GstVaapiVideoPool * pool);
 
+G_GNUC_INTERNAL
+gpointer
+gst_vaapi_video_pool_get_idle_object (GstVaapiVideoPool * pool,
+    gboolean * is_idle_ptr);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_VIDEO_POOL_PRIV_H */
@@ -80,6 +80,7 @@ ensure_filter (GstVaapiWindow * window)
     goto error_create_filter;
   if (!gst_vaapi_filter_set_format (window->filter, GST_VIDEO_FORMAT_NV12))
     goto error_unsupported_format;
+  window->filter_scale_method = GST_VAAPI_SCALE_METHOD_DEFAULT;
 
   return TRUE;
 
@@ -121,9 +122,16 @@ ensure_filter_surface_pool (GstVaapiWindow * window)
 
   /* Ensure VA surface pool is created */
   /* XXX: optimize the surface format to use. e.g. YUY2 */
-  window->surface_pool = gst_vaapi_surface_pool_new (display,
-      window->surface_pool_format, window->width, window->height,
-      window->surface_pool_flags);
+  if (window->rotation == GST_VAAPI_ROTATION_90
+      || window->rotation == GST_VAAPI_ROTATION_270) {
+    window->surface_pool = gst_vaapi_surface_pool_new (display,
+        window->surface_pool_format, window->height, window->width,
+        window->surface_pool_flags);
+  } else {
+    window->surface_pool = gst_vaapi_surface_pool_new (display,
+        window->surface_pool_format, window->width, window->height,
+        window->surface_pool_flags);
+  }
   if (!window->surface_pool) {
     GST_WARNING ("failed to create surface pool for conversion");
     return FALSE;
@@ -278,6 +286,10 @@ gst_vaapi_window_vpp_convert_internal (GstVaapiWindow * window,
   if (!ensure_filter_surface_pool (window))
     return NULL;
 
+  if (window->filter_scale_method != window->scale_method &&
+      gst_vaapi_filter_set_scaling (window->filter, window->scale_method))
+    window->filter_scale_method = window->scale_method;
+
   if (src_rect)
     if (!gst_vaapi_filter_set_cropping_rectangle (window->filter, src_rect))
       return NULL;
@@ -439,6 +451,59 @@ gst_vaapi_window_set_render_rectangle (GstVaapiWindow * window, gint x, gint y,
     klass->set_render_rect (window, x, y, width, height);
 }
 
+/**
+ * gst_vaapi_window_set_rotation:
+ * @window: a #GstVaapiWindow
+ * @rotation: the #GstVaapiRotation to apply
+ *
+ * Requests the windowing system to rotate the surfaces rendered from
+ * now on, e.g. through the buffer transform of a Wayland surface,
+ * which costs no extra pass over the pictures. The render rectangles
+ * remain expressed in window coordinates, i.e. after the rotation.
+ *
+ * Return value: %TRUE if the windowing system applies @rotation,
+ *   %FALSE if it has to be done otherwise
+ */
+gboolean
+gst_vaapi_window_set_rotation (GstVaapiWindow * window,
+    GstVaapiRotation rotation)
+{
+  const GstVaapiWindowClass *klass;
+
+  g_return_val_if_fail (GST_VAAPI_IS_WINDOW (window), FALSE);
+
+  if (window->rotation == rotation)
+    return TRUE;
+
+  klass = GST_VAAPI_WINDOW_GET_CLASS (window);
+  if (!klass->set_rotation || !klass->set_rotation (window, rotation))
+    return FALSE;
+
+  if ((window->rotation + rotation) % 180 == 90)
+    gst_vaapi_video_pool_replace (&window->surface_pool, NULL);
+  window->rotation = rotation;
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_window_set_fast_conversion:
+ * @window: a #GstVaapiWindow
+ * @fast: %TRUE to scale with the fastest method
+ *
+ * Selects the fastest scaling method for the surfaces the window has
+ * to convert before presenting them, e.g. while the VA device can't
+ * keep up, or the default method again if @fast is %FALSE.
+ */
+void
+gst_vaapi_window_set_fast_conversion (GstVaapiWindow * window,
+    gboolean fast)
+{
+  g_return_if_fail (GST_VAAPI_IS_WINDOW (window));
+
+  window->scale_method = fast ? GST_VAAPI_SCALE_METHOD_FAST :
+      GST_VAAPI_SCALE_METHOD_DEFAULT;
+}
+
 /**
  * gst_vaapi_window_set_fullscreen:
  * @window: a #GstVaapiWindow
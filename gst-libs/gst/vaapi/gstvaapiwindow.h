@@ -89,6 +89,14 @@ void
 gst_vaapi_window_set_render_rectangle (GstVaapiWindow * window, gint x, gint y,
     gint width, gint height);
 
+gboolean
+gst_vaapi_window_set_rotation (GstVaapiWindow * window,
+    GstVaapiRotation rotation);
+
+void
+gst_vaapi_window_set_fast_conversion (GstVaapiWindow * window,
+    gboolean fast);
+
 gboolean
 gst_vaapi_window_put_surface (GstVaapiWindow * window,
     GstVaapiSurface * surface, const GstVaapiRectangle * src_rect,
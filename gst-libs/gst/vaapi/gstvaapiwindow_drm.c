@@ -22,34 +22,81 @@
 
 /**
  * SECTION:gstvaapiwindow_drm
- * @short_description: VA/DRM dummy window abstraction
+ * @short_description: VA/DRM window abstraction
  */
 
 #include "sysdeps.h"
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <va/va_drmcommon.h>
 #include "gstvaapiwindow_drm.h"
 #include "gstvaapiwindow_priv.h"
 #include "gstvaapidisplay_drm_priv.h"
+#include "gstvaapisurface_priv.h"
+#include "gstvaapiutils.h"
 
 GST_DEBUG_CATEGORY_EXTERN (gst_debug_vaapi_window);
 #define GST_CAT_DEFAULT gst_debug_vaapi_window
 
+/* Time to wait for a page flip before giving up on it, in ms */
+#define FLIP_TIMEOUT 1000
+
 typedef struct _GstVaapiWindowDRMClass GstVaapiWindowDRMClass;
 
+typedef struct
+{
+  guint32 fb_id;
+  guint32 crtc_id;
+  guint32 src_x;
+  guint32 src_y;
+  guint32 src_w;
+  guint32 src_h;
+  guint32 crtc_x;
+  guint32 crtc_y;
+  guint32 crtc_w;
+  guint32 crtc_h;
+} PlaneProps;
+
 /**
  * GstVaapiWindowDRM:
  *
- * A dummy DRM window abstraction.
+ * A DRM window, that is a full screen KMS plane. VA surfaces are
+ * exported as dma-bufs and scanned out directly through atomic
+ * commits, one per rendered surface, paced by page flip events.
+ *
+ * Without a modesetting capable device, this is a dummy window and
+ * all rendering functions succeed without showing anything.
  */
 struct _GstVaapiWindowDRM
 {
   /*< private > */
   GstVaapiWindow parent_instance;
+
+  gint fd;
+  GstVaapiDisplayDRMOutput output;
+  guint32 connector_crtc_id_prop;
+  guint32 crtc_mode_id_prop;
+  guint32 crtc_active_prop;
+  guint32 mode_blob_id;
+
+  guint32 plane_id;
+  guint32 plane_format;
+  PlaneProps plane_props;
+
+  guint32 front_fb_id;
+  gboolean flip_pending;
+  guint kms:1;
+  guint need_modeset:1;
 };
 
 /**
  * GstVaapiWindowDRMClass:
  *
- * A dummy DRM window abstraction class.
+ * A DRM window abstraction class.
  */
 struct _GstVaapiWindowDRMClass
 {
@@ -59,6 +106,325 @@ struct _GstVaapiWindowDRMClass
 
 G_DEFINE_TYPE (GstVaapiWindowDRM, gst_vaapi_window_drm, GST_TYPE_VAAPI_WINDOW);
 
+/* Looks up the named property of a KMS object, and optionally its
+   value. Returns 0 if there is no such property */
+static guint32
+get_property (gint fd, guint32 object_id, guint32 object_type,
+    const gchar * name, guint64 * value_ptr)
+{
+  drmModeObjectProperties *props;
+  drmModePropertyRes *prop;
+  guint32 prop_id = 0, i;
+
+  props = drmModeObjectGetProperties (fd, object_id, object_type);
+  if (!props)
+    return 0;
+
+  for (i = 0; i < props->count_props && !prop_id; i++) {
+    prop = drmModeGetProperty (fd, props->props[i]);
+    if (!prop)
+      continue;
+    if (strcmp (prop->name, name) == 0) {
+      prop_id = prop->prop_id;
+      if (value_ptr)
+        *value_ptr = props->prop_values[i];
+    }
+    drmModeFreeProperty (prop);
+  }
+  drmModeFreeObjectProperties (props);
+  return prop_id;
+}
+
+static gboolean
+plane_supports_format (drmModePlane * plane, guint32 format)
+{
+  guint32 i;
+
+  for (i = 0; i < plane->count_formats; i++) {
+    if (plane->formats[i] == format)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static gboolean
+get_plane_props (gint fd, guint32 plane_id, PlaneProps * props)
+{
+#define GET_PROP(field, name) \
+  (props->field = get_property (fd, plane_id, DRM_MODE_OBJECT_PLANE, name, \
+      NULL))
+
+  return GET_PROP (fb_id, "FB_ID") && GET_PROP (crtc_id, "CRTC_ID") &&
+      GET_PROP (src_x, "SRC_X") && GET_PROP (src_y, "SRC_Y") &&
+      GET_PROP (src_w, "SRC_W") && GET_PROP (src_h, "SRC_H") &&
+      GET_PROP (crtc_x, "CRTC_X") && GET_PROP (crtc_y, "CRTC_Y") &&
+      GET_PROP (crtc_w, "CRTC_W") && GET_PROP (crtc_h, "CRTC_H");
+#undef GET_PROP
+}
+
+/* Picks a plane of the CRTC that can scan out @format. The primary
+   plane is preferred, so that the video covers the whole output */
+static gboolean
+ensure_plane (GstVaapiWindowDRM * window, guint32 format)
+{
+  drmModePlaneRes *res;
+  drmModePlane *plane;
+  guint32 i, plane_id, primary_id = 0, overlay_id = 0;
+  guint64 type;
+
+  if (window->plane_id && window->plane_format == format)
+    return TRUE;
+
+  res = drmModeGetPlaneResources (window->fd);
+  if (!res)
+    return FALSE;
+
+  for (i = 0; i < res->count_planes; i++) {
+    plane = drmModeGetPlane (window->fd, res->planes[i]);
+    if (!plane)
+      continue;
+    if ((plane->possible_crtcs & (1 << window->output.crtc_index)) &&
+        plane_supports_format (plane, format) &&
+        get_property (window->fd, plane->plane_id, DRM_MODE_OBJECT_PLANE,
+            "type", &type)) {
+      if (type == DRM_PLANE_TYPE_PRIMARY && !primary_id)
+        primary_id = plane->plane_id;
+      else if (type == DRM_PLANE_TYPE_OVERLAY && !overlay_id)
+        overlay_id = plane->plane_id;
+    }
+    drmModeFreePlane (plane);
+  }
+  drmModeFreePlaneResources (res);
+
+  plane_id = primary_id ? primary_id : overlay_id;
+
+  if (!plane_id || !get_plane_props (window->fd, plane_id,
+          &window->plane_props))
+    goto error_no_plane;
+
+  GST_DEBUG ("scanning out %" GST_FOURCC_FORMAT " through plane %u",
+      GST_FOURCC_ARGS (format), plane_id);
+  window->plane_id = plane_id;
+  window->plane_format = format;
+  return TRUE;
+
+  /* ERRORS */
+error_no_plane:
+  {
+    GST_ERROR ("no plane can scan out %" GST_FOURCC_FORMAT,
+        GST_FOURCC_ARGS (format));
+    window->plane_id = 0;
+    return FALSE;
+  }
+}
+
+static void
+page_flip_handler (gint fd, guint frame, guint sec, guint usec,
+    gpointer user_data)
+{
+  GstVaapiWindowDRM *const window = user_data;
+
+  window->flip_pending = FALSE;
+}
+
+/* Waits for the last commit to reach the screen */
+static void
+wait_page_flip (GstVaapiWindowDRM * window)
+{
+  drmEventContext evctx = { 0, };
+  struct pollfd pfd;
+
+  evctx.version = 2;
+  evctx.page_flip_handler = page_flip_handler;
+
+  pfd.fd = window->fd;
+  pfd.events = POLLIN;
+  while (window->flip_pending) {
+    pfd.revents = 0;
+    if (poll (&pfd, 1, FLIP_TIMEOUT) <= 0) {
+      GST_WARNING ("no page flip event after %d ms", FLIP_TIMEOUT);
+      window->flip_pending = FALSE;
+      break;
+    }
+    drmHandleEvent (window->fd, &evctx);
+  }
+}
+
+static void
+close_gem_handle (gint fd, guint32 handle)
+{
+  struct drm_gem_close arg = { 0, };
+
+  arg.handle = handle;
+  drmIoctl (fd, DRM_IOCTL_GEM_CLOSE, &arg);
+}
+
+/* Wraps the surface into a KMS framebuffer, without any copy */
+static guint32
+create_framebuffer (GstVaapiWindowDRM * window, GstVaapiSurface * surface,
+    guint32 * format_ptr)
+{
+#if VA_CHECK_VERSION(1,1,0)
+  GstVaapiDisplay *const display = GST_VAAPI_WINDOW_DISPLAY (window);
+  VADRMPRIMESurfaceDescriptor desc;
+  guint32 handles[4] = { 0, }, pitches[4] = { 0, }, offsets[4] = { 0, };
+  guint64 modifiers[4] = { 0, };
+  guint32 fb_id = 0, flags = 0;
+  VAStatus status;
+  guint i;
+  gint ret = -1;
+
+  GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+  status = vaExportSurfaceHandle (GST_VAAPI_DISPLAY_VADISPLAY (display),
+      GST_VAAPI_SURFACE_ID (surface), VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2,
+      VA_EXPORT_SURFACE_COMPOSED_LAYERS | VA_EXPORT_SURFACE_READ_ONLY, &desc);
+  GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+  if (!vaapi_check_status (status, "vaExportSurfaceHandle()"))
+    return 0;
+
+  if (desc.num_layers != 1 || desc.layers[0].num_planes > 4)
+    goto cleanup;
+
+  for (i = 0; i < desc.layers[0].num_planes; i++) {
+    const guint32 object = desc.layers[0].object_index[i];
+
+    if (drmPrimeFDToHandle (window->fd, desc.objects[object].fd,
+            &handles[i]) != 0)
+      goto cleanup;
+    pitches[i] = desc.layers[0].pitch[i];
+    offsets[i] = desc.layers[0].offset[i];
+    modifiers[i] = desc.objects[object].drm_format_modifier;
+    if (modifiers[i] != DRM_FORMAT_MOD_INVALID)
+      flags = DRM_MODE_FB_MODIFIERS;
+  }
+
+  ret = drmModeAddFB2WithModifiers (window->fd, desc.width, desc.height,
+      desc.layers[0].drm_format, handles, pitches, offsets,
+      flags ? modifiers : NULL, &fb_id, flags);
+  if (ret != 0)
+    GST_ERROR ("failed to create framebuffer: %s", g_strerror (errno));
+  else
+    *format_ptr = desc.layers[0].drm_format;
+
+cleanup:
+  /* The framebuffer holds its own reference to the buffer objects */
+  for (i = 0; i < desc.layers[0].num_planes && i < 4; i++) {
+    if (handles[i])
+      close_gem_handle (window->fd, handles[i]);
+  }
+  for (i = 0; i < desc.num_objects; i++)
+    close (desc.objects[i].fd);
+  return ret == 0 ? fb_id : 0;
+#else
+  return 0;
+#endif
+}
+
+static gboolean
+commit_plane (GstVaapiWindowDRM * window, guint32 fb_id,
+    const GstVaapiRectangle * src_rect, const GstVaapiRectangle * dst_rect)
+{
+  const PlaneProps *const props = &window->plane_props;
+  const guint32 plane_id = window->plane_id;
+  drmModeAtomicReq *req;
+  guint32 flags = DRM_MODE_PAGE_FLIP_EVENT;
+  gint ret;
+
+  req = drmModeAtomicAlloc ();
+  if (!req)
+    return FALSE;
+
+  if (window->need_modeset) {
+    const guint32 crtc_id = window->output.crtc_id;
+
+    if (!window->mode_blob_id &&
+        drmModeCreatePropertyBlob (window->fd, &window->output.mode,
+            sizeof (window->output.mode), &window->mode_blob_id) != 0)
+      goto error_commit;
+    drmModeAtomicAddProperty (req, window->output.connector_id,
+        window->connector_crtc_id_prop, crtc_id);
+    drmModeAtomicAddProperty (req, crtc_id, window->crtc_mode_id_prop,
+        window->mode_blob_id);
+    drmModeAtomicAddProperty (req, crtc_id, window->crtc_active_prop, 1);
+    flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+  } else
+    flags |= DRM_MODE_ATOMIC_NONBLOCK;
+
+  drmModeAtomicAddProperty (req, plane_id, props->fb_id, fb_id);
+  drmModeAtomicAddProperty (req, plane_id, props->crtc_id,
+      fb_id ? window->output.crtc_id : 0);
+  if (fb_id) {
+    /* Source coordinates are in 16.16 fixed point */
+    drmModeAtomicAddProperty (req, plane_id, props->src_x,
+        (guint64) src_rect->x << 16);
+    drmModeAtomicAddProperty (req, plane_id, props->src_y,
+        (guint64) src_rect->y << 16);
+    drmModeAtomicAddProperty (req, plane_id, props->src_w,
+        (guint64) src_rect->width << 16);
+    drmModeAtomicAddProperty (req, plane_id, props->src_h,
+        (guint64) src_rect->height << 16);
+    drmModeAtomicAddProperty (req, plane_id, props->crtc_x, dst_rect->x);
+    drmModeAtomicAddProperty (req, plane_id, props->crtc_y, dst_rect->y);
+    drmModeAtomicAddProperty (req, plane_id, props->crtc_w, dst_rect->width);
+    drmModeAtomicAddProperty (req, plane_id, props->crtc_h, dst_rect->height);
+  }
+
+  ret = drmModeAtomicCommit (window->fd, req, flags, window);
+  if (ret != 0)
+    goto error_commit;
+  drmModeAtomicFree (req);
+
+  window->need_modeset = FALSE;
+  window->flip_pending = TRUE;
+  return TRUE;
+
+  /* ERRORS */
+error_commit:
+  {
+    GST_ERROR ("atomic commit failed: %s", g_strerror (errno));
+    drmModeAtomicFree (req);
+    return FALSE;
+  }
+}
+
+/* Sets up the atomic modesetting of the first connected output */
+static gboolean
+setup_kms (GstVaapiWindowDRM * window)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_WINDOW_DISPLAY (window);
+  GstVaapiDisplayDRMOutput *const output = &window->output;
+
+  window->fd = gst_vaapi_display_drm_get_kms_device (display);
+  if (window->fd < 0)
+    return FALSE;
+
+  if (drmSetClientCap (window->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0 ||
+      drmSetClientCap (window->fd, DRM_CLIENT_CAP_ATOMIC, 1) != 0) {
+    GST_INFO ("atomic modesetting is not supported");
+    return FALSE;
+  }
+
+  if (!gst_vaapi_display_drm_get_kms_output (display, output)) {
+    GST_INFO ("no connected output");
+    return FALSE;
+  }
+
+  window->connector_crtc_id_prop = get_property (window->fd,
+      output->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID", NULL);
+  window->crtc_mode_id_prop = get_property (window->fd, output->crtc_id,
+      DRM_MODE_OBJECT_CRTC, "MODE_ID", NULL);
+  window->crtc_active_prop = get_property (window->fd, output->crtc_id,
+      DRM_MODE_OBJECT_CRTC, "ACTIVE", NULL);
+  if (!window->connector_crtc_id_prop || !window->crtc_mode_id_prop ||
+      !window->crtc_active_prop)
+    return FALSE;
+
+  window->need_modeset = !output->mode_set;
+  GST_INFO ("using connector %u on CRTC %u, mode %s", output->connector_id,
+      output->crtc_id, output->mode.name);
+  return TRUE;
+}
+
 static gboolean
 gst_vaapi_window_drm_show (GstVaapiWindow * window)
 {
@@ -68,6 +434,18 @@ gst_vaapi_window_drm_show (GstVaapiWindow * window)
 static gboolean
 gst_vaapi_window_drm_hide (GstVaapiWindow * window)
 {
+  GstVaapiWindowDRM *const drm_window = GST_VAAPI_WINDOW_DRM (window);
+
+  if (!drm_window->kms || !drm_window->front_fb_id)
+    return TRUE;
+
+  wait_page_flip (drm_window);
+  if (!commit_plane (drm_window, 0, NULL, NULL))
+    return FALSE;
+  wait_page_flip (drm_window);
+
+  drmModeRmFB (drm_window->fd, drm_window->front_fb_id);
+  drm_window->front_fb_id = 0;
   return TRUE;
 }
 
@@ -75,6 +453,17 @@ static gboolean
 gst_vaapi_window_drm_create (GstVaapiWindow * window,
     guint * width, guint * height)
 {
+  GstVaapiWindowDRM *const drm_window = GST_VAAPI_WINDOW_DRM (window);
+
+  drm_window->kms = setup_kms (drm_window);
+  if (!drm_window->kms) {
+    GST_INFO ("no KMS output, rendering is disabled");
+    return TRUE;
+  }
+
+  /* The window covers the whole output */
+  *width = drm_window->output.mode.hdisplay;
+  *height = drm_window->output.mode.vdisplay;
   return TRUE;
 }
 
@@ -90,14 +479,64 @@ gst_vaapi_window_drm_render (GstVaapiWindow * window,
     const GstVaapiRectangle * src_rect,
     const GstVaapiRectangle * dst_rect, guint flags)
 {
+  GstVaapiWindowDRM *const drm_window = GST_VAAPI_WINDOW_DRM (window);
+  guint32 fb_id, format = 0;
+
+  if (!drm_window->kms)
+    return TRUE;
+
+  fb_id = create_framebuffer (drm_window, surface, &format);
+  if (!fb_id)
+    return FALSE;
+  if (!ensure_plane (drm_window, format))
+    goto error;
+
+  wait_page_flip (drm_window);
+  if (!commit_plane (drm_window, fb_id, src_rect, dst_rect))
+    goto error;
+
+  /* Surfaces go back to the decoder once the sink is done with them,
+     so the previous one has to be off the screen by then */
+  wait_page_flip (drm_window);
+
+  if (drm_window->front_fb_id)
+    drmModeRmFB (drm_window->fd, drm_window->front_fb_id);
+  drm_window->front_fb_id = fb_id;
   return TRUE;
+
+  /* ERRORS */
+error:
+  {
+    drmModeRmFB (drm_window->fd, fb_id);
+    return FALSE;
+  }
+}
+
+static void
+gst_vaapi_window_drm_finalize (GObject * object)
+{
+  GstVaapiWindowDRM *const window = GST_VAAPI_WINDOW_DRM (object);
+
+  if (window->kms) {
+    wait_page_flip (window);
+    /* This also turns the plane off */
+    if (window->front_fb_id)
+      drmModeRmFB (window->fd, window->front_fb_id);
+    if (window->mode_blob_id)
+      drmModeDestroyPropertyBlob (window->fd, window->mode_blob_id);
+  }
+
+  G_OBJECT_CLASS (gst_vaapi_window_drm_parent_class)->finalize (object);
 }
 
 static void
 gst_vaapi_window_drm_class_init (GstVaapiWindowDRMClass * klass)
 {
+  GObjectClass *const object_class = G_OBJECT_CLASS (klass);
   GstVaapiWindowClass *const window_class = GST_VAAPI_WINDOW_CLASS (klass);
 
+  object_class->finalize = gst_vaapi_window_drm_finalize;
+
   window_class->create = gst_vaapi_window_drm_create;
   window_class->show = gst_vaapi_window_drm_show;
   window_class->hide = gst_vaapi_window_drm_hide;
@@ -108,23 +547,25 @@ gst_vaapi_window_drm_class_init (GstVaapiWindowDRMClass * klass)
 static void
 gst_vaapi_window_drm_init (GstVaapiWindowDRM * window)
 {
+  window->fd = -1;
 }
 
 /**
  * gst_vaapi_window_drm_new:
  * @display: a #GstVaapiDisplay
  * @width: the requested window width, in pixels (unused)
- * @height: the requested windo height, in pixels (unused)
+ * @height: the requested window height, in pixels (unused)
  *
- * Creates a dummy window. The window will be attached to the @display.
- * All rendering functions will return success since VA/DRM is a
- * renderless API.
+ * Creates a window covering the first connected output of the DRM
+ * device of @display. Surfaces are scanned out directly from a KMS
+ * plane, which requires the modesetting rights on the device, e.g. no
+ * X server or Wayland compositor running on it.
  *
- * Note: this dummy window object is only necessary to fulfill cases
- * where the client application wants to automatically determine the
- * best display to use for the current system. As such, it provides
- * utility functions with the same API (function arguments) to help
- * implement uniform function tables.
+ * If the device has no connected output, or it can't do atomic
+ * modesetting, this is a dummy window: all rendering functions will
+ * return success without showing anything. This is enough for client
+ * applications that want to automatically determine the best display
+ * to use, with uniform function tables.
  *
  * Return value: the newly allocated #GstVaapiWindow object
  */
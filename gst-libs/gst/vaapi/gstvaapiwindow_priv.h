@@ -88,6 +88,14 @@ struct _GstVaapiWindow
   GstVaapiVideoPool *surface_pool;
   GstVaapiFilter *filter;
   gboolean has_vpp;
+  /* scaling method requested for the conversion, and the one the
+     filter was set to */
+  GstVaapiScaleMethod scale_method;
+  GstVaapiScaleMethod filter_scale_method;
+
+  /* applied by the presentation, the conversion surfaces are then
+     sized before the rotation */
+  GstVaapiRotation rotation;
 };
 
 /**
@@ -106,6 +114,8 @@ struct _GstVaapiWindow
  * @unblock: virtual function to unblock a rendering surface operation
  * @unblock_cancel: virtual function to cancel the previous unblock
  *   request.
+ * @set_rotation: virtual function to have the windowing system rotate
+ *   the next rendered surfaces
  *
  * Base class for system-dependent windows.
  */
@@ -130,6 +140,7 @@ struct _GstVaapiWindowClass
   gboolean (*unblock) (GstVaapiWindow * window);
   gboolean (*unblock_cancel) (GstVaapiWindow * window);
   void (*set_render_rect) (GstVaapiWindow * window, gint x, gint y, gint width, gint height);
+  gboolean (*set_rotation) (GstVaapiWindow * window, GstVaapiRotation rotation);
 };
 
 GstVaapiWindow *
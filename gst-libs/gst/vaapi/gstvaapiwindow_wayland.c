@@ -55,6 +55,8 @@ GST_DEBUG_CATEGORY_EXTERN (gst_debug_vaapi);
 typedef struct _GstVaapiWindowWaylandPrivate GstVaapiWindowWaylandPrivate;
 typedef struct _GstVaapiWindowWaylandClass GstVaapiWindowWaylandClass;
 typedef struct _FrameState FrameState;
+typedef struct _CachedBuffer CachedBuffer;
+typedef struct _PresentationFeedback PresentationFeedback;
 
 struct _FrameState
 {
@@ -62,10 +64,33 @@ struct _FrameState
   GstVaapiSurface *surface;
   GstVaapiVideoPool *surface_pool;
   struct wl_buffer *buffer;
+  CachedBuffer *cached;
   struct wl_callback *callback;
   gboolean done;
 };
 
+/* A dma-buf wl_buffer kept for as long as its VA surface lives, since
+   pool surfaces get rendered over and over again. It is in use while
+   attached to a frame the compositor did not release yet */
+struct _CachedBuffer
+{
+  GstVaapiWindow *window;
+  GstVaapiSurface *surface;
+  struct wl_buffer *buffer;
+  guint width;
+  guint height;
+  gboolean in_use;
+};
+
+/* Presentation feedback requested for a commit, kept until the
+   compositor tells whether the frame was presented or discarded */
+struct _PresentationFeedback
+{
+  GstVaapiWindow *window;
+  struct wp_presentation_feedback *feedback;
+  GstClockTime commit_time;
+};
+
 static FrameState *
 frame_state_new (GstVaapiWindow * window)
 {
@@ -78,6 +103,7 @@ frame_state_new (GstVaapiWindow * window)
   frame->window = window;
   frame->surface = NULL;
   frame->surface_pool = NULL;
+  frame->cached = NULL;
   frame->callback = NULL;
   frame->done = FALSE;
   return frame;
@@ -101,9 +127,21 @@ struct _GstVaapiWindowWaylandPrivate
   volatile guint num_frames_pending;
   gint configure_pending;
   gboolean need_vpp;
+  GstVideoFormat vpp_input_format;
   gboolean dmabuf_broken;
   GMutex opaque_mutex;
   gint opaque_width, opaque_height;
+  GMutex buffer_cache_mutex;
+  GHashTable *buffer_cache;
+  GMutex presentation_mutex;
+  GList *feedbacks;
+  GstClockTime refresh_interval;
+  GstClockTime presentation_latency;
+  guint64 last_msc;
+  guint num_frames_discarded;
+  /* the wl_output_transform requested, and the one committed */
+  gint buffer_transform;
+  gint committed_transform;
 };
 
 /**
@@ -140,6 +178,10 @@ enum
 
 static guint signals[N_SIGNALS];
 
+static void buffer_cache_release (CachedBuffer * entry);
+static void buffer_cache_clear (GstVaapiWindow * window);
+static void presentation_feedback_free (PresentationFeedback * pfb);
+
 static void
 frame_state_free (FrameState * frame)
 {
@@ -159,7 +201,10 @@ frame_state_free (FrameState * frame)
   gst_vaapi_video_pool_replace (&frame->surface_pool, NULL);
 
   g_clear_pointer (&frame->callback, wl_callback_destroy);
-  wl_buffer_destroy (frame->buffer);
+  if (frame->cached)
+    buffer_cache_release (frame->cached);
+  else
+    wl_buffer_destroy (frame->buffer);
   g_slice_free (FrameState, frame);
 }
 
@@ -476,6 +521,15 @@ gst_vaapi_window_wayland_create (GstVaapiWindow * window,
 
   g_mutex_init (&priv->opaque_mutex);
 
+  g_mutex_init (&priv->buffer_cache_mutex);
+  priv->buffer_cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  priv->vpp_input_format = GST_VIDEO_FORMAT_UNKNOWN;
+
+  g_mutex_init (&priv->presentation_mutex);
+  priv->refresh_interval = GST_CLOCK_TIME_NONE;
+  priv->presentation_latency = GST_CLOCK_TIME_NONE;
+
   if (priv->fullscreen_on_show)
     gst_vaapi_window_wayland_set_fullscreen (window, TRUE);
 
@@ -509,6 +563,9 @@ gst_vaapi_window_wayland_finalize (GObject * object)
 
   while (priv->frames)
     frame_state_free ((FrameState *) priv->frames->data);
+  buffer_cache_clear (window);
+  while (priv->feedbacks)
+    presentation_feedback_free (priv->feedbacks->data);
 
   g_clear_pointer (&priv->xdg_surface, xdg_surface_destroy);
   g_clear_pointer (&priv->wl_shell_surface, wl_shell_surface_destroy);
@@ -561,6 +618,72 @@ gst_vaapi_window_wayland_set_render_rect (GstVaapiWindow * window, gint x,
   gst_vaapi_window_wayland_update_opaque_region (window, width, height);
 }
 
+static gboolean
+gst_vaapi_window_wayland_set_rotation (GstVaapiWindow * window,
+    GstVaapiRotation rotation)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (window);
+
+  if (!priv->surface || wl_proxy_get_version ((struct wl_proxy *)
+          priv->surface) < WL_SURFACE_SET_BUFFER_TRANSFORM_SINCE_VERSION)
+    return FALSE;
+
+  /* The buffer transform is the one the compositor undoes, so turning
+     the picture clockwise tells it was turned counter-clockwise */
+  switch (rotation) {
+    case GST_VAAPI_ROTATION_0:
+      priv->buffer_transform = WL_OUTPUT_TRANSFORM_NORMAL;
+      break;
+    case GST_VAAPI_ROTATION_90:
+      priv->buffer_transform = WL_OUTPUT_TRANSFORM_90;
+      break;
+    case GST_VAAPI_ROTATION_180:
+      priv->buffer_transform = WL_OUTPUT_TRANSFORM_180;
+      break;
+    case GST_VAAPI_ROTATION_270:
+      priv->buffer_transform = WL_OUTPUT_TRANSFORM_270;
+      break;
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Maps @rect, in surface coordinates, to the coordinates of the
+   buffers, which are rotated by the compositor */
+static void
+get_buffer_rect (GstVaapiWindow * window, const GstVaapiRectangle * rect,
+    GstVaapiRectangle * buffer_rect)
+{
+  const guint width = window->width;
+  const guint height = window->height;
+
+  switch (window->rotation) {
+    case GST_VAAPI_ROTATION_90:
+      buffer_rect->x = rect->y;
+      buffer_rect->y = width - rect->x - rect->width;
+      buffer_rect->width = rect->height;
+      buffer_rect->height = rect->width;
+      break;
+    case GST_VAAPI_ROTATION_180:
+      buffer_rect->x = width - rect->x - rect->width;
+      buffer_rect->y = height - rect->y - rect->height;
+      buffer_rect->width = rect->width;
+      buffer_rect->height = rect->height;
+      break;
+    case GST_VAAPI_ROTATION_270:
+      buffer_rect->x = height - rect->y - rect->height;
+      buffer_rect->y = rect->x;
+      buffer_rect->width = rect->height;
+      buffer_rect->height = rect->width;
+      break;
+    default:
+      *buffer_rect = *rect;
+      break;
+  }
+}
+
 static inline gboolean
 frame_done (FrameState * frame)
 {
@@ -599,6 +722,264 @@ static const struct wl_buffer_listener frame_buffer_listener = {
   frame_release_callback
 };
 
+static GstClockTime
+get_presentation_clock_time (GstVaapiWindow * window)
+{
+  GstVaapiDisplayWaylandPrivate *const priv_display =
+      GST_VAAPI_DISPLAY_WAYLAND_GET_PRIVATE (GST_VAAPI_WINDOW_DISPLAY (window));
+  struct timespec ts;
+
+  if (clock_gettime (priv_display->presentation_clock, &ts) < 0)
+    return GST_CLOCK_TIME_NONE;
+  return GST_TIMESPEC_TO_TIME (ts);
+}
+
+static void
+presentation_feedback_free (PresentationFeedback * pfb)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (pfb->window);
+
+  g_mutex_lock (&priv->presentation_mutex);
+  priv->feedbacks = g_list_remove (priv->feedbacks, pfb);
+  g_mutex_unlock (&priv->presentation_mutex);
+
+  wp_presentation_feedback_destroy (pfb->feedback);
+  g_slice_free (PresentationFeedback, pfb);
+}
+
+static void
+presentation_feedback_sync_output (void *data,
+    struct wp_presentation_feedback *feedback, struct wl_output *output)
+{
+}
+
+static void
+presentation_feedback_presented (void *data,
+    struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi,
+    uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi,
+    uint32_t seq_lo, uint32_t flags)
+{
+  PresentationFeedback *const pfb = data;
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (pfb->window);
+  GstClockTime present_time, latency;
+  guint64 msc;
+
+  present_time = (((guint64) tv_sec_hi << 32) | tv_sec_lo) * GST_SECOND +
+      tv_nsec;
+  msc = ((guint64) seq_hi << 32) | seq_lo;
+
+  g_mutex_lock (&priv->presentation_mutex);
+  /* A zero refresh rate means the output has no constant one (VRR) */
+  priv->refresh_interval = refresh > 0 ? refresh : GST_CLOCK_TIME_NONE;
+
+  if (GST_CLOCK_TIME_IS_VALID (pfb->commit_time)
+      && present_time >= pfb->commit_time) {
+    latency = present_time - pfb->commit_time;
+    /* Smooth out the odd late repaint of the compositor */
+    if (GST_CLOCK_TIME_IS_VALID (priv->presentation_latency))
+      latency = (priv->presentation_latency * 7 + latency) / 8;
+    priv->presentation_latency = latency;
+  }
+
+  if (priv->last_msc && msc > priv->last_msc + 1 && (flags &
+          WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION))
+    GST_LOG ("missed %" G_GUINT64_FORMAT " refresh cycles",
+        msc - priv->last_msc - 1);
+  priv->last_msc = msc;
+  g_mutex_unlock (&priv->presentation_mutex);
+
+  GST_TRACE ("frame presented at %" GST_TIME_FORMAT ", refresh %u ns, "
+      "flags 0x%x", GST_TIME_ARGS (present_time), refresh, flags);
+
+  presentation_feedback_free (pfb);
+}
+
+static void
+presentation_feedback_discarded (void *data,
+    struct wp_presentation_feedback *feedback)
+{
+  PresentationFeedback *const pfb = data;
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (pfb->window);
+
+  g_mutex_lock (&priv->presentation_mutex);
+  priv->num_frames_discarded++;
+  g_mutex_unlock (&priv->presentation_mutex);
+
+  GST_DEBUG ("frame discarded by the compositor");
+
+  presentation_feedback_free (pfb);
+}
+
+static const struct wp_presentation_feedback_listener
+    presentation_feedback_listener = {
+  presentation_feedback_sync_output,
+  presentation_feedback_presented,
+  presentation_feedback_discarded,
+};
+
+/* Must be called with the display lock held, before the surface commit */
+static void
+presentation_feedback_request (GstVaapiWindow * window)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (window);
+  GstVaapiDisplayWaylandPrivate *const priv_display =
+      GST_VAAPI_DISPLAY_WAYLAND_GET_PRIVATE (GST_VAAPI_WINDOW_DISPLAY (window));
+  PresentationFeedback *pfb;
+
+  if (!priv_display->presentation)
+    return;
+
+  pfb = g_slice_new (PresentationFeedback);
+  pfb->window = window;
+  pfb->feedback = wp_presentation_feedback (priv_display->presentation,
+      priv->surface);
+  wl_proxy_set_queue ((struct wl_proxy *) pfb->feedback, priv->event_queue);
+  wp_presentation_feedback_add_listener (pfb->feedback,
+      &presentation_feedback_listener, pfb);
+  pfb->commit_time = get_presentation_clock_time (window);
+
+  g_mutex_lock (&priv->presentation_mutex);
+  priv->feedbacks = g_list_prepend (priv->feedbacks, pfb);
+  g_mutex_unlock (&priv->presentation_mutex);
+}
+
+static void
+cached_buffer_free (CachedBuffer * entry)
+{
+  wl_buffer_destroy (entry->buffer);
+  g_slice_free (CachedBuffer, entry);
+}
+
+/* Called when the VA surface is destroyed, the buffer goes as soon as
+   the compositor released it */
+static void
+buffer_cache_notify (gpointer data, GstMiniObject * surface)
+{
+  CachedBuffer *const entry = data;
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (entry->window);
+
+  g_mutex_lock (&priv->buffer_cache_mutex);
+  g_hash_table_remove (priv->buffer_cache, surface);
+  entry->surface = NULL;
+  if (!entry->in_use)
+    cached_buffer_free (entry);
+  g_mutex_unlock (&priv->buffer_cache_mutex);
+}
+
+static void
+buffer_cache_remove_unlocked (GstVaapiWindowWaylandPrivate * priv,
+    CachedBuffer * entry)
+{
+  g_hash_table_remove (priv->buffer_cache, entry->surface);
+  gst_mini_object_weak_unref (GST_MINI_OBJECT_CAST (entry->surface),
+      buffer_cache_notify, entry);
+  cached_buffer_free (entry);
+}
+
+/* Returns the idle wl_buffer cached for @surface, if it still fits the
+   window */
+static CachedBuffer *
+buffer_cache_lookup (GstVaapiWindow * window, GstVaapiSurface * surface)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (window);
+  CachedBuffer *entry;
+
+  g_mutex_lock (&priv->buffer_cache_mutex);
+  entry = g_hash_table_lookup (priv->buffer_cache, surface);
+  if (entry && !entry->in_use && (entry->width != window->width ||
+          entry->height != window->height)) {
+    buffer_cache_remove_unlocked (priv, entry);
+    entry = NULL;
+  }
+  if (entry && entry->in_use)
+    entry = NULL;
+  if (entry)
+    entry->in_use = TRUE;
+  g_mutex_unlock (&priv->buffer_cache_mutex);
+  return entry;
+}
+
+/* Keeps @buffer for the next renderings of @surface, unless a buffer
+   is already attached for it */
+static CachedBuffer *
+buffer_cache_insert (GstVaapiWindow * window, GstVaapiSurface * surface,
+    struct wl_buffer *buffer)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (window);
+  CachedBuffer *entry = NULL;
+
+  g_mutex_lock (&priv->buffer_cache_mutex);
+  if (g_hash_table_contains (priv->buffer_cache, surface))
+    goto end;
+
+  entry = g_slice_new (CachedBuffer);
+  entry->window = window;
+  entry->surface = surface;
+  entry->buffer = buffer;
+  entry->width = window->width;
+  entry->height = window->height;
+  entry->in_use = TRUE;
+
+  /* The frame being released is set as user data on each attach */
+  wl_proxy_set_queue ((struct wl_proxy *) buffer, priv->event_queue);
+  wl_buffer_add_listener (buffer, &frame_buffer_listener, NULL);
+
+  gst_mini_object_weak_ref (GST_MINI_OBJECT_CAST (surface),
+      buffer_cache_notify, entry);
+  g_hash_table_insert (priv->buffer_cache, surface, entry);
+
+end:
+  g_mutex_unlock (&priv->buffer_cache_mutex);
+  return entry;
+}
+
+static void
+buffer_cache_release (CachedBuffer * entry)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (entry->window);
+
+  g_mutex_lock (&priv->buffer_cache_mutex);
+  entry->in_use = FALSE;
+  if (!entry->surface)
+    cached_buffer_free (entry);
+  g_mutex_unlock (&priv->buffer_cache_mutex);
+}
+
+static void
+buffer_cache_clear (GstVaapiWindow * window)
+{
+  GstVaapiWindowWaylandPrivate *const priv =
+      GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (window);
+  GHashTableIter iter;
+  gpointer value;
+
+  if (!priv->buffer_cache)
+    return;
+
+  g_mutex_lock (&priv->buffer_cache_mutex);
+  g_hash_table_iter_init (&iter, priv->buffer_cache);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    CachedBuffer *const entry = value;
+
+    g_hash_table_iter_remove (&iter);
+    gst_mini_object_weak_unref (GST_MINI_OBJECT_CAST (entry->surface),
+        buffer_cache_notify, entry);
+    cached_buffer_free (entry);
+  }
+  g_mutex_unlock (&priv->buffer_cache_mutex);
+
+  g_clear_pointer (&priv->buffer_cache, g_hash_table_unref);
+  g_mutex_clear (&priv->buffer_cache_mutex);
+}
+
 typedef enum
 {
   GST_VAAPI_DMABUF_SUCCESS,
@@ -772,7 +1153,7 @@ out:
 static gboolean
 buffer_from_surface (GstVaapiWindow * window, GstVaapiSurface ** surf,
     const GstVaapiRectangle * src_rect, const GstVaapiRectangle * dst_rect,
-    guint flags, struct wl_buffer **buffer)
+    guint flags, struct wl_buffer **buffer, CachedBuffer ** cached)
 {
   GstVaapiDisplay *const display = GST_VAAPI_WINDOW_DISPLAY (window);
   GstVaapiWindowWaylandPrivate *const priv =
@@ -784,6 +1165,7 @@ buffer_from_surface (GstVaapiWindow * window, GstVaapiSurface ** surf,
   gint format_index = -1;
 
   va_flags = from_GstVaapiSurfaceRenderFlags (flags);
+  *cached = NULL;
 
 again:
   surface = *surf;
@@ -817,9 +1199,17 @@ again:
     }
   }
   if (!priv->dmabuf_broken) {
+    if ((va_flags & (VA_TOP_FIELD | VA_BOTTOM_FIELD)) == VA_FRAME_PICTURE)
+      *cached = buffer_cache_lookup (window, surface);
+    if (*cached) {
+      *buffer = (*cached)->buffer;
+      goto out;
+    }
+
     ret = dmabuf_buffer_from_surface (window, surface, va_flags, buffer);
     switch (ret) {
       case GST_VAAPI_DMABUF_SUCCESS:
+        *cached = buffer_cache_insert (window, surface, *buffer);
         goto out;
       case GST_VAAPI_DMABUF_BAD_FLAGS:
         /* FIXME: how should this be handed? */
@@ -831,6 +1221,8 @@ again:
         if ((format != GST_VIDEO_FORMAT_UNKNOWN) && window->has_vpp) {
           GST_DEBUG ("Failed to export buffer. Try again with format %s",
               gst_video_format_to_string (format));
+          if (surface == *surf)
+            priv->vpp_input_format = gst_vaapi_surface_get_format (surface);
           priv->need_vpp = TRUE;
           gst_vaapi_window_set_vpp_format_internal (window, format, 0);
           goto again;
@@ -847,6 +1239,8 @@ again:
            current modifier. Try linear instead. */
         if (window->has_vpp) {
           GST_DEBUG ("Modifier rejected by the server. Try linear instead.");
+          if (surface == *surf)
+            priv->vpp_input_format = gst_vaapi_surface_get_format (surface);
           priv->need_vpp = TRUE;
           gst_vaapi_window_set_vpp_format_internal (window,
               gst_vaapi_surface_get_format (surface),
@@ -880,6 +1274,7 @@ again:
           status == VA_STATUS_ERROR_UNIMPLEMENTED ||
           status == VA_STATUS_ERROR_INVALID_IMAGE_FORMAT)) {
     priv->need_vpp = TRUE;
+    priv->vpp_input_format = gst_vaapi_surface_get_format (*surf);
     goto again;
   }
   if (!vaapi_check_status (status, "vaGetSurfaceBufferWl()"))
@@ -903,8 +1298,10 @@ gst_vaapi_window_wayland_render (GstVaapiWindow * window,
   struct wl_display *const wl_display =
       GST_VAAPI_WINDOW_NATIVE_DISPLAY (window);
   struct wl_buffer *buffer;
+  CachedBuffer *cached;
   FrameState *frame;
-  guint width, height;
+  GstVaapiRectangle buffer_rect;
+  guint width, height, buffer_width, buffer_height;
   gboolean ret;
 
   /* Skip rendering without valid window size. This can happen with a foreign
@@ -912,6 +1309,21 @@ gst_vaapi_window_wayland_render (GstVaapiWindow * window,
   if (window->width == 0 || window->height == 0)
     return TRUE;
 
+  /* The checks below are made on the buffers, before the rotation */
+  get_buffer_rect (window, dst_rect, &buffer_rect);
+  dst_rect = &buffer_rect;
+  buffer_width = window->width;
+  buffer_height = window->height;
+  if (window->rotation == GST_VAAPI_ROTATION_90
+      || window->rotation == GST_VAAPI_ROTATION_270)
+    G_PRIMITIVE_SWAP (guint, buffer_width, buffer_height);
+
+  /* Only convert surfaces the compositor cannot take as they are, so
+     that a format or geometry change past the first frames does not
+     keep every later frame going through VPP */
+  priv->need_vpp =
+      gst_vaapi_surface_get_format (surface) == priv->vpp_input_format;
+
   /* Check that we don't need to crop source VA surface */
   gst_vaapi_surface_get_size (surface, &width, &height);
   if (src_rect->x != 0 || src_rect->y != 0)
@@ -922,7 +1334,7 @@ gst_vaapi_window_wayland_render (GstVaapiWindow * window,
   /* Check that we don't render to a subregion of this window */
   if (dst_rect->x != 0 || dst_rect->y != 0)
     priv->need_vpp = TRUE;
-  if (dst_rect->width != window->width || dst_rect->height != window->height)
+  if (dst_rect->width != buffer_width || dst_rect->height != buffer_height)
     priv->need_vpp = TRUE;
 
   /* Check that the surface has the correct size for the window */
@@ -931,22 +1343,30 @@ gst_vaapi_window_wayland_render (GstVaapiWindow * window,
     priv->need_vpp = TRUE;
 
   ret = buffer_from_surface (window, &surface, src_rect, dst_rect, flags,
-      &buffer);
+      &buffer, &cached);
   if (!ret)
     return FALSE;
 
   /* if need_vpp is set then the vpp happend */
   if (priv->need_vpp) {
-    width = window->width;
-    height = window->height;
+    width = buffer_width;
+    height = buffer_height;
   }
 
+  /* damage and opaque regions are in surface coordinates */
+  if (window->rotation == GST_VAAPI_ROTATION_90
+      || window->rotation == GST_VAAPI_ROTATION_270)
+    G_PRIMITIVE_SWAP (guint, width, height);
+
   /* Wait for the previous frame to complete redraw */
   if (!gst_vaapi_window_wayland_sync (window)) {
     /* Release vpp surface if exists */
     if (priv->need_vpp && window->has_vpp)
       gst_vaapi_video_pool_put_object (window->surface_pool, surface);
-    wl_buffer_destroy (buffer);
+    if (cached)
+      buffer_cache_release (cached);
+    else
+      wl_buffer_destroy (buffer);
     return !priv->sync_failed;
   }
 
@@ -963,6 +1383,10 @@ gst_vaapi_window_wayland_render (GstVaapiWindow * window,
 
   /* XXX: attach to the specified target rectangle */
   GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+  if (priv->committed_transform != priv->buffer_transform) {
+    wl_surface_set_buffer_transform (priv->surface, priv->buffer_transform);
+    priv->committed_transform = priv->buffer_transform;
+  }
   wl_surface_attach (priv->surface, buffer, 0, 0);
   wl_surface_damage (priv->surface, 0, 0, width, height);
 
@@ -978,14 +1402,20 @@ gst_vaapi_window_wayland_render (GstVaapiWindow * window,
   }
   g_mutex_unlock (&priv->opaque_mutex);
 
-  wl_proxy_set_queue ((struct wl_proxy *) buffer, priv->event_queue);
-  wl_buffer_add_listener (buffer, &frame_buffer_listener, frame);
+  if (cached)
+    wl_buffer_set_user_data (buffer, frame);
+  else {
+    wl_proxy_set_queue ((struct wl_proxy *) buffer, priv->event_queue);
+    wl_buffer_add_listener (buffer, &frame_buffer_listener, frame);
+  }
 
   frame->buffer = buffer;
+  frame->cached = cached;
   frame->callback = wl_surface_frame (priv->surface);
   wl_callback_add_listener (frame->callback, &frame_callback_listener, frame);
   priv->frames = g_list_append (priv->frames, frame);
 
+  presentation_feedback_request (window);
   wl_surface_commit (priv->surface);
   wl_display_flush (wl_display);
   GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
@@ -1030,6 +1460,7 @@ gst_vaapi_window_wayland_class_init (GstVaapiWindowWaylandClass * klass)
   window_class->set_fullscreen = gst_vaapi_window_wayland_set_fullscreen;
   window_class->unblock = gst_vaapi_window_wayland_unblock;
   window_class->unblock_cancel = gst_vaapi_window_wayland_unblock_cancel;
+  window_class->set_rotation = gst_vaapi_window_wayland_set_rotation;
   window_class->set_render_rect = gst_vaapi_window_wayland_set_render_rect;
 
   signals[SIZE_CHANGED] = g_signal_new ("size-changed",
@@ -1090,3 +1521,43 @@ gst_vaapi_window_wayland_new_with_surface (GstVaapiDisplay * display,
   return gst_vaapi_window_new_internal (GST_TYPE_VAAPI_WINDOW_WAYLAND, display,
       wl_surface, 0, 0);
 }
+
+/**
+ * gst_vaapi_window_wayland_get_presentation_timing:
+ * @window: a #GstVaapiWindowWayland
+ * @refresh_interval: (out) (allow-none): return location for the
+ *   refresh interval of the output, or %GST_CLOCK_TIME_NONE if it has
+ *   no constant refresh rate
+ * @latency: (out) (allow-none): return location for the delay between
+ *   the commit of a frame and its presentation
+ *
+ * Retrieves the display timing measured from the presentation
+ * feedback of the frames rendered so far. This requires the compositor
+ * to support the wp_presentation interface.
+ *
+ * Return value: %TRUE if at least one frame was presented and the
+ *   timing is known
+ *
+ * Since: 1.18
+ */
+gboolean
+gst_vaapi_window_wayland_get_presentation_timing (GstVaapiWindowWayland *
+    window, GstClockTime * refresh_interval, GstClockTime * latency)
+{
+  GstVaapiWindowWaylandPrivate *priv;
+  gboolean ret;
+
+  g_return_val_if_fail (GST_VAAPI_IS_WINDOW_WAYLAND (window), FALSE);
+
+  priv = GST_VAAPI_WINDOW_WAYLAND_GET_PRIVATE (window);
+
+  g_mutex_lock (&priv->presentation_mutex);
+  ret = GST_CLOCK_TIME_IS_VALID (priv->presentation_latency);
+  if (refresh_interval)
+    *refresh_interval = priv->refresh_interval;
+  if (latency)
+    *latency = priv->presentation_latency;
+  g_mutex_unlock (&priv->presentation_mutex);
+
+  return ret;
+}
@@ -49,6 +49,10 @@ GstVaapiWindow *
 gst_vaapi_window_wayland_new_with_surface (GstVaapiDisplay * display,
     guintptr wl_surface);
 
+gboolean
+gst_vaapi_window_wayland_get_presentation_timing (GstVaapiWindowWayland *
+    window, GstClockTime * refresh_interval, GstClockTime * latency);
+
 G_DEFINE_AUTOPTR_CLEANUP_FUNC(GstVaapiWindowWayland, gst_object_unref)
 
 G_END_DECLS
@@ -38,6 +38,18 @@
 #include "gstvaapiutils.h"
 #include "gstvaapiutils_x11.h"
 
+/* Surfaces are exported through vaExportSurfaceHandle() */
+#if HAVE_DRI3_PRESENT && !VA_CHECK_VERSION(1,1,0)
+# undef HAVE_DRI3_PRESENT
+# define HAVE_DRI3_PRESENT 0
+#endif
+
+#if HAVE_DRI3_PRESENT
+# include <unistd.h>
+# include <xcb/dri3.h>
+# include <xcb/present.h>
+#endif
+
 GST_DEBUG_CATEGORY_EXTERN (gst_debug_vaapi_window);
 #define GST_CAT_DEFAULT gst_debug_vaapi_window
 
@@ -286,6 +298,10 @@ gst_vaapi_window_x11_finalize (GObject * object)
   Display *const dpy = GST_VAAPI_WINDOW_NATIVE_DISPLAY (window);
   const Window xid = GST_VAAPI_WINDOW_ID (window);
 
+#if HAVE_DRI3_PRESENT
+  present_cleanup (window);
+#endif
+
   if (xid) {
     if (!window->use_foreign_window) {
       GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
@@ -420,6 +436,382 @@ gst_vaapi_window_x11_put_surface (GstVaapiWindow * window,
   return status;
 }
 
+#if HAVE_DRI3_PRESENT
+/* Maximum number of presented pixmaps the X server did not release yet */
+#define PRESENT_MAX_PENDING 2
+
+/* Maximum time to wait for the X server to release a pixmap */
+#define PRESENT_IDLE_TIMEOUT (100 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct _PresentPixmap PresentPixmap;
+
+/* A DRI3 pixmap kept for as long as its VA surface lives, since pool
+   surfaces get rendered over and over again. While the X server uses
+   it, the surface is kept out of its pool and @surface_pool is set */
+struct _PresentPixmap
+{
+  GstVaapiWindow *window;
+  GstVaapiSurface *surface;
+  GstVaapiVideoPool *surface_pool;
+  xcb_pixmap_t pixmap;
+  guint32 serial;
+};
+
+static inline xcb_connection_t *
+get_xcb_connection (GstVaapiWindow * window)
+{
+  return XGetXCBConnection (GST_VAAPI_WINDOW_NATIVE_DISPLAY (window));
+}
+
+static void
+present_pixmap_free (PresentPixmap * entry)
+{
+  xcb_free_pixmap (get_xcb_connection (entry->window), entry->pixmap);
+  g_slice_free (PresentPixmap, entry);
+}
+
+/* Called when the VA surface is destroyed, which never happens while
+   the X server holds the pixmap */
+static void
+present_pixmap_notify (gpointer data, GstMiniObject * surface)
+{
+  PresentPixmap *const entry = data;
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (entry->window);
+
+  g_mutex_lock (&priv->present_mutex);
+  g_hash_table_remove (priv->present_pixmaps, surface);
+  g_mutex_unlock (&priv->present_mutex);
+  present_pixmap_free (entry);
+}
+
+/* Gives the surface back to its pool. Must be called without the
+   present mutex held, since this may destroy the surface */
+static void
+present_pixmap_release (PresentPixmap * entry, GstVaapiVideoPool * pool)
+{
+  gst_vaapi_video_pool_put_object (pool, entry->surface);
+  gst_vaapi_video_pool_replace (&pool, NULL);
+}
+
+static void
+present_handle_idle_notify (GstVaapiWindow * window,
+    const xcb_present_idle_notify_event_t * ev)
+{
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+  GstVaapiVideoPool *pool = NULL;
+  PresentPixmap *entry = NULL;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_mutex_lock (&priv->present_mutex);
+  g_hash_table_iter_init (&iter, priv->present_pixmaps);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    PresentPixmap *const e = value;
+    if (e->pixmap == ev->pixmap && e->serial == ev->serial) {
+      entry = e;
+      break;
+    }
+  }
+  if (entry && entry->surface_pool) {
+    pool = entry->surface_pool;
+    entry->surface_pool = NULL;
+    priv->present_pending--;
+  }
+  g_mutex_unlock (&priv->present_mutex);
+
+  if (pool)
+    present_pixmap_release (entry, pool);
+}
+
+/* Processes the pending Present events. If @wait is set, also waits
+   until few enough pixmaps are held by the X server */
+static void
+present_process_events (GstVaapiWindow * window, gboolean wait)
+{
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+  xcb_connection_t *const conn = get_xcb_connection (window);
+  xcb_generic_event_t *ev;
+  const gint64 end_time = g_get_monotonic_time () + PRESENT_IDLE_TIMEOUT;
+  guint pending;
+
+  for (;;) {
+    GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+    ev = xcb_poll_for_special_event (conn, priv->present_event);
+    GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+    if (ev) {
+      const xcb_present_generic_event_t *const ge = (gpointer) ev;
+      if (ge->evtype == XCB_PRESENT_EVENT_IDLE_NOTIFY)
+        present_handle_idle_notify (window, (gpointer) ev);
+      free (ev);
+      continue;
+    }
+
+    g_mutex_lock (&priv->present_mutex);
+    pending = priv->present_pending;
+    g_mutex_unlock (&priv->present_mutex);
+    if (!wait || pending < PRESENT_MAX_PENDING)
+      break;
+    if (g_get_monotonic_time () >= end_time) {
+      GST_WARNING ("timeout waiting for the X server to release a pixmap");
+      break;
+    }
+    g_usleep (100);
+  }
+}
+
+/* Checks whether the window contents can be presented through
+   DRI3/Present, and sets it up the first time */
+static gboolean
+present_ensure (GstVaapiWindow * window)
+{
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+  GstVaapiDisplay *const display = GST_VAAPI_WINDOW_DISPLAY (window);
+  Display *const dpy = GST_VAAPI_WINDOW_NATIVE_DISPLAY (window);
+  const Window xid = GST_VAAPI_WINDOW_ID (window);
+  xcb_connection_t *const conn = get_xcb_connection (window);
+  XWindowAttributes wattr;
+
+  if (priv->present_checked)
+    return priv->use_present;
+  priv->present_checked = TRUE;
+
+  /* GLX windows are rendered through GL */
+  if (G_OBJECT_TYPE (window) != GST_TYPE_VAAPI_WINDOW_X11)
+    return FALSE;
+  if (!GST_VAAPI_DISPLAY_X11_PRIVATE (display)->use_dri3_present)
+    return FALSE;
+  /* Surfaces are converted to BGRx for the pixmaps */
+  if (!window->has_vpp)
+    return FALSE;
+
+  GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+  if (!XGetWindowAttributes (dpy, xid, &wattr) || wattr.depth != 24) {
+    GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+    GST_DEBUG ("window depth not supported for DRI3/Present");
+    return FALSE;
+  }
+
+  priv->present_eid = xcb_generate_id (conn);
+  xcb_present_select_input (conn, priv->present_eid, xid,
+      XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+  priv->present_event = xcb_register_for_special_xge (conn, &xcb_present_id,
+      priv->present_eid, NULL);
+  GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+
+  gst_vaapi_window_set_vpp_format_internal (window, GST_VIDEO_FORMAT_BGRx, 0);
+
+  GST_INFO ("presenting through DRI3/Present");
+  priv->use_present = TRUE;
+  return TRUE;
+}
+
+static void
+present_cleanup (GstVaapiWindow * window)
+{
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+  xcb_connection_t *const conn = get_xcb_connection (window);
+  GHashTableIter iter;
+  gpointer value;
+  GList *entries = NULL, *l;
+
+  if (!priv->present_pixmaps)
+    return;
+
+  g_mutex_lock (&priv->present_mutex);
+  g_hash_table_iter_init (&iter, priv->present_pixmaps);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    entries = g_list_prepend (entries, value);
+    g_hash_table_iter_remove (&iter);
+  }
+  priv->present_pending = 0;
+  g_mutex_unlock (&priv->present_mutex);
+
+  for (l = entries; l; l = l->next) {
+    PresentPixmap *const entry = l->data;
+    GstVaapiVideoPool *const pool = entry->surface_pool;
+
+    gst_mini_object_weak_unref (GST_MINI_OBJECT_CAST (entry->surface),
+        present_pixmap_notify, entry);
+    if (pool)
+      present_pixmap_release (entry, pool);
+    present_pixmap_free (entry);
+  }
+  g_list_free (entries);
+
+  if (priv->present_event) {
+    GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+    xcb_present_select_input (conn, priv->present_eid,
+        GST_VAAPI_WINDOW_ID (window), 0);
+    xcb_unregister_for_special_event (conn, priv->present_event);
+    GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+    priv->present_event = NULL;
+  }
+
+  g_hash_table_unref (priv->present_pixmaps);
+  priv->present_pixmaps = NULL;
+  g_mutex_clear (&priv->present_mutex);
+}
+
+/* Imports a BGRx VA surface as a pixmap of the window depth */
+static xcb_pixmap_t
+present_pixmap_from_surface (GstVaapiWindow * window,
+    GstVaapiSurface * surface)
+{
+  xcb_connection_t *const conn = get_xcb_connection (window);
+  VADRMPRIMESurfaceDescriptor desc;
+  xcb_generic_error_t *error;
+  xcb_void_cookie_t cookie;
+  xcb_pixmap_t pixmap = XCB_NONE;
+  guint32 strides[4] = { 0, }, offsets[4] = { 0, };
+  gint32 fds[4];
+  VAStatus status;
+  guint i, num_planes;
+
+  GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+  status = vaExportSurfaceHandle (GST_VAAPI_WINDOW_VADISPLAY (window),
+      GST_VAAPI_SURFACE_ID (surface), VA_SURFACE_ATTRIB_MEM_TYPE_DRM_PRIME_2,
+      VA_EXPORT_SURFACE_COMPOSED_LAYERS | VA_EXPORT_SURFACE_READ_ONLY, &desc);
+  GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+  if (!vaapi_check_status (status, "vaExportSurfaceHandle()"))
+    return XCB_NONE;
+
+  if (desc.num_layers != 1 || (desc.fourcc != VA_FOURCC_BGRX &&
+          desc.fourcc != VA_FOURCC_BGRA))
+    goto error_unsupported_layout;
+
+  /* The X server closes the file descriptors once received */
+  num_planes = desc.layers[0].num_planes;
+  for (i = 0; i < num_planes; i++) {
+    strides[i] = desc.layers[0].pitch[i];
+    offsets[i] = desc.layers[0].offset[i];
+    fds[i] = dup (desc.objects[desc.layers[0].object_index[i]].fd);
+  }
+
+  GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+  pixmap = xcb_generate_id (conn);
+  cookie = xcb_dri3_pixmap_from_buffers_checked (conn, pixmap,
+      GST_VAAPI_WINDOW_ID (window), num_planes, desc.width, desc.height,
+      strides[0], offsets[0], strides[1], offsets[1],
+      strides[2], offsets[2], strides[3], offsets[3],
+      24, 32, desc.objects[desc.layers[0].object_index[0]].drm_format_modifier,
+      fds);
+  error = xcb_request_check (conn, cookie);
+  GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+  if (error) {
+    GST_WARNING ("failed to import surface %" GST_VAAPI_ID_FORMAT
+        " as a pixmap (error %d)",
+        GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID (surface)), error->error_code);
+    free (error);
+    pixmap = XCB_NONE;
+  }
+
+out:
+  for (i = 0; i < desc.num_objects; i++)
+    close (desc.objects[i].fd);
+  return pixmap;
+
+  /* ERRORS */
+error_unsupported_layout:
+  {
+    GST_WARNING ("unsupported exported surface layout (%u layers, %"
+        GST_FOURCC_FORMAT ")", desc.num_layers, GST_FOURCC_ARGS (desc.fourcc));
+    goto out;
+  }
+}
+
+/* Returns the pixmap cached for @surface, creating it if needed */
+static PresentPixmap *
+present_pixmap_lookup (GstVaapiWindow * window, GstVaapiSurface * surface)
+{
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+  PresentPixmap *entry;
+  xcb_pixmap_t pixmap;
+
+  g_mutex_lock (&priv->present_mutex);
+  entry = g_hash_table_lookup (priv->present_pixmaps, surface);
+  g_mutex_unlock (&priv->present_mutex);
+  if (entry)
+    return entry;
+
+  pixmap = present_pixmap_from_surface (window, surface);
+  if (pixmap == XCB_NONE)
+    return NULL;
+
+  entry = g_slice_new0 (PresentPixmap);
+  entry->window = window;
+  entry->surface = surface;
+  entry->pixmap = pixmap;
+
+  gst_mini_object_weak_ref (GST_MINI_OBJECT_CAST (surface),
+      present_pixmap_notify, entry);
+  g_mutex_lock (&priv->present_mutex);
+  g_hash_table_insert (priv->present_pixmaps, surface, entry);
+  g_mutex_unlock (&priv->present_mutex);
+  return entry;
+}
+
+/* Converts @surface to a BGRx surface of the window size and presents
+   it at the next vblank. The X server flips or copies it without
+   tearing, and tells when the pixmap is idle again */
+static gboolean
+gst_vaapi_window_x11_present_surface (GstVaapiWindow * window,
+    GstVaapiSurface * surface,
+    const GstVaapiRectangle * src_rect,
+    const GstVaapiRectangle * dst_rect, guint flags)
+{
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+  xcb_connection_t *const conn = get_xcb_connection (window);
+  GstVaapiSurface *vpp_surface;
+  GstVaapiVideoPool *pool = NULL;
+  PresentPixmap *entry;
+
+  present_process_events (window, TRUE);
+
+  vpp_surface = gst_vaapi_window_vpp_convert_internal (window, surface,
+      src_rect, dst_rect, flags);
+  if (!vpp_surface)
+    return FALSE;
+  gst_vaapi_video_pool_replace (&pool, window->surface_pool);
+
+  entry = present_pixmap_lookup (window, vpp_surface);
+  if (!entry)
+    goto error_no_pixmap;
+
+  g_mutex_lock (&priv->present_mutex);
+  entry->surface_pool = pool;
+  entry->serial = ++priv->present_serial;
+  priv->present_pending++;
+  g_mutex_unlock (&priv->present_mutex);
+
+  GST_VAAPI_WINDOW_LOCK_DISPLAY (window);
+  xcb_present_pixmap (conn, GST_VAAPI_WINDOW_ID (window), entry->pixmap,
+      entry->serial, XCB_NONE, XCB_NONE, 0, 0, XCB_NONE, XCB_NONE, XCB_NONE,
+      XCB_PRESENT_OPTION_NONE, 0, 0, 0, 0, NULL);
+  xcb_flush (conn);
+  GST_VAAPI_WINDOW_UNLOCK_DISPLAY (window);
+  return TRUE;
+
+  /* ERRORS */
+error_no_pixmap:
+  {
+    GST_WARNING ("failed to create a pixmap, disabling DRI3/Present");
+    gst_vaapi_video_pool_put_object (pool, vpp_surface);
+    gst_vaapi_video_pool_replace (&pool, NULL);
+    priv->use_present = FALSE;
+    gst_vaapi_window_set_vpp_format_internal (window, GST_VIDEO_FORMAT_NV12,
+        0);
+    return FALSE;
+  }
+}
+#endif
+
 static gboolean
 gst_vaapi_window_x11_render (GstVaapiWindow * window,
     GstVaapiSurface * surface,
@@ -436,6 +828,15 @@ gst_vaapi_window_x11_render (GstVaapiWindow * window,
   if (surface_id == VA_INVALID_ID)
     return FALSE;
 
+#if HAVE_DRI3_PRESENT
+  if (present_ensure (window)) {
+    ret = gst_vaapi_window_x11_present_surface (window, surface, src_rect,
+        dst_rect, flags);
+    if (ret || priv->use_present)
+      return ret;
+  }
+#endif
+
   if (window->has_vpp && priv->need_vpp)
     goto conversion;
 
@@ -504,6 +905,13 @@ gst_vaapi_window_x11_class_init (GstVaapiWindowX11Class * klass)
 static void
 gst_vaapi_window_x11_init (GstVaapiWindowX11 * window)
 {
+#if HAVE_DRI3_PRESENT
+  GstVaapiWindowX11Private *const priv =
+      GST_VAAPI_WINDOW_X11_GET_PRIVATE (window);
+
+  g_mutex_init (&priv->present_mutex);
+  priv->present_pixmaps = g_hash_table_new (g_direct_hash, g_direct_equal);
+#endif
 }
 
 /**
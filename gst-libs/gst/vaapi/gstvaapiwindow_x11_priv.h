@@ -31,6 +31,10 @@
 # include <X11/extensions/Xrender.h>
 #endif
 
+#if HAVE_DRI3_PRESENT
+# include <X11/Xlib-xcb.h>
+#endif
+
 G_BEGIN_DECLS
 
 #define GST_VAAPI_WINDOW_X11_CAST(obj) ((GstVaapiWindowX11 *)(obj))
@@ -50,6 +54,18 @@ struct _GstVaapiWindowX11Private
   guint is_mapped:1;
   guint fullscreen_on_map:1;
   gboolean need_vpp;
+
+#if HAVE_DRI3_PRESENT
+  /* DRI3/Present */
+  gboolean present_checked;
+  gboolean use_present;
+  GMutex present_mutex;
+  GHashTable *present_pixmaps;
+  guint present_pending;
+  guint32 present_serial;
+  guint32 present_eid;
+  xcb_special_event_t *present_event;
+#endif
 };
 
 /**
@@ -67,6 +67,13 @@ typedef struct _GstVideoFormatMapMap
     G_PASTE(GST_VAAPI_CHROMA_TYPE_RGB,BPP),                             \
     { VA_FOURCC FOURCC, BYTE_ORDER, BPP, DEPTH, R, G, B, A }, }
 
+/* Planar RGB, one 8-bit plane per component */
+#define DEF_RGBP(FORMAT, FOURCC, R,G,B)                                 \
+  { G_PASTE(GST_VIDEO_FORMAT_,FORMAT),                                  \
+    MAKE_DRM_FORMAT(INVALID),                                           \
+    GST_VAAPI_CHROMA_TYPE_RGBP,                                         \
+    { VA_FOURCC FOURCC, VA_BYTE_ORDER_NOT_CARE, 24, 24, R, G, B, 0 }, }
+
 /* Image formats, listed in HW order preference */
 /* XXX: The new added video format must be added to
  * GST_VAAPI_FORMATS_ALL in header file to make it available to all
@@ -176,15 +183,31 @@ static const GstVideoFormatMap gst_vaapi_video_default_formats[] = {
       0x00ff0000, 0x0000ff00, 0x000000ff, 0x00000000),
   DEF_RGB (VA_LSB_FIRST, BGR10A2_LE, ARGB2101010, ('A', 'R', '3', '0'), 32, 30,
       0x3ff00000, 0x000ffc00, 0x000003ff, 0x30000000),
+
+#if GST_CHECK_VERSION(1,19,1)
+  /* RGB planar formats */
+  DEF_RGBP (RGBP, ('R', 'G', 'B', 'P'), 0x00ff0000, 0x0000ff00, 0x000000ff),
+  DEF_RGBP (BGRP, ('B', 'G', 'R', 'P'), 0x000000ff, 0x0000ff00, 0x00ff0000),
+#endif
   {0,}
 };
 /* *INDENT-ON* */
 
+#undef DEF_RGBP
 #undef DEF_RGB
 #undef DEF_YUV
 
 static GArray *gst_vaapi_video_formats_map;
 
+/* Lookup tables into gst_vaapi_video_formats_map, built along with it:
+   the entries indexed by GstVideoFormat, and an open addressing hash
+   table of the entries by VA fourcc, mapping each fourcc to its first
+   entry, so that lookups don't depend on the size of the map */
+static const GstVideoFormatMap **gst_vaapi_video_formats_by_format;
+static guint gst_vaapi_video_formats_by_format_len;
+static const GstVideoFormatMap **gst_vaapi_video_formats_by_fourcc;
+static guint gst_vaapi_video_formats_by_fourcc_mask;
+
 static inline gboolean
 va_format_is_rgb (const VAImageFormat * va_format)
 {
@@ -247,7 +270,7 @@ get_map_in_default_by_va_format (const VAImageFormat * va_format)
 }
 
 static const GstVideoFormatMap *
-get_map_by_gst_format (const GArray * formats, GstVideoFormat format)
+get_map_in_array_by_gst_format (const GArray * formats, GstVideoFormat format)
 {
   const GstVideoFormatMap *entry;
   guint i;
@@ -260,6 +283,39 @@ get_map_by_gst_format (const GArray * formats, GstVideoFormat format)
   return NULL;
 }
 
+static inline const GstVideoFormatMap *
+get_map_by_gst_format (GstVideoFormat format)
+{
+  if ((guint) format >= gst_vaapi_video_formats_by_format_len)
+    return NULL;
+  return gst_vaapi_video_formats_by_format[format];
+}
+
+static inline guint
+fourcc_hash (guint32 fourcc)
+{
+  /* Fibonacci hashing, the high bits are the best mixed */
+  return (fourcc * 2654435769U) >> 16;
+}
+
+static const GstVideoFormatMap *
+get_map_by_va_fourcc (guint32 fourcc)
+{
+  const GstVideoFormatMap *entry;
+  guint i;
+
+  if (!gst_vaapi_video_formats_by_fourcc)
+    return NULL;
+
+  i = fourcc_hash (fourcc);
+  for (;;) {
+    i &= gst_vaapi_video_formats_by_fourcc_mask;
+    entry = gst_vaapi_video_formats_by_fourcc[i++];
+    if (!entry || entry->va_format.fourcc == fourcc)
+      return entry;
+  }
+}
+
 static const GstVideoFormatMap *
 get_map_by_va_format (const VAImageFormat * va_format)
 {
@@ -267,6 +323,14 @@ get_map_by_va_format (const VAImageFormat * va_format)
   const GstVideoFormatMap *entry;
   guint i;
 
+  /* A fourcc only maps to several entries for RGB formats with
+     different component orders, which is unusual */
+  entry = get_map_by_va_fourcc (va_format->fourcc);
+  if (!entry)
+    return NULL;
+  if (va_format_is_same (&entry->va_format, va_format))
+    return entry;
+
   for (i = 0; i < formats->len; i++) {
     entry = &g_array_index (formats, GstVideoFormatMap, i);
     if (va_format_is_same (&entry->va_format, va_format))
@@ -275,6 +339,46 @@ get_map_by_va_format (const VAImageFormat * va_format)
   return NULL;
 }
 
+/* Builds the lookup tables of gst_vaapi_video_formats_map */
+static void
+video_format_create_lookup_tables (const GArray * formats)
+{
+  const GstVideoFormatMap *entry;
+  guint i, j, len = 0, size = 16;
+
+  for (i = 0; i < formats->len; i++) {
+    entry = &g_array_index (formats, GstVideoFormatMap, i);
+    len = MAX (len, (guint) entry->format + 1);
+  }
+  gst_vaapi_video_formats_by_format = g_new0 (const GstVideoFormatMap *, len);
+  for (i = 0; i < formats->len; i++) {
+    entry = &g_array_index (formats, GstVideoFormatMap, i);
+    if (!gst_vaapi_video_formats_by_format[entry->format])
+      gst_vaapi_video_formats_by_format[entry->format] = entry;
+  }
+  gst_vaapi_video_formats_by_format_len = len;
+
+  /* At most a quarter full, so that probes are short */
+  while (size < 4 * formats->len)
+    size <<= 1;
+  gst_vaapi_video_formats_by_fourcc = g_new0 (const GstVideoFormatMap *, size);
+  gst_vaapi_video_formats_by_fourcc_mask = size - 1;
+  for (i = 0; i < formats->len; i++) {
+    entry = &g_array_index (formats, GstVideoFormatMap, i);
+    j = fourcc_hash (entry->va_format.fourcc);
+    for (;; j++) {
+      const GstVideoFormatMap **const slot =
+          &gst_vaapi_video_formats_by_fourcc[j & (size - 1)];
+      if (!*slot) {
+        *slot = entry;
+        break;
+      }
+      if ((*slot)->va_format.fourcc == entry->va_format.fourcc)
+        break;
+    }
+  }
+}
+
 
 static guint
 get_fmt_score_in_default (GstVideoFormat format)
@@ -321,7 +425,7 @@ gboolean
 gst_vaapi_video_format_is_rgb (GstVideoFormat format)
 {
   const GstVideoFormatMap *const m =
-      get_map_by_gst_format (gst_vaapi_video_formats_map, format);
+      get_map_by_gst_format (format);
   return m && va_format_is_rgb (&m->va_format);
 }
 
@@ -337,7 +441,7 @@ gboolean
 gst_vaapi_video_format_is_yuv (GstVideoFormat format)
 {
   const GstVideoFormatMap *const m =
-      get_map_by_gst_format (gst_vaapi_video_formats_map, format);
+      get_map_by_gst_format (format);
   return m && va_format_is_yuv (&m->va_format);
 }
 
@@ -353,19 +457,13 @@ gst_vaapi_video_format_is_yuv (GstVideoFormat format)
 GstVideoFormat
 gst_vaapi_video_format_from_va_fourcc (guint32 fourcc)
 {
-  const GArray *map = gst_vaapi_video_formats_map;
   const GstVideoFormatMap *m;
-  guint i;
 
   /* Note: VA fourcc values are now standardized and shall represent
      a unique format. The associated VAImageFormat is just a hint to
      determine RGBA component ordering */
-  for (i = 0; i < map->len; i++) {
-    m = &g_array_index (map, GstVideoFormatMap, i);
-    if (m->va_format.fourcc == fourcc)
-      return m->format;
-  }
-  return GST_VIDEO_FORMAT_UNKNOWN;
+  m = get_map_by_va_fourcc (fourcc);
+  return m ? m->format : GST_VIDEO_FORMAT_UNKNOWN;
 }
 
 /**
@@ -399,7 +497,7 @@ const VAImageFormat *
 gst_vaapi_video_format_to_va_format (GstVideoFormat format)
 {
   const GstVideoFormatMap *const m =
-      get_map_by_gst_format (gst_vaapi_video_formats_map, format);
+      get_map_by_gst_format (format);
   return m ? &m->va_format : NULL;
 }
 
@@ -417,7 +515,7 @@ guint
 gst_vaapi_video_format_get_chroma_type (GstVideoFormat format)
 {
   const GstVideoFormatMap *const m =
-      get_map_by_gst_format (gst_vaapi_video_formats_map, format);
+      get_map_by_gst_format (format);
   return m ? m->chroma_type : 0;
 }
 
@@ -557,7 +655,7 @@ video_format_create_map_once (gpointer data)
 
       src_entry = get_map_in_default_by_va_format (&formats[i]);
       if (src_entry) {
-        entry = get_map_by_gst_format (array, src_entry->format);
+        entry = get_map_in_array_by_gst_format (array, src_entry->format);
         if (entry && !va_format_is_same (&entry->va_format, &formats[i])) {
           GST_INFO ("va_format1 with fourcc %" GST_FOURCC_FORMAT
               " byte order: %d, BPP: %d, depth %d, red mask 0x%4x,"
@@ -595,6 +693,7 @@ video_format_create_map_once (gpointer data)
   }
 
   g_array_sort (array, video_format_compare_by_score);
+  video_format_create_lookup_tables (array);
   gst_vaapi_video_formats_map = array;
   return array;
 }
@@ -632,19 +731,13 @@ guint
 gst_vaapi_drm_format_from_va_fourcc (guint32 fourcc)
 {
 #if USE_DRM
-  const GArray *map = gst_vaapi_video_formats_map;
   const GstVideoFormatMap *m;
-  guint i;
 
   /* Note: VA fourcc values are now standardized and shall represent
      a unique format. The associated VAImageFormat is just a hint to
      determine RGBA component ordering */
-  for (i = 0; i < map->len; i++) {
-    m = &g_array_index (map, GstVideoFormatMap, i);
-    if (m->va_format.fourcc == fourcc)
-      return m->drm_format;
-  }
-  return DRM_FORMAT_INVALID;
+  m = get_map_by_va_fourcc (fourcc);
+  return m ? m->drm_format : DRM_FORMAT_INVALID;
 #else
   return 0;
 #endif
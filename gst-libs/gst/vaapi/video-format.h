@@ -29,9 +29,17 @@
 
 G_BEGIN_DECLS
 
+/* Planar RGB formats appeared in GStreamer 1.20 */
+#if GST_CHECK_VERSION(1,19,1)
+#define GST_VAAPI_FORMATS_RGB_PLANAR ", RGBP, BGRP "
+#else
+#define GST_VAAPI_FORMATS_RGB_PLANAR " "
+#endif
+
 #define GST_VAAPI_FORMATS_ALL "{ ENCODED, " \
   "NV12, YV12, I420, YUY2, UYVY, Y444, GRAY8, P010_10LE, P012_LE, VUYA, Y210, Y410, " \
-  "ARGB, xRGB, RGBA, RGBx, ABGR, xBGR, BGRA, BGRx, RGB16, RGB, BGR10A2_LE "  \
+  "ARGB, xRGB, RGBA, RGBx, ABGR, xBGR, BGRA, BGRx, RGB16, RGB, BGR10A2_LE"  \
+  GST_VAAPI_FORMATS_RGB_PLANAR \
   "}"
 
 const gchar *
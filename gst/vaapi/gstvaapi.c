@@ -28,6 +28,9 @@
 #include "gstvaapipostproc.h"
 #include "gstvaapisink.h"
 #include "gstvaapidecodebin.h"
+#include "gstvaapiinterop.h"
+#include "gstvaapigopcache.h"
+#include "gstvaapicapscache.h"
 
 #if USE_ENCODERS
 #include "gstvaapiencode_h264.h"
@@ -35,6 +38,7 @@
 #include "gstvaapiencode_jpeg.h"
 #include "gstvaapiencode_vp8.h"
 #include "gstvaapiencode_h265.h"
+#include "gstvaapitranscode.h"
 
 #if USE_VP9_ENCODER
 #include "gstvaapiencode_vp9.h"
@@ -130,14 +134,17 @@ struct _GstVaapiEncoderMap
   GstVaapiCodec codec;
   guint rank;
   const gchar *name;
-    GType (*register_type) (GstVaapiDisplay * display);
+    gboolean (*probe_caps) (GstVaapiDisplay * display,
+      GstCaps ** sink_caps_ptr, GstCaps ** src_caps_ptr);
+    GType (*register_type_with_caps) (GstCaps * sink_caps, GstCaps * src_caps);
 };
 
 #define DEF_ENC(CODEC,codec)          \
   {GST_VAAPI_CODEC_##CODEC,           \
    GST_RANK_PRIMARY,                  \
    "vaapi" G_STRINGIFY (codec) "enc", \
-   gst_vaapiencode_##codec##_register_type}
+   gst_vaapiencode_##codec##_probe_caps, \
+   gst_vaapiencode_##codec##_register_type_with_caps}
 
 static const GstVaapiEncoderMap vaapi_encode_map[] = {
   DEF_ENC (H264, h264),
@@ -152,41 +159,178 @@ static const GstVaapiEncoderMap vaapi_encode_map[] = {
 
 #undef DEF_ENC
 
+/* Saves the pad template caps of the encoder @type, for
+   gst_vaapiencode_register_from_cache() */
 static void
-gst_vaapiencode_register (GstPlugin * plugin, GstVaapiDisplay * display)
+cache_encoder_caps (GKeyFile * cache, const gchar * name, GType type)
+{
+  GstElementClass *klass;
+  const gchar *pad_names[] = { "sink", "src" };
+  guint i;
+
+  klass = g_type_class_ref (type);
+  for (i = 0; i < G_N_ELEMENTS (pad_names); i++) {
+    GstPadTemplate *const templ =
+        gst_element_class_get_pad_template (klass, pad_names[i]);
+    GstCaps *caps;
+    gchar *key, *str;
+
+    if (!templ)
+      continue;
+    caps = gst_pad_template_get_caps (templ);
+    str = gst_caps_to_string (caps);
+    key = g_strdup_printf ("%s-caps", pad_names[i]);
+    g_key_file_set_string (cache, name, key, str);
+    g_free (key);
+    g_free (str);
+    gst_caps_unref (caps);
+  }
+  g_type_class_unref (klass);
+}
+
+/* The encoders are probed on a worker pool, one codec per job, while
+ * the decoders and VPP are probed. Registration only happens once all
+ * of them are done, from the thread running plugin_init() */
+
+typedef struct
+{
+  const GstVaapiEncoderMap *map;
+  GstVaapiDisplay *display;
+  GstCaps *sink_caps;
+  GstCaps *src_caps;
+} EncoderProbe;
+
+typedef struct
+{
+  EncoderProbe *probes;
+  guint num_probes;
+  GThreadPool *pool;
+} EncoderProbes;
+
+static void
+encoder_probe_run (EncoderProbe * probe, gpointer user_data)
+{
+  if (!probe->map->probe_caps (probe->display, &probe->sink_caps,
+          &probe->src_caps)) {
+    probe->sink_caps = NULL;
+    probe->src_caps = NULL;
+  }
+}
+
+static void
+gst_vaapiencode_probe_start (EncoderProbes * probes,
+    GstVaapiDisplay * display)
 {
   guint i, j;
   GArray *codecs;
   GstVaapiCodec codec;
 
+  memset (probes, 0, sizeof (*probes));
   codecs = display_get_encoder_codecs (display);
   if (!codecs)
     return;
 
+  probes->probes = g_new0 (EncoderProbe, codecs->len);
   for (i = 0; i < codecs->len; i++) {
     codec = g_array_index (codecs, GstVaapiCodec, i);
     for (j = 0; j < G_N_ELEMENTS (vaapi_encode_map); j++) {
       if (vaapi_encode_map[j].codec == codec) {
-        gst_element_register (plugin, vaapi_encode_map[j].name,
-            vaapi_encode_map[j].rank,
-            vaapi_encode_map[j].register_type (display));
+        probes->probes[probes->num_probes].map = &vaapi_encode_map[j];
+        probes->probes[probes->num_probes].display = display;
+        probes->num_probes++;
         break;
       }
     }
   }
-
   g_array_unref (codecs);
+
+  if (probes->num_probes > 1)
+    probes->pool = g_thread_pool_new ((GFunc) encoder_probe_run, NULL,
+        MIN (probes->num_probes, g_get_num_processors ()), FALSE, NULL);
+
+  for (i = 0; i < probes->num_probes; i++) {
+    if (!probes->pool
+        || !g_thread_pool_push (probes->pool, &probes->probes[i], NULL))
+      encoder_probe_run (&probes->probes[i], NULL);
+  }
+}
+
+static void
+gst_vaapiencode_register (GstPlugin * plugin, EncoderProbes * probes,
+    GKeyFile * cache)
+{
+  EncoderProbe *probe;
+  GType type;
+  guint i;
+
+  /* Waits for the pending probes */
+  if (probes->pool)
+    g_thread_pool_free (probes->pool, FALSE, TRUE);
+
+  for (i = 0; i < probes->num_probes; i++) {
+    probe = &probes->probes[i];
+    if (!probe->sink_caps)
+      continue;
+    type = probe->map->register_type_with_caps (probe->sink_caps,
+        probe->src_caps);
+    gst_element_register (plugin, probe->map->name, probe->map->rank, type);
+    if (type != G_TYPE_INVALID)
+      cache_encoder_caps (cache, probe->map->name, type);
+  }
+  g_free (probes->probes);
+}
+
+static GstCaps *
+get_cached_caps (GKeyFile * cache, const gchar * name, const gchar * key)
+{
+  GstCaps *caps = NULL;
+  gchar *str;
+
+  str = g_key_file_get_string (cache, name, key, NULL);
+  if (str)
+    caps = gst_caps_from_string (str);
+  g_free (str);
+  return caps;
+}
+
+static void
+gst_vaapiencode_register_from_cache (GstPlugin * plugin, GKeyFile * cache)
+{
+  GstCaps *sink_caps, *src_caps;
+  const gchar *name;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (vaapi_encode_map); i++) {
+    name = vaapi_encode_map[i].name;
+    if (!g_key_file_has_group (cache, name))
+      continue;
+
+    sink_caps = get_cached_caps (cache, name, "sink-caps");
+    src_caps = get_cached_caps (cache, name, "src-caps");
+    if (!sink_caps || !src_caps) {
+      GST_WARNING ("invalid cached caps for %s", name);
+      gst_caps_replace (&sink_caps, NULL);
+      gst_caps_replace (&src_caps, NULL);
+      continue;
+    }
+    gst_element_register (plugin, name, vaapi_encode_map[i].rank,
+        vaapi_encode_map[i].register_type_with_caps (sink_caps, src_caps));
+  }
 }
 #endif
 
+/* Probes the VA driver for the available elements, recording its
+   findings into @cache */
 static gboolean
-plugin_init (GstPlugin * plugin)
+plugin_probe_display (GstPlugin * plugin, GKeyFile * cache)
 {
   GstVaapiDisplay *display;
   GArray *decoders;
-  guint rank;
-
-  plugin_add_dependencies (plugin);
+  const gchar *vendor;
+  gboolean has_overlay = FALSE;
+#if USE_ENCODERS
+  EncoderProbes encoder_probes;
+#endif
 
   display = gst_vaapi_create_test_display ();
   if (!display)
@@ -194,52 +338,135 @@ plugin_init (GstPlugin * plugin)
   if (!gst_vaapi_driver_is_whitelisted (display))
     goto unsupported_driver;
 
+#if USE_ENCODERS
+  gst_vaapiencode_probe_start (&encoder_probes, display);
+#endif
+
   _gst_vaapi_has_video_processing =
       gst_vaapi_display_has_video_processing (display);
 
   decoders = display_get_decoder_codecs (display);
   if (decoders) {
     gst_vaapidecode_register (plugin, decoders);
+    g_key_file_set_integer_list (cache, GST_VAAPI_CAPS_CACHE_GROUP,
+        "decoders", (gint *) decoders->data, decoders->len);
     g_array_unref (decoders);
   }
 
   if (_gst_vaapi_has_video_processing)
-    gst_vaapioverlay_register (plugin, display);
-
-  gst_element_register (plugin, "vaapipostproc",
-      GST_RANK_PRIMARY, GST_TYPE_VAAPIPOSTPROC);
-
-  gst_element_register (plugin, "vaapidecodebin",
-      GST_RANK_PRIMARY + 2, GST_TYPE_VAAPI_DECODE_BIN);
-
-  rank = GST_RANK_SECONDARY;
-  if (g_getenv ("WAYLAND_DISPLAY"))
-    rank = GST_RANK_MARGINAL;
-  gst_element_register (plugin, "vaapisink", rank, GST_TYPE_VAAPISINK);
+    has_overlay = gst_vaapioverlay_register (plugin, display);
 
 #if USE_ENCODERS
-  gst_vaapiencode_register (plugin, display);
+  gst_vaapiencode_register (plugin, &encoder_probes, cache);
 #endif
 
-  gst_object_unref (display);
+  vendor = gst_vaapi_display_get_vendor_string (display);
+  if (vendor)
+    g_key_file_set_string (cache, GST_VAAPI_CAPS_CACHE_GROUP, "vendor", vendor);
+  g_key_file_set_boolean (cache, GST_VAAPI_CAPS_CACHE_GROUP,
+      "video-processing", _gst_vaapi_has_video_processing);
+  g_key_file_set_boolean (cache, GST_VAAPI_CAPS_CACHE_GROUP, "overlay",
+      has_overlay);
 
+  gst_object_unref (display);
   return TRUE;
 
-  /* ERRORS: */
+  /* ERRORS */
 error_no_display:
   {
     GST_WARNING ("Cannot create a VA display");
-    /* Avoid blacklisting: failure to create a display could be a
-     * transient condition */
-    return TRUE;
+    return FALSE;
   }
 unsupported_driver:
   {
     gst_object_unref (display);
-    return TRUE;                /* return TRUE to avoid get blacklisted */
+    return FALSE;
   }
 }
 
+/* Registers the elements found by an earlier plugin_probe_display() */
+static void
+plugin_register_from_cache (GstPlugin * plugin, GKeyFile * cache)
+{
+  gint *codecs;
+  gsize i, n;
+  GArray *decoders;
+
+  _gst_vaapi_has_video_processing = g_key_file_get_boolean (cache,
+      GST_VAAPI_CAPS_CACHE_GROUP, "video-processing", NULL);
+
+  codecs = g_key_file_get_integer_list (cache, GST_VAAPI_CAPS_CACHE_GROUP,
+      "decoders", &n, NULL);
+  if (codecs) {
+    decoders = g_array_sized_new (FALSE, FALSE, sizeof (GstVaapiCodec), n);
+    for (i = 0; i < n; i++) {
+      GstVaapiCodec codec = (GstVaapiCodec) codecs[i];
+      g_array_append_val (decoders, codec);
+    }
+    gst_vaapidecode_register (plugin, decoders);
+    g_array_unref (decoders);
+    g_free (codecs);
+  }
+
+  if (g_key_file_get_boolean (cache, GST_VAAPI_CAPS_CACHE_GROUP, "overlay",
+          NULL))
+    gst_element_register (plugin, "vaapioverlay", GST_RANK_PRIMARY,
+        GST_TYPE_VAAPI_OVERLAY);
+
+#if USE_ENCODERS
+  gst_vaapiencode_register_from_cache (plugin, cache);
+#endif
+}
+
+static gboolean
+plugin_init (GstPlugin * plugin)
+{
+  GKeyFile *cache;
+  guint rank;
+
+  plugin_add_dependencies (plugin);
+
+  /* Skip probing the VA driver if it was already done with this setup */
+  cache = gst_vaapi_caps_cache_load ();
+  if (cache) {
+    plugin_register_from_cache (plugin, cache);
+  } else {
+    cache = g_key_file_new ();
+    /* Avoid blacklisting: failure to create a display could be a
+     * transient condition, and unsupported drivers just expose no
+     * elements */
+    if (!plugin_probe_display (plugin, cache))
+      goto done;
+    gst_vaapi_caps_cache_save (cache);
+  }
+
+  gst_element_register (plugin, "vaapipostproc",
+      GST_RANK_PRIMARY, GST_TYPE_VAAPIPOSTPROC);
+
+  gst_element_register (plugin, "vaapidecodebin",
+      GST_RANK_PRIMARY + 2, GST_TYPE_VAAPI_DECODE_BIN);
+
+  gst_element_register (plugin, "vaapiinterop",
+      GST_RANK_NONE, GST_TYPE_VAAPI_INTEROP);
+
+  gst_element_register (plugin, "vaapigopcache",
+      GST_RANK_NONE, GST_TYPE_VAAPI_GOP_CACHE);
+
+#if USE_ENCODERS
+  gst_element_register (plugin, "vaapitranscode",
+      GST_RANK_NONE, GST_TYPE_VAAPI_TRANSCODE);
+#endif
+
+  rank = GST_RANK_SECONDARY;
+  if (g_getenv ("WAYLAND_DISPLAY"))
+    rank = GST_RANK_MARGINAL;
+  gst_element_register (plugin, "vaapisink", rank, GST_TYPE_VAAPISINK);
+
+done:
+  g_key_file_free (cache);
+  return TRUE;
+}
+
 GST_PLUGIN_DEFINE (GST_VERSION_MAJOR, GST_VERSION_MINOR,
     vaapi, PLUGIN_DESC, plugin_init,
     PACKAGE_VERSION, PLUGIN_LICENSE, PACKAGE, PACKAGE_BUGREPORT)
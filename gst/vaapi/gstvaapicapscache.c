@@ -0,0 +1,227 @@
+/*
+ *  gstvaapicapscache.c - On-disk cache of the probed VA capabilities
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "gstcompat.h"
+#include "gstvaapicapscache.h"
+#include <glib/gstdio.h>
+
+/* Bump whenever the layout of the cached data changes */
+#define CACHE_VERSION   1
+
+/*
+ * The cache holds what plugin_init() learns from a test VA display:
+ * the decoders and encoders the driver exposes, the encoders caps and
+ * whether video processing is available. Its file name is a checksum
+ * of everything the probing depends on which can be checked without
+ * opening a VA display: the environment, the DRM device nodes and the
+ * VA driver modules, whose size and modification time stand in for
+ * the driver vendor and version. Set GST_VAAPI_DISABLE_CAPS_CACHE to
+ * always probe the driver.
+ */
+
+static const gchar *cache_envvars[] = {
+  "GST_VAAPI_ALL_DRIVERS", "GST_VAAPI_DRM_DEVICE", "LIBVA_DRIVER_NAME",
+  "LIBVA_DRIVERS_PATH", "DISPLAY", "WAYLAND_DISPLAY", NULL
+};
+
+static void
+checksum_add_string (GChecksum * checksum, const gchar * str)
+{
+  if (str)
+    g_checksum_update (checksum, (const guchar *) str, strlen (str));
+  g_checksum_update (checksum, (const guchar *) "", 1);
+}
+
+static void
+checksum_add_file (GChecksum * checksum, const gchar * path)
+{
+  GStatBuf st;
+  gchar *str;
+
+  if (g_stat (path, &st) != 0)
+    return;
+
+  /* Device nodes are re-created at boot, only their number matters */
+  if (S_ISCHR (st.st_mode)) {
+    str = g_strdup_printf ("%s:%" G_GUINT64_FORMAT, path,
+        (guint64) st.st_rdev);
+  } else {
+    str = g_strdup_printf ("%s:%" G_GUINT64_FORMAT ":%" G_GINT64_FORMAT,
+        path, (guint64) st.st_size, (gint64) st.st_mtime);
+  }
+  checksum_add_string (checksum, str);
+  g_free (str);
+}
+
+static gint
+compare_paths (gconstpointer a, gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+/* Adds the files of @dirname whose name starts with @prefix and ends
+   with @suffix, in a stable order */
+static void
+checksum_add_dir (GChecksum * checksum, const gchar * dirname,
+    const gchar * prefix, const gchar * suffix)
+{
+  GDir *dir;
+  const gchar *name;
+  GPtrArray *names;
+  guint i;
+
+  dir = g_dir_open (dirname, 0, NULL);
+  if (!dir)
+    return;
+
+  names = g_ptr_array_new_with_free_func (g_free);
+  while ((name = g_dir_read_name (dir))) {
+    if (prefix && !g_str_has_prefix (name, prefix))
+      continue;
+    if (suffix && !g_str_has_suffix (name, suffix))
+      continue;
+    g_ptr_array_add (names, g_build_filename (dirname, name, NULL));
+  }
+  g_dir_close (dir);
+
+  g_ptr_array_sort (names, compare_paths);
+  for (i = 0; i < names->len; i++)
+    checksum_add_file (checksum, g_ptr_array_index (names, i));
+  g_ptr_array_unref (names);
+}
+
+static gchar *
+get_cache_filename (void)
+{
+  GChecksum *checksum;
+  const gchar *drivers_path;
+  gchar **dirs, *basename, *filename;
+  guint i;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  checksum_add_string (checksum, PACKAGE_VERSION);
+  checksum_add_string (checksum, G_STRINGIFY (CACHE_VERSION));
+
+  for (i = 0; cache_envvars[i]; i++) {
+    checksum_add_string (checksum, cache_envvars[i]);
+    checksum_add_string (checksum, g_getenv (cache_envvars[i]));
+  }
+
+  checksum_add_dir (checksum, "/dev/dri", "card", NULL);
+  checksum_add_dir (checksum, "/dev/dri", "renderD", NULL);
+
+  drivers_path = g_getenv ("LIBVA_DRIVERS_PATH");
+  if (!drivers_path)
+    drivers_path = VA_DRIVERS_PATH;
+  dirs = g_strsplit (drivers_path, G_SEARCHPATH_SEPARATOR_S, 0);
+  qsort (dirs, g_strv_length (dirs), sizeof (gchar *), compare_paths);
+  for (i = 0; dirs[i]; i++)
+    checksum_add_dir (checksum, dirs[i], NULL, "_drv_video.so");
+  g_strfreev (dirs);
+
+  basename = g_strdup_printf ("vaapi-caps-%s.cache",
+      g_checksum_get_string (checksum));
+  filename = g_build_filename (g_get_user_cache_dir (), "gstreamer-1.0",
+      basename, NULL);
+  g_free (basename);
+  g_checksum_free (checksum);
+  return filename;
+}
+
+static inline gboolean
+cache_is_enabled (void)
+{
+  return g_getenv ("GST_VAAPI_DISABLE_CAPS_CACHE") == NULL;
+}
+
+/**
+ * gst_vaapi_caps_cache_load:
+ *
+ * Loads the capabilities cached for the current VA setup, as saved by
+ * an earlier gst_vaapi_caps_cache_save().
+ *
+ * Returns: (transfer full): the cached capabilities, or %NULL if there
+ *   are none
+ **/
+GKeyFile *
+gst_vaapi_caps_cache_load (void)
+{
+  GKeyFile *cache;
+  gchar *filename;
+  GError *error = NULL;
+
+  if (!cache_is_enabled ())
+    return NULL;
+
+  filename = get_cache_filename ();
+  cache = g_key_file_new ();
+  if (!g_key_file_load_from_file (cache, filename, G_KEY_FILE_NONE, &error))
+    goto error_load;
+  if (!g_key_file_has_group (cache, GST_VAAPI_CAPS_CACHE_GROUP))
+    goto error_load;
+
+  GST_INFO ("using VA capabilities cached in %s", filename);
+  g_free (filename);
+  return cache;
+
+  /* ERRORS */
+error_load:
+  {
+    GST_DEBUG ("no VA capabilities cached in %s: %s", filename,
+        error ? error->message : "invalid content");
+    g_clear_error (&error);
+    g_key_file_free (cache);
+    g_free (filename);
+    return NULL;
+  }
+}
+
+/**
+ * gst_vaapi_caps_cache_save:
+ * @cache: the capabilities to cache
+ *
+ * Saves @cache for the current VA setup. Failures are not fatal: the
+ * capabilities will just be probed again next time.
+ **/
+void
+gst_vaapi_caps_cache_save (GKeyFile * cache)
+{
+  gchar *filename, *dirname, *data;
+  gsize size;
+  GError *error = NULL;
+
+  g_return_if_fail (cache != NULL);
+
+  if (!cache_is_enabled ())
+    return;
+
+  filename = get_cache_filename ();
+  dirname = g_path_get_dirname (filename);
+  g_mkdir_with_parents (dirname, 0755);
+  g_free (dirname);
+
+  data = g_key_file_to_data (cache, &size, NULL);
+  if (!g_file_set_contents (filename, data, size, &error)) {
+    GST_DEBUG ("failed to cache VA capabilities in %s: %s", filename,
+        error->message);
+    g_clear_error (&error);
+  }
+  g_free (data);
+  g_free (filename);
+}
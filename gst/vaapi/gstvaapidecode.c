@@ -25,9 +25,13 @@
 #include "gstcompat.h"
 #include <gst/vaapi/gstvaapidisplay.h>
 #include <gst/vaapi/gstvaapiprofilecaps.h>
+#include <gst/vaapi/gstvaapisurface_drm.h>
+#include <gst/vaapi/gstvaapivalue.h>
 
 #include "gstvaapidecode.h"
 #include "gstvaapidecode_props.h"
+#include "gstvaapidrmmeta.h"
+#include "gstvaapifencemeta.h"
 #include "gstvaapipluginutil.h"
 #include "gstvaapivideobuffer.h"
 #if (USE_GLX || USE_EGL)
@@ -44,12 +48,19 @@
 #include <gst/vaapi/gstvaapidecoder_vp8.h>
 #include <gst/vaapi/gstvaapidecoder_h265.h>
 #include <gst/vaapi/gstvaapidecoder_vp9.h>
+#if USE_AV1_DECODER
+#include <gst/vaapi/gstvaapidecoder_av1.h>
+#endif
 
 #define GST_PLUGIN_NAME "vaapidecode"
 #define GST_PLUGIN_DESC "A VA-API based video decoder"
 
 #define GST_VAAPI_DECODE_FLOW_PARSE_DATA        GST_FLOW_CUSTOM_SUCCESS_2
 
+/* Late frames in a row after which pictures are skipped up to the next
+   key picture, rather than the non-reference ones only */
+#define QOS_SUSTAINED_LATE_FRAMES 8
+
 GST_DEBUG_CATEGORY_STATIC (gst_debug_vaapidecode);
 #ifndef GST_DISABLE_GST_DEBUG
 #define GST_CAT_DEFAULT gst_debug_vaapidecode
@@ -75,6 +86,9 @@ static const char gst_vaapidecode_sink_caps_str[] =
     GST_CAPS_CODEC("video/x-wmv")
     GST_CAPS_CODEC("video/x-vp8")
     GST_CAPS_CODEC("video/x-vp9")
+#if USE_AV1_DECODER
+    GST_CAPS_CODEC("video/x-av1")
+#endif
     ;
 
 static const char gst_vaapidecode_src_caps_str[] =
@@ -105,7 +119,8 @@ struct _GstVaapiDecoderMap
 };
 
 static const GstVaapiDecoderMap vaapi_decode_map[] = {
-  {GST_VAAPI_CODEC_JPEG, GST_RANK_MARGINAL, "jpeg", "image/jpeg", NULL},
+  {GST_VAAPI_CODEC_JPEG, GST_RANK_MARGINAL, "jpeg", "image/jpeg",
+      gst_vaapi_decode_jpeg_install_properties},
   {GST_VAAPI_CODEC_MPEG2, GST_RANK_PRIMARY, "mpeg2",
       "video/mpeg, mpegversion=2, systemstream=(boolean)false", NULL},
   {GST_VAAPI_CODEC_MPEG4, GST_RANK_PRIMARY, "mpeg4",
@@ -117,7 +132,11 @@ static const GstVaapiDecoderMap vaapi_decode_map[] = {
       "video/x-wmv, wmvversion=3, format={WMV3,WVC1}", NULL},
   {GST_VAAPI_CODEC_VP8, GST_RANK_PRIMARY, "vp8", "video/x-vp8", NULL},
   {GST_VAAPI_CODEC_VP9, GST_RANK_PRIMARY, "vp9", "video/x-vp9", NULL},
-  {GST_VAAPI_CODEC_H265, GST_RANK_PRIMARY, "h265", "video/x-h265", NULL},
+#if USE_AV1_DECODER
+  {GST_VAAPI_CODEC_AV1, GST_RANK_PRIMARY, "av1", "video/x-av1", NULL},
+#endif
+  {GST_VAAPI_CODEC_H265, GST_RANK_PRIMARY, "h265", "video/x-h265",
+      gst_vaapi_decode_h265_install_properties},
   {0 /* the rest */ , GST_RANK_PRIMARY + 1, NULL,
       gst_vaapidecode_sink_caps_str, NULL},
 };
@@ -560,6 +579,350 @@ is_src_allocator_dmabuf (GstVaapiDecode * decode)
       (plugin));
 }
 
+/* Posts the error concealment statistics of the decoder along with
+   a corrupted output frame, if it was decoded with substituted
+   references */
+static void
+post_error_stats (GstVaapiDecode * decode, GstVideoCodecFrame * frame)
+{
+  GstVaapiDecoderErrorStats stats;
+  GstStructure *structure;
+
+  gst_vaapi_decoder_get_error_stats (decode->decoder, &stats);
+  if (stats.concealed_pictures == 0)
+    return;
+
+  structure = gst_structure_new ("GstVaapiDecodeErrorStats",
+      "system-frame-number", G_TYPE_UINT, frame->system_frame_number,
+      "pts", G_TYPE_UINT64, frame->pts,
+      "concealed-pictures", G_TYPE_UINT, stats.concealed_pictures,
+      "missing-references", G_TYPE_UINT, stats.missing_references, NULL);
+
+  gst_element_post_message (GST_ELEMENT_CAST (decode),
+      gst_message_new_element (GST_OBJECT_CAST (decode), structure));
+}
+
+/* ------------------------------------------------------------------------- */
+/* --- DMA-BUF Import                                                    --- */
+/* ------------------------------------------------------------------------- */
+
+/* Number of downstream buffers tried for a decoded picture */
+#define MAX_IMPORT_TRIES 4
+
+/* Protects the imports tables, which outlive the element as long as
+   decoded surfaces imported from downstream buffers are around */
+static GMutex g_imports_lock;
+
+/* A downstream buffer imported as a decoded surface, and handed over
+ * when the picture is output. Buffers wrapping the same dma-buf that
+ * come back while the decoder still references the surface, e.g. as
+ * a reference picture, are parked until it is released. Otherwise,
+ * the next picture would be decoded over it */
+typedef struct
+{
+  GstBuffer *buffer;
+  GSList *parked;
+} ImportEntry;
+
+/* The destroy data of the proxy of an imported surface */
+typedef struct
+{
+  GHashTable *imports;
+  GstVaapiSurface *surface;
+} ImportRef;
+
+static void
+import_entry_free (ImportEntry * entry)
+{
+  if (entry->buffer)
+    gst_buffer_unref (entry->buffer);
+  g_slist_free_full (entry->parked, (GDestroyNotify) gst_buffer_unref);
+  g_slice_free (ImportEntry, entry);
+}
+
+/* Called once the decoder no longer references the surface */
+static void
+import_ref_free (ImportRef * ref)
+{
+  ImportEntry *entry;
+
+  g_mutex_lock (&g_imports_lock);
+  entry = g_hash_table_lookup (ref->imports, ref->surface);
+  if (entry)
+    g_hash_table_steal (ref->imports, ref->surface);
+  g_mutex_unlock (&g_imports_lock);
+
+  /* The buffers go back to the downstream pool */
+  if (entry)
+    import_entry_free (entry);
+  g_hash_table_unref (ref->imports);
+  g_slice_free (ImportRef, ref);
+}
+
+/* Imports @buffer, laid out after @vi, as a surface of at least
+   @width x @height pixels. Pictures are decoded at their coded size,
+   which the luma plane may be padded to */
+static GstVaapiSurface *
+import_buffer (GstVaapiDecode * decode, GstBuffer * buffer, GstVideoInfo * vi,
+    guint width, guint height)
+{
+  GstVideoMeta *vmeta;
+  GstMemory *mem;
+  guint i, padded_height;
+  gint fd;
+
+  if (gst_buffer_n_memory (buffer) != 1)
+    return NULL;
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (!gst_is_dmabuf_memory (mem))
+    return NULL;
+  fd = gst_dmabuf_memory_get_fd (mem);
+  if (fd < 0)
+    return NULL;
+
+  vmeta = gst_buffer_get_video_meta (buffer);
+  if (vmeta) {
+    if (vmeta->n_planes != GST_VIDEO_INFO_N_PLANES (vi))
+      return NULL;
+    for (i = 0; i < vmeta->n_planes; i++) {
+      GST_VIDEO_INFO_PLANE_OFFSET (vi, i) = vmeta->offset[i];
+      GST_VIDEO_INFO_PLANE_STRIDE (vi, i) = vmeta->stride[i];
+    }
+  }
+  GST_VIDEO_INFO_SIZE (vi) = gst_memory_get_sizes (mem, NULL, NULL);
+
+  padded_height = GST_VIDEO_INFO_HEIGHT (vi);
+  if (GST_VIDEO_INFO_N_PLANES (vi) > 1 &&
+      GST_VIDEO_INFO_PLANE_STRIDE (vi, 0) > 0) {
+    padded_height = MAX (padded_height, GST_VIDEO_INFO_PLANE_OFFSET (vi, 1) /
+        GST_VIDEO_INFO_PLANE_STRIDE (vi, 0));
+  }
+  if (GST_VIDEO_INFO_WIDTH (vi) < width || padded_height < height) {
+    GST_LOG_OBJECT (decode, "downstream buffer too small for %ux%u pictures",
+        width, height);
+    return NULL;
+  }
+  GST_VIDEO_INFO_HEIGHT (vi) = MAX (GST_VIDEO_INFO_HEIGHT (vi), height);
+
+  return gst_vaapi_surface_import_dma_buf_handle
+      (GST_VAAPI_PLUGIN_BASE_DISPLAY (decode), fd, vi,
+      gst_vaapi_dmabuf_memory_get_modifier (mem));
+}
+
+/* Provides the decoder with surfaces imported from the buffers of the
+   downstream dma-buf pool. The decoder falls back to its own surfaces
+   when none is available right away */
+static GstVaapiSurfaceProxy *
+import_surface_proxy (GstVaapiDecoder * decoder, GstVaapiChromaType chroma_type,
+    guint width, guint height, gpointer user_data)
+{
+  GstVaapiDecode *const decode = GST_VAAPIDECODE (user_data);
+  GstBufferPoolAcquireParams params = { 0, };
+  GstVaapiSurfaceProxy *proxy = NULL;
+  GstVaapiSurface *surface;
+  GstBufferPool *pool;
+  GHashTable *imports = NULL;
+  GstVideoInfo vi, buffer_vi;
+  ImportEntry *entry;
+  ImportRef *ref;
+  GstBuffer *buffer;
+  gboolean parked;
+  guint i;
+
+  g_mutex_lock (&g_imports_lock);
+  pool = decode->import_pool ? gst_object_ref (decode->import_pool) : NULL;
+  if (pool) {
+    imports = g_hash_table_ref (decode->imports);
+    vi = decode->import_info;
+  }
+  g_mutex_unlock (&g_imports_lock);
+
+  if (!pool)
+    return NULL;
+  if (gst_vaapi_video_format_get_chroma_type (GST_VIDEO_INFO_FORMAT (&vi)) !=
+      chroma_type)
+    goto done;
+
+  params.flags = GST_BUFFER_POOL_ACQUIRE_FLAG_DONTWAIT;
+  for (i = 0; i < MAX_IMPORT_TRIES && !proxy; i++) {
+    if (gst_buffer_pool_acquire_buffer (pool, &buffer, &params) != GST_FLOW_OK)
+      break;
+
+    buffer_vi = vi;
+    surface = import_buffer (decode, buffer, &buffer_vi, width, height);
+    if (!surface) {
+      gst_buffer_unref (buffer);
+      break;
+    }
+
+    g_mutex_lock (&g_imports_lock);
+    entry = g_hash_table_lookup (imports, surface);
+    parked = entry != NULL;
+    if (parked)
+      entry->parked = g_slist_prepend (entry->parked, buffer);
+    else {
+      entry = g_slice_new0 (ImportEntry);
+      entry->buffer = buffer;
+      g_hash_table_insert (imports, surface, entry);
+    }
+    g_mutex_unlock (&g_imports_lock);
+
+    if (!parked) {
+      ref = g_slice_new (ImportRef);
+      ref->imports = g_hash_table_ref (imports);
+      ref->surface = surface;
+      proxy = gst_vaapi_surface_proxy_new (surface);
+      if (proxy) {
+        gst_vaapi_surface_proxy_set_destroy_notify (proxy,
+            (GDestroyNotify) import_ref_free, ref);
+      } else
+        import_ref_free (ref);
+    }
+    gst_vaapi_surface_unref (surface);
+  }
+
+done:
+  g_hash_table_unref (imports);
+  gst_object_unref (pool);
+  return proxy;
+}
+
+/* Takes the downstream buffer @surface was imported from, if any */
+static GstBuffer *
+take_imported_buffer (GstVaapiDecode * decode, GstVaapiSurface * surface)
+{
+  GstBuffer *buffer = NULL;
+  ImportEntry *entry;
+
+  g_mutex_lock (&g_imports_lock);
+  entry = decode->imports ? g_hash_table_lookup (decode->imports, surface) :
+      NULL;
+  if (entry) {
+    buffer = entry->buffer;
+    entry->buffer = NULL;
+  }
+  g_mutex_unlock (&g_imports_lock);
+  return buffer;
+}
+
+static void
+gst_vaapidecode_release_import_pool (GstVaapiDecode * decode)
+{
+  GstBufferPool *pool;
+
+  g_mutex_lock (&g_imports_lock);
+  pool = decode->import_pool;
+  decode->import_pool = NULL;
+  g_mutex_unlock (&g_imports_lock);
+
+  if (pool) {
+    gst_buffer_pool_set_active (pool, FALSE);
+    gst_object_unref (pool);
+  }
+}
+
+/* Keeps the dma-buf pool downstream proposed in @query, if any, so
+   that pictures are decoded straight into its buffers */
+static void
+gst_vaapidecode_ensure_import_pool (GstVaapiDecode * decode, GstQuery * query,
+    GstCaps * caps)
+{
+  GstBufferPool *pool = NULL;
+  GstStructure *config;
+  GstVideoInfo vi;
+  guint size, min, max;
+
+  gst_vaapidecode_release_import_pool (decode);
+
+  if (!decode->dmabuf_import)
+    return;
+  if (!gst_caps_features_contains (gst_caps_get_features (caps, 0),
+          GST_CAPS_FEATURE_MEMORY_DMABUF))
+    return;
+  if (!gst_video_info_from_caps (&vi, caps))
+    return;
+  if (gst_query_get_n_allocation_pools (query) == 0)
+    return;
+
+  gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+  if (!pool)
+    return;
+  if (gst_buffer_pool_has_option (pool,
+          GST_BUFFER_POOL_OPTION_VAAPI_VIDEO_META))
+    goto error_pool;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      MAX (size, GST_VIDEO_INFO_SIZE (&vi)), min, max);
+  if (gst_buffer_pool_has_option (pool, GST_BUFFER_POOL_OPTION_VIDEO_META))
+    gst_buffer_pool_config_add_option (config,
+        GST_BUFFER_POOL_OPTION_VIDEO_META);
+  if (!gst_buffer_pool_set_config (pool, config))
+    goto error_pool;
+  if (!gst_buffer_pool_set_active (pool, TRUE))
+    goto error_pool;
+
+  GST_INFO_OBJECT (decode, "decoding into downstream pool %" GST_PTR_FORMAT,
+      pool);
+
+  g_mutex_lock (&g_imports_lock);
+  decode->import_pool = pool;
+  decode->import_info = vi;
+  if (!decode->imports) {
+    decode->imports = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+        NULL, (GDestroyNotify) import_entry_free);
+  }
+  g_mutex_unlock (&g_imports_lock);
+  return;
+
+  /* ERRORS */
+error_pool:
+  {
+    GST_INFO_OBJECT (decode, "cannot decode into downstream pool %"
+        GST_PTR_FORMAT, pool);
+    gst_object_unref (pool);
+    return;
+  }
+}
+
+/* Names the element the decoded surfaces are pushed to, as their
+   holder in the surface statistics */
+static const gchar *
+get_downstream_holder (GstVaapiDecode * decode)
+{
+  GstElement *element = NULL;
+  const gchar *holder = NULL;
+  GstPad *peer;
+
+  peer = gst_pad_get_peer (GST_VIDEO_DECODER_SRC_PAD (decode));
+  if (peer) {
+    element = gst_pad_get_parent_element (peer);
+    gst_object_unref (peer);
+  }
+  if (element) {
+    GST_OBJECT_LOCK (element);
+    holder = g_intern_string (GST_OBJECT_NAME (element));
+    GST_OBJECT_UNLOCK (element);
+    gst_object_unref (element);
+  }
+  return holder;
+}
+
+/* Attaches what downstream asked for to import the DMA buffer of
+   @surface by itself: its DRM layout, and a fence for the decoding */
+static void
+describe_exported_buffer (GstVaapiDecode * decode, GstBuffer * buffer,
+    GstVaapiSurface * surface)
+{
+  if (decode->export_drm_meta && !gst_buffer_get_vaapi_drm_meta (buffer))
+    gst_buffer_add_vaapi_drm_meta (buffer, surface);
+  if (decode->export_fence && !gst_buffer_get_vaapi_fence_meta (buffer)
+      && !gst_buffer_add_vaapi_fence_meta_from_memory (buffer))
+    GST_DEBUG_OBJECT (decode, "cannot export the fence of surface %"
+        GST_VAAPI_ID_FORMAT, GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID
+            (surface)));
+}
+
 static GstFlowReturn
 gst_vaapidecode_push_decoded_frame (GstVideoDecoder * vdec,
     GstVideoCodecFrame * out_frame)
@@ -574,6 +937,7 @@ gst_vaapidecode_push_decoded_frame (GstVideoDecoder * vdec,
   GstVaapiVideoBufferPoolAcquireParams vaapi_params = { {0,}, };
   guint flags, out_flags = 0;
   gboolean alloc_renegotiate, caps_renegotiate;
+  GstBuffer *imported = NULL;
 
   if (!GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (out_frame)) {
     proxy = gst_video_codec_frame_get_user_data (out_frame);
@@ -600,30 +964,44 @@ gst_vaapidecode_push_decoded_frame (GstVideoDecoder * vdec,
         return GST_FLOW_ERROR;
     }
 
-    if (is_src_allocator_dmabuf (decode)) {
-      vaapi_params.proxy = gst_vaapi_surface_proxy_ref (proxy);
-      params = (GstBufferPoolAcquireParams *) & vaapi_params;
-    }
+    /* The picture was decoded straight into a downstream buffer, that
+     * the consumer reads as soon as it gets it */
+    imported = take_imported_buffer (decode, surface);
+    if (imported) {
+      if (!gst_vaapi_surface_sync (surface))
+        GST_WARNING_OBJECT (decode, "failed to sync imported surface");
+      out_frame->output_buffer = imported;
+    } else {
+      if (is_src_allocator_dmabuf (decode)) {
+        vaapi_params.proxy = gst_vaapi_surface_proxy_ref (proxy);
+        params = (GstBufferPoolAcquireParams *) & vaapi_params;
+      }
 
-    ret = gst_video_decoder_allocate_output_frame_with_params (vdec, out_frame,
-        params);
-    if (params)
-      gst_vaapi_surface_proxy_unref (vaapi_params.proxy);
-    if (ret != GST_FLOW_OK)
-      goto error_create_buffer;
-
-    /* if not dmabuf is negotiated set the vaapi video meta in the
-     * proxy */
-    if (!params) {
-      meta = gst_buffer_get_vaapi_video_meta (out_frame->output_buffer);
-      if (!meta)
-        goto error_get_meta;
-      gst_vaapi_video_meta_set_surface_proxy (meta, proxy);
+      ret = gst_video_decoder_allocate_output_frame_with_params (vdec,
+          out_frame, params);
+      if (params)
+        gst_vaapi_surface_proxy_unref (vaapi_params.proxy);
+      if (ret != GST_FLOW_OK)
+        goto error_create_buffer;
+
+      if (params)
+        describe_exported_buffer (decode, out_frame->output_buffer, surface);
+
+      /* if not dmabuf is negotiated set the vaapi video meta in the
+       * proxy */
+      if (!params) {
+        meta = gst_buffer_get_vaapi_video_meta (out_frame->output_buffer);
+        if (!meta)
+          goto error_get_meta;
+        gst_vaapi_video_meta_set_surface_proxy (meta, proxy);
+      }
     }
 
     flags = gst_vaapi_surface_proxy_get_flags (proxy);
-    if (flags & GST_VAAPI_SURFACE_PROXY_FLAG_CORRUPTED)
+    if (flags & GST_VAAPI_SURFACE_PROXY_FLAG_CORRUPTED) {
       out_flags |= GST_BUFFER_FLAG_CORRUPTED;
+      post_error_stats (decode, out_frame);
+    }
     if (flags & GST_VAAPI_SURFACE_PROXY_FLAG_INTERLACED) {
       out_flags |= GST_VIDEO_BUFFER_FLAG_INTERLACED;
       if (flags & GST_VAAPI_SURFACE_PROXY_FLAG_TFF)
@@ -640,22 +1018,20 @@ gst_vaapidecode_push_decoded_frame (GstVideoDecoder * vdec,
           GST_VIDEO_BUFFER_FLAG_FIRST_IN_BUNDLE);
     }
 #if (USE_GLX || USE_EGL)
-    if (decode->has_texture_upload_meta)
+    if (decode->has_texture_upload_meta && !imported)
       gst_buffer_ensure_texture_upload_meta (out_frame->output_buffer);
 #endif
 
     /* Generate a system allocated output buffer if downstream doesn't
      * support GstVideoMeta */
-    if (GST_VAAPI_PLUGIN_BASE_COPY_OUTPUT_FRAME (vdec)) {
+    if (imported) {
+      /* already in downstream memory */
+    } else if (GST_VAAPI_PLUGIN_BASE_COPY_OUTPUT_FRAME (vdec)) {
       GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (vdec);
       GstBuffer *sys_buf, *va_buf;
 
       va_buf = out_frame->output_buffer;
-      sys_buf =
-          gst_buffer_new_allocate (GST_VAAPI_PLUGIN_BASE_OTHER_ALLOCATOR
-          (plugin),
-          GST_VIDEO_INFO_SIZE (GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (plugin)),
-          &GST_VAAPI_PLUGIN_BASE_OTHER_ALLOCATOR_PARAMS (plugin));
+      sys_buf = gst_vaapi_plugin_base_acquire_sys_buffer (plugin);
       if (!sys_buf)
         goto error_no_sys_buffer;
 
@@ -666,9 +1042,16 @@ gst_vaapidecode_push_decoded_frame (GstVideoDecoder * vdec,
 
       gst_buffer_replace (&out_frame->output_buffer, sys_buf);
       gst_buffer_unref (sys_buf);
-    }
+    } else
+      gst_vaapi_surface_proxy_set_holder (proxy,
+          get_downstream_holder (decode));
   }
 
+  if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (out_frame))
+    gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (vdec));
+  else
+    gst_vaapi_plugin_base_stats_frame_out (GST_VAAPI_PLUGIN_BASE (vdec));
+
   ret = gst_video_decoder_finish_frame (vdec, out_frame);
   if (ret != GST_FLOW_OK)
     goto error_commit_buffer;
@@ -720,7 +1103,7 @@ error_commit_buffer:
 }
 
 static GstFlowReturn
-gst_vaapidecode_push_all_decoded_frames (GstVaapiDecode * decode)
+push_all_decoded_frames (GstVaapiDecode * decode)
 {
   GstVideoDecoder *const vdec = GST_VIDEO_DECODER (decode);
   GstVaapiDecoderStatus status;
@@ -728,6 +1111,7 @@ gst_vaapidecode_push_all_decoded_frames (GstVaapiDecode * decode)
   GstFlowReturn ret;
 
   for (;;) {
+    out_frame = NULL;
     status = gst_vaapi_decoder_get_frame (decode->decoder, &out_frame);
 
     switch (status) {
@@ -741,14 +1125,101 @@ gst_vaapidecode_push_all_decoded_frames (GstVaapiDecode * decode)
       case GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA:
         return GST_FLOW_OK;
       default:
-        GST_VIDEO_DECODER_ERROR (vdec, 1, STREAM, DECODE, ("Decoding failed"),
-            ("Unknown decoding error"), ret);
-        return ret;
+        if (!out_frame) {
+          GST_VIDEO_DECODER_ERROR (vdec, 1, STREAM, DECODE,
+              ("Decoding failed"), ("Unknown decoding error"), ret);
+          return ret;
+        }
+        /* The decode thread failed on this very frame */
+        GST_WARNING_OBJECT (decode, "decode error %d", status);
+        gst_video_codec_frame_unref (out_frame);
+        gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE
+            (decode));
+        gst_video_decoder_drop_frame (vdec, out_frame);
+        GST_VIDEO_DECODER_ERROR (vdec, 1, STREAM, DECODE, ("Decoding error"),
+            ("Decode error %d", status), ret);
+        if (ret != GST_FLOW_OK)
+          return ret;
+        GST_INFO_OBJECT (decode, "requesting upstream a key unit");
+        gst_pad_push_event (GST_VIDEO_DECODER_SINK_PAD (decode),
+            gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+                FALSE, 0));
+        break;
     }
   }
   g_assert_not_reached ();
 }
 
+static GstFlowReturn
+gst_vaapidecode_push_all_decoded_frames (GstVaapiDecode * decode)
+{
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (decode);
+  GstFlowReturn ret, batch_ret;
+
+  gst_vaapi_plugin_base_begin_output_batch (plugin);
+  ret = push_all_decoded_frames (decode);
+  batch_ret = gst_vaapi_plugin_base_end_output_batch (plugin);
+  return ret != GST_FLOW_OK ? ret : batch_ret;
+}
+
+/* Skips the pictures that would be shown late according to the QoS
+   events: the non-reference ones first, then the ones up to the next
+   key picture when lateness is sustained */
+static GstVaapiDecoderSkipMode
+get_qos_skip_mode (GstVaapiDecode * decode, GstVideoCodecFrame * frame)
+{
+  GstVideoDecoder *const vdec = GST_VIDEO_DECODER (decode);
+
+  if (gst_video_decoder_get_max_decode_time (vdec, frame) >= 0) {
+    decode->qos_late_frames = 0;
+    return GST_VAAPI_DECODER_SKIP_NONE;
+  }
+
+  if (++decode->qos_late_frames == QOS_SUSTAINED_LATE_FRAMES)
+    GST_INFO_OBJECT (decode, "sustained lateness, skipping to key frame");
+  if (decode->qos_late_frames >= QOS_SUSTAINED_LATE_FRAMES)
+    return GST_VAAPI_DECODER_SKIP_NON_KEY;
+  return GST_VAAPI_DECODER_SKIP_NON_REFERENCE;
+}
+
+/* Returns the skip mode for @frame of @segment. Trick modes requested
+   upstream, pictures that are not to be shown and lateness can only
+   skip more pictures than the skip-mode property */
+static GstVaapiDecoderSkipMode
+get_skip_mode (GstVaapiDecode * decode, const GstSegment * segment,
+    GstVideoCodecFrame * frame)
+{
+  GstVaapiDecoderSkipMode skip_mode = decode->skip_mode;
+
+  /* decode-only pictures are only needed as references */
+  if (GST_VIDEO_CODEC_FRAME_IS_DECODE_ONLY (frame))
+    skip_mode = MAX (skip_mode, GST_VAAPI_DECODER_SKIP_NON_REFERENCE);
+
+  if (segment->flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS)
+    skip_mode = GST_VAAPI_DECODER_SKIP_NON_KEY;
+  else if ((segment->flags & GST_SEGMENT_FLAG_TRICKMODE_FORWARD_PREDICTED)
+      && skip_mode == GST_VAAPI_DECODER_SKIP_NONE)
+    skip_mode = GST_VAAPI_DECODER_SKIP_NON_REFERENCE;
+  return MAX (skip_mode, get_qos_skip_mode (decode, frame));
+}
+
+/* Asks upstream for a key unit right away when the stream starts in
+   the middle of a GOP, rather than waiting for the next one */
+static void
+check_fast_start (GstVaapiDecode * decode, GstVideoCodecFrame * frame)
+{
+  if (!decode->needs_key_unit)
+    return;
+  decode->needs_key_unit = FALSE;
+
+  if (GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    return;
+  GST_INFO_OBJECT (decode, "stream starts without key unit, requesting one");
+  gst_pad_push_event (GST_VIDEO_DECODER_SINK_PAD (decode),
+      gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+          TRUE, 0));
+}
+
 static GstFlowReturn
 gst_vaapidecode_handle_frame (GstVideoDecoder * vdec,
     GstVideoCodecFrame * frame)
@@ -756,9 +1227,26 @@ gst_vaapidecode_handle_frame (GstVideoDecoder * vdec,
   GstVaapiDecode *const decode = GST_VAAPIDECODE (vdec);
   GstVaapiDecoderStatus status;
 
+  gst_vaapi_plugin_base_stats_frame_in (GST_VAAPI_PLUGIN_BASE (decode));
+
   if (!decode->input_state)
     goto not_negotiated;
 
+  if (gst_video_decoder_get_packetized (vdec)) {
+    status = gst_vaapi_decoder_parse_packet (decode->decoder, frame);
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      goto error_decode;
+  }
+
+  gst_vaapi_decoder_set_job_deadline (decode->decoder,
+      gst_vaapi_plugin_base_get_job_deadline (GST_VAAPI_PLUGIN_BASE (decode),
+          &vdec->input_segment, frame->pts));
+  gst_vaapi_decoder_set_priority (decode->decoder,
+      gst_vaapi_plugin_base_get_priority (GST_VAAPI_PLUGIN_BASE (decode)));
+  gst_vaapi_decoder_set_skip_mode (decode->decoder,
+      get_skip_mode (decode, &vdec->input_segment, frame));
+  check_fast_start (decode, frame);
+
   /* Decode current frame */
   for (;;) {
     status = gst_vaapi_decoder_decode (decode->decoder, frame);
@@ -769,7 +1257,8 @@ gst_vaapidecode_handle_frame (GstVideoDecoder * vdec,
 
   /* Note that gst_vaapi_decoder_decode cannot return success without
      completing the decode and pushing all decoded frames into the output
-     queue */
+     queue, unless the threaded mode is enabled. In that case, this only
+     pushes frames decoded so far */
   return gst_vaapidecode_push_all_decoded_frames (decode);
 
   /* ERRORS */
@@ -794,12 +1283,14 @@ error_decode:
                 FALSE, 0));
         break;
     }
+    gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (decode));
     gst_video_decoder_drop_frame (vdec, frame);
     return ret;
   }
 not_negotiated:
   {
     GST_ERROR_OBJECT (decode, "not negotiated");
+    gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (decode));
     gst_video_decoder_drop_frame (vdec, frame);
     return GST_FLOW_NOT_NEGOTIATED;
   }
@@ -820,6 +1311,7 @@ static GstFlowReturn
 gst_vaapidecode_drain (GstVideoDecoder * vdec)
 {
   GstVaapiDecode *const decode = GST_VAAPIDECODE (vdec);
+  GstVaapiDecoderStatus status;
 
   if (!decode->decoder)
     return GST_FLOW_NOT_NEGOTIATED;
@@ -827,6 +1319,9 @@ gst_vaapidecode_drain (GstVideoDecoder * vdec)
   GST_LOG_OBJECT (decode, "drain");
 
   gst_vaapidecode_flush_output_adapter (decode);
+  status = gst_vaapi_decoder_sync (decode->decoder);
+  if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+    GST_WARNING_OBJECT (decode, "decode error %d", status);
   return gst_vaapidecode_push_all_decoded_frames (decode);
 }
 
@@ -867,6 +1362,13 @@ gst_vaapidecode_decide_allocation (GstVideoDecoder * vdec, GstQuery * query)
 
   decode->has_texture_upload_meta = FALSE;
 
+  /* e.g. Vulkan, that neither waits for the implicit fences of the
+     DMA buffers nor guesses their layout */
+  decode->export_fence = gst_query_find_allocation_meta (query,
+      GST_VAAPI_FENCE_META_API_TYPE, NULL);
+  decode->export_drm_meta = gst_query_find_allocation_meta (query,
+      GST_VAAPI_DRM_META_API_TYPE, NULL);
+
 #if (USE_GLX || USE_EGL)
   decode->has_texture_upload_meta =
       gst_query_find_allocation_meta (query,
@@ -875,8 +1377,31 @@ gst_vaapidecode_decide_allocation (GstVideoDecoder * vdec, GstQuery * query)
       GST_VAAPI_CAPS_FEATURE_GL_TEXTURE_UPLOAD_META);
 #endif
 
-  return gst_vaapi_plugin_base_decide_allocation (GST_VAAPI_PLUGIN_BASE (vdec),
-      query);
+  /* before the query holds our own pool instead */
+  gst_vaapidecode_ensure_import_pool (decode, query, caps);
+
+  if (!gst_vaapi_plugin_base_decide_allocation (GST_VAAPI_PLUGIN_BASE (vdec),
+          query))
+    return FALSE;
+
+  /* Size the next VA context after what the whole downstream chain
+     holds, rather than after the worst case. Copied output frames
+     release their surface right away */
+  if (decode->decoder) {
+    guint min = 0;
+
+    if (!GST_VAAPI_PLUGIN_BASE_COPY_OUTPUT_FRAME (decode))
+      min = gst_vaapi_plugin_base_get_downstream_min_buffers
+          (GST_VAAPI_PLUGIN_BASE (decode));
+    GST_DEBUG_OBJECT (decode, "downstream holds up to %u surfaces", min);
+    gst_vaapi_decoder_set_downstream_surfaces (decode->decoder, min);
+
+    gst_vaapi_decoder_set_surface_alloc_flags (decode->decoder,
+        gst_vaapi_plugin_base_get_downstream_compression
+        (GST_VAAPI_PLUGIN_BASE (decode)) ?
+        GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED : 0);
+  }
+  return TRUE;
 
   /* ERRORS */
 error_no_caps:
@@ -939,12 +1464,25 @@ gst_vaapidecode_create (GstVaapiDecode * decode, GstCaps * caps)
               (decode->decoder), priv->is_low_latency);
           gst_vaapi_decoder_h264_set_base_only (GST_VAAPI_DECODER_H264
               (decode->decoder), priv->base_only);
+          gst_vaapi_decoder_h264_set_error_concealment (GST_VAAPI_DECODER_H264
+              (decode->decoder), priv->conceal_errors);
         }
       }
       break;
     case GST_VAAPI_CODEC_H265:
       decode->decoder = gst_vaapi_decoder_h265_new (dpy, caps);
 
+      if (decode->decoder) {
+        GstVaapiDecodeH265Private *priv =
+            gst_vaapi_decode_h265_get_instance_private (decode);
+        if (priv) {
+          gst_vaapi_decoder_h265_set_low_latency (GST_VAAPI_DECODER_H265
+              (decode->decoder), priv->is_low_latency);
+          gst_vaapi_decoder_h265_set_error_concealment (GST_VAAPI_DECODER_H265
+              (decode->decoder), priv->conceal_errors);
+        }
+      }
+
       /* Set the stream buffer alignment for better optimizations */
       if (decode->decoder && caps) {
         GstStructure *const structure = gst_caps_get_structure (caps, 0);
@@ -972,6 +1510,14 @@ gst_vaapidecode_create (GstVaapiDecode * decode, GstCaps * caps)
       break;
     case GST_VAAPI_CODEC_JPEG:
       decode->decoder = gst_vaapi_decoder_jpeg_new (dpy, caps);
+
+      if (decode->decoder) {
+        GstVaapiDecodeJpegPrivate *priv =
+            gst_vaapi_decode_jpeg_get_instance_private (decode);
+        if (priv)
+          gst_vaapi_decoder_jpeg_set_num_contexts (GST_VAAPI_DECODER_JPEG
+              (decode->decoder), priv->num_contexts);
+      }
       break;
     case GST_VAAPI_CODEC_VP8:
       decode->decoder = gst_vaapi_decoder_vp8_new (dpy, caps);
@@ -979,6 +1525,11 @@ gst_vaapidecode_create (GstVaapiDecode * decode, GstCaps * caps)
     case GST_VAAPI_CODEC_VP9:
       decode->decoder = gst_vaapi_decoder_vp9_new (dpy, caps);
       break;
+#if USE_AV1_DECODER
+    case GST_VAAPI_CODEC_AV1:
+      decode->decoder = gst_vaapi_decoder_av1_new (dpy, caps);
+      break;
+#endif
     default:
       decode->decoder = NULL;
       break;
@@ -986,8 +1537,25 @@ gst_vaapidecode_create (GstVaapiDecode * decode, GstCaps * caps)
   if (!decode->decoder)
     return FALSE;
 
+  /* name after the element so that tracer records are attributable */
+  gst_object_set_name (GST_OBJECT (decode->decoder), GST_ELEMENT_NAME (decode));
+  gst_vaapi_plugin_base_stats_attach (GST_VAAPI_PLUGIN_BASE (decode),
+      decode->decoder);
   gst_vaapi_decoder_set_codec_state_changed_func (decode->decoder,
       gst_vaapi_decoder_state_changed, decode);
+  gst_vaapi_decoder_set_threaded (decode->decoder, decode->threaded);
+  gst_vaapi_decoder_set_rendition_switch (decode->decoder,
+      decode->rendition_switch);
+  gst_vaapi_decoder_set_max_picture_size (decode->decoder,
+      decode->max_width, decode->max_height);
+  gst_vaapi_decoder_set_rendition_settle_time (decode->decoder,
+      decode->rendition_settle_time);
+  gst_vaapi_decoder_set_parallel_contexts (decode->decoder,
+      decode->parallel_contexts);
+  gst_vaapi_decoder_set_starvation_recovery (decode->decoder,
+      decode->starvation_recovery);
+  gst_vaapi_decoder_set_surface_func (decode->decoder, import_surface_proxy,
+      decode);
 
   return TRUE;
 }
@@ -1016,7 +1584,8 @@ gst_vaapidecode_purge (GstVaapiDecode * decode)
       gst_video_decoder_release_frame (GST_VIDEO_DECODER (decode), frame);
       gst_video_codec_frame_unref (frame);
     }
-  } while (status == GST_VAAPI_DECODER_STATUS_SUCCESS);
+    /* frames that failed to decode come out with their error */
+  } while (status != GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA);
 }
 
 static void
@@ -1035,6 +1604,7 @@ gst_vaapidecode_reset (GstVaapiDecode * decode, GstCaps * caps,
 {
   /* Reset tracked frame size */
   decode->current_frame_size = 0;
+  decode->needs_key_unit = decode->fast_start;
 
   if (decode->decoder) {
     if (!gst_caps_is_equal (caps, gst_vaapi_decoder_get_caps (decode->decoder))) {
@@ -1051,9 +1621,161 @@ gst_vaapidecode_reset (GstVaapiDecode * decode, GstCaps * caps,
   return gst_vaapidecode_create (decode, caps);
 }
 
+static void
+gst_vaapidecode_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiDecode *const decode = GST_VAAPIDECODE (object);
+
+  switch (prop_id) {
+    case GST_VAAPI_DECODE_PROP_THREADED:
+      decode->threaded = g_value_get_boolean (value);
+      if (decode->decoder)
+        gst_vaapi_decoder_set_threaded (decode->decoder, decode->threaded);
+      break;
+    case GST_VAAPI_DECODE_PROP_SKIP_MODE:
+      decode->skip_mode = g_value_get_enum (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_RENDITION_SWITCH:
+      decode->rendition_switch = g_value_get_boolean (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_MAX_WIDTH:
+      decode->max_width = g_value_get_uint (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_MAX_HEIGHT:
+      decode->max_height = g_value_get_uint (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_RENDITION_SETTLE_TIME:
+      decode->rendition_settle_time = g_value_get_uint64 (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_PARALLEL_CONTEXTS:
+      decode->parallel_contexts = g_value_get_uint (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_BUFFER_LISTS:
+      GST_VAAPI_PLUGIN_BASE (object)->batch_output =
+          g_value_get_boolean (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_JOB_PRIORITY:
+      GST_VAAPI_PLUGIN_BASE (object)->job_priority = g_value_get_enum (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_PRIORITY:
+      GST_VAAPI_PLUGIN_BASE (object)->priority = g_value_get_enum (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_FAST_START:
+      decode->fast_start = g_value_get_boolean (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_STATS_INTERVAL:
+      GST_VAAPI_PLUGIN_BASE (object)->stats_interval = g_value_get_uint (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_DMABUF_IMPORT:
+      decode->dmabuf_import = g_value_get_boolean (value);
+      break;
+    case GST_VAAPI_DECODE_PROP_STARVATION_RECOVERY:
+      decode->starvation_recovery = g_value_get_uint (value);
+      if (decode->decoder)
+        gst_vaapi_decoder_set_starvation_recovery (decode->decoder,
+            decode->starvation_recovery);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapidecode_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiDecode *const decode = GST_VAAPIDECODE (object);
+
+  switch (prop_id) {
+    case GST_VAAPI_DECODE_PROP_THREADED:
+      g_value_set_boolean (value, decode->threaded);
+      break;
+    case GST_VAAPI_DECODE_PROP_SKIP_MODE:
+      g_value_set_enum (value, decode->skip_mode);
+      break;
+    case GST_VAAPI_DECODE_PROP_RENDITION_SWITCH:
+      g_value_set_boolean (value, decode->rendition_switch);
+      break;
+    case GST_VAAPI_DECODE_PROP_MAX_WIDTH:
+      g_value_set_uint (value, decode->max_width);
+      break;
+    case GST_VAAPI_DECODE_PROP_MAX_HEIGHT:
+      g_value_set_uint (value, decode->max_height);
+      break;
+    case GST_VAAPI_DECODE_PROP_RENDITION_SETTLE_TIME:
+      g_value_set_uint64 (value, decode->rendition_settle_time);
+      break;
+    case GST_VAAPI_DECODE_PROP_PARALLEL_CONTEXTS:
+      g_value_set_uint (value, decode->parallel_contexts);
+      break;
+    case GST_VAAPI_DECODE_PROP_BUFFER_LISTS:
+      g_value_set_boolean (value, GST_VAAPI_PLUGIN_BASE (object)->batch_output);
+      break;
+    case GST_VAAPI_DECODE_PROP_JOB_PRIORITY:
+      g_value_set_enum (value, GST_VAAPI_PLUGIN_BASE (object)->job_priority);
+      break;
+    case GST_VAAPI_DECODE_PROP_PRIORITY:
+      g_value_set_enum (value, GST_VAAPI_PLUGIN_BASE (object)->priority);
+      break;
+    case GST_VAAPI_DECODE_PROP_FAST_START:
+      g_value_set_boolean (value, decode->fast_start);
+      break;
+    case GST_VAAPI_DECODE_PROP_STATS:
+      g_value_take_boxed (value,
+          gst_vaapi_plugin_base_get_stats (GST_VAAPI_PLUGIN_BASE (object)));
+      break;
+    case GST_VAAPI_DECODE_PROP_STATS_INTERVAL:
+      g_value_set_uint (value, GST_VAAPI_PLUGIN_BASE (object)->stats_interval);
+      break;
+    case GST_VAAPI_DECODE_PROP_STARVATION_RECOVERY:
+      g_value_set_uint (value, decode->starvation_recovery);
+      break;
+    case GST_VAAPI_DECODE_PROP_DMABUF_IMPORT:
+      g_value_set_boolean (value, decode->dmabuf_import);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Adds the usage of the decoded surfaces to the "vaapi-stats" */
+static void
+gst_vaapidecode_append_stats (GstVaapiPluginBase * plugin,
+    GstStructure * structure)
+{
+  GstVaapiDecode *const decode = GST_VAAPIDECODE (plugin);
+  GstVaapiDecoderSurfaceStats stats;
+  GstVaapiDecoder *decoder;
+
+  decoder = decode->decoder ? gst_object_ref (decode->decoder) : NULL;
+  if (!decoder)
+    return;
+
+  gst_vaapi_decoder_get_surface_stats (decoder, &stats);
+  gst_object_unref (decoder);
+
+  gst_structure_set (structure,
+      "surfaces-outstanding", G_TYPE_UINT, stats.num_in_use,
+      "surfaces-oldest-age", G_TYPE_UINT64, (guint64) stats.oldest_age,
+      "surfaces-oldest-holder", G_TYPE_STRING,
+      stats.oldest_holder ? stats.oldest_holder : GST_OBJECT_NAME (decode),
+      "surface-starvations", G_TYPE_UINT, stats.num_starvations,
+      "surface-recoveries", G_TYPE_UINT, stats.num_recoveries, NULL);
+}
+
 static void
 gst_vaapidecode_finalize (GObject * object)
 {
+  GstVaapiDecode *const decode = GST_VAAPIDECODE (object);
+
+  gst_vaapidecode_release_import_pool (decode);
+  g_mutex_lock (&g_imports_lock);
+  g_clear_pointer (&decode->imports, g_hash_table_unref);
+  g_mutex_unlock (&g_imports_lock);
+
   gst_vaapi_plugin_base_finalize (GST_VAAPI_PLUGIN_BASE (object));
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
@@ -1117,6 +1839,7 @@ gst_vaapidecode_stop (GstVideoDecoder * vdec)
   gst_vaapidecode_purge (decode);
   gst_vaapi_decode_input_state_replace (decode, NULL);
   gst_vaapi_decoder_replace (&decode->decoder, NULL);
+  gst_vaapidecode_release_import_pool (decode);
   gst_caps_replace (&decode->sinkpad_caps, NULL);
   gst_caps_replace (&decode->srcpad_caps, NULL);
   return TRUE;
@@ -1132,12 +1855,78 @@ gst_vaapidecode_flush (GstVideoDecoder * vdec)
   GST_LOG_OBJECT (vdec, "flushing");
 
   gst_vaapidecode_purge (decode);
+  decode->qos_late_frames = 0;
 
   /* There could be issues if we avoid the reset() while doing
    * seeking: we have to reset the internal state */
   return gst_vaapidecode_reset (decode, decode->sinkpad_caps, TRUE);
 }
 
+/* Access unit aligned avc and hvc1 streams carry whole, length prefixed,
+   NAL units in each buffer, which are then parsed in place rather than
+   through the GstVideoDecoder adapter */
+static void
+gst_vaapidecode_update_packetized (GstVaapiDecode * decode, GstCaps * caps)
+{
+  GstStructure *const structure = gst_caps_get_structure (caps, 0);
+  const gchar *stream_format;
+  gboolean packetized = FALSE;
+
+  stream_format = gst_structure_get_string (structure, "stream-format");
+  if (g_strcmp0 (stream_format, "avc") == 0
+      || g_strcmp0 (stream_format, "hvc1") == 0) {
+    packetized = gst_structure_has_field (structure, "codec_data")
+        && g_strcmp0 (gst_structure_get_string (structure, "alignment"),
+        "au") == 0;
+  }
+
+  GST_INFO_OBJECT (decode, "%s input", packetized ? "packetized" : "parsed");
+  gst_video_decoder_set_packetized (GST_VIDEO_DECODER (decode), packetized);
+}
+
+/* Downstream elements that only accept another size, and possibly
+   another format, get the pictures scaled and converted by the decode
+   pipeline itself. If the driver cannot do so, the decoded surfaces
+   are output as is, for the downstream video processing to convert */
+static void
+gst_vaapidecode_update_output_processing (GstVaapiDecode * decode,
+    GstVideoCodecState * state)
+{
+  GstPad *const srcpad = GST_VIDEO_DECODER_SRC_PAD (decode);
+  GstVideoFormat format = GST_VIDEO_FORMAT_UNKNOWN;
+  GstStructure *structure;
+  const gchar *format_str;
+  GstCaps *peer_caps;
+  gint width = 0, height = 0;
+
+  if (!GST_VIDEO_INFO_WIDTH (&state->info)
+      || !GST_VIDEO_INFO_HEIGHT (&state->info))
+    return;
+
+  peer_caps = gst_pad_peer_query_caps (srcpad, NULL);
+  if (!peer_caps)
+    return;
+  if (!gst_caps_is_empty (peer_caps) && !gst_caps_is_any (peer_caps)) {
+    structure = gst_caps_get_structure (peer_caps, 0);
+    if (!gst_structure_get_int (structure, "width", &width)
+        || !gst_structure_get_int (structure, "height", &height)
+        || (width == GST_VIDEO_INFO_WIDTH (&state->info)
+            && height == GST_VIDEO_INFO_HEIGHT (&state->info)))
+      width = height = 0;
+    format_str = gst_structure_get_string (structure, "format");
+    if (width && format_str)
+      format = gst_video_format_from_string (format_str);
+  }
+  gst_caps_unref (peer_caps);
+
+  if (width && height) {
+    GST_INFO_OBJECT (decode, "requesting %s %dx%d output from the decoder",
+        gst_video_format_to_string (format), width, height);
+  }
+  gst_vaapi_decoder_set_output_processing (decode->decoder, format, width,
+      height);
+}
+
 static gboolean
 gst_vaapidecode_set_format (GstVideoDecoder * vdec, GstVideoCodecState * state)
 {
@@ -1154,6 +1943,8 @@ gst_vaapidecode_set_format (GstVideoDecoder * vdec, GstVideoCodecState * state)
     return FALSE;
   if (!gst_vaapidecode_reset (decode, decode->sinkpad_caps, FALSE))
     return FALSE;
+  gst_vaapidecode_update_packetized (decode, decode->sinkpad_caps);
+  gst_vaapidecode_update_output_processing (decode, state);
 
   return TRUE;
 }
@@ -1387,6 +2178,7 @@ static GstCaps *
 gst_vaapidecode_sink_getcaps (GstVideoDecoder * vdec, GstCaps * filter)
 {
   GstVaapiDecode *const decode = GST_VAAPIDECODE (vdec);
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (decode);
   GstCaps *result;
 
   if (decode->allowed_sinkpad_caps)
@@ -1402,8 +2194,17 @@ gst_vaapidecode_sink_getcaps (GstVideoDecoder * vdec, GstCaps * filter)
     return gst_caps_new_empty ();
 
 bail:
+  /* the template caps fallback isn't worth caching */
+  if (!decode->allowed_sinkpad_caps)
+    return gst_video_decoder_proxy_getcaps (vdec, NULL, filter);
+
+  result = gst_vaapi_plugin_base_lookup_caps (plugin, GST_PAD_SINK, filter);
+  if (result)
+    return result;
+
   result = gst_video_decoder_proxy_getcaps (vdec, decode->allowed_sinkpad_caps,
       filter);
+  gst_vaapi_plugin_base_store_caps (plugin, GST_PAD_SINK, filter, result);
 
   GST_DEBUG_OBJECT (decode, "Returning sink caps %" GST_PTR_FORMAT, result);
 
@@ -1505,8 +2306,12 @@ gst_vaapidecode_class_init (GstVaapiDecodeClass * klass)
   parent_class = g_type_class_peek_parent (klass);
 
   gst_vaapi_plugin_base_class_init (GST_VAAPI_PLUGIN_BASE_CLASS (klass));
+  GST_VAAPI_PLUGIN_BASE_CLASS (klass)->append_stats =
+      gst_vaapidecode_append_stats;
 
   object_class->finalize = gst_vaapidecode_finalize;
+  object_class->set_property = gst_vaapidecode_set_property;
+  object_class->get_property = gst_vaapidecode_get_property;
 
   vdec_class->open = GST_DEBUG_FUNCPTR (gst_vaapidecode_open);
   vdec_class->close = GST_DEBUG_FUNCPTR (gst_vaapidecode_close);
@@ -1550,6 +2355,216 @@ gst_vaapidecode_class_init (GstVaapiDecodeClass * klass)
   g_free (longname);
   g_free (description);
 
+  /**
+   * GstVaapiDecode:threaded-decode:
+   *
+   * When enabled, the slice parameters are built and submitted to
+   * the hardware from a dedicated thread, so the parsing of the next
+   * frame in the streaming thread overlaps with the decoding of the
+   * current one.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_THREADED,
+      g_param_spec_boolean ("threaded-decode", "Threaded decode",
+          "Submit frames to the hardware from a separate thread", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:job-priority:
+   *
+   * How the decoding jobs are scheduled against the other streams
+   * sharing the VA display. Live decoders run in the order of the
+   * running time of their frames, ahead of any batch job.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_JOB_PRIORITY,
+      g_param_spec_enum ("job-priority", "Job priority",
+          "Scheduling priority of the hardware jobs",
+          GST_VAAPI_TYPE_JOB_PRIORITY, GST_VAAPI_JOB_PRIORITY_BATCH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiDecode:priority:
+   *
+   * The priority the GPU scheduler gives to the decoding jobs, over
+   * the ones of every other process, on drivers with context
+   * priorities. By default, live decoders get the high priority and
+   * the others keep the one of the driver.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_PRIORITY,
+      g_param_spec_enum ("priority", "Priority",
+          "GPU scheduling priority of the VA contexts",
+          GST_VAAPI_TYPE_PRIORITY, GST_VAAPI_PRIORITY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiDecode:skip-mode:
+   *
+   * Which frames to drop before they reach the hardware, e.g. for
+   * scrubbing or thumbnail generation. Seeks with the key units or
+   * forward predicted trick mode flags skip at least as many frames.
+   * Only the H.264 and H.265 decoders skip frames.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_SKIP_MODE,
+      g_param_spec_enum ("skip-mode", "Skip mode",
+          "Frames not to decode", GST_VAAPI_TYPE_DECODER_SKIP_MODE,
+          GST_VAAPI_DECODER_SKIP_NONE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiDecode:rendition-switch:
+   *
+   * For adaptive streaming: keep the VA context and its surfaces when
+   * the stream switches to a rendition that fits in them, instead of
+   * re-allocating everything. Smaller pictures are output cropped.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_RENDITION_SWITCH,
+      g_param_spec_boolean ("rendition-switch", "Rendition switch",
+          "Keep the decoding surfaces across resolution changes", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:max-width:
+   *
+   * The width of the largest rendition expected in rendition switch
+   * mode. The surfaces are allocated at least that wide. 0 means the
+   * stream width.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_MAX_WIDTH,
+      g_param_spec_uint ("max-width", "Maximum width",
+          "Width to allocate the surfaces for in rendition switch mode",
+          0, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:max-height:
+   *
+   * The height of the largest rendition expected in rendition switch
+   * mode. The surfaces are allocated at least that high. 0 means the
+   * stream height.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_MAX_HEIGHT,
+      g_param_spec_uint ("max-height", "Maximum height",
+          "Height to allocate the surfaces for in rendition switch mode",
+          0, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:rendition-settle-time:
+   *
+   * How long, in nanoseconds, the surfaces kept in rendition switch
+   * mode may stay larger than the pictures. Past that time, the next
+   * switch down re-allocates them at the picture size, so a stream
+   * that settled at a low rendition releases the memory. -1 keeps
+   * them until the stream grows out of them.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_RENDITION_SETTLE_TIME,
+      g_param_spec_uint64 ("rendition-settle-time", "Rendition settle time",
+          "Time before shrinking the surfaces kept in rendition switch mode "
+          "(in ns, -1 = never)", 0, G_MAXUINT64, 60 * GST_SECOND,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:parallel-contexts:
+   *
+   * The number of VA contexts to spread the pictures of intra-only
+   * H.264 and H.265 streams over, so that the driver can decode
+   * several of them at once. Other streams are decoded on a single
+   * VA context.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_PARALLEL_CONTEXTS,
+      g_param_spec_uint ("parallel-contexts", "Parallel contexts",
+          "Number of VA contexts to decode intra-only streams on",
+          1, 8, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:buffer-lists:
+   *
+   * Whether to push all the frames decoded from an input buffer as a
+   * single #GstBufferList, rather than one buffer at a time. This
+   * saves the per-buffer overhead of the elements downstream for high
+   * frame rates of small pictures.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_BUFFER_LISTS,
+      g_param_spec_boolean ("buffer-lists", "Buffer lists",
+          "Push the decoded frames as buffer lists", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiDecode:stats:
+   *
+   * The live performance counters of the element, see also
+   * GstVaapiDecode:stats-interval to have them posted on the bus.
+   */
+  gst_vaapi_plugin_base_class_install_stats_properties (object_class,
+      GST_VAAPI_DECODE_PROP_STATS, GST_VAAPI_DECODE_PROP_STATS_INTERVAL);
+
+  /**
+   * GstVaapiDecode:starvation-recovery:
+   *
+   * The number of decoded surfaces that may be allocated beyond the
+   * usual ones when downstream elements hold on to all of them,
+   * rather than failing to decode. They are released once enough
+   * surfaces are returned. The "surfaces-oldest-holder" field of the
+   * GstVaapiDecode:stats tells which element holds surfaces the
+   * longest.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_STARVATION_RECOVERY,
+      g_param_spec_uint ("starvation-recovery", "Starvation recovery",
+          "Number of surfaces to allocate when none is available "
+          "(0: disabled)", 0, 64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiDecode:dmabuf-import:
+   *
+   * When dma-buf memory is negotiated and downstream proposes its own
+   * buffer pool, e.g. of scanout or GL/Vulkan owned buffers, decode
+   * the pictures straight into those buffers, imported as VA surfaces,
+   * rather than exporting our own surfaces. Pictures are decoded into
+   * our own surfaces whenever no downstream buffer is free, or does
+   * not fit the coded picture size.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_DMABUF_IMPORT,
+      g_param_spec_boolean ("dmabuf-import", "DMA-BUF import",
+          "Decode into the dma-buf buffers of the downstream pool", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiDecode:fast-start:
+   *
+   * When a stream, e.g. after a channel change, does not start with a
+   * key unit, ask upstream for one right away instead of waiting for
+   * the next key frame of the stream. A vaapigopcache element in
+   * front of the channel switch answers with the GOP it holds, marked
+   * decode-only: its reference pictures are decoded without being
+   * shown, its other pictures are skipped, and the output starts at
+   * the live edge.
+   */
+  g_object_class_install_property (object_class,
+      GST_VAAPI_DECODE_PROP_FAST_START,
+      g_param_spec_boolean ("fast-start", "Fast start",
+          "Request a key unit when the stream does not start with one",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   if (map->install_properties)
     map->install_properties (object_class);
 
@@ -1572,6 +2587,9 @@ gst_vaapidecode_init (GstVaapiDecode * decode)
 
   gst_vaapi_plugin_base_init (GST_VAAPI_PLUGIN_BASE (decode), GST_CAT_DEFAULT);
 
+  decode->parallel_contexts = 1;
+  decode->rendition_settle_time = 60 * GST_SECOND;
+
   gst_video_decoder_set_packetized (vdec, FALSE);
 }
 
@@ -54,6 +54,29 @@ struct _GstVaapiDecode {
     GstVideoCodecState *input_state;
 
     gboolean            do_renego;
+    gboolean            threaded;
+    GstVaapiDecoderSkipMode skip_mode;
+    guint               qos_late_frames;
+    gboolean            rendition_switch;
+    guint               max_width;
+    guint               max_height;
+    guint64             rendition_settle_time;
+    guint               parallel_contexts;
+    guint               starvation_recovery;
+
+    /* ask upstream for a key unit, e.g. the GOP replayed by
+       vaapigopcache, when the stream does not start with one */
+    gboolean            fast_start;
+    gboolean            needs_key_unit;
+
+    /* downstream dma-buf pool decoded into, see import_surface_proxy() */
+    gboolean            dmabuf_import;
+    /* downstream asked for these metas on the DMA buffers we export */
+    gboolean            export_fence;
+    gboolean            export_drm_meta;
+    GstBufferPool      *import_pool;
+    GstVideoInfo        import_info;
+    GHashTable         *imports;
 };
 
 struct _GstVaapiDecodeClass {
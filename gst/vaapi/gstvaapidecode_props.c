@@ -25,14 +25,30 @@
 #include "gstvaapidecode.h"
 
 #include <gst/vaapi/gstvaapidecoder_h264.h>
+#include <gst/vaapi/gstvaapidecoder_h265.h>
+#include <gst/vaapi/gstvaapidecoder_jpeg.h>
 
 enum
 {
-  GST_VAAPI_DECODER_H264_PROP_FORCE_LOW_LATENCY = 1,
+  GST_VAAPI_DECODER_H264_PROP_FORCE_LOW_LATENCY = GST_VAAPI_DECODE_PROP_LAST,
   GST_VAAPI_DECODER_H264_PROP_BASE_ONLY,
+  GST_VAAPI_DECODER_H264_PROP_ERROR_CONCEALMENT,
+};
+
+enum
+{
+  GST_VAAPI_DECODER_H265_PROP_FORCE_LOW_LATENCY = GST_VAAPI_DECODE_PROP_LAST,
+  GST_VAAPI_DECODER_H265_PROP_ERROR_CONCEALMENT,
+};
+
+enum
+{
+  GST_VAAPI_DECODER_JPEG_PROP_NUM_CONTEXTS = GST_VAAPI_DECODE_PROP_LAST,
 };
 
 static gint h264_private_offset;
+static GObjectGetPropertyFunc h264_parent_get_property;
+static GObjectSetPropertyFunc h264_parent_set_property;
 
 static void
 gst_vaapi_decode_h264_get_property (GObject * object, guint prop_id,
@@ -49,8 +65,11 @@ gst_vaapi_decode_h264_get_property (GObject * object, guint prop_id,
     case GST_VAAPI_DECODER_H264_PROP_BASE_ONLY:
       g_value_set_boolean (value, priv->base_only);
       break;
+    case GST_VAAPI_DECODER_H264_PROP_ERROR_CONCEALMENT:
+      g_value_set_boolean (value, priv->conceal_errors);
+      break;
     default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      h264_parent_get_property (object, prop_id, value, pspec);
       break;
   }
 }
@@ -77,8 +96,15 @@ gst_vaapi_decode_h264_set_property (GObject * object, guint prop_id,
       if (decoder)
         gst_vaapi_decoder_h264_set_base_only (decoder, priv->base_only);
       break;
+    case GST_VAAPI_DECODER_H264_PROP_ERROR_CONCEALMENT:
+      priv->conceal_errors = g_value_get_boolean (value);
+      decoder = GST_VAAPI_DECODER_H264 (GST_VAAPIDECODE (object)->decoder);
+      if (decoder)
+        gst_vaapi_decoder_h264_set_error_concealment (decoder,
+            priv->conceal_errors);
+      break;
     default:
-      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      h264_parent_set_property (object, prop_id, value, pspec);
       break;
   }
 }
@@ -89,6 +115,9 @@ gst_vaapi_decode_h264_install_properties (GObjectClass * klass)
   h264_private_offset = sizeof (GstVaapiDecodeH264Private);
   g_type_class_adjust_private_offset (klass, &h264_private_offset);
 
+  /* chain up to the generic decoder properties */
+  h264_parent_get_property = klass->get_property;
+  h264_parent_set_property = klass->set_property;
   klass->get_property = gst_vaapi_decode_h264_get_property;
   klass->set_property = gst_vaapi_decode_h264_set_property;
 
@@ -103,6 +132,13 @@ gst_vaapi_decode_h264_install_properties (GObjectClass * klass)
       g_param_spec_boolean ("base-only", "Decode base view only",
           "Drop any NAL unit not defined in Annex.A", FALSE,
           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (klass,
+      GST_VAAPI_DECODER_H264_PROP_ERROR_CONCEALMENT,
+      g_param_spec_boolean ("error-concealment", "Conceal errors",
+          "Substitute lost reference pictures with the nearest available "
+          "one instead of dropping the frames using them", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 GstVaapiDecodeH264Private *
@@ -112,3 +148,165 @@ gst_vaapi_decode_h264_get_instance_private (gpointer self)
     return NULL;
   return (G_STRUCT_MEMBER_P (self, h264_private_offset));
 }
+
+static gint h265_private_offset;
+static GObjectGetPropertyFunc h265_parent_get_property;
+static GObjectSetPropertyFunc h265_parent_set_property;
+
+static void
+gst_vaapi_decode_h265_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiDecodeH265Private *priv;
+
+  priv = gst_vaapi_decode_h265_get_instance_private (object);
+
+  switch (prop_id) {
+    case GST_VAAPI_DECODER_H265_PROP_FORCE_LOW_LATENCY:
+      g_value_set_boolean (value, priv->is_low_latency);
+      break;
+    case GST_VAAPI_DECODER_H265_PROP_ERROR_CONCEALMENT:
+      g_value_set_boolean (value, priv->conceal_errors);
+      break;
+    default:
+      h265_parent_get_property (object, prop_id, value, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_decode_h265_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiDecodeH265Private *priv;
+  GstVaapiDecoderH265 *decoder;
+
+  priv = gst_vaapi_decode_h265_get_instance_private (object);
+
+  switch (prop_id) {
+    case GST_VAAPI_DECODER_H265_PROP_FORCE_LOW_LATENCY:
+      priv->is_low_latency = g_value_get_boolean (value);
+      decoder = GST_VAAPI_DECODER_H265 (GST_VAAPIDECODE (object)->decoder);
+      if (decoder)
+        gst_vaapi_decoder_h265_set_low_latency (decoder, priv->is_low_latency);
+      break;
+    case GST_VAAPI_DECODER_H265_PROP_ERROR_CONCEALMENT:
+      priv->conceal_errors = g_value_get_boolean (value);
+      decoder = GST_VAAPI_DECODER_H265 (GST_VAAPIDECODE (object)->decoder);
+      if (decoder)
+        gst_vaapi_decoder_h265_set_error_concealment (decoder,
+            priv->conceal_errors);
+      break;
+    default:
+      h265_parent_set_property (object, prop_id, value, pspec);
+      break;
+  }
+}
+
+void
+gst_vaapi_decode_h265_install_properties (GObjectClass * klass)
+{
+  h265_private_offset = sizeof (GstVaapiDecodeH265Private);
+  g_type_class_adjust_private_offset (klass, &h265_private_offset);
+
+  /* chain up to the generic decoder properties */
+  h265_parent_get_property = klass->get_property;
+  h265_parent_set_property = klass->set_property;
+  klass->get_property = gst_vaapi_decode_h265_get_property;
+  klass->set_property = gst_vaapi_decode_h265_set_property;
+
+  g_object_class_install_property (klass,
+      GST_VAAPI_DECODER_H265_PROP_FORCE_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Force low latency mode",
+          "When enabled, frames will be pushed as soon as their display "
+          "order allows it, without waiting for the DPB to fill up", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT));
+
+  g_object_class_install_property (klass,
+      GST_VAAPI_DECODER_H265_PROP_ERROR_CONCEALMENT,
+      g_param_spec_boolean ("error-concealment", "Conceal errors",
+          "Substitute lost reference pictures with the nearest available "
+          "one instead of leaving them out of the reference lists", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+GstVaapiDecodeH265Private *
+gst_vaapi_decode_h265_get_instance_private (gpointer self)
+{
+  if (h265_private_offset == 0)
+    return NULL;
+  return (G_STRUCT_MEMBER_P (self, h265_private_offset));
+}
+
+static gint jpeg_private_offset;
+static GObjectGetPropertyFunc jpeg_parent_get_property;
+static GObjectSetPropertyFunc jpeg_parent_set_property;
+
+static void
+gst_vaapi_decode_jpeg_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiDecodeJpegPrivate *priv;
+
+  priv = gst_vaapi_decode_jpeg_get_instance_private (object);
+
+  switch (prop_id) {
+    case GST_VAAPI_DECODER_JPEG_PROP_NUM_CONTEXTS:
+      g_value_set_uint (value, priv->num_contexts);
+      break;
+    default:
+      jpeg_parent_get_property (object, prop_id, value, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_decode_jpeg_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiDecodeJpegPrivate *priv;
+  GstVaapiDecoderJpeg *decoder;
+
+  priv = gst_vaapi_decode_jpeg_get_instance_private (object);
+
+  switch (prop_id) {
+    case GST_VAAPI_DECODER_JPEG_PROP_NUM_CONTEXTS:
+      priv->num_contexts = g_value_get_uint (value);
+      decoder = GST_VAAPI_DECODER_JPEG (GST_VAAPIDECODE (object)->decoder);
+      if (decoder)
+        gst_vaapi_decoder_jpeg_set_num_contexts (decoder, priv->num_contexts);
+      break;
+    default:
+      jpeg_parent_set_property (object, prop_id, value, pspec);
+      break;
+  }
+}
+
+void
+gst_vaapi_decode_jpeg_install_properties (GObjectClass * klass)
+{
+  jpeg_private_offset = sizeof (GstVaapiDecodeJpegPrivate);
+  g_type_class_adjust_private_offset (klass, &jpeg_private_offset);
+
+  /* chain up to the generic decoder properties */
+  jpeg_parent_get_property = klass->get_property;
+  jpeg_parent_set_property = klass->set_property;
+  klass->get_property = gst_vaapi_decode_jpeg_get_property;
+  klass->set_property = gst_vaapi_decode_jpeg_set_property;
+
+  g_object_class_install_property (klass,
+      GST_VAAPI_DECODER_JPEG_PROP_NUM_CONTEXTS,
+      g_param_spec_uint ("num-contexts", "Number of VA contexts",
+          "Number of VA contexts consecutive pictures are decoded with, "
+          "in turn, so that the hardware can decode several at once",
+          1, 8, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT));
+}
+
+GstVaapiDecodeJpegPrivate *
+gst_vaapi_decode_jpeg_get_instance_private (gpointer self)
+{
+  if (jpeg_private_offset == 0)
+    return NULL;
+  return (G_STRUCT_MEMBER_P (self, jpeg_private_offset));
+}
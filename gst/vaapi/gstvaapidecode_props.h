@@ -28,12 +28,36 @@
 
 G_BEGIN_DECLS
 
+/* Properties common to all decoders. Codec specific properties shall
+   be numbered from GST_VAAPI_DECODE_PROP_LAST */
+enum
+{
+  GST_VAAPI_DECODE_PROP_THREADED = 1,
+  GST_VAAPI_DECODE_PROP_JOB_PRIORITY,
+  GST_VAAPI_DECODE_PROP_SKIP_MODE,
+  GST_VAAPI_DECODE_PROP_RENDITION_SWITCH,
+  GST_VAAPI_DECODE_PROP_MAX_WIDTH,
+  GST_VAAPI_DECODE_PROP_MAX_HEIGHT,
+  GST_VAAPI_DECODE_PROP_RENDITION_SETTLE_TIME,
+  GST_VAAPI_DECODE_PROP_PARALLEL_CONTEXTS,
+  GST_VAAPI_DECODE_PROP_BUFFER_LISTS,
+  GST_VAAPI_DECODE_PROP_STATS,
+  GST_VAAPI_DECODE_PROP_STATS_INTERVAL,
+  GST_VAAPI_DECODE_PROP_STARVATION_RECOVERY,
+  GST_VAAPI_DECODE_PROP_DMABUF_IMPORT,
+  GST_VAAPI_DECODE_PROP_PRIORITY,
+  GST_VAAPI_DECODE_PROP_FAST_START,
+
+  GST_VAAPI_DECODE_PROP_LAST
+};
+
 typedef struct _GstVaapiDecodeH264Private GstVaapiDecodeH264Private;
 
 struct _GstVaapiDecodeH264Private
 {
   gboolean is_low_latency;
   gboolean base_only;
+  gboolean conceal_errors;
 };
 
 void
@@ -42,6 +66,33 @@ gst_vaapi_decode_h264_install_properties (GObjectClass * klass);
 GstVaapiDecodeH264Private *
 gst_vaapi_decode_h264_get_instance_private (gpointer self);
 
+typedef struct _GstVaapiDecodeH265Private GstVaapiDecodeH265Private;
+
+struct _GstVaapiDecodeH265Private
+{
+  gboolean is_low_latency;
+  gboolean conceal_errors;
+};
+
+void
+gst_vaapi_decode_h265_install_properties (GObjectClass * klass);
+
+GstVaapiDecodeH265Private *
+gst_vaapi_decode_h265_get_instance_private (gpointer self);
+
+typedef struct _GstVaapiDecodeJpegPrivate GstVaapiDecodeJpegPrivate;
+
+struct _GstVaapiDecodeJpegPrivate
+{
+  guint num_contexts;
+};
+
+void
+gst_vaapi_decode_jpeg_install_properties (GObjectClass * klass);
+
+GstVaapiDecodeJpegPrivate *
+gst_vaapi_decode_jpeg_get_instance_private (gpointer self);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_DECODE_PROPS_H */
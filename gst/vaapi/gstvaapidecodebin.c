@@ -30,6 +30,11 @@
  * the unregistered vaapidecode, a #GstQueue, and the
  * #GstVaapiPostproc, if it is available and functional in the setup.
  *
+ * The queue and the postprocessor are only linked in once the decoder
+ * negotiates caps that need processing, i.e. interlaced frames or a
+ * format or size downstream does not accept. Otherwise the decoder
+ * output is exposed directly, without the extra thread and latency.
+ *
  * It offers the functionality of GstVaapiDecoder and the many options
  * of #GstVaapiPostproc.
  *
@@ -144,18 +149,22 @@ gst_vaapi_decode_bin_set_property (GObject * object,
   switch (prop_id) {
     case PROP_MAX_SIZE_BYTES:
       vaapidecbin->max_size_bytes = g_value_get_uint (value);
-      g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-bytes",
-          vaapidecbin->max_size_bytes, NULL);
+      if (vaapidecbin->queue)
+        g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-bytes",
+            vaapidecbin->max_size_bytes, NULL);
       break;
     case PROP_MAX_SIZE_BUFFERS:
       vaapidecbin->max_size_buffers = g_value_get_uint (value);
-      g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-buffers",
-          vaapidecbin->max_size_buffers, NULL);
+      vaapidecbin->max_size_buffers_set = TRUE;
+      if (vaapidecbin->queue)
+        g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-buffers",
+            vaapidecbin->max_size_buffers, NULL);
       break;
     case PROP_MAX_SIZE_TIME:
       vaapidecbin->max_size_time = g_value_get_uint64 (value);
-      g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-time",
-          vaapidecbin->max_size_time, NULL);
+      if (vaapidecbin->queue)
+        g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-time",
+            vaapidecbin->max_size_time, NULL);
       break;
     case PROP_DEINTERLACE_METHOD:
       vaapidecbin->deinterlace_method = g_value_get_enum (value);
@@ -254,6 +263,13 @@ gst_vaapi_decode_bin_class_init (GstVaapiDecodeBinClass * klass)
       "Max. size (kB)", "Max. amount of data in the queue (bytes, 0=disable)",
       0, G_MAXUINT, DEFAULT_QUEUE_MAX_SIZE_BYTES,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  /**
+   * GstVaapiDecodeBin:max-size-buffers:
+   *
+   * Maximal number of buffers in the internal queue. Unless set, the
+   * queue holds as many frames as the postprocessor keeps, and the
+   * decoder allocates one more surface for each of them.
+   */
   properties[PROP_MAX_SIZE_BUFFERS] = g_param_spec_uint ("max-size-buffers",
       "Max. size (buffers)", "Max. number of buffers in the queue (0=disable)",
       0, G_MAXUINT, DEFAULT_QUEUE_MAX_SIZE_BUFFERS,
@@ -283,36 +299,81 @@ gst_vaapi_decode_bin_class_init (GstVaapiDecodeBinClass * klass)
       GST_PLUGIN_NAME, 0, GST_PLUGIN_DESC);
 }
 
+/* Checks whether the decoder output described by @caps has to go
+   through the postprocessor before it reaches downstream */
 static gboolean
-gst_vaapi_decode_bin_configure (GstVaapiDecodeBin * vaapidecbin)
+gst_vaapi_decode_bin_needs_vpp (GstVaapiDecodeBin * vaapidecbin, GstPad * pad,
+    GstCaps * caps)
 {
-  GstElement *capsfilter;
-  GstCaps *caps;
-  GstPad *queue_srcpad, *bin_srcpad, *capsfilter_sinkpad, *vpp_srcpad;
-  gboolean res;
-  gboolean has_vpp;
+  GstStructure *const structure = gst_caps_get_structure (caps, 0);
+  const gchar *interlace_mode;
 
-  g_object_set (G_OBJECT (vaapidecbin->queue),
-      "max-size-bytes", vaapidecbin->max_size_bytes,
-      "max-size-buffers", vaapidecbin->max_size_buffers,
-      "max-size-time", vaapidecbin->max_size_time, NULL);
+  interlace_mode = gst_structure_get_string (structure, "interlace-mode");
+  if (interlace_mode && g_strcmp0 (interlace_mode, "progressive") != 0) {
+    GST_INFO_OBJECT (vaapidecbin, "decoder outputs %s frames", interlace_mode);
+    return TRUE;
+  }
 
-  if (vaapidecbin->disable_vpp || vaapidecbin->configured)
+  if (!gst_pad_peer_query_accept_caps (pad, caps)) {
+    GST_INFO_OBJECT (vaapidecbin, "downstream rejects %" GST_PTR_FORMAT, caps);
     return TRUE;
+  }
+  return FALSE;
+}
 
-  has_vpp = _gst_vaapi_has_video_processing;
+/* Makes the decoder reserve one surface for each buffer the queue
+   holds, on top of the ones kept by the postprocessor */
+static void
+gst_vaapi_decode_bin_update_allocation (GstVaapiDecodeBin * vaapidecbin,
+    GstQuery * query)
+{
+  GstBufferPool *pool = NULL;
+  guint size = 0, min = 0, max = 0, depth;
 
-  if (!has_vpp && (vaapidecbin->deinterlace_method ==
-          GST_VAAPI_DEINTERLACE_METHOD_MOTION_ADAPTIVE
-          || vaapidecbin->deinterlace_method ==
-          GST_VAAPI_DEINTERLACE_METHOD_MOTION_COMPENSATED)) {
-    GST_ERROR_OBJECT (vaapidecbin,
-        "Don't have VPP support but advanced deinterlacing selected");
-    return FALSE;
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+
+  depth = vaapidecbin->max_size_buffers;
+  if (!vaapidecbin->max_size_buffers_set) {
+    depth = MAX (min, DEFAULT_QUEUE_MAX_SIZE_BUFFERS);
+    g_object_set (G_OBJECT (vaapidecbin->queue), "max-size-buffers", depth,
+        NULL);
   }
+  GST_DEBUG_OBJECT (vaapidecbin, "queue holds up to %u frames", depth);
+
+  min += depth;
+  if (max > 0 && max < min)
+    max = min;
+  if (gst_query_get_n_allocation_pools (query) > 0)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, NULL, 0, min, 0);
+
+  if (pool)
+    gst_object_unref (pool);
+}
+
+/* Links the queue and the postprocessor between the decoder and the
+   source ghost pad */
+static gboolean
+gst_vaapi_decode_bin_insert_vpp (GstVaapiDecodeBin * vaapidecbin)
+{
+  GstElement *capsfilter;
+  GstCaps *caps;
+  GstPad *bin_srcpad, *vpp_srcpad;
+  gboolean res;
 
   GST_INFO_OBJECT (vaapidecbin, "enabling VPP");
 
+  /* create the queue */
+  vaapidecbin->queue = gst_element_factory_make ("queue", "vaapi-queue");
+  if (!vaapidecbin->queue)
+    goto error_queue_missing;
+  g_object_set (G_OBJECT (vaapidecbin->queue),
+      "max-size-bytes", vaapidecbin->max_size_bytes,
+      "max-size-buffers", vaapidecbin->max_size_buffers,
+      "max-size-time", vaapidecbin->max_size_time, NULL);
+
   /* capsfilter to force memory:VASurface */
   caps = gst_caps_from_string ("video/x-raw(memory:VASurface)");
   if (!caps)
@@ -328,12 +389,15 @@ gst_vaapi_decode_bin_configure (GstVaapiDecodeBin * vaapidecbin)
   g_object_set (G_OBJECT (vaapidecbin->postproc), "deinterlace-method",
       vaapidecbin->deinterlace_method, NULL);
 
-  gst_bin_add_many (GST_BIN (vaapidecbin), capsfilter, vaapidecbin->postproc,
-      NULL);
+  gst_bin_add_many (GST_BIN (vaapidecbin), vaapidecbin->queue, capsfilter,
+      vaapidecbin->postproc, NULL);
 
-  if (!gst_element_link (capsfilter, vaapidecbin->postproc))
+  if (!gst_element_link_many (vaapidecbin->queue, capsfilter,
+          vaapidecbin->postproc, NULL))
     goto error_sync_state;
 
+  if (!gst_element_sync_state_with_parent (vaapidecbin->queue))
+    goto error_sync_state;
   if (!gst_element_sync_state_with_parent (capsfilter))
     goto error_sync_state;
   if (!gst_element_sync_state_with_parent (vaapidecbin->postproc))
@@ -345,13 +409,8 @@ gst_vaapi_decode_bin_configure (GstVaapiDecodeBin * vaapidecbin)
   if (!gst_ghost_pad_set_target (GST_GHOST_PAD_CAST (bin_srcpad), NULL))
     goto error_link_pad;
 
-  /* link decoder and queue */
-  queue_srcpad = gst_element_get_static_pad (vaapidecbin->queue, "src");
-  capsfilter_sinkpad = gst_element_get_static_pad (capsfilter, "sink");
-  res = (gst_pad_link (queue_srcpad, capsfilter_sinkpad) == GST_PAD_LINK_OK);
-  gst_object_unref (capsfilter_sinkpad);
-  gst_object_unref (queue_srcpad);
-  if (!res)
+  /* link now decoder and queue */
+  if (!gst_element_link (vaapidecbin->decoder, vaapidecbin->queue))
     goto error_link_pad;
 
   /* set vpp source pad as source ghost pad target */
@@ -367,6 +426,11 @@ gst_vaapi_decode_bin_configure (GstVaapiDecodeBin * vaapidecbin)
   return TRUE;
 
   /* ERRORS */
+error_queue_missing:
+  {
+    post_missing_element_message (vaapidecbin, "queue");
+    return FALSE;
+  }
 error_cannot_set_caps:
   {
     GST_ELEMENT_ERROR (vaapidecbin, CORE, PAD,
@@ -393,6 +457,68 @@ error_link_pad:
   }
 }
 
+static GstPadProbeReturn
+gst_vaapi_decode_bin_decoder_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GstVaapiDecodeBin *const vaapidecbin = GST_VAAPI_DECODE_BIN (user_data);
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM) {
+    GstQuery *const query = GST_PAD_PROBE_INFO_QUERY (info);
+
+    /* once the postproc answered the allocation query */
+    if (vaapidecbin->configured
+        && GST_QUERY_TYPE (query) == GST_QUERY_ALLOCATION
+        && (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_PULL))
+      gst_vaapi_decode_bin_update_allocation (vaapidecbin, query);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_CAPS
+      && !vaapidecbin->configured) {
+    GstCaps *caps;
+
+    gst_event_parse_caps (GST_PAD_PROBE_INFO_EVENT (info), &caps);
+    if (!gst_vaapi_decode_bin_needs_vpp (vaapidecbin, pad, caps))
+      return GST_PAD_PROBE_OK;
+    if (!gst_vaapi_decode_bin_insert_vpp (vaapidecbin))
+      return GST_PAD_PROBE_OK;
+
+    /* The decoder renegotiates against the postproc, i.e. with
+       VASurface memory, before pushing the next frame */
+    gst_pad_mark_reconfigure (pad);
+    return GST_PAD_PROBE_DROP;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+gst_vaapi_decode_bin_configure (GstVaapiDecodeBin * vaapidecbin)
+{
+  GstPad *pad;
+
+  if (vaapidecbin->disable_vpp || vaapidecbin->configured)
+    return TRUE;
+
+  if (!_gst_vaapi_has_video_processing && (vaapidecbin->deinterlace_method ==
+          GST_VAAPI_DEINTERLACE_METHOD_MOTION_ADAPTIVE
+          || vaapidecbin->deinterlace_method ==
+          GST_VAAPI_DEINTERLACE_METHOD_MOTION_COMPENSATED)) {
+    GST_ERROR_OBJECT (vaapidecbin,
+        "Don't have VPP support but advanced deinterlacing selected");
+    return FALSE;
+  }
+
+  /* Decide on the negotiated caps whether the postproc is needed */
+  pad = gst_element_get_static_pad (vaapidecbin->decoder, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM, gst_vaapi_decode_bin_decoder_probe,
+      vaapidecbin, NULL);
+  gst_object_unref (pad);
+
+  return TRUE;
+}
+
 static void
 gst_vaapi_decode_bin_init (GstVaapiDecodeBin * vaapidecbin)
 {
@@ -408,23 +534,7 @@ gst_vaapi_decode_bin_init (GstVaapiDecodeBin * vaapidecbin)
       g_object_new (g_type_from_name ("GstVaapiDecode"), NULL);
   g_assert (vaapidecbin->decoder);
 
-  /* create the queue */
-  vaapidecbin->queue = gst_element_factory_make ("queue", "vaapi-queue");
-  if (!vaapidecbin->queue) {
-    g_clear_object (&vaapidecbin->decoder);
-    post_missing_element_message (vaapidecbin, "queue");
-    return;
-  }
-
-  gst_bin_add_many (GST_BIN (vaapidecbin), vaapidecbin->decoder,
-      vaapidecbin->queue, NULL);
-
-  if (!gst_element_link (vaapidecbin->decoder, vaapidecbin->queue)) {
-    g_clear_object (&vaapidecbin->decoder);
-    g_clear_object (&vaapidecbin->queue);
-    g_critical ("failed to link decoder and queue");
-    return;
-  }
+  gst_bin_add (GST_BIN (vaapidecbin), vaapidecbin->decoder);
 
   /* create ghost pad sink */
   pad = gst_element_get_static_pad (vaapidecbin->decoder, "sink");
@@ -434,11 +544,12 @@ gst_vaapi_decode_bin_init (GstVaapiDecodeBin * vaapidecbin)
   if (!gst_element_add_pad (GST_ELEMENT (vaapidecbin), ghostpad))
     g_critical ("failed to add decoder sink pad to bin");
 
-  /* create ghost pad src */
-  pad = gst_element_get_static_pad (GST_ELEMENT (vaapidecbin->queue), "src");
+  /* create ghost pad src, targeting the decoder until the postproc
+     is needed */
+  pad = gst_element_get_static_pad (vaapidecbin->decoder, "src");
   ghostpad = gst_ghost_pad_new_from_template ("src", pad,
       GST_PAD_PAD_TEMPLATE (pad));
   gst_object_unref (pad);
   if (!gst_element_add_pad (GST_ELEMENT (vaapidecbin), ghostpad))
-    g_critical ("failed to add queue source pad to bin");
+    g_critical ("failed to add decoder source pad to bin");
 }
@@ -48,12 +48,14 @@ typedef struct _GstVaapiDecodeBin {
   GstElement *postproc;
 
   /* properties */
+  gboolean max_size_buffers_set;
   guint   max_size_buffers;
   guint   max_size_bytes;
   guint64 max_size_time;
   GstVaapiDeinterlaceMethod deinterlace_method;
   gboolean disable_vpp;
 
+  /* the queue and the postproc are only linked in when needed */
   gboolean configured;
 } GstVaapiDecodeBin;
 
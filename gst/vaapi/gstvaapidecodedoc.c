@@ -225,3 +225,24 @@
  * gst-launch-1.0 filesrc location=./sample.vp9.webm ! ivfparse ! vaapivp9dec ! vaapisink
  * ]|
  */
+
+/**
+ * SECTION:element-vaapiav1dec
+ * @short_description: A VA-API based AV1 video decoder
+ *
+ * vaapiav1dec decodes from AV1 bitstreams to surfaces suitable
+ * for the vaapisink or vaapipostproc elements using the installed
+ * [VA-API](https://wiki.freedesktop.org/www/Software/vaapi/) back-end.
+ *
+ * Film grain is synthesized by the driver into the output surfaces,
+ * the references used for prediction are kept without grain.
+ *
+ * Also it can deliver normal video buffers that can be rendered or
+ * processed by other elements, but the performance would be rather
+ * bad.
+ *
+ * ## Example launch line
+ * |[
+ * gst-launch-1.0 filesrc location=./sample.av1.webm ! matroskademux ! av1parse ! vaapiav1dec ! vaapisink
+ * ]|
+ */
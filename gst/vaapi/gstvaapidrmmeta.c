@@ -0,0 +1,132 @@
+/*
+ *  gstvaapidrmmeta.c - DRM layout of exported DMA buffers
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "gstcompat.h"
+#include "gstvaapidrmmeta.h"
+#include <gst/vaapi/gstvaapibufferproxy.h>
+#include <gst/vaapi/gstvaapisurface_drm.h>
+#include <string.h>
+
+static gboolean
+gst_vaapi_drm_meta_init (GstVaapiDrmMeta * meta, gpointer params,
+    GstBuffer * buffer)
+{
+  meta->modifier = GST_VAAPI_DRM_FORMAT_MOD_INVALID;
+  meta->n_planes = 0;
+  return TRUE;
+}
+
+/* The layout only holds for the whole DMA buffer */
+static gboolean
+gst_vaapi_drm_meta_transform (GstBuffer * dst_buffer, GstMeta * meta,
+    GstBuffer * src_buffer, GQuark type, gpointer data)
+{
+  GstVaapiDrmMeta *const src_meta = (GstVaapiDrmMeta *) meta;
+  GstMetaTransformCopy *const copy = data;
+  GstVaapiDrmMeta *dst_meta;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type) || copy->region)
+    return FALSE;
+
+  dst_meta = (GstVaapiDrmMeta *) gst_buffer_add_meta (dst_buffer,
+      meta->info, NULL);
+  if (!dst_meta)
+    return FALSE;
+
+  dst_meta->modifier = src_meta->modifier;
+  dst_meta->n_planes = src_meta->n_planes;
+  memcpy (dst_meta->offset, src_meta->offset, sizeof (dst_meta->offset));
+  memcpy (dst_meta->stride, src_meta->stride, sizeof (dst_meta->stride));
+  return TRUE;
+}
+
+GType
+gst_vaapi_drm_meta_api_get_type (void)
+{
+  static gsize g_type;
+  static const gchar *tags[] = { "memory", "video", NULL };
+
+  if (g_once_init_enter (&g_type)) {
+    GType type = gst_meta_api_type_register ("GstVaapiDrmMetaAPI", tags);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
+#define GST_VAAPI_DRM_META_INFO gst_vaapi_drm_meta_info_get ()
+static const GstMetaInfo *
+gst_vaapi_drm_meta_info_get (void)
+{
+  static gsize g_meta_info;
+
+  if (g_once_init_enter (&g_meta_info)) {
+    gsize meta_info =
+        GPOINTER_TO_SIZE (gst_meta_register (GST_VAAPI_DRM_META_API_TYPE,
+            "GstVaapiDrmMeta", sizeof (GstVaapiDrmMeta),
+            (GstMetaInitFunction) gst_vaapi_drm_meta_init,
+            (GstMetaFreeFunction) NULL,
+            (GstMetaTransformFunction) gst_vaapi_drm_meta_transform));
+    g_once_init_leave (&g_meta_info, meta_info);
+  }
+  return GSIZE_TO_POINTER (g_meta_info);
+}
+
+/**
+ * gst_buffer_add_vaapi_drm_meta:
+ * @buffer: a #GstBuffer holding the DMA buffer of @surface
+ * @surface: the exported #GstVaapiSurface
+ *
+ * Attaches the DRM layout @surface was exported with to @buffer.
+ * Nothing is attached when the driver did not report a modifier, in
+ * which case the buffer can only be imported with the implicit one.
+ *
+ * Returns: the #GstVaapiDrmMeta, or %NULL
+ */
+GstVaapiDrmMeta *
+gst_buffer_add_vaapi_drm_meta (GstBuffer * buffer, GstVaapiSurface * surface)
+{
+  GstVaapiBufferProxy *dmabuf_proxy;
+  GstVaapiDrmMeta *meta;
+  guint i, n_planes;
+  guint64 modifier;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (surface != NULL, NULL);
+
+  dmabuf_proxy = gst_vaapi_surface_peek_dma_buf_handle (surface);
+  if (!dmabuf_proxy)
+    return NULL;
+
+  modifier = gst_vaapi_buffer_proxy_get_modifier (dmabuf_proxy);
+  n_planes = gst_vaapi_buffer_proxy_get_num_planes (dmabuf_proxy);
+  if (modifier == GST_VAAPI_DRM_FORMAT_MOD_INVALID || n_planes == 0)
+    return NULL;
+
+  meta = (GstVaapiDrmMeta *) gst_buffer_add_meta (buffer,
+      GST_VAAPI_DRM_META_INFO, NULL);
+  if (!meta)
+    return NULL;
+
+  meta->modifier = modifier;
+  meta->n_planes = MIN (n_planes, GST_VIDEO_MAX_PLANES);
+  for (i = 0; i < meta->n_planes; i++)
+    gst_vaapi_buffer_proxy_get_plane (dmabuf_proxy, i, &meta->offset[i],
+        &meta->stride[i]);
+  return meta;
+}
@@ -0,0 +1,69 @@
+/*
+ *  gstvaapidrmmeta.h - DRM layout of exported DMA buffers
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_DRM_META_H
+#define GST_VAAPI_DRM_META_H
+
+#include <gst/video/video.h>
+#include <gst/vaapi/gstvaapisurface.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstVaapiDrmMeta GstVaapiDrmMeta;
+
+/**
+ * GstVaapiDrmMeta:
+ * @modifier: the DRM format modifier of the DMA buffer
+ * @n_planes: the number of planes, one per video plane
+ * @offset: the offset of each plane in the DMA buffer, in bytes
+ * @stride: the stride of each plane, in bytes
+ *
+ * Describes the layout of a VA surface exported as a single DMA
+ * buffer, as needed to import it with an explicit modifier, e.g.
+ * through VkImageDrmFormatModifierExplicitCreateInfoEXT or
+ * EGL_EXT_image_dma_buf_import_modifiers. Downstream asks for it by
+ * adding the meta API to the allocation query.
+ */
+struct _GstVaapiDrmMeta
+{
+  GstMeta meta;
+  guint64 modifier;
+  guint n_planes;
+  gsize offset[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+};
+
+#define GST_VAAPI_DRM_META_API_TYPE \
+  gst_vaapi_drm_meta_api_get_type ()
+
+#define gst_buffer_get_vaapi_drm_meta(buffer) \
+  ((GstVaapiDrmMeta *) gst_buffer_get_meta ((buffer), \
+      GST_VAAPI_DRM_META_API_TYPE))
+
+G_GNUC_INTERNAL
+GType
+gst_vaapi_drm_meta_api_get_type (void) G_GNUC_CONST;
+
+G_GNUC_INTERNAL
+GstVaapiDrmMeta *
+gst_buffer_add_vaapi_drm_meta (GstBuffer * buffer, GstVaapiSurface * surface);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_DRM_META_H */
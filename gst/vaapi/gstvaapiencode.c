@@ -25,6 +25,7 @@
 #include <gst/vaapi/gstvaapivalue.h>
 #include <gst/vaapi/gstvaapidisplay.h>
 #include <gst/vaapi/gstvaapiprofilecaps.h>
+#include <gst/vaapi/gstvaapitrace.h>
 #include "gstvaapiencode.h"
 #include "gstvaapipluginutil.h"
 #include "gstvaapivideometa.h"
@@ -54,6 +55,22 @@ GST_VAAPI_PLUGIN_BASE_DEFINE_SET_CONTEXT (gst_vaapiencode_parent_class);
 enum
 {
   PROP_0,
+  PROP_SURFACE_PREWARM,
+  PROP_SURFACE_TRIM_PERIOD,
+  PROP_ZERO_COPY_OUTPUT,
+  PROP_SUBFRAME_OUTPUT,
+  PROP_EXPORT_STATS,
+  PROP_JOB_PRIORITY,
+  PROP_MAX_DUPLICATE_DROPS,
+  PROP_MAX_QUEUE_LATENCY,
+  PROP_NUMA_NODE,
+  PROP_THREAD_POLICY,
+  PROP_THREAD_PRIORITY,
+  PROP_BUFFER_LISTS,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_ADAPTIVE_QUALITY,
+  PROP_PRIORITY,
 
   PROP_BASE,
 };
@@ -165,6 +182,41 @@ prop_value_lookup_entry (GPtrArray * prop_values, guint prop_id)
   return NULL;
 }
 
+/* Maximum number of wrapped coded buffers held downstream at once. The
+   encoder coded buffer pool is small, so anything beyond that is copied
+   to make sure the encoder never stalls waiting for a free one */
+#define MAX_WRAPPED_CODED_BUFFERS 2
+
+/* Called once the last memory of a wrapped buffer is released, i.e.
+   when the coded buffer really returns to the encoder */
+static void
+wrapped_buffer_released (GstVaapiEncode * encode)
+{
+  g_atomic_int_add (&encode->wrapped_codedbufs, -1);
+  gst_object_unref (encode);
+}
+
+static GstBuffer *
+wrap_coded_buffer (GstVaapiEncode * encode)
+{
+  GstBuffer *buf;
+
+  if (!encode->zero_copy_output || !encode->out_codedbuf_proxy)
+    return NULL;
+  if (g_atomic_int_get (&encode->wrapped_codedbufs) >=
+      MAX_WRAPPED_CODED_BUFFERS)
+    return NULL;
+
+  g_atomic_int_inc (&encode->wrapped_codedbufs);
+  buf = gst_vaapi_coded_buffer_proxy_wrap_buffer (encode->out_codedbuf_proxy,
+      (GDestroyNotify) wrapped_buffer_released, gst_object_ref (encode));
+  if (!buf) {
+    wrapped_buffer_released (encode);
+    return NULL;
+  }
+  return buf;
+}
+
 static GstFlowReturn
 gst_vaapiencode_default_alloc_buffer (GstVaapiEncode * encode,
     GstVaapiCodedBuffer * coded_buf, GstBuffer ** outbuf_ptr)
@@ -175,6 +227,12 @@ gst_vaapiencode_default_alloc_buffer (GstVaapiEncode * encode,
   g_return_val_if_fail (coded_buf != NULL, GST_FLOW_ERROR);
   g_return_val_if_fail (outbuf_ptr != NULL, GST_FLOW_ERROR);
 
+  buf = wrap_coded_buffer (encode);
+  if (buf) {
+    *outbuf_ptr = buf;
+    return GST_FLOW_OK;
+  }
+
   buf_size = gst_vaapi_coded_buffer_get_size (coded_buf);
   if (buf_size <= 0)
     goto error_invalid_buffer;
@@ -209,6 +267,84 @@ error_copy_buffer:
   }
 }
 
+/* Subframes are only meaningful for byte-stream formats, where every
+   segment holds complete NAL units */
+static gboolean
+is_byte_stream_output (GstVaapiEncode * encode)
+{
+  GstStructure *structure;
+  const gchar *stream_format;
+
+  if (!encode->output_state || !encode->output_state->caps)
+    return FALSE;
+
+  structure = gst_caps_get_structure (encode->output_state->caps, 0);
+  stream_format = gst_structure_get_string (structure, "stream-format");
+  return g_strcmp0 (stream_format, "byte-stream") == 0;
+}
+
+/* Pushes all coded segments of @frame but the last one as subframes,
+   and returns the last one into @outbuf_ptr */
+static GstFlowReturn
+push_coded_segments (GstVaapiEncode * encode, GstVideoCodecFrame * frame,
+    GstVaapiCodedBuffer * coded_buf, GstBuffer ** outbuf_ptr)
+{
+  GstVideoEncoder *const venc = GST_VIDEO_ENCODER_CAST (encode);
+  GstBuffer *buf, *pending = NULL;
+  GstFlowReturn ret;
+  gssize size;
+  guint i;
+
+  for (i = 0; (size = gst_vaapi_coded_buffer_get_segment_size (coded_buf,
+              i)) >= 0; i++) {
+    if (size == 0)
+      continue;
+
+    buf = gst_video_encoder_allocate_output_buffer (venc, size);
+    if (!buf)
+      goto error_create_buffer;
+    if (!gst_vaapi_coded_buffer_copy_segment_into (buf, coded_buf, i)) {
+      gst_buffer_unref (buf);
+      goto error_copy_buffer;
+    }
+
+    if (pending) {
+      frame->output_buffer = pending;
+      ret = gst_video_encoder_finish_subframe (venc, frame);
+      if (ret != GST_FLOW_OK) {
+        gst_buffer_unref (buf);
+        return ret;
+      }
+    }
+    pending = buf;
+  }
+
+  if (!pending)
+    goto error_invalid_buffer;
+  *outbuf_ptr = pending;
+  return GST_FLOW_OK;
+
+  /* ERRORS */
+error_invalid_buffer:
+  {
+    GST_ERROR ("empty GstVaapiCodedBuffer");
+    return GST_VAAPI_ENCODE_FLOW_MEM_ERROR;
+  }
+error_create_buffer:
+  {
+    GST_ERROR ("failed to create output buffer of size %" G_GSSIZE_FORMAT,
+        size);
+    gst_buffer_replace (&pending, NULL);
+    return GST_VAAPI_ENCODE_FLOW_MEM_ERROR;
+  }
+error_copy_buffer:
+  {
+    GST_ERROR ("failed to copy GstVaapiCodedBuffer segment %u", i);
+    gst_buffer_replace (&pending, NULL);
+    return GST_VAAPI_ENCODE_FLOW_MEM_ERROR;
+  }
+}
+
 static gboolean
 ensure_output_state (GstVaapiEncode * encode)
 {
@@ -243,6 +379,85 @@ ensure_output_state (GstVaapiEncode * encode)
   return TRUE;
 }
 
+/* Returns the size in bytes a frame would get at the target bitrate,
+   or 0 if there is no such target */
+static guint
+get_target_frame_size (GstVaapiEncode * encode)
+{
+  const GstVideoInfo *vip;
+  guint bitrate = 0;
+
+  if (!encode->input_state)
+    return 0;
+  vip = &encode->input_state->info;
+  if (GST_VIDEO_INFO_FPS_N (vip) <= 0 || GST_VIDEO_INFO_FPS_D (vip) <= 0)
+    return 0;
+
+  /* The bitrate is in kbps */
+  g_object_get (encode->encoder, "bitrate", &bitrate, NULL);
+  return gst_util_uint64_scale (bitrate, 1000 * GST_VIDEO_INFO_FPS_D (vip),
+      8 * GST_VIDEO_INFO_FPS_N (vip));
+}
+
+/* Posts the statistics the driver reported for @frame as an element
+   message */
+static void
+post_frame_stats (GstVaapiEncode * encode, GstVideoCodecFrame * frame,
+    GstVaapiCodedBuffer * buf)
+{
+  GstVaapiCodedBufferStats stats;
+  GstStructure *structure;
+
+  if (!gst_vaapi_coded_buffer_get_stats (buf, &stats)) {
+    GST_WARNING_OBJECT (encode, "failed to read back encoding statistics");
+    return;
+  }
+
+  structure = gst_structure_new ("GstVaapiEncodeStats",
+      "system-frame-number", G_TYPE_UINT, frame->system_frame_number,
+      "pts", G_TYPE_UINT64, frame->pts,
+      "keyframe", G_TYPE_BOOLEAN, GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame),
+      "size", G_TYPE_UINT, stats.size,
+      "target-size", G_TYPE_UINT, get_target_frame_size (encode),
+      "num-segments", G_TYPE_UINT, stats.num_segments,
+      "average-qp", G_TYPE_UINT, stats.average_qp,
+      "slice-overflow", G_TYPE_BOOLEAN,
+      (stats.status & GST_VAAPI_CODED_BUFFER_STATUS_SLICE_OVERFLOW) != 0,
+      "bitrate-overflow", G_TYPE_BOOLEAN,
+      (stats.status & GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_OVERFLOW) != 0,
+      "bitrate-high", G_TYPE_BOOLEAN,
+      (stats.status & GST_VAAPI_CODED_BUFFER_STATUS_BITRATE_HIGH) != 0,
+      "frame-size-overflow", G_TYPE_BOOLEAN,
+      (stats.status & GST_VAAPI_CODED_BUFFER_STATUS_FRAME_SIZE_OVERFLOW) != 0,
+      NULL);
+
+  gst_element_post_message (GST_ELEMENT_CAST (encode),
+      gst_message_new_element (GST_OBJECT_CAST (encode), structure));
+}
+
+/* Finishes the frame the rate control dropped, without output */
+static GstFlowReturn
+drop_encoded_frame (GstVaapiEncode * encode,
+    GstVaapiCodedBufferProxy * codedbuf_proxy)
+{
+  GstVideoCodecFrame *out_frame;
+
+  out_frame = gst_vaapi_coded_buffer_proxy_get_user_data (codedbuf_proxy);
+  if (out_frame) {
+    gst_video_codec_frame_ref (out_frame);
+    gst_video_codec_frame_set_user_data (out_frame, NULL, NULL);
+  }
+  gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
+  if (!out_frame)
+    return GST_FLOW_ERROR;
+
+  GST_LOG_OBJECT (encode, "frame %u dropped by the rate control",
+      out_frame->system_frame_number);
+  gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (encode));
+  return gst_video_encoder_finish_frame (GST_VIDEO_ENCODER_CAST (encode),
+      out_frame);
+}
+
 static GstFlowReturn
 gst_vaapiencode_push_frame (GstVaapiEncode * encode, gint64 timeout)
 {
@@ -253,11 +468,14 @@ gst_vaapiencode_push_frame (GstVaapiEncode * encode, gint64 timeout)
   GstVaapiEncoderStatus status;
   GstBuffer *out_buffer;
   GstFlowReturn ret;
+  GstClockTime trace_start;
 
   status = gst_vaapi_encoder_get_buffer_with_timeout (encode->encoder,
       &codedbuf_proxy, timeout);
   if (status == GST_VAAPI_ENCODER_STATUS_NO_BUFFER)
     return GST_VAAPI_ENCODE_FLOW_TIMEOUT;
+  if (status == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED)
+    return drop_encoded_frame (encode, codedbuf_proxy);
   if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
     goto error_get_buffer;
 
@@ -273,10 +491,23 @@ gst_vaapiencode_push_frame (GstVaapiEncode * encode, gint64 timeout)
     goto error_output_state;
   GST_VIDEO_ENCODER_STREAM_UNLOCK (encode);
 
-  /* Allocate and copy buffer into system memory */
+  if (encode->export_stats)
+    post_frame_stats (encode, out_frame,
+        GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy));
+
+  /* Allocate and copy buffer into system memory, or wrap it */
   out_buffer = NULL;
-  ret = klass->alloc_buffer (encode,
-      GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy), &out_buffer);
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
+  encode->out_codedbuf_proxy = codedbuf_proxy;
+  if (encode->subframe_output && is_byte_stream_output (encode))
+    ret = push_coded_segments (encode, out_frame,
+        GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy), &out_buffer);
+  else
+    ret = klass->alloc_buffer (encode,
+        GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy), &out_buffer);
+  encode->out_codedbuf_proxy = NULL;
+  GST_VAAPI_TRACE_END (trace_start, encode, GST_VAAPI_TRACE_STAGE_MAP_CODED,
+      out_frame->pts);
 
   gst_vaapi_coded_buffer_proxy_replace (&codedbuf_proxy, NULL);
   if (ret != GST_FLOW_OK)
@@ -288,6 +519,7 @@ gst_vaapiencode_push_frame (GstVaapiEncode * encode, gint64 timeout)
   GST_TRACE_OBJECT (encode, "output:%" GST_TIME_FORMAT ", size:%zu",
       GST_TIME_ARGS (out_frame->pts), gst_buffer_get_size (out_buffer));
 
+  gst_vaapi_plugin_base_stats_frame_out (GST_VAAPI_PLUGIN_BASE (encode));
   return gst_video_encoder_finish_frame (venc, out_frame);
 
   /* ERRORS */
@@ -318,10 +550,22 @@ error_output_state:
 static void
 gst_vaapiencode_buffer_loop (GstVaapiEncode * encode)
 {
-  GstFlowReturn ret;
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (encode);
+  GstFlowReturn ret, batch_ret;
   const gint64 timeout = 50000; /* microseconds */
 
+  /* The coded buffers are mapped and copied out from here */
+  gst_vaapi_plugin_base_bind_thread (plugin);
+  gst_vaapi_plugin_base_set_thread_scheduling (plugin);
+
+  gst_vaapi_plugin_base_begin_output_batch (plugin);
   ret = gst_vaapiencode_push_frame (encode, timeout);
+  /* Along with the coded buffers that are ready too */
+  while (plugin->batch_output && ret == GST_FLOW_OK)
+    ret = gst_vaapiencode_push_frame (encode, 1);
+  batch_ret = gst_vaapi_plugin_base_end_output_batch (plugin);
+  if (ret == GST_FLOW_OK || ret == GST_VAAPI_ENCODE_FLOW_TIMEOUT)
+    ret = batch_ret;
   if (ret == GST_FLOW_OK || ret == GST_VAAPI_ENCODE_FLOW_TIMEOUT)
     return;
 
@@ -354,6 +598,54 @@ get_profiles (GstVaapiEncode * encode)
   return profiles;
 }
 
+/* RGB formats, e.g. from screen captures, the encoder input is converted
+   from with the video processing of the display if it cannot take them */
+static const GstVideoFormat csc_formats[] = {
+  GST_VIDEO_FORMAT_BGRx, GST_VIDEO_FORMAT_BGRA,
+  GST_VIDEO_FORMAT_RGBx, GST_VIDEO_FORMAT_RGBA,
+};
+
+static gboolean
+has_format (GArray * formats, GstVideoFormat format)
+{
+  guint i;
+
+  for (i = 0; i < formats->len; i++) {
+    if (g_array_index (formats, GstVideoFormat, i) == format)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/**
+ * gst_vaapiencode_add_csc_formats:
+ * @display: a #GstVaapiDisplay
+ * @formats: (allow-none): a #GArray of #GstVideoFormat
+ *
+ * Appends the input formats that are converted to NV12 before the
+ * encoding to @formats, if @display can do such a video processing.
+ *
+ * Returns: the updated @formats, or a new array if @formats is %NULL
+ **/
+GArray *
+gst_vaapiencode_add_csc_formats (GstVaapiDisplay * display, GArray * formats)
+{
+  guint i;
+
+  if (!gst_vaapi_display_has_video_processing (display))
+    return formats;
+
+  if (!formats) {
+    formats = g_array_sized_new (FALSE, FALSE, sizeof (GstVideoFormat),
+        G_N_ELEMENTS (csc_formats));
+  }
+  for (i = 0; i < G_N_ELEMENTS (csc_formats); i++) {
+    if (!has_format (formats, csc_formats[i]))
+      g_array_append_val (formats, csc_formats[i]);
+  }
+  return formats;
+}
+
 static gboolean
 ensure_allowed_sinkpad_caps (GstVaapiEncode * encode)
 {
@@ -381,6 +673,11 @@ ensure_allowed_sinkpad_caps (GstVaapiEncode * encode)
   if (!formats)
     goto failed_get_attributes;
 
+  g_clear_pointer (&encode->input_formats, g_array_unref);
+  encode->input_formats = g_array_copy (formats);
+  formats = gst_vaapiencode_add_csc_formats (GST_VAAPI_PLUGIN_BASE_DISPLAY
+      (encode), formats);
+
   out_caps = gst_vaapi_build_caps_from_formats (formats, min_width, min_height,
       max_width, max_height, mem_types);
   if (!out_caps)
@@ -425,19 +722,41 @@ static GstCaps *
 gst_vaapiencode_get_caps (GstVideoEncoder * venc, GstCaps * filter)
 {
   GstVaapiEncode *const encode = GST_VAAPIENCODE_CAST (venc);
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (encode);
   GstCaps *result;
 
+  /* the allowed caps need an encoder, until then use the template */
+  if (!encode->encoder)
+    return gst_video_encoder_proxy_getcaps (venc, NULL, filter);
+
+  result = gst_vaapi_plugin_base_lookup_caps (plugin, GST_PAD_SINK, filter);
+  if (result)
+    return result;
+
   ensure_allowed_sinkpad_caps (encode);
   result = gst_video_encoder_proxy_getcaps (venc, encode->allowed_sinkpad_caps,
       filter);
+  gst_vaapi_plugin_base_store_caps (plugin, GST_PAD_SINK, filter, result);
 
   GST_DEBUG_OBJECT (venc, "Negotiated sink caps %" GST_PTR_FORMAT, result);
   return result;
 }
 
+static void
+reset_input_drops (GstVaapiEncode * encode)
+{
+  gst_buffer_replace (&encode->last_input_buffer, NULL);
+  encode->has_last_input_hash = FALSE;
+  encode->num_duplicate_drops = 0;
+  encode->dropping_stale = FALSE;
+  encode->pending_keyframe = FALSE;
+}
+
 static gboolean
 gst_vaapiencode_destroy (GstVaapiEncode * encode)
 {
+  reset_input_drops (encode);
+
   if (encode->input_state) {
     gst_video_codec_state_unref (encode->input_state);
     encode->input_state = NULL;
@@ -449,6 +768,9 @@ gst_vaapiencode_destroy (GstVaapiEncode * encode)
   }
 
   gst_caps_replace (&encode->allowed_sinkpad_caps, NULL);
+  gst_vaapi_plugin_base_clear_caps_cache (GST_VAAPI_PLUGIN_BASE (encode));
+  g_clear_pointer (&encode->input_formats, g_array_unref);
+  gst_vaapi_filter_replace (&encode->csc_filter, NULL);
   gst_vaapi_encoder_replace (&encode->encoder, NULL);
   return TRUE;
 }
@@ -463,14 +785,16 @@ gst_vaapiencode_purge (GstVaapiEncode * encode)
   do {
     status = gst_vaapi_encoder_get_buffer_with_timeout (encode->encoder,
         &codedbuf_proxy, 0);
-    if (status == GST_VAAPI_ENCODER_STATUS_SUCCESS) {
+    if (status == GST_VAAPI_ENCODER_STATUS_SUCCESS
+        || status == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED) {
       out_frame = gst_vaapi_coded_buffer_proxy_get_user_data (codedbuf_proxy);
       if (out_frame)
         gst_video_codec_frame_set_user_data (out_frame, NULL, NULL);
 
       gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
     }
-  } while (status == GST_VAAPI_ENCODER_STATUS_SUCCESS);
+  } while (status == GST_VAAPI_ENCODER_STATUS_SUCCESS
+      || status == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED);
 }
 
 static gboolean
@@ -489,6 +813,11 @@ ensure_encoder (GstVaapiEncode * encode)
   if (!encode->encoder)
     return FALSE;
 
+  /* name after the element so that tracer records are attributable */
+  gst_object_set_name (GST_OBJECT (encode->encoder), GST_ELEMENT_NAME (encode));
+  gst_vaapi_plugin_base_stats_attach (GST_VAAPI_PLUGIN_BASE (encode),
+      encode->encoder);
+
   if (encode->prop_values && encode->prop_values->len) {
     for (i = 0; i < encode->prop_values->len; i++) {
       PropValue *const prop_value = g_ptr_array_index (encode->prop_values, i);
@@ -539,10 +868,52 @@ gst_vaapiencode_close (GstVideoEncoder * venc)
   return TRUE;
 }
 
+/* Sets up the conversion to NV12 of an input format the encoder cannot
+   take as is, or drops it otherwise */
+static gboolean
+ensure_csc_filter (GstVaapiEncode * encode, GstVideoCodecState * state)
+{
+  const GstVideoFormat format = GST_VIDEO_INFO_FORMAT (&state->info);
+
+  ensure_allowed_sinkpad_caps (encode);
+  if (!encode->input_formats || has_format (encode->input_formats, format)) {
+    gst_vaapi_filter_replace (&encode->csc_filter, NULL);
+    return TRUE;
+  }
+
+  if (!encode->csc_filter) {
+    encode->csc_filter =
+        gst_vaapi_filter_new (GST_VAAPI_PLUGIN_BASE_DISPLAY (encode));
+    if (!encode->csc_filter)
+      goto error_create_filter;
+  }
+  if (!gst_vaapi_filter_set_format (encode->csc_filter, GST_VIDEO_FORMAT_NV12))
+    goto error_set_format;
+
+  GST_INFO_OBJECT (encode, "converting %s input to NV12",
+      gst_video_format_to_string (format));
+  return TRUE;
+
+  /* ERRORS */
+error_create_filter:
+  {
+    GST_ERROR_OBJECT (encode, "failed to create the color conversion filter");
+    return FALSE;
+  }
+error_set_format:
+  {
+    GST_ERROR_OBJECT (encode, "failed to convert %s input to NV12",
+        gst_video_format_to_string (format));
+    gst_vaapi_filter_replace (&encode->csc_filter, NULL);
+    return FALSE;
+  }
+}
+
 static gboolean
 set_codec_state (GstVaapiEncode * encode, GstVideoCodecState * state)
 {
   GstVaapiEncodeClass *const klass = GST_VAAPIENCODE_GET_CLASS (encode);
+  GstVideoCodecState csc_state = { 0, };
   GstVaapiEncoderStatus status;
 
   g_return_val_if_fail (encode->encoder, FALSE);
@@ -551,6 +922,21 @@ set_codec_state (GstVaapiEncode * encode, GstVideoCodecState * state)
   if (klass->set_config && !klass->set_config (encode))
     return FALSE;
 
+  /* The encoder only looks at the video info, i.e. of the converted
+     frames in that case */
+  if (encode->csc_filter) {
+    const GstVideoInfo *const vip = &state->info;
+
+    csc_state.ref_count = 1;
+    gst_video_info_set_format (&csc_state.info, GST_VIDEO_FORMAT_NV12,
+        GST_VIDEO_INFO_WIDTH (vip), GST_VIDEO_INFO_HEIGHT (vip));
+    GST_VIDEO_INFO_FPS_N (&csc_state.info) = GST_VIDEO_INFO_FPS_N (vip);
+    GST_VIDEO_INFO_FPS_D (&csc_state.info) = GST_VIDEO_INFO_FPS_D (vip);
+    GST_VIDEO_INFO_PAR_N (&csc_state.info) = GST_VIDEO_INFO_PAR_N (vip);
+    GST_VIDEO_INFO_PAR_D (&csc_state.info) = GST_VIDEO_INFO_PAR_D (vip);
+    state = &csc_state;
+  }
+
   status = gst_vaapi_encoder_set_codec_state (encode->encoder, state);
   if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
     return FALSE;
@@ -580,6 +966,8 @@ gst_vaapiencode_set_format (GstVideoEncoder * venc, GstVideoCodecState * state)
 
   g_return_val_if_fail (state->caps != NULL, FALSE);
 
+  if (!ensure_csc_filter (encode, state))
+    return FALSE;
   if (!set_codec_state (encode, state))
     return FALSE;
 
@@ -590,6 +978,8 @@ gst_vaapiencode_set_format (GstVideoEncoder * venc, GstVideoCodecState * state)
   if (!gst_vaapiencode_drain (encode))
     return FALSE;
 
+  reset_input_drops (encode);
+
   if (encode->input_state)
     gst_video_codec_state_unref (encode->input_state);
   encode->input_state = gst_video_codec_state_ref (state);
@@ -623,6 +1013,230 @@ gst_vaapiencode_set_format (GstVideoEncoder * venc, GstVideoCodecState * state)
   return TRUE;
 }
 
+/* FNV-1a over the visible pixels, taken 64 bits at a time */
+static guint64
+hash_video_frame (const GstVideoFrame * vframe)
+{
+  guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+  guint i, y, x;
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (vframe); i++) {
+    const guint8 *data = GST_VIDEO_FRAME_PLANE_DATA (vframe, i);
+    const guint stride = GST_VIDEO_FRAME_PLANE_STRIDE (vframe, i);
+    const guint width = GST_VIDEO_FRAME_COMP_WIDTH (vframe, i) *
+        GST_VIDEO_FRAME_COMP_PSTRIDE (vframe, i);
+    const guint height = GST_VIDEO_FRAME_COMP_HEIGHT (vframe, i);
+
+    for (y = 0; y < height; y++, data += stride) {
+      guint64 word;
+
+      for (x = 0; x + 8 <= width; x += 8) {
+        memcpy (&word, data + x, 8);
+        hash = (hash ^ word) * G_GUINT64_CONSTANT (0x100000001b3);
+      }
+      for (; x < width; x++)
+        hash = (hash ^ data[x]) * G_GUINT64_CONSTANT (0x100000001b3);
+    }
+  }
+  return hash;
+}
+
+/* Checks whether the input of @frame repeats the one of the last
+ * encoded frame. The same buffer, or the same memories, cannot have
+ * been written to while we hold a reference to them. The contents of
+ * system memory buffers are also compared through a hash, the VA and
+ * DMABuf ones are not read back for that */
+static gboolean
+is_duplicate_frame (GstVaapiEncode * encode, GstVideoCodecFrame * frame)
+{
+  GstBuffer *const buf = frame->input_buffer;
+  GstBuffer *const last_buf = encode->last_input_buffer;
+  GstVideoFrame vframe;
+  GstMemory *mem;
+  gboolean is_duplicate = FALSE;
+  gboolean is_sysmem;
+  guint i, n_mems;
+
+  if (encode->max_duplicate_drops == 0)
+    return FALSE;
+
+  n_mems = gst_buffer_n_memory (buf);
+  if (last_buf && n_mems == gst_buffer_n_memory (last_buf)) {
+    is_duplicate = TRUE;
+    for (i = 0; i < n_mems && is_duplicate; i++) {
+      is_duplicate = gst_buffer_peek_memory (buf, i) ==
+          gst_buffer_peek_memory (last_buf, i);
+    }
+  }
+
+  mem = n_mems > 0 ? gst_buffer_peek_memory (buf, 0) : NULL;
+  is_sysmem = mem && !gst_buffer_get_vaapi_video_meta (buf) &&
+      !gst_is_dmabuf_memory (mem);
+  if (!is_duplicate && is_sysmem && gst_video_frame_map (&vframe,
+          &GST_VAAPI_PLUGIN_BASE_SINK_PAD_INFO (encode), buf, GST_MAP_READ)) {
+    const guint64 hash = hash_video_frame (&vframe);
+
+    gst_video_frame_unmap (&vframe);
+    is_duplicate = encode->has_last_input_hash &&
+        encode->last_input_hash == hash;
+    encode->last_input_hash = hash;
+    encode->has_last_input_hash = TRUE;
+  } else if (!is_duplicate) {
+    encode->has_last_input_hash = FALSE;
+  }
+
+  if (is_duplicate && !GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame) &&
+      encode->num_duplicate_drops < encode->max_duplicate_drops) {
+    encode->num_duplicate_drops++;
+    return TRUE;
+  }
+
+  gst_buffer_replace (&encode->last_input_buffer, buf);
+  encode->last_frame_number = frame->system_frame_number;
+  encode->num_duplicate_drops = 0;
+  return FALSE;
+}
+
+/* Drops @frame, the previous frame lasting until its end instead, if
+   it was not pushed yet */
+static GstFlowReturn
+drop_duplicate_frame (GstVaapiEncode * encode, GstVideoCodecFrame * frame)
+{
+  GstVideoEncoder *const venc = GST_VIDEO_ENCODER_CAST (encode);
+  GstVideoCodecFrame *last_frame;
+
+  last_frame = gst_video_encoder_get_frame (venc, encode->last_frame_number);
+  if (last_frame) {
+    if (GST_CLOCK_TIME_IS_VALID (last_frame->pts)
+        && GST_CLOCK_TIME_IS_VALID (frame->pts)
+        && GST_CLOCK_TIME_IS_VALID (frame->duration)
+        && frame->pts > last_frame->pts)
+      last_frame->duration = frame->pts + frame->duration - last_frame->pts;
+    gst_video_codec_frame_unref (last_frame);
+  }
+
+  GST_LOG_OBJECT (encode, "dropping duplicate frame %u (%u in a row)",
+      frame->system_frame_number, encode->num_duplicate_drops);
+  gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (encode));
+  return gst_video_encoder_finish_frame (venc, frame);
+}
+
+/* Whether @frame arrives later than the latency budget after the
+   oldest frame still queued in the encoder, i.e. in a congestion
+   burst. A frame is let through every budget period anyway, so that
+   frames held for reordering or lookahead are eventually released */
+static gboolean
+is_stale_frame (GstVaapiEncode * encode, GstVideoCodecFrame * frame)
+{
+  GstVideoCodecFrame *oldest;
+  gboolean is_stale = FALSE;
+
+  if (encode->max_queue_latency == 0 || !GST_CLOCK_TIME_IS_VALID (frame->pts))
+    return FALSE;
+
+  oldest = gst_video_encoder_get_oldest_frame (GST_VIDEO_ENCODER_CAST (encode));
+  if (oldest && oldest != frame && GST_CLOCK_TIME_IS_VALID (oldest->pts)
+      && frame->pts > oldest->pts)
+    is_stale = frame->pts - oldest->pts > encode->max_queue_latency;
+  if (oldest)
+    gst_video_codec_frame_unref (oldest);
+
+  if (!is_stale) {
+    encode->dropping_stale = FALSE;
+    return FALSE;
+  }
+  if (!encode->dropping_stale) {
+    encode->dropping_stale = TRUE;
+    encode->first_stale_pts = frame->pts;
+  } else if (frame->pts - encode->first_stale_pts >=
+      encode->max_queue_latency) {
+    GST_WARNING_OBJECT (encode, "no frame left the encoder for %"
+        GST_TIME_FORMAT ", letting frame %u through",
+        GST_TIME_ARGS (encode->max_queue_latency),
+        frame->system_frame_number);
+    encode->first_stale_pts = frame->pts;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Reports the display as overloaded while the frames queue up in the
+   encoder beyond the latency it announced, and trades quality levels
+   for speed according to the load of the display */
+static void
+adapt_quality_to_load (GstVaapiEncode * encode, GstVideoCodecFrame * frame)
+{
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (encode);
+  GstVideoEncoder *const venc = GST_VIDEO_ENCODER_CAST (encode);
+  GstVideoCodecFrame *oldest;
+  GstClockTime min_latency;
+
+  if (!plugin->adaptive_quality)
+    return;
+
+  oldest = gst_video_encoder_get_oldest_frame (venc);
+  if (oldest && oldest != frame && GST_CLOCK_TIME_IS_VALID (oldest->pts)
+      && GST_CLOCK_TIME_IS_VALID (frame->pts)
+      && GST_CLOCK_TIME_IS_VALID (frame->duration)
+      && frame->pts > oldest->pts) {
+    gst_video_encoder_get_latency (venc, &min_latency, NULL);
+    if (!GST_CLOCK_TIME_IS_VALID (min_latency))
+      min_latency = 0;
+    gst_vaapi_plugin_base_report_load (plugin,
+        frame->pts - oldest->pts > min_latency + frame->duration);
+  }
+  if (oldest)
+    gst_video_codec_frame_unref (oldest);
+
+  /* Two quality levels per load level, the encoder clamps them to the
+     range of the driver */
+  gst_vaapi_encoder_set_quality_level_boost (encode->encoder,
+      2 * gst_vaapi_plugin_base_get_load_level (plugin));
+}
+
+/* Drops @frame before it is uploaded. A keyframe requested on it is
+   moved to the next frame submitted to the encoder */
+static GstFlowReturn
+drop_stale_frame (GstVaapiEncode * encode, GstVideoCodecFrame * frame)
+{
+  if (GST_VIDEO_CODEC_FRAME_IS_FORCE_KEYFRAME (frame)) {
+    GST_VIDEO_CODEC_FRAME_UNSET_FORCE_KEYFRAME (frame);
+    encode->pending_keyframe = TRUE;
+  }
+
+  GST_LOG_OBJECT (encode, "dropping frame %u beyond the latency budget",
+      frame->system_frame_number);
+  gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (encode));
+  return gst_video_encoder_finish_frame (GST_VIDEO_ENCODER_CAST (encode),
+      frame);
+}
+
+/* Converts the input surface into a new NV12 surface of the encoder
+   input pool, on the same display */
+static GstVaapiSurfaceProxy *
+convert_surface (GstVaapiEncode * encode, GstVaapiSurfaceProxy * proxy)
+{
+  GstVaapiSurfaceProxy *out_proxy;
+  GstVaapiFilterStatus status;
+
+  out_proxy = gst_vaapi_encoder_create_input_surface (encode->encoder);
+  if (!out_proxy)
+    return NULL;
+
+  gst_vaapi_filter_set_cropping_rectangle (encode->csc_filter,
+      gst_vaapi_surface_proxy_get_crop_rect (proxy));
+  status = gst_vaapi_filter_process (encode->csc_filter,
+      GST_VAAPI_SURFACE_PROXY_SURFACE (proxy),
+      GST_VAAPI_SURFACE_PROXY_SURFACE (out_proxy), 0);
+  if (status != GST_VAAPI_FILTER_STATUS_SUCCESS) {
+    GST_WARNING_OBJECT (encode, "failed to convert surface (status %d)",
+        status);
+    gst_vaapi_surface_proxy_unref (out_proxy);
+    return NULL;
+  }
+  return out_proxy;
+}
+
 static GstFlowReturn
 gst_vaapiencode_handle_frame (GstVideoEncoder * venc,
     GstVideoCodecFrame * frame)
@@ -642,6 +1256,19 @@ gst_vaapiencode_handle_frame (GstVideoEncoder * venc,
             (GstTaskFunction) gst_vaapiencode_buffer_loop, encode, NULL))
       goto error_task_failed;
 
+  gst_vaapi_plugin_base_stats_frame_in (GST_VAAPI_PLUGIN_BASE (encode));
+
+  if (is_stale_frame (encode, frame))
+    return drop_stale_frame (encode, frame);
+
+  if (encode->pending_keyframe) {
+    GST_VIDEO_CODEC_FRAME_SET_FORCE_KEYFRAME (frame);
+    encode->pending_keyframe = FALSE;
+  }
+
+  if (is_duplicate_frame (encode, frame))
+    return drop_duplicate_frame (encode, frame);
+
   buf = NULL;
   ret = gst_vaapi_plugin_base_get_input_buffer (GST_VAAPI_PLUGIN_BASE (encode),
       frame->input_buffer, &buf);
@@ -659,16 +1286,32 @@ gst_vaapiencode_handle_frame (GstVideoEncoder * venc,
   if (!proxy)
     goto error_buffer_no_surface_proxy;
 
-  gst_video_codec_frame_set_user_data (frame,
-      gst_vaapi_surface_proxy_ref (proxy),
+  if (encode->csc_filter) {
+    proxy = convert_surface (encode, proxy);
+    if (!proxy)
+      goto error_convert_surface;
+  } else
+    gst_vaapi_surface_proxy_ref (proxy);
+
+  gst_video_codec_frame_set_user_data (frame, proxy,
       (GDestroyNotify) gst_vaapi_surface_proxy_unref);
 
+  gst_vaapi_encoder_set_job_deadline (encode->encoder,
+      gst_vaapi_plugin_base_get_job_deadline (GST_VAAPI_PLUGIN_BASE (encode),
+          &venc->input_segment, frame->pts));
+  gst_vaapi_encoder_set_priority (encode->encoder,
+      gst_vaapi_plugin_base_get_priority (GST_VAAPI_PLUGIN_BASE (encode)));
+  adapt_quality_to_load (encode, frame);
+
   GST_VIDEO_ENCODER_STREAM_UNLOCK (encode);
   status = gst_vaapi_encoder_put_frame (encode->encoder, frame);
   GST_VIDEO_ENCODER_STREAM_LOCK (encode);
   if (status < GST_VAAPI_ENCODER_STATUS_SUCCESS)
     goto error_encode_frame;
 
+  gst_vaapi_plugin_base_trim_surface_pool (GST_VAAPI_PLUGIN_BASE (encode),
+      FALSE);
+
   gst_video_codec_frame_unref (frame);
   return GST_FLOW_OK;
 
@@ -699,6 +1342,13 @@ error_buffer_no_surface_proxy:
     gst_video_codec_frame_unref (frame);
     return GST_FLOW_ERROR;
   }
+error_convert_surface:
+  {
+    GST_ERROR ("failed to convert frame %d to NV12",
+        frame->system_frame_number);
+    gst_video_codec_frame_unref (frame);
+    return GST_FLOW_ERROR;
+  }
 error_encode_frame:
   {
     GST_ERROR ("failed to encode frame %d (status %d)",
@@ -713,7 +1363,7 @@ gst_vaapiencode_finish (GstVideoEncoder * venc)
 {
   GstVaapiEncode *const encode = GST_VAAPIENCODE_CAST (venc);
   GstVaapiEncoderStatus status;
-  GstFlowReturn ret = GST_FLOW_OK;
+  GstFlowReturn ret = GST_FLOW_OK, batch_ret;
 
   /* Don't try to destroy encoder if none was created in the first place.
      Return "not-negotiated" error since this means we did not even reach
@@ -728,11 +1378,19 @@ gst_vaapiencode_finish (GstVideoEncoder * venc)
   gst_pad_stop_task (GST_VAAPI_PLUGIN_BASE_SRC_PAD (encode));
   GST_VIDEO_ENCODER_STREAM_LOCK (encode);
 
+  gst_vaapi_plugin_base_begin_output_batch (GST_VAAPI_PLUGIN_BASE (encode));
   while (status == GST_VAAPI_ENCODER_STATUS_SUCCESS && ret == GST_FLOW_OK)
     ret = gst_vaapiencode_push_frame (encode, 0);
 
   if (ret == GST_VAAPI_ENCODE_FLOW_TIMEOUT)
     ret = GST_FLOW_OK;
+  batch_ret =
+      gst_vaapi_plugin_base_end_output_batch (GST_VAAPI_PLUGIN_BASE (encode));
+  if (ret == GST_FLOW_OK)
+    ret = batch_ret;
+
+  gst_vaapi_plugin_base_trim_surface_pool (GST_VAAPI_PLUGIN_BASE (encode),
+      TRUE);
   return ret;
 }
 
@@ -762,11 +1420,36 @@ drain_error:
   }
 }
 
+/* Returns the number of input frames the encoder keeps before coding
+   them: B-frames waiting for their reference, lookahead analysis and
+   frames in flight */
+static guint
+gst_vaapiencode_get_held_frames (GstVaapiEncode * encode)
+{
+  guint max_bframes = 0, lookahead = 0, async_depth = 0;
+  GObject *object;
+
+  if (!encode->encoder)
+    return 0;
+  object = G_OBJECT (encode->encoder);
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (object),
+          "max-bframes"))
+    g_object_get (object, "max-bframes", &max_bframes, NULL);
+  g_object_get (object, "lookahead", &lookahead, "async-depth", &async_depth,
+      NULL);
+  return max_bframes + lookahead + async_depth;
+}
+
 static gboolean
 gst_vaapiencode_propose_allocation (GstVideoEncoder * venc, GstQuery * query)
 {
   GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (venc);
 
+  gst_vaapi_plugin_base_set_sink_min_buffers (plugin,
+      gst_vaapiencode_get_held_frames (GST_VAAPIENCODE_CAST (venc)));
+  /* Input surfaces are only read by the encoder and VPP engines */
+  gst_vaapi_plugin_base_set_sink_compression (plugin, TRUE);
   if (!gst_vaapi_plugin_base_propose_allocation (plugin, query))
     return FALSE;
   return TRUE;
@@ -799,6 +1482,36 @@ gst_vaapiencode_sink_event (GstVideoEncoder * venc, GstEvent * event)
   return ret;
 }
 
+/* A receiver that lost data sends a "GstVaapiInvalidateReferences"
+   event upstream. The encoders supporting it then recover from a
+   long-term reference, the others produce a keyframe */
+static gboolean
+gst_vaapiencode_src_event (GstVideoEncoder * venc, GstEvent * event)
+{
+  GstVaapiEncode *const encode = GST_VAAPIENCODE_CAST (venc);
+  GstVaapiEncodeClass *const klass = GST_VAAPIENCODE_GET_CLASS (encode);
+
+  gst_vaapi_plugin_base_report_qos (GST_VAAPI_PLUGIN_BASE (encode), event);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM &&
+      gst_event_has_name (event, "GstVaapiInvalidateReferences")) {
+    if (encode->encoder && klass->invalidate_refs
+        && klass->invalidate_refs (encode)) {
+      GST_DEBUG_OBJECT (encode, "recovering from a long-term reference");
+      gst_event_unref (event);
+      return TRUE;
+    }
+
+    GST_DEBUG_OBJECT (encode, "no long-term reference, forcing a keyframe");
+    gst_event_unref (event);
+    event = gst_video_event_new_upstream_force_key_unit (GST_CLOCK_TIME_NONE,
+        TRUE, 0);
+  }
+
+  return GST_VIDEO_ENCODER_CLASS (gst_vaapiencode_parent_class)->src_event
+      (venc, event);
+}
+
 static gboolean
 gst_vaapiencode_flush (GstVideoEncoder * venc)
 {
@@ -812,6 +1525,8 @@ gst_vaapiencode_flush (GstVideoEncoder * venc)
   if (!gst_vaapiencode_drain (encode))
     return FALSE;
 
+  reset_input_drops (encode);
+
   gst_vaapi_encoder_replace (&encode->encoder, NULL);
   if (!ensure_encoder (encode))
     return FALSE;
@@ -837,6 +1552,133 @@ gst_vaapiencode_finalize (GObject * object)
   G_OBJECT_CLASS (gst_vaapiencode_parent_class)->finalize (object);
 }
 
+static void
+gst_vaapiencode_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (object);
+
+  switch (prop_id) {
+    case PROP_SURFACE_PREWARM:
+      plugin->surface_prewarm = g_value_get_uint (value);
+      break;
+    case PROP_SURFACE_TRIM_PERIOD:
+      plugin->surface_trim_period = g_value_get_uint (value);
+      break;
+    case PROP_ZERO_COPY_OUTPUT:
+      GST_VAAPIENCODE_CAST (object)->zero_copy_output =
+          g_value_get_boolean (value);
+      break;
+    case PROP_SUBFRAME_OUTPUT:
+      GST_VAAPIENCODE_CAST (object)->subframe_output =
+          g_value_get_boolean (value);
+      break;
+    case PROP_EXPORT_STATS:
+      GST_VAAPIENCODE_CAST (object)->export_stats = g_value_get_boolean (value);
+      break;
+    case PROP_JOB_PRIORITY:
+      plugin->job_priority = g_value_get_enum (value);
+      break;
+    case PROP_PRIORITY:
+      plugin->priority = g_value_get_enum (value);
+      break;
+    case PROP_MAX_DUPLICATE_DROPS:
+      GST_VAAPIENCODE_CAST (object)->max_duplicate_drops =
+          g_value_get_uint (value);
+      break;
+    case PROP_MAX_QUEUE_LATENCY:
+      GST_VAAPIENCODE_CAST (object)->max_queue_latency =
+          g_value_get_uint64 (value);
+      break;
+    case PROP_NUMA_NODE:
+      plugin->numa_node = g_value_get_int (value);
+      break;
+    case PROP_THREAD_POLICY:
+      plugin->thread_policy = g_value_get_enum (value);
+      break;
+    case PROP_THREAD_PRIORITY:
+      plugin->thread_priority = g_value_get_int (value);
+      break;
+    case PROP_BUFFER_LISTS:
+      plugin->batch_output = g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      plugin->stats_interval = g_value_get_uint (value);
+      break;
+    case PROP_ADAPTIVE_QUALITY:
+      plugin->adaptive_quality = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapiencode_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (object);
+
+  switch (prop_id) {
+    case PROP_SURFACE_PREWARM:
+      g_value_set_uint (value, plugin->surface_prewarm);
+      break;
+    case PROP_SURFACE_TRIM_PERIOD:
+      g_value_set_uint (value, plugin->surface_trim_period);
+      break;
+    case PROP_ZERO_COPY_OUTPUT:
+      g_value_set_boolean (value,
+          GST_VAAPIENCODE_CAST (object)->zero_copy_output);
+      break;
+    case PROP_SUBFRAME_OUTPUT:
+      g_value_set_boolean (value,
+          GST_VAAPIENCODE_CAST (object)->subframe_output);
+      break;
+    case PROP_EXPORT_STATS:
+      g_value_set_boolean (value, GST_VAAPIENCODE_CAST (object)->export_stats);
+      break;
+    case PROP_JOB_PRIORITY:
+      g_value_set_enum (value, plugin->job_priority);
+      break;
+    case PROP_PRIORITY:
+      g_value_set_enum (value, plugin->priority);
+      break;
+    case PROP_MAX_DUPLICATE_DROPS:
+      g_value_set_uint (value,
+          GST_VAAPIENCODE_CAST (object)->max_duplicate_drops);
+      break;
+    case PROP_MAX_QUEUE_LATENCY:
+      g_value_set_uint64 (value,
+          GST_VAAPIENCODE_CAST (object)->max_queue_latency);
+      break;
+    case PROP_NUMA_NODE:
+      g_value_set_int (value, plugin->numa_node);
+      break;
+    case PROP_THREAD_POLICY:
+      g_value_set_enum (value, plugin->thread_policy);
+      break;
+    case PROP_THREAD_PRIORITY:
+      g_value_set_int (value, plugin->thread_priority);
+      break;
+    case PROP_BUFFER_LISTS:
+      g_value_set_boolean (value, plugin->batch_output);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_vaapi_plugin_base_get_stats (plugin));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, plugin->stats_interval);
+      break;
+    case PROP_ADAPTIVE_QUALITY:
+      g_value_set_boolean (value, plugin->adaptive_quality);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
 static void
 gst_vaapiencode_init (GstVaapiEncode * encode)
 {
@@ -859,6 +1701,8 @@ gst_vaapiencode_class_init (GstVaapiEncodeClass * klass)
   gst_vaapi_plugin_base_class_init (GST_VAAPI_PLUGIN_BASE_CLASS (klass));
 
   object_class->finalize = gst_vaapiencode_finalize;
+  object_class->set_property = gst_vaapiencode_set_property;
+  object_class->get_property = gst_vaapiencode_get_property;
 
   element_class->set_context = gst_vaapi_base_set_context;
   element_class->change_state =
@@ -876,12 +1720,217 @@ gst_vaapiencode_class_init (GstVaapiEncodeClass * klass)
       GST_DEBUG_FUNCPTR (gst_vaapiencode_propose_allocation);
   venc_class->flush = GST_DEBUG_FUNCPTR (gst_vaapiencode_flush);
   venc_class->sink_event = GST_DEBUG_FUNCPTR (gst_vaapiencode_sink_event);
+  venc_class->src_event = GST_DEBUG_FUNCPTR (gst_vaapiencode_src_event);
 
   klass->alloc_buffer = gst_vaapiencode_default_alloc_buffer;
 
   venc_class->src_query = GST_DEBUG_FUNCPTR (gst_vaapiencode_src_query);
   venc_class->sink_query = GST_DEBUG_FUNCPTR (gst_vaapiencode_sink_query);
 
+  /**
+   * GstVaapiEncode:surface-prewarm:
+   *
+   * Number of input surfaces to allocate as soon as the input caps are
+   * known, so that the first frames do not wait for their creation.
+   */
+  g_object_class_install_property (object_class, PROP_SURFACE_PREWARM,
+      g_param_spec_uint ("surface-prewarm", "Surface pre-warm",
+          "Number of input surfaces to pre-allocate at negotiation time",
+          0, 64, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiEncode:surface-trim-period:
+   *
+   * Every this many frames, idle input surfaces beyond the largest
+   * number used over the period (or the pre-warm size, if larger) are
+   * released. On EOS, the pool is shrunk down to the pre-warm size.
+   * Zero disables trimming.
+   */
+  g_object_class_install_property (object_class, PROP_SURFACE_TRIM_PERIOD,
+      g_param_spec_uint ("surface-trim-period", "Surface trim period",
+          "Number of frames between releases of unused input surfaces "
+          "(0 = never)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:zero-copy-output:
+   *
+   * Push the mapped VA coded buffer downstream as is, instead of
+   * copying it into system memory. The coded buffer returns to the
+   * encoder once downstream releases it. Only a couple of such buffers
+   * are kept in flight, the others are still copied.
+   */
+  g_object_class_install_property (object_class, PROP_ZERO_COPY_OUTPUT,
+      g_param_spec_boolean ("zero-copy-output", "Zero-copy output",
+          "Wrap the VA coded buffers into output buffers instead of "
+          "copying them", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:subframe-output:
+   *
+   * Push every coded segment reported by the driver as its own buffer,
+   * through gst_video_encoder_finish_subframe(). With several slices
+   * per picture (num-slices > 1), drivers usually report one segment
+   * per slice. The last buffer of a picture carries the
+   * %GST_VIDEO_BUFFER_FLAG_MARKER flag. Only applies to byte-stream
+   * output, and takes precedence over zero-copy-output.
+   */
+  g_object_class_install_property (object_class, PROP_SUBFRAME_OUTPUT,
+      g_param_spec_boolean ("subframe-output", "Subframe output",
+          "Push each coded slice as a separate partial-frame buffer",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:export-stats:
+   *
+   * Post an element message named "GstVaapiEncodeStats" for every
+   * encoded frame, with the statistics reported by the driver: the
+   * coded size against the per-frame budget of the target bitrate
+   * ("size", "target-size"), the average QP ("average-qp", 0 if the
+   * driver does not report it) and the overflow flags
+   * ("slice-overflow", "bitrate-overflow", "bitrate-high",
+   * "frame-size-overflow"). The frame is identified by
+   * "system-frame-number" and "pts".
+   */
+  g_object_class_install_property (object_class, PROP_EXPORT_STATS,
+      g_param_spec_boolean ("export-stats", "Export statistics",
+          "Post per-frame encoding statistics as element messages",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:job-priority:
+   *
+   * How the encoding jobs are scheduled against the other streams
+   * sharing the VA display. Live encoders run in the order of the
+   * running time of their frames, ahead of any batch job.
+   */
+  g_object_class_install_property (object_class, PROP_JOB_PRIORITY,
+      g_param_spec_enum ("job-priority", "Job priority",
+          "Scheduling priority of the hardware jobs",
+          GST_VAAPI_TYPE_JOB_PRIORITY, GST_VAAPI_JOB_PRIORITY_BATCH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:priority:
+   *
+   * The priority the GPU scheduler gives to the encoding jobs, over
+   * the ones of every other process, on drivers with context
+   * priorities. By default, live encoders get the high priority and
+   * the others keep the one of the driver.
+   */
+  g_object_class_install_property (object_class, PROP_PRIORITY,
+      g_param_spec_enum ("priority", "Priority",
+          "GPU scheduling priority of the VA context",
+          GST_VAAPI_TYPE_PRIORITY, GST_VAAPI_PRIORITY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:max-duplicate-drops:
+   *
+   * The maximum number of consecutive input frames dropped, before
+   * being uploaded and encoded, because they repeat the previous
+   * frame, as static slides or screen captures do. The previous frame
+   * lasts until the end of the dropped ones when it was not pushed
+   * yet. The frames forced to be keyframes are never dropped. Zero
+   * disables the detection.
+   */
+  g_object_class_install_property (object_class, PROP_MAX_DUPLICATE_DROPS,
+      g_param_spec_uint ("max-duplicate-drops", "Max duplicate drops",
+          "Maximum number of consecutive duplicate input frames to drop "
+          "(0: disabled)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:max-queue-latency:
+   *
+   * The latency budget of the frames queued in the encoder, in
+   * nanoseconds. The input frames later than that after the oldest
+   * frame not pushed yet are dropped before being uploaded, rather
+   * than waiting for a free surface, so that live sources do not build
+   * up latency in congestion bursts. A keyframe requested on a dropped
+   * frame applies to the next encoded one. It shall exceed the delay
+   * of the B-frames and lookahead. Zero disables the dropping.
+   */
+  g_object_class_install_property (object_class, PROP_MAX_QUEUE_LATENCY,
+      g_param_spec_uint64 ("max-queue-latency", "Max queue latency",
+          "Latency budget of the queued frames, in ns (0: unbounded)",
+          0, G_MAXUINT64, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:numa-node:
+   *
+   * The NUMA node the source pad task runs on, and where the coded
+   * buffers are copied to. The default of -1 selects the node the
+   * GPU is attached to, if any.
+   */
+  g_object_class_install_property (object_class, PROP_NUMA_NODE,
+      g_param_spec_int ("numa-node", "NUMA node",
+          "NUMA node of the output thread (-1: the node of the GPU)",
+          -1, G_MAXINT, -1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:thread-policy:
+   *
+   * The scheduling policy of the source pad task, which waits for the
+   * coded buffers and pushes them downstream. The real-time policies
+   * keep ordinary load from delaying it once a frame is encoded.
+   */
+  g_object_class_install_property (object_class, PROP_THREAD_POLICY,
+      g_param_spec_enum ("thread-policy", "Thread policy",
+          "Scheduling policy of the output thread",
+          GST_VAAPI_TYPE_THREAD_POLICY, GST_VAAPI_THREAD_POLICY_NORMAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:thread-priority:
+   *
+   * The nice value of the source pad task, from -20 to 19, with the
+   * normal GstVaapiEncode:thread-policy. Its real-time priority, from
+   * 1 to 99, with the other ones.
+   */
+  g_object_class_install_property (object_class, PROP_THREAD_PRIORITY,
+      g_param_spec_int ("thread-priority", "Thread priority",
+          "Nice value, or real-time priority, of the output thread",
+          -20, 99, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:buffer-lists:
+   *
+   * Whether to push all the coded buffers that are ready as a single
+   * #GstBufferList, rather than one buffer at a time. This saves the
+   * per-buffer overhead of the elements downstream for high frame
+   * rates of small pictures.
+   */
+  g_object_class_install_property (object_class, PROP_BUFFER_LISTS,
+      g_param_spec_boolean ("buffer-lists", "Buffer lists",
+          "Push the coded buffers as buffer lists", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiEncode:stats:
+   *
+   * The live performance counters of the element, see also
+   * GstVaapiEncode:stats-interval to have them posted on the bus.
+   */
+  gst_vaapi_plugin_base_class_install_stats_properties (object_class,
+      PROP_STATS, PROP_STATS_INTERVAL);
+
+  /**
+   * GstVaapiEncode:adaptive-quality:
+   *
+   * Whether to encode at faster quality levels while the VA device is
+   * overloaded, as estimated from the QoS events, the encoder queue
+   * and the reports of the other elements sharing the display. The
+   * configured quality level is restored once the load eases.
+   */
+  g_object_class_install_property (object_class, PROP_ADAPTIVE_QUALITY,
+      g_param_spec_boolean ("adaptive-quality", "Adaptive quality",
+          "Trade quality for speed while the device is overloaded", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   gst_type_mark_as_plugin_api (GST_TYPE_VAAPIENCODE, 0);
 }
 
@@ -26,6 +26,7 @@
 
 #include "gstvaapipluginbase.h"
 #include <gst/vaapi/gstvaapiencoder.h>
+#include <gst/vaapi/gstvaapifilter.h>
 
 G_BEGIN_DECLS
 
@@ -80,10 +81,9 @@ struct _GstVaapiEncodeInitData
   static void                                                              \
   gst_vaapiencode_##NAME##_init (GstVaapiEncode##CLASS * encode);          \
   GType                                                                    \
-  gst_vaapiencode_##NAME##_register_type (GstVaapiDisplay * display)       \
+  gst_vaapiencode_##NAME##_register_type_with_caps (GstCaps * sink_caps,   \
+      GstCaps * src_caps)                                                  \
   {                                                                        \
-    GstCaps *caps;                                                         \
-    guint i, n;                                                            \
     GTypeInfo type_info = {                                                \
       sizeof (GstVaapiEncodeClass),                                        \
       NULL,                                                                \
@@ -95,6 +95,33 @@ struct _GstVaapiEncodeInitData
       0,                                                                   \
       (GInstanceInitFunc) gst_vaapiencode_##NAME##_init,                   \
     };                                                                     \
+                                                                           \
+    GST_DEBUG_CATEGORY_INIT (gst_vaapi_##NAME##_encode_debug,              \
+        GST_PLUGIN_NAME, 0, GST_PLUGIN_DESC);                              \
+                                                                           \
+    GST_DEBUG (#CODEC" encode's sink caps %" GST_PTR_FORMAT, sink_caps);   \
+    GST_DEBUG (#CODEC" encode's src caps %" GST_PTR_FORMAT, src_caps);     \
+                                                                           \
+    /* class data will be leaked if the element never gets instantiated */ \
+    GST_MINI_OBJECT_FLAG_SET (sink_caps,                                   \
+        GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);                               \
+    GST_MINI_OBJECT_FLAG_SET (src_caps,                                    \
+        GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);                               \
+    encode_init_data.sink_caps = sink_caps;                                \
+    encode_init_data.src_caps = src_caps;                                  \
+    type_info.class_data = &encode_init_data;                              \
+    encode_type = g_type_register_static (GST_TYPE_VAAPIENCODE,            \
+        "GstVaapiEncode"#CLASS, &type_info, 0);                            \
+                                                                           \
+    return encode_type;                                                    \
+  }                                                                        \
+                                                                           \
+  gboolean                                                                 \
+  gst_vaapiencode_##NAME##_probe_caps (GstVaapiDisplay * display,          \
+      GstCaps ** sink_caps_ptr, GstCaps ** src_caps_ptr)                   \
+  {                                                                        \
+    GstCaps *sink_caps, *src_caps;                                         \
+    guint i, n;                                                            \
     GArray *extra_fmts = NULL;                                             \
     GstVideoFormat ext_video_fmts[] = _EXT_FMT_;                           \
                                                                            \
@@ -107,48 +134,39 @@ struct _GstVaapiEncodeInitData
       for (i = 0; i < n; i++)                                              \
         g_array_append_val (extra_fmts, ext_video_fmts[i]);                \
     }                                                                      \
-    caps = gst_vaapi_build_template_raw_caps_by_codec (display,            \
+    extra_fmts = gst_vaapiencode_add_csc_formats (display, extra_fmts);    \
+    sink_caps = gst_vaapi_build_template_raw_caps_by_codec (display,       \
         GST_VAAPI_CONTEXT_USAGE_ENCODE,                                    \
         GST_VAAPI_CODEC_##CODEC, extra_fmts);                              \
     g_clear_pointer (&extra_fmts, g_array_unref);                          \
-    if (!caps) {                                                           \
+    if (!sink_caps) {                                                      \
       GST_ERROR ("failed to get sink caps for " #CODEC                     \
           " encode, can not register");                                    \
-      return G_TYPE_INVALID;                                               \
+      return FALSE;                                                        \
     }                                                                      \
                                                                            \
-    for (i = 0; i < gst_caps_get_size (caps); i++) {                       \
-      GstStructure *structure = gst_caps_get_structure (caps, i);          \
+    for (i = 0; i < gst_caps_get_size (sink_caps); i++) {                  \
+      GstStructure *structure = gst_caps_get_structure (sink_caps, i);     \
       if (!structure)                                                      \
         continue;                                                          \
       gst_structure_set (structure, "interlace-mode", G_TYPE_STRING,       \
           "progressive", NULL);                                            \
     }                                                                      \
-    GST_DEBUG (#CODEC" encode's sink caps %" GST_PTR_FORMAT, caps);        \
                                                                            \
-    /* class data will be leaked if the element never gets instantiated */ \
-    GST_MINI_OBJECT_FLAG_SET (caps, GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);   \
-    encode_init_data.sink_caps = caps;                                     \
-                                                                           \
-    caps = gst_vaapi_build_template_coded_caps_by_codec (display,          \
+    src_caps = gst_vaapi_build_template_coded_caps_by_codec (display,      \
         GST_VAAPI_CONTEXT_USAGE_ENCODE,                                    \
         GST_VAAPI_CODEC_##CODEC, GST_CODEC_CAPS,                           \
         FUN);                                                              \
-    if (!caps) {                                                           \
+    if (!src_caps) {                                                       \
       GST_ERROR ("failed to get src caps for " #CODEC                      \
           " encode, can not register");                                    \
-      gst_caps_unref (encode_init_data.sink_caps);                         \
-      return G_TYPE_INVALID;                                               \
+      gst_caps_unref (sink_caps);                                          \
+      return FALSE;                                                        \
     }                                                                      \
-    GST_DEBUG (#CODEC" encode's src caps %" GST_PTR_FORMAT, caps);         \
-    /* class data will be leaked if the element never gets instantiated */ \
-    GST_MINI_OBJECT_FLAG_SET (caps, GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);   \
-    encode_init_data.src_caps = caps;                                      \
-    type_info.class_data = &encode_init_data;                              \
-    encode_type = g_type_register_static (GST_TYPE_VAAPIENCODE,            \
-        "GstVaapiEncode"#CLASS, &type_info, 0);                            \
                                                                            \
-    return encode_type;                                                    \
+    *sink_caps_ptr = sink_caps;                                            \
+    *src_caps_ptr = src_caps;                                              \
+    return TRUE;                                                           \
   }                                                                        \
                                                                            \
   GType                                                                    \
@@ -174,6 +192,36 @@ struct _GstVaapiEncode
   GstVideoCodecState *output_state;
   GPtrArray *prop_values;
   GstCaps *allowed_sinkpad_caps;
+
+  /* zero-copy output of coded buffers */
+  gboolean zero_copy_output;
+  GstVaapiCodedBufferProxy *out_codedbuf_proxy;
+  gint wrapped_codedbufs;
+
+  /* push each coded segment (slice) as a subframe */
+  gboolean subframe_output;
+
+  /* post per-frame encoding statistics on the bus */
+  gboolean export_stats;
+
+  /* drop the input frames repeating the previous one */
+  guint max_duplicate_drops;
+  guint num_duplicate_drops;
+  GstBuffer *last_input_buffer;
+  guint64 last_input_hash;
+  gboolean has_last_input_hash;
+  guint32 last_frame_number;
+
+  /* drop the input frames beyond the latency budget of the queue */
+  GstClockTime max_queue_latency;
+  GstClockTime first_stale_pts;
+  gboolean dropping_stale;
+  gboolean pending_keyframe;
+
+  /* the input formats the encoder takes as is, the others are converted
+     by csc_filter */
+  GArray *input_formats;
+  GstVaapiFilter *csc_filter;
 };
 
 struct _GstVaapiEncodeClass
@@ -192,11 +240,18 @@ struct _GstVaapiEncodeClass
   /* Get all possible profiles based on allowed caps */
   GArray *            (*get_allowed_profiles)  (GstVaapiEncode * encode,
                                                 GstCaps * allowed);
+  /* Only predict the next frame from frames known to be received */
+  gboolean            (*invalidate_refs)  (GstVaapiEncode * encode);
 };
 
 GType
 gst_vaapiencode_get_type (void) G_GNUC_CONST;
 
+G_GNUC_INTERNAL
+GArray *
+gst_vaapiencode_add_csc_formats (GstVaapiDisplay * display,
+    GArray * formats);
+
 G_GNUC_INTERNAL
 void
 gst_vaapiencode_set_property_subclass (GObject * object,
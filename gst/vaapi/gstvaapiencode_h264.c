@@ -64,6 +64,7 @@
 #include <gst/vaapi/gstvaapiencoder_h264.h>
 #include <gst/vaapi/gstvaapiutils_h264.h>
 #include "gstvaapiencode_h264.h"
+#include "gstvaapinalmeta.h"
 #include "gstvaapipluginutil.h"
 #include "gstvaapivideomemory.h"
 
@@ -404,6 +405,13 @@ gst_vaapiencode_h264_alloc_encoder (GstVaapiEncode * base,
   return gst_vaapi_encoder_h264_new (display);
 }
 
+static gboolean
+gst_vaapiencode_h264_invalidate_refs (GstVaapiEncode * base)
+{
+  return gst_vaapi_encoder_h264_invalidate_refs (GST_VAAPI_ENCODER_H264
+      (base->encoder));
+}
+
 /* h264 NAL byte stream operations */
 static guint8 *
 _h264_byte_stream_next_nal (guint8 * buffer, guint32 len, guint32 * nal_size)
@@ -461,9 +469,13 @@ _start_code_to_size (guint8 nal_start_code[4], guint32 nal_size)
   nal_start_code[3] = (nal_size & 0xFF);
 }
 
+/* Lists the NAL units of the frame in a #GstVaapiNalMeta, so that
+   downstream elements don't scan it again, and converts the start
+   codes to sizes along the way if @to_avc */
 static gboolean
-_h264_convert_byte_stream_to_avc (GstBuffer * buf)
+_h264_index_nal_units (GstBuffer * buf, gboolean to_avc)
 {
+  GstVaapiNalMeta *meta;
   GstMapInfo info;
   guint32 nal_size;
   guint8 *nal_start_code, *nal_body;
@@ -471,9 +483,11 @@ _h264_convert_byte_stream_to_avc (GstBuffer * buf)
 
   g_assert (buf);
 
-  if (!gst_buffer_map (buf, &info, GST_MAP_READ | GST_MAP_WRITE))
+  if (!gst_buffer_map (buf, &info,
+          to_avc ? GST_MAP_READ | GST_MAP_WRITE : GST_MAP_READ))
     return FALSE;
 
+  meta = gst_buffer_add_vaapi_nal_meta (buf);
   nal_start_code = info.data;
   frame_end = info.data + info.size;
   nal_size = 0;
@@ -481,11 +495,20 @@ _h264_convert_byte_stream_to_avc (GstBuffer * buf)
   while ((frame_end > nal_start_code) &&
       (nal_body = _h264_byte_stream_next_nal (nal_start_code,
               frame_end - nal_start_code, &nal_size)) != NULL) {
-    if (!nal_size)
-      goto error;
+    /* an empty NAL unit can only be left as is in a byte-stream */
+    if (!nal_size) {
+      if (to_avc)
+        goto error;
+      break;
+    }
 
-    g_assert (nal_body - nal_start_code == 4);
-    _start_code_to_size (nal_start_code, nal_size);
+    if (meta)
+      gst_vaapi_nal_meta_add_unit (meta, nal_body - info.data, nal_size,
+          nal_body[0] & 0x1f);
+    if (to_avc) {
+      g_assert (nal_body - nal_start_code == 4);
+      _start_code_to_size (nal_start_code, nal_size);
+    }
     nal_start_code = nal_body + nal_size;
   }
   gst_buffer_unmap (buf, &info);
@@ -516,11 +539,8 @@ gst_vaapiencode_h264_alloc_buffer (GstVaapiEncode * base_encode,
   if (ret != GST_FLOW_OK)
     return ret;
 
-  if (!encode->is_avc)
-    return GST_FLOW_OK;
-
-  /* Convert to avcC format */
-  if (!_h264_convert_byte_stream_to_avc (*out_buffer_ptr))
+  /* List the NAL units, and convert to avcC format if needed */
+  if (!_h264_index_nal_units (*out_buffer_ptr, encode->is_avc))
     goto error_convert_buffer;
   return GST_FLOW_OK;
 
@@ -555,6 +575,7 @@ gst_vaapiencode_h264_class_init (GstVaapiEncodeH264Class * klass, gpointer data)
   encode_class->get_caps = gst_vaapiencode_h264_get_caps;
   encode_class->alloc_encoder = gst_vaapiencode_h264_alloc_encoder;
   encode_class->alloc_buffer = gst_vaapiencode_h264_alloc_buffer;
+  encode_class->invalidate_refs = gst_vaapiencode_h264_invalidate_refs;
 
   gst_element_class_set_static_metadata (element_class,
       "VA-API H264 encoder",
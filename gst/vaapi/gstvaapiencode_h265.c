@@ -34,10 +34,12 @@
  */
 
 #include "gstcompat.h"
+#include <gst/video/video.h>
 #include <gst/vaapi/gstvaapidisplay.h>
 #include <gst/vaapi/gstvaapiencoder_h265.h>
 #include <gst/vaapi/gstvaapiutils_h265.h>
 #include "gstvaapiencode_h265.h"
+#include "gstvaapinalmeta.h"
 #include "gstvaapipluginutil.h"
 #include "gstvaapivideomemory.h"
 
@@ -220,6 +222,13 @@ gst_vaapiencode_h265_alloc_encoder (GstVaapiEncode * base,
   return gst_vaapi_encoder_h265_new (display);
 }
 
+static gboolean
+gst_vaapiencode_h265_invalidate_refs (GstVaapiEncode * base)
+{
+  return gst_vaapi_encoder_h265_invalidate_refs (GST_VAAPI_ENCODER_H265
+      (base->encoder));
+}
+
 /* h265 NAL byte stream operations */
 static guint8 *
 _h265_byte_stream_next_nal (guint8 * buffer, guint32 len, guint32 * nal_size)
@@ -277,9 +286,13 @@ _start_code_to_size (guint8 nal_start_code[4], guint32 nal_size)
   nal_start_code[3] = (nal_size & 0xFF);
 }
 
+/* Lists the NAL units of the frame in a #GstVaapiNalMeta, so that
+   downstream elements don't scan it again, and converts the start
+   codes to sizes along the way if @to_hvc */
 static gboolean
-_h265_convert_byte_stream_to_hvc (GstBuffer * buf)
+_h265_index_nal_units (GstBuffer * buf, gboolean to_hvc)
 {
+  GstVaapiNalMeta *meta;
   GstMapInfo info;
   guint32 nal_size;
   guint8 *nal_start_code, *nal_body;
@@ -287,9 +300,11 @@ _h265_convert_byte_stream_to_hvc (GstBuffer * buf)
 
   g_assert (buf);
 
-  if (!gst_buffer_map (buf, &info, GST_MAP_READ | GST_MAP_WRITE))
+  if (!gst_buffer_map (buf, &info,
+          to_hvc ? GST_MAP_READ | GST_MAP_WRITE : GST_MAP_READ))
     return FALSE;
 
+  meta = gst_buffer_add_vaapi_nal_meta (buf);
   nal_start_code = info.data;
   frame_end = info.data + info.size;
   nal_size = 0;
@@ -297,11 +312,20 @@ _h265_convert_byte_stream_to_hvc (GstBuffer * buf)
   while ((frame_end > nal_start_code) &&
       (nal_body = _h265_byte_stream_next_nal (nal_start_code,
               frame_end - nal_start_code, &nal_size)) != NULL) {
-    if (!nal_size)
-      goto error;
+    /* an empty NAL unit can only be left as is in a byte-stream */
+    if (!nal_size) {
+      if (to_hvc)
+        goto error;
+      break;
+    }
 
-    g_assert (nal_body - nal_start_code == 4);
-    _start_code_to_size (nal_start_code, nal_size);
+    if (meta)
+      gst_vaapi_nal_meta_add_unit (meta, nal_body - info.data, nal_size,
+          (nal_body[0] >> 1) & 0x3f);
+    if (to_hvc) {
+      g_assert (nal_body - nal_start_code == 4);
+      _start_code_to_size (nal_start_code, nal_size);
+    }
     nal_start_code = nal_body + nal_size;
   }
   gst_buffer_unmap (buf, &info);
@@ -315,6 +339,60 @@ error:
   }
 }
 
+/* Attaches one "tile" region of interest meta per tile slice, with the
+   position of its NAL unit in the buffer, so that packagers can extract
+   the tiles without parsing the bitstream. The offsets don't change
+   with the hvcC conversion, as the start codes are 4 bytes long */
+static gboolean
+_h265_add_tile_metas (GstVaapiEncoderH265 * encoder, GstBuffer * buf)
+{
+  const guint num_tiles = gst_vaapi_encoder_h265_get_num_tile_slices (encoder);
+  GstVideoRegionOfInterestMeta *meta;
+  GstVaapiRectangle rect;
+  GstMapInfo info;
+  guint32 nal_size;
+  guint8 *nal_start_code, *nal_body;
+  guint8 *frame_end;
+  guint tile = 0;
+
+  if (num_tiles == 0)
+    return TRUE;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ))
+    return FALSE;
+
+  nal_start_code = info.data;
+  frame_end = info.data + info.size;
+  nal_size = 0;
+
+  while ((frame_end > nal_start_code) &&
+      (nal_body = _h265_byte_stream_next_nal (nal_start_code,
+              frame_end - nal_start_code, &nal_size)) != NULL) {
+    if (!nal_size)
+      break;
+
+    /* VCL NAL units, i.e. the slices */
+    if (((nal_body[0] >> 1) & 0x3f) < 32 && tile < num_tiles
+        && gst_vaapi_encoder_h265_get_tile_slice_rect (encoder, tile, &rect)) {
+      meta = gst_buffer_add_video_region_of_interest_meta (buf, "tile",
+          rect.x, rect.y, rect.width, rect.height);
+      gst_video_region_of_interest_meta_add_param (meta,
+          gst_structure_new ("GstVaapiTile", "index", G_TYPE_UINT, tile,
+              "offset", G_TYPE_UINT, (guint) (nal_start_code - info.data),
+              "size", G_TYPE_UINT, (guint) (nal_body + nal_size -
+                  nal_start_code), NULL));
+      tile++;
+    }
+    nal_start_code = nal_body + nal_size;
+  }
+  gst_buffer_unmap (buf, &info);
+
+  if (tile != num_tiles)
+    GST_WARNING ("found %d tile slices in the frame, but expected %d",
+        tile, num_tiles);
+  return TRUE;
+}
+
 static GstFlowReturn
 gst_vaapiencode_h265_alloc_buffer (GstVaapiEncode * base_encode,
     GstVaapiCodedBuffer * coded_buf, GstBuffer ** out_buffer_ptr)
@@ -332,11 +410,11 @@ gst_vaapiencode_h265_alloc_buffer (GstVaapiEncode * base_encode,
   if (ret != GST_FLOW_OK)
     return ret;
 
-  if (!encode->is_hvc)
-    return GST_FLOW_OK;
+  if (!_h265_add_tile_metas (encoder, *out_buffer_ptr))
+    GST_WARNING ("failed to map the buffer to locate its tiles");
 
-  /* Convert to hvcC format */
-  if (!_h265_convert_byte_stream_to_hvc (*out_buffer_ptr))
+  /* List the NAL units, and convert to hvcC format if needed */
+  if (!_h265_index_nal_units (*out_buffer_ptr, encode->is_hvc))
     goto error_convert_buffer;
   return GST_FLOW_OK;
 
@@ -371,6 +449,7 @@ gst_vaapiencode_h265_class_init (GstVaapiEncodeH265Class * klass, gpointer data)
   encode_class->get_caps = gst_vaapiencode_h265_get_caps;
   encode_class->alloc_encoder = gst_vaapiencode_h265_alloc_encoder;
   encode_class->alloc_buffer = gst_vaapiencode_h265_alloc_buffer;
+  encode_class->invalidate_refs = gst_vaapiencode_h265_invalidate_refs;
 
   gst_element_class_set_static_metadata (element_class,
       "VA-API H265 encoder",
@@ -34,6 +34,8 @@
  */
 
 #include "gstcompat.h"
+#include <gst/video/video.h>
+#include <gst/codecparsers/gstjpegparser.h>
 #include <gst/vaapi/gstvaapidisplay.h>
 #include <gst/vaapi/gstvaapiencoder_jpeg.h>
 #include "gstvaapiencode_jpeg.h"
@@ -83,6 +85,120 @@ gst_vaapiencode_jpeg_alloc_encoder (GstVaapiEncode * base,
   return gst_vaapi_encoder_jpeg_new (display);
 }
 
+/* Returns the offset of the entropy-coded data that follows the scan
+   header, or 0 if there is no scan header */
+static gsize
+_jpeg_find_scan_data (const guint8 * data, gsize size)
+{
+  gsize pos = 2;                /* SOI */
+
+  while (pos + 4 <= size) {
+    const guint8 marker = data[pos + 1];
+    const guint length = GST_READ_UINT16_BE (data + pos + 2);
+
+    if (data[pos] != 0xff)
+      return 0;
+    pos += 2 + length;
+    if (marker == GST_JPEG_MARKER_SOS)
+      return pos <= size ? pos : 0;
+  }
+  return 0;
+}
+
+/* Attaches one "restart-interval" region of interest meta per restart
+   interval, with the position of its entropy-coded segment in the
+   buffer, so that decoders can hand the segments out to several
+   threads without scanning the data for the RSTn markers */
+static gboolean
+_jpeg_add_restart_interval_metas (GstVaapiEncoderJpeg * encoder,
+    GstBuffer * buf)
+{
+  const guint num_intervals =
+      gst_vaapi_encoder_jpeg_get_num_restart_intervals (encoder);
+  GstVideoRegionOfInterestMeta *meta;
+  GstVaapiRectangle rect;
+  GstMapInfo info;
+  gsize pos, start;
+  guint interval = 0, first_mcu, num_mcus;
+
+  if (num_intervals == 0)
+    return TRUE;
+
+  if (!gst_buffer_map (buf, &info, GST_MAP_READ))
+    return FALSE;
+
+  start = _jpeg_find_scan_data (info.data, info.size);
+  if (start == 0)
+    goto done;
+
+  for (pos = start; pos < info.size && interval < num_intervals; pos++) {
+    const gboolean at_end = pos + 1 >= info.size;
+    guint8 marker = 0;
+
+    if (!at_end) {
+      if (info.data[pos] != 0xff)
+        continue;
+      marker = info.data[pos + 1];
+      /* stuffed byte, or fill bytes before a marker */
+      if (marker == 0x00 || marker == 0xff)
+        continue;
+    }
+
+    if (at_end || (marker >= GST_JPEG_MARKER_RST_MIN
+            && marker <= GST_JPEG_MARKER_RST_MAX)
+        || marker == GST_JPEG_MARKER_EOI) {
+      if (gst_vaapi_encoder_jpeg_get_restart_interval_rect (encoder, interval,
+              &rect, &first_mcu, &num_mcus)) {
+        const gsize end = at_end ? info.size : pos;
+
+        meta = gst_buffer_add_video_region_of_interest_meta (buf,
+            "restart-interval", rect.x, rect.y, rect.width, rect.height);
+        gst_video_region_of_interest_meta_add_param (meta,
+            gst_structure_new ("GstVaapiRestartInterval",
+                "index", G_TYPE_UINT, interval,
+                "offset", G_TYPE_UINT, (guint) start,
+                "size", G_TYPE_UINT, (guint) (end - start),
+                "first-mcu", G_TYPE_UINT, first_mcu,
+                "num-mcus", G_TYPE_UINT, num_mcus, NULL));
+      }
+      interval++;
+      if (at_end || marker == GST_JPEG_MARKER_EOI)
+        break;
+      start = pos + 2;
+      pos++;
+    }
+  }
+
+done:
+  gst_buffer_unmap (buf, &info);
+
+  if (interval != num_intervals)
+    GST_WARNING ("found %d restart intervals in the picture, but expected %d",
+        interval, num_intervals);
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_vaapiencode_jpeg_alloc_buffer (GstVaapiEncode * base_encode,
+    GstVaapiCodedBuffer * coded_buf, GstBuffer ** out_buffer_ptr)
+{
+  GstVaapiEncoderJpeg *const encoder =
+      GST_VAAPI_ENCODER_JPEG (base_encode->encoder);
+  GstFlowReturn ret;
+
+  g_return_val_if_fail (encoder != NULL, GST_FLOW_ERROR);
+
+  ret =
+      GST_VAAPIENCODE_CLASS (gst_vaapiencode_jpeg_parent_class)->alloc_buffer
+      (base_encode, coded_buf, out_buffer_ptr);
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  if (!_jpeg_add_restart_interval_metas (encoder, *out_buffer_ptr))
+    GST_WARNING ("failed to map the buffer to locate its restart intervals");
+  return GST_FLOW_OK;
+}
+
 static void
 gst_vaapiencode_jpeg_class_init (GstVaapiEncodeJpegClass * klass, gpointer data)
 {
@@ -101,6 +217,7 @@ gst_vaapiencode_jpeg_class_init (GstVaapiEncodeJpegClass * klass, gpointer data)
 
   encode_class->get_caps = gst_vaapiencode_jpeg_get_caps;
   encode_class->alloc_encoder = gst_vaapiencode_jpeg_alloc_encoder;
+  encode_class->alloc_buffer = gst_vaapiencode_jpeg_alloc_buffer;
 
   gst_element_class_set_static_metadata (element_class,
       "VA-API JPEG encoder",
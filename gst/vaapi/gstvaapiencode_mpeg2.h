@@ -69,8 +69,13 @@ struct _GstVaapiEncodeMpeg2Class
 GType
 gst_vaapiencode_mpeg2_get_type (void) G_GNUC_CONST;
 
+gboolean
+gst_vaapiencode_mpeg2_probe_caps (GstVaapiDisplay * display,
+    GstCaps ** sink_caps_ptr, GstCaps ** src_caps_ptr);
+
 GType
-gst_vaapiencode_mpeg2_register_type (GstVaapiDisplay * display);
+gst_vaapiencode_mpeg2_register_type_with_caps (GstCaps * sink_caps,
+    GstCaps * src_caps);
 
 G_END_DECLS
 
@@ -0,0 +1,268 @@
+/*
+ *  gstvaapifencemeta.c - Fences of pending writes to DMA buffers
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/* The fences are the implicit ones the kernel attaches to the DMA
+   buffers written by the VA driver, exported as a sync_file. Waiting
+   for them is left to the consumer, right before it reads the buffer,
+   instead of a vaSyncSurface() in the producer streaming thread. */
+
+#include "gstcompat.h"
+#include "gstvaapifencemeta.h"
+#include <gst/allocators/allocators.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/* from <linux/dma-buf.h>, Linux 6.0 */
+#ifndef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+struct dma_buf_export_sync_file
+{
+  guint32 flags;
+  gint32 fd;
+};
+struct dma_buf_import_sync_file
+{
+  guint32 flags;
+  gint32 fd;
+};
+# define DMA_BUF_SYNC_READ (1 << 0)
+# define DMA_BUF_SYNC_WRITE (2 << 0)
+# define DMA_BUF_BASE 'b'
+# define DMA_BUF_IOCTL_EXPORT_SYNC_FILE \
+  _IOWR (DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+# define DMA_BUF_IOCTL_IMPORT_SYNC_FILE \
+  _IOW (DMA_BUF_BASE, 3, struct dma_buf_import_sync_file)
+#endif
+
+static gboolean
+gst_vaapi_fence_meta_init (GstVaapiFenceMeta * meta, gpointer params,
+    GstBuffer * buffer)
+{
+  meta->fd = -1;
+  return TRUE;
+}
+
+static void
+gst_vaapi_fence_meta_free (GstVaapiFenceMeta * meta, GstBuffer * buffer)
+{
+  if (meta->fd >= 0)
+    close (meta->fd);
+}
+
+static gboolean
+gst_vaapi_fence_meta_transform (GstBuffer * dst_buffer, GstMeta * meta,
+    GstBuffer * src_buffer, GQuark type, gpointer data)
+{
+  GstVaapiFenceMeta *const src_meta = (GstVaapiFenceMeta *) meta;
+  gint fd;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  fd = dup (src_meta->fd);
+  if (fd < 0)
+    return FALSE;
+  return gst_buffer_add_vaapi_fence_meta (dst_buffer, fd) != NULL;
+}
+
+GType
+gst_vaapi_fence_meta_api_get_type (void)
+{
+  static gsize g_type;
+  static const gchar *tags[] = { "memory", NULL };
+
+  if (g_once_init_enter (&g_type)) {
+    GType type = gst_meta_api_type_register ("GstVaapiFenceMetaAPI", tags);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
+#define GST_VAAPI_FENCE_META_INFO gst_vaapi_fence_meta_info_get ()
+static const GstMetaInfo *
+gst_vaapi_fence_meta_info_get (void)
+{
+  static gsize g_meta_info;
+
+  if (g_once_init_enter (&g_meta_info)) {
+    gsize meta_info =
+        GPOINTER_TO_SIZE (gst_meta_register (GST_VAAPI_FENCE_META_API_TYPE,
+            "GstVaapiFenceMeta", sizeof (GstVaapiFenceMeta),
+            (GstMetaInitFunction) gst_vaapi_fence_meta_init,
+            (GstMetaFreeFunction) gst_vaapi_fence_meta_free,
+            (GstMetaTransformFunction) gst_vaapi_fence_meta_transform));
+    g_once_init_leave (&g_meta_info, meta_info);
+  }
+  return GSIZE_TO_POINTER (g_meta_info);
+}
+
+/**
+ * gst_buffer_add_vaapi_fence_meta:
+ * @buffer: a #GstBuffer
+ * @fd: a sync_file descriptor
+ *
+ * Attaches the fence @fd to @buffer, which takes ownership of it.
+ *
+ * Returns: the #GstVaapiFenceMeta, or %NULL on error
+ */
+GstVaapiFenceMeta *
+gst_buffer_add_vaapi_fence_meta (GstBuffer * buffer, gint fd)
+{
+  GstVaapiFenceMeta *meta;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+  g_return_val_if_fail (fd >= 0, NULL);
+
+  meta = (GstVaapiFenceMeta *) gst_buffer_add_meta (buffer,
+      GST_VAAPI_FENCE_META_INFO, NULL);
+  if (!meta) {
+    close (fd);
+    return NULL;
+  }
+  meta->fd = fd;
+  return meta;
+}
+
+/**
+ * gst_buffer_add_vaapi_fence_meta_from_memory:
+ * @buffer: a #GstBuffer holding a DMA buffer
+ *
+ * Exports the pending writes to the first memory of @buffer as a
+ * fence and attaches it to @buffer. This needs Linux 6.0 and a
+ * driver that maintains the implicit fences of its DMA buffers.
+ *
+ * Returns: %TRUE if a fence was attached, %FALSE if the producer has
+ *   to wait for the writes itself
+ */
+gboolean
+gst_buffer_add_vaapi_fence_meta_from_memory (GstBuffer * buffer)
+{
+  GstMemory *mem;
+  gint fd;
+
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), FALSE);
+
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (!mem || !gst_is_dmabuf_memory (mem))
+    return FALSE;
+
+  fd = gst_vaapi_dma_buf_export_fence (gst_dmabuf_memory_get_fd (mem), FALSE);
+  if (fd < 0)
+    return FALSE;
+  return gst_buffer_add_vaapi_fence_meta (buffer, fd) != NULL;
+}
+
+/**
+ * gst_vaapi_fence_meta_wait:
+ * @meta: a #GstVaapiFenceMeta
+ *
+ * Blocks until the fence of @meta is signaled. The fence is left
+ * in place, since the buffer may have other consumers.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+gst_vaapi_fence_meta_wait (GstVaapiFenceMeta * meta)
+{
+  g_return_val_if_fail (meta != NULL, FALSE);
+
+  return gst_vaapi_fence_wait (meta->fd);
+}
+
+/**
+ * gst_vaapi_dma_buf_export_fence:
+ * @fd: a DMA buffer descriptor
+ * @for_write: %TRUE to also wait for the pending reads
+ *
+ * Exports the implicit fences of @fd as a sync_file, that is signaled
+ * once the pending writes, and the pending reads too if @for_write,
+ * are done. This needs Linux 6.0.
+ *
+ * Returns: a sync_file descriptor the caller owns, or -1 on error
+ */
+gint
+gst_vaapi_dma_buf_export_fence (gint fd, gboolean for_write)
+{
+  struct dma_buf_export_sync_file args = { 0, -1 };
+  gint ret;
+
+  args.flags = for_write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ;
+  do {
+    ret = ioctl (fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &args);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+  if (ret < 0) {
+    GST_DEBUG ("cannot export DMA buffer fence: %s", g_strerror (errno));
+    return -1;
+  }
+  return args.fd;
+}
+
+/**
+ * gst_vaapi_dma_buf_import_fence:
+ * @fd: a DMA buffer descriptor
+ * @fence_fd: a sync_file descriptor
+ *
+ * Adds @fence_fd to the implicit write fences of @fd, so that the
+ * next users of the DMA buffer, e.g. the VA driver, wait for it on
+ * the GPU. @fence_fd is left open. This needs Linux 6.0.
+ *
+ * Returns: %TRUE on success, %FALSE if the caller has to wait for
+ *   @fence_fd itself
+ */
+gboolean
+gst_vaapi_dma_buf_import_fence (gint fd, gint fence_fd)
+{
+  struct dma_buf_import_sync_file args = { DMA_BUF_SYNC_WRITE, -1 };
+  gint ret;
+
+  args.fd = fence_fd;
+  do {
+    ret = ioctl (fd, DMA_BUF_IOCTL_IMPORT_SYNC_FILE, &args);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+  if (ret < 0) {
+    GST_DEBUG ("cannot import DMA buffer fence: %s", g_strerror (errno));
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_fence_wait:
+ * @fence_fd: a sync_file descriptor
+ *
+ * Blocks until @fence_fd is signaled.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+gst_vaapi_fence_wait (gint fence_fd)
+{
+  struct pollfd pfd;
+  gint ret;
+
+  g_return_val_if_fail (fence_fd >= 0, FALSE);
+
+  pfd.fd = fence_fd;
+  pfd.events = POLLIN;
+  do {
+    ret = poll (&pfd, 1, -1);
+  } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+  return ret > 0;
+}
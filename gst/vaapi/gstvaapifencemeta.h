@@ -0,0 +1,80 @@
+/*
+ *  gstvaapifencemeta.h - Fences of pending writes to DMA buffers
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_FENCE_META_H
+#define GST_VAAPI_FENCE_META_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstVaapiFenceMeta GstVaapiFenceMeta;
+
+/**
+ * GstVaapiFenceMeta:
+ * @fd: a sync_file descriptor, signaled once the GPU is done writing
+ *   the DMA buffers of the buffer
+ *
+ * Carries the completion of the VA operation that produced a DMA
+ * buffer, so that the producer does not have to wait for it.
+ */
+struct _GstVaapiFenceMeta
+{
+  GstMeta meta;
+  gint fd;
+};
+
+#define GST_VAAPI_FENCE_META_API_TYPE \
+  gst_vaapi_fence_meta_api_get_type ()
+
+#define gst_buffer_get_vaapi_fence_meta(buffer) \
+  ((GstVaapiFenceMeta *) gst_buffer_get_meta ((buffer), \
+      GST_VAAPI_FENCE_META_API_TYPE))
+
+G_GNUC_INTERNAL
+GType
+gst_vaapi_fence_meta_api_get_type (void) G_GNUC_CONST;
+
+G_GNUC_INTERNAL
+GstVaapiFenceMeta *
+gst_buffer_add_vaapi_fence_meta (GstBuffer * buffer, gint fd);
+
+G_GNUC_INTERNAL
+gboolean
+gst_buffer_add_vaapi_fence_meta_from_memory (GstBuffer * buffer);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_fence_meta_wait (GstVaapiFenceMeta * meta);
+
+G_GNUC_INTERNAL
+gint
+gst_vaapi_dma_buf_export_fence (gint fd, gboolean for_write);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_dma_buf_import_fence (gint fd, gint fence_fd);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_fence_wait (gint fence_fd);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_FENCE_META_H */
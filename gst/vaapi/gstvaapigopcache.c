@@ -0,0 +1,400 @@
+/*
+ *  gstvaapigopcache.c - Keeps the latest GOP for fast channel changes
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:element-vaapigopcache
+ * @short_description: Keeps the latest GOP for fast channel changes
+ *
+ * vaapigopcache passes a compressed video stream through, and keeps
+ * the buffers received since its last key unit. When the decoder at
+ * the other end asks for a key unit, as vaapidecode does with its
+ * #GstVaapiDecode:fast-start property when a stream starts in the
+ * middle of a GOP, the cached GOP is pushed again ahead of the next
+ * input buffer, flagged %GST_BUFFER_FLAG_DECODE_ONLY. The decoder
+ * rebuilds its reference pictures from it without showing them and
+ * the output starts at the live edge, instead of waiting for the next
+ * key frame of the stream.
+ *
+ * Channel changes are made with one vaapigopcache per channel, in
+ * front of the element switching between them, so that every channel
+ * keeps its own GOP. The #GstVaapiGopCache::replay action signal
+ * replays the GOP without the decoder asking for it.
+ *
+ * ## Example launch line
+ *
+ * |[
+ * gst-launch-1.0 input-selector name=sel ! h264parse \
+ *     ! vaapih264dec fast-start=true ! vaapisink \
+ *     udpsrc port=5000 ! tsdemux ! h264parse ! vaapigopcache ! sel. \
+ *     udpsrc port=5002 ! tsdemux ! h264parse ! vaapigopcache ! sel.
+ * ]|
+ */
+
+#include "gstcompat.h"
+#include <gst/video/video.h>
+
+#include "gstvaapigopcache.h"
+
+#define GST_PLUGIN_NAME "vaapigopcache"
+#define GST_PLUGIN_DESC "Keeps the latest GOP for fast channel changes"
+
+GST_DEBUG_CATEGORY_STATIC (gst_debug_vaapi_gop_cache);
+#ifndef GST_DISABLE_GST_DEBUG
+#define GST_CAT_DEFAULT gst_debug_vaapi_gop_cache
+#else
+#define GST_CAT_DEFAULT NULL
+#endif
+
+/* *INDENT-OFF* */
+static GstStaticPadTemplate gst_vaapi_gop_cache_sink_factory =
+  GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+/* *INDENT-ON* */
+
+/* *INDENT-OFF* */
+static GstStaticPadTemplate gst_vaapi_gop_cache_src_factory =
+  GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+/* *INDENT-ON* */
+
+enum
+{
+  REPLAY_SIGNAL,
+  LAST_SIGNAL
+};
+
+static guint gst_vaapi_gop_cache_signals[LAST_SIGNAL] = { 0 };
+
+enum
+{
+  PROP_0,
+  PROP_MAX_SIZE_BYTES,
+  PROP_MAX_SIZE_TIME,
+  N_PROPERTIES
+};
+
+static GParamSpec *g_properties[N_PROPERTIES] = { NULL, };
+
+#define DEFAULT_MAX_SIZE_BYTES (32 * 1024 * 1024)
+#define DEFAULT_MAX_SIZE_TIME (10 * GST_SECOND)
+
+G_DEFINE_TYPE (GstVaapiGopCache, gst_vaapi_gop_cache,
+    GST_TYPE_BASE_TRANSFORM);
+
+static inline GstClockTime
+get_buffer_time (GstBuffer * buffer)
+{
+  return GST_BUFFER_DTS_IS_VALID (buffer) ? GST_BUFFER_DTS (buffer) :
+      GST_BUFFER_PTS (buffer);
+}
+
+static void
+clear_gop (GstVaapiGopCache * cache)
+{
+  GST_OBJECT_LOCK (cache);
+  g_queue_clear_full (&cache->gop, (GDestroyNotify) gst_buffer_unref);
+  cache->gop_bytes = 0;
+  GST_OBJECT_UNLOCK (cache);
+}
+
+/* Adds @buffer to the GOP, which starts over at each key unit. A GOP
+   growing past the limits is dropped until the next key unit */
+static void
+cache_buffer (GstVaapiGopCache * cache, GstBuffer * buffer)
+{
+  GstClockTime start, end;
+  gboolean overflow = FALSE;
+
+  if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+    clear_gop (cache);
+  else if (g_queue_is_empty (&cache->gop))
+    return;
+
+  GST_OBJECT_LOCK (cache);
+  g_queue_push_tail (&cache->gop, gst_buffer_ref (buffer));
+  cache->gop_bytes += gst_buffer_get_size (buffer);
+  if (cache->max_size_bytes > 0 && cache->gop_bytes > cache->max_size_bytes)
+    overflow = TRUE;
+
+  start = get_buffer_time (g_queue_peek_head (&cache->gop));
+  end = get_buffer_time (buffer);
+  if (cache->max_size_time > 0 && GST_CLOCK_TIME_IS_VALID (start)
+      && GST_CLOCK_TIME_IS_VALID (end) && end > start
+      && end - start > cache->max_size_time)
+    overflow = TRUE;
+  GST_OBJECT_UNLOCK (cache);
+
+  if (overflow) {
+    GST_DEBUG_OBJECT (cache, "GOP is too large, waiting for a key unit");
+    clear_gop (cache);
+  }
+}
+
+/* Queues the cached GOP, to be pushed before the next input buffer */
+static void
+queue_replay (GstVaapiGopCache * cache)
+{
+  GstBuffer *buffer;
+  GList *l;
+
+  GST_OBJECT_LOCK (cache);
+  for (l = cache->gop.head; l; l = l->next) {
+    buffer = gst_buffer_copy (l->data);
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DECODE_ONLY);
+    if (l == cache->gop.head)
+      GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+    g_queue_push_tail (&cache->pending, buffer);
+  }
+  GST_OBJECT_UNLOCK (cache);
+
+  GST_INFO_OBJECT (cache, "replaying a GOP of %u buffers",
+      g_queue_get_length (&cache->pending));
+}
+
+static GstFlowReturn
+gst_vaapi_gop_cache_submit_input_buffer (GstBaseTransform * trans,
+    gboolean is_discont, GstBuffer * input)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (trans);
+
+  /* the input buffer is the live edge, the GOP up to it is replayed
+     unless it starts a new one */
+  if (g_atomic_int_compare_and_exchange (&cache->replay, TRUE, FALSE)
+      && GST_BUFFER_FLAG_IS_SET (input, GST_BUFFER_FLAG_DELTA_UNIT))
+    queue_replay (cache);
+
+  cache_buffer (cache, input);
+  g_queue_push_tail (&cache->pending, input);
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+gst_vaapi_gop_cache_generate_output (GstBaseTransform * trans,
+    GstBuffer ** outbuf)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (trans);
+
+  *outbuf = g_queue_pop_head (&cache->pending);
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_vaapi_gop_cache_sink_event (GstBaseTransform * trans, GstEvent * event)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (trans);
+  GstCaps *caps, *old_caps;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_STOP:
+    case GST_EVENT_STREAM_START:
+      clear_gop (cache);
+      break;
+    case GST_EVENT_CAPS:
+      gst_event_parse_caps (event, &caps);
+      old_caps = gst_pad_get_current_caps (GST_BASE_TRANSFORM_SINK_PAD (trans));
+      if (!old_caps || !gst_caps_is_equal (caps, old_caps))
+        clear_gop (cache);
+      gst_clear_caps (&old_caps);
+      break;
+    default:
+      break;
+  }
+  return GST_BASE_TRANSFORM_CLASS (gst_vaapi_gop_cache_parent_class)->sink_event
+      (trans, event);
+}
+
+static gboolean
+gst_vaapi_gop_cache_src_event (GstBaseTransform * trans, GstEvent * event)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (trans);
+  gboolean has_gop;
+
+  if (gst_video_event_is_force_key_unit (event)
+      && GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM) {
+    GST_OBJECT_LOCK (cache);
+    has_gop = !g_queue_is_empty (&cache->gop);
+    GST_OBJECT_UNLOCK (cache);
+
+    /* otherwise, the key unit has to come from upstream */
+    if (has_gop) {
+      GST_DEBUG_OBJECT (cache, "key unit requested, replaying the GOP");
+      g_atomic_int_set (&cache->replay, TRUE);
+      gst_event_unref (event);
+      return TRUE;
+    }
+  }
+  return GST_BASE_TRANSFORM_CLASS (gst_vaapi_gop_cache_parent_class)->src_event
+      (trans, event);
+}
+
+static gboolean
+gst_vaapi_gop_cache_stop (GstBaseTransform * trans)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (trans);
+
+  clear_gop (cache);
+  g_queue_clear_full (&cache->pending, (GDestroyNotify) gst_buffer_unref);
+  g_atomic_int_set (&cache->replay, FALSE);
+  return TRUE;
+}
+
+static void
+gst_vaapi_gop_cache_replay (GstVaapiGopCache * cache)
+{
+  GST_DEBUG_OBJECT (cache, "GOP replay requested");
+  g_atomic_int_set (&cache->replay, TRUE);
+}
+
+static void
+gst_vaapi_gop_cache_finalize (GObject * object)
+{
+  gst_vaapi_gop_cache_stop (GST_BASE_TRANSFORM (object));
+
+  G_OBJECT_CLASS (gst_vaapi_gop_cache_parent_class)->finalize (object);
+}
+
+static void
+gst_vaapi_gop_cache_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (object);
+
+  switch (prop_id) {
+    case PROP_MAX_SIZE_BYTES:
+      GST_OBJECT_LOCK (cache);
+      cache->max_size_bytes = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (cache);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      GST_OBJECT_LOCK (cache);
+      cache->max_size_time = g_value_get_uint64 (value);
+      GST_OBJECT_UNLOCK (cache);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_gop_cache_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiGopCache *const cache = GST_VAAPI_GOP_CACHE (object);
+
+  switch (prop_id) {
+    case PROP_MAX_SIZE_BYTES:
+      g_value_set_uint64 (value, cache->max_size_bytes);
+      break;
+    case PROP_MAX_SIZE_TIME:
+      g_value_set_uint64 (value, cache->max_size_time);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_gop_cache_class_init (GstVaapiGopCacheClass * klass)
+{
+  GObjectClass *const object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *const element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *const trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_debug_vaapi_gop_cache,
+      GST_PLUGIN_NAME, 0, GST_PLUGIN_DESC);
+
+  object_class->finalize = gst_vaapi_gop_cache_finalize;
+  object_class->set_property = gst_vaapi_gop_cache_set_property;
+  object_class->get_property = gst_vaapi_gop_cache_get_property;
+
+  trans_class->stop = gst_vaapi_gop_cache_stop;
+  trans_class->sink_event = gst_vaapi_gop_cache_sink_event;
+  trans_class->src_event = gst_vaapi_gop_cache_src_event;
+  trans_class->submit_input_buffer = gst_vaapi_gop_cache_submit_input_buffer;
+  trans_class->generate_output = gst_vaapi_gop_cache_generate_output;
+
+  klass->replay = gst_vaapi_gop_cache_replay;
+
+  gst_element_class_set_static_metadata (element_class,
+      "VA-API GOP cache", "Filter/Video", GST_PLUGIN_DESC,
+      "GStreamer VA-API developers");
+
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_vaapi_gop_cache_sink_factory);
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_vaapi_gop_cache_src_factory);
+
+  /**
+   * GstVaapiGopCache:max-size-bytes:
+   *
+   * The largest GOP to keep, in bytes. A longer GOP is not replayed.
+   */
+  g_properties[PROP_MAX_SIZE_BYTES] =
+      g_param_spec_uint64 ("max-size-bytes",
+      "Max size bytes",
+      "Largest GOP to keep, in bytes (0: unlimited)", 0, G_MAXUINT64,
+      DEFAULT_MAX_SIZE_BYTES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiGopCache:max-size-time:
+   *
+   * The longest GOP to keep, in nanoseconds. A longer GOP is not
+   * replayed.
+   */
+  g_properties[PROP_MAX_SIZE_TIME] =
+      g_param_spec_uint64 ("max-size-time",
+      "Max size time",
+      "Longest GOP to keep, in nanoseconds (0: unlimited)", 0, G_MAXUINT64,
+      DEFAULT_MAX_SIZE_TIME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES,
+      g_properties);
+
+  /**
+   * GstVaapiGopCache::replay:
+   * @object: the #GstVaapiGopCache instance
+   *
+   * Pushes the cached GOP, flagged decode-only, ahead of the next
+   * input buffer, e.g. right after switching to this channel. This
+   * signal can be emitted from any thread.
+   */
+  gst_vaapi_gop_cache_signals[REPLAY_SIGNAL] =
+      g_signal_new ("replay", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstVaapiGopCacheClass, replay), NULL, NULL, NULL,
+      G_TYPE_NONE, 0);
+}
+
+static void
+gst_vaapi_gop_cache_init (GstVaapiGopCache * cache)
+{
+  g_queue_init (&cache->gop);
+  g_queue_init (&cache->pending);
+  cache->max_size_bytes = DEFAULT_MAX_SIZE_BYTES;
+  cache->max_size_time = DEFAULT_MAX_SIZE_TIME;
+
+  /* caps and allocation queries go through unchanged */
+  gst_base_transform_set_passthrough (GST_BASE_TRANSFORM (cache), TRUE);
+}
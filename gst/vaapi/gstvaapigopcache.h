@@ -0,0 +1,77 @@
+/*
+ *  gstvaapigopcache.h - Keeps the latest GOP for fast channel changes
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_GOP_CACHE_H
+#define GST_VAAPI_GOP_CACHE_H
+
+#include <gst/base/gstbasetransform.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VAAPI_GOP_CACHE (gst_vaapi_gop_cache_get_type ())
+#define GST_VAAPI_GOP_CACHE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_VAAPI_GOP_CACHE, \
+      GstVaapiGopCache))
+#define GST_VAAPI_GOP_CACHE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_VAAPI_GOP_CACHE, \
+      GstVaapiGopCacheClass))
+#define GST_IS_VAAPI_GOP_CACHE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_VAAPI_GOP_CACHE))
+#define GST_IS_VAAPI_GOP_CACHE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_VAAPI_GOP_CACHE))
+#define GST_VAAPI_GOP_CACHE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_VAAPI_GOP_CACHE, \
+      GstVaapiGopCacheClass))
+
+typedef struct _GstVaapiGopCache GstVaapiGopCache;
+typedef struct _GstVaapiGopCacheClass GstVaapiGopCacheClass;
+
+struct _GstVaapiGopCache
+{
+  /*< private >*/
+  GstBaseTransform parent_instance;
+
+  /* the buffers since the last key unit, and their total size */
+  GQueue gop;
+  guint64 gop_bytes;
+  /* the buffers left to push for the current input buffer */
+  GQueue pending;
+  /* set from any thread, cleared by the streaming thread */
+  volatile gint replay;
+
+  /* properties */
+  guint64 max_size_bytes;
+  guint64 max_size_time;
+};
+
+struct _GstVaapiGopCacheClass
+{
+  /*< private >*/
+  GstBaseTransformClass parent_class;
+
+  /* action signals */
+  void (*replay) (GstVaapiGopCache * cache);
+};
+
+GType
+gst_vaapi_gop_cache_get_type (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_GOP_CACHE_H */
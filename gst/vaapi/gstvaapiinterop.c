@@ -0,0 +1,442 @@
+/*
+ *  gstvaapiinterop.c - Hands VA surfaces over to other GPU APIs
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:element-vaapiinterop
+ * @short_description: Processes VA surfaces with other GPU APIs
+ *
+ * vaapiinterop lets the application run its own GPU work, e.g. an
+ * OpenCL or oneAPI kernel, on the frames flowing between VA elements,
+ * without downloading them. The frames are processed in place: for
+ * each of them the #GstVaapiInterop::process-frame signal is emitted
+ * with a description the other API can import the frame from, either
+ * the VA display and surface, for cl_intel_va_api_media_sharing, or
+ * the DMA buffer and its plane layout, for the DMA buffer import
+ * extensions.
+ *
+ * The synchronization stays on the GPU when the kernel supports it
+ * (Linux 6.0). The handler gets a sync_file to wait for before it
+ * touches the frame, and may return another one, signaled when its
+ * own work is done, that is attached to the DMA buffer for the next
+ * VA element to wait for. Otherwise, the element waits on the CPU.
+ *
+ * ## Example launch line
+ *
+ * |[
+ * gst-launch-1.0 filesrc location=input.mp4 ! qtdemux ! h264parse \
+ *     ! vaapih264dec ! vaapiinterop ! vaapih264enc ! h264parse \
+ *     ! mp4mux ! filesink location=output.mp4
+ * ]|
+ */
+
+#include "gstcompat.h"
+#include <gst/allocators/allocators.h>
+#include <gst/vaapi/gstvaapidisplay.h>
+#include <gst/vaapi/gstvaapisurface_drm.h>
+
+#include "gstvaapiinterop.h"
+#include "gstvaapifencemeta.h"
+#include "gstvaapipluginutil.h"
+#include "gstvaapivideometa.h"
+#include "gstvaapivideomemory.h"
+
+#include <unistd.h>
+
+#define GST_PLUGIN_NAME "vaapiinterop"
+#define GST_PLUGIN_DESC "Hands VA surfaces over to other GPU APIs"
+
+GST_DEBUG_CATEGORY_STATIC (gst_debug_vaapi_interop);
+#ifndef GST_DISABLE_GST_DEBUG
+#define GST_CAT_DEFAULT gst_debug_vaapi_interop
+#else
+#define GST_CAT_DEFAULT NULL
+#endif
+
+/* *INDENT-OFF* */
+static const char gst_vaapi_interop_caps_str[] =
+  GST_VAAPI_MAKE_SURFACE_CAPS "; "
+  GST_VAAPI_MAKE_DMABUF_CAPS;
+/* *INDENT-ON* */
+
+/* *INDENT-OFF* */
+static GstStaticPadTemplate gst_vaapi_interop_sink_factory =
+  GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (gst_vaapi_interop_caps_str));
+/* *INDENT-ON* */
+
+/* *INDENT-OFF* */
+static GstStaticPadTemplate gst_vaapi_interop_src_factory =
+  GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (gst_vaapi_interop_caps_str));
+/* *INDENT-ON* */
+
+enum
+{
+  PROCESS_FRAME_SIGNAL,
+  LAST_SIGNAL
+};
+
+static guint gst_vaapi_interop_signals[LAST_SIGNAL] = { 0 };
+
+enum
+{
+  PROP_0,
+  PROP_EXPORT_FENCE,
+  N_PROPERTIES
+};
+
+static GParamSpec *g_properties[N_PROPERTIES] = { NULL, };
+
+#define DEFAULT_EXPORT_FENCE TRUE
+
+G_DEFINE_TYPE (GstVaapiInterop, gst_vaapi_interop, GST_TYPE_BASE_TRANSFORM);
+
+/* Describes the DMA buffer of a VA surface, exporting it if needed */
+static gboolean
+describe_surface (GstVaapiInterop * interop, GstBuffer * buffer,
+    GstStructure * frame, gint * dmabuf_fd)
+{
+  GstVaapiVideoMeta *const meta = gst_buffer_get_vaapi_video_meta (buffer);
+  GstVaapiSurfaceProxy *proxy;
+  GstVaapiSurface *surface;
+  GstVaapiBufferProxy *dmabuf_proxy;
+  gchar name[16];
+  gsize offset;
+  gint stride;
+  guint i, n_planes;
+
+  if (!meta)
+    return FALSE;
+  proxy = gst_vaapi_video_meta_get_surface_proxy (meta);
+  if (!proxy)
+    return FALSE;
+  surface = GST_VAAPI_SURFACE_PROXY_SURFACE (proxy);
+
+  gst_structure_set (frame,
+      "va-display", G_TYPE_POINTER,
+      gst_vaapi_display_get_display (GST_VAAPI_SURFACE_DISPLAY (surface)),
+      "va-surface", G_TYPE_UINT, (guint) GST_VAAPI_SURFACE_ID (surface),
+      NULL);
+
+  dmabuf_proxy = gst_vaapi_surface_peek_dma_buf_handle (surface);
+  n_planes = dmabuf_proxy ?
+      gst_vaapi_buffer_proxy_get_num_planes (dmabuf_proxy) : 0;
+  if (n_planes == 0) {
+    GST_DEBUG_OBJECT (interop, "surface %" GST_VAAPI_ID_FORMAT
+        " cannot be exported", GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID
+            (surface)));
+    return TRUE;
+  }
+
+  *dmabuf_fd = gst_vaapi_buffer_proxy_get_handle (dmabuf_proxy);
+  gst_structure_set (frame,
+      "fd", G_TYPE_INT, *dmabuf_fd,
+      "size", G_TYPE_UINT64,
+      (guint64) gst_vaapi_buffer_proxy_get_size (dmabuf_proxy),
+      "modifier", G_TYPE_UINT64,
+      gst_vaapi_buffer_proxy_get_modifier (dmabuf_proxy),
+      "n-planes", G_TYPE_UINT, n_planes, NULL);
+  for (i = 0; i < n_planes; i++) {
+    gst_vaapi_buffer_proxy_get_plane (dmabuf_proxy, i, &offset, &stride);
+    g_snprintf (name, sizeof (name), "offset-%u", i);
+    gst_structure_set (frame, name, G_TYPE_UINT64, (guint64) offset, NULL);
+    g_snprintf (name, sizeof (name), "stride-%u", i);
+    gst_structure_set (frame, name, G_TYPE_INT, stride, NULL);
+  }
+  return TRUE;
+}
+
+/* Describes a buffer negotiated as DMA buffer memory */
+static gboolean
+describe_dmabuf (GstVaapiInterop * interop, GstBuffer * buffer,
+    GstStructure * frame, gint * dmabuf_fd)
+{
+  GstMemory *const mem = gst_buffer_peek_memory (buffer, 0);
+  GstVideoMeta *const vmeta = gst_buffer_get_video_meta (buffer);
+  const GstVideoInfo *const vip = &interop->info;
+  gchar name[16];
+  guint i, n_planes;
+
+  if (gst_buffer_n_memory (buffer) != 1 || !gst_is_dmabuf_memory (mem))
+    return FALSE;
+
+  n_planes = vmeta ? vmeta->n_planes : GST_VIDEO_INFO_N_PLANES (vip);
+  *dmabuf_fd = gst_dmabuf_memory_get_fd (mem);
+  gst_structure_set (frame,
+      "fd", G_TYPE_INT, *dmabuf_fd,
+      "size", G_TYPE_UINT64, (guint64) gst_memory_get_sizes (mem, NULL, NULL),
+      "modifier", G_TYPE_UINT64, (guint64) GST_VAAPI_DRM_FORMAT_MOD_INVALID,
+      "n-planes", G_TYPE_UINT, n_planes, NULL);
+  for (i = 0; i < n_planes; i++) {
+    g_snprintf (name, sizeof (name), "offset-%u", i);
+    gst_structure_set (frame, name, G_TYPE_UINT64, (guint64) (vmeta ?
+            vmeta->offset[i] : GST_VIDEO_INFO_PLANE_OFFSET (vip, i)), NULL);
+    g_snprintf (name, sizeof (name), "stride-%u", i);
+    gst_structure_set (frame, name, G_TYPE_INT, vmeta ? vmeta->stride[i] :
+        GST_VIDEO_INFO_PLANE_STRIDE (vip, i), NULL);
+  }
+  return TRUE;
+}
+
+/* Returns a fence of the pending GPU accesses to the frame, for the
+   handler to wait for, or -1 once they are done */
+static gint
+prepare_frame (GstVaapiInterop * interop, GstBuffer * buffer, gint dmabuf_fd)
+{
+  GstVaapiFenceMeta *const fence_meta =
+      gst_buffer_get_vaapi_fence_meta (buffer);
+  GstVaapiVideoMeta *const meta = gst_buffer_get_vaapi_video_meta (buffer);
+  GstVaapiSurfaceProxy *proxy;
+  gint fence_fd;
+
+  if (interop->export_fence && dmabuf_fd >= 0) {
+    fence_fd = gst_vaapi_dma_buf_export_fence (dmabuf_fd, TRUE);
+    if (fence_fd >= 0)
+      return fence_fd;
+  }
+
+  if (fence_meta) {
+    if (interop->export_fence)
+      return dup (fence_meta->fd);
+    gst_vaapi_fence_meta_wait (fence_meta);
+  }
+
+  proxy = meta ? gst_vaapi_video_meta_get_surface_proxy (meta) : NULL;
+  if (proxy)
+    gst_vaapi_surface_sync (GST_VAAPI_SURFACE_PROXY_SURFACE (proxy));
+  return -1;
+}
+
+/* Hands the fence of the handler work over to the next GPU users of
+   the frame, taking ownership of @done_fd */
+static void
+finish_frame (GstVaapiInterop * interop, GstBuffer * buffer, gint dmabuf_fd,
+    gint done_fd)
+{
+  GstVaapiFenceMeta *const fence_meta =
+      gst_buffer_get_vaapi_fence_meta (buffer);
+  gboolean imported = FALSE;
+
+  /* the fence upstream attached is stale from now on */
+  if (fence_meta)
+    gst_buffer_remove_meta (buffer, (GstMeta *) fence_meta);
+
+  if (done_fd < 0)
+    return;
+
+  if (dmabuf_fd >= 0)
+    imported = gst_vaapi_dma_buf_import_fence (dmabuf_fd, done_fd);
+  if (!imported) {
+    GST_LOG_OBJECT (interop, "waiting for the frame processing");
+    gst_vaapi_fence_wait (done_fd);
+  } else if (fence_meta) {
+    /* downstream handles fences: let it wait instead of the driver */
+    gst_buffer_add_vaapi_fence_meta (buffer, done_fd);
+    return;
+  }
+  close (done_fd);
+}
+
+static GstFlowReturn
+gst_vaapi_interop_transform_ip (GstBaseTransform * trans, GstBuffer * buffer)
+{
+  GstVaapiInterop *const interop = GST_VAAPI_INTEROP (trans);
+  const GstVideoInfo *const vip = &interop->info;
+  GstStructure *frame;
+  gint dmabuf_fd = -1, fence_fd, done_fd = -1;
+  gboolean described, success = FALSE;
+
+  if (!g_signal_has_handler_pending (interop,
+          gst_vaapi_interop_signals[PROCESS_FRAME_SIGNAL], 0, TRUE))
+    return GST_FLOW_OK;
+
+  frame = gst_structure_new ("GstVaapiInteropFrame",
+      "format", G_TYPE_STRING,
+      gst_video_format_to_string (GST_VIDEO_INFO_FORMAT (vip)),
+      "width", G_TYPE_INT, GST_VIDEO_INFO_WIDTH (vip),
+      "height", G_TYPE_INT, GST_VIDEO_INFO_HEIGHT (vip),
+      "pts", G_TYPE_UINT64, GST_BUFFER_PTS (buffer), NULL);
+
+  if (interop->is_dmabuf)
+    described = describe_dmabuf (interop, buffer, frame, &dmabuf_fd);
+  else
+    described = describe_surface (interop, buffer, frame, &dmabuf_fd);
+  if (!described)
+    goto error_invalid_buffer;
+
+  fence_fd = prepare_frame (interop, buffer, dmabuf_fd);
+  gst_structure_set (frame, "fence-fd", G_TYPE_INT, fence_fd, NULL);
+
+  g_signal_emit (interop, gst_vaapi_interop_signals[PROCESS_FRAME_SIGNAL], 0,
+      buffer, frame, &success);
+
+  if (fence_fd >= 0)
+    close (fence_fd);
+  gst_structure_get_int (frame, "done-fence-fd", &done_fd);
+  gst_structure_free (frame);
+
+  finish_frame (interop, buffer, dmabuf_fd, done_fd);
+  if (!success)
+    goto error_process_frame;
+  return GST_FLOW_OK;
+
+  /* ERRORS */
+error_invalid_buffer:
+  {
+    gst_structure_free (frame);
+    GST_ELEMENT_ERROR (interop, STREAM, FAILED,
+        ("Received a buffer without VA surface or DMA buffer."), (NULL));
+    return GST_FLOW_ERROR;
+  }
+error_process_frame:
+  {
+    GST_ELEMENT_ERROR (interop, STREAM, FAILED,
+        ("Failed to process the frame."), (NULL));
+    return GST_FLOW_ERROR;
+  }
+}
+
+static gboolean
+gst_vaapi_interop_set_caps (GstBaseTransform * trans, GstCaps * caps,
+    GstCaps * out_caps)
+{
+  GstVaapiInterop *const interop = GST_VAAPI_INTEROP (trans);
+
+  if (!gst_video_info_from_caps (&interop->info, caps))
+    return FALSE;
+  interop->is_dmabuf = gst_caps_features_contains (gst_caps_get_features (caps,
+          0), GST_CAPS_FEATURE_MEMORY_DMABUF);
+  return TRUE;
+}
+
+static void
+gst_vaapi_interop_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiInterop *const interop = GST_VAAPI_INTEROP (object);
+
+  switch (prop_id) {
+    case PROP_EXPORT_FENCE:
+      interop->export_fence = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_interop_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiInterop *const interop = GST_VAAPI_INTEROP (object);
+
+  switch (prop_id) {
+    case PROP_EXPORT_FENCE:
+      g_value_set_boolean (value, interop->export_fence);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_interop_class_init (GstVaapiInteropClass * klass)
+{
+  GObjectClass *const object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *const element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *const trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_debug_vaapi_interop,
+      GST_PLUGIN_NAME, 0, GST_PLUGIN_DESC);
+
+  object_class->set_property = gst_vaapi_interop_set_property;
+  object_class->get_property = gst_vaapi_interop_get_property;
+
+  trans_class->set_caps = gst_vaapi_interop_set_caps;
+  trans_class->transform_ip = gst_vaapi_interop_transform_ip;
+
+  gst_element_class_set_static_metadata (element_class,
+      "VA-API interop", "Filter/Video/Hardware", GST_PLUGIN_DESC,
+      "GStreamer VA-API developers");
+
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_vaapi_interop_sink_factory);
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_vaapi_interop_src_factory);
+
+  /**
+   * GstVaapiInterop:export-fence:
+   *
+   * Hands the handler a fence of the pending VA work on the frame, in
+   * the "fence-fd" field, instead of waiting for that work before
+   * emitting #GstVaapiInterop::process-frame.
+   */
+  g_properties[PROP_EXPORT_FENCE] =
+      g_param_spec_boolean ("export-fence",
+      "Export fence",
+      "Hand a fence of the pending VA work over to the handler instead of "
+      "waiting for it", DEFAULT_EXPORT_FENCE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES,
+      g_properties);
+
+  /**
+   * GstVaapiInterop::process-frame:
+   * @object: the #GstVaapiInterop instance
+   * @buffer: the frame to process in place
+   * @frame: the description of @buffer, a #GstStructure
+   *
+   * This signal gets emitted from the streaming thread for each frame.
+   * @frame holds "format", "width", "height" and "pts". For VA
+   * surfaces, it also holds the #VADisplay in "va-display" and the
+   * #VASurfaceID in "va-surface". When the frame is backed by a DMA
+   * buffer, it holds its descriptor in "fd", its "size", its DRM
+   * "modifier" and, for each of the "n-planes" planes, "offset-N" and
+   * "stride-N". The descriptors are only valid during the emission.
+   *
+   * "fence-fd" is a sync_file to wait for before accessing the frame,
+   * or -1. The handler can set "done-fence-fd" to a sync_file that is
+   * signaled once its own work is done, whose ownership it transfers.
+   * Otherwise, the work has to be completed before returning.
+   *
+   * Returns: %TRUE on success, %FALSE to stop the stream with an error
+   */
+  gst_vaapi_interop_signals[PROCESS_FRAME_SIGNAL] =
+      g_signal_new ("process-frame", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, g_cclosure_marshal_generic,
+      G_TYPE_BOOLEAN, 2, GST_TYPE_BUFFER | G_SIGNAL_TYPE_STATIC_SCOPE,
+      GST_TYPE_STRUCTURE | G_SIGNAL_TYPE_STATIC_SCOPE);
+}
+
+static void
+gst_vaapi_interop_init (GstVaapiInterop * interop)
+{
+  gst_video_info_init (&interop->info);
+  interop->export_fence = DEFAULT_EXPORT_FENCE;
+
+  /* the frames are modified by the GPU, never by the CPU */
+  gst_base_transform_set_in_place (GST_BASE_TRANSFORM (interop), TRUE);
+}
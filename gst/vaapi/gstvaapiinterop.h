@@ -0,0 +1,69 @@
+/*
+ *  gstvaapiinterop.h - Hands VA surfaces over to other GPU APIs
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_INTEROP_H
+#define GST_VAAPI_INTEROP_H
+
+#include <gst/base/gstbasetransform.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VAAPI_INTEROP (gst_vaapi_interop_get_type ())
+#define GST_VAAPI_INTEROP(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_VAAPI_INTEROP, \
+      GstVaapiInterop))
+#define GST_VAAPI_INTEROP_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_VAAPI_INTEROP, \
+      GstVaapiInteropClass))
+#define GST_IS_VAAPI_INTEROP(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_VAAPI_INTEROP))
+#define GST_IS_VAAPI_INTEROP_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_VAAPI_INTEROP))
+#define GST_VAAPI_INTEROP_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_VAAPI_INTEROP, \
+      GstVaapiInteropClass))
+
+typedef struct _GstVaapiInterop GstVaapiInterop;
+typedef struct _GstVaapiInteropClass GstVaapiInteropClass;
+
+struct _GstVaapiInterop
+{
+  /*< private >*/
+  GstBaseTransform parent_instance;
+
+  GstVideoInfo info;
+  guint is_dmabuf:1;
+
+  /* properties */
+  gboolean export_fence;
+};
+
+struct _GstVaapiInteropClass
+{
+  /*< private >*/
+  GstBaseTransformClass parent_class;
+};
+
+GType
+gst_vaapi_interop_get_type (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_INTEROP_H */
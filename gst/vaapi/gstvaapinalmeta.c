@@ -0,0 +1,143 @@
+/*
+ *  gstvaapinalmeta.c - Layout of the NAL units of encoded buffers
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#include "gstcompat.h"
+#include "gstvaapinalmeta.h"
+
+static gboolean
+gst_vaapi_nal_meta_init (GstVaapiNalMeta * meta, gpointer params,
+    GstBuffer * buffer)
+{
+  meta->units = g_array_new (FALSE, FALSE, sizeof (GstVaapiNalUnit));
+  return TRUE;
+}
+
+static void
+gst_vaapi_nal_meta_free (GstVaapiNalMeta * meta, GstBuffer * buffer)
+{
+  g_clear_pointer (&meta->units, g_array_unref);
+}
+
+/* Copies keep the NAL units that lie fully in the copied region, with
+   their offsets relative to it */
+static gboolean
+gst_vaapi_nal_meta_transform (GstBuffer * dst_buffer, GstMeta * meta,
+    GstBuffer * src_buffer, GQuark type, gpointer data)
+{
+  GstVaapiNalMeta *const src_meta = (GstVaapiNalMeta *) meta;
+  GstMetaTransformCopy *const copy = data;
+  GstVaapiNalMeta *dst_meta;
+  gsize start = 0, end = G_MAXSIZE;
+  guint i;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  if (copy->region) {
+    start = copy->offset;
+    if (copy->size != (gsize) - 1)
+      end = copy->offset + copy->size;
+  }
+
+  dst_meta = gst_buffer_add_vaapi_nal_meta (dst_buffer);
+  if (!dst_meta)
+    return FALSE;
+
+  for (i = 0; i < src_meta->units->len; i++) {
+    const GstVaapiNalUnit *const unit =
+        &g_array_index (src_meta->units, GstVaapiNalUnit, i);
+
+    if (unit->offset < start || unit->offset + unit->size > end)
+      continue;
+    gst_vaapi_nal_meta_add_unit (dst_meta, unit->offset - start, unit->size,
+        unit->type);
+  }
+  return TRUE;
+}
+
+GType
+gst_vaapi_nal_meta_api_get_type (void)
+{
+  static gsize g_type;
+  static const gchar *tags[] = { "video", NULL };
+
+  if (g_once_init_enter (&g_type)) {
+    GType type = gst_meta_api_type_register ("GstVaapiNalMetaAPI", tags);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
+#define GST_VAAPI_NAL_META_INFO gst_vaapi_nal_meta_info_get ()
+static const GstMetaInfo *
+gst_vaapi_nal_meta_info_get (void)
+{
+  static gsize g_meta_info;
+
+  if (g_once_init_enter (&g_meta_info)) {
+    gsize meta_info =
+        GPOINTER_TO_SIZE (gst_meta_register (GST_VAAPI_NAL_META_API_TYPE,
+            "GstVaapiNalMeta", sizeof (GstVaapiNalMeta),
+            (GstMetaInitFunction) gst_vaapi_nal_meta_init,
+            (GstMetaFreeFunction) gst_vaapi_nal_meta_free,
+            (GstMetaTransformFunction) gst_vaapi_nal_meta_transform));
+    g_once_init_leave (&g_meta_info, meta_info);
+  }
+  return GSIZE_TO_POINTER (g_meta_info);
+}
+
+/**
+ * gst_buffer_add_vaapi_nal_meta:
+ * @buffer: a #GstBuffer
+ *
+ * Attaches an empty list of NAL units to @buffer.
+ *
+ * Returns: the #GstVaapiNalMeta, or %NULL on error
+ */
+GstVaapiNalMeta *
+gst_buffer_add_vaapi_nal_meta (GstBuffer * buffer)
+{
+  g_return_val_if_fail (GST_IS_BUFFER (buffer), NULL);
+
+  return (GstVaapiNalMeta *) gst_buffer_add_meta (buffer,
+      GST_VAAPI_NAL_META_INFO, NULL);
+}
+
+/**
+ * gst_vaapi_nal_meta_add_unit:
+ * @meta: a #GstVaapiNalMeta
+ * @offset: the offset of the NAL unit header in the buffer
+ * @size: the size of the NAL unit
+ * @type: the nal_unit_type of the NAL unit
+ *
+ * Appends a NAL unit to the list of @meta.
+ */
+void
+gst_vaapi_nal_meta_add_unit (GstVaapiNalMeta * meta, guint32 offset,
+    guint32 size, guint8 type)
+{
+  GstVaapiNalUnit unit;
+
+  g_return_if_fail (meta != NULL);
+
+  unit.offset = offset;
+  unit.size = size;
+  unit.type = type;
+  g_array_append_val (meta->units, unit);
+}
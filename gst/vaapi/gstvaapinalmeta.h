@@ -0,0 +1,83 @@
+/*
+ *  gstvaapinalmeta.h - Layout of the NAL units of encoded buffers
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_NAL_META_H
+#define GST_VAAPI_NAL_META_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GstVaapiNalUnit GstVaapiNalUnit;
+typedef struct _GstVaapiNalMeta GstVaapiNalMeta;
+
+/**
+ * GstVaapiNalUnit:
+ * @offset: the offset of the NAL unit header in the buffer, past its
+ *   start code or length prefix
+ * @size: the size of the NAL unit, without its start code or length
+ *   prefix
+ * @type: the nal_unit_type of the NAL unit
+ */
+struct _GstVaapiNalUnit
+{
+  guint32 offset;
+  guint32 size;
+  guint8 type;
+};
+
+/**
+ * GstVaapiNalMeta:
+ * @units: (element-type GstVaapiNalUnit): the NAL units of the buffer,
+ *   in bitstream order
+ *
+ * Lists the NAL units of an H.264 or H.265 encoded buffer, so that
+ * parsers and payloaders can split it without scanning for the start
+ * codes again. The offsets are the same in the byte-stream and in
+ * the avc or hvc1 formats, as the encoders use 4-byte start codes.
+ */
+struct _GstVaapiNalMeta
+{
+  GstMeta meta;
+  GArray *units;
+};
+
+#define GST_VAAPI_NAL_META_API_TYPE \
+  gst_vaapi_nal_meta_api_get_type ()
+
+#define gst_buffer_get_vaapi_nal_meta(buffer) \
+  ((GstVaapiNalMeta *) gst_buffer_get_meta ((buffer), \
+      GST_VAAPI_NAL_META_API_TYPE))
+
+G_GNUC_INTERNAL
+GType
+gst_vaapi_nal_meta_api_get_type (void) G_GNUC_CONST;
+
+G_GNUC_INTERNAL
+GstVaapiNalMeta *
+gst_buffer_add_vaapi_nal_meta (GstBuffer * buffer);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_nal_meta_add_unit (GstVaapiNalMeta * meta, guint32 offset,
+    guint32 size, guint8 type);
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_NAL_META_H */
@@ -39,6 +39,20 @@
  *     ! vaapioverlay sink_1::xpos=300 sink_1::alpha=0.75 \
  *     name=overlay ! vaapisink testsrc. ! queue ! overlay.
  * ]|
+ *
+ * Setting #GstVaapiOverlay:columns lays the streams out in a grid
+ * instead, for video walls: every sink pad is scaled into its own
+ * tile, in the order the pads were requested, and all of them are
+ * blended in a single pass per output frame. A single vaapisink then
+ * presents the whole wall, sharing one VA display with the decoders.
+ *
+ * |[
+ *   gst-launch-1.0 vaapioverlay name=wall columns=2 ! vaapisink    \
+ *     filesrc location=a.mp4 ! parsebin ! vaapih264dec ! wall.     \
+ *     filesrc location=b.mp4 ! parsebin ! vaapih264dec ! wall.     \
+ *     filesrc location=c.mp4 ! parsebin ! vaapih264dec ! wall.     \
+ *     filesrc location=d.mp4 ! parsebin ! vaapih264dec ! wall.
+ * ]|
  */
 
 #include "gstvaapioverlay.h"
@@ -90,15 +104,41 @@ G_DEFINE_TYPE (GstVaapiOverlaySinkPad, gst_vaapi_overlay_sink_pad,
 typedef struct _GstVaapiOverlaySurfaceGenerator GstVaapiOverlaySurfaceGenerator;
 struct _GstVaapiOverlaySurfaceGenerator
 {
-  GstVaapiOverlay *overlay;
-  GList *current;
+  GPtrArray *surfaces;
+  guint index;
+};
+
+typedef struct _GstVaapiOverlayLayer GstVaapiOverlayLayer;
+struct _GstVaapiOverlayLayer
+{
+  GstVaapiOverlaySinkPad *pad;
+  GstBuffer *inbuf;
   GstVaapiBlendSurface blend_surface;
+  gboolean geometry_changed;
+  gboolean content_changed;
+  gboolean candidate;
 };
 
+/* Number of output frames a layer has to stay unchanged before it is
+ * composed into the canvas */
+#define STATIC_LAYER_FRAMES 4
+
 #define DEFAULT_PAD_XPOS   0
 #define DEFAULT_PAD_YPOS   0
 #define DEFAULT_PAD_ALPHA  1.0
 
+#define DEFAULT_COLUMNS      0
+#define DEFAULT_TILE_WIDTH   0
+#define DEFAULT_TILE_HEIGHT  0
+
+enum
+{
+  PROP_0,
+  PROP_COLUMNS,
+  PROP_TILE_WIDTH,
+  PROP_TILE_HEIGHT,
+};
+
 enum
 {
   PROP_PAD_0,
@@ -151,9 +191,22 @@ gst_vaapi_overlay_sink_pad_set_property (GObject * object, guint prop_id,
   }
 }
 
+static void
+gst_vaapi_overlay_sink_pad_reset_layer (GstVaapiOverlaySinkPad * pad)
+{
+  gst_buffer_replace (&pad->composed_buffer, NULL);
+  pad->static_geometry = 0;
+  pad->static_content = 0;
+  pad->cached = FALSE;
+  pad->refreshable = FALSE;
+  gst_buffer_replace (&pad->converted_buffer, NULL);
+  gst_mini_object_replace ((GstMiniObject **) & pad->converted_surface, NULL);
+}
+
 static void
 gst_vaapi_overlay_sink_pad_finalize (GObject * object)
 {
+  gst_vaapi_overlay_sink_pad_reset_layer (GST_VAAPI_OVERLAY_SINK_PAD (object));
   gst_vaapi_pad_private_finalize (GST_VAAPI_OVERLAY_SINK_PAD (object)->priv);
 
   G_OBJECT_CLASS (gst_vaapi_overlay_sink_pad_parent_class)->finalize (object);
@@ -230,6 +283,102 @@ gst_vaapi_overlay_release_pad (GstElement * element, GstPad * pad)
       pad);
 }
 
+static void
+gst_vaapi_overlay_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiOverlay *const overlay = GST_VAAPI_OVERLAY (object);
+
+  GST_OBJECT_LOCK (overlay);
+  switch (prop_id) {
+    case PROP_COLUMNS:
+      overlay->columns = g_value_get_uint (value);
+      break;
+    case PROP_TILE_WIDTH:
+      overlay->tile_width = g_value_get_uint (value);
+      break;
+    case PROP_TILE_HEIGHT:
+      overlay->tile_height = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (overlay);
+
+  /* the output size follows the grid */
+  gst_pad_mark_reconfigure (GST_AGGREGATOR_SRC_PAD (overlay));
+}
+
+static void
+gst_vaapi_overlay_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiOverlay *const overlay = GST_VAAPI_OVERLAY (object);
+
+  GST_OBJECT_LOCK (overlay);
+  switch (prop_id) {
+    case PROP_COLUMNS:
+      g_value_set_uint (value, overlay->columns);
+      break;
+    case PROP_TILE_WIDTH:
+      g_value_set_uint (value, overlay->tile_width);
+      break;
+    case PROP_TILE_HEIGHT:
+      g_value_set_uint (value, overlay->tile_height);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (overlay);
+}
+
+/* Number of grid rows needed for all the sink pads. Must be called with
+ * the object lock held */
+static guint
+gst_vaapi_overlay_get_rows (GstVaapiOverlay * overlay)
+{
+  const guint n_pads = GST_ELEMENT (overlay)->numsinkpads;
+
+  return MAX ((n_pads + overlay->columns - 1) / overlay->columns, 1);
+}
+
+/* Fits a picture described by @vip into the grid tile @index of the
+ * output, keeping its display aspect ratio. Must be called with the
+ * object lock held */
+static void
+gst_vaapi_overlay_get_tile_target (GstVaapiOverlay * overlay, guint index,
+    const GstVideoInfo * vip, GstVaapiRectangle * target)
+{
+  GstVideoInfo *const out_vip = GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (overlay);
+  GstVideoRectangle src_rect, tile_rect, rect;
+  guint tile_width, tile_height;
+
+  tile_width = GST_VIDEO_INFO_WIDTH (out_vip) / overlay->columns;
+  tile_height = GST_VIDEO_INFO_HEIGHT (out_vip) /
+      gst_vaapi_overlay_get_rows (overlay);
+
+  src_rect.x = src_rect.y = 0;
+  src_rect.w = GST_VIDEO_INFO_WIDTH (vip);
+  src_rect.h = GST_VIDEO_INFO_HEIGHT (vip);
+  if (GST_VIDEO_INFO_PAR_N (vip) > 0 && GST_VIDEO_INFO_PAR_D (vip) > 0)
+    src_rect.w = gst_util_uint64_scale_int (src_rect.w,
+        GST_VIDEO_INFO_PAR_N (vip), GST_VIDEO_INFO_PAR_D (vip));
+
+  tile_rect.x = (index % overlay->columns) * tile_width;
+  tile_rect.y = (index / overlay->columns) * tile_height;
+  tile_rect.w = tile_width;
+  tile_rect.h = tile_height;
+
+  gst_video_sink_center_rect (src_rect, tile_rect, &rect, TRUE);
+
+  target->x = rect.x;
+  target->y = rect.y;
+  target->width = rect.w;
+  target->height = rect.h;
+}
+
 static inline gboolean
 gst_vaapi_overlay_ensure_display (GstVaapiOverlay * overlay)
 {
@@ -305,6 +454,7 @@ static gboolean
 _reset_sinkpad_private (GstElement * element, GstPad * pad, gpointer user_data)
 {
   gst_vaapi_pad_private_reset (GST_VAAPI_OVERLAY_SINK_PAD (pad)->priv);
+  gst_vaapi_overlay_sink_pad_reset_layer (GST_VAAPI_OVERLAY_SINK_PAD (pad));
 
   return TRUE;
 }
@@ -314,6 +464,8 @@ gst_vaapi_overlay_stop (GstAggregator * agg)
 {
   GstVaapiOverlay *const overlay = GST_VAAPI_OVERLAY (agg);
 
+  gst_vaapi_surface_proxy_replace (&overlay->canvas, NULL);
+  overlay->canvas_layers = 0;
   gst_vaapi_video_pool_replace (&overlay->blend_pool, NULL);
   gst_vaapi_blend_replace (&overlay->blend, NULL);
 
@@ -339,6 +491,8 @@ gst_vaapi_overlay_finalize (GObject * object)
   GstVaapiOverlay *const overlay = GST_VAAPI_OVERLAY (object);
 
   gst_vaapi_overlay_destroy (overlay);
+  g_array_unref (overlay->layers);
+  g_ptr_array_unref (overlay->blend_surfaces);
   gst_vaapi_plugin_base_finalize (GST_VAAPI_PLUGIN_BASE (overlay));
 
   G_OBJECT_CLASS (gst_vaapi_overlay_parent_class)->finalize (object);
@@ -359,61 +513,445 @@ gst_vaapi_overlay_decide_allocation (GstAggregator * agg, GstQuery * query)
       (GST_VAAPI_PLUGIN_BASE (agg), query);
 }
 
+static void
+gst_vaapi_overlay_layer_clear (GstVaapiOverlayLayer * layer)
+{
+  gst_buffer_replace (&layer->inbuf, NULL);
+}
+
+static inline gboolean
+rect_overlaps (const GstVaapiRectangle * a, const GstVaapiRectangle * b)
+{
+  return (gint) a->x < (gint) (b->x + b->width)
+      && (gint) b->x < (gint) (a->x + a->width)
+      && (gint) a->y < (gint) (b->y + b->height)
+      && (gint) b->y < (gint) (a->y + a->height);
+}
+
+static inline gboolean
+rect_equals (const GstVaapiRectangle * a, const GstVaapiRectangle * b)
+{
+  return a->x == b->x && a->y == b->y && a->width == b->width
+      && a->height == b->height;
+}
+
 static GstVaapiBlendSurface *
 gst_vaapi_overlay_surface_next (gpointer data)
 {
-  GstVaapiOverlaySurfaceGenerator *generator;
-  GstVideoAggregatorPad *vagg_pad;
-  GstVaapiOverlaySinkPad *pad;
-  GstVideoFrame *inframe;
-  GstBuffer *inbuf;
-  GstBuffer *buf;
-  GstVaapiVideoMeta *inbuf_meta;
-  GstVaapiBlendSurface *blend_surface;
-
-  generator = (GstVaapiOverlaySurfaceGenerator *) data;
+  GstVaapiOverlaySurfaceGenerator *const generator = data;
 
   /* at the end of the generator? */
-  while (generator->current) {
-    /* get the current video aggregator sinkpad */
-    vagg_pad = GST_VIDEO_AGGREGATOR_PAD (generator->current->data);
+  if (generator->index >= generator->surfaces->len)
+    return NULL;
+  return g_ptr_array_index (generator->surfaces, generator->index++);
+}
 
-    /* increment list pointer */
-    generator->current = generator->current->next;
+/* Records the layer of every sink pad holding a buffer and compares it
+ * with what was composed into the previous output frame */
+static void
+gst_vaapi_overlay_collect_layers (GstVaapiOverlay * overlay)
+{
+  GArray *const layers = overlay->layers;
+  GList *l;
+  guint index = 0;
+
+  g_array_set_size (layers, 0);
 
-    /* recycle the blend surface from the overlay surface generator */
-    blend_surface = &generator->blend_surface;
-    blend_surface->surface = NULL;
+  GST_OBJECT_LOCK (overlay);
+  for (l = GST_ELEMENT (overlay)->sinkpads; l; l = l->next, index++) {
+    GstVideoAggregatorPad *const vagg_pad = l->data;
+    GstVaapiOverlaySinkPad *const pad = GST_VAAPI_OVERLAY_SINK_PAD (vagg_pad);
+    GstVideoFrame *inframe;
+    GstBuffer *buf;
+    GstVaapiOverlayLayer *layer;
+    GstVaapiRectangle target;
 
     /* Current sinkpad may not be queueing buffers yet (e.g. timestamp-offset)
      * or it may have reached EOS */
-    if (!gst_video_aggregator_pad_has_current_buffer (vagg_pad))
+    if (!gst_video_aggregator_pad_has_current_buffer (vagg_pad)) {
+      gst_vaapi_overlay_sink_pad_reset_layer (pad);
       continue;
+    }
 
     inframe = gst_video_aggregator_pad_get_prepared_frame (vagg_pad);
     buf = gst_video_aggregator_pad_get_current_buffer (vagg_pad);
-    pad = GST_VAAPI_OVERLAY_SINK_PAD (vagg_pad);
-
-    if (gst_vaapi_plugin_base_pad_get_input_buffer (GST_VAAPI_PLUGIN_BASE
-            (generator->overlay), GST_PAD (pad), buf, &inbuf) != GST_FLOW_OK)
-      return blend_surface;
-
-    inbuf_meta = gst_buffer_get_vaapi_video_meta (inbuf);
-    if (inbuf_meta) {
-      blend_surface->surface = gst_vaapi_video_meta_get_surface (inbuf_meta);
-      blend_surface->crop = gst_vaapi_video_meta_get_render_rect (inbuf_meta);
-      blend_surface->target.x = pad->xpos;
-      blend_surface->target.y = pad->ypos;
-      blend_surface->target.width = GST_VIDEO_FRAME_WIDTH (inframe);
-      blend_surface->target.height = GST_VIDEO_FRAME_HEIGHT (inframe);
-      blend_surface->alpha = pad->alpha;
+
+    if (overlay->columns > 0) {
+      gst_vaapi_overlay_get_tile_target (overlay, index, &inframe->info,
+          &target);
+    } else {
+      target.x = pad->xpos;
+      target.y = pad->ypos;
+      target.width = GST_VIDEO_FRAME_WIDTH (inframe);
+      target.height = GST_VIDEO_FRAME_HEIGHT (inframe);
+    }
+
+    g_array_set_size (layers, layers->len + 1);
+    layer = &g_array_index (layers, GstVaapiOverlayLayer, layers->len - 1);
+    layer->pad = pad;
+    layer->blend_surface.target = target;
+    layer->blend_surface.alpha = pad->alpha;
+    layer->geometry_changed = !pad->composed_buffer
+        || !rect_equals (&target, &pad->composed_target)
+        || pad->alpha != pad->composed_alpha;
+    /* composed_buffer keeps the previous buffer alive, so that a new
+     * buffer can't be recycled at the same address */
+    layer->content_changed = buf != pad->composed_buffer;
+
+    if (layer->geometry_changed)
+      pad->static_geometry = 0;
+    else if (pad->static_geometry < STATIC_LAYER_FRAMES)
+      pad->static_geometry++;
+    if (layer->content_changed)
+      pad->static_content = 0;
+    else if (pad->static_content < STATIC_LAYER_FRAMES)
+      pad->static_content++;
+
+    gst_buffer_replace (&pad->composed_buffer, buf);
+    pad->composed_target = target;
+    pad->composed_alpha = pad->alpha;
+  }
+  GST_OBJECT_UNLOCK (overlay);
+}
+
+/* Checks whether the canvas still matches the layers composed into
+ * it, and whether it can still be blended below all the other layers */
+static gboolean
+gst_vaapi_overlay_canvas_is_valid (GstVaapiOverlay * overlay)
+{
+  GArray *const layers = overlay->layers;
+  guint i, j, n_cached = 0;
+
+  if (!overlay->canvas)
+    return FALSE;
+
+  for (i = 0; i < layers->len; i++) {
+    GstVaapiOverlayLayer *const layer =
+        &g_array_index (layers, GstVaapiOverlayLayer, i);
+
+    if (layer->pad->cached) {
+      if (layer->geometry_changed)
+        return FALSE;
+      if (layer->content_changed && !layer->pad->refreshable)
+        return FALSE;
+      n_cached++;
+      continue;
+    }
+
+    for (j = i + 1; j < layers->len; j++) {
+      GstVaapiOverlayLayer *const above =
+          &g_array_index (layers, GstVaapiOverlayLayer, j);
+      if (above->pad->cached && rect_overlaps (&layer->blend_surface.target,
+              &above->blend_surface.target))
+        return FALSE;
+    }
+  }
+
+  /* a cached pad went away */
+  return n_cached == overlay->canvas_layers;
+}
+
+/* Selects the layers worth composing into the canvas. Those are the
+ * ones whose geometry is steady and whose content is either steady
+ * too or opaque and not covered by any other steady layer, so that it
+ * can be redrawn in place. A layer above an overlapping non-candidate one
+ * can't be cached as it would end up below it. */
+static guint
+gst_vaapi_overlay_select_candidates (GstVaapiOverlay * overlay,
+    gboolean * changed_ptr)
+{
+  GArray *const layers = overlay->layers;
+  guint i, j, n_candidates = 0;
+  gboolean changed = FALSE;
+
+  for (i = 0; i < layers->len; i++) {
+    GstVaapiOverlayLayer *const layer =
+        &g_array_index (layers, GstVaapiOverlayLayer, i);
+    GstVaapiOverlaySinkPad *const pad = layer->pad;
+    gboolean candidate;
+
+    candidate = pad->static_geometry >= STATIC_LAYER_FRAMES;
+    if (candidate && pad->static_content < STATIC_LAYER_FRAMES) {
+      candidate = layer->blend_surface.alpha == 1.0;
+      for (j = i + 1; candidate && j < layers->len; j++) {
+        GstVaapiOverlayLayer *const above =
+            &g_array_index (layers, GstVaapiOverlayLayer, j);
+        /* moving layers are never cached, they are drawn afterwards */
+        if (above->pad->static_geometry >= STATIC_LAYER_FRAMES
+            && rect_overlaps (&layer->blend_surface.target,
+                &above->blend_surface.target))
+          candidate = FALSE;
+      }
+    }
+    for (j = 0; candidate && j < i; j++) {
+      GstVaapiOverlayLayer *const below =
+          &g_array_index (layers, GstVaapiOverlayLayer, j);
+      if (!below->candidate && rect_overlaps (&layer->blend_surface.target,
+              &below->blend_surface.target))
+        candidate = FALSE;
     }
 
-    gst_buffer_unref (inbuf);
-    return blend_surface;
+    layer->candidate = candidate;
+    if (candidate)
+      n_candidates++;
+    if (candidate != pad->cached)
+      changed = TRUE;
   }
 
-  return NULL;
+  *changed_ptr = changed;
+  return n_candidates;
+}
+
+static void
+gst_vaapi_overlay_reset_canvas (GstVaapiOverlay * overlay)
+{
+  GList *l;
+
+  for (l = GST_ELEMENT (overlay)->sinkpads; l; l = l->next) {
+    GstVaapiOverlaySinkPad *const pad = l->data;
+    pad->cached = FALSE;
+    pad->refreshable = FALSE;
+  }
+
+  gst_vaapi_surface_proxy_replace (&overlay->canvas, NULL);
+  overlay->canvas_layers = 0;
+}
+
+static GstVaapiBlendSurface *
+gst_vaapi_overlay_single_surface_next (gpointer data)
+{
+  GstVaapiBlendSurface **const surface_ptr = data;
+  GstVaapiBlendSurface *const surface = *surface_ptr;
+
+  *surface_ptr = NULL;
+  return surface;
+}
+
+static gboolean
+converted_surface_fits (GstVaapiOverlay * overlay, GstVaapiOverlayLayer * layer)
+{
+  GstVaapiSurface *const surface = layer->pad->converted_surface;
+  const GstVaapiRectangle *const target = &layer->blend_surface.target;
+
+  return surface && GST_VAAPI_SURFACE_WIDTH (surface) == target->width
+      && GST_VAAPI_SURFACE_HEIGHT (surface) == target->height
+      && gst_vaapi_surface_get_format (surface) ==
+      GST_VIDEO_INFO_FORMAT (GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (overlay));
+}
+
+/* Converts the layer into a surface of the output format and of the
+ * size it is composed at, so that the following output frames blend
+ * it without any conversion nor scaling, until a new buffer comes */
+static gboolean
+gst_vaapi_overlay_convert_layer (GstVaapiOverlay * overlay,
+    GstVaapiOverlayLayer * layer)
+{
+  GstVaapiOverlaySinkPad *const pad = layer->pad;
+  const GstVideoFormat format =
+      GST_VIDEO_INFO_FORMAT (GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (overlay));
+  const GstVaapiRectangle *const target = &layer->blend_surface.target;
+  GstVaapiBlendSurface blend_surface, *next_surface = &blend_surface;
+
+  if (!target->width || !target->height
+      || gst_vaapi_surface_get_format ((GstVaapiSurface *)
+          layer->blend_surface.surface) == format)
+    return FALSE;
+
+  gst_buffer_replace (&pad->converted_buffer, NULL);
+  if (!converted_surface_fits (overlay, layer)) {
+    gst_mini_object_replace ((GstMiniObject **) & pad->converted_surface,
+        NULL);
+    pad->converted_surface =
+        gst_vaapi_surface_new_with_format (GST_VAAPI_PLUGIN_BASE_DISPLAY
+        (overlay), format, target->width, target->height, 0);
+    if (!pad->converted_surface)
+      return FALSE;
+  }
+
+  blend_surface = layer->blend_surface;
+  blend_surface.target.x = 0;
+  blend_surface.target.y = 0;
+  blend_surface.alpha = 1.0;
+  if (!gst_vaapi_blend_process (overlay->blend, pad->converted_surface,
+          gst_vaapi_overlay_single_surface_next, &next_surface))
+    return FALSE;
+
+  GST_LOG_OBJECT (pad, "converted layer to %s %ux%u",
+      gst_video_format_to_string (format), target->width, target->height);
+
+  gst_buffer_replace (&pad->converted_buffer, pad->composed_buffer);
+  layer->blend_surface.surface = pad->converted_surface;
+  layer->blend_surface.crop = NULL;
+  return TRUE;
+}
+
+static gboolean
+gst_vaapi_overlay_ensure_layer_surface (GstVaapiOverlay * overlay,
+    GstVaapiOverlayLayer * layer)
+{
+  GstVaapiOverlaySinkPad *const pad = layer->pad;
+  GstVaapiVideoMeta *inbuf_meta;
+
+  if (layer->blend_surface.surface)
+    return TRUE;
+
+  /* The buffer was converted for a previous output frame */
+  if (pad->converted_buffer && pad->converted_buffer == pad->composed_buffer
+      && converted_surface_fits (overlay, layer)) {
+    layer->blend_surface.surface = pad->converted_surface;
+    layer->blend_surface.crop = NULL;
+    return TRUE;
+  }
+
+  if (gst_vaapi_plugin_base_pad_get_input_buffer (GST_VAAPI_PLUGIN_BASE
+          (overlay), GST_PAD (layer->pad), layer->pad->composed_buffer,
+          &layer->inbuf) != GST_FLOW_OK)
+    return FALSE;
+
+  inbuf_meta = gst_buffer_get_vaapi_video_meta (layer->inbuf);
+  if (!inbuf_meta)
+    return FALSE;
+
+  layer->blend_surface.surface = gst_vaapi_video_meta_get_surface (inbuf_meta);
+  layer->blend_surface.crop = gst_vaapi_video_meta_get_render_rect (inbuf_meta);
+  if (!layer->blend_surface.surface)
+    return FALSE;
+
+  /* Whatever is in the canvas is only blended once, and a buffer seen
+   * for the first time may well not be composed again. Otherwise, the
+   * layer keeps the input surface if it cannot be converted */
+  if (!pad->cached && pad->static_content > 0)
+    gst_vaapi_overlay_convert_layer (overlay, layer);
+  return TRUE;
+}
+
+static gboolean
+gst_vaapi_overlay_blend_surfaces (GstVaapiOverlay * overlay,
+    GstVaapiSurface * output)
+{
+  GstVaapiOverlaySurfaceGenerator generator;
+
+  /* initialize the surface generator */
+  generator.surfaces = overlay->blend_surfaces;
+  generator.index = 0;
+
+  return gst_vaapi_blend_process (overlay->blend, output,
+      gst_vaapi_overlay_surface_next, &generator);
+}
+
+/* Queues the layers that are in the canvas if @cached is %TRUE, or the
+ * others, optionally only the ones whose content changed */
+static gboolean
+gst_vaapi_overlay_queue_layers (GstVaapiOverlay * overlay, gboolean cached,
+    gboolean changed_only)
+{
+  GArray *const layers = overlay->layers;
+  guint i;
+
+  for (i = 0; i < layers->len; i++) {
+    GstVaapiOverlayLayer *const layer =
+        &g_array_index (layers, GstVaapiOverlayLayer, i);
+
+    if ((gboolean) layer->pad->cached != cached)
+      continue;
+    if (changed_only && !layer->content_changed)
+      continue;
+    if (!gst_vaapi_overlay_ensure_layer_surface (overlay, layer))
+      return FALSE;
+    g_ptr_array_add (overlay->blend_surfaces, &layer->blend_surface);
+  }
+  return TRUE;
+}
+
+/* Composes the candidate layers into a new canvas */
+static gboolean
+gst_vaapi_overlay_build_canvas (GstVaapiOverlay * overlay)
+{
+  GArray *const layers = overlay->layers;
+  GstVaapiSurfaceProxy *proxy;
+  guint i, j;
+
+  gst_vaapi_overlay_reset_canvas (overlay);
+
+  for (i = 0; i < layers->len; i++) {
+    GstVaapiOverlayLayer *const layer =
+        &g_array_index (layers, GstVaapiOverlayLayer, i);
+    GstVaapiOverlaySinkPad *const pad = layer->pad;
+
+    if (!layer->candidate)
+      continue;
+
+    pad->cached = TRUE;
+    pad->refreshable = layer->blend_surface.alpha == 1.0;
+    for (j = i + 1; pad->refreshable && j < layers->len; j++) {
+      GstVaapiOverlayLayer *const above =
+          &g_array_index (layers, GstVaapiOverlayLayer, j);
+      if (above->candidate && rect_overlaps (&layer->blend_surface.target,
+              &above->blend_surface.target))
+        pad->refreshable = FALSE;
+    }
+    overlay->canvas_layers++;
+  }
+
+  proxy = gst_vaapi_surface_proxy_new_from_pool
+      (GST_VAAPI_SURFACE_POOL (overlay->blend_pool));
+  if (!proxy)
+    goto error;
+
+  g_ptr_array_set_size (overlay->blend_surfaces, 0);
+  if (!gst_vaapi_overlay_queue_layers (overlay, TRUE, FALSE))
+    goto error;
+  if (!gst_vaapi_overlay_blend_surfaces (overlay,
+          GST_VAAPI_SURFACE_PROXY_SURFACE (proxy)))
+    goto error;
+
+  GST_DEBUG_OBJECT (overlay, "composed %u of %u layers into the canvas",
+      overlay->canvas_layers, layers->len);
+
+  overlay->canvas = proxy;
+  return TRUE;
+
+  /* ERRORS */
+error:
+  {
+    if (proxy)
+      gst_vaapi_surface_proxy_unref (proxy);
+    gst_vaapi_overlay_reset_canvas (overlay);
+    return FALSE;
+  }
+}
+
+/* Redraws the opaque cached layers that received a new buffer. The
+ * previous canvas is blended first, the new layers overwrite their
+ * own area. */
+static gboolean
+gst_vaapi_overlay_refresh_canvas (GstVaapiOverlay * overlay,
+    GstVaapiBlendSurface * canvas_surface)
+{
+  GstVaapiSurfaceProxy *proxy;
+
+  g_ptr_array_set_size (overlay->blend_surfaces, 0);
+  g_ptr_array_add (overlay->blend_surfaces, canvas_surface);
+  if (!gst_vaapi_overlay_queue_layers (overlay, TRUE, TRUE))
+    return FALSE;
+  if (overlay->blend_surfaces->len == 1)
+    return TRUE;
+
+  proxy = gst_vaapi_surface_proxy_new_from_pool
+      (GST_VAAPI_SURFACE_POOL (overlay->blend_pool));
+  if (!proxy)
+    return FALSE;
+
+  if (!gst_vaapi_overlay_blend_surfaces (overlay,
+          GST_VAAPI_SURFACE_PROXY_SURFACE (proxy))) {
+    gst_vaapi_surface_proxy_unref (proxy);
+    return FALSE;
+  }
+
+  gst_vaapi_surface_proxy_replace (&overlay->canvas, proxy);
+  gst_vaapi_surface_proxy_unref (proxy);
+  canvas_surface->surface = GST_VAAPI_SURFACE_PROXY_SURFACE (overlay->canvas);
+  return TRUE;
 }
 
 static GstFlowReturn
@@ -424,13 +962,17 @@ gst_vaapi_overlay_aggregate_frames (GstVideoAggregator * vagg,
   GstVaapiVideoMeta *outbuf_meta;
   GstVaapiSurface *outbuf_surface;
   GstVaapiSurfaceProxy *proxy;
-  GstVaapiOverlaySurfaceGenerator generator;
+  GstVaapiBlendSurface canvas_surface = { NULL, };
+  GstVideoInfo *const vip = GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (overlay);
+  gboolean canvas_valid, candidates_changed;
+  gboolean canvas_built = FALSE;
+  guint n_candidates;
+  GstFlowReturn ret = GST_FLOW_ERROR;
 
   if (!overlay->blend_pool) {
     GstVaapiVideoPool *pool =
         gst_vaapi_surface_pool_new_full (GST_VAAPI_PLUGIN_BASE_DISPLAY
-        (overlay),
-        GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (overlay), 0);
+        (overlay), vip, 0);
     if (!pool)
       return GST_FLOW_ERROR;
     gst_vaapi_video_pool_replace (&overlay->blend_pool, pool);
@@ -452,15 +994,44 @@ gst_vaapi_overlay_aggregate_frames (GstVideoAggregator * vagg,
 
   outbuf_surface = gst_vaapi_video_meta_get_surface (outbuf_meta);
 
-  /* initialize the surface generator */
-  generator.overlay = overlay;
-  generator.current = GST_ELEMENT (overlay)->sinkpads;
+  /* Only the layers that changed since the previous frame are drawn
+   * again; the static ones are taken from the canvas in one pass */
+  gst_vaapi_overlay_collect_layers (overlay);
+  canvas_valid = gst_vaapi_overlay_canvas_is_valid (overlay);
+  n_candidates = gst_vaapi_overlay_select_candidates (overlay,
+      &candidates_changed);
+
+  if (n_candidates >= 2 && (!canvas_valid || candidates_changed)) {
+    if (!gst_vaapi_overlay_build_canvas (overlay))
+      goto done;
+    canvas_built = TRUE;
+  } else if (!canvas_valid && overlay->canvas) {
+    gst_vaapi_overlay_reset_canvas (overlay);
+  }
 
-  if (!gst_vaapi_blend_process (overlay->blend, outbuf_surface,
-          gst_vaapi_overlay_surface_next, &generator))
-    return GST_FLOW_ERROR;
+  if (overlay->canvas) {
+    canvas_surface.surface = GST_VAAPI_SURFACE_PROXY_SURFACE (overlay->canvas);
+    canvas_surface.target.width = GST_VIDEO_INFO_WIDTH (vip);
+    canvas_surface.target.height = GST_VIDEO_INFO_HEIGHT (vip);
+    canvas_surface.alpha = 1.0;
+    if (!canvas_built
+        && !gst_vaapi_overlay_refresh_canvas (overlay, &canvas_surface))
+      goto done;
+  }
 
-  return GST_FLOW_OK;
+  g_ptr_array_set_size (overlay->blend_surfaces, 0);
+  if (overlay->canvas)
+    g_ptr_array_add (overlay->blend_surfaces, &canvas_surface);
+  if (!gst_vaapi_overlay_queue_layers (overlay, FALSE, FALSE))
+    goto done;
+
+  if (gst_vaapi_overlay_blend_surfaces (overlay, outbuf_surface))
+    ret = GST_FLOW_OK;
+
+done:
+  g_ptr_array_set_size (overlay->blend_surfaces, 0);
+  g_array_set_size (overlay->layers, 0);
+  return ret;
 }
 
 static GstFlowReturn
@@ -504,6 +1075,7 @@ static GstCaps *
 gst_vaapi_overlay_fixate_src_caps (GstAggregator * agg, GstCaps * caps)
 {
   GstVideoAggregator *vagg = GST_VIDEO_AGGREGATOR (agg);
+  GstVaapiOverlay *const overlay = GST_VAAPI_OVERLAY (agg);
   GList *l;
   gint best_width = -1, best_height = -1;
   gint best_fps_n = -1, best_fps_d = -1;
@@ -524,8 +1096,14 @@ gst_vaapi_overlay_fixate_src_caps (GstAggregator * agg, GstCaps * caps)
     fps_n = GST_VIDEO_INFO_FPS_N (&vaggpad->info);
     fps_d = GST_VIDEO_INFO_FPS_D (&vaggpad->info);
 
-    this_width = GST_VIDEO_INFO_WIDTH (&vaggpad->info) + MAX (pad->xpos, 0);
-    this_height = GST_VIDEO_INFO_HEIGHT (&vaggpad->info) + MAX (pad->ypos, 0);
+    if (overlay->columns > 0) {
+      this_width = GST_VIDEO_INFO_WIDTH (&vaggpad->info);
+      this_height = GST_VIDEO_INFO_HEIGHT (&vaggpad->info);
+    } else {
+      this_width = GST_VIDEO_INFO_WIDTH (&vaggpad->info) + MAX (pad->xpos, 0);
+      this_height = GST_VIDEO_INFO_HEIGHT (&vaggpad->info) + MAX (pad->ypos,
+          0);
+    }
 
     if (best_width < this_width)
       best_width = this_width;
@@ -543,6 +1121,18 @@ gst_vaapi_overlay_fixate_src_caps (GstAggregator * agg, GstCaps * caps)
       best_fps_d = fps_d;
     }
   }
+
+  /* in grid mode, the tiles default to the largest input */
+  if (overlay->columns > 0) {
+    if (overlay->tile_width > 0)
+      best_width = overlay->tile_width;
+    if (overlay->tile_height > 0)
+      best_height = overlay->tile_height;
+    if (best_width > 0 && best_height > 0) {
+      best_width *= overlay->columns;
+      best_height *= gst_vaapi_overlay_get_rows (overlay);
+    }
+  }
   GST_OBJECT_UNLOCK (vagg);
 
   if (best_fps_n <= 0 || best_fps_d <= 0 || best_fps == 0.0) {
@@ -589,6 +1179,42 @@ gst_vaapi_overlay_class_init (GstVaapiOverlayClass * klass)
       GST_DEBUG_FUNCPTR (gst_vaapi_overlay_get_vaapi_pad_private);
 
   object_class->finalize = GST_DEBUG_FUNCPTR (gst_vaapi_overlay_finalize);
+  object_class->set_property = gst_vaapi_overlay_set_property;
+  object_class->get_property = gst_vaapi_overlay_get_property;
+
+  /**
+   * GstVaapiOverlay:columns:
+   *
+   * Number of columns of the grid the sink pads are tiled into, or 0
+   * to place them with their xpos and ypos properties.
+   */
+  g_object_class_install_property (object_class, PROP_COLUMNS,
+      g_param_spec_uint ("columns", "Columns",
+          "Number of grid columns to tile the inputs into (0 = free layout)",
+          0, 64, DEFAULT_COLUMNS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiOverlay:tile-width:
+   *
+   * Width of the grid tiles, or 0 for the width of the largest input.
+   */
+  g_object_class_install_property (object_class, PROP_TILE_WIDTH,
+      g_param_spec_uint ("tile-width", "Tile width",
+          "Width of the grid tiles (0 = largest input)",
+          0, G_MAXINT, DEFAULT_TILE_WIDTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiOverlay:tile-height:
+   *
+   * Height of the grid tiles, or 0 for the height of the largest input.
+   */
+  g_object_class_install_property (object_class, PROP_TILE_HEIGHT,
+      g_param_spec_uint ("tile-height", "Tile height",
+          "Height of the grid tiles (0 = largest input)",
+          0, G_MAXINT, DEFAULT_TILE_HEIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
   agg_class->sink_query = GST_DEBUG_FUNCPTR (gst_vaapi_overlay_sink_query);
   agg_class->src_query = GST_DEBUG_FUNCPTR (gst_vaapi_overlay_src_query);
@@ -630,6 +1256,14 @@ static void
 gst_vaapi_overlay_init (GstVaapiOverlay * overlay)
 {
   gst_vaapi_plugin_base_init (GST_VAAPI_PLUGIN_BASE (overlay), GST_CAT_DEFAULT);
+
+  overlay->layers = g_array_new (FALSE, TRUE, sizeof (GstVaapiOverlayLayer));
+  g_array_set_clear_func (overlay->layers,
+      (GDestroyNotify) gst_vaapi_overlay_layer_clear);
+  overlay->blend_surfaces = g_ptr_array_new ();
+  overlay->columns = DEFAULT_COLUMNS;
+  overlay->tile_width = DEFAULT_TILE_WIDTH;
+  overlay->tile_height = DEFAULT_TILE_HEIGHT;
 }
 
 /* GstChildProxy implementation */
@@ -26,6 +26,7 @@
 #include "gstvaapipluginbase.h"
 #include <gst/vaapi/gstvaapisurfacepool.h>
 #include <gst/vaapi/gstvaapiblend.h>
+#include <gst/vaapi/gstvaapisurfaceproxy.h>
 
 G_BEGIN_DECLS
 
@@ -67,6 +68,18 @@ struct _GstVaapiOverlay
 
   GstVaapiBlend *blend;
   GstVaapiVideoPool *blend_pool;
+
+  /* static layers composed once, then reblended as a single surface */
+  GstVaapiSurfaceProxy *canvas;
+  guint canvas_layers;
+
+  GArray *layers;
+  GPtrArray *blend_surfaces;
+
+  /* grid layout, for video walls */
+  guint columns;
+  guint tile_width;
+  guint tile_height;
 };
 
 struct _GstVaapiOverlayClass
@@ -82,6 +95,19 @@ struct _GstVaapiOverlaySinkPad
   gdouble alpha;
 
   GstVaapiPadPrivate *priv;
+
+  /* layer as composed into the previous output frame */
+  GstBuffer *composed_buffer;
+  GstVaapiRectangle composed_target;
+  gdouble composed_alpha;
+  guint static_geometry;
+  guint static_content;
+  guint cached:1;
+  guint refreshable:1;
+
+  /* composed_buffer converted to the output format and layer size */
+  GstBuffer *converted_buffer;
+  GstVaapiSurface *converted_surface;
 };
 
 struct _GstVaapiOverlaySinkPadClass
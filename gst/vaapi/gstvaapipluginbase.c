@@ -24,15 +24,26 @@
 
 #include "gstcompat.h"
 #include <gst/vaapi/gstvaapisurface_drm.h>
+#include <gst/vaapi/gstvaapiutils_copy.h>
+#include <gst/vaapi/gstvaapiutils_numa.h>
 #include <gst/base/gstpushsrc.h>
 #include "gstvaapipluginbase.h"
 #include "gstvaapipluginutil.h"
 #include "gstvaapivideocontext.h"
 #include "gstvaapivideometa.h"
+#include "gstvaapifencemeta.h"
 #include "gstvaapivideobufferpool.h"
 #if USE_GST_GL_HELPERS
 # include <gst/gl/gl.h>
 #endif
+#ifdef __linux__
+# include <errno.h>
+# include <pthread.h>
+# include <sched.h>
+# include <unistd.h>
+# include <sys/resource.h>
+# include <sys/syscall.h>
+#endif
 
 GST_DEBUG_CATEGORY_STATIC (CAT_PERFORMANCE);
 /* Default debug category is from the subclass */
@@ -40,6 +51,16 @@ GST_DEBUG_CATEGORY_STATIC (CAT_PERFORMANCE);
 
 #define BUFFER_POOL_SINK_MIN_BUFFERS 2
 
+/* Allocation meta parameters carrying the number of surfaces held by
+   the elements downstream, see gst_vaapi_plugin_base_propose_allocation() */
+#define ALLOCATION_PARAMS_NAME          "GstVaapiAllocationParams"
+#define ALLOCATION_PARAMS_MIN_BUFFERS   "min-buffers"
+#define ALLOCATION_PARAMS_COMPRESSION   "compression"
+#define ALLOCATION_PARAMS_VA_DISPLAY    "va-display"
+
+/* Number of caps query results kept by each element */
+#define CAPS_CACHE_SIZE 16
+
 #define GST_VAAPI_PAD_PRIVATE(pad) \
   (GST_VAAPI_PLUGIN_BASE_GET_CLASS(plugin)->get_vaapi_pad_private(plugin, pad))
 
@@ -49,6 +70,7 @@ gst_vaapi_pad_private_new (void)
   GstVaapiPadPrivate *priv = g_new0 (GstVaapiPadPrivate, 1);
 
   gst_video_info_init (&priv->info);
+  priv->can_userptr = TRUE;
 
   return priv;
 }
@@ -66,8 +88,15 @@ gst_vaapi_pad_private_reset (GstVaapiPadPrivate * priv)
 
   priv->buffer_size = 0;
   priv->caps_is_raw = FALSE;
+  priv->can_userptr = TRUE;
+  priv->min_buffers = 0;
+  priv->compression = FALSE;
 
   g_clear_object (&priv->other_allocator);
+  if (priv->other_pool) {
+    gst_buffer_pool_set_active (priv->other_pool, FALSE);
+    g_clear_object (&priv->other_pool);
+  }
 }
 
 void
@@ -93,7 +122,11 @@ plugin_set_display (GstVaapiPluginBase * plugin, GstVaapiDisplay * display)
     gst_vaapi_display_replace (&plugin->display, display);
     plugin->display_type = gst_vaapi_display_get_display_type (display);
     gst_vaapi_plugin_base_set_display_name (plugin, display_name);
+    /* a shared display is known, the prefetched one would stay idle */
+    g_clear_pointer (&plugin->display_prefetch,
+        gst_vaapi_display_prefetch_free);
   }
+  gst_vaapi_plugin_base_clear_caps_cache (plugin);
   gst_object_unref (display);
 }
 
@@ -143,19 +176,172 @@ default_display_changed (GstVaapiPluginBase * plugin)
 {
 }
 
-static GstVaapiSurface *
-_get_cached_surface (GstBuffer * buf)
+/* A cached caps query result, for a given pad direction and filter */
+typedef struct
+{
+  GstPadDirection direction;
+  guint filter_hash;
+  GstCaps *filter;
+  GstCaps *caps;
+} CapsCacheEntry;
+
+static void
+caps_cache_entry_free (CapsCacheEntry * entry)
+{
+  gst_caps_replace (&entry->filter, NULL);
+  gst_caps_replace (&entry->caps, NULL);
+  g_slice_free (CapsCacheEntry, entry);
+}
+
+/* Cheap hash of the structure names and features of @caps, so that
+ * most of the entries are told apart without comparing the caps */
+static guint
+caps_hash (GstCaps * caps)
+{
+  guint i, j, n, hash;
+
+  if (!caps)
+    return 0;
+
+  n = gst_caps_get_size (caps);
+  hash = n + 1;
+  for (i = 0; i < n; i++) {
+    GstCapsFeatures *const features = gst_caps_get_features (caps, i);
+
+    hash = hash * 31 +
+        gst_structure_get_name_id (gst_caps_get_structure (caps, i));
+    if (!features)
+      continue;
+    for (j = 0; j < gst_caps_features_get_size (features); j++)
+      hash = hash * 31 + gst_caps_features_get_nth_id (features, j);
+  }
+  return hash;
+}
+
+static inline gboolean
+caps_cache_entry_matches (CapsCacheEntry * entry, GstPadDirection direction,
+    guint filter_hash, GstCaps * filter)
+{
+  if (entry->direction != direction || entry->filter_hash != filter_hash)
+    return FALSE;
+  if (entry->filter == filter)
+    return TRUE;
+  return entry->filter && filter
+      && gst_caps_is_strictly_equal (entry->filter, filter);
+}
+
+/* Peers changing their caps send a reconfigure event upstream */
+static GstPadProbeReturn
+caps_cache_reconfigure_probe (GstPad * pad, GstPadProbeInfo * info,
+    GstVaapiPluginBase * plugin)
+{
+  GstEvent *const event = GST_PAD_PROBE_INFO_EVENT (info);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_RECONFIGURE)
+    gst_vaapi_plugin_base_clear_caps_cache (plugin);
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+caps_cache_pad_linked (GstPad * pad, GstPad * peer, GstVaapiPluginBase * plugin)
 {
-  return gst_mini_object_get_qdata (GST_MINI_OBJECT (buf),
-      g_quark_from_static_string ("GstVaapiDMABufSurface"));
+  gst_vaapi_plugin_base_clear_caps_cache (plugin);
 }
 
 static void
-_set_cached_surface (GstBuffer * buf, GstVaapiSurface * surface)
+caps_cache_watch_pad (GstVaapiPluginBase * plugin, GstPad * pad)
+{
+  g_signal_connect (pad, "linked", G_CALLBACK (caps_cache_pad_linked), plugin);
+  g_signal_connect (pad, "unlinked", G_CALLBACK (caps_cache_pad_linked),
+      plugin);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM,
+      (GstPadProbeCallback) caps_cache_reconfigure_probe, plugin, NULL);
+}
+
+/**
+ * gst_vaapi_plugin_base_lookup_caps:
+ * @plugin: a #GstVaapiPluginBase
+ * @direction: the direction of the caps query
+ * @filter: (allow-none): the filter of the caps query
+ *
+ * Looks up the result of a previous caps query with the same
+ * @direction and @filter, as stored by
+ * gst_vaapi_plugin_base_store_caps(). The results are dropped when the
+ * display changes, when a pad is linked or unlinked, and when a peer
+ * asks for a reconfiguration.
+ *
+ * Returns: (transfer full): the cached #GstCaps, or %NULL if none
+ **/
+GstCaps *
+gst_vaapi_plugin_base_lookup_caps (GstVaapiPluginBase * plugin,
+    GstPadDirection direction, GstCaps * filter)
+{
+  const guint filter_hash = caps_hash (filter);
+  GstCaps *caps = NULL;
+  guint i;
+
+  g_mutex_lock (&plugin->caps_cache_lock);
+  for (i = 0; plugin->caps_cache && i < plugin->caps_cache->len; i++) {
+    CapsCacheEntry *const entry = g_ptr_array_index (plugin->caps_cache, i);
+
+    if (caps_cache_entry_matches (entry, direction, filter_hash, filter)) {
+      caps = gst_caps_ref (entry->caps);
+      break;
+    }
+  }
+  g_mutex_unlock (&plugin->caps_cache_lock);
+  return caps;
+}
+
+/**
+ * gst_vaapi_plugin_base_store_caps:
+ * @plugin: a #GstVaapiPluginBase
+ * @direction: the direction of the caps query
+ * @filter: (allow-none): the filter of the caps query
+ * @caps: the result of the caps query
+ *
+ * Caches @caps as the result of the caps query for @direction and
+ * @filter. Only the results that don't depend on anything else than
+ * the display, the peers and the queried filter should be stored.
+ **/
+void
+gst_vaapi_plugin_base_store_caps (GstVaapiPluginBase * plugin,
+    GstPadDirection direction, GstCaps * filter, GstCaps * caps)
+{
+  CapsCacheEntry *entry;
+
+  g_return_if_fail (caps != NULL);
+
+  entry = g_slice_new (CapsCacheEntry);
+  entry->direction = direction;
+  entry->filter_hash = caps_hash (filter);
+  entry->filter = filter ? gst_caps_ref (filter) : NULL;
+  entry->caps = gst_caps_ref (caps);
+
+  g_mutex_lock (&plugin->caps_cache_lock);
+  if (!plugin->caps_cache)
+    plugin->caps_cache =
+        g_ptr_array_new_with_free_func ((GDestroyNotify) caps_cache_entry_free);
+  if (plugin->caps_cache->len >= CAPS_CACHE_SIZE)
+    g_ptr_array_remove_index (plugin->caps_cache, 0);
+  g_ptr_array_add (plugin->caps_cache, entry);
+  g_mutex_unlock (&plugin->caps_cache_lock);
+}
+
+/**
+ * gst_vaapi_plugin_base_clear_caps_cache:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Drops all the caps query results cached so far, e.g. because the
+ * state they were computed from changed.
+ **/
+void
+gst_vaapi_plugin_base_clear_caps_cache (GstVaapiPluginBase * plugin)
 {
-  return gst_mini_object_set_qdata (GST_MINI_OBJECT (buf),
-      g_quark_from_static_string ("GstVaapiDMABufSurface"), surface,
-      (GDestroyNotify) gst_vaapi_surface_unref);
+  g_mutex_lock (&plugin->caps_cache_lock);
+  if (plugin->caps_cache)
+    g_ptr_array_set_size (plugin->caps_cache, 0);
+  g_mutex_unlock (&plugin->caps_cache_lock);
 }
 
 static gboolean
@@ -208,9 +394,11 @@ plugin_bind_dma_to_vaapi_buffer (GstVaapiPluginBase * plugin, GstPad * sinkpad,
   GstVaapiVideoMeta *meta;
   GstVaapiSurface *surface;
   GstVaapiSurfaceProxy *proxy;
+  GstMemory *mem;
   gint fd;
 
-  fd = gst_dmabuf_memory_get_fd (gst_buffer_peek_memory (inbuf, 0));
+  mem = gst_buffer_peek_memory (inbuf, 0);
+  fd = gst_dmabuf_memory_get_fd (mem);
   if (fd < 0)
     return FALSE;
 
@@ -220,18 +408,15 @@ plugin_bind_dma_to_vaapi_buffer (GstVaapiPluginBase * plugin, GstPad * sinkpad,
   meta = gst_buffer_get_vaapi_video_meta (outbuf);
   g_return_val_if_fail (meta != NULL, FALSE);
 
-  /* Check for a VASurface cached in the buffer */
-  surface = _get_cached_surface (inbuf);
-  if (!surface) {
-    /* otherwise create one and cache it */
-    surface =
-        gst_vaapi_surface_new_with_dma_buf_handle (plugin->display, fd, vip);
-    if (!surface)
-      goto error_create_surface;
-    _set_cached_surface (inbuf, surface);
-  }
+  /* Imports are cached on the display by dma-buf identity, since
+   * producers may wrap the same dma-buf in a new buffer every frame */
+  surface = gst_vaapi_surface_import_dma_buf_handle (plugin->display, fd, vip,
+      gst_vaapi_dmabuf_memory_get_modifier (mem));
+  if (!surface)
+    goto error_create_surface;
 
   proxy = gst_vaapi_surface_proxy_new (surface);
+  gst_vaapi_surface_unref (surface);
   if (!proxy)
     goto error_create_proxy;
   gst_vaapi_video_meta_set_surface_proxy (meta, proxy);
@@ -260,6 +445,176 @@ error_create_proxy:
   }
 }
 
+/* Shares the surface of @inbuf, which belongs to another VA display,
+ * with ours through a dma-buf export. The new buffer keeps @inbuf
+ * alive, along with the source surface, until it is released. */
+static GstBuffer *
+plugin_import_vaapi_buffer (GstVaapiPluginBase * plugin, GstBuffer * inbuf,
+    GstVaapiVideoMeta * src_meta)
+{
+  GstVaapiSurfaceProxy *src_proxy, *proxy;
+  GstVaapiSurface *surface;
+  GstVaapiVideoMeta *meta;
+  const GstVaapiRectangle *rect;
+  GstBuffer *outbuf;
+
+  src_proxy = gst_vaapi_video_meta_get_surface_proxy (src_meta);
+  if (!src_proxy)
+    return NULL;
+
+  surface = gst_vaapi_surface_import_from_surface (plugin->display,
+      gst_vaapi_surface_proxy_get_surface (src_proxy));
+  if (!surface)
+    goto error_import_surface;
+
+  proxy = gst_vaapi_surface_proxy_new (surface);
+  gst_vaapi_surface_unref (surface);
+  if (!proxy)
+    goto error_create_proxy;
+  rect = gst_vaapi_surface_proxy_get_crop_rect (src_proxy);
+  if (rect)
+    gst_vaapi_surface_proxy_set_crop_rect (proxy, rect);
+
+  meta = gst_vaapi_video_meta_new_with_surface_proxy (proxy);
+  gst_vaapi_surface_proxy_unref (proxy);
+  if (!meta)
+    goto error_create_meta;
+  gst_vaapi_video_meta_set_render_flags (meta,
+      gst_vaapi_video_meta_get_render_flags (src_meta));
+  rect = gst_vaapi_video_meta_get_render_rect (src_meta);
+  if (rect)
+    gst_vaapi_video_meta_set_render_rect (meta, rect);
+
+  outbuf = gst_buffer_new ();
+  gst_buffer_set_vaapi_video_meta (outbuf, meta);
+  gst_vaapi_video_meta_unref (meta);
+
+  /* The VA-API meta is tagged as memory, hence not copied over */
+  gst_buffer_copy_into (outbuf, inbuf, GST_BUFFER_COPY_FLAGS |
+      GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_META, 0, -1);
+  gst_buffer_add_parent_buffer_meta (outbuf, inbuf);
+  return outbuf;
+
+  /* ERRORS */
+error_import_surface:
+  {
+    GST_ERROR_OBJECT (plugin,
+        "failed to import VA surface from another VA display");
+    return NULL;
+  }
+error_create_proxy:
+  {
+    GST_ERROR_OBJECT (plugin,
+        "failed to create VA surface proxy from imported VA surface");
+    return NULL;
+  }
+error_create_meta:
+  {
+    GST_ERROR_OBJECT (plugin, "failed to create VA-API video meta");
+    return NULL;
+  }
+}
+
+/* Alignment of the system memory the driver can map directly */
+#define USERPTR_ALIGNMENT 4096
+
+#define GST_VAAPI_USERPTR_SURFACE_QUARK gst_vaapi_userptr_surface_quark_get ()
+static GQuark
+gst_vaapi_userptr_surface_quark_get (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    gsize quark = (gsize) g_quark_from_static_string ("GstVaapiUserPtrSurface");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+static GstMemory *
+get_userptr_memory (GstBuffer * buf, gpointer * data_ptr)
+{
+  GstMemory *mem;
+  GstMapInfo map_info;
+  gpointer data;
+
+  if (gst_buffer_n_memory (buf) != 1)
+    return NULL;
+
+  mem = gst_buffer_peek_memory (buf, 0);
+  if (!gst_memory_is_type (mem, GST_ALLOCATOR_SYSMEM))
+    return NULL;
+
+  /* System memory does not move once allocated */
+  if (!gst_memory_map (mem, &map_info, GST_MAP_READ))
+    return NULL;
+  data = map_info.data;
+  gst_memory_unmap (mem, &map_info);
+
+  if ((guintptr) data % USERPTR_ALIGNMENT != 0)
+    return NULL;
+  *data_ptr = data;
+  return mem;
+}
+
+/* Wraps page aligned system memory into a VA surface. The surface is
+ * kept on the memory, which upstream pools recycle from frame to
+ * frame */
+static gboolean
+plugin_bind_userptr_to_vaapi_buffer (GstVaapiPluginBase * plugin,
+    GstPad * sinkpad, GstBuffer * inbuf, GstBuffer * outbuf)
+{
+  GstVaapiPadPrivate *sinkpriv = GST_VAAPI_PAD_PRIVATE (sinkpad);
+  GstVideoInfo *const vip = &sinkpriv->info;
+  GstVaapiVideoMeta *meta;
+  GstVaapiSurface *surface;
+  GstVaapiSurfaceProxy *proxy;
+  GstMemory *mem;
+  gpointer data;
+
+  mem = get_userptr_memory (inbuf, &data);
+  if (!mem)
+    return FALSE;
+
+  if (!plugin_update_sinkpad_info_from_buffer (plugin, sinkpad, inbuf))
+    return FALSE;
+
+  meta = gst_buffer_get_vaapi_video_meta (outbuf);
+  g_return_val_if_fail (meta != NULL, FALSE);
+
+  surface = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (mem),
+      GST_VAAPI_USERPTR_SURFACE_QUARK);
+  if (surface && (gst_vaapi_surface_get_format (surface) !=
+          GST_VIDEO_INFO_FORMAT (vip)
+          || gst_vaapi_surface_get_width (surface) != GST_VIDEO_INFO_WIDTH (vip)
+          || gst_vaapi_surface_get_height (surface) !=
+          GST_VIDEO_INFO_HEIGHT (vip)))
+    surface = NULL;
+
+  if (!surface) {
+    surface = gst_vaapi_surface_new_with_user_ptr (plugin->display, data, vip);
+    if (!surface) {
+      /* Do not retry on every frame if the driver refuses the layout */
+      GST_INFO_OBJECT (plugin, "driver can't wrap system memory, copying");
+      sinkpriv->can_userptr = FALSE;
+      return FALSE;
+    }
+    gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (mem),
+        GST_VAAPI_USERPTR_SURFACE_QUARK, surface,
+        (GDestroyNotify) gst_vaapi_surface_unref);
+  }
+
+  proxy = gst_vaapi_surface_proxy_new (surface);
+  if (!proxy)
+    return FALSE;
+  gst_vaapi_video_meta_set_surface_proxy (meta, proxy);
+  gst_vaapi_surface_proxy_unref (proxy);
+
+  /* The surface reads from inbuf, which must not be recycled before */
+  gst_buffer_add_parent_buffer_meta (outbuf, inbuf);
+  return TRUE;
+}
+
 static void
 plugin_reset_texture_map (GstVaapiPluginBase * plugin)
 {
@@ -267,6 +622,13 @@ plugin_reset_texture_map (GstVaapiPluginBase * plugin)
     gst_vaapi_display_reset_texture_map (plugin->display);
 }
 
+static void
+plugin_reset_dma_buf_cache (GstVaapiPluginBase * plugin)
+{
+  if (plugin->display)
+    gst_vaapi_surface_reset_dma_buf_cache (plugin->display);
+}
+
 static GstVaapiPadPrivate *
 default_get_vaapi_pad_private (GstVaapiPluginBase * plugin, GstPad * pad)
 {
@@ -306,8 +668,24 @@ gst_vaapi_plugin_base_init (GstVaapiPluginBase * plugin,
   if (plugin->srcpad)
     plugin->srcpriv = gst_vaapi_pad_private_new ();
 
+  g_mutex_init (&plugin->caps_cache_lock);
+  if (plugin->sinkpad)
+    caps_cache_watch_pad (plugin, plugin->sinkpad);
+  if (plugin->srcpad)
+    caps_cache_watch_pad (plugin, plugin->srcpad);
+
   plugin->enable_direct_rendering =
       (g_getenv ("GST_VAAPI_ENABLE_DIRECT_RENDERING") != NULL);
+
+  g_mutex_init (&plugin->stats_lock);
+  plugin->trace_stats = gst_vaapi_trace_stats_new ();
+  gst_vaapi_trace_stats_attach (plugin->trace_stats, plugin);
+  plugin->stats_last_post = GST_CLOCK_TIME_NONE;
+  plugin->numa_node = -1;
+  plugin->thread_policy = GST_VAAPI_THREAD_POLICY_NORMAL;
+  plugin->thread_priority = 0;
+  g_queue_init (&plugin->batch_queue);
+  plugin->startup_epoch = GST_CLOCK_TIME_NONE;
 }
 
 void
@@ -326,6 +704,90 @@ gst_vaapi_plugin_base_finalize (GstVaapiPluginBase * plugin)
     gst_object_unref (plugin->sinkpad);
   if (plugin->srcpad)
     gst_object_unref (plugin->srcpad);
+
+  if (plugin->caps_cache)
+    g_ptr_array_unref (plugin->caps_cache);
+  g_mutex_clear (&plugin->caps_cache_lock);
+
+  gst_vaapi_trace_stats_detach (plugin);
+  gst_vaapi_trace_stats_unref (plugin->trace_stats);
+  g_mutex_clear (&plugin->stats_lock);
+
+  g_queue_foreach (&plugin->batch_queue, (GFunc) gst_mini_object_unref, NULL);
+  g_queue_clear (&plugin->batch_queue);
+}
+
+/* The stages of the objects working for the element that make up its
+   startup, in the order of startup_stage_base */
+static const GstVaapiTraceStage startup_stages[] = {
+  GST_VAAPI_TRACE_STAGE_CONFIG,
+  GST_VAAPI_TRACE_STAGE_CONTEXT,
+  GST_VAAPI_TRACE_STAGE_SURFACES,
+};
+
+static const gchar *const startup_stage_fields[] = {
+  "config-time",
+  "context-time",
+  "surfaces-time",
+};
+
+/* Starts timing the startup, unless it already is */
+static void
+startup_begin (GstVaapiPluginBase * plugin)
+{
+  guint i;
+
+  g_mutex_lock (&plugin->stats_lock);
+  if (GST_CLOCK_TIME_IS_VALID (plugin->startup_epoch))
+    goto done;
+
+  plugin->startup_epoch = gst_util_get_timestamp ();
+  plugin->startup_display_time = 0;
+  plugin->startup_posted = FALSE;
+
+  /* The trace stats accumulate over the lifetime of the element */
+  for (i = 0; i < G_N_ELEMENTS (startup_stages); i++) {
+    plugin->startup_stage_base[i] =
+        gst_vaapi_trace_stats_get_total (plugin->trace_stats,
+        startup_stages[i]);
+  }
+
+done:
+  g_mutex_unlock (&plugin->stats_lock);
+}
+
+static void
+startup_reset (GstVaapiPluginBase * plugin)
+{
+  g_mutex_lock (&plugin->stats_lock);
+  plugin->startup_epoch = GST_CLOCK_TIME_NONE;
+  g_mutex_unlock (&plugin->stats_lock);
+}
+
+/* Builds the "vaapi-startup" structure, see
+   gst_vaapi_plugin_base_stats_frame_out(). Called with stats_lock
+   held, the display times are added afterwards */
+static GstStructure *
+startup_report_new (GstVaapiPluginBase * plugin, GstClockTime first_output)
+{
+  GstStructure *structure;
+  GstClockTime total;
+  guint i;
+
+  structure = gst_structure_new ("vaapi-startup",
+      "display-time", G_TYPE_UINT64, (guint64) plugin->startup_display_time,
+      NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (startup_stages); i++) {
+    total = gst_vaapi_trace_stats_get_total (plugin->trace_stats,
+        startup_stages[i]);
+    gst_structure_set (structure, startup_stage_fields[i], G_TYPE_UINT64,
+        (guint64) (total - plugin->startup_stage_base[i]), NULL);
+  }
+
+  gst_structure_set (structure, "first-output-time", G_TYPE_UINT64,
+      (guint64) first_output, NULL);
+  return structure;
 }
 
 /**
@@ -341,6 +803,15 @@ gboolean
 gst_vaapi_plugin_base_open (GstVaapiPluginBase * plugin)
 {
   gst_caps_replace (&plugin->allowed_raw_caps, NULL);
+  startup_begin (plugin);
+
+  /* Give the VA initialization a head start, off the state change
+     thread. It is joined by the first gst_vaapi_ensure_display() */
+  if (!plugin->display && !plugin->gl_display && !plugin->display_prefetch
+      && !g_getenv ("GST_VAAPI_DISABLE_ASYNC_DISPLAY"))
+    plugin->display_prefetch =
+        gst_vaapi_display_prefetch_new (plugin->display_type_req,
+        plugin->display_name);
   return TRUE;
 }
 
@@ -356,17 +827,25 @@ gst_vaapi_plugin_base_close (GstVaapiPluginBase * plugin)
 {
   /* Release vaapi textures first if exist, which refs display object */
   plugin_reset_texture_map (plugin);
+  /* Same for the imported dma-buf surfaces */
+  plugin_reset_dma_buf_cache (plugin);
+
+  g_clear_pointer (&plugin->display_prefetch,
+      gst_vaapi_display_prefetch_free);
 
   gst_object_replace (&plugin->gl_context, NULL);
   gst_object_replace (&plugin->gl_display, NULL);
   gst_object_replace (&plugin->gl_other_context, NULL);
 
   gst_caps_replace (&plugin->allowed_raw_caps, NULL);
+  gst_vaapi_plugin_base_clear_caps_cache (plugin);
 
   if (plugin->sinkpriv)
     gst_vaapi_pad_private_reset (plugin->sinkpriv);
   if (plugin->srcpriv)
     gst_vaapi_pad_private_reset (plugin->srcpriv);
+
+  startup_reset (plugin);
 }
 
 /**
@@ -442,15 +921,27 @@ gst_vaapi_plugin_base_set_display_name (GstVaapiPluginBase * plugin,
 gboolean
 gst_vaapi_plugin_base_ensure_display (GstVaapiPluginBase * plugin)
 {
+  GstClockTime start;
+  gboolean success;
+
+  /* Sinks are not opened, their startup begins here */
+  startup_begin (plugin);
+
   if (gst_vaapi_plugin_base_has_display_type (plugin, plugin->display_type_req))
     return TRUE;
   gst_vaapi_display_replace (&plugin->display, NULL);
 
-  if (!gst_vaapi_ensure_display (GST_ELEMENT (plugin),
-          plugin->display_type_req))
+  start = gst_util_get_timestamp ();
+  success = gst_vaapi_ensure_display (GST_ELEMENT (plugin),
+      plugin->display_type_req);
+  g_mutex_lock (&plugin->stats_lock);
+  plugin->startup_display_time += gst_util_get_timestamp () - start;
+  g_mutex_unlock (&plugin->stats_lock);
+  if (!success)
     return FALSE;
   plugin->display_type = gst_vaapi_display_get_display_type (plugin->display);
 
+  gst_vaapi_plugin_base_clear_caps_cache (plugin);
   GST_VAAPI_PLUGIN_BASE_GET_CLASS (plugin)->display_changed (plugin);
   return TRUE;
 }
@@ -488,6 +979,27 @@ reset_allocator (GstAllocator * allocator, GstVideoInfo * vinfo)
   return TRUE;
 }
 
+/* Pre-allocates the configured number of surfaces, so that the first
+   frames do not wait for vaCreateSurfaces() */
+static void
+prewarm_surface_pool (GstVaapiPluginBase * plugin, GstAllocator * allocator)
+{
+  GstVaapiVideoPool *pool;
+
+  if (plugin->surface_prewarm == 0)
+    return;
+  if (!GST_VAAPI_IS_VIDEO_ALLOCATOR (allocator))
+    return;
+
+  pool = GST_VAAPI_VIDEO_ALLOCATOR_CAST (allocator)->surface_pool;
+  if (!gst_vaapi_video_pool_reserve (pool, plugin->surface_prewarm))
+    GST_WARNING_OBJECT (plugin, "failed to pre-allocate %u surfaces",
+        plugin->surface_prewarm);
+  else
+    GST_INFO_OBJECT (plugin, "pre-allocated %u surfaces",
+        plugin->surface_prewarm);
+}
+
 static gboolean
 ensure_sinkpad_allocator (GstVaapiPluginBase * plugin, GstPad * sinkpad,
     GstCaps * caps, guint * size)
@@ -511,6 +1023,9 @@ ensure_sinkpad_allocator (GstVaapiPluginBase * plugin, GstPad * sinkpad,
   }
   sinkpriv->allocator =
       gst_vaapi_video_allocator_new (plugin->display, &vinfo, 0, usage_flag);
+  if (sinkpriv->allocator)
+    prewarm_surface_pool (plugin, sinkpriv->allocator);
+  plugin->surface_trim_count = 0;
 
 bail:
   if (!sinkpriv->allocator)
@@ -588,6 +1103,16 @@ ensure_srcpad_allocator (GstVaapiPluginBase * plugin, GstPad * srcpad,
 {
   GstVaapiPadPrivate *srcpriv = GST_VAAPI_PAD_PRIVATE (srcpad);
   const GstVideoInfo *image_info;
+  guint surface_alloc_flags, flags = 0;
+
+  surface_alloc_flags = srcpriv->compression ?
+      GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED : 0;
+  if (srcpriv->allocator) {
+    gst_allocator_get_vaapi_video_info (srcpriv->allocator, &flags);
+    if ((flags & GST_VAAPI_SURFACE_ALLOC_FLAG_COMPRESSED) !=
+        surface_alloc_flags)
+      g_clear_object (&srcpriv->allocator);
+  }
 
   if (!reset_allocator (srcpriv->allocator, vinfo))
     goto valid_allocator;
@@ -609,8 +1134,8 @@ ensure_srcpad_allocator (GstVaapiPluginBase * plugin, GstPad * srcpad,
       GST_INFO_OBJECT (plugin, "enabling direct rendering in source allocator");
     }
 
-    srcpriv->allocator =
-        gst_vaapi_video_allocator_new (plugin->display, vinfo, 0, usage_flag);
+    srcpriv->allocator = gst_vaapi_video_allocator_new (plugin->display,
+        vinfo, surface_alloc_flags, usage_flag);
   }
 
   if (!srcpriv->allocator)
@@ -775,7 +1300,7 @@ ensure_sinkpad_buffer_pool (GstVaapiPluginBase * plugin, GstPad * sinkpad)
 
   pool =
       gst_vaapi_plugin_base_create_pool (plugin, caps, size,
-      BUFFER_POOL_SINK_MIN_BUFFERS, 0,
+      BUFFER_POOL_SINK_MIN_BUFFERS + sinkpriv->min_buffers, 0,
       GST_VAAPI_VIDEO_BUFFER_POOL_OPTION_VIDEO_META, sinkpriv->allocator);
   if (!pool)
     return FALSE;
@@ -829,6 +1354,7 @@ _set_sinkpad_caps (GstVaapiPluginBase * plugin, GstPad * sinkpad,
         return FALSE;
       gst_caps_replace (&sinkpriv->caps, caps);
       sinkpriv->caps_is_raw = !gst_caps_has_vaapi_surface (caps);
+      sinkpriv->can_userptr = TRUE;
     }
 
     if (!ensure_sinkpad_buffer_pool (plugin, sinkpad))
@@ -887,6 +1413,14 @@ gst_vaapi_plugin_base_set_caps (GstVaapiPluginBase * plugin, GstCaps * incaps,
  * Proposes allocation parameters to the upstream elements on the requested
  * sinkpad.
  *
+ * The proposed pool holds as many buffers as the element keeps, see
+ * gst_vaapi_plugin_base_set_sink_min_buffers(). The same count is
+ * attached to the #GstVaapiVideoMeta allocation meta, so that an
+ * upstream VA-API element sizes its surfaces once for the whole chain,
+ * even if some element in between dropped or replaced the pool.
+ * It also tells whether the element lets its input surfaces be
+ * compressed, see gst_vaapi_plugin_base_set_sink_compression().
+ *
  * Returns: %TRUE if successful, %FALSE otherwise.
  */
 gboolean
@@ -896,8 +1430,9 @@ gst_vaapi_plugin_base_pad_propose_allocation (GstVaapiPluginBase * plugin,
   GstVaapiPadPrivate *sinkpriv = GST_VAAPI_PAD_PRIVATE (sinkpad);
   GstCaps *caps = NULL;
   GstBufferPool *pool = NULL;
+  GstStructure *params;
   gboolean need_pool;
-  guint size = 0, n_allocators;
+  guint size = 0, min, n_allocators;
 
   gst_query_parse_allocation (query, &caps, &need_pool);
   if (!caps)
@@ -906,10 +1441,17 @@ gst_vaapi_plugin_base_pad_propose_allocation (GstVaapiPluginBase * plugin,
   if (!ensure_sinkpad_allocator (plugin, sinkpad, caps, &size))
     return FALSE;
 
+  min = BUFFER_POOL_SINK_MIN_BUFFERS + sinkpriv->min_buffers;
   if (need_pool) {
-    pool = gst_vaapi_plugin_base_create_pool (plugin, caps, size,
-        BUFFER_POOL_SINK_MIN_BUFFERS, 0,
-        GST_VAAPI_VIDEO_BUFFER_POOL_OPTION_VIDEO_META, sinkpriv->allocator);
+    /* Hand out the sink pad pool if it is still unused, rather than
+       creating yet another set of surfaces for the same caps */
+    if (sinkpriv->buffer_pool
+        && !gst_buffer_pool_is_active (sinkpriv->buffer_pool)
+        && gst_vaapi_buffer_pool_caps_is_equal (sinkpriv->buffer_pool, caps))
+      pool = gst_object_ref (sinkpriv->buffer_pool);
+    else
+      pool = gst_vaapi_plugin_base_create_pool (plugin, caps, size, min, 0,
+          GST_VAAPI_VIDEO_BUFFER_POOL_OPTION_VIDEO_META, sinkpriv->allocator);
     if (!pool)
       return FALSE;
   }
@@ -922,20 +1464,36 @@ gst_vaapi_plugin_base_pad_propose_allocation (GstVaapiPluginBase * plugin,
   n_allocators = gst_query_get_n_allocation_params (query);
   if (n_allocators == 0) {
     GstAllocator *allocator;
+    GstAllocationParams params;
+
+    /* Page aligned system memory can be wrapped as a VA surface
+     * rather than copied, see plugin_bind_userptr_to_vaapi_buffer() */
+    gst_allocation_params_init (&params);
+    params.align = USERPTR_ALIGNMENT - 1;
 
     allocator = gst_allocator_find (GST_ALLOCATOR_SYSMEM);
-    gst_query_add_allocation_param (query, allocator, NULL);
+    gst_query_add_allocation_param (query, allocator, &params);
     gst_object_unref (allocator);
   }
   gst_query_add_allocation_param (query, sinkpriv->allocator, NULL);
 
-  gst_query_add_allocation_pool (query, pool, size,
-      BUFFER_POOL_SINK_MIN_BUFFERS, 0);
+  gst_query_add_allocation_pool (query, pool, size, min, 0);
   if (pool)
     gst_object_unref (pool);
 
-  gst_query_add_allocation_meta (query, GST_VAAPI_VIDEO_META_API_TYPE, NULL);
+  params = gst_structure_new (ALLOCATION_PARAMS_NAME,
+      ALLOCATION_PARAMS_MIN_BUFFERS, G_TYPE_UINT, min, NULL);
+  if (plugin->display) {
+    gst_structure_set (params, ALLOCATION_PARAMS_VA_DISPLAY, G_TYPE_POINTER,
+        gst_vaapi_display_get_display (plugin->display), NULL);
+    if (sinkpriv->compression)
+      gst_structure_set (params,
+          ALLOCATION_PARAMS_COMPRESSION, G_TYPE_BOOLEAN, TRUE, NULL);
+  }
+  gst_query_add_allocation_meta (query, GST_VAAPI_VIDEO_META_API_TYPE, params);
+  gst_structure_free (params);
   gst_query_add_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL);
+  gst_query_add_allocation_meta (query, GST_VAAPI_FENCE_META_API_TYPE, NULL);
   return TRUE;
 
   /* ERRORS */
@@ -964,6 +1522,47 @@ gst_vaapi_plugin_base_propose_allocation (GstVaapiPluginBase * plugin,
       query);
 }
 
+static gboolean
+configure_other_pool (GstVaapiPluginBase * plugin, GstBufferPool * pool,
+    GstCaps * caps, guint min, guint max)
+{
+  GstVaapiPadPrivate *const srcpriv = GST_VAAPI_PAD_PRIVATE (plugin->srcpad);
+  GstStructure *config;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps,
+      GST_VIDEO_INFO_SIZE (&srcpriv->info), min, max);
+  gst_buffer_pool_config_set_allocator (config, srcpriv->other_allocator,
+      &srcpriv->other_allocator_params);
+  if (!gst_buffer_pool_set_config (pool, config))
+    return FALSE;
+  return gst_buffer_pool_set_active (pool, TRUE);
+}
+
+/* Returns the pool of system memory buffers the VA frames are copied
+   into: the one proposed by downstream if it accepts the copy layout,
+   otherwise a plain video pool, so that the buffers are recycled
+   rather than allocated and faulted in for every frame */
+static GstBufferPool *
+ensure_other_pool (GstVaapiPluginBase * plugin, GstBufferPool * pool,
+    GstCaps * caps, guint min, guint max)
+{
+  if (pool) {
+    if (configure_other_pool (plugin, pool, caps, min, max))
+      return gst_object_ref (pool);
+    GST_INFO_OBJECT (plugin, "downstream pool %" GST_PTR_FORMAT
+        " refused the copy layout", pool);
+  }
+
+  pool = gst_video_buffer_pool_new ();
+  if (configure_other_pool (plugin, pool, caps, min, 0))
+    return pool;
+
+  GST_WARNING_OBJECT (plugin, "failed to set up a system memory pool");
+  gst_object_unref (pool);
+  return NULL;
+}
+
 /**
  * gst_vaapi_plugin_base_decide_allocation:
  * @plugin: a #GstVaapiPluginBase
@@ -984,6 +1583,7 @@ gst_vaapi_plugin_base_decide_allocation (GstVaapiPluginBase * plugin,
   GstCaps *caps = NULL;
   GstBufferPool *pool;
   GstVideoInfo vi;
+  GstBufferPool *other_pool = NULL;
   guint i, size, min, max, pool_options, num_allocators;
   gint index_allocator;
   gboolean update_pool = FALSE;
@@ -1080,12 +1680,15 @@ gst_vaapi_plugin_base_decide_allocation (GstVaapiPluginBase * plugin,
               GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT))
         pool_options |= GST_VAAPI_VIDEO_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT;
 
-      /* GstVaapiVideoMeta is mandatory, and this implies VA surface memory */
+      /* GstVaapiVideoMeta is mandatory, and this implies VA surface
+         memory. The downstream pool is kept aside though, since the
+         frames may have to be copied into system memory anyway */
       if (!gst_buffer_pool_has_option (pool,
               GST_BUFFER_POOL_OPTION_VAAPI_VIDEO_META)) {
         GST_INFO_OBJECT (plugin, "ignoring non-VAAPI pool: %" GST_PTR_FORMAT,
             pool);
-        g_clear_object (&pool);
+        other_pool = pool;
+        pool = NULL;
       }
     }
   } else {
@@ -1094,6 +1697,54 @@ gst_vaapi_plugin_base_decide_allocation (GstVaapiPluginBase * plugin,
     min = max = 0;
   }
 
+  /* The pool may have been dropped or resized on the way, while the
+     surfaces held by the VA-API elements downstream are still known */
+  srcpriv->compression = FALSE;
+  if (gst_query_find_allocation_meta (query, GST_VAAPI_VIDEO_META_API_TYPE,
+          &i)) {
+    const GstStructure *params;
+    gpointer va_display = NULL;
+    gboolean compression = FALSE;
+    guint held;
+
+    gst_query_parse_nth_allocation_meta (query, i, &params);
+    if (params && gst_structure_get_uint (params,
+            ALLOCATION_PARAMS_MIN_BUFFERS, &held) && held > min) {
+      GST_DEBUG_OBJECT (plugin, "downstream holds %u surfaces, pool "
+          "requested %u", held, min);
+      min = held;
+      if (max > 0 && max < min)
+        max = min;
+    }
+
+    if (params) {
+      gst_structure_get (params, ALLOCATION_PARAMS_VA_DISPLAY,
+          G_TYPE_POINTER, &va_display, NULL);
+      gst_structure_get_boolean (params, ALLOCATION_PARAMS_COMPRESSION,
+          &compression);
+    }
+
+    /* Compressed surfaces never cross a CPU mapping, a dmabuf export
+       or another VA display, where they would have to be resolved */
+    srcpriv->compression = compression && va_display ==
+        gst_vaapi_display_get_display (plugin->display) &&
+        gst_caps_has_vaapi_surface (caps);
+
+    /* The surfaces of a pool from another VA display, possibly on
+       another device, cannot be rendered to. Ours are shared with it
+       through dma-buf instead, see plugin_import_vaapi_buffer() */
+    if (va_display && va_display !=
+        gst_vaapi_display_get_display (plugin->display) && pool) {
+      GST_INFO_OBJECT (plugin, "ignoring pool of another VA display: %"
+          GST_PTR_FORMAT, pool);
+      gst_object_unref (pool);
+      pool = NULL;
+    }
+  }
+  srcpriv->min_buffers = min;
+  GST_DEBUG_OBJECT (plugin, "compressed surfaces %s",
+      srcpriv->compression ? "enabled" : "disabled");
+
   if (!pool) {
     if (!ensure_srcpad_allocator (plugin, plugin->srcpad, &vi, caps))
       goto error;
@@ -1130,6 +1781,15 @@ gst_vaapi_plugin_base_decide_allocation (GstVaapiPluginBase * plugin,
    * should copy the VA-API frame into a dumb buffer */
   plugin->copy_output_frame = gst_vaapi_video_buffer_pool_copy_buffer (pool);
 
+  if (srcpriv->other_pool) {
+    gst_buffer_pool_set_active (srcpriv->other_pool, FALSE);
+    g_clear_object (&srcpriv->other_pool);
+  }
+  if (plugin->copy_output_frame)
+    srcpriv->other_pool = ensure_other_pool (plugin, other_pool, caps, min,
+        max);
+  g_clear_object (&other_pool);
+
   return TRUE;
 
   /* ERRORS */
@@ -1152,6 +1812,7 @@ error_ensure_display:
 error:
   {
     /* error message already sent */
+    g_clear_object (&other_pool);
     return FALSE;
   }
 }
@@ -1166,7 +1827,8 @@ error:
  * Acquires the static sink pad (input) buffer as a VA surface backed
  * buffer. This is mostly useful for raw YUV buffers, as source
  * buffers that are already backed as a VA surface are passed
- * verbatim.
+ * verbatim, unless the surface belongs to another VA display. It is
+ * then shared through a dma-buf export rather than copied.
  *
  * Returns: #GST_FLOW_OK if the buffer could be acquired
  */
@@ -1176,7 +1838,9 @@ gst_vaapi_plugin_base_pad_get_input_buffer (GstVaapiPluginBase * plugin,
 {
   GstVaapiPadPrivate *sinkpriv = GST_VAAPI_PAD_PRIVATE (sinkpad);
   GstVaapiVideoMeta *meta;
+  GstVaapiFenceMeta *fence_meta;
   GstBuffer *outbuf;
+  GstMemory *mem;
   GstVideoFrame src_frame, out_frame;
   gboolean success;
 
@@ -1185,6 +1849,14 @@ gst_vaapi_plugin_base_pad_get_input_buffer (GstVaapiPluginBase * plugin,
 
   meta = gst_buffer_get_vaapi_video_meta (inbuf);
   if (meta) {
+    if (plugin->display &&
+        gst_vaapi_video_meta_get_display (meta) != plugin->display) {
+      outbuf = plugin_import_vaapi_buffer (plugin, inbuf, meta);
+      if (!outbuf)
+        goto error_import_buffer;
+      *outbuf_ptr = outbuf;
+      return GST_FLOW_OK;
+    }
     *outbuf_ptr = gst_buffer_ref (inbuf);
     return GST_FLOW_OK;
   }
@@ -1205,14 +1877,32 @@ gst_vaapi_plugin_base_pad_get_input_buffer (GstVaapiPluginBase * plugin,
     goto error_create_buffer;
 
   if (is_dma_buffer (inbuf)) {
+    /* The producer left the wait for its GPU writes to us */
+    fence_meta = gst_buffer_get_vaapi_fence_meta (inbuf);
+    if (fence_meta && !gst_vaapi_fence_meta_wait (fence_meta))
+      goto error_wait_fence;
     if (!plugin_bind_dma_to_vaapi_buffer (plugin, sinkpad, inbuf, outbuf))
       goto error_bind_dma_buffer;
     goto done;
   }
 
+  if (sinkpriv->can_userptr &&
+      plugin_bind_userptr_to_vaapi_buffer (plugin, sinkpad, inbuf, outbuf))
+    goto done;
+
   if (!gst_video_frame_map (&src_frame, &sinkpriv->info, inbuf, GST_MAP_READ))
     goto error_map_src_buffer;
 
+  /* Single copy into the surface, converting the chroma layout if
+   * needed, rather than going through a VA image */
+  mem = gst_buffer_peek_memory (outbuf, 0);
+  if (GST_VAAPI_IS_VIDEO_MEMORY (mem) &&
+      gst_vaapi_video_memory_upload_frame (GST_VAAPI_VIDEO_MEMORY_CAST (mem),
+          &src_frame)) {
+    gst_video_frame_unmap (&src_frame);
+    goto done;
+  }
+
   if (!gst_video_frame_map (&out_frame, &sinkpriv->info, outbuf, GST_MAP_WRITE))
     goto error_map_dst_buffer;
 
@@ -1275,6 +1965,19 @@ error_bind_dma_buffer:
     gst_buffer_unref (outbuf);
     return GST_FLOW_ERROR;
   }
+error_wait_fence:
+  {
+    GST_ELEMENT_ERROR (plugin, STREAM, FAILED, ("Allocation failed"),
+        ("failed to wait for the dma_buf fence"));
+    gst_buffer_unref (outbuf);
+    return GST_FLOW_ERROR;
+  }
+error_import_buffer:
+  {
+    GST_ELEMENT_ERROR (plugin, STREAM, FAILED, ("Allocation failed"),
+        ("failed to share VA surface with another VA display"));
+    return GST_FLOW_ERROR;
+  }
 error_copy_buffer:
   {
     GST_WARNING_OBJECT (plugin, "failed to upload buffer to VA surface");
@@ -1518,12 +2221,588 @@ gst_vaapi_plugin_base_get_allowed_sinkpad_raw_caps (GstVaapiPluginBase * plugin)
 }
 
 /**
- * gst_vaapi_plugin_base_set_srcpad_can_dmabuf:
+ * gst_vaapi_plugin_base_trim_surface_pool:
  * @plugin: a #GstVaapiPluginBase
- * @object: the GL context from gst-gl
+ * @idle: %TRUE if no more frames are expected for now, e.g. on EOS
  *
- * This function will determine if @object supports dmabuf
- * importing on the base plugin static srcpad.
+ * Applies the surface pool sizing policy to the sink pad allocator. In
+ * streaming, it is meant to be called once per frame: every
+ * surface-trim-period frames, free surfaces in excess of the largest
+ * number of surfaces simultaneously used over that period, or of the
+ * pre-warm size if larger, are released. When @idle, the pool is
+ * shrunk down to the pre-warm size regardless of the period.
+ */
+void
+gst_vaapi_plugin_base_trim_surface_pool (GstVaapiPluginBase * plugin,
+    gboolean idle)
+{
+  GstAllocator *allocator;
+  GstVaapiVideoPool *pool;
+  guint high_water, target, released;
+
+  if (!plugin->sinkpriv || plugin->surface_trim_period == 0)
+    return;
+  if (!idle && ++plugin->surface_trim_count < plugin->surface_trim_period)
+    return;
+  plugin->surface_trim_count = 0;
+
+  allocator = plugin->sinkpriv->allocator;
+  if (!allocator || !GST_VAAPI_IS_VIDEO_ALLOCATOR (allocator))
+    return;
+
+  pool = GST_VAAPI_VIDEO_ALLOCATOR_CAST (allocator)->surface_pool;
+  high_water = gst_vaapi_video_pool_get_high_water_mark (pool, TRUE);
+  target = MAX (plugin->surface_prewarm, idle ? 0 : high_water);
+
+  released = gst_vaapi_video_pool_shrink (pool, target);
+  if (released > 0)
+    GST_DEBUG_OBJECT (plugin, "released %u idle surfaces (high-water mark %u)",
+        released, high_water);
+}
+
+/**
+ * gst_vaapi_plugin_base_bind_thread:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Binds the calling thread, and the memory it allocates from now on,
+ * to the NUMA node set on @plugin, or else to the node the GPU is
+ * attached to. This is cheap once the thread is bound, so that task
+ * functions can call it on every iteration.
+ *
+ * Returns: %TRUE if the thread is bound to a NUMA node
+ */
+gboolean
+gst_vaapi_plugin_base_bind_thread (GstVaapiPluginBase * plugin)
+{
+  gint node = plugin->numa_node;
+
+  if (node < 0 && plugin->display)
+    node = gst_vaapi_display_get_numa_node (plugin->display);
+  return gst_vaapi_numa_bind_thread (node);
+}
+
+/* The scheduling applied to the calling thread, plus one, encoded as
+   the policy in the upper bits and the priority offset by 20 below */
+static GPrivate thread_scheduling;
+
+#ifdef __linux__
+/* Returns 0, or the error number */
+static gint
+apply_thread_scheduling (guint policy, gint priority)
+{
+  struct sched_param param = { 0, };
+  gint sched_policy, err;
+
+  if (policy == GST_VAAPI_THREAD_POLICY_NORMAL) {
+    /* Back from a real-time policy first, if the thread was reused */
+    err = pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+    if (err != 0)
+      return err;
+    /* On Linux, the nice value is per thread */
+    if (setpriority (PRIO_PROCESS, syscall (SYS_gettid),
+            CLAMP (priority, -20, 19)) != 0)
+      return errno;
+    return 0;
+  }
+
+  sched_policy = policy == GST_VAAPI_THREAD_POLICY_FIFO ?
+      SCHED_FIFO : SCHED_RR;
+  param.sched_priority = CLAMP (priority,
+      sched_get_priority_min (sched_policy),
+      sched_get_priority_max (sched_policy));
+  return pthread_setschedparam (pthread_self (), sched_policy, &param);
+}
+#endif
+
+/**
+ * gst_vaapi_plugin_base_set_thread_scheduling:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Applies the thread-policy and thread-priority of @plugin to the
+ * calling thread. Threads are left alone until either is changed from
+ * its default, and this is cheap once applied, so that task functions
+ * can call it on every iteration. Raising the priority normally takes
+ * CAP_SYS_NICE, or an RLIMIT_RTPRIO for the real-time policies.
+ */
+void
+gst_vaapi_plugin_base_set_thread_scheduling (GstVaapiPluginBase * plugin)
+{
+  const guint policy = plugin->thread_policy;
+  const gint priority = CLAMP (plugin->thread_priority, -20, 99);
+  const guint key = ((policy << 8) | (priority + 20)) + 1;
+  const guint applied = GPOINTER_TO_UINT (g_private_get (&thread_scheduling));
+#ifdef __linux__
+  gint err;
+#endif
+
+  if (applied == key)
+    return;
+  if (applied == 0 && policy == GST_VAAPI_THREAD_POLICY_NORMAL
+      && priority == 0)
+    return;
+
+  /* Remember failures too, not to retry and warn on every iteration */
+  g_private_set (&thread_scheduling, GUINT_TO_POINTER (key));
+
+#ifdef __linux__
+  err = apply_thread_scheduling (policy, priority);
+  if (err != 0) {
+    GST_WARNING_OBJECT (plugin, "failed to set thread scheduling policy %u "
+        "priority %d: %s", policy, priority, g_strerror (err));
+    return;
+  }
+  GST_DEBUG_OBJECT (plugin, "thread scheduling policy %u priority %d",
+      policy, priority);
+#else
+  GST_WARNING_OBJECT (plugin, "thread scheduling is not supported");
+#endif
+}
+
+/* Holds back what the base class pushes from the batching thread, so
+   that the buffers go downstream as lists, in order with the events */
+static GstPadProbeReturn
+batch_probe (GstPad * pad, GstPadProbeInfo * info, GstVaapiPluginBase * plugin)
+{
+  GstMiniObject *const data = GST_PAD_PROBE_INFO_DATA (info);
+
+  if (plugin->batch_thread != g_thread_self ())
+    return GST_PAD_PROBE_OK;
+  /* Nothing to keep in order with */
+  if (GST_IS_EVENT (data) && (g_queue_is_empty (&plugin->batch_queue)
+          || !GST_EVENT_IS_SERIALIZED (GST_EVENT_CAST (data))))
+    return GST_PAD_PROBE_OK;
+
+  /* The probe owns what it handles */
+  g_queue_push_tail (&plugin->batch_queue, data);
+  GST_PAD_PROBE_INFO_FLOW_RETURN (info) = GST_FLOW_OK;
+  return GST_PAD_PROBE_HANDLED;
+}
+
+/**
+ * gst_vaapi_plugin_base_begin_output_batch:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Starts holding back the buffers pushed on the source pad from the
+ * calling thread, e.g. by gst_video_decoder_finish_frame(), if the
+ * element batches its output. They are pushed downstream as a
+ * #GstBufferList by gst_vaapi_plugin_base_end_output_batch(), which
+ * saves the per-buffer overhead of the elements downstream for high
+ * frame rates.
+ */
+void
+gst_vaapi_plugin_base_begin_output_batch (GstVaapiPluginBase * plugin)
+{
+  if (!plugin->batch_output)
+    return;
+
+  if (!plugin->batch_probe_id) {
+    plugin->batch_probe_id = gst_pad_add_probe (plugin->srcpad,
+        GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+        (GstPadProbeCallback) batch_probe, plugin, NULL);
+  }
+  plugin->batch_thread = g_thread_self ();
+}
+
+/**
+ * gst_vaapi_plugin_base_end_output_batch:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Pushes what was held back since
+ * gst_vaapi_plugin_base_begin_output_batch(): each run of buffers as
+ * a #GstBufferList, and the events in between as they came.
+ *
+ * Returns: the first #GstFlowReturn that is not %GST_FLOW_OK, if any
+ */
+GstFlowReturn
+gst_vaapi_plugin_base_end_output_batch (GstVaapiPluginBase * plugin)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstBufferList *list = NULL;
+  GstMiniObject *data;
+
+  plugin->batch_thread = NULL;
+
+  while ((data = g_queue_pop_head (&plugin->batch_queue))) {
+    if (GST_IS_BUFFER (data)) {
+      if (!list)
+        list = gst_buffer_list_new ();
+      gst_buffer_list_add (list, GST_BUFFER_CAST (data));
+      if (!g_queue_is_empty (&plugin->batch_queue) &&
+          GST_IS_BUFFER (g_queue_peek_head (&plugin->batch_queue)))
+        continue;
+
+      /* Downstream would refuse the next buffers all the same */
+      if (ret != GST_FLOW_OK) {
+        gst_buffer_list_unref (list);
+        list = NULL;
+        continue;
+      }
+
+      GST_LOG_OBJECT (plugin, "pushing %u buffers",
+          gst_buffer_list_length (list));
+      ret = gst_pad_push_list (plugin->srcpad, list);
+      list = NULL;
+    } else {
+      gst_pad_push_event (plugin->srcpad, GST_EVENT_CAST (data));
+    }
+  }
+  return ret;
+}
+
+GType
+gst_vaapi_thread_policy_get_type (void)
+{
+  static gsize g_type = 0;
+
+  static const GEnumValue thread_policy_values[] = {
+    {GST_VAAPI_THREAD_POLICY_NORMAL,
+        "Time-shared, at a nice value", "normal"},
+    {GST_VAAPI_THREAD_POLICY_FIFO,
+        "Real-time first-in first-out", "fifo"},
+    {GST_VAAPI_THREAD_POLICY_RR,
+        "Real-time round-robin", "rr"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&g_type)) {
+    const GType type =
+        g_enum_register_static ("GstVaapiThreadPolicy", thread_policy_values);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
+GType
+gst_vaapi_job_priority_get_type (void)
+{
+  static gsize g_type = 0;
+
+  static const GEnumValue job_priority_values[] = {
+    {GST_VAAPI_JOB_PRIORITY_BATCH,
+        "Run after live jobs", "batch"},
+    {GST_VAAPI_JOB_PRIORITY_LIVE,
+        "Run by earliest running time", "live"},
+    {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter (&g_type)) {
+    const GType type =
+        g_enum_register_static ("GstVaapiJobPriority", job_priority_values);
+    g_once_init_leave (&g_type, type);
+  }
+  return g_type;
+}
+
+/**
+ * gst_vaapi_plugin_base_get_job_deadline:
+ * @plugin: a #GstVaapiPluginBase
+ * @segment: the #GstSegment @timestamp belongs to
+ * @timestamp: the timestamp of the frame about to be processed
+ *
+ * Computes the deadline the next hardware job of @plugin is scheduled
+ * by. Batch elements get no deadline, so they only run once no live
+ * job is pending. Live elements get the clock time at which the frame
+ * is due, and turn job scheduling on for the display they use.
+ *
+ * Returns: the job deadline, or %GST_CLOCK_TIME_NONE
+ */
+GstClockTime
+gst_vaapi_plugin_base_get_job_deadline (GstVaapiPluginBase * plugin,
+    const GstSegment * segment, GstClockTime timestamp)
+{
+  GstClockTime running_time;
+
+  if (plugin->job_priority != GST_VAAPI_JOB_PRIORITY_LIVE || !plugin->display)
+    return GST_CLOCK_TIME_NONE;
+
+  if (!gst_vaapi_display_get_job_scheduling (plugin->display))
+    gst_vaapi_display_set_job_scheduling (plugin->display, TRUE);
+
+  /* Frames without a timestamp still run ahead of batch jobs */
+  if (!GST_CLOCK_TIME_IS_VALID (timestamp) || !segment)
+    return 0;
+  running_time = gst_segment_to_running_time (segment, GST_FORMAT_TIME,
+      timestamp);
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return 0;
+  return gst_element_get_base_time (GST_ELEMENT (plugin)) + running_time;
+}
+
+/**
+ * gst_vaapi_plugin_base_get_priority:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Determines the priority the VA contexts of @plugin get from the GPU
+ * scheduler. Unless one was set explicitly, live elements run ahead
+ * of the others.
+ *
+ * Returns: the #GstVaapiPriority
+ */
+GstVaapiPriority
+gst_vaapi_plugin_base_get_priority (GstVaapiPluginBase * plugin)
+{
+  if (plugin->priority == GST_VAAPI_PRIORITY_DEFAULT &&
+      plugin->job_priority == GST_VAAPI_JOB_PRIORITY_LIVE)
+    return GST_VAAPI_PRIORITY_HIGH;
+  return plugin->priority;
+}
+
+/**
+ * gst_vaapi_plugin_base_report_load:
+ * @plugin: a #GstVaapiPluginBase
+ * @overloaded: %TRUE if the frame being reported on was late
+ *
+ * Feeds the load estimate of the display with a sample observed by
+ * @plugin, if it adapts its quality to the load.
+ */
+void
+gst_vaapi_plugin_base_report_load (GstVaapiPluginBase * plugin,
+    gboolean overloaded)
+{
+  if (plugin->adaptive_quality && plugin->display)
+    gst_vaapi_display_report_load (plugin->display, overloaded);
+}
+
+/**
+ * gst_vaapi_plugin_base_report_qos:
+ * @plugin: a #GstVaapiPluginBase
+ * @event: an upstream #GstEvent
+ *
+ * Feeds the load estimate of the display with the lateness carried by
+ * @event, if it is a QoS event. Throttle events, sent on purpose by a
+ * rate limiting sink, don't tell about the load.
+ */
+void
+gst_vaapi_plugin_base_report_qos (GstVaapiPluginBase * plugin,
+    GstEvent * event)
+{
+  GstQOSType type;
+  GstClockTimeDiff diff;
+
+  if (GST_EVENT_TYPE (event) != GST_EVENT_QOS)
+    return;
+
+  gst_event_parse_qos (event, &type, NULL, &diff, NULL);
+  if (type != GST_QOS_TYPE_THROTTLE)
+    gst_vaapi_plugin_base_report_load (plugin, diff > 0);
+}
+
+/**
+ * gst_vaapi_plugin_base_get_load_level:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Returns: the load level of the display @plugin should degrade its
+ *   quality for, i.e. %GST_VAAPI_DISPLAY_LOAD_NORMAL unless it adapts
+ *   its quality to the load
+ */
+GstVaapiDisplayLoadLevel
+gst_vaapi_plugin_base_get_load_level (GstVaapiPluginBase * plugin)
+{
+  if (!plugin->adaptive_quality || !plugin->display)
+    return GST_VAAPI_DISPLAY_LOAD_NORMAL;
+  return gst_vaapi_display_get_load_level (plugin->display);
+}
+
+/**
+ * gst_vaapi_plugin_base_class_install_stats_properties:
+ * @klass: the #GObjectClass of a #GstVaapiPluginBase subclass
+ * @stats_prop_id: the id of the "stats" property
+ * @interval_prop_id: the id of the "stats-interval" property
+ *
+ * Installs the properties exposing the live performance counters of
+ * the element, as returned by gst_vaapi_plugin_base_get_stats(). The
+ * subclass maps them to that function and to the stats_interval field.
+ */
+void
+gst_vaapi_plugin_base_class_install_stats_properties (GObjectClass * klass,
+    guint stats_prop_id, guint interval_prop_id)
+{
+  g_object_class_install_property (klass, stats_prop_id,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Live performance counters of the element, latencies in ns",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (klass, interval_prop_id,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval in ms between statistics element messages posted on "
+          "the bus (0 = never)", 0, G_MAXUINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+/**
+ * gst_vaapi_plugin_base_stats_attach:
+ * @plugin: a #GstVaapiPluginBase
+ * @object: a decoder, encoder or filter object working for @plugin
+ *
+ * Accounts the stage latencies of @object into the statistics of
+ * @plugin.
+ */
+void
+gst_vaapi_plugin_base_stats_attach (GstVaapiPluginBase * plugin,
+    gpointer object)
+{
+  gst_vaapi_trace_stats_attach (plugin->trace_stats, object);
+}
+
+/**
+ * gst_vaapi_plugin_base_stats_frame_in:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Accounts a frame received by @plugin.
+ */
+void
+gst_vaapi_plugin_base_stats_frame_in (GstVaapiPluginBase * plugin)
+{
+  g_mutex_lock (&plugin->stats_lock);
+  plugin->frames_in++;
+  g_mutex_unlock (&plugin->stats_lock);
+}
+
+/**
+ * gst_vaapi_plugin_base_stats_frame_out:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Accounts a frame produced, or rendered, by @plugin, and posts the
+ * statistics on the bus if the "stats-interval" elapsed.
+ *
+ * The first frame since @plugin was opened also posts a "vaapi-startup"
+ * element message, which breaks down the time it took to get there, in
+ * ns: "display-time" to get the display, either from the context or by
+ * creating it, "va-initialize-time" and "probe-time" for vaInitialize()
+ * and the capability queries of the display, which may be shared with
+ * other elements that paid for them, "config-time", "context-time" and
+ * "surfaces-time" to create the VA objects, and "first-output-time"
+ * from the opening of @plugin to this frame.
+ */
+void
+gst_vaapi_plugin_base_stats_frame_out (GstVaapiPluginBase * plugin)
+{
+  GstClockTime now = GST_CLOCK_TIME_NONE;
+  GstClockTime init_time, probe_time;
+  GstStructure *startup = NULL;
+  gboolean post = FALSE;
+
+  g_mutex_lock (&plugin->stats_lock);
+  plugin->frames_out++;
+  if (!plugin->startup_posted &&
+      GST_CLOCK_TIME_IS_VALID (plugin->startup_epoch)) {
+    plugin->startup_posted = TRUE;
+    startup = startup_report_new (plugin,
+        gst_util_get_timestamp () - plugin->startup_epoch);
+  }
+  if (plugin->stats_interval > 0) {
+    now = gst_util_get_timestamp ();
+    if (!GST_CLOCK_TIME_IS_VALID (plugin->stats_last_post))
+      plugin->stats_last_post = now;
+    else if (now - plugin->stats_last_post >=
+        plugin->stats_interval * GST_MSECOND) {
+      plugin->stats_last_post = now;
+      post = TRUE;
+    }
+  }
+  g_mutex_unlock (&plugin->stats_lock);
+
+  if (startup) {
+    if (plugin->display &&
+        gst_vaapi_display_get_startup_times (plugin->display, &init_time,
+            &probe_time)) {
+      gst_structure_set (startup,
+          "va-initialize-time", G_TYPE_UINT64, (guint64) init_time,
+          "probe-time", G_TYPE_UINT64, (guint64) probe_time, NULL);
+    }
+    GST_INFO_OBJECT (plugin, "startup: %" GST_PTR_FORMAT, startup);
+    gst_element_post_message (GST_ELEMENT_CAST (plugin),
+        gst_message_new_element (GST_OBJECT_CAST (plugin), startup));
+  }
+
+  if (post) {
+    gst_element_post_message (GST_ELEMENT_CAST (plugin),
+        gst_message_new_element (GST_OBJECT_CAST (plugin),
+            gst_vaapi_plugin_base_get_stats (plugin)));
+  }
+}
+
+/**
+ * gst_vaapi_plugin_base_stats_frame_dropped:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Accounts a frame dropped by @plugin.
+ */
+void
+gst_vaapi_plugin_base_stats_frame_dropped (GstVaapiPluginBase * plugin)
+{
+  g_mutex_lock (&plugin->stats_lock);
+  plugin->frames_dropped++;
+  g_mutex_unlock (&plugin->stats_lock);
+}
+
+/**
+ * gst_vaapi_plugin_base_get_stats:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Builds a "vaapi-stats" structure with the counters of @plugin since
+ * it was created: the frames received, produced and dropped, the count,
+ * average and maximum latency of each pipeline stage it performed, the
+ * surfaces in use in its buffer pool and their high-water mark, and the
+ * number of VA display lock acquisitions, which serialize the VA calls,
+ * along with the time the lock was held. Subclasses can add their own
+ * counters through the append_stats() class function.
+ *
+ * Returns: (transfer full): a new #GstStructure
+ */
+GstStructure *
+gst_vaapi_plugin_base_get_stats (GstVaapiPluginBase * plugin)
+{
+  GstStructure *structure;
+  GstBufferPool *pool = NULL;
+  guint64 lock_count;
+  GstClockTime lock_time;
+  guint in_use, max_in_use;
+
+  g_mutex_lock (&plugin->stats_lock);
+  structure = gst_structure_new ("vaapi-stats",
+      "frames-in", G_TYPE_UINT64, plugin->frames_in,
+      "frames-out", G_TYPE_UINT64, plugin->frames_out,
+      "frames-dropped", G_TYPE_UINT64, plugin->frames_dropped, NULL);
+  g_mutex_unlock (&plugin->stats_lock);
+
+  gst_vaapi_trace_stats_append (plugin->trace_stats, structure);
+
+  /* The surfaces an element outputs, or else the ones it receives */
+  if (plugin->srcpriv && plugin->srcpriv->buffer_pool &&
+      GST_VAAPI_IS_VIDEO_BUFFER_POOL (plugin->srcpriv->buffer_pool))
+    pool = gst_object_ref (plugin->srcpriv->buffer_pool);
+  else if (plugin->sinkpriv && plugin->sinkpriv->buffer_pool &&
+      GST_VAAPI_IS_VIDEO_BUFFER_POOL (plugin->sinkpriv->buffer_pool))
+    pool = gst_object_ref (plugin->sinkpriv->buffer_pool);
+
+  if (pool) {
+    gst_vaapi_video_buffer_pool_get_usage (pool, &in_use, &max_in_use);
+    gst_structure_set (structure, "surfaces-in-use", G_TYPE_UINT, in_use,
+        "surfaces-max-in-use", G_TYPE_UINT, max_in_use, NULL);
+    gst_object_unref (pool);
+  }
+
+  if (plugin->display &&
+      gst_vaapi_display_get_lock_stats (plugin->display, &lock_count,
+          &lock_time)) {
+    gst_structure_set (structure,
+        "display-lock-count", G_TYPE_UINT64, lock_count,
+        "display-lock-time", G_TYPE_UINT64, (guint64) lock_time, NULL);
+  }
+
+  if (GST_VAAPI_PLUGIN_BASE_GET_CLASS (plugin)->append_stats)
+    GST_VAAPI_PLUGIN_BASE_GET_CLASS (plugin)->append_stats (plugin, structure);
+  return structure;
+}
+
+/**
+ * gst_vaapi_plugin_base_set_srcpad_can_dmabuf:
+ * @plugin: a #GstVaapiPluginBase
+ * @object: the GL context from gst-gl
+ *
+ * This function will determine if @object supports dmabuf
+ * importing on the base plugin static srcpad.
  *
  * Please note that the context @object should come from downstream.
  **/
@@ -1555,6 +2834,85 @@ _init_performance_debug (void)
 #endif
 }
 
+/* Same as gst_video_frame_copy() but reading the source planes with
+   gst_vaapi_copy_plane(), since VA mappings are usually uncached */
+static gboolean
+copy_video_frame (GstVideoFrame * dst, const GstVideoFrame * src)
+{
+  const GstVideoFormatInfo *const finfo = dst->info.finfo;
+  guint i, w, h;
+  gint comp[GST_VIDEO_MAX_COMPONENTS];
+
+  if (GST_VIDEO_FORMAT_INFO_IS_TILED (finfo) ||
+      GST_VIDEO_FORMAT_INFO_HAS_PALETTE (finfo) ||
+      GST_VIDEO_INFO_WIDTH (&dst->info) != GST_VIDEO_INFO_WIDTH (&src->info) ||
+      GST_VIDEO_INFO_HEIGHT (&dst->info) != GST_VIDEO_INFO_HEIGHT (&src->info))
+    return gst_video_frame_copy (dst, src);
+
+  for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (dst); i++) {
+    gst_video_format_info_component (finfo, i, comp);
+    w = GST_VIDEO_FRAME_COMP_WIDTH (dst, comp[0]) *
+        GST_VIDEO_FRAME_COMP_PSTRIDE (dst, comp[0]);
+    if (w == 0)
+      return gst_video_frame_copy (dst, src);
+    h = GST_VIDEO_FRAME_COMP_HEIGHT (dst, comp[0]);
+
+    gst_vaapi_copy_plane (GST_VIDEO_FRAME_PLANE_DATA (dst, i),
+        GST_VIDEO_FRAME_PLANE_STRIDE (dst, i),
+        GST_VIDEO_FRAME_PLANE_DATA (src, i),
+        GST_VIDEO_FRAME_PLANE_STRIDE (src, i), w, h);
+  }
+  return TRUE;
+}
+
+/* Copies the surface of @inbuf into the memory of @outbuf with the
+   copy engine of the GPU, through a surface wrapping that memory */
+static gboolean
+copy_va_buffer_with_gpu (GstVaapiPluginBase * plugin, GstBuffer * inbuf,
+    GstBuffer * outbuf)
+{
+  GstVaapiPadPrivate *srcpriv = GST_VAAPI_PAD_PRIVATE (plugin->srcpad);
+  GstVaapiVideoMeta *meta;
+  GstVaapiSurface *src_surface, *dst_surface;
+  GstMapInfo map;
+  gboolean success;
+
+  if (plugin->no_gpu_copy || gst_buffer_n_memory (outbuf) != 1)
+    return FALSE;
+
+  meta = gst_buffer_get_vaapi_video_meta (inbuf);
+  src_surface = meta ? gst_vaapi_video_meta_get_surface (meta) : NULL;
+  if (!src_surface)
+    return FALSE;
+
+  if (!gst_buffer_map (outbuf, &map, GST_MAP_WRITE))
+    return FALSE;
+  /* User pointer surfaces need page aligned memory */
+  dst_surface = ((guintptr) map.data & 4095) != 0 ? NULL :
+      gst_vaapi_surface_new_with_user_ptr (plugin->display, map.data,
+      &srcpriv->info);
+  if (!dst_surface) {
+    gst_buffer_unmap (outbuf, &map);
+    goto error_no_gpu_copy;
+  }
+  success = gst_vaapi_surface_copy (dst_surface, src_surface);
+  gst_vaapi_surface_unref (dst_surface);
+  gst_buffer_unmap (outbuf, &map);
+  if (!success)
+    goto error_no_gpu_copy;
+  return TRUE;
+
+  /* ERRORS */
+error_no_gpu_copy:
+  {
+    /* Most likely for good, e.g. the downstream pool does not align
+       its memory or the driver has no copy engine */
+    GST_INFO_OBJECT (plugin, "cannot copy VA buffers with the GPU");
+    plugin->no_gpu_copy = TRUE;
+    return FALSE;
+  }
+}
+
 /**
  * gst_vaapi_plugin_copy_va_buffer:
  * @plugin: a #GstVaapiPluginBase
@@ -1563,7 +2921,9 @@ _init_performance_debug (void)
  *
  * Copy @inbuf to @outbuf. This if required when downstream doesn't
  * support GstVideoMeta, and since VA memory may have custom strides a
- * frame copy is required.
+ * frame copy is required. The copy engine of the GPU writes straight
+ * into @outbuf if the driver supports it, instead of having the CPU
+ * read the surface back.
  *
  * Returns: %FALSE if the copy failed, otherwise %TRUE. Also returns
  *          %TRUE if it is not required to do the copy
@@ -1586,6 +2946,12 @@ gst_vaapi_plugin_copy_va_buffer (GstVaapiPluginBase * plugin,
     return FALSE;
 
   _init_performance_debug ();
+  if (copy_va_buffer_with_gpu (plugin, inbuf, outbuf)) {
+    GST_CAT_INFO (CAT_PERFORMANCE, "copied VA buffer to system memory "
+        "buffer with the GPU");
+    success = TRUE;
+    goto done;
+  }
   GST_CAT_INFO (CAT_PERFORMANCE, "copying VA buffer to system memory buffer");
 
   if (!gst_video_frame_map (&src_frame, &srcpriv->info, inbuf, GST_MAP_READ))
@@ -1594,10 +2960,11 @@ gst_vaapi_plugin_copy_va_buffer (GstVaapiPluginBase * plugin,
     gst_video_frame_unmap (&src_frame);
     return FALSE;
   }
-  success = gst_video_frame_copy (&dst_frame, &src_frame);
+  success = copy_video_frame (&dst_frame, &src_frame);
   gst_video_frame_unmap (&dst_frame);
   gst_video_frame_unmap (&src_frame);
 
+done:
   if (success) {
     gst_buffer_copy_into (outbuf, inbuf, GST_BUFFER_COPY_TIMESTAMPS
         | GST_BUFFER_COPY_FLAGS, 0, -1);
@@ -1605,3 +2972,98 @@ gst_vaapi_plugin_copy_va_buffer (GstVaapiPluginBase * plugin,
 
   return success;
 }
+
+/**
+ * gst_vaapi_plugin_base_acquire_sys_buffer:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Returns a system memory buffer for gst_vaapi_plugin_copy_va_buffer()
+ * to copy the output frame into, taken from the downstream pool when
+ * there is one, so that the copy writes straight into the buffers
+ * downstream asked for.
+ *
+ * Returns: (transfer full): a new #GstBuffer, or %NULL on error
+ **/
+GstBuffer *
+gst_vaapi_plugin_base_acquire_sys_buffer (GstVaapiPluginBase * plugin)
+{
+  GstVaapiPadPrivate *const srcpriv = GST_VAAPI_PAD_PRIVATE (plugin->srcpad);
+  GstBuffer *buffer = NULL;
+
+  if (srcpriv->other_pool &&
+      gst_buffer_pool_acquire_buffer (srcpriv->other_pool, &buffer,
+          NULL) == GST_FLOW_OK)
+    return buffer;
+
+  return gst_buffer_new_allocate (srcpriv->other_allocator,
+      GST_VIDEO_INFO_SIZE (&srcpriv->info), &srcpriv->other_allocator_params);
+}
+
+/**
+ * gst_vaapi_plugin_base_set_sink_min_buffers:
+ * @plugin: a #GstVaapiPluginBase
+ * @min_buffers: the number of input buffers the element keeps
+ *
+ * Declares how many input buffers the element holds on to, besides
+ * the one being processed, e.g. for reordering or for a render
+ * queue. The next allocation proposal and sink pad pool account for
+ * them, so that upstream never stalls waiting for a free surface.
+ */
+void
+gst_vaapi_plugin_base_set_sink_min_buffers (GstVaapiPluginBase * plugin,
+    guint min_buffers)
+{
+  g_return_if_fail (plugin->sinkpriv != NULL);
+
+  plugin->sinkpriv->min_buffers = min_buffers;
+}
+
+/**
+ * gst_vaapi_plugin_base_get_downstream_min_buffers:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Returns: the number of output buffers the elements downstream hold,
+ *   as aggregated in the last allocation query
+ */
+guint
+gst_vaapi_plugin_base_get_downstream_min_buffers (GstVaapiPluginBase * plugin)
+{
+  g_return_val_if_fail (plugin->srcpriv != NULL, 0);
+
+  return plugin->srcpriv->min_buffers;
+}
+
+/**
+ * gst_vaapi_plugin_base_set_sink_compression:
+ * @plugin: a #GstVaapiPluginBase
+ * @compression: %TRUE if the input surfaces are only read by VA engines
+ *
+ * Declares that the element never maps nor exports its input
+ * surfaces, or only forwards them to elements that do the same, so
+ * that upstream allocates them with a compressed layout. This is
+ * advertised in the next allocation proposal, along with the VA
+ * display, since another display would not share the layout.
+ */
+void
+gst_vaapi_plugin_base_set_sink_compression (GstVaapiPluginBase * plugin,
+    gboolean compression)
+{
+  g_return_if_fail (plugin->sinkpriv != NULL);
+
+  plugin->sinkpriv->compression = compression;
+}
+
+/**
+ * gst_vaapi_plugin_base_get_downstream_compression:
+ * @plugin: a #GstVaapiPluginBase
+ *
+ * Returns: %TRUE if the whole downstream chain, as of the last
+ *   allocation query, takes compressed surfaces
+ */
+gboolean
+gst_vaapi_plugin_base_get_downstream_compression (GstVaapiPluginBase * plugin)
+{
+  g_return_val_if_fail (plugin->srcpriv != NULL, FALSE);
+
+  return plugin->srcpriv->compression;
+}
@@ -30,6 +30,7 @@
 #include <gst/video/gstvideoencoder.h>
 #include <gst/video/gstvideosink.h>
 #include <gst/vaapi/gstvaapidisplay.h>
+#include <gst/vaapi/gstvaapitrace.h>
 
 G_BEGIN_DECLS
 
@@ -37,6 +38,46 @@ typedef struct _GstVaapiPluginBase GstVaapiPluginBase;
 typedef struct _GstVaapiPluginBaseClass GstVaapiPluginBaseClass;
 typedef struct _GstVaapiPadPrivate GstVaapiPadPrivate;
 
+/**
+ * GstVaapiJobPriority:
+ * @GST_VAAPI_JOB_PRIORITY_BATCH: hardware jobs run after any live job
+ * @GST_VAAPI_JOB_PRIORITY_LIVE: hardware jobs are ordered by the
+ *   running time of the frames they process
+ *
+ * How the jobs of an element are scheduled against the other streams
+ * sharing the same VA display.
+ */
+typedef enum
+{
+  GST_VAAPI_JOB_PRIORITY_BATCH = 0,
+  GST_VAAPI_JOB_PRIORITY_LIVE,
+} GstVaapiJobPriority;
+
+#define GST_VAAPI_TYPE_JOB_PRIORITY \
+  gst_vaapi_job_priority_get_type ()
+
+/**
+ * GstVaapiThreadPolicy:
+ * @GST_VAAPI_THREAD_POLICY_NORMAL: time-shared, at the thread-priority
+ *   nice value
+ * @GST_VAAPI_THREAD_POLICY_FIFO: real-time first-in first-out, at the
+ *   thread-priority real-time priority
+ * @GST_VAAPI_THREAD_POLICY_RR: real-time round-robin, at the
+ *   thread-priority real-time priority
+ *
+ * How the operating system schedules the latency critical threads of
+ * an element.
+ */
+typedef enum
+{
+  GST_VAAPI_THREAD_POLICY_NORMAL = 0,
+  GST_VAAPI_THREAD_POLICY_FIFO,
+  GST_VAAPI_THREAD_POLICY_RR,
+} GstVaapiThreadPolicy;
+
+#define GST_VAAPI_TYPE_THREAD_POLICY \
+  gst_vaapi_thread_policy_get_type ()
+
 #define GST_VAAPI_PLUGIN_BASE(plugin) \
   ((GstVaapiPluginBase *)(plugin))
 #define GST_VAAPI_PLUGIN_BASE_CLASS(plugin) \
@@ -132,10 +173,24 @@ struct _GstVaapiPadPrivate
   guint buffer_size;
   gboolean caps_is_raw;
 
+  /* sink: surfaces the element keeps besides the one it processes,
+     src: surfaces the downstream chain keeps, from the allocation
+     query */
+  guint min_buffers;
+
+  /* sink: the element only hands the surfaces to VA engines, src: so
+     do all the elements downstream, on the same display, thus the
+     surfaces can be allocated with a compressed layout */
+  gboolean compression;
+
   gboolean can_dmabuf;
+  gboolean can_userptr;
 
   GstAllocator *other_allocator;
   GstAllocationParams other_allocator_params;
+  /* system memory buffers the VA frames are copied into, when
+     downstream doesn't support GstVideoMeta */
+  GstBufferPool *other_pool;
 };
 
 G_GNUC_INTERNAL
@@ -175,6 +230,8 @@ struct _GstVaapiPluginBase
   GstVaapiDisplayType display_type;
   GstVaapiDisplayType display_type_req;
   gchar *display_name;
+  /* the display being opened since NULL to READY, if any */
+  struct _GstVaapiDisplayPrefetch *display_prefetch;
 
   GstObject *gl_context;
   GstObject *gl_display;
@@ -184,6 +241,56 @@ struct _GstVaapiPluginBase
 
   gboolean enable_direct_rendering;
   gboolean copy_output_frame;
+  /* set once gst_vaapi_plugin_copy_va_buffer() fell back to the CPU */
+  gboolean no_gpu_copy;
+
+  /* sink pad surface pool sizing policy */
+  guint surface_prewarm;
+  guint surface_trim_period;
+  guint surface_trim_count;
+
+  /* GstVaapiJobPriority, for the display job scheduler */
+  guint job_priority;
+  /* GstVaapiPriority of the VA contexts, for the GPU scheduler */
+  guint priority;
+
+  /* NUMA node of the element threads, or -1 for the one of the GPU */
+  gint numa_node;
+
+  /* GstVaapiThreadPolicy, and the nice value or real-time priority,
+     of the latency critical threads */
+  guint thread_policy;
+  gint thread_priority;
+
+  /* trade quality for speed while the display is overloaded, see
+     gst_vaapi_plugin_base_get_load_level() */
+  gboolean adaptive_quality;
+
+  /* caps query results, see gst_vaapi_plugin_base_lookup_caps() */
+  GMutex caps_cache_lock;
+  GPtrArray *caps_cache;
+
+  /* live performance counters, see gst_vaapi_plugin_base_get_stats() */
+  GMutex stats_lock;
+  guint64 frames_in;
+  guint64 frames_out;
+  guint64 frames_dropped;
+  GstVaapiTraceStats *trace_stats;
+  guint stats_interval;
+  GstClockTime stats_last_post;
+
+  /* startup report, posted along with the first output frame. The
+     config, context and surfaces stage totals at the startup epoch */
+  GstClockTime startup_epoch;
+  GstClockTime startup_display_time;
+  GstClockTime startup_stage_base[3];
+  gboolean startup_posted;
+
+  /* output batching, see gst_vaapi_plugin_base_begin_output_batch() */
+  gboolean batch_output;
+  gulong batch_probe_id;
+  GThread *batch_thread;
+  GQueue batch_queue;
 };
 
 struct _GstVaapiPluginBaseClass
@@ -202,6 +309,7 @@ struct _GstVaapiPluginBaseClass
   gboolean  (*has_interface) (GstVaapiPluginBase * plugin, GType type);
   void (*display_changed) (GstVaapiPluginBase * plugin);
   GstVaapiPadPrivate * (*get_vaapi_pad_private) (GstVaapiPluginBase * plugin, GstPad * pad);
+  void (*append_stats) (GstVaapiPluginBase * plugin, GstStructure * stats);
 };
 
 G_GNUC_INTERNAL
@@ -301,6 +409,20 @@ G_GNUC_INTERNAL
 GstCaps *
 gst_vaapi_plugin_base_get_allowed_sinkpad_raw_caps (GstVaapiPluginBase * plugin);
 
+G_GNUC_INTERNAL
+GstCaps *
+gst_vaapi_plugin_base_lookup_caps (GstVaapiPluginBase * plugin,
+    GstPadDirection direction, GstCaps * filter);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_store_caps (GstVaapiPluginBase * plugin,
+    GstPadDirection direction, GstCaps * filter, GstCaps * caps);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_clear_caps_cache (GstVaapiPluginBase * plugin);
+
 G_GNUC_INTERNAL
 void
 gst_vaapi_plugin_base_set_srcpad_can_dmabuf (GstVaapiPluginBase * plugin,
@@ -311,6 +433,106 @@ gboolean
 gst_vaapi_plugin_copy_va_buffer (GstVaapiPluginBase * plugin,
     GstBuffer * inbuf, GstBuffer * outbuf);
 
+G_GNUC_INTERNAL
+GstBuffer *
+gst_vaapi_plugin_base_acquire_sys_buffer (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_trim_surface_pool (GstVaapiPluginBase * plugin,
+    gboolean idle);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_set_sink_min_buffers (GstVaapiPluginBase * plugin,
+    guint min_buffers);
+
+G_GNUC_INTERNAL
+guint
+gst_vaapi_plugin_base_get_downstream_min_buffers (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_set_sink_compression (GstVaapiPluginBase * plugin,
+    gboolean compression);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_plugin_base_get_downstream_compression (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_plugin_base_bind_thread (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_set_thread_scheduling (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_begin_output_batch (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+GstFlowReturn
+gst_vaapi_plugin_base_end_output_batch (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+GType
+gst_vaapi_thread_policy_get_type (void) G_GNUC_CONST;
+
+G_GNUC_INTERNAL
+GType
+gst_vaapi_job_priority_get_type (void) G_GNUC_CONST;
+
+G_GNUC_INTERNAL
+GstClockTime
+gst_vaapi_plugin_base_get_job_deadline (GstVaapiPluginBase * plugin,
+    const GstSegment * segment, GstClockTime timestamp);
+
+G_GNUC_INTERNAL
+GstVaapiPriority
+gst_vaapi_plugin_base_get_priority (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_report_load (GstVaapiPluginBase * plugin,
+    gboolean overloaded);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_report_qos (GstVaapiPluginBase * plugin,
+    GstEvent * event);
+
+G_GNUC_INTERNAL
+GstVaapiDisplayLoadLevel
+gst_vaapi_plugin_base_get_load_level (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_class_install_stats_properties (GObjectClass * klass,
+    guint stats_prop_id, guint interval_prop_id);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_stats_attach (GstVaapiPluginBase * plugin,
+    gpointer object);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_stats_frame_in (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_stats_frame_out (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_plugin_base_stats_frame_dropped (GstVaapiPluginBase * plugin);
+
+G_GNUC_INTERNAL
+GstStructure *
+gst_vaapi_plugin_base_get_stats (GstVaapiPluginBase * plugin);
+
 
 G_END_DECLS
 
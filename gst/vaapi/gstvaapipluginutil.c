@@ -97,7 +97,7 @@ static const DisplayMap g_display_map[] = {
 /* *INDENT-ON* */
 
 static GstVaapiDisplay *
-gst_vaapi_create_display (GstVaapiDisplayType display_type,
+create_display_unshared (GstVaapiDisplayType display_type,
     const gchar * display_name)
 {
   GstVaapiDisplay *display = NULL;
@@ -111,6 +111,77 @@ gst_vaapi_create_display (GstVaapiDisplayType display_type,
     if (display || display_type != GST_VAAPI_DISPLAY_TYPE_ANY)
       break;
   }
+
+  /* GST_VAAPI_PREWARM lists the operations whose kernels the driver
+     loads in the background, see gst_vaapi_display_prewarm() */
+  if (display && g_getenv ("GST_VAAPI_PREWARM"))
+    gst_vaapi_display_prewarm (display, g_getenv ("GST_VAAPI_PREWARM"));
+  return display;
+}
+
+/* Displays created by gst_vaapi_create_display(), keyed by requested
+   type and name, so that independent pipelines share them. Only weak
+   references are held: a display goes away with its last user */
+static GHashTable *g_shared_displays;
+static GMutex g_shared_displays_lock;
+
+static void
+shared_display_free (GWeakRef * ref)
+{
+  g_weak_ref_clear (ref);
+  g_slice_free (GWeakRef, ref);
+}
+
+static gboolean
+display_is_shareable (const gchar * display_name)
+{
+  if (g_getenv ("GST_VAAPI_DISABLE_SHARED_DISPLAY"))
+    return FALSE;
+#if USE_DRM
+  /* Sharing would defeat the balancing of displays across devices */
+  if (!display_name && gst_vaapi_display_drm_get_device_policy () !=
+      GST_VAAPI_DRM_DEVICE_POLICY_FIRST)
+    return FALSE;
+#endif
+  return TRUE;
+}
+
+static GstVaapiDisplay *
+gst_vaapi_create_display (GstVaapiDisplayType display_type,
+    const gchar * display_name)
+{
+  GstVaapiDisplay *display;
+  GWeakRef *ref;
+  gchar *key;
+
+  if (!display_is_shareable (display_name))
+    return create_display_unshared (display_type, display_name);
+
+  key = g_strdup_printf ("%d:%s", display_type,
+      display_name ? display_name : "");
+
+  g_mutex_lock (&g_shared_displays_lock);
+  if (!g_shared_displays) {
+    g_shared_displays = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) shared_display_free);
+  }
+
+  ref = g_hash_table_lookup (g_shared_displays, key);
+  display = ref ? g_weak_ref_get (ref) : NULL;
+  if (display) {
+    GST_DEBUG ("reusing display %" GST_PTR_FORMAT, display);
+    g_free (key);
+  } else {
+    display = create_display_unshared (display_type, display_name);
+    if (display) {
+      ref = g_slice_new (GWeakRef);
+      g_weak_ref_init (ref, display);
+      g_hash_table_replace (g_shared_displays, key, ref);
+    } else {
+      g_free (key);
+    }
+  }
+  g_mutex_unlock (&g_shared_displays_lock);
   return display;
 }
 
@@ -371,6 +442,165 @@ no_valid_gl_display:
 #endif
 }
 
+/* A display opened by a worker thread while the element goes from
+   NULL to READY, so that the VA initialization and the first probing
+   of the driver capabilities are out of the way at the first use */
+struct _GstVaapiDisplayPrefetch
+{
+  gint ref_count;
+  GMutex lock;
+  GCond cond;
+  gboolean done;
+  gboolean cancelled;
+
+  GstVaapiDisplayType type;
+  gchar *name;
+  GstVaapiDisplay *display;
+};
+
+static void
+prefetch_unref (GstVaapiDisplayPrefetch * prefetch)
+{
+  if (!g_atomic_int_dec_and_test (&prefetch->ref_count))
+    return;
+
+  gst_vaapi_display_replace (&prefetch->display, NULL);
+  g_free (prefetch->name);
+  g_mutex_clear (&prefetch->lock);
+  g_cond_clear (&prefetch->cond);
+  g_slice_free (GstVaapiDisplayPrefetch, prefetch);
+}
+
+static void
+prefetch_run (GstVaapiDisplayPrefetch * prefetch, gpointer user_data)
+{
+  GstVaapiDisplay *display = NULL;
+  GArray *array;
+  gboolean cancelled;
+
+  /* nobody is waiting for a display any more, e.g. a neighbour
+     already shared its own */
+  g_mutex_lock (&prefetch->lock);
+  cancelled = prefetch->cancelled;
+  g_mutex_unlock (&prefetch->lock);
+
+  if (!cancelled)
+    display = gst_vaapi_create_display (prefetch->type, prefetch->name);
+  if (display) {
+    /* the probing results are cached by the display */
+    array = gst_vaapi_display_get_decode_profiles (display);
+    if (array)
+      g_array_unref (array);
+    array = gst_vaapi_display_get_image_formats (display);
+    if (array)
+      g_array_unref (array);
+  }
+
+  g_mutex_lock (&prefetch->lock);
+  prefetch->display = display;
+  prefetch->done = TRUE;
+  g_cond_broadcast (&prefetch->cond);
+  g_mutex_unlock (&prefetch->lock);
+
+  prefetch_unref (prefetch);
+}
+
+static GThreadPool *
+prefetch_get_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool)) {
+    GThreadPool *const new_pool = g_thread_pool_new ((GFunc) prefetch_run,
+        NULL, g_get_num_processors (), FALSE, NULL);
+    g_once_init_leave (&pool, (gsize) new_pool);
+  }
+  return (GThreadPool *) pool;
+}
+
+/**
+ * gst_vaapi_display_prefetch_new:
+ * @type: the requested #GstVaapiDisplayType
+ * @name: (allow-none): the requested display name
+ *
+ * Starts opening a display of @type on a worker thread. The caller
+ * gets the result with gst_vaapi_display_prefetch_join(). When no
+ * worker can be started, the display is opened right away.
+ *
+ * Returns: (transfer full): the new #GstVaapiDisplayPrefetch
+ */
+GstVaapiDisplayPrefetch *
+gst_vaapi_display_prefetch_new (GstVaapiDisplayType type, const gchar * name)
+{
+  GstVaapiDisplayPrefetch *prefetch;
+  GThreadPool *pool;
+
+  prefetch = g_slice_new0 (GstVaapiDisplayPrefetch);
+  /* one reference for the caller, one for the worker */
+  prefetch->ref_count = 2;
+  g_mutex_init (&prefetch->lock);
+  g_cond_init (&prefetch->cond);
+  prefetch->type = type;
+  prefetch->name = g_strdup (name);
+
+  pool = prefetch_get_pool ();
+  if (!pool || !g_thread_pool_push (pool, prefetch, NULL))
+    prefetch_run (prefetch, NULL);
+  return prefetch;
+}
+
+/**
+ * gst_vaapi_display_prefetch_join:
+ * @prefetch: a #GstVaapiDisplayPrefetch
+ * @type: the #GstVaapiDisplayType wanted now
+ * @name: (allow-none): the display name wanted now
+ *
+ * Waits for the display started by @prefetch, if it still matches
+ * @type and @name.
+ *
+ * Returns: (transfer full): the display, or %NULL if it could not be
+ *   opened or if the request changed in the meantime
+ */
+GstVaapiDisplay *
+gst_vaapi_display_prefetch_join (GstVaapiDisplayPrefetch * prefetch,
+    GstVaapiDisplayType type, const gchar * name)
+{
+  GstVaapiDisplay *display = NULL;
+
+  g_return_val_if_fail (prefetch != NULL, NULL);
+
+  if (prefetch->type != type || g_strcmp0 (prefetch->name, name) != 0)
+    return NULL;
+
+  g_mutex_lock (&prefetch->lock);
+  while (!prefetch->done)
+    g_cond_wait (&prefetch->cond, &prefetch->lock);
+  if (prefetch->display)
+    display = gst_object_ref (prefetch->display);
+  g_mutex_unlock (&prefetch->lock);
+  return display;
+}
+
+/**
+ * gst_vaapi_display_prefetch_free:
+ * @prefetch: a #GstVaapiDisplayPrefetch
+ *
+ * Drops the caller's interest in @prefetch. A prefetch not started
+ * yet is cancelled, and a display still being opened is released by
+ * the worker once it is done.
+ */
+void
+gst_vaapi_display_prefetch_free (GstVaapiDisplayPrefetch * prefetch)
+{
+  g_return_if_fail (prefetch != NULL);
+
+  g_mutex_lock (&prefetch->lock);
+  prefetch->cancelled = TRUE;
+  g_mutex_unlock (&prefetch->lock);
+
+  prefetch_unref (prefetch);
+}
+
 gboolean
 gst_vaapi_ensure_display (GstElement * element, GstVaapiDisplayType type)
 {
@@ -381,8 +611,11 @@ gst_vaapi_ensure_display (GstElement * element, GstVaapiDisplayType type)
 
   if (gst_vaapi_video_context_prepare (element, &plugin->display)) {
     /* Neighbour found and it updated the display */
-    if (gst_vaapi_plugin_base_has_display_type (plugin, type))
+    if (gst_vaapi_plugin_base_has_display_type (plugin, type)) {
+      g_clear_pointer (&plugin->display_prefetch,
+          gst_vaapi_display_prefetch_free);
       return TRUE;
+    }
   }
 
   /* Query for a local GstGL context. If it's found, it will be used
@@ -398,6 +631,15 @@ gst_vaapi_ensure_display (GstElement * element, GstVaapiDisplayType type)
     if (!display)
       gst_vaapi_plugin_base_set_display_type (plugin,
           GST_VAAPI_DISPLAY_TYPE_ANY);
+    else
+      g_clear_pointer (&plugin->display_prefetch,
+          gst_vaapi_display_prefetch_free);
+  }
+  if (!display && plugin->display_prefetch) {
+    display = gst_vaapi_display_prefetch_join (plugin->display_prefetch,
+        type, plugin->display_name);
+    g_clear_pointer (&plugin->display_prefetch,
+        gst_vaapi_display_prefetch_free);
   }
   if (!display)
     display = gst_vaapi_create_display (type, plugin->display_name);
@@ -1224,9 +1466,17 @@ gst_vaapi_build_template_raw_caps_by_codec (GstVaapiDisplay * display,
     goto out;
 
   if (extra_fmts) {
-    for (i = 0; i < extra_fmts->len; i++)
-      g_array_append_val (supported_fmts,
-          g_array_index (extra_fmts, GstVideoFormat, i));
+    for (i = 0; i < extra_fmts->len; i++) {
+      GstVideoFormat format = g_array_index (extra_fmts, GstVideoFormat, i);
+      guint j;
+
+      for (j = 0; j < supported_fmts->len; j++) {
+        if (g_array_index (supported_fmts, GstVideoFormat, j) == format)
+          break;
+      }
+      if (j == supported_fmts->len)
+        g_array_append_val (supported_fmts, format);
+    }
   }
 
   out_caps = gst_vaapi_build_caps_from_formats (supported_fmts, 1, 1,
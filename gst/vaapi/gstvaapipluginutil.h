@@ -32,6 +32,20 @@
 
 typedef GstVaapiProfile (*GstVaapiStrToProfileFunc) (const gchar * str);
 typedef const gchar * (*GstVaapiProfileToStrFunc) (GstVaapiProfile profile);
+typedef struct _GstVaapiDisplayPrefetch GstVaapiDisplayPrefetch;
+
+G_GNUC_INTERNAL
+GstVaapiDisplayPrefetch *
+gst_vaapi_display_prefetch_new (GstVaapiDisplayType type, const gchar * name);
+
+G_GNUC_INTERNAL
+GstVaapiDisplay *
+gst_vaapi_display_prefetch_join (GstVaapiDisplayPrefetch * prefetch,
+    GstVaapiDisplayType type, const gchar * name);
+
+G_GNUC_INTERNAL
+void
+gst_vaapi_display_prefetch_free (GstVaapiDisplayPrefetch * prefetch);
 
 G_GNUC_INTERNAL
 gboolean
@@ -117,7 +131,8 @@ gst_vaapi_caps_feature_contains (const GstCaps * caps,
 
 #define GST_VAAPI_MAKE_DMABUF_CAPS                                      \
     GST_VIDEO_CAPS_MAKE_WITH_FEATURES(                                  \
-        GST_CAPS_FEATURE_MEMORY_DMABUF, "{ I420, YV12, RGBA }")
+        GST_CAPS_FEATURE_MEMORY_DMABUF, "{ I420, YV12, RGBA"           \
+        GST_VAAPI_FORMATS_RGB_PLANAR "}")
 
 G_GNUC_INTERNAL
 gboolean
@@ -38,6 +38,7 @@
 #include <gst/video/video.h>
 
 #include <gst/vaapi/gstvaapivalue.h>
+#include <gst/vaapi/gstvaapitrace.h>
 
 #include "gstvaapipostproc.h"
 #include "gstvaapipostprocutil.h"
@@ -45,6 +46,8 @@
 #include "gstvaapivideobuffer.h"
 #include "gstvaapivideobufferpool.h"
 #include "gstvaapivideomemory.h"
+#include "gstvaapidrmmeta.h"
+#include "gstvaapifencemeta.h"
 
 #define GST_PLUGIN_NAME "vaapipostproc"
 #define GST_PLUGIN_DESC "A VA-API video postprocessing filter"
@@ -129,11 +132,21 @@ enum
   PROP_CROP_RIGHT,
   PROP_CROP_TOP,
   PROP_CROP_BOTTOM,
+  PROP_ROI_WIDTH,
+  PROP_ROI_HEIGHT,
+  PROP_LETTERBOX,
+  PROP_BACKGROUND_COLOR,
   PROP_HDR_TONE_MAP,
 #ifndef GST_REMOVE_DEPRECATED
   PROP_SKIN_TONE_ENHANCEMENT,
 #endif
   PROP_SKIN_TONE_ENHANCEMENT_LEVEL,
+  PROP_JOB_PRIORITY,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_FRAMERATE,
+  PROP_ADAPTIVE_QUALITY,
+  PROP_PRIORITY,
 };
 
 #define GST_VAAPI_TYPE_HDR_TONE_MAP \
@@ -190,47 +203,48 @@ ds_reset (GstVaapiDeinterlaceState * ds)
 {
   guint i;
 
-  for (i = 0; i < G_N_ELEMENTS (ds->buffers); i++)
-    gst_buffer_replace (&ds->buffers[i], NULL);
-  ds->buffers_index = 0;
+  for (i = 0; i < G_N_ELEMENTS (ds->proxies); i++)
+    gst_vaapi_surface_proxy_replace (&ds->proxies[i], NULL);
+  ds->proxies_index = 0;
   ds->num_surfaces = 0;
+  ds->last_pts = GST_CLOCK_TIME_NONE;
   ds->deint = FALSE;
   ds->tff = FALSE;
 }
 
+/* Changes the number of references kept in the history. Dropping
+   references is only done on the next ds_reset() */
 static void
-ds_add_buffer (GstVaapiDeinterlaceState * ds, GstBuffer * buf)
+ds_set_depth (GstVaapiDeinterlaceState * ds, guint depth)
 {
-  gst_buffer_replace (&ds->buffers[ds->buffers_index], buf);
-  ds->buffers_index = (ds->buffers_index + 1) % G_N_ELEMENTS (ds->buffers);
-}
+  depth = MIN (depth, G_N_ELEMENTS (ds->proxies));
+  if (ds->depth == depth)
+    return;
 
-static inline GstBuffer *
-ds_get_buffer (GstVaapiDeinterlaceState * ds, guint index)
-{
-  /* Note: the index increases towards older buffers.
-     i.e. buffer at index 0 means the immediately preceding buffer
-     in the history, buffer at index 1 means the one preceding the
-     surface at index 0, etc. */
-  const guint n = ds->buffers_index + G_N_ELEMENTS (ds->buffers) - index - 1;
-  return ds->buffers[n % G_N_ELEMENTS (ds->buffers)];
+  ds_reset (ds);
+  ds->depth = depth;
 }
 
 static void
-ds_set_surfaces (GstVaapiDeinterlaceState * ds)
+ds_add_proxy (GstVaapiDeinterlaceState * ds, GstVaapiSurfaceProxy * proxy,
+    GstClockTime pts)
 {
-  GstVaapiVideoMeta *meta;
   guint i;
 
-  ds->num_surfaces = 0;
-  for (i = 0; i < G_N_ELEMENTS (ds->buffers); i++) {
-    GstBuffer *const buf = ds_get_buffer (ds, i);
-    if (!buf)
-      break;
+  if (ds->depth == 0 || !proxy)
+    return;
 
-    meta = gst_buffer_get_vaapi_video_meta (buf);
-    ds->surfaces[ds->num_surfaces++] = gst_vaapi_video_meta_get_surface (meta);
-  }
+  gst_vaapi_surface_proxy_replace (&ds->proxies[ds->proxies_index], proxy);
+  ds->proxies_index = (ds->proxies_index + 1) % ds->depth;
+  ds->last_pts = pts;
+
+  /* Keep the reference list up-to-date here, rather than rebuilding
+     it for every field: shift older surfaces and put the new one first */
+  if (ds->num_surfaces < ds->depth)
+    ds->num_surfaces++;
+  for (i = ds->num_surfaces - 1; i > 0; i--)
+    ds->surfaces[i] = ds->surfaces[i - 1];
+  ds->surfaces[0] = GST_VAAPI_SURFACE_PROXY_SURFACE (proxy);
 }
 
 static GstVaapiFilterOpInfo *
@@ -258,6 +272,8 @@ gst_vaapipostproc_ensure_display (GstVaapiPostproc * postproc)
 static gboolean
 gst_vaapipostproc_ensure_filter (GstVaapiPostproc * postproc)
 {
+  GstClockTime trace_start;
+
   if (postproc->filter)
     return TRUE;
 
@@ -266,11 +282,19 @@ gst_vaapipostproc_ensure_filter (GstVaapiPostproc * postproc)
 
   gst_caps_replace (&postproc->allowed_srcpad_caps, NULL);
   gst_caps_replace (&postproc->allowed_sinkpad_caps, NULL);
+  gst_vaapi_plugin_base_clear_caps_cache (GST_VAAPI_PLUGIN_BASE (postproc));
 
+  /* The filter creates its VA config and context right away */
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
   postproc->filter =
       gst_vaapi_filter_new (GST_VAAPI_PLUGIN_BASE_DISPLAY (postproc));
   if (!postproc->filter)
     return FALSE;
+  postproc->filter_scale_method = GST_VAAPI_SCALE_METHOD_DEFAULT;
+  GST_VAAPI_TRACE_END (trace_start, postproc, GST_VAAPI_TRACE_STAGE_CONTEXT,
+      GST_CLOCK_TIME_NONE);
+  gst_vaapi_plugin_base_stats_attach (GST_VAAPI_PLUGIN_BASE (postproc),
+      postproc->filter);
   return TRUE;
 }
 
@@ -325,12 +349,26 @@ gst_vaapipostproc_destroy_filter (GstVaapiPostproc * postproc)
   }
   gst_vaapi_filter_replace (&postproc->filter, NULL);
   gst_vaapi_video_pool_replace (&postproc->filter_pool, NULL);
+  if (postproc->roi_pool) {
+    gst_buffer_pool_set_active (postproc->roi_pool, FALSE);
+    gst_clear_object (&postproc->roi_pool);
+  }
+}
+
+static void
+frc_reset (GstVaapiPostproc * postproc)
+{
+  postproc->frc_base = GST_CLOCK_TIME_NONE;
+  postproc->frc_slot = 0;
+  postproc->frc_drop = FALSE;
+  gst_buffer_replace (&postproc->frc_last, NULL);
 }
 
 static void
 gst_vaapipostproc_destroy (GstVaapiPostproc * postproc)
 {
   ds_reset (&postproc->deinterlace_state);
+  frc_reset (postproc);
   gst_vaapipostproc_destroy_filter (postproc);
 
   gst_caps_replace (&postproc->allowed_sinkpad_caps, NULL);
@@ -360,6 +398,7 @@ gst_vaapipostproc_stop (GstBaseTransform * trans)
 
   g_mutex_lock (&postproc->postproc_lock);
   ds_reset (&postproc->deinterlace_state);
+  frc_reset (postproc);
   gst_vaapi_plugin_base_close (GST_VAAPI_PLUGIN_BASE (postproc));
 
   postproc->field_duration = GST_CLOCK_TIME_NONE;
@@ -439,10 +478,7 @@ create_output_dump_buffer (GstVaapiPostproc * postproc)
 {
   GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (postproc);
 
-  return
-      gst_buffer_new_allocate (GST_VAAPI_PLUGIN_BASE_OTHER_ALLOCATOR (plugin),
-      GST_VIDEO_INFO_SIZE (GST_VAAPI_PLUGIN_BASE_SRC_PAD_INFO (plugin)),
-      &GST_VAAPI_PLUGIN_BASE_OTHER_ALLOCATOR_PARAMS (plugin));
+  return gst_vaapi_plugin_base_acquire_sys_buffer (plugin);
 }
 
 static void
@@ -605,6 +641,10 @@ check_filter_update (GstVaapiPostproc * postproc)
   if (!postproc->has_vpp)
     return FALSE;
 
+  /* Region crops are extra outputs, the frame can't be passed through */
+  if (filter_flag & GST_VAAPI_POSTPROC_FLAG_ROI_CROP)
+    return TRUE;
+
   for (i = GST_VAAPI_FILTER_OP_DENOISE;
       i <= GST_VAAPI_FILTER_OP_SKINTONE_LEVEL; i++) {
     op_flag = (filter_flag >> i) & 1;
@@ -684,6 +724,7 @@ update_filter (GstVaapiPostproc * postproc)
     if (!gst_vaapi_filter_set_scaling (postproc->filter,
             postproc->scale_method))
       return FALSE;
+    postproc->filter_scale_method = postproc->scale_method;
 
     if (gst_vaapi_filter_get_scaling_default (postproc->filter) ==
         postproc->scale_method)
@@ -747,6 +788,148 @@ update_filter (GstVaapiPostproc * postproc)
   return TRUE;
 }
 
+/* Filters whose values are applied from the streaming thread */
+#ifndef GST_REMOVE_DEPRECATED
+#define LIVE_PARAMS_SKINTONE_FLAG GST_VAAPI_POSTPROC_FLAG_SKINTONE
+#else
+#define LIVE_PARAMS_SKINTONE_FLAG 0
+#endif
+#define LIVE_PARAMS_FLAGS (GST_VAAPI_POSTPROC_FLAG_DENOISE | \
+    GST_VAAPI_POSTPROC_FLAG_SHARPEN | GST_VAAPI_POSTPROC_FLAG_SCALE | \
+    GST_VAAPI_POSTPROC_FLAG_HUE | GST_VAAPI_POSTPROC_FLAG_SATURATION | \
+    GST_VAAPI_POSTPROC_FLAG_BRIGHTNESS | GST_VAAPI_POSTPROC_FLAG_CONTRAST | \
+    GST_VAAPI_POSTPROC_FLAG_SKINTONE_LEVEL | LIVE_PARAMS_SKINTONE_FLAG)
+
+static void
+free_live_params (GstVaapiPostprocParams * params)
+{
+  g_slice_free (GstVaapiPostprocParams, params);
+}
+
+/* Publishes a snapshot of the live filter values, replacing the one
+ * the streaming thread did not pick up yet. Called with postproc_lock
+ * held, so that publishers are serialized: the slot can't get back to
+ * a snapshot freed in between */
+static void
+publish_live_params (GstVaapiPostproc * postproc)
+{
+  GstVaapiPostprocParams *params, *old_params;
+
+  params = g_slice_new (GstVaapiPostprocParams);
+  params->version = ++postproc->live_params_version;
+  params->flags = postproc->flags & LIVE_PARAMS_FLAGS;
+  params->denoise_level = postproc->denoise_level;
+  params->sharpen_level = postproc->sharpen_level;
+  params->scale_method = postproc->scale_method;
+  params->hue = postproc->hue;
+  params->saturation = postproc->saturation;
+  params->brightness = postproc->brightness;
+  params->contrast = postproc->contrast;
+  params->skintone_enhance = postproc->skintone_enhance;
+  params->skintone_value = postproc->skintone_value;
+
+  do {
+    old_params = g_atomic_pointer_get (&postproc->live_params);
+  } while (!g_atomic_pointer_compare_and_exchange (&postproc->live_params,
+          old_params, params));
+  if (old_params)
+    free_live_params (old_params);
+}
+
+/* Takes the latest published snapshot, if any */
+static GstVaapiPostprocParams *
+take_live_params (GstVaapiPostproc * postproc)
+{
+  GstVaapiPostprocParams *params;
+
+  do {
+    params = g_atomic_pointer_get (&postproc->live_params);
+  } while (params && !g_atomic_pointer_compare_and_exchange
+      (&postproc->live_params, params, NULL));
+  return params;
+}
+
+/* Applies the live filter values at a frame boundary, without the
+ * renegotiation update_filter() is part of */
+static void
+apply_live_params (GstVaapiPostproc * postproc)
+{
+  GstVaapiPostprocParams *params;
+  GstVaapiFilter *const filter = postproc->filter;
+  gboolean success = TRUE;
+
+  params = take_live_params (postproc);
+  if (!params)
+    return;
+  if (!filter || !postproc->has_vpp)
+    goto done;
+
+  GST_DEBUG_OBJECT (postproc, "applying filter values version %u",
+      params->version);
+
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_DENOISE)
+    success &= gst_vaapi_filter_set_denoising_level (filter,
+        params->denoise_level);
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_SHARPEN)
+    success &= gst_vaapi_filter_set_sharpening_level (filter,
+        params->sharpen_level);
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_SCALE) {
+    success &= gst_vaapi_filter_set_scaling (filter, params->scale_method);
+    postproc->filter_scale_method = params->scale_method;
+  }
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_HUE)
+    success &= gst_vaapi_filter_set_hue (filter, params->hue);
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_SATURATION)
+    success &= gst_vaapi_filter_set_saturation (filter, params->saturation);
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_BRIGHTNESS)
+    success &= gst_vaapi_filter_set_brightness (filter, params->brightness);
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_CONTRAST)
+    success &= gst_vaapi_filter_set_contrast (filter, params->contrast);
+  if (params->flags & GST_VAAPI_POSTPROC_FLAG_SKINTONE_LEVEL)
+    success &= gst_vaapi_filter_set_skintone_level (filter,
+        params->skintone_value);
+#ifndef GST_REMOVE_DEPRECATED
+  else if (params->flags & GST_VAAPI_POSTPROC_FLAG_SKINTONE)
+    success &= gst_vaapi_filter_set_skintone (filter,
+        params->skintone_enhance);
+#endif
+
+  if (!success)
+    GST_WARNING_OBJECT (postproc, "failed to apply some filter values");
+
+done:
+  free_live_params (params);
+}
+
+/* Steps the scaling method down towards the fastest one while the
+ * display is overloaded, one step on high load and all the way on
+ * critical load, and restores the configured method once it eases */
+static void
+adapt_scaling_to_load (GstVaapiPostproc * postproc)
+{
+  GstVaapiDisplayLoadLevel level;
+  GstVaapiScaleMethod method;
+
+  level = gst_vaapi_plugin_base_get_load_level (GST_VAAPI_PLUGIN_BASE
+      (postproc));
+  method = postproc->scale_method;
+  if (level == GST_VAAPI_DISPLAY_LOAD_CRITICAL)
+    method = GST_VAAPI_SCALE_METHOD_FAST;
+  else if (level == GST_VAAPI_DISPLAY_LOAD_HIGH
+      && method == GST_VAAPI_SCALE_METHOD_HQ)
+    method = GST_VAAPI_SCALE_METHOD_DEFAULT;
+  else if (level == GST_VAAPI_DISPLAY_LOAD_HIGH)
+    method = GST_VAAPI_SCALE_METHOD_FAST;
+
+  if (method == postproc->filter_scale_method)
+    return;
+
+  GST_DEBUG_OBJECT (postproc, "load level %d, scaling method %d", level,
+      method);
+  if (gst_vaapi_filter_set_scaling (postproc->filter, method))
+    postproc->filter_scale_method = method;
+}
+
 static void
 gst_vaapipostproc_set_passthrough (GstBaseTransform * trans)
 {
@@ -846,6 +1029,243 @@ rotate_crop_meta (GstVaapiPostproc * const postproc, const GstVideoMeta * vmeta,
   }
 }
 
+/* The VPP output is left pending: VA consumers on the same display are
+   ordered by the driver, and CPU consumers sync when mapping it */
+static GstVaapiFilterStatus
+postproc_filter_process (GstVaapiPostproc * postproc,
+    GstVaapiSurface * src_surface, GstVaapiSurfaceProxy * dst_proxy,
+    guint flags, GstClockTime pts)
+{
+  GstVaapiFilterStatus status;
+  GstClockTime trace_start;
+
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
+  status = gst_vaapi_filter_process (postproc->filter, src_surface,
+      GST_VAAPI_SURFACE_PROXY_SURFACE (dst_proxy), flags);
+  GST_VAAPI_TRACE_END (trace_start, postproc, GST_VAAPI_TRACE_STAGE_FILTER,
+      pts);
+
+  if (status == GST_VAAPI_FILTER_STATUS_SUCCESS)
+    gst_vaapi_surface_proxy_set_pending (dst_proxy);
+  return status;
+}
+
+/* DMA buffer importers, e.g. GL or another device, are not ordered
+   against the VA driver, so wait for the VPP output before pushing,
+   unless downstream takes over the wait through a fence. Downstream
+   may also ask for the DRM layout, to import with explicit modifiers */
+static gboolean
+sync_exported_output (GstVaapiPostproc * postproc, GstBuffer * buf)
+{
+  GstMemory *const mem = gst_buffer_peek_memory (buf, 0);
+  GstVaapiVideoMeta *meta;
+  GstVaapiSurfaceProxy *proxy;
+
+  if (!mem || !gst_is_dmabuf_memory (mem))
+    return TRUE;
+
+  meta = gst_buffer_get_vaapi_video_meta (buf);
+  proxy = meta ? gst_vaapi_video_meta_get_surface_proxy (meta) : NULL;
+  if (proxy && postproc->export_drm_meta
+      && !gst_buffer_get_vaapi_drm_meta (buf))
+    gst_buffer_add_vaapi_drm_meta (buf,
+        GST_VAAPI_SURFACE_PROXY_SURFACE (proxy));
+
+  if (postproc->export_fence && gst_buffer_add_vaapi_fence_meta_from_memory
+      (buf))
+    return TRUE;
+  return !proxy || gst_vaapi_surface_proxy_sync (proxy);
+}
+
+/* Fits the source picture into the output frame, keeping its display
+   aspect ratio, and lets VPP fill the borders with the background */
+static void
+set_letterbox_rect (GstVaapiPostproc * postproc,
+    const GstVaapiRectangle * crop_rect)
+{
+  const GstVideoInfo *const src_vip = &postproc->sinkpad_info;
+  const GstVideoInfo *const dst_vip = &postproc->srcpad_info;
+  guint src_w, src_h, dst_w, dst_h;
+  guint64 num, den;
+  GstVaapiRectangle rect;
+
+  src_w = crop_rect ? crop_rect->width : GST_VIDEO_INFO_WIDTH (src_vip);
+  src_h = crop_rect ? crop_rect->height : GST_VIDEO_INFO_HEIGHT (src_vip);
+  dst_w = GST_VIDEO_INFO_WIDTH (dst_vip);
+  dst_h = GST_VIDEO_INFO_HEIGHT (dst_vip);
+
+  switch (gst_vaapi_filter_get_video_direction (postproc->filter)) {
+    case GST_VIDEO_ORIENTATION_90R:
+    case GST_VIDEO_ORIENTATION_UL_LR:
+    case GST_VIDEO_ORIENTATION_90L:
+    case GST_VIDEO_ORIENTATION_UR_LL:
+      G_PRIMITIVE_SWAP (guint, src_w, src_h);
+    default:
+      break;
+  }
+
+  /* Source display aspect ratio, in output pixels */
+  num = (guint64) src_w * GST_VIDEO_INFO_PAR_N (src_vip) *
+      GST_VIDEO_INFO_PAR_D (dst_vip);
+  den = (guint64) src_h * GST_VIDEO_INFO_PAR_D (src_vip) *
+      GST_VIDEO_INFO_PAR_N (dst_vip);
+  if (num == 0 || den == 0 || dst_w == 0 || dst_h == 0) {
+    gst_vaapi_filter_set_target_rectangle (postproc->filter, NULL);
+    return;
+  }
+
+  if (dst_w * den > dst_h * num) {
+    rect.height = dst_h;
+    rect.width = MIN (gst_util_uint64_scale (dst_h, num, den), dst_w);
+  } else {
+    rect.width = dst_w;
+    rect.height = MIN (gst_util_uint64_scale (dst_w, den, num), dst_h);
+  }
+  /* Keep the offsets even for chroma subsampled outputs */
+  rect.x = ((dst_w - rect.width) / 2) & ~1U;
+  rect.y = ((dst_h - rect.height) / 2) & ~1U;
+
+  gst_vaapi_filter_set_background_color (postproc->filter,
+      postproc->background_color);
+  gst_vaapi_filter_set_target_rectangle (postproc->filter, &rect);
+}
+
+static gboolean
+ensure_roi_pool (GstVaapiPostproc * postproc)
+{
+  GstBufferPool *pool;
+  GstStructure *config;
+  GstVideoInfo vi;
+  GstCaps *caps;
+
+  gst_video_info_set_format (&vi, GST_VIDEO_INFO_FORMAT (&postproc->srcpad_info),
+      postproc->roi_width, postproc->roi_height);
+  if (postproc->roi_pool
+      && GST_VIDEO_INFO_FORMAT (&vi) ==
+      GST_VIDEO_INFO_FORMAT (&postproc->roi_pool_info)
+      && GST_VIDEO_INFO_WIDTH (&vi) == GST_VIDEO_INFO_WIDTH
+      (&postproc->roi_pool_info)
+      && GST_VIDEO_INFO_HEIGHT (&vi) ==
+      GST_VIDEO_INFO_HEIGHT (&postproc->roi_pool_info))
+    return TRUE;
+
+  if (postproc->roi_pool) {
+    gst_buffer_pool_set_active (postproc->roi_pool, FALSE);
+    gst_clear_object (&postproc->roi_pool);
+  }
+
+  pool = gst_vaapi_video_buffer_pool_new (GST_VAAPI_PLUGIN_BASE_DISPLAY
+      (postproc));
+  if (!pool)
+    return FALSE;
+
+  caps = gst_video_info_to_caps (&vi);
+  gst_caps_set_features (caps, 0,
+      gst_caps_features_new (GST_CAPS_FEATURE_MEMORY_VAAPI_SURFACE, NULL));
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, GST_VIDEO_INFO_SIZE (&vi),
+      0, 0);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_VAAPI_VIDEO_META);
+  gst_buffer_pool_config_add_option (config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+  gst_caps_unref (caps);
+
+  if (!gst_buffer_pool_set_config (pool, config)
+      || !gst_buffer_pool_set_active (pool, TRUE)) {
+    gst_object_unref (pool);
+    return FALSE;
+  }
+
+  postproc->roi_pool = pool;
+  postproc->roi_pool_info = vi;
+  return TRUE;
+}
+
+/* Scales every region of interest of @outbuf out of @surface, in a
+   single VPP submission. Each result is attached to its region as a
+   "GstVaapiRoiCrop" parameter holding the buffer */
+static gboolean
+process_roi_crops (GstVaapiPostproc * postproc, GstVaapiSurface * surface,
+    GstBuffer * outbuf)
+{
+  const guint width = gst_vaapi_surface_get_width (surface);
+  const guint height = gst_vaapi_surface_get_height (surface);
+  GstVideoRegionOfInterestMeta *roi;
+  GPtrArray *rois, *buffers;
+  GArray *regions, *surfaces;
+  GstVaapiFilterStatus status;
+  gpointer state = NULL;
+  gboolean success = FALSE;
+  guint i;
+
+  if (!ensure_roi_pool (postproc))
+    return FALSE;
+
+  rois = g_ptr_array_new ();
+  buffers = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_buffer_unref);
+  regions = g_array_new (FALSE, FALSE, sizeof (GstVaapiRectangle));
+  surfaces = g_array_new (FALSE, FALSE, sizeof (GstVaapiSurface *));
+
+  while ((roi = (GstVideoRegionOfInterestMeta *)
+          gst_buffer_iterate_meta_filtered (outbuf, &state,
+              GST_VIDEO_REGION_OF_INTEREST_META_API_TYPE))) {
+    GstVaapiRectangle region;
+    GstVaapiSurface *crop_surface;
+    GstBuffer *buf;
+
+    /* Already cropped by an upstream postproc */
+    if (gst_video_region_of_interest_meta_get_param (roi, "GstVaapiRoiCrop"))
+      continue;
+
+    region.x = MIN (roi->x, width);
+    region.y = MIN (roi->y, height);
+    region.width = MIN (roi->w, width - region.x);
+    region.height = MIN (roi->h, height - region.y);
+    if (region.width == 0 || region.height == 0)
+      continue;
+
+    if (gst_buffer_pool_acquire_buffer (postproc->roi_pool, &buf, NULL) !=
+        GST_FLOW_OK)
+      goto done;
+    g_ptr_array_add (buffers, buf);
+    crop_surface =
+        gst_vaapi_video_meta_get_surface (gst_buffer_get_vaapi_video_meta
+        (buf));
+    if (!crop_surface)
+      goto done;
+
+    g_ptr_array_add (rois, roi);
+    g_array_append_val (regions, region);
+    g_array_append_val (surfaces, crop_surface);
+  }
+
+  if (rois->len > 0) {
+    status = gst_vaapi_filter_process_regions (postproc->filter, surface,
+        (GstVaapiRectangle *) regions->data,
+        (GstVaapiSurface **) surfaces->data, rois->len, 0);
+    if (status != GST_VAAPI_FILTER_STATUS_SUCCESS)
+      goto done;
+  }
+
+  for (i = 0; i < rois->len; i++) {
+    GstBuffer *const buf = g_ptr_array_index (buffers, i);
+
+    GST_BUFFER_PTS (buf) = GST_BUFFER_PTS (outbuf);
+    GST_BUFFER_DURATION (buf) = GST_BUFFER_DURATION (outbuf);
+    gst_video_region_of_interest_meta_add_param (g_ptr_array_index (rois, i),
+        gst_structure_new ("GstVaapiRoiCrop", "buffer", GST_TYPE_BUFFER, buf,
+            NULL));
+  }
+  success = TRUE;
+
+done:
+  g_ptr_array_unref (rois);
+  g_ptr_array_unref (buffers);
+  g_array_unref (regions);
+  g_array_unref (surfaces);
+  return success;
+}
+
 static GstFlowReturn
 gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
     GstBuffer * outbuf)
@@ -853,7 +1273,7 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
   GstVaapiPostproc *const postproc = GST_VAAPIPOSTPROC (trans);
   GstVaapiDeinterlaceState *const ds = &postproc->deinterlace_state;
   GstVaapiVideoMeta *inbuf_meta, *outbuf_meta;
-  GstVaapiSurface *inbuf_surface, *outbuf_surface;
+  GstVaapiSurface *inbuf_surface;
   GstVaapiSurfaceProxy *proxy;
   GstVaapiFilterStatus status;
   GstClockTime timestamp;
@@ -896,6 +1316,9 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
   discont = GST_BUFFER_FLAG_IS_SET (inbuf, GST_BUFFER_FLAG_DISCONT);
   deint = should_deinterlace_buffer (postproc, inbuf);
 
+  if (postproc->letterbox)
+    set_letterbox_rect (postproc, crop_rect);
+
   /* Drop references if deinterlacing conditions changed */
   deint_changed = deint != ds->deint;
   if (deint_changed || (ds->num_surfaces > 0 && tff != ds->tff))
@@ -903,11 +1326,11 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
 
   deint_method = postproc->deinterlace_method;
   deint_refs = deint_method_is_advanced (deint_method);
+  ds_set_depth (ds, deint_refs ? GST_VAAPI_DEINTERLACE_MAX_REFERENCES : 0);
   if (deint_refs && 0) {
-    GstBuffer *const prev_buf = ds_get_buffer (ds, 0);
-    GstClockTime prev_pts, pts = GST_BUFFER_TIMESTAMP (inbuf);
+    GstClockTime prev_pts = ds->last_pts, pts = GST_BUFFER_TIMESTAMP (inbuf);
     /* Reset deinterlacing state when there is a discontinuity */
-    if (prev_buf && (prev_pts = GST_BUFFER_TIMESTAMP (prev_buf)) != pts) {
+    if (ds->num_surfaces > 0 && prev_pts != pts) {
       const GstClockTimeDiff pts_diff = GST_CLOCK_DIFF (prev_pts, pts);
       if (pts_diff < 0 || (postproc->field_duration > 0 &&
               pts_diff >= postproc->field_duration * 3 - 1))
@@ -956,7 +1379,6 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
       }
 
       if (deint_refs) {
-        ds_set_surfaces (ds);
         if (!gst_vaapi_filter_set_deinterlacing_references (postproc->filter,
                 ds->surfaces, ds->num_surfaces, NULL, 0))
           goto error_op_deinterlace;
@@ -969,10 +1391,10 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
         goto error_op_deinterlace;
     }
 
-    outbuf_surface = gst_vaapi_video_meta_get_surface (outbuf_meta);
     gst_vaapi_filter_set_cropping_rectangle (postproc->filter, crop_rect);
-    status = gst_vaapi_filter_process (postproc->filter, inbuf_surface,
-        outbuf_surface, flags);
+    status = postproc_filter_process (postproc, inbuf_surface,
+        gst_vaapi_video_meta_get_surface_proxy (outbuf_meta), flags,
+        GST_BUFFER_PTS (inbuf));
     if (status != GST_VAAPI_FILTER_STATUS_SUCCESS)
       goto error_process_vpp;
 
@@ -986,6 +1408,8 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
 
     if (!replace_to_dumb_buffer_if_required (postproc, &fieldbuf))
       goto error_copy_buffer;
+    if (!sync_exported_output (postproc, fieldbuf))
+      goto error_sync_output;
 
     ret = gst_pad_push (trans->srcpad, fieldbuf);
     if (ret != GST_FLOW_OK)
@@ -1025,10 +1449,10 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
           0))
     goto error_op_deinterlace;
 
-  outbuf_surface = gst_vaapi_video_meta_get_surface (outbuf_meta);
   gst_vaapi_filter_set_cropping_rectangle (postproc->filter, crop_rect);
-  status = gst_vaapi_filter_process (postproc->filter, inbuf_surface,
-      outbuf_surface, flags);
+  status = postproc_filter_process (postproc, inbuf_surface,
+      gst_vaapi_video_meta_get_surface_proxy (outbuf_meta), flags,
+      GST_BUFFER_PTS (inbuf));
   if (status != GST_VAAPI_FILTER_STATUS_SUCCESS)
     goto error_process_vpp;
 
@@ -1048,8 +1472,20 @@ gst_vaapipostproc_process_vpp (GstBaseTransform * trans, GstBuffer * inbuf,
   rotate_crop_meta (postproc, gst_buffer_get_video_meta (inbuf),
       gst_buffer_get_video_crop_meta (outbuf));
 
+  /* The target rectangle applies to the main output only */
+  if (postproc->letterbox)
+    gst_vaapi_filter_set_target_rectangle (postproc->filter, NULL);
+
+  if ((postproc->flags & GST_VAAPI_POSTPROC_FLAG_ROI_CROP)
+      && !process_roi_crops (postproc, inbuf_surface, outbuf))
+    goto error_process_roi;
+
+  if (!sync_exported_output (postproc, outbuf))
+    goto error_sync_output;
+
   if (deint && deint_refs)
-    ds_add_buffer (ds, inbuf);
+    ds_add_proxy (ds, gst_vaapi_video_meta_get_surface_proxy (inbuf_meta),
+        GST_BUFFER_TIMESTAMP (inbuf));
   postproc->use_vpp = TRUE;
   return GST_FLOW_OK;
 
@@ -1095,6 +1531,18 @@ error_copy_buffer:
     gst_buffer_replace (&fieldbuf, NULL);
     return GST_FLOW_ERROR;
   }
+error_process_roi:
+  {
+    GST_ERROR_OBJECT (postproc, "failed to crop regions of interest");
+    gst_buffer_replace (&fieldbuf, NULL);
+    return GST_FLOW_ERROR;
+  }
+error_sync_output:
+  {
+    GST_ERROR_OBJECT (postproc, "failed to wait for VPP output");
+    gst_buffer_replace (&fieldbuf, NULL);
+    return GST_FLOW_ERROR;
+  }
 error_push_buffer:
   {
     GST_DEBUG_OBJECT (postproc, "failed to push output buffer: %s",
@@ -1435,12 +1883,19 @@ gst_vaapipostproc_transform_caps (GstBaseTransform * trans,
     GstPadDirection direction, GstCaps * caps, GstCaps * filter)
 {
   GstVaapiPostproc *const postproc = GST_VAAPIPOSTPROC (trans);
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (postproc);
   GstCaps *out_caps;
 
   GST_DEBUG_OBJECT (trans,
       "Transforming caps %" GST_PTR_FORMAT " in direction %s", caps,
       (direction == GST_PAD_SINK) ? "sink" : "src");
 
+  /* The result doesn't depend on @caps, only on the display, the
+     properties and @filter */
+  out_caps = gst_vaapi_plugin_base_lookup_caps (plugin, direction, filter);
+  if (out_caps)
+    return out_caps;
+
   g_mutex_lock (&postproc->postproc_lock);
   out_caps = gst_vaapipostproc_transform_caps_impl (trans, direction);
   g_mutex_unlock (&postproc->postproc_lock);
@@ -1454,6 +1909,10 @@ gst_vaapipostproc_transform_caps (GstBaseTransform * trans,
     out_caps = intersection;
   }
 
+  /* don't keep the template fallback, until the display is there */
+  if (out_caps && postproc->filter)
+    gst_vaapi_plugin_base_store_caps (plugin, direction, filter, out_caps);
+
   GST_DEBUG_OBJECT (trans, "returning caps: %" GST_PTR_FORMAT, out_caps);
 
   return out_caps;
@@ -1533,6 +1992,117 @@ gst_vaapipostproc_transform_meta (GstBaseTransform * trans, GstBuffer * outbuf,
   return TRUE;
 }
 
+/* Checks whether @inbuf can be forwarded downstream as is. This is the
+   case when deinterlacing is the only operation enabled and this
+   particular buffer is progressive, e.g. with mixed content */
+static gboolean
+can_bypass_vpp (GstVaapiPostproc * postproc, GstBuffer * inbuf)
+{
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (postproc);
+
+  if (postproc->flags != GST_VAAPI_POSTPROC_FLAG_DEINTERLACE)
+    return FALSE;
+  if (should_deinterlace_buffer (postproc, inbuf))
+    return FALSE;
+  if (GST_VAAPI_PLUGIN_BASE_COPY_OUTPUT_FRAME (postproc))
+    return FALSE;
+  if (!gst_buffer_get_vaapi_video_meta (inbuf))
+    return FALSE;
+  if (gst_buffer_get_video_crop_meta (inbuf) && use_vpp_crop (postproc))
+    return FALSE;
+
+  /* The input surface is handed over, so downstream must accept it */
+  if (!gst_caps_has_vaapi_surface (GST_VAAPI_PLUGIN_BASE_SRC_PAD_CAPS (plugin)))
+    return FALSE;
+  if (!gst_video_colorimetry_is_equal
+      (&GST_VIDEO_INFO_COLORIMETRY (&postproc->sinkpad_info),
+          &GST_VIDEO_INFO_COLORIMETRY (&postproc->srcpad_info)))
+    return FALSE;
+  return TRUE;
+}
+
+/* Checks whether the frames are converted to the framerate property,
+   which deinterlacing, that outputs fields, is not compatible with */
+static gboolean
+frc_is_enabled (GstVaapiPostproc * postproc, GstBuffer * inbuf)
+{
+  const GstVideoInfo *const vip = &postproc->sinkpad_info;
+
+  if (postproc->fps_n <= 0 || postproc->fps_d <= 0)
+    return FALSE;
+  if (GST_VIDEO_INFO_FPS_N (vip) <= 0 || GST_VIDEO_INFO_FPS_D (vip) <= 0)
+    return FALSE;
+  if (gst_util_fraction_compare (postproc->fps_n, postproc->fps_d,
+          GST_VIDEO_INFO_FPS_N (vip), GST_VIDEO_INFO_FPS_D (vip)) == 0)
+    return FALSE;
+  if (!GST_BUFFER_PTS_IS_VALID (inbuf))
+    return FALSE;
+  return !should_deinterlace_buffer (postproc, inbuf);
+}
+
+static inline GstClockTime
+frc_slot_time (GstVaapiPostproc * postproc, guint64 slot)
+{
+  return postproc->frc_base + gst_util_uint64_scale (slot,
+      postproc->fps_d * GST_SECOND, postproc->fps_n);
+}
+
+/* Decides, before any processing, whether @inbuf fills the next output
+   slot of the framerate property, or is to be dropped. Each slot goes
+   to the first frame past its start, minus half a frame duration. The
+   slots no frame fell into are filled with duplicates of the previous
+   output, sharing its surface */
+static GstFlowReturn
+frc_process_input (GstVaapiPostproc * postproc, GstBuffer * inbuf)
+{
+  GstBaseTransform *const trans = GST_BASE_TRANSFORM (postproc);
+  const GstClockTime pts = GST_BUFFER_PTS (inbuf);
+  const GstClockTime half_duration = gst_util_uint64_scale_int (GST_SECOND,
+      postproc->fps_d, 2 * postproc->fps_n);
+  GstClockTime slot_time;
+  GstBuffer *dupbuf;
+  GstFlowReturn ret;
+
+  postproc->frc_drop = FALSE;
+  if (!GST_CLOCK_TIME_IS_VALID (postproc->frc_base)
+      || pts < postproc->frc_base) {
+    postproc->frc_base = pts;
+    postproc->frc_slot = 0;
+  }
+
+  for (;;) {
+    slot_time = frc_slot_time (postproc, postproc->frc_slot);
+    if (slot_time + half_duration > pts || !postproc->frc_last)
+      break;
+
+    dupbuf = gst_buffer_copy (postproc->frc_last);
+    GST_BUFFER_PTS (dupbuf) = slot_time;
+    GST_BUFFER_DTS (dupbuf) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION (dupbuf) = 2 * half_duration;
+    GST_BUFFER_FLAG_UNSET (dupbuf, GST_BUFFER_FLAG_DISCONT);
+    postproc->frc_slot++;
+
+    GST_LOG_OBJECT (postproc, "duplicating frame at %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (slot_time));
+    ret = gst_pad_push (trans->srcpad, dupbuf);
+    if (ret != GST_FLOW_OK)
+      return ret;
+  }
+
+  if (slot_time + half_duration > pts && slot_time < pts + half_duration) {
+    postproc->frc_slot++;
+  } else if (slot_time >= pts + half_duration) {
+    GST_LOG_OBJECT (postproc, "dropping frame at %" GST_TIME_FORMAT,
+        GST_TIME_ARGS (pts));
+    postproc->frc_drop = TRUE;
+  } else {
+    /* Past slot with nothing to duplicate, e.g. the first frame */
+    postproc->frc_slot = gst_util_uint64_scale (pts - postproc->frc_base +
+        half_duration, postproc->fps_n, postproc->fps_d * GST_SECOND) + 1;
+  }
+  return GST_FLOW_OK;
+}
+
 static GstFlowReturn
 gst_vaapipostproc_transform (GstBaseTransform * trans, GstBuffer * inbuf,
     GstBuffer * outbuf)
@@ -1542,6 +2112,25 @@ gst_vaapipostproc_transform (GstBaseTransform * trans, GstBuffer * inbuf,
   GstBuffer *buf, *sys_buf = NULL;
   GstFlowReturn ret;
 
+  gst_vaapi_plugin_base_stats_frame_in (plugin);
+
+  /* Frame not converted to the output framerate */
+  if (postproc->frc_drop) {
+    postproc->frc_drop = FALSE;
+    gst_vaapi_plugin_base_stats_frame_dropped (plugin);
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+  }
+
+  /* Buffer forwarded as is, see gst_vaapipostproc_prepare_output_buffer() */
+  if (outbuf == inbuf) {
+    if (frc_is_enabled (postproc, inbuf))
+      gst_buffer_replace (&postproc->frc_last, outbuf);
+    if (postproc->deinterlace_state.deint)
+      ds_reset (&postproc->deinterlace_state);
+    gst_vaapi_plugin_base_stats_frame_out (plugin);
+    return GST_FLOW_OK;
+  }
+
   ret = gst_vaapi_plugin_base_get_input_buffer (plugin, inbuf, &buf);
   if (ret != GST_FLOW_OK)
     return GST_FLOW_ERROR;
@@ -1560,7 +2149,21 @@ gst_vaapipostproc_transform (GstBaseTransform * trans, GstBuffer * inbuf,
   if (postproc->flags) {
     /* Use VA/VPP extensions to process this frame */
     if (postproc->has_vpp) {
+      GstClockTime start;
+
+      apply_live_params (postproc);
+      adapt_scaling_to_load (postproc);
+      gst_vaapi_filter_set_job_deadline (postproc->filter,
+          gst_vaapi_plugin_base_get_job_deadline (plugin, &trans->segment,
+              GST_BUFFER_PTS (inbuf)));
+      gst_vaapi_filter_set_priority (postproc->filter,
+          gst_vaapi_plugin_base_get_priority (plugin));
+      start = gst_util_get_timestamp ();
       ret = gst_vaapipostproc_process_vpp (trans, buf, outbuf);
+      /* Processing slower than the frame rate can't keep up */
+      if (ret == GST_FLOW_OK && GST_BUFFER_DURATION_IS_VALID (inbuf))
+        gst_vaapi_plugin_base_report_load (plugin,
+            gst_util_get_timestamp () - start > GST_BUFFER_DURATION (inbuf));
       if (ret != GST_FLOW_NOT_SUPPORTED)
         goto done;
       GST_WARNING_OBJECT (postproc, "unsupported VPP filters. Disabling");
@@ -1588,6 +2191,16 @@ done:
     outbuf = sys_buf;
   }
 
+  if (ret == GST_FLOW_OK && frc_is_enabled (postproc, inbuf)) {
+    GST_BUFFER_DURATION (outbuf) = gst_util_uint64_scale_int (GST_SECOND,
+        postproc->fps_d, postproc->fps_n);
+    gst_buffer_replace (&postproc->frc_last, outbuf);
+  }
+
+  if (ret == GST_FLOW_OK)
+    gst_vaapi_plugin_base_stats_frame_out (plugin);
+  else if (ret == GST_BASE_TRANSFORM_FLOW_DROPPED)
+    gst_vaapi_plugin_base_stats_frame_dropped (plugin);
   return ret;
 }
 
@@ -1631,6 +2244,24 @@ gst_vaapipostproc_prepare_output_buffer (GstBaseTransform * trans,
     return GST_FLOW_OK;
   }
 
+  /* Dropped frames skip VPP and the output pool */
+  if (frc_is_enabled (postproc, inbuf)) {
+    GstFlowReturn ret = frc_process_input (postproc, inbuf);
+    if (ret != GST_FLOW_OK)
+      return ret;
+    if (postproc->frc_drop) {
+      *outbuf_ptr = inbuf;
+      return GST_FLOW_OK;
+    }
+  }
+
+  /* Frames that need no processing skip VPP and the output pool */
+  if (can_bypass_vpp (postproc, inbuf)) {
+    GST_LOG_OBJECT (postproc, "bypassing VPP for %" GST_PTR_FORMAT, inbuf);
+    *outbuf_ptr = inbuf;
+    return GST_FLOW_OK;
+  }
+
   /* If we are not using vpp crop (i.e. forwarding crop meta to downstream)
    * then, ensure our output buffer pool is sized and rotated for uncropped
    * output */
@@ -1840,6 +2471,12 @@ bail:
   /* Let vaapidecode allocate the video buffers */
   if (postproc->get_va_surfaces)
     return FALSE;
+
+  /* Input surfaces are handed over as is when deinterlacing is the
+     only processing, then downstream has the last word */
+  gst_vaapi_plugin_base_set_sink_compression (plugin,
+      postproc->flags != GST_VAAPI_POSTPROC_FLAG_DEINTERLACE
+      || gst_vaapi_plugin_base_get_downstream_compression (plugin));
   if (!gst_vaapi_plugin_base_propose_allocation (plugin, query))
     return FALSE;
   return TRUE;
@@ -1856,6 +2493,10 @@ gst_vaapipostproc_decide_allocation (GstBaseTransform * trans, GstQuery * query)
           GST_VIDEO_CROP_META_API_TYPE, NULL) &&
       gst_query_find_allocation_meta (query, GST_VIDEO_META_API_TYPE, NULL));
   GST_DEBUG_OBJECT (postproc, "use_vpp_crop=%d", use_vpp_crop (postproc));
+  postproc->export_fence = gst_query_find_allocation_meta (query,
+      GST_VAAPI_FENCE_META_API_TYPE, NULL);
+  postproc->export_drm_meta = gst_query_find_allocation_meta (query,
+      GST_VAAPI_DRM_META_API_TYPE, NULL);
   g_mutex_unlock (&postproc->postproc_lock);
 
   return gst_vaapi_plugin_base_decide_allocation (GST_VAAPI_PLUGIN_BASE (trans),
@@ -1901,6 +2542,8 @@ gst_vaapipostproc_src_event (GstBaseTransform * trans, GstEvent * event)
 
   GST_TRACE_OBJECT (postproc, "handling %s event", GST_EVENT_TYPE_NAME (event));
 
+  gst_vaapi_plugin_base_report_qos (GST_VAAPI_PLUGIN_BASE (postproc), event);
+
   switch (GST_EVENT_TYPE (event)) {
     case GST_EVENT_NAVIGATION:
       event =
@@ -1985,6 +2628,10 @@ gst_vaapipostproc_sink_event (GstBaseTransform * trans, GstEvent * event)
   GST_DEBUG_OBJECT (postproc, "handling %s event", GST_EVENT_TYPE_NAME (event));
 
   switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_STOP:
+    case GST_EVENT_SEGMENT:
+      frc_reset (postproc);
+      break;
     case GST_EVENT_TAG:
       gst_event_parse_tag (event, &taglist);
 
@@ -2034,6 +2681,7 @@ gst_vaapipostproc_finalize (GObject * object)
   GstVaapiPostproc *const postproc = GST_VAAPIPOSTPROC (object);
 
   gst_vaapipostproc_destroy (postproc);
+  g_clear_pointer (&postproc->live_params, free_live_params);
 
   g_mutex_clear (&postproc->postproc_lock);
   gst_vaapi_plugin_base_finalize (GST_VAAPI_PLUGIN_BASE (postproc));
@@ -2045,7 +2693,7 @@ gst_vaapipostproc_set_property (GObject * object,
     guint prop_id, const GValue * value, GParamSpec * pspec)
 {
   GstVaapiPostproc *const postproc = GST_VAAPIPOSTPROC (object);
-  gboolean do_reconf = FALSE;
+  gboolean do_reconf = FALSE, is_live = FALSE;
 
   g_mutex_lock (&postproc->postproc_lock);
   switch (prop_id) {
@@ -2080,30 +2728,37 @@ gst_vaapipostproc_set_property (GObject * object,
     case PROP_DENOISE:
       postproc->denoise_level = g_value_get_float (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_DENOISE;
+      is_live = TRUE;
       break;
     case PROP_SHARPEN:
       postproc->sharpen_level = g_value_get_float (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_SHARPEN;
+      is_live = TRUE;
       break;
     case PROP_HUE:
       postproc->hue = g_value_get_float (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_HUE;
+      is_live = TRUE;
       break;
     case PROP_SATURATION:
       postproc->saturation = g_value_get_float (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_SATURATION;
+      is_live = TRUE;
       break;
     case PROP_BRIGHTNESS:
       postproc->brightness = g_value_get_float (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_BRIGHTNESS;
+      is_live = TRUE;
       break;
     case PROP_CONTRAST:
       postproc->contrast = g_value_get_float (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_CONTRAST;
+      is_live = TRUE;
       break;
     case PROP_SCALE_METHOD:
       postproc->scale_method = g_value_get_enum (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_SCALE;
+      is_live = TRUE;
       break;
     case PROP_VIDEO_DIRECTION:
       postproc->video_direction = g_value_get_enum (value);
@@ -2113,11 +2768,13 @@ gst_vaapipostproc_set_property (GObject * object,
     case PROP_SKIN_TONE_ENHANCEMENT:
       postproc->skintone_enhance = g_value_get_boolean (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_SKINTONE;
+      is_live = TRUE;
       break;
 #endif
     case PROP_SKIN_TONE_ENHANCEMENT_LEVEL:
       postproc->skintone_value = g_value_get_uint (value);
       postproc->flags |= GST_VAAPI_POSTPROC_FLAG_SKINTONE_LEVEL;
+      is_live = TRUE;
       break;
     case PROP_CROP_LEFT:
     {
@@ -2151,15 +2808,62 @@ gst_vaapipostproc_set_property (GObject * object,
       do_reconf = (prev_crop_bottom != postproc->crop_bottom);
       break;
     }
+    case PROP_ROI_WIDTH:
+    case PROP_ROI_HEIGHT:
+      if (prop_id == PROP_ROI_WIDTH)
+        postproc->roi_width = g_value_get_uint (value);
+      else
+        postproc->roi_height = g_value_get_uint (value);
+      if (postproc->roi_width > 0 && postproc->roi_height > 0)
+        postproc->flags |= GST_VAAPI_POSTPROC_FLAG_ROI_CROP;
+      else
+        postproc->flags &= ~GST_VAAPI_POSTPROC_FLAG_ROI_CROP;
+      break;
+    case PROP_LETTERBOX:
+      postproc->letterbox = g_value_get_boolean (value);
+      break;
+    case PROP_BACKGROUND_COLOR:
+      postproc->background_color = g_value_get_uint (value);
+      break;
+    case PROP_JOB_PRIORITY:
+      GST_VAAPI_PLUGIN_BASE (object)->job_priority = g_value_get_enum (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_VAAPI_PLUGIN_BASE (object)->stats_interval = g_value_get_uint (value);
+      break;
     case PROP_HDR_TONE_MAP:
       postproc->hdr_tone_map = g_value_get_enum (value);
       break;
+    case PROP_FRAMERATE:
+      postproc->fps_n = gst_value_get_fraction_numerator (value);
+      postproc->fps_d = gst_value_get_fraction_denominator (value);
+      break;
+    case PROP_ADAPTIVE_QUALITY:
+      GST_VAAPI_PLUGIN_BASE (object)->adaptive_quality =
+          g_value_get_boolean (value);
+      break;
+    case PROP_PRIORITY:
+      GST_VAAPI_PLUGIN_BASE (object)->priority = g_value_get_enum (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
   }
+  if (is_live)
+    publish_live_params (postproc);
   g_mutex_unlock (&postproc->postproc_lock);
 
+  /* A live value only needs renegotiation to leave passthrough */
+  if (is_live) {
+    if (gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (postproc))
+        && check_filter_update (postproc))
+      gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (postproc));
+    return;
+  }
+
+  /* the transformed caps follow the format and size properties */
+  gst_vaapi_plugin_base_clear_caps_cache (GST_VAAPI_PLUGIN_BASE (postproc));
+
   if (do_reconf || check_filter_update (postproc))
     gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (postproc));
 }
@@ -2236,9 +2940,41 @@ gst_vaapipostproc_get_property (GObject * object,
     case PROP_CROP_BOTTOM:
       g_value_set_uint (value, postproc->crop_bottom);
       break;
+    case PROP_ROI_WIDTH:
+      g_value_set_uint (value, postproc->roi_width);
+      break;
+    case PROP_ROI_HEIGHT:
+      g_value_set_uint (value, postproc->roi_height);
+      break;
+    case PROP_LETTERBOX:
+      g_value_set_boolean (value, postproc->letterbox);
+      break;
+    case PROP_BACKGROUND_COLOR:
+      g_value_set_uint (value, postproc->background_color);
+      break;
+    case PROP_JOB_PRIORITY:
+      g_value_set_enum (value, GST_VAAPI_PLUGIN_BASE (object)->job_priority);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          gst_vaapi_plugin_base_get_stats (GST_VAAPI_PLUGIN_BASE (object)));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, GST_VAAPI_PLUGIN_BASE (object)->stats_interval);
+      break;
     case PROP_HDR_TONE_MAP:
       g_value_set_enum (value, postproc->hdr_tone_map);
       break;
+    case PROP_FRAMERATE:
+      gst_value_set_fraction (value, postproc->fps_n, postproc->fps_d);
+      break;
+    case PROP_ADAPTIVE_QUALITY:
+      g_value_set_boolean (value,
+          GST_VAAPI_PLUGIN_BASE (object)->adaptive_quality);
+      break;
+    case PROP_PRIORITY:
+      g_value_set_enum (value, GST_VAAPI_PLUGIN_BASE (object)->priority);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -2440,6 +3176,144 @@ gst_vaapipostproc_class_init (GstVaapiPostprocClass * klass)
           "Pixels to crop at bottom",
           0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  /**
+   * GstVaapiPostproc:roi-width:
+   *
+   * The width of the crops made out of the regions of interest of
+   * each frame, see #GstVaapiPostproc:roi-height.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_ROI_WIDTH,
+      g_param_spec_uint ("roi-width",
+          "ROI crop width",
+          "Width of the crops of each region of interest (0: disabled)",
+          0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:roi-height:
+   *
+   * The height of the crops made out of the regions of interest of
+   * each frame. When both #GstVaapiPostproc:roi-width and this
+   * property are set, every #GstVideoRegionOfInterestMeta of the
+   * output buffers gets a "GstVaapiRoiCrop" parameter whose "buffer"
+   * field holds the region, scaled to that size, in a VA surface.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_ROI_HEIGHT,
+      g_param_spec_uint ("roi-height",
+          "ROI crop height",
+          "Height of the crops of each region of interest (0: disabled)",
+          0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:letterbox:
+   *
+   * When enabled, the picture is scaled to fit the output frame while
+   * keeping its display aspect ratio. The remaining borders are
+   * filled with #GstVaapiPostproc:background-color. This is meant
+   * for fixed size outputs, e.g. the input of a neural network.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_LETTERBOX,
+      g_param_spec_boolean ("letterbox",
+          "Letterbox",
+          "Keep the aspect ratio in fixed size outputs by padding the borders",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:background-color:
+   *
+   * The color of the letterbox borders, as 0xAARRGGBB.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_BACKGROUND_COLOR,
+      g_param_spec_uint ("background-color",
+          "Background color",
+          "Color of the letterbox borders, in big-endian ARGB",
+          0, G_MAXUINT32, 0xff000000,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:job-priority:
+   *
+   * How the video processing jobs are scheduled against the other
+   * streams sharing the VA display. Live filters run in the order of
+   * the running time of their frames, ahead of any batch job.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_JOB_PRIORITY,
+      g_param_spec_enum ("job-priority",
+          "Job priority",
+          "Scheduling priority of the hardware jobs",
+          GST_VAAPI_TYPE_JOB_PRIORITY, GST_VAAPI_JOB_PRIORITY_BATCH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:priority:
+   *
+   * The priority the GPU scheduler gives to the video processing
+   * jobs, over the ones of every other process, on drivers with
+   * context priorities. By default, live filters get the high
+   * priority and the others keep the one of the driver.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_PRIORITY,
+      g_param_spec_enum ("priority",
+          "Priority",
+          "GPU scheduling priority of the VA context",
+          GST_VAAPI_TYPE_PRIORITY, GST_VAAPI_PRIORITY_DEFAULT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:stats:
+   *
+   * The live performance counters of the element, see also
+   * GstVaapiPostproc:stats-interval to have them posted on the bus.
+   */
+  gst_vaapi_plugin_base_class_install_stats_properties (object_class,
+      PROP_STATS, PROP_STATS_INTERVAL);
+
+  /**
+   * GstVaapiPostproc:framerate:
+   *
+   * The output frame rate, or 0/1 to keep the input one. Frames are
+   * dropped before being processed, and duplicated by sharing the
+   * surface of the previous output, so that lowering the frame rate
+   * also lowers the processing load. Deinterlaced frames are not
+   * converted.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_FRAMERATE,
+      gst_param_spec_fraction ("framerate",
+          "Framerate",
+          "Output frame rate (0/1 = same as input)",
+          0, 1, G_MAXINT, 1, 0, 1,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /**
+   * GstVaapiPostproc:adaptive-quality:
+   *
+   * Whether to scale with faster methods than
+   * GstVaapiPostproc:scale-method while the VA device is overloaded,
+   * as estimated from the QoS events, the processing time and the
+   * reports of the other elements sharing the display. The configured
+   * method is restored once the load eases.
+   */
+  g_object_class_install_property
+      (object_class,
+      PROP_ADAPTIVE_QUALITY,
+      g_param_spec_boolean ("adaptive-quality",
+          "Adaptive quality",
+          "Trade quality for speed while the device is overloaded",
+          FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   /**
    * GstVaapiPostproc:force-aspect-ratio:
    *
@@ -2628,9 +3502,14 @@ gst_vaapipostproc_init (GstVaapiPostproc * postproc)
   postproc->deinterlace_mode = DEFAULT_DEINTERLACE_MODE;
   postproc->deinterlace_method = DEFAULT_DEINTERLACE_METHOD;
   postproc->field_duration = GST_CLOCK_TIME_NONE;
+  postproc->fps_d = 1;
+  postproc->frc_base = GST_CLOCK_TIME_NONE;
   postproc->keep_aspect = TRUE;
+  postproc->background_color = 0xff000000;
   postproc->get_va_surfaces = TRUE;
   postproc->forward_crop = FALSE;
+  postproc->export_fence = FALSE;
+  postproc->export_drm_meta = FALSE;
 
   /* AUTO is not valid for tag_video_direction, this is just to
    * ensure we setup the method as sink event tag */
@@ -2753,12 +3632,14 @@ gst_vaapipostproc_colorbalance_set_value (GstColorBalance * balance,
 
   var = cb_get_value_ptr (postproc, channel, &flags);
   if (var) {
-    *var = new_val;
     g_mutex_lock (&postproc->postproc_lock);
+    *var = new_val;
     postproc->flags |= flags;
+    publish_live_params (postproc);
     g_mutex_unlock (&postproc->postproc_lock);
     gst_color_balance_value_changed (balance, channel, value);
-    if (check_filter_update (postproc))
+    if (gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (postproc))
+        && check_filter_update (postproc))
       gst_base_transform_reconfigure_src (GST_BASE_TRANSFORM (postproc));
     return;
   }
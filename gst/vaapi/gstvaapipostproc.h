@@ -26,6 +26,7 @@
 #include "gstvaapipluginbase.h"
 #include <gst/vaapi/gstvaapisurface.h>
 #include <gst/vaapi/gstvaapisurfacepool.h>
+#include <gst/vaapi/gstvaapisurfaceproxy.h>
 #include <gst/vaapi/gstvaapifilter.h>
 
 G_BEGIN_DECLS
@@ -101,6 +102,7 @@ typedef enum
  * @GST_VAAPI_POSTPROC_FLAG_HDR_TONE_MAP: HDR tone mapping.
  * @GST_VAAPI_POSTPROC_FLAG_SKINTONE: Skin tone enhancement.
  * @GST_VAAPI_POSTPROC_FLAG_SKINTONE_LEVEL: Skin tone enhancement with value.
+ * @GST_VAAPI_POSTPROC_FLAG_ROI_CROP: Scaled crops of the regions of interest.
  *
  * The set of operations that are to be performed for each frame.
  */
@@ -128,29 +130,55 @@ typedef enum
   /* Additional custom flags */
   GST_VAAPI_POSTPROC_FLAG_CUSTOM      = 1 << 20,
   GST_VAAPI_POSTPROC_FLAG_SIZE        = GST_VAAPI_POSTPROC_FLAG_CUSTOM,
+  GST_VAAPI_POSTPROC_FLAG_ROI_CROP    = GST_VAAPI_POSTPROC_FLAG_CUSTOM << 1,
 } GstVaapiPostprocFlags;
 
 /*
  * GstVaapiDeinterlaceState:
- * @buffers: history buffer, maintained as a cyclic array
- * @buffers_index: next free slot in the history buffer
- * @surfaces: array of surfaces used as references
+ * @proxies: history of surface proxies, maintained as a cyclic array
+ * @proxies_index: next free slot in the history
+ * @depth: number of history slots in use, at most
+ *   %GST_VAAPI_DEINTERLACE_MAX_REFERENCES
+ * @surfaces: array of surfaces used as references, most recent first
  * @num_surfaces: number of active surfaces in that array
+ * @last_pts: timestamp of the most recent buffer in the history
  * @deint: flag: previous buffers were interlaced?
  * @tff: flag: previous buffers were organized as top-field-first?
  *
- * Context used to maintain deinterlacing state.
+ * Context used to maintain deinterlacing state. Only the surface
+ * proxies are retained, so that the input buffers themselves can be
+ * released as soon as they are processed.
  */
 struct _GstVaapiDeinterlaceState
 {
-  GstBuffer *buffers[GST_VAAPI_DEINTERLACE_MAX_REFERENCES];
-  guint buffers_index;
+  GstVaapiSurfaceProxy *proxies[GST_VAAPI_DEINTERLACE_MAX_REFERENCES];
+  guint proxies_index;
+  guint depth;
   GstVaapiSurface *surfaces[GST_VAAPI_DEINTERLACE_MAX_REFERENCES];
   guint num_surfaces;
+  GstClockTime last_pts;
   guint deint:1;
   guint tff:1;
 };
 
+/* The filter values that change with no renegotiation, handed over
+ * from the property setters to the streaming thread */
+typedef struct _GstVaapiPostprocParams GstVaapiPostprocParams;
+struct _GstVaapiPostprocParams
+{
+  guint version;
+  guint flags;
+  gfloat denoise_level;
+  gfloat sharpen_level;
+  GstVaapiScaleMethod scale_method;
+  gfloat hue;
+  gfloat saturation;
+  gfloat brightness;
+  gfloat contrast;
+  gboolean skintone_enhance;
+  guint skintone_value;
+};
+
 struct _GstVaapiPostproc
 {
   /*< private >*/
@@ -196,6 +224,16 @@ struct _GstVaapiPostproc
   guint crop_top;
   guint crop_bottom;
 
+  /* Regions of interest cropping */
+  guint roi_width;
+  guint roi_height;
+  GstBufferPool *roi_pool;
+  GstVideoInfo roi_pool_info;
+
+  /* Letterboxing */
+  guint32 background_color;
+  gboolean letterbox;
+
   /* Color balance filter values */
   gfloat hue;
   gfloat saturation;
@@ -204,7 +242,21 @@ struct _GstVaapiPostproc
 
   gboolean skintone_enhance;
   guint skintone_value;
+
+  /* latest GstVaapiPostprocParams not picked up yet, swapped
+     atomically; the version is bumped under postproc_lock */
+  gpointer live_params;
+  guint live_params_version;
+
+  /* scaling method set on the filter, degraded from scale_method while
+     the display is overloaded */
+  GstVaapiScaleMethod filter_scale_method;
+
   gboolean forward_crop;
+  /* downstream waits for the GstVaapiFenceMeta of exported buffers */
+  gboolean export_fence;
+  /* downstream imports with the GstVaapiDrmMeta of exported buffers */
+  gboolean export_drm_meta;
 
   guint get_va_surfaces:1;
   guint has_vpp:1;
@@ -214,6 +266,14 @@ struct _GstVaapiPostproc
   /* color balance's channel list */
   GList *cb_channels;
   gboolean same_caps;
+
+  /* Frame rate conversion, see GstVaapiPostproc:framerate */
+  gint fps_n;
+  gint fps_d;
+  GstClockTime frc_base;        /* timestamp of the first output slot */
+  guint64 frc_slot;             /* index of the next output slot */
+  GstBuffer *frc_last;          /* previous output, for duplicates */
+  gboolean frc_drop;
 };
 
 struct _GstVaapiPostprocClass
@@ -559,6 +559,10 @@ _fixate_frame_rate (GstVaapiPostproc * postproc, GstVideoInfo * vinfo,
   if (is_deinterlace_enabled (postproc, vinfo)) {
     if (!gst_util_fraction_multiply (fps_n, fps_d, 2, 1, &fps_n, &fps_d))
       goto overflow_error;
+  } else if (postproc->fps_n > 0 && postproc->fps_d > 0 && fps_n > 0) {
+    /* Frame rate conversion, see gst_vaapipostproc_transform() */
+    fps_n = postproc->fps_n;
+    fps_d = postproc->fps_d;
   }
   gst_structure_set (outs, "framerate", GST_TYPE_FRACTION, fps_n, fps_d, NULL);
   return TRUE;
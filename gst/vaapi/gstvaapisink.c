@@ -42,6 +42,9 @@
 #include <gst/video/video.h>
 
 #include <gst/vaapi/gstvaapivalue.h>
+#include <gst/vaapi/gstvaapisurface_drm.h>
+#include <gst/vaapi/gstvaapisurfacepool.h>
+#include <gst/vaapi/gstvaapitrace.h>
 
 /* Supported interfaces */
 # include <gst/video/videooverlay.h>
@@ -135,13 +138,30 @@ enum
   PROP_BRIGHTNESS,
   PROP_CONTRAST,
   PROP_SIGNAL_HANDOFFS,
-
-  N_PROPERTIES
+  PROP_RENDER_QUEUE_DEPTH,
+  PROP_RENDER_QUEUE_LATENCY,
+  PROP_RENDER_QUEUE_MAX_LATENCY,
+  PROP_NULL_PRESENT,
+  PROP_NULL_PRESENT_FORMAT,
+  PROP_NULL_PRESENT_STATS,
+  PROP_NUMA_NODE,
+  PROP_THREAD_POLICY,
+  PROP_THREAD_PRIORITY,
+  PROP_ADAPTIVE_QUALITY,
+
+  N_PROPERTIES,
+
+  /* see gst_vaapi_plugin_base_class_install_stats_properties() */
+  PROP_STATS = N_PROPERTIES,
+  PROP_STATS_INTERVAL,
 };
 
 #define DEFAULT_DISPLAY_TYPE            GST_VAAPI_DISPLAY_TYPE_ANY
 #define DEFAULT_ROTATION                GST_VAAPI_ROTATION_0
 #define DEFAULT_SIGNAL_HANDOFFS         FALSE
+#define DEFAULT_RENDER_QUEUE_DEPTH      0
+#define DEFAULT_NULL_PRESENT            FALSE
+#define DEFAULT_NULL_PRESENT_FORMAT     GST_VIDEO_FORMAT_UNKNOWN
 
 static GParamSpec *g_properties[N_PROPERTIES] = { NULL, };
 
@@ -155,6 +175,15 @@ gst_vaapisink_set_event_handling (GstVaapiSink * sink, gboolean handle_events);
 static GstFlowReturn
 gst_vaapisink_show_frame (GstVideoSink * video_sink, GstBuffer * buffer);
 
+static gboolean gst_vaapisink_start_render_thread (GstVaapiSink * sink);
+
+static void gst_vaapisink_stop_render_thread (GstVaapiSink * sink);
+
+static void gst_vaapisink_drain_render_queue (GstVaapiSink * sink);
+
+static void
+gst_vaapisink_set_render_flushing (GstVaapiSink * sink, gboolean flushing);
+
 static gboolean
 gst_vaapisink_ensure_render_rect (GstVaapiSink * sink, guint width,
     guint height);
@@ -179,21 +208,26 @@ gst_vaapisink_render_surface (GstVaapiSink * sink, GstVaapiSurface * surface,
 
 #if USE_DRM
 #include <gst/vaapi/gstvaapidisplay_drm.h>
+#include <gst/vaapi/gstvaapiwindow_drm.h>
 
 static gboolean
 gst_vaapisink_drm_create_window (GstVaapiSink * sink, guint width, guint height)
 {
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
+
   g_return_val_if_fail (sink->window == NULL, FALSE);
 
-  GST_ERROR ("failed to create a window for VA/DRM display");
-  return FALSE;
-}
+  /* The display has no size without a connected output */
+  if (!width || !height) {
+    width = sink->video_width;
+    height = sink->video_height;
+  }
 
-static gboolean
-gst_vaapisink_drm_render_surface (GstVaapiSink * sink,
-    GstVaapiSurface * surface, const GstVaapiRectangle * surface_rect,
-    guint flags)
-{
+  sink->window = gst_vaapi_window_drm_new (display, width, height);
+  if (!sink->window) {
+    GST_ERROR ("failed to create a window for VA/DRM display");
+    return FALSE;
+  }
   return TRUE;
 }
 
@@ -202,7 +236,7 @@ gst_vaapisink_backend_drm (void)
 {
   static const GstVaapiSinkBackend GstVaapiSinkBackendDRM = {
     .create_window = gst_vaapisink_drm_create_window,
-    .render_surface = gst_vaapisink_drm_render_surface,
+    .render_surface = gst_vaapisink_render_surface,
   };
   return &GstVaapiSinkBackendDRM;
 }
@@ -579,6 +613,106 @@ gst_vaapisink_wayland_create_window_from_handle (GstVaapiSink * sink,
   return sink->window != NULL;
 }
 
+/* Renders ahead of time by the delay the compositor takes to present
+   a frame, as measured by the presentation feedback. This lets the
+   base sink schedule frames against their actual display time and drop
+   the ones that cannot make it before they go through VPP */
+static void
+gst_vaapisink_wayland_update_render_delay (GstVaapiSink * sink)
+{
+  GstBaseSink *const base_sink = GST_BASE_SINK_CAST (sink);
+  GstClockTime refresh, latency, render_delay, threshold;
+
+  if (!gst_vaapi_window_wayland_get_presentation_timing
+      (GST_VAAPI_WINDOW_WAYLAND (sink->window), &refresh, &latency))
+    return;
+
+  /* Only follow changes large enough to move frames to another vsync */
+  threshold = GST_CLOCK_TIME_IS_VALID (refresh) ? refresh / 2 : GST_MSECOND;
+  render_delay = gst_base_sink_get_render_delay (base_sink);
+  if (ABS (GST_CLOCK_DIFF (render_delay, latency)) < threshold)
+    return;
+
+  GST_DEBUG_OBJECT (sink, "presentation latency %" GST_TIME_FORMAT
+      ", refresh interval %" GST_TIME_FORMAT, GST_TIME_ARGS (latency),
+      GST_TIME_ARGS (refresh));
+
+  gst_base_sink_set_render_delay (base_sink, latency);
+  gst_element_post_message (GST_ELEMENT_CAST (sink),
+      gst_message_new_latency (GST_OBJECT_CAST (sink)));
+}
+
+static gboolean
+gst_vaapisink_wayland_render_surface (GstVaapiSink * sink,
+    GstVaapiSurface * surface, const GstVaapiRectangle * surface_rect,
+    guint flags)
+{
+  if (!gst_vaapisink_render_surface (sink, surface, surface_rect, flags))
+    return FALSE;
+
+  gst_vaapisink_wayland_update_render_delay (sink);
+  return TRUE;
+}
+
+static gboolean
+format_list_contains (const GValue * list, const gchar * format)
+{
+  guint i;
+
+  for (i = 0; i < gst_value_list_get_size (list); i++) {
+    const GValue *const value = gst_value_list_get_value (list, i);
+    if (g_strcmp0 (g_value_get_string (value), format) == 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Lists first the formats the compositor accepts as dma-buf, so that
+   upstream picks one that can be presented without a VPP blit
+   whenever it has the choice */
+static void
+gst_vaapisink_wayland_sort_formats (GstVaapiSink * sink, GstCaps * caps)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
+  GArray *dmabuf_formats;
+  guint i, j, k;
+
+  dmabuf_formats = gst_vaapi_display_wayland_get_dmabuf_formats
+      (GST_VAAPI_DISPLAY_WAYLAND (display));
+  if (!dmabuf_formats)
+    return;
+
+  for (i = 0; i < gst_caps_get_size (caps) && dmabuf_formats->len > 0; i++) {
+    GstStructure *const structure = gst_caps_get_structure (caps, i);
+    const GValue *const formats = gst_structure_get_value (structure,
+        "format");
+    GValue sorted = G_VALUE_INIT;
+
+    if (!formats || !GST_VALUE_HOLDS_LIST (formats))
+      continue;
+
+    g_value_init (&sorted, GST_TYPE_LIST);
+    for (j = 0; j < dmabuf_formats->len; j++) {
+      const gchar *const format = gst_video_format_to_string
+          (g_array_index (dmabuf_formats, GstVideoFormat, j));
+      if (format_list_contains (formats, format)
+          && !format_list_contains (&sorted, format)) {
+        GValue value = G_VALUE_INIT;
+        g_value_init (&value, G_TYPE_STRING);
+        g_value_set_string (&value, format);
+        gst_value_list_append_and_take_value (&sorted, &value);
+      }
+    }
+    for (k = 0; k < gst_value_list_get_size (formats); k++) {
+      const GValue *const value = gst_value_list_get_value (formats, k);
+      if (!format_list_contains (&sorted, g_value_get_string (value)))
+        gst_value_list_append_value (&sorted, value);
+    }
+    gst_structure_take_value (structure, "format", &sorted);
+  }
+  g_array_unref (dmabuf_formats);
+}
+
 static const inline GstVaapiSinkBackend *
 gst_vaapisink_backend_wayland (void)
 {
@@ -586,7 +720,7 @@ gst_vaapisink_backend_wayland (void)
     .create_window = gst_vaapisink_wayland_create_window,
     .create_window_from_handle =
         gst_vaapisink_wayland_create_window_from_handle,
-    .render_surface = gst_vaapisink_render_surface,
+    .render_surface = gst_vaapisink_wayland_render_surface,
   };
   return &GstVaapiSinkBackendWayland;
 }
@@ -975,6 +1109,8 @@ gst_vaapisink_reconfigure_window (GstVaapiSink * sink)
 static gpointer
 gst_vaapisink_event_thread (GstVaapiSink * sink)
 {
+  gst_vaapi_plugin_base_bind_thread (GST_VAAPI_PLUGIN_BASE (sink));
+
   GST_OBJECT_LOCK (sink);
   while (!sink->event_thread_cancel) {
     GST_OBJECT_UNLOCK (sink);
@@ -1208,17 +1344,25 @@ gst_vaapisink_ensure_rotation (GstVaapiSink * sink,
   if (sink->rotation == sink->rotation_req)
     return TRUE;
 
-  if (!sink->use_rotation) {
+  /* The windowing system rotates the buffers at no cost, e.g. with a
+     Wayland buffer transform, rather than the VA display */
+  if (sink->window
+      && gst_vaapi_window_set_rotation (sink->window, sink->rotation_req)) {
+    GST_DEBUG ("rotation applied by the window");
+  } else if (!sink->use_rotation) {
+    /* Try again once the window is created */
+    if (!sink->window)
+      return FALSE;
     GST_WARNING ("VA display does not support rotation");
     goto end;
-  }
-
-  gst_vaapi_display_lock (display);
-  success = gst_vaapi_display_set_rotation (display, sink->rotation_req);
-  gst_vaapi_display_unlock (display);
-  if (!success) {
-    GST_ERROR ("failed to change VA display rotation mode");
-    goto end;
+  } else {
+    gst_vaapi_display_lock (display);
+    success = gst_vaapi_display_set_rotation (display, sink->rotation_req);
+    gst_vaapi_display_unlock (display);
+    if (!success) {
+      GST_ERROR ("failed to change VA display rotation mode");
+      goto end;
+    }
   }
 
   if (((sink->rotation + sink->rotation_req) % 180) == 90) {
@@ -1273,6 +1417,149 @@ gst_vaapisink_display_changed (GstVaapiPluginBase * plugin)
       GST_VAAPI_DISPLAY_PROP_ROTATION);
 }
 
+/* --- Null present --- */
+
+static gboolean
+gst_vaapisink_null_present_ensure_filter (GstVaapiSink * sink)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
+
+  if (!sink->null_present_filter) {
+    sink->null_present_filter = gst_vaapi_filter_new (display);
+    if (!sink->null_present_filter)
+      goto error_create_filter;
+    if (!gst_vaapi_filter_set_format (sink->null_present_filter,
+            sink->null_present_format))
+      goto error_unsupported_format;
+  }
+
+  if (!sink->null_present_pool) {
+    sink->null_present_pool = gst_vaapi_surface_pool_new (display,
+        sink->null_present_format, sink->window_width, sink->window_height, 0);
+    if (!sink->null_present_pool)
+      goto error_create_pool;
+  }
+  return TRUE;
+
+  /* ERRORS */
+error_create_filter:
+  {
+    GST_ERROR_OBJECT (sink, "failed to create VPP filter");
+    return FALSE;
+  }
+error_unsupported_format:
+  {
+    GST_ERROR_OBJECT (sink, "unsupported null present format %s",
+        gst_video_format_to_string (sink->null_present_format));
+    gst_vaapi_filter_replace (&sink->null_present_filter, NULL);
+    return FALSE;
+  }
+error_create_pool:
+  {
+    GST_ERROR_OBJECT (sink, "failed to create %s surface pool",
+        gst_video_format_to_string (sink->null_present_format));
+    return FALSE;
+  }
+}
+
+/* Goes through what a window backend does, but for the present itself */
+static gboolean
+gst_vaapisink_null_present_surface (GstVaapiSink * sink,
+    GstVaapiSurface * surface, const GstVaapiRectangle * surface_rect,
+    guint flags)
+{
+  GstVaapiSurface *out_surface = NULL;
+  GstVaapiFilterStatus status;
+  GstClockTime start_time, convert_time = 0, render_time;
+
+  start_time = gst_util_get_timestamp ();
+
+  if (sink->null_present_format != GST_VIDEO_FORMAT_UNKNOWN) {
+    if (!gst_vaapisink_null_present_ensure_filter (sink))
+      return FALSE;
+
+    out_surface = gst_vaapi_video_pool_get_object (sink->null_present_pool);
+    if (!out_surface)
+      goto error_get_surface;
+
+    gst_vaapi_filter_set_cropping_rectangle (sink->null_present_filter,
+        surface_rect);
+    gst_vaapi_filter_set_target_rectangle (sink->null_present_filter,
+        &sink->display_rect);
+
+    status = gst_vaapi_filter_process (sink->null_present_filter, surface,
+        out_surface, flags);
+    if (status != GST_VAAPI_FILTER_STATUS_SUCCESS)
+      goto error_process;
+
+    /* Accounts for the conversion the GPU actually did */
+    if (!gst_vaapi_surface_sync (out_surface))
+      goto error_sync;
+    convert_time = gst_util_get_timestamp () - start_time;
+    gst_vaapi_video_pool_put_object (sink->null_present_pool, out_surface);
+  } else if (!gst_vaapi_surface_sync (surface))
+    goto error_sync;
+
+  render_time = gst_util_get_timestamp () - start_time;
+
+  GST_OBJECT_LOCK (sink);
+  sink->null_present_frames++;
+  sink->null_present_time += render_time;
+  sink->null_present_convert_time += convert_time;
+  if (sink->null_present_convert_max_time < convert_time)
+    sink->null_present_convert_max_time = convert_time;
+  GST_OBJECT_UNLOCK (sink);
+  return TRUE;
+
+  /* ERRORS */
+error_get_surface:
+  {
+    GST_ERROR_OBJECT (sink, "failed to get a surface from the pool");
+    return FALSE;
+  }
+error_process:
+  {
+    GST_ERROR_OBJECT (sink, "failed to convert surface (status %d)", status);
+    gst_vaapi_video_pool_put_object (sink->null_present_pool, out_surface);
+    return FALSE;
+  }
+error_sync:
+  {
+    GST_ERROR_OBJECT (sink, "failed to synchronize surface");
+    if (out_surface)
+      gst_vaapi_video_pool_put_object (sink->null_present_pool, out_surface);
+    return FALSE;
+  }
+}
+
+static GstStructure *
+gst_vaapisink_get_null_present_stats (GstVaapiSink * sink)
+{
+  GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (sink);
+  GstStructure *stats;
+  guint64 frames;
+  GstClockTime total_time, convert_time, convert_max_time;
+
+  GST_OBJECT_LOCK (sink);
+  frames = sink->null_present_frames;
+  total_time = sink->null_present_time;
+  convert_time = sink->null_present_convert_time;
+  convert_max_time = sink->null_present_convert_max_time;
+  GST_OBJECT_UNLOCK (sink);
+
+  stats = gst_structure_new ("null-present-stats",
+      "backend", G_TYPE_STRING, get_display_type_name (plugin->display_type),
+      "format", G_TYPE_STRING,
+      gst_video_format_to_string (sink->null_present_format),
+      "frames", G_TYPE_UINT64, frames,
+      "average-convert-time", G_TYPE_UINT64,
+      frames > 0 ? convert_time / frames : 0,
+      "max-convert-time", G_TYPE_UINT64, convert_max_time,
+      "max-fps", G_TYPE_DOUBLE,
+      total_time > 0 ? (gdouble) frames * GST_SECOND / total_time : 0.0, NULL);
+  return stats;
+}
+
 static gboolean
 gst_vaapisink_start (GstBaseSink * base_sink)
 {
@@ -1287,7 +1574,23 @@ gst_vaapisink_start (GstBaseSink * base_sink)
   if (!gst_vaapi_plugin_base_get_allowed_sinkpad_raw_caps (plugin))
     return FALSE;
 
-  return TRUE;
+  GST_OBJECT_LOCK (sink);
+  sink->null_present_frames = 0;
+  sink->null_present_time = 0;
+  sink->null_present_convert_time = 0;
+  sink->null_present_convert_max_time = 0;
+  GST_OBJECT_UNLOCK (sink);
+
+  return gst_vaapisink_start_render_thread (sink);
+}
+
+static void
+gst_vaapisink_reset_composition (GstVaapiSink * sink)
+{
+  gst_vaapi_surface_proxy_replace (&sink->composition_proxy, NULL);
+  gst_vaapi_video_pool_replace (&sink->composition_pool, NULL);
+  gst_vaapi_blend_replace (&sink->composition_blend, NULL);
+  sink->no_composition_blend = FALSE;
 }
 
 static gboolean
@@ -1296,8 +1599,19 @@ gst_vaapisink_stop (GstBaseSink * base_sink)
   GstVaapiSink *const sink = GST_VAAPISINK_CAST (base_sink);
 
   gst_vaapisink_set_event_handling (sink, FALSE);
+  gst_vaapisink_stop_render_thread (sink);
+
+  if (sink->null_present) {
+    GstStructure *const stats = gst_vaapisink_get_null_present_stats (sink);
+    GST_INFO_OBJECT (sink, "null present: %" GST_PTR_FORMAT, stats);
+    gst_structure_free (stats);
+  }
+
   gst_buffer_replace (&sink->video_buffer, NULL);
   gst_vaapi_window_replace (&sink->window, NULL);
+  gst_vaapi_video_pool_replace (&sink->null_present_pool, NULL);
+  gst_vaapi_filter_replace (&sink->null_present_filter, NULL);
+  gst_vaapisink_reset_composition (sink);
 
   gst_vaapi_plugin_base_close (GST_VAAPI_PLUGIN_BASE (sink));
   return TRUE;
@@ -1319,6 +1633,11 @@ gst_vaapisink_get_caps_impl (GstBaseSink * base_sink)
     return gst_static_pad_template_get_caps (&gst_vaapisink_sink_factory);
 
   out_caps = gst_caps_from_string (surface_caps_str);
+#if USE_WAYLAND
+  if (GST_VAAPI_PLUGIN_BASE_DISPLAY_TYPE (sink) ==
+      GST_VAAPI_DISPLAY_TYPE_WAYLAND)
+    gst_vaapisink_wayland_sort_formats (sink, out_caps);
+#endif
   raw_caps =
       gst_vaapi_plugin_base_get_allowed_sinkpad_raw_caps (GST_VAAPI_PLUGIN_BASE
       (sink));
@@ -1386,6 +1705,9 @@ gst_vaapisink_set_caps (GstBaseSink * base_sink, GstCaps * caps)
     return FALSE;
   display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
 
+  /* The queued frames are rendered with the previous setup */
+  gst_vaapisink_drain_render_queue (sink);
+
   if (!gst_vaapi_plugin_base_set_caps (plugin, caps, NULL))
     return FALSE;
 
@@ -1404,8 +1726,16 @@ gst_vaapisink_set_caps (GstBaseSink * base_sink, GstCaps * caps)
   gst_vaapisink_ensure_colorbalance (sink);
   gst_vaapisink_ensure_rotation (sink, FALSE);
 
-  if (GST_VAAPI_PLUGIN_BASE_DISPLAY_TYPE (sink) == GST_VAAPI_DISPLAY_TYPE_DRM)
-    return TRUE;
+  /* No window at all, the frames are rendered at their own size */
+  if (sink->null_present) {
+    win_width = sink->video_width;
+    win_height = sink->video_height;
+    if (sink->window_width != win_width || sink->window_height != win_height)
+      gst_vaapi_video_pool_replace (&sink->null_present_pool, NULL);
+    sink->window_width = win_width;
+    sink->window_height = win_height;
+    return gst_vaapisink_ensure_render_rect (sink, win_width, win_height);
+  }
 
   gst_vaapisink_ensure_window_size (sink, &win_width, &win_height);
   if (sink->window) {
@@ -1431,41 +1761,246 @@ gst_vaapisink_set_caps (GstBaseSink * base_sink, GstCaps * caps)
   return gst_vaapisink_ensure_render_rect (sink, win_width, win_height);
 }
 
+/* A frame ready to be rendered, possibly by the render thread */
+typedef struct _GstVaapiSinkFrame GstVaapiSinkFrame;
+struct _GstVaapiSinkFrame
+{
+  GstBuffer *buffer;
+  GstVaapiSurface *surface;
+  GstVaapiRectangle surface_rect;
+  gboolean has_surface_rect;
+  guint flags;
+  GstClockTime pts;
+  gint64 queued_time;
+  /* the surface, with the overlay composition blended in */
+  GstVaapiSurfaceProxy *composed;
+};
+
+static void
+gst_vaapisink_frame_free (GstVaapiSinkFrame * frame)
+{
+  gst_buffer_unref (frame->buffer);
+  if (frame->composed)
+    gst_vaapi_surface_proxy_unref (frame->composed);
+  g_slice_free (GstVaapiSinkFrame, frame);
+}
+
+/* --- Overlay composition --- */
+
+typedef struct _GstVaapiSinkCompositionLayers GstVaapiSinkCompositionLayers;
+struct _GstVaapiSinkCompositionLayers
+{
+  GstVaapiBlendSurface *surfaces;
+  guint n_surfaces;
+  guint index;
+};
+
+static GstVaapiBlendSurface *
+composition_layers_next (gpointer data)
+{
+  GstVaapiSinkCompositionLayers *const layers = data;
+
+  if (layers->index >= layers->n_surfaces)
+    return NULL;
+  return &layers->surfaces[layers->index++];
+}
+
+/* Imports the pixels of @rect as a VA surface, if they are in a
+ * dma-buf and premultiplied, as the blend wants them */
+static GstVaapiSurface *
+import_overlay_rectangle (GstVaapiDisplay * display,
+    GstVideoOverlayRectangle * rect)
+{
+  const GstVideoOverlayFormatFlags flags =
+      gst_video_overlay_rectangle_get_flags (rect);
+  GstVideoMeta *vmeta;
+  GstVideoInfo vi;
+  GstBuffer *buffer;
+  GstMemory *mem;
+  guint i;
+  gint fd;
+
+  if (!(flags & GST_VIDEO_OVERLAY_FORMAT_FLAG_PREMULTIPLIED_ALPHA))
+    return NULL;
+
+  /* The pixels as stored, so that nothing gets converted on the CPU */
+  buffer = gst_video_overlay_rectangle_get_pixels_unscaled_raw (rect, flags);
+  if (!buffer || gst_buffer_n_memory (buffer) != 1)
+    return NULL;
+  mem = gst_buffer_peek_memory (buffer, 0);
+  if (!gst_is_dmabuf_memory (mem))
+    return NULL;
+  fd = gst_dmabuf_memory_get_fd (mem);
+  vmeta = gst_buffer_get_video_meta (buffer);
+  if (fd < 0 || !vmeta)
+    return NULL;
+
+  gst_video_info_set_format (&vi, vmeta->format, vmeta->width, vmeta->height);
+  for (i = 0; i < vmeta->n_planes; i++) {
+    GST_VIDEO_INFO_PLANE_OFFSET (&vi, i) = vmeta->offset[i];
+    GST_VIDEO_INFO_PLANE_STRIDE (&vi, i) = vmeta->stride[i];
+  }
+  return gst_vaapi_surface_import_dma_buf_handle (display, fd, &vi,
+      gst_vaapi_dmabuf_memory_get_modifier (mem));
+}
+
+static gboolean
+gst_vaapisink_ensure_composition_blend (GstVaapiSink * sink,
+    GstVaapiSurface * surface)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
+  GstVideoInfo *const vip = &sink->composition_info;
+  const GstVideoFormat format = gst_vaapi_surface_get_format (surface);
+  const guint width = GST_VAAPI_SURFACE_WIDTH (surface);
+  const guint height = GST_VAAPI_SURFACE_HEIGHT (surface);
+
+  if (!sink->composition_blend) {
+    sink->composition_blend = gst_vaapi_blend_new (display);
+    if (!sink->composition_blend
+        || !gst_vaapi_blend_has_premultiplied_alpha (sink->composition_blend))
+      goto error_no_blend;
+  }
+
+  if (sink->composition_pool && GST_VIDEO_INFO_FORMAT (vip) == format
+      && GST_VIDEO_INFO_WIDTH (vip) == width
+      && GST_VIDEO_INFO_HEIGHT (vip) == height)
+    return TRUE;
+
+  gst_vaapi_video_pool_replace (&sink->composition_pool, NULL);
+  if (format == GST_VIDEO_FORMAT_UNKNOWN)
+    return FALSE;
+  sink->composition_pool =
+      gst_vaapi_surface_pool_new (display, format, width, height, 0);
+  if (!sink->composition_pool)
+    return FALSE;
+  gst_video_info_set_format (vip, format, width, height);
+  return TRUE;
+
+  /* ERRORS */
+error_no_blend:
+  {
+    GST_INFO_OBJECT (sink, "VPP cannot blend overlay rectangles, "
+        "uploading them as subpictures");
+    gst_vaapi_blend_replace (&sink->composition_blend, NULL);
+    sink->no_composition_blend = TRUE;
+    return FALSE;
+  }
+}
+
+/* Blends the overlay composition of @buffer onto a copy of @surface
+ * through VPP, if all the rectangles are in dma-buf, e.g. rendered
+ * with GL: importing them saves reading them back for subpictures */
+static GstVaapiSurfaceProxy *
+gst_vaapisink_blend_composition (GstVaapiSink * sink,
+    GstVaapiSurface * surface, GstBuffer * buffer)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
+  GstVideoOverlayCompositionMeta *const cmeta =
+      gst_buffer_get_video_overlay_composition_meta (buffer);
+  GstVaapiSinkCompositionLayers layers = { NULL, };
+  GstVideoOverlayComposition *composition;
+  GstVaapiSurfaceProxy *proxy = NULL;
+  GstVaapiSurface **imported;
+  guint i, n_rects, n_imported = 0;
+
+  if (!cmeta || sink->no_composition_blend)
+    return NULL;
+  composition = cmeta->overlay;
+  n_rects = gst_video_overlay_composition_n_rectangles (composition);
+  if (n_rects == 0)
+    return NULL;
+
+  layers.surfaces = g_newa (GstVaapiBlendSurface, n_rects + 1);
+  memset (layers.surfaces, 0, (n_rects + 1) * sizeof (*layers.surfaces));
+  layers.surfaces[0].surface = surface;
+  layers.surfaces[0].target.width = GST_VAAPI_SURFACE_WIDTH (surface);
+  layers.surfaces[0].target.height = GST_VAAPI_SURFACE_HEIGHT (surface);
+  layers.surfaces[0].alpha = 1.0;
+
+  imported = g_newa (GstVaapiSurface *, n_rects);
+  for (i = 0; i < n_rects; i++) {
+    GstVideoOverlayRectangle *const rect =
+        gst_video_overlay_composition_get_rectangle (composition, i);
+    GstVaapiBlendSurface *const layer = &layers.surfaces[i + 1];
+    gint x, y;
+    guint width, height;
+
+    gst_video_overlay_rectangle_get_render_rectangle (rect, &x, &y,
+        &width, &height);
+    if (x < 0 || y < 0 || x + width > GST_VAAPI_SURFACE_WIDTH (surface)
+        || y + height > GST_VAAPI_SURFACE_HEIGHT (surface))
+      goto done;
+
+    imported[i] = import_overlay_rectangle (display, rect);
+    if (!imported[i])
+      goto done;
+    n_imported++;
+
+    layer->surface = imported[i];
+    layer->target.x = x;
+    layer->target.y = y;
+    layer->target.width = width;
+    layer->target.height = height;
+    layer->alpha = (gst_video_overlay_rectangle_get_flags (rect) &
+        GST_VIDEO_OVERLAY_FORMAT_FLAG_GLOBAL_ALPHA) ?
+        gst_video_overlay_rectangle_get_global_alpha (rect) : 1.0;
+    layer->premultiplied_alpha = TRUE;
+  }
+
+  if (!gst_vaapisink_ensure_composition_blend (sink, surface))
+    goto done;
+  proxy = gst_vaapi_surface_proxy_new_from_pool (GST_VAAPI_SURFACE_POOL
+      (sink->composition_pool));
+  if (!proxy)
+    goto done;
+
+  layers.n_surfaces = n_rects + 1;
+  if (!gst_vaapi_blend_process (sink->composition_blend,
+          GST_VAAPI_SURFACE_PROXY_SURFACE (proxy), composition_layers_next,
+          &layers)) {
+    GST_WARNING_OBJECT (sink, "could not blend overlay composition");
+    gst_vaapi_surface_proxy_unref (proxy);
+    proxy = NULL;
+  }
+
+done:
+  for (i = 0; i < n_imported; i++)
+    gst_vaapi_surface_unref (imported[i]);
+  return proxy;
+}
+
+/* Uploads @src_buffer if needed and collects what it takes to render
+ * it. Returns GST_FLOW_CUSTOM_SUCCESS if there is nothing to render */
 static GstFlowReturn
-gst_vaapisink_show_frame_unlocked (GstVaapiSink * sink, GstBuffer * src_buffer)
+gst_vaapisink_prepare_frame_unlocked (GstVaapiSink * sink,
+    GstBuffer * src_buffer, GstVaapiSinkFrame ** frame_ptr)
 {
+  GstVaapiSinkFrame *frame;
   GstVaapiVideoMeta *meta;
   GstVaapiSurfaceProxy *proxy;
   GstVaapiSurface *surface;
   GstBuffer *buffer;
-  GstBuffer *old_buf;
   guint flags;
-  GstVaapiRectangle *surface_rect = NULL;
+  const GstVaapiRectangle *surface_rect = NULL;
   GstVaapiRectangle tmp_rect;
   GstFlowReturn ret;
   gint32 view_id;
   GstVideoCropMeta *crop_meta;
-
-  if (!src_buffer) {
-    if (sink->video_buffer)
-      src_buffer = sink->video_buffer;
-    else
-      return GST_FLOW_OK;
-  }
+  GstVaapiSurfaceProxy *composed;
 
   crop_meta = gst_buffer_get_video_crop_meta (src_buffer);
   if (crop_meta) {
+    tmp_rect.x = crop_meta->x;
+    tmp_rect.y = crop_meta->y;
+    tmp_rect.width = crop_meta->width;
+    tmp_rect.height = crop_meta->height;
     surface_rect = &tmp_rect;
-    surface_rect->x = crop_meta->x;
-    surface_rect->y = crop_meta->y;
-    surface_rect->width = crop_meta->width;
-    surface_rect->height = crop_meta->height;
   }
 
   ret = gst_vaapi_plugin_base_get_input_buffer (GST_VAAPI_PLUGIN_BASE (sink),
       src_buffer, &buffer);
   if (ret == GST_FLOW_NOT_SUPPORTED)
-    return GST_FLOW_OK;         /* let's ignore the frame if it couldn't be uploaded */
+    return GST_FLOW_CUSTOM_SUCCESS;     /* let's ignore the frame if it couldn't be uploaded */
   if (ret != GST_FLOW_OK)
     return ret;
 
@@ -1487,19 +2022,15 @@ gst_vaapisink_show_frame_unlocked (GstVaapiSink * sink, GstBuffer * src_buffer)
   if (G_UNLIKELY (sink->view_id == -1))
     sink->view_id = view_id;
   else if (sink->view_id != view_id) {
-    ret = GST_FLOW_OK;
-    goto done;
+    gst_buffer_unref (buffer);
+    return GST_FLOW_CUSTOM_SUCCESS;
   }
 
   gst_vaapisink_ensure_colorbalance (sink);
   gst_vaapisink_ensure_rotation (sink, TRUE);
 
-  GST_TRACE_OBJECT (sink, "render surface %" GST_VAAPI_ID_FORMAT,
-      GST_VAAPI_ID_ARGS (gst_vaapi_surface_get_id (surface)));
-
   if (!surface_rect)
-    surface_rect = (GstVaapiRectangle *)
-        gst_vaapi_video_meta_get_render_rect (meta);
+    surface_rect = gst_vaapi_video_meta_get_render_rect (meta);
 
   if (surface_rect)
     GST_DEBUG ("render rect (%d,%d), size %ux%u",
@@ -1513,69 +2044,408 @@ gst_vaapisink_show_frame_unlocked (GstVaapiSink * sink, GstBuffer * src_buffer)
   if (!(flags & GST_VAAPI_COLOR_STANDARD_MASK))
     flags |= sink->color_standard;
 
-  if (!gst_vaapi_apply_composition (surface, src_buffer))
+  composed = gst_vaapisink_blend_composition (sink, surface, src_buffer);
+  if (composed)
+    surface = GST_VAAPI_SURFACE_PROXY_SURFACE (composed);
+  else if (!gst_vaapi_apply_composition (surface, src_buffer))
     GST_WARNING ("could not update subtitles");
 
-  if (!sink->backend->render_surface (sink, surface, surface_rect, flags))
-    goto error;
+  frame = g_slice_new0 (GstVaapiSinkFrame);
+  frame->buffer = buffer;
+  frame->surface = surface;
+  frame->composed = composed;
+  if (surface_rect) {
+    frame->surface_rect = *surface_rect;
+    frame->has_surface_rect = TRUE;
+  }
+  frame->flags = flags;
+  frame->pts = GST_BUFFER_PTS (src_buffer);
+  *frame_ptr = frame;
+  return GST_FLOW_OK;
 
-  if (sink->signal_handoffs)
-    g_signal_emit (sink, gst_vaapisink_signals[HANDOFF_SIGNAL], 0, buffer);
+  /* ERRORS */
+no_surface:
+  {
+    /* No surface or surface proxy. That's very bad! */
+    GST_WARNING_OBJECT (sink, "could not get surface");
+    gst_buffer_unref (buffer);
+    return GST_FLOW_ERROR;
+  }
 
-  /* Retain VA surface until the next one is displayed */
-  old_buf = sink->video_buffer;
-  sink->video_buffer = gst_buffer_ref (buffer);
-  /* Need to release the lock while releasing old buffer, otherwise a
-   * deadlock is possible */
-  gst_vaapi_display_unlock (GST_VAAPI_PLUGIN_BASE_DISPLAY (sink));
-  if (old_buf)
-    gst_buffer_unref (old_buf);
-  gst_vaapi_display_lock (GST_VAAPI_PLUGIN_BASE_DISPLAY (sink));
+different_display:
+  {
+    GST_WARNING_OBJECT (sink, "incoming surface has different VAAPI Display");
+    gst_buffer_unref (buffer);
+    return GST_FLOW_ERROR;
+  }
+}
 
-  ret = GST_FLOW_OK;
+/* Puts the frame on screen. The display lock need not be held */
+static GstFlowReturn
+gst_vaapisink_put_frame (GstVaapiSink * sink, GstVaapiSinkFrame * frame)
+{
+  GstClockTime trace_start;
 
-done:
-  gst_buffer_unref (buffer);
-  return ret;
+  GST_TRACE_OBJECT (sink, "render surface %" GST_VAAPI_ID_FORMAT,
+      GST_VAAPI_ID_ARGS (gst_vaapi_surface_get_id (frame->surface)));
+
+  /* The conversions the window needs are kept, only their scaling
+     gets faster while the display is overloaded */
+  if (sink->window)
+    gst_vaapi_window_set_fast_conversion (sink->window,
+        gst_vaapi_plugin_base_get_load_level (GST_VAAPI_PLUGIN_BASE (sink))
+        != GST_VAAPI_DISPLAY_LOAD_NORMAL);
+
+  trace_start = GST_VAAPI_TRACE_BEGIN ();
+  if (sink->null_present) {
+    if (!gst_vaapisink_null_present_surface (sink, frame->surface,
+            frame->has_surface_rect ? &frame->surface_rect : NULL,
+            frame->flags))
+      goto error;
+  } else if (!sink->backend->render_surface (sink, frame->surface,
+          frame->has_surface_rect ? &frame->surface_rect : NULL, frame->flags))
+    goto error;
+  GST_VAAPI_TRACE_END (trace_start, sink, GST_VAAPI_TRACE_STAGE_PUT_SURFACE,
+      frame->pts);
+
+  if (sink->signal_handoffs)
+    g_signal_emit (sink, gst_vaapisink_signals[HANDOFF_SIGNAL], 0,
+        frame->buffer);
+
+  return GST_FLOW_OK;
 
   /* ERRORS */
 error:
   {
     GST_ELEMENT_ERROR (sink, RESOURCE, WRITE,
         ("Internal error: could not render surface"), (NULL));
-    ret = GST_FLOW_ERROR;
-    goto done;
+    return GST_FLOW_ERROR;
   }
+}
 
-no_surface:
-  {
-    /* No surface or surface proxy. That's very bad! */
-    GST_WARNING_OBJECT (sink, "could not get surface");
-    ret = GST_FLOW_ERROR;
-    goto done;
+static GstFlowReturn
+gst_vaapisink_show_frame_unlocked (GstVaapiSink * sink, GstBuffer * src_buffer)
+{
+  GstVaapiSinkFrame *frame = NULL;
+  GstBuffer *old_buf;
+  GstFlowReturn ret;
+  const gboolean redraw = !src_buffer;
+
+  if (!src_buffer) {
+    if (sink->video_buffer)
+      src_buffer = sink->video_buffer;
+    else
+      return GST_FLOW_OK;
   }
 
-different_display:
-  {
-    GST_WARNING_OBJECT (sink, "incoming surface has different VAAPI Display");
-    ret = GST_FLOW_ERROR;
-    goto done;
+  ret = gst_vaapisink_prepare_frame_unlocked (sink, src_buffer, &frame);
+  if (ret == GST_FLOW_CUSTOM_SUCCESS)
+    return GST_FLOW_OK;
+  if (ret != GST_FLOW_OK)
+    return ret;
+
+  ret = gst_vaapisink_put_frame (sink, frame);
+  if (ret == GST_FLOW_OK) {
+    if (!redraw)
+      gst_vaapi_plugin_base_stats_frame_out (GST_VAAPI_PLUGIN_BASE (sink));
+
+    /* Retain VA surface until the next one is displayed */
+    old_buf = sink->video_buffer;
+    sink->video_buffer = gst_buffer_ref (frame->buffer);
+    gst_vaapi_surface_proxy_replace (&sink->composition_proxy,
+        frame->composed);
+    /* Need to release the lock while releasing old buffer, otherwise a
+     * deadlock is possible */
+    gst_vaapi_display_unlock (GST_VAAPI_PLUGIN_BASE_DISPLAY (sink));
+    if (old_buf)
+      gst_buffer_unref (old_buf);
+    gst_vaapi_display_lock (GST_VAAPI_PLUGIN_BASE_DISPLAY (sink));
+  }
+  gst_vaapisink_frame_free (frame);
+  return ret;
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Render queue                                                     --- */
+/* ------------------------------------------------------------------------ */
+
+/* With a render queue, the streaming thread only uploads the frames
+ * and queues them. The render thread puts them on screen without the
+ * display lock, so that waiting for the display vsync does not hold
+ * off the streaming thread which prepares the next frames meanwhile.
+ * Only the render thread touches the window then, redraws included. */
+
+static gpointer
+gst_vaapisink_render_thread (GstVaapiSink * sink)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (sink);
+  GstVaapiSinkFrame *frame;
+  GstBuffer *old_buf;
+  GstClockTime latency;
+  GstFlowReturn ret;
+
+  gst_vaapi_plugin_base_bind_thread (GST_VAAPI_PLUGIN_BASE (sink));
+  gst_vaapi_plugin_base_set_thread_scheduling (GST_VAAPI_PLUGIN_BASE (sink));
+
+  g_mutex_lock (&sink->render_lock);
+  for (;;) {
+    while (!sink->render_thread_cancel && !sink->render_redraw
+        && g_queue_is_empty (&sink->render_queue))
+      g_cond_wait (&sink->render_cond, &sink->render_lock);
+    if (sink->render_thread_cancel)
+      break;
+
+    if (g_queue_is_empty (&sink->render_queue)) {
+      sink->render_redraw = FALSE;
+      sink->render_busy = TRUE;
+      g_mutex_unlock (&sink->render_lock);
+
+      gst_vaapi_display_lock (display);
+      gst_vaapisink_show_frame_unlocked (sink, NULL);
+      gst_vaapi_display_unlock (display);
+
+      g_mutex_lock (&sink->render_lock);
+      sink->render_busy = FALSE;
+      g_cond_broadcast (&sink->render_cond);
+      continue;
+    }
+
+    /* a new frame makes any pending redraw useless */
+    frame = g_queue_pop_head (&sink->render_queue);
+    sink->render_redraw = FALSE;
+    sink->render_busy = TRUE;
+    g_cond_broadcast (&sink->render_cond);
+    g_mutex_unlock (&sink->render_lock);
+
+    latency = (g_get_monotonic_time () - frame->queued_time) * GST_USECOND;
+
+    ret = gst_vaapisink_put_frame (sink, frame);
+    if (ret == GST_FLOW_OK) {
+      gst_vaapi_plugin_base_stats_frame_out (GST_VAAPI_PLUGIN_BASE (sink));
+
+      /* Retain VA surface until the next one is displayed */
+      gst_vaapi_display_lock (display);
+      old_buf = sink->video_buffer;
+      sink->video_buffer = gst_buffer_ref (frame->buffer);
+      gst_vaapi_surface_proxy_replace (&sink->composition_proxy,
+          frame->composed);
+      gst_vaapi_display_unlock (display);
+      if (old_buf)
+        gst_buffer_unref (old_buf);
+    }
+    gst_vaapisink_frame_free (frame);
+
+    g_mutex_lock (&sink->render_lock);
+    if (GST_CLOCK_TIME_IS_VALID (sink->render_queue_latency))
+      sink->render_queue_latency =
+          (sink->render_queue_latency * 7 + latency) / 8;
+    else
+      sink->render_queue_latency = latency;
+    sink->render_queue_max_latency =
+        MAX (sink->render_queue_max_latency, latency);
+    if (ret != GST_FLOW_OK && sink->render_ret == GST_FLOW_OK)
+      sink->render_ret = ret;
+    sink->render_busy = FALSE;
+    g_cond_broadcast (&sink->render_cond);
+  }
+  g_mutex_unlock (&sink->render_lock);
+  return NULL;
+}
+
+static gboolean
+gst_vaapisink_start_render_thread (GstVaapiSink * sink)
+{
+  GThread *thread;
+
+  if (sink->render_queue_depth == 0)
+    return TRUE;
+
+  sink->render_thread_cancel = FALSE;
+  sink->render_flushing = FALSE;
+  sink->render_redraw = FALSE;
+  sink->render_busy = FALSE;
+  sink->render_ret = GST_FLOW_OK;
+  sink->render_queue_latency = GST_CLOCK_TIME_NONE;
+  sink->render_queue_max_latency = 0;
+
+  thread = g_thread_try_new ("vaapisink-render",
+      (GThreadFunc) gst_vaapisink_render_thread, sink, NULL);
+  if (!thread)
+    return FALSE;
+
+  g_mutex_lock (&sink->render_lock);
+  sink->render_thread = thread;
+  g_mutex_unlock (&sink->render_lock);
+  return TRUE;
+}
+
+/* Drops the frames not rendered yet */
+static void
+gst_vaapisink_flush_render_queue (GstVaapiSink * sink)
+{
+  GQueue frames = G_QUEUE_INIT;
+  GstVaapiSinkFrame *frame;
+
+  g_mutex_lock (&sink->render_lock);
+  while ((frame = g_queue_pop_head (&sink->render_queue)))
+    g_queue_push_tail (&frames, frame);
+  g_cond_broadcast (&sink->render_cond);
+  g_mutex_unlock (&sink->render_lock);
+
+  while ((frame = g_queue_pop_head (&frames))) {
+    gst_vaapi_plugin_base_stats_frame_dropped (GST_VAAPI_PLUGIN_BASE (sink));
+    gst_vaapisink_frame_free (frame);
+  }
+}
+
+static void
+gst_vaapisink_stop_render_thread (GstVaapiSink * sink)
+{
+  GThread *thread;
+
+  g_mutex_lock (&sink->render_lock);
+  thread = sink->render_thread;
+  sink->render_thread = NULL;
+  sink->render_thread_cancel = TRUE;
+  g_cond_broadcast (&sink->render_cond);
+  g_mutex_unlock (&sink->render_lock);
+
+  if (thread) {
+    /* make sure the render thread is not left waiting for the display */
+    if (sink->window)
+      gst_vaapi_window_unblock (sink->window);
+    g_thread_join (thread);
+    if (sink->window)
+      gst_vaapi_window_unblock_cancel (sink->window);
   }
+  gst_vaapisink_flush_render_queue (sink);
+}
+
+/* Waits for all the queued frames to be rendered */
+static void
+gst_vaapisink_drain_render_queue (GstVaapiSink * sink)
+{
+  g_mutex_lock (&sink->render_lock);
+  while (sink->render_thread && !sink->render_flushing
+      && (sink->render_busy || !g_queue_is_empty (&sink->render_queue)))
+    g_cond_wait (&sink->render_cond, &sink->render_lock);
+  g_mutex_unlock (&sink->render_lock);
+}
+
+static void
+gst_vaapisink_set_render_flushing (GstVaapiSink * sink, gboolean flushing)
+{
+  g_mutex_lock (&sink->render_lock);
+  sink->render_flushing = flushing;
+  if (!flushing)
+    sink->render_ret = GST_FLOW_OK;
+  g_cond_broadcast (&sink->render_cond);
+  g_mutex_unlock (&sink->render_lock);
+
+  if (flushing)
+    gst_vaapisink_flush_render_queue (sink);
+}
+
+static GstFlowReturn
+gst_vaapisink_queue_frame (GstVaapiSink * sink, GstVaapiSinkFrame * frame)
+{
+  GstFlowReturn ret;
+
+  g_mutex_lock (&sink->render_lock);
+  while (!sink->render_flushing && sink->render_ret == GST_FLOW_OK
+      && g_queue_get_length (&sink->render_queue) >= sink->render_queue_depth)
+    g_cond_wait (&sink->render_cond, &sink->render_lock);
+
+  ret = sink->render_flushing ? GST_FLOW_FLUSHING : sink->render_ret;
+  if (ret == GST_FLOW_OK) {
+    frame->queued_time = g_get_monotonic_time ();
+    g_queue_push_tail (&sink->render_queue, frame);
+    g_cond_broadcast (&sink->render_cond);
+    frame = NULL;
+  }
+  g_mutex_unlock (&sink->render_lock);
+
+  if (frame)
+    gst_vaapisink_frame_free (frame);
+  return ret;
+}
+
+/* Asks the render thread to render the last frame again. Returns
+ * %FALSE if there is no render thread */
+static gboolean
+gst_vaapisink_queue_redraw (GstVaapiSink * sink)
+{
+  gboolean ret;
+
+  g_mutex_lock (&sink->render_lock);
+  ret = sink->render_thread != NULL;
+  if (ret) {
+    sink->render_redraw = TRUE;
+    g_cond_broadcast (&sink->render_cond);
+  }
+  g_mutex_unlock (&sink->render_lock);
+  return ret;
+}
+
+/* Reports the display as overloaded when @buffer reaches the sink past
+   the end of the time it should be displayed for */
+static void
+gst_vaapisink_report_load (GstVaapiSink * sink, GstBuffer * buffer)
+{
+  GstBaseSink *const base_sink = GST_BASE_SINK_CAST (sink);
+  GstClockTime running_time, now;
+  GstClock *clock;
+
+  if (!GST_VAAPI_PLUGIN_BASE (sink)->adaptive_quality
+      || !GST_BUFFER_PTS_IS_VALID (buffer)
+      || !GST_BUFFER_DURATION_IS_VALID (buffer))
+    return;
+
+  running_time = gst_segment_to_running_time (&base_sink->segment,
+      GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+  if (!GST_CLOCK_TIME_IS_VALID (running_time))
+    return;
+
+  clock = gst_element_get_clock (GST_ELEMENT_CAST (sink));
+  if (!clock)
+    return;
+  now = gst_clock_get_time (clock) -
+      gst_element_get_base_time (GST_ELEMENT_CAST (sink));
+  gst_object_unref (clock);
+
+  gst_vaapi_plugin_base_report_load (GST_VAAPI_PLUGIN_BASE (sink),
+      now > running_time + gst_base_sink_get_render_delay (base_sink) +
+      GST_BUFFER_DURATION (buffer));
 }
 
 static GstFlowReturn
 gst_vaapisink_show_frame (GstVideoSink * video_sink, GstBuffer * src_buffer)
 {
   GstVaapiSink *const sink = GST_VAAPISINK_CAST (video_sink);
+  GstVaapiSinkFrame *frame = NULL;
   GstFlowReturn ret;
 
+  if (!src_buffer && gst_vaapisink_queue_redraw (sink))
+    return GST_FLOW_OK;
+  if (src_buffer) {
+    gst_vaapi_plugin_base_stats_frame_in (GST_VAAPI_PLUGIN_BASE (sink));
+    gst_vaapisink_report_load (sink, src_buffer);
+  }
+
   /* We need at least to protect the gst_vaapi_aplpy_composition()
    * call to prevent a race during subpicture destruction.
    * FIXME: a less coarse grained lock could be used, though */
   gst_vaapi_display_lock (GST_VAAPI_PLUGIN_BASE_DISPLAY (sink));
-  ret = gst_vaapisink_show_frame_unlocked (sink, src_buffer);
+  if (src_buffer && sink->render_thread)
+    ret = gst_vaapisink_prepare_frame_unlocked (sink, src_buffer, &frame);
+  else
+    ret = gst_vaapisink_show_frame_unlocked (sink, src_buffer);
   gst_vaapi_display_unlock (GST_VAAPI_PLUGIN_BASE_DISPLAY (sink));
 
+  if (ret == GST_FLOW_CUSTOM_SUCCESS)
+    return GST_FLOW_OK;
+  if (frame)
+    ret = gst_vaapisink_queue_frame (sink, frame);
   return ret;
 }
 
@@ -1583,7 +2453,11 @@ static gboolean
 gst_vaapisink_propose_allocation (GstBaseSink * base_sink, GstQuery * query)
 {
   GstVaapiPluginBase *const plugin = GST_VAAPI_PLUGIN_BASE (base_sink);
+  GstVaapiSink *const sink = GST_VAAPISINK_CAST (base_sink);
 
+  /* The render queue holds on to that many more buffers */
+  gst_vaapi_plugin_base_set_sink_min_buffers (plugin,
+      sink->render_queue_depth);
   if (!gst_vaapi_plugin_base_propose_allocation (plugin, query))
     return FALSE;
 
@@ -1617,6 +2491,11 @@ gst_vaapisink_destroy (GstVaapiSink * sink)
 {
   cb_channels_finalize (sink);
   gst_buffer_replace (&sink->video_buffer, NULL);
+  gst_vaapi_video_pool_replace (&sink->null_present_pool, NULL);
+  gst_vaapi_filter_replace (&sink->null_present_filter, NULL);
+  gst_vaapisink_reset_composition (sink);
+  g_mutex_clear (&sink->render_lock);
+  g_cond_clear (&sink->render_cond);
   gst_caps_replace (&sink->caps, NULL);
 }
 
@@ -1659,6 +2538,31 @@ gst_vaapisink_set_property (GObject * object,
     case PROP_SIGNAL_HANDOFFS:
       sink->signal_handoffs = g_value_get_boolean (value);
       break;
+    case PROP_RENDER_QUEUE_DEPTH:
+      sink->render_queue_depth = g_value_get_uint (value);
+      break;
+    case PROP_NULL_PRESENT:
+      sink->null_present = g_value_get_boolean (value);
+      break;
+    case PROP_NULL_PRESENT_FORMAT:
+      sink->null_present_format = g_value_get_enum (value);
+      break;
+    case PROP_NUMA_NODE:
+      GST_VAAPI_PLUGIN_BASE (sink)->numa_node = g_value_get_int (value);
+      break;
+    case PROP_THREAD_POLICY:
+      GST_VAAPI_PLUGIN_BASE (sink)->thread_policy = g_value_get_enum (value);
+      break;
+    case PROP_THREAD_PRIORITY:
+      GST_VAAPI_PLUGIN_BASE (sink)->thread_priority = g_value_get_int (value);
+      break;
+    case PROP_ADAPTIVE_QUALITY:
+      GST_VAAPI_PLUGIN_BASE (sink)->adaptive_quality =
+          g_value_get_boolean (value);
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_VAAPI_PLUGIN_BASE (sink)->stats_interval = g_value_get_uint (value);
+      break;
     case PROP_HUE:
     case PROP_SATURATION:
     case PROP_BRIGHTNESS:
@@ -1700,6 +2604,48 @@ gst_vaapisink_get_property (GObject * object,
     case PROP_SIGNAL_HANDOFFS:
       g_value_set_boolean (value, sink->signal_handoffs);
       break;
+    case PROP_RENDER_QUEUE_DEPTH:
+      g_value_set_uint (value, sink->render_queue_depth);
+      break;
+    case PROP_RENDER_QUEUE_LATENCY:
+      g_mutex_lock (&sink->render_lock);
+      g_value_set_uint64 (value, sink->render_queue_latency);
+      g_mutex_unlock (&sink->render_lock);
+      break;
+    case PROP_RENDER_QUEUE_MAX_LATENCY:
+      g_mutex_lock (&sink->render_lock);
+      g_value_set_uint64 (value, sink->render_queue_max_latency);
+      g_mutex_unlock (&sink->render_lock);
+      break;
+    case PROP_NULL_PRESENT:
+      g_value_set_boolean (value, sink->null_present);
+      break;
+    case PROP_NULL_PRESENT_FORMAT:
+      g_value_set_enum (value, sink->null_present_format);
+      break;
+    case PROP_NULL_PRESENT_STATS:
+      g_value_take_boxed (value, gst_vaapisink_get_null_present_stats (sink));
+      break;
+    case PROP_NUMA_NODE:
+      g_value_set_int (value, GST_VAAPI_PLUGIN_BASE (sink)->numa_node);
+      break;
+    case PROP_THREAD_POLICY:
+      g_value_set_enum (value, GST_VAAPI_PLUGIN_BASE (sink)->thread_policy);
+      break;
+    case PROP_THREAD_PRIORITY:
+      g_value_set_int (value, GST_VAAPI_PLUGIN_BASE (sink)->thread_priority);
+      break;
+    case PROP_ADAPTIVE_QUALITY:
+      g_value_set_boolean (value,
+          GST_VAAPI_PLUGIN_BASE (sink)->adaptive_quality);
+      break;
+    case PROP_STATS:
+      g_value_take_boxed (value,
+          gst_vaapi_plugin_base_get_stats (GST_VAAPI_PLUGIN_BASE (sink)));
+      break;
+    case PROP_STATS_INTERVAL:
+      g_value_set_uint (value, GST_VAAPI_PLUGIN_BASE (sink)->stats_interval);
+      break;
     case PROP_HUE:
     case PROP_SATURATION:
     case PROP_BRIGHTNESS:
@@ -1718,6 +2664,8 @@ gst_vaapisink_unlock (GstBaseSink * base_sink)
 {
   GstVaapiSink *const sink = GST_VAAPISINK_CAST (base_sink);
 
+  gst_vaapisink_set_render_flushing (sink, TRUE);
+
   if (sink->window)
     return gst_vaapi_window_unblock (sink->window);
 
@@ -1729,6 +2677,8 @@ gst_vaapisink_unlock_stop (GstBaseSink * base_sink)
 {
   GstVaapiSink *const sink = GST_VAAPISINK_CAST (base_sink);
 
+  gst_vaapisink_set_render_flushing (sink, FALSE);
+
   if (sink->window)
     return gst_vaapi_window_unblock_cancel (sink->window);
 
@@ -1769,6 +2719,10 @@ gst_vaapisink_event (GstBaseSink * base_sink, GstEvent * event)
         g_free (orientation);
       }
       break;
+    case GST_EVENT_EOS:
+      /* Post EOS only once the last frames are on screen */
+      gst_vaapisink_drain_render_queue (sink);
+      break;
     default:
       break;
   }
@@ -1858,6 +2812,8 @@ gst_vaapisink_class_init (GstVaapiSinkClass * klass)
    * GstVaapiSink:rotation:
    *
    * The VA display rotation mode, expressed as a #GstVaapiRotation.
+   * On Wayland, the compositor rotates the frames through the buffer
+   * transform of the video surface instead.
    */
   g_properties[PROP_ROTATION] =
       g_param_spec_enum (GST_VAAPI_DISPLAY_PROP_ROTATION,
@@ -1888,6 +2844,135 @@ gst_vaapisink_class_init (GstVaapiSinkClass * klass)
       "Send a signal after rendering the buffer", DEFAULT_SIGNAL_HANDOFFS,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
+  /**
+   * GstVaapiSink:render-queue-depth:
+   *
+   * Number of frames that can be queued for rendering by a dedicated
+   * thread, so that the streaming thread does not wait for the display
+   * to present a frame before preparing the next one. Set to 0 to
+   * render from the streaming thread.
+   */
+  g_properties[PROP_RENDER_QUEUE_DEPTH] =
+      g_param_spec_uint ("render-queue-depth", "Render queue depth",
+      "Number of frames queued for the render thread (0 = no render thread)",
+      0, 16, DEFAULT_RENDER_QUEUE_DEPTH,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+
+  /**
+   * GstVaapiSink:render-queue-latency:
+   *
+   * Average time, in nanoseconds, the frames wait in the render queue.
+   */
+  g_properties[PROP_RENDER_QUEUE_LATENCY] =
+      g_param_spec_uint64 ("render-queue-latency", "Render queue latency",
+      "Average time the frames wait in the render queue", 0, G_MAXUINT64,
+      GST_CLOCK_TIME_NONE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiSink:render-queue-max-latency:
+   *
+   * Longest time, in nanoseconds, a frame waited in the render queue.
+   */
+  g_properties[PROP_RENDER_QUEUE_MAX_LATENCY] =
+      g_param_spec_uint64 ("render-queue-max-latency",
+      "Render queue maximum latency",
+      "Longest time a frame waited in the render queue", 0, G_MAXUINT64, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiSink:null-present:
+   *
+   * Handles the frames as usual, but does not create any window and
+   * skips presenting them. Along with #GstVaapiSink:null-present-format
+   * and #GstVaapiSink:null-present-stats, this allows to benchmark the
+   * sink on machines without a display, e.g. with a DRM render node:
+   *
+   * |[
+   * gst-launch-1.0 filesrc location=video.mp4 ! parsebin ! vaapih264dec ! \
+   *     vaapisink display=drm null-present=true null-present-format=bgrx
+   * ]|
+   */
+  g_properties[PROP_NULL_PRESENT] =
+      g_param_spec_boolean ("null-present", "Null present",
+      "Process the frames without presenting them", DEFAULT_NULL_PRESENT,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+
+  /**
+   * GstVaapiSink:null-present-format:
+   *
+   * Format the frames are converted to by VPP, at their display size,
+   * when #GstVaapiSink:null-present is set. This stands for the
+   * conversion a window backend would do before presenting. With
+   * %GST_VIDEO_FORMAT_UNKNOWN, the frames are not converted.
+   */
+  g_properties[PROP_NULL_PRESENT_FORMAT] =
+      g_param_spec_enum ("null-present-format", "Null present format",
+      "Format the frames are converted to when not presented",
+      GST_TYPE_VIDEO_FORMAT, DEFAULT_NULL_PRESENT_FORMAT,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY);
+
+  /**
+   * GstVaapiSink:null-present-stats:
+   *
+   * Statistics of the frames processed since the sink was started
+   * with #GstVaapiSink:null-present set: the "backend", the number of
+   * "frames", the "average-convert-time" and "max-convert-time" of the
+   * conversions, and "max-fps", the frame rate the sink could sustain.
+   */
+  g_properties[PROP_NULL_PRESENT_STATS] =
+      g_param_spec_boxed ("null-present-stats", "Null present statistics",
+      "Statistics of the frames processed without being presented",
+      GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiSink:numa-node:
+   *
+   * The NUMA node the window event thread runs on. The default of -1
+   * selects the node the GPU is attached to, if any.
+   */
+  g_properties[PROP_NUMA_NODE] =
+      g_param_spec_int ("numa-node", "NUMA node",
+      "NUMA node of the event thread (-1: the node of the GPU)",
+      -1, G_MAXINT, -1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiSink:thread-policy:
+   *
+   * The scheduling policy of the render thread, see
+   * GstVaapiSink:render-queue-depth. The real-time policies keep
+   * ordinary load from delaying the presentation of the frames.
+   */
+  g_properties[PROP_THREAD_POLICY] =
+      g_param_spec_enum ("thread-policy", "Thread policy",
+      "Scheduling policy of the render thread",
+      GST_VAAPI_TYPE_THREAD_POLICY, GST_VAAPI_THREAD_POLICY_NORMAL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiSink:thread-priority:
+   *
+   * The nice value of the render thread, from -20 to 19, with the
+   * normal GstVaapiSink:thread-policy. Its real-time priority, from 1
+   * to 99, with the other ones.
+   */
+  g_properties[PROP_THREAD_PRIORITY] =
+      g_param_spec_int ("thread-priority", "Thread priority",
+      "Nice value, or real-time priority, of the render thread",
+      -20, 99, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  /**
+   * GstVaapiSink:adaptive-quality:
+   *
+   * Whether to report the late frames to the other elements sharing
+   * the display, and to convert the surfaces the window can't present
+   * as is with the fastest scaling method while the VA device is
+   * overloaded.
+   */
+  g_properties[PROP_ADAPTIVE_QUALITY] =
+      g_param_spec_boolean ("adaptive-quality", "Adaptive quality",
+      "Trade quality for speed while the device is overloaded", FALSE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
   /**
    * GstVaapiSink:view-id:
    *
@@ -1951,6 +3036,15 @@ gst_vaapisink_class_init (GstVaapiSinkClass * klass)
 
   g_object_class_install_properties (object_class, N_PROPERTIES, g_properties);
 
+  /**
+   * GstVaapiSink:stats:
+   *
+   * The live performance counters of the element, see also
+   * GstVaapiSink:stats-interval to have them posted on the bus.
+   */
+  gst_vaapi_plugin_base_class_install_stats_properties (object_class,
+      PROP_STATS, PROP_STATS_INTERVAL);
+
   /**
    * GstVaapiSink::handoff:
    * @object: the #GstVaapiSink instance
@@ -1982,6 +3076,13 @@ gst_vaapisink_init (GstVaapiSink * sink)
   sink->rotation_tag = DEFAULT_ROTATION;
   sink->keep_aspect = TRUE;
   sink->signal_handoffs = DEFAULT_SIGNAL_HANDOFFS;
+  sink->render_queue_depth = DEFAULT_RENDER_QUEUE_DEPTH;
+  sink->null_present = DEFAULT_NULL_PRESENT;
+  sink->null_present_format = DEFAULT_NULL_PRESENT_FORMAT;
+  sink->render_queue_latency = GST_CLOCK_TIME_NONE;
+  g_mutex_init (&sink->render_lock);
+  g_cond_init (&sink->render_cond);
+  g_queue_init (&sink->render_queue);
   gst_video_info_init (&sink->video_info);
 
   for (i = 0; i < G_N_ELEMENTS (sink->cb_values); i++)
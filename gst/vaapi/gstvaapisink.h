@@ -27,6 +27,9 @@
 
 #include "gstvaapipluginbase.h"
 #include <gst/vaapi/gstvaapiwindow.h>
+#include <gst/vaapi/gstvaapifilter.h>
+#include <gst/vaapi/gstvaapiblend.h>
+#include <gst/vaapi/gstvaapivideopool.h>
 #include "gstvaapipluginutil.h"
 
 G_BEGIN_DECLS
@@ -101,6 +104,35 @@ struct _GstVaapiSink
   GThread *event_thread;
   volatile gboolean event_thread_cancel;
 
+  /* Render queue */
+  guint render_queue_depth;
+  GThread *render_thread;
+  GMutex render_lock;
+  GCond render_cond;
+  GQueue render_queue;
+  GstFlowReturn render_ret;
+  GstClockTime render_queue_latency;
+  GstClockTime render_queue_max_latency;
+  gboolean render_thread_cancel;
+  gboolean render_flushing;
+  gboolean render_redraw;
+  gboolean render_busy;
+
+  /* Null present */
+  GstVideoFormat null_present_format;
+  GstVaapiFilter *null_present_filter;
+  GstVaapiVideoPool *null_present_pool;
+  guint64 null_present_frames;
+  GstClockTime null_present_time;
+  GstClockTime null_present_convert_time;
+  GstClockTime null_present_convert_max_time;
+
+  /* Overlay compositions in dma-buf, blended through VPP */
+  GstVaapiBlend *composition_blend;
+  GstVaapiVideoPool *composition_pool;
+  GstVideoInfo composition_info;
+  GstVaapiSurfaceProxy *composition_proxy;
+
   /* Color balance values */
   guint cb_changed;
   GValue cb_values[4];
@@ -113,6 +145,8 @@ struct _GstVaapiSink
   guint use_rotation : 1;
   guint keep_aspect : 1;
   guint signal_handoffs : 1;
+  guint null_present : 1;
+  guint no_composition_blend : 1;
 };
 
 struct _GstVaapiSinkClass
@@ -0,0 +1,1056 @@
+/*
+ *  gstvaapitranscode.c - VA-API fused decode, scale and encode element
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/**
+ * SECTION:element-vaapitranscode
+ * @short_description: A VA-API based video transcoder
+ *
+ * vaapitranscode decodes, optionally scales, and re-encodes a video
+ * stream within a single element. The decoder, the VPP filter and the
+ * encoder share one VA display and hand each other surface proxies
+ * directly, so no #GstBuffer, video meta or buffer pool negotiation
+ * is involved between the stages. The decoded surfaces are encoded in
+ * place when no scaling is requested; otherwise they are scaled into
+ * surfaces of the encoder pool.
+ *
+ * The output codec is the one preferred by downstream, among those
+ * listed in the source pad template.
+ *
+ * ## Example launch line
+ *
+ * |[
+ * gst-launch-1.0 filesrc location=input.mkv ! matroskademux ! h264parse \
+ *     ! vaapitranscode width=1280 height=720 bitrate=3000 ! h265parse \
+ *     ! matroskamux ! filesink location=output.mkv
+ * ]|
+ */
+
+#include "gstcompat.h"
+#include <gst/vaapi/gstvaapidisplay.h>
+#include <gst/vaapi/gstvaapicodedbufferproxy.h>
+
+#include "gstvaapitranscode.h"
+#include "gstvaapipluginutil.h"
+
+#include <gst/vaapi/gstvaapidecoder_h264.h>
+#include <gst/vaapi/gstvaapidecoder_h265.h>
+#include <gst/vaapi/gstvaapidecoder_mpeg2.h>
+#include <gst/vaapi/gstvaapidecoder_vp8.h>
+#include <gst/vaapi/gstvaapidecoder_vp9.h>
+#if USE_AV1_DECODER
+#include <gst/vaapi/gstvaapidecoder_av1.h>
+#endif
+
+#include <gst/vaapi/gstvaapiencoder_h264.h>
+#include <gst/vaapi/gstvaapiencoder_h265.h>
+#include <gst/vaapi/gstvaapiencoder_mpeg2.h>
+#include <gst/vaapi/gstvaapiencoder_vp8.h>
+#if USE_VP9_ENCODER
+#include <gst/vaapi/gstvaapiencoder_vp9.h>
+#endif
+
+#define GST_PLUGIN_NAME "vaapitranscode"
+#define GST_PLUGIN_DESC "A VA-API based video transcoder"
+
+GST_DEBUG_CATEGORY_STATIC (gst_debug_vaapi_transcode);
+#ifndef GST_DISABLE_GST_DEBUG
+#define GST_CAT_DEFAULT gst_debug_vaapi_transcode
+#else
+#define GST_CAT_DEFAULT NULL
+#endif
+
+/* Number of decoded surfaces the encoder may hold for reordering and
+   lookahead, on top of the decoder references */
+#define TRANSCODE_ENCODER_SURFACES      8
+
+#define GST_CAPS_CODEC(CODEC) CODEC "; "
+
+/* *INDENT-OFF* */
+static const char gst_vaapi_transcode_sink_caps_str[] =
+    GST_CAPS_CODEC("video/mpeg, mpegversion=2, systemstream=(boolean)false")
+    GST_CAPS_CODEC("video/x-h264")
+    GST_CAPS_CODEC("video/x-h265")
+    GST_CAPS_CODEC("video/x-vp8")
+#if USE_AV1_DECODER
+    GST_CAPS_CODEC("video/x-av1")
+#endif
+    "video/x-vp9";
+
+static const char gst_vaapi_transcode_src_caps_str[] =
+    GST_CAPS_CODEC("video/x-h265, stream-format=(string)byte-stream, "
+        "alignment=(string)au")
+    GST_CAPS_CODEC("video/x-h264, stream-format=(string)byte-stream, "
+        "alignment=(string)au")
+#if USE_VP9_ENCODER
+    GST_CAPS_CODEC("video/x-vp9")
+#endif
+    GST_CAPS_CODEC("video/x-vp8")
+    "video/mpeg, mpegversion=2, systemstream=(boolean)false";
+/* *INDENT-ON* */
+
+static GstStaticPadTemplate gst_vaapi_transcode_sink_factory =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (gst_vaapi_transcode_sink_caps_str));
+
+static GstStaticPadTemplate gst_vaapi_transcode_src_factory =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (gst_vaapi_transcode_src_caps_str));
+
+typedef GstVaapiEncoder *(*GstVaapiEncoderNewFunc) (GstVaapiDisplay *
+    display);
+
+typedef struct
+{
+  const gchar *media_type;
+  GstVaapiEncoderNewFunc create;
+} GstVaapiTranscodeEncoderMap;
+
+static const GstVaapiTranscodeEncoderMap vaapi_transcode_encoder_map[] = {
+  {"video/x-h265", gst_vaapi_encoder_h265_new},
+  {"video/x-h264", gst_vaapi_encoder_h264_new},
+#if USE_VP9_ENCODER
+  {"video/x-vp9", gst_vaapi_encoder_vp9_new},
+#endif
+  {"video/x-vp8", gst_vaapi_encoder_vp8_new},
+  {"video/mpeg", gst_vaapi_encoder_mpeg2_new},
+};
+
+enum
+{
+  PROP_0,
+  PROP_WIDTH,
+  PROP_HEIGHT,
+  PROP_BITRATE,
+  PROP_KEYFRAME_PERIOD,
+  PROP_JOB_PRIORITY,
+};
+
+G_DEFINE_TYPE_WITH_CODE (GstVaapiTranscode, gst_vaapi_transcode,
+    GST_TYPE_ELEMENT, GST_VAAPI_PLUGIN_BASE_INIT_INTERFACES);
+
+GST_VAAPI_PLUGIN_BASE_DEFINE_SET_CONTEXT (gst_vaapi_transcode_parent_class);
+
+static void
+gst_vaapi_transcode_clear_pending_events (GstVaapiTranscode * transcode)
+{
+  g_list_free_full (transcode->pending_events,
+      (GDestroyNotify) gst_event_unref);
+  transcode->pending_events = NULL;
+}
+
+/* Pushes the events held back until the source caps were known */
+static void
+gst_vaapi_transcode_push_pending_events (GstVaapiTranscode * transcode)
+{
+  GstPad *const srcpad = GST_VAAPI_PLUGIN_BASE_SRC_PAD (transcode);
+  GList *events, *l;
+
+  events = g_list_reverse (transcode->pending_events);
+  transcode->pending_events = NULL;
+  for (l = events; l; l = l->next)
+    gst_pad_push_event (srcpad, l->data);
+  g_list_free (events);
+}
+
+/* Releases the decode, scale and encode stages */
+static void
+gst_vaapi_transcode_destroy (GstVaapiTranscode * transcode)
+{
+  gst_clear_object (&transcode->encoder);
+  gst_clear_object (&transcode->filter);
+  gst_clear_object (&transcode->decoder);
+  g_array_set_size (transcode->timestamps, 0);
+  transcode->last_dts = GST_CLOCK_TIME_NONE;
+  transcode->frame_number = 0;
+  transcode->scaled = FALSE;
+}
+
+static gboolean
+gst_vaapi_transcode_create_decoder (GstVaapiTranscode * transcode,
+    GstCaps * caps)
+{
+  GstVaapiDisplay *display;
+
+  if (!gst_vaapi_plugin_base_ensure_display (GST_VAAPI_PLUGIN_BASE
+          (transcode)))
+    return FALSE;
+  display = GST_VAAPI_PLUGIN_BASE_DISPLAY (transcode);
+
+  /* Keep the pipeline running across compatible caps updates */
+  if (transcode->decoder && gst_vaapi_decoder_get_codec (transcode->decoder)
+      == gst_vaapi_get_codec_from_caps (caps))
+    return gst_vaapi_decoder_update_caps (transcode->decoder, caps);
+
+  gst_vaapi_transcode_destroy (transcode);
+
+  switch (gst_vaapi_get_codec_from_caps (caps)) {
+    case GST_VAAPI_CODEC_MPEG2:
+      transcode->decoder = gst_vaapi_decoder_mpeg2_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_H264:
+      transcode->decoder = gst_vaapi_decoder_h264_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_H265:
+      transcode->decoder = gst_vaapi_decoder_h265_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_VP8:
+      transcode->decoder = gst_vaapi_decoder_vp8_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_VP9:
+      transcode->decoder = gst_vaapi_decoder_vp9_new (display, caps);
+      break;
+#if USE_AV1_DECODER
+    case GST_VAAPI_CODEC_AV1:
+      transcode->decoder = gst_vaapi_decoder_av1_new (display, caps);
+      break;
+#endif
+    default:
+      break;
+  }
+  if (!transcode->decoder)
+    return FALSE;
+
+  /* The encoder keeps the decoded surfaces it has not coded yet */
+  gst_vaapi_decoder_set_downstream_surfaces (transcode->decoder,
+      TRANSCODE_ENCODER_SURFACES);
+  return TRUE;
+}
+
+/* Picks the output codec preferred by downstream */
+static const GstVaapiTranscodeEncoderMap *
+gst_vaapi_transcode_find_encoder (GstVaapiTranscode * transcode)
+{
+  GstPad *const srcpad = GST_VAAPI_PLUGIN_BASE_SRC_PAD (transcode);
+  const GstVaapiTranscodeEncoderMap *map = NULL;
+  GstCaps *templ, *peer_caps;
+  guint i, j;
+
+  templ = gst_pad_get_pad_template_caps (srcpad);
+  peer_caps = gst_pad_peer_query_caps (srcpad, templ);
+  gst_caps_unref (templ);
+  if (!peer_caps)
+    return NULL;
+
+  for (i = 0; i < gst_caps_get_size (peer_caps) && !map; i++) {
+    const gchar *const name =
+        gst_structure_get_name (gst_caps_get_structure (peer_caps, i));
+
+    for (j = 0; j < G_N_ELEMENTS (vaapi_transcode_encoder_map); j++) {
+      if (g_strcmp0 (name, vaapi_transcode_encoder_map[j].media_type) == 0) {
+        map = &vaapi_transcode_encoder_map[j];
+        break;
+      }
+    }
+  }
+  gst_caps_unref (peer_caps);
+  return map;
+}
+
+static GstCaps *
+gst_vaapi_transcode_get_output_caps (const GstVaapiTranscodeEncoderMap * map,
+    const GstVideoInfo * vip)
+{
+  GstCaps *caps;
+
+  caps = gst_caps_new_empty_simple (map->media_type);
+  if (g_strcmp0 (map->media_type, "video/x-h264") == 0 ||
+      g_strcmp0 (map->media_type, "video/x-h265") == 0) {
+    gst_caps_set_simple (caps, "stream-format", G_TYPE_STRING, "byte-stream",
+        "alignment", G_TYPE_STRING, "au", NULL);
+  } else if (g_strcmp0 (map->media_type, "video/mpeg") == 0) {
+    gst_caps_set_simple (caps, "mpegversion", G_TYPE_INT, 2,
+        "systemstream", G_TYPE_BOOLEAN, FALSE, NULL);
+  }
+
+  gst_caps_set_simple (caps,
+      "width", G_TYPE_INT, GST_VIDEO_INFO_WIDTH (vip),
+      "height", G_TYPE_INT, GST_VIDEO_INFO_HEIGHT (vip),
+      "framerate", GST_TYPE_FRACTION, GST_VIDEO_INFO_FPS_N (vip),
+      GST_VIDEO_INFO_FPS_D (vip),
+      "pixel-aspect-ratio", GST_TYPE_FRACTION, GST_VIDEO_INFO_PAR_N (vip),
+      GST_VIDEO_INFO_PAR_D (vip), NULL);
+  return caps;
+}
+
+/* Configures the scale and encode stages from the first decoded
+   surface, then announces the output caps */
+static gboolean
+gst_vaapi_transcode_ensure_encoder (GstVaapiTranscode * transcode,
+    GstVaapiSurfaceProxy * proxy)
+{
+  GstVaapiDisplay *const display = GST_VAAPI_PLUGIN_BASE_DISPLAY (transcode);
+  const GstVaapiTranscodeEncoderMap *map;
+  GstVideoCodecState *src_state;
+  GstVideoCodecState state = { 0, };
+  GstVideoInfo *const vip = &state.info;
+  const GstVideoInfo *src_vip;
+  GstVideoFormat format;
+  GstVaapiEncoderStatus status;
+  guint width, height;
+  GstCaps *caps;
+  gboolean ret;
+
+  if (transcode->encoder)
+    return TRUE;
+
+  map = gst_vaapi_transcode_find_encoder (transcode);
+  if (!map)
+    goto error_not_negotiated;
+
+  src_state = gst_vaapi_decoder_get_codec_state (transcode->decoder);
+  src_vip = &src_state->info;
+
+  format = gst_vaapi_surface_get_format (GST_VAAPI_SURFACE_PROXY_SURFACE
+      (proxy));
+  if (format == GST_VIDEO_FORMAT_UNKNOWN || format == GST_VIDEO_FORMAT_ENCODED)
+    format = GST_VIDEO_FORMAT_NV12;
+
+  width = transcode->width ? transcode->width : GST_VIDEO_INFO_WIDTH (src_vip);
+  height = transcode->height ? transcode->height :
+      GST_VIDEO_INFO_HEIGHT (src_vip);
+  transcode->scaled = width != GST_VIDEO_INFO_WIDTH (src_vip) ||
+      height != GST_VIDEO_INFO_HEIGHT (src_vip);
+
+  /* Only the video info is looked at by the encoder */
+  state.ref_count = 1;
+  gst_video_info_set_interlaced_format (vip, format,
+      GST_VIDEO_INFO_INTERLACE_MODE (src_vip), width, height);
+  GST_VIDEO_INFO_FPS_N (vip) = GST_VIDEO_INFO_FPS_N (src_vip);
+  GST_VIDEO_INFO_FPS_D (vip) = GST_VIDEO_INFO_FPS_D (src_vip);
+  GST_VIDEO_INFO_PAR_N (vip) = GST_VIDEO_INFO_PAR_N (src_vip);
+  GST_VIDEO_INFO_PAR_D (vip) = GST_VIDEO_INFO_PAR_D (src_vip);
+  GST_VIDEO_INFO_COLORIMETRY (vip) = GST_VIDEO_INFO_COLORIMETRY (src_vip);
+  GST_VIDEO_INFO_CHROMA_SITE (vip) = GST_VIDEO_INFO_CHROMA_SITE (src_vip);
+
+  if (transcode->scaled) {
+    transcode->filter = gst_vaapi_filter_new (display);
+    if (!transcode->filter)
+      goto error_create_filter;
+    if (!gst_vaapi_filter_set_format (transcode->filter, format))
+      goto error_create_filter;
+  }
+
+  transcode->encoder = map->create (display);
+  if (!transcode->encoder)
+    goto error_create_encoder;
+
+  if (transcode->bitrate > 0) {
+    status = gst_vaapi_encoder_set_rate_control (transcode->encoder,
+        GST_VAAPI_RATECONTROL_CBR);
+    if (status == GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      status = gst_vaapi_encoder_set_bitrate (transcode->encoder,
+          transcode->bitrate);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_configure_encoder;
+  }
+  if (transcode->keyframe_period > 0) {
+    status = gst_vaapi_encoder_set_keyframe_period (transcode->encoder,
+        transcode->keyframe_period);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_configure_encoder;
+  }
+
+  status = gst_vaapi_encoder_set_codec_state (transcode->encoder, &state);
+  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    goto error_configure_encoder;
+
+  caps = gst_vaapi_transcode_get_output_caps (map, vip);
+  GST_INFO_OBJECT (transcode, "transcoding to %" GST_PTR_FORMAT, caps);
+  ret = gst_pad_set_caps (GST_VAAPI_PLUGIN_BASE_SRC_PAD (transcode), caps);
+  gst_caps_unref (caps);
+  if (!ret)
+    goto error_not_negotiated;
+
+  gst_vaapi_transcode_push_pending_events (transcode);
+  return TRUE;
+
+  /* ERRORS */
+error_not_negotiated:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to negotiate the output codec");
+    gst_clear_object (&transcode->encoder);
+    gst_clear_object (&transcode->filter);
+    return FALSE;
+  }
+error_create_filter:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to create the scaling filter");
+    gst_clear_object (&transcode->filter);
+    return FALSE;
+  }
+error_create_encoder:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to create the %s encoder",
+        map->media_type);
+    gst_clear_object (&transcode->filter);
+    return FALSE;
+  }
+error_configure_encoder:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to configure the encoder "
+        "(status %d)", status);
+    gst_clear_object (&transcode->encoder);
+    gst_clear_object (&transcode->filter);
+    return FALSE;
+  }
+}
+
+/* Applies one deadline and GPU priority to every stage, so the decode,
+   scale and encode jobs of a frame are scheduled together */
+static void
+gst_vaapi_transcode_set_job_deadline (GstVaapiTranscode * transcode,
+    GstClockTime timestamp)
+{
+  const GstClockTime deadline =
+      gst_vaapi_plugin_base_get_job_deadline (GST_VAAPI_PLUGIN_BASE
+      (transcode), &transcode->segment, timestamp);
+  const GstVaapiPriority priority =
+      gst_vaapi_plugin_base_get_priority (GST_VAAPI_PLUGIN_BASE (transcode));
+
+  if (transcode->decoder) {
+    gst_vaapi_decoder_set_job_deadline (transcode->decoder, deadline);
+    gst_vaapi_decoder_set_priority (transcode->decoder, priority);
+  }
+  if (transcode->filter) {
+    gst_vaapi_filter_set_job_deadline (transcode->filter, deadline);
+    gst_vaapi_filter_set_priority (transcode->filter, priority);
+  }
+  if (transcode->encoder) {
+    gst_vaapi_encoder_set_job_deadline (transcode->encoder, deadline);
+    gst_vaapi_encoder_set_priority (transcode->encoder, priority);
+  }
+}
+
+/* Returns the decode timestamp of the next output frame. The frames
+   leave the encoder in coding order, so the timestamps of the input
+   frames, taken in presentation order, are clamped to stay below the
+   presentation timestamp and monotonic */
+static GstClockTime
+gst_vaapi_transcode_pop_dts (GstVaapiTranscode * transcode, GstClockTime pts)
+{
+  GstClockTime dts;
+
+  if (transcode->timestamps->len == 0)
+    return pts;
+
+  dts = g_array_index (transcode->timestamps, GstClockTime, 0);
+  g_array_remove_index (transcode->timestamps, 0);
+  if (GST_CLOCK_TIME_IS_VALID (pts) && dts > pts)
+    dts = pts;
+  if (GST_CLOCK_TIME_IS_VALID (transcode->last_dts)
+      && dts < transcode->last_dts)
+    dts = transcode->last_dts;
+  transcode->last_dts = dts;
+  return dts;
+}
+
+static GstFlowReturn
+gst_vaapi_transcode_push_coded_buffer (GstVaapiTranscode * transcode,
+    GstVaapiCodedBufferProxy * codedbuf_proxy)
+{
+  GstVaapiCodedBuffer *const coded_buf =
+      GST_VAAPI_CODED_BUFFER_PROXY_BUFFER (codedbuf_proxy);
+  GstVideoCodecFrame *const frame =
+      gst_vaapi_coded_buffer_proxy_get_user_data (codedbuf_proxy);
+  GstBuffer *buf;
+  gint size;
+
+  size = gst_vaapi_coded_buffer_get_size (coded_buf);
+  if (size <= 0)
+    goto error_invalid_buffer;
+
+  buf = gst_buffer_new_allocate (NULL, size, NULL);
+  if (!buf)
+    goto error_create_buffer;
+  if (!gst_vaapi_coded_buffer_copy_into (buf, coded_buf))
+    goto error_copy_buffer;
+
+  GST_BUFFER_PTS (buf) = frame->pts;
+  GST_BUFFER_DTS (buf) = gst_vaapi_transcode_pop_dts (transcode, frame->pts);
+  GST_BUFFER_DURATION (buf) = frame->duration;
+  if (!GST_VIDEO_CODEC_FRAME_IS_SYNC_POINT (frame))
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  return gst_pad_push (GST_VAAPI_PLUGIN_BASE_SRC_PAD (transcode), buf);
+
+  /* ERRORS */
+error_invalid_buffer:
+  {
+    GST_ERROR_OBJECT (transcode, "invalid encoded buffer size %d", size);
+    return GST_FLOW_ERROR;
+  }
+error_create_buffer:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to create output buffer of size %d",
+        size);
+    return GST_FLOW_ERROR;
+  }
+error_copy_buffer:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to copy encoded buffer");
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* Pushes downstream every frame the encoder has finished */
+static GstFlowReturn
+gst_vaapi_transcode_drain_encoder (GstVaapiTranscode * transcode)
+{
+  GstVaapiCodedBufferProxy *codedbuf_proxy = NULL;
+  GstVaapiEncoderStatus status;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (ret == GST_FLOW_OK) {
+    status = gst_vaapi_encoder_get_buffer_with_timeout (transcode->encoder,
+        &codedbuf_proxy, 0);
+    if (status == GST_VAAPI_ENCODER_STATUS_NO_BUFFER)
+      break;
+    if (status == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED) {
+      /* Its input timestamp must not be reused as a decode timestamp */
+      if (transcode->timestamps->len > 0)
+        g_array_set_size (transcode->timestamps,
+            transcode->timestamps->len - 1);
+      gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
+      continue;
+    }
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      goto error_get_buffer;
+
+    ret = gst_vaapi_transcode_push_coded_buffer (transcode, codedbuf_proxy);
+    gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
+  }
+  return ret;
+
+  /* ERRORS */
+error_get_buffer:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to get encoded buffer (status %d)",
+        status);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* Creates the frame handed over to the encoder: it carries the
+   timing of the decoded surface, and takes over @proxy */
+static GstVideoCodecFrame *
+gst_vaapi_transcode_frame_new (GstVaapiTranscode * transcode,
+    GstVaapiSurfaceProxy * proxy, GstClockTime pts, GstClockTime duration)
+{
+  GstVideoCodecFrame *frame;
+
+  frame = g_slice_new0 (GstVideoCodecFrame);
+  frame->ref_count = 1;
+  frame->system_frame_number = transcode->frame_number;
+  frame->decode_frame_number = transcode->frame_number;
+  frame->presentation_frame_number = transcode->frame_number;
+  transcode->frame_number++;
+  frame->dts = GST_CLOCK_TIME_NONE;
+  frame->pts = pts;
+  frame->duration = duration;
+  frame->deadline = GST_CLOCK_TIME_NONE;
+
+  gst_video_codec_frame_set_user_data (frame, proxy,
+      (GDestroyNotify) gst_vaapi_surface_proxy_unref);
+  return frame;
+}
+
+/* Scales, if needed, and encodes one decoded surface */
+static GstFlowReturn
+gst_vaapi_transcode_encode_surface (GstVaapiTranscode * transcode,
+    GstVaapiSurfaceProxy * proxy)
+{
+  const GstClockTime pts = GST_VAAPI_SURFACE_PROXY_TIMESTAMP (proxy);
+  const GstClockTime duration = GST_VAAPI_SURFACE_PROXY_DURATION (proxy);
+  GstVaapiSurfaceProxy *out_proxy;
+  GstVideoCodecFrame *frame;
+  GstVaapiFilterStatus filter_status;
+  GstVaapiEncoderStatus status;
+
+  if (!gst_vaapi_transcode_ensure_encoder (transcode, proxy))
+    goto error_not_negotiated;
+
+  if (!transcode->scaled) {
+    out_proxy = gst_vaapi_surface_proxy_ref (proxy);
+  } else {
+    out_proxy = gst_vaapi_encoder_create_input_surface (transcode->encoder);
+    if (!out_proxy)
+      goto error_create_surface;
+
+    gst_vaapi_filter_set_cropping_rectangle (transcode->filter,
+        gst_vaapi_surface_proxy_get_crop_rect (proxy));
+    filter_status = gst_vaapi_filter_process (transcode->filter,
+        GST_VAAPI_SURFACE_PROXY_SURFACE (proxy),
+        GST_VAAPI_SURFACE_PROXY_SURFACE (out_proxy), 0);
+    if (filter_status != GST_VAAPI_FILTER_STATUS_SUCCESS)
+      goto error_process;
+  }
+
+  g_array_append_val (transcode->timestamps, pts);
+  frame = gst_vaapi_transcode_frame_new (transcode, out_proxy, pts, duration);
+  status = gst_vaapi_encoder_put_frame (transcode->encoder, frame);
+  gst_video_codec_frame_unref (frame);
+  if (status < GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    goto error_encode_frame;
+
+  return gst_vaapi_transcode_drain_encoder (transcode);
+
+  /* ERRORS */
+error_not_negotiated:
+  {
+    GST_ELEMENT_ERROR (transcode, CORE, NEGOTIATION, (NULL),
+        ("no supported output codec downstream"));
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+error_create_surface:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to allocate a scaled surface");
+    return GST_FLOW_ERROR;
+  }
+error_process:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to scale frame (status %d)",
+        filter_status);
+    gst_vaapi_surface_proxy_unref (out_proxy);
+    return GST_FLOW_ERROR;
+  }
+error_encode_frame:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to encode frame (status %d)",
+        status);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* Feeds every decoded surface to the scale and encode stages */
+static GstFlowReturn
+gst_vaapi_transcode_drain_decoder (GstVaapiTranscode * transcode)
+{
+  GstVaapiSurfaceProxy *proxy;
+  GstVaapiDecoderStatus status;
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  while (ret == GST_FLOW_OK) {
+    status = gst_vaapi_decoder_get_surface (transcode->decoder, &proxy);
+    if (status == GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA ||
+        status == GST_VAAPI_DECODER_STATUS_END_OF_STREAM)
+      break;
+    if (status != GST_VAAPI_DECODER_STATUS_SUCCESS)
+      goto error_decode;
+
+    gst_vaapi_transcode_set_job_deadline (transcode,
+        GST_VAAPI_SURFACE_PROXY_TIMESTAMP (proxy));
+    ret = gst_vaapi_transcode_encode_surface (transcode, proxy);
+    gst_vaapi_surface_proxy_unref (proxy);
+  }
+  return ret;
+
+  /* ERRORS */
+error_decode:
+  {
+    GST_ELEMENT_ERROR (transcode, STREAM, DECODE, (NULL),
+        ("failed to decode frame (status %d)", status));
+    return GST_FLOW_ERROR;
+  }
+}
+
+static GstFlowReturn
+gst_vaapi_transcode_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstVaapiTranscode *const transcode = GST_VAAPI_TRANSCODE (parent);
+  GstFlowReturn ret;
+
+  if (!transcode->decoder)
+    goto error_not_negotiated;
+
+  gst_vaapi_transcode_set_job_deadline (transcode, GST_BUFFER_PTS (buf));
+  if (!gst_vaapi_decoder_put_buffer (transcode->decoder, buf))
+    goto error_put_buffer;
+  gst_buffer_unref (buf);
+
+  ret = gst_vaapi_transcode_drain_decoder (transcode);
+  gst_vaapi_plugin_base_trim_surface_pool (GST_VAAPI_PLUGIN_BASE (transcode),
+      FALSE);
+  return ret;
+
+  /* ERRORS */
+error_not_negotiated:
+  {
+    GST_ELEMENT_ERROR (transcode, CORE, NEGOTIATION, (NULL),
+        ("no caps received before the first buffer"));
+    gst_buffer_unref (buf);
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+error_put_buffer:
+  {
+    GST_ERROR_OBJECT (transcode, "failed to queue input buffer to decoder");
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+}
+
+/* Pushes out everything still held by the decoder and the encoder */
+static GstFlowReturn
+gst_vaapi_transcode_finish (GstVaapiTranscode * transcode)
+{
+  GstVaapiEncoderStatus status;
+  GstFlowReturn ret;
+
+  if (!transcode->decoder)
+    return GST_FLOW_OK;
+
+  if (!gst_vaapi_decoder_put_buffer (transcode->decoder, NULL))
+    return GST_FLOW_ERROR;
+  ret = gst_vaapi_transcode_drain_decoder (transcode);
+  if (ret != GST_FLOW_OK || !transcode->encoder)
+    return ret;
+
+  status = gst_vaapi_encoder_flush (transcode->encoder);
+  if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return GST_FLOW_ERROR;
+  return gst_vaapi_transcode_drain_encoder (transcode);
+}
+
+static gboolean
+gst_vaapi_transcode_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstVaapiTranscode *const transcode = GST_VAAPI_TRANSCODE (parent);
+  GstPad *const srcpad = GST_VAAPI_PLUGIN_BASE_SRC_PAD (transcode);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps;
+      gboolean ret;
+
+      gst_event_parse_caps (event, &caps);
+      ret = gst_vaapi_transcode_create_decoder (transcode, caps);
+      if (!ret)
+        GST_ERROR_OBJECT (transcode, "failed to create decoder for %"
+            GST_PTR_FORMAT, caps);
+      gst_event_unref (event);
+      return ret;
+    }
+    case GST_EVENT_SEGMENT:
+      gst_event_copy_segment (event, &transcode->segment);
+      break;
+    case GST_EVENT_EOS:
+      if (gst_vaapi_transcode_finish (transcode) != GST_FLOW_OK)
+        GST_WARNING_OBJECT (transcode, "failed to drain pending frames");
+      gst_vaapi_transcode_push_pending_events (transcode);
+      return gst_pad_push_event (srcpad, event);
+    case GST_EVENT_FLUSH_STOP:
+      gst_vaapi_transcode_clear_pending_events (transcode);
+      if (transcode->decoder)
+        gst_vaapi_decoder_reset (transcode->decoder);
+      if (transcode->encoder) {
+        GstVaapiCodedBufferProxy *codedbuf_proxy = NULL;
+
+        gst_vaapi_encoder_flush (transcode->encoder);
+        while (gst_vaapi_encoder_get_buffer_with_timeout (transcode->encoder,
+                &codedbuf_proxy, 0) != GST_VAAPI_ENCODER_STATUS_NO_BUFFER) {
+          if (!codedbuf_proxy)
+            break;
+          gst_vaapi_coded_buffer_proxy_unref (codedbuf_proxy);
+          codedbuf_proxy = NULL;
+        }
+      }
+      g_array_set_size (transcode->timestamps, 0);
+      transcode->last_dts = GST_CLOCK_TIME_NONE;
+      gst_segment_init (&transcode->segment, GST_FORMAT_TIME);
+      return gst_pad_push_event (srcpad, event);
+    default:
+      break;
+  }
+
+  /* Serialized events must follow the output caps */
+  if (!transcode->encoder && GST_EVENT_IS_SERIALIZED (event)
+      && GST_EVENT_TYPE (event) != GST_EVENT_STREAM_START) {
+    transcode->pending_events =
+        g_list_prepend (transcode->pending_events, event);
+    return TRUE;
+  }
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static gboolean
+gst_vaapi_transcode_query (GstPad * pad, GstObject * parent, GstQuery * query)
+{
+  GstElement *const element = GST_ELEMENT (parent);
+
+  switch (GST_QUERY_TYPE (query)) {
+    case GST_QUERY_CONTEXT:
+      if (gst_vaapi_handle_context_query (element, query))
+        return TRUE;
+      break;
+    case GST_QUERY_CAPS:{
+      GstCaps *filter, *caps;
+
+      gst_query_parse_caps (query, &filter);
+      caps = gst_pad_get_pad_template_caps (pad);
+      if (filter) {
+        GstCaps *const tmp = caps;
+        caps = gst_caps_intersect_full (filter, tmp,
+            GST_CAPS_INTERSECT_FIRST);
+        gst_caps_unref (tmp);
+      }
+      gst_query_set_caps_result (query, caps);
+      gst_caps_unref (caps);
+      return TRUE;
+    }
+    default:
+      break;
+  }
+  return gst_pad_query_default (pad, parent, query);
+}
+
+static GstStateChangeReturn
+gst_vaapi_transcode_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstVaapiTranscode *const transcode = GST_VAAPI_TRANSCODE (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      if (!gst_vaapi_plugin_base_open (GST_VAAPI_PLUGIN_BASE (transcode)))
+        return GST_STATE_CHANGE_FAILURE;
+      break;
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      gst_segment_init (&transcode->segment, GST_FORMAT_TIME);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (gst_vaapi_transcode_parent_class)->change_state
+      (element, transition);
+  if (ret == GST_STATE_CHANGE_FAILURE)
+    return ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_vaapi_transcode_destroy (transcode);
+      gst_vaapi_transcode_clear_pending_events (transcode);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      gst_vaapi_plugin_base_close (GST_VAAPI_PLUGIN_BASE (transcode));
+      break;
+    default:
+      break;
+  }
+  return ret;
+}
+
+static void
+gst_vaapi_transcode_finalize (GObject * object)
+{
+  GstVaapiTranscode *const transcode = GST_VAAPI_TRANSCODE (object);
+
+  gst_vaapi_transcode_destroy (transcode);
+  gst_vaapi_transcode_clear_pending_events (transcode);
+  g_array_unref (transcode->timestamps);
+  gst_vaapi_plugin_base_finalize (GST_VAAPI_PLUGIN_BASE (transcode));
+
+  G_OBJECT_CLASS (gst_vaapi_transcode_parent_class)->finalize (object);
+}
+
+static void
+gst_vaapi_transcode_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstVaapiTranscode *const transcode = GST_VAAPI_TRANSCODE (object);
+
+  switch (prop_id) {
+    case PROP_WIDTH:
+      transcode->width = g_value_get_uint (value);
+      break;
+    case PROP_HEIGHT:
+      transcode->height = g_value_get_uint (value);
+      break;
+    case PROP_BITRATE:
+      transcode->bitrate = g_value_get_uint (value);
+      break;
+    case PROP_KEYFRAME_PERIOD:
+      transcode->keyframe_period = g_value_get_uint (value);
+      break;
+    case PROP_JOB_PRIORITY:
+      GST_VAAPI_PLUGIN_BASE (object)->job_priority = g_value_get_enum (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_transcode_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstVaapiTranscode *const transcode = GST_VAAPI_TRANSCODE (object);
+
+  switch (prop_id) {
+    case PROP_WIDTH:
+      g_value_set_uint (value, transcode->width);
+      break;
+    case PROP_HEIGHT:
+      g_value_set_uint (value, transcode->height);
+      break;
+    case PROP_BITRATE:
+      g_value_set_uint (value, transcode->bitrate);
+      break;
+    case PROP_KEYFRAME_PERIOD:
+      g_value_set_uint (value, transcode->keyframe_period);
+      break;
+    case PROP_JOB_PRIORITY:
+      g_value_set_enum (value, GST_VAAPI_PLUGIN_BASE (object)->job_priority);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_vaapi_transcode_class_init (GstVaapiTranscodeClass * klass)
+{
+  GObjectClass *const object_class = G_OBJECT_CLASS (klass);
+  GstElementClass *const element_class = GST_ELEMENT_CLASS (klass);
+  GstVaapiPluginBaseClass *const plugin_class =
+      GST_VAAPI_PLUGIN_BASE_CLASS (klass);
+
+  GST_DEBUG_CATEGORY_INIT (gst_debug_vaapi_transcode,
+      GST_PLUGIN_NAME, 0, GST_PLUGIN_DESC);
+
+  gst_vaapi_plugin_base_class_init (plugin_class);
+
+  object_class->finalize = gst_vaapi_transcode_finalize;
+  object_class->set_property = gst_vaapi_transcode_set_property;
+  object_class->get_property = gst_vaapi_transcode_get_property;
+
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_vaapi_transcode_change_state);
+  element_class->set_context = gst_vaapi_base_set_context;
+
+  /**
+   * GstVaapiTranscode:width:
+   *
+   * Width of the encoded frames, or 0 to keep the source width.
+   */
+  g_object_class_install_property (object_class, PROP_WIDTH,
+      g_param_spec_uint ("width", "Width",
+          "Output width (0: source width)", 0, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiTranscode:height:
+   *
+   * Height of the encoded frames, or 0 to keep the source height.
+   */
+  g_object_class_install_property (object_class, PROP_HEIGHT,
+      g_param_spec_uint ("height", "Height",
+          "Output height (0: source height)", 0, G_MAXINT, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiTranscode:bitrate:
+   *
+   * The constant bitrate of the output stream, in kbps. The encoder
+   * default rate control is kept when 0.
+   */
+  g_object_class_install_property (object_class, PROP_BITRATE,
+      g_param_spec_uint ("bitrate", "Bitrate (kbps)",
+          "The desired bitrate expressed in kbps (0: encoder default)",
+          0, 2000 * 1024, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiTranscode:keyframe-period:
+   *
+   * Maximal distance between two keyframes, or 0 for the encoder
+   * default.
+   */
+  g_object_class_install_property (object_class, PROP_KEYFRAME_PERIOD,
+      g_param_spec_uint ("keyframe-period", "Keyframe Period",
+          "Maximal distance between two keyframes (0: encoder default)",
+          0, G_MAXUINT32, 0,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  /**
+   * GstVaapiTranscode:job-priority:
+   *
+   * How the decode, scale and encode jobs are scheduled against the
+   * other streams sharing the VA display. The three stages of a frame
+   * share the same deadline.
+   */
+  g_object_class_install_property (object_class, PROP_JOB_PRIORITY,
+      g_param_spec_enum ("job-priority", "Job priority",
+          "Scheduling priority of the hardware jobs",
+          GST_VAAPI_TYPE_JOB_PRIORITY, GST_VAAPI_JOB_PRIORITY_BATCH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_vaapi_transcode_sink_factory);
+  gst_element_class_add_static_pad_template (element_class,
+      &gst_vaapi_transcode_src_factory);
+
+  gst_element_class_set_static_metadata (element_class,
+      "VA-API transcoder",
+      "Codec/Decoder/Encoder/Video/Hardware",
+      GST_PLUGIN_DESC, "GStreamer VA-API developers");
+}
+
+static void
+gst_vaapi_transcode_init (GstVaapiTranscode * transcode)
+{
+  GstPad *pad;
+
+  pad = gst_pad_new_from_static_template (&gst_vaapi_transcode_sink_factory,
+      "sink");
+  gst_pad_set_chain_function (pad,
+      GST_DEBUG_FUNCPTR (gst_vaapi_transcode_chain));
+  gst_pad_set_event_function (pad,
+      GST_DEBUG_FUNCPTR (gst_vaapi_transcode_sink_event));
+  gst_pad_set_query_function (pad,
+      GST_DEBUG_FUNCPTR (gst_vaapi_transcode_query));
+  gst_element_add_pad (GST_ELEMENT (transcode), pad);
+
+  pad = gst_pad_new_from_static_template (&gst_vaapi_transcode_src_factory,
+      "src");
+  gst_pad_set_query_function (pad,
+      GST_DEBUG_FUNCPTR (gst_vaapi_transcode_query));
+  gst_pad_use_fixed_caps (pad);
+  gst_element_add_pad (GST_ELEMENT (transcode), pad);
+
+  /* The pads must exist before the plugin base looks them up */
+  gst_vaapi_plugin_base_init (GST_VAAPI_PLUGIN_BASE (transcode),
+      GST_CAT_DEFAULT);
+
+  gst_segment_init (&transcode->segment, GST_FORMAT_TIME);
+  transcode->timestamps = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  transcode->last_dts = GST_CLOCK_TIME_NONE;
+}
@@ -0,0 +1,82 @@
+/*
+ *  gstvaapitranscode.h - VA-API fused decode, scale and encode element
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef GST_VAAPI_TRANSCODE_H
+#define GST_VAAPI_TRANSCODE_H
+
+#include "gstvaapipluginbase.h"
+#include <gst/vaapi/gstvaapidecoder.h>
+#include <gst/vaapi/gstvaapiencoder.h>
+#include <gst/vaapi/gstvaapifilter.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_VAAPI_TRANSCODE (gst_vaapi_transcode_get_type ())
+#define GST_VAAPI_TRANSCODE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_VAAPI_TRANSCODE, \
+      GstVaapiTranscode))
+#define GST_VAAPI_TRANSCODE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_VAAPI_TRANSCODE, \
+      GstVaapiTranscodeClass))
+#define GST_IS_VAAPI_TRANSCODE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_VAAPI_TRANSCODE))
+#define GST_IS_VAAPI_TRANSCODE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_VAAPI_TRANSCODE))
+#define GST_VAAPI_TRANSCODE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_VAAPI_TRANSCODE, \
+      GstVaapiTranscodeClass))
+
+typedef struct _GstVaapiTranscode GstVaapiTranscode;
+typedef struct _GstVaapiTranscodeClass GstVaapiTranscodeClass;
+
+struct _GstVaapiTranscode
+{
+  /*< private >*/
+  GstVaapiPluginBase parent_instance;
+
+  GstVaapiDecoder *decoder;
+  GstVaapiFilter *filter;
+  GstVaapiEncoder *encoder;
+
+  GstSegment segment;
+  GList *pending_events;
+  GArray *timestamps;
+  GstClockTime last_dts;
+  guint32 frame_number;
+  guint scaled:1;
+
+  /* properties */
+  guint width;
+  guint height;
+  guint bitrate;
+  guint keyframe_period;
+};
+
+struct _GstVaapiTranscodeClass
+{
+  /*< private >*/
+  GstVaapiPluginBaseClass parent_class;
+};
+
+GType
+gst_vaapi_transcode_get_type (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* GST_VAAPI_TRANSCODE_H */
@@ -47,8 +47,10 @@ struct _GstVaapiVideoBufferPoolPrivate
   guint options;
   guint use_dmabuf_memory:1;
   guint forced_video_meta:1;
-  /* Map between surface and GstMemory, only DMA */
-  GHashTable *dma_mem_map;
+
+  /* buffers currently acquired, and the most ever acquired at once */
+  gint outstanding;
+  gint max_outstanding;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (GstVaapiVideoBufferPool,
@@ -62,8 +64,6 @@ gst_vaapi_video_buffer_pool_finalize (GObject * object)
 
   gst_vaapi_display_replace (&priv->display, NULL);
   g_clear_object (&priv->allocator);
-  if (priv->dma_mem_map)
-    g_hash_table_destroy (priv->dma_mem_map);
 
   G_OBJECT_CLASS (gst_vaapi_video_buffer_pool_parent_class)->finalize (object);
 }
@@ -313,26 +313,39 @@ error_no_allocator:
   }
 }
 
+/* The dmabuf GstMemory exported for a surface is attached to the
+ * surface itself, rather than to the pool, so that it survives pool
+ * reconfigurations and flushes as long as the surface lives. */
+#define GST_VAAPI_DMA_MEM_QUARK gst_vaapi_dma_mem_quark_get ()
+static GQuark
+gst_vaapi_dma_mem_quark_get (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    gsize quark = (gsize) g_quark_from_static_string ("GstVaapiDmaBufMemory");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
 static void
 vaapi_buffer_pool_cache_dma_mem (GstVaapiVideoBufferPool * pool,
     GstVaapiSurfaceProxy * proxy, GstMemory * mem)
 {
-  GstVaapiVideoBufferPoolPrivate *const priv = pool->priv;
   GstVaapiSurface *surface;
 
   surface = GST_VAAPI_SURFACE_PROXY_SURFACE (proxy);
   g_assert (surface);
   g_assert (gst_vaapi_surface_peek_buffer_proxy (surface));
 
-  if (!priv->dma_mem_map)
-    priv->dma_mem_map = g_hash_table_new_full (g_direct_hash,
-        g_direct_equal, NULL, (GDestroyNotify) gst_memory_unref);
+  if (gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (surface),
+          GST_VAAPI_DMA_MEM_QUARK) == mem)
+    return;
 
-  if (!g_hash_table_contains (priv->dma_mem_map, surface)) {
-    g_hash_table_insert (priv->dma_mem_map, surface, gst_memory_ref (mem));
-  } else {
-    g_assert (g_hash_table_lookup (priv->dma_mem_map, surface) == mem);
-  }
+  gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (surface),
+      GST_VAAPI_DMA_MEM_QUARK, gst_memory_ref (mem),
+      (GDestroyNotify) gst_memory_unref);
 }
 
 static GstMemory *
@@ -341,26 +354,32 @@ vaapi_buffer_pool_lookup_dma_mem (GstVaapiVideoBufferPool * pool,
 {
   GstVaapiSurface *surface;
   GstVaapiVideoBufferPoolPrivate *const priv = pool->priv;
-  GstVaapiBufferProxy *buf_proxy;
+  const GstVideoInfo *mem_vinfo, *pool_vinfo;
   GstMemory *mem;
 
   g_assert (priv->use_dmabuf_memory);
 
-  if (!priv->dma_mem_map)
-    return NULL;
-
   surface = GST_VAAPI_SURFACE_PROXY_SURFACE (proxy);
   g_assert (surface);
 
-  buf_proxy = gst_vaapi_surface_peek_buffer_proxy (surface);
   /* Have not exported yet */
-  if (!buf_proxy) {
-    g_assert (!g_hash_table_contains (priv->dma_mem_map, surface));
+  if (!gst_vaapi_surface_peek_buffer_proxy (surface))
     return NULL;
-  }
 
-  mem = g_hash_table_lookup (priv->dma_mem_map, surface);
-  g_assert (mem);
+  mem = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (surface),
+      GST_VAAPI_DMA_MEM_QUARK);
+  if (!mem)
+    return NULL;
+
+  /* A memory exported by a previous pool can be reused as long as its
+   * allocator describes the same layout */
+  if (mem->allocator != priv->allocator) {
+    mem_vinfo = gst_allocator_get_vaapi_video_info (mem->allocator, NULL);
+    pool_vinfo = gst_allocator_get_vaapi_video_info (priv->allocator, NULL);
+    if (!mem_vinfo || !pool_vinfo
+        || !gst_video_info_is_equal (mem_vinfo, pool_vinfo))
+      return NULL;
+  }
 
   return gst_memory_ref (mem);
 }
@@ -487,6 +506,12 @@ gst_vaapi_video_buffer_pool_acquire_buffer (GstBufferPool * pool,
       (gst_vaapi_video_buffer_pool_parent_class)->acquire_buffer (pool, &buffer,
       params);
 
+  if (ret == GST_FLOW_OK) {
+    const gint outstanding = g_atomic_int_add (&priv->outstanding, 1) + 1;
+    if (outstanding > g_atomic_int_get (&priv->max_outstanding))
+      g_atomic_int_set (&priv->max_outstanding, outstanding);
+  }
+
   if (!priv->use_dmabuf_memory || !params || !priv_params->proxy
       || ret != GST_FLOW_OK) {
     *out_buffer_ptr = buffer;
@@ -525,10 +550,10 @@ gst_vaapi_video_buffer_pool_acquire_buffer (GstBufferPool * pool,
       return GST_FLOW_OK;
     }
   } else {
-    /* Should be an unexported surface */
+    /* Either an unexported surface, or one exported with a different
+     * layout */
     surface = GST_VAAPI_SURFACE_PROXY_SURFACE (priv_params->proxy);
     g_assert (surface);
-    g_assert (gst_vaapi_surface_peek_buffer_proxy (surface) == NULL);
     gst_vaapi_video_meta_set_surface_proxy (meta, priv_params->proxy);
     mem = gst_vaapi_dmabuf_memory_new (priv->allocator, meta);
     if (mem)
@@ -547,6 +572,19 @@ gst_vaapi_video_buffer_pool_acquire_buffer (GstBufferPool * pool,
   }
 }
 
+static void
+gst_vaapi_video_buffer_pool_release_buffer (GstBufferPool * pool,
+    GstBuffer * buffer)
+{
+  GstVaapiVideoBufferPoolPrivate *const priv =
+      GST_VAAPI_VIDEO_BUFFER_POOL (pool)->priv;
+
+  g_atomic_int_add (&priv->outstanding, -1);
+
+  GST_BUFFER_POOL_CLASS
+      (gst_vaapi_video_buffer_pool_parent_class)->release_buffer (pool, buffer);
+}
+
 static void
 gst_vaapi_video_buffer_pool_reset_buffer (GstBufferPool * pool,
     GstBuffer * buffer)
@@ -586,6 +624,7 @@ gst_vaapi_video_buffer_pool_class_init (GstVaapiVideoBufferPoolClass * klass)
   pool_class->set_config = gst_vaapi_video_buffer_pool_set_config;
   pool_class->alloc_buffer = gst_vaapi_video_buffer_pool_alloc_buffer;
   pool_class->acquire_buffer = gst_vaapi_video_buffer_pool_acquire_buffer;
+  pool_class->release_buffer = gst_vaapi_video_buffer_pool_release_buffer;
   pool_class->reset_buffer = gst_vaapi_video_buffer_pool_reset_buffer;
 
   /**
@@ -605,7 +644,6 @@ static void
 gst_vaapi_video_buffer_pool_init (GstVaapiVideoBufferPool * pool)
 {
   pool->priv = gst_vaapi_video_buffer_pool_get_instance_private (pool);
-  pool->priv->dma_mem_map = NULL;
 }
 
 GstBufferPool *
@@ -635,3 +673,28 @@ gst_vaapi_video_buffer_pool_copy_buffer (GstBufferPool * pool)
 
   return va_pool->priv->forced_video_meta;
 }
+
+/**
+ * gst_vaapi_video_buffer_pool_get_usage:
+ * @pool: a #GstVaapiVideoBufferPool
+ * @in_use_ptr: (out) (allow-none): return location for the number of
+ *   buffers currently acquired from @pool
+ * @max_in_use_ptr: (out) (allow-none): return location for the most
+ *   buffers ever acquired at once
+ *
+ * Retrieves the usage of @pool, i.e. of the surfaces it holds.
+ */
+void
+gst_vaapi_video_buffer_pool_get_usage (GstBufferPool * pool,
+    guint * in_use_ptr, guint * max_in_use_ptr)
+{
+  GstVaapiVideoBufferPoolPrivate *priv;
+
+  g_return_if_fail (GST_VAAPI_IS_VIDEO_BUFFER_POOL (pool));
+
+  priv = GST_VAAPI_VIDEO_BUFFER_POOL (pool)->priv;
+  if (in_use_ptr)
+    *in_use_ptr = MAX (g_atomic_int_get (&priv->outstanding), 0);
+  if (max_in_use_ptr)
+    *max_in_use_ptr = g_atomic_int_get (&priv->max_outstanding);
+}
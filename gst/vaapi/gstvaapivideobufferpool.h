@@ -124,6 +124,11 @@ G_GNUC_INTERNAL
 gboolean
 gst_vaapi_video_buffer_pool_copy_buffer (GstBufferPool * pool);
 
+G_GNUC_INTERNAL
+void
+gst_vaapi_video_buffer_pool_get_usage (GstBufferPool * pool,
+    guint * in_use_ptr, guint * max_in_use_ptr);
+
 G_END_DECLS
 
 #endif /* GST_VAAPI_VIDEO_BUFFER_POOL_H */
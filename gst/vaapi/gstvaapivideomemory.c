@@ -25,6 +25,7 @@
 #include <gst/vaapi/gstvaapisurface_drm.h>
 #include <gst/vaapi/gstvaapisurfacepool.h>
 #include <gst/vaapi/gstvaapiimagepool.h>
+#include <gst/vaapi/gstvaapiutils_copy.h>
 #include "gstvaapivideomemory.h"
 #include "gstvaapipluginutil.h"
 
@@ -119,6 +120,16 @@ new_image (GstVaapiDisplay * display, const GstVideoInfo * vip)
       GST_VIDEO_INFO_WIDTH (vip), GST_VIDEO_INFO_HEIGHT (vip));
 }
 
+/* Releases the derived image cached by read-only maps */
+static void
+drop_derived_image (GstVaapiVideoMemory * mem)
+{
+  if (!mem->image || use_native_formats (mem->usage_flag))
+    return;
+  gst_vaapi_video_meta_set_image (mem->meta, NULL);
+  gst_vaapi_video_memory_reset_image (mem);
+}
+
 static gboolean
 ensure_image (GstVaapiVideoMemory * mem)
 {
@@ -156,8 +167,11 @@ ensure_image_is_current (GstVaapiVideoMemory * mem)
     if (!gst_vaapi_surface_get_image (mem->surface, mem->image))
       return FALSE;
 
+    /* Both now hold the same pixels, so that a read-only map never
+     * gets the image written back into the surface */
     GST_VAAPI_VIDEO_MEMORY_FLAG_SET (mem,
-        GST_VAAPI_VIDEO_MEMORY_FLAG_IMAGE_IS_CURRENT);
+        GST_VAAPI_VIDEO_MEMORY_FLAG_IMAGE_IS_CURRENT |
+        GST_VAAPI_VIDEO_MEMORY_FLAG_SURFACE_IS_CURRENT);
   }
   return TRUE;
 }
@@ -187,6 +201,9 @@ ensure_surface (GstVaapiVideoMemory * mem)
       gst_vaapi_video_meta_set_surface_proxy (mem->meta, mem->proxy);
     }
   }
+  /* The meta may have been bound to another surface meanwhile */
+  if (mem->surface != GST_VAAPI_SURFACE_PROXY_SURFACE (mem->proxy))
+    drop_derived_image (mem);
   mem->surface = GST_VAAPI_SURFACE_PROXY_SURFACE (mem->proxy);
   return mem->surface != NULL;
 }
@@ -210,11 +227,95 @@ ensure_surface_is_current (GstVaapiVideoMemory * mem)
   return TRUE;
 }
 
+/* Stops sharing the surface with the copies of the memory */
+static void
+unshare_surface (GstVaapiVideoMemory * mem)
+{
+  if (mem->share_count && g_atomic_int_dec_and_test (mem->share_count))
+    g_free (mem->share_count);
+  mem->share_count = NULL;
+}
+
+static gboolean
+copy_surface (GstVaapiVideoMemory * mem, GstVaapiSurface * dst_surface,
+    GstVaapiSurface * src_surface)
+{
+  GstVaapiVideoAllocator *const allocator =
+      GST_VAAPI_VIDEO_ALLOCATOR_CAST (GST_MEMORY_CAST (mem)->allocator);
+  GstVaapiImage *image;
+  gboolean success;
+
+  if (gst_vaapi_surface_copy (dst_surface, src_surface))
+    return TRUE;
+
+  /* Go through an image when the GPU cannot copy surfaces */
+  image = gst_vaapi_video_pool_get_object (allocator->image_pool);
+  if (!image)
+    return FALSE;
+  success = gst_vaapi_surface_get_image (src_surface, image)
+      && gst_vaapi_surface_put_image (dst_surface, image);
+  gst_vaapi_video_pool_put_object (allocator->image_pool, image);
+  return success;
+}
+
+/* Gives the memory a surface of its own before it gets written to,
+ * if it still shares one with its copies: the readers keep the
+ * original surface, the writer gets a GPU copy of it. The vaapi meta
+ * of @buffer is moved over to the new surface as well */
+static gboolean
+ensure_surface_is_private (GstVaapiVideoMemory * mem, GstBuffer * buffer)
+{
+  GstVaapiSurfaceProxy *proxy;
+  GstVaapiVideoMeta *buffer_meta;
+
+  if (!mem->share_count)
+    return TRUE;
+  if (g_atomic_int_get (mem->share_count) == 1) {
+    unshare_surface (mem);
+    return TRUE;
+  }
+
+  if (!ensure_surface (mem) || !ensure_surface_is_current (mem))
+    return FALSE;
+
+  proxy = new_surface_proxy (mem);
+  if (!proxy)
+    return FALSE;
+  if (!copy_surface (mem, GST_VAAPI_SURFACE_PROXY_SURFACE (proxy),
+          mem->surface)) {
+    gst_vaapi_surface_proxy_unref (proxy);
+    return FALSE;
+  }
+  gst_vaapi_surface_proxy_set_crop_rect (proxy,
+      gst_vaapi_surface_proxy_get_crop_rect (mem->proxy));
+
+  GST_DEBUG ("copied surface %" GST_VAAPI_ID_FORMAT " for writing",
+      GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID (mem->surface)));
+
+  buffer_meta = buffer ? gst_buffer_get_vaapi_video_meta (buffer) : NULL;
+  if (buffer_meta && buffer_meta != mem->meta &&
+      gst_vaapi_video_meta_get_surface_proxy (buffer_meta) == mem->proxy)
+    gst_vaapi_video_meta_set_surface_proxy (buffer_meta, proxy);
+
+  gst_vaapi_video_meta_set_surface_proxy (mem->meta, proxy);
+  gst_vaapi_surface_proxy_replace (&mem->proxy, proxy);
+  gst_vaapi_surface_proxy_unref (proxy);
+  /* The image was loaded from the shared surface */
+  if (use_native_formats (mem->usage_flag))
+    GST_VAAPI_VIDEO_MEMORY_FLAG_UNSET (mem,
+        GST_VAAPI_VIDEO_MEMORY_FLAG_IMAGE_IS_CURRENT);
+  unshare_surface (mem);
+  return ensure_surface (mem);
+}
+
 static inline gboolean
 map_vaapi_memory (GstVaapiVideoMemory * mem, GstMapFlags flags)
 {
   if (!ensure_surface (mem))
     goto error_no_surface;
+  /* Wait for the GPU before the CPU accesses the pixels */
+  if (!gst_vaapi_surface_proxy_sync (mem->proxy))
+    goto error_sync_surface;
   if (!ensure_image (mem))
     goto error_no_image;
 
@@ -223,7 +324,11 @@ map_vaapi_memory (GstVaapiVideoMemory * mem, GstMapFlags flags)
   if ((flags & GST_MAP_READ) && !ensure_image_is_current (mem))
     goto error_no_current_image;
 
-  if (!gst_vaapi_image_map (mem->image))
+  /* Read-only maps let the driver use a cached CPU mapping */
+  if (flags & GST_MAP_WRITE) {
+    if (!gst_vaapi_image_map (mem->image))
+      goto error_map_image;
+  } else if (!gst_vaapi_image_map_read_only (mem->image))
     goto error_map_image;
 
   /* Mark surface as dirty and expect updates from image */
@@ -241,6 +346,12 @@ error_no_surface:
         GST_VIDEO_INFO_FORMAT_STRING (vip));
     return FALSE;
   }
+error_sync_surface:
+  {
+    GST_ERROR ("failed to wait for surface %" GST_VAAPI_ID_FORMAT,
+        GST_VAAPI_ID_ARGS (GST_VAAPI_SURFACE_ID (mem->surface)));
+    return FALSE;
+  }
 error_no_image:
   {
     const GstVideoInfo *const vip = mem->image_info;
@@ -265,6 +376,15 @@ error_map_image:
 static inline void
 unmap_vaapi_memory (GstVaapiVideoMemory * mem, GstMapFlags flags)
 {
+  /* Keep the derived image mapped across read-only maps of the same
+   * surface, so that consumers mapping a frame several times do not
+   * derive and map it again each time. It is released as soon as the
+   * surface may change, see drop_derived_image() */
+  if (!use_native_formats (mem->usage_flag) && !(flags & GST_MAP_WRITE)) {
+    gst_vaapi_video_meta_set_image (mem->meta, NULL);
+    return;
+  }
+
   gst_vaapi_image_unmap (mem->image);
 
   if (flags & GST_MAP_WRITE) {
@@ -299,6 +419,9 @@ gst_video_meta_map_vaapi_memory (GstVideoMeta * meta, guint plane,
 
   /* Map for writing */
   if (mem->map_count == 0) {
+    if ((flags & GST_MAP_WRITE) &&
+        !ensure_surface_is_private (mem, meta->buffer))
+      goto error_private_surface;
     if (!map_vaapi_memory (mem, flags))
       goto out;
     mem->map_type = GST_VAAPI_VIDEO_MEMORY_MAP_TYPE_PLANAR;
@@ -320,6 +443,11 @@ error_incompatible_map:
     GST_ERROR ("incompatible map type (%d)", mem->map_type);
     goto out;
   }
+error_private_surface:
+  {
+    GST_ERROR ("failed to copy shared surface for writing");
+    goto out;
+  }
 }
 
 gboolean
@@ -380,6 +508,7 @@ gst_vaapi_video_memory_new (GstAllocator * base_allocator,
   mem->map_count = 0;
   mem->map_surface_id = VA_INVALID_ID;
   mem->usage_flag = allocator->usage_flag;
+  mem->share_count = NULL;
   g_mutex_init (&mem->lock);
 
   GST_VAAPI_VIDEO_MEMORY_FLAG_SET (mem,
@@ -410,6 +539,7 @@ void
 gst_vaapi_video_memory_reset_surface (GstVaapiVideoMemory * mem)
 {
   mem->surface = NULL;
+  unshare_surface (mem);
   gst_vaapi_video_memory_reset_image (mem);
   gst_vaapi_surface_proxy_replace (&mem->proxy, NULL);
   if (mem->meta)
@@ -427,6 +557,122 @@ gst_vaapi_video_memory_sync (GstVaapiVideoMemory * mem)
   return ensure_surface_is_current (mem);
 }
 
+/* Writes @frame into the derived image of @image, converting planar
+ * 4:2:0 chroma into interleaved chroma on the way if needed */
+static gboolean
+upload_frame_to_image (GstVaapiImage * image, GstVideoFrame * frame)
+{
+  const GstVideoFormat src_format = GST_VIDEO_FRAME_FORMAT (frame);
+  const GstVideoFormat dst_format = gst_vaapi_image_get_format (image);
+  const guint width = GST_VIDEO_FRAME_WIDTH (frame);
+  const guint height = GST_VIDEO_FRAME_HEIGHT (frame);
+  guint i, u, v;
+
+  if (src_format == dst_format) {
+    for (i = 0; i < GST_VIDEO_FRAME_N_PLANES (frame); i++) {
+      const guint comp = GST_VIDEO_FORMAT_INFO_PLANE (frame->info.finfo, i);
+      gst_vaapi_upload_plane (gst_vaapi_image_get_plane (image, i),
+          gst_vaapi_image_get_pitch (image, i),
+          GST_VIDEO_FRAME_PLANE_DATA (frame, i),
+          GST_VIDEO_FRAME_PLANE_STRIDE (frame, i),
+          GST_VIDEO_FRAME_COMP_WIDTH (frame, comp) *
+          GST_VIDEO_FRAME_COMP_PSTRIDE (frame, comp),
+          GST_VIDEO_FRAME_COMP_HEIGHT (frame, comp));
+    }
+    return TRUE;
+  }
+
+  if (dst_format != GST_VIDEO_FORMAT_NV12)
+    return FALSE;
+  switch (src_format) {
+    case GST_VIDEO_FORMAT_I420:
+      u = 1, v = 2;
+      break;
+    case GST_VIDEO_FORMAT_YV12:
+      u = 2, v = 1;
+      break;
+    default:
+      return FALSE;
+  }
+
+  gst_vaapi_upload_plane (gst_vaapi_image_get_plane (image, 0),
+      gst_vaapi_image_get_pitch (image, 0),
+      GST_VIDEO_FRAME_PLANE_DATA (frame, 0),
+      GST_VIDEO_FRAME_PLANE_STRIDE (frame, 0), width, height);
+  gst_vaapi_upload_interleaved_plane (gst_vaapi_image_get_plane (image, 1),
+      gst_vaapi_image_get_pitch (image, 1),
+      GST_VIDEO_FRAME_PLANE_DATA (frame, u),
+      GST_VIDEO_FRAME_PLANE_STRIDE (frame, u),
+      GST_VIDEO_FRAME_PLANE_DATA (frame, v),
+      GST_VIDEO_FRAME_PLANE_STRIDE (frame, v),
+      (width + 1) / 2, (height + 1) / 2);
+  return TRUE;
+}
+
+/**
+ * gst_vaapi_video_memory_upload_frame:
+ * @mem: a #GstVaapiVideoMemory
+ * @frame: a system memory #GstVideoFrame
+ *
+ * Writes @frame straight into the surface of @mem through a derived
+ * image, in a single copy, instead of going through an intermediate
+ * VA image and vaPutImage(). Planar I420 and YV12 frames are
+ * converted to NV12 surfaces in the same pass.
+ *
+ * Returns: %TRUE if the frame was uploaded, %FALSE if the surface
+ *   can't be derived or the formats are not handled, in which case
+ *   the regular mapping path has to be used.
+ */
+gboolean
+gst_vaapi_video_memory_upload_frame (GstVaapiVideoMemory * mem,
+    GstVideoFrame * frame)
+{
+  GstVaapiImage *image = NULL;
+  gboolean success = FALSE;
+
+  g_return_val_if_fail (mem, FALSE);
+  g_return_val_if_fail (frame, FALSE);
+
+  g_mutex_lock (&mem->lock);
+  if (mem->map_count > 0)
+    goto out;
+
+  if (!ensure_surface (mem))
+    goto out;
+  if (GST_VIDEO_FRAME_WIDTH (frame) > gst_vaapi_surface_get_width (mem->surface)
+      || GST_VIDEO_FRAME_HEIGHT (frame) >
+      gst_vaapi_surface_get_height (mem->surface))
+    goto out;
+  /* The GPU may still be reading a previous frame */
+  if (!gst_vaapi_surface_proxy_sync (mem->proxy))
+    goto out;
+  drop_derived_image (mem);
+
+  image = gst_vaapi_surface_derive_image (mem->surface);
+  if (!image)
+    goto out;
+  if (!gst_vaapi_image_map (image))
+    goto out;
+  success = upload_frame_to_image (image, frame);
+  gst_vaapi_image_unmap (image);
+  if (!success)
+    goto out;
+
+  /* Any image loaded earlier is now stale */
+  if (use_native_formats (mem->usage_flag) && mem->image)
+    gst_vaapi_video_memory_reset_image (mem);
+  GST_VAAPI_VIDEO_MEMORY_FLAG_UNSET (mem,
+      GST_VAAPI_VIDEO_MEMORY_FLAG_IMAGE_IS_CURRENT);
+  GST_VAAPI_VIDEO_MEMORY_FLAG_SET (mem,
+      GST_VAAPI_VIDEO_MEMORY_FLAG_SURFACE_IS_CURRENT);
+
+out:
+  g_mutex_unlock (&mem->lock);
+  if (image)
+    gst_vaapi_image_unref (image);
+  return success;
+}
+
 static gpointer
 gst_vaapi_video_memory_map (GstMemory * base_mem, gsize maxsize, guint flags)
 {
@@ -446,6 +692,8 @@ gst_vaapi_video_memory_map (GstMemory * base_mem, gsize maxsize, guint flags)
             gst_vaapi_video_meta_get_surface_proxy (mem->meta));
         if (!mem->proxy)
           goto error_no_surface_proxy;
+        /* The surface may be written to through VA from now on */
+        drop_derived_image (mem);
         if (!ensure_surface_is_current (mem))
           goto error_no_current_surface;
         mem->map_type = GST_VAAPI_VIDEO_MEMORY_MAP_TYPE_SURFACE;
@@ -566,12 +814,13 @@ gst_vaapi_video_memory_copy (GstMemory * base_mem, gssize offset, gssize size)
   allocator = base_mem->allocator;
   g_return_val_if_fail (GST_VAAPI_IS_VIDEO_ALLOCATOR (allocator), FALSE);
 
-  /* XXX: this implements a soft-copy, i.e. underlying VA surfaces
-     are not copied */
+  /* This is a copy-on-write: the VA surface is shared until either
+     memory gets mapped for writing, see ensure_surface_is_private() */
   (void) gst_memory_get_sizes (base_mem, NULL, &maxsize);
   if (offset != 0 || (size != -1 && (gsize) size != maxsize))
     goto error_unsupported;
 
+  g_mutex_lock (&mem->lock);
   if (!ensure_surface_is_current (mem))
     goto error_no_current_surface;
 
@@ -583,11 +832,20 @@ gst_vaapi_video_memory_copy (GstMemory * base_mem, gssize offset, gssize size)
   gst_vaapi_video_meta_unref (meta);
   if (!out_mem)
     goto error_allocate_memory;
+
+  if (!mem->share_count) {
+    mem->share_count = g_new (gint, 1);
+    *mem->share_count = 1;
+  }
+  g_atomic_int_inc (mem->share_count);
+  GST_VAAPI_VIDEO_MEMORY_CAST (out_mem)->share_count = mem->share_count;
+  g_mutex_unlock (&mem->lock);
   return out_mem;
 
   /* ERRORS */
 error_no_current_surface:
   {
+    g_mutex_unlock (&mem->lock);
     GST_ERROR ("failed to make surface current");
     return NULL;
   }
@@ -598,6 +856,7 @@ error_unsupported:
   }
 error_allocate_memory:
   {
+    g_mutex_unlock (&mem->lock);
     GST_ERROR ("failed to allocate GstVaapiVideoMemory copy");
     return NULL;
   }
@@ -616,6 +875,7 @@ gst_vaapi_video_allocator_free (GstAllocator * allocator, GstMemory * base_mem)
   GstVaapiVideoMemory *const mem = GST_VAAPI_VIDEO_MEMORY_CAST (base_mem);
 
   mem->surface = NULL;
+  unshare_surface (mem);
   gst_vaapi_video_memory_reset_image (mem);
   gst_vaapi_surface_proxy_replace (&mem->proxy, NULL);
   gst_vaapi_video_meta_replace (&mem->meta, NULL);
@@ -943,6 +1203,20 @@ error_cannot_map:
   }
 }
 
+/* Whether surface pools are shared among all allocators of a display,
+   i.e. across elements and pipelines using the same GstContext */
+static gboolean
+use_shared_surface_pools (void)
+{
+  static gsize g_shared = 0;
+
+  if (g_once_init_enter (&g_shared)) {
+    gsize shared = g_getenv ("GST_VAAPI_SHARE_SURFACE_POOLS") ? 2 : 1;
+    g_once_init_leave (&g_shared, shared);
+  }
+  return g_shared == 2;
+}
+
 static inline gboolean
 allocator_params_init (GstVaapiVideoAllocator * allocator,
     GstVaapiDisplay * display, const GstVideoInfo * alloc_info,
@@ -953,8 +1227,12 @@ allocator_params_init (GstVaapiVideoAllocator * allocator,
   if (!allocator_configure_surface_info (display, allocator, req_usage_flag,
           surface_alloc_flags))
     return FALSE;
-  allocator->surface_pool = gst_vaapi_surface_pool_new_full (display,
-      &allocator->surface_info, surface_alloc_flags);
+  if (use_shared_surface_pools ())
+    allocator->surface_pool = gst_vaapi_surface_pool_new_shared (display,
+        &allocator->surface_info, surface_alloc_flags);
+  else
+    allocator->surface_pool = gst_vaapi_surface_pool_new_full (display,
+        &allocator->surface_info, surface_alloc_flags);
   if (!allocator->surface_pool)
     goto error_create_surface_pool;
 
@@ -1023,6 +1301,33 @@ gst_vaapi_buffer_proxy_quark_get (void)
   return g_quark;
 }
 
+#define GST_VAAPI_DRM_MODIFIER_QUARK gst_vaapi_drm_modifier_quark_get ()
+static GQuark
+gst_vaapi_drm_modifier_quark_get (void)
+{
+  static gsize g_quark;
+
+  if (g_once_init_enter (&g_quark)) {
+    gsize quark = (gsize) g_quark_from_static_string ("GstVaapiDrmModifier");
+    g_once_init_leave (&g_quark, quark);
+  }
+  return g_quark;
+}
+
+/* The DRM format modifier @mem was exported with, if any, so that
+ * another VA element importing it keeps the same layout. */
+guint64
+gst_vaapi_dmabuf_memory_get_modifier (GstMemory * mem)
+{
+  const guint64 *modifier;
+
+  g_return_val_if_fail (mem != NULL, GST_VAAPI_DRM_FORMAT_MOD_INVALID);
+
+  modifier = gst_mini_object_get_qdata (GST_MINI_OBJECT_CAST (mem),
+      GST_VAAPI_DRM_MODIFIER_QUARK);
+  return modifier ? *modifier : GST_VAAPI_DRM_FORMAT_MOD_INVALID;
+}
+
 /* Whether @mem holds an internal VA surface proxy created at
  * gst_vaapi_dmabuf_memory_new(). */
 gboolean
@@ -1113,6 +1418,14 @@ gst_vaapi_dmabuf_memory_new (GstAllocator * base_allocator,
         GST_VAAPI_BUFFER_PROXY_QUARK, GINT_TO_POINTER (TRUE), NULL);
   }
 
+  if (gst_vaapi_buffer_proxy_get_modifier (dmabuf_proxy) !=
+      GST_VAAPI_DRM_FORMAT_MOD_INVALID) {
+    guint64 *const modifier = g_new (guint64, 1);
+    *modifier = gst_vaapi_buffer_proxy_get_modifier (dmabuf_proxy);
+    gst_mini_object_set_qdata (GST_MINI_OBJECT_CAST (mem),
+        GST_VAAPI_DRM_MODIFIER_QUARK, modifier, g_free);
+  }
+
   /* When a VA surface is going to be filled by a VAAPI element
    * (decoder or VPP), it has _not_ be marked as busy in the driver.
    * Releasing the surface's derived image, held by the buffer proxy,
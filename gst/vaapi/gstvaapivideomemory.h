@@ -130,6 +130,8 @@ struct _GstVaapiVideoMemory
   gint map_count;
   VASurfaceID map_surface_id;
   GstVaapiImageUsageFlags usage_flag;
+  /* The number of memories sharing the surface since a copy, or NULL */
+  gint *share_count;
   GMutex lock;
 };
 
@@ -155,6 +157,11 @@ G_GNUC_INTERNAL
 gboolean
 gst_vaapi_video_memory_sync (GstVaapiVideoMemory * mem);
 
+G_GNUC_INTERNAL
+gboolean
+gst_vaapi_video_memory_upload_frame (GstVaapiVideoMemory * mem,
+    GstVideoFrame * frame);
+
 /* ------------------------------------------------------------------------ */
 /* --- GstVaapiVideoAllocator                                           --- */
 /* ------------------------------------------------------------------------ */
@@ -222,6 +229,10 @@ G_GNUC_INTERNAL
 gboolean
 gst_vaapi_dmabuf_memory_holds_surface (GstMemory * mem);
 
+G_GNUC_INTERNAL
+guint64
+gst_vaapi_dmabuf_memory_get_modifier (GstMemory * mem);
+
 /* ------------------------------------------------------------------------ */
 /* --- GstVaapiDmaBufAllocator                                          --- */
 /* ------------------------------------------------------------------------ */
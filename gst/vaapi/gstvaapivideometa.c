@@ -209,6 +209,11 @@ _gst_vaapi_video_meta_free (GstVaapiVideoMeta * meta)
  * @meta object shall not contain any VA objects created from a
  * #GstVaapiVideoPool.
  *
+ * This is a shallow copy: the image and the surface proxy are shared
+ * with @meta, and the surface is released once neither meta holds it
+ * anymore. A meta only ever replaces its image or proxy, it never
+ * modifies them, so either meta can still be updated on its own.
+ *
  * Return value: the newly allocated #GstVaapiVideoMeta, or %NULL on error
  */
 GstVaapiVideoMeta *
@@ -231,7 +236,7 @@ gst_vaapi_video_meta_copy (GstVaapiVideoMeta * meta)
   copy->image_pool = NULL;
   copy->image = meta->image ? (GstVaapiImage *)
       gst_mini_object_ref (GST_MINI_OBJECT_CAST (meta->image)) : NULL;
-  copy->proxy = meta->proxy ? gst_vaapi_surface_proxy_copy (meta->proxy) : NULL;
+  copy->proxy = meta->proxy ? gst_vaapi_surface_proxy_ref (meta->proxy) : NULL;
   copy->converter = meta->converter;
   copy->render_flags = meta->render_flags;
 
@@ -0,0 +1,465 @@
+/*
+ *  vaapiperf.c - GStreamer throughput and latency checks of VA elements
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Each test runs one element at full speed for a fixed duration, and
+ * measures the frames it outputs per second and the mean time frames
+ * spend in it. The tests pass, without measuring anything, when the
+ * elements or a VA device are not available.
+ *
+ * The results are compared to the baseline of the driver, the key file
+ * $GST_VAAPI_PERF_BASELINE_DIR/$LIBVA_DRIVER_NAME.ini ("default.ini"
+ * without LIBVA_DRIVER_NAME), which holds a group per test with "fps"
+ * and "latency-ms" keys. A test fails when it runs slower than its
+ * baseline by more than $GST_VAAPI_PERF_THRESHOLD percent, 10 by
+ * default. With GST_VAAPI_PERF_UPDATE_BASELINE=1, the results are
+ * stored as the new baseline instead. $GST_VAAPI_PERF_DURATION sets
+ * the duration of each test, in seconds.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <gst/check/gstcheck.h>
+#include <gst/video/video.h>
+
+#define DEFAULT_DURATION 2
+#define DEFAULT_THRESHOLD 10
+
+#define RAW_CAPS "video/x-raw,format=NV12,width=1920,height=1080," \
+    "framerate=60/1"
+
+typedef struct
+{
+  gint64 pts;                   /* first, as the hash table key */
+  GstClockTime time;
+} PerfInput;
+
+typedef struct
+{
+  GMutex lock;
+  GHashTable *inputs;           /* PerfInput, by timestamp */
+  guint num_outputs;
+  GstClockTime first_input;
+  GstClockTime last_output;
+  GstClockTime total_latency;
+  guint num_latencies;
+} PerfStats;
+
+typedef struct
+{
+  GstBuffer **buffers;
+  guint num_buffers;
+  GstCaps *caps;
+  GstClockTime duration;
+  guint index;
+} PerfClip;
+
+static GstPadProbeReturn
+cb_input (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  PerfStats *const stats = data;
+  GstBuffer *const buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  const GstClockTime now = gst_util_get_timestamp ();
+  PerfInput *input;
+
+  g_mutex_lock (&stats->lock);
+  if (!GST_CLOCK_TIME_IS_VALID (stats->first_input))
+    stats->first_input = now;
+  if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+    input = g_new (PerfInput, 1);
+    input->pts = GST_BUFFER_PTS (buffer);
+    input->time = now;
+    g_hash_table_replace (stats->inputs, input, input);
+  }
+  g_mutex_unlock (&stats->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+cb_output (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  PerfStats *const stats = data;
+  GstBuffer *const buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  const GstClockTime now = gst_util_get_timestamp ();
+  const gint64 pts = GST_BUFFER_PTS (buffer);
+  PerfInput *input;
+
+  g_mutex_lock (&stats->lock);
+  stats->num_outputs++;
+  stats->last_output = now;
+  input = GST_BUFFER_PTS_IS_VALID (buffer) ?
+      g_hash_table_lookup (stats->inputs, &pts) : NULL;
+  if (input) {
+    stats->total_latency += now - input->time;
+    stats->num_latencies++;
+    g_hash_table_remove (stats->inputs, &pts);
+  }
+  g_mutex_unlock (&stats->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+have_elements (const gchar * names[])
+{
+  GstElementFactory *factory;
+  guint i;
+
+  for (i = 0; names[i]; i++) {
+    factory = gst_element_factory_find (names[i]);
+    if (!factory) {
+      GST_WARNING ("no %s element, skipping", names[i]);
+      return FALSE;
+    }
+    gst_object_unref (factory);
+  }
+  return TRUE;
+}
+
+static gint
+get_env_int (const gchar * name, gint default_value)
+{
+  const gchar *const value = g_getenv (name);
+
+  return value ? (gint) g_ascii_strtoll (value, NULL, 10) : default_value;
+}
+
+static gchar *
+get_baseline_path (void)
+{
+  const gchar *const dir = g_getenv ("GST_VAAPI_PERF_BASELINE_DIR");
+  const gchar *driver = g_getenv ("LIBVA_DRIVER_NAME");
+  gchar *name, *path;
+
+  if (!dir)
+    return NULL;
+  name = g_strdup_printf ("%s.ini", driver ? driver : "default");
+  path = g_build_filename (dir, name, NULL);
+  g_free (name);
+  return path;
+}
+
+/* Compares the results of @test to its baseline, or stores them */
+static void
+check_baseline (const gchar * test, gdouble fps, gdouble latency_ms)
+{
+  gchar *const path = get_baseline_path ();
+  GKeyFile *const key_file = g_key_file_new ();
+  const gdouble threshold =
+      get_env_int ("GST_VAAPI_PERF_THRESHOLD", DEFAULT_THRESHOLD) / 100.0;
+  gdouble base_fps, base_latency_ms;
+  GError *error = NULL;
+
+  g_print ("%s: %.1f fps, %.2f ms latency\n", test, fps, latency_ms);
+  if (!path)
+    goto done;
+
+  g_key_file_load_from_file (key_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+  if (get_env_int ("GST_VAAPI_PERF_UPDATE_BASELINE", 0)) {
+    g_key_file_set_double (key_file, test, "fps", fps);
+    g_key_file_set_double (key_file, test, "latency-ms", latency_ms);
+    fail_unless (g_key_file_save_to_file (key_file, path, &error),
+        "Failed to save %s: %s", path, error ? error->message : "");
+    goto done;
+  }
+
+  if (!g_key_file_has_group (key_file, test)) {
+    GST_WARNING ("no baseline for %s in %s", test, path);
+    goto done;
+  }
+
+  base_fps = g_key_file_get_double (key_file, test, "fps", NULL);
+  base_latency_ms = g_key_file_get_double (key_file, test, "latency-ms", NULL);
+  fail_unless (base_fps <= 0 || fps >= base_fps * (1 - threshold),
+      "%s throughput regressed: %.1f fps, baseline %.1f fps", test, fps,
+      base_fps);
+  fail_unless (base_latency_ms <= 0
+      || latency_ms <= base_latency_ms * (1 + threshold),
+      "%s latency regressed: %.2f ms, baseline %.2f ms", test, latency_ms,
+      base_latency_ms);
+
+done:
+  g_clear_error (&error);
+  g_key_file_free (key_file);
+  g_free (path);
+}
+
+/* Runs @pipeline for the test duration, measuring its "perf" element */
+static void
+run_pipeline (const gchar * test, GstElement * pipeline)
+{
+  const GstClockTime duration =
+      get_env_int ("GST_VAAPI_PERF_DURATION", DEFAULT_DURATION) * GST_SECOND;
+  GstElement *element;
+  GstPad *sinkpad, *srcpad;
+  GstBus *bus;
+  GstMessage *msg;
+  PerfStats stats;
+  gdouble fps, latency_ms;
+
+  memset (&stats, 0, sizeof (stats));
+  g_mutex_init (&stats.lock);
+  stats.inputs = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+      g_free);
+  stats.first_input = GST_CLOCK_TIME_NONE;
+
+  element = gst_bin_get_by_name (GST_BIN (pipeline), "perf");
+  fail_unless (element != NULL);
+  sinkpad = gst_element_get_static_pad (element, "sink");
+  if (!sinkpad)
+    sinkpad = gst_element_get_static_pad (element, "sink_0");
+  srcpad = gst_element_get_static_pad (element, "src");
+  fail_unless (sinkpad != NULL && srcpad != NULL);
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, cb_input, &stats,
+      NULL);
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER, cb_output, &stats,
+      NULL);
+
+  /* no VA device, or one without support for the scenario */
+  if (gst_element_set_state (pipeline, GST_STATE_PAUSED) ==
+      GST_STATE_CHANGE_FAILURE
+      || gst_element_get_state (pipeline, NULL, NULL, 10 * GST_SECOND) !=
+      GST_STATE_CHANGE_SUCCESS) {
+    GST_WARNING ("%s: pipeline does not preroll, skipping", test);
+    goto done;
+  }
+
+  bus = gst_element_get_bus (pipeline);
+  fail_unless (gst_element_set_state (pipeline, GST_STATE_PLAYING) !=
+      GST_STATE_CHANGE_FAILURE);
+  msg = gst_bus_timed_pop_filtered (bus, duration,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  if (!msg) {
+    gst_element_send_event (pipeline, gst_event_new_eos ());
+    msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+        GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  }
+  fail_unless (msg != NULL, "%s: no EOS", test);
+  fail_unless (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS,
+      "%s: error %" GST_PTR_FORMAT, test, msg);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  fail_unless (stats.num_outputs > 1, "%s: no output", test);
+  fps = (stats.num_outputs - 1) * (gdouble) GST_SECOND /
+      MAX (stats.last_output - stats.first_input, 1);
+  latency_ms = stats.num_latencies == 0 ? 0 :
+      (gdouble) stats.total_latency / stats.num_latencies / GST_MSECOND;
+  check_baseline (test, fps, latency_ms);
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (sinkpad);
+  gst_object_unref (srcpad);
+  gst_object_unref (element);
+  g_hash_table_unref (stats.inputs);
+  g_mutex_clear (&stats.lock);
+}
+
+static void
+run_launch_line (const gchar * test, const gchar * launch_line)
+{
+  GstElement *pipeline;
+  GError *error = NULL;
+
+  pipeline = gst_parse_launch (launch_line, &error);
+  fail_unless (pipeline != NULL, "Failed to create %s: %s", launch_line,
+      error ? error->message : "");
+  g_clear_error (&error);
+
+  run_pipeline (test, pipeline);
+  gst_object_unref (pipeline);
+}
+
+static void
+on_clip_handoff (GstElement * sink, GstBuffer * buffer, GstPad * pad,
+    gpointer data)
+{
+  PerfClip *const clip = data;
+
+  if (!clip->caps)
+    clip->caps = gst_pad_get_current_caps (pad);
+  clip->buffers = g_renew (GstBuffer *, clip->buffers, clip->num_buffers + 1);
+  clip->buffers[clip->num_buffers++] = gst_buffer_ref (buffer);
+}
+
+/* Encodes the clip the decoder test loops over, a single GOP */
+static gboolean
+perf_clip_init (PerfClip * clip)
+{
+  GstElement *pipeline, *sink;
+  GstBus *bus;
+  GstMessage *msg;
+  gboolean success;
+
+  memset (clip, 0, sizeof (*clip));
+  pipeline = gst_parse_launch ("videotestsrc num-buffers=60 ! " RAW_CAPS
+      " ! vaapih264enc keyframe-period=60 ! fakesink name=clip "
+      "signal-handoffs=true", NULL);
+  fail_unless (pipeline != NULL);
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "clip");
+  g_signal_connect (sink, "handoff", G_CALLBACK (on_clip_handoff), clip);
+  gst_object_unref (sink);
+
+  bus = gst_element_get_bus (pipeline);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  msg = gst_bus_timed_pop_filtered (bus, 20 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  success = msg && GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS &&
+      clip->num_buffers > 0 && clip->caps;
+  if (msg)
+    gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  if (success)
+    clip->duration = clip->num_buffers * GST_SECOND / 60;
+  return success;
+}
+
+static void
+perf_clip_clear (PerfClip * clip)
+{
+  guint i;
+
+  for (i = 0; i < clip->num_buffers; i++)
+    gst_buffer_unref (clip->buffers[i]);
+  g_free (clip->buffers);
+  gst_clear_caps (&clip->caps);
+}
+
+/* Feeds the clip over and over, shifting its timestamps at each loop */
+static void
+on_need_data (GstElement * src, guint length, gpointer data)
+{
+  PerfClip *const clip = data;
+  const guint loop = clip->index / clip->num_buffers;
+  GstBuffer *buffer;
+  GstFlowReturn ret;
+
+  buffer = gst_buffer_copy (clip->buffers[clip->index % clip->num_buffers]);
+  if (GST_BUFFER_PTS_IS_VALID (buffer))
+    GST_BUFFER_PTS (buffer) += loop * clip->duration;
+  if (GST_BUFFER_DTS_IS_VALID (buffer))
+    GST_BUFFER_DTS (buffer) += loop * clip->duration;
+  clip->index++;
+
+  g_signal_emit_by_name (src, "push-buffer", buffer, &ret);
+  gst_buffer_unref (buffer);
+}
+
+GST_START_TEST (test_decode)
+{
+  const gchar *elements[] = { "vaapih264enc", "vaapih264dec", "appsrc",
+    NULL
+  };
+  GstElement *pipeline, *src;
+  PerfClip clip;
+
+  if (!have_elements (elements))
+    return;
+  if (!perf_clip_init (&clip)) {
+    GST_WARNING ("failed to encode the clip, skipping");
+    perf_clip_clear (&clip);
+    return;
+  }
+
+  pipeline = gst_parse_launch ("appsrc name=src format=time ! "
+      "vaapih264dec name=perf ! fakesink sync=false", NULL);
+  fail_unless (pipeline != NULL);
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  g_object_set (src, "caps", clip.caps, NULL);
+  g_signal_connect (src, "need-data", G_CALLBACK (on_need_data), &clip);
+  gst_object_unref (src);
+
+  run_pipeline ("vaapidecode", pipeline);
+  gst_object_unref (pipeline);
+  perf_clip_clear (&clip);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_postproc)
+{
+  const gchar *elements[] = { "vaapipostproc", NULL };
+
+  if (!have_elements (elements))
+    return;
+
+  /* the frames are uploaded first, so that the latency only covers the
+     scaling and color conversion */
+  run_launch_line ("vaapipostproc", "videotestsrc ! " RAW_CAPS
+      " ! vaapipostproc ! video/x-raw(memory:VASurface),format=NV12 "
+      "! vaapipostproc name=perf "
+      "! video/x-raw(memory:VASurface),format=BGRA,width=1280,height=720 "
+      "! fakesink sync=false");
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_overlay)
+{
+  const gchar *elements[] = { "vaapipostproc", "vaapioverlay", NULL };
+
+  if (!have_elements (elements))
+    return;
+
+  run_launch_line ("vaapioverlay", "vaapioverlay name=perf "
+      "sink_1::xpos=64 sink_1::ypos=64 ! fakesink sync=false "
+      "videotestsrc ! " RAW_CAPS " ! vaapipostproc ! perf.sink_0 "
+      "videotestsrc ! video/x-raw,width=640,height=360,framerate=60/1 "
+      "! vaapipostproc ! perf.sink_1");
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_encode)
+{
+  const gchar *elements[] = { "vaapipostproc", "vaapih264enc", NULL };
+
+  if (!have_elements (elements))
+    return;
+
+  run_launch_line ("vaapiencode", "videotestsrc ! " RAW_CAPS
+      " ! vaapipostproc ! video/x-raw(memory:VASurface),format=NV12 "
+      "! vaapih264enc name=perf ! fakesink sync=false");
+}
+
+GST_END_TEST;
+
+static Suite *
+vaapiperf_suite (void)
+{
+  Suite *s = suite_create ("vaapiperf");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_decode);
+  tcase_add_test (tc_chain, test_postproc);
+  tcase_add_test (tc_chain, test_overlay);
+  tcase_add_test (tc_chain, test_encode);
+
+  return s;
+}
+
+GST_CHECK_MAIN (vaapiperf);
@@ -0,0 +1,556 @@
+/*
+ *  bench-decode.c - Multi-instance decoder benchmark
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This application runs several decoder instances concurrently on the
+ * same raw bitstream, either on a single shared VA display or on one
+ * display per instance, and reports the throughput and the per-frame
+ * latency of each instance. VP9 streams are expected in IVF container.
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include "gst/vaapi/sysdeps.h"
+#include <dlfcn.h>
+#include <gst/vaapi/gstvaapidecoder.h>
+#include <gst/vaapi/gstvaapidecoder_h264.h>
+#include <gst/vaapi/gstvaapidecoder_h265.h>
+#include <gst/vaapi/gstvaapidecoder_vp9.h>
+#include <gst/vaapi/gstvaapidecoder_priv.h>
+#include <gst/vaapi/gstvaapisurfaceproxy.h>
+#include "codec.h"
+#include "mappedinput.h"
+#include "output.h"
+
+static gchar *g_codec_str;
+static guint g_num_instances = 1;
+static gboolean g_separate_displays;
+static guint g_num_loops = 1;
+
+static GOptionEntry g_options[] = {
+  {"codec", 'c',
+        0,
+        G_OPTION_ARG_STRING, &g_codec_str,
+      "suggested codec", NULL},
+  {"instances", 'n',
+        0,
+        G_OPTION_ARG_INT, &g_num_instances,
+      "number of concurrent decoder instances", NULL},
+  {"separate-displays", 0,
+        0,
+        G_OPTION_ARG_NONE, &g_separate_displays,
+      "create one VA display per decoder instance", NULL},
+  {"loops", 'l',
+        0,
+        G_OPTION_ARG_INT, &g_num_loops,
+      "number of times each instance decodes the stream", NULL},
+  {NULL,}
+};
+
+/* ------------------------------------------------------------------------ */
+/* --- VA calls accounting                                              --- */
+/* ------------------------------------------------------------------------ */
+
+/* The libva entry points used by the decoders are interposed here so
+   that calls issued by the statically linked libgstvaapi are counted
+   before they are forwarded to the actual library */
+
+typedef enum
+{
+  VA_CALL_CREATE_BUFFER,
+  VA_CALL_DESTROY_BUFFER,
+  VA_CALL_MAP_BUFFER,
+  VA_CALL_UNMAP_BUFFER,
+  VA_CALL_BEGIN_PICTURE,
+  VA_CALL_RENDER_PICTURE,
+  VA_CALL_END_PICTURE,
+  VA_CALL_SYNC_SURFACE,
+
+  VA_CALL_COUNT
+} VaCall;
+
+static const gchar *g_va_call_names[VA_CALL_COUNT] = {
+  "vaCreateBuffer",
+  "vaDestroyBuffer",
+  "vaMapBuffer",
+  "vaUnmapBuffer",
+  "vaBeginPicture",
+  "vaRenderPicture",
+  "vaEndPicture",
+  "vaSyncSurface",
+};
+
+static gint g_va_calls[VA_CALL_COUNT];
+
+static gpointer
+va_call_lookup (VaCall call)
+{
+  gpointer func;
+
+  func = dlsym (RTLD_NEXT, g_va_call_names[call]);
+  if (!func)
+    g_error ("failed to resolve %s", g_va_call_names[call]);
+  return func;
+}
+
+#define VA_CALL_ENTER(call, func) do {          \
+    if (G_UNLIKELY (!func))                     \
+      func = va_call_lookup (call);             \
+    g_atomic_int_inc (&g_va_calls[call]);       \
+  } while (0)
+
+VAStatus
+vaCreateBuffer (VADisplay dpy, VAContextID context, VABufferType type,
+    unsigned int size, unsigned int num_elements, void *data,
+    VABufferID * buf_id)
+{
+  static VAStatus (*func) (VADisplay, VAContextID, VABufferType,
+      unsigned int, unsigned int, void *, VABufferID *);
+
+  VA_CALL_ENTER (VA_CALL_CREATE_BUFFER, func);
+  return func (dpy, context, type, size, num_elements, data, buf_id);
+}
+
+VAStatus
+vaDestroyBuffer (VADisplay dpy, VABufferID buffer_id)
+{
+  static VAStatus (*func) (VADisplay, VABufferID);
+
+  VA_CALL_ENTER (VA_CALL_DESTROY_BUFFER, func);
+  return func (dpy, buffer_id);
+}
+
+VAStatus
+vaMapBuffer (VADisplay dpy, VABufferID buf_id, void **pbuf)
+{
+  static VAStatus (*func) (VADisplay, VABufferID, void **);
+
+  VA_CALL_ENTER (VA_CALL_MAP_BUFFER, func);
+  return func (dpy, buf_id, pbuf);
+}
+
+VAStatus
+vaUnmapBuffer (VADisplay dpy, VABufferID buf_id)
+{
+  static VAStatus (*func) (VADisplay, VABufferID);
+
+  VA_CALL_ENTER (VA_CALL_UNMAP_BUFFER, func);
+  return func (dpy, buf_id);
+}
+
+VAStatus
+vaBeginPicture (VADisplay dpy, VAContextID context, VASurfaceID render_target)
+{
+  static VAStatus (*func) (VADisplay, VAContextID, VASurfaceID);
+
+  VA_CALL_ENTER (VA_CALL_BEGIN_PICTURE, func);
+  return func (dpy, context, render_target);
+}
+
+VAStatus
+vaRenderPicture (VADisplay dpy, VAContextID context, VABufferID * buffers,
+    int num_buffers)
+{
+  static VAStatus (*func) (VADisplay, VAContextID, VABufferID *, int);
+
+  VA_CALL_ENTER (VA_CALL_RENDER_PICTURE, func);
+  return func (dpy, context, buffers, num_buffers);
+}
+
+VAStatus
+vaEndPicture (VADisplay dpy, VAContextID context)
+{
+  static VAStatus (*func) (VADisplay, VAContextID);
+
+  VA_CALL_ENTER (VA_CALL_END_PICTURE, func);
+  return func (dpy, context);
+}
+
+VAStatus
+vaSyncSurface (VADisplay dpy, VASurfaceID render_target)
+{
+  static VAStatus (*func) (VADisplay, VASurfaceID);
+
+  VA_CALL_ENTER (VA_CALL_SYNC_SURFACE, func);
+  return func (dpy, render_target);
+}
+
+#undef VA_CALL_ENTER
+
+/* ------------------------------------------------------------------------ */
+/* --- Bitstream input                                                  --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  MappedInput *input;
+  GstVaapiCodec codec;
+} Bitstream;
+
+typedef struct
+{
+  const Bitstream *bitstream;
+  guint index;
+} BitstreamReader;
+
+static void
+bitstream_reader_init (BitstreamReader * reader, const Bitstream * bs)
+{
+  reader->bitstream = bs;
+  reader->index = 0;
+}
+
+/* Returns the next chunk of data to feed the decoder with, i.e. a whole
+   frame for IVF files or a NAL unit for Annex-B streams, or NULL at the
+   end of the stream. The chunks wrap the mapped file, as indexed once
+   by mapped_input_open() */
+static GstBuffer *
+bitstream_reader_next (BitstreamReader * reader)
+{
+  return mapped_input_get_frame (reader->bitstream->input, reader->index++);
+}
+
+static GstVaapiDecoder *
+bitstream_create_decoder (const Bitstream * bs, GstVaapiDisplay * display)
+{
+  GstVaapiDecoder *decoder;
+  GstCaps *caps;
+
+  caps = caps_from_codec (bs->codec);
+  if (!caps)
+    return NULL;
+
+  switch (bs->codec) {
+    case GST_VAAPI_CODEC_H264:
+      decoder = gst_vaapi_decoder_h264_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_H265:
+      decoder = gst_vaapi_decoder_h265_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_VP9:
+      decoder = gst_vaapi_decoder_vp9_new (display, caps);
+      break;
+    default:
+      decoder = NULL;
+      break;
+  }
+  gst_caps_unref (caps);
+  return decoder;
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Decoder instances                                                --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  guint id;
+  const Bitstream *bitstream;
+  GstVaapiDisplay *display;
+  GstVaapiDecoder *decoder;
+  GThread *thread;
+  GArray *latencies;
+  guint num_frames;
+  guint max_surfaces_in_use;
+  guint num_surfaces;
+  gdouble elapsed;
+  GstVaapiDecoderStatus status;
+} Instance;
+
+static void
+instance_update_surface_usage (Instance * inst)
+{
+  GstVaapiContext *const context = GST_VAAPI_DECODER_CONTEXT (inst->decoder);
+  guint capacity, in_use;
+
+  if (!context)
+    return;
+
+  capacity = gst_vaapi_video_pool_get_capacity (context->surfaces_pool);
+  if (capacity == 0)
+    return;
+
+  in_use = capacity - gst_vaapi_video_pool_get_size (context->surfaces_pool);
+  inst->num_surfaces = capacity;
+  inst->max_surfaces_in_use = MAX (inst->max_surfaces_in_use, in_use);
+}
+
+static gboolean
+instance_decode_stream (Instance * inst)
+{
+  BitstreamReader reader;
+  GstVaapiDecoderStatus status;
+  GstVaapiSurfaceProxy *proxy;
+  GstBuffer *buffer;
+  gboolean got_eos = FALSE, flushed = FALSE;
+  gint64 start_time, latency;
+
+  bitstream_reader_init (&reader, inst->bitstream);
+
+  for (;;) {
+    if (!got_eos) {
+      buffer = bitstream_reader_next (&reader);
+      if (!buffer)
+        got_eos = TRUE;
+      if (!gst_vaapi_decoder_put_buffer (inst->decoder, buffer)) {
+        gst_buffer_replace (&buffer, NULL);
+        inst->status = GST_VAAPI_DECODER_STATUS_ERROR_UNKNOWN;
+        return FALSE;
+      }
+      gst_buffer_replace (&buffer, NULL);
+    }
+
+    /* Per-frame latency covers parsing, submission to the hardware and
+       completion of the decode operation */
+    start_time = g_get_monotonic_time ();
+    status = gst_vaapi_decoder_get_surface (inst->decoder, &proxy);
+    switch (status) {
+      case GST_VAAPI_DECODER_STATUS_SUCCESS:
+        instance_update_surface_usage (inst);
+        gst_vaapi_surface_sync (gst_vaapi_surface_proxy_get_surface (proxy));
+        latency = g_get_monotonic_time () - start_time;
+        g_array_append_val (inst->latencies, latency);
+        inst->num_frames++;
+        gst_vaapi_surface_proxy_unref (proxy);
+        break;
+      case GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA:
+        break;
+      case GST_VAAPI_DECODER_STATUS_END_OF_STREAM:
+        /* Drain the remaining frames first, then rewind */
+        if (flushed)
+          return gst_vaapi_decoder_reset (inst->decoder) ==
+              GST_VAAPI_DECODER_STATUS_SUCCESS;
+        gst_vaapi_decoder_flush (inst->decoder);
+        flushed = TRUE;
+        break;
+      default:
+        inst->status = status;
+        return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static gpointer
+instance_thread (gpointer data)
+{
+  Instance *const inst = data;
+  GTimer *const timer = g_timer_new ();
+  guint i;
+
+  for (i = 0; i < g_num_loops; i++) {
+    if (!instance_decode_stream (inst))
+      break;
+  }
+  inst->elapsed = g_timer_elapsed (timer, NULL);
+  g_timer_destroy (timer);
+  return NULL;
+}
+
+static gboolean
+instance_init (Instance * inst, guint id, const Bitstream * bs,
+    GstVaapiDisplay * display)
+{
+  inst->id = id;
+  inst->bitstream = bs;
+  inst->display = gst_object_ref (display);
+  inst->status = GST_VAAPI_DECODER_STATUS_SUCCESS;
+  inst->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  inst->decoder = bitstream_create_decoder (bs, display);
+  if (!inst->decoder)
+    return FALSE;
+  return TRUE;
+}
+
+static void
+instance_finalize (Instance * inst)
+{
+  gst_vaapi_decoder_replace (&inst->decoder, NULL);
+  gst_vaapi_display_replace (&inst->display, NULL);
+  if (inst->latencies) {
+    g_array_unref (inst->latencies);
+    inst->latencies = NULL;
+  }
+}
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  const gint64 va = *(const gint64 *) a;
+  const gint64 vb = *(const gint64 *) b;
+
+  return (va > vb) - (va < vb);
+}
+
+static gdouble
+get_percentile (GArray * sorted, guint percent)
+{
+  if (sorted->len == 0)
+    return 0.0;
+  return g_array_index (sorted, gint64, (sorted->len - 1) * percent / 100) /
+      1000.0;
+}
+
+static void
+instance_report (Instance * inst)
+{
+  g_array_sort (inst->latencies, compare_latency);
+
+  g_print ("  #%-3u %6u frames  %8.1f fps  p50 %7.2f ms  p99 %7.2f ms  "
+      "surfaces %u/%u%s\n", inst->id, inst->num_frames,
+      inst->elapsed > 0 ? inst->num_frames / inst->elapsed : 0.0,
+      get_percentile (inst->latencies, 50),
+      get_percentile (inst->latencies, 99),
+      inst->max_surfaces_in_use, inst->num_surfaces,
+      inst->status != GST_VAAPI_DECODER_STATUS_SUCCESS ? "  (error)" : "");
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Application                                                      --- */
+/* ------------------------------------------------------------------------ */
+
+static gboolean
+bitstream_open (Bitstream * bs, const gchar * file_name)
+{
+  bs->input = mapped_input_open (file_name);
+  if (!bs->input || bs->input->type == MAPPED_INPUT_Y4M)
+    return FALSE;
+
+  if (bs->input->type == MAPPED_INPUT_IVF &&
+      bs->input->fourcc == GST_MAKE_FOURCC ('V', 'P', '9', '0'))
+    bs->codec = GST_VAAPI_CODEC_VP9;
+  else
+    bs->codec = identify_codec (file_name);
+  if (!bs->codec)
+    bs->codec = identify_codec_from_string (g_codec_str);
+  return bs->codec != 0;
+}
+
+static void
+bitstream_close (Bitstream * bs)
+{
+  if (bs->input) {
+    mapped_input_close (bs->input);
+    bs->input = NULL;
+  }
+}
+
+static gboolean
+app_run (const gchar * file_name)
+{
+  Bitstream bs = { NULL, };
+  Instance *instances;
+  GstVaapiDisplay *display = NULL;
+  guint i, total_frames = 0;
+  gdouble max_elapsed = 0.0;
+  gboolean success = FALSE;
+
+  if (!bitstream_open (&bs, file_name)) {
+    g_message ("failed to open or identify bitstream '%s'", file_name);
+    bitstream_close (&bs);
+    return FALSE;
+  }
+
+  g_print ("Decoder benchmark (%s bitstream, %u instance%s, %s display%s)\n",
+      string_from_codec (bs.codec), g_num_instances,
+      g_num_instances > 1 ? "s" : "",
+      g_separate_displays ? "separate" : "shared",
+      g_separate_displays && g_num_instances > 1 ? "s" : "");
+
+  instances = g_new0 (Instance, g_num_instances);
+  for (i = 0; i < g_num_instances; i++) {
+    if (!display || g_separate_displays) {
+      gst_vaapi_display_replace (&display, NULL);
+      display = video_output_create_display (NULL);
+      if (!display) {
+        g_message ("failed to create VA display");
+        goto cleanup;
+      }
+    }
+    if (!instance_init (&instances[i], i, &bs, display)) {
+      g_message ("failed to create decoder instance #%u", i);
+      goto cleanup;
+    }
+  }
+
+  for (i = 0; i < g_num_instances; i++) {
+    instances[i].thread = g_thread_try_new ("Decoder Thread", instance_thread,
+        &instances[i], NULL);
+    if (!instances[i].thread)
+      g_message ("failed to start decoder instance #%u", i);
+  }
+
+  for (i = 0; i < g_num_instances; i++) {
+    if (!instances[i].thread)
+      continue;
+    g_thread_join (instances[i].thread);
+    instances[i].thread = NULL;
+  }
+
+  g_print ("Per instance results:\n");
+  for (i = 0; i < g_num_instances; i++) {
+    instance_report (&instances[i]);
+    total_frames += instances[i].num_frames;
+    max_elapsed = MAX (max_elapsed, instances[i].elapsed);
+  }
+
+  g_print ("Total: %u frames in %.2f sec (%.1f fps)\n", total_frames,
+      max_elapsed, max_elapsed > 0 ? total_frames / max_elapsed : 0.0);
+
+  g_print ("VA calls:\n");
+  for (i = 0; i < VA_CALL_COUNT; i++) {
+    g_print ("  %-16s %10d (%.1f per frame)\n", g_va_call_names[i],
+        g_atomic_int_get (&g_va_calls[i]),
+        total_frames ? (gdouble) g_atomic_int_get (&g_va_calls[i]) /
+        total_frames : 0.0);
+  }
+  success = TRUE;
+
+cleanup:
+  for (i = 0; i < g_num_instances; i++)
+    instance_finalize (&instances[i]);
+  g_free (instances);
+  gst_vaapi_display_replace (&display, NULL);
+  bitstream_close (&bs);
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint ret;
+
+  if (!video_output_init (&argc, argv, g_options))
+    g_error ("failed to initialize video output subsystem");
+
+  if (argc < 2) {
+    g_message ("no bitstream file specified");
+    ret = 1;
+  } else if (g_num_instances == 0 || g_num_loops == 0) {
+    g_message ("invalid number of instances or loops");
+    ret = 1;
+  } else
+    ret = !app_run (argv[1]);
+
+  g_free (g_codec_str);
+  video_output_exit ();
+  return ret;
+}
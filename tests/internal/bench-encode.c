@@ -0,0 +1,877 @@
+/*
+ *  bench-encode.c - Multi-instance encoder benchmark
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This application preloads the frames of a Y4M (I420) file into VA
+ * surfaces, scaled to each requested resolution beforehand, so that
+ * upload costs are left out of the measurements. It then runs several
+ * encoder instances concurrently for every combination of codec,
+ * resolution, rate control mode and number of B-frames, and writes the
+ * results out as JSON: throughput, per-frame latency from submission
+ * to coded data, CPU time per frame and coded buffer utilization.
+ */
+
+#include "gst/vaapi/sysdeps.h"
+#include <sys/resource.h>
+#include <gst/vaapi/gstvaapiencoder.h>
+#include <gst/vaapi/gstvaapiencoder_h264.h>
+#include <gst/vaapi/gstvaapiencoder_h265.h>
+#include <gst/vaapi/gstvaapiencoder_jpeg.h>
+#include <gst/vaapi/gstvaapiencoder_mpeg2.h>
+#if USE_VP9_ENCODER
+#include <gst/vaapi/gstvaapiencoder_vp9.h>
+#endif
+#include <gst/vaapi/gstvaapiencoder_priv.h>
+#include <gst/vaapi/gstvaapifilter.h>
+#include <gst/vaapi/gstvaapisurfaceproxy.h>
+#include "output.h"
+#include "mappedinput.h"
+
+static gchar *g_codecs_str;
+static gchar *g_sizes_str;
+static gchar *g_rate_controls_str;
+static gchar *g_bframes_str;
+static guint g_num_instances = 1;
+static guint g_num_frames = 300;
+static guint g_num_preload = 60;
+static guint g_bitrate;
+static gchar *g_output_file_name;
+
+static GOptionEntry g_options[] = {
+  {"codecs", 'c',
+        0,
+        G_OPTION_ARG_STRING, &g_codecs_str,
+      "comma separated list of codecs (h264,h265,vp9,jpeg,mpeg2)", NULL},
+  {"sizes", 's',
+        0,
+        G_OPTION_ARG_STRING, &g_sizes_str,
+      "comma separated list of WIDTHxHEIGHT resolutions", NULL},
+  {"rate-controls", 'r',
+        0,
+        G_OPTION_ARG_STRING, &g_rate_controls_str,
+      "comma separated list of rate control modes (cqp,cbr,vbr,icq,qvbr)",
+      NULL},
+  {"bframes", 'B',
+        0,
+        G_OPTION_ARG_STRING, &g_bframes_str,
+      "comma separated list of B-frame counts", NULL},
+  {"instances", 'n',
+        0,
+        G_OPTION_ARG_INT, &g_num_instances,
+      "number of concurrent encoder instances", NULL},
+  {"frames", 'f',
+        0,
+        G_OPTION_ARG_INT, &g_num_frames,
+      "number of frames each instance encodes", NULL},
+  {"preload", 'p',
+        0,
+        G_OPTION_ARG_INT, &g_num_preload,
+      "maximum number of input frames kept in memory", NULL},
+  {"bitrate", 'b',
+        0,
+        G_OPTION_ARG_INT, &g_bitrate,
+      "bitrate in kbps for the bitrate based modes", NULL},
+  {"output", 'o',
+        0,
+        G_OPTION_ARG_FILENAME, &g_output_file_name,
+      "JSON report file name (default: standard output)", NULL},
+  {NULL,}
+};
+
+/* ------------------------------------------------------------------------ */
+/* --- Configurations                                                   --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  const gchar *name;
+  GstVaapiEncoder *(*create) (GstVaapiDisplay * display);
+} CodecInfo;
+
+static const CodecInfo g_codec_infos[] = {
+  {"h264", gst_vaapi_encoder_h264_new},
+  {"h265", gst_vaapi_encoder_h265_new},
+#if USE_VP9_ENCODER
+  {"vp9", gst_vaapi_encoder_vp9_new},
+#endif
+  {"jpeg", gst_vaapi_encoder_jpeg_new},
+  {"mpeg2", gst_vaapi_encoder_mpeg2_new},
+};
+
+typedef struct
+{
+  const gchar *name;
+  GstVaapiRateControl rate_control;
+} RateControlInfo;
+
+static const RateControlInfo g_rate_control_infos[] = {
+  {"cqp", GST_VAAPI_RATECONTROL_CQP},
+  {"cbr", GST_VAAPI_RATECONTROL_CBR},
+  {"vbr", GST_VAAPI_RATECONTROL_VBR},
+  {"icq", GST_VAAPI_RATECONTROL_ICQ},
+  {"qvbr", GST_VAAPI_RATECONTROL_QVBR},
+};
+
+typedef struct
+{
+  guint width;
+  guint height;
+} Size;
+
+typedef struct
+{
+  GPtrArray *codecs;
+  GArray *sizes;
+  GPtrArray *rate_controls;
+  GArray *bframes;
+} Sweep;
+
+static const CodecInfo *
+find_codec_info (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (g_codec_infos); i++) {
+    if (g_strcmp0 (g_codec_infos[i].name, name) == 0)
+      return &g_codec_infos[i];
+  }
+  return NULL;
+}
+
+static const RateControlInfo *
+find_rate_control_info (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (g_rate_control_infos); i++) {
+    if (g_strcmp0 (g_rate_control_infos[i].name, name) == 0)
+      return &g_rate_control_infos[i];
+  }
+  return NULL;
+}
+
+static gboolean
+sweep_init (Sweep * sweep, guint width, guint height)
+{
+  gchar **tokens, **token;
+  gboolean success = FALSE;
+  Size size;
+  guint bframes;
+
+  sweep->codecs = g_ptr_array_new ();
+  sweep->sizes = g_array_new (FALSE, FALSE, sizeof (Size));
+  sweep->rate_controls = g_ptr_array_new ();
+  sweep->bframes = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  tokens = g_strsplit (g_codecs_str ? g_codecs_str : "h264", ",", -1);
+  for (token = tokens; *token; token++) {
+    const CodecInfo *const info = find_codec_info (g_strstrip (*token));
+    if (!info) {
+      g_message ("unsupported codec '%s'", *token);
+      goto cleanup;
+    }
+    g_ptr_array_add (sweep->codecs, (gpointer) info);
+  }
+  g_strfreev (tokens);
+
+  if (g_sizes_str) {
+    tokens = g_strsplit (g_sizes_str, ",", -1);
+    for (token = tokens; *token; token++) {
+      if (sscanf (*token, "%ux%u", &size.width, &size.height) != 2 ||
+          size.width == 0 || size.height == 0) {
+        g_message ("invalid resolution '%s'", *token);
+        goto cleanup;
+      }
+      g_array_append_val (sweep->sizes, size);
+    }
+    g_strfreev (tokens);
+  } else {
+    size.width = width;
+    size.height = height;
+    g_array_append_val (sweep->sizes, size);
+  }
+
+  tokens = g_strsplit (g_rate_controls_str ? g_rate_controls_str : "cqp",
+      ",", -1);
+  for (token = tokens; *token; token++) {
+    const RateControlInfo *const info =
+        find_rate_control_info (g_strstrip (*token));
+    if (!info) {
+      g_message ("unsupported rate control mode '%s'", *token);
+      goto cleanup;
+    }
+    g_ptr_array_add (sweep->rate_controls, (gpointer) info);
+  }
+  g_strfreev (tokens);
+
+  tokens = g_strsplit (g_bframes_str ? g_bframes_str : "0", ",", -1);
+  for (token = tokens; *token; token++) {
+    if (sscanf (*token, "%u", &bframes) != 1) {
+      g_message ("invalid number of B-frames '%s'", *token);
+      goto cleanup;
+    }
+    g_array_append_val (sweep->bframes, bframes);
+  }
+  success = TRUE;
+
+cleanup:
+  g_strfreev (tokens);
+  return success;
+}
+
+static void
+sweep_finalize (Sweep * sweep)
+{
+  g_ptr_array_unref (sweep->codecs);
+  g_array_unref (sweep->sizes);
+  g_ptr_array_unref (sweep->rate_controls);
+  g_array_unref (sweep->bframes);
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Preloaded input                                                  --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  MappedInput *input;
+  GPtrArray *images;
+  guint width;
+  guint height;
+  gint fps_n;
+  gint fps_d;
+} Source;
+
+static gboolean
+source_load_image (Source * src, guint index, GstVaapiImage * image)
+{
+  gboolean success;
+
+  if (!gst_vaapi_image_map (image))
+    return FALSE;
+  success = mapped_input_load_image (src->input, index, image);
+  if (!gst_vaapi_image_unmap (image))
+    return FALSE;
+  return success;
+}
+
+static gboolean
+source_open (Source * src, GstVaapiDisplay * display, const gchar * file_name)
+{
+  GstVaapiImage *image;
+
+  src->input = mapped_input_open (file_name);
+  if (!src->input || src->input->type != MAPPED_INPUT_Y4M)
+    return FALSE;
+
+  src->width = src->input->width;
+  src->height = src->input->height;
+  src->fps_n = src->input->fps_n;
+  src->fps_d = src->input->fps_d;
+
+  src->images = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      gst_vaapi_image_unref);
+  while (src->images->len < g_num_preload) {
+    image = gst_vaapi_image_new (display, GST_VIDEO_FORMAT_I420,
+        src->width, src->height);
+    if (!image)
+      return FALSE;
+    if (!source_load_image (src, src->images->len, image)) {
+      gst_vaapi_image_unref (image);
+      break;
+    }
+    g_ptr_array_add (src->images, image);
+  }
+  return src->images->len > 0;
+}
+
+static void
+source_close (Source * src)
+{
+  if (src->images) {
+    g_ptr_array_unref (src->images);
+    src->images = NULL;
+  }
+  if (src->input) {
+    mapped_input_close (src->input);
+    src->input = NULL;
+  }
+}
+
+/* Uploads the preloaded frames into surfaces of the requested size,
+   all of it before the measurements start */
+static GPtrArray *
+source_create_inputs (Source * src, GstVaapiDisplay * display,
+    GstVaapiFilter * filter, const Size * size)
+{
+  GstVaapiSurface *surface, *scaled;
+  GPtrArray *inputs;
+  guint i;
+
+  inputs = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      gst_vaapi_surface_proxy_unref);
+
+  for (i = 0; i < src->images->len; i++) {
+    surface = gst_vaapi_surface_new (display, GST_VAAPI_CHROMA_TYPE_YUV420,
+        src->width, src->height);
+    if (!surface)
+      goto error;
+    if (!gst_vaapi_surface_put_image (surface,
+            g_ptr_array_index (src->images, i))) {
+      gst_vaapi_surface_unref (surface);
+      goto error;
+    }
+
+    if (size->width != src->width || size->height != src->height) {
+      scaled = gst_vaapi_surface_new (display, GST_VAAPI_CHROMA_TYPE_YUV420,
+          size->width, size->height);
+      if (!scaled || !filter || gst_vaapi_filter_process (filter, surface,
+              scaled, 0) != GST_VAAPI_FILTER_STATUS_SUCCESS) {
+        if (scaled)
+          gst_vaapi_surface_unref (scaled);
+        gst_vaapi_surface_unref (surface);
+        goto error;
+      }
+      gst_vaapi_surface_unref (surface);
+      surface = scaled;
+    }
+
+    g_ptr_array_add (inputs, gst_vaapi_surface_proxy_new (surface));
+    gst_vaapi_surface_unref (surface);
+  }
+  return inputs;
+
+error:
+  g_ptr_array_unref (inputs);
+  return NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Encoder instances                                                --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  guint id;
+  GstVaapiEncoder *encoder;
+  GPtrArray *inputs;
+  GstClockTime frame_duration;
+  GThread *submit_thread;
+  GThread *collect_thread;
+  gint64 *submit_times;
+  GArray *latencies;
+  gint input_done;
+  guint num_coded;
+  guint num_dropped;
+  guint64 coded_bytes;
+  gdouble codedbuf_usage_sum;
+  gdouble codedbuf_usage_max;
+  gint64 start_time;
+  gdouble elapsed;
+  gboolean failed;
+} Instance;
+
+static GstVideoCodecState *
+new_codec_state (const Size * size, const Source * src)
+{
+  GstVideoCodecState *state;
+
+  state = g_slice_new0 (GstVideoCodecState);
+  state->ref_count = 1;
+  gst_video_info_set_format (&state->info, GST_VIDEO_FORMAT_ENCODED,
+      size->width, size->height);
+  state->info.fps_n = src->fps_n;
+  state->info.fps_d = src->fps_d;
+  return state;
+}
+
+/* Returns FALSE if the configuration is not supported */
+static gboolean
+instance_init (Instance * inst, guint id, GstVaapiDisplay * display,
+    const CodecInfo * codec, const RateControlInfo * rc, guint bframes,
+    const Size * size, const Source * src, GPtrArray * inputs)
+{
+  GstVideoCodecState *state;
+  GstVaapiEncoderStatus status;
+
+  inst->id = id;
+  inst->inputs = g_ptr_array_ref (inputs);
+  inst->submit_times = g_new0 (gint64, g_num_frames);
+  inst->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  inst->frame_duration = src->fps_n > 0 ?
+      gst_util_uint64_scale (GST_SECOND, src->fps_d, src->fps_n) : 0;
+
+  inst->encoder = codec->create (display);
+  if (!inst->encoder)
+    return FALSE;
+
+  if (gst_vaapi_encoder_set_rate_control (inst->encoder, rc->rate_control) !=
+      GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    return FALSE;
+  if (rc->rate_control != GST_VAAPI_RATECONTROL_CQP)
+    gst_vaapi_encoder_set_bitrate (inst->encoder, g_bitrate);
+
+  if (bframes > 0) {
+    if (!g_object_class_find_property (G_OBJECT_GET_CLASS (inst->encoder),
+            "max-bframes"))
+      return FALSE;
+    g_object_set (inst->encoder, "max-bframes", bframes, NULL);
+  }
+
+  state = new_codec_state (size, src);
+  status = gst_vaapi_encoder_set_codec_state (inst->encoder, state);
+  g_slice_free (GstVideoCodecState, state);
+  return status == GST_VAAPI_ENCODER_STATUS_SUCCESS;
+}
+
+static void
+instance_finalize (Instance * inst)
+{
+  gst_vaapi_encoder_replace (&inst->encoder, NULL);
+  if (inst->inputs) {
+    g_ptr_array_unref (inst->inputs);
+    inst->inputs = NULL;
+  }
+  if (inst->latencies) {
+    g_array_unref (inst->latencies);
+    inst->latencies = NULL;
+  }
+  g_free (inst->submit_times);
+  inst->submit_times = NULL;
+}
+
+static gpointer
+instance_submit_thread (gpointer data)
+{
+  Instance *const inst = data;
+  GstVideoCodecFrame *frame;
+  GstVaapiSurfaceProxy *proxy;
+  GstVaapiEncoderStatus status;
+  guint i;
+
+  for (i = 0; i < g_num_frames && !inst->failed; i++) {
+    proxy = g_ptr_array_index (inst->inputs, i % inst->inputs->len);
+
+    frame = g_slice_new0 (GstVideoCodecFrame);
+    frame->ref_count = 1;
+    frame->system_frame_number = i;
+    frame->pts = i * inst->frame_duration;
+    frame->duration = inst->frame_duration;
+    gst_video_codec_frame_set_user_data (frame,
+        gst_vaapi_surface_proxy_ref (proxy),
+        (GDestroyNotify) gst_vaapi_surface_proxy_unref);
+
+    inst->submit_times[i] = g_get_monotonic_time ();
+    status = gst_vaapi_encoder_put_frame (inst->encoder, frame);
+    gst_video_codec_frame_unref (frame);
+    if (status != GST_VAAPI_ENCODER_STATUS_SUCCESS) {
+      inst->failed = TRUE;
+      break;
+    }
+  }
+
+  if (gst_vaapi_encoder_flush (inst->encoder) !=
+      GST_VAAPI_ENCODER_STATUS_SUCCESS)
+    inst->failed = TRUE;
+  g_atomic_int_set (&inst->input_done, TRUE);
+  return NULL;
+}
+
+static void
+instance_account_coded_buffer (Instance * inst,
+    GstVaapiCodedBufferProxy * proxy)
+{
+  GstVideoCodecFrame *const frame =
+      gst_vaapi_coded_buffer_proxy_get_user_data (proxy);
+  const guint codedbuf_size = inst->encoder->codedbuf_size;
+  gint64 latency;
+  gssize size;
+  gdouble usage;
+
+  if (frame && frame->system_frame_number < g_num_frames) {
+    latency = g_get_monotonic_time () -
+        inst->submit_times[frame->system_frame_number];
+    g_array_append_val (inst->latencies, latency);
+  }
+
+  size = gst_vaapi_coded_buffer_get_size (GST_VAAPI_CODED_BUFFER_PROXY_BUFFER
+      (proxy));
+  if (size > 0) {
+    inst->coded_bytes += size;
+    usage = codedbuf_size > 0 ? (gdouble) size / codedbuf_size : 0.0;
+    inst->codedbuf_usage_sum += usage;
+    inst->codedbuf_usage_max = MAX (inst->codedbuf_usage_max, usage);
+  }
+  inst->num_coded++;
+}
+
+static gpointer
+instance_collect_thread (gpointer data)
+{
+  Instance *const inst = data;
+  GstVaapiCodedBufferProxy *proxy;
+  GstVaapiEncoderStatus status;
+  gboolean input_done;
+
+  while (inst->num_coded + inst->num_dropped < g_num_frames) {
+    /* Once everything was submitted, a zero timeout drains the pictures
+       still in flight and then reports the end */
+    input_done = g_atomic_int_get (&inst->input_done);
+
+    proxy = NULL;
+    status = gst_vaapi_encoder_get_buffer_with_timeout (inst->encoder, &proxy,
+        input_done ? 0 : 50000);
+    if (status == GST_VAAPI_ENCODER_STATUS_SUCCESS)
+      instance_account_coded_buffer (inst, proxy);
+    else if (status == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED)
+      inst->num_dropped++;
+    else if (status == GST_VAAPI_ENCODER_STATUS_NO_BUFFER) {
+      if (input_done)
+        break;
+    } else {
+      inst->failed = TRUE;
+      break;
+    }
+    if (proxy)
+      gst_vaapi_coded_buffer_proxy_unref (proxy);
+  }
+
+  inst->elapsed = (g_get_monotonic_time () - inst->start_time) / 1e6;
+  return NULL;
+}
+
+static gboolean
+instance_start (Instance * inst)
+{
+  inst->start_time = g_get_monotonic_time ();
+  inst->collect_thread = g_thread_try_new ("Collect Thread",
+      instance_collect_thread, inst, NULL);
+  if (!inst->collect_thread)
+    return FALSE;
+  inst->submit_thread = g_thread_try_new ("Submit Thread",
+      instance_submit_thread, inst, NULL);
+  if (!inst->submit_thread) {
+    inst->failed = TRUE;
+    g_atomic_int_set (&inst->input_done, TRUE);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+instance_join (Instance * inst)
+{
+  if (inst->submit_thread) {
+    g_thread_join (inst->submit_thread);
+    inst->submit_thread = NULL;
+  }
+  if (inst->collect_thread) {
+    g_thread_join (inst->collect_thread);
+    inst->collect_thread = NULL;
+  }
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- JSON report                                                      --- */
+/* ------------------------------------------------------------------------ */
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  const gint64 va = *(const gint64 *) a;
+  const gint64 vb = *(const gint64 *) b;
+
+  return (va > vb) - (va < vb);
+}
+
+static gdouble
+get_percentile (GArray * sorted, guint percent)
+{
+  if (sorted->len == 0)
+    return 0.0;
+  return g_array_index (sorted, gint64, (sorted->len - 1) * percent / 100) /
+      1000.0;
+}
+
+static void
+json_append_double (GString * json, const gchar * key, gdouble value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* Locale independent, JSON wants a dot as decimal separator */
+  g_string_append_printf (json, "\"%s\": %s", key,
+      g_ascii_formatd (buf, sizeof (buf), "%.3f", value));
+}
+
+static void
+json_append_string (GString * json, const gchar * key, const gchar * value)
+{
+  const gchar *p;
+
+  g_string_append_printf (json, "\"%s\": \"", key);
+  for (p = value; *p; p++) {
+    if (*p == '"' || *p == '\\')
+      g_string_append_c (json, '\\');
+    g_string_append_c (json, *p);
+  }
+  g_string_append_c (json, '"');
+}
+
+static void
+report_config (GString * json, const CodecInfo * codec,
+    const RateControlInfo * rc, guint bframes, const Size * size,
+    const gchar * status, Instance * instances, gdouble cpu_time)
+{
+  GArray *latencies;
+  guint i, total_frames = 0, num_coded = 0;
+  gdouble max_elapsed = 0.0, usage_sum = 0.0, usage_max = 0.0;
+  gdouble latency_sum = 0.0;
+  guint64 coded_bytes = 0;
+
+  latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  g_string_append (json, "    {");
+  json_append_string (json, "codec", codec->name);
+  g_string_append_printf (json, ", \"width\": %u, \"height\": %u, ",
+      size->width, size->height);
+  json_append_string (json, "rate_control", rc->name);
+  g_string_append_printf (json, ", \"bframes\": %u, ", bframes);
+  json_append_string (json, "status", status);
+
+  if (!instances)
+    goto done;
+
+  g_string_append (json, ",\n      \"per_instance\": [");
+  for (i = 0; i < g_num_instances; i++) {
+    Instance *const inst = &instances[i];
+
+    g_string_append_printf (json, "%s{\"frames\": %u, \"dropped\": %u, ",
+        i > 0 ? ", " : "", inst->num_coded, inst->num_dropped);
+    json_append_double (json, "fps",
+        inst->elapsed > 0 ? inst->num_coded / inst->elapsed : 0.0);
+    g_string_append_c (json, '}');
+
+    total_frames += inst->num_coded + inst->num_dropped;
+    num_coded += inst->num_coded;
+    coded_bytes += inst->coded_bytes;
+    usage_sum += inst->codedbuf_usage_sum;
+    usage_max = MAX (usage_max, inst->codedbuf_usage_max);
+    max_elapsed = MAX (max_elapsed, inst->elapsed);
+    g_array_append_vals (latencies, inst->latencies->data,
+        inst->latencies->len);
+  }
+  g_string_append (json, "],\n      ");
+
+  g_array_sort (latencies, compare_latency);
+  for (i = 0; i < latencies->len; i++)
+    latency_sum += g_array_index (latencies, gint64, i) / 1000.0;
+
+  json_append_double (json, "fps",
+      max_elapsed > 0 ? total_frames / max_elapsed : 0.0);
+  g_string_append (json, ", ");
+  json_append_double (json, "cpu_ms_per_frame",
+      total_frames ? cpu_time * 1000.0 / total_frames : 0.0);
+  g_string_append_printf (json, ", \"coded_bytes\": %" G_GUINT64_FORMAT
+      ",\n      \"latency_ms\": {", coded_bytes);
+  json_append_double (json, "mean",
+      latencies->len ? latency_sum / latencies->len : 0.0);
+  g_string_append (json, ", ");
+  json_append_double (json, "p50", get_percentile (latencies, 50));
+  g_string_append (json, ", ");
+  json_append_double (json, "p90", get_percentile (latencies, 90));
+  g_string_append (json, ", ");
+  json_append_double (json, "p99", get_percentile (latencies, 99));
+  g_string_append (json, ", ");
+  json_append_double (json, "max", get_percentile (latencies, 100));
+  g_string_append (json, "},\n      \"codedbuf_utilization\": {");
+  json_append_double (json, "mean", num_coded ? usage_sum / num_coded : 0.0);
+  g_string_append (json, ", ");
+  json_append_double (json, "max", usage_max);
+  g_string_append_c (json, '}');
+
+done:
+  g_string_append (json, "}");
+  g_array_unref (latencies);
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Application                                                      --- */
+/* ------------------------------------------------------------------------ */
+
+static gdouble
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/* Runs all the instances for one configuration and appends its
+   results to @json */
+static void
+run_config (GString * json, GstVaapiDisplay * display, const Source * src,
+    GPtrArray * inputs, const CodecInfo * codec, const RateControlInfo * rc,
+    guint bframes, const Size * size)
+{
+  Instance *instances;
+  const gchar *status = "ok";
+  gdouble cpu_time;
+  guint i;
+
+  instances = g_new0 (Instance, g_num_instances);
+  for (i = 0; i < g_num_instances; i++) {
+    if (!instance_init (&instances[i], i, display, codec, rc, bframes, size,
+            src, inputs)) {
+      report_config (json, codec, rc, bframes, size, "unsupported", NULL,
+          0.0);
+      goto cleanup;
+    }
+  }
+
+  cpu_time = get_cpu_time ();
+  for (i = 0; i < g_num_instances; i++) {
+    if (!instance_start (&instances[i]))
+      g_message ("failed to start encoder instance #%u", i);
+  }
+  for (i = 0; i < g_num_instances; i++) {
+    instance_join (&instances[i]);
+    if (instances[i].failed)
+      status = "error";
+  }
+  cpu_time = get_cpu_time () - cpu_time;
+
+  report_config (json, codec, rc, bframes, size, status, instances, cpu_time);
+
+cleanup:
+  for (i = 0; i < g_num_instances; i++)
+    instance_finalize (&instances[i]);
+  g_free (instances);
+}
+
+static gboolean
+app_run (const gchar * file_name)
+{
+  Source src = { NULL, };
+  Sweep sweep;
+  GstVaapiDisplay *display;
+  GstVaapiFilter *filter = NULL;
+  GPtrArray *inputs;
+  GString *json;
+  guint c, s, r, b, num_results = 0;
+  gboolean success = FALSE;
+
+  display = video_output_create_display (NULL);
+  if (!display) {
+    g_message ("failed to create VA display");
+    return FALSE;
+  }
+
+  if (!source_open (&src, display, file_name)) {
+    g_message ("failed to preload Y4M file '%s'", file_name);
+    goto cleanup_source;
+  }
+  if (!sweep_init (&sweep, src.width, src.height))
+    goto cleanup_sweep;
+  filter = gst_vaapi_filter_new (display);
+
+  json = g_string_new ("{\n  ");
+  json_append_string (json, "input", file_name);
+  g_string_append_printf (json, ",\n  \"input_width\": %u, "
+      "\"input_height\": %u, \"preloaded_frames\": %u,\n"
+      "  \"instances\": %u, \"frames\": %u,\n  \"results\": [\n",
+      src.width, src.height, src.images->len, g_num_instances, g_num_frames);
+
+  for (s = 0; s < sweep.sizes->len; s++) {
+    const Size *const size = &g_array_index (sweep.sizes, Size, s);
+
+    inputs = source_create_inputs (&src, display, filter, size);
+    if (!inputs) {
+      g_message ("failed to upload input frames at %ux%u", size->width,
+          size->height);
+      continue;
+    }
+
+    for (c = 0; c < sweep.codecs->len; c++) {
+      for (r = 0; r < sweep.rate_controls->len; r++) {
+        for (b = 0; b < sweep.bframes->len; b++) {
+          if (num_results++ > 0)
+            g_string_append (json, ",\n");
+          run_config (json, display, &src, inputs,
+              g_ptr_array_index (sweep.codecs, c),
+              g_ptr_array_index (sweep.rate_controls, r),
+              g_array_index (sweep.bframes, guint, b), size);
+        }
+      }
+    }
+    g_ptr_array_unref (inputs);
+  }
+  g_string_append (json, "\n  ]\n}\n");
+
+  if (g_output_file_name) {
+    GError *error = NULL;
+
+    success = g_file_set_contents (g_output_file_name, json->str, json->len,
+        &error);
+    if (!success) {
+      g_message ("failed to write report: %s", error->message);
+      g_error_free (error);
+    }
+  } else {
+    g_print ("%s", json->str);
+    success = TRUE;
+  }
+  g_string_free (json, TRUE);
+
+  gst_vaapi_filter_replace (&filter, NULL);
+cleanup_sweep:
+  sweep_finalize (&sweep);
+cleanup_source:
+  source_close (&src);
+  gst_vaapi_display_replace (&display, NULL);
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint ret;
+
+  if (!video_output_init (&argc, argv, g_options))
+    g_error ("failed to initialize video output subsystem");
+
+  if (argc < 2) {
+    g_message ("no Y4M file specified");
+    ret = 1;
+  } else if (g_num_instances == 0 || g_num_frames == 0 || g_num_preload == 0) {
+    g_message ("invalid number of instances, frames or preloaded frames");
+    ret = 1;
+  } else
+    ret = !app_run (argv[1]);
+
+  g_free (g_codecs_str);
+  g_free (g_sizes_str);
+  g_free (g_rate_controls_str);
+  g_free (g_bframes_str);
+  g_free (g_output_file_name);
+  video_output_exit ();
+  return ret;
+}
@@ -0,0 +1,598 @@
+/*
+ *  bench-filter.c - Video processing benchmark
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This application measures gst_vaapi_filter_process() for each VPP
+ * operation (scaling methods, color conversions, deinterlacing methods,
+ * denoising, sharpening, HDR tone mapping and cropping) at several
+ * resolutions. Every case runs twice: once with the pipeline buffer
+ * kept across frames and once with one buffer per frame, see
+ * GST_VAAPI_DISABLE_VPP_BUFFER_REUSE. The results are written out as
+ * JSON: pipelined throughput, CPU time per frame and the latency of
+ * synchronous frames.
+ */
+
+#include "gst/vaapi/sysdeps.h"
+#include <sys/resource.h>
+#include <gst/vaapi/gstvaapifilter.h>
+#include <gst/vaapi/gstvaapisurface.h>
+#include "image.h"
+#include "output.h"
+
+#define NUM_SOURCES 4
+#define NUM_TARGETS 4
+
+static gchar *g_sizes_str;
+static gchar *g_ops_str;
+static guint g_num_frames = 300;
+static gchar *g_output_file_name;
+
+static GOptionEntry g_options[] = {
+  {"sizes", 's',
+        0,
+        G_OPTION_ARG_STRING, &g_sizes_str,
+      "comma separated list of WIDTHxHEIGHT source resolutions", NULL},
+  {"ops", 'O',
+        0,
+        G_OPTION_ARG_STRING, &g_ops_str,
+      "comma separated list of operations (default: all)", NULL},
+  {"frames", 'f',
+        0,
+        G_OPTION_ARG_INT, &g_num_frames,
+      "number of frames processed per measurement", NULL},
+  {"output", 'o',
+        0,
+        G_OPTION_ARG_FILENAME, &g_output_file_name,
+      "JSON report file name (default: standard output)", NULL},
+  {NULL,}
+};
+
+/* ------------------------------------------------------------------------ */
+/* --- Operations                                                       --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  guint width;
+  guint height;
+} Size;
+
+typedef struct _FilterCase FilterCase;
+struct _FilterCase
+{
+  const gchar *name;
+  GstVideoFormat src_format;
+  GstVideoFormat dst_format;
+  /* the output is the source size divided by this */
+  guint downscale;
+  /* number of past frames used as deinterlacing references */
+  guint num_references;
+  gboolean (*setup) (GstVaapiFilter * filter, const FilterCase * fc,
+      const Size * size);
+  gint arg;
+};
+
+static gboolean
+setup_scaling (GstVaapiFilter * filter, const FilterCase * fc,
+    const Size * size)
+{
+  return gst_vaapi_filter_set_scaling (filter, fc->arg);
+}
+
+static gboolean
+setup_deinterlacing (GstVaapiFilter * filter, const FilterCase * fc,
+    const Size * size)
+{
+  return gst_vaapi_filter_set_deinterlacing (filter, fc->arg,
+      GST_VAAPI_DEINTERLACE_FLAG_TFF);
+}
+
+static gboolean
+setup_denoising (GstVaapiFilter * filter, const FilterCase * fc,
+    const Size * size)
+{
+  return gst_vaapi_filter_set_denoising_level (filter, 0.5);
+}
+
+static gboolean
+setup_sharpening (GstVaapiFilter * filter, const FilterCase * fc,
+    const Size * size)
+{
+  return gst_vaapi_filter_set_sharpening_level (filter, 0.5);
+}
+
+static gboolean
+setup_hdr_tone_map (GstVaapiFilter * filter, const FilterCase * fc,
+    const Size * size)
+{
+  GstVideoMasteringDisplayInfo minfo;
+  GstVideoContentLightLevel linfo;
+
+  /* BT.2020 primaries and D65 white point, 1000 nits mastering */
+  gst_video_mastering_display_info_init (&minfo);
+  minfo.display_primaries[0].x = 8500;
+  minfo.display_primaries[0].y = 39850;
+  minfo.display_primaries[1].x = 6550;
+  minfo.display_primaries[1].y = 2300;
+  minfo.display_primaries[2].x = 35400;
+  minfo.display_primaries[2].y = 14600;
+  minfo.white_point.x = 15635;
+  minfo.white_point.y = 16450;
+  minfo.max_display_mastering_luminance = 10000000;
+  minfo.min_display_mastering_luminance = 50;
+
+  gst_video_content_light_level_init (&linfo);
+  linfo.max_content_light_level = 1000;
+  linfo.max_frame_average_light_level = 400;
+
+  return gst_vaapi_filter_set_hdr_tone_map (filter, TRUE) &&
+      gst_vaapi_filter_set_hdr_tone_map_meta (filter, &minfo, &linfo);
+}
+
+static gboolean
+setup_cropping (GstVaapiFilter * filter, const FilterCase * fc,
+    const Size * size)
+{
+  GstVaapiRectangle rect;
+
+  rect.x = size->width / 4;
+  rect.y = size->height / 4;
+  rect.width = size->width / 2;
+  rect.height = size->height / 2;
+  return gst_vaapi_filter_set_cropping_rectangle (filter, &rect);
+}
+
+static const FilterCase g_filter_cases[] = {
+  {"scale-default", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 2, 0,
+      setup_scaling, GST_VAAPI_SCALE_METHOD_DEFAULT},
+  {"scale-fast", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 2, 0,
+      setup_scaling, GST_VAAPI_SCALE_METHOD_FAST},
+  {"scale-hq", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 2, 0,
+      setup_scaling, GST_VAAPI_SCALE_METHOD_HQ},
+  {"csc-nv12-bgra", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_BGRA, 1, 0,
+      NULL, 0},
+  {"csc-nv12-yuy2", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_YUY2, 1, 0,
+      NULL, 0},
+  {"csc-i420-nv12", GST_VIDEO_FORMAT_I420, GST_VIDEO_FORMAT_NV12, 1, 0,
+      NULL, 0},
+  {"csc-p010-nv12", GST_VIDEO_FORMAT_P010_10LE, GST_VIDEO_FORMAT_NV12, 1, 0,
+      NULL, 0},
+  {"deinterlace-bob", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 1, 0,
+      setup_deinterlacing, GST_VAAPI_DEINTERLACE_METHOD_BOB},
+  {"deinterlace-weave", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 1, 0,
+      setup_deinterlacing, GST_VAAPI_DEINTERLACE_METHOD_WEAVE},
+  {"deinterlace-motion-adaptive", GST_VIDEO_FORMAT_NV12,
+        GST_VIDEO_FORMAT_NV12, 1, 1,
+      setup_deinterlacing, GST_VAAPI_DEINTERLACE_METHOD_MOTION_ADAPTIVE},
+  {"deinterlace-motion-compensated", GST_VIDEO_FORMAT_NV12,
+        GST_VIDEO_FORMAT_NV12, 1, 1,
+      setup_deinterlacing, GST_VAAPI_DEINTERLACE_METHOD_MOTION_COMPENSATED},
+  {"denoise", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 1, 0,
+      setup_denoising, 0},
+  {"sharpen", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 1, 0,
+      setup_sharpening, 0},
+  {"hdr-tone-map", GST_VIDEO_FORMAT_P010_10LE, GST_VIDEO_FORMAT_NV12, 1, 0,
+      setup_hdr_tone_map, 0},
+  {"crop", GST_VIDEO_FORMAT_NV12, GST_VIDEO_FORMAT_NV12, 1, 0,
+      setup_cropping, 0},
+};
+
+static const FilterCase *
+find_filter_case (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (g_filter_cases); i++) {
+    if (g_strcmp0 (g_filter_cases[i].name, name) == 0)
+      return &g_filter_cases[i];
+  }
+  return NULL;
+}
+
+static gboolean
+parse_sizes (GArray * sizes)
+{
+  gchar **tokens, **token;
+  gboolean success = TRUE;
+  Size size;
+
+  tokens = g_strsplit (g_sizes_str ? g_sizes_str :
+      "1280x720,1920x1080,3840x2160", ",", -1);
+  for (token = tokens; *token; token++) {
+    if (sscanf (*token, "%ux%u", &size.width, &size.height) != 2 ||
+        size.width < 16 || size.height < 16) {
+      g_message ("invalid resolution '%s'", *token);
+      success = FALSE;
+      break;
+    }
+    g_array_append_val (sizes, size);
+  }
+  g_strfreev (tokens);
+  return success;
+}
+
+static gboolean
+parse_ops (GPtrArray * cases)
+{
+  gchar **tokens, **token;
+  gboolean success = TRUE;
+  guint i;
+
+  if (!g_ops_str) {
+    for (i = 0; i < G_N_ELEMENTS (g_filter_cases); i++)
+      g_ptr_array_add (cases, (gpointer) & g_filter_cases[i]);
+    return TRUE;
+  }
+
+  tokens = g_strsplit (g_ops_str, ",", -1);
+  for (token = tokens; *token; token++) {
+    const FilterCase *const fc = find_filter_case (g_strstrip (*token));
+    if (!fc) {
+      g_message ("unknown operation '%s'", *token);
+      success = FALSE;
+      break;
+    }
+    g_ptr_array_add (cases, (gpointer) fc);
+  }
+  g_strfreev (tokens);
+  return success;
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Measurements                                                     --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  const FilterCase *fc;
+  Size src_size;
+  Size dst_size;
+  gboolean reuse;
+  const gchar *status;
+  gdouble fps;
+  gdouble cpu_time;
+  GArray *latencies;
+} Result;
+
+static gdouble
+get_cpu_time (void)
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+      usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void
+surfaces_clear (GstVaapiSurface ** surfaces, guint num_surfaces)
+{
+  guint i;
+
+  for (i = 0; i < num_surfaces; i++) {
+    if (surfaces[i])
+      gst_vaapi_surface_unref (surfaces[i]);
+    surfaces[i] = NULL;
+  }
+}
+
+static gboolean
+create_sources (GstVaapiDisplay * display, const FilterCase * fc,
+    const Size * size, GstVaapiSurface ** surfaces)
+{
+  GstVaapiImage *image;
+  gboolean success;
+  guint i;
+
+  image = image_generate (display, fc->src_format, size->width, size->height);
+  if (!image)
+    return FALSE;
+
+  for (i = 0, success = TRUE; success && i < NUM_SOURCES; i++) {
+    surfaces[i] = gst_vaapi_surface_new_with_format (display, fc->src_format,
+        size->width, size->height, 0);
+    success = surfaces[i] && image_upload (image, surfaces[i]);
+  }
+  gst_vaapi_image_unref (image);
+  return success;
+}
+
+static gboolean
+create_targets (GstVaapiDisplay * display, const FilterCase * fc,
+    const Size * size, GstVaapiSurface ** surfaces)
+{
+  guint i;
+
+  for (i = 0; i < NUM_TARGETS; i++) {
+    surfaces[i] = gst_vaapi_surface_new_with_format (display, fc->dst_format,
+        size->width, size->height, 0);
+    if (!surfaces[i])
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+process_frame (GstVaapiFilter * filter, const FilterCase * fc,
+    GstVaapiSurface ** sources, GstVaapiSurface * target, guint index)
+{
+  GstVaapiSurface *reference;
+
+  if (fc->num_references > 0) {
+    reference = sources[(index + NUM_SOURCES - 1) % NUM_SOURCES];
+    if (!gst_vaapi_filter_set_deinterlacing_references (filter, &reference,
+            1, NULL, 0))
+      return FALSE;
+  }
+  return gst_vaapi_filter_process (filter, sources[index % NUM_SOURCES],
+      target, 0) == GST_VAAPI_FILTER_STATUS_SUCCESS;
+}
+
+static void
+run_case (Result * result, GstVaapiDisplay * display,
+    GstVaapiSurface ** sources, GstVaapiSurface ** targets)
+{
+  const FilterCase *const fc = result->fc;
+  GstVaapiFilter *filter = NULL;
+  gint64 start_time, latency;
+  gdouble cpu_time;
+  guint i;
+
+  /* The filter picks the pipeline buffer policy when created */
+  if (result->reuse)
+    g_unsetenv ("GST_VAAPI_DISABLE_VPP_BUFFER_REUSE");
+  else
+    g_setenv ("GST_VAAPI_DISABLE_VPP_BUFFER_REUSE", "1", TRUE);
+
+  result->status = "unsupported";
+  filter = gst_vaapi_filter_new (display);
+  if (!filter)
+    goto done;
+  if (!gst_vaapi_filter_set_format (filter, fc->dst_format))
+    goto done;
+  if (fc->setup && !fc->setup (filter, fc, &result->src_size))
+    goto done;
+
+  /* Warm up, so that the VA context and buffers are set up */
+  if (!process_frame (filter, fc, sources, targets[0], 0) ||
+      !gst_vaapi_surface_sync (targets[0]))
+    goto done;
+
+  /* Throughput, with a few frames in flight */
+  result->status = "error";
+  cpu_time = get_cpu_time ();
+  start_time = g_get_monotonic_time ();
+  for (i = 0; i < g_num_frames; i++) {
+    GstVaapiSurface *const target = targets[i % NUM_TARGETS];
+
+    if (i >= NUM_TARGETS && !gst_vaapi_surface_sync (target))
+      goto done;
+    if (!process_frame (filter, fc, sources, target, i))
+      goto done;
+  }
+  for (i = 0; i < NUM_TARGETS; i++) {
+    if (!gst_vaapi_surface_sync (targets[i]))
+      goto done;
+  }
+  latency = g_get_monotonic_time () - start_time;
+  result->cpu_time = get_cpu_time () - cpu_time;
+  result->fps = latency > 0 ? g_num_frames * 1e6 / latency : 0.0;
+
+  /* Latency, one frame at a time */
+  for (i = 0; i < g_num_frames; i++) {
+    GstVaapiSurface *const target = targets[i % NUM_TARGETS];
+
+    start_time = g_get_monotonic_time ();
+    if (!process_frame (filter, fc, sources, target, i) ||
+        !gst_vaapi_surface_sync (target))
+      goto done;
+    latency = g_get_monotonic_time () - start_time;
+    g_array_append_val (result->latencies, latency);
+  }
+  result->status = "ok";
+
+done:
+  gst_vaapi_filter_replace (&filter, NULL);
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- JSON report                                                      --- */
+/* ------------------------------------------------------------------------ */
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  const gint64 va = *(const gint64 *) a;
+  const gint64 vb = *(const gint64 *) b;
+
+  return (va > vb) - (va < vb);
+}
+
+static gdouble
+get_percentile (GArray * sorted, guint percent)
+{
+  if (sorted->len == 0)
+    return 0.0;
+  return g_array_index (sorted, gint64, (sorted->len - 1) * percent / 100) /
+      1000.0;
+}
+
+static void
+json_append_double (GString * json, const gchar * key, gdouble value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* Locale independent, JSON wants a dot as decimal separator */
+  g_string_append_printf (json, "\"%s\": %s", key,
+      g_ascii_formatd (buf, sizeof (buf), "%.3f", value));
+}
+
+static void
+report_result (GString * json, Result * result)
+{
+  const FilterCase *const fc = result->fc;
+  gdouble latency_sum = 0.0;
+  guint i;
+
+  g_string_append_printf (json, "    {\"op\": \"%s\", \"src_format\": \"%s\", "
+      "\"dst_format\": \"%s\",\n      \"src_width\": %u, \"src_height\": %u, "
+      "\"dst_width\": %u, \"dst_height\": %u, \"pipeline_buffer\": \"%s\", "
+      "\"status\": \"%s\"", fc->name,
+      gst_video_format_to_string (fc->src_format),
+      gst_video_format_to_string (fc->dst_format),
+      result->src_size.width, result->src_size.height,
+      result->dst_size.width, result->dst_size.height,
+      result->reuse ? "reuse" : "rebuild", result->status);
+
+  if (g_strcmp0 (result->status, "ok") != 0)
+    goto done;
+
+  g_array_sort (result->latencies, compare_latency);
+  for (i = 0; i < result->latencies->len; i++)
+    latency_sum += g_array_index (result->latencies, gint64, i) / 1000.0;
+
+  g_string_append (json, ",\n      ");
+  json_append_double (json, "fps", result->fps);
+  g_string_append (json, ", ");
+  json_append_double (json, "cpu_us_per_frame",
+      result->cpu_time * 1e6 / g_num_frames);
+  g_string_append (json, ",\n      \"latency_ms\": {");
+  json_append_double (json, "mean", result->latencies->len ?
+      latency_sum / result->latencies->len : 0.0);
+  g_string_append (json, ", ");
+  json_append_double (json, "p50", get_percentile (result->latencies, 50));
+  g_string_append (json, ", ");
+  json_append_double (json, "p99", get_percentile (result->latencies, 99));
+  g_string_append (json, ", ");
+  json_append_double (json, "max", get_percentile (result->latencies, 100));
+  g_string_append_c (json, '}');
+
+done:
+  g_string_append_c (json, '}');
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Application                                                      --- */
+/* ------------------------------------------------------------------------ */
+
+static gboolean
+app_run (void)
+{
+  GstVaapiSurface *sources[NUM_SOURCES] = { NULL, };
+  GstVaapiSurface *targets[NUM_TARGETS] = { NULL, };
+  GstVaapiDisplay *display;
+  GArray *sizes;
+  GPtrArray *cases;
+  GString *json;
+  Result result;
+  guint c, s, m, num_results = 0;
+  gboolean success = FALSE;
+
+  sizes = g_array_new (FALSE, FALSE, sizeof (Size));
+  cases = g_ptr_array_new ();
+  if (!parse_sizes (sizes) || !parse_ops (cases))
+    goto cleanup;
+
+  display = video_output_create_display (NULL);
+  if (!display) {
+    g_message ("failed to create VA display");
+    goto cleanup;
+  }
+
+  json = g_string_new (NULL);
+  g_string_append_printf (json, "{\n  \"frames\": %u,\n  \"results\": [\n",
+      g_num_frames);
+
+  for (c = 0; c < cases->len; c++) {
+    const FilterCase *const fc = g_ptr_array_index (cases, c);
+
+    for (s = 0; s < sizes->len; s++) {
+      memset (&result, 0, sizeof (result));
+      result.fc = fc;
+      result.src_size = g_array_index (sizes, Size, s);
+      result.dst_size.width = result.src_size.width / fc->downscale;
+      result.dst_size.height = result.src_size.height / fc->downscale;
+
+      if (!create_sources (display, fc, &result.src_size, sources) ||
+          !create_targets (display, fc, &result.dst_size, targets)) {
+        result.status = "unsupported";
+        if (num_results++ > 0)
+          g_string_append (json, ",\n");
+        report_result (json, &result);
+      } else {
+        for (m = 0; m < 2; m++) {
+          result.reuse = m == 0;
+          result.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+          run_case (&result, display, sources, targets);
+          if (num_results++ > 0)
+            g_string_append (json, ",\n");
+          report_result (json, &result);
+          g_array_unref (result.latencies);
+        }
+      }
+      surfaces_clear (sources, NUM_SOURCES);
+      surfaces_clear (targets, NUM_TARGETS);
+    }
+  }
+  g_string_append (json, "\n  ]\n}\n");
+  g_unsetenv ("GST_VAAPI_DISABLE_VPP_BUFFER_REUSE");
+
+  if (g_output_file_name) {
+    GError *error = NULL;
+
+    success = g_file_set_contents (g_output_file_name, json->str, json->len,
+        &error);
+    if (!success) {
+      g_message ("failed to write report: %s", error->message);
+      g_error_free (error);
+    }
+  } else {
+    g_print ("%s", json->str);
+    success = TRUE;
+  }
+  g_string_free (json, TRUE);
+  gst_vaapi_display_replace (&display, NULL);
+
+cleanup:
+  g_ptr_array_unref (cases);
+  g_array_unref (sizes);
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint ret;
+
+  if (!video_output_init (&argc, argv, g_options))
+    g_error ("failed to initialize video output subsystem");
+
+  if (g_num_frames == 0) {
+    g_message ("invalid number of frames");
+    ret = 1;
+  } else
+    ret = !app_run ();
+
+  g_free (g_sizes_str);
+  g_free (g_ops_str);
+  g_free (g_output_file_name);
+  video_output_exit ();
+  return ret;
+}
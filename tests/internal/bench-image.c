@@ -0,0 +1,509 @@
+/*
+ *  bench-image.c - Image upload and download benchmark
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This application measures the ways pixels move between VA surfaces
+ * and system memory, per format and resolution:
+ *
+ * - the native formats path of the video memory, i.e. vaGetImage() or
+ *   vaPutImage() plus a copy between the VA image and system memory
+ *   with gst_vaapi_image_get_raw() or gst_vaapi_image_update_from_raw();
+ * - the direct rendering and direct uploading paths, i.e. the same
+ *   copies on an image derived from the surface, either derived for
+ *   every frame or kept mapped across frames;
+ * - gst_vaapi_image_update_from_buffer() from a GstBuffer.
+ *
+ * The results are written out as JSON, with the time per frame and
+ * the resulting bandwidth.
+ */
+
+#include "gst/vaapi/sysdeps.h"
+#include <gst/vaapi/gstvaapiimage.h>
+#include <gst/vaapi/gstvaapiimage_priv.h>
+#include <gst/vaapi/gstvaapisurface.h>
+#include "output.h"
+
+static gchar *g_formats_str;
+static gchar *g_sizes_str;
+static guint g_num_frames = 100;
+static gchar *g_output_file_name;
+
+static GOptionEntry g_options[] = {
+  {"formats", 'F',
+        0,
+        G_OPTION_ARG_STRING, &g_formats_str,
+      "comma separated list of formats (default: NV12,P010_10LE,I420,YUY2,"
+        "RGBA)", NULL},
+  {"sizes", 's',
+        0,
+        G_OPTION_ARG_STRING, &g_sizes_str,
+      "comma separated list of WIDTHxHEIGHT resolutions", NULL},
+  {"frames", 'f',
+        0,
+        G_OPTION_ARG_INT, &g_num_frames,
+      "number of frames transferred per measurement", NULL},
+  {"output", 'o',
+        0,
+        G_OPTION_ARG_FILENAME, &g_output_file_name,
+      "JSON report file name (default: standard output)", NULL},
+  {NULL,}
+};
+
+typedef struct
+{
+  guint width;
+  guint height;
+} Size;
+
+/* ------------------------------------------------------------------------ */
+/* --- System memory frames                                             --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  GstVideoInfo info;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  GstVaapiImageRaw raw;
+} SysFrame;
+
+static gboolean
+sys_frame_init (SysFrame * frame, GstVideoFormat format, guint width,
+    guint height)
+{
+  guint i;
+
+  if (!gst_video_info_set_format (&frame->info, format, width, height))
+    return FALSE;
+
+  frame->buffer = gst_buffer_new_allocate (NULL,
+      GST_VIDEO_INFO_SIZE (&frame->info), NULL);
+  if (!frame->buffer)
+    return FALSE;
+  gst_buffer_add_video_meta_full (frame->buffer, GST_VIDEO_FRAME_FLAG_NONE,
+      format, width, height, GST_VIDEO_INFO_N_PLANES (&frame->info),
+      frame->info.offset, frame->info.stride);
+
+  if (!gst_buffer_map (frame->buffer, &frame->map, GST_MAP_READWRITE))
+    return FALSE;
+  memset (frame->map.data, 0x80, frame->map.size);
+
+  frame->raw.format = format;
+  frame->raw.width = width;
+  frame->raw.height = height;
+  frame->raw.num_planes = MIN (GST_VIDEO_INFO_N_PLANES (&frame->info), 3);
+  for (i = 0; i < frame->raw.num_planes; i++) {
+    frame->raw.pixels[i] = frame->map.data +
+        GST_VIDEO_INFO_PLANE_OFFSET (&frame->info, i);
+    frame->raw.stride[i] = GST_VIDEO_INFO_PLANE_STRIDE (&frame->info, i);
+  }
+  return TRUE;
+}
+
+static void
+sys_frame_clear (SysFrame * frame)
+{
+  if (!frame->buffer)
+    return;
+  if (frame->map.data)
+    gst_buffer_unmap (frame->buffer, &frame->map);
+  gst_buffer_replace (&frame->buffer, NULL);
+  memset (&frame->map, 0, sizeof (frame->map));
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Transfer modes                                                   --- */
+/* ------------------------------------------------------------------------ */
+
+typedef struct
+{
+  GstVaapiDisplay *display;
+  GstVaapiSurface *surface;
+  /* image as allocated by vaCreateImage(), the native formats path */
+  GstVaapiImage *image;
+  SysFrame image_frame;
+  /* image derived from the surface, the direct paths */
+  GstVaapiImage *derived_image;
+  SysFrame derived_frame;
+} Context;
+
+typedef gboolean (*TransferFunc) (Context * ctx);
+
+typedef struct
+{
+  const gchar *name;
+  const gchar *direction;
+  TransferFunc func;
+} TransferMode;
+
+static gboolean
+transfer_get_image (Context * ctx)
+{
+  return gst_vaapi_surface_get_image (ctx->surface, ctx->image);
+}
+
+static gboolean
+transfer_get_image_raw (Context * ctx)
+{
+  return gst_vaapi_surface_get_image (ctx->surface, ctx->image) &&
+      gst_vaapi_image_get_raw (ctx->image, &ctx->image_frame.raw, NULL);
+}
+
+static gboolean
+transfer_derive_get_raw (Context * ctx)
+{
+  GstVaapiImage *image;
+  gboolean success;
+
+  image = gst_vaapi_surface_derive_image (ctx->surface);
+  if (!image)
+    return FALSE;
+  success = gst_vaapi_image_get_raw (image, &ctx->derived_frame.raw, NULL);
+  gst_vaapi_image_unref (image);
+  return success;
+}
+
+static gboolean
+transfer_derived_get_raw (Context * ctx)
+{
+  return gst_vaapi_image_get_raw (ctx->derived_image,
+      &ctx->derived_frame.raw, NULL);
+}
+
+static gboolean
+transfer_update_raw_put_image (Context * ctx)
+{
+  return gst_vaapi_image_update_from_raw (ctx->image,
+      &ctx->image_frame.raw, NULL) &&
+      gst_vaapi_surface_put_image (ctx->surface, ctx->image);
+}
+
+static gboolean
+transfer_derive_update_raw (Context * ctx)
+{
+  GstVaapiImage *image;
+  gboolean success;
+
+  image = gst_vaapi_surface_derive_image (ctx->surface);
+  if (!image)
+    return FALSE;
+  success = gst_vaapi_image_update_from_raw (image, &ctx->derived_frame.raw,
+      NULL);
+  gst_vaapi_image_unref (image);
+  return success;
+}
+
+static gboolean
+transfer_derived_update_raw (Context * ctx)
+{
+  return gst_vaapi_image_update_from_raw (ctx->derived_image,
+      &ctx->derived_frame.raw, NULL);
+}
+
+static gboolean
+transfer_update_buffer_put_image (Context * ctx)
+{
+  return gst_vaapi_image_update_from_buffer (ctx->image,
+      ctx->image_frame.buffer, NULL) &&
+      gst_vaapi_surface_put_image (ctx->surface, ctx->image);
+}
+
+static const TransferMode g_transfer_modes[] = {
+  {"get-image", "download", transfer_get_image},
+  {"get-image+get-raw", "download", transfer_get_image_raw},
+  {"derive+get-raw", "download", transfer_derive_get_raw},
+  {"derived+get-raw", "download", transfer_derived_get_raw},
+  {"update-raw+put-image", "upload", transfer_update_raw_put_image},
+  {"derive+update-raw", "upload", transfer_derive_update_raw},
+  {"derived+update-raw", "upload", transfer_derived_update_raw},
+  {"update-buffer+put-image", "upload", transfer_update_buffer_put_image},
+};
+
+static void
+context_clear (Context * ctx)
+{
+  sys_frame_clear (&ctx->image_frame);
+  sys_frame_clear (&ctx->derived_frame);
+  if (ctx->derived_image) {
+    gst_vaapi_image_unref (ctx->derived_image);
+    ctx->derived_image = NULL;
+  }
+  if (ctx->image) {
+    gst_vaapi_image_unref (ctx->image);
+    ctx->image = NULL;
+  }
+  if (ctx->surface) {
+    gst_vaapi_surface_unref (ctx->surface);
+    ctx->surface = NULL;
+  }
+}
+
+/* Returns FALSE if the display has no surface of that format. Either
+   image may be missing, then the modes that use it are unsupported */
+static gboolean
+context_init (Context * ctx, GstVaapiDisplay * display,
+    GstVideoFormat format, const Size * size)
+{
+  guint width, height;
+
+  memset (ctx, 0, sizeof (*ctx));
+  ctx->display = display;
+  ctx->surface = gst_vaapi_surface_new_with_format (display, format,
+      size->width, size->height, 0);
+  if (!ctx->surface)
+    return FALSE;
+
+  ctx->image = gst_vaapi_image_new (display, format, size->width,
+      size->height);
+  if (ctx->image && !sys_frame_init (&ctx->image_frame, format, size->width,
+          size->height))
+    gst_mini_object_replace ((GstMiniObject **) & ctx->image, NULL);
+
+  /* Derived images may be larger than the surface, e.g. for alignment,
+     so their system memory frame follows their size */
+  ctx->derived_image = gst_vaapi_surface_derive_image (ctx->surface);
+  if (ctx->derived_image) {
+    gst_vaapi_image_get_size (ctx->derived_image, &width, &height);
+    if (gst_vaapi_image_get_format (ctx->derived_image) != format ||
+        !sys_frame_init (&ctx->derived_frame, format, width, height))
+      gst_mini_object_replace ((GstMiniObject **) & ctx->derived_image, NULL);
+  }
+  return TRUE;
+}
+
+static gboolean
+context_supports (Context * ctx, const TransferMode * mode)
+{
+  if (mode->func == transfer_get_image ||
+      mode->func == transfer_get_image_raw ||
+      mode->func == transfer_update_raw_put_image ||
+      mode->func == transfer_update_buffer_put_image)
+    return ctx->image != NULL;
+  return ctx->derived_image != NULL;
+}
+
+/* ------------------------------------------------------------------------ */
+/* --- Measurements and report                                          --- */
+/* ------------------------------------------------------------------------ */
+
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  const gint64 va = *(const gint64 *) a;
+  const gint64 vb = *(const gint64 *) b;
+
+  return (va > vb) - (va < vb);
+}
+
+static gdouble
+get_percentile (GArray * sorted, guint percent)
+{
+  if (sorted->len == 0)
+    return 0.0;
+  return g_array_index (sorted, gint64, (sorted->len - 1) * percent / 100) /
+      1000.0;
+}
+
+static void
+json_append_double (GString * json, const gchar * key, gdouble value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* Locale independent, JSON wants a dot as decimal separator */
+  g_string_append_printf (json, "\"%s\": %s", key,
+      g_ascii_formatd (buf, sizeof (buf), "%.3f", value));
+}
+
+static void
+run_mode (GString * json, Context * ctx, const TransferMode * mode,
+    GstVideoFormat format, const Size * size)
+{
+  GArray *times;
+  GstVideoInfo info;
+  const gchar *status = "unsupported";
+  gint64 start_time, elapsed;
+  gdouble total_ms = 0.0;
+  guint i;
+
+  times = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  if (context_supports (ctx, mode)) {
+    /* Warm up, the first transfer may allocate and map */
+    status = mode->func (ctx) ? "ok" : "unsupported";
+    for (i = 0; i < g_num_frames && g_strcmp0 (status, "ok") == 0; i++) {
+      start_time = g_get_monotonic_time ();
+      if (!mode->func (ctx)) {
+        status = "error";
+        break;
+      }
+      elapsed = g_get_monotonic_time () - start_time;
+      g_array_append_val (times, elapsed);
+      total_ms += elapsed / 1000.0;
+    }
+  }
+
+  g_string_append_printf (json, "    {\"format\": \"%s\", \"width\": %u, "
+      "\"height\": %u, \"mode\": \"%s\", \"direction\": \"%s\", "
+      "\"status\": \"%s\"", gst_video_format_to_string (format),
+      size->width, size->height, mode->name, mode->direction, status);
+
+  if (g_strcmp0 (status, "ok") == 0 && times->len > 0) {
+    /* Bandwidth counts the visible pixels only */
+    gst_video_info_set_format (&info, format, size->width, size->height);
+
+    g_array_sort (times, compare_latency);
+    g_string_append (json, ",\n      ");
+    json_append_double (json, "mean_ms", total_ms / times->len);
+    g_string_append (json, ", ");
+    json_append_double (json, "p50_ms", get_percentile (times, 50));
+    g_string_append (json, ", ");
+    json_append_double (json, "p99_ms", get_percentile (times, 99));
+    g_string_append (json, ", ");
+    json_append_double (json, "mb_per_s", total_ms > 0 ?
+        GST_VIDEO_INFO_SIZE (&info) * times->len / (total_ms * 1000.0) :
+        0.0);
+  }
+  g_string_append_c (json, '}');
+  g_array_unref (times);
+}
+
+static gboolean
+parse_list (const gchar * str, GArray * formats, GArray * sizes)
+{
+  gchar **tokens, **token;
+  gboolean success = TRUE;
+  GstVideoFormat format;
+  Size size;
+
+  tokens = g_strsplit (str, ",", -1);
+  for (token = tokens; success && *token; token++) {
+    g_strstrip (*token);
+    if (formats) {
+      format = gst_video_format_from_string (*token);
+      if (format == GST_VIDEO_FORMAT_UNKNOWN)
+        success = FALSE;
+      else
+        g_array_append_val (formats, format);
+    } else {
+      if (sscanf (*token, "%ux%u", &size.width, &size.height) != 2 ||
+          size.width == 0 || size.height == 0)
+        success = FALSE;
+      else
+        g_array_append_val (sizes, size);
+    }
+    if (!success)
+      g_message ("invalid value '%s'", *token);
+  }
+  g_strfreev (tokens);
+  return success;
+}
+
+static gboolean
+app_run (void)
+{
+  GstVaapiDisplay *display = NULL;
+  GArray *formats, *sizes;
+  GString *json = NULL;
+  Context ctx;
+  guint f, s, m, num_results = 0;
+  gboolean success = FALSE;
+
+  formats = g_array_new (FALSE, FALSE, sizeof (GstVideoFormat));
+  sizes = g_array_new (FALSE, FALSE, sizeof (Size));
+  if (!parse_list (g_formats_str ? g_formats_str :
+          "NV12,P010_10LE,I420,YUY2,RGBA", formats, NULL) ||
+      !parse_list (g_sizes_str ? g_sizes_str : "1280x720,1920x1080,3840x2160",
+          NULL, sizes))
+    goto cleanup;
+
+  display = video_output_create_display (NULL);
+  if (!display) {
+    g_message ("failed to create VA display");
+    goto cleanup;
+  }
+
+  json = g_string_new (NULL);
+  g_string_append_printf (json, "{\n  \"frames\": %u,\n  \"results\": [\n",
+      g_num_frames);
+
+  for (f = 0; f < formats->len; f++) {
+    const GstVideoFormat format = g_array_index (formats, GstVideoFormat, f);
+
+    for (s = 0; s < sizes->len; s++) {
+      const Size *const size = &g_array_index (sizes, Size, s);
+
+      if (!context_init (&ctx, display, format, size)) {
+        g_message ("no %s surface of size %ux%u",
+            gst_video_format_to_string (format), size->width, size->height);
+        context_clear (&ctx);
+        continue;
+      }
+      for (m = 0; m < G_N_ELEMENTS (g_transfer_modes); m++) {
+        if (num_results++ > 0)
+          g_string_append (json, ",\n");
+        run_mode (json, &ctx, &g_transfer_modes[m], format, size);
+      }
+      context_clear (&ctx);
+    }
+  }
+  g_string_append (json, "\n  ]\n}\n");
+
+  if (g_output_file_name) {
+    GError *error = NULL;
+
+    success = g_file_set_contents (g_output_file_name, json->str, json->len,
+        &error);
+    if (!success) {
+      g_message ("failed to write report: %s", error->message);
+      g_error_free (error);
+    }
+  } else {
+    g_print ("%s", json->str);
+    success = TRUE;
+  }
+
+cleanup:
+  if (json)
+    g_string_free (json, TRUE);
+  gst_vaapi_display_replace (&display, NULL);
+  g_array_unref (formats);
+  g_array_unref (sizes);
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint ret;
+
+  if (!video_output_init (&argc, argv, g_options))
+    g_error ("failed to initialize video output subsystem");
+
+  if (g_num_frames == 0) {
+    g_message ("invalid number of frames");
+    ret = 1;
+  } else
+    ret = !app_run ();
+
+  g_free (g_formats_str);
+  g_free (g_sizes_str);
+  g_free (g_output_file_name);
+  video_output_exit ();
+  return ret;
+}
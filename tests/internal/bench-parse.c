@@ -0,0 +1,482 @@
+/*
+ *  bench-parse.c - Bitstream parser benchmark
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This application only runs gst_vaapi_decoder_parse() over a raw
+ * bitstream, the way the decoder element does on its streaming
+ * thread, and drops the parsed frames instead of decoding them, so no
+ * VA context is ever created. It reports the parse throughput, then
+ * the parse cost per byte by unit size and per unit by number of units
+ * in the frame: a cost that grows along either axis points at a
+ * superlinear parser, e.g. with huge SEI messages or many slices. The
+ * slowest units are listed with their offset in the stream, so that
+ * they can be extracted.
+ *
+ * VP8 and VP9 streams are expected in IVF container. Their parsers
+ * only delimit frames, the headers being parsed at decode time.
+ */
+
+#include "gst/vaapi/sysdeps.h"
+#include <gst/base/gstadapter.h>
+#include <gst/vaapi/gstvaapidecoder.h>
+#include <gst/vaapi/gstvaapidecoder_h264.h>
+#include <gst/vaapi/gstvaapidecoder_h265.h>
+#include <gst/vaapi/gstvaapidecoder_jpeg.h>
+#include <gst/vaapi/gstvaapidecoder_mpeg2.h>
+#include <gst/vaapi/gstvaapidecoder_mpeg4.h>
+#include <gst/vaapi/gstvaapidecoder_vc1.h>
+#include <gst/vaapi/gstvaapidecoder_vp8.h>
+#include <gst/vaapi/gstvaapidecoder_vp9.h>
+#include "codec.h"
+#include "output.h"
+
+#define IVF_FILE_HEADER_SIZE    32
+#define IVF_FRAME_HEADER_SIZE   12
+
+/* Buckets are indexed by the log2 of the unit size, or of the number
+   of units in the frame */
+#define NUM_BUCKETS             32
+
+/* Ratio between the costs of two buckets beyond which parsing is
+   reported as superlinear */
+#define SUPERLINEAR_RATIO       4.0
+
+/* Buckets need that many samples to be compared */
+#define MIN_BUCKET_SAMPLES      16
+
+static gchar *g_codec_str;
+static guint g_num_loops = 1;
+static guint g_chunk_size = 4096;
+static guint g_num_slowest = 10;
+
+static GOptionEntry g_options[] = {
+  {"codec", 'c',
+        0,
+        G_OPTION_ARG_STRING, &g_codec_str,
+      "suggested codec", NULL},
+  {"loops", 'l',
+        0,
+        G_OPTION_ARG_INT, &g_num_loops,
+      "number of times the stream is parsed", NULL},
+  {"chunk-size", 0,
+        0,
+        G_OPTION_ARG_INT, &g_chunk_size,
+      "size of the input buffers for raw bitstreams (default: 4096)", NULL},
+  {"slowest", 0,
+        0,
+        G_OPTION_ARG_INT, &g_num_slowest,
+      "number of slowest units to list (default: 10)", NULL},
+  {NULL,}
+};
+
+typedef struct
+{
+  guint64 count;
+  guint64 size;
+  gint64 time;
+} Bucket;
+
+typedef struct
+{
+  gint64 time;
+  gsize offset;
+  guint size;
+} SlowUnit;
+
+typedef struct
+{
+  const guint8 *data;
+  gsize size;
+  gboolean is_ivf;
+  GstVaapiCodec codec;
+  GstVaapiDecoder *decoder;
+
+  /* Totals, in bytes and us */
+  guint64 num_bytes;
+  guint64 num_units;
+  guint64 num_frames;
+  guint64 num_errors;
+  gint64 parse_time;
+
+  Bucket unit_buckets[NUM_BUCKETS];
+  Bucket frame_buckets[NUM_BUCKETS];
+  /* sorted by decreasing time */
+  GArray *slowest;
+} Bench;
+
+static guint
+bucket_index (guint64 value)
+{
+  guint i = 0;
+
+  while (value > 1 && i < NUM_BUCKETS - 1) {
+    value >>= 1;
+    i++;
+  }
+  return i;
+}
+
+static void
+bench_add_unit (Bench * bench, gsize offset, guint size, gint64 time)
+{
+  Bucket *const bucket = &bench->unit_buckets[bucket_index (size)];
+  SlowUnit unit;
+  guint i;
+
+  bucket->count++;
+  bucket->size += size;
+  bucket->time += time;
+
+  for (i = 0; i < bench->slowest->len; i++) {
+    if (time > g_array_index (bench->slowest, SlowUnit, i).time)
+      break;
+  }
+  if (i >= g_num_slowest)
+    return;
+
+  unit.time = time;
+  unit.offset = offset;
+  unit.size = size;
+  g_array_insert_val (bench->slowest, i, unit);
+  if (bench->slowest->len > g_num_slowest)
+    g_array_set_size (bench->slowest, g_num_slowest);
+}
+
+static void
+bench_add_frame (Bench * bench, guint num_units, gint64 time)
+{
+  Bucket *const bucket = &bench->frame_buckets[bucket_index (num_units)];
+
+  bucket->count++;
+  bucket->size += num_units;
+  bucket->time += time;
+}
+
+static GstVaapiDecoder *
+bench_create_decoder (Bench * bench, GstVaapiDisplay * display)
+{
+  GstVaapiDecoder *decoder;
+  GstCaps *caps;
+
+  caps = caps_from_codec (bench->codec);
+  if (!caps)
+    return NULL;
+
+  switch (bench->codec) {
+    case GST_VAAPI_CODEC_H264:
+      decoder = gst_vaapi_decoder_h264_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_H265:
+      decoder = gst_vaapi_decoder_h265_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_JPEG:
+      decoder = gst_vaapi_decoder_jpeg_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_MPEG2:
+      decoder = gst_vaapi_decoder_mpeg2_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_MPEG4:
+      decoder = gst_vaapi_decoder_mpeg4_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_VC1:
+      decoder = gst_vaapi_decoder_vc1_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_VP8:
+      decoder = gst_vaapi_decoder_vp8_new (display, caps);
+      break;
+    case GST_VAAPI_CODEC_VP9:
+      decoder = gst_vaapi_decoder_vp9_new (display, caps);
+      break;
+    default:
+      decoder = NULL;
+      break;
+  }
+  gst_caps_unref (caps);
+  return decoder;
+}
+
+/* Returns the size of the next input buffer at *offset, i.e. a whole
+   frame for IVF files, and moves *offset to its data. Returns 0 at the
+   end of the stream */
+static gsize
+bench_next_chunk (Bench * bench, gsize * offset)
+{
+  gsize size;
+
+  if (bench->is_ivf) {
+    if (*offset + IVF_FRAME_HEADER_SIZE > bench->size)
+      return 0;
+    size = GST_READ_UINT32_LE (bench->data + *offset);
+    *offset += IVF_FRAME_HEADER_SIZE;
+    if (*offset + size > bench->size)
+      return 0;
+    return size;
+  }
+  return MIN (g_chunk_size, bench->size - *offset);
+}
+
+static GstVideoCodecFrame *
+codec_frame_new (void)
+{
+  GstVideoCodecFrame *frame;
+
+  /* Same as what the decoder allocates for its own parsing */
+  frame = g_slice_new0 (GstVideoCodecFrame);
+  frame->ref_count = 1;
+  return frame;
+}
+
+/* Parses the whole stream once, in the way decode_step() does, except
+   that frames are dropped instead of decoded */
+static gboolean
+bench_parse_stream (Bench * bench)
+{
+  GstAdapter *const adapter = gst_adapter_new ();
+  GstVideoCodecFrame *frame = NULL;
+  GstVaapiDecoderStatus status;
+  gsize offset, chunk_size, unit_offset;
+  guint unit_size, frame_units = 0;
+  gboolean got_frame, at_eos = FALSE;
+  gint64 start, time, frame_time = 0;
+
+  offset = bench->is_ivf ? IVF_FILE_HEADER_SIZE : 0;
+  unit_offset = offset;
+
+  while (!at_eos) {
+    chunk_size = bench_next_chunk (bench, &offset);
+    if (chunk_size > 0) {
+      gst_adapter_push (adapter,
+          gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+              (gpointer) bench->data, bench->size, offset, chunk_size, NULL,
+              NULL));
+      if (bench->is_ivf)
+        unit_offset = offset;
+      offset += chunk_size;
+    } else
+      at_eos = TRUE;
+
+    /* At the end of the stream, the last frame may still be pending */
+    while (gst_adapter_available (adapter) > 0 || (at_eos && frame)) {
+      if (!frame)
+        frame = codec_frame_new ();
+
+      start = g_get_monotonic_time ();
+      status = gst_vaapi_decoder_parse (bench->decoder, frame, adapter,
+          at_eos, &unit_size, &got_frame);
+      time = g_get_monotonic_time () - start;
+      bench->parse_time += time;
+
+      if (status == GST_VAAPI_DECODER_STATUS_ERROR_NO_DATA)
+        break;
+      if (status != GST_VAAPI_DECODER_STATUS_SUCCESS) {
+        /* Resynchronize on the next input buffer */
+        bench->num_errors++;
+        unit_offset += gst_adapter_available (adapter);
+        gst_adapter_clear (adapter);
+        g_clear_pointer (&frame, gst_video_codec_frame_unref);
+        frame_units = 0;
+        frame_time = 0;
+        break;
+      }
+
+      frame_time += time;
+      if (unit_size > 0) {
+        bench_add_unit (bench, unit_offset, unit_size, time);
+        gst_adapter_flush (adapter, unit_size);
+        unit_offset += unit_size;
+        bench->num_bytes += unit_size;
+        bench->num_units++;
+        frame_units++;
+      }
+
+      if (got_frame) {
+        bench_add_frame (bench, frame_units, frame_time);
+        bench->num_frames++;
+        g_clear_pointer (&frame, gst_video_codec_frame_unref);
+        frame_units = 0;
+        frame_time = 0;
+      }
+    }
+  }
+
+  if (frame)
+    gst_video_codec_frame_unref (frame);
+  g_object_unref (adapter);
+  return gst_vaapi_decoder_reset (bench->decoder) ==
+      GST_VAAPI_DECODER_STATUS_SUCCESS;
+}
+
+/* Prints the buckets with enough samples, and returns the ratio of the
+   highest cost to the lowest one. Costs are in ns per byte or unit */
+static gdouble
+report_buckets (const Bucket * buckets, const gchar * label,
+    const gchar * unit)
+{
+  gdouble cost, min_cost = 0.0, max_cost = 0.0;
+  guint i;
+
+  for (i = 0; i < NUM_BUCKETS; i++) {
+    const Bucket *const b = &buckets[i];
+
+    if (b->count == 0)
+      continue;
+    cost = b->size > 0 ? b->time * 1000.0 / b->size : 0.0;
+    g_print ("  %s %10" G_GUINT64_FORMAT "-%-10" G_GUINT64_FORMAT
+        " %10" G_GUINT64_FORMAT " samples  %10.2f ns/%s\n", label,
+        G_GUINT64_CONSTANT (1) << i, (G_GUINT64_CONSTANT (2) << i) - 1,
+        b->count, cost, unit);
+
+    if (b->count < MIN_BUCKET_SAMPLES || cost == 0.0)
+      continue;
+    if (min_cost == 0.0 || cost < min_cost)
+      min_cost = cost;
+    max_cost = MAX (max_cost, cost);
+  }
+  return min_cost > 0.0 ? max_cost / min_cost : 1.0;
+}
+
+static void
+bench_report (Bench * bench, gdouble elapsed)
+{
+  const gdouble parse_sec = bench->parse_time / 1000000.0;
+  gdouble ratio;
+  guint i;
+
+  g_print ("Parsed %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT
+      " units, %.2f MB in %.2f sec (%.2f sec parsing)\n", bench->num_frames,
+      bench->num_units, bench->num_bytes / 1000000.0, elapsed, parse_sec);
+  if (parse_sec > 0)
+    g_print ("Throughput: %.2f MB/s, %.0f units/s, %.0f frames/s\n",
+        bench->num_bytes / 1000000.0 / parse_sec,
+        bench->num_units / parse_sec, bench->num_frames / parse_sec);
+  if (bench->num_errors > 0)
+    g_print ("Parse errors: %" G_GUINT64_FORMAT "\n", bench->num_errors);
+
+  g_print ("Cost by unit size (bytes):\n");
+  ratio = report_buckets (bench->unit_buckets, "size", "byte");
+  if (ratio > SUPERLINEAR_RATIO)
+    g_print ("warning: the cost per byte grows %.1fx with the unit size\n",
+        ratio);
+
+  g_print ("Cost by frame size (units):\n");
+  ratio = report_buckets (bench->frame_buckets, "units", "unit");
+  if (ratio > SUPERLINEAR_RATIO)
+    g_print ("warning: the cost per unit grows %.1fx with the number of "
+        "units per frame\n", ratio);
+
+  if (bench->slowest->len > 0)
+    g_print ("Slowest units:\n");
+  for (i = 0; i < bench->slowest->len; i++) {
+    const SlowUnit *const u = &g_array_index (bench->slowest, SlowUnit, i);
+
+    g_print ("  %8.3f ms  offset %10" G_GSIZE_FORMAT "  size %8u\n",
+        u->time / 1000.0, u->offset, u->size);
+  }
+}
+
+static gboolean
+app_run (const gchar * file_name)
+{
+  Bench bench = { NULL, };
+  GMappedFile *file;
+  GstVaapiDisplay *display = NULL;
+  GTimer *timer;
+  guint i;
+  gboolean success = FALSE;
+
+  file = g_mapped_file_new (file_name, FALSE, NULL);
+  if (!file) {
+    g_message ("failed to open bitstream '%s'", file_name);
+    return FALSE;
+  }
+  bench.data = (const guint8 *) g_mapped_file_get_contents (file);
+  bench.size = g_mapped_file_get_length (file);
+
+  bench.is_ivf = bench.size >= IVF_FILE_HEADER_SIZE &&
+      memcmp (bench.data, "DKIF", 4) == 0;
+  if (bench.is_ivf && memcmp (bench.data + 8, "VP80", 4) == 0)
+    bench.codec = GST_VAAPI_CODEC_VP8;
+  else if (bench.is_ivf && memcmp (bench.data + 8, "VP90", 4) == 0)
+    bench.codec = GST_VAAPI_CODEC_VP9;
+  else
+    bench.codec = identify_codec (file_name);
+  if (!bench.codec)
+    bench.codec = identify_codec_from_string (g_codec_str);
+  if (!bench.codec) {
+    g_message ("failed to identify codec for '%s'", file_name);
+    goto cleanup;
+  }
+
+  g_print ("Parser benchmark (%s bitstream)\n",
+      string_from_codec (bench.codec));
+
+  /* The decoders need a display, but parsing never touches it */
+  display = video_output_create_display (NULL);
+  if (!display) {
+    g_message ("failed to create VA display");
+    goto cleanup;
+  }
+
+  bench.decoder = bench_create_decoder (&bench, display);
+  if (!bench.decoder) {
+    g_message ("failed to create %s decoder", string_from_codec (bench.codec));
+    goto cleanup;
+  }
+  bench.slowest = g_array_new (FALSE, FALSE, sizeof (SlowUnit));
+
+  timer = g_timer_new ();
+  for (i = 0; i < g_num_loops; i++) {
+    if (!bench_parse_stream (&bench))
+      break;
+  }
+  g_timer_stop (timer);
+  bench_report (&bench, g_timer_elapsed (timer, NULL));
+  g_timer_destroy (timer);
+  success = TRUE;
+
+cleanup:
+  if (bench.slowest)
+    g_array_unref (bench.slowest);
+  gst_vaapi_decoder_replace (&bench.decoder, NULL);
+  gst_vaapi_display_replace (&display, NULL);
+  g_mapped_file_unref (file);
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint ret;
+
+  if (!video_output_init (&argc, argv, g_options))
+    g_error ("failed to initialize video output subsystem");
+
+  if (argc < 2) {
+    g_message ("no bitstream file specified");
+    ret = 1;
+  } else if (g_num_loops == 0 || g_chunk_size == 0) {
+    g_message ("invalid number of loops or chunk size");
+    ret = 1;
+  } else
+    ret = !app_run (argv[1]);
+
+  g_free (g_codec_str);
+  video_output_exit ();
+  return ret;
+}
@@ -0,0 +1,325 @@
+/*
+ *  mappedinput.c - Memory-mapped, indexed test input
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/* The whole file is mapped and its frames are indexed once, so that the
+ * benchmarks looping over a stream neither read nor copy it: the frames
+ * are served as read-only buffers wrapping the mapping. Annex-B streams
+ * are indexed by NAL unit, IVF and Y4M files by frame. */
+
+#include "gst/vaapi/sysdeps.h"
+#include "mappedinput.h"
+
+#define IVF_FILE_HEADER_SIZE    32
+#define IVF_FRAME_HEADER_SIZE   12
+
+typedef struct
+{
+  gsize offset;
+  gsize size;
+} MappedFrame;
+
+static void
+index_add (MappedInput * input, gsize offset, gsize size)
+{
+  const MappedFrame frame = { offset, size };
+
+  g_array_append_val (input->index, frame);
+}
+
+/* Finds the next 00 00 01 start code from @offset, and returns the
+   offset of its first byte, or the size of the input if none */
+static gsize
+find_start_code (MappedInput * input, gsize offset)
+{
+  const guint8 *const data = input->data;
+
+  for (; offset + 3 <= input->size; offset++) {
+    if (data[offset + 2] > 1)
+      offset += 2;
+    else if (data[offset] == 0 && data[offset + 1] == 0 &&
+        data[offset + 2] == 1)
+      return offset;
+  }
+  return input->size;
+}
+
+static gboolean
+index_annexb (MappedInput * input)
+{
+  gsize start, next;
+
+  start = find_start_code (input, 0);
+  while (start < input->size) {
+    next = find_start_code (input, start + 3);
+    /* A zero byte before a start code belongs to the next NAL unit */
+    if (next < input->size && input->data[next - 1] == 0)
+      next--;
+    index_add (input, start, next - start);
+    start = next;
+  }
+  return input->index->len > 0;
+}
+
+static gboolean
+index_ivf (MappedInput * input)
+{
+  gsize offset, size;
+
+  input->fourcc = GST_READ_UINT32_LE (input->data + 8);
+  offset = GST_READ_UINT16_LE (input->data + 6);
+  if (offset < IVF_FILE_HEADER_SIZE)
+    offset = IVF_FILE_HEADER_SIZE;
+
+  while (offset + IVF_FRAME_HEADER_SIZE <= input->size) {
+    size = GST_READ_UINT32_LE (input->data + offset);
+    offset += IVF_FRAME_HEADER_SIZE;
+    if (size == 0 || offset + size > input->size)
+      break;
+    index_add (input, offset, size);
+    offset += size;
+  }
+  return input->index->len > 0;
+}
+
+/* Returns the offset past the line starting at @offset, or 0 if the
+   line is not terminated */
+static gsize
+skip_line (MappedInput * input, gsize offset)
+{
+  const guint8 *const eol = memchr (input->data + offset, '\n',
+      input->size - offset);
+
+  return eol ? eol - input->data + 1 : 0;
+}
+
+/* format documentation:
+ * http://wiki.multimedia.cx/index.php?title=YUV4MPEG2 */
+static gboolean
+parse_y4m_header (MappedInput * input, gsize header_size)
+{
+  gchar *header, **tokens;
+  gboolean success = TRUE;
+  guint num, den, i;
+
+  input->fps_n = 30;
+  input->fps_d = 1;
+
+  header = g_strndup ((const gchar *) input->data, header_size - 1);
+  tokens = g_strsplit (header, " ", -1);
+  for (i = 1; tokens[i] && success; i++) {
+    const gchar *const value = tokens[i] + 1;
+
+    switch (tokens[i][0]) {
+      case 'W':
+        input->width = strtoul (value, NULL, 10);
+        break;
+      case 'H':
+        input->height = strtoul (value, NULL, 10);
+        break;
+      case 'F':
+        if (sscanf (value, "%u:%u", &num, &den) == 2 && num > 0 && den > 0) {
+          input->fps_n = num;
+          input->fps_d = den;
+        }
+        break;
+      case 'C':
+        success = strncmp (value, "420", 3) == 0;
+        if (!success)
+          g_warning ("Unsupported chroma subsampling.");
+        break;
+      case 'I':
+        success = *value == 'p' || *value == '?';
+        if (!success)
+          g_warning ("Interlaced content are not supported.");
+        break;
+      default:
+        break;
+    }
+  }
+  g_strfreev (tokens);
+  g_free (header);
+  return success && input->width > 0 && input->height > 0;
+}
+
+static gboolean
+index_y4m (MappedInput * input)
+{
+  gsize offset, frame_size;
+
+  offset = skip_line (input, 0);
+  if (!offset || !parse_y4m_header (input, offset))
+    return FALSE;
+
+  frame_size = (gsize) input->width * input->height * 3 / 2;
+  while (offset + 5 <= input->size &&
+      memcmp (input->data + offset, "FRAME", 5) == 0) {
+    offset = skip_line (input, offset);
+    if (!offset || offset + frame_size > input->size)
+      break;
+    index_add (input, offset, frame_size);
+    offset += frame_size;
+  }
+  return input->index->len > 0;
+}
+
+/**
+ * mapped_input_open:
+ * @filename: the Y4M, IVF or Annex-B file to open
+ *
+ * Maps @filename and indexes its frames. The type of file is told from
+ * its signature, the files without Y4M or IVF signature are taken as
+ * Annex-B byte streams.
+ *
+ * Return value: the new #MappedInput, or %NULL if @filename can't be
+ *   mapped or has no frame
+ */
+MappedInput *
+mapped_input_open (const gchar * filename)
+{
+  MappedInput *input;
+  gboolean success;
+
+  g_return_val_if_fail (filename != NULL, NULL);
+
+  input = g_slice_new0 (MappedInput);
+  input->index = g_array_new (FALSE, FALSE, sizeof (MappedFrame));
+  input->file = g_mapped_file_new (filename, FALSE, NULL);
+  if (!input->file)
+    goto error;
+  input->size = g_mapped_file_get_length (input->file);
+  input->data = (const guint8 *) g_mapped_file_get_contents (input->file);
+  if (!input->data)
+    goto error;
+
+  if (input->size >= 9 && memcmp (input->data, "YUV4MPEG2", 9) == 0) {
+    input->type = MAPPED_INPUT_Y4M;
+    success = index_y4m (input);
+  } else if (input->size >= IVF_FILE_HEADER_SIZE &&
+      memcmp (input->data, "DKIF", 4) == 0) {
+    input->type = MAPPED_INPUT_IVF;
+    success = index_ivf (input);
+  } else {
+    input->type = MAPPED_INPUT_ANNEXB;
+    success = index_annexb (input);
+  }
+  if (!success)
+    goto error;
+  return input;
+
+error:
+  g_warning ("failed to open or index file %s", filename);
+  mapped_input_close (input);
+  return NULL;
+}
+
+void
+mapped_input_close (MappedInput * input)
+{
+  g_return_if_fail (input);
+
+  if (input->file)
+    g_mapped_file_unref (input->file);
+  g_array_unref (input->index);
+  g_slice_free (MappedInput, input);
+}
+
+guint
+mapped_input_get_num_frames (MappedInput * input)
+{
+  g_return_val_if_fail (input, 0);
+
+  return input->index->len;
+}
+
+/**
+ * mapped_input_get_frame:
+ * @input: a #MappedInput
+ * @index: the index of the frame
+ *
+ * Return value: a read-only #GstBuffer wrapping the mapped data of the
+ *   frame, which holds the mapping alive, or %NULL past the last frame
+ */
+GstBuffer *
+mapped_input_get_frame (MappedInput * input, guint index)
+{
+  const MappedFrame *frame;
+
+  g_return_val_if_fail (input, NULL);
+
+  if (index >= input->index->len)
+    return NULL;
+
+  frame = &g_array_index (input->index, MappedFrame, index);
+  return gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      (gpointer) input->data, input->size, frame->offset, frame->size,
+      g_mapped_file_ref (input->file), (GDestroyNotify) g_mapped_file_unref);
+}
+
+static void
+copy_plane (GstVaapiImage * image, guint plane, const guint8 * src,
+    guint width, guint height)
+{
+  guint8 *dst = gst_vaapi_image_get_plane (image, plane);
+  const guint stride = gst_vaapi_image_get_pitch (image, plane);
+  guint i;
+
+  for (i = 0; i < height; i++) {
+    memcpy (dst, src, width);
+    dst += stride;
+    src += width;
+  }
+}
+
+/**
+ * mapped_input_load_image:
+ * @input: a Y4M #MappedInput
+ * @index: the index of the frame
+ * @image: a mapped I420 #GstVaapiImage of the size of the frames
+ *
+ * Copies the frame @index straight from the mapping into @image.
+ *
+ * Return value: %TRUE on success
+ */
+gboolean
+mapped_input_load_image (MappedInput * input, guint index,
+    GstVaapiImage * image)
+{
+  const MappedFrame *frame;
+  const guint8 *data;
+  const guint luma_size = input->width * input->height;
+
+  g_return_val_if_fail (gst_vaapi_image_is_mapped (image), FALSE);
+  g_return_val_if_fail (input->type == MAPPED_INPUT_Y4M, FALSE);
+
+  if (index >= input->index->len)
+    return FALSE;
+  if (gst_vaapi_image_get_data_size (image) < luma_size * 3 / 2)
+    return FALSE;
+  if (gst_vaapi_image_get_plane_count (image) != 3)
+    return FALSE;
+
+  frame = &g_array_index (input->index, MappedFrame, index);
+  data = input->data + frame->offset;
+  copy_plane (image, 0, data, input->width, input->height);
+  copy_plane (image, 1, data + luma_size, input->width / 2,
+      input->height / 2);
+  copy_plane (image, 2, data + luma_size * 5 / 4, input->width / 2,
+      input->height / 2);
+  return TRUE;
+}
@@ -0,0 +1,71 @@
+/*
+ *  mappedinput.h - Memory-mapped, indexed test input
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+#ifndef MAPPED_INPUT_H
+#define MAPPED_INPUT_H
+
+#include <gst/gst.h>
+#include <gst/vaapi/gstvaapiimage.h>
+
+typedef enum
+{
+  MAPPED_INPUT_ANNEXB = 1,
+  MAPPED_INPUT_IVF,
+  MAPPED_INPUT_Y4M,
+} MappedInputType;
+
+typedef struct _MappedInput MappedInput;
+
+struct _MappedInput
+{
+  GMappedFile *file;
+  const guint8 *data;
+  gsize size;
+  MappedInputType type;
+  /* offset and size of each frame, i.e. of each NAL unit for Annex-B
+     streams, built when the file is opened */
+  GArray *index;
+
+  /* IVF only */
+  guint32 fourcc;
+
+  /* Y4M only, the frames are I420 */
+  guint width;
+  guint height;
+  gint fps_n;
+  gint fps_d;
+};
+
+MappedInput *
+mapped_input_open (const gchar * filename);
+
+void
+mapped_input_close (MappedInput * input);
+
+guint
+mapped_input_get_num_frames (MappedInput * input);
+
+GstBuffer *
+mapped_input_get_frame (MappedInput * input, guint index);
+
+gboolean
+mapped_input_load_image (MappedInput * input, guint index,
+    GstVaapiImage * image);
+
+#endif /* MAPPED_INPUT_H */
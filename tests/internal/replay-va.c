@@ -0,0 +1,579 @@
+/*
+ *  replay-va.c - VA call record replay
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free
+ *  Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ *  Boston, MA 02110-1301 USA
+ */
+
+/*
+ * This application resubmits the VA calls recorded by a pipeline run
+ * with GST_VAAPI_VA_RECORD=<file>, straight to the driver, and compares
+ * the time each kind of call took at recording time and at replay time.
+ * A slowdown that reproduces here lies in the driver, one that does not
+ * lies in GStreamer or in the plugins.
+ *
+ * The configs, contexts, surfaces, buffers and images are created
+ * again, and their IDs are mapped in the call arguments. IDs embedded
+ * in the buffer contents, e.g. reference surfaces or coded buffers,
+ * are submitted as they were recorded: this relies on the driver
+ * handing out the same IDs in a fresh process, and the IDs that came
+ * out differently are reported. Video processing pictures are not
+ * submitted since their parameters hold pointers.
+ */
+
+#include "gst/vaapi/sysdeps.h"
+#include <gst/vaapi/gstvaapidisplay.h>
+#include <gst/vaapi/gstvaapivarecord.h>
+#include "output.h"
+
+typedef struct
+{
+  guint count;
+  guint skipped;
+  guint failed;
+  GstClockTime recorded;
+  GstClockTime replayed;
+} CallStats;
+
+static const gchar *const g_call_names[] = {
+  NULL,
+  "vaCreateConfig",
+  "vaDestroyConfig",
+  "vaCreateSurfaces",
+  "vaDestroySurfaces",
+  "vaCreateContext",
+  "vaDestroyContext",
+  "vaCreateBuffer",
+  "vaDestroyBuffer",
+  "vaMapBuffer",
+  "vaUnmapBuffer",
+  "vaBeginPicture",
+  "vaRenderPicture",
+  "vaEndPicture",
+  "vaSyncSurface",
+  "vaDeriveImage",
+  "vaDestroyImage",
+  "buffer data",
+};
+
+#define NUM_CALLS G_N_ELEMENTS (g_call_names)
+
+typedef struct
+{
+  GstVaapiDisplay *display;
+  VADisplay va_display;
+  /* recorded ID -> replayed ID */
+  GHashTable *configs;
+  GHashTable *contexts;
+  GHashTable *surfaces;
+  GHashTable *buffers;
+  GHashTable *images;
+  /* replayed IDs of the video processing configs and contexts */
+  GHashTable *vpp_configs;
+  GHashTable *vpp_contexts;
+} ReplayDisplay;
+
+typedef struct
+{
+  GPtrArray *displays;
+  CallStats stats[NUM_CALLS];
+  guint id_drift;
+  GstClockTime recorded_end;
+} Replay;
+
+typedef struct
+{
+  GstVaapiVaRecordHeader header;
+  guint32 *args;
+  guint8 *data;
+} Record;
+
+static GHashTable *
+id_map_new (void)
+{
+  return g_hash_table_new (g_direct_hash, g_direct_equal);
+}
+
+/* VA IDs start from 0, hence the lookup of the key rather than its
+   value */
+static gboolean
+id_map_lookup (GHashTable * map, guint32 id, guint32 * out_id)
+{
+  gpointer value;
+
+  if (!g_hash_table_lookup_extended (map, GUINT_TO_POINTER (id), NULL,
+          &value))
+    return FALSE;
+  *out_id = GPOINTER_TO_UINT (value);
+  return TRUE;
+}
+
+static void
+id_map_insert (Replay * replay, GHashTable * map, guint32 id,
+    guint32 new_id)
+{
+  g_hash_table_insert (map, GUINT_TO_POINTER (id),
+      GUINT_TO_POINTER (new_id));
+  if (new_id != id)
+    replay->id_drift++;
+}
+
+static gboolean
+id_map_remove (GHashTable * map, guint32 id, guint32 * out_id)
+{
+  if (!id_map_lookup (map, id, out_id))
+    return FALSE;
+  g_hash_table_remove (map, GUINT_TO_POINTER (id));
+  return TRUE;
+}
+
+static ReplayDisplay *
+replay_display_new (void)
+{
+  ReplayDisplay *rd;
+
+  rd = g_new0 (ReplayDisplay, 1);
+  rd->display = video_output_create_display (NULL);
+  if (!rd->display) {
+    g_free (rd);
+    return NULL;
+  }
+  rd->va_display = gst_vaapi_display_get_display (rd->display);
+  rd->configs = id_map_new ();
+  rd->contexts = id_map_new ();
+  rd->surfaces = id_map_new ();
+  rd->buffers = id_map_new ();
+  rd->images = id_map_new ();
+  rd->vpp_configs = g_hash_table_new (g_direct_hash, g_direct_equal);
+  rd->vpp_contexts = g_hash_table_new (g_direct_hash, g_direct_equal);
+  return rd;
+}
+
+/* Releases whatever the recording did not destroy */
+static void
+replay_display_free (ReplayDisplay * rd)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, rd->images);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    vaDestroyImage (rd->va_display, GPOINTER_TO_UINT (value));
+  g_hash_table_iter_init (&iter, rd->buffers);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    vaDestroyBuffer (rd->va_display, GPOINTER_TO_UINT (value));
+  g_hash_table_iter_init (&iter, rd->contexts);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    vaDestroyContext (rd->va_display, GPOINTER_TO_UINT (value));
+  g_hash_table_iter_init (&iter, rd->surfaces);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    VASurfaceID surface_id = GPOINTER_TO_UINT (value);
+    vaDestroySurfaces (rd->va_display, &surface_id, 1);
+  }
+  g_hash_table_iter_init (&iter, rd->configs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    vaDestroyConfig (rd->va_display, GPOINTER_TO_UINT (value));
+
+  g_hash_table_unref (rd->configs);
+  g_hash_table_unref (rd->contexts);
+  g_hash_table_unref (rd->surfaces);
+  g_hash_table_unref (rd->buffers);
+  g_hash_table_unref (rd->images);
+  g_hash_table_unref (rd->vpp_configs);
+  g_hash_table_unref (rd->vpp_contexts);
+  gst_object_unref (rd->display);
+  g_free (rd);
+}
+
+static ReplayDisplay *
+replay_get_display (Replay * replay, guint index)
+{
+  ReplayDisplay *rd;
+
+  while (replay->displays->len <= index) {
+    rd = replay_display_new ();
+    if (!rd)
+      return NULL;
+    g_ptr_array_add (replay->displays, rd);
+  }
+  return g_ptr_array_index (replay->displays, index);
+}
+
+static gboolean
+record_read (FILE * file, Record * record)
+{
+  GstVaapiVaRecordHeader *const header = &record->header;
+
+  if (fread (header, sizeof (*header), 1, file) != 1)
+    return FALSE;
+  if (header->call == 0 || header->call >= NUM_CALLS)
+    return FALSE;
+
+  record->args = g_renew (guint32, record->args, header->n_args + 1);
+  if (header->n_args > 0 &&
+      fread (record->args, sizeof (guint32), header->n_args,
+          file) != header->n_args)
+    return FALSE;
+
+  record->data = g_realloc (record->data, header->data_size + 1);
+  if (header->data_size > 0 &&
+      fread (record->data, header->data_size, 1, file) != 1)
+    return FALSE;
+  return TRUE;
+}
+
+#define CHECK_ARGS(n) G_STMT_START {            \
+    if (n_args < (n))                           \
+      return FALSE;                             \
+  } G_STMT_END
+
+/* Submits @record, returns FALSE if it could not be replayed. The VA
+   status of the call is stored in @status */
+static gboolean
+replay_record (Replay * replay, ReplayDisplay * rd, const Record * record,
+    VAStatus * status)
+{
+  VADisplay const dpy = rd->va_display;
+  const guint32 *const args = record->args;
+  const guint n_args = record->header.n_args;
+  guint32 id, id2;
+  guint i, n;
+
+  *status = VA_STATUS_SUCCESS;
+
+  switch (record->header.call) {
+    case GST_VAAPI_VA_RECORD_CREATE_CONFIG:{
+      VAConfigID config_id;
+
+      CHECK_ARGS (3);
+      *status = vaCreateConfig (dpy, (VAProfile) args[0],
+          (VAEntrypoint) args[1], (VAConfigAttrib *) record->data,
+          record->header.data_size / sizeof (VAConfigAttrib), &config_id);
+      if (*status != VA_STATUS_SUCCESS)
+        break;
+      id_map_insert (replay, rd->configs, args[2], config_id);
+      if (args[1] == VAEntrypointVideoProc)
+        g_hash_table_add (rd->vpp_configs, GUINT_TO_POINTER (config_id));
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_DESTROY_CONFIG:
+      CHECK_ARGS (1);
+      if (!id_map_remove (rd->configs, args[0], &id))
+        return FALSE;
+      g_hash_table_remove (rd->vpp_configs, GUINT_TO_POINTER (id));
+      *status = vaDestroyConfig (dpy, id);
+      break;
+    case GST_VAAPI_VA_RECORD_CREATE_SURFACES:{
+      VASurfaceID *surfaces;
+
+      CHECK_ARGS (4);
+      n = n_args - 3;
+      surfaces = g_new (VASurfaceID, n);
+      *status = vaCreateSurfaces (dpy, args[0], args[1], args[2], surfaces,
+          n, NULL, 0);
+      if (*status == VA_STATUS_SUCCESS) {
+        for (i = 0; i < n; i++)
+          id_map_insert (replay, rd->surfaces, args[3 + i], surfaces[i]);
+      }
+      g_free (surfaces);
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_DESTROY_SURFACES:
+      for (i = 0; i < n_args; i++) {
+        VASurfaceID surface_id;
+
+        if (!id_map_remove (rd->surfaces, args[i], &surface_id))
+          continue;
+        *status = vaDestroySurfaces (dpy, &surface_id, 1);
+      }
+      break;
+    case GST_VAAPI_VA_RECORD_CREATE_CONTEXT:{
+      VASurfaceID *targets;
+      VAContextID context_id;
+
+      CHECK_ARGS (5);
+      if (!id_map_lookup (rd->configs, args[0], &id))
+        return FALSE;
+      targets = g_new (VASurfaceID, n_args - 5 + 1);
+      for (i = 5, n = 0; i < n_args; i++) {
+        if (id_map_lookup (rd->surfaces, args[i], &targets[n]))
+          n++;
+      }
+      *status = vaCreateContext (dpy, id, args[1], args[2], args[3],
+          n > 0 ? targets : NULL, n, &context_id);
+      g_free (targets);
+      if (*status != VA_STATUS_SUCCESS)
+        break;
+      id_map_insert (replay, rd->contexts, args[4], context_id);
+      if (g_hash_table_contains (rd->vpp_configs, GUINT_TO_POINTER (id)))
+        g_hash_table_add (rd->vpp_contexts, GUINT_TO_POINTER (context_id));
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_DESTROY_CONTEXT:
+      CHECK_ARGS (1);
+      if (!id_map_remove (rd->contexts, args[0], &id))
+        return FALSE;
+      g_hash_table_remove (rd->vpp_contexts, GUINT_TO_POINTER (id));
+      *status = vaDestroyContext (dpy, id);
+      break;
+    case GST_VAAPI_VA_RECORD_CREATE_BUFFER:{
+      VABufferID buffer_id;
+
+      CHECK_ARGS (5);
+      if (!id_map_lookup (rd->contexts, args[0], &id))
+        return FALSE;
+      *status = vaCreateBuffer (dpy, id, (VABufferType) args[1], args[2],
+          args[3], NULL, &buffer_id);
+      if (*status == VA_STATUS_SUCCESS)
+        id_map_insert (replay, rd->buffers, args[4], buffer_id);
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_DESTROY_BUFFER:
+      CHECK_ARGS (1);
+      if (!id_map_remove (rd->buffers, args[0], &id))
+        return FALSE;
+      *status = vaDestroyBuffer (dpy, id);
+      break;
+    case GST_VAAPI_VA_RECORD_MAP_BUFFER:{
+      void *data;
+
+      CHECK_ARGS (1);
+      if (!id_map_lookup (rd->buffers, args[0], &id))
+        return FALSE;
+      *status = vaMapBuffer (dpy, id, &data);
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_UNMAP_BUFFER:
+      CHECK_ARGS (1);
+      if (!id_map_lookup (rd->buffers, args[0], &id))
+        return FALSE;
+      *status = vaUnmapBuffer (dpy, id);
+      break;
+    case GST_VAAPI_VA_RECORD_BUFFER_DATA:{
+      VABufferType type;
+      unsigned int size, num_elements;
+      void *data;
+
+      CHECK_ARGS (1);
+      if (!id_map_lookup (rd->buffers, args[0], &id))
+        return FALSE;
+      *status = vaBufferInfo (dpy, id, &type, &size, &num_elements);
+      if (*status != VA_STATUS_SUCCESS)
+        break;
+      *status = vaMapBuffer (dpy, id, &data);
+      if (*status != VA_STATUS_SUCCESS)
+        break;
+      memcpy (data, record->data, MIN (record->header.data_size,
+              (gsize) size * num_elements));
+      *status = vaUnmapBuffer (dpy, id);
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_BEGIN_PICTURE:
+      CHECK_ARGS (2);
+      if (!id_map_lookup (rd->contexts, args[0], &id) ||
+          g_hash_table_contains (rd->vpp_contexts, GUINT_TO_POINTER (id)) ||
+          !id_map_lookup (rd->surfaces, args[1], &id2))
+        return FALSE;
+      *status = vaBeginPicture (dpy, id, id2);
+      break;
+    case GST_VAAPI_VA_RECORD_RENDER_PICTURE:{
+      VABufferID *buffers;
+
+      CHECK_ARGS (2);
+      if (!id_map_lookup (rd->contexts, args[0], &id) ||
+          g_hash_table_contains (rd->vpp_contexts, GUINT_TO_POINTER (id)))
+        return FALSE;
+      buffers = g_new (VABufferID, n_args - 1);
+      for (i = 1, n = 0; i < n_args; i++) {
+        if (id_map_lookup (rd->buffers, args[i], &buffers[n]))
+          n++;
+      }
+      if (n > 0)
+        *status = vaRenderPicture (dpy, id, buffers, n);
+      g_free (buffers);
+      if (n == 0)
+        return FALSE;
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_END_PICTURE:
+      CHECK_ARGS (1);
+      if (!id_map_lookup (rd->contexts, args[0], &id) ||
+          g_hash_table_contains (rd->vpp_contexts, GUINT_TO_POINTER (id)))
+        return FALSE;
+      *status = vaEndPicture (dpy, id);
+      break;
+    case GST_VAAPI_VA_RECORD_SYNC_SURFACE:
+      CHECK_ARGS (1);
+      if (!id_map_lookup (rd->surfaces, args[0], &id))
+        return FALSE;
+      *status = vaSyncSurface (dpy, id);
+      break;
+    case GST_VAAPI_VA_RECORD_DERIVE_IMAGE:{
+      VAImage image;
+
+      CHECK_ARGS (2);
+      if (!id_map_lookup (rd->surfaces, args[0], &id))
+        return FALSE;
+      *status = vaDeriveImage (dpy, id, &image);
+      if (*status == VA_STATUS_SUCCESS)
+        id_map_insert (replay, rd->images, args[1], image.image_id);
+      break;
+    }
+    case GST_VAAPI_VA_RECORD_DESTROY_IMAGE:
+      CHECK_ARGS (1);
+      if (!id_map_remove (rd->images, args[0], &id))
+        return FALSE;
+      *status = vaDestroyImage (dpy, id);
+      break;
+#if VA_CHECK_VERSION(1,9,0)
+    case GST_VAAPI_VA_RECORD_SYNC_BUFFER:
+      CHECK_ARGS (1);
+      if (!id_map_lookup (rd->buffers, args[0], &id))
+        return FALSE;
+      *status = vaSyncBuffer (dpy, id, VA_TIMEOUT_INFINITE);
+      break;
+#endif
+    default:
+      return FALSE;
+  }
+  return TRUE;
+}
+
+#undef CHECK_ARGS
+
+static void
+print_stats (Replay * replay, GstClockTime elapsed)
+{
+  guint i;
+
+  g_print ("%-18s %8s %8s %8s %12s %12s %10s %10s\n", "call", "count",
+      "skipped", "failed", "rec (ms)", "replay (ms)", "rec (us)",
+      "replay (us)");
+  for (i = 1; i < NUM_CALLS; i++) {
+    const CallStats *const s = &replay->stats[i];
+    const guint n = s->count - s->skipped;
+
+    if (s->count == 0)
+      continue;
+    g_print ("%-18s %8u %8u %8u %12.3f %12.3f %10.1f %10.1f\n",
+        g_call_names[i], s->count, s->skipped, s->failed,
+        s->recorded / (gdouble) GST_MSECOND,
+        s->replayed / (gdouble) GST_MSECOND,
+        n > 0 ? s->recorded / (gdouble) n / GST_USECOND : 0.0,
+        n > 0 ? s->replayed / (gdouble) n / GST_USECOND : 0.0);
+  }
+  g_print ("\nrecorded run: %.3f ms, replay: %.3f ms\n",
+      replay->recorded_end / (gdouble) GST_MSECOND,
+      elapsed / (gdouble) GST_MSECOND);
+  if (replay->id_drift > 0)
+    g_print ("warning: %u IDs differ from the recording, the references "
+        "held in buffer contents may be wrong\n", replay->id_drift);
+}
+
+static gboolean
+app_run (const gchar * filename)
+{
+  gchar magic[GST_VAAPI_VA_RECORD_MAGIC_SIZE];
+  Replay replay = { NULL, };
+  Record record = { {0,}, };
+  GstClockTime start, call_start, call_end;
+  ReplayDisplay *rd;
+  CallStats *stats;
+  VAStatus status;
+  FILE *file;
+  gboolean success = FALSE;
+
+  file = fopen (filename, "rb");
+  if (!file) {
+    g_message ("failed to open %s", filename);
+    return FALSE;
+  }
+  if (fread (magic, sizeof (magic), 1, file) != 1 ||
+      memcmp (magic, GST_VAAPI_VA_RECORD_MAGIC, sizeof (magic)) != 0) {
+    g_message ("%s is not a VA record file", filename);
+    fclose (file);
+    return FALSE;
+  }
+
+  replay.displays =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) replay_display_free);
+
+  start = gst_util_get_timestamp ();
+  while (record_read (file, &record)) {
+    const GstVaapiVaRecordHeader *const header = &record.header;
+
+    stats = &replay.stats[header->call];
+    stats->count++;
+    replay.recorded_end = MAX (replay.recorded_end,
+        header->timestamp + header->duration);
+
+    /* Calls that failed at recording time are not replayed */
+    if (header->status != VA_STATUS_SUCCESS) {
+      stats->skipped++;
+      continue;
+    }
+
+    rd = replay_get_display (&replay, header->display);
+    if (!rd) {
+      g_message ("failed to create VA display");
+      goto cleanup;
+    }
+
+    call_start = gst_util_get_timestamp ();
+    if (!replay_record (&replay, rd, &record, &status)) {
+      stats->skipped++;
+      continue;
+    }
+    call_end = gst_util_get_timestamp ();
+
+    if (status != VA_STATUS_SUCCESS)
+      stats->failed++;
+    stats->recorded += header->duration;
+    stats->replayed += call_end - call_start;
+  }
+  if (!feof (file))
+    g_message ("truncated or invalid record, replay stopped");
+
+  print_stats (&replay, gst_util_get_timestamp () - start);
+  success = TRUE;
+
+cleanup:
+  g_ptr_array_unref (replay.displays);
+  g_free (record.args);
+  g_free (record.data);
+  fclose (file);
+  return success;
+}
+
+int
+main (int argc, char *argv[])
+{
+  gint ret;
+
+  /* The replay itself must not be recorded */
+  g_unsetenv ("GST_VAAPI_VA_RECORD");
+
+  if (!video_output_init (&argc, argv, NULL))
+    g_error ("failed to initialize video output subsystem");
+
+  if (argc != 2) {
+    g_print ("Usage: %s [OPTION...] RECORD-FILE\n", argv[0]);
+    ret = 1;
+  } else
+    ret = !app_run (argv[1]);
+
+  video_output_exit ();
+  return ret;
+}
@@ -24,22 +24,34 @@
  * This is a really simple decoder application that only accepts raw
  * bitstreams. So, it may be needed to suggest what codec to use to
  * the application.
+ *
+ * In --benchmark mode, the bitstream is loaded in memory and decoded
+ * --loops times as fast as possible, without any window. Decoded
+ * surfaces are only synchronized, then optionally read back to system
+ * memory or exported as dma-buf (--readback), and the throughput and
+ * per-frame latency percentiles are reported. This measures the
+ * library alone, without the GStreamer elements overhead.
  */
 
 #include "gst/vaapi/sysdeps.h"
 #include <stdarg.h>
 #include <gst/vaapi/gstvaapidecoder.h>
 #include <gst/vaapi/gstvaapidecoder_h264.h>
+#include <gst/vaapi/gstvaapidecoder_h265.h>
 #include <gst/vaapi/gstvaapidecoder_jpeg.h>
 #include <gst/vaapi/gstvaapidecoder_mpeg2.h>
 #include <gst/vaapi/gstvaapidecoder_mpeg4.h>
 #include <gst/vaapi/gstvaapidecoder_vc1.h>
+#include <gst/vaapi/gstvaapiimage.h>
+#include <gst/vaapi/gstvaapisurface_drm.h>
 #include <gst/vaapi/gstvaapiwindow.h>
 #include "codec.h"
 #include "output.h"
 
 static gchar *g_codec_str;
 static gboolean g_benchmark;
+static gchar *g_readback_str;
+static guint g_num_loops = 1;
 
 static GOptionEntry g_options[] = {
   {"codec", 'c',
@@ -50,9 +62,25 @@ static GOptionEntry g_options[] = {
         0,
         G_OPTION_ARG_NONE, &g_benchmark,
       "benchmark mode", NULL},
+  {"readback", 0,
+        0,
+        G_OPTION_ARG_STRING, &g_readback_str,
+      "per-frame readback in benchmark mode: none, cpu or dmabuf "
+        "(default: none)", NULL},
+  {"loops", 'l',
+        0,
+        G_OPTION_ARG_INT, &g_num_loops,
+      "number of times the bitstream is decoded in benchmark mode", NULL},
   {NULL,}
 };
 
+typedef enum
+{
+  READBACK_NONE,
+  READBACK_CPU,
+  READBACK_DMABUF,
+} Readback;
+
 typedef enum
 {
   APP_RUNNING,
@@ -72,6 +100,8 @@ typedef struct
   GstVaapiSurfaceProxy *proxy;
   GstClockTime pts;
   GstClockTime duration;
+  /* monotonic time the decoder was asked for the frame, in us */
+  gint64 decode_time;
 } RenderFrame;
 
 typedef struct
@@ -82,6 +112,7 @@ typedef struct
   guint file_offset;
   guint file_size;
   guchar *file_data;
+  gchar *file_contents;
   GstVaapiDisplay *display;
   GstVaapiDecoder *decoder;
   GThread *decoder_thread;
@@ -105,6 +136,11 @@ typedef struct
   GCond event_cond;
   GTimer *timer;
   guint32 num_frames;
+  Readback readback;
+  GstVaapiImage *readback_image;
+  guchar *readback_data;
+  gsize readback_size;
+  GArray *latencies;
 } App;
 
 static inline RenderFrame *
@@ -229,7 +265,8 @@ decoder_thread (gpointer data)
   GstBuffer *buffer;
   GstClockTime pts;
   gboolean got_eos = FALSE;
-  guint ofs;
+  guint ofs, loop = 0;
+  gint64 decode_time;
 
   g_print ("Decoder thread started\n");
 
@@ -256,6 +293,7 @@ decoder_thread (gpointer data)
       SEND_ERROR ("failed to push buffer to decoder");
     gst_buffer_replace (&buffer, NULL);
 
+    decode_time = g_get_monotonic_time ();
     status = gst_vaapi_decoder_get_surface (app->decoder, &proxy);
     switch (status) {
       case GST_VAAPI_DECODER_STATUS_SUCCESS:
@@ -265,6 +303,7 @@ decoder_thread (gpointer data)
         rfp->proxy = proxy;
         rfp->pts = pts;
         rfp->duration = app->frame_duration;
+        rfp->decode_time = decode_time;
         pts += app->frame_duration;
         g_async_queue_push (app->decoder_queue, rfp);
         break;
@@ -273,9 +312,18 @@ decoder_thread (gpointer data)
         break;
       case GST_VAAPI_DECODER_STATUS_END_OF_STREAM:
         gst_vaapi_decoder_flush (app->decoder);
-        if (got_eos)
+        if (!got_eos) {
+          got_eos = TRUE;
+          break;
+        }
+        if (!g_benchmark || ++loop >= g_num_loops)
           goto send_eos;
-        got_eos = TRUE;
+        /* Rewind once the remaining frames are drained */
+        if (gst_vaapi_decoder_reset (app->decoder) !=
+            GST_VAAPI_DECODER_STATUS_SUCCESS)
+          SEND_ERROR ("failed to reset decoder");
+        got_eos = FALSE;
+        ofs = 0;
         break;
       default:
         SEND_ERROR ("%s", get_decoder_status_string (status));
@@ -326,20 +374,34 @@ start_decoder (App * app)
 {
   GstCaps *caps;
 
-  app->file = g_mapped_file_new (app->file_name, FALSE, NULL);
-  if (!app->file)
-    return FALSE;
+  if (g_benchmark) {
+    /* Keep the file I/O out of the measurements */
+    gsize size;
 
-  app->file_size = g_mapped_file_get_length (app->file);
-  app->file_data = (guint8 *) g_mapped_file_get_contents (app->file);
-  if (!app->file_data)
-    return FALSE;
+    if (!g_file_get_contents (app->file_name, &app->file_contents, &size,
+            NULL))
+      return FALSE;
+    app->file_size = size;
+    app->file_data = (guchar *) app->file_contents;
+  } else {
+    app->file = g_mapped_file_new (app->file_name, FALSE, NULL);
+    if (!app->file)
+      return FALSE;
+
+    app->file_size = g_mapped_file_get_length (app->file);
+    app->file_data = (guint8 *) g_mapped_file_get_contents (app->file);
+    if (!app->file_data)
+      return FALSE;
+  }
 
   caps = caps_from_codec (app->codec);
   switch (app->codec) {
     case GST_VAAPI_CODEC_H264:
       app->decoder = gst_vaapi_decoder_h264_new (app->display, caps);
       break;
+    case GST_VAAPI_CODEC_H265:
+      app->decoder = gst_vaapi_decoder_h265_new (app->display, caps);
+      break;
     case GST_VAAPI_CODEC_JPEG:
       app->decoder = gst_vaapi_decoder_jpeg_new (app->display, caps);
       break;
@@ -401,6 +463,78 @@ ensure_window_size (App * app, GstVaapiSurface * surface)
       &app->window_width, &app->window_height);
 }
 
+/* Reads the whole surface back to system memory, through an image
+   derived from it, or else copied out of it */
+static gboolean
+readback_cpu (App * app, GstVaapiSurface * surface)
+{
+  GstVaapiImage *image;
+  GstVideoFormat format;
+  guint width, height, size;
+  gboolean success = FALSE;
+
+  image = gst_vaapi_surface_derive_image (surface);
+  if (!image) {
+    format = gst_vaapi_surface_get_format (surface);
+    if (format == GST_VIDEO_FORMAT_UNKNOWN)
+      format = GST_VIDEO_FORMAT_NV12;
+    gst_vaapi_surface_get_size (surface, &width, &height);
+    if (!app->readback_image ||
+        gst_vaapi_image_get_width (app->readback_image) != width ||
+        gst_vaapi_image_get_height (app->readback_image) != height) {
+      g_clear_pointer (&app->readback_image, gst_vaapi_image_unref);
+      app->readback_image = gst_vaapi_image_new (app->display, format,
+          width, height);
+      if (!app->readback_image)
+        return FALSE;
+    }
+    if (!gst_vaapi_surface_get_image (surface, app->readback_image))
+      return FALSE;
+    image = (GstVaapiImage *)
+        gst_mini_object_ref (GST_MINI_OBJECT_CAST (app->readback_image));
+  }
+
+  if (!gst_vaapi_image_map_read_only (image))
+    goto done;
+  size = gst_vaapi_image_get_data_size (image);
+  if (size > app->readback_size) {
+    app->readback_data = g_realloc (app->readback_data, size);
+    app->readback_size = size;
+  }
+  memcpy (app->readback_data, gst_vaapi_image_get_plane (image, 0), size);
+  success = gst_vaapi_image_unmap (image);
+
+done:
+  gst_vaapi_image_unref (image);
+  return success;
+}
+
+/* Decoded frames are only completed, and possibly read back, in
+   benchmark mode */
+static gboolean
+renderer_complete (App * app, GstVaapiSurface * surface, RenderFrame * rfp)
+{
+  gint64 latency;
+
+  switch (app->readback) {
+    case READBACK_CPU:
+      if (!readback_cpu (app, surface))
+        return FALSE;
+      break;
+    case READBACK_DMABUF:
+      /* Same as the elements, the handle is exported once per surface */
+      if (!gst_vaapi_surface_peek_dma_buf_handle (surface))
+        return FALSE;
+      break;
+    default:
+      break;
+  }
+
+  latency = g_get_monotonic_time () - rfp->decode_time;
+  g_array_append_val (app->latencies, latency);
+  return TRUE;
+}
+
 static inline void
 renderer_wait_until (App * app, GstClockTime pts)
 {
@@ -427,6 +561,15 @@ renderer_process (App * app, RenderFrame * rfp)
   if (!surface)
     SEND_ERROR ("failed to get decoded surface from render frame");
 
+  if (g_benchmark) {
+    if (!gst_vaapi_surface_sync (surface))
+      SEND_ERROR ("failed to sync decoded surface");
+    if (!renderer_complete (app, surface, rfp))
+      SEND_ERROR ("failed to read back surface %" GST_VAAPI_ID_FORMAT,
+          GST_VAAPI_ID_ARGS (gst_vaapi_surface_get_id (surface)));
+    goto done;
+  }
+
   ensure_window_size (app, surface);
 
   crop_rect = gst_vaapi_surface_proxy_get_crop_rect (rfp->proxy);
@@ -434,14 +577,14 @@ renderer_process (App * app, RenderFrame * rfp)
   if (!gst_vaapi_surface_sync (surface))
     SEND_ERROR ("failed to sync decoded surface");
 
-  if (G_LIKELY (!g_benchmark))
-    renderer_wait_until (app, rfp->pts);
+  renderer_wait_until (app, rfp->pts);
 
   if (!gst_vaapi_window_put_surface (app->window, surface,
           crop_rect, NULL, GST_VAAPI_PICTURE_STRUCTURE_FRAME))
     SEND_ERROR ("failed to render surface %" GST_VAAPI_ID_FORMAT,
         GST_VAAPI_ID_ARGS (gst_vaapi_surface_get_id (surface)));
 
+done:
   app->num_frames++;
 
   render_frame_replace (&app->last_frame, rfp);
@@ -517,8 +660,16 @@ app_free (App * app)
     g_mapped_file_unref (app->file);
     app->file = NULL;
   }
+  g_free (app->file_contents);
   g_free (app->file_name);
 
+  g_clear_pointer (&app->readback_image, gst_vaapi_image_unref);
+  g_free (app->readback_data);
+  if (app->latencies) {
+    g_array_unref (app->latencies);
+    app->latencies = NULL;
+  }
+
   gst_vaapi_decoder_replace (&app->decoder, NULL);
   gst_vaapi_window_replace (&app->window, NULL);
   gst_vaapi_display_replace (&app->display, NULL);
@@ -564,6 +715,8 @@ app_new (void)
   app->timer = g_timer_new ();
   if (!app->timer)
     goto error;
+
+  app->latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
   return app;
 
 error:
@@ -604,6 +757,55 @@ app_check_events (App * app)
   return FALSE;
 }
 
+static gint
+compare_latency (gconstpointer a, gconstpointer b)
+{
+  const gint64 va = *(const gint64 *) a;
+  const gint64 vb = *(const gint64 *) b;
+
+  return (va > vb) - (va < vb);
+}
+
+static gdouble
+get_percentile (GArray * sorted, guint percent)
+{
+  if (sorted->len == 0)
+    return 0.0;
+  return g_array_index (sorted, gint64, (sorted->len - 1) * percent / 100) /
+      1000.0;
+}
+
+static void
+app_report_benchmark (App * app)
+{
+  const gdouble elapsed = g_timer_elapsed (app->timer, NULL);
+
+  g_array_sort (app->latencies, compare_latency);
+
+  g_print (" in %.2f sec (%.1f fps)\n", elapsed,
+      (gdouble) app->num_frames / elapsed);
+  g_print ("%s latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, "
+      "max %.2f ms\n", string_from_codec (app->codec),
+      get_percentile (app->latencies, 50),
+      get_percentile (app->latencies, 90),
+      get_percentile (app->latencies, 99),
+      get_percentile (app->latencies, 100));
+}
+
+static gboolean
+app_parse_readback (App * app)
+{
+  if (!g_readback_str || g_strcmp0 (g_readback_str, "none") == 0)
+    app->readback = READBACK_NONE;
+  else if (g_strcmp0 (g_readback_str, "cpu") == 0)
+    app->readback = READBACK_CPU;
+  else if (g_strcmp0 (g_readback_str, "dmabuf") == 0)
+    app->readback = READBACK_DMABUF;
+  else
+    return FALSE;
+  return TRUE;
+}
+
 static gboolean
 app_run (App * app, int argc, char *argv[])
 {
@@ -613,6 +815,15 @@ app_run (App * app, int argc, char *argv[])
   }
   app->file_name = g_strdup (argv[1]);
 
+  if (!app_parse_readback (app)) {
+    g_message ("invalid readback mode '%s'", g_readback_str);
+    return FALSE;
+  }
+  if (g_num_loops == 0) {
+    g_message ("invalid number of loops");
+    return FALSE;
+  }
+
   if (!g_file_test (app->file_name, G_FILE_TEST_IS_REGULAR)) {
     g_message ("failed to find file '%s'", app->file_name);
     return FALSE;
@@ -635,14 +846,16 @@ app_run (App * app, int argc, char *argv[])
     return FALSE;
   }
 
-  app->window = video_output_create_window (app->display,
-      app->window_width, app->window_height);
-  if (!app->window) {
-    g_message ("failed to create window");
-    return FALSE;
-  }
+  if (!g_benchmark) {
+    app->window = video_output_create_window (app->display,
+        app->window_width, app->window_height);
+    if (!app->window) {
+      g_message ("failed to create window");
+      return FALSE;
+    }
 
-  gst_vaapi_window_show (app->window);
+    gst_vaapi_window_show (app->window);
+  }
 
   if (!start_decoder (app)) {
     g_message ("failed to start decoder thread");
@@ -660,11 +873,8 @@ app_run (App * app, int argc, char *argv[])
   stop_decoder (app);
 
   g_print ("Decoded %u frames", app->num_frames);
-  if (g_benchmark) {
-    const gdouble elapsed = g_timer_elapsed (app->timer, NULL);
-    g_print (" in %.2f sec (%.1f fps)\n",
-        elapsed, (gdouble) app->num_frames / elapsed);
-  }
+  if (g_benchmark)
+    app_report_benchmark (app);
   g_print ("\n");
   return TRUE;
 }
@@ -686,6 +896,7 @@ main (int argc, char *argv[])
 
   app_free (app);
   g_free (g_codec_str);
+  g_free (g_readback_str);
   video_output_exit ();
   return ret;
 }
@@ -214,6 +214,10 @@ get_encoder_buffer (GstVaapiEncoder * encoder, GstBuffer ** buffer)
   GstVaapiEncoderStatus status;
 
   status = gst_vaapi_encoder_get_buffer_with_timeout (encoder, &proxy, 50000);
+  if (status == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED) {
+    gst_vaapi_coded_buffer_proxy_unref (proxy);
+    return status;
+  }
   if (status < GST_VAAPI_ENCODER_STATUS_SUCCESS) {
     g_warning ("Failed to get a buffer from encoder: %d", status);
     return status;
@@ -264,6 +268,8 @@ get_buffer_thread (gpointer data)
   while (1) {
     obuf = NULL;
     ret = get_encoder_buffer (app->encoder, &obuf);
+    if (ret == GST_VAAPI_ENCODER_STATUS_FRAME_DROPPED)
+      continue;                 /* no coded data */
     if (app->input_stopped && ret > GST_VAAPI_ENCODER_STATUS_SUCCESS) {
       break;                    /* finished */
     } else if (ret > GST_VAAPI_ENCODER_STATUS_SUCCESS) {        /* another chance */